@@ -9,6 +9,7 @@
 #include <cstdlib>
 #include <string>
 #include <stdexcept>
+#include <limits>
 #include <boost/program_options.hpp>
 #include "../interface/ProfileLikelihood.h"
 #include "../interface/HybridNew.h"
@@ -24,7 +25,11 @@
 #include "../interface/MultiDimFit.h"
 #include "../interface/CascadeMinimizer.h"
 #include "../interface/ProfilingTools.h"
+#include "../interface/CachingNLL.h"
+#include "../interface/CounterRandom.h"
 #include "../interface/GenerateOnly.h"
+#include "../interface/ColumnarToys.h"
+#include "../interface/ColumnarLimits.h"
 #include <map>
 
 using namespace std;
@@ -79,6 +84,7 @@ int main(int argc, char **argv) {
   combiner.statOptions().add_options()
     ("toys,t", po::value<int>(&runToys)->default_value(0), "Number of Toy MC extractions")
     ("seed,s", po::value<int>(&seed)->default_value(123456), "Toy MC random seed")
+    ("counterRNG", "Use a counter-based random number generator, in which each toy has its own streams defined by the seed and the toy number, so that any toy can be regenerated on its own")
     ("hintMethod,H",  po::value<string>(&whichHintMethod)->default_value(""), "Run first this method to provide a hint on the result")
     ;
   combiner.ioOptions().add_options()
@@ -198,6 +204,7 @@ int main(int argc, char **argv) {
   } else {
     std::cout << ">>> random number generator seed is " << seed << std::endl;
   }
+  if (vm.count("counterRNG")) RooRandom::setRandomGenerator(new CounterRandom(seed));
   RooRandom::randomGenerator()->SetSeed(seed); 
 
   TString massName = TString::Format("mH%g.", iMass);
@@ -221,7 +228,18 @@ int main(int argc, char **argv) {
   t->Branch("quantileExpected",  &g_quantileExpected_, "quantileExpected/F");
   
   writeToysHere = test->mkdir("toys","toys"); 
-  if (toysFile != "") readToysFromHere = TFile::Open(toysFile.c_str());
+  if (vm.count("saveToys") && vm.count("saveToysColumnar")) {
+    TString columnarName = fileName; columnarName.Replace(columnarName.Length()-4, 4, "toys");
+    writeColumnarToysHere = new ColumnarToyWriter(columnarName.Data());
+  }
+  if (vm.count("saveColumnarTree")) {
+    TString columnarName = fileName; columnarName.Replace(columnarName.Length()-4, 4, "limit");
+    writeColumnarLimitsHere = new ColumnarLimitWriter(columnarName.Data());
+  }
+  if (toysFile != "") {
+    if (ColumnarToyReader::isColumnar(toysFile)) readColumnarToysFromHere = new ColumnarToyReader(toysFile);
+    else readToysFromHere = TFile::Open(toysFile.c_str());
+  }
   
   syst = withSystematics;
   mass = iMass;
@@ -255,6 +273,8 @@ int main(int argc, char **argv) {
   runtimedef::set("ADDNLL_PRODNLL",1);
   runtimedef::set("ADDNLL_HFNLL",1);
   runtimedef::set("ADDNLL_ROOREALSUM_CHEAPPROD",1);
+  // NLLs given new data with the same entries (e.g. binned toys) only update their weights
+  runtimedef::set("SIMNLL_WEIGHTS_ONLY_DATA",1);
  
 
 
@@ -272,21 +292,65 @@ int main(int argc, char **argv) {
     }
   }
 
+  ScopedTimer::enable(runtimedef::get("PROFILE_TIMERS"));
+
+  // requests of --server: the method and its options, plus a few common options that apply only to that request
+  combiner.setServerRequestParser([&](const vector<string> &args, Combine::ServerRequest &request) {
+      string method;
+      po::options_description common("Options of a request");
+      common.add_options()
+        ("method,M", po::value<string>(&method)->default_value(whichMethod), "")
+        ("mass,m", po::value<float>(), "")
+        ("significance", "")
+        ("setPhysicsModelParameters", po::value<string>(&request.setParameters)->default_value(""), "")
+        ("setPhysicsModelParameterRanges", po::value<string>(&request.setParameterRanges)->default_value(""), "")
+        ("freezeNuisances", po::value<string>(&request.freezeNuisances)->default_value(""), "")
+        ;
+      po::variables_map vmc, vmreq, vmr;
+      po::store(po::command_line_parser(args).options(common).allow_unregistered().run(), vmc);
+      po::notify(vmc);
+      map<string, LimitAlgo *>::const_iterator it_req = methods.find(method);
+      if (it_req == methods.end()) throw std::invalid_argument("Unsupported method: "+method);
+      po::options_description reqdesc;
+      reqdesc.add(common);
+      reqdesc.add(it_req->second->options());
+      po::store(po::command_line_parser(args).options(reqdesc).run(), vmreq);
+      // the options given in the request win over those of the command line, which win over the defaults of the request
+      // (insert never replaces a key that is already there); the options of the previous requests are all undone, 
+      // as notify sets again every bound variable and the algorithm sees the whole map
+      for (po::variables_map::const_iterator i = vmreq.begin(); i != vmreq.end(); ++i) if (!i->second.defaulted()) vmr.insert(*i);
+      for (po::variables_map::const_iterator i = vm.begin(); i != vm.end(); ++i) vmr.insert(*i);
+      for (po::variables_map::const_iterator i = vmreq.begin(); i != vmreq.end(); ++i) vmr.insert(*i);
+      po::notify(vmr);
+      request.mass = vmc.count("mass") ? vmc["mass"].as<float>() : std::numeric_limits<float>::quiet_NaN();
+      doSignificance_ = vmc.count("significance");
+      it_req->second->applyOptions(vmr);
+      request.algo = it_req->second;
+  });
+
   try {
      combiner.run(datacard, dataset, limit, limitErr, iToy, t, runToys);
   } catch (std::exception &ex) {
      cerr << "Error when running the combination:\n\t" << ex.what() << std::endl;
+     delete writeColumnarToysHere;
+     delete writeColumnarLimitsHere;
      test->Close();
      return 3001;
   }
   
   test->WriteTObject(t);
   test->Close();
+  delete writeColumnarToysHere; writeColumnarToysHere = 0;
+  delete writeColumnarLimitsHere; writeColumnarLimitsHere = 0;
+  delete readColumnarToysFromHere; readColumnarToysFromHere = 0;
 
   for(map<string, LimitAlgo *>::const_iterator i = methods.begin(); i != methods.end(); ++i)
     delete i->second;
 
   if (vm.count("perfCounters")) PerfCounter::printAll();
+  ScopedTimer::report();
+  cacheutils::CostReport::print();
+  cacheutils::RecomputeReport::print();
 }
 
 
@@ -0,0 +1,476 @@
+/** Combine text datacards into one, as scripts/combineCards.py does, for very large cards.
+ *
+ * The cards are read with TextDatacard. A first pass collects the header, the directives and the size of the
+ * columns; the systematics are then written one at a time, with each card reading its values again from its mapped
+ * file. So the memory only grows with the number of cards and nuisances, never with the number of nuisances times
+ * the number of columns.
+ *
+ * The options are those of combineCards.py (which runs this program with --cpp):
+ *   combineCards [-s] [-S] [-P prefix] [--xc regexp] [--ic regexp] [--xn-file f] [--en-file f] [label=]datacard.txt ...
+ * The output is the same card, up to the order of the processes within a bin (the order of the card, signals first)
+ * and of the params, rateParams, extArgs and groups (the order in which they're first found) and of the discretes, the
+ * nuisances of the groups and the edits (sorted), which combineCards.py takes from python dictionaries and sets.
+ */
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include <regex>
+#include <algorithm>
+#include <stdexcept>
+#include <boost/program_options.hpp>
+#include <boost/algorithm/string/trim.hpp>
+#include "../interface/TextDatacard.h"
+
+using namespace std;
+
+namespace {
+    /// str() of a python float
+    string pyStr(double x) {
+        if (std::isnan(x)) return "nan";
+        if (std::isinf(x)) return x > 0 ? "inf" : "-inf";
+        char buff[64];
+        snprintf(buff, sizeof(buff), "%.12g", x);
+        string ret(buff);
+        if (ret.find_first_of(".e") == string::npos) ret += ".0";
+        return ret;
+    }
+
+    /// the text of a value of a systematic, as combineCards.py writes it
+    const string & effectText(double lo, double hi) {
+        static const string dash("-");
+        bool asymmetric = !std::isnan(hi);
+        if (!asymmetric && lo == 0) return dash;
+        // the cards have few different values, and formatting them is most of the time spent: keep the last one
+        // of each slot of a direct-mapped cache
+        static uint64_t bits[4096][2];
+        static string texts[4096];
+        uint64_t key[2] = { 0, 0 };
+        memcpy(&key[0], &lo, sizeof(double));
+        if (asymmetric) memcpy(&key[1], &hi, sizeof(double));
+        uint64_t h = key[0] ^ (key[1] * 0x9E3779B97F4A7C15ull);
+        unsigned int slot = (h ^ (h >> 29) ^ (h >> 47)) & 4095;
+        if (texts[slot].empty() || bits[slot][0] != key[0] || bits[slot][1] != key[1]) {
+            bits[slot][0] = key[0]; bits[slot][1] = key[1];
+            if (asymmetric) {
+                char buff[64];
+                snprintf(buff, sizeof(buff), "%.3f/%.3f", lo, hi);
+                texts[slot] = buff;
+            } else {
+                texts[slot] = pyStr(lo);
+            }
+        }
+        return texts[slot];
+    }
+
+    /// the arguments of the pdf as combineCards.py writes them, i.e. str() of what parseCard makes of them
+    vector<string> pdfArgs(const string &pdf, const vector<string> &args) {
+        vector<string> ret;
+        for (const string &a : args) {
+            if (pdf == "gmN") ret.push_back(to_string(strtol(a.c_str(), 0, 10)));
+            else ret.push_back(pyStr(strtod(a.c_str(), 0)));
+        }
+        return ret;
+    }
+
+    string join(const vector<string> &words, const string &sep) {
+        string ret;
+        for (unsigned int i = 0, n = words.size(); i < n; ++i) { if (i) ret += sep; ret += words[i]; }
+        return ret;
+    }
+
+    /// "%-<width>s"
+    inline void pad(string &out, const string &s, unsigned int width) {
+        out += s;
+        if (s.size() < width) out.append(width - s.size(), ' ');
+    }
+
+    string replaceAll(string s, const string &from, const string &to) {
+        for (size_t at = 0; (at = s.find(from, at)) != string::npos; at += to.size()) s.replace(at, from.size(), to);
+        return s;
+    }
+
+    /// re.match of any of the patterns
+    bool matches(const string &name, const vector<regex> &patterns) {
+        for (const regex &p : patterns) if (regex_search(name, p, regex_constants::match_continuous)) return true;
+        return false;
+    }
+
+    struct Card {
+        unique_ptr<TextDatacard> dc;
+        string label;
+        bool singlebin;
+        /// the columns of the card in the output (the bins not excluded; signals first in each bin)
+        vector<unsigned int> columns;
+        /// the name of each bin in the output, and whether it's kept
+        vector<string> bout;
+        vector<char> kept;
+    };
+
+    struct Syst {
+        string pdf;
+        vector<string> args;
+        bool nofloat;
+        /// the row with this nuisance in each card, or -1
+        map<unsigned int, int> rows;
+    };
+
+    /// first-seen order, with the later definitions replacing the earlier ones as for a python dictionary
+    template<typename T> struct Ordered {
+        vector<string> keys;
+        map<string, T> values;
+        T & operator[](const string &key) {
+            typename map<string, T>::iterator it = values.find(key);
+            if (it != values.end()) return it->second;
+            keys.push_back(key);
+            return values[key];
+        }
+        bool has(const string &key) const { return values.count(key) != 0; }
+    };
+}
+
+int main(int argc, char **argv) {
+    namespace po = boost::program_options;
+    string prefix, nuisVetoFile, editNuisFile;
+    vector<string> args, channelVetos, channelIncludes, moreVetos, moreIncludes;
+    po::options_description desc("Options");
+    desc.add_options()
+        ("help,h", "Produce help message")
+        ("stat,s", "Drop all systematics")
+        ("force-shape,S", "Treat all channels as shape analysis. Useful for mixed combinations")
+        ("asimov,a", "Replace observation with asimov dataset. Works only for counting experiments")
+        ("prefix,P", po::value<string>(&prefix)->default_value(""), "Prefix this to all file names")
+        ("xc", po::value<vector<string> >(&channelVetos), "Exclude channels that match this regexp; can specify multiple ones")
+        ("exclude-channel", po::value<vector<string> >(&moreVetos), "Same as --xc")
+        ("ic", po::value<vector<string> >(&channelIncludes), "Only include channels that match this regexp; can specify multiple ones")
+        ("include-channel", po::value<vector<string> >(&moreIncludes), "Same as --ic")
+        ("X-no-jmax", "FOR DEBUG ONLY: Turn off the consistency check between jmax and number of processes.")
+        ("xn-file", po::value<string>(&nuisVetoFile), "Exclude all the nuisances in this file")
+        ("exclude-nuisances-from-file", po::value<string>(&nuisVetoFile), "Same as --xn-file")
+        ("en-file", po::value<string>(&editNuisFile), "edit the nuisances in this file")
+        ("edit-nuisances-from-file", po::value<string>(&editNuisFile), "Same as --en-file")
+        ("cpp", "Ignored (the option of combineCards.py that runs this program)")
+        ("input", po::value<vector<string> >(&args), "label=datacard.txt or datacard.txt");
+    po::positional_options_description pos;
+    pos.add("input", -1);
+    po::variables_map vm;
+    try {
+        po::store(po::command_line_parser(argc, argv).options(desc).positional(pos).run(), vm);
+        po::notify(vm);
+    } catch (std::exception &e) {
+        cerr << "Invalid options: " << e.what() << endl << desc << endl;
+        return 1;
+    }
+    if (vm.count("help")) {
+        cout << "Usage: combineCards [options] [label=datacard.txt | datacard.txt]" << endl << desc << endl;
+        return 0;
+    }
+    if (args.empty()) {
+        cerr << "Error: No input datacards specified." << endl;
+        return 1;
+    }
+    bool stat = vm.count("stat"), forceShape = vm.count("force-shape"), noJMax = vm.count("X-no-jmax");
+    channelVetos.insert(channelVetos.end(), moreVetos.begin(), moreVetos.end());
+    channelIncludes.insert(channelIncludes.end(), moreIncludes.begin(), moreIncludes.end());
+
+    try {
+        vector<regex> vetos, includes;
+        for (const string &p : channelVetos) if (!p.empty()) vetos.push_back(regex(p));
+        for (const string &p : channelIncludes) if (!p.empty()) includes.push_back(regex(p));
+        vector<string> nuisanceVetos;
+        if (!nuisVetoFile.empty()) {
+            ifstream in(nuisVetoFile.c_str());
+            if (!in.good()) throw runtime_error("can't read "+nuisVetoFile);
+            string line;
+            while (getline(in, line)) {
+                boost::algorithm::trim(line);
+                if (!line.empty()) nuisanceVetos.push_back(line);
+            }
+        }
+
+        // first pass: the header, the directives and the widths of the columns
+        vector<Card> cards(args.size());
+        map<string, Syst> systs; // sorted by name, as they're written
+        Ordered<vector<string> > params, extArgs;
+        Ordered<bool> flatParams;
+        Ordered<vector<pair<vector<string>, string> > > rateParams;
+        set<string> discretes;
+        Ordered<set<string> > groups;
+        set<string> edits;
+        vector<string> obsKeyline, obsline;
+        bool hasObsline = true;
+        vector<pair<pair<string, string>, string> > shapeLines; // (channel, process), rest of the line
+        vector<string> expline;
+        unsigned int cmax = 5; // column width
+        vector<double> lo, hi;
+        for (unsigned int ich = 0, nch = args.size(); ich < nch; ++ich) {
+            Card &card = cards[ich];
+            string label = "ch" + to_string(ich + 1), fname = args[ich];
+            string::size_type eq = fname.find('=');
+            if (eq != string::npos) { label = fname.substr(0, eq); fname = fname.substr(eq + 1); }
+            fname = prefix + fname;
+            string::size_type slash = fname.rfind('/');
+            string dirname = slash == string::npos ? string() : fname.substr(0, slash);
+            card.dc.reset(new TextDatacard(fname, nuisanceVetos, stat, noJMax, true, true));
+            const TextDatacard &dc = *card.dc;
+            dc.checkNuisances();
+            const vector<string> &bins = dc.bins();
+            card.singlebin = (bins.size() == 1);
+            if (label == ".") label = card.singlebin ? bins[0] : string();
+            else if (!card.singlebin) label += "_";
+            card.label = label;
+            for (const string &b : bins) {
+                card.bout.push_back(card.singlebin ? label : label + b);
+                const string &bin = card.singlebin ? label : b;
+                card.kept.push_back(!matches(bin, vetos) && (includes.empty() || matches(bin, includes)));
+            }
+            for (unsigned int b = 0, nb = bins.size(); b < nb; ++b) {
+                if (!card.kept[b]) continue;
+                obsKeyline.push_back(card.bout[b]);
+                for (int signal = 1; signal >= 0; --signal) {
+                    for (unsigned int i = 0, n = dc.columns(); i < n; ++i) {
+                        if (dc.columnBinIndex(i) != b || dc.columnIsSignal(i) != bool(signal)) continue;
+                        card.columns.push_back(i);
+                        double e = dc.rate(i);
+                        char buff[64];
+                        snprintf(buff, sizeof(buff), (e == 0 || e > 1e-3) ? "%.4f" : "%.4g", e);
+                        expline.push_back(buff);
+                    }
+                }
+            }
+            // systematics
+            for (unsigned int i = 0, n = dc.nParams(); i < n; ++i) {
+                if (params.has(dc.paramName(i))) {
+                    if (params[dc.paramName(i)] != dc.paramArgs(i)) throw runtime_error("Parameter uncerainty "+dc.paramName(i)+" mismatch between cards.");
+                } else {
+                    params[dc.paramName(i)] = dc.paramArgs(i);
+                }
+            }
+            for (unsigned int r = 0, n = dc.nRows(); r < n; ++r) {
+                if (!dc.rowHasEffect(r)) continue;
+                const string &name = dc.rowName(r);
+                string pdf = dc.rowPdf(r);
+                dc.readRow(r, lo, hi);
+                for (unsigned int i : card.columns) cmax = max<unsigned int>(cmax, effectText(lo[i], hi[i]).size());
+                map<string, Syst>::iterator it = systs.find(name);
+                if (it == systs.end()) {
+                    Syst &s = systs[name];
+                    s.pdf = pdf; s.args = pdfArgs(pdf, dc.rowArgs(r)); s.nofloat = dc.rowNoFloat(r);
+                    s.rows[ich] = r;
+                    continue;
+                }
+                Syst &s = it->second;
+                if (s.pdf != pdf) {
+                    if (pdf == "lnN" && s.pdf.compare(0, 5, "shape") == 0) {
+                        if (s.pdf[s.pdf.size() - 1] != '?') s.pdf += '?';
+                    } else if (pdf.compare(0, 5, "shape") == 0 && s.pdf == "lnN") {
+                        if (pdf[pdf.size() - 1] != '?') pdf += '?';
+                        s.pdf = pdf;
+                    } else if (pdf == s.pdf + "?" || pdf + "?" == s.pdf) {
+                        s.pdf = replaceAll(pdf, "?", "") + "?";
+                    } else {
+                        throw runtime_error("File "+fname+" defines systematic "+name+" as using pdf "+pdf+", while a previous file defines it as using "+s.pdf);
+                    }
+                } else if (pdf == "gmN" && strtol(dc.rowArgs(r)[0].c_str(), 0, 10) != strtol(s.args[0].c_str(), 0, 10)) {
+                    throw runtime_error("File "+fname+" defines systematic "+name+" as using gamma with "+dc.rowArgs(r)[0]+" events in sideband, while a previous file has "+s.args[0]);
+                }
+                s.rows[ich] = r; // a later line of the same card replaces the earlier one
+            }
+            for (const string &K : dc.flatParams()) flatParams[K] = true;
+            for (unsigned int i = 0, n = dc.nExtArgs(); i < n; ++i) extArgs[dc.extArgName(i)] = dc.extArgTokens(i);
+            // rate params (for the bins of the card, each replacing those of the earlier cards)
+            map<string, vector<pair<vector<string>, string> > > cardRateParams;
+            vector<string> cardRateKeys;
+            for (unsigned int i = 0, n = dc.nRateParams(); i < n; ++i) {
+                string tbin = card.singlebin ? label : label + dc.rateParamBin(i);
+                string key = tbin + " " + dc.rateParamProcess(i);
+                vector<string> line(1, dc.rateParamName(i));
+                line.insert(line.end(), dc.rateParamValues(i).begin(), dc.rateParamValues(i).end());
+                if (!cardRateParams.count(key)) cardRateKeys.push_back(key);
+                cardRateParams[key].push_back(make_pair(line, dc.rateParamRange(i)));
+            }
+            for (const string &key : cardRateKeys) rateParams[key] = cardRateParams[key];
+            // discrete nuisances
+            for (const string &K : dc.discretes()) {
+                if (!discretes.insert(K).second) throw runtime_error("Cannot currently correlate discrete nuisances across categories. Rename "+K+" in one.");
+            }
+            // put shapes, if available
+            if (dc.nShapes()) {
+                for (unsigned int b = 0, nb = bins.size(); b < nb; ++b) {
+                    if (!card.kept[b]) continue;
+                    // those of the bin, then those of any bin for the other processes
+                    vector<string> done;
+                    for (int any = 0; any <= 1; ++any) {
+                        for (unsigned int i = 0, n = dc.nShapes(); i < n; ++i) {
+                            if (dc.shapeChannel(i) != (any ? string("*") : bins[b])) continue;
+                            if (any && find(done.begin(), done.end(), dc.shapeProcess(i)) != done.end()) continue;
+                            if (!any) done.push_back(dc.shapeProcess(i));
+                            vector<string> xrep = dc.shapeArgs(i);
+                            for (string &x : xrep) x = replaceAll(x, "$CHANNEL", bins[b]);
+                            if (xrep[0] != "FAKE" && !dirname.empty()) xrep[0] = dirname + "/" + xrep[0];
+                            shapeLines.push_back(make_pair(make_pair(card.bout[b], dc.shapeProcess(i)), join(xrep, " ")));
+                        }
+                    }
+                }
+            } else if (forceShape) {
+                for (unsigned int b = 0, nb = bins.size(); b < nb; ++b) shapeLines.push_back(make_pair(make_pair(card.bout[b], string("*")), string("FAKE")));
+            }
+            // combine observations, but remove line if any of the datacards doesn't have it
+            if (!dc.hasObservation()) {
+                hasObsline = false;
+            } else if (hasObsline) {
+                for (unsigned int b = 0, nb = bins.size(); b < nb; ++b) if (card.kept[b]) obsline.push_back(pyStr(dc.observation(b)));
+            }
+            // groups, each nuisance once
+            for (unsigned int i = 0, n = dc.nGroups(); i < n; ++i) groups[dc.groupName(i)].insert(dc.groupNuisances(i).begin(), dc.groupNuisances(i).end());
+            // nuisance edits propagated to the end of the card
+            for (unsigned int i = 0, n = dc.nEdits(); i < n; ++i) {
+                const vector<string> &e = dc.edit(i);
+                if (e[0] == "changepdf" || e[0] == "freeze") { edits.insert(join(e, " ")); continue; }
+                string proc = e[1], chan = e[2];
+                if (chan == "*") chan = bins.size() > 1 ? label + "(" + join(bins, "|") + ")" : label;
+                if (proc == "*") proc = "(" + join(dc.processes(), "|") + ")";
+                vector<string> rest(e.begin() + 3, e.end());
+                edits.insert(e[0] + " " + proc + " " + chan + " " + join(rest, " "));
+            }
+        }
+
+        // the combined keyline
+        vector<string> keyBins, keyProcs, outBins, signals, backgrounds, tmpsignals;
+        vector<char> keySignal;
+        for (const Card &card : cards) {
+            for (unsigned int i : card.columns) {
+                keyBins.push_back(card.bout[card.dc->columnBinIndex(i)]);
+                keyProcs.push_back(card.dc->columnProcess(i));
+                keySignal.push_back(card.dc->columnIsSignal(i));
+            }
+        }
+        for (unsigned int i = 0, n = keyBins.size(); i < n; ++i) {
+            if (find(outBins.begin(), outBins.end(), keyBins[i]) == outBins.end()) outBins.push_back(keyBins[i]);
+            vector<string> &list = keySignal[i] ? tmpsignals : backgrounds;
+            if (find(list.begin(), list.end(), keyProcs[i]) == list.end()) list.push_back(keyProcs[i]);
+        }
+        vector<string> pidline;
+        for (unsigned int i = 0, n = keyBins.size(); i < n; ++i) {
+            if (keySignal[i]) {
+                vector<string>::iterator it = find(signals.begin(), signals.end(), keyProcs[i]);
+                if (it == signals.end()) it = signals.insert(signals.end(), keyProcs[i]);
+                pidline.push_back(to_string(int(it - signals.begin()) - int(tmpsignals.size()) + 1));
+            } else {
+                pidline.push_back(to_string(1 + int(find(backgrounds.begin(), backgrounds.end(), keyProcs[i]) - backgrounds.begin())));
+            }
+        }
+
+        string out;
+        string rule(130, '-');
+        out += "Combination of " + join(args, "  ") + "\n";
+        out += "imax " + to_string(outBins.size()) + " number of bins\n";
+        out += "jmax " + to_string(int(signals.size() + backgrounds.size()) - 1) + " number of processes minus 1\n";
+        out += "kmax " + to_string(systs.size() + params.keys.size()) + " number of nuisance parameters\n";
+        out += rule + "\n";
+
+        if (!shapeLines.empty()) {
+            unsigned int chmax = 0;
+            for (const auto &s : shapeLines) chmax = max<unsigned int>(chmax, max(s.first.first.size(), s.first.second.size()));
+            stable_sort(shapeLines.begin(), shapeLines.end(), [](const pair<pair<string, string>, string> &a, const pair<pair<string, string>, string> &b) { return a.first < b.first; });
+            for (const auto &s : shapeLines) {
+                out += "shapes ";
+                pad(out, s.first.second, chmax); out += "  ";
+                pad(out, s.first.first, chmax); out += "  ";
+                out += s.second + "\n";
+            }
+            out += rule + "\n";
+        }
+
+        if (hasObsline && !obsline.empty()) {
+            for (const string &s : obsKeyline) cmax = max<unsigned int>(cmax, s.size());
+            for (const string &s : obsline) cmax = max<unsigned int>(cmax, s.size());
+            out += "bin          ";
+            for (unsigned int i = 0, n = obsKeyline.size(); i < n; ++i) { if (i) out += "  "; pad(out, obsKeyline[i], cmax); }
+            out += "\nobservation  ";
+            for (unsigned int i = 0, n = obsline.size(); i < n; ++i) { if (i) out += "  "; pad(out, obsline[i], cmax); }
+            out += "\n";
+        }
+        out += rule + "\n";
+
+        for (unsigned int i = 0, n = keyBins.size(); i < n; ++i) cmax = max<unsigned int>(cmax, max(keyBins[i].size(), keyProcs[i].size()));
+        for (const string &e : expline) cmax = max<unsigned int>(cmax, e.size());
+        unsigned int hmax = 10;
+        for (const auto &s : systs) {
+            // len("%-12s[nofloat]  %s %s" % (name, pdf, args)), with the python repr of the list of the args
+            unsigned int nargs = 2;
+            for (unsigned int i = 0, n = s.second.args.size(); i < n; ++i) nargs += s.second.args[i].size() + 2 + (i ? 2 : 0);
+            hmax = max<unsigned int>(hmax, max<unsigned int>(12, s.first.size()) + 9 + 2 + s.second.pdf.size() + 1 + nargs);
+        }
+        const vector<string> *rows[4] = { &keyBins, &keyProcs, &pidline, &expline };
+        const char *heads[4] = { "bin", "process", "process", "rate" };
+        for (unsigned int k = 0; k < 4; ++k) {
+            pad(out, heads[k], hmax); out += "   ";
+            for (unsigned int i = 0, n = rows[k]->size(); i < n; ++i) { if (i) out += "  "; pad(out, (*rows[k])[i], cmax); }
+            out += "\n";
+        }
+        out += rule + "\n";
+        fwrite(out.data(), 1, out.size(), stdout);
+
+        // second pass: one systematic at a time, reading its values again from each card
+        for (const auto &s : systs) {
+            out.clear();
+            string head = s.first + (s.second.nofloat ? "[nofloat]" : "");
+            head.resize(max<size_t>(head.size(), 21), ' ');
+            head += "   " + s.second.pdf + "  " + join(s.second.args, " ");
+            pad(out, head, hmax); out += "   ";
+            bool first = true;
+            for (unsigned int ich = 0, nch = cards.size(); ich < nch; ++ich) {
+                const Card &card = cards[ich];
+                map<unsigned int, int>::const_iterator it = s.second.rows.find(ich);
+                if (it != s.second.rows.end()) card.dc->readRow(it->second, lo, hi);
+                for (unsigned int i : card.columns) {
+                    if (!first) out += "  ";
+                    first = false;
+                    pad(out, it != s.second.rows.end() ? effectText(lo[i], hi[i]) : string("-"), cmax);
+                }
+            }
+            out += "\n";
+            fwrite(out.data(), 1, out.size(), stdout);
+        }
+
+        out.clear();
+        char buff[64];
+        for (const string &name : params.keys) { snprintf(buff, sizeof(buff), "%-12s", name.c_str()); out += string(buff) + "  param  " + join(params[name], " ") + "\n"; }
+        for (const string &name : flatParams.keys) { snprintf(buff, sizeof(buff), "%-12s", name.c_str()); out += string(buff) + "  flatParam\n"; }
+        for (const string &key : rateParams.keys) {
+            for (const auto &rp : rateParams[key]) {
+                snprintf(buff, sizeof(buff), "%-12s", rp.first[0].c_str());
+                out += string(buff) + "  rateParam " + key;
+                for (unsigned int i = 1, n = rp.first.size(); i < n; ++i) out += " " + rp.first[i];
+                out += " " + rp.second + " \n";
+            }
+        }
+        for (const string &name : discretes) { snprintf(buff, sizeof(buff), "%-12s", name.c_str()); out += string(buff) + "  discrete\n"; }
+        for (const string &name : extArgs.keys) out += join(extArgs[name], " ") + "\n";
+        for (const string &name : groups.keys) out += name + " group = " + join(vector<string>(groups[name].begin(), groups[name].end()), " ") + "\n";
+        for (const string &edit : edits) out += "nuisance edit  " + edit + "\n";
+        if (!editNuisFile.empty()) {
+            ifstream in(editNuisFile.c_str());
+            if (!in.good()) throw runtime_error("can't read "+editNuisFile);
+            stringstream text;
+            text << in.rdbuf();
+            out += text.str() + "\n";
+        }
+        fwrite(out.data(), 1, out.size(), stdout);
+    } catch (std::exception &e) {
+        fflush(stdout);
+        cerr << "Error: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,214 @@
+/** Merge the toys of many HybridNew jobs into one toy store (see ToyResultStore), to be read with combine -M HybridNew --toyStore.
+ *
+ * The inputs are the ROOT files written with --saveHybridResult, and/or toy stores. The ROOT files are split among
+ * forked workers, each reading the HypoTestResults of its files and writing them to a partial store; the partial stores
+ * and the input stores are then merged into one block per mass and point, skipping the results that were merged already
+ * (e.g. the same job run twice with the same seed). This replaces hadd of the outputs followed by the Append of each
+ * HypoTestResult when reading the grid.
+ *
+ *   mergeToys -o grid.toys [-j 8] [-P r] [-m 125] higgsCombine*.HybridNew.*.root [@list.txt]
+ */
+#include <TFile.h>
+#include <TKey.h>
+#include <TDirectory.h>
+#include <TString.h>
+#include <RooRealVar.h>
+#include <RooArgList.h>
+#include <RooStats/HypoTestResult.h>
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <set>
+#include <memory>
+#include <stdexcept>
+#include <unistd.h>
+#include <boost/program_options.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/trim.hpp>
+#include "../interface/ToyResultStore.h"
+#include "../interface/utils.h"
+
+using namespace std;
+
+namespace {
+    /// mass and values of the POIs from the name of a HypoTestResult saved by HybridNew,
+    /// i.e. HypoTestResult_mh<mass>_<poi1><value1>[_<poi2><value2>...]_<uniqueId>
+    bool parseName(const string &name, const vector<string> &pois, double &mass, vector<double> &values) {
+        const string prefix = "HypoTestResult_mh";
+        if (name.compare(0, prefix.size(), prefix) != 0) return false;
+        const char *p = name.c_str() + prefix.size();
+        char *end;
+        mass = strtod(p, &end);
+        if (end == p) return false;
+        values.resize(pois.size());
+        for (unsigned int i = 0, n = pois.size(); i < n; ++i) {
+            p = end;
+            if (*p != '_' || strncmp(p + 1, pois[i].c_str(), pois[i].size()) != 0) return false;
+            p += 1 + pois[i].size();
+            values[i] = strtod(p, &end);
+            if (end == p) return false;
+        }
+        // the unique id
+        if (*end != '_' || end[1] == '\0') return false;
+        for (p = end + 1; *p != '\0'; ++p) if (*p < '0' || *p > '9') return false;
+        return true;
+    }
+
+    /// append the HypoTestResults of the files to the store; returns the number of results
+    unsigned int convert(const vector<string> &files, const vector<string> &pois, double mass, const ToyResultStore &store, int verbose) {
+        RooArgList poiList;
+        vector<RooRealVar *> vars;
+        for (const string &poi : pois) {
+            vars.push_back(new RooRealVar(poi.c_str(), poi.c_str(), 0));
+            poiList.add(*vars.back());
+        }
+        unsigned int nresults = 0;
+        vector<char> blocks, block;
+        vector<double> values;
+        for (const string &fileName : files) {
+            std::auto_ptr<TFile> file(TFile::Open(fileName.c_str()));
+            if (file.get() == 0 || file->IsZombie()) throw runtime_error("can't open "+fileName);
+            TDirectory *toyDir = file->GetDirectory("toys");
+            if (toyDir == 0) { cerr << "Warning: no toys directory in " << fileName << ", skipping it" << endl; continue; }
+            blocks.clear();
+            set<string> done; // the keys are listed once per cycle
+            unsigned int nfile = 0;
+            TIter next(toyDir->GetListOfKeys()); TKey *k;
+            while ((k = (TKey *) next()) != 0) {
+                double mh;
+                if (!parseName(k->GetName(), pois, mh, values) || !done.insert(k->GetName()).second) continue;
+                if (!std::isnan(mass) && TString::Format("%g", mh) != TString::Format("%g", mass)) continue;
+                std::auto_ptr<TObject> obj(toyDir->Get(k->GetName()));
+                RooStats::HypoTestResult *res = dynamic_cast<RooStats::HypoTestResult *>(obj.get());
+                if (res == 0) continue;
+                for (unsigned int i = 0, n = vars.size(); i < n; ++i) vars[i]->setVal(values[i]);
+                ToyResultStore::serialize(mh, poiList, *res, block);
+                blocks.insert(blocks.end(), block.begin(), block.end());
+                ++nfile;
+            }
+            // all the results of the file with a single write
+            if (!blocks.empty()) store.appendBlock(blocks);
+            if (verbose > 1) cout << "  " << fileName << ": " << nfile << " results" << endl;
+            nresults += nfile;
+        }
+        for (RooRealVar *v : vars) delete v;
+        return nresults;
+    }
+
+    void addInput(const string &name, vector<string> &inputs) {
+        if (name.empty() || name[0] != '@') { inputs.push_back(name); return; }
+        ifstream list(name.substr(1).c_str());
+        if (!list.good()) throw invalid_argument("can't read the list of inputs "+name.substr(1));
+        string line;
+        while (getline(list, line)) {
+            boost::algorithm::trim(line);
+            if (!line.empty() && line[0] != '#') inputs.push_back(line);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    namespace po = boost::program_options;
+    string output, poiNames;
+    unsigned int jobs;
+    double mass;
+    int verbose;
+    vector<string> args;
+    po::options_description desc("Options");
+    desc.add_options()
+        ("help,h", "Produce help message")
+        ("output,o", po::value<string>(&output), "Toy store to write (must not exist)")
+        ("jobs,j", po::value<unsigned int>(&jobs)->default_value(1), "Number of forked workers reading the ROOT files")
+        ("poi,P", po::value<string>(&poiNames)->default_value("r"), "Comma separated names of the POIs in the names of the HypoTestResults")
+        ("mass,m", po::value<double>(&mass)->default_value(NAN), "Only take the results for this mass")
+        ("verbose,v", po::value<int>(&verbose)->default_value(1), "Verbosity level")
+        ("input", po::value<vector<string> >(&args), "ROOT files from combine -M HybridNew --saveHybridResult, toy stores, or @file with a list of them");
+    po::positional_options_description pos;
+    pos.add("input", -1);
+    po::variables_map vm;
+    try {
+        po::store(po::command_line_parser(argc, argv).options(desc).positional(pos).run(), vm);
+        po::notify(vm);
+    } catch (std::exception &e) {
+        cerr << "Invalid options: " << e.what() << endl << desc << endl;
+        return 1;
+    }
+    if (vm.count("help") || output.empty() || args.empty()) {
+        cout << "Usage: mergeToys -o <store> [options] <inputs>" << endl << desc << endl;
+        return vm.count("help") ? 0 : 1;
+    }
+    vector<string> pois;
+    boost::algorithm::split(pois, poiNames, boost::algorithm::is_any_of(","));
+    vector<string> inputs, rootFiles, stores;
+    try {
+        for (const string &a : args) addInput(a, inputs);
+    } catch (std::exception &e) {
+        cerr << "Error: " << e.what() << endl;
+        return 1;
+    }
+    if (access(output.c_str(), F_OK) == 0) {
+        cerr << "Error: " << output << " exists already" << endl;
+        return 1;
+    }
+    for (const string &in : inputs) (ToyResultStore::isStore(in) ? stores : rootFiles).push_back(in);
+
+    // each worker gets a contiguous range of the files, so that the results keep the order of the inputs
+    jobs = std::max(1u, std::min<unsigned int>(jobs, rootFiles.size()));
+    vector<string> parts;
+    vector<pid_t> pids;
+    for (unsigned int j = 0; j < jobs && !rootFiles.empty(); ++j) {
+        vector<string> mine(rootFiles.begin() + j * rootFiles.size() / jobs, rootFiles.begin() + (j + 1) * rootFiles.size() / jobs);
+        parts.push_back(output + TString::Format(".part%u", j).Data());
+        unlink(parts.back().c_str());
+        fflush(stdout); fflush(stderr);
+        pid_t pid = jobs > 1 ? fork() : 0;
+        if (pid == -1) throw runtime_error("failed to fork");
+        if (pid == 0) {
+            int status = 0;
+            try {
+                unsigned int n = convert(mine, pois, mass, ToyResultStore(parts.back()), verbose);
+                if (verbose > 0) cout << "Read " << n << " results from " << mine.size() << " files" << endl;
+            } catch (std::exception &e) {
+                cerr << "Error: " << e.what() << endl;
+                status = 1;
+            }
+            if (jobs > 1) { fflush(stdout); fflush(stderr); _exit(status); }
+            if (status != 0) { unlink(parts.back().c_str()); return status; }
+        } else {
+            pids.push_back(pid);
+        }
+    }
+    // the workers write on our stdout and stderr, so their errors are printed already
+    bool ok = true;
+    for (unsigned int j = 0; j < pids.size(); ++j) {
+        string problem = utils::waitForChild(pids[j]);
+        if (!problem.empty()) {
+            cerr << "Error: the worker reading the files " << j * rootFiles.size() / jobs << "-" << (j + 1) * rootFiles.size() / jobs - 1 << " " << problem << endl;
+            ok = false;
+        }
+    }
+    int ret = 0;
+    if (ok) {
+        vector<string> all(parts);
+        all.insert(all.end(), stores.begin(), stores.end());
+        try {
+            unsigned int skipped = ToyResultStore::compact(all, ToyResultStore(output));
+            if (verbose > 0) cout << "Merged " << all.size() << " stores into " << output << ", skipping " << skipped << " duplicate results" << endl;
+        } catch (std::exception &e) {
+            cerr << "Error: " << e.what() << endl;
+            unlink(output.c_str());
+            ret = 1;
+        }
+    } else {
+        cerr << "Error: some of the workers failed, nothing written" << endl;
+        ret = 1;
+    }
+    for (const string &part : parts) unlink(part.c_str());
+    return ret;
+}
@@ -0,0 +1,154 @@
+/** Replay a trace of the evaluations of the NLL written by combine --fcnTrace on the same workspace, without the
+ *  minimizer: set the parameters of each evaluation in turn, evaluate the NLL, and report the throughput against the
+ *  one of the trace and the largest differences from the recorded values.
+ *
+ *   replayFcnTrace -t fit.trace workspace.root [-w w] [-D data_obs] [--repeat 3] [--X-rtd SIMNLL_THREADS=4]
+ *
+ * The values are compared as differences from the first evaluation with the same state (same data and zero points,
+ * see FcnTrace.h), as the zero points of the fit aren't set here. The data is the one of -D, so the evaluations done
+ * on toys are replayed on it too and only their timing is meaningful.
+ */
+#include <TFile.h>
+#include <TSystem.h>
+#include <RooWorkspace.h>
+#include <RooAbsPdf.h>
+#include <RooAbsData.h>
+#include <RooRealVar.h>
+#include <RooCategory.h>
+#include <RooArgSet.h>
+#include <RooMsgService.h>
+#include <RooStats/ModelConfig.h>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <memory>
+#include <stdexcept>
+#include <boost/program_options.hpp>
+#include "../interface/FcnTrace.h"
+#include "../interface/ProfilingTools.h"
+
+using namespace std;
+
+extern int verbose; // of the library, for the messages of the NLL
+
+int main(int argc, char **argv) {
+    namespace po = boost::program_options;
+    string traceFile, workspaceFile, workspaceName, dataName, modelConfigName;
+    unsigned int repeat;
+    double tolerance;
+    vector<string> runtimeDefines, libraries;
+    po::options_description desc("replayFcnTrace -t trace workspace.root [options]");
+    desc.add_options()
+        ("help,h", "Print this message")
+        ("trace,t", po::value<string>(&traceFile), "Trace written by combine --fcnTrace")
+        ("workspace", po::value<string>(&workspaceFile), "ROOT file with the workspace (as made by text2workspace.py)")
+        ("workspaceName,w", po::value<string>(&workspaceName)->default_value("w"), "Name of the workspace")
+        ("dataset,D", po::value<string>(&dataName)->default_value("data_obs"), "Dataset of the workspace for the NLL")
+        ("modelConfigName", po::value<string>(&modelConfigName)->default_value("ModelConfig"), "ModelConfig of the workspace")
+        ("repeat,n", po::value<unsigned int>(&repeat)->default_value(1), "Replay the whole trace this many times, for the timing")
+        ("tolerance", po::value<double>(&tolerance)->default_value(1e-6), "Report the evaluations whose value differs by more than this from the recorded one")
+        ("X-rtd", po::value<vector<string> >(&runtimeDefines), "Runtime defines for the NLL, as in combine (--X-rtd NAME[=value])")
+        ("LoadLibrary,L", po::value<vector<string> >(&libraries), "Load these libraries before reading the workspace")
+        ("verbose,v", po::value<int>(&verbose)->default_value(0), "Verbosity level (also of the messages of the NLL)")
+        ;
+    po::positional_options_description pos;
+    pos.add("workspace", 1);
+    po::variables_map vm;
+    try {
+        po::store(po::command_line_parser(argc, argv).options(desc).positional(pos).run(), vm);
+        po::notify(vm);
+    } catch (std::exception &ex) {
+        cerr << "Invalid options: " << ex.what() << endl << desc << endl;
+        return 1;
+    }
+    if (vm.count("help") || traceFile.empty() || workspaceFile.empty()) { cout << desc << endl; return vm.count("help") ? 0 : 1; }
+
+    // same defaults as combine
+    runtimedef::set("OPTIMIZE_BOUNDS", 1);
+    runtimedef::set("ADDNLL_RECURSIVE", 1);
+    runtimedef::set("ADDNLL_GAUSSNLL", 1);
+    runtimedef::set("ADDNLL_HISTNLL", 1);
+    runtimedef::set("ADDNLL_CBNLL", 1);
+    for (const string &rtd : runtimeDefines) {
+        string::size_type idx = rtd.find('=');
+        if (idx == string::npos) runtimedef::set(rtd, 1);
+        else runtimedef::set(rtd.substr(0, idx), atoi(rtd.substr(idx+1).c_str()));
+    }
+    for (const string &lib : libraries) gSystem->Load(lib.c_str());
+    if (verbose < 2) RooMsgService::instance().setGlobalKillBelow(RooFit::ERROR);
+
+    try {
+        FcnTraceReader trace(traceFile);
+        std::unique_ptr<TFile> file(TFile::Open(workspaceFile.c_str()));
+        if (file.get() == 0 || file->IsZombie()) throw runtime_error("Can't open "+workspaceFile);
+        RooWorkspace *w = dynamic_cast<RooWorkspace *>(file->Get(workspaceName.c_str()));
+        if (w == 0) throw runtime_error("No workspace "+workspaceName+" in "+workspaceFile);
+        RooStats::ModelConfig *mc = dynamic_cast<RooStats::ModelConfig *>(w->genobj(modelConfigName.c_str()));
+        if (mc == 0 || mc->GetPdf() == 0) throw runtime_error("No ModelConfig "+modelConfigName+" with a pdf in the workspace");
+        RooAbsData *data = w->data(dataName.c_str());
+        if (data == 0) throw runtime_error("No dataset "+dataName+" in the workspace");
+        RooAbsPdf &pdf = *mc->GetPdf();
+        RooArgSet constrain;
+        if (mc->GetNuisanceParameters()) constrain.add(*mc->GetNuisanceParameters());
+        std::unique_ptr<RooAbsReal> nll(pdf.createNLL(*data, RooFit::Constrain(constrain), RooFit::Extended(pdf.canBeExtended()), RooFit::Offset(true)));
+        std::unique_ptr<RooArgSet> params(nll->getParameters((const RooArgSet *)0));
+
+        // the parameters of the trace in the workspace
+        const vector<string> &names = trace.names();
+        vector<RooRealVar *> vars(names.size(), (RooRealVar *)0);
+        vector<RooCategory *> cats(names.size(), (RooCategory *)0);
+        unsigned int missing = 0;
+        for (unsigned int i = 0, n = names.size(); i < n; ++i) {
+            RooAbsArg *a = params->find(names[i].c_str());
+            if (a == 0) a = w->arg(names[i].c_str());
+            if ((vars[i] = dynamic_cast<RooRealVar *>(a)) == 0 && (cats[i] = dynamic_cast<RooCategory *>(a)) == 0) {
+                if (missing++ < 10) cerr << "Warning: parameter " << names[i] << " of the trace is not in the workspace" << endl;
+            }
+        }
+        if (missing) cerr << "Warning: " << missing << " parameters of the trace are not in the workspace, and are ignored" << endl;
+
+        const vector<FcnTraceReader::Eval> &evals = trace.evals();
+        unsigned int nevals = evals.size();
+        double recordedTime = 0;
+        for (const FcnTraceReader::Eval &e : evals) recordedTime += e.seconds;
+        vector<double> values(nevals);
+        double replayTime = 0;
+        for (unsigned int pass = 0; pass < repeat; ++pass) {
+            for (unsigned int k = 0; k < nevals; ++k) {
+                for (const std::pair<uint32_t, double> &c : evals[k].changed) {
+                    if (vars[c.first]) vars[c.first]->setVal(c.second);
+                    else if (cats[c.first]) cats[c.first]->setIndex(int(c.second));
+                }
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                values[k] = nll->getVal();
+                replayTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            }
+            // the next pass starts with all the parameters changing again, as the first evaluation lists all of them
+        }
+
+        // differences from the first evaluation of each state
+        double maxDiff = 0; unsigned int nbad = 0, maxAt = 0;
+        uint64_t state = 0; double recorded0 = 0, replayed0 = 0;
+        for (unsigned int k = 0; k < nevals; ++k) {
+            if (k == 0 || evals[k].state != state) { state = evals[k].state; recorded0 = evals[k].nll; replayed0 = values[k]; }
+            double diff = (values[k] - replayed0) - (evals[k].nll - recorded0);
+            if (std::isnan(diff) || std::abs(diff) > tolerance) {
+                if (nbad++ < 10 || verbose > 0) printf("evaluation %u: recorded %.10g, replayed %.10g (difference %+.3g from the first one of its state)\n", k, evals[k].nll, values[k], diff);
+            }
+            if (std::abs(diff) > maxDiff || std::isnan(diff)) { maxDiff = std::isnan(diff) ? NAN : std::abs(diff); maxAt = k; }
+        }
+        printf("%u evaluations, %u parameters, replayed %u time%s\n", nevals, unsigned(names.size()), repeat, repeat > 1 ? "s" : "");
+        printf("recorded: %.3f s, %.1f evaluations/s\n", recordedTime, recordedTime > 0 ? nevals/recordedTime : 0.);
+        printf("replayed: %.3f s, %.1f evaluations/s (%.2fx)\n", replayTime/repeat, replayTime > 0 ? nevals*repeat/replayTime : 0.,
+               replayTime > 0 ? recordedTime*repeat/replayTime : 0.);
+        printf("largest difference: %.3g at evaluation %u, %u above the tolerance of %g\n", maxDiff, maxAt, nbad, tolerance);
+        return nbad ? 2 : 0;
+    } catch (std::exception &ex) {
+        cerr << "Error: " << ex.what() << endl;
+        return 1;
+    }
+}
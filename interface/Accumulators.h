@@ -36,20 +36,47 @@ inline double sumWith(const std::vector<double> & vals) {
     return ret.sum();
 }
 
+/// Kahan summation of an array in four interleaved lanes, each with its own compensation, combined at the end
+/// (so the same precision as KahanAccumulator, but without the dependency of each addition on the previous one)
+inline double sumKahanLanes(const double *vals, unsigned int size) {
+    double sums[4] = { 0, 0, 0, 0 }, comps[4] = { 0, 0, 0, 0 };
+    unsigned int i = 0;
+    for (; i + 4 <= size; i += 4) {
+        for (unsigned int j = 0; j < 4; ++j) {
+            double y = vals[i+j] - comps[j];
+            double t = sums[j] + y;
+            comps[j] = (t - sums[j]) - y;
+            sums[j] = t;
+        }
+    }
+    KahanAccumulator ret = 0;
+    for (unsigned int j = 0; j < 4; ++j) { ret += sums[j]; ret -= comps[j]; }
+    for (; i < size; ++i) ret += vals[i];
+    return ret.sum();
+}
+
 typedef KahanAccumulator PreciseAccumulator;
 typedef NaiveAccumulator FastAccumulator;
 typedef PreciseAccumulator DefaultAccumulator;
 
+inline double sumPrecise(const double *vals, unsigned int size) {
+    return sumKahanLanes(vals, size);
+}
+
 inline double sumPrecise(const std::vector<double> & vals) {
-    return sumWith<PreciseAccumulator>(vals);
+    return vals.empty() ? 0. : sumPrecise(&vals[0], vals.size());
 }
 
 inline double sumFast(const std::vector<double> & vals) {
     return sumWith<FastAccumulator>(vals);
 }
 
+inline double sumDefault(const double *vals, unsigned int size) {
+    return sumPrecise(vals, size);
+}
+
 inline double sumDefault(const std::vector<double> & vals) {
-    return sumWith<DefaultAccumulator>(vals);
+    return sumPrecise(vals);
 }
 
 #endif
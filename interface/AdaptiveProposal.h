@@ -0,0 +1,56 @@
+#ifndef HiggsAnalysis_CombinedLimit_AdaptiveProposal_h
+#define HiggsAnalysis_CombinedLimit_AdaptiveProposal_h
+
+#include <Rtypes.h>
+
+#include <RooArgList.h>
+#include <TMatrixDSym.h>
+#include <vector>
+
+#include <RooStats/ProposalFunction.h>
+
+class RooRealVar;
+
+/// Adaptive Metropolis proposal: correlated multivariate gaussian moves of all the parameters,
+/// with covariance 2.38^2/N times the covariance of the posterior. This starts as the one given
+/// in the constructor (e.g. from Hesse at the best fit), and for the first adaptSteps proposals
+/// it is updated from the points of the chain, which belong to the burn-in. After that the covariance
+/// is frozen, so that the proposal stays symmetric and the rest of the chain is a valid Markov chain.
+class AdaptiveProposal : public RooStats::ProposalFunction {
+
+   public:
+      AdaptiveProposal() : RooStats::ProposalFunction(), n_(0), adaptSteps_(0), calls_(0), lastSet_(0) {}
+      /// vars are the parameters to step, in the order of the rows of cov
+      AdaptiveProposal(const RooArgList &vars, const TMatrixDSym &cov, unsigned int adaptSteps) ;
+
+      // Populate xPrime with a new proposed point
+      virtual void Propose(RooArgSet& xPrime, RooArgSet& x);
+
+      // The moves are symmetric gaussians
+      virtual Bool_t IsSymmetric(RooArgSet& x1, RooArgSet& x2) ;
+
+      // Return the probability of proposing the point x1 given the starting
+      // point x2
+      virtual Double_t GetProposalDensity(RooArgSet& x1, RooArgSet& x2);
+
+      virtual ~AdaptiveProposal() {}
+
+      ClassDef(AdaptiveProposal,1) // Adaptive Metropolis proposal with correlated gaussian moves
+
+   private:
+      RooArgList vars_;
+      unsigned int n_, adaptSteps_, calls_;
+      /// initial covariance, running mean and sum of squared deviations of the chain (n_ x n_, row-major)
+      std::vector<double> cov0_, mean_, m2_;
+      /// cholesky factor of the scaled proposal covariance (lower triangular, row-major)
+      std::vector<double> chol_;
+      std::vector<double> z_;
+      /// the variables of the last xPrime, in the order of vars_
+      const RooArgSet *lastSet_;
+      std::vector<RooRealVar *> primeVars_;
+
+      /// set chol_ from the current estimate of the covariance
+      void decompose() ;
+};
+
+#endif
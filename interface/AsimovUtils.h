@@ -1,3 +1,4 @@
+#include <string>
 class RooAbsData;
 class RooAbsCollection;
 namespace RooStats { class ModelConfig; }
@@ -7,5 +8,11 @@ namespace asimovutils {
     RooAbsData * asimovDatasetNominal(RooStats::ModelConfig *mc, double poiValue=0.0, int verbose=0) ;
     /// Generate asimov dataset from best fit value of nuisance parameters, and fill in snapshot of corresponding global observables
     RooAbsData * asimovDatasetWithFit(RooStats::ModelConfig *mc, RooAbsData &realdata, RooAbsCollection &snapshot, bool needsFit, double poiValue=0.0, int verbose=0) ;
+    /// Keep the results of asimovDatasetWithFit (dataset, global observables, and parameters after the fit) in memory and,
+    /// if dir is not empty, also in files in that directory, and reuse them when called again for the same pdf
+    /// with the same values of all its parameters, the same data and the same poiValue, skipping the fit.
+    /// The pdf is identified by the content of the file it was read from (modelFile), and by its structure;
+    /// the datasets kept in memory for another model file are freed.
+    void setCache(bool enable, const std::string &dir = "", const std::string &modelFile = "") ;
 }
 
@@ -30,6 +30,13 @@ class AsymPow : public RooAbsReal {
 
       TObject * clone(const char *newname) const ;
 
+      /// derivative with respect to theta, if it can be computed analytically (i.e. if the kappas don't depend on theta)
+      bool analyticalDerivative(const RooAbsArg &theta, double &deriv) const ;
+
+      const RooAbsReal & kappaLow() const { return kappaLow_.arg(); }
+      const RooAbsReal & kappaHigh() const { return kappaHigh_.arg(); }
+      const RooAbsReal & theta() const { return theta_.arg(); }
+
     protected:
         Double_t evaluate() const;
 
@@ -12,6 +12,7 @@
 #include "HiggsAnalysis/CombinedLimit/interface/utils.h"
 #include <memory>
 class RooRealVar;
+class CascadeMinimizer;
 #include <RooAbsReal.h>
 #include <RooArgSet.h>
 #include <RooFitResult.h>
@@ -30,8 +31,13 @@ public:
   std::vector<std::pair<float,float> > runLimitExpected(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, double &limit, double &limitErr, const double *hint) ;
 
   float findExpectedLimitFromCrossing(RooAbsReal &nll, RooRealVar *r, double rMin, double rMax, double nll0, double quantile) ; 
+  /// with --approxExpected, sigma of equation 37 at the minimum of the asimov fit done by minim: from the Hessian, then
+  /// corrected twice with q_mu at the median it predicts; relErr gets the relative change of the median in the last step.
+  /// Returns a negative value if it can't be computed
+  double approxExpectedSigma(RooAbsReal &nll, CascadeMinimizer &minim, RooRealVar *r, double nll0, double &relErr) ;
 
   virtual const std::string& name() const { static std::string name_ = "Asymptotic"; return name_; }
+  virtual void beginMassPoint(unsigned int index) ;
 private:
   static double rAbsAccuracy_, rRelAccuracy_;
   static std::string what_;
@@ -47,8 +53,17 @@ private:
   static int         minimizerStrategy_;
 
   static double rValue_;
+  /// values of r for --gridPoints, and the number of processes computing them
+  static std::string gridPoints_;
+  static unsigned int gridForks_;
 
   static bool   strictBounds_;
+  /// compute the observed limit and the expected quantiles in forked processes
+  static bool   forkQuantiles_;
+  /// pick the next r of the observed limit search from a monotone spline through the values of log(CLs) computed so far
+  static bool   adaptiveCLs_;
+  /// get all the expected quantiles from one value of sigma, instead of a search of the crossing for each of them
+  static bool   approxExpected_;
 
   bool    hasFloatParams_;
   bool    hasDiscreteParams_;
@@ -59,12 +74,24 @@ private:
   utils::CheapValueSnapshot fitFreeD_, fitFreeA_, fitFixD_,  fitFixA_;
 
   mutable double                      minNllD_,  minNllA_, rBestD_;
+
+  /// with --massList, after the first mass point: keep the likelihoods, and start from the results of the previous point
+  bool warmStart_;
+  const RooAbsData *nllData_;             // the dataset of nllD_
+  std::auto_ptr<RooAbsReal> nllExp_;      // on the asimov dataset, for the expected limits
+  RooArgSet warmParams_;                  // the parameters floating in the global fit of the data
+  utils::CheapValueSnapshot warmFitD_;    // their values at the best fit of the previous mass point
+  double lastLimit_;                      // observed limit of the previous mass point, or -1
+  bool rBranch_;                          // the branch "r" of --singlePoint and --gridPoints was added to the tree
   mutable RooArgSet snapGlobalObsData, snapGlobalObsAsimov;
 
   float calculateLimitFromGrid(RooRealVar *, double, double);
 
   RooAbsData *asimovDataset(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data);
-  double getCLs(RooRealVar &r, double rVal, bool getAlsoExpected=false, double *limit=0, double *limitErr=0);
+  /// if expectedCLs is given, the expected CLs of the quantiles are put there instead of being committed
+  double getCLs(RooRealVar &r, double rVal, bool getAlsoExpected=false, double *limit=0, double *limitErr=0, std::vector<double> *expectedCLs=0);
+  /// with --gridPoints, after the global fits: observed and expected CLs at all the points, committed as by --singlePoint
+  void runGrid(RooRealVar &r, double &limit, double &limitErr);
   
   TFile *gridFile_;
   TTree *limitsTree_;
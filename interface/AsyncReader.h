@@ -0,0 +1,55 @@
+#ifndef HiggsAnalysis_CombinedLimit_AsyncReader_h
+#define HiggsAnalysis_CombinedLimit_AsyncReader_h
+/** Background thread reading objects from a ROOT file ahead of when they are needed, so that the
+    reads and the decompression overlap with the fits done by the main thread.
+    The objects are read in the order in which their names are given, with at most maxAhead of
+    them read and not yet taken at any time. Only the bytes are read and decompressed in the
+    background: the objects are streamed by the thread that takes them with get(), since RooFit
+    allocates some of them from pools that are not thread safe.
+    Nothing else should read from the same file while the reader exists.                           */
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+class TObject;
+class TDirectory;
+class TKey;
+
+class AsyncReader {
+    public:
+        AsyncReader(TDirectory *dir, const std::vector<std::string> &names, unsigned int maxAhead) ;
+        /// stops the thread
+        ~AsyncReader() ;
+        /// the object with this name in dir (owned by the caller), or 0 if there is none.
+        /// The objects given before it in the list and not taken yet are dropped.
+        TObject * get(const std::string &name) ;
+        /// read the object with this name from dir (owned by the caller) like TDirectory::Get, but with the compressed
+        /// blocks of the record (of up to 16 MB each) decompressed in parallel on nThreads threads of the global pool.
+        /// For the workspace at startup, whose single key ROOT's implicit multi-threading doesn't parallelize.
+        static TObject * readWithThreads(TDirectory *dir, const std::string &name, unsigned int nThreads) ;
+    private:
+        AsyncReader(const AsyncReader &) ;
+        AsyncReader & operator=(const AsyncReader &) ;
+        /// the key, and its record once read and decompressed (keylen bytes of header, then the object)
+        struct Item { TKey *key; std::vector<char> image; bool done, taken; };
+        void loop_() ;
+        /// read the record of the key, and decompress it
+        bool read_(const TKey &key, std::vector<char> &image) ;
+        /// mark the item as taken, freeing its record
+        void drop_(Item &item) ;
+        TDirectory *dir_;
+        std::vector<Item> items_;
+        std::map<std::string, unsigned int> index_;
+        /// items read and not taken, next item for the thread, item being read by the thread (or -1)
+        unsigned int maxAhead_, ready_, next_;
+        int reading_;
+        std::mutex mutex_, fileMutex_;
+        std::condition_variable hasRoom_, hasItem_;
+        bool stop_;
+        std::thread thread_;
+};
+
+#endif
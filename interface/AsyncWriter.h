@@ -0,0 +1,49 @@
+#ifndef HiggsAnalysis_CombinedLimit_AsyncWriter_h
+#define HiggsAnalysis_CombinedLimit_AsyncWriter_h
+/** Background thread writing objects to ROOT files, so that their streaming and compression
+    overlap with the fits done by the main thread.
+    Objects are written in the order in which they are queued; at most maxQueued of them can be
+    waiting at any time, beyond that write() blocks until there is room again.
+    The thread holds the given file mutex while writing, so anything else writing to the same
+    files (e.g. filling a tree) must hold it too.
+    Objects are deleted by the thread that queues them (on later calls to write or flush), since
+    RooFit allocates some of them from pools that are not thread safe.
+    The objects must not share anything with those that the other threads keep changing, e.g. the
+    variables of the workspace: streaming them from the background thread would race with the
+    setVal and the snapshots of the main thread. Write those on the main thread, under the file mutex. */
+#include <string>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+class TObject;
+class TDirectory;
+
+class AsyncWriter {
+    public:
+        AsyncWriter(unsigned int maxQueued, std::mutex &fileMutex) ;
+        /// writes all the queued objects, and stops the thread
+        ~AsyncWriter() ;
+        /// queue obj to be written in dir with the given name; the writer takes ownership of it
+        void write(TDirectory *dir, TObject *obj, const std::string &name) ;
+        /// wait until all the queued objects have been written
+        void flush() ;
+    private:
+        AsyncWriter(const AsyncWriter &) ;
+        AsyncWriter & operator=(const AsyncWriter &) ;
+        struct Item { TDirectory *dir; TObject *obj; std::string name; };
+        void loop_() ;
+        void deleteWritten_() ;
+        unsigned int maxQueued_;
+        std::mutex &fileMutex_;
+        std::mutex mutex_;
+        std::condition_variable hasWork_, hasRoom_, idle_;
+        std::deque<Item> queue_;
+        std::vector<TObject *> written_;
+        bool busy_, stop_;
+        std::thread thread_;
+};
+
+#endif
@@ -32,6 +32,10 @@ private:
   static float hintSafetyFactor_;
 
   static std::vector<std::string> twoPoints_;
+  /// split the points of the prior predictive distribution among this number of forked processes
+  static unsigned int sampleForks_;
+  /// sample the gaussian and uniform nuisance priors with a randomized Sobol sequence
+  static bool quasiRandom_;
   std::pair<double,double> priorPredictiveDistribution(RooStats::ModelConfig *mc, RooAbsData &data, const RooArgSet *point=0, double *offset=0);
 };
 
@@ -11,6 +11,7 @@ class RooMinimizer;
 #include <RooStats/TestStatistic.h>
 #include "HiggsAnalysis/CombinedLimit/interface/RooSimultaneousOpt.h"
 #include "HiggsAnalysis/CombinedLimit/interface/CachingNLL.h"
+#include "HiggsAnalysis/CombinedLimit/interface/utils.h"
 
 class BestFitSigmaTestStat : public RooStats::TestStatistic {
     public:
@@ -32,10 +33,17 @@ class BestFitSigmaTestStat : public RooStats::TestStatistic {
         std::auto_ptr<RooArgSet> params_;
         std::auto_ptr<RooAbsReal> nll_;
         Int_t verbosity_;
+        // opt-in (--X-rtd BFSTS_WARMSTART): POIs and nuisances at the minimum for the previous toy, used as starting point
+        // (only those of snap_, so that the global observables of the toy are not touched)
+        RooArgSet fitParams_;
+        utils::CheapValueSnapshot warmStart_;
 
         // create NLL. if returns true, it can be kept, if false it should be deleted at the end of Evaluate
         bool createNLL(RooAbsPdf &pdf, RooAbsData &data) ;
+        /// minimize the NLL, returning its minimum, or NaN if the minimization failed
         double minNLL(bool constrained, RooRealVar *r=0) ;
+        /// move the parameters to warmStart_, unless the NLL is lower at the current starting point; returns true if moved
+        bool applyWarmStart_() ;
 }; // TestSimpleStatistics
 
 
@@ -0,0 +1,63 @@
+#ifndef HiggsAnalysis_CombinedLimit_BinnedOffload_h
+#define HiggsAnalysis_CombinedLimit_BinnedOffload_h
+/** \class cacheutils::BinnedOffload
+ *
+ * Evaluation of the binned part of the NLL of a channel made only of FastVerticalInterpHistPdf2 (ADDNLL_OFFLOAD) by a backend
+ * that gets the nominal templates and the morphs once, and then for each call only the values of the morphing parameters
+ * and of the coefficients, returning sum_i w_i log(S_i/sumCoeff). The backend is loaded from the shared library in
+ * COMBINE_OFFLOAD_BACKEND if set (see BinnedOffloadBackend.h for its interface, e.g. for a GPU), otherwise the built-in one
+ * on the CPU is used.
+ */
+#include <vector>
+#include <Rtypes.h>
+#include "HiggsAnalysis/CombinedLimit/interface/BinnedOffloadBackend.h"
+
+class RooAbsReal;
+class RooAbsData;
+class FastVerticalInterpHistPdf2;
+struct BinnedOffloadBackendFuncs;
+
+namespace cacheutils {
+/// The inputs of a channel made only of FastVerticalInterpHistPdf2, packed as described in BinnedOffloadBackend.h
+struct BinnedChannelData {
+    unsigned int nbins;
+    std::vector<double> binWidths, weights, smoothRegion, nominal, morphSum, morphDiff;
+    std::vector<int> smoothAlgo;
+    std::vector<unsigned int> entryBins, morphBegin, morphParam;
+    /// distinct morphing parameters of all the pdfs, in the order of the indices of morphParam
+    std::vector<const RooAbsReal *> params;
+    /// returns false if the channel can't be packed: the templates don't have all the same binning,
+    /// or the dataset has more than one observable or entries outside of the templates
+    bool fill(const std::vector<const FastVerticalInterpHistPdf2 *> &pdfs, const RooAbsData &data, bool includeZeroWeights, const std::vector<Double_t> &weights) ;
+    /// the same arrays in the layout of the backends, valid as long as this is not changed
+    void view(CombineOffloadChannel &channel) const ;
+};
+
+class BinnedOffload {
+    public:
+        /// returns 0 if the channel can't be offloaded: the templates don't have all the same binning,
+        /// the dataset has more than one observable or entries outside of the templates, or no backend could be loaded
+        static BinnedOffload * create(const std::vector<const FastVerticalInterpHistPdf2 *> &pdfs, const RooAbsData &data, bool includeZeroWeights, const std::vector<Double_t> &weights) ;
+        ~BinnedOffload() ;
+        /// replace the weights, in the same order as those passed to create()
+        void setWeights(const std::vector<Double_t> &weights) ;
+        /// nll = sum_i w_i log(S_i/sumCoeff) for the current values of the morphing parameters and these coefficients;
+        /// returns false if some S_i is not positive, in which case the caller has to evaluate the channel itself
+        bool evaluate(const double *coeffs, double sumCoeff, double &nll) const ;
+        /// description of the backend in use
+        static const char * backendName() ;
+    private:
+        BinnedOffload(const BinnedOffloadBackendFuncs *funcs) : funcs_(funcs), handle_(0) {}
+        BinnedOffload(const BinnedOffload &other) ;
+        BinnedOffload & operator=(const BinnedOffload &other) ;
+        /// the backend, loaded at the first call; 0 if the library in COMBINE_OFFLOAD_BACKEND can't be used
+        static const BinnedOffloadBackendFuncs * backend_() ;
+        /// distinct morphing parameters of all the pdfs
+        std::vector<const RooAbsReal *> params_;
+        mutable std::vector<double> paramVals_;
+        const BinnedOffloadBackendFuncs *funcs_;
+        void *handle_;
+};
+}
+
+#endif
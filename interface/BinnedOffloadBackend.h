@@ -0,0 +1,56 @@
+#ifndef HiggsAnalysis_CombinedLimit_BinnedOffloadBackend_h
+#define HiggsAnalysis_CombinedLimit_BinnedOffloadBackend_h
+/* Interface of the backends of cacheutils::BinnedOffload (ADDNLL_OFFLOAD), in plain C and without any ROOT dependency,
+ * so that a backend (e.g. for CUDA or HIP) can be compiled separately into a shared library exporting the functions below
+ * with C linkage, and used with COMBINE_OFFLOAD_BACKEND=/path/to/library.so. Without it, a built-in backend runs on the CPU.
+ *
+ * A channel is made of nproc processes, each a template of nbins bins morphed as in FastVerticalInterpHistPdf2:
+ *    t_p  = nominal_p + sum_k 0.5 * x_k * (diff_k + step_p(x_k) * sum_k)     for the morphs k of the process
+ *    t_p  = exp(t_p) if smoothAlgo_p < 0, max(t_p, 1e-9) otherwise
+ *    t_p /= sum_b t_p[b] * binWidths[b]                                      (if positive)
+ * where step_p(x) = x/|x| for |x| >= smoothRegion_p, and 1/8 u (u^2 (3 u^2 - 10) + 15) with u = x/smoothRegion_p otherwise.
+ * The expectation for the data entry i is S_i = sum_p coeff_p * t_p[entryBins[i]], and the result of an evaluation is
+ *    sum_i weights[i] * log(S_i/sumCoeff)
+ * so that per call only the nparams values x of the morphing parameters and the nproc coefficients go in, and one number comes out.
+ *
+ * All the arrays are copied by the backend, so the caller can free them after the call.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    unsigned int nproc, nbins, nentries, nparams;
+    const double *binWidths;         /* [nbins] */
+    const unsigned int *entryBins;   /* [nentries] */
+    const double *weights;           /* [nentries] */
+    const int *smoothAlgo;           /* [nproc] */
+    const double *smoothRegion;      /* [nproc] */
+    const double *nominal;           /* [nproc][nbins], in log scale if smoothAlgo < 0 */
+    const unsigned int *morphBegin;  /* [nproc+1]: the morphs of the process p are [morphBegin[p], morphBegin[p+1]) */
+    const unsigned int *morphParam;  /* [nmorphs]: index of the parameter of each morph, in [0, nparams) */
+    const double *morphSum;          /* [nmorphs][nbins] */
+    const double *morphDiff;         /* [nmorphs][nbins] */
+} CombineOffloadChannel;
+
+/* upload the channel; returns an opaque handle, or 0 if it can't be done */
+typedef void * (*CombineOffloadCreateFunc)(const CombineOffloadChannel *channel);
+/* replace the nentries weights of the channel */
+typedef void   (*CombineOffloadSetWeightsFunc)(void *handle, const double *weights);
+/* evaluate the channel at the parameters params[nparams] and coefficients coeffs[nproc]; returns 0 on success,
+   or non-zero if some S_i is not positive and finite (the caller then evaluates the channel itself) */
+typedef int    (*CombineOffloadEvalFunc)(void *handle, const double *params, const double *coeffs, double sumCoeff, double *result);
+typedef void   (*CombineOffloadDestroyFunc)(void *handle);
+
+/* names of the functions exported by a backend library */
+#define COMBINE_OFFLOAD_CREATE      "combineOffloadCreate"
+#define COMBINE_OFFLOAD_SET_WEIGHTS "combineOffloadSetWeights"
+#define COMBINE_OFFLOAD_EVAL        "combineOffloadEval"
+#define COMBINE_OFFLOAD_DESTROY     "combineOffloadDestroy"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -3,20 +3,28 @@
 
 #include "HiggsAnalysis/CombinedLimit/interface/RooMultiPdf.h"
 #include "HiggsAnalysis/CombinedLimit/interface/CachingNLL.h"
+#include "HiggsAnalysis/CombinedLimit/interface/VerticalInterpPdf.h"
+#include "HiggsAnalysis/CombinedLimit/interface/RooMomentMorphND.h"
 #include <RooAbsData.h>
 #include <RooAddPdf.h>
 #include <RooProduct.h>
 #include <vector>
 
 namespace cacheutils {
+    class CachingParamHistFunc;
+
+    /// One caching pdf per component, each with its own cache keyed by its own parameters,
+    /// so that switching the index back and forth doesn't recompute the values over the dataset
     class CachingMultiPdf : public CachingPdfBase {
         public:
-            CachingMultiPdf(const RooMultiPdf &pdf, const RooArgSet &obs) ;
+            /// if optimizeComponents is false, the components always use the generic CachingPdf
+            CachingMultiPdf(const RooMultiPdf &pdf, const RooArgSet &obs, bool optimizeComponents = true) ;
             ~CachingMultiPdf() ;
             virtual const std::vector<Double_t> & eval(const RooAbsData &data) ;
             const RooAbsReal *pdf() const { return pdf_; }
             virtual void  setDataDirty() ;
             virtual void  setIncludeZeroWeights(bool includeZeroWeights) ;
+            virtual std::size_t cacheBytes() const ;
         protected:
             const RooMultiPdf * pdf_;
             boost::ptr_vector<CachingPdfBase>  cachingPdfs_;
@@ -30,6 +38,7 @@ namespace cacheutils {
             const RooAbsReal *pdf() const { return pdf_; }
             virtual void  setDataDirty() ;
             virtual void  setIncludeZeroWeights(bool includeZeroWeights) ;
+            virtual std::size_t cacheBytes() const ;
         protected:
             const RooAddPdf * pdf_;
             std::vector<const RooAbsReal *> coeffs_;
@@ -45,13 +54,57 @@ namespace cacheutils {
             const RooAbsReal *pdf() const { return pdf_; }
             virtual void  setDataDirty() ;
             virtual void  setIncludeZeroWeights(bool includeZeroWeights) ;
+            virtual std::size_t cacheBytes() const ;
         protected:
             const RooProduct * pdf_;
             boost::ptr_vector<CachingPdfBase>  cachingPdfs_;
+            /// the factors that are ParamHistFunc, or null, for ADDNLL_PRODUCT_GATHER
+            std::vector<CachingParamHistFunc *> gathered_;
             std::vector<Double_t> work_;
     };
 
+    /// VerticalInterpPdf with additive interpolation of pdfs: each component has its own caching pdf,
+    /// so only those whose parameters changed are recomputed, and the interpolation is done on the arrays.
+    /// The components are normalized, so they are multiplied back by their integrals, as in VerticalInterpPdf::evaluate
+    class CachingVerticalInterpPdf : public CachingPdfBase {
+        public:
+            CachingVerticalInterpPdf(const VerticalInterpPdf &pdf, const RooArgSet &obs) ;
+            ~CachingVerticalInterpPdf() ;
+            /// false if the pdf can't be done this way (multiplicative morphing, numeric integrals, components that are not pdfs or have other observables)
+            static bool supports(const VerticalInterpPdf &pdf, const RooArgSet &obs) ;
+            virtual const std::vector<Double_t> & eval(const RooAbsData &data) ;
+            const RooAbsReal *pdf() const { return pdf_; }
+            virtual void  setDataDirty() ;
+            virtual void  setIncludeZeroWeights(bool includeZeroWeights) ;
+            virtual std::size_t cacheBytes() const ;
+        protected:
+            const VerticalInterpPdf * pdf_;
+            const RooArgSet * obs_;
+            std::vector<const RooAbsPdf *>  funcs_;
+            std::vector<const RooAbsReal *> coeffs_;
+            boost::ptr_vector<CachingPdfBase>  cachingPdfs_;
+            std::vector<Double_t> work_;
+    };
 
+    /// RooMomentMorphND without horizontal morphing, as the mixture of the cached reference pdfs with the fractions
+    /// of RooMomentMorphND::mixingFractions (ADDNLL_MOMENTMORPHNLL)
+    class CachingMomentMorphND : public CachingPdfBase {
+        public:
+            CachingMomentMorphND(const RooMomentMorphND &pdf, const RooArgSet &obs) ;
+            ~CachingMomentMorphND() ;
+            /// false if the pdf can't be done this way (horizontal morphing, fractions not known in closed form, reference pdfs that are not pdfs or have other observables)
+            static bool supports(const RooMomentMorphND &pdf, const RooArgSet &obs) ;
+            virtual const std::vector<Double_t> & eval(const RooAbsData &data) ;
+            const RooAbsReal *pdf() const { return pdf_; }
+            virtual void  setDataDirty() ;
+            virtual void  setIncludeZeroWeights(bool includeZeroWeights) ;
+            virtual std::size_t cacheBytes() const ;
+        protected:
+            const RooMomentMorphND * pdf_;
+            boost::ptr_vector<CachingPdfBase>  cachingPdfs_;
+            std::vector<double> fracs_;
+            std::vector<Double_t> work_;
+    };
 
 } // namespace
 
@@ -3,11 +3,14 @@
 
 #include <memory>
 #include <map>
+#include <set>
+#include <vector>
 #include <RooAbsPdf.h>
 #include <RooAddPdf.h>
 #include <RooRealSumPdf.h>
 #include <RooProdPdf.h>
 #include <RooAbsData.h>
+#include <RooDataSet.h>
 #include <RooArgSet.h>
 #include <RooSetProxy.h>
 #include <RooRealVar.h>
@@ -17,6 +20,12 @@
 #include <RooProduct.h>
 #include "HiggsAnalysis/CombinedLimit/interface/SimpleGaussianConstraint.h"
 #include "HiggsAnalysis/CombinedLimit/interface/SimplePoissonConstraint.h"
+#include "HiggsAnalysis/CombinedLimit/interface/SimpleCacheSentry.h"
+#include "HiggsAnalysis/CombinedLimit/interface/ThreadPool.h"
+#include "HiggsAnalysis/CombinedLimit/interface/ProfilingTools.h"
+#include "HiggsAnalysis/CombinedLimit/interface/BinnedOffload.h"
+#include "HiggsAnalysis/CombinedLimit/interface/ChannelKernel.h"
+#include "HiggsAnalysis/CombinedLimit/interface/DataColumns.h"
 #include <boost/ptr_container/ptr_vector.hpp>
 
 class RooMultiPdf;
@@ -28,6 +37,10 @@ namespace cacheutils {
             ArgSetChecker() {}
             ArgSetChecker(const RooAbsCollection &set) ;
             bool changed(bool updateIfChanged=false) ;
+            /// hash of the current values of the parameters
+            std::size_t currentHash() const ;
+            /// append to out all the parameters whose value differs from the stored one (changed() stops at the first)
+            void changedArgs(std::vector<const RooAbsArg *> &out) const ;
         private:
             std::vector<RooRealVar *> vars_;
             std::vector<double> vals_;
@@ -38,8 +51,9 @@ namespace cacheutils {
 // Part zero point five: Cache of pdf values for different parameters
     class ValuesCache {
         public:
-            ValuesCache(const RooAbsReal &pdf, const RooArgSet &obs, int size=MaxItems_);
-            ValuesCache(const RooAbsCollection &params, int size=MaxItems_);
+            /// size <= 0 means the default, which can be changed at runtime with CACHINGPDF_CACHE_SIZE
+            ValuesCache(const RooAbsReal &pdf, const RooArgSet &obs, int size=-1);
+            ValuesCache(const RooAbsCollection &params, int size=-1);
             ~ValuesCache();
             // search for the item corresponding to the current values of the parameters.
             // if available, return (&values, true)
@@ -47,17 +61,128 @@ namespace cacheutils {
             // and it will be up to the caller code to fill the room the new item
             std::pair<std::vector<Double_t> *, bool> get(); 
             void clear();
+            /// copy the values to memory allocated by the calling thread (see FastTemplate::Localize)
+            void localize();
+            /// memory held by the values of all the items
+            std::size_t bytes() const ;
+            /// with ADDNLL_RECOMPUTE_REPORT, the parameters that changed since the last values before the last miss
+            /// (empty if there were no valid values, e.g. for new data); 0 otherwise
+            const std::vector<const RooAbsArg *> * missCause() const { return reportMisses_ ? &missCause_ : 0; }
         private:
             struct Item {
-                Item(const RooAbsCollection &set)   : checker(set),   good(false) {}
-                Item(const ArgSetChecker    &check) : checker(check), good(false) {}
+                Item(const RooAbsCollection &set)   : checker(set),   good(false), hash(0) {}
+                Item(const ArgSetChecker    &check) : checker(check), good(false), hash(0) {}
                 std::vector<Double_t> values;
                 ArgSetChecker         checker;
                 bool                  good;
+                std::size_t           hash;
             };
-            int size_, maxSize_;
-            enum { MaxItems_ = 3 };
-            Item *items[MaxItems_];
+            ValuesCache(const ValuesCache &) ;
+            ValuesCache & operator=(const ValuesCache &) ;
+            void setup_(const RooAbsCollection &params, int size, const char *className) ;
+            int maxSize_;
+            enum { DefaultItems_ = 3 };
+            /// items in order of last use, the most recent first (so that the last one is evicted if needed)
+            std::vector<Item *> items_;
+            /// hit and miss counters for the class of the pdf (CACHINGPDF_CACHE_STATS)
+            PerfCounter *hits_, *misses_;
+            /// client of all the parameters, so that RooFit tells it if any of them was set since the last call 
+            /// and the values don't have to be compared one by one otherwise (CACHINGPDF_DIRTY_SENTRY)
+            std::auto_ptr<SimpleCacheSentry> sentry_;
+            bool reportMisses_;
+            std::vector<const RooAbsArg *> missCause_;
+    };
+// Part zero point seven: cost accounting per channel and per class of cached pdf (ADDNLL_COST_REPORT)
+    class CostReport {
+        public:
+            struct Entry {
+                Entry() : seconds(0), calls(0), bins(0), hits(0), misses(0) {}
+                double seconds;
+                unsigned long calls, bins, hits, misses;
+            };
+            /// entry for a channel and class of cached pdf (an empty class is the channel as a whole).
+            /// the reference stays valid until the end of the job.
+            static Entry & get(const std::string &channel, const std::string &pdfClass) ;
+            /// print the channels and the classes ranked by time, if anything was recorded
+            static void print() ;
+            /// count the time, the ValuesCache lookups done by the current thread, and the bins, from construction to destruction
+            class Scope {
+                public:
+                    Scope(Entry *entry, unsigned long bins) ;
+                    ~Scope() ;
+                private:
+                    Scope(const Scope &) ;
+                    Scope & operator=(const Scope &) ;
+                    Entry *entry_;
+                    double start_;
+                    unsigned long hits_, misses_;
+            };
+    };
+// Part zero point seven five: recomputations attributed to the parameters that triggered them (ADDNLL_RECOMPUTE_REPORT)
+/// Each miss of a ValuesCache is attributed to the parameters whose values changed since the last values it held, as
+/// found by its ArgSetChecker, and so is the time of the realFill_ that follows (which includes the syncTotal of the
+/// morphing pdfs it evaluates). When several parameters changed at once, each gets the same share of the miss and of
+/// the time, so that the totals add up to those of the job.
+    class RecomputeReport {
+        public:
+            struct Entry {
+                Entry() : misses(0), seconds(0), bins(0), alone(0) {}
+                double misses, seconds, bins;
+                /// misses for which this was the only parameter that changed
+                unsigned long alone;
+                /// distinct caches it made miss (roughly the pdfs of the channels that depend on it)
+                std::set<const void *> caches;
+            };
+            static bool enabled() ;
+            /// a miss of the cache, for the parameters in cause
+            static void miss(const std::vector<const RooAbsArg *> &cause, const void *cache) ;
+            /// print the parameters ranked by the time of the recomputations, if anything was recorded
+            static void print() ;
+            /// count the time and the bins from construction to destruction, for the cause of the last miss (if not 0)
+            class Scope {
+                public:
+                    Scope(const std::vector<const RooAbsArg *> *cause, unsigned long bins) ;
+                    ~Scope() ;
+                private:
+                    Scope(const Scope &) ;
+                    Scope & operator=(const Scope &) ;
+                    const std::vector<const RooAbsArg *> *cause_;
+                    unsigned long bins_;
+                    double start_;
+            };
+    };
+// Part zero point eight: scratch memory of a channel
+/// Per-entry working arrays of a channel, laid out one after the other in a single block of 64-byte aligned memory.
+/// The block only grows, so it's reused across setData calls (e.g. in toy loops). Contents are not preserved by resize.
+    class ScratchArena {
+        public:
+            ScratchArena() : size_(0), arrays_(0), stride_(0), capacity_(0), data_(0) {}
+            ~ScratchArena() ;
+            /// room for arrays arrays of size entries each
+            void resize(unsigned int size, unsigned int arrays) ;
+            unsigned int size() const { return size_; }
+            unsigned int arrays() const { return arrays_; }
+            Double_t * operator[](unsigned int i) const { return data_ + i * stride_; }
+            std::size_t bytes() const { return capacity_ * sizeof(Double_t); }
+            /// copy the arrays to memory allocated by the calling thread (see FastTemplate::Localize)
+            void localize() ;
+        private:
+            enum { Alignment = 64 };
+            unsigned int size_, arrays_, stride_;
+            std::size_t capacity_;
+            Double_t *data_;
+            ScratchArena(const ScratchArena &) ;
+            ScratchArena & operator=(const ScratchArena &) ;
+    };
+// Part zero point nine: memory held by a channel (SIMNLL_MEMORY_REPORT)
+    struct MemoryFootprint {
+        MemoryFootprint() : nominal(0), morphs(0), caches(0), data(0), nodes(0) {}
+        /// templates (nominal, with its log and the morphed total, and morphs), cached pdf values and working arrays of the NLL,
+        /// dataset with its columns and weights, RooFit objects of the pdf
+        std::size_t nominal, morphs, caches, data, nodes;
+        std::size_t total() const { return nominal + morphs + caches + data + nodes; }
+        /// the single pieces, as (bytes, description), to list the largest ones
+        std::vector<std::pair<std::size_t, std::string> > items;
     };
 // Part one: cache all values of a pdf
 class CachingPdfBase {
@@ -68,6 +193,13 @@ class CachingPdfBase {
         virtual const RooAbsReal *pdf() const = 0;
         virtual void  setDataDirty() = 0;
         virtual void  setIncludeZeroWeights(bool includeZeroWeights) = 0;
+        /// fill out with the derivative of eval(data) with respect to param, if it can be computed analytically.
+        /// returns false otherwise, in which case the caller has to resort to finite differences.
+        virtual bool  evalDerivative(const RooAbsData &data, const RooAbsArg &param, std::vector<Double_t> &out) { return false; }
+        /// memory held by the cached values and working arrays, including those of the components
+        virtual std::size_t cacheBytes() const { return 0; }
+        /// reallocate the cached values from the calling thread, so that they are on its NUMA node
+        virtual void  localize() {}
 };
 class CachingPdf : public CachingPdfBase {
     public:
@@ -78,6 +210,8 @@ class CachingPdf : public CachingPdfBase {
         const RooAbsReal *pdf() const { return pdf_; }
         virtual void  setDataDirty() { lastData_ = 0; }
         virtual void  setIncludeZeroWeights(bool includeZeroWeights) { includeZeroWeights_ = includeZeroWeights;  setDataDirty(); }
+        virtual std::size_t cacheBytes() const { return cache_.bytes() + nonZeroW_.capacity(); }
+        virtual void  localize() { cache_.localize(); }
     protected:
         const RooArgSet *obs_;
         RooAbsReal *pdfOriginal_;
@@ -90,6 +224,9 @@ class CachingPdf : public CachingPdfBase {
         bool                 includeZeroWeights_;
         virtual void newData_(const RooAbsData &data) ;
         virtual void realFill_(const RooAbsData &data, std::vector<Double_t> &values) ;
+        /// evaluate the pdf setting the observables from the DataColumns of the dataset instead of loading each entry;
+        /// returns false if they can't be used (no columns, entries outside the ranges, non-real observables, or CACHINGPDF_ROWS)
+        bool fillFromColumns_(const RooAbsData &data, std::vector<Double_t> &values) ;
 };
 
 template <typename PdfT, typename VPdfT> 
@@ -100,6 +237,7 @@ class OptimizedCachingPdfT : public CachingPdf {
         OptimizedCachingPdfT(const OptimizedCachingPdfT &other) : 
             CachingPdf(other), vpdf_(0) {}
         virtual ~OptimizedCachingPdfT() { delete vpdf_; }
+        virtual bool  evalDerivative(const RooAbsData &data, const RooAbsArg &param, std::vector<Double_t> &out) { return false; }
     protected:
         virtual void realFill_(const RooAbsData &data, std::vector<Double_t> &values) ;
         virtual void newData_(const RooAbsData &data) ;
@@ -108,6 +246,110 @@ class OptimizedCachingPdfT : public CachingPdf {
 
 CachingPdfBase * makeCachingPdf(RooAbsReal *pdf, const RooArgSet *obs) ;
 
+/// The ProcessNormalization and AsymPow coefficients of a channel, evaluated together (ADDNLL_NORMBLOCK):
+/// the logarithms of all the yields come from one sparse (coefficients x distinct nuisances) matrix of log-kappas
+/// times the nuisance values, plus the asymmetric terms, followed by one vectorized exp.
+class NormalizationBlock {
+    public:
+        /// take the coefficients that it can handle among coeffs
+        NormalizationBlock(const std::vector<RooAbsReal *> &coeffs) ;
+        /// number of coefficients in the block
+        unsigned int size() const { return nominal_.size(); }
+        /// position in eval() of the i-th coefficient passed to the constructor, or -1 if it's not in the block
+        int index(unsigned int i) const { return index_[i]; }
+        /// values of all the coefficients in the block
+        const std::vector<Double_t> & eval() const ;
+    private:
+        std::vector<const RooAbsReal *> thetas_;
+        /// symmetric log-normals, one row per coefficient: entries [symBegin_[i], symBegin_[i+1]) of symTheta_, symLogKappa_
+        std::vector<unsigned int> symBegin_, symTheta_;
+        std::vector<double> symLogKappa_;
+        /// asymmetric log-normals; the log-kappas are taken from kappaLo/kappaHi if they are not null (AsymPow)
+        struct AsymTerm { 
+            unsigned int coeff, theta; double logKappaLo, logKappaHi; const RooAbsReal *kappaLo, *kappaHi; 
+        };
+        std::vector<AsymTerm> asymTerms_;
+        std::vector<double> nominal_;
+        std::vector<std::vector<const RooAbsReal *> > others_;
+        std::vector<int> index_;
+        mutable std::vector<Double_t> thetaVals_, logs_, values_, work_;
+        unsigned int thetaIndex_(const RooAbsArg *theta, std::map<const RooAbsArg *, unsigned int> &indices) ;
+};
+
+/// All the coefficients of a channel flattened into one straight-line program over their leaf parameters (ADDNLL_COEFF_PROGRAM).
+/// RooProduct, RooCheapProduct, ProcessNormalization and AsymPow nodes are expanded into instructions on registers;
+/// RooRealVars and anything else (e.g. RooFormulaVar) are leaves read with getVal once per evaluation, RooConstVars are
+/// folded at setup. Nodes shared by several coefficients (e.g. the same signal strength or nuisance) get a single register.
+/// Unless ADDNLL_COEFF_NOFOLD is set, the constant RooRealVars (frozen nuisances and parameters of the model) and the
+/// leaves depending only on them are folded too, together with all the instructions that only depend on constants, 
+/// in the same order of the operations so that the values don't change. The program is rebuilt when one of the folded
+/// variables is floated again or changes value, or when one of the floating ones is frozen.
+class CoefficientProgram {
+    public:
+        CoefficientProgram(const std::vector<RooAbsReal *> &coeffs) ;
+        /// number of nodes that were expanded instead of being read as leaves, i.e. of instructions before folding the constants
+        unsigned int size() const { return expanded_; }
+        /// number of instructions executed at each evaluation
+        unsigned int instructions() const { return code_.size(); }
+        /// values of all the coefficients, in the order they were passed to the constructor
+        const std::vector<Double_t> & eval() const ;
+    private:
+        enum OpCode { Set, Mul, MulConst, AddMulConst, AddAsymLog, AddAsymLogVar, Exp };
+        /// regs[out] = f(regs[a], regs[b], regs[c], k1, k2)
+        struct Instr { OpCode op; unsigned int out, a, b, c; double k1, k2; };
+        std::vector<RooAbsReal *> coeffs_;
+        bool fold_;
+        mutable unsigned int expanded_;
+        mutable std::vector<Instr> code_;
+        mutable std::vector<std::pair<unsigned int, const RooAbsReal *> > leaves_;
+        mutable std::vector<unsigned int> outputs_;
+        mutable std::vector<Double_t> regs_, values_;
+        mutable std::map<const RooAbsArg *, unsigned int> nodes_;
+        /// the variables folded as constants with their values, and the floating ones
+        mutable std::vector<std::pair<const RooRealVar *, double> > frozen_;
+        mutable std::vector<const RooRealVar *> floating_;
+        /// compile all the coefficients, and fold the constants
+        void build_() const ;
+        /// true if the constant flags and the values of the variables are still those the program was built for
+        bool upToDate_() const ;
+        unsigned int compile_(const RooAbsReal *node) const ;
+        /// true if the value of the node only depends on constants (adding the variables to frozen_ if so)
+        bool freeze_(const RooAbsReal *node) const ;
+        /// execute at setup the instructions whose inputs are all constant
+        void foldConstants_() const ;
+        /// register with constant times the product of the factors (no instruction for a single factor)
+        unsigned int product_(const std::vector<unsigned int> &factors, double constant) const ;
+        unsigned int newReg_(double init = 0.) const { regs_.push_back(init); return regs_.size()-1; }
+        void emit_(OpCode op, unsigned int out, unsigned int a, unsigned int b = 0, unsigned int c = 0, double k1 = 0, double k2 = 0) const {
+            Instr ins = { op, out, a, b, c, k1, k2 }; code_.push_back(ins);
+        }
+        static void exec_(const Instr &ins, Double_t *regs) ;
+};
+
+/// The fast Gaussian and Poisson constraints of a CachingSimNLL, evaluated together from contiguous arrays (SIMNLL_CONSTRAINT_BLOCK):
+/// x and mean of all the terms are read in one pass, then the log-pdfs plus their zero points are computed in a second
+/// one without going through the constraint objects. The terms whose x or mean is not a RooRealVar or a RooConstVar
+/// are left out, and evaluated as before with getLogValFast.
+class ConstraintBlock {
+    public:
+        ConstraintBlock(const std::vector<SimpleGaussianConstraint *> &gaussians, const std::vector<SimplePoissonConstraint *> &poissons) ;
+        /// number of terms in the block
+        unsigned int size() const { return gaussX_.size() + poisX_.size(); }
+        /// true if the i-th gaussian (poisson) passed to the constructor is in the block
+        bool hasGaussian(unsigned int i) const { return gaussIn_[i]; }
+        bool hasPoisson(unsigned int i) const { return poisIn_[i]; }
+        /// set the zero points, in the order of the constraints passed to the constructor
+        void setZeroPoints(const std::vector<double> &gaussians, const std::vector<double> &poissons) ;
+        /// sum of the log-pdfs plus the zero points of the terms in the block
+        double eval() const ;
+    private:
+        std::vector<const RooAbsReal *> gaussX_, gaussMean_, poisX_, poisMean_;
+        std::vector<unsigned int> gaussIndex_, poisIndex_;
+        std::vector<double> gaussScale_, gaussZero_, poisLogGamma_, poisZero_;
+        std::vector<char> gaussIn_, poisIn_;
+        mutable std::vector<Double_t> xVals_, meanVals_, values_;
+};
+
 class CachingAddNLL : public RooAbsReal {
     public:
         CachingAddNLL(const char *name, const char *title, RooAbsPdf *pdf, RooAbsData *data, bool includeZeroWeights = false) ;
@@ -118,6 +360,12 @@ class CachingAddNLL : public RooAbsReal {
         virtual Bool_t isDerived() const { return kTRUE; }
         virtual Double_t defaultErrorLevel() const { return 0.5; }
         void setData(const RooAbsData &data) ;
+        /// replace only the weights of the entries of the current dataset, keeping the pdf caches (e.g. for binned toys).
+        /// weights are in the order of the entries that were kept by setData (those with non-zero weight, or all of them if
+        /// zero weights are included); returns false and changes nothing if n != numWeights().
+        /// note: the weights stored in the RooAbsData itself are not updated
+        bool setWeights(const double *weights, unsigned int n) ;
+        unsigned int numWeights() const { return weights_.size(); }
         virtual RooArgSet* getObservables(const RooArgSet* depList, Bool_t valueOnly = kTRUE) const ;
         virtual RooArgSet* getParameters(const RooArgSet* depList, Bool_t stripDisconnected = kTRUE) const ;
         double  sumWeights() const { return sumWeights_; }
@@ -126,29 +374,124 @@ class CachingAddNLL : public RooAbsReal {
         void clearZeroPoint() ;
         void clearConstantZeroPoint() ;
         void updateZeroPoint() { clearZeroPoint(); setZeroPoint(); }
+        /// value this NLL would have for a saturated model (a histogram of the data itself, normalized to the observed yield), 
+        /// with the same zero points; returns false if the data is not binned with at most one entry per bin of the observables
+        bool saturatedNll(double &ret) const ;
+        /// expected yield of each entry of the current dataset (in the order of setWeights) at the current values of the parameters,
+        /// from the same cached pdf values and coefficients as the NLL, i.e. the weights of the Asimov dataset. Returns false if the
+        /// entries are not all the bins of the observables, one each (unbinned data, or empty bins left out), or for RooRealSumPdf
+        /// channels and fine binning
+        bool expectedWeights(std::vector<Double_t> &out) const ;
         /// note: setIncludeZeroWeights(true) won't have effect unless you also re-call setData
         virtual void  setIncludeZeroWeights(bool includeZeroWeights) ;
         RooSetProxy & params() { return params_; }
+        /// true if the value can change also through discrete indices (e.g. RooMultiPdf), which are not in params()
+        bool hasDiscreteParams() const { return !multiPdfs_.empty(); }
+        /// add to grad[i] the derivative of this NLL with respect to params[i], for each i in which
+        void addGradient(const std::vector<RooRealVar *> &params, const std::vector<unsigned int> &which, double *grad) const ;
+        /// true if the pdfs are evaluated on a fine binning of the unbinned dataset instead of on its entries (ADDNLL_FINEBINNING)
+        bool fineBinned() const { return fineData_.get() != 0; }
+        /// nll with the entries of the unbinned dataset at the current values of the parameters, which for fineBinned()
+        /// means evaluating it once without the binning (and then going back to it)
+        double exactNll() ;
+        /// add the memory held by this channel to out; the datasets and the RooFit objects are estimates
+        /// (one double per observable and entry, size of each object plus its links to the servers)
+        void memoryFootprint(MemoryFootprint &out) const ;
+        /// reallocate the data, the cached values, the working arrays and the templates of the channel from the calling
+        /// thread, so that with first-touch NUMA placement they are on the node of the thread that evaluates it
+        void localize() ;
     private:
         void setup_();
         void addPdfs_(RooAddPdf *addpdf, bool recursive, const RooArgList & basecoeffs) ;
+        /// protect the bins [begin, end) of the partial sums against underflows before taking the log; returns false for a fast exit
+        bool checkPartialSum_(unsigned int begin, unsigned int end, double &ret) const ;
         RooAbsPdf *pdf_;
         RooSetProxy params_;
         const RooAbsData *data_;
+        /// fine binning approximation (ADDNLL_FINEBINNING=<bins>): originalData_ is the dataset given to setData, fineData_
+        /// the centres of the bins weighted by the events in them, or with ADDNLL_FINEBINNING_SIMPSON the centres then the
+        /// edges of the bins, all with unit weight, and the events in each bin in fineCounts_
+        const RooAbsData *originalData_;
+        std::auto_ptr<RooDataSet> fineData_;
+        std::vector<Double_t> fineCounts_;
+        bool fineBinningOff_;
+        /// make fineData_ for this dataset, if it's to be binned; returns false otherwise
+        bool makeFineData_(const RooAbsData &data) ;
+        /// with ADDNLL_MERGE_IDENTICAL=<min entries>, the unbinned dataset with the entries of identical values of all
+        /// the observables merged into one, weighted by the sum of their weights; made by makeMergedData_ if it has fewer
+        /// entries than the original one (returns false otherwise)
+        std::auto_ptr<RooDataSet> mergedData_;
+        bool makeMergedData_(const RooAbsData &data) ;
+        void setData_(const RooAbsData &data) ;
+        /// values of the observables of data_, made once by setData and shared by the pdfs (through DataColumns::find)
+        std::auto_ptr<DataColumns> columns_;
         std::vector<Double_t>  weights_, binWidths_;
         double               sumWeights_;
         bool includeZeroWeights_;
         mutable std::vector<RooAbsReal*> coeffs_;
+        /// coefficients evaluated together, if ADDNLL_NORMBLOCK is set
+        std::auto_ptr<NormalizationBlock> normBlock_;
+        /// all coefficients flattened into one program, if ADDNLL_COEFF_PROGRAM is set (takes precedence over normBlock_)
+        std::auto_ptr<CoefficientProgram> coeffProgram_;
         mutable boost::ptr_vector<CachingPdfBase>  pdfs_;
         mutable boost::ptr_vector<RooAbsReal>  prods_;
         mutable std::vector<RooAbsReal*> integrals_;
         mutable std::vector<std::pair<const RooMultiPdf*,CachingPdfBase*> > multiPdfs_;
-        mutable std::vector<Double_t> partialSum_;
-        mutable std::vector<Double_t> workingArea_;
+        /// per-entry working arrays: the partial sums of the pdfs times their coefficients, the work area of the reduction,
+        /// then the MC statistical variances and the arrays of the gradient, only if they are used
+        enum { PartialSum = 0, WorkingArea, MCStatVar, GradSum, GradWork };
+        mutable ScratchArena scratch_;
         mutable bool isRooRealSum_, fastExit_;
+        /// sum, check and reduce in blocks of bins that stay in cache (ADDNLL_FUSED)
+        mutable bool fused_;
+        mutable std::vector<Double_t> fusedCoeffs_;
+        mutable std::vector<const Double_t *> fusedVals_;
         mutable int canBasicIntegrals_, basicIntegrals_;
+        /// processes whose integral from the bins didn't match the RooFit one at the first evaluation, and keep using that
+        mutable std::vector<char> badBasicIntegral_;
         double zeroPoint_; 
         double constantZeroPoint_; // this is arbitrary and kept constant for all the lifetime of the PDF
+        // for the gradient: which coefficients and pdfs depend on each parameter
+        struct GradDeps { std::vector<unsigned int> coeffs, pdfs; };
+        const GradDeps & gradDeps_(const RooRealVar &param) const ;
+        double numericDerivative_(RooRealVar &param) const ;
+        mutable std::map<const RooAbsArg *, GradDeps> gradDepsCache_;
+        mutable std::vector<Double_t> gradPdfWork_;
+        // ADDNLL_COST_REPORT entries for the channel and for each of the pdfs_, made on the first evaluation
+        mutable CostReport::Entry *costChannel_;
+        mutable std::vector<CostReport::Entry *> costPdfs_;
+        void setupCostReport_() const ;
+        // Barlow-Beeston lite, for templates made with text2workspace --mc-stat-lite: relative MC statistical uncertainty
+        // of each pdf in each bin of its template, the same multiplied by the bin width for each data entry, and the bin widths
+        std::vector<std::vector<Double_t> > mcStatRelErr_, mcStatScale_;
+        std::vector<Double_t> mcStatWidths_;
+        void setupMCStat_() ;
+        /// nll of one nuisance per bin scaling its total expectation, each minimized analytically
+        double mcStatNll_() const ;
+        /// add the extended term, the corrections of the multipdfs and the zero point to the nll of the entries
+        double finishNll_(double ret, double sumCoeff) const ;
+        /// the nll of the entries evaluated by a BinnedOffload backend (ADDNLL_OFFLOAD), for channels made only of FastVerticalInterpHistPdf2;
+        /// offloadState_ is 0 if not yet set up for the current data, +1 if in use, -1 if not used
+        mutable std::auto_ptr<BinnedOffload> offload_;
+        mutable int offloadState_;
+        mutable std::vector<Double_t> offloadCoeffs_;
+        void setupOffload_() const ;
+        /// false if the backend can't do this point (underflows), and the evaluation has to be done here
+        bool evaluateOffload_(double &ret) const ;
+        /// the same for a ChannelKernel compiled for the number of processes of the channel (ADDNLL_KERNELS),
+        /// if the offload backend is not in use; kernelState_ as offloadState_
+        mutable std::auto_ptr<ChannelKernel> kernel_;
+        mutable int kernelState_;
+        void setupKernel_() const ;
+        bool evaluateKernel_(double &ret) const ;
+        /// the coefficients of the pdfs as in evaluate(), into offloadCoeffs_; returns their sum
+        double packedCoeffs_() const ;
+        /// the FastVerticalInterpHistPdf2 of all the pdfs, or false if the channel can't be evaluated from packed templates
+        bool packablePdfs_(std::vector<const FastVerticalInterpHistPdf2 *> &hpdfs) const ;
+        /// bin volume of each entry for expectedWeights, found at its first call for the current data; asimovState_ as offloadState_
+        mutable std::vector<Double_t> asimovVolumes_;
+        mutable int asimovState_;
+        void setupAsimovVolumes_() const ;
 };
 
 class CachingSimNLL  : public RooAbsReal {
@@ -161,6 +504,23 @@ class CachingSimNLL  : public RooAbsReal {
         virtual Bool_t isDerived() const { return kTRUE; }
         virtual Double_t defaultErrorLevel() const { return 0.5; }
         void setData(const RooAbsData &data) ;
+        /// weights-only update of all channels, as CachingAddNLL::setWeights: the weights of the channels are concatenated
+        /// in the order of weightsLayout(); returns false and changes nothing if the layout doesn't match, in which case setData is needed
+        bool setWeights(const double *weights, unsigned int n) ;
+        /// number of weights of each channel (zero for channels without a pdf) in the current data
+        void weightsLayout(std::vector<unsigned int> &sizes) const ;
+        /// expected yields of all the channels at the current values of the parameters (CachingAddNLL::expectedWeights), in the
+        /// order of weightsLayout(); returns false if some channel can't do them
+        bool expectedWeights(std::vector<double> &out) const ;
+        /// a new dataset of the observables (with the category of the channels) and weightVar, with the entries of the current data
+        /// weighted by their expected yields: the same as SimPdfGenInfo::generateAsimov at the current values of the parameters,
+        /// from the cached templates of the NLL. Returns 0 if some channel can't do its expected yields
+        RooDataSet * asimovDataset(const RooArgSet &observables, RooRealVar &weightVar) const ;
+        /// print, for the channels evaluated on a fine binning of their unbinned data (ADDNLL_FINEBINNING), the difference
+        /// between their nll and the one with the unbinned data at the current values of the parameters (e.g. at the best fit)
+        void reportFineBinning() ;
+        /// print the memory held by each channel, split by kind, and the N largest pieces (done at the end of the setup with SIMNLL_MEMORY_REPORT=N)
+        void reportMemory() const ;
         virtual RooArgSet* getObservables(const RooArgSet* depList, Bool_t valueOnly = kTRUE) const ;
         virtual RooArgSet* getParameters(const RooArgSet* depList, Bool_t stripDisconnected = kTRUE) const ;
         void splitWithWeights(const RooAbsData &data, const RooAbsCategory& splitCat, Bool_t createEmptyDataSets) ;
@@ -169,13 +529,62 @@ class CachingSimNLL  : public RooAbsReal {
         void clearZeroPoint() ;
         void clearConstantZeroPoint() ;
         void updateZeroPoint() { clearZeroPoint(); setZeroPoint(); }
+        /// minimum of the NLL of the saturated model, in closed form: the saturated term of each channel, plus each constraint at its maximum.
+        /// returns false if it can't be done (unbinned channels, masks, or constraints other than the fast gaussian and poisson ones)
+        bool saturatedNll(double &ret) const ;
         static void forceUnoptimizedConstraints() { optimizeContraints_ = false; }
+        /// With SIMNLL_LAZY_CHANNELS the channel NLLs are built only when first evaluated while not masked
+        /// (and, if it's 2, deleted again when they're found masked); what needs all of them (e.g. setWeights) builds them.
         void setChannelMasks(RooArgList const& args);
+        /// changes every time the data or the zero points change, so that values of the NLL kept outside (e.g. by
+        /// RooMinimizerFcnOpt with MINIMIZER_MEMO) can be dropped; the parameters, masks included, are to be checked apart
+        unsigned long stateId() const { return stateId_; }
+        /// different for each object and each dataset it is given (setData, setWeights), and never reused by another object,
+        /// so that what is kept outside for one NLL and dataset (e.g. by CascadeMinimizer) is not taken for another one
+        unsigned long dataId() const { return dataId_; }
+        /// Compute the gradient of the NLL with respect to params. 
+        /// Derivatives are analytic for the main binned ingredients (RooAddPdf channels of FastVerticalInterpHistPdf2, 
+        /// ProcessNormalization and AsymPow coefficients, SimpleGaussianConstraint terms), 
+        /// and are computed with finite differences on the single component otherwise.
+        void gradient(const std::vector<RooRealVar *> &params, std::vector<double> &grad) const ;
+        /// Same, with central finite differences only, perturbing at once all the parameters that have no channel or
+        /// constraint term in common (a greedy colouring of the parameters, made when params change): each of them reads
+        /// its difference from the partial NLLs of its own terms, so the cost is two evaluations of the terms touched
+        /// per colour instead of two full evaluations per parameter.
+        void coloredGradient(const std::vector<RooRealVar *> &params, std::vector<double> &grad) const ;
+        /// Matrix of the second derivatives of the NLL with respect to params (n x n, by rows), with finite differences on
+        /// the single channel and constraint terms: only the pairs of parameters entering a common term are computed, all
+        /// the parameters of a pair of colours (as in coloredGradient) at once, and the jobs of the different pairs are
+        /// spread over nThreads threads, each with its own NLLEvalContext. Returns false if some parameter is at one of
+        /// its boundaries or the clones don't match this NLL.
+        bool hessian(const std::vector<RooRealVar *> &params, std::vector<double> &hess, unsigned int nThreads = 1) const ;
+        /// Group the floating parameters into blocks that don't share any channel or generic constraint term,
+        /// so that changing the parameters of one block doesn't affect the NLL minimum in the others.
+        void parameterBlocks(std::vector<std::vector<std::string> > &blocks) const ;
+        /// Floating parameters with a SimpleGaussianConstraint that enter the channels only through ProcessNormalization terms,
+        /// so that the NLL is smooth and nearly quadratic in each of them
+        void rateOnlyParameters(std::vector<std::string> &names) const ;
         friend class CachingAddNLL;
+        friend class NLLEvalContext;
         // trap this call, since we don't care about propagating it to the sub-components
         virtual void constOptimizeTestStatistic(ConstOpCode opcode, Bool_t doAlsoTrackingOpt=kTRUE) { }
     private:
         void setup_();
+        bool channelsShareBranchNodes_() const ;
+        void setupChannelIndex_() ;
+        void findDirtyChannels_() const ;
+        void invalidateChannelIndex_() { channelIndexValid_ = false; ++stateId_; }
+        /// the NLL of channel ib, built now if it's lazy; 0 if the channel has no pdf
+        CachingAddNLL * channel_(unsigned int ib) const ;
+        void buildAllChannels_() const ;
+        /// the channels whose entries of zero weight are kept by splitWithWeights; returns true if there are any
+        bool zeroWeightChannels_(std::vector<int> &includeZeroWeights) const ;
+        /// setData by setWeights (SIMNLL_WEIGHTS_ONLY_DATA), if the entries of data that splitWithWeights would keep are at the
+        /// same points as the current ones in all the channels; returns false and changes nothing otherwise
+        bool setWeightsFromData_(const RooAbsData &data) ;
+        /// the pdf and the parameters of channel ib, without building it
+        const RooAbsPdf * channelPdf_(unsigned int ib) const { return pdfs_[ib] ? pdfs_[ib]->pdf() : lazyPdfs_[ib]; }
+        void channelParams_(unsigned int ib, RooArgSet &params) const ;
         RooSimultaneous   *pdfOriginal_;
         const RooAbsData  *dataOriginal_;
         const RooArgSet   *nuis_;
@@ -187,16 +596,80 @@ class CachingSimNLL  : public RooAbsReal {
         std::vector<bool>                        constrainPdfsFastOwned_;
         std::vector<SimplePoissonConstraint *>   constrainPdfsFastPoisson_;
         std::vector<bool>                        constrainPdfsFastPoissonOwned_;
-        std::vector<CachingAddNLL*>     pdfs_;
+        mutable std::vector<CachingAddNLL*> pdfs_;
         std::auto_ptr<TList>            dataSets_;
         std::vector<RooDataSet *>       datasets_;
         static bool noDeepLEE_;
-        static bool hasError_;
+        static thread_local bool hasError_;
         static bool optimizeContraints_;
         std::vector<double> constrainZeroPoints_;
         std::vector<double> constrainZeroPointsFast_;
         std::vector<double> constrainZeroPointsFastPoisson_;
+        // opt-in evaluation of the fast constraints from contiguous arrays (--X-rtd SIMNLL_CONSTRAINT_BLOCK)
+        std::auto_ptr<ConstraintBlock>    constraintBlock_;
         std::vector<RooAbsReal*> channelMasks_;
+        // opt-in lazy construction of the channel NLLs (--X-rtd SIMNLL_LAZY_CHANNELS=1, or 2 to delete them again when masked)
+        int                               lazyChannels_;
+        std::vector<RooAbsPdf *>          lazyPdfs_;
+        std::vector<std::string>          lazyLabels_;
+        std::vector<char>                 lazyIncludeZeroWeights_;
+        // zero point state, to apply to the channels built later
+        bool                              zeroPointSet_, constantZeroPointCleared_;
+        // opt-in parallel evaluation of the channels on the global pool (--X-rtd SIMNLL_THREADS=N, at most --threads)
+        ThreadPool                       *threadPool_;
+        unsigned int                      nThreads_;
+        // channels already moved to the memory of the thread that evaluates them, if the threads are pinned (--pinThreads)
+        mutable std::vector<char>         channelLocal_;
+        mutable std::vector<unsigned int> activeChannels_;
+        // opt-in parameter -> channel index, to re-evaluate only the channels whose parameters changed (--X-rtd SIMNLL_CHANNEL_INDEX)
+        bool                                   channelIndex_;
+        mutable bool                           channelIndexValid_;
+        std::vector<RooRealVar *>              indexedParams_;
+        mutable std::vector<double>            indexedParamVals_;
+        std::vector<std::vector<unsigned int> > paramChannels_;
+        std::vector<unsigned int>              alwaysDirtyChannels_;
+        mutable std::vector<char>              channelDirty_;
+        mutable std::vector<double>            channelCachedNLLs_;
+        unsigned long                          stateId_, dataId_;
+        // for the gradient: which parameters each channel and generic constraint depend on
+        void setupGradient_(const std::vector<RooRealVar *> &params) const ;
+        mutable std::vector<RooRealVar *>               gradParams_;
+        mutable std::vector<std::vector<unsigned int> > gradChannelParams_;
+        mutable std::vector<std::vector<unsigned int> > gradConstrainParams_, gradConstrainFastParams_, gradConstrainFastPoissonParams_;
+        // for coloredGradient: the parameters of each colour, and the terms it touches with the parameter touching each,
+        // the terms being numbered as the channels, then the generic, fast gaussian and fast poisson constraints
+        void setupColoring_() const ;
+        double termNll_(unsigned int term) const ;
+        mutable std::vector<std::vector<unsigned int> > gradColorParams_;
+        mutable std::vector<std::vector<std::pair<unsigned int, unsigned int> > > gradColorTerms_;
+        mutable std::vector<double> gradX0_, gradXlo_, gradXhi_, gradTermHi_, gradTermLo_;
+};
+
+// Part four: independent copies of a CachingSimNLL, to evaluate the same model at different points in different threads
+/// An evaluation context owns a deep clone of the pdf of a CachingSimNLL, with its own parameters, and a CachingSimNLL
+/// built on it, with its own caches and working areas; only the data is shared, and only read.
+/// Different contexts (and the original) can then be evaluated at the same time from different threads, as long as each
+/// context is used by one thread at a time. Build the contexts in a single thread, when the original NLL is not being used.
+/// Note that RooFit's own bookkeeping of evaluation errors is global, so SIMNLL_NO_LEE is recommended with threads.
+class NLLEvalContext {
+    public:
+        explicit NLLEvalContext(const CachingSimNLL &nll) ;
+        ~NLLEvalContext() ;
+        /// the NLL of this context, depending only on params()
+        CachingSimNLL & nll() { return *nll_; }
+        /// all the parameters of this context, as clones of those of the original NLL with the same names
+        const RooArgSet & params() const { return *params_; }
+        /// the parameter of this context with this name, or 0 if there's none
+        RooRealVar * param(const char *name) const ;
+        /// copy values and constant flags of the parameters with the same names from other (e.g. the original, or a snapshot)
+        void setValues(const RooAbsCollection &other) ;
+        double getVal() { return nll_->getVal(); }
+    private:
+        std::auto_ptr<RooArgSet> nodes_;   // owns the clone of the pdf
+        std::auto_ptr<RooArgSet> params_, nuis_;
+        std::auto_ptr<CachingSimNLL> nll_;
+        NLLEvalContext(const NLLEvalContext &) ;
+        NLLEvalContext & operator=(const NLLEvalContext &) ;
 };
 
 }
@@ -9,6 +9,9 @@ class RooRealVar;
 #include <RooSetProxy.h>
 #include "HiggsAnalysis/CombinedLimit/interface/RooMinimizerOpt.h"
 #include <boost/program_options.hpp>
+#include <map>
+#include <string>
+#include <vector>
 
 class CascadeMinimizer {
     public:
@@ -35,7 +38,33 @@ class CascadeMinimizer {
         //void collectIrrelevantNuisances(RooAbsCollection &irrelevant) const ;
         void setAutoBounds(const RooArgSet *pois) ; 
         void setAutoMax(const RooArgSet *pois) ; 
+        /// cost of the last fit done with minimize or improve, plus the hesse and minos run after it through this class;
+        /// fcnCalls counts the calls of all of them, minimizeCalls and timePerCall only those of the minimization
+        struct Telemetry {
+            Int_t   fcnCalls, minimizeCalls, fallbacks, status;
+            Float_t edm, minimizeTime, hesseTime, minosTime, timePerCall;
+        };
+        static const Telemetry & telemetry() { return telemetry_; }
+        /// add the fit_* branches of telemetry() to the output tree, if --saveFitTelemetry was given
+        static void addTelemetryBranches() ;
     private:
+        /// accounts a minimize or improve (only the outermost one, if nested), a hesse or a minos in telemetry_
+        class TelemetryScope {
+            public:
+                enum Phase { Minimize, Hesse, Minos };
+                TelemetryScope(CascadeMinimizer &cmin, Phase phase) ;
+                ~TelemetryScope() ;
+                void setStatus(bool ok) { ok_ = ok; }
+            private:
+                CascadeMinimizer &cmin_;
+                Phase phase_;
+                bool outer_, ok_;
+                unsigned long evals_;
+                double start_;
+        };
+        static bool saveTelemetry_;
+        static Telemetry telemetry_;
+        static int telemetryDepth_;
         RooAbsReal & nll_;
         std::auto_ptr<RooMinimizerOpt> minimizer_;
         Mode         mode_;
@@ -47,10 +76,17 @@ class CascadeMinimizer {
         const RooArgSet *poisForAutoBounds_, *poisForAutoMax_;
 
         bool improveOnce(int verbose, bool noHesse=false);
+        /// run the nominal configuration, the fallbacks and the jittered starts in forked processes, and keep the best valid minimum
+        bool improveInParallel(int verbose);
+        /// run the nominal configuration and the fallbacks in the order of their expected cost from the fits done so far (--cminAdaptive)
+        bool improveAdaptive(int verbose);
         bool autoBoundsOk(int verbose) ;
 
 	bool multipleMinimize(const RooArgSet &,bool &,double &,int,bool,int
 		,std::vector<std::vector<bool> > & );
+        /// fit the given combinations of the discrete indices in forked processes, updating the best one as multipleMinimize does
+        bool multipleMinimizeInParallel(const std::vector<std::vector<int> > &, RooArgSet &, RooArgSet &, const RooArgSet &, 
+                                        std::vector<int> &, bool &, double &, int, bool, int, std::vector<std::vector<bool> > &);
        
         bool iterativeMinimize(double &,int,bool); 
         /// options configured from command line
@@ -65,6 +101,25 @@ class CascadeMinimizer {
         };
         /// list of algorithms to run if the default one fails
         static std::vector<Algo> fallbacks_;
+        /// if > 1, run the fallbacks concurrently in up to this many processes instead of one after the other
+        static int parallelStarts_;
+        /// try first the configurations that needed the fewest calls per successful fit so far in this job, and every
+        /// adaptiveReprobe_ fits the configured order again, so that the nominal one is measured anew
+        static bool adaptive_;
+        static int adaptiveReprobe_;
+        /// the fits of each configuration (algorithm, tolerance, strategy) in this job, for the adaptive mode
+        struct AdaptiveStats {
+            AdaptiveStats() : tries(0), successes(0), calls(0) {}
+            unsigned long tries, successes, calls;
+            /// calls per attempt over the success rate (with one success and one failure more), infinite if never tried
+            double cost() const ;
+        };
+        static std::map<std::string, AdaptiveStats> adaptiveStats_;
+        static unsigned long adaptiveFits_;
+        /// number of additional starting points, jittered around the initial one, to try in the parallel mode
+        static int jitteredStarts_;
+        /// width of the jitter, in units of the parameter uncertainty (or 1 if it's not known)
+        static float jitterWidth_;
         /// do a pre-scan
         static bool preScan_;
         /// do a pre-fit (with larger tolerance)
@@ -89,6 +144,37 @@ class CascadeMinimizer {
         static int minuit2StorageLevel_;
 
 	static double discreteMinTol_;
+        /// if > 1, fit the combinations of discrete indices in up to this many processes at the same time
+        static int discreteForks_;
+        /// if > 0, the scans of the discrete indices skip the pdfs whose NLL was more than this above the best one in the
+        /// last scan that fitted them (--cminDiscretePruneDeltaNLL); all of them are fitted in the first minimization, every
+        /// discretePruneRecheck_ ones, and again at any point that becomes the best one found so far without some of them
+        /// among the minimizations with the same floating parameters (e.g. the points of a scan, apart from the fit where
+        /// the POIs float too). Only for a CachingSimNLL, and for as long as it has the same data
+        static double discretePruneDeltaNLL_;
+        static int discretePruneRecheck_;
+        /// what the pruning keeps from one minimization to the next (e.g. the points of a scan), for the NLL and data of dataId
+        struct DiscretePruning {
+            DiscretePruning() : dataId(0), calls(0), fullCheck(true), pruned(0) {}
+            unsigned long dataId;
+            unsigned long calls;
+            /// the best NLL for each set of floating parameters (a hash of their names)
+            std::map<std::size_t, double> bestNLL;
+            bool fullCheck;
+            int pruned;
+            /// for each category and each of its pdfs, the NLL above the best one in the last scan that fitted it (NaN if none)
+            std::vector<std::vector<double> > deltaNLL;
+            /// the indices at the start of the current scan, and the NLL of each pdf fitted in it with the others at the start
+            std::vector<int> start;
+            std::vector<std::vector<double> > pass;
+        };
+        static DiscretePruning discretePruning_;
+        /// at the start of a scan of the indices in mode 0: mark the pdfs to skip as not contributing
+        void startDiscretePass_(const std::vector<int> &start, const std::vector<int> &sizes, std::vector<std::vector<bool> > &contributing) ;
+        /// the NLL of a combination fitted in the scan (only those with at most one index moved from the start are kept)
+        void noteDiscreteNLL_(const std::vector<int> &combo, double nll) ;
+        /// at the end of the scan, the pdfs it fitted get their new NLL above the best one
+        void endDiscretePass_() ;
 
 	static std::string defaultMinimizerType_;
 	static std::string defaultMinimizerAlgo_;
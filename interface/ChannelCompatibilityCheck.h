@@ -27,6 +27,10 @@ protected:
 
   static bool runMinos_;
   static bool saveFitResult_;
+  /// run the nominal fit in a forked process, at the same time as the freeform one
+  static bool parallelFits_;
+  /// start the freeform fit from the nominal one, with all the per-channel POIs at the common value
+  static bool warmStart_;
 
   static std::vector<std::string> groups_;
 
@@ -0,0 +1,55 @@
+#ifndef HiggsAnalysis_CombinedLimit_ChannelKernel_h
+#define HiggsAnalysis_CombinedLimit_ChannelKernel_h
+/** \class cacheutils::ChannelKernel
+ *
+ * Evaluation of the binned part of the NLL of a channel made only of FastVerticalInterpHistPdf2 (ADDNLL_KERNELS), in one
+ * function compiled for each number of processes up to MaxProcesses (as RooBernsteinFast<N> is for each order): the
+ * morphing of all the templates, their normalization, the sum over the processes and the logs, on the arrays packed by
+ * BinnedChannelData and without the virtual calls of the CachingPdfs of each process.
+ * The morphs of a process are added to its template a few at a time, with their number also known at compile time.
+ */
+#include <vector>
+#include <Rtypes.h>
+
+class RooAbsReal;
+class RooAbsData;
+class FastVerticalInterpHistPdf2;
+
+namespace cacheutils {
+struct BinnedChannelData;
+class ChannelKernel {
+    public:
+        enum { MaxProcesses = 8 };
+        /// returns 0 if the channel can't be packed (see BinnedChannelData::fill), or has more than MaxProcesses processes
+        static ChannelKernel * create(const std::vector<const FastVerticalInterpHistPdf2 *> &pdfs, const RooAbsData &data, bool includeZeroWeights, const std::vector<Double_t> &weights) ;
+        virtual ~ChannelKernel() ;
+        /// replace the weights, in the same order as those passed to create()
+        void setWeights(const std::vector<Double_t> &weights) ;
+        /// nll = sum_i w_i log(S_i/sumCoeff) for the current values of the morphing parameters and these coefficients;
+        /// returns false if some S_i is not positive, in which case the caller has to evaluate the channel itself
+        virtual bool evaluate(const double *coeffs, double sumCoeff, double &nll) const = 0;
+        /// memory held by the packed templates and the working arrays
+        std::size_t bytes() const ;
+    protected:
+        ChannelKernel(const BinnedChannelData &data) ;
+        /// morph, exponentiate or crop, and normalize the template of a process into templ_[p], returning its normalization;
+        /// nothing is done if the morphing parameters of the process are the same as for the last call
+        double morph_(unsigned int p) const ;
+        unsigned int nbins_, nentries_;
+        /// true if the entries are the bins in order, so that there's nothing to look up
+        bool identity_;
+        std::vector<double> binWidths_, weights_, smoothRegion_, nominal_, morphSum_, morphDiff_;
+        std::vector<int> smoothAlgo_;
+        std::vector<unsigned int> entryBins_, morphBegin_, morphParam_;
+        std::vector<const RooAbsReal *> params_;
+        mutable std::vector<double> paramVals_, templ_;
+        /// the value of the parameter of each morph for the last templ_ of its process, and the normalizations of templ_
+        mutable std::vector<double> morphedVals_, morphedNorms_;
+        mutable std::vector<char> morphed_;
+    private:
+        ChannelKernel(const ChannelKernel &other) ;
+        ChannelKernel & operator=(const ChannelKernel &other) ;
+};
+}
+
+#endif
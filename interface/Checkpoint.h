@@ -0,0 +1,49 @@
+#ifndef HiggsAnalysis_CombinedLimit_Checkpoint_h
+#define HiggsAnalysis_CombinedLimit_Checkpoint_h
+/** \class Checkpoint
+ *
+ * Side file with the partial results of a long job (combine --checkpoint), so that with --resume a job that was
+ * killed continues from where it stopped instead of starting again: HybridNew saves each batch of toys,
+ * MarkovChainMC each chain, and MultiDimFit each point of the grid.
+ *
+ * The file is a sequence of records, each with the name of the algorithm, a key (e.g. the point), a payload and the
+ * state of the RooRandom generator after it, so that once the saved results are used up the job draws the same
+ * random numbers it would have drawn without the interruption (this is not done for --counterRNG, whose numbers
+ * depend only on the toy and stream).
+ * Each record is added with a single write at the end of the file, and a record that was being written when the
+ * job was killed is ignored. Numbers are stored in the native byte order.
+ */
+#include <string>
+#include <vector>
+
+class TObject;
+class TClass;
+
+class Checkpoint {
+    public:
+        struct Record {
+            std::string key;
+            std::vector<char> payload, random;
+        };
+        /// use this file; without resume, a file left by a previous job is removed
+        static void setup(const std::string &fileName, bool resume) ;
+        /// true if there is a checkpoint file
+        static bool enabled() { return !fileName_.empty(); }
+        /// true if the records already in the file are to be used
+        static bool resuming() { return resume_; }
+        /// append a record for the algorithm what
+        static void save(const std::string &what, const std::string &key, const std::vector<char> &payload) ;
+        /// append a record with a copy of the object, streamed with ROOT
+        static void save(const std::string &what, const std::string &key, const TObject &object) ;
+        /// all the complete records of the algorithm what, in the order in which they were saved
+        static void load(const std::string &what, std::vector<Record> &records) ;
+        /// object saved in the record, of class cls (the caller owns it), or 0 if it's not one
+        static TObject *object(const Record &record, const TClass *cls) ;
+        /// set the RooRandom generator in the state saved in the record
+        static void restoreRandom(const Record &record) ;
+    private:
+        static std::string fileName_;
+        static bool resume_;
+};
+
+#endif
@@ -1,7 +1,8 @@
 #ifndef HiggsAnalysis_CombinedLimit_CloseCoutSentry_
 #define HiggsAnalysis_CombinedLimit_CloseCoutSentry_
 /** This class redirects cout and cerr to /dev/null when created,
-    and restores them back when destroyed.                        */
+    and restores them back when destroyed.
+    While it's active, the messages of logging (CMB_LOG) are dropped before being formatted. */
 #include <cstdio>
 
 class CloseCoutSentry {
@@ -16,7 +17,7 @@ class CloseCoutSentry {
         static FILE *trueStdOutGlobal();
     private:
         bool silent_;
-        static int fdOut_, fdErr_;
+        static int fdOut_, fdErr_, fdNull_;
         static bool open_;
         // always clear, even if I was not the one closing it
         void static reallyClear() ;
@@ -0,0 +1,53 @@
+#ifndef HiggsAnalysis_CombinedLimit_ColumnarLimits_h
+#define HiggsAnalysis_CombinedLimit_ColumnarLimits_h
+/** \class ColumnarLimitWriter
+ *
+ * Copy of the rows of the limit tree in a columnar binary file (combine --saveColumnarTree), for the aggregation of
+ * large campaigns without opening a ROOT file per job: the rows are kept in memory, one array per branch, and the
+ * whole file is written at the end of the job. python/ColumnarLimits.py reads the files into numpy arrays.
+ *
+ * The file is a single block, so that the files of many jobs can be merged just by concatenating them (cat):
+ *   "CMBLIMT1" { uint32 ncolumns, reserved; uint64 nrows, bytes of text }
+ *   the names of the columns, each terminated by a '\0' (padded with '\0' to 8 bytes)
+ *   ncolumns x { char type[4]; uint32 size of one value, values per row } with the type as in the leaf lists of
+ *   ROOT (D, F, L, l, I, i, S, s, B, b, O)
+ *   for each column, its nrows x values per row values (padded with '\0' to 8 bytes)
+ * all in the native byte order. Branches booked after the first row get zeros in the rows before.
+ */
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+class TTree;
+class TLeaf;
+
+class ColumnarLimitWriter {
+    public:
+        ColumnarLimitWriter(const std::string &fileName) ;
+        /// calls close()
+        ~ColumnarLimitWriter() ;
+        /// add a row with the current content of the leaves of the tree (all booked with a leaf list)
+        void fill(const TTree &tree) ;
+        /// write the file; nothing can be added afterwards
+        void close() ;
+        const std::string & fileName() const { return fileName_; }
+        unsigned long rows() const { return rows_; }
+    private:
+        struct Column {
+            std::string name;
+            char type;
+            uint32_t size, len;
+            const TLeaf *leaf;
+            std::vector<char> data;
+        };
+        std::string fileName_;
+        bool closed_;
+        unsigned long rows_;
+        std::vector<Column> columns_;
+        /// take the leaves of the tree that aren't columns yet
+        void columnsFrom_(const TTree &tree) ;
+        ColumnarLimitWriter(const ColumnarLimitWriter &) ;
+        ColumnarLimitWriter & operator=(const ColumnarLimitWriter &) ;
+};
+
+#endif
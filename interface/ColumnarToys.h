@@ -0,0 +1,95 @@
+#ifndef HiggsAnalysis_CombinedLimit_ColumnarToys_h
+#define HiggsAnalysis_CombinedLimit_ColumnarToys_h
+/** \class ColumnarToyWriter, ColumnarToyReader
+ *
+ * Binary file with the toys of combine --saveToys --saveToysColumnar, read back with --toysFile without going
+ * through ROOT I/O. Instead of one streamed RooDataSet per toy, each toy is stored as its entries split by channel
+ * (the runs of the same value of the category of the dataset): the coordinates of the entries of a binned channel
+ * are the same in every toy and are stored once, so that each toy only adds its weights (a toys x bins matrix),
+ * while the events of an unbinned channel are stored with their coordinates, one toy after the other. The values of
+ * the global observables of all the toys are stored as one toys x observables matrix at the end of the file,
+ * together with the index of the toys. The file is memory mapped when it's read.
+ *
+ * The layout, with all the numbers in the native byte order and the arrays of doubles aligned to 8 bytes, is
+ *   "CMBTOYS1"
+ *   records: { int type, id; unsigned int n, nseg; }, followed by
+ *       for a layout (type 1):  n x ncolumns coordinates
+ *       for a toy (type 2, n = kind of dataset): nseg x { int layout; unsigned int n; [n x ncolumns coordinates if
+ *                               layout = -1] [n weights if the dataset is weighted] }
+ *   footer: { uint64 bytes of text, ntoys, nlayouts, nglobal }, the text with the names of the columns and of the
+ *           global observables (padded to 8 bytes), the ids and offsets of the toys, the offsets of the
+ *           layouts, and the ntoys x nglobal matrix of the global observables (NaN where a toy has none)
+ *   { uint64 offset of the footer } "CMBTOYS1"
+ * The id of a toy is its number in the job, -1 for the asimov dataset.
+ */
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdio>
+#include <stdint.h>
+
+class RooAbsData;
+class RooArgSet;
+class ColumnarToyReader;
+
+class ColumnarToyWriter {
+    public:
+        ColumnarToyWriter(const std::string &fileName) ;
+        /// calls close()
+        ~ColumnarToyWriter() ;
+        /// add the toy, and the values of the global observables if not null
+        void write(int id, const RooAbsData &data, const RooArgSet *globalObs = 0) ;
+        /// add all the toys of another file (e.g. one written by a forked process), in their order
+        void append(const ColumnarToyReader &in) ;
+        /// write the footer and close the file; nothing can be written afterwards
+        void close() ;
+        const std::string & fileName() const { return fileName_; }
+    private:
+        std::string fileName_;
+        FILE *file_;
+        uint64_t offset_;
+        /// names of the observables, with "cat:" or "real:" in front, and of the global observables
+        std::vector<std::string> columns_, globalNames_;
+        /// the column of the category that tells the channels apart, or -1
+        int catColumn_;
+        std::vector<int64_t> ids_;
+        std::vector<uint64_t> toyOffsets_, layoutOffsets_;
+        std::vector<double> globals_;
+        /// for each channel (index of the category), the coordinates of the entries of its layout, and its number
+        std::map<int, std::pair<std::vector<double>, int> > channelLayouts_;
+        void put_(const void *p, std::size_t n) ;
+        void columnsFrom_(const RooAbsData &data) ;
+        /// the layout of a channel with these entries if it has one, otherwise -1, or a new layout if always
+        int layoutFor_(const double *first, const double *last, bool always) ;
+};
+
+class ColumnarToyReader {
+    public:
+        ColumnarToyReader(const std::string &fileName) ;
+        ~ColumnarToyReader() ;
+        /// true if the file is a columnar toy file (i.e. ends with the magic string)
+        static bool isColumnar(const std::string &fileName) ;
+        const std::string & fileName() const { return fileName_; }
+        unsigned int ntoys() const { return index_.size(); }
+        bool has(int id) const { return index_.count(id) != 0; }
+        /// a new dataset (owned by the caller) with the toy, in the variables with the same names from obs; 0 if there's no such toy
+        RooAbsData * get(int id, const RooArgSet &obs) const ;
+        /// set the global observables to the values saved with the toy; false if none were saved
+        bool getGlobalObservables(int id, RooArgSet &globalObs) const ;
+    private:
+        std::string fileName_;
+        const char *data_;
+        std::size_t size_;
+        std::vector<std::string> columns_, globalNames_;
+        unsigned int nglobal_;
+        uint64_t ntoys_, nlayouts_;
+        /// arrays of the footer, in the mapped file
+        const int64_t *ids_;
+        const uint64_t *toyOffsets_, *layoutOffsets_;
+        const double *globals_;
+        /// from the id of each toy to its position in the arrays
+        std::map<int, unsigned int> index_;
+        friend class ColumnarToyWriter;
+};
+
+#endif
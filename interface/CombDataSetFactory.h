@@ -8,6 +8,7 @@
 #include <RooRealVar.h>
 #include <map>
 #include <string>
+#include <vector>
 
 
 //_________________________________________________
@@ -25,6 +26,13 @@ class CombDataSetFactory : public TObject {
       ~CombDataSetFactory() ;
 
       void addSetBin(const char *label, RooDataHist *set);
+      /// bulk import: the weights of the bins of the observable of a one-dimensional binned dataset (in the order of its bins, 
+      /// i.e. like the bin contents of a TH1), filled directly in the combined dataset by done() without making a RooDataHist for the channel.
+      /// sumw2 are the sums of the squared weights of the bins (the squared bin errors of the TH1); if not given, those of
+      /// unit weights, i.e. the weights themselves
+      void addSetBin(const char *label, const double *weights, const double *sumw2, unsigned int n);
+      void addSetBin(const char *label, const std::vector<double> &weights) { addSetBin(label, weights.empty() ? 0 : &weights[0], 0, weights.size()); }
+      void addSetBin(const char *label, const std::vector<double> &weights, const std::vector<double> &sumw2) ;
       void addSetAny(const char *label, RooDataSet  *set);
       void addSetAny(const char *label, RooDataHist *set);
 
@@ -39,6 +47,7 @@ class CombDataSetFactory : public TObject {
         RooRealVar  *weight_;
         std::map<std::string, RooDataHist *> map_;
         std::map<std::string, RooDataSet *> mapUB_;
+        std::map<std::string, std::vector<double> > bulk_, bulkSumw2_;
 };
 
 #endif
@@ -6,12 +6,18 @@
 #include "RooAbsReal.h"
 #include <boost/algorithm/string/split.hpp>
 #include <boost/algorithm/string/classification.hpp>
+#include <mutex>
+#include <vector>
+#include <functional>
 
 class TDirectory;
 class TTree;
 class LimitAlgo;
 class RooWorkspace;
 class RooAbsData;
+class ColumnarToyWriter;
+class ColumnarToyReader;
+class ColumnarLimitWriter;
 namespace RooStats { class ModelConfig; }
 
 extern Float_t t_cpu_, t_real_, g_quantileExpected_; 
@@ -20,6 +26,11 @@ extern bool g_fillTree_;
 extern TDirectory *outputFile;
 extern TDirectory *writeToysHere;
 extern TDirectory *readToysFromHere;
+/// used instead of writeToysHere and readToysFromHere for the toys in a columnar file (--saveToysColumnar)
+extern ColumnarToyWriter *writeColumnarToysHere;
+extern ColumnarToyReader *readColumnarToysFromHere;
+/// if not null, gets a copy of each row of the limit tree (--saveColumnarTree)
+extern ColumnarLimitWriter *writeColumnarLimitsHere;
 extern LimitAlgo * algo, * hintAlgo ;
 extern int verbose;
 extern bool withSystematics;
@@ -40,6 +51,17 @@ public:
   void applyOptions(const boost::program_options::variables_map &vm) ;
   
   void run(TString hlfFile, const std::string &dataset, double &limit, double &limitErr, int &iToy, TTree *tree, int nToys);
+
+  /// A request to the server mode (--server): the algorithm, already configured with the options of the request,
+  /// and the changes to the model for this request only (mass is NaN and the strings empty if not requested)
+  struct ServerRequest {
+    LimitAlgo *algo;
+    float mass;
+    std::string setParameters, setParameterRanges, freezeNuisances;
+  };
+  /// Turns the arguments of a request into a ServerRequest, throwing std::exception if they are not valid
+  typedef std::function<void (const std::vector<std::string> &args, ServerRequest &request)> ServerRequestParser;
+  void setServerRequestParser(const ServerRequestParser &parser) { serverParser_ = parser; }
  
   /// Stop combine from fillint the tree (some algos need control)
   static void toggleGlobalFillTree(bool flag=false);
@@ -49,6 +71,10 @@ public:
 
   /// Add a branch to the output tree (for advanced use or debugging only)
   static void addBranch(const char *name, void *address, const char *leaflist) ;
+
+  /// Lock to be held while writing to the output files, since the toys can be written from a background thread
+  static std::unique_lock<std::mutex> lockOutput() ;
+  static std::mutex & outputMutex() ;
 private:
   bool mklimit(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, double &limit, double &limitErr) ;
  
@@ -89,13 +115,35 @@ private:
   bool makeTempDir_;
   bool rebuildSimPdf_;
   bool optSimPdf_;
+  bool upgradeHistPdfs_;
+  std::string loadChannels_;
   bool noMCbonly_;
   bool noDefaultPrior_;
   bool floatAllNuisances_;
   bool freezeAllGlobalObs_;
   std::vector<std::string> librariesToLoad_;
+  std::string modelCache_;
+  std::string asimovCache_;
+  std::string fcnTrace_;
+  std::string checkpoint_;
+  bool resume_;
+  unsigned int asyncOutput_;
+  unsigned int prefetchToys_;
+  unsigned int toyForks_;
+  unsigned int threads_;
+  std::string massListString_;
+  std::vector<double> massList_;
+  /// compute the result for each mass of --massList in turn, on the same model and data
+  void runMassList_(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, double &limit, double &limitErr) ;
+  std::string server_;
+  ServerRequestParser serverParser_;
+  /// with --server: run the requests read from stdin or from the socket on the same model and data, until 'quit'
+  void serve_(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, double &limit, double &limitErr) ;
   
   static TTree *tree_;
+  /// set in the processes forked by --toyForks, where commitPoint records the branches here instead of filling the tree
+  static std::vector<char> *toyRecord_;
+  void collectForkedToys_(const char *tmpfile, const std::vector<int> &pids, int nToys, unsigned int &nLimits, double &expLimit, std::vector<double> &limitHistory) ;
 
   static std::vector<std::pair<RooAbsReal*,float> > trackedParametersMap_;
   static std::string  trackParametersNameString_;
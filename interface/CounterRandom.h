@@ -0,0 +1,40 @@
+#ifndef HiggsAnalysis_CombinedLimit_CounterRandom_h
+#define HiggsAnalysis_CombinedLimit_CounterRandom_h
+/** Counter-based random number generator (Philox4x32-10, Salmon et al., SC'11).
+    The numbers are a function of the key (the seed) and of a 128-bit counter made of
+    the index of the item (e.g. the toy number), the id of the stream, and the position within the stream.
+    So any stream can be positioned at its beginning at no cost, and every toy can be generated
+    on its own (or in any order, or in parallel) giving always the same numbers.
+    If installed as the RooRandom generator (combine --counterRNG), Combine::run selects for each toy
+    a stream for the global observables and one for the toy itself. */
+#include <TRandom.h>
+#include <RVersion.h>
+
+class CounterRandom : public TRandom {
+    public:
+        enum Stream { ToyStream = 0, GlobalObservablesStream = 1 };
+        explicit CounterRandom(ULong64_t seed = 0) ;
+        virtual ~CounterRandom() {}
+        /// restart from the beginning of the stream for item index
+        void setStream(ULong64_t index, UInt_t stream) ;
+        /// set the key; the stream is reset to (0, 0)
+        virtual void SetSeed(ULong_t seed = 0) ;
+#if ROOT_VERSION_CODE < ROOT_VERSION(6,4,0)
+        virtual Double_t Rndm(Int_t i = 0) ;
+#else
+        virtual Double_t Rndm() ;
+#endif
+        virtual void RndmArray(Int_t n, Float_t *array) ;
+        virtual void RndmArray(Int_t n, Double_t *array) ;
+        /// if the RooRandom generator is a CounterRandom, set it at the beginning of the stream and return true
+        static bool select(ULong64_t index, UInt_t stream) ;
+        /// true if the RooRandom generator is a CounterRandom
+        static bool active() ;
+    private:
+        UInt_t key_[2], counter_[4], block_[4];
+        unsigned int used_;
+        void nextBlock_() ;
+        double next_() { if (used_ == 4) nextBlock_(); return (block_[used_++] + 0.5) * 2.3283064365386963e-10; } // in (0,1), like TRandom3
+};
+
+#endif
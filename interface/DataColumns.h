@@ -0,0 +1,52 @@
+#ifndef HiggsAnalysis_CombinedLimit_DataColumns_h
+#define HiggsAnalysis_CombinedLimit_DataColumns_h
+
+#include <string>
+#include <vector>
+#include <Rtypes.h>
+
+class RooAbsData;
+
+namespace cacheutils {
+/// Columnar copy of the entries of a dataset that a channel uses (those with non-zero weight, or all of them if
+/// includeZeroWeights): one contiguous 64-byte aligned array of values for each RooRealVar observable, plus one of weights.
+/// It is made once by CachingAddNLL::setData and found through find() by all the pdfs of the channel, so that
+/// they don't each go through the dataset entry by entry to extract the same values.
+class DataColumns {
+    public:
+        DataColumns(const RooAbsData &data, bool includeZeroWeights) ;
+        ~DataColumns() ;
+        const RooAbsData & data() const { return *data_; }
+        bool includeZeroWeights() const { return includeZeroWeights_; }
+        /// number of entries kept
+        unsigned int size() const { return entries_.size(); }
+        /// index in the dataset of each entry kept
+        const std::vector<unsigned int> & entries() const { return entries_; }
+        /// values of the observable with this name for the entries kept, or 0 if it's not a RooRealVar of the dataset
+        const Double_t * column(const std::string &name) const ;
+        /// weights of the entries kept, as in the dataset (i.e. not changed by CachingAddNLL::setWeights)
+        const Double_t * weights() const { return block_ + names_.size() * stride_; }
+        /// true if all the values are within the ranges of the observables, so that they can be set with RooRealVar::setVal
+        bool withinRanges() const { return withinRanges_; }
+        /// memory held by the values, the weights and the indices of the entries
+        std::size_t bytes() const { return std::size_t(stride_) * (names_.size() + 1) * sizeof(Double_t) + entries_.capacity() * sizeof(unsigned int); }
+
+        /// the columns that exist for this dataset with this includeZeroWeights, or 0
+        static const DataColumns * find(const RooAbsData &data, bool includeZeroWeights) ;
+        /// the values of the observable name for the entries of data with non-zero weight (or all of them if includeZeroWeights),
+        /// copied from the columns if they exist, otherwise read from the dataset
+        static void fill(const RooAbsData &data, const std::string &name, bool includeZeroWeights, std::vector<Double_t> &out) ;
+    private:
+        enum { Alignment = 64 };
+        const RooAbsData *data_;
+        bool includeZeroWeights_, withinRanges_;
+        std::vector<unsigned int> entries_;
+        std::vector<std::string> names_;
+        unsigned int stride_;
+        Double_t *block_;
+        DataColumns(const DataColumns &) ;
+        DataColumns & operator=(const DataColumns &) ;
+};
+}
+
+#endif
@@ -6,6 +6,11 @@
 #include <TH3.h>
 #include <algorithm>
 #include <vector>
+#include <memory>
+
+class FastTemplateFloat;
+class FastTemplateShared;
+class FastTemplateSparsePair;
 
 class FastTemplate {
     public:
@@ -52,11 +57,17 @@ class FastTemplate {
         /// return the active size of the template (can be less than the full size if the SetActiveSize
         /// has been used to inform the code that only the first N bins are not empty)
         const unsigned int size() const { return size_; }
+        /// memory held by the values
+        std::size_t bytes() const { return values_.capacity() * sizeof(T); }
+        /// copy the values to memory allocated by the calling thread, so that with first-touch NUMA placement they are on its node
+        void Localize() { AT(values_).swap(values_); }
+        /// free the values, leaving an empty template
+        void Release() { size_ = 0; AT().swap(values_); }
         
         /// *this = log(*this) 
         void Log();
-        /// *this = exp(*this) 
-        void Exp();
+        /// *this = max(exp(*this), minimum), cropping the underflows in the same pass
+        void Exp(T minimum=0);
         /// *this = *this - reference
         void Subtract(const FastTemplate &reference);
         /// *this = log(*this)/(reference)
@@ -65,6 +76,12 @@ class FastTemplate {
         static void SumDiff(const FastTemplate &h1, const FastTemplate &h2, FastTemplate &sum, FastTemplate &diff);
         /// Does this += x * (diff + (sum)*y)
         void Meld(const FastTemplate & diff, const FastTemplate & sum, T x, T y) ;
+        /// Same as above, with single precision inputs (the sum is still done in double precision)
+        void Meld(const FastTemplateFloat & diff, const FastTemplateFloat & sum, T x, T y) ;
+        /// Same as above, with inputs in shared memory
+        void Meld(const FastTemplateShared & diff, const FastTemplateShared & sum, T x, T y) ;
+        /// Same as above, only on the bins where diff or sum are not zero
+        void Meld(const FastTemplateSparsePair & diffsum, T x, T y) ;
         /// protect from underflows (*this = max(*this, minimum));
         void CropUnderflows(T minimum=1e-9, bool activebinsonly=true);
 
@@ -77,10 +94,107 @@ class FastTemplate {
     protected:
         unsigned int size_;
         AT values_;
+
+        /// 1/width of the bins if the edges are equally spaced, or 0 if the bins have to be searched
+        static T uniformInvWidth(const AT &edges) ;
+        /// index i of the bin with edges[i] < x <= edges[i+1] as found by std::lower_bound, or -1 below the first edge
+        /// and edges.size()-1 above the last; with invWidth != 0 the bin is computed instead of searched, and then
+        /// checked against the edges so that the result is the same also for the values on the edges
+        static int findBin(const AT &edges, T invWidth, T x) {
+            int n = edges.size() - 1;
+            if (invWidth == 0 || n <= 0) return std::lower_bound(edges.begin(), edges.end(), x) - edges.begin() - 1;
+            if (!(x > edges[0])) return -1;
+            if (x > edges[n]) return n;
+            int i = std::min(int((x - edges[0]) * invWidth), n-1);
+            while (x <= edges[i]) --i;
+            while (x > edges[i+1]) ++i;
+            return i;
+        }
+};
+/// Read-only single precision copy of a FastTemplate, to halve the memory bandwidth 
+/// of templates that are read many times (e.g. the morphs of FastVerticalInterpHistPdf2)
+class FastTemplateFloat {
+    public:
+        typedef float T;
+        FastTemplateFloat() : size_(0), fullsize_(0), values_(), data_(0) {}
+        explicit FastTemplateFloat(const FastTemplate &other) : size_(other.size()), fullsize_(other.fullsize()), values_(other.fullsize()), data_(0) {
+            for (unsigned int i = 0, n = values_.size(); i < n; ++i) values_[i] = other[i];
+            if (!values_.empty()) data_ = &values_[0];
+        }
+        FastTemplateFloat(const FastTemplateFloat &other) : size_(other.size_), fullsize_(other.fullsize_), values_(other.values_), shared_(other.shared_), data_(0) {
+            data_ = shared_ ? other.data_ : (values_.empty() ? 0 : &values_[0]);
+        }
+        FastTemplateFloat & operator=(const FastTemplateFloat &other) {
+            if (&other != this) { FastTemplateFloat tmp(other); swap(tmp); }
+            return *this;
+        }
+        void swap(FastTemplateFloat &other) {
+            std::swap(size_, other.size_);
+            std::swap(fullsize_, other.fullsize_);
+            std::swap(values_, other.values_);
+            std::swap(shared_, other.shared_);
+            std::swap(data_, other.data_);
+        }
+        const T & operator[](unsigned int i) const { return data_[i]; }
+        const unsigned int size() const { return size_; }
+        const unsigned int fullsize() const { return fullsize_; }
+        /// the values in double precision, as a FastTemplate of the same full and active size
+        FastTemplate ToDouble() const ;
+        /// Move the values to a read-only mapping of a file in dir named after their content, 
+        /// so that all the processes on a node using the same template share a single copy of it.
+        /// The files are removed when the process that created them exits (the others keep their mapping).
+        /// Returns false (and keeps the private copy) if that is not possible
+        bool Share(const char *dir) ;
+        bool shared() const { return shared_.get() != 0; }
+        /// memory held by the private copy of the values (none if they are shared)
+        std::size_t bytes() const { return values_.capacity() * sizeof(T); }
+    private:
+        unsigned int size_, fullsize_;
+        std::vector<T> values_;
+        std::shared_ptr<const T> shared_;
+        const T *data_;
+};
+/// Read-only double precision copy of a FastTemplate in a read-only mapping of a file named after its content
+/// (see FastTemplateFloat::Share), for the templates that are only read when many processes run on the same model
+class FastTemplateShared {
+    public:
+        typedef FastTemplate::T T;
+        FastTemplateShared() : size_(0), fullsize_(0) {}
+        /// Map the values of other from dir; the result is empty if that is not possible
+        FastTemplateShared(const FastTemplate &other, const char *dir) ;
+        const T & operator[](unsigned int i) const { return data_.get()[i]; }
+        const unsigned int size() const { return size_; }
+        const unsigned int fullsize() const { return fullsize_; }
+        /// the values, as a FastTemplate of the same full and active size
+        FastTemplate ToDouble() const ;
+    private:
+        unsigned int size_, fullsize_;
+        std::shared_ptr<const T> data_;
+};
+/// The bins where at least one of two templates (e.g. the diff and sum of a morph) is not zero, with their values,
+/// for the shape systematics that change only a few bins: melding them costs as many operations as the non-zero bins
+class FastTemplateSparsePair {
+    public:
+        typedef FastTemplate::T T;
+        FastTemplateSparsePair() : size_(0) {}
+        FastTemplateSparsePair(const FastTemplate &diff, const FastTemplate &sum) ;
+        /// fraction of the bins where diff or sum are not zero
+        static double Density(const FastTemplate &diff, const FastTemplate &sum) ;
+        /// number of bins of the templates (0 if not set)
+        unsigned int size() const { return size_; }
+        /// number of non-zero bins
+        unsigned int entries() const { return bins_.size(); }
+        /// memory held by the bins and values
+        std::size_t bytes() const { return bins_.capacity() * sizeof(unsigned int) + (diff_.capacity() + sum_.capacity()) * sizeof(T); }
+        friend class FastTemplate;
+    private:
+        unsigned int size_;
+        std::vector<unsigned int> bins_; // in increasing order
+        std::vector<T> diff_, sum_;
 };
 class FastHisto : public FastTemplate {
     public:
-        FastHisto() : FastTemplate(), binEdges_(), binWidths_() {}
+        FastHisto() : FastTemplate(), binEdges_(), binWidths_(), invWidth_(0) {}
         FastHisto(const TH1 &hist) ;
         FastHisto(const FastHisto &other) ;
         FastHisto & operator=(const FastHisto &other) { 
@@ -89,6 +203,7 @@ class FastHisto : public FastTemplate {
                 values_    = other.values_;
                 binWidths_ = other.binWidths_;
                 binEdges_  = other.binEdges_;
+                invWidth_  = other.invWidth_;
             } else CopyValues(other); 
             return *this; 
         }
@@ -105,14 +220,19 @@ class FastHisto : public FastTemplate {
             std::swap(values_, other.values_);
             std::swap(binWidths_, other.binWidths_);
             std::swap(binEdges_, other.binEdges_);
+            std::swap(invWidth_, other.invWidth_);
         }
         T GetAt(const T &x) const ;
         int FindBin(const T &x) const ;
         const T & GetBinContent(int bin) const { return values_[bin]; }
+        /// the size()+1 bin edges
+        const AT & binEdges() const { return binEdges_; }
         T IntegralWidth() const ;
-        void Normalize() {
+        /// normalize to unit integral, and return the integral before normalization
+        T Normalize() {
             T sum = IntegralWidth();
             if (sum > 0) Scale(1.0f/sum);
+            return sum;
         }
 
         void Dump() const ;
@@ -122,11 +242,12 @@ class FastHisto : public FastTemplate {
     private:
         AT binEdges_;
         AT binWidths_;
+        T invWidth_; // see FastTemplate::findBin
     
 };
 class FastHisto2D : public FastTemplate {
     public:
-        FastHisto2D() : FastTemplate(), binX_(0), binY_(0), binEdgesX_(), binEdgesY_(), binWidths_() {}
+        FastHisto2D() : FastTemplate(), binX_(0), binY_(0), binEdgesX_(), binEdgesY_(), binWidths_(), invWidthX_(0), invWidthY_(0) {}
         FastHisto2D(const TH2 &hist, bool normXonly=false) ;
         FastHisto2D(const FastHisto2D &other) ;
         FastHisto2D & operator=(const FastHisto2D &other) { 
@@ -138,6 +259,8 @@ class FastHisto2D : public FastTemplate {
                 binEdgesY_ = other.binEdgesY_;
                 binX_      = other.binX_;
                 binY_      = other.binY_;
+                invWidthX_ = other.invWidthX_;
+                invWidthY_ = other.invWidthY_;
             } else CopyValues(other); 
             return *this; 
         }
@@ -150,6 +273,8 @@ class FastHisto2D : public FastTemplate {
             std::swap(binWidths_, other.binWidths_);
             std::swap(binEdgesX_, other.binEdgesX_);
             std::swap(binEdgesY_, other.binEdgesY_);
+            std::swap(invWidthX_, other.invWidthX_);
+            std::swap(invWidthY_, other.invWidthY_);
         }
         T GetAt(const T &x, const T &y) const ;
         T IntegralWidth() const ;
@@ -159,25 +284,32 @@ class FastHisto2D : public FastTemplate {
             T sum = IntegralWidth();
             if (sum > 0) Scale(1.0f/sum);
         }
-        /// For each X, normalize along Y
-        void NormalizeXSlices() ;
+        /// For each X, normalize along Y. If maxOnY and maxOnX are given, they are filled in the same pass with the maximum
+        /// of each X slice (binX() values, as from GetMaxOnY) and of each Y column (binY() values, as from GetMaxOnX)
+        void NormalizeXSlices(T *maxOnY = 0, T *maxOnX = 0) ;
 
         void Dump() const ;
 
         T GetMaxOnXY() const ;
         T GetMaxOnX(const T &y) const ;
         T GetMaxOnY(const T &x) const ;
+        /// Fill the same maxima as NormalizeXSlices, without normalizing
+        void GetMaxima(T *maxOnY, T *maxOnX) const ;
+        /// bin along X or Y, -1 below the first edge and binX() or binY() above the last
+        int FindBinX(const T &x) const { return findBin(binEdgesX_, invWidthX_, x); }
+        int FindBinY(const T &y) const { return findBin(binEdgesY_, invWidthY_, y); }
     private:
         unsigned int binX_, binY_;
         AT binEdgesX_;
         AT binEdgesY_;
         AT binWidths_;
+        T invWidthX_, invWidthY_; // see FastTemplate::findBin
     
 };
 
 class FastHisto3D : public FastTemplate {
     public:
-        FastHisto3D() : FastTemplate(), binX_(0), binY_(0), binZ_(0),binEdgesX_(), binEdgesY_(), binEdgesZ_(), binWidths_() {}
+        FastHisto3D() : FastTemplate(), binX_(0), binY_(0), binZ_(0),binEdgesX_(), binEdgesY_(), binEdgesZ_(), binWidths_(), invWidthX_(0), invWidthY_(0), invWidthZ_(0) {}
         FastHisto3D(const TH3 &hist, bool normXonly=false) ;
         FastHisto3D(const FastHisto3D &other) ;
         FastHisto3D & operator=(const FastHisto3D &other) { 
@@ -191,6 +323,9 @@ class FastHisto3D : public FastTemplate {
                 binX_      = other.binX_;
                 binY_      = other.binY_;
                 binZ_      = other.binZ_;
+                invWidthX_ = other.invWidthX_;
+                invWidthY_ = other.invWidthY_;
+                invWidthZ_ = other.invWidthZ_;
             } else CopyValues(other); 
             return *this; 
         }
@@ -205,6 +340,9 @@ class FastHisto3D : public FastTemplate {
             std::swap(binEdgesX_, other.binEdgesX_);
             std::swap(binEdgesY_, other.binEdgesY_);
             std::swap(binEdgesZ_, other.binEdgesZ_);
+            std::swap(invWidthX_, other.invWidthX_);
+            std::swap(invWidthY_, other.invWidthY_);
+            std::swap(invWidthZ_, other.invWidthZ_);
         }
         T GetAt(const T &x, const T &y, const T &z) const ;
         T IntegralWidth() const ;
@@ -225,6 +363,7 @@ class FastHisto3D : public FastTemplate {
         AT binEdgesY_;
         AT binEdgesZ_;
         AT binWidths_;
+        T invWidthX_, invWidthY_, invWidthZ_; // see FastTemplate::findBin
     
 };
 #endif
@@ -0,0 +1,72 @@
+#ifndef HiggsAnalysis_CombinedLimit_FcnTrace_h
+#define HiggsAnalysis_CombinedLimit_FcnTrace_h
+/** Binary traces of the evaluations of the functions minimized through RooMinimizerOpt (combine --fcnTrace file),
+ *  to replay them later on the same model with replayFcnTrace (bin/replayFcnTrace.cpp), e.g. to benchmark changes
+ *  of the NLL on the sequence of points of a real fit without running the minimizer.
+ *
+ *  The file starts with the 8 characters "CMBFCNT1", followed by records, each starting with a byte for its type:
+ *    'P' <uint32 index> <uint32 length> <name>
+ *        a new parameter, numbered from 0 in order of appearance
+ *    'E' <uint64 state> <uint32 n> n x (<uint32 index> <double value>) <double nll> <double seconds>
+ *        an evaluation: the parameters whose value changed since the previous evaluation (all of them at the first one),
+ *        the value of the function and the time it took; state is CachingSimNLL::stateId() (0 for other functions),
+ *        which changes with the data and the zero points, so that the values are comparable only within the same state
+ *  The parameters are the floating and constant ones of the function, the categories with their index as value.
+ *  Numbers are in the byte order of the machine that wrote the file.
+ */
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <unistd.h>
+
+class RooAbsArg;
+class RooAbsCollection;
+
+class FcnTraceWriter {
+    public:
+        /// start writing all the evaluations of this process to fileName; throws std::runtime_error if it can't be created
+        static void open(const std::string &fileName) ;
+        /// the writer of this process, or 0 if none was opened (or in a process forked after it was, which doesn't write)
+        static FcnTraceWriter * get() ;
+        ~FcnTraceWriter() ;
+        /// record an evaluation of a function of these parameters
+        void record(const RooAbsCollection &floating, const RooAbsCollection &constant, unsigned long state, double nll, double seconds) ;
+    private:
+        FcnTraceWriter(int fd, const std::string &fileName) ;
+        FcnTraceWriter(const FcnTraceWriter &) ;
+        FcnTraceWriter & operator=(const FcnTraceWriter &) ;
+        void add_(const RooAbsCollection &params) ;
+        unsigned int index_(const RooAbsArg *arg) ;
+        void put_(const void *data, std::size_t size) ;
+        void flush_() ;
+        int fd_;
+        std::string fileName_;
+        pid_t pid_;
+        std::vector<char> buffer_;
+        /// the last parameter with this address (checked by name, as it may be another one now), and the index of each name
+        std::unordered_map<const RooAbsArg *, unsigned int> byArg_;
+        std::unordered_map<std::string, unsigned int> byName_;
+        std::vector<std::string> names_;
+        std::vector<double> last_;
+        std::vector<char> written_;
+        std::vector<std::pair<uint32_t, double> > changed_;
+};
+
+class FcnTraceReader {
+    public:
+        /// read the whole trace; throws std::runtime_error if it can't be read or it's not a trace
+        explicit FcnTraceReader(const std::string &fileName) ;
+        struct Eval {
+            uint64_t state;
+            std::vector<std::pair<uint32_t, double> > changed;
+            double nll, seconds;
+        };
+        const std::vector<std::string> & names() const { return names_; }
+        const std::vector<Eval> & evals() const { return evals_; }
+    private:
+        std::vector<std::string> names_;
+        std::vector<Eval> evals_;
+};
+
+#endif
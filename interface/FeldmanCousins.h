@@ -9,6 +9,9 @@
  *
  */
 #include "LimitAlgo.h"
+#include <vector>
+class RooAbsReal;
+class RooRealVar;
 
 class FeldmanCousins : public LimitAlgo {
 public:
@@ -23,6 +26,16 @@ public:
 private:
   static float toysFactor_;
   static float rAbsAccuracy_, rRelAccuracy_;
+  /// run the Neyman construction here instead of with RooStats::FeldmanCousins
+  static bool native_;
+  /// with native_, spread the points among up to this number of forked processes
+  static unsigned int forks_;
+
+  /// native construction: fill inside with whether each of the values of the POI r is in the interval
+  void nativeConstruction(RooStats::ModelConfig *mc_s, RooAbsData &data, RooRealVar *r, const std::vector<double> &points, float toysFactor, std::vector<bool> &inside) const ;
+  /// profile likelihood ratio test statistic at the current value of r, for the data the nll is attached to.
+  /// if nuisSnapshot is not null, the parameters are left at the conditional best fit, and saved there
+  double testStatistic(RooAbsReal &nll, RooRealVar *r, RooArgSet &params, const RooArgSet &start, RooArgSet *nuisSnapshot) const ;
 };
 
 #endif
@@ -0,0 +1,37 @@
+#ifndef HiggsAnalysis_CombinedLimit_FitResultCache_h
+#define HiggsAnalysis_CombinedLimit_FitResultCache_h
+/** \class FitResultCache
+ *
+ * Directory of the results of fits shared by the jobs of a campaign (MultiDimFit --fitCache), so that the jobs of
+ * impacts, scans, fixed points and breakdowns that all start with the same best fit do it only once.
+ *
+ * Each result is a ROOT file named by a hash of everything that the fit depends on: the structure of the pdf (class
+ * and name of each node), the values, errors, ranges and constant flags of all its parameters (so the frozen and
+ * floating sets and the starting point) and the indices of its categories, the dataset (every entry and weight),
+ * and a string of the settings of the caller (algorithm, minimizer options). The file holds the RooFitResult and the
+ * value of the NLL at the minimum, which the user of the result checks with one evaluation before trusting it.
+ * Files are written under a temporary name and renamed, so that concurrent jobs never read half a file; a job that
+ * finds a result written by another one meanwhile just uses it.
+ */
+#include <string>
+
+class RooAbsPdf;
+class RooAbsData;
+class RooFitResult;
+
+class FitResultCache {
+    public:
+        /// use this directory (created if needed); an empty name disables the cache
+        static void setup(const std::string &dir) ;
+        static bool enabled() { return !dir_.empty(); }
+        /// key of the fit of pdf on data starting from the current state of its parameters, with these settings
+        static std::string key(const RooAbsPdf &pdf, const RooAbsData &data, const std::string &settings) ;
+        /// the result saved with this key (owned by the caller) and the value of the NLL at its minimum, or 0
+        static RooFitResult * load(const std::string &key, double &nll) ;
+        /// save the result and the value of the NLL at its minimum; failures to write are reported and otherwise ignored
+        static void save(const std::string &key, const RooFitResult &result, double nll) ;
+    private:
+        static std::string dir_;
+};
+
+#endif
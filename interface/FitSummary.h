@@ -0,0 +1,60 @@
+#ifndef HiggsAnalysis_CombinedLimit_FitSummary_h
+#define HiggsAnalysis_CombinedLimit_FitSummary_h
+/** \class FitSummary
+ *
+ * What the loops over toys need of each fit, instead of a RooFitResult (FitterAlgoBase::doFit with a summary set,
+ * MaxLikelihoodFit --lightToyFits): status, covariance quality, EDM, number of invalid evaluations and value of the
+ * NLL, and value, hesse error and crossings (or MINOS errors) of a few tracked parameters, the POIs and any
+ * nuisances of interest. The buffers are allocated once by setParameters and overwritten by each fit, while a
+ * RooFitResult snapshots all the parameters, floating and constant, and builds the covariance and correlation
+ * matrices of the floating ones in every toy. A full RooFitResult is still made by doFit whenever no summary is set.
+ */
+#include <vector>
+#include <string>
+
+class RooArgList;
+class RooRealVar;
+class RooMinimizerOpt;
+
+class FitSummary {
+    public:
+        FitSummary() ;
+        /// track these parameters (the non-RooRealVars are skipped); the buffers are allocated here, once
+        void setParameters(const RooArgList &params) ;
+        unsigned int size() const { return params_.size(); }
+        /// index of the tracked parameter with this name, or -1
+        int index(const char *name) const ;
+        const RooRealVar & parameter(unsigned int i) const { return *params_[i]; }
+        /// forget the last fit: status -1, NLL NaN, no errors
+        void clear() ;
+        /// take the status of the minimizer, the value of the NLL, and the current values and errors of the parameters
+        void fill(const RooMinimizerOpt &minim, double nll) ;
+        /// set the 68% and 95% intervals of a parameter (NaN for the sides not found); its value isn't changed
+        void setInterval68(unsigned int i, double lo, double hi) { lo68_[i] = lo; hi68_[i] = hi; }
+        void setInterval95(unsigned int i, double lo, double hi) { lo95_[i] = lo; hi95_[i] = hi; }
+
+        int status() const { return status_; }
+        int covQual() const { return covQual_; }
+        double edm() const { return edm_; }
+        int numInvalidNLL() const { return numInvalidNLL_; }
+        double minNll() const { return minNll_; }
+        /// false if the parameter was constant in the fit
+        bool floating(unsigned int i) const { return floating_[i]; }
+        double value(unsigned int i) const { return values_[i]; }
+        double error(unsigned int i) const { return errors_[i]; }
+        /// ends of the intervals found by doFit, NaN if not computed or the crossing wasn't found
+        double lo68(unsigned int i) const { return lo68_[i]; }
+        double hi68(unsigned int i) const { return hi68_[i]; }
+        double lo95(unsigned int i) const { return lo95_[i]; }
+        double hi95(unsigned int i) const { return hi95_[i]; }
+        bool hasInterval68(unsigned int i) const ;
+        bool hasInterval95(unsigned int i) const ;
+    private:
+        std::vector<RooRealVar *> params_;
+        std::vector<char>   floating_;
+        std::vector<double> values_, errors_, lo68_, hi68_, lo95_, hi95_;
+        int status_, covQual_, numInvalidNLL_;
+        double edm_, minNll_;
+};
+
+#endif
@@ -16,7 +16,11 @@ class RooCmdArg;
 class RooAbsReal;
 class RooArgList;
 class CascadeMinimizer;
+class FitSummary;
 #include <RooArgSet.h>
+#include <string>
+#include <vector>
+#include <functional>
 
 class FitterAlgoBase : public LimitAlgo {
 public:
@@ -37,6 +41,7 @@ protected:
   static bool robustFit_, do95_, forceRecreateNLL_;
   static float stepSize_;
   static int   maxFailedSteps_;
+  static int   crossingForks_;
 
   enum ProfilingMode { ProfileAll, ProfileUnconstrained, ProfilePOI, NoProfiling };
   static ProfilingMode profileMode_;
@@ -47,6 +52,17 @@ protected:
   RooArgSet autoBoundsPOISet_, autoMaxPOISet_;
   static double nllValue_, nll0Value_;
   std::auto_ptr<RooAbsReal> nll;
+  /// what nll (and spareNLL_) was made for: it's reused only for the same pdf, constraints and offset (pdf = 0: never)
+  struct NLLKey { 
+      NLLKey() : nll(0), pdf(0), offset(false) {}
+      const RooAbsReal *nll; const RooAbsPdf *pdf; std::string constrain; bool offset; 
+  };
+  NLLKey nllKey_, spareNLLKey_;
+  /// the NLL of the pdf fitted before the current one, for the algorithms that alternate between two pdfs
+  std::auto_ptr<RooAbsReal> spareNLL_;
+  /// if set (by the subclass, which owns it), doFit fills it instead of saving the fit in a RooFitResult, and returns an
+  /// empty one; the intervals of the parameters to scan go in the summary, for the ones it tracks
+  FitSummary *fitSummary_;
   // method that is implemented in the subclass
   virtual bool runSpecific(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, double &limit, double &limitErr, const double *hint) = 0;
 
@@ -56,8 +72,17 @@ protected:
   /// If ndim > 1, errors on each parameter are from a n-dim chisquare, as for a joint estimation of N parameters 
   RooFitResult *doFit(RooAbsPdf &pdf, RooAbsData &data, RooRealVar &r,  const RooCmdArg &constrain, bool doHesse=true, int ndim=1,bool reuseNLL=false, bool saveFitResult=true) ;
   RooFitResult *doFit(RooAbsPdf &pdf, RooAbsData &data, const RooArgList &rs, const RooCmdArg &constrain, bool doHesse=true, int ndim=1,bool reuseNLL=false, bool saveFitResult=true) ;
+  /// make nll the NLL of pdf on data: if reuse (and not --forceRecreateNLL), the one already made for the same pdf and constraints
+  /// with the new data swapped in, unless it can't take it; otherwise a new one. Returns true if an NLL was reused
+  bool setupNLL(RooAbsPdf &pdf, RooAbsData &data, const RooCmdArg &constrain, bool reuse=true, bool offset=true) ;
   double findCrossing(CascadeMinimizer &minim, RooAbsReal &nll, RooRealVar &r, double level, double rStart, double rBound) ;
   double findCrossingNew(CascadeMinimizer &minim, RooAbsReal &nll, RooRealVar &r, double level, double rStart, double rBound) ;
+  /// speculative version of findCrossing: profile crossingForks_ candidate values of r at a time in forked processes, 
+  /// placed using the parabolic or secant prediction from the points already fitted
+  double findCrossingParallel(CascadeMinimizer &minim, RooAbsReal &nll, RooRealVar &r, double level, double rStart, double rBound) ;
+  /// run job(0) ... job(n-1) each in a forked process (except job(0), run in this one if parentTakesFirst), and return what they returned
+  /// (see utils::runInForks); the jobs that failed are reported and get an empty result. Returns their number
+  static unsigned int runInForks(unsigned int n, const std::function<std::vector<double>(unsigned int)> &job, std::vector<std::vector<double> > &results, bool parentTakesFirst) ;
 
   void optimizeBounds(const RooWorkspace *w, const RooStats::ModelConfig *mc) ;
   void restoreBounds(const RooWorkspace *w, const RooStats::ModelConfig *mc) ;
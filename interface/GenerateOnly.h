@@ -4,6 +4,10 @@
  *
  * Class for generation of toy samples without any actual limit computation
  *
+ * For large banks of toys, --toyForks N --saveToys --saveToysColumnar generates them in N forked processes,
+ * each toy with its own seed (or its own streams with --counterRNG), and collects them in toy order in one
+ * columnar toy file.
+ *
  * \author Luca Lista (INFN)
  *
  *
@@ -12,6 +12,8 @@
 #include "HiggsAnalysis/CombinedLimit/interface/ProfileLikelihood.h"
 
 class TDirectory;
+#include <map>
+#include <memory>
 
 class GoodnessOfFit : public LimitAlgo {
 public:
@@ -22,6 +24,8 @@ public:
     return name;
   }
   virtual void applyOptions(const boost::program_options::variables_map &vm) ;
+  /// the plots are written in a directory of the output file made before the toys
+  virtual bool forkableToys() const { return !makePlots_; }
 
   virtual bool runSaturatedModel(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, double &limit, double &limitErr, const double *hint);
   virtual bool runKSandAD(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, double &limit, double &limitErr, const double *hint, bool kolmo);
@@ -39,6 +43,7 @@ protected:
   static bool  fixedMu_;
 
   static bool  makePlots_;
+  static bool  fastSaturated_;
   static TDirectory *plotDir_;
   static std::vector<std::string>  binNames_;
   static std::vector<float>        qVals_;
@@ -48,6 +53,14 @@ protected:
   RooAbsPdf *makeSaturatedPdf(RooAbsData &data);
   mutable std::vector<RooAbsData*> tempData_;
 
+  /// for KS and AD: the pdf without constraints, and the CDFs of each of its channels, made only once for all the toys.
+  /// their values follow the parameters, as they share them with the pdf they're made from
+  RooAbsPdf *ksadPdf_, *ksadObsOnlyPdf_;
+  std::unique_ptr<RooAbsPdf> ksadObsOnlyPdfOwned_;
+  std::map<std::string, std::unique_ptr<RooAbsReal> > cdfCache_;
+  RooAbsPdf *obsOnlyPdfFor(RooAbsPdf &pdf, const RooArgSet &observables) ;
+  RooAbsReal &cdfFor(RooAbsPdf &pdf, RooRealVar &observable) ;
+
 };
 
 
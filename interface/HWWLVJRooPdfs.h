@@ -331,6 +331,9 @@ public:
 
   inline virtual ~RooGausExpPdf() { }
 
+  Int_t getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* rangeName=0) const ;
+  Double_t analyticalIntegral(Int_t code, const char* rangeName=0) const ;
+
 protected:
 
   RooRealProxy x ;
@@ -404,6 +407,9 @@ public:
 
   inline virtual ~RooErfPowPdf() { }
 
+  Int_t getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* rangeName=0) const ;
+  Double_t analyticalIntegral(Int_t code, const char* rangeName=0) const ;
+
 protected:
 
   RooRealProxy x ;
@@ -472,6 +478,9 @@ public:
 
   inline virtual ~RooPow2Pdf() { }
 
+  Int_t getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* rangeName=0) const ;
+  Double_t analyticalIntegral(Int_t code, const char* rangeName=0) const ;
+
 protected:
 
   RooRealProxy x ;
@@ -499,6 +508,9 @@ public:
 
   inline virtual ~RooPowPdf() { }
 
+  Int_t getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* rangeName=0) const ;
+  Double_t analyticalIntegral(Int_t code, const char* rangeName=0) const ;
+
 protected:
 
   RooRealProxy x ;
@@ -528,6 +540,9 @@ public:
 
   inline virtual ~RooQCDPdf() { }
 
+  Int_t getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* rangeName=0) const ;
+  Double_t analyticalIntegral(Int_t code, const char* rangeName=0) const ;
+
 protected:
 
   RooRealProxy x ;
@@ -559,6 +574,9 @@ public:
 
   inline virtual ~RooUser1Pdf() { }
 
+  Int_t getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* rangeName=0) const ;
+  Double_t analyticalIntegral(Int_t code, const char* rangeName=0) const ;
+
 protected:
 
   RooRealProxy x ;
@@ -590,6 +608,9 @@ public:
 
   inline virtual ~RooExpNPdf() { }
 
+  Int_t getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* rangeName=0) const ;
+  Double_t analyticalIntegral(Int_t code, const char* rangeName=0) const ;
+
 protected:
 
   RooRealProxy x ;
@@ -653,6 +674,9 @@ public:
 
   inline virtual ~RooExpTailPdf() { }
 
+  Int_t getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* rangeName=0) const ;
+  Double_t analyticalIntegral(Int_t code, const char* rangeName=0) const ;
+
 protected:
 
   RooRealProxy x ;
@@ -717,6 +741,9 @@ public:
 
   inline virtual ~Roo2ExpPdf() { }
 
+  Int_t getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* rangeName=0) const ;
+  Double_t analyticalIntegral(Int_t code, const char* rangeName=0) const ;
+
 protected:
 
   RooRealProxy x ;
@@ -17,6 +17,7 @@
 #include "TH1.h"
 #include "RooDataHist.h"
 #include "RooHistFunc.h"
+#include <vector>
 using namespace RooFit;
 class HZZ4L_RooSpinZeroPdf : public RooAbsPdf {
 protected:
@@ -44,6 +45,8 @@ public:
   Int_t getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* rangeName=0) const ;
   Double_t analyticalIntegral(Int_t code, const char* rangeName=0) const ;
   const RooArgList& coefList() const { return _coefList ; }
+  /// coefficients of the templates in coefList() at the current fractions: the pdf is sum_j coeffs[j] * T_j (floored at 1e-200)
+  void templateCoefficients(std::vector<double> &coeffs) const ;
 
 private:
 
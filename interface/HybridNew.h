@@ -9,7 +9,11 @@
  *
  */
 #include "HiggsAnalysis/CombinedLimit/interface/LimitAlgo.h"
+#include "HiggsAnalysis/CombinedLimit/interface/Checkpoint.h"
+#include "HiggsAnalysis/CombinedLimit/interface/ToyMCSamplerOpt.h"
 #include <algorithm> 
+#include <deque>
+#include <map>
 #include <RooStats/ModelConfig.h>
 #include <RooStats/HybridCalculator.h>
 #include <RooStats/ToyMCSampler.h>
@@ -28,6 +32,10 @@ public:
   virtual bool runLimit(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, double &limit, double &limitErr, const double *hint);
   virtual bool runSignificance(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, double &limit, double &limitErr, const double *hint);
   virtual bool runSinglePoint(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, double &limit, double &limitErr, const double *hint);
+  /// with --workQueue: throw the toys of the units handed out by the coordinator until there are no more
+  virtual bool runWorker(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, double &limit, double &limitErr, const double *hint);
+  /// with --sharedBToysGrid: CLs at each point of the grid, from S+B toys thrown at the point and B-only toys thrown once for all
+  virtual bool runSharedBToysGrid(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, double &limit, double &limitErr, const double *hint);
   virtual bool runTestStatistics(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, double &limit, double &limitErr, const double *hint);
   virtual const std::string & name() const {
     static const std::string name("HybridNew");
@@ -49,6 +57,9 @@ private:
   static unsigned int iterations_;
   static bool saveHybridResult_, readHybridResults_; 
   static std::string gridFile_;
+  static std::string toyStore_;
+  static std::string workQueue_;
+  static std::string sharedBToysGrid_;
   static bool expectedFromGrid_, clsQuantiles_; 
   static float quantileForExpectedFromGrid_;
   static bool fullBToys_; 
@@ -57,6 +68,7 @@ private:
   static bool noUpdateGrid_; 
   static unsigned int nCpu_, fork_;
   static bool importanceSamplingNull_, importanceSamplingAlt_;
+  static float importanceSamplingFraction_;
   static std::string algo_;
   static std::string plot_;
   static std::string minimizerAlgo_;
@@ -72,6 +84,9 @@ private:
   static float maxProbability_;
   static float confidenceToleranceForToyScaling_;
   static float adaptiveToys_;
+  static unsigned int sequentialToys_;
+  static float sequentialSigmas_;
+  static unsigned int reuseToys_;
 
   // graph, used to compute the limit, not just for plotting!
   std::auto_ptr<TGraphErrors> limitPlot_;
@@ -84,11 +99,14 @@ private:
   // std::auto_ptr<RooAbsCollection>  snapGlobalObs_;
 
   struct Setup {
+    Setup() : priorNuisanceNull(0) {}
     RooStats::ModelConfig modelConfig, modelConfig_bonly;
     std::auto_ptr<RooStats::TestStatistic> qvar;
     std::auto_ptr<RooStats::ToyMCSampler>  toymcsampler;
     std::auto_ptr<RooStats::ProofConfig> pc;
     RooArgSet cleanupList;
+    /// the pdf the nuisances of the B-only toys are generated from (0 if none)
+    RooAbsPdf *priorNuisanceNull;
   };
 
   void validateOptions() ;
@@ -112,11 +130,39 @@ private:
   std::pair<double,double> eval(const RooStats::HypoTestResult &hcres, const RooAbsCollection & rVals) ;
   std::pair<double,double> eval(const RooStats::HypoTestResult &hcres, double rVal) ;
 
+  /// true if CLs is far enough from clsTarget, given the number of toys, to stop throwing toys for this point
+  bool sequentialDecision(const RooStats::HypoTestResult &hcres, const std::pair<double,double> &cls, double clsTarget) ;
   void applyExpectedQuantile(RooStats::HypoTestResult &hcres);
   void applyClsQuantile(RooStats::HypoTestResult &hcres);
   void applySignalQuantile(RooStats::HypoTestResult &hcres);
+  /// the test statistic of each null toy sorted by the CLs (or CLsplusb) it gives, with the running sum of the weights, so that
+  /// any quantile of CLs is a binary search
+  struct ClsQuantileTable { std::vector<double> testStat, cumulWeight; double btot; int nNull, nAlt; };
+  static void fillClsQuantileTable(const RooStats::HypoTestResult &hcres, ClsQuantileTable &table) ;
+  /// tables of the points of grid_, filled by updateGridData
+  std::map<const RooStats::HypoTestResult *, ClsQuantileTable> clsQuantileTables_;
+  /// value of the test statistic below which lies this fraction of the toys, taking into account their weights
+  static double distributionQuantile(const RooStats::SamplingDistribution &dist, double quantile) ;
   RooStats::HypoTestResult *evalGeneric(RooStats::HybridCalculator &hc, bool forceNoFork=false);
+  /// Run the toys in fork_ processes. They are not run in threads of one process: every toy fit changes the parameters,
+  /// which are objects of the workspace, and the generation and fits use RooFit global state that is not thread-safe
+  /// (the RooRandom generator, the eval error log, the message service). With HybridNew_ForkWarmup the NLL is built
+  /// once before forking, and the children share it copy-on-write.
   RooStats::HypoTestResult *evalWithFork(RooStats::HybridCalculator &hc);
+  /// with saveHybridResult or toyStore, write the result for these values of the POIs
+  void saveResult(const RooStats::HypoTestResult &hcres, const RooAbsCollection & rVals) ;
+  /// throw ntoys B-only toys with the sampler of the setup, and evaluate its test statistic at all the values of r on each;
+  /// the values for rVals[i] are put in testStats[i]. With --fork the toys are split among the forked processes.
+  /// Returns the number of toys skipped, because the test statistic was nan at some value of r
+  unsigned int throwSharedBToys(Setup &setup, const std::vector<Double_t> &rVals, unsigned int ntoys, std::vector<std::vector<Double_t> > &testStats) ;
+  /// name of the batches of toys of this calculator in the checkpoint: mass and POIs of the two hypotheses
+  std::string checkpointKey(const RooStats::HybridCalculator &hc) const ;
+  /// with --resume, the next batch of toys saved in the checkpoint for this key, or 0 if there are no more. The caller owns it.
+  RooStats::HypoTestResult *resumeBatch(const std::string &key) ;
+  std::map<std::string, std::deque<Checkpoint::Record> > resumeBatches_;
+  /// with --reuseToys, the toys thrown so far for this dataset
+  std::auto_ptr<toymcoptutils::ToyRecycler> recycler_;
+  bool resumeLoaded_;
   // RooStats::HypoTestResult *evalFrequentist(RooStats::HybridCalculator &hc);  // cross-check implementation, 
   RooStats::HypoTestResult *readToysFromFile(const RooAbsCollection & rVals);
 
@@ -126,6 +172,8 @@ private:
   void readGrid(TDirectory *directory, double rMin, double rMax); 
   void updateGridData(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, bool smart, double clsTarget); 
   void updateGridDataFC(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, bool smart, double clsTarget); 
+  /// with expectedFromGrid, set the expected test statistic of these points and compute their CLs (or CLsplusb) into values
+  void updateExpectedGrid(const std::vector<std::map<double, RooStats::HypoTestResult *>::iterator> &points, std::vector<std::pair<double,double> > &values);
   std::pair<double,double> updateGridPoint(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, std::map<double, RooStats::HypoTestResult *>::iterator point);
   void useGrid();
 
@@ -1,5 +1,8 @@
+#ifndef HiggsAnalysis_CombinedLimit_JacknifeQuantile_h
+#define HiggsAnalysis_CombinedLimit_JacknifeQuantile_h
 #include <vector>
 #include <algorithm>
+#include <utility>
 struct RooAbsData;
 
 class QuantileCalculator {
@@ -28,6 +31,35 @@ class QuantileCalculator {
         template<typename T> void import(const std::vector<T> &values, const std::vector<T> &weights) ;
         void partition(int m, bool doJacknife) ;
         void quantiles(double quantile, bool doJacknife);
-         
+        /// same as quantiles, by selection on a copy of each subset instead of sorting all the points,
+        /// with the subsets done in parallel by nThreads threads of the global pool (QUANTILE_SELECT=nThreads, at most --threads)
+        void selectQuantiles(double quantile, bool doJacknife, unsigned int nThreads);
+        /// quantile of the points in [begin, end) with the same definition as in quantiles(); reorders the range
+        static double selectQuantile(point *begin, point *end, double threshold) ;
 };
 
+/// Streaming, mergeable approximation of a distribution for its quantiles (a merging t-digest):
+/// the values are summarized by at most ~compression clusters, smaller in the tails, so that 
+/// the sketches of the toys of many jobs can be merged and stored without keeping all the values.
+class QuantileSketch {
+    public:
+        explicit QuantileSketch(double compression = 200) ;
+        /// a sketch from the clusters (mean, weight) of another one, as returned by clusters()
+        QuantileSketch(const std::vector<std::pair<double,double> > &clusters, double compression = 200) ;
+        void add(double x, double w = 1.0) ;
+        void merge(const QuantileSketch &other) ;
+        /// approximate value below which there is a fraction q of the total weight
+        double quantile(double q) const ;
+        /// approximate fraction of the total weight below x
+        double cdf(double x) const ;
+        double sumWeights() const { return sumw_ + bufferSumw_; }
+        const std::vector<std::pair<double,double> > & clusters() const { compress_(); return clusters_; }
+    private:
+        double compression_;
+        mutable std::vector<std::pair<double,double> > clusters_, buffer_;
+        mutable double sumw_, bufferSumw_;
+        double min_, max_;
+        /// merge the buffer into the clusters
+        void compress_() const ;
+};
+#endif
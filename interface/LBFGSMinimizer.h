@@ -0,0 +1,66 @@
+#ifndef HiggsAnalysis_CombinedLimit_LBFGSMinimizer_h
+#define HiggsAnalysis_CombinedLimit_LBFGSMinimizer_h
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <Math/Minimizer.h>
+#include <Math/IFunction.h>
+
+namespace cmsmath {
+
+    /** Limited-memory quasi-Newton (L-BFGS) minimizer, with box constraints handled by projection.
+        Memory and time per iteration are linear in the number of parameters, instead of quadratic as for Migrad.
+        It uses the analytical gradient if the function provides one (e.g. RooMinimizerFcnOptGrad, with MINIMIZER_ANALYTIC_GRADIENT),
+        and central finite differences otherwise. It doesn't provide errors: run Hesse with Minuit2 afterwards if needed.
+        Registered as the "LBFGS" ROOT::Math::Minimizer plugin; the number of stored corrections is set with --X-rtd LBFGS_memory=N (default 10). */
+    class LBFGSMinimizer : public ROOT::Math::Minimizer {
+        public:
+            LBFGSMinimizer(const char *name=0) ;
+
+            virtual void Clear() ;
+            virtual void SetFunction(const ROOT::Math::IMultiGenFunction & func) ;
+            virtual void SetFunction(const ROOT::Math::IMultiGradFunction & func) ;
+            virtual bool SetVariable(unsigned int ivar, const std::string & name, double val, double step) ;
+            virtual bool SetLimitedVariable(unsigned int ivar, const std::string & name, double val, double  step, double  lower, double  upper) ;
+            virtual bool SetFixedVariable(unsigned int ivar, const std::string & name, double val) ;
+            virtual bool Minimize() ;
+            virtual double MinValue() const { return minValue_;  }
+            virtual double Edm() const { return edm_; }
+            virtual const double *  X() const { return &x_[0]; }
+            virtual const double *  MinGradient() const { return &grad_[0]; }
+            virtual unsigned int NCalls() const { return nCalls_; }
+            virtual unsigned int NDim() const { return x_.size(); }
+            virtual unsigned int NFree() const { return free_.size(); }
+            virtual bool ProvidesError() const { return false; }
+            virtual const double * Errors() const { return 0; }
+            virtual double CovMatrix(unsigned int i, unsigned int j) const { return 0; }
+        protected:
+            struct Var {
+                Var() : step(1.0), lower(-1e300), upper(1e300), fixed(false) {}
+                std::string name; double step, lower, upper; bool fixed;
+            };
+            const ROOT::Math::IMultiGenFunction  *func_;
+            const ROOT::Math::IMultiGradFunction *gradFunc_;
+            std::vector<Var>    vars_;
+            std::vector<double> x_, grad_;
+            std::vector<unsigned int> free_;
+            double minValue_, edm_;
+            unsigned int nCalls_;
+
+            /// pairs of position and gradient differences from the last iterations, on the free parameters only
+            std::deque<std::vector<double> > s_, y_;
+
+            void resize(unsigned int ivar) ;
+            double eval(const std::vector<double> &x) ;
+            /// fill the full-dimensional gradient at x
+            void gradient(std::vector<double> &x, double fx, std::vector<double> &grad) ;
+            /// true if the free parameter i is at a bound the gradient pushes against
+            bool blocked(unsigned int i, const std::vector<double> &x, const std::vector<double> &grad) const ;
+            /// quasi-Newton direction -H*grad on the free parameters, from the two-loop recursion
+            void direction(const std::vector<double> &x, const std::vector<double> &grad, std::vector<double> &dir) const ;
+            double project(unsigned int i, double xi) const { const Var &v = vars_[free_[i]]; return std::max(v.lower, std::min(v.upper, xi)); }
+    };
+
+} // namespace
+#endif
@@ -23,6 +23,12 @@ public:
   virtual void applyDefaultOptions() { }
   virtual void setToyNumber(const int) { }
   virtual void setNToys(const int) { }
+  /// false if the algorithm writes its own output for each toy outside of the output tree and the toys directory,
+  /// so that the toys can't be split among forked processes (--toyForks)
+  virtual bool forkableToys() const { return true; }
+  /// called by --massList before each mass point (index 0 is the first one), if the algorithm can reuse
+  /// the likelihoods and the results of the previous point of the same model
+  virtual void beginMassPoint(unsigned int index) { }
   virtual bool run(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, double &limit, double &limitErr, const double *hint) = 0;
   virtual const std::string & name() const = 0;
   const boost::program_options::options_description & options() const {
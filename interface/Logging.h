@@ -0,0 +1,27 @@
+#ifndef HiggsAnalysis_CombinedLimit_Logging_h
+#define HiggsAnalysis_CombinedLimit_Logging_h
+/** Levels of the messages that combine prints itself, checked before the message is formatted:
+        CMB_LOG(logging::Warning, "underflow in " << pdf->GetName());
+        CMB_LOGF(logging::Info, "%f    %+.5f\n", x, y);
+    print the message only if the verbosity (-v) is at least its level and no CloseCoutSentry is silencing the output.
+    A message that is not wanted costs just these two comparisons, instead of being formatted and written to /dev/null,
+    so that they can be used inside the likelihood and the fits. The output of RooFit and Minuit still needs a CloseCoutSentry. */
+#include <atomic>
+#include <cstdio>
+#include <iostream>
+
+extern int verbose;
+
+namespace logging {
+    enum Level { Error = -99, Warning = 0, Info = 1, Debug = 2, Trace = 3 };
+    /// number of active silencing sentries (see CloseCoutSentry)
+    extern std::atomic<int> silenced_;
+    inline bool enabled(Level level) { return verbose >= int(level) && silenced_.load(std::memory_order_relaxed) == 0; }
+}
+
+/// stream msg and an end of line to std::cout, if the level is enabled
+#define CMB_LOG(level, msg) do { if (logging::enabled(level)) { std::cout << msg << std::endl; } } while (0)
+/// printf to stdout, if the level is enabled
+#define CMB_LOGF(level, ...) do { if (logging::enabled(level)) { printf(__VA_ARGS__); fflush(stdout); } } while (0)
+
+#endif
@@ -11,7 +11,7 @@
 #include "HiggsAnalysis/CombinedLimit/interface/LimitAlgo.h"
 #include <TList.h>
 class RooArgSet;
-namespace RooStats { class MarkovChain; }
+namespace RooStats { class MarkovChain; class ProposalFunction; }
 
 class MarkovChainMC : public LimitAlgo {
 public:
@@ -23,7 +23,7 @@ public:
     return name;
   }
 private:
-  enum ProposalType { FitP, UniformP, MultiGaussianP, TestP };
+  enum ProposalType { FitP, UniformP, MultiGaussianP, TestP, AdaptiveP };
   static std::string proposalTypeName_;
   static ProposalType proposalType_;
   static bool runMinos_, noReset_, updateProposalParams_, updateHint_;
@@ -37,6 +37,10 @@ private:
   static bool adaptiveBurnIn_;
   /// compute the limit N times
   static unsigned int tries_;
+  /// run up to this number of tries at the same time, in forked processes
+  static unsigned int chainForks_;
+  /// stop once the Gelman-Rubin R of the POI among the completed chains is below this, if positive
+  static float gelmanRubin_;
   /// Ignore up to this fraction of results if they're too far from the median
   static float truncatedMeanFraction_;
   /// do adaptive truncated mean
@@ -47,6 +51,8 @@ private:
   static bool saveChain_;
   /// Leave all parameters in the markov chain, not just the POI 
   static bool noSlimChain_;
+  /// Run the Metropolis-Hastings loop here on the NLL, instead of through MCMCCalculator
+  static bool nativeChain_;
   /// Merge chains instead of averaging limits
   static bool mergeChains_; 
   /// Read chains from file instead of running them 
@@ -68,8 +74,22 @@ private:
 
   mutable TList chains_;
 
-  // return number of items in chain, 0 for error
-  int runOnce(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, double &limit, double &limitErr, const double *hint) const ;
+  /// outcome of one try, as sent back from a forked process: accepted steps (0 for error), limit,
+  /// and weighted mean, variance and sum of weights of the POI in the chain after the burn-in
+  struct ChainResult { int accepted; double limit, mean, var, weight; };
+
+  // return number of items in chain, 0 for error.
+  // if stats is not null, fill in its mean, var and weight; if keepChain is not null, return there the chain instead of storing it 
+  int runOnce(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, double &limit, double &limitErr, const double *hint, ChainResult *stats = 0, RooStats::MarkovChain **keepChain = 0) const ;
+  /// run the tries from first to first+n-1 in forked processes, seeded with seeds[i], storing their chains in this process
+  void runForked(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, const double *hint, const std::vector<UInt_t> &seeds, unsigned int first, unsigned int n, std::vector<ChainResult> &results) const ;
+  /// Metropolis-Hastings on the NLL of the pdf (plus -log of the prior), keeping the points in flat arrays, and 
+  /// returning at the end a chain of the POI (or of all the parameters, with noSlimChain), or 0 for error
+  RooStats::MarkovChain *runNativeChain(RooStats::ModelConfig *mc_s, RooAbsData &data, RooStats::ProposalFunction &proposal) const ;
+  /// add the chain to chains_ for merging, and/or save it in the output file
+  void storeChain(RooStats::MarkovChain *chain) const ;
+  /// potential scale reduction factor of the POI among the chains
+  double gelmanRubin(const std::vector<ChainResult> &chains) const ;
 
   RooStats::MarkovChain *mergeChains(const RooArgSet &poi, const std::vector<double> &limits) const;
   void readChains(const RooArgSet &poi, std::vector<double> &limits);
@@ -9,6 +9,7 @@
  *
  */
 #include "HiggsAnalysis/CombinedLimit/interface/FitterAlgoBase.h"
+#include "HiggsAnalysis/CombinedLimit/interface/FitSummary.h"
 #include <TTree.h>
 #include <RooArgList.h>
 #include <RooFitResult.h>
@@ -26,6 +27,8 @@ public:
   virtual void applyOptions(const boost::program_options::variables_map &vm) ;
   virtual void setToyNumber(const int) ;
   virtual void setNToys(const int);
+  /// the fit results of each toy go to the trees of mlfit.root
+  virtual bool forkableToys() const { return false; }
 
 protected:
   virtual bool runSpecific(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, double &limit, double &limitErr, const double *hint);
@@ -39,6 +42,8 @@ protected:
   static bool        makePlots_;
   static float       rebinFactor_;
   static int         numToysForShapes_;
+  static int         shapeForks_;
+  static bool        linearShapeErrors_;
   static std::string signalPdfNames_, backgroundPdfNames_;
   static std::string filterString_;
   static bool        saveNormalizations_;
@@ -49,6 +54,11 @@ protected:
   static bool	     saveWorkspace_;
   static bool        reuseParams_;
   static bool        customStartingPoint_;
+  /// run the S+B fit in a forked process while this one does the B-only fit
+  static bool        parallelFits_;
+  /// in the toys after the first, fill toySummary_ with the fits instead of saving RooFitResults (--lightToyFits)
+  static bool        lightToyFits_;
+  FitSummary         toySummary_;
   int currentToy_, nToys;
   int fitStatus_, numbadnll_;
   double mu_, muErr_, muLoErr_, muHiErr_, nll_nll0_, nll_bonly_, nll_sb_;
@@ -80,6 +90,8 @@ protected:
         virtual void  generate(int ntoys) = 0;
         virtual const RooAbsCollection & get(int itoy) = 0;
         virtual const RooAbsCollection & centralValues() = 0;
+        /// the fit result the samples are drawn from, if any (for the linear propagation of the uncertainties)
+        virtual const RooFitResult * fitResult() const { return 0; }
   };
   void getNormalizations(RooAbsPdf *pdf, const RooArgSet &obs, RooArgSet &out, NuisanceSampler &sampler, TDirectory *fOut, const std::string &postfix,RooAbsData &data);
 
@@ -89,6 +101,7 @@ protected:
         virtual void  generate(int ntoys) {}
         virtual const RooAbsCollection & get(int) { return res_->randomizePars(); }
         virtual const RooAbsCollection & centralValues() { return res_->floatParsFinal(); }
+        virtual const RooFitResult * fitResult() const { return res_; }
     protected:
         RooFitResult *res_;
   };
@@ -11,6 +11,8 @@
 #include "HiggsAnalysis/CombinedLimit/interface/FitterAlgoBase.h"
 #include <RooRealVar.h>
 #include <vector>
+#include <map>
+#include <functional>
 
 class MultiDimFit : public FitterAlgoBase {
 public:
@@ -24,7 +26,7 @@ public:
 protected:
   virtual bool runSpecific(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, double &limit, double &limitErr, const double *hint);
 
-  enum Algo { None, Singles, Cross, Grid, RandomPoints, Contour2D, Stitch2D, FixedPoint, Impact };
+  enum Algo { None, Singles, Cross, Grid, AdaptiveGrid, RandomPoints, Contour2D, Stitch2D, FixedPoint, Impact, Breakdown };
   static Algo algo_;
 
   enum GridType { G1x1, G3x3 };
@@ -49,6 +51,7 @@ protected:
   static float autoRange_;
   static bool  startFromPreFit_;
   static std::string fixedPointPOIs_;
+  static std::string fixedPointsFile_;
 
   static std::string saveSpecifiedFuncs_;
   static std::string saveSpecifiedNuis_;
@@ -66,21 +69,104 @@ protected:
   static std::vector<float>        specifiedVals_;
   static RooArgList                specifiedList_;
   static bool saveInactivePOI_;
+  static unsigned int gridForks_;
+  static bool gridWarmStart_;
+  static bool randomPointsSobol_, randomPointsWarmStart_;
+  static bool fastScanHesse_, fastScanNewton_;
+  /// with --fastScanHesse, the parameters moved with the POIs, their best fit values (and those of the POIs),
+  /// their derivatives with respect to the POIs (n per parameter) and, with --fastScanNewton, their conditional covariance
+  static std::vector<RooRealVar *> hesseParams_;
+  static std::vector<double> hesseBest_, hessePoiBest_, hesseSlope_, hesseCondCov_;
+  static std::string adaptiveLevels_;
+  static unsigned int adaptiveDepth_;
+  /// when set (in the children of doWithFork), the points are recorded here instead of being committed
+  static std::vector<double> *pointRecord_;
+  /// with --checkpoint, index of the point of the grid being done (or -1), and what was committed for it so far
+  static int checkpointPoint_;
+  static std::vector<double> checkpointRecord_;
+  /// with --resume, what was committed for each point of the grid done by a previous job
+  static std::map<unsigned int, std::vector<double> > checkpointSaved_;
+  static std::string impactNuisances_;
+  static unsigned int impactForks_;
+  static unsigned int contourForks_;
+  static bool impactHesse_, impactWarmStart_;
+  /// --algo=breakdown: the groups of nuisances frozen in turn, the number of processes to split them among,
+  /// whether to print the estimate from the covariance matrix first, and the index of the group of each entry (-1 = none)
+  static std::string breakdownGroups_;
+  static unsigned int breakdownForks_;
+  static bool breakdownHesse_;
+  static int breakdownGroup_;
+  static float freezeNegligible_;
+  /// nuisances kept constant during the scan by --freezeNegligibleNuisances
+  static RooArgSet frozenNuisances_;
+  static double bestFitNLL_;
+  static float bestScanDeltaNLL_;
+  static std::vector<float> bestScanPoiVals_;
+  /// --fitCache: directory of the results of initial fits shared with the other jobs (see FitResultCache)
+  static std::string fitCache_;
+  /// the initial fit saved with this key by another job, with the parameters set to its best fit, if the NLL there
+  /// is the one that was saved (otherwise 0, and the parameters are left as they were)
+  RooFitResult * loadCachedFit(RooAbsPdf &pdf, RooAbsData &data, const RooCmdArg &constrain, const std::string &key) ;
   // initialize variables
   void initOnce(RooWorkspace *w, RooStats::ModelConfig *mc_s) ;
 
   // variables
   void doSingles(RooFitResult &res) ;
   void doGrid(RooWorkspace *w, RooAbsReal &nll) ;
+  /// grid of --points points, with the cells crossed by the contours at adaptiveLevels_ split in 2^n, recursively up to adaptiveDepth_ times
+  void doAdaptiveGrid(RooWorkspace *w, RooAbsReal &nll) ;
   void doRandomPoints(RooWorkspace *w, RooAbsReal &nll) ;
+  /// fit the random points first ... last, taken from points (n POIs per point) or drawn here if points is empty
+  void doRandomPointRange(RooAbsReal &nll, double nll0, const std::vector<double> &points, unsigned int first, unsigned int last) ;
   void doFixedPoint(RooWorkspace *w, RooAbsReal &nll) ;
+  /// evaluate all the points of fixedPointsFile_, in nearest-neighbour order
+  void doFixedPoints(RooAbsReal &nll, double nll0) ;
+  /// fit the points first ... last of points (n POIs per point), each starting from the result of the previous one
+  void doFixedPointRange(RooAbsReal &nll, double nll0, const std::vector<double> &points, unsigned int first, unsigned int last) ;
   void doContour2D(RooWorkspace *w, RooAbsReal &nll) ;
   void doStitch2D(RooWorkspace *w, RooAbsReal &nll) ;
   void doImpact(RooFitResult &res, RooAbsReal &nll) ;
+  /// do the +/- 1 sigma fits for the parameters of interest first ... last
+  void doImpactRange(RooFitResult &res, RooAbsReal &nll, RooArgSet &params, const RooArgSet &init_snap, const std::vector<float> &specifiedVals, int len, unsigned int first, unsigned int last) ;
+  /// 68% intervals of the POIs with each group of breakdownGroups_ frozen in turn at its best fit value
+  void doBreakdown(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooFitResult &res, RooAbsReal &nll) ;
+  /// starting from the best fit, the two crossings of each POI (lo then hi) with the groups first ... last frozen in turn
+  void doBreakdownRange(RooAbsReal &nll, const std::vector<RooArgList> &groups, unsigned int first, unsigned int last) ;
+  /// split the points of doGrid among gridForks_ child processes, and commit their results in order
+  void doGridWithFork(RooWorkspace *w, RooAbsReal &nll) ;
 
   // utilities
   /// for each RooRealVar, set a range 'box' from the PL profiling all other parameters
   void doBox(RooAbsReal &nll, double cl, const char *name="box", bool commitPoints=true) ;
+  /// read the points of fixedPointsFile_ (n POIs per point, those not given are kept at their current value)
+  void readFixedPoints(std::vector<double> &points) const ;
+  /// number of points in the grid, before applying firstPoint_ and lastPoint_
+  unsigned int gridSize() const ;
+  /// commit a point, or record it if running in a child of doWithFork
+  void commitPoint(const RooAbsCollection &params, float quantile) ;
+  /// append the quantile, deltaNLL_, poiVals_ and the values of params to record
+  void recordPoint(std::vector<double> &record, const RooAbsCollection &params, float quantile) const ;
+  /// restore the parameters of each point in record (as filled by recordPoint) and commit it; returns the number of points
+  unsigned int replayPoints(const RooAbsCollection &params, const std::vector<double> &record) ;
+  /// with --resume, read the points of the grid saved by a previous job
+  void loadGridCheckpoint(const RooAbsCollection &params) ;
+  /// with --checkpoint, save what was committed for the previous point of the grid and start recording ipoint (-1 to just save);
+  /// returns true if ipoint had been done by a previous job, in which case its points are committed again and it can be skipped
+  bool checkpointGridPoint(const RooAbsCollection &params, int ipoint) ;
+  /// set constant the nuisances whose correlation with all the POIs in res is below freezeNegligible_
+  void freezeNegligibleNuisances(const RooFitResult &res, const RooArgSet *nuisances) ;
+  /// fill the hesse* members from the covariance matrix of the initial fit
+  void setupHesseScan(RooWorkspace *w, const RooFitResult &res) ;
+  /// with --fastScan, move the other parameters to the prediction of --fastScanHesse for the current POIs (unless skip); returns true
+  bool fastProfile(RooAbsReal &nll, bool skip) ;
+  /// keep track of the point with the smallest deltaNLL_ committed while nuisances are frozen
+  void trackBestPoint() ;
+  /// release the frozen nuisances, and compare the fits with and without them at the best point of the scan
+  void checkFrozenNuisances(RooAbsReal &nll, const RooArgSet &bestFitSnap) ;
+  /// run job(first', last') on nforks child processes, splitting [first, last] in contiguous blocks, 
+  /// and then commit in order all the points recorded by the children (printing their logs if printLogs),
+  /// also appending their records to collected if not null (if not commit, the points are only collected)
+  void doWithFork(RooAbsReal &nll, unsigned int first, unsigned int last, unsigned int nforks, bool printLogs, const std::function<void(unsigned int, unsigned int)> &job, std::vector<double> *collected = 0, bool commit = true) ;
 };
 
 
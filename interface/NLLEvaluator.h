@@ -0,0 +1,70 @@
+#ifndef HiggsAnalysis_CombinedLimit_NLLEvaluator_h
+#define HiggsAnalysis_CombinedLimit_NLLEvaluator_h
+/** \class cacheutils::NLLEvaluator
+ *
+ * A CachingSimNLL as a plain function of an array of parameter values, for external optimisers and studies driven from
+ * python: one call sets all the parameters and evaluates, instead of one setVal per parameter through PyROOT.
+ * The arrays are raw pointers, so that PyROOT passes numpy arrays (or any contiguous buffer of doubles) without copies:
+ *
+ *    ROOT.gSystem.Load("libHiggsAnalysisCombinedLimit")
+ *    nll = w.pdf("model_s").createNLL(w.data("data_obs"), ROOT.RooFit.Constrain(w.set("nuisances")))
+ *    ev = ROOT.cacheutils.NLLEvaluator(nll)
+ *    x = numpy.zeros(ev.size()); ev.values(x); f = ev.eval(x)
+ *    grad = numpy.zeros(ev.size()); f = ev.evalGradient(x, grad)
+ *    X = numpy.zeros((1000, ev.size())); out = numpy.zeros(1000); ev.evalBatch(1000, X, out, 8)
+ *
+ * (python/NLLEvaluator.py wraps this for numpy). The batches on more than one thread are evaluated on clones of the
+ * NLL (NLLEvalContext) built on the first call, whose values are shifted to those of the original NLL, so that they
+ * don't depend on the number of threads; as for the other threaded features, SIMNLL_NO_LEE is recommended.
+ */
+#include <memory>
+#include <vector>
+
+class RooAbsReal;
+class RooArgList;
+class RooRealVar;
+
+namespace cacheutils {
+class CachingSimNLL;
+class NLLEvalContext;
+
+class NLLEvaluator {
+    public:
+        /// nll must be a CachingSimNLL (e.g. from createNLL of a RooSimultaneousOpt), or std::invalid_argument is thrown;
+        /// the parameters are those of params in this order, or the floating ones of the NLL in alphabetical order
+        explicit NLLEvaluator(RooAbsReal &nll, const RooArgList *params = 0) ;
+        ~NLLEvaluator() ;
+        /// number of parameters, i.e. of values in each point
+        unsigned int size() const { return params_.size(); }
+        const char * name(unsigned int i) const ;
+        /// the current values of the parameters (size() of them) into x
+        void values(double *x) const ;
+        /// NLL at x; the parameters of the NLL are left at x
+        double eval(const double *x) ;
+        /// NLL at x, and its gradient into grad (from CachingSimNLL::gradient: analytic for the main binned ingredients,
+        /// finite differences on the single terms otherwise)
+        double evalGradient(const double *x, double *grad) ;
+        /// NLL at the n points x[k*size()] ... x[k*size()+size()-1] into out[k], on nThreads threads (with the global
+        /// pool); the parameters of the NLL are left as they were
+        void evalBatch(unsigned int n, const double *x, double *out, unsigned int nThreads = 1) ;
+    private:
+        struct Clone {
+            std::unique_ptr<NLLEvalContext> context;
+            std::vector<RooRealVar *> params;
+            /// value of the original NLL minus that of the clone, at the same point (the zero points of the original)
+            double offset;
+        };
+        CachingSimNLL *nll_;
+        std::vector<RooRealVar *> params_;
+        std::vector<double> grad_;
+        std::vector<std::unique_ptr<Clone> > clones_;
+        /// stateId of the NLL when the clones were made: they are made again when its data or zero points change
+        unsigned long clonesState_;
+        static void set_(const std::vector<RooRealVar *> &params, const double *x) ;
+        void makeClones_(unsigned int n) ;
+        NLLEvaluator(const NLLEvaluator &) ;
+        NLLEvaluator & operator=(const NLLEvaluator &) ;
+};
+}
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef HiggsAnalysis_CombinedLimit_NormalizationCache_h
+#define HiggsAnalysis_CombinedLimit_NormalizationCache_h
+/** Shared cache of the normalization integrals of one-dimensional shapes without a closed form (PDF_NORM_CACHE).
+    
+    The integrals are keyed on the function, the values of its parameters and the range, so a point visited again
+    by the minimizer, or the same shape used in many categories or by the clones made for fits and toys, 
+    doesn't integrate again. On a miss the integral is computed by adaptive Gauss-Kronrod (7-15 points), 
+    subdividing until the relative difference between the two rules is below the tolerance.
+    Values are never interpolated between parameter points: the minimizer's numerical derivatives take steps 
+    far smaller than any interpolation error that could be guaranteed without integrating at the point anyway. */
+#include <vector>
+
+class NormalizationCache {
+    public:
+        typedef double (*Function)(double x, const double *params);
+        /// integral of f(x, params) over [xmin, xmax]
+        static double integral(Function f, const std::vector<double> &params, double xmin, double xmax) ;
+        /// drop all the cached integrals
+        static void clear() ;
+        /// whether the pdfs should use the cache, i.e. the value of PDF_NORM_CACHE
+        static bool enabled() ;
+    private:
+        static double integrate_(Function f, const double *params, double xmin, double xmax) ;
+};
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef HiggsAnalysis_CombinedLimit_PoissonSampler_h
+#define HiggsAnalysis_CombinedLimit_PoissonSampler_h
+
+#include <vector>
+class TRandom;
+
+/// Poisson random numbers for many means at once (e.g. all the bins of a binned toy), with the constants of each mean
+/// computed once and kept as long as the means don't change. Means below 10 are drawn by inversion starting from
+/// exp(-mean), the larger ones with the transformed rejection with squeeze of W. Hoermann (PTRS, 1993), which is
+/// exact and needs on average little more than two uniforms per draw. The uniforms are taken from the generator
+/// in blocks with TRandom::RndmArray.
+class PoissonSampler {
+    public:
+        PoissonSampler() : uniformsPerToy_(0), block_(16), next_(0), rnd_(0) {}
+        /// set the means of the bins, recomputing the constants only if they changed
+        void setMeans(unsigned int n, const double *means) ;
+        unsigned int size() const { return means_.size(); }
+        /// counts[itoy * size() + i] for ntoys draws of all the means, one toy after the other
+        void generate(TRandom &rnd, double *counts, unsigned int ntoys = 1) ;
+    private:
+        /// per mean: exp(-mean) for the inversion (a = 0), or the PTRS constants a, b, vr, log(1/alpha), log(mean)
+        struct Params { double mean, expm, a, b, vr, logInvAlpha, logMean; };
+        std::vector<double> means_;
+        std::vector<Params> params_;
+        /// about how many uniforms a toy takes, to size the blocks so that few are thrown away at the end of a call
+        double uniformsPerToy_;
+        std::vector<double> uniforms_;
+        unsigned int block_, next_;
+        TRandom *rnd_;
+        double uniform_() ;
+        double draw_(const Params &p) ;
+};
+
+#endif
@@ -5,6 +5,8 @@
 #include <RooAbsReal.h>
 #include "RooListProxy.h"
 
+class RooWorkspace;
+
 //_________________________________________________
 /*
 BEGIN_HTML
@@ -29,6 +31,22 @@ class ProcessNormalization : public RooAbsReal {
       void addAsymmLogNormal(double kappaLo, double kappaHi, RooAbsReal &theta) ;
       void addOtherFactor(RooAbsReal &factor) ;
       void dump() const ;
+      /// make n normalizations and import them into w in one call (for text2workspace, instead of one call per term):
+      /// names and params are lists of names separated by spaces, the parameters being RooAbsReals of w; the i-th
+      /// normalization has nominal value nominal[i] and the terms begin[i] ... begin[i+1]-1, each with the index of its
+      /// parameter in param, and kind 0 (addLogNormal of kappaHi), 1 (addAsymmLogNormal of kappaLo, kappaHi) or 2 (addOtherFactor).
+      /// Returns the number imported; throws std::invalid_argument if a parameter is not in w or the arrays don't match
+      static unsigned int importAll(RooWorkspace &w, unsigned int n, const char *names, const double *nominal, const char *params,
+                                    const int *begin, const int *kind, const int *param, const double *kappaLo, const double *kappaHi) ;
+      /// derivative with respect to theta, if it can be computed analytically (i.e. unless theta enters through a function in the other factors)
+      bool analyticalDerivative(const RooAbsArg &theta, double &deriv) const ;
+      // ---- read-only access to the terms, e.g. to evaluate many normalizations together ----
+      double nominalValue() const { return nominalValue_; }
+      const std::vector<double> & logKappas() const { return logKappa_; }
+      const RooArgList & thetaList() const { return thetaList_; }
+      const std::vector<std::pair<double,double> > & logAsymmKappas() const { return logAsymmKappa_; }
+      const RooArgList & asymmThetaList() const { return asymmThetaList_; }
+      const RooArgList & otherFactorList() const { return otherFactorList_; }
     protected:
         Double_t evaluate() const;
 
@@ -43,6 +61,10 @@ class ProcessNormalization : public RooAbsReal {
 
         // get the kappa for the appropriate x
         Double_t logKappaForX(double x, const std::pair<double,double> &logKappas ) const ;
+        // and its derivative with respect to x
+        Double_t logKappaForXDerivative(double x, const std::pair<double,double> &logKappas ) const ;
+        // sum of theta * logKappa over all the log-normals
+        Double_t logValue() const ;
 
   ClassDef(ProcessNormalization,1) // Process normalization interpolator 
 };
@@ -9,6 +9,8 @@
  *
  */
 #include "HiggsAnalysis/CombinedLimit/interface/LimitAlgo.h"
+#include <functional>
+#include <vector>
 
 class RooAbsPdf; class RooRealVar; class RooAbsData; class RooArgSet;
 
@@ -39,6 +41,8 @@ protected:
   static bool useMinos_, bruteForce_;
   static std::string bfAlgo_;
   static int  points_;
+  /// processes among which to split the points of the brute force searches
+  static int  bfForks_;
 
   // ----- options for handling cases where the likelihood fit misbihaves ------
   /// compute the limit N times
@@ -70,6 +74,10 @@ protected:
   std::pair<double,double> upperLimitBruteForce(RooAbsPdf &pdf, RooAbsData &data, RooRealVar &poi, const RooArgSet *nuisances, double tolerance, double cl) const ;
   double significanceBruteForce(RooAbsPdf &pdf, RooAbsData &data, RooRealVar &poi, const RooArgSet *nuisances, double tolerance) const ;
   double significanceFromScan(RooAbsPdf &pdf, RooAbsData &data, RooRealVar &poi, const RooArgSet *nuisances, double tolerance, int npoints) const ;
+  /// profile nll at each of the values of poi, split in contiguous blocks among bfForks_ processes where each point starts from
+  /// the fit of the one before it (and then once more in the opposite order, if twice). Returns nll and success of each point,
+  /// in the order of the values, for the first pass and then for the second; NaN and 0 for the points of a process that failed
+  std::vector<double> profileInForks_(const std::vector<double> &rvals, RooRealVar &poi, RooAbsReal &nll, const std::function<bool()> &minimize, bool twice) const ;
 };
 
 #endif
@@ -3,6 +3,7 @@
 
 #include <memory>
 #include <vector>
+#include <map>
 
 class RooMinimizerOpt;
 #include <RooAbsPdf.h>
@@ -11,6 +12,7 @@ class RooMinimizerOpt;
 #include <RooStats/TestStatistic.h>
 #include "HiggsAnalysis/CombinedLimit/interface/RooSimultaneousOpt.h"
 #include "HiggsAnalysis/CombinedLimit/interface/CachingNLL.h"
+#include "HiggsAnalysis/CombinedLimit/interface/utils.h"
 
 namespace nllutils {
     bool robustMinimize(RooAbsReal &nll, RooMinimizerOpt &minimizer, int verbosity=0, bool zeroPoint=false);
@@ -64,6 +66,9 @@ class ProfiledLikelihoodTestStatOpt : public RooStats::TestStatistic {
         void setPrintLevel(Int_t level) { verbosity_ = level; }
 
         void SetOneSided(OneSidedness oneSided) { oneSided_ = oneSided; }
+        /// in the multi-r Evaluate, start each constrained fit from the minimum of the previous value of r, if the NLL
+        /// is lower there than at the unconstrained one (the values of r should then be sorted)
+        void setWarmStartAdjacent(bool warm) { warmStartAdjacent_ = warm; }
     private:
 
         RooAbsPdf *pdf_;
@@ -75,10 +80,16 @@ class ProfiledLikelihoodTestStatOpt : public RooStats::TestStatistic {
         RooArgList gobsParams_, gobs_;
         Int_t verbosity_;
         OneSidedness oneSided_;
+        bool warmStartAdjacent_;
+        // opt-in (--X-rtd PLTSO_WARMSTART): parameters at the minima for the previous toy, for each value of r, used as starting points
+        std::map<double, utils::CheapValueSnapshot> warmUnconstrained_, warmConstrained_;
 
         // create NLL. if returns true, it can be kept, if false it should be deleted at the end of Evaluate
         bool createNLL(RooAbsPdf &pdf, RooAbsData &data) ;
         double minNLL(bool constrained, RooRealVar *r=0) ;
+        /// move the parameters to start, unless the NLL is lower at the current starting point; returns true if moved
+        bool warmStart_(const utils::CheapValueSnapshot &start) ;
+        void saveWarmStart_(utils::CheapValueSnapshot &start, double nll) ;
 }; // TestSimpleStatistics
 
 
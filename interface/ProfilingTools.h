@@ -1,6 +1,7 @@
 #ifndef HiggsAnalysis_CombinedLimit_ProfilingTools_
 #define HiggsAnalysis_CombinedLimit_ProfilingTools_
 #include <string>
+#include <typeinfo>
 
 bool setupIgProfDumpHook() ;
 
@@ -20,6 +21,35 @@ class PerfCounter {
         double value_;
 };
 
+struct ScopedTimerNode;
+/// Hierarchical wall-clock timer: it measures the time between its construction and destruction,
+/// and accounts it under the path of the timers open at that moment on the same thread
+/// (e.g. MultiDimFit / CascadeMinimizer::minimize / CachingSimNLL / channel / pdf class).
+/// Timers are disabled unless enabled at runtime, and in that case cost just a branch.
+class ScopedTimer {
+    public:
+        explicit ScopedTimer(const char *name) : node_(enabled_ && name ? push(name, false) : 0) {}
+        /// timer named after a class (e.g. typeid(*this))
+        explicit ScopedTimer(const std::type_info &type) : node_(enabled_ ? push(type.name(), true) : 0) {}
+        ~ScopedTimer() { if (node_) pop(node_); }
+        static bool enabled() { return enabled_; }
+        /// level 1 = print the timers at the end of the job, 2 = also write them as JSON in timers.<pid>.json,
+        /// 3 = also write all the timed calls as a Chrome trace (chrome://tracing) in trace.<pid>.json.
+        /// With the runtimedef PROFILE_COUNTERS, the timers also count cycles, instructions and L1D and LLC misses with
+        /// the Linux perf_event counters of each thread (plus one raw event of the CPU, if PROFILE_COUNTERS_RAW gives its code, 
+        /// e.g. the retired vector instructions); this costs two system calls per timer, so it's for tuning and not for timing
+        static void enable(int level) ;
+        /// produce the output requested in enable 
+        static void report() ;
+    private:
+        ScopedTimer(const ScopedTimer &) ;
+        ScopedTimer & operator=(const ScopedTimer &) ;
+        ScopedTimerNode *node_;
+        static bool enabled_;
+        static ScopedTimerNode *push(const char *name, bool demangle) ;
+        static void pop(ScopedTimerNode *node) ;
+};
+
 namespace runtimedef {
     // get the flag. name MUST BE a compile-time string
     int  get(const char *name);
@@ -16,6 +16,7 @@
 #include "RooChangeTracker.h"
 #include "TMath.h"
 #include "Math/SMatrix.h"
+#include <algorithm>
 
 class RooRealVar;
 class RooArgList ;
@@ -98,6 +99,21 @@ public:
 
     }
 
+  const RooAbsReal & x() const { return _x.arg(); }
+
+  /// coefficients of the polynomial in the power basis of the rescaled x in [0,1], for the current bernstein coefficients;
+  /// returns the integral of the polynomial over the rescaled x (to be multiplied by xmax-xmin)
+  double powerCoefficients(double *coeffs) const
+    {
+      _bernvector[0] = 1.0;
+      for (int ipow=1; ipow<=N; ++ipow) {
+        _bernvector[ipow] = static_cast<RooAbsReal*>(_coefList.at(ipow-1))->getVal();
+      }     
+      _powvector = _cmatrix*_bernvector;
+      std::copy(_powvector.begin(), _powvector.end(), coeffs);
+      return ROOT::Math::Dot(_powvector,_rvector);
+    }
+
 protected:
 
   typedef ROOT::Math::SMatrix<double,N+1,N+1,ROOT::Math::MatRepStd<double,N+1,N+1> > MType;
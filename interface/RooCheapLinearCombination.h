@@ -0,0 +1,28 @@
+#ifndef HiggsAnalysis_CombinedLimit_RooCheapLinearCombination_h
+#define HiggsAnalysis_CombinedLimit_RooCheapLinearCombination_h
+#include <RooAbsReal.h>
+#include <RooListProxy.h>
+#include <vector>
+
+/// offset + sum_i coeffs[i] * terms[i], with the coefficients stored as plain numbers
+/// (unlike RooAddition of two lists, that makes one RooProduct per term and one RooRealVar per coefficient)
+class RooCheapLinearCombination : public RooAbsReal {
+    public:
+        RooCheapLinearCombination() : offset_(0) {}
+        RooCheapLinearCombination(const char *name, const char *title, const RooArgList &terms, const std::vector<double> &coeffs, double offset=0);
+        RooCheapLinearCombination(const RooCheapLinearCombination& other, const char* name=0);
+        virtual ~RooCheapLinearCombination() {}
+        virtual TObject *clone(const char *newname) const { return new RooCheapLinearCombination(*this,newname); } 
+        const RooArgList & terms() const { return terms_; }
+        const std::vector<double> & coefficients() const { return coeffs_; }
+        double offset() const { return offset_; }
+    protected:
+        RooListProxy terms_;
+        std::vector<double> coeffs_;
+        double offset_;
+        virtual Double_t evaluate() const ;
+    private:
+        ClassDef(RooCheapLinearCombination,1) // Linear combination with constant coefficients
+};
+
+#endif
@@ -12,6 +12,8 @@ class RooCheapProduct : public RooAbsReal {
         virtual ~RooCheapProduct() {}
         virtual TObject *clone(const char *newname) const { return new RooCheapProduct(*this,newname); } 
         const RooArgList & components() const { return terms_; }
+        /// product of the constant terms that were pruned from the components
+        double offset() const { return offset_; }
     protected:
         RooListProxy terms_;
         std::vector<RooAbsReal *> vterms_;
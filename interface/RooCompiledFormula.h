@@ -0,0 +1,64 @@
+#ifndef HiggsAnalysis_CombinedLimit_RooCompiledFormula_h
+#define HiggsAnalysis_CombinedLimit_RooCompiledFormula_h
+
+#include <RooAbsReal.h>
+#include <RooListProxy.h>
+#include <string>
+#include <vector>
+
+//_________________________________________________
+/*
+BEGIN_HTML
+<p>
+RooCompiledFormula computes the same expressions as a RooFormulaVar, with the same syntax for the dependents
+(by name or as @0, @1, ...), without going through TFormula: the formula is parsed once into a straight-line
+program on registers, with the common subexpressions evaluated once and the constant subexpressions folded.
+Supported are the arithmetic, comparison and logical operators, ^ and ** for powers, and the functions
+sqrt, exp, log, log10, pow, abs, fabs, min, max, sin, cos, tan, atan, atan2 and their TMath:: counterparts.
+</p>
+END_HTML
+*/
+//
+class RooCompiledFormula : public RooAbsReal {
+
+   public:
+      RooCompiledFormula() : init_(false), compiled_(false) {}
+      RooCompiledFormula(const char *name, const char *title, const char *formula, const RooArgList &dependents) ;
+      RooCompiledFormula(const RooCompiledFormula &other, const char *newname=0) ;
+      ~RooCompiledFormula() {}
+
+      TObject * clone(const char *newname) const { return new RooCompiledFormula(*this, newname); }
+
+      const std::string & formula() const { return formula_; }
+      const RooArgList & dependents() const { return deps_; }
+      /// false if the formula uses something that can't be compiled, and should be left to a RooFormulaVar
+      bool compiled() const ;
+      /// number of instructions, after the common subexpressions and the constants have been folded
+      unsigned int size() const ;
+
+    protected:
+        Double_t evaluate() const;
+
+    private:
+        std::string formula_;
+        RooListProxy deps_;
+
+        enum OpCode { Add, Sub, Mul, Div, Pow, Min, Max, Atan2, Lt, Le, Gt, Ge, Eq, Ne, And, Or,
+                      Neg, Not, Sqrt, Exp, Log, Log10, Abs, Sin, Cos, Tan, Atan };
+        /// regs[out] = op(regs[a], regs[b])
+        struct Instr { OpCode op; unsigned int out, a, b; };
+
+        /// registers: the dependents first, then the constants, then the results of the instructions
+        mutable bool init_, compiled_; //! not to be serialized
+        mutable std::vector<Instr> code_; //! not to be serialized
+        mutable std::vector<Double_t> regs_; //! not to be serialized
+        mutable unsigned int result_; //! not to be serialized
+        void init() const ;
+        static double apply(OpCode op, double a, double b) ;
+
+        friend class RooCompiledFormulaParser;
+
+  ClassDef(RooCompiledFormula,1) // Formula compiled into a straight-line program
+};
+
+#endif
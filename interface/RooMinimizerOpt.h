@@ -8,6 +8,14 @@
    #include <RooMinimizer.h>
    #undef protected
 #endif
+#include <memory>
+#include <vector>
+#include <Math/IFunction.h>
+#include <TMatrixDSym.h>
+
+namespace cacheutils { class CachingSimNLL; }
+class RooMinimizerFcnOptGrad;
+class RooMinimizerFcnOptForkGrad;
 
 class RooMinimizerOpt : public RooMinimizer {
     public:
@@ -16,10 +24,35 @@ class RooMinimizerOpt : public RooMinimizer {
         Int_t minimize(const char* type, const char* alg=0) ;
         Int_t improve() ;
         Int_t migrad() ;
+        /// with --X-rtd MINIMIZER_NATIVE_HESSE (=N for N threads) the second derivatives come from CachingSimNLL::hessian
+        /// instead of Minuit's HESSE, falling back to it if they can't be computed there or aren't positive definite
         Int_t hesse() ;
+        /// as RooMinimizer::save, with the covariance matrix of the native hesse if the parameters haven't moved since
+        RooFitResult *save(const char *name = 0, const char *title = 0) ;
+        /// what save puts in the RooFitResult besides the parameters: status of the last step, quality of the covariance
+        /// matrix, EDM and number of invalid evaluations of the function (for the results that don't need the rest)
+        void fitStatus(int &status, int &covQual, double &edm, int &numInvalidNLL) const ;
         Int_t minos() ;
         Int_t minos(const RooArgSet& minosParamList) ;
-
+        /// use Minuit2Warm instead of Minuit2, seeding each minimization with the covariance matrix of the previous one
+        static void setWarmStart(bool warmStart) { warmStart_ = warmStart; }
+    protected:
+        static bool warmStart_;
+        /// minimizer type to configure in the fitter for the requested one
+        static const char *fitterType(const char *type) ;
+        /// analytical gradient of the function, if requested with MINIMIZER_ANALYTIC_GRADIENT and available,
+        /// or the numerical one of groups of parameters at once with MINIMIZER_COLORED_GRADIENT
+        std::auto_ptr<RooMinimizerFcnOptGrad> _gradFcn;
+        /// numerical gradient computed in parallel processes, if requested with MINIMIZER_PARALLEL_GRADIENT=N
+        std::auto_ptr<RooMinimizerFcnOptForkGrad> _forkGradFcn;
+        bool fitFCN() ;
+        /// covariance matrix of the native hesse, and the values of the floating parameters where it was computed
+        std::auto_ptr<TMatrixDSym> _nativeCov;
+        std::vector<double> _nativeCovX;
+        bool nativeHesse_() ;
+        /// MINOS for both sides of each parameter in a separate forked process, at most forks at a time
+        /// (--X-rtd MINIMIZER_PARALLEL_MINOS=N); errors gets the lower and upper errors, like those of Minuit
+        bool parallelMinos_(const std::vector<unsigned int> &paramInd, unsigned int forks, std::vector<std::pair<double,double> > &errors) ;
 };
 
 class RooMinimizerFcnOpt : public RooMinimizerFcn {
@@ -29,11 +62,34 @@ class RooMinimizerFcnOpt : public RooMinimizerFcn {
         virtual ROOT::Math::IBaseFunctionMultiDim* Clone() const;
         Bool_t Synchronize(std::vector<ROOT::Fit::ParameterSettings>& parameters, Bool_t optConst, Bool_t verbose);
         void initStdVects() const ;
+        const std::vector<RooRealVar *> & floatVars() const { return _vars; }
+        /// derivative of the value of the i-th parameter with respect to the one seen by the minimizer 
+        double dTransform(int index, double x) const { return _hasOptimzedBounds[index] ? _optimzedBounds[index].derivative(x) : 1.0; }
+        /// true if the i-th parameter is seen by the minimizer through the soft bounds transformation (so it has no hard bounds)
+        bool hasOptimizedBounds(int index) const { return _hasOptimzedBounds[index]; }
+        /// number of evaluations done by all the instances in this process (the fitter works on clones of the function)
+        static unsigned long totalEvals() { return totalEvals_; }
+        /// number of calls answered from the memo of MINIMIZER_MEMO instead of evaluating the function
+        static unsigned long memoHits() { return memoHits_; }
     protected:
+        static unsigned long totalEvals_, memoHits_;
+        /// with MINIMIZER_MEMO=N, the values of the function at the last points, in N slots by hash of the point (e.g. the
+        /// best fit, evaluated again by the fallbacks, hesse and minos); dropped when the constant parameters change,
+        /// or the data or zero points (see CachingSimNLL::stateId). Only when minimizing a CachingSimNLL, since the
+        /// data of other functions can change without notice
+        struct MemoEntry { std::vector<double> x; double value; };
+        mutable std::vector<MemoEntry> _memo;
+        mutable std::vector<double>    _memoState, _memoStateWork;
+        /// the slot for x, after emptying all of them if the state changed
+        MemoEntry & memoSlot_(const double *x, unsigned int size) const ;
         virtual double DoEval(const double * x) const;
         mutable std::vector<RooRealVar *> _vars;
         mutable std::vector<double>       _vals;
         mutable std::vector<bool  >       _hasOptimzedBounds;
+        /// with MINIMIZER_DIRECT_WRITE, for each parameter all the nodes downstream of its value, each listed once:
+        /// the parameters are then set with the propagation of the dirty flags inhibited, and only these nodes marked
+        mutable std::vector<std::vector<RooAbsArg *> > _dirtyLists;
+        void initDirtyLists() const ;
         struct OptBound {
             double softMin, softMax, hardMin, hardMax;
             double transform(double x) const {
@@ -47,8 +103,67 @@ class RooMinimizerFcnOpt : public RooMinimizerFcn {
                     return x;
                 }
             }
+            double derivative(double x) const {
+                if (x < softMin) {
+                    double dx = (softMin-x)/(softMin-hardMin); 
+                    return std::exp(-2*dx) * (1 + 2*dx);
+                } else if (x > softMax) { 
+                    double dx = (x-softMax)/(hardMax-softMax);
+                    return std::exp(-2*dx) * (1 + 2*dx);
+                } else {
+                    return 1.0;
+                }
+            }
         };
         mutable std::vector<OptBound> _optimzedBounds;
 };
 
+/// Gradient of a CachingSimNLL, as seen by the minimizer through a RooMinimizerFcnOpt
+class RooMinimizerFcnOptGrad : public ROOT::Math::IMultiGradFunction {
+    public:
+        /// with colored, CachingSimNLL::coloredGradient instead of the analytical one
+        RooMinimizerFcnOptGrad(const RooMinimizerFcnOpt &fcn, const cacheutils::CachingSimNLL &nll, bool colored = false) ;
+        virtual ROOT::Math::IMultiGradFunction* Clone() const { return new RooMinimizerFcnOptGrad(*this); }
+        virtual unsigned int NDim() const { return _fcn.NDim(); }
+        virtual void Gradient(const double *x, double *grad) const ;
+        /// true if the analytical gradient is implemented for this function
+        static bool canHandle(const RooAbsReal &funct) ;
+    protected:
+        virtual double DoEval(const double * x) const { return _fcn(x); }
+        virtual double DoDerivative(const double * x, unsigned int icoord) const ;
+        const RooMinimizerFcnOpt &_fcn;
+        const cacheutils::CachingSimNLL &_nll;
+        bool _colored;
+        mutable std::vector<double> _lastX, _lastGrad, _work;
+};
+
+/// Numerical gradient of a RooMinimizerFcnOpt by central finite differences, the coordinates being shared among
+/// persistent forked processes, each with its own copy of the function: the processes are started on the first call
+/// and stay alive until stopWorkers() or until the last copy of this object is deleted.
+class RooMinimizerFcnOptForkGrad : public ROOT::Math::IMultiGradFunction {
+    public:
+        RooMinimizerFcnOptForkGrad(const RooMinimizerFcnOpt &fcn, unsigned int workers) ;
+        virtual ROOT::Math::IMultiGradFunction* Clone() const { return new RooMinimizerFcnOptForkGrad(*this); }
+        virtual unsigned int NDim() const { return _fcn.NDim(); }
+        virtual void Gradient(const double *x, double *grad) const ;
+        /// stop the processes, e.g. because the function is going to change (new data, zero points, constant parameters)
+        void stopWorkers() const ;
+    protected:
+        struct Workers {
+            unsigned int size;
+            std::vector<int> pids, toChild, fromChild;
+            Workers(unsigned int n) : size(n) {}
+            ~Workers() { stop(); }
+            void stop() ;
+        };
+        virtual double DoEval(const double * x) const { return _fcn(x); }
+        virtual double DoDerivative(const double * x, unsigned int icoord) const ;
+        /// derivative along coordinate i at x, using (and then restoring) _xwork
+        double partial_(const double *x, unsigned int i) const ;
+        void startWorkers_() const ;
+        const RooMinimizerFcnOpt &_fcn;
+        std::shared_ptr<Workers> _workers; // shared with the clones
+        mutable std::vector<double> _lastX, _lastGrad, _xwork, _buffer;
+};
+
 #endif
@@ -120,6 +120,11 @@ public:
   virtual Bool_t selfNormalized() const { return kTRUE; }
   Bool_t setBinIntegrator(RooArgSet& allVars);
   void useHorizontalMorphing(Bool_t val) { _useHorizMorph = val; }
+  Bool_t useHorizontalMorphing() const { return _useHorizMorph; }
+  const RooArgList& pdfList() const { return _pdfList; }
+  // fractions of the reference pdfs at the current values of the parameters, for the pdf without horizontal morphing
+  // (which is then just their mixture, normalized by the sum of the fractions); false if they can't be computed
+  Bool_t mixingFractions(vector<double>& fracs) const;
 
   Double_t evaluate() const;
   virtual Double_t getVal(const RooArgSet* set=0) const;
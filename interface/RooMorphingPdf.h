@@ -7,12 +7,17 @@
 #include "RooRealProxy.h"
 #include "RooArgSet.h"
 #include "RooAbsReal.h"
+#include "RooAbsData.h"
 #include "TH1F.h"
 #include "Rtypes.h"
 #include "HiggsAnalysis/CombinedLimit/interface/VerticalInterpHistPdf.h"
 #include "HiggsAnalysis/CombinedLimit/interface/SimpleCacheSentry.h"
 
+class RooMorphingPdfV;
+
 class RooMorphingPdf : public RooAbsPdf {
+  friend class RooMorphingPdfV;
+
  protected:
 
   // Store morphing parameters and allocate arrays
@@ -58,6 +63,12 @@ class RooMorphingPdf : public RooAbsPdf {
   mutable double mh_lo_;  //! not to be serialized
   mutable double mh_hi_;  //! not to be serialized
 
+  // Morphed and rebinned templates for the last mass values, valid as long as
+  // the shape parameters of the input templates don't change
+  typedef std::map<double, FastHisto> MorphedMap;
+  mutable MorphedMap morphed_;  //! not to be serialized
+  mutable SimpleCacheSentry shape_sentry_; //! not to be serialized
+
   void SetAxisInfo();
   void Init() const;
 
@@ -86,8 +97,26 @@ class RooMorphingPdf : public RooAbsPdf {
 
   virtual Double_t evaluate() const;
 
+  // Bring the morphed template up to date with the current mass and
+  // shape parameters, and return it
+  FastHisto const& cache() const;
+
  public:
   ClassDef(RooMorphingPdf, 1);
 };
 
+// Vectorized evaluation of a RooMorphingPdf over a dataset: the bins of all
+// the entries are found once, and each fill only copies the contents of the
+// morphed template
+class RooMorphingPdfV {
+ public:
+  RooMorphingPdfV(const RooMorphingPdf& pdf, const RooAbsData& data,
+                  bool includeZeroWeights = false);
+  void fill(std::vector<Double_t>& out) const;
+
+ private:
+  const RooMorphingPdf& pdf_;
+  std::vector<int> bins_;
+};
+
 #endif
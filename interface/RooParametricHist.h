@@ -6,13 +6,17 @@
 #include "RooAbsPdf.h"
 #include "RooAddition.h"
 #include "RooAbsReal.h"
-//#include "RooAbsData.h"
+#include "RooAbsData.h"
 #include "TH1D.h"
 #include "TH1F.h"
 #include "TH1.h"
 #include "TString.h"
+#include <vector>
   
+class RooParametricHistV;
+
 class RooParametricHist : public RooAbsPdf {
+friend class RooParametricHistV;
 public:
   
   RooParametricHist() {} ;
@@ -47,4 +51,17 @@ private:
    ClassDef(RooParametricHist, 1) 
 };
 
+// Vectorized evaluation over a dataset: each entry is mapped to its bin once,
+// and each fill is a gather of the bin densities, normalized by their dot product with the widths
+class RooParametricHistV {
+public:
+  RooParametricHistV(const RooParametricHist &pdf, const RooAbsData &data, bool includeZeroWeights=false) ;
+  void fill(std::vector<Double_t> &out) const ;
+private:
+  std::vector<const RooAbsReal *> pars_;
+  std::vector<double> widths_;
+  std::vector<int> bins_;
+  mutable std::vector<double> densities_;
+};
+
 #endif
@@ -14,7 +14,7 @@ typedef std::complex<double> complexD;
 class RooScaleLOSM: public RooAbsReal
 {
   public:
-    RooScaleLOSM(){};
+    RooScaleLOSM() : mHAmp_(NAN), mbAmp_(NAN) {};
     RooScaleLOSM(const char *name, const char *title, RooAbsReal &mH);
     ~RooScaleLOSM(){};
 
@@ -25,16 +25,20 @@ class RooScaleLOSM: public RooAbsReal
     inline complexD AmpSpinOneHalf(double tau) const;
     inline complexD AmpSpinOne(double tau) const;
     virtual Double_t evaluate() const = 0;
+    /// true (and remember the masses) if the amplitudes were last computed for other values of mH and mb
+    bool amplitudesOutdated(double mH, double mb) const;
 
     RooRealProxy mH_;
     static const double mt_, mW_;
-    complexD At_, Ab_, AW_;
+    mutable complexD At_, Ab_, AW_;
 
-    double C_SM_;
+    mutable double C_SM_;
+    /// masses of the current amplitudes, which are computed again only when they change
+    mutable double mHAmp_, mbAmp_; //!
 
   private:
 
-    ClassDef(RooScaleLOSM,1)
+    ClassDef(RooScaleLOSM,2)
 };
 
 class RooScaleHGamGamLOSM: public RooScaleLOSM
@@ -49,6 +53,7 @@ class RooScaleHGamGamLOSM: public RooScaleLOSM
 
   protected:
       Double_t evaluate() const;
+      void updateAmplitudes() const;
       RooRealProxy ct_, cW_, mb_, cb_;
 
   private:
@@ -68,6 +73,7 @@ class RooScaleHGluGluLOSM: public RooScaleLOSM
 
   protected:
       Double_t evaluate() const;
+      void updateAmplitudes() const;
       RooRealProxy ct_, mb_, cb_;
 
   private:
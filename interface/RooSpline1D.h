@@ -18,7 +18,7 @@ END_HTML
 class RooSpline1D : public RooAbsReal {
 
    public:
-      RooSpline1D() : interp_(0) {}
+      RooSpline1D() : interp_(0), init_(false), direct_(false), lastValid_(false) {}
       RooSpline1D(const char *name, const char *title, RooAbsReal &xvar, const char *path, const unsigned short xcol, const unsigned short ycol, const unsigned short skipLines=0, const char *algo="CSPLINE") ;
       RooSpline1D(const char *name, const char *title, RooAbsReal &xvar, unsigned int npoints, const double *xvals, const double *yvals, const char *algo="CSPLINE") ;
       RooSpline1D(const char *name, const char *title, RooAbsReal &xar, unsigned int npoints, const float *xvals, const float *yvals, const char *algo="CSPLINE") ;
@@ -38,6 +38,18 @@ class RooSpline1D : public RooAbsReal {
         mutable ROOT::Math::Interpolator *interp_; //! not to be serialized        
         void init() const ;
 
+        /// CSPLINE and LINEAR are evaluated directly with the coefficients of each interval,
+        /// y = y_[i] + dx*(b_[i] + dx*(c_[i] + dx*d_[i])) with dx = x - x_[i], and the interpolator
+        /// is only built for the other types or for x outside the points
+        mutable bool init_, direct_; //! not to be serialized
+        mutable std::vector<double> b_, c_, d_; //! not to be serialized
+        mutable unsigned int lastInterval_; //! not to be serialized
+        /// last value of x and of the result, as x (typically MH) rarely changes
+        mutable bool lastValid_; //! not to be serialized
+        mutable double lastX_, lastY_; //! not to be serialized
+        void initCoefficients() const ;
+        double evalDirect(double x) const ;
+
   ClassDef(RooSpline1D,1) // Smooth interpolation	
 };
 
@@ -41,6 +41,16 @@ Produces N ->1 function from TTree
 Branch to be considered as F(x) should be passed in fName, 
 otherwise it is assumed to be called, "f"
 
+If support > 0, a compactly supported (Wendland) radial function of that
+radius is used instead of the gaussian: the points are indexed in a k-d tree,
+only those within the support contribute to the evaluation, and the weights
+are found from a sparse linear system. This is much faster when there are
+many points, provided the support contains only a few tens of them.
+
+If weightCache is the name of a ROOT file, the solved weights are stored
+there keyed by a hash of the points, values and settings, and read back
+instead of solving again when the same spline is built.
+
 TODO : 
 1) Add additional Radial basis function to choose from (via enums?)
 
@@ -60,16 +70,23 @@ END_HTML
 class RooSplineND : public RooAbsReal {
 
    public:
-      RooSplineND() : ndim_(0),M_(0),eps_(3.) {}
-      RooSplineND(const char *name, const char *title, RooArgList &vars, TTree *tree, const char* fName="f", double eps=3., bool rescale=false, std::string cutstring="" ) ;
+      RooSplineND() : ndim_(0),M_(0),eps_(3.),support_(0.) {}
+      RooSplineND(const char *name, const char *title, RooArgList &vars, TTree *tree, const char* fName="f", double eps=3., bool rescale=false, std::string cutstring="", double support=0., const char *weightCache="" ) ;
       RooSplineND(const RooSplineND& other, const char *name) ; 
-      RooSplineND(const char *name, const char *title, const RooListProxy &vars, int ndim, int M, double eps, bool rescale, std::vector<double> &w, std::map<int,std::vector<double> > &map, std::map<int,std::pair<double,double> > & ,double,double) ;
+      RooSplineND(const char *name, const char *title, const RooListProxy &vars, int ndim, int M, double eps, bool rescale, std::vector<double> &w, std::map<int,std::vector<double> > &map, std::map<int,std::pair<double,double> > & ,double,double, double support=0.) ;
       ~RooSplineND() ;
 
       TObject * clone(const char *newname) const ;
 
       TGraph* getGraph(const char *xvar, double step) ;
 
+      /// Tabulate the spline on a regular grid of nPointsPerDim points per variable over the range of the
+      /// input points, to be used with multilinear interpolation inside that range instead of the exact sum.
+      /// The table is dropped, and false returned, if it differs from the exact spline by more than tolerance
+      /// at any of nCheck random points. The table is persisted with the object.
+      bool buildLookupTable(int nPointsPerDim, double tolerance, int nCheck=1000) ;
+      void clearLookupTable() { lut_.clear(); lutN_.clear(); setValueDirty(); }
+
     protected:
         Double_t evaluate() const;
 
@@ -89,13 +106,38 @@ class RooSplineND : public RooAbsReal {
 
 	void calculateWeights(std::vector<double> &);
 	double getDistSquare(int i, int j);
-	double getDistFromSquare(int i) const;
+	double getDistFromSquare(int i, const double *x) const;
 	double radialFunc(double d2, double eps) const;
 
 	bool rescaleAxis;
-	
 
-  ClassDef(RooSplineND,1) 
+	/// radius of the compactly supported radial function, or 0 to use the gaussian one
+	double support_;
+	/// coordinates of the points as used for the distances (i.e. rescaled if rescaleAxis), point-major
+	mutable std::vector<double> kdPts_; //!
+	/// k-d tree over kdPts_: the median of each range is the node, split along depth % ndim_
+	mutable std::vector<int> kdIdx_; //!
+	/// scratch space for the neighbours in evaluate
+	mutable std::vector<std::pair<int,double> > kdFound_; //!
+
+	double coord(int k, double v) const { return rescaleAxis ? axis_pts_*v/(r_map.find(k)->second.second-r_map.find(k)->second.first) : v; }
+	double compactFunc(double d2) const;
+	void buildTree() const;
+	void buildTree(int lo, int hi, int depth) const;
+	/// append to out all the points i, with their squared distance d2 from x, for which d2 < support_*support_
+	void neighbours(const double *x, std::vector<std::pair<int,double> > &out, int lo, int hi, int depth) const;
+	void calculateSparseWeights(std::vector<double> &);
+	void setWeights(const TVectorD &weights);
+
+	/// points of the lookup table, along each variable
+	std::vector<int> lutN_;
+	/// values of the lookup table, first variable running fastest
+	std::vector<double> lut_;
+	mutable std::vector<double> evalX_, evalFrac_; //!
+	double evaluateExact(const double *v) const;
+	bool evaluateTable(const double *v, double &ret) const;
+
+  ClassDef(RooSplineND,3) 
 };
 
 #endif
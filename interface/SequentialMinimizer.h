@@ -5,6 +5,9 @@ struct RooAbsReal;
 struct RooRealVar;
 #include <vector>
 #include <memory>
+#include <string>
+#include <map>
+#include <set>
 #include <Math/Minimizer.h>
 
 namespace cmsmath {
@@ -25,11 +28,11 @@ namespace cmsmath {
 
     class OneDimMinimizer {
         public:
-            OneDimMinimizer() : f_(0), idx_(0) {}
+            OneDimMinimizer() : f_(0), idx_(0), newton_(false) {}
             OneDimMinimizer(const MinimizerContext &ctx, unsigned int idx) :
-                f_(&ctx), idx_(idx) {}
+                f_(&ctx), idx_(idx), newton_(false) {}
             OneDimMinimizer(const MinimizerContext &ctx, unsigned int idx, double xmin, double xmax, double xstep, const std::string &name) : 
-                f_(&ctx), idx_(idx), name_(name), xmin_(xmin), xmax_(xmax), xstep_(xstep) {}
+                f_(&ctx), idx_(idx), name_(name), xmin_(xmin), xmax_(xmax), xstep_(xstep), newton_(false) {}
 
             const std::string &  name() const { return name_; }
             const char        * cname() const { return name_.c_str(); }
@@ -64,6 +67,9 @@ namespace cmsmath {
             ImproveRet improve(int steps=1, double ytol=0, double xtol = 0, bool force=true);
             
             void moveTo(double x) ;
+
+            /// try Newton steps before the golden bisection, for a function known to be nearly quadratic in this variable
+            void setNewton(bool newton) { newton_ = newton; }
         private:
             // Function
             const MinimizerContext * f_;
@@ -78,6 +84,9 @@ namespace cmsmath {
             // Bounds and step
             double xmin_, xmax_, xstep_;
 
+            /// use newtonSteps
+            bool newton_;
+
             /// basic loop
             /// return false if ended steps, true if reached tolerance
             bool doloop(int steps, double ytol, double xtol) ;
@@ -98,6 +107,11 @@ namespace cmsmath {
             /// do the parabola fit
             double parabolaFit();
 
+            /// Newton steps, with first and second derivatives from the current triplet (exact for a quadratic function),
+            /// each followed by a new triplet around the new point with the size of the step.
+            /// return true if reached tolerance; otherwise the triplet is left valid for the golden bisection
+            bool newtonSteps(int steps, double ytol, double xtol) ;
+
             /// evaluate function at x
             inline double &x() { return f_->x[idx_]; }
             inline double eval() { return f_->eval(); }
@@ -159,12 +173,22 @@ namespace cmsmath {
 
             virtual double CovMatrix(unsigned int i, unsigned int j) const { return 0; }
 
+            /// declare groups of parameters that don't affect each other's minimum (e.g. from CachingSimNLL::parameterBlocks).
+            /// Once a block has converged, its workers are woken up again only if some parameter of the same block moved,
+            /// or one not assigned to any block. Applies to the variables set after the call; an empty list disables it.
+            static void setParameterBlocks(const std::vector<std::vector<std::string> > &blocks) ;
+
+            /// declare the parameters in which the function is nearly quadratic (e.g. from CachingSimNLL::rateOnlyParameters),
+            /// to be minimized with Newton steps instead of golden bisection. Applies to the variables set after the call.
+            static void setNewtonParameters(const std::vector<std::string> &names) ;
+
             // these have to be public for ROOT to handle
             enum State { Cleared, Ready, Active, Done, Fixed, Unknown };
             struct Worker : public OneDimMinimizer {
-                Worker() : OneDimMinimizer(), state(Unknown) {}
+                Worker() : OneDimMinimizer(), state(Unknown), block(-1) {}
                 State state;
                 int   nUnaffected; /// number of consecutive times it has been woken up and set to sleep immediately afterwards
+                int   block;       /// independent block of parameters this belongs to, or -1 if not known
             };
         protected:
             bool minimize(int smallsteps=5);
@@ -185,6 +209,13 @@ namespace cmsmath {
             // ROOT::Math::Minimizer for strategy 2
             std::auto_ptr<ROOT::Math::Minimizer> fullMinimizer_;
             std::vector<int> subspaceIndices_;
+
+            /// block of each parameter name, from setParameterBlocks
+            static std::map<std::string,int> parameterBlocks_;
+            static int nParameterBlocks_;
+            /// names from setNewtonParameters
+            static std::set<std::string> newtonParameters_;
+            int blockOf(const std::string &name) const ;
                     
     };
 
@@ -27,6 +27,24 @@ class SimpleGaussianConstraint : public RooGaussian {
             return _value;
         }
 
+        /// derivative of getLogValFast() with respect to param; 
+        /// returns false if param enters through a function of x or of the mean, for which it can't be done analytically
+        bool getLogValFastDerivative(const RooAbsArg &param, double &deriv) const {
+            double dxdp = 0;
+            if (&x.arg() == &param) dxdp += 1;
+            else if (x.arg().dependsOnValue(param)) return false;
+            if (&mean.arg() == &param) dxdp -= 1;
+            else if (mean.arg().dependsOnValue(param)) return false;
+            deriv = 2*scale_*(x - mean)*dxdp;
+            return true;
+        }
+
+        const RooAbsReal & getX() const { return x.arg(); }
+        const RooAbsReal & getMean() const { return mean.arg(); }
+        const RooAbsReal & getSigma() const { return sigma.arg(); }
+        /// -0.5/sigma^2, so that getLogValFast() = scale() * (x - mean)^2
+        double getScale() const { return scale_; }
+
         static RooGaussian * make(RooGaussian &c) ;
     private:
         double scale_;
@@ -38,6 +38,11 @@ class SimplePoissonConstraint : public RooPoisson {
             return _value;
         }
 
+        const RooAbsReal & getX() const { return x.arg(); }
+        const RooAbsReal & getMean() const { return mean.arg(); }
+        /// log(x!) for the value of x at construction, as used by getLogValFast()
+        double getLogGamma() const { return logGamma_; }
+
         static RooPoisson * make(RooPoisson &c) ;
     private:
         double logGamma_;
@@ -15,6 +15,8 @@
   <li>Simultaneous pdfs are split at construction time; when evaluating the likelihood, no lookups of components by name are performed.</li>
   <li>The amount of objects created and destroyed for each evaluation is reduced to a minimum.</li>
   <li>Only one loop is performed on the dataset (since only one is necessary), and the data is not copied.</li>
+  <li>Optionally (runtimedef SLRTSO_FUSED), log(pdfAlt/pdfNull) is cached for each entry of the data: as long as the parameters and the 
+      observables of the entries don't change (e.g. binned toys with fixed nuisances), Q is then just a dot product with the weights.</li>
 
   </ul>
   Author: Giovanni Petrucciani (UCSD/CMS/CERN), May 2011
@@ -24,6 +26,7 @@
 
 #include <memory>
 #include <stdexcept>
+#include <vector>
 #include <RooAbsPdf.h>
 #include <RooAbsData.h>
 #include <RooSimultaneous.h>
@@ -67,9 +70,21 @@ class SimplerLikelihoodRatioTestStatOpt : public RooStats::TestStatistic {
         /// components of the sim pdfs after factorization, for each bin in sim. category. can contain nulls
         std::vector<RooAbsPdf *> simPdfComponentsNull_, simPdfComponentsAlt_;
 
+        /// for the fused evaluation: observables and channel of each entry, and weights, of the current dataset
+        std::vector<double> fusedCoords_, fusedWeights_;
+        std::vector<int>    fusedChannels_;
+        /// for the fused evaluation: cached layout and parameters, log(pdfAlt/pdfNull) per entry and expected events per channel
+        std::vector<double> cachedCoords_, cachedParamsNull_, cachedParamsAlt_;
+        std::vector<int>    cachedChannels_;
+        std::vector<double> logRatio_, expectedNull_, expectedAlt_;
+        std::vector<char>   logRatioBad_; // entries where one of the pdfs is zero: the cache can't be used if they have a weight
+
         double evalSimNLL(RooAbsData &data,  RooSimultaneous *pdf, std::vector<RooAbsPdf *> &components);
         double evalSimpleNLL(RooAbsData &data,  RooAbsPdf *pdf);
         void unrollSimPdf(RooSimultaneous *pdf, std::vector<RooAbsPdf *> &out);
+        /// evaluate Q from the cache, filling it first if needed; returns false if it can't be used for this dataset
+        bool evalFused(RooAbsData &data, RooArgSet &nullPOI, double &ret);
+        void fillFusedCache(RooAbsData &data, RooArgSet &nullPOI);
 
 }; // 
 
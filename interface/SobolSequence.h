@@ -0,0 +1,26 @@
+#ifndef HiggsAnalysis_CombinedLimit_SobolSequence_h
+#define HiggsAnalysis_CombinedLimit_SobolSequence_h
+
+#include <vector>
+#include <stdint.h>
+
+/// Sobol quasi-random sequence in the unit hypercube, in any number of dimensions.
+/// The primitive polynomials are enumerated as needed, and the initial direction numbers
+/// (any odd m_k < 2^k gives a valid Sobol sequence) are drawn from the seed.
+/// The points are randomized with a digital shift, also drawn from the seed, so that
+/// independent sequences can be used to estimate the integration error.
+class SobolSequence {
+    public:
+        SobolSequence(unsigned int dimension, uint32_t seed) ;
+        unsigned int dimension() const { return dim_; }
+        /// fill x[0 ... dimension()-1] with the next point, with coordinates in the open interval (0,1)
+        void next(double *x) ;
+    private:
+        unsigned int dim_;
+        uint32_t index_;
+        /// direction numbers, 32 per dimension
+        std::vector<uint32_t> v_;
+        std::vector<uint32_t> state_;
+};
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef HiggsAnalysis_CombinedLimit_SplitWorkspace_h
+#define HiggsAnalysis_CombinedLimit_SplitWorkspace_h
+/** Workspaces written split by channel (text2workspace.py --X-split-channels), so that a job reads only the channels
+    it uses. The file holds, besides the usual workspace w:
+     - one workspace w_channel_<label> for each channel, with the pdfs of this channel in all the models
+     - a TNamed w_channels, whose title lists how to put the models together again, one line per item, tab separated:
+         model <name> <index category> <extra constraints> <channel masks>
+             a RooSimultaneousOpt of the top workspace (the last two comma separated, or - if there are none)
+         pdf <model> <channel label> <pdf> <key of the channel workspace>
+             the pdf of the model for this channel
+    The top workspace has everything but the pdfs of the channels: all their parameters, the named sets, the datasets,
+    the extra constraints and the ModelConfigs, which refer to the models by name before they exist.           */
+#include <string>
+
+class TDirectory;
+class RooWorkspace;
+
+namespace splitworkspace {
+    /// true if w (read from dir) was written split by channel
+    bool isSplit(TDirectory &dir, const RooWorkspace &w) ;
+    /// Read the pdfs of the channels whose label matches the regular expression channels (all if it's empty) and
+    /// whose mask is zero at this point, and import in w the models made of them. The channels not read are left
+    /// out of the models, which leaves their data out of the NLL, as a mask does, and out of the toys.
+    /// Returns the number of channels read; throws std::runtime_error if the list doesn't match the file
+    int loadChannels(TDirectory &dir, RooWorkspace &w, const std::string &channels, int verbose=0) ;
+}
+
+#endif
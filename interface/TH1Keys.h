@@ -7,6 +7,10 @@
 #include <RooDataSet.h>
 #include <RooNDKeysPdf.h>
 
+/// Histogram filled with a kernel density estimate of the events (RooNDKeysPdf options and rho).
+/// With "F" in the options, the estimate is instead made on a fine binning of the events, convolving
+/// with gaussian kernels by FFT, so that the cost doesn't scale with the number of events.
+/// Also then "a" selects adaptive bandwidths and "m" mirroring at the boundaries.
 class TH1Keys : public TH1 {
     public:
        TH1Keys();
@@ -65,6 +69,7 @@ class TH1Keys : public TH1 {
         mutable bool isCacheGood_;
 
         void FillH1() const;
+        void FillH1FFT() const;
 
         void dont(const char *) const ;
 }; // class
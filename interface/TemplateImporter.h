@@ -0,0 +1,24 @@
+#ifndef HiggsAnalysis_CombinedLimit_TemplateImporter_h
+#define HiggsAnalysis_CombinedLimit_TemplateImporter_h
+
+#include <TH1.h>
+#include <TList.h>
+
+//_________________________________________________
+/*
+BEGIN_HTML
+TemplateImporter is a helper class for text2workspace, to convert many histogram templates at once in C++ instead of looping over their bins in python
+END_HTML
+*/
+//
+class TemplateImporter {
+    public:
+        /// copy of the first min(nbins, bins of shape) bins of shape into a new TH1F with nbins unit bins in [0, nbins], not attached to any directory
+        static TH1 *rebin(const TH1 &shape, int nbins, const char *name) ;
+        /// rebin all the histograms in shapes, naming the copies after them with the "_rebin" suffix. The caller owns the list and the histograms.
+        static TList *rebinAll(const TList &shapes, int nbins) ;
+        /// largest number of bins among the histograms in shapes
+        static int maxBins(const TList &shapes) ;
+};
+
+#endif
@@ -0,0 +1,138 @@
+#ifndef HiggsAnalysis_CombinedLimit_TextDatacard_h
+#define HiggsAnalysis_CombinedLimit_TextDatacard_h
+/** \class TextDatacard
+ *
+ * Parser of text datacards in C++, with the same rules and error messages as parseCard in python/DatacardParser.py
+ * (as called by combineCards.py, i.e. without evaluating the nuisance edits), for the cards with thousands of
+ * nuisances and channels. The file is memory mapped, and the lines of the systematics are validated when the card is
+ * read but only their position in the file is kept: their values are parsed again each time they're asked for, so the
+ * memory doesn't grow with the number of nuisances times the number of columns.
+ *
+ * It's used by the combineCards program (bin/combineCards.cpp), and from python by parseCard with --X-fast-parser,
+ * which builds the same Datacard from the rows converted here. All the errors are std::runtime_error.
+ */
+#include <string>
+#include <vector>
+#include <cstddef>
+
+class TextDatacard {
+    public:
+        /// read the card; the nuisances matching one of excludePatterns (regular expressions, matched at the start of
+        /// the name) are dropped, and with stat all the systematics
+        TextDatacard(const std::string &fileName, const std::vector<std::string> &excludePatterns = std::vector<std::string>(),
+                     bool stat = false, bool noJMax = false, bool allowNoSignal = false, bool allowNoBackground = false) ;
+        ~TextDatacard() ;
+        const std::string & fileName() const { return fileName_; }
+
+        /// bins and processes, in the order of the card
+        const std::vector<std::string> & bins() const { return bins_; }
+        const std::vector<std::string> & processes() const { return processes_; }
+        bool isSignal(const std::string &process) const ;
+        /// the columns of the bin/process/rate lines
+        unsigned int columns() const { return colBin_.size(); }
+        const std::string & columnBin(unsigned int i) const { return bins_[colBin_[i]]; }
+        unsigned int columnBinIndex(unsigned int i) const { return colBin_[i]; }
+        const std::string & columnProcess(unsigned int i) const { return processes_[colProcess_[i]]; }
+        bool columnIsSignal(unsigned int i) const { return colSignal_[i]; }
+        /// rate of the column (set to 1e-6 for the gmN with no events in the sideband, as parseCard does)
+        double rate(unsigned int i) const { return rates_[i]; }
+        bool ratesChanged() const { return ratesChanged_; }
+        bool hasObservation() const { return !obs_.empty(); }
+        double observation(unsigned int bin) const { return obs_[bin]; }
+
+        /// shapes lines: process, channel and the rest of the line
+        unsigned int nShapes() const { return shapes_.size(); }
+        const std::string & shapeProcess(unsigned int i) const { return shapes_[i][0]; }
+        const std::string & shapeChannel(unsigned int i) const { return shapes_[i][1]; }
+        std::vector<std::string> shapeArgs(unsigned int i) const { return std::vector<std::string>(shapes_[i].begin() + 2, shapes_[i].end()); }
+
+        /// the systematics lines with one value per column (lnN, shape, gmN, ...), in the order of the card,
+        /// including those without any effect that parseCard drops (see rowHasEffect); none with stat
+        unsigned int nRows() const { return rows_.size(); }
+        /// the row on this line of the file (counting from 0), or -1
+        int rowAtLine(unsigned int line) const ;
+        /// name without [nofloat], with "theta" in front if it starts with a digit
+        const std::string & rowName(unsigned int r) const { return rows_[r].name; }
+        /// name as written (without [nofloat]), which is the one checked against the exclusion patterns
+        const std::string & rowWrittenName(unsigned int r) const { return rows_[r].written; }
+        bool rowNoFloat(unsigned int r) const { return rows_[r].nofloat; }
+        const std::string & rowPdf(unsigned int r) const { return rows_[r].pdf; }
+        const std::vector<std::string> & rowArgs(unsigned int r) const { return rows_[r].args; }
+        unsigned int rowLine(unsigned int r) const { return rows_[r].line; }
+        /// true if the row has some value of the form low/high
+        bool rowAsymmetric(unsigned int r) const { return rows_[r].asymmetric; }
+        /// false if it has no effect on any process with a non-zero rate
+        bool rowHasEffect(unsigned int r) const { return rows_[r].hasEffect; }
+        /// the values of the row, one per column; hi is NaN where the value isn't asymmetric
+        void readRow(unsigned int r, std::vector<double> &lo, std::vector<double> &hi) const ;
+        /// the values of the row as text for float() in python, separated by spaces (the low one if asymmetric);
+        /// with high, the column and the high value of each asymmetric one instead
+        std::string rowText(unsigned int r, bool high = false) const ;
+
+        /// the other directives, in the order of the card
+        unsigned int nParams() const { return params_.size(); }
+        const std::string & paramName(unsigned int i) const { return params_[i].first; }
+        const std::vector<std::string> & paramArgs(unsigned int i) const { return params_[i].second; }
+        const std::vector<std::string> & flatParams() const { return flatParams_; }
+        const std::vector<std::string> & discretes() const { return discretes_; }
+        /// extArg lines, as all their words
+        unsigned int nExtArgs() const { return extArgs_.size(); }
+        const std::string & extArgName(unsigned int i) const { return extArgs_[i].first; }
+        const std::vector<std::string> & extArgTokens(unsigned int i) const { return extArgs_[i].second; }
+        /// rateParams, with the wildcards of the bins and processes expanded: the initial value (or the formula and
+        /// its arguments), and the range (or "")
+        unsigned int nRateParams() const { return rateParams_.size(); }
+        const std::string & rateParamName(unsigned int i) const { return rateParams_[i].name; }
+        const std::string & rateParamBin(unsigned int i) const { return rateParams_[i].bin; }
+        const std::string & rateParamProcess(unsigned int i) const { return rateParams_[i].process; }
+        const std::vector<std::string> & rateParamValues(unsigned int i) const { return rateParams_[i].values; }
+        const std::string & rateParamRange(unsigned int i) const { return rateParams_[i].range; }
+        /// groups and their nuisances (each once, in the order of the card)
+        unsigned int nGroups() const { return groups_.size(); }
+        const std::string & groupName(unsigned int i) const { return groups_[i].first; }
+        const std::vector<std::string> & groupNuisances(unsigned int i) const { return groups_[i].second; }
+        /// the words after "edit" of the nuisance edit lines, not evaluated
+        unsigned int nEdits() const { return edits_.size(); }
+        const std::vector<std::string> & edit(unsigned int i) const { return edits_[i]; }
+
+        /// number of systematics (rows with an effect and params), checked against kmax if it was given
+        unsigned int nuisances() const ;
+        void checkNuisances() const ;
+    private:
+        TextDatacard(const TextDatacard &) ;
+        TextDatacard & operator=(const TextDatacard &) ;
+        struct Row {
+            std::string name, written, pdf;
+            std::vector<std::string> args;
+            bool nofloat, asymmetric, hasEffect;
+            unsigned int line;
+            /// the values, after the name, pdf and args, in the mapped file
+            std::size_t begin, end;
+        };
+        struct RateParam { std::string name, bin, process; std::vector<std::string> values; std::string range; };
+        std::string fileName_;
+        const char *data_;
+        std::size_t size_;
+        std::vector<std::string> bins_, processes_;
+        std::vector<int> signal_; // per process: 1 signal, 0 background, -1 not in the columns
+        std::vector<unsigned int> colBin_, colProcess_;
+        std::vector<char> colSignal_;
+        std::vector<double> rates_, obs_;
+        bool ratesChanged_;
+        std::vector<std::vector<std::string> > shapes_;
+        std::vector<Row> rows_;
+        std::vector<std::pair<std::string, std::vector<std::string> > > params_, extArgs_, groups_;
+        std::vector<std::string> flatParams_, discretes_;
+        std::vector<RateParam> rateParams_;
+        std::vector<std::vector<std::string> > edits_;
+        /// kmax, decreased for the excluded nuisances, or -1
+        int declared_;
+        void readHeader_(std::size_t &pos, unsigned int &line, bool noJMax, bool allowNoSignal) ;
+        void readBody_(std::size_t pos, unsigned int line, const std::vector<std::string> &excludePatterns, bool stat) ;
+        void addRateParam_(const std::string &name, const std::vector<std::string> &f) ;
+        /// parse and check the values of the row
+        void parseValues_(const Row &row, std::vector<double> &lo, std::vector<double> &hi) const ;
+        bool hasEffect_(const Row &row, const std::vector<double> &lo, const std::vector<double> &hi) const ;
+};
+
+#endif
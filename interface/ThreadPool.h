@@ -0,0 +1,98 @@
+#ifndef HiggsAnalysis_CombinedLimit_ThreadPool_h
+#define HiggsAnalysis_CombinedLimit_ThreadPool_h
+/** Fixed-size pool of worker threads, with work stealing.
+    parallelFor(n, job) runs job(0) ... job(n-1) on the workers and on the calling thread,
+    and returns only when all of them are done. Each thread taking part gets a contiguous
+    range of the indices, and when it's done with it steals half of what's left of the range
+    of another thread, so the caller must not rely on any execution order: results should be
+    written to per-index slots and reduced afterwards in a fixed order if reproducibility is needed.
+    A parallelFor issued from inside a job is nested: its jobs are shared by the calling thread
+    and by the workers that are idle, the innermost loop first (e.g. the channels of the NLL
+    inside the toys), so that there are never more threads running than in the pool.
+    A parallelFor issued from a process forked after the pool was created (which doesn't
+    inherit the worker threads) runs serially on the current thread.
+
+    global() is the pool shared by all the parallel features of combine, with the number of
+    threads of --threads: the knob of each feature (e.g. --X-rtd HybridNew_GridThreads=N) only limits
+    how many of them it uses, except for the channels of the NLL, that are evaluated in parallel
+    only if asked with --X-rtd SIMNLL_THREADS=N. Without --threads the pool grows to the largest knob asked for.
+    With --threads, the processes forked before the first use of the pool (--toyForks, the
+    forks of HybridNew and MultiDimFit) run everything serially, so that they don't multiply it.
+
+    With --pinThreads each thread of the global pool is pinned to one of the cores allowed to the
+    process, filling one NUMA node after the other. The k-th range of a loop then always goes to
+    the same thread (e.g. the same channels of the NLL, whose arrays are allocated by that thread
+    on its node, see CachingSimNLL), and the threads steal from and join the loops of threads of
+    their node before those of the other nodes. */
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <atomic>
+#include <memory>
+#include <unistd.h>
+#include <pthread.h>
+
+class ThreadPool {
+    public:
+        /// create a pool with nThreads threads in total, including the calling one
+        explicit ThreadPool(unsigned int nThreads) ;
+        ~ThreadPool() ;
+        unsigned int size() const { return nWorkers_ + 1; }
+        /// run the jobs on at most maxThreads threads (0 = all those of the pool)
+        void parallelFor(unsigned int n, const std::function<void(unsigned int)> &job, unsigned int maxThreads = 0) ;
+        /// true if the current thread is running a job of any pool
+        static bool inJob() ;
+
+        /// the pool shared by all of combine; without --threads, it's first grown to nThreads threads
+        static ThreadPool & global(unsigned int nThreads = 1) ;
+        /// set the number of threads of the global pool (--threads), and pin them to cores (--pinThreads); to be called before it's used
+        static void setGlobalThreads(unsigned int nThreads, bool pin = false) ;
+        /// true if the threads of the global pool are pinned to cores
+        static bool pinned() ;
+        /// the number of threads of --threads, or 0 if it wasn't set
+        static unsigned int globalThreads() ;
+        /// the number of threads for a feature with this knob: the knob if set (capped by --threads), otherwise --threads
+        static unsigned int threadsFor(int knob) ;
+    private:
+        ThreadPool(const ThreadPool &) ;
+        ThreadPool & operator=(const ThreadPool &) ;
+        /// the indices still to be done by one of the threads of a loop
+        struct Range { std::mutex mutex; unsigned int begin, end; int node; bool taken; };
+        /// one parallelFor; lives on the stack of its caller, that waits for all the threads that joined it to leave
+        struct Loop {
+            const std::function<void(unsigned int)> *job;
+            std::unique_ptr<Range[]> ranges;
+            unsigned int nRanges, joined, active;
+            /// NUMA node of the calling thread (-1 if not pinned)
+            int node;
+            std::mutex mutex;
+            std::condition_variable left;
+            std::exception_ptr error;
+        };
+        void workerLoop_(unsigned int id) ;
+        /// run the jobs of the loop starting from the range slot, stealing from the others when it's done
+        void runJobs_(Loop &loop, unsigned int slot) ;
+        bool take_(Loop &loop, unsigned int slot, unsigned int &index) ;
+        void grow_(unsigned int nThreads) ;
+        /// pin worker i to the i-th of the allowed cores (the calling thread, that forks the other processes, isn't pinned)
+        void pinAll_() ;
+        /// pin worker id (from 1) to its core, and record its node
+        void pinOne_(unsigned int id, pthread_t thread) ;
+        std::vector<std::thread> workers_;
+        std::atomic<unsigned int> nWorkers_;
+        std::mutex mutex_;
+        std::condition_variable wakeUp_;
+        /// the loops with ranges not yet taken by any thread, the innermost last
+        std::vector<Loop *> loops_;
+        /// the cores allowed to the process, grouped by NUMA node, and for each thread its node (if pinned)
+        std::vector<std::pair<int,int> > cores_;
+        std::vector<int> nodes_;
+        bool pinned_;
+        bool stop_;
+        pid_t pid_;
+};
+
+#endif
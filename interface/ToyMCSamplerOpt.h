@@ -2,9 +2,15 @@
 #define ROOT_ToyMCSamplerOpt_h
 
 #include <memory>
+#include <set>
+#include <string>
 #include <RooStats/ToyMCSampler.h>
+#include <RooArgList.h>
+#include "HiggsAnalysis/CombinedLimit/interface/PoissonSampler.h"
 struct RooProdPdf;
 struct RooPoisson;
+namespace cacheutils { class CachingPdfBase; }
+namespace RooStats { class DetailedOutputAggregator; }
 
 namespace toymcoptutils {
     class SinglePdfGenInfo {
@@ -16,7 +22,10 @@ namespace toymcoptutils {
             RooDataSet *generateAsimov(RooRealVar *&weightVar, double weightScale = 1.0) ;
             RooDataSet *generatePseudoAsimov(RooRealVar *&weightVar, int nPoints, double weightScale = 1.0) ;
             const RooAbsPdf * pdf() const { return pdf_; }
-            void setCacheTemplates(bool cache) { keepHistoSpec_ = cache; }
+            void setCacheTemplates(bool cache) { keepHistoSpec_ = cache; if (!cache) setBatchSize(0); }
+            /// with cached templates, throw the Poisson toys n at a time from a single evaluation of the expected yields,
+            /// as long as the parameters of the pdf don't change
+            void setBatchSize(unsigned int n) { batchSize_ = n; batchToys_ = batchNext_ = 0; }
             Mode mode() const { return mode_; }
         private:
             Mode mode_;
@@ -26,11 +35,96 @@ namespace toymcoptutils {
             TH1        *histoSpec_;
             bool        keepHistoSpec_;
             RooRealVar *weightVar_;
+            // for the batched generation: expected yields (as an asimov dataset), and the counts for all toys, one toy after the other
+            unsigned int batchSize_, batchToys_, batchNext_;
+            RooDataSet *batchAsimov_;
+            std::vector<double> batchCounts_, batchPoint_;
+            /// Poisson sampler for the bins, with the constants of the means kept from one toy to the next (TMCSO_FastPoisson)
+            PoissonSampler poisson_;
+            /// for the unbinned generation by accept/reject on batches of uniform proposals (TMCSO_FastUnbinned):
+            /// the pdf evaluated on the whole batch at once, and the envelope for the values of the parameters it was found at
+            bool fastUnbinned_;
+            cacheutils::CachingPdfBase *cachingPdf_;
+            RooArgSet *params_;
+            std::vector<double> envelopePoint_;
+            double envelope_, acceptance_;
+            std::vector<double> events_;
             RooDataSet *generateWithHisto(RooRealVar *&weightVar, bool asimov, double weightScale = 1.0) ;
+            RooDataSet *generateFromBatch(RooRealVar *&weightVar) ;
+            /// current values of the parameters of the pdf (the indices for the categories)
+            void paramValues(std::vector<double> &values) ;
             RooDataSet *generateCountingAsimov() ;
+            RooDataSet *generateUnbinnedFast() ;
+            /// evaluate the pdf at the points (one after the other, observables_.getSize() values each)
+            const std::vector<double> & evalPoints(const std::vector<double> &points) ;
+            /// counts[itoy * nbins + i] drawn from expected[i], for ntoys toys
+            void throwPoisson(unsigned int nbins, const double *expected, double *counts, unsigned int ntoys) ;
             void setToExpected(RooProdPdf &prod, RooArgSet &obs) ;
             void setToExpected(RooPoisson &pois, RooArgSet &obs) ;
     };
+    /// The values of some variables (e.g. the global observables, or the nuisances) for many toys at once, drawn in one pass
+    /// into a flat array when the pdf factorizes into SimpleGaussianConstraint, RooGaussian, SimplePoissonConstraint and
+    /// RooPoisson terms each generating one of them (TMCSO_FastGlobalObs). As in RooFit, each value is kept within the
+    /// range of its variable, and the other parameters of the terms are taken at their values when generate is called.
+    class ConstraintSampler {
+        public:
+            ConstraintSampler(RooAbsPdf &pdf, const RooArgSet &vars) ;
+            /// false if the pdf doesn't factorize as above, and must be generated by RooFit
+            bool ok() const { return ok_; }
+            /// draw the values of all the variables for ntoys toys
+            void generate(unsigned int ntoys) ;
+            unsigned int ntoys() const { return ntoys_; }
+            /// set the variables to the values of toy itoy
+            void set(unsigned int itoy) const ;
+            /// the variables, as they are set
+            const RooArgList & vars() const { return vars_; }
+        private:
+            /// var drawn from a gaussian of center and sigma, or from a poisson of mean center
+            struct Term { RooRealVar *var; const RooAbsReal *center, *sigma; };
+            std::vector<Term> gaussians_, poissons_;
+            RooArgList vars_;
+            std::vector<double> values_;
+            unsigned int ntoys_;
+            bool ok_;
+            PoissonSampler poisson_;
+            void addTerms_(RooAbsPdf *pdf, const RooArgSet &vars) ;
+    };
+    /// Toys thrown at some parameter points, kept so that they can be used again at nearby points with the weights
+    /// L(toy | new point)/L(toy | point it was thrown at) (HybridNew --reuseToys). With each toy are kept the values of
+    /// the global observables and nuisances it was thrown with, so that both likelihoods are those of the whole toy.
+    class ToyRecycler {
+        public:
+            ToyRecycler(unsigned int maxToys) : maxToys_(maxToys), ntoys_(0), nextId_(0) {}
+            ~ToyRecycler() { clear(); }
+            struct Toy { RooAbsData *data; std::vector<double> globalObs, nuisances; double weight; };
+            struct Batch {
+                /// never reused, also after the batch is dropped
+                unsigned long id;
+                std::string pdf;
+                /// values of all the variables of the pdf when the toys were thrown
+                RooArgSet *point;
+                std::vector<std::string> globalObsNames, nuisanceNames;
+                std::vector<Toy> toys;
+            };
+            /// the batch thrown with the same pdf at the point nearest to this one in the values of the POIs, or 0.
+            /// Each batch is handed out at most once for each key (e.g. the point and the parameters of the test statistic),
+            /// so that no toy is counted twice in the same distribution
+            const Batch * nearest(const std::string &pdf, const RooArgSet &point, const RooArgSet &pois, const std::string &key) ;
+            /// start a new batch, thrown at this point for the key (to which it is then never handed out)
+            void newBatch(const std::string &pdf, const RooArgSet &point, const RooArgList &globalObs, const RooArgList &nuisances, const std::string &key) ;
+            /// add a copy of the toy to the last batch, with the current values of the global observables and nuisances
+            void add(const RooAbsData &data, const RooArgList &globalObs, const RooArgList &nuisances, double weight) ;
+            /// drop all the toys
+            void clear() ;
+        private:
+            std::vector<Batch> batches_;
+            /// the keys and ids of the batches already handed out
+            std::set<std::pair<std::string, unsigned long> > served_;
+            unsigned int maxToys_, ntoys_;
+            unsigned long nextId_;
+            ToyRecycler(const ToyRecycler &) ;
+            ToyRecycler & operator=(const ToyRecycler &) ;
+    };
     class SimPdfGenInfo {
         public:
             SimPdfGenInfo(RooAbsPdf &pdf, const RooArgSet& observables, bool preferBinned, const RooDataSet* protoData = NULL, int forceEvents = 0) ;
@@ -40,6 +134,7 @@ namespace toymcoptutils {
             RooAbsData *generateEpsilon(RooRealVar *&weightVar) ;
             void setCopyData(bool copyData) { copyData_ = copyData; }
             void setCacheTemplates(bool cache) ;
+            void setBatchSize(unsigned int n) ;
         private:
             RooAbsPdf                       *pdf_; 
             RooAbsCategoryLValue            *cat_;
@@ -63,8 +158,24 @@ class ToyMCSamplerOpt : public RooStats::ToyMCSampler{
         void setGlobalObsPdf(RooAbsPdf *pdf) { globalObsPdf_ = pdf; }
         virtual RooAbsData* GenerateToyData(RooArgSet& /*nullPOI*/, double& weight) const ;
         virtual RooDataSet* GetSamplingDistributionsSingleWorker(RooArgSet& paramPointIn) ;
+        /// Importance sampling for the toys of the parameter point (e.g. the null hypothesis) matching the values in point:
+        /// a fraction of the toys is thrown from pdf with the values in density (e.g. the POI of the alternate hypothesis),
+        /// and all toys get the weight L(point)/[(1-fraction) L(point) + fraction L(density)], so that the weighted
+        /// distribution stays that of the point. The other parameters are the same for both, so they cancel in the weights.
+        void addImportanceDensity(RooAbsPdf &pdf, const RooArgSet &point, const RooArgSet &density, double fraction) ;
+        /// Use first the toys thrown at the nearest point in the values of pois (possibly by another sampler) that are
+        /// in the recycler, weighted with the likelihood ratio, and throw new toys only until the effective number of
+        /// toys, (sum w)^2/(sum w^2), reaches the number requested; the new toys are added to the recycler
+        void setToyRecycler(toymcoptutils::ToyRecycler *recycler, const RooArgSet &pois) ;
     private:
-        RooAbsData* GenerateToyDataWithImportanceSampling(RooArgSet& /*nullPOI*/, double& weight) const ;
+        struct ImportanceDensity {
+            RooAbsPdf *pdf;
+            RooArgSet *point, *density;
+            double fraction;
+            RooAbsReal *nllPoint, *nllDensity; // created on the first toy, then re-used with new data
+        };
+        RooAbsData* GenerateToyDataWithImportanceSampling(RooArgSet& observables, double& weight) const ;
+        double importanceNll_(RooAbsPdf &pdf, RooAbsData &data, RooAbsReal *&nll) const ;
 
         RooAbsData* Generate(RooAbsPdf& pdf, RooArgSet& observables, const RooDataSet* protoData = NULL, int forceEvents = 0) const ;
         RooAbsPdf *globalObsPdf_;
@@ -75,11 +186,23 @@ class ToyMCSamplerOpt : public RooStats::ToyMCSampler{
         mutable RooDataSet *nuisValues_; 
         mutable int nuisIndex_;
 
+        /// used instead of globalObsValues_ and nuisValues_ when the pdfs factorize (TMCSO_FastGlobalObs)
+        mutable toymcoptutils::ConstraintSampler *globalObsSampler_, *nuisSampler_;
+
         mutable RooRealVar *weightVar_;
         mutable std::map<RooAbsPdf *, toymcoptutils::SimPdfGenInfo *> genCache_;
 
-        mutable std::auto_ptr<RooArgSet> paramsForImportanceSampling_;
-        mutable std::vector<RooArgSet *> importanceSnapshots_;
+        mutable std::vector<ImportanceDensity> importanceDensities_;
+        mutable ImportanceDensity *currentImportance_;
+
+        toymcoptutils::ToyRecycler *recycler_;
+        RooArgSet recyclerPois_;
+        mutable RooAbsReal *recyclerNll_;
+        /// the nuisances the last toy was thrown with (empty if they were not generated)
+        mutable std::vector<double> lastNuisances_;
+        /// evaluate the test statistics on the toys of the batch reweighted to the current point, adding them to detOutAgg;
+        /// returns the effective number of toys, and adds the weights of those in the tails to toysInTails
+        double reuseToys_(const toymcoptutils::ToyRecycler::Batch &batch, RooArgSet &allVars, const RooArgSet &saveAll, RooStats::DetailedOutputAggregator &detOutAgg, double &toysInTails) ;
 };
 
 #endif
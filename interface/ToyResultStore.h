@@ -0,0 +1,63 @@
+#ifndef HiggsAnalysis_CombinedLimit_ToyResultStore_h
+#define HiggsAnalysis_CombinedLimit_ToyResultStore_h
+/** \class ToyResultStore
+ *
+ * Append-only binary store of the toys of HybridNew, an alternative to HypoTestResult objects in ROOT files for large grids.
+ *
+ * The file is a sequence of blocks, each made of a small header (mass, names and values of the POIs, number of toys,
+ * test statistic on data, flags) followed by the columns of test statistic values and weights of the null and alternate toys.
+ * Opening the store only reads the headers, seeking over the columns, so reading one point of a grid doesn't load the others;
+ * appending a block is a single write at the end of the file, so that many jobs can add their toys to the same store.
+ * Numbers are stored in the native byte order.
+ */
+#include <string>
+#include <vector>
+#include <map>
+
+class RooAbsCollection;
+namespace RooStats { class HypoTestResult; }
+
+class ToyResultStore {
+    public:
+        explicit ToyResultStore(const std::string &fileName) ;
+        /// append the toys of result for this mass and values of the POIs
+        void append(double mass, const RooAbsCollection &pois, const RooStats::HypoTestResult &result) const ;
+        /// the block that append() would write, e.g. to send it to another process (see WorkQueueClient)
+        static void serialize(double mass, const RooAbsCollection &pois, const RooStats::HypoTestResult &result, std::vector<char> &block) ;
+        /// append a block made by serialize(), as is
+        void appendBlock(const std::vector<char> &block) const ;
+        /// merge all the blocks for this mass and values of the POIs, or return 0 if there are none. The caller owns the result.
+        RooStats::HypoTestResult *read(double mass, const RooAbsCollection &pois) const ;
+        /// merge the blocks for this mass and the single POI poiName, for each of its values in [rMin, rMax]. The caller owns the results.
+        void readGrid(double mass, const std::string &poiName, double rMin, double rMax, std::map<double, RooStats::HypoTestResult *> &grid) const ;
+        /// write to out one block per mass and values of the POIs, merging the blocks of all the inputs for that point
+        /// (in the order of the inputs) and skipping those identical to one already merged, e.g. the toys of a job
+        /// that was run twice with the same seed. Returns the number of blocks skipped.
+        static unsigned int compact(const std::vector<std::string> &inputs, const ToyResultStore &out) ;
+        /// true if the file starts with a block of toys
+        static bool isStore(const std::string &fileName) ;
+        const std::string & fileName() const { return fileName_; }
+        /// number of blocks in the file (as of the last read)
+        unsigned int blocks() const { return index_.size(); }
+    private:
+        struct Block {
+            double mass;
+            std::string poiNames; // comma separated
+            std::vector<double> poiValues;
+            int nNull, nAlt;
+            double tsData;
+            bool rightTail, backgroundIsAlt;
+            long offset; // of the columns in the file
+        };
+        std::string fileName_;
+        mutable std::vector<Block> index_;
+        mutable long indexedBytes_;
+        /// read the headers of the blocks added after the last call
+        void updateIndex_() const ;
+        RooStats::HypoTestResult *merge_(const std::vector<const Block *> &blocks) const ;
+        static void putHeader_(std::vector<char> &buff, double mass, const std::string &names, const std::vector<double> &values, int nNull, int nAlt, double tsData, bool rightTail, bool backgroundIsAlt) ;
+        /// same matching as the names of the HypoTestResult objects, i.e. with %g
+        static bool sameValue_(double a, double b) ;
+};
+
+#endif
@@ -26,16 +26,24 @@ class VectorizedCBShape {
         const RooAbsReal * m0_, * n_, *alpha_, *sigma_;
         std::vector<Double_t> xvals_;
         mutable std::vector<Double_t> work1_, work2_;
+        /// for Branchless: the core Gaussian exp(-t*t/2) of all the events (and their t in work1_), for the mean and sigma they were computed with,
+        /// so that a change of only the tail parameters (alpha, n) doesn't recompute them
+        mutable std::vector<Double_t> core_;
+        mutable double coreMean_, coreSigma_;
+        mutable bool coreValid_;
         std::vector<int> xindex_;
         std::vector<Double_t> xsorted_;
         enum WorkingMode { 
-            Plain=1, FastPlain=2, Sorted=11, FastSorted=12, PreSort=21, FastPreSort=22
+            Plain=1, FastPlain=2, Sorted=11, FastSorted=12, PreSort=21, FastPreSort=22, Branchless=31, FastBranchless=32
         } mode_;
         inline bool hasPreSort() const { return mode_ == PreSort || mode_ == FastPreSort; }
         inline bool hasSort() const { return mode_ == Sorted || mode_ == FastSorted || mode_ == PreSort || mode_ == FastPreSort; }
-        inline bool hasFast() const { return mode_ == FastPlain || mode_ == FastSorted || mode_ == FastPreSort; }
+        inline bool hasFast() const { return mode_ == FastPlain || mode_ == FastSorted || mode_ == FastPreSort || mode_ == FastBranchless; }
+        inline bool hasBranchless() const { return mode_ == Branchless || mode_ == FastBranchless; }
         void cbGauss(double* __restrict__ t, unsigned int n, double norm, double* __restrict__ out,  double* __restrict__ work2) const ;
         void cbCB(double* __restrict__ t, unsigned int n, double norm, double* __restrict__ out,  double* __restrict__ work2) const ;
+        /// core and tail computed for all the events and selected per event, without branches, so that the loops vectorize
+        void fillBranchless(std::vector<Double_t> &out, double norm) const ;
 };
 
 #endif
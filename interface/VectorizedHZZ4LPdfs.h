@@ -0,0 +1,52 @@
+#ifndef VectorizedHZZ4LPdfs_h
+#define VectorizedHZZ4LPdfs_h
+
+#include <RooAbsData.h>
+#include <RooAbsReal.h>
+#include <vector>
+#include <utility>
+
+/// Vectorized evaluation of the HZZ4L_RooSpinZeroPdf family (HZZ4L_RooSpinZeroPdf, HZZ4L_RooSpinZeroPdf_2D, HZZ4L_RooSpinZeroPdf_phase),
+/// i.e. of pdfs that are a linear combination of fixed templates with coefficients that depend only on the fractions and phases.
+/// The template values at the dataset entries and the template integrals are read once, so each evaluation is
+/// a few mul_add over the dataset, without going through the RooHistFunc lookups.
+template<typename PdfT>
+class VectorizedHZZ4LSpinZeroPdf {
+    public:
+        VectorizedHZZ4LSpinZeroPdf(const PdfT &pdf, const RooAbsData &data, bool includeZeroWeights=false) ;
+        void fill(std::vector<Double_t> &out) const ;
+    private:
+        const PdfT * pdf_;
+        /// values of each template at the selected dataset entries
+        std::vector<std::vector<Double_t> > templates_;
+        /// integrals of the templates over the observables
+        std::vector<Double_t> integrals_;
+        mutable std::vector<double> coeffs_;
+};
+
+/// Vectorized evaluation of the ZZ continuum shapes RooqqZZPdf_v2 and RooggZZPdf_v2, i.e. sums of 
+/// (1+erf((m4l-a)/b))/2 * c/(1+exp((m4l-a)/d)) terms, with the exponentials done by vdt over the whole dataset.
+/// These pdfs have no analytical integral, so the numerical normalization of RooFit is kept,
+/// but remembered for the last parameter points so that going back to one of them doesn't integrate again.
+template<typename PdfT>
+class VectorizedZZContinuumPdf {
+    public:
+        VectorizedZZContinuumPdf(const PdfT &pdf, const RooAbsData &data, bool includeZeroWeights=false) ;
+        void fill(std::vector<Double_t> &out) const ;
+    private:
+        const PdfT * pdf_;
+        const RooArgSet * obs_;
+        /// a0 ... a13 (or a9)
+        std::vector<const RooAbsReal *> params_;
+        std::vector<Double_t> xvals_;
+        mutable std::vector<Double_t> work1_, work2_, work3_;
+        /// normalizations for the last parameter points, the most recent first
+        enum { NormCacheSize = 16 };
+        mutable std::vector<std::pair<std::vector<double>, double> > normCache_;
+        mutable std::vector<double> pars_;
+        double normalization_() const ;
+        /// out += (1+erf((x-a)/b))/2 * sum_k c_k/(1+exp((x-a)/d_k))
+        void addTerm_(unsigned int size, double a, double b, const double *c, const double *d, unsigned int nk, double *out) const ;
+};
+
+#endif
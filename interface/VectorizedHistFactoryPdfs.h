@@ -15,6 +15,7 @@ namespace cacheutils {
             virtual const RooAbsReal *pdf() const { return pdf_; };
             virtual void  setDataDirty() { data_ = 0; }
             virtual void  setIncludeZeroWeights(bool includeZeroWeights) { includeZeroWeights_ = includeZeroWeights; }
+            virtual std::size_t cacheBytes() const { return yvals_.capacity() * sizeof(Double_t); }
         private:
             const RooHistFunc * pdf_;
             const RooAbsData * data_;
@@ -27,8 +28,31 @@ namespace cacheutils {
         public:
             VectorizedParamHistFunc(const ParamHistFunc &pdf, const RooAbsData &data, bool includeZeroWeights=false) ;
             void fill(std::vector<Double_t> &out) const ;
+            /// out *= the values for each entry
+            void multiply(std::vector<Double_t> &out) const ;
+            unsigned int size() const { return index_.size(); }
         private:
+            /// the distinct parameters, and the index of the one of each entry
             std::vector<const RooRealVar *> yvars_;
+            std::vector<uint32_t> index_;
+            mutable std::vector<Double_t> yvals_;
+            void readValues_() const ;
+    };
+
+    /// ParamHistFunc on the bin index cache of VectorizedParamHistFunc, whose values can also be multiplied
+    /// directly into the product of a CachingProduct instead of going through the cache
+    class CachingParamHistFunc : public CachingPdf {
+        public:
+            CachingParamHistFunc(RooAbsReal *pdf, const RooArgSet *obs) : CachingPdf(pdf, obs) {}
+            CachingParamHistFunc(const CachingParamHistFunc &other) : CachingPdf(other) {}
+            /// out *= the values for the entries of data
+            void multiply(const RooAbsData &data, std::vector<Double_t> &out) ;
+            /// number of values for the entries of data
+            unsigned int size(const RooAbsData &data) ;
+        protected:
+            std::unique_ptr<VectorizedParamHistFunc> vpdf_;
+            virtual void newData_(const RooAbsData &data) ;
+            virtual void realFill_(const RooAbsData &data, std::vector<Double_t> &values) ;
     };
 
     class CachingPiecewiseInterpolation : public CachingPdfBase {
@@ -39,6 +63,7 @@ namespace cacheutils {
             const RooAbsReal *pdf() const { return pdf_; }
             virtual void  setDataDirty() ;
             virtual void  setIncludeZeroWeights(bool includeZeroWeights) ;
+            virtual std::size_t cacheBytes() const ;
         protected:
             const PiecewiseInterpolation * pdf_;
             std::vector<const RooAbsReal *> coeffs_;
@@ -48,6 +73,21 @@ namespace cacheutils {
             boost::ptr_vector<CachingPdfBase>  cachingPdfsHi_;
             boost::ptr_vector<CachingPdfBase>  cachingPdfsLow_;
             std::vector<Double_t> work_;
+            /// if the templates don't depend on any parameter, their differences from the nominal are computed once per dataset:
+            /// (hi - nominal) and (nominal - lo), or hi/nominal and lo/nominal for code 2
+            bool constantTemplates_;
+            const RooAbsData * diffData_;
+            std::vector<Double_t> nominal_;
+            std::vector<std::vector<Double_t> > diffHi_, diffLo_;
+            /// with MORPH_INCREMENTAL and no multiplicative terms, the sum is kept and only the terms of the coefficients that changed are replaced
+            bool additive_;
+            std::vector<Double_t> sum_;
+            std::vector<double>   sumX_;
+            int sumUpdates_; // -1 if sum_ is not valid
+            const std::vector<Double_t> & evalFromTemplates_(const RooAbsData &data) ;
+            void fillDiffs_(const RooAbsData &data) ;
+            /// out += scale * (term of coefficient i at value x)
+            void addTerm_(std::vector<Double_t> &out, int i, double x, double scale) const ;
     };
 }
 
@@ -4,6 +4,11 @@
 #include <RooExponential.h>
 #include <RooAbsData.h>
 #include "HiggsAnalysis/CombinedLimit/interface/HGGRooPdfs.h"
+#include "HiggsAnalysis/CombinedLimit/interface/RooBernsteinFast.h"
+#include "HiggsAnalysis/CombinedLimit/interface/HWWLVJRooPdfs.h"
+#include "HiggsAnalysis/CombinedLimit/interface/HWWLVJJRooPdfs.h"
+#include <RooPolynomial.h>
+#include <RooChebychev.h>
 #include <vector>
 
 class VectorizedExponential {
@@ -28,4 +33,69 @@ class VectorizedPower {
         mutable std::vector<Double_t> work_;
 };
 
+/// The powers of the rescaled x of all the entries are computed once,
+/// so each fill is one (N+1) x entries matrix-vector product
+template<int N>
+class VectorizedBernstein {
+    public:
+        VectorizedBernstein(const RooBernsteinFast<N> &pdf, const RooAbsData &data, bool includeZeroWeights=false) ;
+        void fill(std::vector<Double_t> &out) const ;
+    private:
+        const RooBernsteinFast<N> * pdf_;
+        Double_t xrange_;
+        /// x^ipow of the entries, in rows of size()
+        std::vector<Double_t> xpows_;
+        unsigned int size_;
+};
+
+/// Pdfs that are a linear combination of fixed functions of x (RooPolynomial, RooChebychev):
+/// the functions are evaluated once on all the entries, each with its integral over the range of x,
+/// so each fill is a matrix-vector product and the normalization is the same combination of the integrals
+template<typename PdfT>
+class VectorizedLinearBasisPdf {
+    public:
+        VectorizedLinearBasisPdf(const PdfT &pdf, const RooAbsData &data, bool includeZeroWeights=false) ;
+        void fill(std::vector<Double_t> &out) const ;
+    private:
+        /// coefficients of the functions, null for those with a coefficient of one
+        std::vector<const RooAbsReal *> coeffs_;
+        std::vector<Double_t> integrals_;
+        /// values of the functions on the entries, in rows of size_
+        std::vector<Double_t> rows_;
+        unsigned int size_;
+};
+
+/// Pdfs that are the exponential of a linear combination of fixed functions of x: RooExpPoly,
+/// and the dijet-style RooPowPdf, RooPow2Pdf and RooQCDPdf (which are exponentials of polynomials of log(x)).
+/// The functions are evaluated once on all the entries, so each fill is a matrix-vector product and
+/// one vectorized exp; the normalization is the one of the pdf itself, analytical or numerical.
+template<typename PdfT>
+class VectorizedExpOfSumPdf {
+    public:
+        VectorizedExpOfSumPdf(const PdfT &pdf, const RooAbsData &data, bool includeZeroWeights=false) ;
+        void fill(std::vector<Double_t> &out) const ;
+    private:
+        const PdfT * pdf_;
+        const RooArgSet * obs_;
+        /// the argument of the exponential is sum_k factors_[k] * params_[k] * rows_[k]
+        std::vector<const RooAbsReal *> params_;
+        std::vector<Double_t> factors_;
+        std::vector<Double_t> rows_;
+        unsigned int size_;
+        mutable std::vector<Double_t> work_;
+};
+
+/// Sum of two exponentials, Roo2ExpPdf: exp(c0 x) + frac exp(c1 x)
+class VectorizedTwoExp {
+    public:
+        VectorizedTwoExp(const Roo2ExpPdf &pdf, const RooAbsData &data, bool includeZeroWeights=false) ;
+        void fill(std::vector<Double_t> &out) const ;
+    private:
+        const Roo2ExpPdf * pdf_;
+        const RooArgSet * obs_;
+        const RooAbsReal *c0_, *c1_, *frac_;
+        std::vector<Double_t> xvals_;
+        mutable std::vector<Double_t> work1_, work2_;
+};
+
 #endif
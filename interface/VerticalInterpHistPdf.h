@@ -11,6 +11,8 @@
 #include "HiggsAnalysis/CombinedLimit/interface/SimpleCacheSentry.h"
 #include "HiggsAnalysis/CombinedLimit/interface/FastTemplate.h"
 #include <cmath>
+#include <memory>
+#include <mutex>
 
 class FastVerticalInterpHistPdf;
 class FastVerticalInterpHistPdf2Base;
@@ -34,6 +36,8 @@ public:
   const RooArgList& coefList() const { return _coefList ; }
 
   const RooRealProxy &x() const { return _x; }
+  Double_t smoothRegion() const { return _smoothRegion; }
+  Int_t smoothAlgo() const { return _smoothAlgo; }
   friend class FastVerticalInterpHistPdf;
 protected:
   RooRealProxy   _x;
@@ -249,6 +253,16 @@ public:
   virtual void setActiveBins(unsigned int bins) {}
 
   bool cacheIsGood() const { return _sentry.good() && _initBase; }
+
+  /// Add the memory held by the templates to nominal (nominal, its log and the morphed total) and morphs (in all the copies in use)
+  virtual void templateBytes(std::size_t &nominal, std::size_t &morphs) const ;
+  /// Reallocate the templates from the calling thread (see FastTemplate::Localize)
+  virtual void localizeTemplates() ;
+  /// Put back the double precision morphs released with MORPH_FLOAT or COMBINE_SHARED_TEMPLATES, from their copies, e.g. before
+  /// writing this pdf (with MORPH_FLOAT the morphs are then rounded to single precision)
+  void restoreDoubleMorphs() const ;
+  /// The same for all the FastVerticalInterpHistPdf2Base in the collection
+  static void restoreDoubleMorphs(const RooAbsCollection &components) ;
   /// Must be public, for serialization
   typedef FastVerticalInterpHistPdfBase::Morph Morph;
 protected:
@@ -265,11 +279,69 @@ protected:
   // For additive morphing, histograms of (fUp-f0)+(fDown-f0) and (fUp-f0)-(fDown-f0)
   // For multiplicative morphing, log(fUp/f0)+log(fDown/f0),  log(fUp/f0)-log(fDown/f0)
   // NOTE: it's the responsibility of the daughter to make sure these are initialized!!!
-  std::vector<Morph> _morphs;  
+  // With MORPH_FLOAT or COMBINE_SHARED_TEMPLATES, those that have a copy are released (see restoreDoubleMorphs)
+  mutable std::vector<Morph> _morphs;  
 
   // Coefficients of the list in _coefList, already dynamic_cast'ed and in a vector
   mutable std::vector<const RooAbsReal *> _morphParams; //! not to be serialized
 
+  // For the incremental morphing (MORPH_INCREMENTAL): sum of the morphs before going back to linear scale,
+  // the values of the coefficients it was computed for, and how many updates were done since it was last rebuilt (-1 = invalid)
+  mutable FastTemplate _morphSum; //! not to be serialized
+  mutable std::vector<double> _morphSumX; //! not to be serialized
+  mutable int _morphSumUpdates; //! not to be serialized
+
+  // For the folding of the constant coefficients (MORPH_FOLD_CONSTANT): the nominal plus the morphs of the coefficients that
+  // were constant, with their values, and the coefficients that were floating; _frozenState is 0 if it has to be rebuilt
+  mutable FastTemplate _frozenSum; //! not to be serialized
+  mutable std::vector<int> _frozenIdx, _floatingIdx; //! not to be serialized
+  mutable std::vector<double> _frozenX; //! not to be serialized
+  mutable int _frozenState; //! not to be serialized
+  // true if _frozenSum is still valid for the current constant flags and values of the coefficients
+  bool frozenSumIsGood(const FastTemplate &nominal) const ;
+
+  // Single precision copies of _morphs, used in their place with MORPH_FLOAT (an empty one for the sparse morphs)
+  struct MorphFloat { FastTemplateFloat sum; FastTemplateFloat diff; };
+  mutable std::vector<MorphFloat> _morphsFloat; //! not to be serialized
+  // 0 = not yet set up, +1 = in use, -1 = not used since they failed the validation against the double precision morphs
+  mutable int _morphsFloatState; //! not to be serialized
+
+  // Sparse copies of the morphs that change few bins (an empty one for the others), used in their place
+  mutable std::vector<FastTemplateSparsePair> _morphsSparse; //! not to be serialized
+  // 0 = not yet set up, +1 = in use (for some of the morphs), -1 = not used
+  mutable int _morphsSparseState; //! not to be serialized
+  // Make the sparse morphs, for the ones with at most this fraction of non-zero bins
+  void initMorphsSparse() const ;
+
+  // Copies of _morphs shared with the other processes (COMBINE_SHARED_TEMPLATES) and used in their place, 
+  // when not in single precision (an empty one for the sparse morphs and those that could not be shared)
+  struct MorphShared { FastTemplateShared sum; FastTemplateShared diff; };
+  mutable std::vector<MorphShared> _morphsShared; //! not to be serialized
+  // 0 = not yet set up, +1 = in use (for some of the morphs), -1 = not used
+  mutable int _morphsSharedState; //! not to be serialized
+  // Make the shared morphs, and release the double precision ones they replace
+  void initMorphsShared() const ;
+
+  // Do cache += a * (diff + b * sum) for the i-th morph, on its non-zero bins only or in single or double precision 
+  void meldMorph(FastTemplate &cache, int i, double a, double b) const {
+    if (_morphsSparseState > 0 && _morphsSparse[i].size()) cache.Meld(_morphsSparse[i], a, b);
+    else if (_morphsSharedState > 0 && _morphsShared[i].sum.size()) cache.Meld(_morphsShared[i].diff, _morphsShared[i].sum, a, b);
+    else if (_morphsFloatState > 0) cache.Meld(_morphsFloat[i].diff, _morphsFloat[i].sum, a, b);
+    else                            cache.Meld(_morphs[i].diff, _morphs[i].sum, a, b);
+  }
+  // Make the single precision morphs, check that each gives the same result as the double precision one at -1 and +1
+  // on top of start, and release the double precision ones
+  void initMorphsFloat(const FastTemplate &start) const ;
+
+  // Morphed total (in linear scale, before normalization) shared by all the objects in this process with the same 
+  // templates, smoothing and morphing parameters, e.g. the same pdf used in several channels (MORPH_SHARED_TOTAL)
+  struct SharedTotal { std::mutex lock; bool valid; std::vector<double> x; FastTemplate cache; };
+  mutable std::shared_ptr<SharedTotal> _sharedTotal; //! not to be serialized
+  // 0 = not yet looked up, +1 = in use, -1 = not used
+  mutable int _sharedTotalState; //! not to be serialized
+  // Find or create the SharedTotal for these templates
+  void initSharedTotal(const FastTemplate &cacheNominal) const ;
+
   // Prepare morphing data for a triplet of templates
   void initMorph(Morph &out, const FastTemplate &nominal, FastTemplate &lo, FastTemplate &hi) const;
 
@@ -297,13 +369,13 @@ struct FastVerticalInterpHistPdf2V;
 class FastVerticalInterpHistPdf2 : public FastVerticalInterpHistPdf2Base {
 public:
 
-  FastVerticalInterpHistPdf2() : FastVerticalInterpHistPdf2Base() {}
+  FastVerticalInterpHistPdf2() : FastVerticalInterpHistPdf2Base(), _cacheNorm(1.0) {}
   FastVerticalInterpHistPdf2(const char *name, const char *title, const RooRealVar &x, const TList & funcList, const RooArgList& coefList, Double_t smoothRegion=1., Int_t smoothAlgo=1) ;
 
   FastVerticalInterpHistPdf2(const FastVerticalInterpHistPdf2& other, const char* name=0) :
     FastVerticalInterpHistPdf2Base(other, name),
     _x("x",this,other._x),
-    _cache(other._cache), _cacheNominal(other._cacheNominal), _cacheNominalLog(other._cacheNominalLog)  {}
+    _cache(other._cache), _cacheNorm(other._cacheNorm), _cacheNominal(other._cacheNominal), _cacheNominalLog(other._cacheNominalLog)  {}
   explicit FastVerticalInterpHistPdf2(const FastVerticalInterpHistPdf& other, const char* name=0) ;
   virtual TObject* clone(const char* newname) const { return new FastVerticalInterpHistPdf2(*this,newname) ; }
   virtual ~FastVerticalInterpHistPdf2() {}
@@ -313,12 +385,30 @@ public:
 
   FastHisto const& cache() const { return _cache; }
 
+  /// Derivative of cache() with respect to param, for the current values of the coefficients.
+  /// Returns false if param enters through a function of the coefficients, which can't be done analytically.
+  bool cacheDerivative(const RooAbsArg &param, FastHisto &out) const ;
+
+  /// Inputs of the morphing, to redo it elsewhere (e.g. cacheutils::BinnedOffload): the nominal template with its binning,
+  /// the nominal in the scale of the morphing (log scale for multiplicative morphing), and one morph per coefficient
+  const FastHisto & nominal() const { return _cacheNominal; }
+  const FastHisto & nominalMorphScale() const { return _smoothAlgo < 0 ? _cacheNominalLog : _cacheNominal; }
+  /// (the morphs released with MORPH_FLOAT or COMBINE_SHARED_TEMPLATES are empty)
+  const std::vector<Morph> & morphs() const { return _morphs; }
+  Double_t smoothRegion() const { return _smoothRegion; }
+  Int_t smoothAlgo() const { return _smoothAlgo; }
+
+  virtual void templateBytes(std::size_t &nominal, std::size_t &morphs) const ;
+  virtual void localizeTemplates() ;
+
   friend class FastVerticalInterpHistPdf2V;
 protected:
   RooRealProxy   _x;
 
   /// Cache of the result
   mutable FastHisto _cache; //! not to be serialized
+  /// Integral of the result before the normalization
+  mutable double _cacheNorm; //! not to be serialized
 
   /// Cache of nominal pdf (additive morphing) and its bin-by-bin logarithm (multiplicative)
   FastHisto _cacheNominal; 
@@ -335,6 +425,8 @@ class FastVerticalInterpHistPdf2V {
     public: 
         FastVerticalInterpHistPdf2V(const FastVerticalInterpHistPdf2 &, const RooAbsData &data, bool includeZeroWeights=false) ;
         void fill(std::vector<Double_t> &out) const ;
+        /// fill with the values of another template with the same binning as the pdf (e.g. its derivative)
+        void fill(const FastHisto &templ, std::vector<Double_t> &out) const ;
     private:
         const FastVerticalInterpHistPdf2 & hpdf_;
         int begin_, end_, nbins_;
@@ -351,13 +443,14 @@ class FastVerticalInterpHistPdf2V {
 class FastVerticalInterpHistPdf2D2 : public FastVerticalInterpHistPdf2Base {
 public:
 
-  FastVerticalInterpHistPdf2D2() : FastVerticalInterpHistPdf2Base() {}
+  FastVerticalInterpHistPdf2D2() : FastVerticalInterpHistPdf2Base(), _maxOnXY(0), _trackMax(false), _maxValid(false) {}
   FastVerticalInterpHistPdf2D2(const char *name, const char *title, const RooRealVar &x, const RooRealVar &y, bool conditional, const TList & funcList, const RooArgList& coefList, Double_t smoothRegion=1., Int_t smoothAlgo=1) ;
 
   FastVerticalInterpHistPdf2D2(const FastVerticalInterpHistPdf2D2& other, const char* name=0) :
     FastVerticalInterpHistPdf2Base(other, name),
     _x("x",this,other._x), _y("y",this,other._y), _conditional(other._conditional),
-    _cache(other._cache), _cacheNominal(other._cacheNominal), _cacheNominalLog(other._cacheNominalLog)  {}
+    _cache(other._cache), _cacheNominal(other._cacheNominal), _cacheNominalLog(other._cacheNominalLog),
+    _maxOnXY(0), _trackMax(false), _maxValid(false)  {}
   explicit FastVerticalInterpHistPdf2D2(const FastVerticalInterpHistPdf2D& other, const char* name=0) ;
   virtual TObject* clone(const char* newname) const { return new FastVerticalInterpHistPdf2D2(*this,newname) ; }
   virtual ~FastVerticalInterpHistPdf2D2() {}
@@ -370,6 +463,9 @@ public:
   Double_t maxVal(Int_t code) const ;
 
   Double_t evaluate() const ;
+
+  virtual void templateBytes(std::size_t &nominal, std::size_t &morphs) const ;
+  virtual void localizeTemplates() ;
 protected:
   RooRealProxy _x, _y;
   bool _conditional;
@@ -381,9 +477,16 @@ protected:
   FastHisto2D _cacheNominal; 
   FastHisto2D _cacheNominalLog; 
 
+  /// Maxima of _cache for maxVal, along each X slice, each Y column and overall; once maxVal has been called,
+  /// the conditional pdfs fill them while normalizing, the others recompute them at most once per syncTotal
+  mutable std::vector<FastHisto2D::T> _maxOnY, _maxOnX; //! not to be serialized
+  mutable FastHisto2D::T _maxOnXY; //! not to be serialized
+  mutable bool _trackMax, _maxValid; //! not to be serialized
+
   void syncTotal() const ;
   void initNominal(TObject *nominal) ;
   void initComponent(int which, TObject *hi, TObject *lo) ;
+  void syncMaxima(bool normalizeXSlices) const ;
 
 private:
   ClassDef(FastVerticalInterpHistPdf2D2,1) // 
@@ -27,6 +27,8 @@ public:
 
   const RooArgList& funcList() const { return _funcList ; }
   const RooArgList& coefList() const { return _coefList ; }
+  Double_t quadraticRegion() const { return _quadraticRegion; }
+  Int_t    quadraticAlgo() const { return _quadraticAlgo; }
 
 protected:
   
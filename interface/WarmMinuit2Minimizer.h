@@ -0,0 +1,32 @@
+#ifndef HiggsAnalysis_CombinedLimit_WarmMinuit2Minimizer_h
+#define HiggsAnalysis_CombinedLimit_WarmMinuit2Minimizer_h
+
+#include <vector>
+#include <string>
+#if defined(ROOT_Minuit2_Minuit2Minimizer)
+   #error "You cannot include Minuit2Minimizer.h before WarmMinuit2Minimizer.h"
+#else
+   #define private protected
+   #include <Minuit2/Minuit2Minimizer.h>
+   #undef private
+#endif
+
+namespace cmsmath {
+
+    /** Minuit2 that seeds each minimization with the covariance matrix of the last successful one 
+        having the same floating parameters, instead of rebuilding it from the numerical second derivatives.
+        Neighbouring points of a scan have nearly the same hessian, so Migrad needs far fewer iterations.
+        Registered as the "Minuit2Warm" plugin; RooMinimizerOpt uses it in place of Minuit2 after RooMinimizerOpt::setWarmStart(true) */
+    class WarmMinuit2Minimizer : public ROOT::Minuit2::Minuit2Minimizer {
+        public:
+            WarmMinuit2Minimizer(const char *algo = 0) ;
+            virtual bool Minimize() ;
+        private:
+            void floatingNames(std::vector<std::string> &names) const ;
+            /// floating parameters and covariance matrix (lower triangle) of the last successful minimization
+            static std::vector<std::string> names_;
+            static std::vector<double>      covariance_;
+    };
+
+} // namespace
+#endif
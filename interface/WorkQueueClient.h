@@ -0,0 +1,39 @@
+#ifndef HiggsAnalysis_CombinedLimit_WorkQueueClient_h
+#define HiggsAnalysis_CombinedLimit_WorkQueueClient_h
+/** \class WorkQueueClient
+ *
+ * Client of a work queue coordinator (test/toyCoordinator.py), used by long-lived combine workers (HybridNew --workQueue)
+ * that load the model once and then pull units of work (number of toys, seed and point of the POIs) until the queue is done.
+ *
+ * The protocol is made of text lines over TCP, one connection for each exchange so that workers and coordinator
+ * can be restarted independently. Each request starts with AUTH <token>, the token shared with the coordinator,
+ * taken from $COMBINE_WORKQUEUE_TOKEN or else from the file named by $COMBINE_WORKQUEUE_TOKEN_FILE:
+ *    GET <worker>                         ->  UNIT <id> <toys> <seed> <point>  |  WAIT <seconds>  |  END
+ *    RESULT <id> <bytes>\n<bytes of data> ->  OK  |  IGNORED
+ * where the data of the result is a block of a ToyResultStore with the toys of the unit, which the coordinator
+ * appends to its store.
+ */
+#include <string>
+#include <vector>
+
+class WorkQueueClient {
+    public:
+        struct Unit {
+            std::string id;
+            unsigned int toys, seed;
+            std::string point; // name=value,name2=value2,... as for --singlePoint
+        };
+        /// address as host:port; throws if no token is set
+        explicit WorkQueueClient(const std::string &address) ;
+        /// get the next unit, waiting while the coordinator has none to give; returns false when the queue is done
+        bool next(Unit &unit) ;
+        /// send the result of a unit
+        void submit(const Unit &unit, const std::vector<char> &data) ;
+    private:
+        std::string host_, port_, worker_, token_;
+        /// send the request, plus data if not null, and return the first line of the reply;
+        /// if the coordinator can't be reached it tries again for some time before throwing
+        std::string exchange_(const std::string &request, const std::vector<char> *data) ;
+};
+
+#endif
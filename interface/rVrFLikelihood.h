@@ -33,6 +33,19 @@ class rVrFLikelihood : public RooAbsReal {
     private:
         std::vector<Channel> channels_;
 
+        /// bin centers and contents of the chi2 histogram of a channel, for the same bilinear interpolation as
+        /// TH2::Interpolate without its bin lookups, and the last value computed
+        struct Grid {
+            Grid() {}
+            Grid(const TH2 &chi2) ;
+            /// chi2 at (x, y), which must be inside the axes
+            double eval(double x, double y) const ;
+            double xmin, xmax, ymin, ymax;
+            std::vector<double> centersX, centersY, values;
+            mutable double lastX, lastY, lastValue;
+        };
+        std::vector<Grid> grids_;
+
         ClassDef(rVrFLikelihood,1) // Asymmetric power	
 };
 
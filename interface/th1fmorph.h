@@ -1,4 +1,9 @@
+#ifndef HiggsAnalysis_CombinedLimit_th1fmorph_h
+#define HiggsAnalysis_CombinedLimit_th1fmorph_h
+
 #include "TH1.h"
+#include <vector>
+#include "HiggsAnalysis/CombinedLimit/interface/FastTemplate.h"
 
 TH1F *th1fmorph(const char *chname, 
                 const char *chtitle,
@@ -70,3 +75,32 @@ TH1D *th1fmorph(const char *chname,
   //   well-tested).
   // *------------------------------------------------------------------------
 
+/// The same interpolation as th1fmorph, for repeated morphing of one pair of templates.
+/// The cumulative distributions of the two inputs, and the pairs of positions at which 
+/// they reach the same cumulative probability, are computed once in the constructor;
+/// each morph() then only interpolates those positions and projects the resulting cdf 
+/// on the output binning (the union of the input bin edges), with no ROOT objects involved.
+/// Unlike th1fmorph, no warning is printed for extrapolations.
+class FastHorizontalMorph {
+    public:
+        FastHorizontalMorph() : empty_(true) {}
+        FastHorizontalMorph(const TH1 &hist1, const TH1 &hist2) ;
+        FastHorizontalMorph(const FastHisto &hist1, const FastHisto &hist2) ;
+        /// contents of the two templates, and their bin edges (size()+1 each)
+        FastHorizontalMorph(const FastTemplate &hist1, const std::vector<double> &edges1, const FastTemplate &hist2, const std::vector<double> &edges2) ;
+        /// bin edges of the morphed template
+        const std::vector<double> & edges() const { return bedgesn_; }
+        /// morph to parinterp, with the inputs at par1 and par2, and fill out (resized to edges().size()-1 bins) with unit norm times morphedhistnorm
+        void morph(double par1, double par2, double parinterp, double morphedhistnorm, FastTemplate &out) const ;
+    private:
+        void init(const FastTemplate &hist1, const std::vector<double> &edges1, const FastTemplate &hist2, const std::vector<double> &edges2) ;
+        bool empty_;
+        std::vector<double> bedgesn_;
+        /// bin width in the second input at each output edge (for the empty bin treatment)
+        std::vector<double> dx2_;
+        /// positions in the two inputs with the same cumulative probability y_
+        std::vector<double> x1_, x2_, y_;
+        mutable std::vector<double> xdisn_, sigdisf_;
+};
+
+#endif
@@ -4,6 +4,7 @@
 #include <vector>
 #include <string>
 #include <unordered_map>
+#include <functional>
 #include <TGraphAsymmErrors.h>
 #include <RooHistError.h>
 #include <TH1.h>
@@ -19,6 +20,7 @@ struct RooAbsCollection;
 struct RooWorkspace;
 struct RooPlot;
 struct RooRealVar;
+struct RooCategory;
 struct RooProduct;
 namespace RooStats { class ModelConfig; }
 namespace utils {
@@ -47,6 +49,10 @@ namespace utils {
     void factorizePdf(const RooArgSet &observables, RooAbsPdf &pdf, RooArgList &obsTerms, RooArgList &constraints, bool debug=false);
     RooAbsPdf *makeNuisancePdf(RooStats::ModelConfig &model, const char *name="nuisancePdf") ;
     RooAbsPdf *makeNuisancePdf(RooAbsPdf &pdf, const RooArgSet &observables, const char *name="nuisancePdf") ;
+    /// With UTILS_FACTORIZE_CACHE, the functions above remember which terms depend on which sets of observables;
+    /// an entry is recomputed if the term changed name or number of servers, but other changes of the graph need this call
+    /// (done by CachingSimNLL each time it builds its factorized pdf)
+    void clearFactorizeCache() ;
 
     /// factorize a RooAbsReal
     void factorizeFunc(const RooArgSet &observables, RooAbsReal &pdf, RooArgList &obsTerms, RooArgList &otherTerms, bool keepDuplicates = true, bool debug=false);
@@ -71,6 +77,12 @@ namespace utils {
 
     RooSimultaneous * rebuildSimPdf(const RooArgSet &observables, RooSimultaneous *pdf) ;
 
+    /// replace the VerticalInterpHistPdf, FastVerticalInterpHistPdf and FastVerticalInterpHistPdf2D in pdf with their
+    /// FastVerticalInterpHistPdf2 and FastVerticalInterpHistPdf2D2 equivalents (same name, owned by pdf), in all their clients.
+    /// Each one is replaced only if both agree within the relative tolerance on all the bins of its observables, at the
+    /// current values of the parameters and with each of them moved to +1 and -1 in turn. Returns the number replaced
+    int upgradeHistPdfs(RooAbsPdf &pdf, const RooArgSet &observables, double tolerance=1e-5, int verbose=0) ;
+
     void copyAttributes(const RooAbsArg &from, RooAbsArg &to) ;
 
     void guessChannelMode(RooSimultaneous &simPdf, RooAbsData &simData, bool verbose=false) ;
@@ -97,6 +109,38 @@ namespace utils {
             std::vector<double> values_;
     };
 
+    /// Flat copy of the state of the RooRealVars and RooCategories of a collection: values and constant flags, and also
+    /// the ranges if withRanges. It keeps the pointers to the variables, so writing it back needs no lookup by name nor cast,
+    /// which is much cheaper than RooArgSet::snapshot plus assignment, or RooWorkspace::loadSnapshot, for each toy or point
+    struct FastSnapshot {
+        public:
+            FastSnapshot() : withRanges_(false) {}
+            explicit FastSnapshot(const RooAbsCollection &src, bool withRanges=false) : withRanges_(false) { readFrom(src, withRanges); }
+            /// take the variables of src (other kinds of arguments are ignored), and their current state
+            void readFrom(const RooAbsCollection &src, bool withRanges=false) ;
+            /// take again the current state of the same variables
+            void update() ;
+            /// put the variables back in the saved state (only the ones that changed are touched), the ranges before the values
+            void writeTo() const ;
+            void clear() { reals_.clear(); cats_.clear(); }
+            bool empty() const { return reals_.empty() && cats_.empty(); }
+            unsigned int size() const { return reals_.size() + cats_.size(); }
+        private:
+            struct RealState { RooRealVar *var; double val, min, max; bool constant; };
+            struct CatState  { RooCategory *cat; int index; bool constant; };
+            std::vector<RealState> reals_;
+            std::vector<CatState>  cats_;
+            bool withRanges_;
+    };
+
+    /// as RooWorkspace::saveSnapshot, also keeping a FastSnapshot of the variables for loadSnapshot
+    void saveSnapshot(RooWorkspace *w, const char *name, const RooArgSet &params) ;
+    /// as RooWorkspace::loadSnapshot, but using the FastSnapshot if the snapshot was saved with saveSnapshot 
+    /// (and not replaced since by RooWorkspace::saveSnapshot)
+    bool loadSnapshot(RooWorkspace *w, const char *name) ;
+    /// forget the FastSnapshots kept by saveSnapshot, e.g. before the workspace is deleted
+    void clearSnapshots() ;
+
     // Create snapshot from string of values
     void createSnapshotFromString( const std::string expression, const RooArgSet &allvars, RooArgSet &output, const char *context="createSnapshotFromString");
 
@@ -112,5 +156,24 @@ namespace utils {
     std::vector<std::vector<int> > generateCombinations(const std::vector<int> &vec);
     std::vector<std::vector<int> > generateOrthogonalCombinations(const std::vector<int> &vec);
     int countFloating(const RooArgSet &);
+
+    /// Fork a child process whose stdout and stderr go to tmpfile.i.out.txt and tmpfile.i.err.txt: returns its pid in the
+    /// parent, and 0 in the child. Throws if the fork fails.
+    int forkWithLogs(const char *tmpfile, unsigned int i) ;
+    /// Wait for the child process pid: returns an empty string if it exited with status 0, and what went wrong otherwise.
+    std::string waitForChild(int pid) ;
+    /// Print on stderr that child i of who had the given problem, followed by its stderr (tmpfile.i.err.txt).
+    void reportFailedChild(const char *who, const char *tmpfile, unsigned int i, const std::string &problem) ;
+
+    /// Run job(i) for each i in [first, last), each in a forked process except job(first) if parentTakesFirst, which runs
+    /// in this one, and put what each returned in results[i] (results is extended to at least last entries).
+    /// RooFit and Minuit keep global state and are not thread safe, so this is how combine runs fits, toys and scans in
+    /// parallel: the children share the model, the data and the caches of the NLL with the parent copy-on-write, and send
+    /// back only numbers, through temporary files. Only the children started here are waited for, so calls can be nested.
+    /// The stdout of each child is copied to ours if showOutput. A child that throws, exits with an error or is killed, or
+    /// that doesn't send back all of its result, is reported on stderr together with its own stderr; its result is left
+    /// empty and (*failed)[i] set, if failed is given. Returns the number of such jobs.
+    unsigned int runInForks(unsigned int first, unsigned int last, const std::function<std::vector<double>(unsigned int)> &job,
+                            std::vector<std::vector<double> > &results, bool parentTakesFirst, bool showOutput, std::vector<bool> *failed = 0) ;
 }
 #endif
@@ -0,0 +1,54 @@
+"""
+Reader of the columnar copies of the limit tree written by combine --saveColumnarTree (interface/ColumnarLimits.h):
+
+    from HiggsAnalysis.CombinedLimit.ColumnarLimits import readLimits
+    cols = readLimits(glob.glob("higgsCombine*.limit"))
+    cols["limit"][cols["quantileExpected"] == -1]
+
+The files of many jobs can be merged with cat (each file is a block, and a file can hold any number of blocks);
+the columns of the blocks are concatenated, with zeros in the rows of the blocks that don't have a column.
+"""
+import struct
+import numpy
+
+MAGIC = b"CMBLIMT1"
+TYPES = { 'D': 'f8', 'F': 'f4', 'L': 'i8', 'l': 'u8', 'I': 'i4', 'i': 'u4', 'S': 'i2', 's': 'u2', 'B': 'i1', 'b': 'u1', 'O': 'b1' }
+
+def _padded(n):
+    return (n + 7) // 8 * 8
+
+def readBlocks(fileName):
+    """the blocks of the file, as a list of (number of rows, ordered list of (name, array)); the arrays of the columns
+       with more than one value per row have shape (rows, values)"""
+    buf = numpy.fromfile(fileName, dtype=numpy.uint8)
+    blocks, pos = [], 0
+    while pos < len(buf):
+        if buf[pos:pos+8].tostring() != MAGIC: raise IOError("%s: no columnar limit tree at byte %d" % (fileName, pos))
+        ncol, _, nrows, ntext = struct.unpack("=IIQQ", buf[pos+8:pos+32].tostring())
+        pos += 32
+        names = buf[pos:pos+ntext].tostring().split(b"\0")[:ncol]
+        pos += _padded(ntext)
+        heads = [ struct.unpack("=4sII", buf[pos+12*i:pos+12*i+12].tostring()) for i in range(ncol) ]
+        pos += _padded(12*ncol)
+        columns = []
+        for name, (code, size, length) in zip(names, heads):
+            nbytes = nrows * size * length
+            arr = buf[pos:pos+nbytes].view(numpy.dtype(TYPES[code[0:1].decode()]))
+            columns.append((name.decode(), arr.reshape((nrows, length)) if length > 1 else arr))
+            pos += _padded(nbytes)
+        blocks.append((nrows, columns))
+    return blocks
+
+def readLimits(fileNames):
+    """all the rows of the files (a name or a list of names), as a dictionary of numpy arrays by name of the branch"""
+    if isinstance(fileNames, str): fileNames = [ fileNames ]
+    blocks = []
+    for f in fileNames: blocks += readBlocks(f)
+    total = sum(n for n, cols in blocks)
+    out, row = {}, 0
+    for n, cols in blocks:
+        for name, arr in cols:
+            if name not in out: out[name] = numpy.zeros((total,) + arr.shape[1:], dtype=arr.dtype)
+            out[name][row:row+n] = arr
+        row += n
+    return out
@@ -1,4 +1,5 @@
-import re, fnmatch
+import re, fnmatch, os
+from itertools import izip
 from sys import stderr
 
 globalNuisances = re.compile('(lumi|pdf_(qqbar|gg|qg)|QCDscale_(ggH|qqH|VH|ggH1in|ggH2in|VV)|UEPS|FakeRate|CMS_(eff|fake|trigger|scale|res)_([gemtjb]|met))')
@@ -21,6 +22,7 @@ def addDatacardParserOptions(parser):
     parser.add_option("--optimize-simpdf-constraints",    dest="moreOptimizeSimPdf", default="none", type="string", help="Handling of constraints in simultaneous pdf: 'none' = add all constraints on all channels (default); 'lhchcg' = add constraints on only the first channel; 'cms' = add constraints to the RooSimultaneousOpt.")
     #parser.add_option("--use-HistPdf",  dest="useHistPdf", type="string", default="always", help="Use RooHistPdf for TH1s: 'always' (default), 'never', 'when-constant' (i.e. not when doing template morphing)")
     parser.add_option("--channel-masks",  dest="doMasks", default=False, action="store_true", help="Create channel-masking RooRealVars")
+    parser.add_option("--mc-stat-lite",  dest="mcStatLite", default=False, action="store_true", help="Store the statistical uncertainties of the histogram templates, so that combine adds for each bin one nuisance on the total expectation, minimized analytically (Barlow-Beeston lite) instead of the per-bin nuisances of the datacard")
     parser.add_option("--use-HistPdf",  dest="useHistPdf", type="string", default="never", help="Use RooHistPdf for TH1s: 'always', 'never' (default), 'when-constant' (i.e. not when doing template morphing)")
     parser.add_option("--X-exclude-nuisance", dest="nuisancesToExclude", type="string", action="append", default=[], help="Exclude nuisances that match these regular expressions.")
     parser.add_option("--X-rescale-nuisance", dest="nuisancesToRescale", type="string", action="append", nargs=2, default=[], help="Rescale by this factor the nuisances that match these regular expressions (the rescaling is applied to the sigma of the gaussian constraint term).")
@@ -36,6 +38,14 @@ def addDatacardParserOptions(parser):
     parser.add_option("--X-no-optimize-templates",  dest="optimizeExistingTemplates", default=True, action="store_false", help="Don't optimize templates on the fly (relevant for HZZ)")
     parser.add_option("--X-no-optimize-bound-nusances",  dest="optimizeBoundNuisances", default=True, action="store_false", help="Don't flag nuisances to have a different implementation of bounds")
     parser.add_option("--X-no-optimize-bins",  dest="optimizeTemplateBins", default=True, action="store_false", help="Don't optimize template bins")
+    parser.add_option("--parallel-build",  dest="parallelBuild", default=0, type="int", help="Build the pdfs of the channels in this many parallel processes, merging their workspaces at the end")
+    parser.add_option("--build-cache",  dest="buildCache", default=None, type="string", help="Directory where the pdfs of each channel are saved, and reused in the next builds until the datacard lines, the shape files or the options they depend on change")
+    parser.add_option("--X-share-identical-templates",  dest="shareIdenticalTemplates", default=False, action="store_true", help="Use a single morphing pdf for the processes of different channels with identical templates and morphing parameters (e.g. datacards split by era)")
+    parser.add_option("--X-compile-formulas",  dest="compileFormulas", default=False, action="store_true", help="Build the expr:: functions of the physics models as RooCompiledFormula, which evaluates a precompiled program instead of interpreting the formula with TFormula (falling back to RooFormulaVar for the formulas it can't compile)")
+    parser.add_option("--X-fast-parser",  dest="fastParser", default=False, action="store_true", help="Read the systematics of the datacard with the C++ parser (TextDatacard), which is much faster for datacards with many nuisances and channels")
+    parser.add_option("--X-bulk-data-import",  dest="bulkDataImport", default=False, action="store_true", help="Fill the combined binned dataset directly from the bin contents of the TH1 of each channel")
+    parser.add_option("--X-slim-workspace",  dest="slimWorkspace", default=False, action="store_true", help="Write only what the models evaluate, leaving out the nodes no longer referenced by any of them (e.g. the source templates of the morphing pdfs after their conversion)")
+    parser.add_option("--X-split-channels",  dest="splitChannels", default=False, action="store_true", help="Write the pdfs of each channel in a workspace of their own, so that combine reads only the channels it uses (see its option --loadChannels)")
 
 
 from HiggsAnalysis.CombinedLimit.Datacard import Datacard
@@ -70,6 +80,37 @@ def addRateParam(lsyst,f,ret):
     else: ret.rateParams["%sAND%s"%(f[2],f[3])] = [tmp_exp]
     ret.rateParamsOrder.add(lsyst)
 
+def _fastParser(file, options):
+    """The C++ parser of the same file for --X-fast-parser, or None to read it all in python (also if it fails,
+       so that the error is the one of parseCard)"""
+    if not getattr(options, "fastParser", False): return None
+    if not hasattr(file, "name") or not hasattr(file, "tell") or not os.path.isfile(file.name) or file.tell() != 0: return None
+    import ROOT
+    ROOT.gSystem.Load("libHiggsAnalysisCombinedLimit")
+    try:
+        # the checks done by parseCard itself are turned off
+        return ROOT.TextDatacard(file.name, ROOT.std.vector('string')(), False, True, True, True)
+    except Exception:
+        return None
+
+def _fastErrline(fast, irow, ret, runs):
+    """The errline of a row of the C++ parser; runs are the columns of the keyline grouped by bin"""
+    values = map(float, str(fast.rowText(irow)).split())
+    if fast.rowAsymmetric(irow):
+        high = str(fast.rowText(irow, True)).split()
+        for i in xrange(0, len(high), 2):
+            values[int(high[i])] = [ values[int(high[i])], float(high[i+1]) ]
+    errline = dict([(b,{}) for b in ret.bins])
+    for b, start, procs in runs:
+        errline[b].update(izip(procs, values[start:start+len(procs)]))
+    return errline
+
+def _fastArgs(fast, irow):
+    pdf = str(fast.rowPdf(irow))
+    args = [ str(a) for a in fast.rowArgs(irow) ]
+    if pdf == "gmN": return [ int(a) for a in args ]
+    return [ float(a) for a in args ]
+
 def parseCard(file, options):
     if type(file) == type("str"):
         raise RuntimeError, "You should pass as argument to parseCards a file object, stream or a list of lines, not a string"
@@ -88,6 +129,10 @@ def parseCard(file, options):
     try: getattr(options,"evaluateEdits")
     except: setattr(options,"evaluateEdits",True)
 
+    # with --X-fast-parser, the rows of the systematics come from the C++ parser
+    fast = _fastParser(file, options)
+    fastRows = {}; fastRuns = None; headerLines = 0; editsEvaluated = False
+
     try:
         for lineNumber,l in enumerate(file):
             f = l.split();
@@ -164,9 +209,26 @@ def parseCard(file, options):
                 if len(f[1:]) != len(ret.keyline): raise RuntimeError, "Malformed rate line: length %d, while bins and process lines have length %d" % (len(f[1:]), len(ret.keyline))
                 for (b,p,s),r in zip(ret.keyline,f[1:]):
                     ret.exp[b][p] = float(r)
+                headerLines = lineNumber + 1
                 break # rate is the last line before nuisances
         # parse nuisances   
         for lineNumber,l in enumerate(file):
+            irow = fast.rowAtLine(headerLines + lineNumber) if fast is not None else -1
+            if irow >= 0:
+                lsyst = str(fast.rowWrittenName(irow))
+                if options.nuisancesToExclude and isVetoed(lsyst, options.nuisancesToExclude):
+                    if options.verbose > 0: stderr.write("Excluding nuisance %s selected by a veto pattern among %s\n" % (lsyst, options.nuisancesToExclude))
+                    if nuisances != -1: nuisances -= 1
+                    continue
+                if fastRuns is None:
+                    fastRuns = []
+                    for i,(b,p,s) in enumerate(ret.keyline):
+                        if fastRuns and fastRuns[-1][0] == b: fastRuns[-1][2].append(p)
+                        else: fastRuns.append((b,i,[p]))
+                errline = _fastErrline(fast, irow, ret, fastRuns)
+                fastRows[id(errline)] = irow
+                ret.systs.append([str(fast.rowName(irow)),fast.rowNoFloat(irow),str(fast.rowPdf(irow)),_fastArgs(fast, irow),errline])
+                continue
             if l.startswith("--"): continue
             l  = re.sub("\\s*#.*","",l)
             l = re.sub("(?<=\\s)-+(\\s|$)"," 0\\1",l);
@@ -224,6 +286,7 @@ def parseCard(file, options):
             elif pdf=="edit":
                 if nuisances != -1: nuisances = -1
 		if options.evaluateEdits :
+                  editsEvaluated = True
                   if options.verbose > 1: print "Before edit: \n\t%s\n" % ("\n\t".join( [str(x) for x in ret.systs] ))
                   if options.verbose > 1: print "Edit command: %s\n" % numbers
                   doEditNuisance(ret, numbers[0], numbers[1:])
@@ -286,6 +349,10 @@ def parseCard(file, options):
 
         raise
 
+    # the rates of the gmN with no events in the sideband, set by the C++ parser
+    if fast is not None and fast.ratesChanged():
+        for i,(b,p,s) in enumerate(ret.keyline):
+            if ret.exp[b][p] == 0: ret.exp[b][p] = fast.rate(i)
 
     # check if there are bins with no rate
     for b in ret.bins:
@@ -302,6 +369,10 @@ def parseCard(file, options):
         if pdf == "param" or pdf=="discrete" or pdf=="rateParam": # this doesn't have an errline
             syst2.append((lsyst,nofloat,pdf,args,errline))
             continue
+        if not editsEvaluated and id(errline) in fastRows:
+            if fast.rowHasEffect(fastRows[id(errline)]): syst2.append((lsyst,nofloat,pdf,args,errline))
+            elif nuisances != -1: nuisances -= 1
+            continue
         for (b,p,s) in ret.keyline:
             r = errline[b][p]
             nullEffect = (r == 0.0 or (pdf == "lnN" and r == 1.0))
@@ -1,5 +1,6 @@
 import ROOT
 import re, os, os.path
+from array import array
 from sys import stderr, stdout
 from math import *
 ROOFIT_EXPR = "expr"
@@ -25,6 +26,7 @@ class ModelBuilderBase():
         self.options = options
         self.out = stdout
 	self.discrete_param_set = []
+        self.namedSets = []
         if options.bin:
             if options.out == None: options.out = re.sub(".txt$","",options.fileName)+".root"
             options.baseDir = os.path.dirname(options.fileName)
@@ -51,6 +53,9 @@ class ModelBuilderBase():
     def factory_(self,X):
         if self.options.verbose >= 7:
             print "RooWorkspace::factory('%s')" % X
+        if getattr(self.options, "compileFormulas", False) and X.startswith("expr::"):
+            ret = self.compiledFormula_(X)
+            if ret: return ret
         if (len(X) > 1000):
             print "Executing factory with a string of length ",len(X)," > 1000, could trigger a bug: ",X
         ret = self.out.factory(X);
@@ -64,6 +69,26 @@ class ModelBuilderBase():
             raise RuntimeError, "Error in factory statement" 
     def doComment(self,X):
         if not self.options.bin: self.out.write("// "+X+"\n");
+    def compiledFormula_(self,X):
+        """Build expr::name("formula",args) as a RooCompiledFormula, or return None to leave it to the factory
+           (e.g. if the arguments are not all in the workspace yet, or if the formula can't be compiled)"""
+        m = re.match(r'expr::(\w+)\(\s*(["\'])(.*?)\2\s*,(.*)\)\s*$', X, re.DOTALL)
+        if not m or self.out.arg(m.group(1)): return None
+        name, formula, args = m.group(1), m.group(3), m.group(4).strip()
+        if args.startswith("{") and args.endswith("}"): args = args[1:-1]
+        deps = ROOT.RooArgList()
+        for a in args.split(","):
+            arg = self.out.arg(a.strip())
+            if not arg: return None
+            deps.add(arg)
+        func = ROOT.RooCompiledFormula(name, formula, formula, deps)
+        if not func.compiled():
+            if self.options.verbose > 1: print "Can't compile formula '%s' of %s, will use a RooFormulaVar" % (formula, name)
+            return None
+        self.out._import(func, ROOT.RooFit.RecycleConflictNodes(), ROOT.RooFit.Silence())
+        ret = self.out.function(name)
+        if self.options.verbose >= 7: print " ---> ",ret," (%d instructions)" % func.size()
+        return ret
     def doVar(self,vardef):
         if self.options.bin: self.factory_(vardef);
         else: self.out.write(vardef+";\n");
@@ -71,6 +96,7 @@ class ModelBuilderBase():
         if self.options.bin: self.factory_('expr::%s("%s",%s)'%(name,expression,vars));
         else: self.out.write('%s = expr::%s("%s",%s)'%(name,name,expression,vars)+";\n");
     def doSet(self,name,vars):
+        if name not in self.namedSets: self.namedSets.append(name)
         if self.options.bin: self.out.defineSet(name,vars)
         else: self.out.write("%s = set(%s);\n" % (name,vars));
     def doObj(self,name,type,X,ignoreExisting=False):
@@ -464,6 +490,15 @@ class ModelBuilder(ModelBuilderBase):
 
     def doExpectedEvents(self):
         self.doComment(" --- Expected events in each bin, for each process ----")
+        # the ProcessNormalizations are all made at the end, by one call to ProcessNormalization::importAll
+        normNames, normNominals, normBegin = [], [], [0]
+        termKinds, termParams, termKappaLo, termKappaHi = [], [], [], []
+        paramNames, paramIndex = [], {}
+        def termParam(name):
+            if name not in paramIndex:
+                paramIndex[name] = len(paramNames)
+                paramNames.append(name)
+            return paramIndex[name]
         for b in self.DC.bins:
             for p in self.DC.exp[b].keys(): # so that we get only self.DC.processes contributing to this bin
                 # if it's a zero background, write a zero and move on
@@ -530,13 +565,19 @@ class ModelBuilder(ModelBuilderBase):
                     self.doVar("n_exp_bin%s_proc_%s[%g]" % (b, p, self.DC.exp[b][p]))
                 else:
                     #print "Process %s of bin %s depends on:\n\tlog-normals: %s\n\tasymm log-normals: %s\n\tother factors: %s\n" % (p,b,logNorms, alogNorms, factors)
-                    procNorm = ROOT.ProcessNormalization("n_exp_bin%s_proc_%s" % (b,p), "", nominal)
-                    for kappa, thetaName in logNorms: procNorm.addLogNormal(kappa, self.out.function(thetaName))
-                    for kappaLo, kappaHi, thetaName in alogNorms: procNorm.addAsymmLogNormal(kappaLo, kappaHi, self.out.function(thetaName))
+                    normNames.append("n_exp_bin%s_proc_%s" % (b,p))
+                    normNominals.append(nominal)
+                    for kappa, thetaName in logNorms: 
+                        termKinds.append(0); termParams.append(termParam(thetaName)); termKappaLo.append(0); termKappaHi.append(kappa)
+                    for kappaLo, kappaHi, thetaName in alogNorms: 
+                        termKinds.append(1); termParams.append(termParam(thetaName)); termKappaLo.append(kappaLo); termKappaHi.append(kappaHi)
                     for factorName in factors:
-		    	if self.out.function(factorName): procNorm.addOtherFactor(self.out.function(factorName))
-			else: procNorm.addOtherFactor(self.out.var(factorName))
-                    self.out._import(procNorm)
+                        termKinds.append(2); termParams.append(termParam(factorName)); termKappaLo.append(0); termKappaHi.append(0)
+                    normBegin.append(len(termKinds))
+        if normNames:
+            ROOT.ProcessNormalization.importAll(self.out, len(normNames), " ".join(normNames), array('d', normNominals), " ".join(paramNames),
+                                                array('i', normBegin), array('i', termKinds), array('i', termParams),
+                                                array('d', termKappaLo), array('d', termKappaHi))
     def doIndividualModels(self):
         """create pdf_bin<X> and pdf_bin<X>_bonly for each bin"""
         raise RuntimeError, "Not implemented in ModelBuilder"
@@ -549,6 +590,7 @@ class ModelBuilder(ModelBuilderBase):
         for nuis,warn in self.DC.flatParamNuisances.iteritems():
             if self.out.var(nuis): self.out.var(nuis).setAttribute("flatParam")
             elif warn: stderr.write("Missing variable %s declared as flatParam, will create one!\n" % nuis)	
+        if self.options.slimWorkspace: self.slimWorkspace()
         mc_s = ROOT.RooStats.ModelConfig("ModelConfig",       self.out)
         mc_b = ROOT.RooStats.ModelConfig("ModelConfig_bonly", self.out)
         for (l,mc) in [ ('s',mc_s), ('b',mc_b) ]:
@@ -569,7 +611,93 @@ class ModelBuilder(ModelBuilderBase):
 		roocpar =  self.out.cat(cpar)
 		discparams.add(self.out.cat(cpar))
 	self.out._import(discparams,discparams.GetName())
-        self.out.writeToFile(self.options.out)
+        if self.options.splitChannels: self.writeSplitChannels()
+        else: self.out.writeToFile(self.options.out)
+    def slimWorkspace(self):
+        """Replace the output workspace with a copy of only what the models evaluate: the pdfs model_s, model_b and prior
+           with all their servers, the contents of the named sets, MH, the datasets and the generic objects. Whatever else
+           was imported on the way and is no longer referenced (e.g. the source templates of the pdfs converted by
+           optimizeExistingTemplates, or the products of constraints already attached to the channels) is left out."""
+        old = self.out
+        slim = ROOT.RooWorkspace(old.GetName(), old.GetTitle())
+        slim._import = SafeWorkspaceImporter(slim)
+        slim.dont_delete = old.dont_delete + [ old ]
+        for name in "model_s", "model_b", "prior":
+            if old.pdf(name): slim._import(old.pdf(name), ROOT.RooFit.RecycleConflictNodes(), ROOT.RooFit.Silence())
+        self.copyWorkspaceContents(old, slim)
+        if self.options.verbose:
+            stderr.write("Slimmed the workspace from %d to %d nodes\n" % (old.components().getSize(), slim.components().getSize()))
+        self.out = slim
+    def copyWorkspaceContents(self,old,new):
+        "Copy from old to new the named sets with their contents, MH, the datasets and the generic objects"
+        setNames = [ "observables", "POI", "nuisances", "globalObservables" ] + [ "group_%s" % g for g in self.DC.groups.iterkeys() ]
+        for name in setNames + [ n for n in self.namedSets if n not in setNames ]:
+            argset = old.set(name)
+            if not argset: continue
+            newset = ROOT.RooArgSet()
+            iter = argset.createIterator()
+            while True:
+                arg = iter.Next()
+                if arg == None: break
+                if not new.arg(arg.GetName()): new._import(arg, ROOT.RooFit.RecycleConflictNodes(), ROOT.RooFit.Silence())
+                newset.add(new.arg(arg.GetName()))
+            new.defineSet(name, newset)
+        if old.var("MH") and not new.var("MH"): new._import(old.var("MH"))
+        for data in old.allData(): new._import(data)
+        for obj in old.allGenericObjects():
+            if obj.InheritsFrom("RooArgSet"):
+                # e.g. discreteParams, whose contents have to be those of the new workspace
+                copy = ROOT.RooArgSet(obj.GetName())
+                iter = obj.createIterator()
+                while True:
+                    arg = iter.Next()
+                    if arg == None: break
+                    if not new.arg(arg.GetName()): new._import(arg, ROOT.RooFit.RecycleConflictNodes(), ROOT.RooFit.Silence())
+                    copy.add(new.arg(arg.GetName()))
+                new._import(copy, obj.GetName())
+            else:
+                new._import(obj, obj.GetName())
+    def writeSplitChannels(self):
+        """Write the output workspace split by channel, as read by combine (see interface/SplitWorkspace.h): a workspace
+           with the pdfs of each channel, and a top workspace with everything else, from which the models are made again
+           with the channels a job needs."""
+        old = self.out
+        models = [ old.pdf(n) for n in ("model_s", "model_b") if old.pdf(n) ]
+        for m in models:
+            if not m.InheritsFrom("RooSimultaneousOpt"): 
+                raise RuntimeError, "--X-split-channels needs the RooSimultaneousOpt models of the default optimizations, not a %s" % m.ClassName()
+        top = ROOT.RooWorkspace(old.GetName(), old.GetTitle())
+        top._import = SafeWorkspaceImporter(top)
+        rows = []; channels = {}
+        for m in models:
+            names = {}
+            for (what,args) in ("constraints", m.extraConstraints()), ("masks", m.channelMasks()):
+                for i in xrange(args.getSize()): top._import(args.at(i), ROOT.RooFit.RecycleConflictNodes(), ROOT.RooFit.Silence())
+                names[what] = ",".join([ args.at(i).GetName() for i in xrange(args.getSize()) ]) or "-"
+            rows.append("\t".join([ "model", m.GetName(), m.indexCat().GetName(), names["constraints"], names["masks"] ]))
+            for b in self.DC.bins:
+                pdf = m.getPdf(b)
+                if not pdf: continue
+                channels.setdefault(b, []).append(pdf)
+                rows.append("\t".join([ "pdf", m.GetName(), b, pdf.GetName(), "%s_channel_%s" % (old.GetName(), b) ]))
+            # the parameters of all the channels, so that they can be set before the channels are read
+            params = m.getParameters(old.set("observables"))
+            iter = params.createIterator()
+            while True:
+                arg = iter.Next()
+                if arg == None: break
+                if not top.arg(arg.GetName()): top._import(arg, ROOT.RooFit.RecycleConflictNodes(), ROOT.RooFit.Silence())
+        self.copyWorkspaceContents(old, top)
+        fout = ROOT.TFile.Open(self.options.out, "RECREATE")
+        top.Write()
+        for b in self.DC.bins:
+            if b not in channels: continue
+            wc = ROOT.RooWorkspace("%s_channel_%s" % (old.GetName(), b), "")
+            for pdf in channels[b]: getattr(wc,"import")(pdf, ROOT.RooFit.RecycleConflictNodes(), ROOT.RooFit.Silence())
+            wc.Write()
+        ROOT.TNamed("%s_channels" % old.GetName(), "\n".join(rows)).Write()
+        fout.Close()
+        if self.options.verbose: stderr.write("Wrote the workspace split in %d channels\n" % len(channels))
     def isShapeSystematic(self,channel,process,syst):
         return False
 
@@ -0,0 +1,67 @@
+"""
+The NLL of a combine workspace as a function of numpy arrays, through cacheutils::NLLEvaluator (interface/NLLEvaluator.h):
+
+    from HiggsAnalysis.CombinedLimit.NLLEvaluator import NLLFunction
+    f = NLLFunction("workspace.root")
+    x0 = f.values()
+    f(x0), f.gradient(x0), f.batch(numpy.tile(x0, (100, 1)), threads=4)
+
+The arrays are passed to C++ without copies, so they must be contiguous arrays of float64 (they're converted if not).
+"""
+import ROOT
+import numpy
+
+ROOT.gSystem.Load("libHiggsAnalysisCombinedLimit")
+
+class NLLFunction(object):
+    def __init__(self, fileName, workspace="w", modelConfig="ModelConfig", dataset="data_obs", params=None):
+        """NLL of the pdf of the ModelConfig on the dataset, with the constraints of its nuisances; the parameters are
+           the names in params, in this order, or the floating parameters of the NLL in alphabetical order"""
+        self.file = ROOT.TFile.Open(fileName)
+        if not self.file or self.file.IsZombie(): raise IOError("Can't open %s" % fileName)
+        self.w = self.file.Get(workspace)
+        if not self.w: raise RuntimeError("No workspace %s in %s" % (workspace, fileName))
+        mc = self.w.genobj(modelConfig)
+        if not mc or not mc.GetPdf(): raise RuntimeError("No ModelConfig %s with a pdf in the workspace" % modelConfig)
+        data = self.w.data(dataset)
+        if not data: raise RuntimeError("No dataset %s in the workspace" % dataset)
+        constrain = mc.GetNuisanceParameters() if mc.GetNuisanceParameters() else ROOT.RooArgSet()
+        self.nll = mc.GetPdf().createNLL(data, ROOT.RooFit.Constrain(constrain))
+        if params is not None:
+            self.params = ROOT.RooArgList()
+            for name in params:
+                var = self.w.var(name)
+                if not var: raise RuntimeError("No parameter %s in the workspace" % name)
+                self.params.add(var)
+            self.evaluator = ROOT.cacheutils.NLLEvaluator(self.nll, self.params)
+        else:
+            self.evaluator = ROOT.cacheutils.NLLEvaluator(self.nll)
+        self.names = [ self.evaluator.name(i) for i in xrange(self.evaluator.size()) ]
+
+    def _point(self, x):
+        x = numpy.ascontiguousarray(x, dtype=numpy.float64)
+        if x.shape != (len(self.names),): raise ValueError("Expected %d parameters, got an array of shape %s" % (len(self.names), x.shape))
+        return x
+
+    def values(self):
+        """current values of the parameters"""
+        x = numpy.zeros(len(self.names))
+        self.evaluator.values(x)
+        return x
+
+    def __call__(self, x):
+        return self.evaluator.eval(self._point(x))
+
+    def gradient(self, x):
+        """NLL and gradient at x"""
+        grad = numpy.zeros(len(self.names))
+        val = self.evaluator.evalGradient(self._point(x), grad)
+        return val, grad
+
+    def batch(self, points, threads=1):
+        """NLL at each row of points, evaluated on threads threads"""
+        points = numpy.ascontiguousarray(points, dtype=numpy.float64)
+        if points.ndim != 2 or points.shape[1] != len(self.names): raise ValueError("Expected an array of shape (n, %d), got %s" % (len(self.names), points.shape))
+        out = numpy.zeros(points.shape[0])
+        self.evaluator.evalBatch(points.shape[0], points, out, threads)
+        return out
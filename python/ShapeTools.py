@@ -1,5 +1,7 @@
 from sys import stdout, stderr
 import os.path
+import re
+import hashlib
 import ROOT
 
 from HiggsAnalysis.CombinedLimit.ModelTools import ModelBuilder
@@ -15,6 +17,8 @@ class ShapeBuilder(ModelBuilder):
     	self.wspnames = {}
     	self.wsp = None
 	self.norm_rename_map = {}
+        self.prebuiltPdfs = {}
+        self.cachedPdfsFiles = {}; self.shapeFileHashes = {}
     ## ------------------------------------------
     ## -------- ModelBuilder interface ----------
     ## ------------------------------------------
@@ -38,6 +42,8 @@ class ShapeBuilder(ModelBuilder):
         if len(self.DC.obs) != 0: 
             self.doCombinedDataset()
     def doIndividualModels(self):
+        if self.options.buildCache or (self.options.parallelBuild > 1 and len(self.DC.bins) > 1):
+            self.prebuildPdfs(self.options.parallelBuild)
         if self.options.verbose:
             stderr.write("Creating pdfs for individual modes (%d): " % len(self.DC.bins));
             stderr.flush()
@@ -152,6 +158,127 @@ class ShapeBuilder(ModelBuilder):
     ## --------------------------------------
     ## -------- High level helpers ----------
     ## --------------------------------------
+    def prebuildPdfs(self,nforks):
+        """Build the pdfs of the processes of all channels before the model, in one go.
+           With --build-cache, the channels whose inputs didn't change since the last build are read from the cache,
+           and the others are built and added to it. With --parallel-build, the channels to build are split in nforks 
+           contiguous groups built in as many child processes, each writing them to a temporary workspace, 
+           so that each child opens only the files of its own channels."""
+        cache = self.options.buildCache
+        if cache and not os.path.isdir(cache): os.makedirs(cache)
+        todo = []
+        for b in self.DC.bins:
+            if cache and os.path.exists(self.cachedPdfsFile(b)):
+                self.readPdfs(self.cachedPdfsFile(b))
+            else:
+                todo.append(b)
+        if cache and self.options.verbose: stderr.write("Reusing the pdfs of %d channels from %s, building the other %d\n" % (len(self.DC.bins)-len(todo), cache, len(todo)))
+        if not todo: return
+        if cache:
+            # the files of older versions of the channels we rebuild are not needed anymore
+            for b in todo:
+                for f in os.listdir(cache):
+                    if re.match(re.escape(b)+r"-[0-9a-f]{32}\.root$", f): os.remove(os.path.join(cache, f))
+        nforks = min(nforks, len(todo))
+        if nforks <= 1:
+            for b in todo: 
+                self.writePdfs([b], self.cachedPdfsFile(b))
+                self.readPdfs(self.cachedPdfsFile(b))
+            return
+        chunks = [ [ b for (j,b) in enumerate(todo) if j * nforks / len(todo) == i ] for i in xrange(nforks) ]
+        files = [ "%s.build%d.root" % (self.options.out, i) for i in xrange(nforks) ]
+        stdout.flush(); stderr.flush()
+        children = {}
+        for i in xrange(nforks):
+            pid = os.fork()
+            if pid == 0:
+                ret = 0
+                try:
+                    if cache:
+                        for b in chunks[i]: self.writePdfs([b], self.cachedPdfsFile(b))
+                    else:
+                        self.writePdfs(chunks[i], files[i])
+                except Exception, e:
+                    stderr.write("ERROR building the pdfs of channels %s: %s\n" % (",".join(chunks[i]), e))
+                    ret = 1
+                stdout.flush(); stderr.flush()
+                os._exit(ret)
+            children[pid] = i
+        failed = False
+        while children:
+            (pid, status) = os.wait()
+            if pid in children:
+                if status != 0: failed = True
+                del children[pid]
+        if failed:
+            for f in files: 
+                if os.path.exists(f): os.remove(f)
+            raise RuntimeError, "Failed to build the pdfs in parallel, see the errors above"
+        for i in xrange(nforks):
+            if cache:
+                for b in chunks[i]: self.readPdfs(self.cachedPdfsFile(b))
+            else:
+                self.readPdfs(files[i])
+                os.remove(files[i])
+        if self.options.verbose: stderr.write("Built the pdfs of %d channels in %d processes\n" % (len(todo), nforks))
+    def writePdfs(self,channels,fname):
+        "Build the pdfs of the processes of these channels, and save them in a workspace in fname"
+        wsb = ROOT.RooWorkspace("w_build", "")
+        rows = []
+        for b in channels:
+            for p in self.DC.exp[b].keys():
+                if self.DC.exp[b][p] == 0 or self.physics.getYieldScale(b,p) == 0: continue
+                pdf = self.getPdf(b,p)
+                getattr(wsb,"import")(pdf, ROOT.RooFit.RecycleConflictNodes(), ROOT.RooFit.Silence())
+                rows.append("%s\t%s\t%s" % (b,p,pdf.GetName()))
+        # write under a temporary name and rename, so that an interrupted build never leaves a partial file in the cache
+        fout = ROOT.TFile.Open(fname+".tmp", "RECREATE")
+        wsb.Write()
+        ROOT.TNamed("pdfs", "\n".join(rows)).Write()
+        fout.Close()
+        os.rename(fname+".tmp", fname)
+    def readPdfs(self,fname):
+        "Import in the output workspace the pdfs saved by writePdfs, to be returned by getPdf"
+        fin = ROOT.TFile.Open(fname)
+        if not fin or not fin.Get("w_build") or not fin.Get("pdfs"): raise RuntimeError, "Can't read the pdfs from %s" % fname
+        wsb = fin.Get("w_build")
+        for row in str(fin.Get("pdfs").GetTitle()).split("\n"):
+            if not row: continue
+            (b,p,name) = row.split("\t")
+            if not self.out.pdf(name):
+                self.out._import(wsb.pdf(name), ROOT.RooFit.RecycleConflictNodes(), ROOT.RooFit.Silence())
+            self.prebuiltPdfs[(b,p)] = self.out.pdf(name)
+        fin.Close()
+    def cachedPdfsFile(self,channel):
+        """File of the build cache for this channel, named after a hash of everything its pdfs depend on:
+           the options used to build them, the number of bins of the templates, the lines of the datacard for this 
+           channel (processes, rates, shapes and systematics) and the contents of its shape files."""
+        if self.cachedPdfsFiles.has_key(channel): return self.cachedPdfsFiles[channel]
+        o = self.options
+        h = hashlib.md5()
+        h.update(repr((o.mass, o.defMorph, o.useHistPdf, o.optimizeTemplateBins, o.mcStatLite, o.shareIdenticalTemplates, getattr(self.out,'maxbins',None), self.out.mode)))
+        procs = sorted(self.DC.exp[channel].keys())
+        h.update(repr([ (p, self.DC.exp[channel][p], self.DC.isSignal[p], self.physics.getYieldScale(channel,p) == 0) for p in procs ]))
+        h.update(repr([ (syst,nofloat,pdf,args,[ errline[channel].get(p) for p in procs ]) for (syst,nofloat,pdf,args,errline) in self.DC.systs ]))
+        h.update(repr(sorted((k,v) for (k,v) in self.DC.systematicsShapeMap.iteritems() if k[1] == channel)))
+        for p in procs:
+            names = self.getShapeMapEntry(channel,p)
+            h.update(repr(names))
+            if len(names) == 1 and names[0] == "FAKE": continue
+            strmass = "%d" % o.mass if o.mass % 1 == 0 else str(o.mass)
+            fname = self.getShapeFileName(names[0].replace("$PROCESS",p).replace("$CHANNEL",channel).replace("$MASS",strmass))
+            if not self.shapeFileHashes.has_key(fname):
+                fh = hashlib.md5()
+                if os.path.exists(fname):
+                    with open(fname, "rb") as f:
+                        for block in iter(lambda: f.read(1<<20), ""): fh.update(block)
+                else: 
+                    # e.g. a file name depending on the systematic: we can't tell if it changed
+                    fh.update(repr(os.times()))
+                self.shapeFileHashes[fname] = fh.hexdigest()
+            h.update(self.shapeFileHashes[fname])
+        self.cachedPdfsFiles[channel] = os.path.join(self.options.buildCache, "%s-%s.root" % (channel, h.hexdigest()))
+        return self.cachedPdfsFiles[channel]
     def prepareAllShapes(self):
         shapeTypes = []; shapeBins = []; shapeObs = {}
         self.pdfModes = {}
@@ -257,7 +384,18 @@ class ShapeBuilder(ModelBuilder):
             return
         if self.out.mode == "binned":
             combiner = ROOT.CombDataSetFactory(self.out.obs, self.out.binCat)
-            for b in self.DC.bins: combiner.addSetBin(b, self.getData(b,self.options.dataname))
+            for b in self.DC.bins:
+                shape = self.getShape(b,self.options.dataname) if self.options.bulkDataImport else None
+                if shape != None and shape.ClassName().startswith("TH1"):
+                    rebinh1 = self.rebinH1(shape)
+                    weights = ROOT.std.vector('double')(rebinh1.GetNbinsX())
+                    sumw2 = ROOT.std.vector('double')(rebinh1.GetNbinsX())
+                    for i in xrange(rebinh1.GetNbinsX()):
+                        weights[i] = rebinh1.GetBinContent(i+1)
+                        sumw2[i] = rebinh1.GetBinError(i+1)**2
+                    combiner.addSetBin(b, weights, sumw2)
+                else:
+                    combiner.addSetBin(b, self.getData(b,self.options.dataname))
             self.out.data_obs = combiner.done(self.options.dataname,self.options.dataname)
             self.out._import(self.out.data_obs)
         elif self.out.mode == "unbinned":
@@ -276,16 +414,7 @@ class ShapeBuilder(ModelBuilder):
             if self.options.verbose > 2: print "recyling (%s,%s,%s) -> %s\n" % (channel,process,syst,_cache[(channel,process,syst)].GetName())
             return _cache[(channel,process,syst)];
         postFix="Sig" if (process in self.DC.isSignal and self.DC.isSignal[process]) else "Bkg"
-        bentry = None
-        if self.DC.shapeMap.has_key(channel): bentry = self.DC.shapeMap[channel]
-        elif self.DC.shapeMap.has_key("*"):   bentry = self.DC.shapeMap["*"]
-        else: raise KeyError, "Shape map has no entry for channel '%s'" % (channel)
-        names = []
-        if bentry.has_key(process): names = bentry[process]
-        elif bentry.has_key("*"):   names = bentry["*"]
-        elif self.DC.shapeMap["*"].has_key(process): names = self.DC.shapeMap["*"][process]
-        elif self.DC.shapeMap["*"].has_key("*"):     names = self.DC.shapeMap["*"]["*"]
-        else: raise KeyError, "Shape map has no entry for process '%s', channel '%s'" % (process,channel)
+        names = self.getShapeMapEntry(channel,process)
         if len(names) == 1 and names[0] == "FAKE": return None
         if syst != "": 
             if len(names) == 2:
@@ -297,10 +426,7 @@ class ShapeBuilder(ModelBuilder):
         strmass = "%d" % self.options.mass if self.options.mass % 1 == 0 else str(self.options.mass)
         finalNames = [ x.replace("$PROCESS",process).replace("$CHANNEL",channel).replace("$SYSTEMATIC",syst).replace("$MASS",strmass) for x in names ]
         if not _fileCache.has_key(finalNames[0]): 
-            trueFName = finalNames[0]
-            if not os.path.exists(trueFName) and not os.path.isabs(trueFName) and os.path.exists(self.options.baseDir+"/"+trueFName):
-                trueFName = self.options.baseDir+"/"+trueFName;
-            _fileCache[finalNames[0]] = ROOT.TFile.Open(trueFName)
+            _fileCache[finalNames[0]] = ROOT.TFile.Open(self.getShapeFileName(finalNames[0]))
         file = _fileCache[finalNames[0]]; objname = finalNames[1]
         if not file: raise RuntimeError, "Cannot open file %s (from pattern %s)" % (finalNames[0],names[0])
         if ":" in objname: # workspace:obj or ttree:xvar or th1::xvar
@@ -369,11 +495,28 @@ class ShapeBuilder(ModelBuilder):
             if self.options.verbose > 2: print "import (%s,%s) -> %s\n" % (finalNames[0],objname,ret.GetName())
             _cache[(channel,process,syst)] = ret
             return ret
+    def getShapeMapEntry(self,channel,process):
+        "The [ file, object, systematics ] patterns of the shapes line for this channel and process"
+        bentry = None
+        if self.DC.shapeMap.has_key(channel): bentry = self.DC.shapeMap[channel]
+        elif self.DC.shapeMap.has_key("*"):   bentry = self.DC.shapeMap["*"]
+        else: raise KeyError, "Shape map has no entry for channel '%s'" % (channel)
+        if bentry.has_key(process): return bentry[process]
+        elif bentry.has_key("*"):   return bentry["*"]
+        elif self.DC.shapeMap["*"].has_key(process): return self.DC.shapeMap["*"][process]
+        elif self.DC.shapeMap["*"].has_key("*"):     return self.DC.shapeMap["*"]["*"]
+        else: raise KeyError, "Shape map has no entry for process '%s', channel '%s'" % (process,channel)
+    def getShapeFileName(self,fname):
+        "Path of a shape file, also relative to the directory of the datacard"
+        if not os.path.exists(fname) and not os.path.isabs(fname) and os.path.exists(self.options.baseDir+"/"+fname):
+            return self.options.baseDir+"/"+fname
+        return fname
     def getData(self,channel,process,syst="",_cache={}):
         return self.shape2Data(self.getShape(channel,process,syst),channel,process)
-    def getPdf(self,channel,process,_cache={}):
+    def getPdf(self,channel,process,_cache={},_sharedMorphs={}):
         postFix="Sig" if (process in self.DC.isSignal and self.DC.isSignal[process]) else "Bkg"
         if _cache.has_key((channel,process)): return _cache[(channel,process)]
+        if self.prebuiltPdfs.has_key((channel,process)): return self.prebuiltPdfs[(channel,process)]
         shapeNominal = self.getShape(channel,process)
         nominalPdf = self.shape2Pdf(shapeNominal,channel,process) if (self.options.useHistPdf == "always" or shapeNominal == None) else shapeNominal
         if shapeNominal == None: return nominalPdf # no point morphing a fake shape
@@ -405,7 +548,7 @@ class ShapeBuilder(ModelBuilder):
             if self.options.useHistPdf == "always":
                 return nominalPdf
             else:
-                return self.shape2Pdf(shapeNominal,channel,process)
+                return self.addMCStatErrors(self.shape2Pdf(shapeNominal,channel,process), shapeNominal)
         if shapeAlgo == "shapeN": stderr.write("Warning: the shapeN implementation in RooStats and L&S are different\n")
         pdfs = ROOT.RooArgList(nominalPdf) if self.options.useHistPdf == "always" else ROOT.TList()
         if self.options.useHistPdf != "always": pdfs.Add(nominalPdf)
@@ -430,17 +573,24 @@ class ShapeBuilder(ModelBuilder):
         elif "shapeN" in shapeAlgo: qalgo = -1;
         if self.options.useHistPdf != "always":
             if nominalPdf.InheritsFrom("TH1"):
-                rebins = ROOT.TList()
-                maxbins = 0 
-                for i in xrange(pdfs.GetSize()):
-                    rebinned = self.rebinH1(pdfs.At(i))
-                    rebins.Add(rebinned)
-                    maxbins = max(maxbins, rebinned._original_bins)
+                rebins = ROOT.TemplateImporter.rebinAll(pdfs, self.out.maxbins)
+                rebins.SetOwner(True); ROOT.SetOwnership(rebins, True)
+                maxbins = ROOT.TemplateImporter.maxBins(pdfs)
+                if self.options.shareIdenticalTemplates:
+                    key = (postFix, qrange, qalgo, maxbins, tuple(coeffs.at(i).GetName() for i in xrange(coeffs.getSize())),
+                           tuple(tuple(rebins.At(i).GetBinContent(b) for b in xrange(1, self.out.maxbins+1)) for i in xrange(rebins.GetSize())))
+                    if self.options.mcStatLite: key += (tuple(shapeNominal.GetBinError(b) for b in xrange(1, min(shapeNominal.GetNbinsX(),self.out.maxbins)+1)),)
+                    if key in _sharedMorphs:
+                        if self.options.verbose > 1: print "Using %s also for channel %s, process %s (identical templates)" % (_sharedMorphs[key].GetName(), channel, process)
+                        _cache[(channel,process)] = _sharedMorphs[key]
+                        return _sharedMorphs[key]
                 rhp = ROOT.FastVerticalInterpHistPdf2("shape%s_%s_%s_morph" % (postFix,channel,process), "", self.out.binVar, rebins, coeffs, qrange, qalgo)
                 if self.options.optimizeTemplateBins and maxbins < self.out.maxbins:
                     #print "Optimizing binning: %d -> %d for %s " % (self.out.maxbins, maxbins, rhp.GetName())
                     rhp.setActiveBins(maxbins) 
+                self.addMCStatErrors(rhp, shapeNominal)
                 _cache[(channel,process)] = rhp
+                if self.options.shareIdenticalTemplates: _sharedMorphs[key] = rhp
                 return rhp
             elif nominalPdf.InheritsFrom("RooHistPdf") or nominalPdf.InheritsFrom("RooDataHist"):
                 nominalPdf = self.shape2Pdf(shapeNominal,channel,process)
@@ -523,10 +673,15 @@ class ShapeBuilder(ModelBuilder):
                 self.doObj( "systeff_%s_%s_%s" % (channel,process,syst), "AsymPow", "%f,%f,%s" % (kappasScaled[0], kappasScaled[1], syst) ) 
                 terms.append( "systeff_%s_%s_%s" % (channel,process,syst) )
         return terms if terms else None;
+    def addMCStatErrors(self,pdf,shape):
+        "Store in the pdf the relative statistical uncertainties of the bins of its nominal histogram (--mc-stat-lite)"
+        if not self.options.mcStatLite or not shape.InheritsFrom("TH1") or shape.GetDimension() != 1: return pdf
+        relErrs = [ (shape.GetBinError(i)/shape.GetBinContent(i) if shape.GetBinContent(i) > 0 else 0.) for i in xrange(1, min(shape.GetNbinsX(),self.out.maxbins)+1) ]
+        pdf.setStringAttribute("mcStatRelErrors", ",".join(["%.6g" % r for r in relErrs]))
+        return pdf
     def rebinH1(self,shape):
-        rebinh1 = ROOT.TH1F(shape.GetName()+"_rebin", "", self.out.maxbins, 0.0, float(self.out.maxbins))
-        for i in range(1,min(shape.GetNbinsX(),self.out.maxbins)+1): 
-            rebinh1.SetBinContent(i, shape.GetBinContent(i))
+        rebinh1 = ROOT.TemplateImporter.rebin(shape, self.out.maxbins, shape.GetName()+"_rebin")
+        ROOT.SetOwnership(rebinh1, True)
         rebinh1._original_bins = shape.GetNbinsX()
         return rebinh1;
     def shape2Data(self,shape,channel,process,_cache={}):
@@ -17,8 +17,11 @@ parser.add_option("--ic", "--include-channel", type="string", dest="channelInclu
 parser.add_option("--X-no-jmax",  dest="noJMax", default=False, action="store_true", help="FOR DEBUG ONLY: Turn off the consistency check between jmax and number of processes.")
 parser.add_option("--xn-file", "--exclude-nuisances-from-file", type="string", dest="nuisVetoFile", help="Exclude all the nuisances in this file")
 parser.add_option("--en-file", "--edit-nuisances-from-file", type="string", dest="editNuisFile", help="edit the nuisances in this file")
+parser.add_option("--cpp", dest="cpp", default=False, action="store_true", help="Combine the cards with the C++ program combineCards, which is much faster for cards with many nuisances and channels")
 
 (options, args) = parser.parse_args()
+if options.cpp:
+    os.execvp("combineCards", ["combineCards"] + argv[1:])
 options.bin = True # fake that is a binary output, so that we parse shape lines
 options.nuisancesToExclude = []
 options.verbose = 0
@@ -0,0 +1,101 @@
+#include "HiggsAnalysis/CombinedLimit/interface/AdaptiveProposal.h"
+#include <RooArgSet.h>
+#include <RooRealVar.h>
+#include <iostream>
+#include <cmath>
+#include <stdexcept>
+#include <RooRandom.h>
+#include <RooStats/RooStatsUtils.h>
+
+AdaptiveProposal::AdaptiveProposal(const RooArgList &vars, const TMatrixDSym &cov, unsigned int adaptSteps) :
+    RooStats::ProposalFunction(),
+    vars_(vars),
+    n_(vars.getSize()),
+    adaptSteps_(adaptSteps),
+    calls_(0),
+    cov0_(n_*n_), mean_(n_, 0.), m2_(n_*n_, 0.), chol_(n_*n_, 0.), z_(n_),
+    lastSet_(0)
+{
+    if (cov.GetNrows() != int(n_)) throw std::invalid_argument("AdaptiveProposal: covariance matrix doesn't match the variables");
+    for (unsigned int i = 0; i < n_; ++i) {
+        for (unsigned int j = 0; j < n_; ++j) cov0_[i*n_+j] = cov(i,j);
+    }
+    decompose();
+}
+
+void AdaptiveProposal::decompose()
+{
+    // the initial covariance counts as 10 points per dimension, so that it's not forgotten before the chain has explored the posterior
+    double k0 = 10.*n_, k = (calls_ > 1 ? calls_ - 1 : 0), scale = 2.38*2.38/n_;
+    std::vector<double> c(n_*n_);
+    for (unsigned int i = 0; i < n_*n_; ++i) c[i] = scale * (k0 * cov0_[i] + m2_[i]) / (k0 + k);
+    for (unsigned int i = 0; i < n_; ++i) c[i*n_+i] *= (1 + 1e-9);
+    std::fill(chol_.begin(), chol_.end(), 0.);
+    for (unsigned int j = 0; j < n_; ++j) {
+        double d = c[j*n_+j];
+        for (unsigned int l = 0; l < j; ++l) d -= chol_[j*n_+l]*chol_[j*n_+l];
+        if (!(d > 0)) {
+            // not positive definite: fall back to uncorrelated moves
+            std::fill(chol_.begin(), chol_.end(), 0.);
+            for (unsigned int i = 0; i < n_; ++i) chol_[i*n_+i] = std::sqrt(std::max(c[i*n_+i], 0.));
+            return;
+        }
+        chol_[j*n_+j] = std::sqrt(d);
+        for (unsigned int i = j+1; i < n_; ++i) {
+            double s = c[i*n_+j];
+            for (unsigned int l = 0; l < j; ++l) s -= chol_[i*n_+l]*chol_[j*n_+l];
+            chol_[i*n_+j] = s / chol_[j*n_+j];
+        }
+    }
+}
+
+// Populate xPrime with a new proposed point
+void AdaptiveProposal::Propose(RooArgSet& xPrime, RooArgSet& x)
+{
+    RooStats::SetParameters(&x, &xPrime);
+    if (&xPrime != lastSet_) {
+        primeVars_.resize(n_);
+        for (unsigned int i = 0; i < n_; ++i) {
+            primeVars_[i] = dynamic_cast<RooRealVar *>(xPrime.find(vars_.at(i)->GetName()));
+            if (primeVars_[i] == 0) {
+                std::cout << "ERROR: missing parameter " << vars_.at(i)->GetName() << " in xPrime" << std::endl;
+                throw std::logic_error("Missing parameter in ArgSet");
+            }
+        }
+        lastSet_ = &xPrime;
+    }
+    if (calls_ < adaptSteps_) {
+        // Welford update of the mean and covariance with the current point of the chain
+        ++calls_;
+        for (unsigned int i = 0; i < n_; ++i) z_[i] = primeVars_[i]->getVal() - mean_[i];
+        for (unsigned int i = 0; i < n_; ++i) mean_[i] += z_[i] / calls_;
+        for (unsigned int i = 0; i < n_; ++i) {
+            double di = primeVars_[i]->getVal() - mean_[i];
+            for (unsigned int j = 0; j < n_; ++j) m2_[i*n_+j] += di * z_[j];
+        }
+        if (calls_ % std::max(10u, n_) == 0 || calls_ == adaptSteps_) decompose();
+    }
+    for (unsigned int i = 0; i < n_; ++i) z_[i] = RooRandom::gaussian();
+    for (unsigned int i = 0; i < n_; ++i) {
+        RooRealVar *var = primeVars_[i];
+        double val = var->getVal(), max = var->getMax(), min = var->getMin(), len = max - min;
+        for (unsigned int j = 0; j <= i; ++j) val += chol_[i*n_+j] * z_[j];
+        while (val > max) val -= len;
+        while (val < min) val += len;
+        var->setVal(val);
+    }
+}
+
+Bool_t AdaptiveProposal::IsSymmetric(RooArgSet& x1, RooArgSet& x2) {
+   return true;
+}
+
+// Return the probability of proposing the point x1 given the starting
+// point x2
+Double_t AdaptiveProposal::GetProposalDensity(RooArgSet& x1,
+                                          RooArgSet& x2)
+{
+   return 1.0; // should not be needed
+}
+
+ClassImp(AdaptiveProposal)
@@ -1,8 +1,17 @@
 #include "HiggsAnalysis/CombinedLimit/interface/AsimovUtils.h"
 
 #include <memory>
+#include <map>
+#include <vector>
+#include <fstream>
 #include <stdexcept>
+#include <cstdio>
+#include <unistd.h>
+#include <boost/functional/hash.hpp>
 #include <TIterator.h>
+#include <TFile.h>
+#include <RooCategory.h>
+#include <RooRealVar.h>
 #include <RooAbsData.h>
 #include <RooArgSet.h>
 #include <RooProdPdf.h>
@@ -11,6 +20,115 @@
 #include "HiggsAnalysis/CombinedLimit/interface/ToyMCSamplerOpt.h"
 #include "HiggsAnalysis/CombinedLimit/interface/CloseCoutSentry.h"
 #include "HiggsAnalysis/CombinedLimit/interface/CascadeMinimizer.h"
+#include "HiggsAnalysis/CombinedLimit/interface/CachingNLL.h"
+#include "HiggsAnalysis/CombinedLimit/interface/ProfilingTools.h"
+
+namespace {
+    bool asimovCacheEnabled_ = false;
+    std::string asimovCacheDir_;
+    struct CachedAsimov {
+        std::auto_ptr<RooAbsData> data;
+        RooArgSet globalObs, params;
+    };
+    std::map<std::size_t, std::unique_ptr<CachedAsimov> > asimovCache_;
+    /// hash of the content of the file of the model, for the templates and constants that are not among the parameters
+    std::size_t asimovModelHash_ = 0;
+
+    std::size_t hashFile(const std::string &name) {
+        std::size_t key = 0;
+        std::ifstream in(name.c_str(), std::ios::binary);
+        if (!in.good()) throw std::runtime_error("Cannot read the model file "+name+" for the asimov cache");
+        std::vector<char> buff(1<<20);
+        while (in.read(&buff[0], buff.size()), in.gcount() > 0) {
+            boost::hash_combine(key, boost::hash_range(buff.begin(), buff.begin() + in.gcount()));
+        }
+        return key;
+    }
+
+    void hashValues(std::size_t &key, const RooAbsCollection &set, bool withSetup) {
+        std::auto_ptr<TIterator> iter(set.createIterator());
+        for (RooAbsArg *a = (RooAbsArg *) iter->Next(); a != 0; a = (RooAbsArg *) iter->Next()) {
+            if (withSetup) boost::hash_combine(key, std::string(a->GetName()));
+            if (RooRealVar *rrv = dynamic_cast<RooRealVar *>(a)) {
+                boost::hash_combine(key, rrv->getVal());
+                if (withSetup) { boost::hash_combine(key, rrv->isConstant()); boost::hash_combine(key, rrv->getMin()); boost::hash_combine(key, rrv->getMax()); }
+            } else if (RooAbsCategory *cat = dynamic_cast<RooAbsCategory *>(a)) {
+                boost::hash_combine(key, cat->getIndex());
+            } else if (RooAbsReal *rar = dynamic_cast<RooAbsReal *>(a)) {
+                boost::hash_combine(key, rar->getVal());
+            }
+        }
+    }
+    /// key of the asimov dataset: content of the model file, structure of the pdf, values and ranges of its parameters, content of the data, and options
+    std::size_t asimovKey(RooStats::ModelConfig *mc, RooAbsData &realdata, const RooArgSet &params, bool needsFit, double poiValue) {
+        std::size_t key = asimovModelHash_;
+        boost::hash_combine(key, needsFit);
+        boost::hash_combine(key, poiValue);
+        std::auto_ptr<RooArgSet> comps(mc->GetPdf()->getComponents());
+        std::auto_ptr<TIterator> iter(comps->createIterator());
+        for (RooAbsArg *a = (RooAbsArg *) iter->Next(); a != 0; a = (RooAbsArg *) iter->Next()) {
+            boost::hash_combine(key, std::string(a->GetName()));
+            boost::hash_combine(key, std::string(a->ClassName()));
+        }
+        hashValues(key, params, true);
+        if (mc->GetNuisanceParameters()) hashValues(key, *mc->GetNuisanceParameters(), true);
+        if (mc->GetGlobalObservables()) hashValues(key, *mc->GetGlobalObservables(), true);
+        for (int i = 0, n = realdata.numEntries(); i < n; ++i) {
+            hashValues(key, *realdata.get(i), i == 0);
+            boost::hash_combine(key, realdata.weight());
+        }
+        return key;
+    }
+    std::string asimovCacheFile(std::size_t key) {
+        char buff[32]; snprintf(buff, 31, "%016llx", (unsigned long long) key);
+        return asimovCacheDir_ + "/asimov-" + buff + ".root";
+    }
+    /// look for the asimov dataset in memory, and then on disk
+    CachedAsimov * findCachedAsimov(std::size_t key) {
+        std::map<std::size_t, std::unique_ptr<CachedAsimov> >::iterator match = asimovCache_.find(key);
+        if (match != asimovCache_.end()) return match->second.get();
+        if (asimovCacheDir_.empty()) return 0;
+        std::string name = asimovCacheFile(key);
+        if (access(name.c_str(), R_OK) != 0) return 0;
+        std::auto_ptr<TFile> file(TFile::Open(name.c_str()));
+        if (file.get() == 0) return 0;
+        RooAbsData *data = dynamic_cast<RooAbsData *>(file->Get("asimov"));
+        RooArgSet *gobs  = dynamic_cast<RooArgSet *>(file->Get("globalObservables"));
+        RooArgSet *pars  = dynamic_cast<RooArgSet *>(file->Get("parameters"));
+        if (data == 0 || gobs == 0 || pars == 0) { delete data; delete gobs; delete pars; return 0; }
+        CachedAsimov *ret = new CachedAsimov();
+        ret->data.reset(data);
+        gobs->snapshot(ret->globalObs); delete gobs;
+        pars->snapshot(ret->params); delete pars;
+        asimovCache_[key].reset(ret);
+        return ret;
+    }
+    void storeCachedAsimov(std::size_t key, const RooAbsData &asimov, const RooAbsCollection &globalObs, const RooAbsCollection &params) {
+        CachedAsimov *item = new CachedAsimov();
+        item->data.reset((RooAbsData *) asimov.Clone());
+        globalObs.snapshot(item->globalObs);
+        params.snapshot(item->params);
+        asimovCache_[key].reset(item);
+        if (asimovCacheDir_.empty()) return;
+        // write to a temporary name and then rename, so that concurrent jobs never see a partial file
+        std::string name = asimovCacheFile(key), tmpName = name + TString::Format(".%d", getpid()).Data();
+        std::auto_ptr<TFile> file(TFile::Open(tmpName.c_str(), "RECREATE"));
+        if (file.get() == 0) return;
+        file->WriteTObject(item->data.get(), "asimov");
+        file->WriteTObject(&item->globalObs, "globalObservables");
+        file->WriteTObject(&item->params, "parameters");
+        file->Close();
+        if (rename(tmpName.c_str(), name.c_str()) != 0) unlink(tmpName.c_str());
+    }
+}
+
+void asimovutils::setCache(bool enable, const std::string &dir, const std::string &modelFile) {
+    asimovCacheEnabled_ = enable;
+    asimovCacheDir_ = dir;
+    std::size_t modelHash = (enable && !modelFile.empty() ? hashFile(modelFile) : 0);
+    if (!enable || modelHash != asimovModelHash_) asimovCache_.clear();
+    asimovModelHash_ = modelHash;
+}
 
 RooAbsData *asimovutils::asimovDatasetNominal(RooStats::ModelConfig *mc, double poiValue, int verbose) {
         RooArgSet  poi(*mc->GetParametersOfInterest());
@@ -27,6 +145,26 @@ RooAbsData *asimovutils::asimovDatasetWithFit(RooStats::ModelConfig *mc, RooAbsD
         RooArgSet  poi(*mc->GetParametersOfInterest());
         RooRealVar *r = dynamic_cast<RooRealVar *>(poi.first());
         r->setConstant(true); r->setVal(poiValue);
+        std::auto_ptr<RooArgSet> cacheParams;
+        std::size_t cacheKey = 0;
+        if (asimovCacheEnabled_) {
+            cacheParams.reset(mc->GetPdf()->getParameters(realdata));
+            cacheKey = asimovKey(mc, realdata, *cacheParams, needsFit, poiValue);
+            if (CachedAsimov *cached = findCachedAsimov(cacheKey)) {
+                if (verbose > 0) std::cout << "Using the cached asimov dataset, skipping the fit." << std::endl;
+                cacheParams->assignValueOnly(cached->params);
+                snapshot.removeAll();
+                if (cached->globalObs.getSize() > 0) {
+                    RooArgSet gobs(*mc->GetGlobalObservables());
+                    utils::setAllConstant(gobs, true);
+                    gobs.snapshot(snapshot);
+                    snapshot.assignValueOnly(cached->globalObs);
+                }
+                return (RooAbsData *) cached->data->Clone();
+            }
+        }
+        // the NLL of the fit, which can also make the asimov dataset from its cached templates (ASIMOV_FROM_NLL)
+        std::auto_ptr<RooAbsReal> nll;
         {
             CloseCoutSentry sentry(verbose < 3);
             if (mc->GetNuisanceParameters()) {
@@ -43,7 +181,7 @@ RooAbsData *asimovutils::asimovDatasetWithFit(RooStats::ModelConfig *mc, RooAbsD
             if (needsFit) {
                 //mc->GetPdf()->fitTo(realdata, RooFit::Minimizer("Minuit2","minimize"), RooFit::Strategy(1), RooFit::Constrain(*mc->GetNuisanceParameters()));
                 const RooCmdArg &constrain = (mc->GetNuisanceParameters() ? RooFit::Constrain(*mc->GetNuisanceParameters()) : RooCmdArg());
-                std::auto_ptr<RooAbsReal> nll(mc->GetPdf()->createNLL(realdata, constrain, RooFit::Extended(mc->GetPdf()->canBeExtended())));
+                nll.reset(mc->GetPdf()->createNLL(realdata, constrain, RooFit::Extended(mc->GetPdf()->canBeExtended())));
                 CascadeMinimizer minim(*nll, CascadeMinimizer::Constrained);
                 minim.setStrategy(1);
                 minim.minimize(verbose-1);
@@ -53,10 +191,19 @@ RooAbsData *asimovutils::asimovDatasetWithFit(RooStats::ModelConfig *mc, RooAbsD
             std::cout << "Nuisance parameters after fit for asimov dataset: " << std::endl;
             mc->GetNuisanceParameters()->Print("V");
         }
-        toymcoptutils::SimPdfGenInfo newToyMC(*mc->GetPdf(), *mc->GetObservables(), false); 
-        RooRealVar *weightVar = 0;
-        RooAbsData *asimov = newToyMC.generateAsimov(weightVar); 
-        delete weightVar;
+        RooAbsData *asimov = 0;
+        cacheutils::CachingSimNLL *simnll = dynamic_cast<cacheutils::CachingSimNLL *>(nll.get());
+        if (simnll != 0 && runtimedef::get("ASIMOV_FROM_NLL")) {
+            RooRealVar weightVar("_weight_","",1.0);
+            asimov = simnll->asimovDataset(*mc->GetObservables(), weightVar);
+            if (asimov == 0 && verbose > 0) std::cout << "Can't make the asimov dataset from the NLL (not all channels are binned), will generate it." << std::endl;
+        }
+        if (asimov == 0) {
+            toymcoptutils::SimPdfGenInfo newToyMC(*mc->GetPdf(), *mc->GetObservables(), false); 
+            RooRealVar *weightVar = 0;
+            asimov = newToyMC.generateAsimov(weightVar); 
+            delete weightVar;
+        }
 
         // NOW SNAPSHOT THE GLOBAL OBSERVABLES
         if (mc->GetGlobalObservables() && mc->GetGlobalObservables()->getSize() > 0) {
@@ -155,5 +302,10 @@ RooAbsData *asimovutils::asimovDatasetWithFit(RooStats::ModelConfig *mc, RooAbsD
             }
         }
 
+        if (asimovCacheEnabled_) {
+            RooArgSet gobsAsimov; 
+            if (mc->GetGlobalObservables() && mc->GetGlobalObservables()->getSize() > 0) gobsAsimov.add(snapshot);
+            storeCachedAsimov(cacheKey, *asimov, gobsAsimov, *cacheParams);
+        }
         return asimov;
 }
@@ -55,4 +55,24 @@ Double_t AsymPow::logKappaForX(Double_t x) const {
 #endif
 } 
 
+bool AsymPow::analyticalDerivative(const RooAbsArg &theta, double &deriv) const {
+    if (kappaLow_.arg().dependsOnValue(theta) || kappaHigh_.arg().dependsOnValue(theta)) return false;
+    if (&theta_.arg() != &theta) {
+        deriv = 0;
+        return !theta_.arg().dependsOnValue(theta);
+    }
+    // d/dx exp(logKappa(x) * x) = exp(logKappa(x) * x) * (logKappa(x) + x * logKappa'(x))
+    Double_t x = theta_;
+    double dlogKappa = 0;
+    if (fabs(x) < 0.5) {
+        double logKhi =  log(kappaHigh_);
+        double logKlo = -log(kappaLow_);
+        double halfdiff = 0.5*(logKhi - logKlo);
+        double twox = x+x, twox2 = twox*twox;
+        dlogKappa = halfdiff * 2 * 0.125 * 15. * (twox2 * (twox2 - 2.) + 1.);
+    }
+    deriv = getVal() * (logKappaForX(x) + x * dlogKappa);
+    return true;
+}
+
 ClassImp(AsymPow)
@@ -1,4 +1,8 @@
 #include <stdexcept>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
 
 #include "HiggsAnalysis/CombinedLimit/interface/Asymptotic.h"
 #include <RooRealVar.h>
@@ -16,10 +20,13 @@
 #include "HiggsAnalysis/CombinedLimit/interface/ToyMCSamplerOpt.h"
 #include "HiggsAnalysis/CombinedLimit/interface/ProfileLikelihood.h"
 #include "HiggsAnalysis/CombinedLimit/interface/CascadeMinimizer.h"
+#include "HiggsAnalysis/CombinedLimit/interface/FitterAlgoBase.h"
 #include "HiggsAnalysis/CombinedLimit/interface/utils.h"
 #include "HiggsAnalysis/CombinedLimit/interface/AsimovUtils.h"
 
 #include <boost/bind.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/classification.hpp>
 
 using namespace RooStats;
 
@@ -38,15 +45,62 @@ float       Asymptotic::minimizerTolerance_ = 0.01;
 int         Asymptotic::minimizerStrategy_  = 0;
 double Asymptotic::rValue_ = 1.0;
 bool Asymptotic::strictBounds_ = false;
+bool Asymptotic::forkQuantiles_ = false;
+bool Asymptotic::adaptiveCLs_ = false;
+bool Asymptotic::approxExpected_ = false;
+std::string Asymptotic::gridPoints_ = "";
+unsigned int Asymptotic::gridForks_ = 1;
+
+namespace {
+    /// monotone cubic (Fritsch-Carlson) interpolation of the points (sorted in x), linear outside them
+    class MonotoneSpline {
+        public:
+            MonotoneSpline(const std::vector<std::pair<double,double> > &points) : p_(points), m_(points.size()) {
+                int n = p_.size();
+                std::vector<double> d(n-1);
+                for (int i = 0; i < n-1; ++i) d[i] = (p_[i+1].second - p_[i].second)/(p_[i+1].first - p_[i].first);
+                m_[0] = d[0]; m_[n-1] = d[n-2];
+                for (int i = 1; i < n-1; ++i) m_[i] = (d[i-1]*d[i] <= 0 ? 0 : 0.5*(d[i-1]+d[i]));
+                for (int i = 0; i < n-1; ++i) {
+                    if (d[i] == 0) { m_[i] = m_[i+1] = 0; continue; }
+                    double a = m_[i]/d[i], b = m_[i+1]/d[i], s2 = a*a + b*b;
+                    if (s2 > 9) { double t = 3/std::sqrt(s2); m_[i] = t*a*d[i]; m_[i+1] = t*b*d[i]; }
+                }
+            }
+            double operator()(double x) const {
+                int n = p_.size();
+                if (x <= p_[0].first)   return p_[0].second   + m_[0]  *(x - p_[0].first);
+                if (x >= p_[n-1].first) return p_[n-1].second + m_[n-1]*(x - p_[n-1].first);
+                int i = 0; while (x > p_[i+1].first) ++i;
+                double h = p_[i+1].first - p_[i].first, t = (x - p_[i].first)/h, t2 = t*t, t3 = t2*t;
+                return (2*t3 - 3*t2 + 1)*p_[i].second + (t3 - 2*t2 + t)*h*m_[i] + (-2*t3 + 3*t2)*p_[i+1].second + (t3 - t2)*h*m_[i+1];
+            }
+            /// x in [xlo, xhi] where the spline crosses y, by bisection; the midpoint if it doesn't cross it there
+            double inverse(double y, double xlo, double xhi) const {
+                double flo = (*this)(xlo) - y, fhi = (*this)(xhi) - y;
+                if (flo*fhi > 0) return 0.5*(xlo + xhi);
+                for (int it = 0; it < 60; ++it) {
+                    double xm = 0.5*(xlo + xhi), fm = (*this)(xm) - y;
+                    if (fm*flo > 0) { xlo = xm; flo = fm; } else { xhi = xm; }
+                }
+                return 0.5*(xlo + xhi);
+            }
+        private:
+            std::vector<std::pair<double,double> > p_;
+            std::vector<double> m_;
+    };
+}
 
 
 Asymptotic::Asymptotic() : 
-LimitAlgo("Asymptotic specific options") {
+LimitAlgo("Asymptotic specific options"), warmStart_(false), nllData_(0), lastLimit_(-1), rBranch_(false) {
     options_.add_options()
         ("rAbsAcc", boost::program_options::value<double>(&rAbsAccuracy_)->default_value(rAbsAccuracy_), "Absolute accuracy on r to reach to terminate the scan")
         ("rRelAcc", boost::program_options::value<double>(&rRelAccuracy_)->default_value(rRelAccuracy_), "Relative accuracy on r to reach to terminate the scan")
         ("run", boost::program_options::value<std::string>(&what_)->default_value(what_), "What to run: both (default), observed, expected, blind.")
         ("singlePoint",  boost::program_options::value<double>(&rValue_),  "Just compute CLs for the given value of r")
+        ("gridPoints", boost::program_options::value<std::string>(&gridPoints_), "Compute CLs at all these values of r, as a comma separated list or as rMin:rMax:npoints (evenly spaced, including both ends), doing the fits of the data and of the asimov dataset only once: the output tree is the one of --singlePoint at each value, for --getLimitFromGrid")
+        ("gridForks", boost::program_options::value<unsigned int>(&gridForks_)->default_value(gridForks_), "With --gridPoints, split the values among this many processes, each computing a contiguous range of them")
         ("minimizerAlgo",      boost::program_options::value<std::string>(&minimizerAlgo_)->default_value(minimizerAlgo_), "Choice of minimizer used for profiling (Minuit vs Minuit2)")
         ("minimizerTolerance", boost::program_options::value<float>(&minimizerTolerance_)->default_value(minimizerTolerance_),  "Tolerance for minimizer used for profiling")
         ("minimizerStrategy",  boost::program_options::value<int>(&minimizerStrategy_)->default_value(minimizerStrategy_),      "Stragegy for minimizer")
@@ -57,13 +111,21 @@ LimitAlgo("Asymptotic specific options") {
         ("newExpected", boost::program_options::value<bool>(&newExpected_)->default_value(newExpected_), "Use the new formula for expected limits (default is true)")
         ("minosAlgo", boost::program_options::value<std::string>(&minosAlgo_)->default_value(minosAlgo_), "Algorithm to use to get the median expected limit: 'minos' (fastest), 'bisection', 'stepping' (default, most robust)")
         ("strictBounds", "Take --rMax as a strict upper bound")
+        ("forkQuantiles", "Compute the observed limit and the expected quantiles at the same time, in forked processes")
+        ("adaptiveCLs", "Search the observed limit by inverse interpolation of a monotone spline through the values of CLs computed so far")
+        ("approxExpected", "Compute all the expected limits in closed form from the sigma of r in the asimov fit (from its Hessian, corrected with q_mu at two values of r near the median), instead of searching each crossing; limitErr is the estimated error of the approximation")
     ;
 }
 
 void Asymptotic::applyOptions(const boost::program_options::variables_map &vm) {
     if (vm.count("singlePoint") && !vm["singlePoint"].defaulted()) {
         if (!vm["run"].defaulted()) throw std::invalid_argument("Asymptotic: when using --singlePoint you can't use --run (at least for now)");
+        if (vm.count("gridPoints")) throw std::invalid_argument("Asymptotic: you can't use --singlePoint and --gridPoints at the same time");
         what_ = "singlePoint";
+    } else if (vm.count("gridPoints")) {
+        if (!vm["run"].defaulted()) throw std::invalid_argument("Asymptotic: when using --gridPoints you can't use --run (at least for now)");
+        if (vm.count("getLimitFromGrid")) throw std::invalid_argument("Asymptotic: --gridPoints makes a grid, it can't be used with --getLimitFromGrid");
+        what_ = "grid";
     } else {
         if (what_ != "observed" && what_ != "expected" && what_ != "both" && what_ != "blind") 
             throw std::invalid_argument("Asymptotic: option 'run' can only be 'observed', 'expected' or 'both' (the default) or 'blind' (a-priori expected)");
@@ -73,6 +135,9 @@ void Asymptotic::applyOptions(const boost::program_options::variables_map &vm) {
     if (what_ == "blind") { what_ = "expected"; noFitAsimov_ = true; } 
     if (noFitAsimov_) std::cout << "Will use a-priori expected background instead of a-posteriori one." << std::endl; 
     strictBounds_ = vm.count("strictBounds");
+    forkQuantiles_ = vm.count("forkQuantiles");
+    adaptiveCLs_ = vm.count("adaptiveCLs");
+    approxExpected_ = vm.count("approxExpected");
     useGrid_ = vm.count("getLimitFromGrid");
 
     if (useGrid_){
@@ -90,6 +155,11 @@ void Asymptotic::applyDefaultOptions() {
     what_ = "observed"; noFitAsimov_ = true; // faster
 }
 
+void Asymptotic::beginMassPoint(unsigned int index) {
+    warmStart_ = (index > 0);
+    if (!warmStart_) { warmFitD_.clear(); lastLimit_ = -1; }
+}
+
 bool Asymptotic::run(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, double &limit, double &limitErr, const double *hint) {
     RooFitGlobalKillSentry silence(verbose <= 1 ? RooFit::WARNING : RooFit::DEBUG);
     ProfileLikelihood::MinimizerSentry minimizerConfig(minimizerAlgo_, minimizerTolerance_);
@@ -105,14 +175,35 @@ bool Asymptotic::run(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::Mod
 
     bool ret = false; 
     std::vector<std::pair<float,float> > expected;
-    if (what_ == "both" || what_ == "expected") expected = runLimitExpected(w, mc_s, mc_b, data, limit, limitErr, hint);
-    if (what_ != "expected") ret = runLimit(w, mc_s, mc_b, data, limit, limitErr, hint);
+    if (forkQuantiles_ && what_ == "both" && !useGrid_) {
+        // make the asimov dataset first, so that it's not made again in each process.
+        // the expected limits are computed here, since they are committed as they come; the observed one in a fork
+        asimovDataset(w, mc_s, mc_b, data);
+        std::vector<std::vector<double> > results;
+        FitterAlgoBase::runInForks(2, [&](unsigned int i) -> std::vector<double> {
+            if (i == 0) { expected = runLimitExpected(w, mc_s, mc_b, data, limit, limitErr, hint); return std::vector<double>(); }
+            double obsLimit = 0, obsLimitErr = 0;
+            bool ok = runLimit(w, mc_s, mc_b, data, obsLimit, obsLimitErr, hint);
+            std::vector<double> ret(3); ret[0] = ok; ret[1] = obsLimit; ret[2] = obsLimitErr;
+            return ret;
+        }, results, true);
+        if (results[1].size() == 3) {
+            ret = (results[1][0] != 0); limit = results[1][1]; limitErr = results[1][2];
+        } else {
+            std::cerr << "Asymptotic: the process computing the observed limit failed." << std::endl;
+        }
+    } else {
+        if (what_ == "both" || what_ == "expected") expected = runLimitExpected(w, mc_s, mc_b, data, limit, limitErr, hint);
+        if (what_ != "expected") ret = runLimit(w, mc_s, mc_b, data, limit, limitErr, hint);
+    }
 
     if (verbose >= 0) {
         const char *rname = mc_s->GetParametersOfInterest()->first()->GetName();
         std::cout << "\n -- Asymptotic -- " << "\n";
         if (what_ == "singlePoint") {
             printf("Observed CLs for %s = %.1f: %6.4f \n", rname, rValue_, limit);
+        } else if (what_ == "grid") {
+            printf("Observed and expected CLs computed at %d values of %s\n", int(limit), rname);
         } else if (ret && what_ != "expected") {
             printf("Observed Limit: %s < %6.4f\n", rname, limit);
         }
@@ -122,6 +213,8 @@ bool Asymptotic::run(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::Mod
         std::cout << std::endl;
     }
 
+    if (ret && what_ != "singlePoint") lastLimit_ = limit;
+
     // note that for expected we have to return FALSE even if we succeed because otherwise it goes into the observed limit as well
     return ret;
 }
@@ -138,9 +231,9 @@ bool Asymptotic::runLimit(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats
 	return true;
   }
    
-  w->loadSnapshot("clean");
+  utils::loadSnapshot(w, "clean");
   RooAbsData &asimov = *asimovDataset(w, mc_s, mc_b, data);
-  w->loadSnapshot("clean");
+  utils::loadSnapshot(w, "clean");
   
   r->setConstant(false);
   r->setVal(0.1*r->getMax());
@@ -155,9 +248,20 @@ bool Asymptotic::runLimit(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats
       if ( rrv != 0 && rrv != r && rrv->isConstant() == false ) { hasFloatParams_ = true; break; }
   }
 
-  RooArgSet constraints; if (withSystematics) constraints.add(*mc_s->GetNuisanceParameters());
-  nllD_.reset(mc_s->GetPdf()->createNLL(data,   RooFit::Constrain(constraints)));
-  nllA_.reset(mc_s->GetPdf()->createNLL(asimov, RooFit::Constrain(constraints)));
+  // the likelihoods only change through MH from one mass point to the next, which they track as any other parameter
+  if (!warmStart_ || nllD_.get() == 0 || nllData_ != &data) {
+    RooArgSet constraints; if (withSystematics) constraints.add(*mc_s->GetNuisanceParameters());
+    nllD_.reset(mc_s->GetPdf()->createNLL(data,   RooFit::Constrain(constraints)));
+    nllA_.reset(mc_s->GetPdf()->createNLL(asimov, RooFit::Constrain(constraints)));
+    nllData_ = &data;
+  }
+  if (warmParams_.getSize() == 0) {
+    RooLinkedListIter iter = params_->iterator();
+    for (RooAbsArg *a = (RooAbsArg *) iter.Next(); a != 0; a = (RooAbsArg *) iter.Next()) {
+        RooRealVar *rrv = dynamic_cast<RooRealVar *>(a);
+        if (rrv != 0 && !rrv->isConstant()) warmParams_.add(*rrv);
+    }
+  }
 
   if (verbose > 0) std::cout << (qtilde_ ? "Restricting" : "Not restricting") << " " << r->GetName() << " to positive values." << std::endl;
   if (verbose > 1) params_->Print("V");
@@ -166,10 +270,12 @@ bool Asymptotic::runLimit(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats
   {
     CloseCoutSentry sentry(verbose < 3);
     *params_ = snapGlobalObsData;
+    if (warmStart_ && !warmFitD_.empty()) warmFitD_.writeTo(warmParams_);
     CascadeMinimizer minim(*nllD_, CascadeMinimizer::Unconstrained, r);
     minim.setStrategy(minimizerStrategy_);
     minim.minimize(verbose-2);
     fitFreeD_.readFrom(*params_);
+    warmFitD_.readFrom(warmParams_);
     minNllD_ = nllD_->getVal();
   }
   rBestD_ = r->getVal();
@@ -197,18 +303,25 @@ bool Asymptotic::runLimit(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats
   r->setConstant(true);
 
   if (what_ == "singlePoint") {
-    Combine::addBranch("r",&rValue_,"r/D");
+    if (!rBranch_) { Combine::addBranch("r",&rValue_,"r/D"); rBranch_ = true; }
     limit = getCLs(*r, rValue_, true, &limit, &limitErr); 
     return true;
   }
+  if (what_ == "grid") {
+    runGrid(*r, limit, limitErr);
+    return false; // the points are already in the tree
+  }
 
   double clsTarget = 1-cl;
   double rMin = std::max<double>(0, r->getVal()), rMax = rMin + 3 * rErr;
+  if (warmStart_ && lastLimit_ > rMin) rMax = 1.2 * lastLimit_; // the limit changes slowly with the mass
   if (strictBounds_ && rMax > r->getMax()) rMax = r->getMax();
   double clsMax = 1, clsMin = 0;
+  std::vector<std::pair<double,double> > curve; // (r, log(CLs)) of the points computed so far, for adaptiveCLs
   for (int tries = 0; tries < 5; ++tries) {
     double cls = getCLs(*r, rMax);
     if (cls == -999) { std::cerr << "Minimization failed in an unrecoverable way" << std::endl; break; }
+    if (cls > 0) curve.push_back(std::make_pair(rMax, std::log(cls)));
     if (cls < clsTarget) { clsMin = cls; break; }
     if (strictBounds_ && rMax == r->getMax()) {
         std::cout << "CLs at upper bound " << r->GetName() << " = " << r->getVal() << " is " << cls << ". Stopping search and using that as a limit.\n" << std::endl; 
@@ -217,6 +330,38 @@ bool Asymptotic::runLimit(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats
     }
     rMax *= 2;
   }
+
+  if (adaptiveCLs_) {
+    // the surrogate is used once there are two points; it has converged when adding the point at the last prediction
+    // moves the prediction by less than the accuracy, and that difference is taken as the uncertainty on the limit
+    double lastPrediction = -1;
+    for (int iter = 0; iter < 100; ++iter) {
+        double rNext;
+        if (curve.size() >= 2) {
+            std::sort(curve.begin(), curve.end());
+            rNext = MonotoneSpline(curve).inverse(std::log(clsTarget), rMin, rMax);
+            // stay strictly inside the bracket, so that it keeps shrinking
+            double margin = 1e-3*(rMax - rMin);
+            rNext = std::min(std::max(rNext, rMin + margin), rMax - margin);
+        } else if (clsMax < 3*clsTarget && clsMin > 0.3*clsTarget) {
+            rNext = rMin + (rMax-rMin)*log(clsMax/clsTarget)/log(clsMax/clsMin);
+        } else {
+            rNext = 0.5*(rMin + rMax);
+        }
+        double tolerance = std::max(rRelAccuracy_ * rNext, rAbsAccuracy_);
+        limit = rNext;
+        if (lastPrediction >= 0 && std::abs(rNext - lastPrediction) < tolerance) { limitErr = std::abs(rNext - lastPrediction); break; }
+        limitErr = 0.5*(rMax - rMin);
+        if (limitErr < tolerance) break;
+        double cls = getCLs(*r, rNext);
+        if (cls == -999) { std::cerr << "Minimization failed in an unrecoverable way" << std::endl; break; }
+        if (cls > clsTarget) { clsMax = cls; rMin = rNext; } else { clsMin = cls; rMax = rNext; }
+        if (cls > 0) curve.push_back(std::make_pair(rNext, std::log(cls)));
+        lastPrediction = rNext;
+    }
+    if (verbose > 0) std::cout << "Adaptive search of the limit used " << curve.size() << " values of CLs." << std::endl;
+    return true;
+  }
   
   do {
     if (clsMax < 3*clsTarget && clsMin > 0.3*clsTarget) {
@@ -245,7 +390,7 @@ bool Asymptotic::runLimit(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats
   return true;
 }
 
-double Asymptotic::getCLs(RooRealVar &r, double rVal, bool getAlsoExpected, double *limit, double *limitErr) {
+double Asymptotic::getCLs(RooRealVar &r, double rVal, bool getAlsoExpected, double *limit, double *limitErr, std::vector<double> *expectedCLs) {
   if (strictBounds_ && rVal > r.getMax()) throw std::runtime_error("Overflow in getCLs");
   if (!strictBounds_) r.setMax(1.1 * rVal);
   r.setConstant(true);
@@ -271,9 +416,9 @@ double Asymptotic::getCLs(RooRealVar &r, double rVal, bool getAlsoExpected, doub
   double qmu = 2*(nllD_->getVal() - minNllD_); if (qmu < 0) qmu = 0;
   // qmu is zero when mu < mu^ (CMS NOTE-2011/005)
   // --> prevents us excluding from below
-  if (what_ == "singlePoint" && rVal < rBestD_) {
+  if ((what_ == "singlePoint" || what_ == "grid") && rVal < rBestD_) {
     if (verbose > 0) {
-      std::cout << "Value being tested (" << r.GetName() << " = " << rValue_
+      std::cout << "Value being tested (" << r.GetName() << " = " << rVal
                 << ") is lower than the best fit (" << r.GetName() << " = "
                 << rBestD_ << "). Setting q_mu to zero.\n";
     }
@@ -317,14 +462,76 @@ double Asymptotic::getCLs(RooRealVar &r, double rVal, bool getAlsoExpected, doub
         double N = ROOT::Math::normal_quantile(quantiles[iq], 1.0);
         double clb = quantiles[iq];
         double clsplusb = ROOT::Math::normal_cdf_c( sqrt(qA) - N, 1.);
-        *limit = (clb != 0 ? clsplusb/clb : 0); *limitErr = 0;
-        Combine::commitPoint(true, quantiles[iq]);
+        if (expectedCLs) {
+            expectedCLs->push_back(clb != 0 ? clsplusb/clb : 0);
+        } else {
+            *limit = (clb != 0 ? clsplusb/clb : 0); *limitErr = 0;
+            Combine::commitPoint(true, quantiles[iq]);
+        }
         if (verbose > 0) printf("Expected %4.1f%%: CLsb = %.5f  CLb = %.5f   CLs = %.5f\n", quantiles[iq]*100, clsplusb, clb, clsplusb/clb);
     }
   }
   return CLs; 
 }   
 
+void Asymptotic::runGrid(RooRealVar &r, double &limit, double &limitErr) {
+    std::vector<double> rVals;
+    std::vector<std::string> items;
+    boost::split(items, gridPoints_, boost::is_any_of(","));
+    if (items.size() == 1 && std::count(gridPoints_.begin(), gridPoints_.end(), ':') == 2) {
+        double rMin, rMax; int npoints;
+        if (sscanf(gridPoints_.c_str(), "%lf:%lf:%d", &rMin, &rMax, &npoints) != 3 || npoints < 1) throw std::invalid_argument("Asymptotic: bad --gridPoints "+gridPoints_);
+        for (int i = 0; i < npoints; ++i) rVals.push_back(npoints > 1 ? rMin + i*(rMax-rMin)/(npoints-1) : rMin);
+    } else {
+        for (const std::string &item : items) {
+            if (!item.empty()) rVals.push_back(atof(item.c_str()));
+        }
+    }
+    std::sort(rVals.begin(), rVals.end());
+    if (rVals.empty()) throw std::invalid_argument("Asymptotic: no values of r in --gridPoints "+gridPoints_);
+
+    // each process goes through a contiguous range of increasing r, so that the conditional fits of the data and of the
+    // asimov dataset at each value start from those at the previous one (fitFixD_, fitFixA_)
+    unsigned int npoints = rVals.size(), nforks = std::max(1u, std::min(gridForks_, npoints));
+    std::vector<std::vector<double> > results;
+    FitterAlgoBase::runInForks(nforks, [&](unsigned int k) -> std::vector<double> {
+        // per point: the value of r, the expected CLs of the 5 quantiles and the observed CLs
+        std::vector<double> ret;
+        fitFixD_.clear(); fitFixA_.clear(); // the first point starts from the global fits
+        for (unsigned int i = (k*npoints)/nforks, end = ((k+1)*npoints)/nforks; i < end; ++i) {
+            std::vector<double> expected;
+            double cls = getCLs(r, rVals[i], true, 0, 0, &expected);
+            if (cls == -999) { std::cerr << "Minimization failed at " << r.GetName() << " = " << rVals[i] << ", the point is skipped" << std::endl; continue; }
+            ret.push_back(rVals[i]);
+            ret.insert(ret.end(), expected.begin(), expected.end());
+            ret.push_back(cls);
+        }
+        return ret;
+    }, results, true);
+
+    // committed in the order expected by calculateLimitFromGrid: the 5 expected quantiles then the observed, for each r
+    const double quantiles[5] = { 0.025, 0.16, 0.50, 0.84, 0.975 };
+    if (!rBranch_) { Combine::addBranch("r",&rValue_,"r/D"); rBranch_ = true; }
+    double rValueSave = rValue_;
+    unsigned int ndone = 0;
+    for (unsigned int k = 0; k < nforks; ++k) {
+        if (results[k].empty()) std::cerr << "Asymptotic: no points from the process computing points " << (k*npoints)/nforks << " to " << ((k+1)*npoints)/nforks-1 << " of the grid" << std::endl;
+        for (unsigned int j = 0, n = results[k].size(); j + 7 <= n; j += 7, ++ndone) {
+            rValue_ = results[k][j];
+            for (int iq = 0; iq < 5; ++iq) {
+                limit = results[k][j+1+iq]; limitErr = 0;
+                Combine::commitPoint(true, quantiles[iq]);
+            }
+            limit = results[k][j+6]; limitErr = 0;
+            Combine::commitPoint(false, -1);
+            if (verbose > 0) printf("At %s = %f:\tCLs = %7.5f (expected median %7.5f)\n", r.GetName(), rValue_, limit, results[k][j+3]);
+        }
+    }
+    rValue_ = rValueSave;
+    fitFreeD_.writeTo(*params_);
+    limit = ndone; limitErr = 0;
+}
+
 std::vector<std::pair<float,float> > Asymptotic::runLimitExpected(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, double &limit, double &limitErr, const double *hint) {
     // See equation 35-38 of AN 2011/298 and references cited therein
     //
@@ -370,7 +577,8 @@ std::vector<std::pair<float,float> > Asymptotic::runLimitExpected(RooWorkspace *
     r->setError(0.1*r->getMax());
     //r->removeMax();
     
-    std::auto_ptr<RooAbsReal> nll(mc_s->GetPdf()->createNLL(*asimov, RooFit::Constrain(*mc_s->GetNuisanceParameters())));
+    if (!warmStart_ || nllExp_.get() == 0) nllExp_.reset(mc_s->GetPdf()->createNLL(*asimov, RooFit::Constrain(*mc_s->GetNuisanceParameters())));
+    RooAbsReal *nll = nllExp_.get();
     CascadeMinimizer minim(*nll, CascadeMinimizer::Unconstrained, r);
     minim.setStrategy(minimizerStrategy_);
     minim.setErrorLevel(0.5*pow(ROOT::Math::normal_quantile(1-0.5*(1-cl),1.0), 2)); // the 0.5 is because qmu is -2*NLL
@@ -391,6 +599,24 @@ std::vector<std::pair<float,float> > Asymptotic::runLimitExpected(RooWorkspace *
 
     // 3) get ingredients for equation 37
     double nll0 = nll->getVal();
+    const double quantiles[5] = { 0.025, 0.16, 0.50, 0.84, 0.975 };
+    if (approxExpected_) {
+        double relErr = 0;
+        double sigma = approxExpectedSigma(*nll, minim, r, nll0, relErr);
+        if (sigma > 0) {
+            printf("Expected limits from sigma = %g, approximated with an estimated relative error of %.2g (from the change of the median in the last correction)\n", sigma, relErr);
+            for (int iq = 0; iq < 5; ++iq) {
+                double N = ROOT::Math::normal_quantile(quantiles[iq], 1.0);
+                limit = sigma*(ROOT::Math::normal_quantile(1 - (1-cl) * quantiles[iq], 1.0) + N);
+                if (strictBounds_ && limit > r->getMax()) limit = r->getMax();
+                limitErr = relErr * limit;
+                Combine::commitPoint(true, quantiles[iq]);
+                expected.push_back(std::pair<float,float>(quantiles[iq], limit));
+            }
+            return expected;
+        }
+        std::cout << "Could not approximate the expected limits from the asimov fit, searching the crossings instead" << std::endl;
+    }
     double median = findExpectedLimitFromCrossing(*nll, r, r->getMin(), r->getMax(), nll0, 0.5);
     double sigma  = median / ROOT::Math::normal_quantile(1-0.5*(1-cl),1.0);
     double alpha = 1-cl;
@@ -399,10 +625,33 @@ std::vector<std::pair<float,float> > Asymptotic::runLimitExpected(RooWorkspace *
         std::cout << "Sigma  for expected limits: " << sigma  << std::endl; 
     }
 
-    const double quantiles[5] = { 0.025, 0.16, 0.50, 0.84, 0.975 };
+    std::vector<std::vector<double> > forked;
+    if (forkQuantiles_ && newExpected_) {
+        // the four crossings are independent, if each is bracketed starting from the median (or rMin) 
+        // instead of from the quantile before it, so they can all be found at the same time.
+        // With --forkQuantiles and both limits this runs alongside the process of the observed limit, which is fine as
+        // runInForks waits only for the processes it started
+        const int which[4] = { 0, 1, 3, 4 };
+        const double rMax[4] = { median, median, median+2*sigma, median+4*sigma };
+        std::vector<std::vector<double> > results;
+        std::string minosAlgoBackup = minosAlgo_;
+        if (minosAlgo_ == "stepping") minosAlgo_ = "bisection";
+        FitterAlgoBase::runInForks(4, [&](unsigned int i) -> std::vector<double> {
+            double rLo = (which[i] < 2 ? r->getMin() : median);
+            return std::vector<double>(1, findExpectedLimitFromCrossing(*nll, r, rLo, rMax[i], nll0, quantiles[which[i]]));
+        }, results, true);
+        minosAlgo_ = minosAlgoBackup;
+        forked.resize(5);
+        for (int i = 0; i < 4; ++i) {
+            forked[which[i]] = results[i].empty() ? std::vector<double>(1, std::numeric_limits<double>::quiet_NaN()) : results[i];
+        }
+    }
     for (int iq = 0; iq < 5; ++iq) {
         double N = ROOT::Math::normal_quantile(quantiles[iq], 1.0);
-        if (newExpected_ && iq != 2) { // the median is exactly the same in the two methods
+        if (!forked.empty() && iq != 2) {
+            limit = forked[iq][0];
+            if (std::isnan(limit)) { expected.clear(); break; } 
+        } else if (newExpected_ && iq != 2) { // the median is exactly the same in the two methods
             std::string minosAlgoBackup = minosAlgo_;
             if (minosAlgo_ == "stepping") minosAlgo_ = "bisection";
             switch (iq) {
@@ -425,6 +674,52 @@ std::vector<std::pair<float,float> > Asymptotic::runLimitExpected(RooWorkspace *
 
 }
 
+double Asymptotic::approxExpectedSigma(RooAbsReal &nll, CascadeMinimizer &minim, RooRealVar *r, double nll0, double &relErr) {
+    // sigma^2 = mu^2 / q_mu(Asimov) (eq. 35) is the same at all mu only for a gaussian likelihood: start from the 
+    // Hessian at the minimum, then take it from q_mu at the median predicted so far, where it matters most
+    double zMedian = ROOT::Math::normal_quantile(1-0.5*(1-cl),1.0);
+    utils::CheapValueSnapshot bestFit(*params_);
+    double rMin0 = r->getMin();
+    {
+        CloseCoutSentry sentry(verbose < 3);
+        // the asimov minimum is at r = 0, on the bound of r with qtilde, where the error from the Hessian would be wrong
+        if (r->getVal() - rMin0 < 1e-3*r->getMax()) r->setMin(r->getVal() - r->getMax());
+        minim.setErrorLevel(0.5);
+        minim.minimizer().hesse();
+        minim.setErrorLevel(0.5*zMedian*zMedian);
+        r->setMin(rMin0);
+    }
+    double sigma = r->getError();
+    if (verbose > 0) printf("Sigma for expected limits from the Hessian of the asimov fit: %g\n", sigma);
+    if (!(sigma > 0) || !std::isfinite(sigma)) return -1;
+    double median = sigma * zMedian, prevMedian = median;
+    CascadeMinimizer minim2(nll, CascadeMinimizer::Constrained);
+    minim2.setStrategy(minimizerStrategy_);
+    for (int i = 0; i < 2; ++i) {
+        double rEval = median;
+        if (rEval >= r->getMax()) {
+            if (strictBounds_) rEval = r->getMax();
+            else r->setMax(1.1*rEval);
+        }
+        r->setVal(rEval); r->setConstant(true);
+        bool ok = true;
+        {
+            CloseCoutSentry sentry(verbose < 3);
+            if (hasDiscreteParams_) ok = minim2.minimize(verbose-2);
+            else ok = minim2.improve(verbose-2);
+        }
+        double qmu = 2*(nll.getVal() - nll0);
+        if (verbose > 1) printf("At %s = %f:\tq_mu(asimov) = %.5f\n", r->GetName(), rEval, qmu);
+        if ((!ok && picky_) || !(qmu > 0)) { sigma = -1; break; }
+        sigma = rEval / sqrt(qmu);
+        prevMedian = median; median = sigma * zMedian;
+    }
+    relErr = (sigma > 0 ? fabs(median - prevMedian)/median : 0);
+    r->setConstant(false);
+    bestFit.writeTo(*params_);
+    return sigma;
+}
+
 float Asymptotic::findExpectedLimitFromCrossing(RooAbsReal &nll, RooRealVar *r, double rMin, double rMax, double nll0, double clb) {
     // EQ 37 of CMS NOTE 2011-005:
     //   mu_N = sigma * ( normal_quantile_c( (1-cl) * normal_cdf(N) ) + N )
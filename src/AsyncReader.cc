@@ -0,0 +1,192 @@
+#include "HiggsAnalysis/CombinedLimit/interface/AsyncReader.h"
+#include "HiggsAnalysis/CombinedLimit/interface/ThreadPool.h"
+#include <algorithm>
+#include <iostream>
+#include <TObject.h>
+#include <TDirectory.h>
+#include <TFile.h>
+#include <TKey.h>
+#include <TClass.h>
+#include <TBufferFile.h>
+#include <RZip.h>
+#include <TROOT.h>
+#include <RVersion.h>
+#if ROOT_VERSION_CODE < ROOT_VERSION(6,4,0)
+#include <TThread.h>
+#endif
+
+namespace {
+    /// R__unzip takes the output as char * or unsigned char *, depending on the ROOT version
+    template<typename T>
+    void unzip(void (*f)(Int_t *, UChar_t *, Int_t *, T *, Int_t *), Int_t *nin, UChar_t *in, Int_t *nbuf, char *out, Int_t *nout) {
+        f(nin, in, nbuf, reinterpret_cast<T *>(out), nout);
+    }
+
+    /// decompress the record of a key (keylen bytes of header, then the compressed object) in place, as in TKey::ReadObj.
+    /// The compressed blocks are independent, so with a pool they're decompressed in parallel, each into its place.
+    bool unzipRecord(std::vector<char> &image, Int_t keylen, Int_t objlen, ThreadPool *pool) {
+        Int_t nbytes = image.size();
+        if (objlen <= nbytes - keylen) return true; // not compressed
+        // where each block starts in the record and in the object
+        std::vector<Int_t> inBegin, outBegin, inSize, outSize;
+        Int_t in = keylen, out = keylen, nin, nbuf;
+        while (in < nbytes && out < keylen + objlen) {
+            if (nbytes - in < 9 || R__unzip_header(&nin, reinterpret_cast<UChar_t *>(&image[in]), &nbuf) != 0) return false;
+            if (nin <= 0 || nbuf <= 0 || in + nin > nbytes) return false;
+            inBegin.push_back(in); inSize.push_back(nin); outBegin.push_back(out); outSize.push_back(nbuf);
+            in += nin; out += nbuf;
+        }
+        if (out != keylen + objlen) return false;
+        std::vector<char> unzipped(keylen + objlen);
+        std::copy(image.begin(), image.begin() + keylen, unzipped.begin());
+        std::vector<char> good(inBegin.size(), 0);
+        auto block = [&](unsigned int i) {
+            Int_t nin = inSize[i], nbuf = outSize[i], nout = 0;
+            unzip(&R__unzip, &nin, reinterpret_cast<UChar_t *>(&image[inBegin[i]]), &nbuf, &unzipped[outBegin[i]], &nout);
+            good[i] = (nout == outSize[i]);
+        };
+        if (pool) pool->parallelFor(inBegin.size(), block);
+        else for (unsigned int i = 0, n = inBegin.size(); i < n; ++i) block(i);
+        if (std::find(good.begin(), good.end(), 0) != good.end()) return false;
+        image.swap(unzipped);
+        return true;
+    }
+}
+
+AsyncReader::AsyncReader(TDirectory *dir, const std::vector<std::string> &names, unsigned int maxAhead) :
+    dir_(dir), maxAhead_(std::max(1u, maxAhead)), ready_(0), next_(0), reading_(-1), stop_(false)
+{
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,4,0)
+    ROOT::EnableThreadSafety();
+#else
+    TThread::Initialize();
+#endif
+    // the keys are looked up here, so that the thread only reads from the file
+    items_.resize(names.size());
+    for (unsigned int i = 0, n = names.size(); i < n; ++i) {
+        items_[i].key = dir->GetKey(names[i].c_str());
+        items_[i].done = items_[i].taken = false;
+        index_[names[i]] = i;
+    }
+    thread_ = std::thread(&AsyncReader::loop_, this);
+}
+
+AsyncReader::~AsyncReader()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    hasRoom_.notify_all();
+    thread_.join();
+}
+
+TObject * AsyncReader::get(const std::string &name)
+{
+    std::map<std::string, unsigned int>::const_iterator it = index_.find(name);
+    if (it == index_.end()) {
+        std::lock_guard<std::mutex> lock(fileMutex_);
+        return dir_->Get(name.c_str());
+    }
+    unsigned int i = it->second;
+    TKey *key = items_[i].key;
+    std::vector<char> image;
+    bool prefetched = false;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (unsigned int j = 0; j < i; ++j) drop_(items_[j]);
+        if (reading_ == int(i)) hasItem_.wait(lock, [this, i]{ return items_[i].done; });
+        Item &item = items_[i];
+        if (!item.taken) {
+            prefetched = item.done;
+            if (item.done) --ready_;
+            item.taken = true;
+            image.swap(item.image);
+        }
+    }
+    hasRoom_.notify_all();
+    if (key == 0) return 0;
+    TClass *cl = TClass::GetClass(key->GetClassName());
+    if (!prefetched || image.empty() || cl == 0 || !cl->InheritsFrom(TObject::Class())) {
+        // not read yet (or taken twice, or failed to read in the background): read it here as usual
+        std::lock_guard<std::mutex> lock(fileMutex_);
+        return key->ReadObj();
+    }
+    TBufferFile buff(TBuffer::kRead, image.size(), &image[0], kFALSE);
+    buff.SetParent(dir_->GetFile());
+    buff.SetBufferOffset(key->GetKeylen());
+    TObject *obj = static_cast<TObject *>(cl->New());
+    if (obj) obj->Streamer(buff);
+    return obj;
+}
+
+void AsyncReader::drop_(Item &item)
+{
+    if (item.taken) return;
+    item.taken = true;
+    if (item.done) { --ready_; std::vector<char>().swap(item.image); }
+}
+
+bool AsyncReader::read_(const TKey &key, std::vector<char> &image)
+{
+    Int_t nbytes = key.GetNbytes();
+    image.resize(nbytes);
+    {
+        std::lock_guard<std::mutex> lock(fileMutex_);
+        if (key.GetFile()->ReadBuffer(&image[0], key.GetSeekKey(), nbytes)) return false;
+    }
+    return unzipRecord(image, key.GetKeylen(), key.GetObjlen(), 0);
+}
+
+TObject * AsyncReader::readWithThreads(TDirectory *dir, const std::string &name, unsigned int nThreads)
+{
+    TKey *key = dir->GetKey(name.c_str());
+    TClass *cl = key ? TClass::GetClass(key->GetClassName()) : 0;
+    if (nThreads <= 1 || cl == 0 || !cl->InheritsFrom(TObject::Class()) || cl->InheritsFrom(TDirectory::Class())) return dir->Get(name.c_str());
+    std::vector<char> image(key->GetNbytes());
+    if (key->GetFile()->ReadBuffer(&image[0], key->GetSeekKey(), image.size()) ||
+        !unzipRecord(image, key->GetKeylen(), key->GetObjlen(), &ThreadPool::global(nThreads))) {
+        return key->ReadObj();
+    }
+    // streamed as in TKey::ReadObj
+    TBufferFile buff(TBuffer::kRead, image.size(), &image[0], kFALSE);
+    buff.SetParent(dir->GetFile());
+    buff.SetBufferOffset(key->GetKeylen());
+    TObject *obj = static_cast<TObject *>(cl->New());
+    if (obj == 0) return 0;
+    buff.MapObject(obj, cl);
+    obj->Streamer(buff);
+    return obj;
+}
+
+void AsyncReader::loop_()
+{
+    for (;;) {
+        unsigned int i;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            hasRoom_.wait(lock, [this]{ return stop_ || ready_ < maxAhead_; });
+            while (next_ < items_.size() && items_[next_].taken) ++next_;
+            if (stop_ || next_ == items_.size()) return;
+            i = next_++;
+            reading_ = i;
+        }
+        TKey *key = items_[i].key;
+        std::vector<char> image;
+        if (key && !read_(*key, image)) {
+            std::cerr << "AsyncReader: failed to read " << key->GetName() << " from " << dir_->GetPath() << ", it will be read again when needed" << std::endl;
+            image.clear();
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            Item &item = items_[i];
+            if (!item.taken) {
+                item.image.swap(image);
+                ++ready_;
+            }
+            item.done = true;
+            reading_ = -1;
+        }
+        hasItem_.notify_all();
+    }
+}
@@ -0,0 +1,91 @@
+#include "HiggsAnalysis/CombinedLimit/interface/AsyncWriter.h"
+#include <algorithm>
+#include <iostream>
+#include <TObject.h>
+#include <TDirectory.h>
+#include <TROOT.h>
+#include <RVersion.h>
+#if ROOT_VERSION_CODE < ROOT_VERSION(6,4,0)
+#include <TThread.h>
+#endif
+
+AsyncWriter::AsyncWriter(unsigned int maxQueued, std::mutex &fileMutex) :
+    maxQueued_(std::max(1u, maxQueued)), fileMutex_(fileMutex), busy_(false), stop_(false)
+{
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,4,0)
+    ROOT::EnableThreadSafety();
+#else
+    TThread::Initialize();
+#endif
+    thread_ = std::thread(&AsyncWriter::loop_, this);
+}
+
+AsyncWriter::~AsyncWriter()
+{
+    flush();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    hasWork_.notify_all();
+    thread_.join();
+}
+
+void AsyncWriter::write(TDirectory *dir, TObject *obj, const std::string &name)
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        hasRoom_.wait(lock, [this]{ return queue_.size() < maxQueued_; });
+        Item item = { dir, obj, name };
+        queue_.push_back(item);
+    }
+    hasWork_.notify_one();
+    deleteWritten_();
+}
+
+void AsyncWriter::flush()
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_.wait(lock, [this]{ return queue_.empty() && !busy_; });
+    }
+    deleteWritten_();
+}
+
+void AsyncWriter::deleteWritten_()
+{
+    std::vector<TObject *> done;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        done.swap(written_);
+    }
+    for (std::vector<TObject *>::iterator it = done.begin(), ed = done.end(); it != ed; ++it) delete *it;
+}
+
+void AsyncWriter::loop_()
+{
+    for (;;) {
+        Item item;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            hasWork_.wait(lock, [this]{ return stop_ || !queue_.empty(); });
+            if (queue_.empty()) return;
+            item = queue_.front(); 
+            queue_.pop_front();
+            busy_ = true;
+        }
+        hasRoom_.notify_one();
+        {
+            std::lock_guard<std::mutex> lock(fileMutex_);
+            if (item.dir->WriteTObject(item.obj, item.name.c_str()) <= 0) {
+                std::cerr << "AsyncWriter: failed to write " << item.name << " in " << item.dir->GetPath() << std::endl;
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            written_.push_back(item.obj);
+            busy_ = false;
+        }
+        idle_.notify_all();
+    }
+}
@@ -1,5 +1,8 @@
 #include <stdexcept>
 #include <cmath>
+#include <cstdio>
+#include <limits>
+#include <algorithm>
 #include "HiggsAnalysis/CombinedLimit/interface/BayesianToyMC.h"
 #include "RooRealVar.h"
 #include "RooArgSet.h"
@@ -7,23 +10,48 @@
 #include "RooProdPdf.h"
 #include "RooWorkspace.h"
 #include "RooDataSet.h"
+#include "RooGaussian.h"
+#include "RooRandom.h"
+#include "RooFIter.h"
+#include "TString.h"
 #include "RooStats/BayesianCalculator.h"
 #include "RooStats/SimpleInterval.h"
 #include "RooStats/ModelConfig.h"
 #include "RooStats/RooStatsUtils.h"
 #include <Math/DistFuncMathCore.h>
+#include <Math/QuantFuncMathCore.h>
 
 #include "HiggsAnalysis/CombinedLimit/interface/Combine.h"
 #include "HiggsAnalysis/CombinedLimit/interface/CachingNLL.h"
 #include "HiggsAnalysis/CombinedLimit/interface/utils.h"
+#include "HiggsAnalysis/CombinedLimit/interface/Accumulators.h"
+#include "HiggsAnalysis/CombinedLimit/interface/SimpleGaussianConstraint.h"
+#include "HiggsAnalysis/CombinedLimit/interface/SobolSequence.h"
 
 using namespace RooStats;
 
+namespace {
+    /// a nuisance with a gaussian (truncated to its range) or flat prior, that can be sampled from a uniform number
+    struct QuasiRandomNuisance {
+        RooRealVar *var; 
+        const RooAbsReal *center, *sigma; // null for a flat prior
+        void set(double u) const {
+            double min = var->getMin(), max = var->getMax();
+            if (center == 0) { var->setVal(min + u*(max-min)); return; }
+            double c = center->getVal(), s = sigma->getVal();
+            double pmin = ROOT::Math::normal_cdf((min-c)/s), pmax = ROOT::Math::normal_cdf((max-c)/s);
+            var->setVal(c + s * ROOT::Math::normal_quantile(pmin + u*(pmax-pmin), 1.0));
+        }
+    };
+}
+
 int BayesianToyMC::numIters_ = 1000;
 std::string BayesianToyMC::integrationType_ = "toymc";
 unsigned int BayesianToyMC::tries_ = 1;
 float BayesianToyMC::hintSafetyFactor_ = 5.;
 std::vector<std::string> BayesianToyMC::twoPoints_;
+unsigned int BayesianToyMC::sampleForks_ = 0;
+bool BayesianToyMC::quasiRandom_ = false;
 
 BayesianToyMC::BayesianToyMC() :
     LimitAlgo("BayesianToyMC specific options")
@@ -36,7 +64,9 @@ BayesianToyMC::BayesianToyMC() :
                 boost::program_options::value<float>(&hintSafetyFactor_)->default_value(hintSafetyFactor_),
                 "set range of integration equal to this number of times the hinted limit")
         ("twoPoints",
-                boost::program_options::value<std::vector<std::string> >(&twoPoints_)->multitoken(), "Compute BF comparing two points in parameter space");
+                boost::program_options::value<std::vector<std::string> >(&twoPoints_)->multitoken(), "Compute BF comparing two points in parameter space")
+        ("sampleForks", boost::program_options::value<unsigned int>(&sampleForks_)->default_value(sampleForks_), "With --significance, split the evaluation of the likelihood at the sampled points among up to N forked processes")
+        ("quasiRandom", "With --significance, sample the nuisances with gaussian or uniform priors with a randomized Sobol sequence instead of pseudo-random numbers (faster convergence)");
         ;
 }
 
@@ -49,6 +79,7 @@ void BayesianToyMC::applyOptions(const boost::program_options::variables_map &vm
     }
     if (!twoPoints_.empty() && twoPoints_.size() != 2) throw std::logic_error("twoPoints option requires exactly two points\n");
     if (!twoPoints_.empty() && !doSignificance_) throw std::logic_error("twoPoints option works with --significance\n"); 
+    quasiRandom_ = vm.count("quasiRandom");
 }
 bool BayesianToyMC::run(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, double &limit, double &limitErr, const double *hint) {
   if (doSignificance_) return runBayesFactor(w,mc_s,mc_b,data,limit,limitErr,hint);
@@ -148,8 +179,8 @@ std::pair<double,double> BayesianToyMC::priorPredictiveDistribution(RooStats::Mo
   // factorize away nuisance pdf
   RooAbsPdf *pdf = mc->GetPdf();
   std::auto_ptr<RooAbsPdf>  nuisancePdf, nonNuisancePdf; 
+  RooArgList constraints;
   if (withSystematics) {
-    RooArgList constraints;
     nonNuisancePdf.reset(utils::factorizePdf(*data.get(), *pdf, constraints));
     if (constraints.getSize() > 0) {
         nuisancePdf.reset(new RooProdPdf("nuis","",constraints));
@@ -178,8 +209,33 @@ std::pair<double,double> BayesianToyMC::priorPredictiveDistribution(RooStats::Mo
   // Set the point we're running at
   if (point != 0) params->assignValueOnly(*point);
 
+  // nuisances whose prior is a single gaussian or flat term, to be sampled from the quasi-random sequence
+  std::vector<QuasiRandomNuisance> qrNuisances;
+  if (quasiRandom_ && withSystematics) {
+      const RooArgSet &nuis = *mc->GetNuisanceParameters();
+      RooFIter iter = constraints.fwdIterator();
+      for (RooAbsArg *a = iter.next(); a != 0; a = iter.next()) {
+          QuasiRandomNuisance qn = { 0, 0, 0 };
+          if (typeid(*a) == typeid(RooGaussian) || typeid(*a) == typeid(SimpleGaussianConstraint)) {
+              SimpleGaussianConstraint g(static_cast<const RooGaussian &>(*a));
+              const RooAbsReal *x = &g.getX(), *mean = &g.getMean();
+              if (nuis.find(mean->GetName())) std::swap(x, mean); // the constraint could be written as G(global observable; nuisance, sigma)
+              if (!nuis.find(x->GetName()) || mean->dependsOn(nuis) || g.getSigma().dependsOn(nuis)) continue;
+              qn.var = dynamic_cast<RooRealVar *>(params->find(x->GetName()));
+              qn.center = mean; qn.sigma = &g.getSigma();
+          } else if (typeid(*a) == typeid(RooUniform)) {
+              std::auto_ptr<RooArgSet> vars(a->getVariables());
+              if (vars->getSize() != 1 || !nuis.find(vars->first()->GetName())) continue;
+              qn.var = dynamic_cast<RooRealVar *>(params->find(vars->first()->GetName()));
+          }
+          if (qn.var) qrNuisances.push_back(qn);
+      }
+      if (verbose) std::cout << "Sampling " << qrNuisances.size() << " of the " << nuis.getSize() << " nuisances with a quasi-random sequence" << std::endl;
+  }
+  unsigned int nqr = qrNuisances.size();
+
   // start running
-  std::vector<double> results; double sum = 0;
+  std::vector<double> results;
   for (unsigned int t = 0; t < tries_; ++t) {
       std::auto_ptr<RooDataSet> nuisanceValues, poiValues;
       if (withSystematics) nuisanceValues.reset(nuisancePdf->generate(*mc->GetNuisanceParameters(), numIters_));
@@ -187,30 +243,70 @@ std::pair<double,double> BayesianToyMC::priorPredictiveDistribution(RooStats::Mo
         if (mc->GetPriorPdf() == 0) throw std::logic_error(std::string("Missing prior in model: ")+ mc->GetName());
         poiValues.reset(mc->GetPriorPdf()->generate(poiToGen, numIters_));
       }
+      std::vector<double> qr(nqr * numIters_);
+      if (nqr) {
+        SobolSequence sobol(nqr, RooRandom::integer(std::numeric_limits<UInt_t>::max() - 1));
+        for (int i = 0; i < numIters_; ++i) sobol.next(&qr[i*nqr]);
+      }
+      // the other parameters are randomized here, in the order of the points, so that the points don't depend on how
+      // they are split among the forked processes
+      std::vector<double> otherValues;
+      RooArgList otherReals;
+      RooFIter iterOther = otherParams.fwdIterator();
+      for (RooAbsArg *a = iterOther.next(); a != 0; a = iterOther.next()) if (dynamic_cast<RooRealVar *>(a)) otherReals.add(*a);
+      if (otherReals.getSize()) {
+        otherValues.reserve(numIters_ * otherReals.getSize());
+        for (int i = 0; i < numIters_; ++i) {
+          RooStats::RandomizeCollection(otherParams);
+          for (int j = 0, nj = otherReals.getSize(); j < nj; ++j) otherValues.push_back(((RooRealVar &)otherReals[j]).getVal());
+        }
+      }
+      // evaluate the NLL at the points from first to last-1
+      std::vector<double> nlls(numIters_);
+      auto evalPoints = [&](int first, int last) {
+        for (int i = first; i < last; ++i) {
+          if (nuisanceValues.get() != 0) *params = *nuisanceValues->get(i);
+          for (unsigned int k = 0; k < nqr; ++k) qrNuisances[k].set(qr[i*nqr+k]);
+          if (poiValues.get() != 0) *params = *poiValues->get(i);
+          for (int j = 0, nj = otherReals.getSize(); j < nj; ++j) ((RooRealVar &)otherReals[j]).setVal(otherValues[i*nj+j]);
+          if (verbose > 2) { std::cout << "\n\n==== POINT "<< t << ","<<i<<" ====" << std::endl; params->Print("V"); }
+          nlls[i] = nll->getVal();
+        }
+      };
+      unsigned int nforks = std::min<unsigned int>(sampleForks_, numIters_);
+      if (nforks > 1) {
+        // each process takes a contiguous block of points; this process the first one
+        std::vector<std::vector<double> > blocks;
+        unsigned int nfailed = utils::runInForks(0, nforks, [&](unsigned int k) -> std::vector<double> {
+            int first = k*numIters_/nforks, last = (k+1)*numIters_/nforks;
+            evalPoints(first, last);
+            return std::vector<double>(nlls.begin()+first, nlls.begin()+last);
+        }, blocks, true, verbose > 2);
+        if (nfailed) throw std::runtime_error("BayesianToyMC: a forked process failed");
+        for (unsigned int k = 1; k < nforks; ++k) std::copy(blocks[k].begin(), blocks[k].end(), nlls.begin() + k*numIters_/nforks);
+      } else {
+        evalPoints(0, numIters_);
+      }
       for (int i = 0; i < numIters_; ++i) {
-        if (nuisanceValues.get() != 0) *params = *nuisanceValues->get(i);
-        if (poiValues.get() != 0) *params = *poiValues->get(i);
-        if (otherParams.getSize()) RooStats::RandomizeCollection(otherParams);
-        if (verbose > 2) { std::cout << "\n\n==== POINT "<< t << ","<<i<<" ====" << std::endl; params->Print("V"); }
-        double nllVal = nll->getVal();
+        double nllVal = nlls[i];
         if (offset) { 
             if (isnan(*offset)) *offset = nllVal; 
             nllVal -= *offset; 
         }
         if (verbose > 1) std::cout << "nll[" << t << ","<<i<<"] = " << nllVal << ", p = " << std::exp(-nllVal) << std::endl;
         results.push_back(std::exp(-nllVal));
-        sum += results.back();
       }
   }
   double n = results.size();
-  sum /= n; 
-  double sumd = 0, sumd2 = 0;
+  DefaultAccumulator sumacc, sumd, sumd2;
+  for (int i = 0, ni = results.size(); i < ni; ++i) sumacc += results[i];
+  double sum = sumacc.sum() / n; 
   for (int i = 0, ni = results.size(); i < ni; ++i) {
       sumd  += results[i] - sum;
       sumd2 += std::pow(results[i] - sum,2);
   }
-  sum += sumd/numIters_; 
-  double err = std::sqrt((sumd2/numIters_ - std::pow(sumd/numIters_,2))/numIters_);
+  sum += sumd.sum()/numIters_; 
+  double err = std::sqrt((sumd2.sum()/numIters_ - std::pow(sumd.sum()/numIters_,2))/numIters_);
   return std::make_pair(sum,err);
 }
 
@@ -4,6 +4,8 @@
 #include "HiggsAnalysis/CombinedLimit/interface/CloseCoutSentry.h"
 #include "HiggsAnalysis/CombinedLimit/interface/utils.h"
 #include <stdexcept>
+#include <cmath>
+#include <limits>
 #include <RooRealVar.h>
 #include "HiggsAnalysis/CombinedLimit/interface/RooMinimizerOpt.h"
 #include <RooFitResult.h>
@@ -54,13 +56,15 @@ BestFitSigmaTestStat::BestFitSigmaTestStat(
     poi_.add(snap_);
     if (nuisances) { nuisances_.add(*nuisances); snap_.addClone(*nuisances, /*silent=*/true); }
     params_.reset(pdf_->getParameters(observables));
+    std::auto_ptr<RooAbsCollection> fitParams(params_->selectCommon(snap_));
+    fitParams_.add(*fitParams);
 }
 
 
 Double_t BestFitSigmaTestStat::Evaluate(RooAbsData& data, RooArgSet& /*nullPOI*/)
 {
     // Take snapshot of initial state, to restore it at the end 
-    RooArgSet initialState; params_->snapshot(initialState);
+    utils::FastSnapshot initialState(*params_);
 
    // Initialize parameters
     *params_ = snap_;
@@ -77,13 +81,19 @@ Double_t BestFitSigmaTestStat::Evaluate(RooAbsData& data, RooArgSet& /*nullPOI*/
     r->setConstant(false);
 
     std::cout << "Doing a fit for with " << r->GetName() << " in range [ " << r->getMin() << " , " << r->getMax() << "]" << std::endl;
+    static bool warmStart = runtimedef::get("BFSTS_WARMSTART");
+    if (warmStart && applyWarmStart_()) std::cout << "Starting from the minimum for the previous toy" << std::endl;
     std::cout << "Starting point is " << r->GetName() << " = " << r->getVal() << std::endl;
-    minNLL(/*constrained=*/false, r);
+    double bestFitNLL = minNLL(/*constrained=*/false, r);
     double bestFitR = r->getVal();
+    if (warmStart) {
+        if (std::isfinite(bestFitNLL)) warmStart_.readFrom(fitParams_);
+        else warmStart_.clear();
+    }
     std::cout << "Fit result was " << r->GetName() << " = " << r->getVal() << std::endl;
 
     //Restore initial state, to avoid issues with ToyMCSampler
-    *params_ = initialState;
+    initialState.writeTo();
 
     if (!canKeepNLL) nll_.reset();
 
@@ -102,10 +112,23 @@ bool BestFitSigmaTestStat::createNLL(RooAbsPdf &pdf, RooAbsData &data)
     }
 }
 
+bool BestFitSigmaTestStat::applyWarmStart_() 
+{
+    if (warmStart_.empty()) return false;
+    double nllDefault = nll_->getVal();
+    utils::CheapValueSnapshot defaults(fitParams_);
+    warmStart_.writeTo(fitParams_);
+    // fallback in case the previous toy was too different from this one
+    if (nll_->getVal() <= nllDefault) return true;
+    defaults.writeTo(fitParams_);
+    return false;
+}
+
 double BestFitSigmaTestStat::minNLL(bool constrained, RooRealVar *r) 
 {
     CascadeMinimizer::Mode mode(constrained ? CascadeMinimizer::Constrained : CascadeMinimizer::Unconstrained);
     CascadeMinimizer minim(*nll_, mode, r);
-    minim.minimize(verbosity_-2);
-    return nll_->getVal();
+    bool ok = minim.minimize(verbosity_-2);
+    // a failed minimization is not a minimum, e.g. for the warm start of the next toy
+    return ok ? nll_->getVal() : std::numeric_limits<double>::quiet_NaN();
 }
@@ -0,0 +1,261 @@
+#include "HiggsAnalysis/CombinedLimit/interface/BinnedOffload.h"
+#include "HiggsAnalysis/CombinedLimit/interface/BinnedOffloadBackend.h"
+#include "HiggsAnalysis/CombinedLimit/interface/VerticalInterpHistPdf.h"
+#include <RooAbsData.h>
+#include <RooRealVar.h>
+#include <RooArgSet.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <dlfcn.h>
+
+struct BinnedOffloadBackendFuncs {
+    std::string name;
+    CombineOffloadCreateFunc create;
+    CombineOffloadSetWeightsFunc setWeights;
+    CombineOffloadEvalFunc eval;
+    CombineOffloadDestroyFunc destroy;
+};
+
+namespace {
+    /// the built-in backend: the same operations as FastVerticalInterpHistPdf2 and CachingAddNLL, on the packed arrays
+    struct CpuChannel {
+        unsigned int nproc, nbins, nentries, nparams;
+        std::vector<double> binWidths, weights, smoothRegion, nominal, morphSum, morphDiff;
+        std::vector<int> smoothAlgo;
+        std::vector<unsigned int> entryBins, morphBegin, morphParam;
+        std::vector<double> templ, expected;
+        /// the value of the parameter of each morph for the last template of its process in templ, and its normalization
+        std::vector<double> morphedVals, morphedNorms;
+        std::vector<char> morphed;
+    };
+
+    void * cpuCreate(const CombineOffloadChannel *c) {
+        CpuChannel *ret = new CpuChannel();
+        ret->nproc = c->nproc; ret->nbins = c->nbins; ret->nentries = c->nentries; ret->nparams = c->nparams;
+        unsigned int nmorphs = c->morphBegin[c->nproc];
+        ret->binWidths.assign(c->binWidths, c->binWidths + c->nbins);
+        ret->weights.assign(c->weights, c->weights + c->nentries);
+        ret->entryBins.assign(c->entryBins, c->entryBins + c->nentries);
+        ret->smoothAlgo.assign(c->smoothAlgo, c->smoothAlgo + c->nproc);
+        ret->smoothRegion.assign(c->smoothRegion, c->smoothRegion + c->nproc);
+        ret->nominal.assign(c->nominal, c->nominal + c->nproc * c->nbins);
+        ret->morphBegin.assign(c->morphBegin, c->morphBegin + c->nproc + 1);
+        ret->morphParam.assign(c->morphParam, c->morphParam + nmorphs);
+        ret->morphSum.assign(c->morphSum, c->morphSum + nmorphs * c->nbins);
+        ret->morphDiff.assign(c->morphDiff, c->morphDiff + nmorphs * c->nbins);
+        ret->templ.resize(c->nproc * c->nbins);
+        ret->expected.resize(c->nentries);
+        ret->morphedVals.resize(nmorphs);
+        ret->morphedNorms.resize(c->nproc);
+        ret->morphed.assign(c->nproc, 0);
+        return ret;
+    }
+
+    void cpuSetWeights(void *handle, const double *weights) {
+        CpuChannel &c = *static_cast<CpuChannel *>(handle);
+        std::copy(weights, weights + c.nentries, c.weights.begin());
+    }
+
+    int cpuEval(void *handle, const double *params, const double *coeffs, double sumCoeff, double *result) {
+        CpuChannel &c = *static_cast<CpuChannel *>(handle);
+        unsigned int nbins = c.nbins, nentries = c.nentries;
+        double *s = &c.expected[0];
+        std::fill(s, s + nentries, 0.);
+        for (unsigned int p = 0; p < c.nproc; ++p) {
+            if (coeffs[p] == 0) continue;
+            double *t = &c.templ[p*nbins];
+            // the template is morphed again only if some of its parameters moved since the last call
+            bool same = c.morphed[p];
+            for (unsigned int k = c.morphBegin[p]; same && k < c.morphBegin[p+1]; ++k) same = (c.morphedVals[k] == params[c.morphParam[k]]);
+            if (!same) {
+                std::copy(&c.nominal[p*nbins], &c.nominal[p*nbins] + nbins, t);
+                double region = c.smoothRegion[p];
+                for (unsigned int k = c.morphBegin[p]; k < c.morphBegin[p+1]; ++k) {
+                    double x = params[c.morphParam[k]], a = 0.5*x, b;
+                    c.morphedVals[k] = x;
+                    if (std::abs(x) >= region) b = (x > 0 ? +1 : -1);
+                    else { double u = x/region, u2 = u*u; b = 0.125 * u * (u2 * (3.*u2 - 10.) + 15); }
+                    const double *diff = &c.morphDiff[k*nbins], *sum = &c.morphSum[k*nbins];
+                    for (unsigned int j = 0; j < nbins; ++j) t[j] += a*(diff[j] + b*sum[j]);
+                }
+                if (c.smoothAlgo[p] < 0) {
+                    for (unsigned int j = 0; j < nbins; ++j) t[j] = std::exp(t[j]);
+                } else {
+                    for (unsigned int j = 0; j < nbins; ++j) t[j] = std::max(t[j], 1e-9);
+                }
+                double norm = 0;
+                for (unsigned int j = 0; j < nbins; ++j) norm += t[j]*c.binWidths[j];
+                c.morphedNorms[p] = norm; c.morphed[p] = 1;
+            }
+            double norm = c.morphedNorms[p];
+            double scale = coeffs[p] * (norm > 0 ? 1.0/norm : 1.0);
+            const unsigned int *bins = &c.entryBins[0];
+            for (unsigned int i = 0; i < nentries; ++i) s[i] += scale * t[bins[i]];
+        }
+        double ret = 0, invSumCoeff = 1.0/sumCoeff;
+        for (unsigned int i = 0; i < nentries; ++i) {
+            if (!std::isnormal(s[i]) || s[i] <= 0) return 1;
+            ret += c.weights[i] * std::log(s[i]*invSumCoeff);
+        }
+        *result = ret;
+        return 0;
+    }
+
+    void cpuDestroy(void *handle) { delete static_cast<CpuChannel *>(handle); }
+}
+
+const BinnedOffloadBackendFuncs *
+cacheutils::BinnedOffload::backend_()
+{
+    static std::mutex lock;
+    static bool loaded = false;
+    static std::auto_ptr<BinnedOffloadBackendFuncs> funcs;
+    std::lock_guard<std::mutex> guard(lock);
+    if (loaded) return funcs.get();
+    loaded = true;
+    const char *lib = getenv("COMBINE_OFFLOAD_BACKEND");
+    funcs.reset(new BinnedOffloadBackendFuncs());
+    if (lib == 0 || lib[0] == 0) {
+        funcs->name = "built-in (CPU)";
+        funcs->create = &cpuCreate; funcs->setWeights = &cpuSetWeights; funcs->eval = &cpuEval; funcs->destroy = &cpuDestroy;
+        return funcs.get();
+    }
+    // the library is never unloaded, as channels may use it until the end of the job
+    void *dl = dlopen(lib, RTLD_NOW | RTLD_LOCAL);
+    if (dl == 0) {
+        fprintf(stderr, "ERROR: can't load the offload backend %s: %s\n", lib, dlerror());
+        funcs.reset();
+        return 0;
+    }
+    funcs->name = lib;
+    funcs->create = (CombineOffloadCreateFunc) dlsym(dl, COMBINE_OFFLOAD_CREATE);
+    funcs->setWeights = (CombineOffloadSetWeightsFunc) dlsym(dl, COMBINE_OFFLOAD_SET_WEIGHTS);
+    funcs->eval = (CombineOffloadEvalFunc) dlsym(dl, COMBINE_OFFLOAD_EVAL);
+    funcs->destroy = (CombineOffloadDestroyFunc) dlsym(dl, COMBINE_OFFLOAD_DESTROY);
+    if (!funcs->create || !funcs->setWeights || !funcs->eval || !funcs->destroy) {
+        fprintf(stderr, "ERROR: the offload backend %s does not export all of %s, %s, %s, %s\n", lib,
+                COMBINE_OFFLOAD_CREATE, COMBINE_OFFLOAD_SET_WEIGHTS, COMBINE_OFFLOAD_EVAL, COMBINE_OFFLOAD_DESTROY);
+        funcs.reset();
+        return 0;
+    }
+    return funcs.get();
+}
+
+const char *
+cacheutils::BinnedOffload::backendName()
+{
+    const BinnedOffloadBackendFuncs *funcs = backend_();
+    return funcs ? funcs->name.c_str() : "none";
+}
+
+bool
+cacheutils::BinnedChannelData::fill(const std::vector<const FastVerticalInterpHistPdf2 *> &pdfs, const RooAbsData &data, bool includeZeroWeights, const std::vector<Double_t> &weights)
+{
+    if (pdfs.empty() || weights.empty()) return false;
+    const RooArgSet *obs = data.get();
+    const RooRealVar *x = dynamic_cast<const RooRealVar *>(obs->first());
+    if (obs->getSize() != 1 || x == 0) return false;
+
+    // all the templates must have the same binning, so that each entry is in the same bin for all of them
+    const FastHisto &binning = pdfs.front()->nominal();
+    nbins = binning.size();
+    const std::vector<double> &edges = binning.binEdges();
+    if (nbins == 0 || edges.size() < nbins + 1) return false;
+    for (const FastVerticalInterpHistPdf2 *pdf : pdfs) {
+        if (pdf->nominal().size() != nbins || !std::equal(edges.begin(), edges.begin() + nbins + 1, pdf->nominal().binEdges().begin())) return false;
+        std::auto_ptr<RooArgSet> pobs(pdf->getObservables(data));
+        if (pobs->getSize() != 1 || pobs->find(x->GetName()) == 0) return false;
+    }
+    binWidths.resize(nbins);
+    for (unsigned int j = 0; j < nbins; ++j) binWidths[j] = edges[j+1] - edges[j];
+    // same selection of the entries as in CachingAddNLL::setData
+    entryBins.clear();
+    for (int i = 0, n = data.numEntries(); i < n; ++i) {
+        data.get(i);
+        if (data.weight() == 0 && !includeZeroWeights) continue;
+        int bin = binning.FindBin(x->getVal());
+        if (bin < 0 || bin >= int(nbins)) return false;
+        entryBins.push_back(bin);
+    }
+    if (entryBins.size() != weights.size()) return false;
+    this->weights = weights;
+
+    smoothAlgo.clear(); smoothRegion.clear(); nominal.clear(); morphSum.clear(); morphDiff.clear();
+    morphBegin.assign(1, 0); morphParam.clear(); params.clear();
+    for (const FastVerticalInterpHistPdf2 *pdf : pdfs) {
+        const FastHisto &nom = pdf->nominalMorphScale();
+        const std::vector<FastVerticalInterpHistPdf2::Morph> &morphs = pdf->morphs();
+        const RooArgList &coefs = pdf->coefList();
+        if (int(morphs.size()) != coefs.getSize()) return false;
+        smoothAlgo.push_back(pdf->smoothAlgo());
+        smoothRegion.push_back(pdf->smoothRegion());
+        for (unsigned int j = 0; j < nbins; ++j) nominal.push_back(nom[j]);
+        for (unsigned int k = 0, nk = morphs.size(); k < nk; ++k) {
+            const RooAbsReal *param = dynamic_cast<const RooAbsReal *>(coefs.at(k));
+            if (param == 0 || morphs[k].sum.size() < nbins || morphs[k].diff.size() < nbins) return false;
+            std::vector<const RooAbsReal *>::const_iterator match = std::find(params.begin(), params.end(), param);
+            morphParam.push_back(match - params.begin());
+            if (match == params.end()) params.push_back(param);
+            for (unsigned int j = 0; j < nbins; ++j) morphSum.push_back(morphs[k].sum[j]);
+            for (unsigned int j = 0; j < nbins; ++j) morphDiff.push_back(morphs[k].diff[j]);
+        }
+        morphBegin.push_back(morphParam.size());
+    }
+    return true;
+}
+
+void
+cacheutils::BinnedChannelData::view(CombineOffloadChannel &channel) const
+{
+    channel.nproc = smoothAlgo.size(); channel.nbins = nbins; channel.nentries = entryBins.size(); channel.nparams = params.size();
+    channel.binWidths = &binWidths[0];
+    channel.entryBins = &entryBins[0];
+    channel.weights = &weights[0];
+    channel.smoothAlgo = &smoothAlgo[0];
+    channel.smoothRegion = &smoothRegion[0];
+    channel.nominal = &nominal[0];
+    channel.morphBegin = &morphBegin[0];
+    channel.morphParam = morphParam.empty() ? 0 : &morphParam[0];
+    channel.morphSum = morphSum.empty() ? 0 : &morphSum[0];
+    channel.morphDiff = morphDiff.empty() ? 0 : &morphDiff[0];
+}
+
+cacheutils::BinnedOffload *
+cacheutils::BinnedOffload::create(const std::vector<const FastVerticalInterpHistPdf2 *> &pdfs, const RooAbsData &data, bool includeZeroWeights, const std::vector<Double_t> &weights)
+{
+    const BinnedOffloadBackendFuncs *funcs = backend_();
+    if (funcs == 0) return 0;
+    BinnedChannelData packed;
+    if (!packed.fill(pdfs, data, includeZeroWeights, weights)) return 0;
+    std::auto_ptr<BinnedOffload> ret(new BinnedOffload(funcs));
+    ret->params_ = packed.params;
+    CombineOffloadChannel channel;
+    packed.view(channel);
+    ret->handle_ = funcs->create(&channel);
+    if (ret->handle_ == 0) return 0;
+    ret->paramVals_.resize(ret->params_.size());
+    return ret.release();
+}
+
+cacheutils::BinnedOffload::~BinnedOffload()
+{
+    if (handle_) funcs_->destroy(handle_);
+}
+
+void
+cacheutils::BinnedOffload::setWeights(const std::vector<Double_t> &weights)
+{
+    funcs_->setWeights(handle_, &weights[0]);
+}
+
+bool
+cacheutils::BinnedOffload::evaluate(const double *coeffs, double sumCoeff, double &nll) const
+{
+    for (unsigned int k = 0, n = params_.size(); k < n; ++k) paramVals_[k] = params_[k]->getVal();
+    return funcs_->eval(handle_, paramVals_.empty() ? 0 : &paramVals_[0], coeffs, sumCoeff, &nll) == 0;
+}
@@ -1,17 +1,20 @@
 #include "HiggsAnalysis/CombinedLimit/interface/CachingMultiPdf.h"
 #include "vectorized.h"
+#include <cmath>
 #include "HiggsAnalysis/CombinedLimit/interface/utils.h"
+#include "HiggsAnalysis/CombinedLimit/interface/ProfilingTools.h"
+#include "HiggsAnalysis/CombinedLimit/interface/VectorizedHistFactoryPdfs.h"
 
 // Uncomment do do regression testing wrt uncached multipdf
 //#define CachingMultiPdf_VALIDATE
 
-cacheutils::CachingMultiPdf::CachingMultiPdf(const RooMultiPdf &pdf, const RooArgSet &obs) :
+cacheutils::CachingMultiPdf::CachingMultiPdf(const RooMultiPdf &pdf, const RooArgSet &obs, bool optimizeComponents) :
     pdf_(&pdf)
 {
     //std::cout << "Making a CachingMultiPdf for " << pdf.GetName() << " with " <<  pdf_->getNumPdfs() << " pdfs." << std::endl;
     for (int i = 0, n = pdf_->getNumPdfs(); i < n; ++i) {
-        cachingPdfs_.push_back(makeCachingPdf(pdf_->getPdf(i), &obs));
-        //cachingPdfs_.push_back(new CachingPdf(pdf_->getPdf(i), &obs));
+        if (optimizeComponents) cachingPdfs_.push_back(makeCachingPdf(pdf_->getPdf(i), &obs));
+        else                    cachingPdfs_.push_back(new CachingPdf(pdf_->getPdf(i), &obs));
         //std::cout << "      MultiPdfAdding " <<  pdf.GetName() << "[" << i << "]: " << pdf_->getPdf(i)->ClassName() << " " << pdf_->getPdf(i)->GetName() << " using " << typeid(cachingPdfs_.back()).name() << std::endl;
     }
 #ifdef CachingMultiPdf_VALIDATE
@@ -69,6 +72,13 @@ void cacheutils::CachingMultiPdf::setIncludeZeroWeights(bool includeZeroWeights)
     }
 }
 
+std::size_t cacheutils::CachingMultiPdf::cacheBytes() const
+{
+    std::size_t ret = 0;
+    for (const CachingPdfBase &pdf : cachingPdfs_) ret += pdf.cacheBytes();
+    return ret;
+}
+
 
 
 cacheutils::CachingAddPdf::CachingAddPdf(const RooAddPdf &pdf, const RooArgSet &obs) :
@@ -131,6 +141,13 @@ void cacheutils::CachingAddPdf::setIncludeZeroWeights(bool includeZeroWeights)
     }
 }
 
+std::size_t cacheutils::CachingAddPdf::cacheBytes() const
+{
+    std::size_t ret = 0;
+    for (const CachingPdfBase &pdf : cachingPdfs_) ret += pdf.cacheBytes();
+    return ret + work_.capacity() * sizeof(Double_t);
+}
+
 cacheutils::CachingProduct::CachingProduct(const RooProduct &pdf, const RooArgSet &obs) :
     pdf_(&pdf)
 {
@@ -139,6 +156,7 @@ cacheutils::CachingProduct::CachingProduct(const RooProduct &pdf, const RooArgSe
     for (int i = 0, n = pdfs.getSize(); i < n; ++i) {
         RooAbsReal *pdfi = (RooAbsReal*) pdfs.at(i);
         cachingPdfs_.push_back(makeCachingPdf(pdfi, &obs));
+        gathered_.push_back(dynamic_cast<CachingParamHistFunc *>(&cachingPdfs_.back()));
     }
 }
 
@@ -148,6 +166,23 @@ cacheutils::CachingProduct::~CachingProduct()
 
 const std::vector<Double_t> & cacheutils::CachingProduct::eval(const RooAbsData &data)
 {
+    static bool gather = runtimedef::get("ADDNLL_PRODUCT_GATHER");
+    if (gather) {
+        // the other factors first, then the ParamHistFunc ones multiplied in straight from their parameters
+        bool started = false;
+        for (int i = 0, n = cachingPdfs_.size(); i < n; ++i) {
+            if (gathered_[i]) continue;
+            const std::vector<Double_t> & vals = cachingPdfs_[i].eval(data);
+            if (!started) { work_.assign(vals.begin(), vals.end()); started = true; }
+            else vectorized::mul_inplace(work_.size(), &vals[0], &work_[0]);
+        }
+        for (int i = 0, n = cachingPdfs_.size(); i < n; ++i) {
+            if (!gathered_[i]) continue;
+            if (!started) { work_.assign(gathered_[i]->size(data), 1.0); started = true; }
+            gathered_[i]->multiply(data, work_);
+        }
+        return work_;
+    }
     const std::vector<Double_t> & one = cachingPdfs_.front().eval(data);
     unsigned int size = one.size();
     work_.resize(size);
@@ -172,3 +207,179 @@ void cacheutils::CachingProduct::setIncludeZeroWeights(bool includeZeroWeights)
     }
 }
 
+std::size_t cacheutils::CachingProduct::cacheBytes() const
+{
+    std::size_t ret = 0;
+    for (const CachingPdfBase &pdf : cachingPdfs_) ret += pdf.cacheBytes();
+    return ret + work_.capacity() * sizeof(Double_t);
+}
+
+
+cacheutils::CachingVerticalInterpPdf::CachingVerticalInterpPdf(const VerticalInterpPdf &pdf, const RooArgSet &obs) :
+    pdf_(&pdf),
+    obs_(&obs)
+{
+    const RooArgList & funcs  = pdf.funcList();
+    const RooArgList & coeffs = pdf.coefList();
+    for (int i = 0, n = funcs.getSize(); i < n; ++i) {
+        RooAbsPdf *funci = (RooAbsPdf*) funcs.at(i);
+        funcs_.push_back(funci);
+        cachingPdfs_.push_back(makeCachingPdf(funci, &obs));
+    }
+    for (int i = 0, n = coeffs.getSize(); i < n; ++i) {
+        coeffs_.push_back((RooAbsReal*)coeffs.at(i));
+    }
+}
+
+cacheutils::CachingVerticalInterpPdf::~CachingVerticalInterpPdf()
+{
+}
+
+bool cacheutils::CachingVerticalInterpPdf::supports(const VerticalInterpPdf &pdf, const RooArgSet &obs) 
+{
+    if (pdf.quadraticAlgo() < 0 || pdf.getForceNumInt()) return false;
+    std::auto_ptr<RooArgSet> pdfObs(pdf.getObservables(obs));
+    const RooArgList & funcs  = pdf.funcList();
+    for (int i = 0, n = funcs.getSize(); i < n; ++i) {
+        const RooAbsPdf *funci = dynamic_cast<const RooAbsPdf *>(funcs.at(i));
+        if (funci == 0) return false;
+        std::auto_ptr<RooArgSet> funcObs(funci->getObservables(obs));
+        if (!funcObs->equals(*pdfObs)) return false;
+    }
+    return true;
+}
+
+const std::vector<Double_t> & cacheutils::CachingVerticalInterpPdf::eval(const RooAbsData &data)
+{
+    // the functions of VerticalInterpPdf::evaluate are (normalized pdf) x (integral), and its normalization the interpolation of the integrals
+    double qr = pdf_->quadraticRegion();
+    int algo  = pdf_->quadraticAlgo();
+    double intCentral = funcs_[0]->getNorm(obs_);
+    const std::vector<Double_t> & central = cachingPdfs_[0].eval(data);
+    unsigned int size = central.size();
+    work_.resize(size);
+    double wCentral = intCentral, norm = intCentral;
+    std::fill(work_.begin(), work_.end(), 0.0);
+    for (int i = 0, n = coeffs_.size(); i < n; ++i) {
+        double x = coeffs_[i]->getVal();
+        double cUp, cDn, cCen;
+        if (fabs(x) >= qr) {
+            cUp = x > 0 ? x : 0; cDn = x > 0 ? 0 : -x; cCen = -fabs(x);
+        } else if (algo != 1) {
+            cUp  = + x * (qr + x) / (2 * qr);
+            cDn  = - x * (qr - x) / (2 * qr);
+            cCen = - x * x / qr;
+        } else {
+            cUp  = (qr + x) * (qr + x) / (4 * qr);
+            cDn  = (qr - x) * (qr - x) / (4 * qr);
+            cCen = - cUp - cDn;
+        }
+        wCentral += cCen * intCentral;
+        norm     += cCen * intCentral;
+        if (cUp != 0) {
+            double intUp = funcs_[2*i+1]->getNorm(obs_);
+            vectorized::mul_add(size, cUp * intUp, &cachingPdfs_[2*i+1].eval(data)[0], &work_[0]);
+            norm += cUp * intUp;
+        }
+        if (cDn != 0) {
+            double intDn = funcs_[2*i+2]->getNorm(obs_);
+            vectorized::mul_add(size, cDn * intDn, &cachingPdfs_[2*i+2].eval(data)[0], &work_[0]);
+            norm += cDn * intDn;
+        }
+    }
+    double invNorm = 1.0/(norm > 0 ? norm : 1E-9);
+    for (unsigned int j = 0; j < size; ++j) {
+        double val = work_[j] + wCentral * central[j];
+        work_[j] = (val > 0 ? val : 1E-9) * invNorm;
+    }
+    return work_;
+}
+
+void cacheutils::CachingVerticalInterpPdf::setDataDirty()
+{
+    for (CachingPdfBase &pdf : cachingPdfs_) {
+        pdf.setDataDirty();
+    }
+}
+
+void cacheutils::CachingVerticalInterpPdf::setIncludeZeroWeights(bool includeZeroWeights) 
+{
+    for (CachingPdfBase &pdf : cachingPdfs_) {
+        pdf.setIncludeZeroWeights(includeZeroWeights);
+    }
+}
+
+std::size_t cacheutils::CachingVerticalInterpPdf::cacheBytes() const
+{
+    std::size_t ret = 0;
+    for (const CachingPdfBase &pdf : cachingPdfs_) ret += pdf.cacheBytes();
+    return ret + work_.capacity() * sizeof(Double_t);
+}
+
+
+cacheutils::CachingMomentMorphND::CachingMomentMorphND(const RooMomentMorphND &pdf, const RooArgSet &obs) :
+    pdf_(&pdf)
+{
+    const RooArgList & pdfs = pdf.pdfList();
+    for (int i = 0, n = pdfs.getSize(); i < n; ++i) {
+        cachingPdfs_.push_back(makeCachingPdf((RooAbsPdf*) pdfs.at(i), &obs));
+    }
+}
+
+cacheutils::CachingMomentMorphND::~CachingMomentMorphND()
+{
+}
+
+bool cacheutils::CachingMomentMorphND::supports(const RooMomentMorphND &pdf, const RooArgSet &obs) 
+{
+    std::vector<double> fracs;
+    if (pdf.useHorizontalMorphing() || !pdf.mixingFractions(fracs)) return false;
+    std::auto_ptr<RooArgSet> pdfObs(pdf.getObservables(obs));
+    const RooArgList & pdfs = pdf.pdfList();
+    for (int i = 0, n = pdfs.getSize(); i < n; ++i) {
+        const RooAbsPdf *pdfi = dynamic_cast<const RooAbsPdf *>(pdfs.at(i));
+        if (pdfi == 0) return false;
+        std::auto_ptr<RooArgSet> pdfiObs(pdfi->getObservables(obs));
+        if (!pdfiObs->equals(*pdfObs)) return false;
+    }
+    return true;
+}
+
+const std::vector<Double_t> & cacheutils::CachingMomentMorphND::eval(const RooAbsData &data)
+{
+    // the sum pdf of RooMomentMorphND is a RooAddPdf with a fraction for each reference pdf, which normalizes them by their sum;
+    // the reference pdfs are usually templates without parameters, so their values are computed only once
+    pdf_->mixingFractions(fracs_);
+    double sum = 0;
+    for (double f : fracs_) sum += f;
+    double invSum = 1.0/(sum != 0 ? sum : 1E-9);
+    unsigned int size = cachingPdfs_[0].eval(data).size();
+    work_.resize(size);
+    std::fill(work_.begin(), work_.end(), 0.0);
+    for (int i = 0, n = fracs_.size(); i < n; ++i) {
+        if (fracs_[i] == 0) continue;
+        vectorized::mul_add(size, fracs_[i] * invSum, &cachingPdfs_[i].eval(data)[0], &work_[0]);
+    }
+    return work_;
+}
+
+void cacheutils::CachingMomentMorphND::setDataDirty()
+{
+    for (CachingPdfBase &pdf : cachingPdfs_) {
+        pdf.setDataDirty();
+    }
+}
+
+void cacheutils::CachingMomentMorphND::setIncludeZeroWeights(bool includeZeroWeights) 
+{
+    for (CachingPdfBase &pdf : cachingPdfs_) {
+        pdf.setIncludeZeroWeights(includeZeroWeights);
+    }
+}
+
+std::size_t cacheutils::CachingMomentMorphND::cacheBytes() const
+{
+    std::size_t ret = 0;
+    for (const CachingPdfBase &pdf : cachingPdfs_) ret += pdf.cacheBytes();
+    return ret + (work_.capacity() + fracs_.capacity()) * sizeof(Double_t);
+}
@@ -1,29 +1,76 @@
 #include "HiggsAnalysis/CombinedLimit/interface/CachingNLL.h"
 #include "HiggsAnalysis/CombinedLimit/interface/utils.h"
 #include <stdexcept>
+#include <new>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <set>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cxxabi.h>
+#include <boost/functional/hash.hpp>
 #include <RooCategory.h>
 #include <RooDataSet.h>
 #include <RooProduct.h>
+#include <RooConstVar.h>
+#include <RooDataHist.h>
+#include <RooHistFunc.h>
+#include <RooHistPdf.h>
+#include <RooLinkedListElem.h>
+#include <TMath.h>
 
 #include "HiggsAnalysis/CombinedLimit/interface/ProfilingTools.h"
+#include "HiggsAnalysis/CombinedLimit/interface/Logging.h"
 #include <HiggsAnalysis/CombinedLimit/interface/RooMultiPdf.h>
 #include <HiggsAnalysis/CombinedLimit/interface/VerticalInterpHistPdf.h>
+#include <HiggsAnalysis/CombinedLimit/interface/RooMorphingPdf.h>
+#include <HiggsAnalysis/CombinedLimit/interface/RooParametricHist.h>
 #include <HiggsAnalysis/CombinedLimit/interface/VectorizedGaussian.h>
 #include <HiggsAnalysis/CombinedLimit/interface/VectorizedCB.h>
 #include <HiggsAnalysis/CombinedLimit/interface/VectorizedSimplePdfs.h>
 #include <HiggsAnalysis/CombinedLimit/interface/VectorizedHistFactoryPdfs.h>
+#include <HiggsAnalysis/CombinedLimit/interface/VectorizedHZZ4LPdfs.h>
+#include <HiggsAnalysis/CombinedLimit/interface/HZZ4L_RooSpinZeroPdf.h>
+#include <HiggsAnalysis/CombinedLimit/interface/HZZ4L_RooSpinZeroPdf_2D.h>
+#include <HiggsAnalysis/CombinedLimit/interface/HZZ4L_RooSpinZeroPdf_phase.h>
+#include <HiggsAnalysis/CombinedLimit/interface/HZZ4LRooPdfs.h>
 #include <HiggsAnalysis/CombinedLimit/interface/CachingMultiPdf.h>
 #include <HiggsAnalysis/CombinedLimit/interface/RooCheapProduct.h>
 #include <HiggsAnalysis/CombinedLimit/interface/Accumulators.h>
+#include <HiggsAnalysis/CombinedLimit/interface/ProcessNormalization.h>
+#include <HiggsAnalysis/CombinedLimit/interface/AsymPow.h>
 #include "vectorized.h"
 
+namespace {
+    // lookups done by this thread in any ValuesCache, for CostReport
+    __thread unsigned long threadCacheHits_ = 0, threadCacheMisses_ = 0;
+}
+
 namespace cacheutils {
     typedef OptimizedCachingPdfT<FastVerticalInterpHistPdf,FastVerticalInterpHistPdfV> CachingHistPdf;
     typedef OptimizedCachingPdfT<FastVerticalInterpHistPdf2,FastVerticalInterpHistPdf2V> CachingHistPdf2;
+    typedef OptimizedCachingPdfT<RooMorphingPdf,RooMorphingPdfV> CachingMorphingPdf;
+    typedef OptimizedCachingPdfT<RooParametricHist,RooParametricHistV> CachingParametricHist;
     typedef OptimizedCachingPdfT<RooGaussian,VectorizedGaussian> CachingGaussPdf;
     typedef OptimizedCachingPdfT<RooCBShape,VectorizedCBShape> CachingCBPdf;
     typedef OptimizedCachingPdfT<RooExponential,VectorizedExponential> CachingExpoPdf;
     typedef OptimizedCachingPdfT<RooPower,VectorizedPower> CachingPowerPdf;
+    typedef OptimizedCachingPdfT<RooPolynomial,VectorizedLinearBasisPdf<RooPolynomial> > CachingPolynomialPdf;
+    typedef OptimizedCachingPdfT<RooChebychev,VectorizedLinearBasisPdf<RooChebychev> > CachingChebychevPdf;
+    typedef OptimizedCachingPdfT<RooExpPoly,VectorizedExpOfSumPdf<RooExpPoly> > CachingExpPolyPdf;
+    typedef OptimizedCachingPdfT<RooPowPdf,VectorizedExpOfSumPdf<RooPowPdf> > CachingPowPdf;
+    typedef OptimizedCachingPdfT<RooPow2Pdf,VectorizedExpOfSumPdf<RooPow2Pdf> > CachingPow2Pdf;
+    typedef OptimizedCachingPdfT<RooQCDPdf,VectorizedExpOfSumPdf<RooQCDPdf> > CachingQCDPdf;
+    typedef OptimizedCachingPdfT<Roo2ExpPdf,VectorizedTwoExp> Caching2ExpPdf;
+    typedef OptimizedCachingPdfT<HZZ4L_RooSpinZeroPdf,VectorizedHZZ4LSpinZeroPdf<HZZ4L_RooSpinZeroPdf> > CachingHZZ4LSpinZeroPdf;
+    typedef OptimizedCachingPdfT<HZZ4L_RooSpinZeroPdf_2D,VectorizedHZZ4LSpinZeroPdf<HZZ4L_RooSpinZeroPdf_2D> > CachingHZZ4LSpinZeroPdf2D;
+    typedef OptimizedCachingPdfT<HZZ4L_RooSpinZeroPdf_phase,VectorizedHZZ4LSpinZeroPdf<HZZ4L_RooSpinZeroPdf_phase> > CachingHZZ4LSpinZeroPdfPhase;
+    typedef OptimizedCachingPdfT<RooqqZZPdf_v2,VectorizedZZContinuumPdf<RooqqZZPdf_v2> > CachingqqZZPdf;
+    typedef OptimizedCachingPdfT<RooggZZPdf_v2,VectorizedZZContinuumPdf<RooggZZPdf_v2> > CachingggZZPdf;
 
     class ReminderSum : public RooAbsReal {
         public:
@@ -58,7 +105,8 @@ namespace cacheutils {
 
 //std::map<std::string,double> cacheutils::CachingAddNLL::offsets_;
 bool cacheutils::CachingSimNLL::noDeepLEE_ = false;
-bool cacheutils::CachingSimNLL::hasError_  = false;
+namespace { std::atomic<unsigned long> nextSimNLLDataId_(0); }
+thread_local bool cacheutils::CachingSimNLL::hasError_  = false;
 bool cacheutils::CachingSimNLL::optimizeContraints_  = true;
 
 //#define DEBUG_TRACE_POINTS
@@ -103,6 +151,55 @@ namespace {
 namespace { unsigned long CachingSimNLLEvalCount = 0; }
 #endif
 
+namespace { 
+    // RooAbsReal::logEvalError uses global bookkeeping, so serialize it when channels are evaluated in threads
+    std::mutex logEvalErrorMutex_;
+}
+
+namespace {
+    // step for the finite difference derivatives with respect to param
+    double derivativeStep(const RooRealVar &param) {
+        double err = param.getError();
+        return 1e-4 * (err > 0 ? err : std::max(1.0, std::abs(param.getVal())));
+    }
+    // the two points for the finite differences, kept within the boundaries of param
+    void derivativePoints(const RooRealVar &param, double &xlo, double &xhi) {
+        double x0 = param.getVal(), h = derivativeStep(param);
+        xhi = x0 + h; xlo = x0 - h;
+        if (param.hasMax() && xhi > param.getMax()) xhi = x0;
+        if (param.hasMin() && xlo < param.getMin()) xlo = x0;
+    }
+    // derivative of func with respect to param, with central finite differences
+    template<typename F> double numericDerivative(RooRealVar &param, const F &func) {
+        double x0 = param.getVal(), xlo, xhi;
+        derivativePoints(param, xlo, xhi);
+        if (xhi == xlo) return 0;
+        param.setVal(xhi); double fhi = func();
+        param.setVal(xlo); double flo = func();
+        param.setVal(x0);
+        return (fhi - flo)/(xhi - xlo);
+    }
+    // same, for all the values of a CachingPdf 
+    void numericDerivative(RooRealVar &param, cacheutils::CachingPdfBase &pdf, const RooAbsData &data, std::vector<Double_t> &out) {
+        double x0 = param.getVal(), xlo, xhi;
+        derivativePoints(param, xlo, xhi);
+        if (xhi == xlo) { out.assign(pdf.eval(data).size(), 0.0); return; }
+        param.setVal(xhi); out = pdf.eval(data);
+        param.setVal(xlo); const std::vector<Double_t> &vlo = pdf.eval(data);
+        double inv = 1.0/(xhi - xlo);
+        for (unsigned int i = 0, n = out.size(); i < n; ++i) out[i] = (out[i] - vlo[i]) * inv;
+        param.setVal(x0);
+    }
+    // derivative of a coefficient, analytically for the common cases
+    double coeffDerivative(RooAbsReal *coeff, RooRealVar &param) {
+        if (coeff == &param) return 1.0;
+        double deriv;
+        if (typeid(*coeff) == typeid(ProcessNormalization) && static_cast<const ProcessNormalization *>(coeff)->analyticalDerivative(param, deriv)) return deriv;
+        if (typeid(*coeff) == typeid(AsymPow) && static_cast<const AsymPow *>(coeff)->analyticalDerivative(param, deriv)) return deriv;
+        return numericDerivative(param, [coeff]() { return coeff->getVal(); });
+    }
+}
+
 cacheutils::ArgSetChecker::ArgSetChecker(const RooAbsCollection &set) 
 {
     std::auto_ptr<TIterator> iter(set.createIterator());
@@ -153,84 +250,333 @@ cacheutils::ArgSetChecker::changed(bool updateIfChanged)
     return changed;
 }
 
-cacheutils::ValuesCache::ValuesCache(const RooAbsCollection &params, int size) :
-    size_(1),
-    maxSize_(size)
+std::size_t
+cacheutils::ArgSetChecker::currentHash() const
+{
+    std::size_t ret = 0;
+    for (std::vector<RooRealVar *>::const_iterator it = vars_.begin(), ed = vars_.end(); it != ed; ++it) {
+        boost::hash_combine(ret, (*it)->getVal());
+    }
+    for (std::vector<RooCategory *>::const_iterator it = cats_.begin(), ed = cats_.end(); it != ed; ++it) {
+        boost::hash_combine(ret, (*it)->getIndex());
+    }
+    return ret;
+}
+
+void
+cacheutils::ArgSetChecker::changedArgs(std::vector<const RooAbsArg *> &out) const
+{
+    for (unsigned int i = 0, n = vars_.size(); i < n; ++i) {
+        if (vars_[i]->getVal() != vals_[i]) out.push_back(vars_[i]);
+    }
+    for (unsigned int i = 0, n = cats_.size(); i < n; ++i) {
+        if (cats_[i]->getIndex() != states_[i]) out.push_back(cats_[i]);
+    }
+}
+
+cacheutils::ValuesCache::ValuesCache(const RooAbsCollection &params, int size) 
 {
-    assert(size <= MaxItems_);
-    items[0] = new Item(params);
+    setup_(params, size, "generic");
 }
-cacheutils::ValuesCache::ValuesCache(const RooAbsReal &pdf, const RooArgSet &obs, int size) :
-    size_(1),
-    maxSize_(size)
+cacheutils::ValuesCache::ValuesCache(const RooAbsReal &pdf, const RooArgSet &obs, int size) 
 {
-    assert(size <= MaxItems_);
     std::auto_ptr<RooArgSet> params(pdf.getParameters(obs));
     //std::cout << "Parameters for pdf " << pdf.GetName() << " (" << pdf.ClassName() << "):"; params->Print("");
-    items[0] = new Item(*params);
+    setup_(*params, size, pdf.ClassName());
 }
 
+void cacheutils::ValuesCache::setup_(const RooAbsCollection &params, int size, const char *className) 
+{
+    static int defaultSize = runtimedef::get("CACHINGPDF_CACHE_SIZE");
+    maxSize_ = (size > 0 ? size : (defaultSize > 0 ? defaultSize : int(DefaultItems_)));
+    items_.reserve(maxSize_);
+    items_.push_back(new Item(params));
+    hits_ = misses_ = 0;
+    reportMisses_ = RecomputeReport::enabled();
+    static bool dirtySentry = runtimedef::get("CACHINGPDF_DIRTY_SENTRY");
+    if (dirtySentry) {
+        sentry_.reset(new SimpleCacheSentry());
+        sentry_->addVars(params);
+        sentry_->setValueDirty();
+    }
+    static bool stats = runtimedef::get("CACHINGPDF_CACHE_STATS");
+    if (stats) {
+        // PerfCounter wants names that stay alive until the end of the job
+        static std::set<std::string> names;
+        hits_   = &PerfCounter::get(names.insert(std::string("ValuesCache hit ")+className).first->c_str());
+        misses_ = &PerfCounter::get(names.insert(std::string("ValuesCache miss ")+className).first->c_str());
+    }
+}
 
 cacheutils::ValuesCache::~ValuesCache() 
 {
-    for (int i = 0; i < size_; ++i) delete items[i];
+    for (Item *item : items_) delete item;
 }
 
 void cacheutils::ValuesCache::clear() 
 {
-    for (int i = 0; i < size_; ++i) items[i]->good = false;
+    for (Item *item : items_) item->good = false;
+}
+
+void cacheutils::ValuesCache::localize() 
+{
+    for (Item *item : items_) std::vector<Double_t>(item->values).swap(item->values);
+}
+
+std::size_t cacheutils::ValuesCache::bytes() const 
+{
+    std::size_t ret = 0;
+    for (const Item *item : items_) ret += sizeof(Item) + item->values.capacity() * sizeof(Double_t);
+    return ret;
 }
 
 std::pair<std::vector<Double_t> *, bool> cacheutils::ValuesCache::get() 
 {
     int found = -1; bool good = false;
-    for (int i = 0; i < size_; ++i) {
-        if (items[i]->good) {
-            // valid entry, check if fresh
-            if (!items[i]->checker.changed()) {
-#ifdef DEBUG_CACHE
-                PerfCounter::add(i == 0 ? "ValuesCache::get hit first" : "ValuesCache::get hit other");
-#endif
-                // fresh: done! 
-                found = i; 
-                good = true; 
-                break;
-            } 
-        } else if (found == -1) {
-            // invalid entry, can be replaced
-            found = i;
-#ifdef DEBUG_CACHE
-            PerfCounter::add("ValuesCache::get hit invalid");
-#endif
+    // most of the times nothing changed since the last call, so check the first one directly
+    // (with the sentry, we don't even have to look at the values unless some parameter was set)
+    bool untouched = sentry_.get() && sentry_->good();
+    if (sentry_.get()) sentry_->reset();
+    if (items_[0]->good && (untouched || !items_[0]->checker.changed())) {
+        if (hits_) hits_->add();
+        ++threadCacheHits_;
+        return std::pair<std::vector<Double_t> *, bool>(&items_[0]->values, true);
+    }
+    // otherwise, compare the hashes first, and check the values only if they match
+    std::size_t hash = items_[0]->checker.currentHash();
+    for (int i = 1, n = items_.size(); i < n; ++i) {
+        if (items_[i]->good && items_[i]->hash == hash && !items_[i]->checker.changed()) {
+            found = i; 
+            good = true; 
+            break;
         }
-    } 
-    if (found == -1) {
-        // all entries are valid but old 
-#ifdef DEBUG_CACHE
-        PerfCounter::add("ValuesCache::get miss");
-#endif
-        if (size_ < maxSize_) {
-            // if I can, make a new entry
-            items[size_] = new Item(items[0]->checker); // create a new item, copying the ArgSetChecker from the first one
-            found = size_; 
-            size_++;
-        } else {
-            // otherwise, pick the last one
-            found = size_-1;
+    }
+    if (!good) {
+        // pick an invalid entry if any, otherwise make a new entry if I can, otherwise evict the least recently used
+        for (int i = 0, n = items_.size(); i < n; ++i) {
+            if (!items_[i]->good) { found = i; break; }
+        }
+        if (found == -1) {
+            if (int(items_.size()) < maxSize_) {
+                items_.push_back(new Item(items_[0]->checker)); // create a new item, copying the ArgSetChecker from the first one
+            }
+            found = items_.size()-1;
         }
     }
+    if (good) { if (hits_) hits_->add(); ++threadCacheHits_; }
+    else { if (misses_) misses_->add(); ++threadCacheMisses_; }
+    if (!good && reportMisses_) {
+        // the most recent item has the values of the last evaluation, so what changed since then caused this miss
+        missCause_.clear();
+        if (items_[0]->good) items_[0]->checker.changedArgs(missCause_);
+        RecomputeReport::miss(missCause_, this);
+    }
     // make sure new entry is the first one
     if (found != 0) {
-        // remember what found is pointing to
-        Item *f = items[found];
-        // shift the other items down one place
-        while (found > 0) { items[found] = items[found-1]; --found; } 
-        // and put found on top
-        items[found] = f;
+        Item *f = items_[found];
+        std::copy_backward(items_.begin(), items_.begin()+found, items_.begin()+found+1);
+        items_[0] = f;
+    }
+    if (!good) {
+        items_[0]->checker.changed(true); // store new values in cache sentry
+        items_[0]->hash = hash;
+    }
+    items_[0]->good = true;               // mark this as valid entry
+    return std::pair<std::vector<Double_t> *, bool>(&items_[0]->values, good);
+}
+
+namespace {
+    struct CostReportRegistry {
+        std::mutex mutex;
+        // std::map nodes don't move, so the entries can be handed out by reference
+        std::map<std::pair<std::string,std::string>, cacheutils::CostReport::Entry> entries;
+    };
+    CostReportRegistry & costReportRegistry() {
+        static CostReportRegistry registry;
+        return registry;
+    }
+    std::string demangledName(const std::type_info &type) {
+        int status = 0;
+        char *demangled = abi::__cxa_demangle(type.name(), 0, 0, &status);
+        std::string ret(status == 0 && demangled ? demangled : type.name());
+        free(demangled);
+        return ret;
+    }
+    double costReportNow() {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    void printCostTable(const char *title, const std::map<std::string, cacheutils::CostReport::Entry> &rows, double total) {
+        std::vector<std::pair<std::string, cacheutils::CostReport::Entry> > ranked(rows.begin(), rows.end());
+        std::sort(ranked.begin(), ranked.end(), [](const std::pair<std::string, cacheutils::CostReport::Entry> &a, const std::pair<std::string, cacheutils::CostReport::Entry> &b) { return a.second.seconds > b.second.seconds; });
+        printf("%-60s %10s %6s %10s %10s %10s %8s\n", title, "time [s]", "%", "calls", "us/call", "bins/call", "hit rate");
+        for (const auto &row : ranked) {
+            const cacheutils::CostReport::Entry &e = row.second;
+            unsigned long lookups = e.hits + e.misses;
+            printf("%-60s %10.3f %6.1f %10lu %10.2f %10.1f ", row.first.c_str(), e.seconds, total > 0 ? 100*e.seconds/total : 0., e.calls,
+                    e.calls ? 1e6*e.seconds/e.calls : 0., e.calls ? double(e.bins)/e.calls : 0.);
+            if (lookups) printf("%7.1f%%\n", 100.0*e.hits/lookups); else printf("%8s\n", "-");
+        }
+    }
+}
+
+cacheutils::CostReport::Entry & 
+cacheutils::CostReport::get(const std::string &channel, const std::string &pdfClass) 
+{
+    CostReportRegistry &reg = costReportRegistry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    return reg.entries[std::make_pair(channel, pdfClass)];
+}
+
+cacheutils::CostReport::Scope::Scope(Entry *entry, unsigned long bins) :
+    entry_(entry)
+{
+    if (entry_) {
+        entry_->calls++;
+        entry_->bins += bins;
+        hits_ = threadCacheHits_; misses_ = threadCacheMisses_;
+        start_ = costReportNow();
     }
-    if (!good) items[found]->checker.changed(true); // store new values in cache sentry
-    items[found]->good = true;                      // mark this as valid entry
-    return std::pair<std::vector<Double_t> *, bool>(&items[found]->values, good);
+}
+
+cacheutils::CostReport::Scope::~Scope() 
+{
+    if (entry_) {
+        entry_->seconds += costReportNow() - start_;
+        entry_->hits   += threadCacheHits_ - hits_;
+        entry_->misses += threadCacheMisses_ - misses_;
+    }
+}
+
+void cacheutils::CostReport::print() 
+{
+    CostReportRegistry &reg = costReportRegistry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    if (reg.entries.empty()) return;
+    std::map<std::string, Entry> channels, classes;
+    double total = 0;
+    for (const auto &item : reg.entries) {
+        const Entry &e = item.second;
+        Entry &sum = item.first.second.empty() ? channels[item.first.first] : classes[item.first.second];
+        sum.seconds += e.seconds; sum.calls += e.calls; sum.bins += e.bins; sum.hits += e.hits; sum.misses += e.misses;
+        if (item.first.second.empty()) total += e.seconds;
+    }
+    printf("\n=== Cost of the CachingAddNLL evaluations (ADDNLL_COST_REPORT) ===\n");
+    printCostTable("Channel", channels, total);
+    printf("\n");
+    printCostTable("Cached pdf class (percent of the total channel time)", classes, total);
+    printf("\n");
+}
+
+namespace {
+    struct RecomputeReportRegistry {
+        std::mutex mutex;
+        std::map<std::string, cacheutils::RecomputeReport::Entry> entries;
+    };
+    RecomputeReportRegistry & recomputeReportRegistry() {
+        static RecomputeReportRegistry registry;
+        return registry;
+    }
+    const char *recomputeNoCause = "(no earlier values: new data, or cache cleared)";
+}
+
+bool cacheutils::RecomputeReport::enabled() 
+{
+    static bool enabled = runtimedef::get("ADDNLL_RECOMPUTE_REPORT");
+    return enabled;
+}
+
+void cacheutils::RecomputeReport::miss(const std::vector<const RooAbsArg *> &cause, const void *cache) 
+{
+    RecomputeReportRegistry &reg = recomputeReportRegistry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    if (cause.empty()) { 
+        Entry &e = reg.entries[recomputeNoCause];
+        e.misses += 1; e.alone++; e.caches.insert(cache);
+        return;
+    }
+    double share = 1.0/cause.size();
+    for (const RooAbsArg *a : cause) {
+        Entry &e = reg.entries[a->GetName()];
+        e.misses += share;
+        if (cause.size() == 1) e.alone++;
+        e.caches.insert(cache);
+    }
+}
+
+cacheutils::RecomputeReport::Scope::Scope(const std::vector<const RooAbsArg *> *cause, unsigned long bins) :
+    cause_(cause), bins_(bins), start_(cause ? costReportNow() : 0)
+{
+}
+
+cacheutils::RecomputeReport::Scope::~Scope() 
+{
+    if (cause_ == 0) return;
+    double seconds = costReportNow() - start_;
+    RecomputeReportRegistry &reg = recomputeReportRegistry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    if (cause_->empty()) {
+        Entry &e = reg.entries[recomputeNoCause];
+        e.seconds += seconds; e.bins += bins_;
+        return;
+    }
+    double share = 1.0/cause_->size();
+    for (const RooAbsArg *a : *cause_) {
+        Entry &e = reg.entries[a->GetName()];
+        e.seconds += share*seconds; e.bins += share*bins_;
+    }
+}
+
+void cacheutils::RecomputeReport::print() 
+{
+    RecomputeReportRegistry &reg = recomputeReportRegistry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    if (reg.entries.empty()) return;
+    std::vector<std::pair<std::string, const Entry *> > ranked;
+    double total = 0;
+    for (const auto &item : reg.entries) { ranked.push_back(std::make_pair(item.first, &item.second)); total += item.second.seconds; }
+    std::sort(ranked.begin(), ranked.end(), [](const std::pair<std::string, const Entry *> &a, const std::pair<std::string, const Entry *> &b) { return a.second->seconds > b.second->seconds; });
+    printf("\n=== Recomputations of the cached pdfs by parameter (ADDNLL_RECOMPUTE_REPORT) ===\n");
+    printf("%-60s %10s %6s %10s %10s %8s %12s\n", "Parameter", "time [s]", "%", "misses", "alone", "caches", "bins");
+    unsigned int shown = 0, maxShown = 50;
+    for (const auto &row : ranked) {
+        if (shown++ == maxShown) { printf("... and %u more parameters\n", unsigned(ranked.size()) - maxShown); break; }
+        const Entry &e = *row.second;
+        printf("%-60s %10.3f %6.1f %10.1f %10lu %8u %12.0f\n", row.first.c_str(), e.seconds, total > 0 ? 100*e.seconds/total : 0.,
+                e.misses, e.alone, unsigned(e.caches.size()), e.bins);
+    }
+    printf("\n");
+}
+
+cacheutils::ScratchArena::~ScratchArena()
+{
+    free(data_);
+}
+
+void cacheutils::ScratchArena::localize()
+{
+    if (data_ == 0) return;
+    void *mem = 0;
+    if (posix_memalign(&mem, Alignment, capacity_ * sizeof(Double_t)) != 0) throw std::bad_alloc();
+    std::copy(data_, data_ + capacity_, static_cast<Double_t *>(mem));
+    free(data_);
+    data_ = static_cast<Double_t *>(mem);
+}
+
+void cacheutils::ScratchArena::resize(unsigned int size, unsigned int arrays)
+{
+    // each array starts on a new 64-byte boundary
+    const unsigned int perLine = Alignment / sizeof(Double_t);
+    unsigned int stride = ((size + perLine - 1) / perLine) * perLine;
+    std::size_t needed = std::size_t(stride) * arrays;
+    if (needed > capacity_) {
+        free(data_); data_ = 0; capacity_ = 0;
+        void *mem = 0;
+        if (posix_memalign(&mem, Alignment, needed * sizeof(Double_t)) != 0) throw std::bad_alloc();
+        data_ = static_cast<Double_t *>(mem);
+        capacity_ = needed;
+    }
+    if (needed) std::fill(data_, data_ + needed, 0.0);
+    size_ = size; arrays_ = arrays; stride_ = stride;
 }
 
 cacheutils::CachingPdf::CachingPdf(RooAbsReal *pdf, const RooArgSet *obs) :
@@ -269,6 +615,7 @@ cacheutils::CachingPdf::eval(const RooAbsData &data)
     if (newdata) newData_(data);
     std::pair<std::vector<Double_t> *, bool> hit = cache_.get();
     if (!hit.second) { 
+        RecomputeReport::Scope recomputeScope(cache_.missCause(), data.numEntries());
         realFill_(data, *hit.first);
     } 
     return *hit.first;
@@ -284,6 +631,15 @@ cacheutils::CachingPdf::newData_(const RooAbsData &data)
     cache_.clear();
     nonZeroW_.resize(data.numEntries());
     nonZeroWEntries_ = 0;
+    if (const DataColumns *columns = DataColumns::find(data, includeZeroWeights_)) {
+        std::fill(nonZeroW_.begin(), nonZeroW_.end(), 0);
+        const std::vector<unsigned int> &entries = columns->entries();
+        const Double_t *weights = columns->weights();
+        for (unsigned int k = 0, nk = entries.size(); k < nk; ++k) {
+            if (weights[k] > 0 || includeZeroWeights_) { nonZeroW_[entries[k]] = 1; nonZeroWEntries_++; }
+        }
+        return;
+    }
     for (unsigned int i = 0, n = nonZeroW_.size(); i < n; ++i) {
         data.get(i);
         if (data.weight() > 0 || includeZeroWeights_) {
@@ -307,6 +663,7 @@ cacheutils::CachingPdf::realFill_(const RooAbsData &data, std::vector<Double_t>
     
     int n = data.numEntries();
     vals.resize(nonZeroWEntries_); // should be a no-op if size is already >= n.
+    if (fillFromColumns_(data, vals)) return;
     std::vector<Double_t>::iterator itv = vals.begin();
     for (int i = 0; i < n; ++i) {
         if (!nonZeroW_[i]) continue;
@@ -319,6 +676,29 @@ cacheutils::CachingPdf::realFill_(const RooAbsData &data, std::vector<Double_t>
 }
 
 
+bool
+cacheutils::CachingPdf::fillFromColumns_(const RooAbsData &data, std::vector<Double_t> &vals) 
+{
+    static bool rows = runtimedef::get("CACHINGPDF_ROWS");
+    if (rows) return false;
+    const DataColumns *columns = DataColumns::find(data, includeZeroWeights_);
+    // the columns may also keep entries with negative weights, which are skipped here
+    if (columns == 0 || columns->size() != nonZeroWEntries_ || !columns->withinRanges()) return false;
+    std::vector<std::pair<RooRealVar *, const Double_t *> > vars;
+    RooLinkedListIter iter = data.get()->iterator();
+    for (RooAbsArg *a = (RooAbsArg *) iter.Next(); a != 0; a = (RooAbsArg *) iter.Next()) {
+        RooRealVar *rrv = dynamic_cast<RooRealVar *>(a);
+        const Double_t *column = rrv ? columns->column(rrv->GetName()) : 0;
+        if (column == 0) return false;
+        vars.push_back(std::make_pair(rrv, column));
+    }
+    for (unsigned int k = 0, nk = columns->size(); k < nk; ++k) {
+        for (auto itv = vars.begin(), edv = vars.end(); itv != edv; ++itv) itv->first->setVal(itv->second[k]);
+        vals[k] = pdf_->getVal(obs_);
+    }
+    return true;
+}
+
 template <typename PdfT, typename VPdfT>
 void
 cacheutils::OptimizedCachingPdfT<PdfT,VPdfT>::newData_(const RooAbsData &data) 
@@ -339,6 +719,19 @@ cacheutils::OptimizedCachingPdfT<PdfT,VPdfT>::realFill_(const RooAbsData &data,
     vpdf_->fill(vals);
 }
 
+namespace cacheutils {
+template <>
+bool
+OptimizedCachingPdfT<FastVerticalInterpHistPdf2,FastVerticalInterpHistPdf2V>::evalDerivative(const RooAbsData &data, const RooAbsArg &param, std::vector<Double_t> &out) 
+{
+    eval(data); // make sure the vectorized pdf is up to date
+    FastHisto deriv;
+    if (!static_cast<const FastVerticalInterpHistPdf2 &>(*pdf_).cacheDerivative(param, deriv)) return false;
+    vpdf_->fill(deriv, out);
+    return true;
+}
+}
+
 
 cacheutils::ReminderSum::ReminderSum(const char *name, const char *title, const RooArgList& sumSet) :
     RooAbsReal(name,title),
@@ -360,9 +753,14 @@ cacheutils::CachingAddNLL::CachingAddNLL(const char *name, const char *title, Ro
     RooAbsReal(name, title),
     pdf_(pdf),
     params_("params","parameters",this),
+    originalData_(0),
+    fineBinningOff_(false),
     includeZeroWeights_(includeZeroWeights),
     zeroPoint_(0),
-    constantZeroPoint_(0)
+    constantZeroPoint_(0),
+    offloadState_(0),
+    kernelState_(0),
+    asimovState_(0)
 {
     if (pdf == 0) throw std::invalid_argument(std::string("Pdf passed to ")+name+" is null");
     setData(*data);
@@ -374,11 +772,16 @@ cacheutils::CachingAddNLL::CachingAddNLL(const CachingAddNLL &other, const char
     RooAbsReal(name ? name : (TString("nll_")+other.pdf_->GetName()).Data(), ""),
     pdf_(other.pdf_),
     params_("params","parameters",this),
+    originalData_(0),
+    fineBinningOff_(false),
     includeZeroWeights_(other.includeZeroWeights_),
     zeroPoint_(0),
-    constantZeroPoint_(0)
+    constantZeroPoint_(0),
+    offloadState_(0),
+    kernelState_(0),
+    asimovState_(0)
 {
-    setData(*other.data_);
+    setData(*other.originalData_);
     setup_();
     constantZeroPoint_ = -evaluate();
 }
@@ -434,20 +837,41 @@ void cacheutils::CachingAddNLL::addPdfs_(RooAddPdf *addpdf, bool recursive, cons
     }
 }
 
+namespace {
+    /// CachingPdf for RooBernsteinFast<M> with M <= N, or null if the pdf is not one of them
+    template<int N>
+    cacheutils::CachingPdfBase * makeCachingBernstein(RooAbsReal *pdf, const RooArgSet *obs) {
+        if (typeid(*pdf) == typeid(RooBernsteinFast<N>)) return new cacheutils::OptimizedCachingPdfT<RooBernsteinFast<N>,VectorizedBernstein<N> >(pdf, obs);
+        return makeCachingBernstein<N-1>(pdf, obs);
+    }
+    template<>
+    cacheutils::CachingPdfBase * makeCachingBernstein<0>(RooAbsReal *pdf, const RooArgSet *obs) { return 0; }
+}
+
 cacheutils::CachingPdfBase *
 cacheutils::makeCachingPdf(RooAbsReal *pdf, const RooArgSet *obs) {
     static bool histNll  = runtimedef::get("ADDNLL_HISTNLL");
     static bool gaussNll  = runtimedef::get("ADDNLL_GAUSSNLL");
     static bool multiNll  = runtimedef::get("ADDNLL_MULTINLL");
+    static bool multiPersist  = !runtimedef::get("ADDNLL_MULTIPDF_NOPERSIST");
     static bool prodNll  = runtimedef::get("ADDNLL_PRODNLL");
+    static bool vertNll  = runtimedef::get("ADDNLL_VERTINTNLL");
+    static bool morphNll  = runtimedef::get("ADDNLL_MOMENTMORPHNLL");
     static bool cbNll  = runtimedef::get("ADDNLL_CBNLL");
     static bool hfNll  = runtimedef::get("ADDNLL_HFNLL");
+    static bool hzzNll  = runtimedef::get("ADDNLL_HZZNLL");
+    static bool bkgNll  = runtimedef::get("ADDNLL_BKGNLL");
     static bool verb  = runtimedef::get("ADDNLL_VERBOSE_CACHING");
+    CachingPdfBase *bern = 0;
 
     if (histNll && typeid(*pdf) == typeid(FastVerticalInterpHistPdf)) {
         return new CachingHistPdf(pdf, obs);
     } else if (histNll && typeid(*pdf) == typeid(FastVerticalInterpHistPdf2)) {
         return new CachingHistPdf2(pdf, obs);
+    } else if (histNll && typeid(*pdf) == typeid(RooMorphingPdf)) {
+        return new CachingMorphingPdf(pdf, obs);
+    } else if (histNll && typeid(*pdf) == typeid(RooParametricHist)) {
+        return new CachingParametricHist(pdf, obs);
     } else if (gaussNll && typeid(*pdf) == typeid(RooGaussian)) {
         return new CachingGaussPdf(pdf, obs);
     } else if (cbNll && typeid(*pdf) == typeid(RooCBShape)) {
@@ -458,19 +882,52 @@ cacheutils::makeCachingPdf(RooAbsReal *pdf, const RooArgSet *obs) {
         return new CachingExpoPdf(pdf, obs);
     } else if (gaussNll && typeid(*pdf) == typeid(RooPower)) {
         return new CachingPowerPdf(pdf, obs);
+    } else if (gaussNll && (bern = makeCachingBernstein<7>(pdf, obs)) != 0) {
+        return bern;
+    } else if (bkgNll && typeid(*pdf) == typeid(RooPolynomial)) {
+        return new CachingPolynomialPdf(pdf, obs);
+    } else if (bkgNll && typeid(*pdf) == typeid(RooChebychev)) {
+        return new CachingChebychevPdf(pdf, obs);
+    } else if (bkgNll && typeid(*pdf) == typeid(RooExpPoly)) {
+        return new CachingExpPolyPdf(pdf, obs);
+    } else if (bkgNll && typeid(*pdf) == typeid(RooPowPdf)) {
+        return new CachingPowPdf(pdf, obs);
+    } else if (bkgNll && typeid(*pdf) == typeid(RooPow2Pdf)) {
+        return new CachingPow2Pdf(pdf, obs);
+    } else if (bkgNll && typeid(*pdf) == typeid(RooQCDPdf)) {
+        return new CachingQCDPdf(pdf, obs);
+    } else if (bkgNll && typeid(*pdf) == typeid(Roo2ExpPdf)) {
+        return new Caching2ExpPdf(pdf, obs);
     } else if (multiNll && typeid(*pdf) == typeid(RooMultiPdf)) {
         return new CachingMultiPdf(static_cast<RooMultiPdf&>(*pdf), *obs);
+    } else if (multiPersist && typeid(*pdf) == typeid(RooMultiPdf)) {
+        // same evaluation as the generic CachingPdf of the current component, but the caches survive index changes
+        return new CachingMultiPdf(static_cast<RooMultiPdf&>(*pdf), *obs, false);
     } else if (multiNll && typeid(*pdf) == typeid(RooAddPdf)) {
         return new CachingAddPdf(static_cast<RooAddPdf&>(*pdf), *obs);
     } else if (prodNll && typeid(*pdf) == typeid(RooProduct)) {
         return new CachingProduct(static_cast<RooProduct&>(*pdf), *obs);
+    } else if (vertNll && typeid(*pdf) == typeid(VerticalInterpPdf) && CachingVerticalInterpPdf::supports(static_cast<VerticalInterpPdf&>(*pdf), *obs)) {
+        return new CachingVerticalInterpPdf(static_cast<VerticalInterpPdf&>(*pdf), *obs);
+    } else if (morphNll && typeid(*pdf) == typeid(RooMomentMorphND) && CachingMomentMorphND::supports(static_cast<RooMomentMorphND&>(*pdf), *obs)) {
+        return new CachingMomentMorphND(static_cast<RooMomentMorphND&>(*pdf), *obs);
     } else if (hfNll && typeid(*pdf) == typeid(RooHistFunc)) {
         //return new OptimizedCachingPdfT<RooHistFunc,VectorizedHistFunc>(pdf, obs);
         return new VectorizedHistFunc(static_cast<RooHistFunc&>(*pdf));
     } else if (hfNll && typeid(*pdf) == typeid(ParamHistFunc)) {
-        return new OptimizedCachingPdfT<ParamHistFunc,VectorizedParamHistFunc>(pdf, obs);
+        return new CachingParamHistFunc(pdf, obs);
     } else if (hfNll && typeid(*pdf) == typeid(PiecewiseInterpolation)) {
         return new CachingPiecewiseInterpolation(static_cast<PiecewiseInterpolation&>(*pdf), *obs);
+    } else if (hzzNll && typeid(*pdf) == typeid(HZZ4L_RooSpinZeroPdf)) {
+        return new CachingHZZ4LSpinZeroPdf(pdf, obs);
+    } else if (hzzNll && typeid(*pdf) == typeid(HZZ4L_RooSpinZeroPdf_2D)) {
+        return new CachingHZZ4LSpinZeroPdf2D(pdf, obs);
+    } else if (hzzNll && typeid(*pdf) == typeid(HZZ4L_RooSpinZeroPdf_phase)) {
+        return new CachingHZZ4LSpinZeroPdfPhase(pdf, obs);
+    } else if (hzzNll && typeid(*pdf) == typeid(RooqqZZPdf_v2)) {
+        return new CachingqqZZPdf(pdf, obs);
+    } else if (hzzNll && typeid(*pdf) == typeid(RooggZZPdf_v2)) {
+        return new CachingggZZPdf(pdf, obs);
     } else {
         if (verb) {
             std::cout << "I don't have an optimized implementation for " << pdf->ClassName() << " (" << pdf->GetName() << ")" << std::endl;
@@ -480,10 +937,367 @@ cacheutils::makeCachingPdf(RooAbsReal *pdf, const RooArgSet *obs) {
 
 }
 
+namespace { 
+    /// same smooth interpolation of the log-kappas for |x| < 0.5 as in ProcessNormalization and AsymPow
+    inline double asymmLogKappaForX(double x, double logKappaLo, double logKappaHi) {
+        if (fabs(x) >= 0.5) return (x >= 0 ? logKappaHi : -logKappaLo);
+        double logKhi =  logKappaHi;
+        double logKlo = -logKappaLo;
+        double avg = 0.5*(logKhi + logKlo), halfdiff = 0.5*(logKhi - logKlo);
+        double twox = x+x, twox2 = twox*twox;
+        double alpha = 0.125 * twox * (twox2 * (3*twox2 - 10.) + 15.);
+        return avg + alpha*halfdiff;
+    }
+}
+
+cacheutils::NormalizationBlock::NormalizationBlock(const std::vector<RooAbsReal *> &coeffs) 
+{
+    std::map<const RooAbsArg *, unsigned int> indices;
+    symBegin_.push_back(0);
+    for (unsigned int i = 0, n = coeffs.size(); i < n; ++i) {
+        const RooAbsReal *coeff = coeffs[i];
+        unsigned int ib = nominal_.size();
+        if (typeid(*coeff) == typeid(ProcessNormalization)) {
+            const ProcessNormalization *pn = static_cast<const ProcessNormalization *>(coeff);
+            for (int j = 0, nj = pn->thetaList().getSize(); j < nj; ++j) {
+                symTheta_.push_back(thetaIndex_(pn->thetaList().at(j), indices));
+                symLogKappa_.push_back(pn->logKappas()[j]);
+            }
+            for (int j = 0, nj = pn->asymmThetaList().getSize(); j < nj; ++j) {
+                AsymTerm term = { ib, thetaIndex_(pn->asymmThetaList().at(j), indices), pn->logAsymmKappas()[j].first, pn->logAsymmKappas()[j].second, 0, 0 };
+                asymTerms_.push_back(term);
+            }
+            nominal_.push_back(pn->nominalValue());
+            others_.push_back(std::vector<const RooAbsReal *>());
+            for (int j = 0, nj = pn->otherFactorList().getSize(); j < nj; ++j) {
+                others_.back().push_back(static_cast<const RooAbsReal *>(pn->otherFactorList().at(j)));
+            }
+        } else if (typeid(*coeff) == typeid(AsymPow)) {
+            const AsymPow *ap = static_cast<const AsymPow *>(coeff);
+            AsymTerm term = { ib, thetaIndex_(&ap->theta(), indices), 0., 0., &ap->kappaLow(), &ap->kappaHigh() };
+            asymTerms_.push_back(term);
+            nominal_.push_back(1.0);
+            others_.push_back(std::vector<const RooAbsReal *>());
+        } else {
+            index_.push_back(-1);
+            continue;
+        }
+        symBegin_.push_back(symTheta_.size());
+        index_.push_back(ib);
+    }
+    thetaVals_.resize(thetas_.size());
+    logs_.resize(nominal_.size());
+    values_.resize(nominal_.size());
+    work_.resize(nominal_.size());
+}
+
+unsigned int 
+cacheutils::NormalizationBlock::thetaIndex_(const RooAbsArg *theta, std::map<const RooAbsArg *, unsigned int> &indices) 
+{
+    std::map<const RooAbsArg *, unsigned int>::const_iterator match = indices.find(theta);
+    if (match != indices.end()) return match->second;
+    indices[theta] = thetas_.size();
+    thetas_.push_back(static_cast<const RooAbsReal *>(theta));
+    return thetas_.size()-1;
+}
+
+const std::vector<Double_t> & 
+cacheutils::NormalizationBlock::eval() const 
+{
+    // each nuisance is read once, even if it enters many processes
+    for (unsigned int t = 0, nt = thetas_.size(); t < nt; ++t) {
+        thetaVals_[t] = thetas_[t]->getVal();
+    }
+    for (unsigned int i = 0, n = nominal_.size(); i < n; ++i) {
+        double logVal = 0;
+        for (unsigned int k = symBegin_[i], end = symBegin_[i+1]; k < end; ++k) {
+            logVal += symLogKappa_[k] * thetaVals_[symTheta_[k]];
+        }
+        logs_[i] = logVal;
+    }
+    for (const AsymTerm &term : asymTerms_) {
+        double x = thetaVals_[term.theta];
+        double logKappaLo = term.kappaLo ? std::log(term.kappaLo->getVal()) : term.logKappaLo;
+        double logKappaHi = term.kappaHi ? std::log(term.kappaHi->getVal()) : term.logKappaHi;
+        logs_[term.coeff] += x * asymmLogKappaForX(x, logKappaLo, logKappaHi);
+    }
+    if (!logs_.empty()) vectorized::exponentials(logs_.size(), 1.0, 1.0, &logs_[0], &values_[0], &work_[0]);
+    for (unsigned int i = 0, n = nominal_.size(); i < n; ++i) {
+        double norm = nominal_[i] * values_[i];
+        for (const RooAbsReal *fact : others_[i]) norm *= fact->getVal();
+        values_[i] = norm;
+    }
+    return values_;
+}
+
+cacheutils::CoefficientProgram::CoefficientProgram(const std::vector<RooAbsReal *> &coeffs) :
+    coeffs_(coeffs),
+    fold_(!runtimedef::get("ADDNLL_COEFF_NOFOLD"))
+{
+    build_();
+}
+
+void
+cacheutils::CoefficientProgram::build_() const
+{
+    code_.clear(); leaves_.clear(); outputs_.clear(); regs_.clear(); frozen_.clear(); floating_.clear();
+    for (const RooAbsReal *coeff : coeffs_) outputs_.push_back(compile_(coeff));
+    nodes_.clear();
+    expanded_ = code_.size();
+    if (fold_) foldConstants_();
+    values_.resize(outputs_.size());
+}
+
+bool
+cacheutils::CoefficientProgram::upToDate_() const
+{
+    for (const std::pair<const RooRealVar *, double> &var : frozen_) {
+        if (!var.first->isConstant() || var.first->getVal() != var.second) return false;
+    }
+    for (const RooRealVar *var : floating_) {
+        if (var->isConstant()) return false;
+    }
+    return true;
+}
+
+bool
+cacheutils::CoefficientProgram::freeze_(const RooAbsReal *node) const
+{
+    if (const RooRealVar *var = dynamic_cast<const RooRealVar *>(node)) {
+        if (!var->isConstant()) return false;
+        frozen_.push_back(std::make_pair(var, var->getVal()));
+        return true;
+    }
+    // e.g. a RooFormulaVar of constant parameters
+    std::auto_ptr<RooArgSet> vars(node->getVariables());
+    std::vector<std::pair<const RooRealVar *, double> > found;
+    RooFIter iter = vars->fwdIterator();
+    for (RooAbsArg *a = iter.next(); a != 0; a = iter.next()) {
+        if (typeid(*a) == typeid(RooConstVar)) continue;
+        const RooRealVar *var = dynamic_cast<const RooRealVar *>(a);
+        if (var == 0 || !var->isConstant()) return false;
+        found.push_back(std::make_pair(var, var->getVal()));
+    }
+    frozen_.insert(frozen_.end(), found.begin(), found.end());
+    return true;
+}
+
+void
+cacheutils::CoefficientProgram::foldConstants_() const
+{
+    std::vector<char> isConst(regs_.size(), 1);
+    for (const std::pair<unsigned int, const RooAbsReal *> &leaf : leaves_) isConst[leaf.first] = 0;
+    std::vector<Instr> folded;
+    for (const Instr &ins : code_) {
+        bool constInputs = true, accumulates = false;
+        switch (ins.op) {
+            case Set:           break;
+            case Mul:           constInputs = isConst[ins.a] && isConst[ins.b]; break;
+            case MulConst:      
+            case Exp:           constInputs = isConst[ins.a]; break;
+            case AddMulConst:   
+            case AddAsymLog:    accumulates = true; constInputs = isConst[ins.out] && isConst[ins.a]; break;
+            case AddAsymLogVar: accumulates = true; constInputs = isConst[ins.out] && isConst[ins.a] && isConst[ins.b] && isConst[ins.c]; break;
+        }
+        if (constInputs) {
+            exec_(ins, &regs_[0]);
+            isConst[ins.out] = 1;
+            continue;
+        }
+        // the sum of the constant terms so far becomes the starting value of the register
+        if (accumulates && isConst[ins.out]) {
+            Instr set = { Set, ins.out, 0, 0, 0, regs_[ins.out], 0 };
+            folded.push_back(set);
+        }
+        folded.push_back(ins);
+        isConst[ins.out] = 0;
+    }
+    code_.swap(folded);
+}
+
+unsigned int 
+cacheutils::CoefficientProgram::compile_(const RooAbsReal *node) const
+{
+    std::map<const RooAbsArg *, unsigned int>::const_iterator match = nodes_.find(node);
+    if (match != nodes_.end()) return match->second;
+    unsigned int ret;
+    std::vector<unsigned int> factors;
+    if (typeid(*node) == typeid(RooConstVar)) {
+        ret = newReg_(node->getVal());
+    } else if (typeid(*node) == typeid(RooCheapProduct)) {
+        const RooCheapProduct *cp = static_cast<const RooCheapProduct *>(node);
+        RooFIter iter = cp->components().fwdIterator();
+        for (RooAbsArg *a = iter.next(); a != 0; a = iter.next()) factors.push_back(compile_(static_cast<const RooAbsReal *>(a)));
+        ret = product_(factors, cp->offset());
+    } else if (typeid(*node) == typeid(RooProduct)) {
+        RooArgList terms = utils::factors(*static_cast<const RooProduct *>(node));
+        RooFIter iter = terms.fwdIterator();
+        for (RooAbsArg *a = iter.next(); a != 0; a = iter.next()) factors.push_back(compile_(static_cast<const RooAbsReal *>(a)));
+        ret = product_(factors, 1.0);
+    } else if (typeid(*node) == typeid(ProcessNormalization)) {
+        const ProcessNormalization *pn = static_cast<const ProcessNormalization *>(node);
+        if (pn->thetaList().getSize() || pn->asymmThetaList().getSize()) {
+            unsigned int logReg = newReg_();
+            emit_(Set, logReg, 0);
+            for (int j = 0, nj = pn->thetaList().getSize(); j < nj; ++j) {
+                emit_(AddMulConst, logReg, compile_(static_cast<const RooAbsReal *>(pn->thetaList().at(j))), 0, 0, pn->logKappas()[j]);
+            }
+            for (int j = 0, nj = pn->asymmThetaList().getSize(); j < nj; ++j) {
+                emit_(AddAsymLog, logReg, compile_(static_cast<const RooAbsReal *>(pn->asymmThetaList().at(j))), 0, 0, pn->logAsymmKappas()[j].first, pn->logAsymmKappas()[j].second);
+            }
+            emit_(Exp, logReg, logReg);
+            factors.push_back(logReg);
+        }
+        for (int j = 0, nj = pn->otherFactorList().getSize(); j < nj; ++j) {
+            factors.push_back(compile_(static_cast<const RooAbsReal *>(pn->otherFactorList().at(j))));
+        }
+        ret = product_(factors, pn->nominalValue());
+    } else if (typeid(*node) == typeid(AsymPow)) {
+        const AsymPow *ap = static_cast<const AsymPow *>(node);
+        unsigned int theta = compile_(&ap->theta());
+        ret = newReg_();
+        emit_(Set, ret, 0);
+        if (typeid(ap->kappaLow()) == typeid(RooConstVar) && typeid(ap->kappaHigh()) == typeid(RooConstVar)) {
+            emit_(AddAsymLog, ret, theta, 0, 0, std::log(ap->kappaLow().getVal()), std::log(ap->kappaHigh().getVal()));
+        } else {
+            emit_(AddAsymLogVar, ret, theta, compile_(&ap->kappaLow()), compile_(&ap->kappaHigh()));
+        }
+        emit_(Exp, ret, ret);
+    } else if (fold_ && freeze_(node)) {
+        ret = newReg_(node->getVal());
+    } else {
+        // RooRealVar, or a node we can't expand (e.g. RooFormulaVar): read it as it is
+        ret = newReg_();
+        leaves_.push_back(std::make_pair(ret, node));
+        if (fold_ && typeid(*node) == typeid(RooRealVar)) floating_.push_back(static_cast<const RooRealVar *>(node));
+    }
+    nodes_[node] = ret;
+    return ret;
+}
+
+unsigned int 
+cacheutils::CoefficientProgram::product_(const std::vector<unsigned int> &factors, double constant) const
+{
+    if (factors.empty()) return newReg_(constant);
+    if (factors.size() == 1 && constant == 1.0) return factors.front();
+    unsigned int ret = newReg_();
+    emit_(MulConst, ret, factors.front(), 0, 0, constant);
+    for (unsigned int i = 1, n = factors.size(); i < n; ++i) emit_(Mul, ret, ret, factors[i]);
+    return ret;
+}
+
+inline void
+cacheutils::CoefficientProgram::exec_(const Instr &ins, Double_t *regs)
+{
+    switch (ins.op) {
+        case Set:         regs[ins.out] = ins.k1; break;
+        case Mul:         regs[ins.out] = regs[ins.a] * regs[ins.b]; break;
+        case MulConst:    regs[ins.out] = ins.k1 * regs[ins.a]; break;
+        case AddMulConst: regs[ins.out] += ins.k1 * regs[ins.a]; break;
+        case AddAsymLog:  
+            regs[ins.out] += regs[ins.a] * asymmLogKappaForX(regs[ins.a], ins.k1, ins.k2); 
+            break;
+        case AddAsymLogVar:  
+            regs[ins.out] += regs[ins.a] * asymmLogKappaForX(regs[ins.a], std::log(regs[ins.b]), std::log(regs[ins.c])); 
+            break;
+        case Exp:         regs[ins.out] = std::exp(regs[ins.a]); break;
+    }
+}
+
+const std::vector<Double_t> & 
+cacheutils::CoefficientProgram::eval() const 
+{
+    if (fold_ && !upToDate_()) build_();
+    Double_t *regs = &regs_[0];
+    for (const std::pair<unsigned int, const RooAbsReal *> &leaf : leaves_) regs[leaf.first] = leaf.second->getVal();
+    for (const Instr &ins : code_) exec_(ins, regs);
+    for (unsigned int i = 0, n = outputs_.size(); i < n; ++i) values_[i] = regs[outputs_[i]];
+    return values_;
+}
+
+namespace {
+    bool isLeafValue(const RooAbsReal &x) { return dynamic_cast<const RooRealVar *>(&x) != 0 || dynamic_cast<const RooConstVar *>(&x) != 0; }
+}
+
+cacheutils::ConstraintBlock::ConstraintBlock(const std::vector<SimpleGaussianConstraint *> &gaussians, const std::vector<SimplePoissonConstraint *> &poissons) :
+    gaussIn_(gaussians.size(), 0), poisIn_(poissons.size(), 0)
+{
+    for (unsigned int i = 0, n = gaussians.size(); i < n; ++i) {
+        const SimpleGaussianConstraint *pdf = gaussians[i];
+        if (!isLeafValue(pdf->getX()) || !isLeafValue(pdf->getMean())) continue;
+        gaussX_.push_back(&pdf->getX()); gaussMean_.push_back(&pdf->getMean());
+        gaussScale_.push_back(pdf->getScale());
+        gaussIndex_.push_back(i); gaussIn_[i] = 1;
+    }
+    for (unsigned int i = 0, n = poissons.size(); i < n; ++i) {
+        const SimplePoissonConstraint *pdf = poissons[i];
+        if (!isLeafValue(pdf->getX()) || !isLeafValue(pdf->getMean())) continue;
+        poisX_.push_back(&pdf->getX()); poisMean_.push_back(&pdf->getMean());
+        poisLogGamma_.push_back(pdf->getLogGamma());
+        poisIndex_.push_back(i); poisIn_[i] = 1;
+    }
+    gaussZero_.assign(gaussX_.size(), 0.0);
+    poisZero_.assign(poisX_.size(), 0.0);
+    xVals_.resize(size()); meanVals_.resize(size()); values_.resize(size());
+}
+
+void
+cacheutils::ConstraintBlock::setZeroPoints(const std::vector<double> &gaussians, const std::vector<double> &poissons) 
+{
+    for (unsigned int i = 0, n = gaussIndex_.size(); i < n; ++i) gaussZero_[i] = gaussians[gaussIndex_[i]];
+    for (unsigned int i = 0, n = poisIndex_.size(); i < n; ++i) poisZero_[i] = poissons[poisIndex_[i]];
+}
+
+double 
+cacheutils::ConstraintBlock::eval() const 
+{
+    const unsigned int ng = gaussX_.size(), np = poisX_.size();
+    Double_t *x = xVals_.data(), *mean = meanVals_.data(), *vals = values_.data();
+    for (unsigned int i = 0; i < ng; ++i) { x[i] = gaussX_[i]->getVal(); mean[i] = gaussMean_[i]->getVal(); }
+    for (unsigned int i = 0; i < np; ++i) { x[ng+i] = poisX_[i]->getVal(); mean[ng+i] = poisMean_[i]->getVal(); }
+    // same as SimpleGaussianConstraint::getLogValFast and SimplePoissonConstraint::getLogValFast, plus the zero points
+    const double *scale = gaussScale_.data(), *gzero = gaussZero_.data();
+    for (unsigned int i = 0; i < ng; ++i) {
+        double arg = x[i] - mean[i];
+        vals[i] = scale[i]*arg*arg + gzero[i];
+    }
+    for (unsigned int i = 0; i < np; ++i) {
+        double observed = x[ng+i], expected = mean[ng+i], value;
+        if (std::abs(observed) < 1e-10) {
+            value = (std::abs(expected) < 1e-10) ? 0 : -1*expected;
+        } else if (observed < 1000000) {
+            value = - ( - observed * log(expected) + expected + poisLogGamma_[i] );
+        } else {
+            double diff = observed - expected;
+            value = log(expected)/2 - (diff*diff)/(2*expected);
+        }
+        vals[ng+i] = value + poisZero_[i];
+    }
+    return sumDefault(values_);
+}
+
+void
+cacheutils::CachingAddNLL::setupCostReport_() const
+{
+    costChannel_ = &CostReport::get(GetName(), "");
+    costPdfs_.clear();
+    for (const CachingPdfBase &pdf : pdfs_) {
+        // the generic CachingPdf is labelled with the RooFit class it falls back to, since those are the ones to look at
+        std::string name = demangledName(typeid(pdf));
+        if (typeid(pdf) == typeid(CachingPdf)) name += std::string("<") + pdf.pdf()->ClassName() + ">";
+        costPdfs_.push_back(&CostReport::get(GetName(), name));
+    }
+}
+
 void
 cacheutils::CachingAddNLL::setup_() 
 {
     fastExit_ = !runtimedef::get("NO_ADDNLL_FASTEXIT");
+    fused_ = runtimedef::get("ADDNLL_FUSED");
+    gradDepsCache_.clear();
+    costChannel_ = 0; costPdfs_.clear();
+    offload_.reset(); offloadState_ = 0;
+    kernel_.reset(); kernelState_ = 0;
     for (int i = 0, n = integrals_.size(); i < n; ++i) delete integrals_[i];
     integrals_.clear(); pdfs_.clear(); coeffs_.clear(); prods_.clear();
     RooAddPdf *addpdf = 0;
@@ -495,6 +1309,7 @@ cacheutils::CachingAddNLL::setup_()
         const RooArgSet *obs = data_->get();
         isRooRealSum_ = true;  basicIntegrals_ = canBasicIntegrals_;
         int npdf = sumpdf->coefList().getSize();
+        badBasicIntegral_.assign(npdf, 0);
         coeffs_.reserve(npdf);
         pdfs_.reserve(npdf);
         integrals_.reserve(npdf);
@@ -551,13 +1366,75 @@ cacheutils::CachingAddNLL::setup_()
             multiPdfs_.push_back(std::make_pair(mpdf, &*itp));
         }
     }
- 
+
+    normBlock_.reset(); coeffProgram_.reset();
+    if (runtimedef::get("ADDNLL_COEFF_PROGRAM")) {
+        coeffProgram_.reset(new CoefficientProgram(coeffs_));
+        // nothing to gain if all the coefficients are leaves
+        if (coeffProgram_->size() == 0) coeffProgram_.reset();
+    }
+    if (coeffProgram_.get() == 0 && runtimedef::get("ADDNLL_NORMBLOCK")) {
+        normBlock_.reset(new NormalizationBlock(coeffs_));
+        // not worth it for a single process
+        if (normBlock_->size() < 2) normBlock_.reset();
+    }
+
+    setupMCStat_();
+}
+
+void
+cacheutils::CachingAddNLL::setupMCStat_() 
+{
+    mcStatRelErr_.clear(); mcStatScale_.clear(); mcStatWidths_.clear();
+    if (runtimedef::get("ADDNLL_NO_MCSTAT_LITE")) return;
+    bool any = false;
+    std::vector<std::vector<Double_t> > relErr(pdfs_.size());
+    for (unsigned int ip = 0, np = pdfs_.size(); ip < np; ++ip) {
+        const char *attr = pdfs_[ip].pdf()->getStringAttribute("mcStatRelErrors");
+        for (const char *ptr = attr; ptr && *ptr; ) {
+            char *end; 
+            relErr[ip].push_back(strtod(ptr, &end));
+            if (end == ptr) break;
+            ptr = (*end == ',' ? end + 1 : end);
+        }
+        if (!relErr[ip].empty()) any = true;
+    }
+    if (!any) return;
+    const RooArgSet *obs = data_->get();
+    if (obs->getSize() != 1 || dynamic_cast<RooRealVar *>(obs->first()) == 0) {
+        std::cerr << "WARNING: MC statistical uncertainties of channel " << pdf_->GetName() << " ignored, since they are supported only for one observable" << std::endl;
+        return;
+    }
+    mcStatRelErr_.swap(relErr);
+    // all bins are needed, also the empty ones, and the partial sums must be computed in full before reducing it
+    fused_ = false;
+    setIncludeZeroWeights(true);
+    setData(*data_);
+}
+
+double
+cacheutils::CachingAddNLL::mcStatNll_() const 
+{
+    // each bin expectation nu gets a factor beta constrained by a gaussian of width tau = sigma/nu around 1, so its nll is
+    //      nu*(beta-1) - n*log(beta) + (beta-1)^2/(2 tau^2)
+    // and the minimum is at the positive root of beta^2 + (nu tau^2 - 1) beta - n tau^2 = 0
+    double ret = 0;
+    const Double_t *partialSum = scratch_[PartialSum], *mcStatVar = scratch_[MCStatVar];
+    for (unsigned int i = 0, n = weights_.size(); i < n; ++i) {
+        double nu = partialSum[i] * mcStatWidths_[i], var = mcStatVar[i];
+        if (!(nu > 0) || !(var > 0)) continue;
+        double tau2 = var/(nu*nu), obs = weights_[i], b = 1 - nu*tau2, root = std::sqrt(b*b + 4*obs*tau2);
+        double beta = (b >= 0 ? 0.5*(b + root) : (root - b > 0 ? 2*obs*tau2/(root - b) : 0)); // avoid cancellations for b < 0
+        ret += nu*(beta - 1) + 0.5*(beta - 1)*(beta - 1)/tau2;
+        if (obs != 0) ret -= obs*std::log(beta);
+    }
+    return ret;
 }
 
 void
 cacheutils::CachingAddNLL::setIncludeZeroWeights(bool includeZeroWeights) 
 {
-    includeZeroWeights_ = includeZeroWeights;
+    includeZeroWeights_ = includeZeroWeights || !mcStatRelErr_.empty();
     for (CachingPdfBase &pdf : pdfs_) {
         pdf.setIncludeZeroWeights(includeZeroWeights_);
     }
@@ -569,48 +1446,82 @@ cacheutils::CachingAddNLL::evaluate() const
 #ifdef DEBUG_CACHE
     PerfCounter::add("CachingAddNLL::evaluate called");
 #endif
+    ScopedTimer timer(GetName());
+    static bool costReport = runtimedef::get("ADDNLL_COST_REPORT");
+    if (costReport && costChannel_ == 0) setupCostReport_();
+    CostReport::Scope costScope(costChannel_, weights_.size());
 
     // For multi pdf's need to reset the cache if index changed before evaluations
-    // unless they're being properly treated in the CachingPdf
+    // unless they're being properly treated by a CachingMultiPdf
     static bool multiNll  = runtimedef::get("ADDNLL_MULTINLL");
-    if (!multiNll && !multiPdfs_.empty()) {
+    static bool multiPersist  = !runtimedef::get("ADDNLL_MULTIPDF_NOPERSIST");
+    if (!multiNll && !multiPersist && !multiPdfs_.empty()) {
         for (std::vector<std::pair<const RooMultiPdf*,CachingPdfBase*> >::iterator itp = multiPdfs_.begin(), edp = multiPdfs_.end(); itp != edp; ++itp) {
 		bool hasChangedPdf = itp->first->checkIndexDirty();
 		if (hasChangedPdf) itp->second->setDataDirty();
         }
     }
 
-    std::fill( partialSum_.begin(), partialSum_.end(), 0.0 );
+    static bool offload = runtimedef::get("ADDNLL_OFFLOAD");
+    if (offload && offloadState_ == 0) setupOffload_();
+    if (offloadState_ > 0) {
+        double ret;
+        if (evaluateOffload_(ret)) return ret;
+        // otherwise go on here, with the same protections and warnings as without the backend
+    }
+    static bool kernels = runtimedef::get("ADDNLL_KERNELS");
+    if (kernels && kernelState_ == 0 && offloadState_ <= 0) setupKernel_();
+    if (kernelState_ > 0) {
+        double ret;
+        if (evaluateKernel_(ret)) return ret;
+    }
+
+    unsigned int nEntries = weights_.size();
+    Double_t *partialSum = scratch_[PartialSum], *workingArea = scratch_[WorkingArea];
+    Double_t *mcStatVar = mcStatWidths_.empty() ? 0 : scratch_[MCStatVar];
+    // Simpson's rule combines the sums at different entries before the logs, so it can't reduce block by block
+    bool fused = fused_ && fineCounts_.empty();
+    if (!fused) std::fill( partialSum, partialSum + nEntries, 0.0 );
+    else { fusedCoeffs_.clear(); fusedVals_.clear(); }
+    if (mcStatVar) std::fill( mcStatVar, mcStatVar + nEntries, 0.0 );
 
     std::vector<RooAbsReal*>::iterator  itc = coeffs_.begin(), edc = coeffs_.end();
     boost::ptr_vector<CachingPdfBase>::iterator   itp = pdfs_.begin();//,   edp = pdfs_.end();
     std::vector<Double_t>::const_iterator itw, bgw = weights_.begin();//,    edw = weights_.end();
-    std::vector<Double_t>::iterator       its, bgs = partialSum_.begin(), eds = partialSum_.end();
     double sumCoeff = 0;
-    bool allBasicIntegralsOk = (basicIntegrals_ == 1);
+    const std::vector<Double_t> *blockCoeffs = normBlock_.get() ? &normBlock_->eval() : 0;
+    const std::vector<Double_t> *progCoeffs = coeffProgram_.get() ? &coeffProgram_->eval() : 0;
     //std::cout << "Performing evaluation of " << GetName() << std::endl;
     for ( ; itc != edc; ++itp, ++itc ) {
         // get coefficient
-        Double_t coeff = (*itc)->getVal();
-        if (isRooRealSum_ && basicIntegrals_ < 2) {
+        int iblock = blockCoeffs ? normBlock_->index(itc - coeffs_.begin()) : -1;
+        Double_t coeff = progCoeffs ? (*progCoeffs)[itc - coeffs_.begin()] : (iblock >= 0 ? (*blockCoeffs)[iblock] : (*itc)->getVal());
+        unsigned int ipdf = itc - coeffs_.begin();
+        bool basicIntegral = basicIntegrals_ && !badBasicIntegral_[ipdf];
+        if (isRooRealSum_ && (basicIntegrals_ < 2 || !basicIntegral)) {
             sumCoeff += coeff * integrals_[itc - coeffs_.begin()]->getVal();
             //std::cout << "  coefficient = " << coeff << ", integral = " << integrals_[itc - coeffs_.begin()]->getVal() << std::endl;
         } else {
             sumCoeff += coeff;
         }
         // get vals
-        const std::vector<Double_t> &pdfvals = itp->eval(*data_);
-        if (basicIntegrals_) {
+        const std::vector<Double_t> *pdfvalsp;
+        {
+            ScopedTimer pdfTimer(typeid(*itp));
+            CostReport::Scope pdfCostScope(costChannel_ ? costPdfs_[itp - pdfs_.begin()] : 0, weights_.size());
+            pdfvalsp = &itp->eval(*data_);
+        }
+        const std::vector<Double_t> &pdfvals = *pdfvalsp;
+        if (basicIntegral) {
             double integral = (binWidths_.size() > 1) ? 
                                     vectorized::dot_product(pdfvals.size(), &pdfvals[0], &binWidths_[0]) :
-                                    binWidths_.front() * sumDefault(pdfvals);
+                                    binWidths_.front() * vectorized::sum(pdfvals.size(), &pdfvals[0]);
             if (basicIntegrals_ == 1) {
                 double refintegral = integrals_[itc - coeffs_.begin()]->getVal();
                 if (refintegral > 0) {
                     if (std::abs((integral - refintegral)/refintegral) > 1e-5) {
-                        printf("integrals don't match: %+10.6f  %+10.6f  %10.7f %s\n", refintegral, integral, refintegral ? std::abs((integral - refintegral)/refintegral) : 0,  itp->pdf()->GetName());
-                        allBasicIntegralsOk = false;
-                        basicIntegrals_ = 0; // don't waste time on this anymore
+                        printf("integrals don't match: %+10.6f  %+10.6f  %10.7f %s (will use the RooFit integral for it)\n", refintegral, integral, refintegral ? std::abs((integral - refintegral)/refintegral) : 0,  itp->pdf()->GetName());
+                        badBasicIntegral_[ipdf] = 1; // only this process keeps its RooFit integral
                     }
                 }
             } else {
@@ -630,55 +1541,72 @@ cacheutils::CachingAddNLL::evaluate() const
         //         *its += coeff * (*itv); // sum (n_i * pdf_i)
         //    }
         // vectorize to make it faster
-        vectorized::mul_add(pdfvals.size(), coeff, &pdfvals[0], &partialSum_[0]);
+        if (fused) { 
+            // just collect them, the sum is done below block by block
+            fusedCoeffs_.push_back(coeff); fusedVals_.push_back(&pdfvals[0]);
+        } else {
+            vectorized::mul_add(pdfvals.size(), coeff, &pdfvals[0], partialSum);
+        }
+        const std::vector<Double_t> *mcStatScale = mcStatWidths_.empty() ? 0 : &mcStatScale_[itc - coeffs_.begin()];
+        if (mcStatScale && !mcStatScale->empty()) {
+            // MC statistical uncertainty of this process, summed in quadrature with the others
+            for (unsigned int i = 0, n = pdfvals.size(); i < n; ++i) {
+                double sigma = coeff * pdfvals[i] * (*mcStatScale)[i];
+                mcStatVar[i] += sigma*sigma;
+            }
+        }
     }
-    // if all basic integrals evaluated ok, use them
-    if (allBasicIntegralsOk) basicIntegrals_ = 2;
+    // from now on use the basic integrals of the processes for which they matched the RooFit ones
+    if (basicIntegrals_ == 1) basicIntegrals_ = 2;
     // then get the final nll
-    static bool gentleNegativePenalty_ = runtimedef::get("GENTLE_LEE");
     double ret = constantZeroPoint_;
-    for (its = bgs; its != eds ; ++its) {
-        if (!isnormal(*its) || *its <= 0) {
-            if ((weights_[its-bgs] == 0) && (*its == 0)) {
-                // this special case we don't care, as zero is fine and it will be multiplied by zero afterwards,
-                // we just need to protect it for the logarithm
-                *its = 1.0; // arbitrary number, to avoid log(0)
-                continue;
-            } else if (weights_[its-bgs] == 0) {
-                // this is a special case we should in principle care, even if it does not alter the likelihood
-                // since it's multiplied by zero. However, normally RooFit ignores errors in zero-weight bins,
-                // so we comply to his policy (but we issue a warning, and we protect the logarithm)
-                static int nwarn = 0;
-                if (++nwarn < 100) {
-                    std::cout << "WARNING: underflow to " << *its << " in " << pdf_->GetName() << " for zero-entry bin " << its-bgs << std::endl;
-                }
-                *its = 1.0; // arbitrary number, to avoid bad logs
-                continue;
-            }
-            if (gentleNegativePenalty_ && abs(weights_[its-bgs]) < 1e-2) {
-                std::cout << "WARNING: gentle underflow to " << *its << " in " << pdf_->GetName() << " for bin " << its-bgs << ", weight " << weights_[its-bgs] << std::endl; 
-                *its = 1.0; // skip the log
-                ret -= 25;  // add a penalty (negative since we flip 'ret' afterwards)
-                continue;
+    if (!fineCounts_.empty()) {
+        // average of each fine bin from the centre (first entries) and the edges (the others)
+        unsigned int nbins = fineCounts_.size();
+        for (unsigned int b = 0; b < nbins; ++b) {
+            partialSum[b] = (4*partialSum[b] + partialSum[nbins+b] + partialSum[nbins+b+1])/6.0;
+        }
+        if (!checkPartialSum_(0, nbins, ret)) return 9e9;
+        ret -= vectorized::nll_reduce(nbins, partialSum, &fineCounts_[0], sumCoeff, workingArea);
+    } else if (fused) {
+        // process a block of bins at a time, so that the partial sums are still in cache 
+        // when they are checked and reduced, instead of making a full pass over memory for each process
+        enum { BlockSize = 512 };
+        DefaultAccumulator reduced = 0;
+        for (unsigned int begin = 0, n = nEntries; begin < n; begin += BlockSize) {
+            unsigned int end = std::min<unsigned int>(begin + BlockSize, n), size = end - begin;
+            std::fill(partialSum + begin, partialSum + end, 0.0);
+            for (unsigned int ip = 0, np = fusedCoeffs_.size(); ip < np; ++ip) {
+                vectorized::mul_add(size, fusedCoeffs_[ip], fusedVals_[ip] + begin, partialSum + begin);
             }
-            std::cout << "WARNING: underflow to " << *its << " in " << pdf_->GetName() << " for bin " << its-bgs << ", weight " << weights_[its-bgs] << std::endl; 
-            if (!CachingSimNLL::noDeepLEE_) logEvalError("Number of events is negative or error"); else CachingSimNLL::hasError_ = true;
-            if (fastExit_) { std::cout << "FASTEXIT from " << pdf_->GetName() << std::endl; return 9e9; }
-            else *its = 1;
+            if (!checkPartialSum_(begin, end, ret)) return 9e9;
+            reduced += vectorized::nll_reduce(size, partialSum + begin, &weights_[begin], sumCoeff, workingArea + begin);
         }
+        ret -= reduced.sum();
+    } else {
+        // the analytic minimization of the MC statistical nuisances needs the expectations before they are protected for the logs
+        if (!mcStatWidths_.empty()) ret += mcStatNll_();
+        if (!checkPartialSum_(0, nEntries, ret)) return 9e9;
+        // Do the reduction 
+        //      for ( its = bgs, itw = bgw ; its != eds ; ++its, ++itw ) {
+        //         ret -= (*itw) * log( ((*its) / sumCoeff) );
+        //      }
+        ret -= vectorized::nll_reduce(nEntries, partialSum, &weights_[0], sumCoeff, workingArea);
     }
-    // Do the reduction 
-    //      for ( its = bgs, itw = bgw ; its != eds ; ++its, ++itw ) {
-    //         ret -= (*itw) * log( ((*its) / sumCoeff) );
-    //      }
-    ret -= vectorized::nll_reduce(partialSum_.size(), &partialSum_[0], &weights_[0], sumCoeff, &workingArea_[0]);
+    return finishNll_(ret, sumCoeff);
+}
+
+double
+cacheutils::CachingAddNLL::finishNll_(double ret, double sumCoeff) const 
+{
     // std::cout << "AddNLL for " << pdf_->GetName() << ": " << ret << std::endl;
     // and add extended term: expected - observed*log(expected);
     static bool expEventsNoNorm = runtimedef::get("ADDNLL_ROOREALSUM_NONORM");
-    double expectedEvents = (isRooRealSum_ && !expEventsNoNorm ? pdf_->getNorm(data_->get()) : sumCoeff);
+    // once the basic integrals are checked, sumCoeff is the same as the normalization of the RooRealSumPdf
+    double expectedEvents = (isRooRealSum_ && !expEventsNoNorm && basicIntegrals_ != 2 ? pdf_->getNorm(data_->get()) : sumCoeff);
     if (expectedEvents <= 0) {
-        std::cout << "WARNING: underflow in total event yield for " << pdf_->GetName() << ", expected yield = " << expectedEvents << " (observed: " << sumWeights_ << ")" << std::endl;
-        if (!CachingSimNLL::noDeepLEE_) logEvalError("Expected number of events is negative"); else CachingSimNLL::hasError_ = true;
+        CMB_LOG(logging::Warning, "WARNING: underflow in total event yield for " << pdf_->GetName() << ", expected yield = " << expectedEvents << " (observed: " << sumWeights_ << ")");
+        if (!CachingSimNLL::noDeepLEE_) { std::lock_guard<std::mutex> lock(logEvalErrorMutex_); logEvalError("Expected number of events is negative"); } else CachingSimNLL::hasError_ = true;
         expectedEvents = 1e-6;
     }
     // I can add any arbitrary constant that does not depend on the expected events,
@@ -702,6 +1630,208 @@ cacheutils::CachingAddNLL::evaluate() const
     return ret;
 }
 
+bool
+cacheutils::CachingAddNLL::packablePdfs_(std::vector<const FastVerticalInterpHistPdf2 *> &hpdfs) const 
+{
+    // only RooAddPdf channels of FastVerticalInterpHistPdf2, without the other terms computed from the per-entry sums
+    if (isRooRealSum_ || !multiPdfs_.empty() || !mcStatRelErr_.empty() || !fineCounts_.empty() || weights_.empty()) return false;
+    hpdfs.clear();
+    for (const CachingPdfBase &pdf : pdfs_) {
+        if (typeid(*pdf.pdf()) != typeid(FastVerticalInterpHistPdf2)) return false;
+        hpdfs.push_back(static_cast<const FastVerticalInterpHistPdf2 *>(pdf.pdf()));
+    }
+    return true;
+}
+
+void
+cacheutils::CachingAddNLL::setupOffload_() const 
+{
+    offloadState_ = -1;
+    std::vector<const FastVerticalInterpHistPdf2 *> hpdfs;
+    if (!packablePdfs_(hpdfs)) return;
+    offload_.reset(BinnedOffload::create(hpdfs, *data_, includeZeroWeights_, weights_));
+    if (offload_.get() == 0) return;
+    // check against the evaluation here, at the current point
+    offloadState_ = +1;
+    double offloaded, ref;
+    bool ok = evaluateOffload_(offloaded);
+    offloadState_ = -1;
+    ref = evaluate();
+    if (!ok || std::abs(offloaded - ref) > 1e-9 * std::max(1.0, std::abs(ref))) {
+        std::cout << "WARNING: " << pdf_->GetName() << ": NLL from the offload backend " << BinnedOffload::backendName() << " " << (ok ? "differs" : "failed") 
+                  << " (" << offloaded << " vs " << ref << "), will not use it." << std::endl;
+        offload_.reset();
+        return;
+    }
+    offloadState_ = +1;
+}
+
+double
+cacheutils::CachingAddNLL::packedCoeffs_() const 
+{
+    const std::vector<Double_t> *blockCoeffs = normBlock_.get() ? &normBlock_->eval() : 0;
+    const std::vector<Double_t> *progCoeffs = coeffProgram_.get() ? &coeffProgram_->eval() : 0;
+    offloadCoeffs_.resize(coeffs_.size());
+    double sumCoeff = 0;
+    for (unsigned int ip = 0, np = coeffs_.size(); ip < np; ++ip) {
+        int iblock = blockCoeffs ? normBlock_->index(ip) : -1;
+        offloadCoeffs_[ip] = progCoeffs ? (*progCoeffs)[ip] : (iblock >= 0 ? (*blockCoeffs)[iblock] : coeffs_[ip]->getVal());
+        sumCoeff += offloadCoeffs_[ip];
+    }
+    return sumCoeff;
+}
+
+bool
+cacheutils::CachingAddNLL::evaluateOffload_(double &ret) const 
+{
+    double sumCoeff = packedCoeffs_(), nll;
+    if (!offload_->evaluate(&offloadCoeffs_[0], sumCoeff, nll)) return false;
+    ret = finishNll_(constantZeroPoint_ - nll, sumCoeff);
+    return true;
+}
+
+void
+cacheutils::CachingAddNLL::setupKernel_() const 
+{
+    kernelState_ = -1;
+    std::vector<const FastVerticalInterpHistPdf2 *> hpdfs;
+    if (!packablePdfs_(hpdfs)) return;
+    kernel_.reset(ChannelKernel::create(hpdfs, *data_, includeZeroWeights_, weights_));
+    if (kernel_.get() == 0) return;
+    // check against the evaluation here, at the current point
+    kernelState_ = +1;
+    double fast, ref;
+    bool ok = evaluateKernel_(fast);
+    kernelState_ = -1;
+    ref = evaluate();
+    if (!ok || std::abs(fast - ref) > 1e-9 * std::max(1.0, std::abs(ref))) {
+        std::cout << "WARNING: " << pdf_->GetName() << ": NLL from the kernel for " << hpdfs.size() << " processes " << (ok ? "differs" : "failed") 
+                  << " (" << fast << " vs " << ref << "), will not use it." << std::endl;
+        kernel_.reset();
+        return;
+    }
+    kernelState_ = +1;
+}
+
+bool
+cacheutils::CachingAddNLL::evaluateKernel_(double &ret) const 
+{
+    double sumCoeff = packedCoeffs_(), nll;
+    if (!kernel_->evaluate(&offloadCoeffs_[0], sumCoeff, nll)) return false;
+    ret = finishNll_(constantZeroPoint_ - nll, sumCoeff);
+    return true;
+}
+
+bool
+cacheutils::CachingAddNLL::checkPartialSum_(unsigned int begin, unsigned int end, double &ret) const 
+{
+    static bool gentleNegativePenalty_ = runtimedef::get("GENTLE_LEE");
+    Double_t *its, *bgs = scratch_[PartialSum], *eds = bgs + end;
+    for (its = bgs + begin; its != eds ; ++its) {
+        if (!isnormal(*its) || *its <= 0) {
+            if ((weights_[its-bgs] == 0) && (*its == 0)) {
+                // this special case we don't care, as zero is fine and it will be multiplied by zero afterwards,
+                // we just need to protect it for the logarithm
+                *its = 1.0; // arbitrary number, to avoid log(0)
+                continue;
+            } else if (weights_[its-bgs] == 0) {
+                // this is a special case we should in principle care, even if it does not alter the likelihood
+                // since it's multiplied by zero. However, normally RooFit ignores errors in zero-weight bins,
+                // so we comply to his policy (but we issue a warning, and we protect the logarithm)
+                static int nwarn = 0;
+                if (++nwarn < 100) {
+                    CMB_LOG(logging::Warning, "WARNING: underflow to " << *its << " in " << pdf_->GetName() << " for zero-entry bin " << its-bgs);
+                }
+                *its = 1.0; // arbitrary number, to avoid bad logs
+                continue;
+            }
+            if (gentleNegativePenalty_ && abs(weights_[its-bgs]) < 1e-2) {
+                CMB_LOG(logging::Warning, "WARNING: gentle underflow to " << *its << " in " << pdf_->GetName() << " for bin " << its-bgs << ", weight " << weights_[its-bgs]);
+                *its = 1.0; // skip the log
+                ret -= 25;  // add a penalty (negative since we flip 'ret' afterwards)
+                continue;
+            }
+            CMB_LOG(logging::Warning, "WARNING: underflow to " << *its << " in " << pdf_->GetName() << " for bin " << its-bgs << ", weight " << weights_[its-bgs]);
+            if (!CachingSimNLL::noDeepLEE_) { std::lock_guard<std::mutex> lock(logEvalErrorMutex_); logEvalError("Number of events is negative or error"); } else CachingSimNLL::hasError_ = true;
+            if (fastExit_) { std::cout << "FASTEXIT from " << pdf_->GetName() << std::endl; return false; }
+            else *its = 1;
+        }
+    }
+    return true;
+}
+
+const cacheutils::CachingAddNLL::GradDeps &
+cacheutils::CachingAddNLL::gradDeps_(const RooRealVar &param) const 
+{
+    std::map<const RooAbsArg *, GradDeps>::const_iterator match = gradDepsCache_.find(&param);
+    if (match != gradDepsCache_.end()) return match->second;
+    GradDeps &deps = gradDepsCache_[&param];
+    for (unsigned int ip = 0, np = coeffs_.size(); ip < np; ++ip) {
+        if (coeffs_[ip] == &param || coeffs_[ip]->dependsOnValue(param)) deps.coeffs.push_back(ip);
+        if (pdfs_[ip].pdf()->dependsOnValue(param)) deps.pdfs.push_back(ip);
+    }
+    return deps;
+}
+
+double
+cacheutils::CachingAddNLL::numericDerivative_(RooRealVar &param) const 
+{
+    return numericDerivative(param, [this]() { return evaluate(); });
+}
+
+void
+cacheutils::CachingAddNLL::addGradient(const std::vector<RooRealVar *> &params, const std::vector<unsigned int> &which, double *grad) const 
+{
+    // For a RooAddPdf 
+    //      nll = sumCoeff - sum_i w_i log(S_i) + const,    with S_i = sum_p coeff_p * pdf_p(x_i)
+    // so the derivative is
+    //      d(nll) = sum_p d(coeff_p) - sum_i w_i (sum_p d(coeff_p) * pdf_p(x_i) + coeff_p * d(pdf_p(x_i))) / S_i
+    // For RooRealSumPdf, multipdfs, MC statistical nuisances, Simpson's rule or in case of underflows we just do finite differences on this channel. 
+    bool analytic = !isRooRealSum_ && multiPdfs_.empty() && mcStatWidths_.empty() && fineCounts_.empty();
+    unsigned int nEntries = weights_.size();
+    if (analytic && scratch_.arrays() <= GradWork) scratch_.resize(nEntries, GradWork+1);
+    Double_t *gradSum = scratch_[GradSum], *gradWork = scratch_[GradWork];
+    if (analytic) {
+        std::fill(gradSum, gradSum + nEntries, 0.0);
+        for (unsigned int ip = 0, np = coeffs_.size(); ip < np; ++ip) {
+            const std::vector<Double_t> &pdfvals = pdfs_[ip].eval(*data_);
+            vectorized::mul_add(pdfvals.size(), coeffs_[ip]->getVal(), &pdfvals[0], gradSum);
+        }
+        for (unsigned int i = 0; i < nEntries; ++i) {
+            if (weights_[i] != 0 && !(gradSum[i] > 0)) { analytic = false; break; }
+        }
+    }
+    for (unsigned int j : which) {
+        RooRealVar &param = *params[j];
+        if (!analytic) { 
+            grad[j] += numericDerivative_(param);
+            continue;
+        }
+        const GradDeps &deps = gradDeps_(param);
+        if (deps.coeffs.empty() && deps.pdfs.empty()) continue;
+        std::fill(gradWork, gradWork + nEntries, 0.0);
+        double dsumCoeff = 0;
+        for (unsigned int ip : deps.coeffs) {
+            double dcoeff = coeffDerivative(coeffs_[ip], param);
+            if (dcoeff == 0) continue;
+            dsumCoeff += dcoeff; 
+            const std::vector<Double_t> &pdfvals = pdfs_[ip].eval(*data_);
+            vectorized::mul_add(pdfvals.size(), dcoeff, &pdfvals[0], gradWork);
+        }
+        for (unsigned int ip : deps.pdfs) {
+            if (!pdfs_[ip].evalDerivative(*data_, param, gradPdfWork_)) {
+                numericDerivative(param, pdfs_[ip], *data_, gradPdfWork_);
+            }
+            vectorized::mul_add(gradPdfWork_.size(), coeffs_[ip]->getVal(), &gradPdfWork_[0], gradWork);
+        }
+        DefaultAccumulator dnll = dsumCoeff;
+        for (unsigned int i = 0; i < nEntries; ++i) {
+            if (weights_[i] != 0) dnll -= weights_[i] * gradWork[i] / gradSum[i];
+        }
+        grad[j] += dnll.sum();
+    }
+}
+
 void
 cacheutils::CachingAddNLL::setZeroPoint()
 {
@@ -725,51 +1855,405 @@ cacheutils::CachingAddNLL::clearConstantZeroPoint()
     setValueDirty();
 }
 
+bool
+cacheutils::CachingAddNLL::saturatedNll(double &ret) const 
+{
+    // same as GoodnessOfFit::makeSaturatedPdf: a RooHistPdf of the data in the default binning of the observables,
+    // whose density in each bin is w_i/(W*volume_i), and an expected yield W so that the extended term vanishes
+    if (!fineCounts_.empty()) return false;
+    std::auto_ptr<RooArgSet> obs(pdf_->getObservables(*data_));
+    std::vector<RooRealVar *> vars; 
+    RooFIter iter = obs->fwdIterator();
+    for (RooAbsArg *a = iter.next(); a != 0; a = iter.next()) {
+        RooRealVar *rrv = dynamic_cast<RooRealVar *>(a);
+        if (rrv == 0) return false;
+        vars.push_back(rrv);
+    }
+    const RooArgSet *row = data_->get();
+    std::vector<RooRealVar *> vals(vars.size());
+    for (unsigned int j = 0, nj = vars.size(); j < nj; ++j) {
+        vals[j] = dynamic_cast<RooRealVar *>(row->find(vars[j]->GetName()));
+        if (vals[j] == 0) return false;
+    }
+    std::vector<long> bins; bins.reserve(data_->numEntries());
+    DefaultAccumulator sum = 0;
+    double sumw = sumWeights_;
+    // the weights are taken from weights_, which can have been updated by setWeights after setData
+    for (int i = 0, n = data_->numEntries(), k = 0; i < n; ++i) {
+        data_->get(i);
+        if (data_->weight() == 0 && !includeZeroWeights_) continue;
+        double w = weights_[k++];
+        if (w == 0) continue;
+        long ibin = 0; double volume = 1;
+        for (unsigned int j = 0, nj = vars.size(); j < nj; ++j) {
+            const RooAbsBinning &binning = vars[j]->getBinning();
+            int b = binning.binNumber(vals[j]->getVal());
+            ibin = ibin * binning.numBins() + b;
+            volume *= binning.binWidth(b);
+        }
+        bins.push_back(ibin);
+        sum += w * log(w/(sumw*volume));
+    }
+    // two entries in the same bin would be merged in the histogram: that's not a binned dataset
+    std::sort(bins.begin(), bins.end());
+    if (std::adjacent_find(bins.begin(), bins.end()) != bins.end()) return false;
+    ret = constantZeroPoint_ - sum.sum() + zeroPoint_;
+    return true;
+}
+
+void
+cacheutils::CachingAddNLL::setupAsimovVolumes_() const 
+{
+    asimovState_ = -1;
+    asimovVolumes_.clear();
+    if (isRooRealSum_ || !fineCounts_.empty() || int(weights_.size()) != data_->numEntries()) return;
+    std::auto_ptr<RooArgSet> obs(pdf_->getObservables(*data_));
+    std::vector<RooRealVar *> vars, vals;
+    long nbins = 1;
+    RooFIter iter = obs->fwdIterator();
+    for (RooAbsArg *a = iter.next(); a != 0; a = iter.next()) {
+        RooRealVar *rrv = dynamic_cast<RooRealVar *>(a);
+        if (rrv == 0) return;
+        vars.push_back(rrv);
+        vals.push_back(dynamic_cast<RooRealVar *>(data_->get()->find(rrv->GetName())));
+        if (vals.back() == 0) return;
+        nbins *= rrv->getBinning().numBins();
+    }
+    if (vars.empty() || nbins != long(weights_.size())) return;
+    // one entry in the center of each bin of the default binning of the observables, as made by SinglePdfGenInfo::generateWithHisto
+    std::vector<char> seen(nbins, 0);
+    asimovVolumes_.resize(weights_.size());
+    for (int i = 0, n = data_->numEntries(); i < n; ++i) {
+        data_->get(i);
+        long ibin = 0; double volume = 1;
+        for (unsigned int j = 0, nj = vars.size(); j < nj; ++j) {
+            const RooAbsBinning &binning = vars[j]->getBinning();
+            double x = vals[j]->getVal();
+            int b = binning.binNumber(x);
+            if (std::abs(x - binning.binCenter(b)) > 1e-5 * binning.binWidth(b)) { asimovVolumes_.clear(); return; }
+            ibin = ibin * binning.numBins() + b;
+            volume *= binning.binWidth(b);
+        }
+        if (seen[ibin]++) { asimovVolumes_.clear(); return; }
+        asimovVolumes_[i] = volume;
+    }
+    asimovState_ = +1;
+}
+
+bool
+cacheutils::CachingAddNLL::expectedWeights(std::vector<Double_t> &out) const 
+{
+    if (asimovState_ == 0) setupAsimovVolumes_();
+    if (asimovState_ < 0) return false;
+    // as in evaluate(), the multipdfs that are not handled by a CachingMultiPdf need their cache reset if the index changed
+    static bool multiNll  = runtimedef::get("ADDNLL_MULTINLL");
+    static bool multiPersist  = !runtimedef::get("ADDNLL_MULTIPDF_NOPERSIST");
+    if (!multiNll && !multiPersist && !multiPdfs_.empty()) {
+        for (std::vector<std::pair<const RooMultiPdf*,CachingPdfBase*> >::const_iterator itp = multiPdfs_.begin(), edp = multiPdfs_.end(); itp != edp; ++itp) {
+            if (itp->first->checkIndexDirty()) itp->second->setDataDirty();
+        }
+    }
+    unsigned int nEntries = weights_.size();
+    out.assign(nEntries, 0.0);
+    packedCoeffs_();
+    for (unsigned int ip = 0, np = pdfs_.size(); ip < np; ++ip) {
+        if (offloadCoeffs_[ip] == 0) continue;
+        const std::vector<Double_t> &pdfvals = pdfs_[ip].eval(*data_);
+        vectorized::mul_add(nEntries, offloadCoeffs_[ip], &pdfvals[0], &out[0]);
+    }
+    for (unsigned int i = 0; i < nEntries; ++i) out[i] *= asimovVolumes_[i];
+    return true;
+}
+
 void 
 cacheutils::CachingAddNLL::setData(const RooAbsData &data) 
+{
+    bool first = (originalData_ == 0);
+    originalData_ = &data;
+    // the old columns go first, as they may be those of the old fineData_
+    columns_.reset();
+    mergedData_.reset();
+    if (makeFineData_(data)) {
+        if (first) {
+            std::cout << "Channel " << pdf_->GetName() << ": " << data.numEntries() << " unbinned entries approximated with " 
+                      << (fineCounts_.empty() ? fineData_->numEntries() : fineCounts_.size()) << " bins"
+                      << (fineCounts_.empty() ? " (midpoint rule)" : " (Simpson's rule)") << std::endl;
+        }
+        setData_(*fineData_);
+    } else if (makeMergedData_(data)) {
+        if (first) {
+            std::cout << "Channel " << pdf_->GetName() << ": " << data.numEntries() << " unbinned entries merged into " 
+                      << mergedData_->numEntries() << " distinct ones" << std::endl;
+        }
+        setData_(*mergedData_);
+    } else {
+        setData_(data);
+    }
+}
+
+bool
+cacheutils::CachingAddNLL::makeFineData_(const RooAbsData &data) 
+{
+    fineData_.reset(); fineCounts_.clear();
+    static int nbins = runtimedef::get("ADDNLL_FINEBINNING");
+    static int minEntries = runtimedef::get("ADDNLL_FINEBINNING_MIN");
+    static bool simpson = runtimedef::get("ADDNLL_FINEBINNING_SIMPSON");
+    if (nbins <= 0 || fineBinningOff_ || pdf_->getAttribute("BinnedLikelihood") || dynamic_cast<const RooDataSet *>(&data) == 0) return false;
+    // only datasets much larger than the binning (by default ten events per bin)
+    if (data.numEntries() <= (minEntries > 0 ? minEntries : 10*nbins)) return false;
+    const RooArgSet *obs = data.get();
+    const RooRealVar *x = (obs->getSize() == 1 ? dynamic_cast<const RooRealVar *>(obs->first()) : 0);
+    if (x == 0 || !x->hasMin() || !x->hasMax()) return false;
+    double xmin = x->getMin(), xmax = x->getMax(), width = (xmax - xmin)/nbins;
+    std::vector<Double_t> counts(nbins, 0.0);
+    for (int i = 0, n = data.numEntries(); i < n; ++i) {
+        data.get(i);
+        int bin = int(std::floor((x->getVal() - xmin)/width));
+        counts[std::max(0, std::min(nbins-1, bin))] += data.weight();
+    }
+    RooRealVar xfine(*x), weight("_weight_", "", 1.0);
+    fineData_.reset(new RooDataSet((std::string(data.GetName())+"_fine").c_str(), "", RooArgSet(xfine, weight), RooFit::WeightVar(weight)));
+    RooArgSet row(xfine);
+    for (int b = 0; b < nbins; ++b) {
+        xfine.setVal(xmin + (b + 0.5)*width);
+        fineData_->add(row, simpson ? 1.0 : counts[b]);
+    }
+    if (simpson) {
+        // Simpson's rule needs also the pdfs at the edges of the bins, all entries have unit weight so that none are dropped
+        for (int b = 0; b <= nbins; ++b) {
+            xfine.setVal(b < nbins ? xmin + b*width : xmax);
+            fineData_->add(row, 1.0);
+        }
+        fineCounts_.swap(counts);
+    }
+    return true;
+}
+
+bool
+cacheutils::CachingAddNLL::makeMergedData_(const RooAbsData &data) 
+{
+    static int minEntries = runtimedef::get("ADDNLL_MERGE_IDENTICAL");
+    if (minEntries <= 0 || pdf_->getAttribute("BinnedLikelihood") || dynamic_cast<const RooDataSet *>(&data) == 0) return false;
+    if (data.numEntries() < std::max(minEntries, 2)) return false;
+    const RooArgSet *obs = data.get();
+    std::vector<const RooAbsReal *> reals; std::vector<const RooAbsCategory *> cats;
+    RooFIter iter = obs->fwdIterator();
+    for (RooAbsArg *a = iter.next(); a != 0; a = iter.next()) {
+        if (const RooAbsReal *rar = dynamic_cast<const RooAbsReal *>(a)) reals.push_back(rar);
+        else if (const RooAbsCategory *cat = dynamic_cast<const RooAbsCategory *>(a)) cats.push_back(cat);
+        else return false;
+    }
+    unsigned int n = data.numEntries(), nr = reals.size(), nv = nr + cats.size();
+    std::vector<double> values(std::size_t(n)*nv), weights(n);
+    for (unsigned int i = 0; i < n; ++i) {
+        data.get(i);
+        double *row = &values[std::size_t(i)*nv];
+        for (unsigned int k = 0; k < nr; ++k) row[k] = reals[k]->getVal();
+        for (unsigned int k = nr; k < nv; ++k) row[k] = cats[k-nr]->getIndex();
+        weights[i] = data.weight();
+    }
+    // the entries sorted by their values, so that identical ones are next to each other; the merged entries are in the
+    // order of the first of each group, as the original ones
+    std::vector<unsigned int> order(n);
+    for (unsigned int i = 0; i < n; ++i) order[i] = i;
+    auto less = [&](unsigned int i, unsigned int j) { 
+        const double *a = &values[std::size_t(i)*nv], *b = &values[std::size_t(j)*nv];
+        return std::lexicographical_compare(a, a + nv, b, b + nv) || (std::equal(a, a + nv, b) && i < j);
+    };
+    std::sort(order.begin(), order.end(), less);
+    std::vector<unsigned int> first(n);
+    std::vector<double> sums(n, 0.0);
+    unsigned int distinct = 0;
+    for (unsigned int k = 0; k < n; ++k) {
+        unsigned int i = order[k];
+        if (k == 0 || !std::equal(&values[std::size_t(i)*nv], &values[std::size_t(i)*nv] + nv, &values[std::size_t(first[order[k-1]])*nv])) {
+            first[i] = i; ++distinct;
+        } else {
+            first[i] = first[order[k-1]];
+        }
+        sums[first[i]] += weights[i];
+    }
+    if (distinct == n) return false;
+    RooRealVar weight("_weight_", "", 1.0);
+    RooArgSet vars(*obs); vars.add(weight);
+    mergedData_.reset(new RooDataSet((std::string(data.GetName())+"_merged").c_str(), "", vars, RooFit::WeightVar(weight)));
+    for (unsigned int i = 0; i < n; ++i) {
+        if (first[i] != i) continue;
+        mergedData_->add(*data.get(i), sums[i]);
+    }
+    return true;
+}
+
+double
+cacheutils::CachingAddNLL::exactNll() 
+{
+    if (!fineBinned()) return evaluate();
+    const RooAbsData *original = originalData_;
+    fineBinningOff_ = true;
+    setData(*original);
+    double ret = evaluate();
+    fineBinningOff_ = false;
+    setData(*original);
+    return ret;
+}
+
+namespace {
+    /// estimate of the memory of the values of a dataset: one double per observable and entry, plus the weight
+    /// (for a RooDataHist also the errors, the sum of the squares of the weights and the bin volume)
+    std::size_t dataBytes(const RooAbsData &data) {
+        unsigned int perEntry = data.get()->getSize() + (dynamic_cast<const RooDataHist *>(&data) ? 5 : 1);
+        return std::size_t(data.numEntries()) * perEntry * sizeof(Double_t);
+    }
+}
+
+void
+cacheutils::CachingAddNLL::memoryFootprint(MemoryFootprint &out) const
+{
+    std::string channel = GetName();
+    // each link to a server is in the server list of the client and in the client lists of the server
+    const std::size_t linkBytes = 4 * sizeof(RooLinkedListElem);
+    RooArgSet branches;
+    pdf_->branchNodeServerList(&branches);
+    RooFIter iter = branches.fwdIterator();
+    for (RooAbsArg *a = iter.next(); a != 0; a = iter.next()) {
+        std::auto_ptr<TIterator> servers(a->serverIterator());
+        unsigned int links = 0;
+        while (servers->Next() != 0) ++links;
+        out.nodes += a->IsA()->Size() + links * linkBytes;
+        std::size_t nominal = 0, morphs = 0;
+        if (const FastVerticalInterpHistPdf2Base *hpdf = dynamic_cast<const FastVerticalInterpHistPdf2Base *>(a)) {
+            hpdf->templateBytes(nominal, morphs);
+        } else if (RooHistFunc *hfunc = dynamic_cast<RooHistFunc *>(a)) {
+            nominal = dataBytes(hfunc->dataHist());
+        } else if (RooHistPdf *hpdf = dynamic_cast<RooHistPdf *>(a)) {
+            nominal = dataBytes(hpdf->dataHist());
+        }
+        if (nominal + morphs == 0) continue;
+        out.nominal += nominal; out.morphs += morphs;
+        out.items.push_back(std::make_pair(nominal + morphs, channel + ": templates of " + a->GetName()));
+    }
+    for (const CachingPdfBase &pdf : pdfs_) {
+        std::size_t bytes = pdf.cacheBytes();
+        out.caches += bytes;
+        if (bytes) out.items.push_back(std::make_pair(bytes, channel + ": cached values of " + pdf.pdf()->GetName()));
+    }
+    std::size_t work = scratch_.bytes() + (fusedCoeffs_.capacity() + gradPdfWork_.capacity() + mcStatWidths_.capacity() + offloadCoeffs_.capacity()) * sizeof(Double_t);
+    for (const std::vector<Double_t> &v : mcStatRelErr_) work += v.capacity() * sizeof(Double_t);
+    for (const std::vector<Double_t> &v : mcStatScale_) work += v.capacity() * sizeof(Double_t);
+    if (kernel_.get()) work += kernel_->bytes();
+    out.caches += work;
+    out.items.push_back(std::make_pair(work, channel + ": working arrays of the NLL"));
+    std::size_t data = (weights_.capacity() + binWidths_.capacity() + fineCounts_.capacity()) * sizeof(Double_t);
+    if (originalData_) data += dataBytes(*originalData_);
+    if (fineData_.get()) data += dataBytes(*fineData_);
+    if (mergedData_.get()) data += dataBytes(*mergedData_);
+    if (columns_.get()) data += columns_->bytes();
+    out.data += data;
+    out.items.push_back(std::make_pair(data, channel + ": dataset"));
+}
+
+void 
+cacheutils::CachingAddNLL::setData_(const RooAbsData &data) 
 {
     //std::cout << "Setting data for pdf " << pdf_->GetName() << std::endl;
     //utils::printRAD(&data);
     data_ = &data;
     setValueDirty();
-    weights_.clear(); weights_.reserve(data.numEntries());
-    for (int i = 0, n = data.numEntries(); i < n; ++i) {
-        data.get(i);
-        double w = data.weight();
-        if (w || includeZeroWeights_) weights_.push_back(w); 
+    offload_.reset(); offloadState_ = 0;
+    kernel_.reset(); kernelState_ = 0;
+    asimovVolumes_.clear(); asimovState_ = 0;
+    columns_.reset(new DataColumns(data, includeZeroWeights_));
+    weights_.assign(columns_->weights(), columns_->weights() + columns_->size());
+    sumWeights_ = sumDefault(fineCounts_.empty() ? weights_ : fineCounts_);
+    // the arrays of the gradient are added by the first call to addGradient
+    scratch_.resize(weights_.size(), std::max<unsigned int>(scratch_.arrays(), mcStatRelErr_.empty() ? MCStatVar : MCStatVar+1));
+    mcStatScale_.clear(); mcStatWidths_.clear();
+    if (!mcStatRelErr_.empty() && int(weights_.size()) == data.numEntries()) {
+        // find the template bin of each data entry
+        RooRealVar *xvar = dynamic_cast<RooRealVar *>(data.get()->first());
+        const RooAbsBinning &bins = xvar->getBinning();
+        mcStatScale_.resize(mcStatRelErr_.size());
+        for (int i = 0, n = data.numEntries(); i < n; ++i) {
+            int bin = bins.binNumber(data.get(i)->getRealValue(xvar->GetName()));
+            double width = bins.binWidth(bin);
+            mcStatWidths_.push_back(width);
+            for (unsigned int ip = 0, np = mcStatRelErr_.size(); ip < np; ++ip) {
+                const std::vector<Double_t> &relErr = mcStatRelErr_[ip];
+                if (!relErr.empty()) mcStatScale_[ip].push_back(bin < int(relErr.size()) ? relErr[bin] * width : 0.);
+            }
+        }
     }
-    sumWeights_ = sumDefault(weights_);
-    partialSum_.resize(weights_.size());
-    workingArea_.resize(weights_.size());
     for (auto itp = pdfs_.begin(), edp = pdfs_.end(); itp != edp; ++itp) {
         itp->setDataDirty();
     }
     binWidths_.clear(); canBasicIntegrals_ = 0;
     if (dynamic_cast<RooRealSumPdf *>(pdf_) != 0 && runtimedef::get("ADDNLL_ROOREALSUM_BASICINT") > 0) {
+        // the integrals are sums over the entries of the values times the volumes of their bins, if the entries are 
+        // the centers of all the bins of the binning of the observables, once each (in any order, and in any dimension)
         const RooArgSet *obs = data_->get();
-        RooRealVar *xvar = dynamic_cast<RooRealVar *>(obs->first());
-        if (obs->getSize() == 1 && xvar != 0 && xvar->numBins() == data_->numEntries()) {
-            const RooAbsBinning &bins = xvar->getBinning();
-            binWidths_.resize(xvar->numBins());
+        std::vector<RooRealVar *> xvars;
+        long nbins = 1;
+        RooFIter iterObs = obs->fwdIterator();
+        for (RooAbsArg *a = iterObs.next(); a != 0; a = iterObs.next()) {
+            RooRealVar *xvar = dynamic_cast<RooRealVar *>(a);
+            if (xvar == 0) { xvars.clear(); break; }
+            xvars.push_back(xvar);
+            nbins *= xvar->numBins();
+        }
+        if (!xvars.empty() && nbins == data_->numEntries()) {
+            binWidths_.resize(nbins);
+            std::vector<char> seen(nbins, 0);
             bool all_equal = true;
             canBasicIntegrals_ = runtimedef::get("ADDNLL_ROOREALSUM_BASICINT");
-            for (unsigned int ibin = 0, nbin = binWidths_.size(); ibin < nbin; ++ibin) {
-                double bc = bins.binCenter(ibin), dc = data_->get(ibin)->getRealValue(xvar->GetName());
-                //printf("bin %3d: center %+8.5f ( data %+8.5f , diff %+8.5f ), width %8.5f, data weight %10.5f, channel %s\n", ibin, bc, dc, abs(dc-bc)/bins.binWidth(ibin), bins.binWidth(ibin), data_->weight(), pdf_->GetName());
-                binWidths_[ibin] = bins.binWidth(ibin);
-                if (std::abs(bc-dc) > 1e-5*binWidths_[ibin]) {
-                    printf("channel %s, for observable %s, bin %d mismatch: binning %+8.5f ( data %+8.5f , diff %+7.8f of width %8.5f\n",
-                        pdf_->GetName(), xvar->GetName(), ibin, bc, dc, std::abs(bc-dc)/binWidths_[ibin], binWidths_[ibin]);
-                    canBasicIntegrals_ = 0; 
+            for (long i = 0; i < nbins && canBasicIntegrals_; ++i) {
+                const RooArgSet *entry = data_->get(i);
+                long flat = 0;
+                double volume = 1;
+                for (unsigned int d = 0, nd = xvars.size(); d < nd; ++d) {
+                    const RooAbsBinning &bins = xvars[d]->getBinning();
+                    double dc = entry->getRealValue(xvars[d]->GetName());
+                    int ibin = bins.binNumber(dc);
+                    double bc = bins.binCenter(ibin), width = bins.binWidth(ibin);
+                    if (std::abs(bc-dc) > 1e-5*width) {
+                        printf("channel %s, for observable %s, entry %ld mismatch: binning %+8.5f ( data %+8.5f , diff %+7.8f of width %8.5f\n",
+                            pdf_->GetName(), xvars[d]->GetName(), i, bc, dc, std::abs(bc-dc)/width, width);
+                        canBasicIntegrals_ = 0; 
+                        break;
+                    }
+                    flat = flat * bins.numBins() + ibin;
+                    volume *= width;
+                }
+                if (!canBasicIntegrals_) break;
+                if (seen[flat]++) {
+                    printf("channel %s, entry %ld is in the same bin as another one: can't do binned integrals\n", pdf_->GetName(), i);
+                    canBasicIntegrals_ = 0;
                     break;
                 }
-                if ((ibin > 0) && (binWidths_[ibin] != binWidths_[ibin-1])) all_equal = false;
+                binWidths_[i] = volume;
+                if ((i > 0) && (binWidths_[i] != binWidths_[i-1])) all_equal = false;
             }
-            if (all_equal) binWidths_.resize(1);
+            if (!canBasicIntegrals_) binWidths_.clear();
+            else if (all_equal) binWidths_.resize(1);
         } else {
-            printf("channel %s (binned likelihood? %d), can't do binned intergals. nobs %d, obs %s, nbins %d, ndata %d\n", pdf_->GetName(), pdf_->getAttribute("BinnedLikelihood"), obs->getSize(), (xvar ? xvar->GetName() : "<nil>"), (xvar ? xvar->numBins() : -999), data_->numEntries());
+            RooRealVar *xvar = dynamic_cast<RooRealVar *>(obs->first());
+            printf("channel %s (binned likelihood? %d), can't do binned intergals. nobs %d, obs %s, nbins %ld, ndata %d\n", pdf_->GetName(), pdf_->getAttribute("BinnedLikelihood"), obs->getSize(), (xvar ? xvar->GetName() : "<nil>"), (xvars.empty() ? -999 : nbins), data_->numEntries());
         }
     }
+    // the integrals checked on the previous dataset aren't trusted for this one: check them again at the next evaluation
+    basicIntegrals_ = canBasicIntegrals_;
+    std::fill(badBasicIntegral_.begin(), badBasicIntegral_.end(), 0);
+}
+
+bool
+cacheutils::CachingAddNLL::setWeights(const double *weights, unsigned int n)
+{
+    if (n != weights_.size() || fineBinned() || mergedData_.get()) return false;
+    std::copy(weights, weights + n, weights_.begin());
+    sumWeights_ = sumDefault(weights_);
+    if (offloadState_ > 0) offload_->setWeights(weights_);
+    if (kernelState_ > 0) kernel_->setWeights(weights_);
+    setValueDirty();
+    return true;
 }
 
 RooArgSet* 
@@ -789,7 +2273,11 @@ cacheutils::CachingSimNLL::CachingSimNLL(RooSimultaneous *pdf, RooAbsData *data,
     pdfOriginal_(pdf),
     dataOriginal_(data),
     nuis_(nuis),
-    params_("params","parameters",this)
+    params_("params","parameters",this),
+    zeroPointSet_(false),
+    constantZeroPointCleared_(false),
+    stateId_(0),
+    dataId_(++nextSimNLLDataId_)
 {
     setup_();
 }
@@ -798,7 +2286,11 @@ cacheutils::CachingSimNLL::CachingSimNLL(const CachingSimNLL &other, const char
     pdfOriginal_(other.pdfOriginal_),
     dataOriginal_(other.dataOriginal_),
     nuis_(other.nuis_),
-    params_("params","parameters",this)
+    params_("params","parameters",this),
+    zeroPointSet_(false),
+    constantZeroPointCleared_(false),
+    stateId_(0),
+    dataId_(++nextSimNLLDataId_)
 {
     setup_();
 }
@@ -839,6 +2331,8 @@ cacheutils::CachingSimNLL::setup_()
     //params_.add(*params);
 
     RooArgList constraints;
+    // a new NLL can come with terms that take the addresses of those of a deleted one, don't trust what was cached for them
+    utils::clearFactorizeCache();
     factorizedPdf_.reset(dynamic_cast<RooSimultaneous *>(utils::factorizePdf(*dataOriginal_->get(), *pdfclone, constraints)));
 
     RooSimultaneous *simpdf = factorizedPdf_.get();
@@ -892,6 +2386,12 @@ cacheutils::CachingSimNLL::setup_()
         for (const auto & p : constraintsByType) {
             std::cout << "Constraints of type " << p.first << ": " << p.second << std::endl;
         }
+        constraintBlock_.reset();
+        if (runtimedef::get("SIMNLL_CONSTRAINT_BLOCK")) {
+            constraintBlock_.reset(new ConstraintBlock(constrainPdfsFast_, constrainPdfsFastPoisson_));
+            std::cout << "Constraint block with " << constraintBlock_->size() << " of the " << (constrainPdfsFast_.size() + constrainPdfsFastPoisson_.size()) << " fast constraints" << std::endl;
+            if (constraintBlock_->size() < 2) constraintBlock_.reset();
+        }
     } else {
         std::cerr << "PDF didn't factorize!" << std::endl;
         std::cout << "Parameters: " << std::endl;
@@ -906,6 +2406,8 @@ cacheutils::CachingSimNLL::setup_()
     
     std::auto_ptr<RooAbsCategoryLValue> catClone((RooAbsCategoryLValue*) simpdf->indexCat().Clone());
     pdfs_.resize(catClone->numBins(NULL), 0);
+    lazyChannels_ = runtimedef::get("SIMNLL_LAZY_CHANNELS");
+    lazyPdfs_.assign(pdfs_.size(), 0); lazyLabels_.assign(pdfs_.size(), std::string()); lazyIncludeZeroWeights_.assign(pdfs_.size(), 0);
     //dataSets_.reset(dataOriginal_->split(pdfOriginal_->indexCat(), true));
     datasets_.resize(pdfs_.size(), 0);
     splitWithWeights(*dataOriginal_, simpdf->indexCat(), true);
@@ -919,6 +2421,13 @@ cacheutils::CachingSimNLL::setup_()
             //std::cout << "   bin " << ib << " (label " << catClone->getLabel() << ") has pdf " << pdf->GetName() << " of type " << pdf->ClassName() << " and " << (data ? data->numEntries() : -1) << " dataset entries" << std::endl;
             if (data == 0) { throw std::logic_error("Error: no data"); }
             bool includeZeroWeights = (runtimedef::get("ADDNLL_ROOREALSUM_BASICINT") && runtimedef::get("ADDNLL_ROOREALSUM_KEEPZEROS") && (dynamic_cast<RooRealSumPdf*>(pdf)!=0));
+            if (lazyChannels_) {
+                // keep what's needed to build it later, and take the parameters directly from the pdf
+                lazyPdfs_[ib] = pdf; lazyLabels_[ib] = catClone->getLabel(); lazyIncludeZeroWeights_[ib] = includeZeroWeights;
+                std::auto_ptr<RooArgSet> params(pdf->getParameters(*data));
+                params_.add(*params, /*silent=*/true);
+                continue;
+            }
             pdfs_[ib] = new CachingAddNLL(catClone->getLabel(), "", pdf, data, includeZeroWeights);
             params_.add(pdfs_[ib]->params(), /*silent=*/true); 
         } else { 
@@ -927,9 +2436,197 @@ cacheutils::CachingSimNLL::setup_()
         }
     }   
 
+    threadPool_ = 0;
+    // opt-in, not implied by --threads: SIMNLL_THREADS of the threads of the global pool (capped by --threads, if set)
+    int knob = runtimedef::get("SIMNLL_THREADS");
+    nThreads_ = (knob > 1 ? ThreadPool::threadsFor(knob) : 1);
+    if (nThreads_ > 1) {
+        if (channelsShareBranchNodes_()) {
+            std::cout << "WARNING: some channels share function nodes, so they can't be evaluated in parallel. SIMNLL_THREADS will be ignored." << std::endl;
+        } else {
+            threadPool_ = &ThreadPool::global(nThreads_);
+        }
+    }
+    channelLocal_.assign(pdfs_.size(), 0);
+
+    setupChannelIndex_();
+
+    if (runtimedef::get("SIMNLL_MEMORY_REPORT")) reportMemory();
+
     setValueDirty();
 }
 
+void
+cacheutils::CachingAddNLL::localize()
+{
+    std::vector<Double_t>(weights_).swap(weights_);
+    std::vector<Double_t>(binWidths_).swap(binWidths_);
+    std::vector<Double_t>(fineCounts_).swap(fineCounts_);
+    scratch_.localize();
+    for (CachingPdfBase &pdf : pdfs_) pdf.localize();
+    RooArgSet branches;
+    pdf_->branchNodeServerList(&branches);
+    RooFIter iter = branches.fwdIterator();
+    for (RooAbsArg *a = iter.next(); a != 0; a = iter.next()) {
+        if (FastVerticalInterpHistPdf2Base *hpdf = dynamic_cast<FastVerticalInterpHistPdf2Base *>(a)) hpdf->localizeTemplates();
+    }
+}
+
+void
+cacheutils::CachingSimNLL::setupChannelIndex_()
+{
+    channelIndex_ = runtimedef::get("SIMNLL_CHANNEL_INDEX");
+    channelIndexValid_ = false;
+    indexedParams_.clear(); indexedParamVals_.clear(); paramChannels_.clear(); alwaysDirtyChannels_.clear();
+    channelDirty_.assign(pdfs_.size(), 1);
+    channelCachedNLLs_.assign(pdfs_.size(), 0.0);
+    if (!channelIndex_) return;
+    std::unordered_map<const RooAbsArg *, unsigned int> paramIndex;
+    for (unsigned int ib = 0, nb = pdfs_.size(); ib < nb; ++ib) {
+        if (channelPdf_(ib) == 0) continue;
+        // the channels with discrete parameters anywhere in their tree (multipdfs, also nested in other pdfs, 
+        // or categories used by some function) are always evaluated
+        bool discrete = pdfs_[ib] ? pdfs_[ib]->hasDiscreteParams() : false;
+        RooArgSet params; channelParams_(ib, params);
+        RooFIter iter = params.fwdIterator();
+        for (RooAbsArg *a = iter.next(); a != 0 && !discrete; a = iter.next()) {
+            if (dynamic_cast<RooAbsCategory *>(a) != 0) discrete = true;
+        }
+        if (!discrete) {
+            RooArgSet branches; channelPdf_(ib)->branchNodeServerList(&branches);
+            RooFIter itb = branches.fwdIterator();
+            for (RooAbsArg *a = itb.next(); a != 0 && !discrete; a = itb.next()) {
+                if (dynamic_cast<RooMultiPdf *>(a) != 0 || dynamic_cast<RooAbsCategory *>(a) != 0) discrete = true;
+            }
+        }
+        if (discrete) { alwaysDirtyChannels_.push_back(ib); continue; }
+        iter = params.fwdIterator();
+        for (RooAbsArg *a = iter.next(); a != 0; a = iter.next()) {
+            RooRealVar *rrv = dynamic_cast<RooRealVar *>(a);
+            if (rrv == 0) continue;
+            std::pair<std::unordered_map<const RooAbsArg *, unsigned int>::iterator, bool> ins = paramIndex.insert(std::make_pair(a, indexedParams_.size()));
+            if (ins.second) {
+                indexedParams_.push_back(rrv);
+                paramChannels_.push_back(std::vector<unsigned int>());
+            }
+            paramChannels_[ins.first->second].push_back(ib);
+        }
+    }
+    indexedParamVals_.resize(indexedParams_.size());
+    if (runtimedef::get("SIMNLL_CHANNEL_INDEX_VERBOSE")) {
+        std::cout << "CachingSimNLL channel index: " << indexedParams_.size() << " parameters, " << alwaysDirtyChannels_.size() << " channels always re-evaluated" << std::endl;
+    }
+}
+
+void
+cacheutils::CachingSimNLL::findDirtyChannels_() const
+{
+    if (!channelIndexValid_) {
+        std::fill(channelDirty_.begin(), channelDirty_.end(), 1);
+        for (unsigned int i = 0, n = indexedParams_.size(); i < n; ++i) indexedParamVals_[i] = indexedParams_[i]->getVal();
+        channelIndexValid_ = true;
+        return;
+    }
+    // flags are cleared only when a channel is evaluated, so masked channels stay dirty until they are used again
+    for (unsigned int i = 0, n = indexedParams_.size(); i < n; ++i) {
+        double val = indexedParams_[i]->getVal();
+        if (val != indexedParamVals_[i]) {
+            indexedParamVals_[i] = val;
+            for (unsigned int ib : paramChannels_[i]) channelDirty_[ib] = 1;
+        }
+    }
+    for (unsigned int ib : alwaysDirtyChannels_) channelDirty_[ib] = 1;
+}
+
+void
+cacheutils::CachingSimNLL::parameterBlocks(std::vector<std::vector<std::string> > &blocks) const
+{
+    // union-find over the floating parameters, merging all those that enter the same channel or generic constraint
+    std::unordered_map<const RooAbsArg *, unsigned int> index;
+    std::vector<RooAbsArg *> items; std::vector<unsigned int> parent;
+    auto find = [&parent](unsigned int i) { while (parent[i] != i) { parent[i] = parent[parent[i]]; i = parent[i]; } return i; };
+    auto join = [&](const RooAbsCollection &params) {
+        int first = -1;
+        RooFIter iter = params.fwdIterator();
+        for (RooAbsArg *a = iter.next(); a != 0; a = iter.next()) {
+            if (a->isConstant() || dynamic_cast<RooRealVar *>(a) == 0) continue;
+            std::pair<std::unordered_map<const RooAbsArg *, unsigned int>::iterator, bool> ins = index.insert(std::make_pair(a, items.size()));
+            if (ins.second) { items.push_back(a); parent.push_back(ins.first->second); }
+            unsigned int root = find(ins.first->second);
+            if (first == -1) first = root; else parent[root] = first;
+        }
+    };
+    for (unsigned int ib = 0, nb = pdfs_.size(); ib < nb; ++ib) {
+        if (channelPdf_(ib) == 0) continue;
+        RooArgSet params; channelParams_(ib, params);
+        join(params);
+    }
+    for (RooAbsPdf *pdf : constrainPdfs_) {
+        std::auto_ptr<RooArgSet> params(pdf->getParameters((const RooArgSet *)0));
+        join(*params);
+    }
+    blocks.clear();
+    std::unordered_map<unsigned int, unsigned int> blockOfRoot;
+    for (unsigned int i = 0, n = items.size(); i < n; ++i) {
+        std::pair<std::unordered_map<unsigned int, unsigned int>::iterator, bool> ins = blockOfRoot.insert(std::make_pair(find(i), blocks.size()));
+        if (ins.second) blocks.push_back(std::vector<std::string>());
+        blocks[ins.first->second].push_back(items[i]->GetName());
+    }
+}
+
+void
+cacheutils::CachingSimNLL::rateOnlyParameters(std::vector<std::string> &names) const
+{
+    std::set<const RooAbsArg *> candidates;
+    for (const SimpleGaussianConstraint *pdf : constrainPdfsFast_) {
+        const RooAbsArg *x = &pdf->getX();
+        if (dynamic_cast<const RooRealVar *>(x) != 0 && !x->isConstant()) candidates.insert(x);
+    }
+    // anything constrained also by some other term, or read by a channel through something else than a ProcessNormalization, is out
+    for (RooAbsPdf *pdf : constrainPdfs_) {
+        std::auto_ptr<RooArgSet> params(pdf->getParameters((const RooArgSet *)0));
+        RooFIter iter = params->fwdIterator();
+        for (RooAbsArg *a = iter.next(); a != 0; a = iter.next()) candidates.erase(a);
+    }
+    for (unsigned int ib = 0, nb = pdfs_.size(); ib < nb && !candidates.empty(); ++ib) {
+        if (channelPdf_(ib) == 0) continue;
+        RooArgSet branches;
+        channelPdf_(ib)->branchNodeServerList(&branches);
+        RooFIter iter = branches.fwdIterator();
+        for (RooAbsArg *b = iter.next(); b != 0; b = iter.next()) {
+            if (dynamic_cast<ProcessNormalization *>(b) != 0) continue;
+            std::auto_ptr<TIterator> servers(b->serverIterator());
+            for (RooAbsArg *s = (RooAbsArg *) servers->Next(); s != 0; s = (RooAbsArg *) servers->Next()) candidates.erase(s);
+        }
+    }
+    names.clear();
+    for (const SimpleGaussianConstraint *pdf : constrainPdfsFast_) {
+        if (candidates.erase(&pdf->getX())) names.push_back(pdf->getX().GetName());
+    }
+}
+
+bool
+cacheutils::CachingSimNLL::channelsShareBranchNodes_() const
+{
+    // Parameters (leaf nodes) are only read during the evaluation, so they can be shared freely.
+    // Any function shared between two channels would instead be evaluated concurrently, and RooFit objects are not thread-safe.
+    std::unordered_map<const RooAbsArg *, int> owner;
+    for (int ib = 0, nb = pdfs_.size(); ib < nb; ++ib) {
+        if (channelPdf_(ib) == 0) continue;
+        RooArgSet branches;
+        channelPdf_(ib)->branchNodeServerList(&branches);
+        RooFIter iter = branches.fwdIterator();
+        for (RooAbsArg *a = iter.next(); a != 0; a = iter.next()) {
+            std::pair<std::unordered_map<const RooAbsArg *, int>::iterator, bool> ins = owner.insert(std::make_pair(a, ib));
+            if (!ins.second && ins.first->second != ib) {
+                if (runtimedef::get("SIMNLL_THREADS_VERBOSE")) std::cout << "Node " << a->GetName() << " is shared between channels " << channelPdf_(ins.first->second)->GetName() << " and " << channelPdf_(ib)->GetName() << std::endl;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
 Double_t 
 cacheutils::CachingSimNLL::evaluate() const 
 {
@@ -940,20 +2637,53 @@ cacheutils::CachingSimNLL::evaluate() const
 #ifdef DEBUG_CACHE
     PerfCounter::add("CachingSimNLL::evaluate called");
 #endif
+    ScopedTimer timer("CachingSimNLL::evaluate");
     static bool gentleNegativePenalty_ = runtimedef::get("GENTLE_LEE");
     DefaultAccumulator ret = 0;
-    unsigned idx = 0;
-    for (std::vector<CachingAddNLL*>::const_iterator it = pdfs_.begin(), ed = pdfs_.end(); it != ed; ++it, ++idx) {
-        if (*it != 0) {
-            if (channelMasks_.size() > 0 && channelMasks_[idx]->getVal() != 0.) {
-                // std::cout << "Channel " << (*it)->GetName() << " will be masked as " 
-                //     << channelMasks_[idx]->GetName() << " evalutes to " 
-                //     << channelMasks_[idx]->getVal() << "\n";
+    if (channelIndex_) findDirtyChannels_();
+    if (threadPool_) {
+        // masks are evaluated here, only the channel NLLs go to the threads
+        activeChannels_.clear();
+        for (unsigned int idx = 0, n = pdfs_.size(); idx < n; ++idx) {
+            if (channelPdf_(idx) == 0) continue;
+            if (channelMasks_.size() > 0 && channelMasks_[idx]->getVal() != 0.) { 
+                if (lazyChannels_ > 1 && pdfs_[idx] != 0) { delete pdfs_[idx]; pdfs_[idx] = 0; channelLocal_[idx] = 0; }
                 continue;
             }
-            double nllval = (*it)->getVal();
-            // what sanity check could I put here?
-            ret += nllval;
+            if (pdfs_[idx] == 0) channel_(idx); // built here, not in the threads
+            if (channelIndex_ && !channelDirty_[idx]) continue;
+            activeChannels_.push_back(idx);
+        }
+        bool localize = ThreadPool::pinned();
+        threadPool_->parallelFor(activeChannels_.size(), [this, localize](unsigned int i) { 
+            // the first time, on the thread that will then get the same range of channels in all the next calls
+            if (localize && !channelLocal_[activeChannels_[i]]) { pdfs_[activeChannels_[i]]->localize(); channelLocal_[activeChannels_[i]] = 1; }
+            channelCachedNLLs_[activeChannels_[i]] = pdfs_[activeChannels_[i]]->getVal(); 
+            channelDirty_[activeChannels_[i]] = 0;
+        }, nThreads_);
+        // reduce in the same order as the serial loop, so the result is identical
+        for (unsigned int idx = 0, n = pdfs_.size(); idx < n; ++idx) {
+            if (pdfs_[idx] == 0) continue;
+            if (channelMasks_.size() > 0 && channelMasks_[idx]->getVal() != 0.) continue;
+            ret += channelCachedNLLs_[idx];
+        }
+    } else {
+        unsigned idx = 0;
+        for (std::vector<CachingAddNLL*>::const_iterator it = pdfs_.begin(), ed = pdfs_.end(); it != ed; ++it, ++idx) {
+            if (*it != 0 || lazyPdfs_[idx] != 0) {
+                if (channelMasks_.size() > 0 && channelMasks_[idx]->getVal() != 0.) {
+                    // std::cout << "Channel " << (*it)->GetName() << " will be masked as " 
+                    //     << channelMasks_[idx]->GetName() << " evalutes to " 
+                    //     << channelMasks_[idx]->getVal() << "\n";
+                    if (lazyChannels_ > 1 && *it != 0) { delete pdfs_[idx]; pdfs_[idx] = 0; channelLocal_[idx] = 0; }
+                    continue;
+                }
+                if (channelIndex_ && !channelDirty_[idx]) { ret += channelCachedNLLs_[idx]; continue; }
+                double nllval = channel_(idx)->getVal();
+                // what sanity check could I put here?
+                ret += nllval;
+                channelCachedNLLs_[idx] = nllval; channelDirty_[idx] = 0;
+            }
         }
     }
     if (!constrainPdfs_.empty() || !constrainPdfsFast_.empty()) {
@@ -963,16 +2693,20 @@ cacheutils::CachingSimNLL::evaluate() const
         for (std::vector<RooAbsPdf *>::const_iterator it = constrainPdfs_.begin(), ed = constrainPdfs_.end(); it != ed; ++it, ++itz) { 
             double pdfval = (*it)->getVal(nuis_);
             if (!isnormal(pdfval) || pdfval <= 0) {
-                std::cout << "WARNING: underflow constraint pdf " << (*it)->GetName() << ", value = " << pdfval << std::endl;
+                CMB_LOG(logging::Warning, "WARNING: underflow constraint pdf " << (*it)->GetName() << ", value = " << pdfval);
                 if (gentleNegativePenalty_) { ret += 25; continue; }
-                if (!noDeepLEE_) logEvalError((std::string("Constraint pdf ")+(*it)->GetName()+" evaluated to zero, negative or error").c_str());
+                if (!noDeepLEE_) { std::lock_guard<std::mutex> lock(logEvalErrorMutex_); logEvalError((std::string("Constraint pdf ")+(*it)->GetName()+" evaluated to zero, negative or error").c_str()); }
                 pdfval = 1e-9;
             }
             ret2 += (log(pdfval) + *itz);
         }
+        /// ============= FAST CONSTRAINTS IN THE BLOCK  =========
+        const ConstraintBlock *block = constraintBlock_.get();
+        if (block) ret2 += block->eval();
         /// ============= FAST GAUSSIAN CONSTRAINTS  =========
         itz = constrainZeroPointsFast_.begin();
         for (std::vector<SimpleGaussianConstraint*>::const_iterator it = constrainPdfsFast_.begin(), ed = constrainPdfsFast_.end(); it != ed; ++it, ++itz) { 
+            if (block && block->hasGaussian(it - constrainPdfsFast_.begin())) continue;
             double logpdfval = (*it)->getLogValFast();
             //std::cout << "pdf " << (*it)->GetName() << " = " << logpdfval << std::endl;
             ret2 += (logpdfval + *itz);
@@ -980,6 +2714,7 @@ cacheutils::CachingSimNLL::evaluate() const
         /// ============= FAST POISSON CONSTRAINTS  =========
         itz = constrainZeroPointsFastPoisson_.begin();
         for (std::vector<SimplePoissonConstraint*>::const_iterator it = constrainPdfsFastPoisson_.begin(), ed = constrainPdfsFastPoisson_.end(); it != ed; ++it, ++itz) { 
+            if (block && block->hasPoisson(it - constrainPdfsFastPoisson_.begin())) continue;
             double logpdfval = (*it)->getLogValFast();
             //std::cout << "pdf " << (*it)->GetName() << " = " << logpdfval << std::endl;
             ret2 += (logpdfval + *itz);
@@ -999,6 +2734,7 @@ void
 cacheutils::CachingSimNLL::setData(const RooAbsData &data) 
 {
     dataOriginal_ = &data;
+    dataId_ = ++nextSimNLLDataId_;
     //std::cout << "combined data has " << data.numEntries() << " dataset entries (sumw " << data.sumEntries() << ", weighted " << data.isWeighted() << ")" << std::endl;
     //utils::printRAD(&data);
     //dataSets_.reset(dataOriginal_->split(pdfOriginal_->indexCat(), true));
@@ -1006,6 +2742,13 @@ cacheutils::CachingSimNLL::setData(const RooAbsData &data)
     	throw  std::logic_error("Error: no category in dataset. You should try to recreate your datacard as a Fake shape -- combineCards.py mycard.txt -S > myshapecard.txt OR rerun with option --forceRecreateNLL");
 	assert(0);
     }
+    // new data with the same entries as the current one (e.g. binned toys), in the channels already built, only changes the weights
+    static bool weightsOnly = runtimedef::get("SIMNLL_WEIGHTS_ONLY_DATA");
+    if (weightsOnly && setWeightsFromData_(data)) {
+        invalidateChannelIndex_();
+        setValueDirty();
+        return;
+    }
     splitWithWeights(*dataOriginal_, pdfOriginal_->indexCat(), true);
     for (int ib = 0, nb = pdfs_.size(); ib < nb; ++ib) {
         CachingAddNLL *canll = pdfs_[ib];
@@ -1017,28 +2760,235 @@ cacheutils::CachingSimNLL::setData(const RooAbsData &data)
         //             " and " << (data ? data->numEntries() : -1) << " dataset entries (sumw " << data->sumEntries() << ", weighted " << data->isWeighted() << ")" << std::endl;
         canll->setData(*data);
     }
+    invalidateChannelIndex_();
 }
 
-void cacheutils::CachingSimNLL::splitWithWeights(const RooAbsData &data, const RooAbsCategory& splitCat, Bool_t createEmptyDataSets) {
-    RooCategory *cat = dynamic_cast<RooCategory *>(data.get()->find(splitCat.GetName()));
-    if (cat == 0) throw std::logic_error("Error: no category");
-    std::auto_ptr<RooAbsCategoryLValue> catClone((RooAbsCategoryLValue*) splitCat.Clone());
-    int nb = cat->numBins((const char *)0), ne = data.numEntries();
-    RooArgSet obs(*data.get()); obs.remove(*cat, true, true);
-    RooRealVar weight("_weight_","",1);
-    RooArgSet obsplus(obs); obsplus.add(weight);
-    if (nb != int(datasets_.size())) throw std::logic_error("Number of categories changed"); // this can happen due to bugs in RooDataSet
-    std::vector<int> includeZeroWeights(nb,0); bool includeZeroWeightsAny = false;
+bool
+cacheutils::CachingSimNLL::setWeights(const double *weights, unsigned int n)
+{
+    // check the whole layout first, so that nothing is changed if it doesn't match
+    buildAllChannels_();
+    unsigned int expected = 0;
+    for (int ib = 0, nb = pdfs_.size(); ib < nb; ++ib) {
+        if (pdfs_[ib] == 0) continue;
+        if (pdfs_[ib]->fineBinned()) return false;
+        expected += pdfs_[ib]->numWeights();
+    }
+    if (n != expected) return false;
+    for (int ib = 0, nb = pdfs_.size(); ib < nb; ++ib) {
+        CachingAddNLL *canll = pdfs_[ib];
+        if (canll == 0) continue;
+        unsigned int nw = canll->numWeights();
+        canll->setWeights(weights, nw);
+        weights += nw;
+    }
+    dataId_ = ++nextSimNLLDataId_;
+    invalidateChannelIndex_();
+    setValueDirty();
+    return true;
+}
+
+bool
+cacheutils::CachingSimNLL::expectedWeights(std::vector<double> &out) const
+{
+    buildAllChannels_();
+    out.clear();
+    std::vector<Double_t> channel;
+    for (int ib = 0, nb = pdfs_.size(); ib < nb; ++ib) {
+        if (pdfs_[ib] == 0) continue;
+        if (!pdfs_[ib]->expectedWeights(channel)) return false;
+        out.insert(out.end(), channel.begin(), channel.end());
+    }
+    return true;
+}
+
+RooDataSet *
+cacheutils::CachingSimNLL::asimovDataset(const RooArgSet &observables, RooRealVar &weightVar) const
+{
+    std::vector<double> weights;
+    if (!expectedWeights(weights)) return 0;
+    RooArgSet vars(observables), varsPlusWeight(observables); varsPlusWeight.add(weightVar);
+    RooAbsCategoryLValue *cat = dynamic_cast<RooAbsCategoryLValue *>(vars.find(pdfOriginal_->indexCat().GetName()));
+    if (cat == 0) return 0;
+    std::auto_ptr<RooAbsCategoryLValue> catClone((RooAbsCategoryLValue*) pdfOriginal_->indexCat().Clone());
+    std::auto_ptr<RooDataSet> ret(new RooDataSet(TString::Format("%sData", pdfOriginal_->GetName()), "", varsPlusWeight, weightVar.GetName()));
+    const double *w = weights.empty() ? 0 : &weights[0];
+    RooAbsArg::setDirtyInhibit(true); // don't propagate dirty flags while filling the dataset
+    for (int ib = 0, nb = pdfs_.size(); ib < nb; ++ib) {
+        if (pdfs_[ib] == 0) continue;
+        catClone->setBin(ib);
+        cat->setLabel(catClone->getLabel());
+        // expectedWeights succeeded, so all the entries of the channel are in its weights
+        const RooAbsData *data = datasets_[ib];
+        for (int i = 0, n = data->numEntries(); i < n; ++i) {
+            vars = *data->get(i);
+            ret->add(vars, *w++);
+        }
+    }
+    RooAbsArg::setDirtyInhibit(false); // restore proper propagation of dirty flags
+    return ret.release();
+}
+
+void
+cacheutils::CachingSimNLL::weightsLayout(std::vector<unsigned int> &sizes) const
+{
+    buildAllChannels_();
+    sizes.resize(pdfs_.size());
+    for (int ib = 0, nb = pdfs_.size(); ib < nb; ++ib) {
+        sizes[ib] = pdfs_[ib] ? pdfs_[ib]->numWeights() : 0;
+    }
+}
+
+void
+cacheutils::CachingSimNLL::reportFineBinning()
+{
+    double total = 0; bool any = false;
+    for (int ib = 0, nb = pdfs_.size(); ib < nb; ++ib) {
+        CachingAddNLL *canll = pdfs_[ib];
+        if (canll == 0 || !canll->fineBinned()) continue;
+        double binned = canll->getVal(), exact = canll->exactNll();
+        printf("Fine binning of channel %s: NLL %.6f, with the unbinned data %.6f, difference %+.6f\n", canll->pdf()->GetName(), binned, exact, binned - exact);
+        total += binned - exact; any = true;
+    }
+    if (any) printf("Fine binning: total NLL difference from the unbinned data %+.6f\n", total);
+    setValueDirty();
+}
+
+namespace {
+    std::string formatBytes(double bytes) {
+        static const char *units[] = { "B", "kB", "MB", "GB", "TB" };
+        int u = 0;
+        while (bytes >= 1024 && u < 4) { bytes /= 1024; ++u; }
+        char buff[32];
+        snprintf(buff, sizeof(buff), "%.1f %s", bytes, units[u]);
+        return buff;
+    }
+}
+
+void
+cacheutils::CachingSimNLL::reportMemory() const
+{
+    // SIMNLL_MEMORY_REPORT=<n> lists the n largest pieces (just the largest with the bare flag, which is 1), and none if
+    // called without it. The pdfs are evaluated once at the current values of the parameters, so that what they cache is there.
+    int top = std::max(0, runtimedef::get("SIMNLL_MEMORY_REPORT"));
+    getVal();
+    std::vector<std::pair<std::string, MemoryFootprint> > channels;
+    MemoryFootprint all;
+    unsigned int notBuilt = 0;
+    for (int ib = 0, nb = pdfs_.size(); ib < nb; ++ib) {
+        if (pdfs_[ib] == 0) { if (lazyPdfs_[ib] != 0) ++notBuilt; continue; }
+        MemoryFootprint fp;
+        pdfs_[ib]->memoryFootprint(fp);
+        all.nominal += fp.nominal; all.morphs += fp.morphs; all.caches += fp.caches; all.data += fp.data; all.nodes += fp.nodes;
+        all.items.insert(all.items.end(), fp.items.begin(), fp.items.end());
+        fp.items.clear();
+        channels.push_back(std::make_pair(std::string(pdfs_[ib]->GetName()), fp));
+    }
+    std::sort(channels.begin(), channels.end(), [](const std::pair<std::string, MemoryFootprint> &a, const std::pair<std::string, MemoryFootprint> &b) { return a.second.total() > b.second.total(); });
+    printf("\n=== Memory held by the channels of the NLL (SIMNLL_MEMORY_REPORT) ===\n");
+    printf("%-40s %11s %11s %11s %11s %11s %11s\n", "channel", "nominal", "morphs", "caches", "data", "nodes", "total");
+    auto printRow = [](const std::string &name, const MemoryFootprint &fp) {
+        printf("%-40s %11s %11s %11s %11s %11s %11s\n", name.c_str(), formatBytes(fp.nominal).c_str(), formatBytes(fp.morphs).c_str(),
+                formatBytes(fp.caches).c_str(), formatBytes(fp.data).c_str(), formatBytes(fp.nodes).c_str(), formatBytes(fp.total()).c_str());
+    };
+    for (const auto &channel : channels) printRow(channel.first, channel.second);
+    printRow("TOTAL", all);
+    if (notBuilt) printf("(%u channels not built yet, SIMNLL_LAZY_CHANNELS)\n", notBuilt);
+    if (channelsShareBranchNodes_()) printf("(some channels share function nodes, which are counted in each of them)\n");
+    std::sort(all.items.begin(), all.items.end(), [](const std::pair<std::size_t, std::string> &a, const std::pair<std::size_t, std::string> &b) { return a.first > b.first; });
+    if (top > 0) printf("Largest pieces:\n");
+    for (int i = 0, n = std::min<int>(top, all.items.size()); i < n; ++i) {
+        printf("  %11s  %s\n", formatBytes(all.items[i].first).c_str(), all.items[i].second.c_str());
+    }
+    setValueDirty();
+}
+
+bool
+cacheutils::CachingSimNLL::zeroWeightChannels_(std::vector<int> &includeZeroWeights) const
+{
+    int nb = datasets_.size();
+    includeZeroWeights.assign(nb, 0);
+    bool any = false;
     if (runtimedef::get("ADDNLL_ROOREALSUM_BASICINT") && runtimedef::get("ADDNLL_ROOREALSUM_KEEPZEROS") && factorizedPdf_.get()) {
+        std::auto_ptr<RooAbsCategoryLValue> catClone((RooAbsCategoryLValue*) pdfOriginal_->indexCat().Clone());
         for (int ib = 0; ib < nb; ++ib) {
             catClone->setBin(ib);
             RooAbsPdf *pdf = factorizedPdf_->getPdf(catClone->getLabel());
             if (dynamic_cast<RooRealSumPdf*>(pdf)!=0) {
                 includeZeroWeights[ib] = 1;
-                includeZeroWeightsAny = true;
+                any = true;
             }
         }
     }
+    return any;
+}
+
+bool
+cacheutils::CachingSimNLL::setWeightsFromData_(const RooAbsData &data)
+{
+    RooCategory *cat = dynamic_cast<RooCategory *>(data.get()->find(pdfOriginal_->indexCat().GetName()));
+    int nb = datasets_.size();
+    if (cat == 0 || cat->numBins((const char *)0) != nb || int(pdfs_.size()) != nb || int(lazyPdfs_.size()) != nb) return false;
+    // the weights of the datasets of the channels are not updated, so the channels that are built (or built again) from
+    // them later need a full split
+    if (lazyChannels_ >= 2) return false;
+    // the observables of the new data matching those of each channel
+    std::vector<std::vector<std::pair<const RooRealVar *, const RooRealVar *> > > vars(nb);
+    std::vector<unsigned int> offsets(nb+1, 0);
+    const RooArgSet *row = data.get();
+    for (int ib = 0; ib < nb; ++ib) {
+        offsets[ib+1] = offsets[ib];
+        if (pdfs_[ib] == 0) { if (lazyPdfs_[ib] != 0) return false; continue; }
+        if (datasets_[ib] == 0 || pdfs_[ib]->fineBinned() || int(pdfs_[ib]->numWeights()) != datasets_[ib]->numEntries()) return false;
+        RooFIter iter = datasets_[ib]->get()->fwdIterator();
+        for (RooAbsArg *a = iter.next(); a != 0; a = iter.next()) {
+            const RooRealVar *mine = dynamic_cast<const RooRealVar *>(a), *theirs = dynamic_cast<const RooRealVar *>(row->find(a->GetName()));
+            if (mine == 0 || theirs == 0) return false;
+            vars[ib].push_back(std::make_pair(theirs, mine));
+        }
+        offsets[ib+1] += datasets_[ib]->numEntries();
+    }
+    // the same selection of the entries as splitWithWeights; each entry kept must be at the same point as the one it replaces
+    std::vector<int> includeZeroWeights;
+    bool includeZeroWeightsAny = zeroWeightChannels_(includeZeroWeights);
+    std::vector<double> weights(offsets[nb]);
+    std::vector<unsigned int> pos(nb, 0);
+    for (int i = 0, ne = data.numEntries(); i < ne; ++i) {
+        data.get(i);
+        double w = data.weight();
+        if (w == 0 && !includeZeroWeightsAny) continue;
+        int ib = cat->getBin();
+        if (ib < 0 || ib >= nb || pdfs_[ib] == 0 || !(w > 0 || includeZeroWeights[ib])) continue;
+        unsigned int k = pos[ib]++;
+        if (offsets[ib] + k >= offsets[ib+1]) return false;
+        datasets_[ib]->get(k);
+        for (const std::pair<const RooRealVar *, const RooRealVar *> &v : vars[ib]) {
+            if (v.first->getVal() != v.second->getVal()) return false;
+        }
+        weights[offsets[ib] + k] = w;
+    }
+    if (offsets[nb] == 0) return false;
+    for (int ib = 0; ib < nb; ++ib) {
+        if (offsets[ib] + pos[ib] != offsets[ib+1]) return false;
+    }
+    for (int ib = 0; ib < nb; ++ib) {
+        if (pdfs_[ib] == 0) continue;
+        pdfs_[ib]->setWeights(&weights[offsets[ib]], offsets[ib+1] - offsets[ib]);
+    }
+    return true;
+}
+
+void cacheutils::CachingSimNLL::splitWithWeights(const RooAbsData &data, const RooAbsCategory& splitCat, Bool_t createEmptyDataSets) {
+    RooCategory *cat = dynamic_cast<RooCategory *>(data.get()->find(splitCat.GetName()));
+    if (cat == 0) throw std::logic_error("Error: no category");
+    std::auto_ptr<RooAbsCategoryLValue> catClone((RooAbsCategoryLValue*) splitCat.Clone());
+    int nb = cat->numBins((const char *)0), ne = data.numEntries();
+    RooArgSet obs(*data.get()); obs.remove(*cat, true, true);
+    RooRealVar weight("_weight_","",1);
+    RooArgSet obsplus(obs); obsplus.add(weight);
+    if (nb != int(datasets_.size())) throw std::logic_error("Number of categories changed"); // this can happen due to bugs in RooDataSet
+    std::vector<int> includeZeroWeights;
+    bool includeZeroWeightsAny = zeroWeightChannels_(includeZeroWeights);
     for (int ib = 0; ib < nb; ++ib) {
         if (datasets_[ib] == 0) {
             catClone->setBin(ib);
@@ -1065,6 +3015,7 @@ void cacheutils::CachingSimNLL::splitWithWeights(const RooAbsData &data, const R
 }
 
 void cacheutils::CachingSimNLL::setZeroPoint() {
+    zeroPointSet_ = true;
     for (std::vector<CachingAddNLL*>::const_iterator it = pdfs_.begin(), ed = pdfs_.end(); it != ed; ++it) {
         if (*it != 0) (*it)->setZeroPoint();
     }
@@ -1083,26 +3034,368 @@ void cacheutils::CachingSimNLL::setZeroPoint() {
         double logpdfval = (*it)->getLogValFast();
         *itz = -logpdfval;
     }
+    if (constraintBlock_.get()) constraintBlock_->setZeroPoints(constrainZeroPointsFast_, constrainZeroPointsFastPoisson_);
+    invalidateChannelIndex_();
     setValueDirty();
 }
 
 void cacheutils::CachingSimNLL::clearZeroPoint() {
+    zeroPointSet_ = false;
     for (std::vector<CachingAddNLL*>::const_iterator it = pdfs_.begin(), ed = pdfs_.end(); it != ed; ++it) {
         if (*it != 0) (*it)->clearZeroPoint();
     }
     std::fill(constrainZeroPoints_.begin(), constrainZeroPoints_.end(), 0.0);
     std::fill(constrainZeroPointsFast_.begin(), constrainZeroPointsFast_.end(), 0.0);
     std::fill(constrainZeroPointsFastPoisson_.begin(), constrainZeroPointsFastPoisson_.end(), 0.0);
+    if (constraintBlock_.get()) constraintBlock_->setZeroPoints(constrainZeroPointsFast_, constrainZeroPointsFastPoisson_);
+    invalidateChannelIndex_();
     setValueDirty();
 }
 
 void cacheutils::CachingSimNLL::clearConstantZeroPoint() {
+    constantZeroPointCleared_ = true;
     for (std::vector<CachingAddNLL*>::const_iterator it = pdfs_.begin(), ed = pdfs_.end(); it != ed; ++it) {
         if (*it != 0) (*it)->clearConstantZeroPoint();
     }
+    invalidateChannelIndex_();
     setValueDirty();
 }
 
+bool cacheutils::CachingSimNLL::saturatedNll(double &ret) const {
+    if (!constrainPdfs_.empty() || !channelMasks_.empty()) return false;
+    buildAllChannels_();
+    DefaultAccumulator sum = 0;
+    for (std::vector<CachingAddNLL*>::const_iterator it = pdfs_.begin(), ed = pdfs_.end(); it != ed; ++it) {
+        if (*it == 0) continue;
+        double nllval;
+        if (!(*it)->saturatedNll(nllval)) return false;
+        sum += nllval;
+    }
+    // the channels of the saturated model don't depend on the nuisances, which then go where each constraint is at its maximum:
+    // x = mean for the gaussians (log = 0), and mean = observed for the poissons
+    std::vector<double>::const_iterator itz = constrainZeroPointsFast_.begin();
+    for (std::vector<SimpleGaussianConstraint*>::const_iterator it = constrainPdfsFast_.begin(), ed = constrainPdfsFast_.end(); it != ed; ++it, ++itz) { 
+        sum -= *itz;
+    }
+    itz = constrainZeroPointsFastPoisson_.begin();
+    for (std::vector<SimplePoissonConstraint*>::const_iterator it = constrainPdfsFastPoisson_.begin(), ed = constrainPdfsFastPoisson_.end(); it != ed; ++it, ++itz) { 
+        double observed = (*it)->getX().getVal();
+        double logpdfval = 0; // same cases as in getLogValFast
+        if (std::abs(observed) >= 1e-10) logpdfval = (observed < 1000000 ? observed * log(observed) - observed - TMath::LnGamma(observed+1.) : 0.5*log(observed));
+        sum -= (logpdfval + *itz);
+    }
+    ret = sum.sum();
+    return true;
+}
+
+void
+cacheutils::CachingSimNLL::setupGradient_(const std::vector<RooRealVar *> &params) const 
+{
+    gradParams_ = params;
+    gradColorParams_.clear(); gradColorTerms_.clear();
+    std::unordered_map<const RooAbsArg *, unsigned int> index;
+    for (unsigned int j = 0, n = params.size(); j < n; ++j) index[params[j]] = j;
+    gradChannelParams_.assign(pdfs_.size(), std::vector<unsigned int>());
+    for (unsigned int ib = 0, nb = pdfs_.size(); ib < nb; ++ib) {
+        if (channelPdf_(ib) == 0) continue;
+        RooArgSet channelParams; channelParams_(ib, channelParams);
+        RooFIter iter = channelParams.fwdIterator();
+        for (RooAbsArg *a = iter.next(); a != 0; a = iter.next()) {
+            std::unordered_map<const RooAbsArg *, unsigned int>::const_iterator match = index.find(a);
+            if (match != index.end()) gradChannelParams_[ib].push_back(match->second);
+        }
+    }
+    // same for the constraints, which always come in the same three flavours
+    std::vector<std::vector<unsigned int> > * constrainParams[3] = { &gradConstrainParams_, &gradConstrainFastParams_, &gradConstrainFastPoissonParams_ };
+    std::vector<const RooAbsPdf *> constrains[3];
+    constrains[0].assign(constrainPdfs_.begin(), constrainPdfs_.end());
+    constrains[1].assign(constrainPdfsFast_.begin(), constrainPdfsFast_.end());
+    constrains[2].assign(constrainPdfsFastPoisson_.begin(), constrainPdfsFastPoisson_.end());
+    for (int k = 0; k < 3; ++k) {
+        constrainParams[k]->assign(constrains[k].size(), std::vector<unsigned int>());
+        for (unsigned int ic = 0, nc = constrains[k].size(); ic < nc; ++ic) {
+            std::auto_ptr<RooArgSet> vars(constrains[k][ic]->getVariables());
+            RooFIter iter = vars->fwdIterator();
+            for (RooAbsArg *a = iter.next(); a != 0; a = iter.next()) {
+                std::unordered_map<const RooAbsArg *, unsigned int>::const_iterator match = index.find(a);
+                if (match != index.end()) (*constrainParams[k])[ic].push_back(match->second);
+            }
+        }
+    }
+}
+
+void
+cacheutils::CachingSimNLL::gradient(const std::vector<RooRealVar *> &params, std::vector<double> &grad) const 
+{
+    if (params != gradParams_) setupGradient_(params);
+    grad.assign(params.size(), 0.0);
+    for (unsigned int ib = 0, nb = pdfs_.size(); ib < nb; ++ib) {
+        if (channelPdf_(ib) == 0 || gradChannelParams_[ib].empty()) continue;
+        if (channelMasks_.size() > 0 && channelMasks_[ib]->getVal() != 0.) continue;
+        channel_(ib)->addGradient(params, gradChannelParams_[ib], &grad[0]);
+    }
+    // constraints enter as -log(pdf)
+    for (unsigned int ic = 0, nc = constrainPdfs_.size(); ic < nc; ++ic) {
+        const RooAbsPdf *pdf = constrainPdfs_[ic]; const RooArgSet *nuis = nuis_;
+        for (unsigned int j : gradConstrainParams_[ic]) {
+            grad[j] -= numericDerivative(*params[j], [pdf,nuis]() { double pdfval = pdf->getVal(nuis); return pdfval > 0 ? log(pdfval) : log(1e-9); });
+        }
+    }
+    for (unsigned int ic = 0, nc = constrainPdfsFast_.size(); ic < nc; ++ic) {
+        const SimpleGaussianConstraint *pdf = constrainPdfsFast_[ic];
+        for (unsigned int j : gradConstrainFastParams_[ic]) {
+            double deriv;
+            if (!pdf->getLogValFastDerivative(*params[j], deriv)) {
+                deriv = numericDerivative(*params[j], [pdf]() { return pdf->getLogValFast(); });
+            }
+            grad[j] -= deriv;
+        }
+    }
+    for (unsigned int ic = 0, nc = constrainPdfsFastPoisson_.size(); ic < nc; ++ic) {
+        const SimplePoissonConstraint *pdf = constrainPdfsFastPoisson_[ic];
+        for (unsigned int j : gradConstrainFastPoissonParams_[ic]) {
+            grad[j] -= numericDerivative(*params[j], [pdf]() { return pdf->getLogValFast(); });
+        }
+    }
+}
+
+void
+cacheutils::CachingSimNLL::setupColoring_() const
+{
+    // the terms each parameter enters, and the parameters of each term
+    unsigned int n = gradParams_.size(), nb = pdfs_.size();
+    std::vector<const std::vector<unsigned int> *> termParams;
+    for (unsigned int ib = 0; ib < nb; ++ib) termParams.push_back(&gradChannelParams_[ib]);
+    for (const std::vector<unsigned int> &ps : gradConstrainParams_) termParams.push_back(&ps);
+    for (const std::vector<unsigned int> &ps : gradConstrainFastParams_) termParams.push_back(&ps);
+    for (const std::vector<unsigned int> &ps : gradConstrainFastPoissonParams_) termParams.push_back(&ps);
+    std::vector<std::vector<unsigned int> > paramTerms(n);
+    std::vector<unsigned int> degree(n, 0);
+    for (unsigned int t = 0, nt = termParams.size(); t < nt; ++t) {
+        for (unsigned int j : *termParams[t]) { paramTerms[j].push_back(t); degree[j] += termParams[t]->size(); }
+    }
+    // greedy colouring, the parameters with most neighbours first (e.g. the signal strength, and the nuisances of all the channels)
+    std::vector<unsigned int> order;
+    for (unsigned int j = 0; j < n; ++j) if (!paramTerms[j].empty()) order.push_back(j);
+    std::stable_sort(order.begin(), order.end(), [&degree](unsigned int a, unsigned int b) { return degree[a] > degree[b]; });
+    std::vector<int> color(n, -1);
+    std::vector<unsigned int> seen;
+    for (unsigned int k = 0, nk = order.size(); k < nk; ++k) {
+        unsigned int j = order[k];
+        for (unsigned int t : paramTerms[j]) {
+            for (unsigned int q : *termParams[t]) if (color[q] >= 0) seen[color[q]] = k+1;
+        }
+        unsigned int c = 0;
+        while (c < seen.size() && seen[c] == k+1) ++c;
+        if (c == seen.size()) { seen.push_back(0); gradColorParams_.push_back(std::vector<unsigned int>()); gradColorTerms_.push_back(std::vector<std::pair<unsigned int, unsigned int> >()); }
+        color[j] = c;
+        gradColorParams_[c].push_back(j);
+        for (unsigned int t : paramTerms[j]) gradColorTerms_[c].push_back(std::make_pair(t, j));
+    }
+    for (std::vector<std::pair<unsigned int, unsigned int> > &terms : gradColorTerms_) std::sort(terms.begin(), terms.end());
+    CMB_LOG(logging::Info, "CachingSimNLL coloured gradient: " << order.size() << " parameters in " << gradColorParams_.size() << " colours");
+}
+
+double
+cacheutils::CachingSimNLL::termNll_(unsigned int t) const
+{
+    unsigned int nb = pdfs_.size(), ng = constrainPdfs_.size(), nf = constrainPdfsFast_.size();
+    if (t < nb) return channel_(t)->getVal();
+    t -= nb;
+    if (t < ng) { double pdfval = constrainPdfs_[t]->getVal(nuis_); return -(pdfval > 0 ? log(pdfval) : log(1e-9)); }
+    t -= ng;
+    if (t < nf) return -constrainPdfsFast_[t]->getLogValFast();
+    return -constrainPdfsFastPoisson_[t - nf]->getLogValFast();
+}
+
+void
+cacheutils::CachingSimNLL::coloredGradient(const std::vector<RooRealVar *> &params, std::vector<double> &grad) const 
+{
+    if (params != gradParams_) setupGradient_(params);
+    if (gradColorParams_.empty() && !params.empty()) setupColoring_();
+    grad.assign(params.size(), 0.0);
+    gradX0_.resize(params.size()); gradXlo_.resize(params.size()); gradXhi_.resize(params.size());
+    unsigned int nb = pdfs_.size();
+    for (unsigned int c = 0, nc = gradColorParams_.size(); c < nc; ++c) {
+        const std::vector<unsigned int> &colorParams = gradColorParams_[c];
+        const std::vector<std::pair<unsigned int, unsigned int> > &terms = gradColorTerms_[c];
+        // the channels are built before the threads, as in evaluate()
+        activeChannels_.clear();
+        for (unsigned int k = 0, nt = terms.size(); k < nt; ++k) {
+            unsigned int ib = terms[k].first;
+            if (ib >= nb) break;
+            if (channelMasks_.size() > 0 && channelMasks_[ib]->getVal() != 0.) continue;
+            channel_(ib);
+            activeChannels_.push_back(k);
+        }
+        gradTermHi_.assign(terms.size(), 0.0); gradTermLo_.assign(terms.size(), 0.0);
+        std::vector<double> *values[2] = { &gradTermHi_, &gradTermLo_ };
+        for (int side = 0; side < 2; ++side) {
+            for (unsigned int j : colorParams) {
+                if (side == 0) { gradX0_[j] = params[j]->getVal(); derivativePoints(*params[j], gradXlo_[j], gradXhi_[j]); }
+                params[j]->setVal(side == 0 ? gradXhi_[j] : gradXlo_[j]);
+            }
+            std::vector<double> &out = *values[side];
+            if (threadPool_) {
+                threadPool_->parallelFor(activeChannels_.size(), [this, &terms, &out](unsigned int i) {
+                    unsigned int k = activeChannels_[i];
+                    out[k] = pdfs_[terms[k].first]->getVal();
+                }, nThreads_);
+            } else {
+                for (unsigned int k : activeChannels_) out[k] = pdfs_[terms[k].first]->getVal();
+            }
+            for (unsigned int k = 0, nt = terms.size(); k < nt; ++k) {
+                if (terms[k].first >= nb) out[k] = termNll_(terms[k].first);
+            }
+        }
+        // at most one parameter of the colour per term, so each difference goes to that one only
+        for (unsigned int j : colorParams) params[j]->setVal(gradX0_[j]);
+        for (unsigned int k = 0, nt = terms.size(); k < nt; ++k) {
+            unsigned int j = terms[k].second;
+            if (gradXhi_[j] == gradXlo_[j]) continue;
+            grad[j] += (gradTermHi_[k] - gradTermLo_[k])/(gradXhi_[j] - gradXlo_[j]);
+        }
+    }
+}
+
+bool
+cacheutils::CachingSimNLL::hessian(const std::vector<RooRealVar *> &params, std::vector<double> &hess, unsigned int nThreads) const 
+{
+    if (params != gradParams_) setupGradient_(params);
+    if (gradColorParams_.empty() && !params.empty()) setupColoring_();
+    unsigned int n = params.size(), nb = pdfs_.size(), nc = gradColorParams_.size();
+    unsigned int nTerms = nb + constrainPdfs_.size() + constrainPdfsFast_.size() + constrainPdfsFastPoisson_.size();
+    hess.assign(n*n, 0.0);
+    // steps larger than those of the gradient, as the rounding of the second differences goes with the inverse of their square;
+    // the stencils are symmetric, so they're shrunk near the boundaries, and a parameter sitting on one can't be done here
+    std::vector<double> x0(n), h(n);
+    for (unsigned int j = 0; j < n; ++j) {
+        const RooRealVar &var = *params[j];
+        x0[j] = var.getVal();
+        double err = var.getError();
+        h[j] = 1e-2 * (err > 0 ? err : std::max(1.0, std::abs(x0[j])));
+        if (var.hasMax()) h[j] = std::min(h[j], var.getMax() - x0[j]);
+        if (var.hasMin()) h[j] = std::min(h[j], x0[j] - var.getMin());
+        if (!(h[j] > 0)) return false;
+    }
+    // one job per colour for the diagonal, and one per pair of colours with parameters entering the same term; each
+    // term has at most one parameter of each colour, so each of its second differences goes to a single element
+    struct Job { bool diagonal; std::vector<unsigned int> terms, first, second; std::vector<double> result; };
+    std::vector<Job> jobs(nc);
+    std::vector<std::vector<std::pair<unsigned int, unsigned int> > > termParams(nTerms);
+    for (unsigned int c = 0; c < nc; ++c) {
+        jobs[c].diagonal = true;
+        for (const std::pair<unsigned int, unsigned int> &tj : gradColorTerms_[c]) {
+            if (tj.first < nb && channelMasks_.size() > 0 && channelMasks_[tj.first]->getVal() != 0.) continue;
+            jobs[c].terms.push_back(tj.first); jobs[c].first.push_back(tj.second); jobs[c].second.push_back(tj.second);
+            termParams[tj.first].push_back(std::make_pair(c, tj.second));
+        }
+    }
+    std::unordered_map<unsigned long, unsigned int> pairJob;
+    for (unsigned int t = 0; t < nTerms; ++t) {
+        const std::vector<std::pair<unsigned int, unsigned int> > &tp = termParams[t];
+        for (unsigned int p = 0, np = tp.size(); p < np; ++p) {
+            for (unsigned int q = p+1; q < np; ++q) {
+                const std::pair<unsigned int, unsigned int> &a = std::min(tp[p], tp[q]), &b = std::max(tp[p], tp[q]);
+                std::pair<std::unordered_map<unsigned long, unsigned int>::iterator, bool> ins = pairJob.insert(std::make_pair((unsigned long)(a.first) * nc + b.first, jobs.size()));
+                if (ins.second) { jobs.push_back(Job()); jobs.back().diagonal = false; }
+                Job &job = jobs[ins.first->second];
+                job.terms.push_back(t); job.first.push_back(a.second); job.second.push_back(b.second);
+            }
+        }
+    }
+    // the clones for the threads, with the same terms in the same order; or just this NLL
+    std::vector<std::unique_ptr<NLLEvalContext> > contexts;
+    std::vector<std::pair<const CachingSimNLL *, std::vector<RooRealVar *> > > evaluators;
+    if (nThreads > 1 && jobs.size() > 1) {
+        for (unsigned int k = 0, nk = std::min<unsigned int>(nThreads, jobs.size()); k < nk; ++k) {
+            contexts.emplace_back(new NLLEvalContext(*this));
+            const CachingSimNLL &clone = contexts.back()->nll();
+            if (clone.pdfs_.size() != nb || clone.constrainPdfs_.size() != constrainPdfs_.size() ||
+                clone.constrainPdfsFast_.size() != constrainPdfsFast_.size() || clone.constrainPdfsFastPoisson_.size() != constrainPdfsFastPoisson_.size()) return false;
+            clone.buildAllChannels_();
+            evaluators.push_back(std::make_pair(&clone, std::vector<RooRealVar *>(n)));
+            for (unsigned int j = 0; j < n; ++j) {
+                if ((evaluators.back().second[j] = contexts.back()->param(params[j]->GetName())) == 0) return false;
+            }
+        }
+    } else {
+        evaluators.push_back(std::make_pair(this, params));
+    }
+    std::mutex mutex;
+    std::vector<unsigned int> idle;
+    for (unsigned int e = 0, ne = evaluators.size(); e < ne; ++e) idle.push_back(e);
+    auto run = [&](unsigned int ij) {
+        unsigned int e;
+        { std::lock_guard<std::mutex> lock(mutex); e = idle.back(); idle.pop_back(); }
+        struct Release { std::mutex &mutex; std::vector<unsigned int> &idle; unsigned int e; ~Release() { std::lock_guard<std::mutex> lock(mutex); idle.push_back(e); } } release = { mutex, idle, e };
+        const CachingSimNLL &nll = *evaluators[e].first;
+        const std::vector<RooRealVar *> &vars = evaluators[e].second;
+        Job &job = jobs[ij];
+        unsigned int nt = job.terms.size();
+        auto eval = [&](double sfirst, double ssecond, std::vector<double> &out) {
+            for (unsigned int k = 0; k < nt; ++k) {
+                vars[job.first[k]]->setVal(x0[job.first[k]] + sfirst * h[job.first[k]]);
+                vars[job.second[k]]->setVal(x0[job.second[k]] + ssecond * h[job.second[k]]);
+            }
+            out.resize(nt);
+            for (unsigned int k = 0; k < nt; ++k) out[k] = nll.termNll_(job.terms[k]);
+        };
+        std::vector<double> f[4];
+        job.result.resize(nt);
+        if (job.diagonal) {
+            eval(+1, +1, f[0]); eval(-1, -1, f[1]); eval(0, 0, f[2]);
+            for (unsigned int k = 0; k < nt; ++k) job.result[k] = (f[0][k] - 2*f[2][k] + f[1][k]) / (h[job.first[k]] * h[job.first[k]]);
+        } else {
+            eval(+1, +1, f[0]); eval(+1, -1, f[1]); eval(-1, +1, f[2]); eval(-1, -1, f[3]);
+            for (unsigned int k = 0; k < nt; ++k) job.result[k] = (f[0][k] - f[1][k] - f[2][k] + f[3][k]) / (4 * h[job.first[k]] * h[job.second[k]]);
+            for (unsigned int k = 0; k < nt; ++k) { vars[job.first[k]]->setVal(x0[job.first[k]]); vars[job.second[k]]->setVal(x0[job.second[k]]); }
+        }
+    };
+    if (contexts.empty()) {
+        for (unsigned int ij = 0, nj = jobs.size(); ij < nj; ++ij) run(ij);
+    } else {
+        ThreadPool::global(evaluators.size()).parallelFor(jobs.size(), run, evaluators.size());
+    }
+    // reduced in the order of the jobs, so that the result doesn't depend on the threads
+    for (const Job &job : jobs) {
+        for (unsigned int k = 0, nt = job.terms.size(); k < nt; ++k) {
+            unsigned int i = job.first[k], j = job.second[k];
+            hess[i*n + j] += job.result[k];
+            if (i != j) hess[j*n + i] += job.result[k];
+        }
+    }
+    CMB_LOG(logging::Info, "CachingSimNLL hessian: " << jobs.size() << " jobs on " << evaluators.size() << " threads");
+    return true;
+}
+
+cacheutils::CachingAddNLL *
+cacheutils::CachingSimNLL::channel_(unsigned int ib) const
+{
+    if (pdfs_[ib] == 0 && lazyPdfs_[ib] != 0) {
+        CachingAddNLL *canll = new CachingAddNLL(lazyLabels_[ib].c_str(), "", lazyPdfs_[ib], datasets_[ib], lazyIncludeZeroWeights_[ib]);
+        if (constantZeroPointCleared_) canll->clearConstantZeroPoint();
+        if (zeroPointSet_) canll->setZeroPoint();
+        pdfs_[ib] = canll;
+        channelDirty_[ib] = 1;
+    }
+    return pdfs_[ib];
+}
+
+void
+cacheutils::CachingSimNLL::buildAllChannels_() const
+{
+    for (unsigned int ib = 0, nb = pdfs_.size(); ib < nb; ++ib) channel_(ib);
+}
+
+void
+cacheutils::CachingSimNLL::channelParams_(unsigned int ib, RooArgSet &params) const
+{
+    if (pdfs_[ib] != 0) { params.add(pdfs_[ib]->params()); return; }
+    std::auto_ptr<RooArgSet> pdfParams(lazyPdfs_[ib]->getParameters(*datasets_[ib]));
+    params.add(*pdfParams);
+}
+
 void cacheutils::CachingSimNLL::setChannelMasks(const RooArgList &args) {
     // Here we're assuming that args has the same size and is aligned with
     // the vector of pdfs. This should be ok because RooSimultaneousOpt does
@@ -1129,3 +3422,44 @@ cacheutils::CachingSimNLL::getParameters(const RooArgSet* depList, Bool_t stripD
     return new RooArgSet(params_); 
 }
 
+cacheutils::NLLEvalContext::NLLEvalContext(const CachingSimNLL &nll)
+{
+    // deep clone: also the leaves (parameters and observables of the pdf) are copied
+    RooArgSet pdfSet(*nll.pdfOriginal_);
+    nodes_.reset((RooArgSet *) pdfSet.snapshot(true));
+    if (nodes_.get() == 0) throw std::runtime_error("NLLEvalContext: failed to clone pdf "+std::string(nll.pdfOriginal_->GetName()));
+    RooSimultaneous *pdf = dynamic_cast<RooSimultaneous *>(nodes_->find(nll.pdfOriginal_->GetName()));
+    if (pdf == 0) throw std::logic_error("NLLEvalContext: clone of "+std::string(nll.pdfOriginal_->GetName())+" is not a RooSimultaneous");
+    params_.reset(pdf->getParameters(*nll.dataOriginal_));
+    if (nll.nuis_) nuis_.reset((RooArgSet *) params_->selectCommon(*nll.nuis_));
+    nll_.reset(new CachingSimNLL(pdf, const_cast<RooAbsData *>(nll.dataOriginal_), nuis_.get()));
+    setValues(nll.params_);
+    // the first evaluation fills the caches and the global counters, so let's do it here and not in the threads
+    nll_->getVal();
+}
+
+cacheutils::NLLEvalContext::~NLLEvalContext()
+{
+    // the NLL holds pointers to the cloned nodes, so it goes first
+    nll_.reset();
+}
+
+RooRealVar *
+cacheutils::NLLEvalContext::param(const char *name) const
+{
+    return dynamic_cast<RooRealVar *>(params_->find(name));
+}
+
+void
+cacheutils::NLLEvalContext::setValues(const RooAbsCollection &other)
+{
+    RooFIter iter = params_->fwdIterator();
+    for (RooAbsArg *a = iter.next(); a != 0; a = iter.next()) {
+        RooRealVar *rrv = dynamic_cast<RooRealVar *>(a);
+        if (rrv == 0) continue;
+        const RooRealVar *src = dynamic_cast<const RooRealVar *>(other.find(a->GetName()));
+        if (src == 0 || src == rrv) continue;
+        rrv->setVal(src->getVal());
+        rrv->setConstant(src->isConstant());
+    }
+}
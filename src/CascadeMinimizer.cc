@@ -4,18 +4,40 @@
 #include "HiggsAnalysis/CombinedLimit/interface/CloseCoutSentry.h"
 #include "HiggsAnalysis/CombinedLimit/interface/utils.h"
 #include "HiggsAnalysis/CombinedLimit/interface/ProfilingTools.h"
+#include "HiggsAnalysis/CombinedLimit/interface/SequentialMinimizer.h"
+#include "HiggsAnalysis/CombinedLimit/interface/Combine.h"
 
 #include <Math/MinimizerOptions.h>
 #include <Math/IOptions.h>
 #include <RooCategory.h>
 #include <RooNumIntConfig.h>
+#include <RooRandom.h>
+#include <RooFIter.h>
+#include <TRandom.h>
+#include <TString.h>
 #include <TStopwatch.h>
 #include <RooStats/RooStatsUtils.h>
+#include <boost/functional/hash.hpp>
 
 #include <iomanip>
+#include <cstdio>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <chrono>
+#include <algorithm>
+#include <numeric>
 
 boost::program_options::options_description CascadeMinimizer::options_("Cascade Minimizer options");
 std::vector<CascadeMinimizer::Algo> CascadeMinimizer::fallbacks_;
+int CascadeMinimizer::parallelStarts_ = 0;
+bool CascadeMinimizer::adaptive_ = false;
+int CascadeMinimizer::adaptiveReprobe_ = 20;
+std::map<std::string, CascadeMinimizer::AdaptiveStats> CascadeMinimizer::adaptiveStats_;
+unsigned long CascadeMinimizer::adaptiveFits_ = 0;
+int CascadeMinimizer::jitteredStarts_ = 0;
+float CascadeMinimizer::jitterWidth_ = 1.0;
 bool CascadeMinimizer::preScan_;
 double CascadeMinimizer::approxPreFitTolerance_ = 0;
 int CascadeMinimizer::approxPreFitStrategy_ = 0;
@@ -28,8 +50,67 @@ bool CascadeMinimizer::firstHesse_ = false;
 bool CascadeMinimizer::lastHesse_ = false;
 int  CascadeMinimizer::minuit2StorageLevel_ = 0;
 bool CascadeMinimizer::runShortCombinations = true;
+bool CascadeMinimizer::saveTelemetry_ = false;
+CascadeMinimizer::Telemetry CascadeMinimizer::telemetry_ = { 0, 0, 0, 0, 0, 0, 0, 0 };
+int CascadeMinimizer::telemetryDepth_ = 0;
+
+namespace {
+    double telemetryNow() {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+}
+
+CascadeMinimizer::TelemetryScope::TelemetryScope(CascadeMinimizer &cmin, Phase phase) :
+    cmin_(cmin), phase_(phase), outer_(telemetryDepth_ == 0), ok_(true), 
+    evals_(RooMinimizerFcnOpt::totalEvals()), start_(telemetryNow())
+{
+    if (phase_ != Minimize) return;
+    if (outer_) {
+        Telemetry empty = { 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+        telemetry_ = empty;
+    }
+    telemetryDepth_++;
+}
+
+CascadeMinimizer::TelemetryScope::~TelemetryScope()
+{
+    double elapsed = telemetryNow() - start_;
+    switch (phase_) {
+        case Minimize: telemetryDepth_--; if (outer_) telemetry_.minimizeTime += elapsed; break;
+        case Hesse:    telemetry_.hesseTime += elapsed; break;
+        case Minos:    telemetry_.minosTime += elapsed; break;
+    }
+    // the calls and the result are counted only for the outermost scope, the nested ones are already part of it
+    if (!outer_) return;
+    unsigned long calls = RooMinimizerFcnOpt::totalEvals() - evals_;
+    telemetry_.fcnCalls += calls;
+    if (phase_ == Minimize) {
+        telemetry_.minimizeCalls += calls;
+        telemetry_.status = ok_ ? 0 : 1;
+        try { telemetry_.edm = cmin_.minimizer().edm(); } catch (std::exception &) { telemetry_.edm = -1; }
+        telemetry_.timePerCall = telemetry_.minimizeCalls ? telemetry_.minimizeTime/telemetry_.minimizeCalls : 0;
+    }
+}
+
+void CascadeMinimizer::addTelemetryBranches() 
+{
+    if (!saveTelemetry_) return;
+    Combine::addBranch("fit_fcnCalls",     &telemetry_.fcnCalls,     "fit_fcnCalls/I");
+    Combine::addBranch("fit_minimizeCalls",&telemetry_.minimizeCalls,"fit_minimizeCalls/I");
+    Combine::addBranch("fit_fallbacks",    &telemetry_.fallbacks,    "fit_fallbacks/I");
+    Combine::addBranch("fit_status",       &telemetry_.status,       "fit_status/I");
+    Combine::addBranch("fit_edm",          &telemetry_.edm,          "fit_edm/F");
+    Combine::addBranch("fit_minimizeTime", &telemetry_.minimizeTime, "fit_minimizeTime/F");
+    Combine::addBranch("fit_hesseTime",    &telemetry_.hesseTime,    "fit_hesseTime/F");
+    Combine::addBranch("fit_minosTime",    &telemetry_.minosTime,    "fit_minosTime/F");
+    Combine::addBranch("fit_timePerCall",  &telemetry_.timePerCall,  "fit_timePerCall/F");
+}
 float CascadeMinimizer::nuisancePruningThreshold_ = 0;
 double CascadeMinimizer::discreteMinTol_ = 0.001;
+int CascadeMinimizer::discreteForks_ = 0;
+double CascadeMinimizer::discretePruneDeltaNLL_ = 0;
+int CascadeMinimizer::discretePruneRecheck_ = 10;
+CascadeMinimizer::DiscretePruning CascadeMinimizer::discretePruning_;
 std::string CascadeMinimizer::defaultMinimizerType_=ROOT::Math::MinimizerOptions::DefaultMinimizerType();
 std::string CascadeMinimizer::defaultMinimizerAlgo_=ROOT::Math::MinimizerOptions::DefaultMinimizerAlgo();
 
@@ -62,6 +143,7 @@ void CascadeMinimizer::setAutoMax(const RooArgSet *pois)
 
 bool CascadeMinimizer::improve(int verbose, bool cascade) 
 {
+    TelemetryScope telemetry(*this, TelemetryScope::Minimize);
     minimizer_->setPrintLevel(verbose-1);
    
     minimizer_->setStrategy(strategy_);
@@ -82,6 +164,14 @@ bool CascadeMinimizer::improve(int verbose, bool cascade)
     }
     bool outcome;
     do {
+      if (cascade && parallelStarts_ > 1 && (!fallbacks_.empty() || jitteredStarts_ > 0)) {
+        outcome = improveInParallel(verbose);
+        continue;
+      }
+      if (cascade && adaptive_ && !fallbacks_.empty()) {
+        outcome = improveAdaptive(verbose);
+        continue;
+      }
       outcome = improveOnce(verbose-1);
       if (cascade && !outcome && !fallbacks_.empty()) {
         int         nominalStrat(strategy_);
@@ -96,12 +186,67 @@ bool CascadeMinimizer::improve(int verbose, bool cascade)
                 if (verbose > 0) std::cerr << "Will fallback to minimization using " << it->algo << ", strategy " << myStrategy << " and tolerance " << it->tolerance << std::endl;
                 minimizer_->setEps(ROOT::Math::MinimizerOptions::DefaultTolerance());
                 minimizer_->setStrategy(myStrategy);
+                telemetry_.fallbacks++;
                 outcome = improveOnce(verbose-2);
                 if (outcome) break;
             }
         }
       }
     } while (autoBounds_ && !autoBoundsOk(verbose-1));
+    telemetry.setStatus(outcome);
+    return outcome;
+}
+
+double CascadeMinimizer::AdaptiveStats::cost() const
+{
+    if (tries == 0) return std::numeric_limits<double>::infinity();
+    return (double(calls)/tries) / ((successes + 1.0)/(tries + 2.0));
+}
+
+bool CascadeMinimizer::improveAdaptive(int verbose) 
+{
+    std::string nominalType(ROOT::Math::MinimizerOptions::DefaultMinimizerType());
+    std::string nominalAlgo(ROOT::Math::MinimizerOptions::DefaultMinimizerAlgo());
+    float       nominalTol(ROOT::Math::MinimizerOptions::DefaultTolerance());
+    std::vector<Algo> candidates(1, Algo(nominalType+","+nominalAlgo, nominalTol, strategy_));
+    for (std::vector<Algo>::const_iterator it = fallbacks_.begin(), ed = fallbacks_.end(); it != ed; ++it) {
+        Algo c(it->algo, it->tolerance != Algo::default_tolerance() ? it->tolerance : nominalTol, 
+                         it->strategy  != Algo::default_strategy()  ? it->strategy  : strategy_);
+        // as in the cascade, a fallback that is the nominal configuration again is not run
+        if (c.algo == candidates[0].algo && c.tolerance == candidates[0].tolerance && c.strategy == candidates[0].strategy) continue;
+        candidates.push_back(c);
+    }
+    std::vector<AdaptiveStats *> stats;
+    for (const Algo &c : candidates) stats.push_back(&adaptiveStats_[TString::Format("%s:%g:%d", c.algo.c_str(), c.tolerance, c.strategy).Data()]);
+    // the never tried ones keep their place in the configured order, after those that were
+    std::vector<unsigned int> order(candidates.size());
+    std::iota(order.begin(), order.end(), 0);
+    bool reprobe = (adaptiveReprobe_ > 0 && adaptiveFits_ % adaptiveReprobe_ == 0);
+    ++adaptiveFits_;
+    if (!reprobe) std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) { return stats[a]->cost() < stats[b]->cost(); });
+    if (verbose > 1) {
+        std::cout << "Adaptive cascade" << (reprobe ? " (configured order)" : "") << ":";
+        for (unsigned int i : order) std::cout << " " << candidates[i].algo << "," << candidates[i].strategy << ":" << candidates[i].tolerance << " [" << stats[i]->successes << "/" << stats[i]->tries << "]";
+        std::cout << std::endl;
+    }
+    bool outcome = false;
+    for (unsigned int k = 0, n = order.size(); k < n && !outcome; ++k) {
+        const Algo &c = candidates[order[k]];
+        ProfileLikelihood::MinimizerSentry minimizerConfig(c.algo, c.tolerance);
+        if (k > 0) {
+            if (verbose > 0) std::cerr << "Will fallback to minimization using " << c.algo << ", strategy " << c.strategy << " and tolerance " << c.tolerance << std::endl;
+            telemetry_.fallbacks++;
+        }
+        minimizer_->setEps(ROOT::Math::MinimizerOptions::DefaultTolerance());
+        minimizer_->setStrategy(c.strategy);
+        unsigned long calls0 = RooMinimizerFcnOpt::totalEvals();
+        outcome = improveOnce(k == 0 ? verbose-1 : verbose-2);
+        AdaptiveStats &st = *stats[order[k]];
+        st.tries++; st.calls += RooMinimizerFcnOpt::totalEvals() - calls0;
+        if (outcome) st.successes++;
+    }
+    minimizer_->setEps(nominalTol);
+    minimizer_->setStrategy(strategy_);
     return outcome;
 }
 
@@ -117,6 +262,24 @@ bool CascadeMinimizer::improveOnce(int verbose, bool noHesse)
         minimizer_->setMaxFunctionCalls(maxcalls);
         minimizer_->setMaxIterations(maxcalls);
     }
+    static int seqBlocks = runtimedef::get("SeqMinimizer_blocks");
+    if (seqBlocks && myType == "SeqMinimizer") {
+        // let the sequential minimizer skip the blocks of parameters that can't have been affected by the last moves
+        std::vector<std::vector<std::string> > blocks;
+        cacheutils::CachingSimNLL *blocknll = dynamic_cast<cacheutils::CachingSimNLL *>(&nll_);
+        if (blocknll) blocknll->parameterBlocks(blocks);
+        cmsmath::SequentialMinimizer::setParameterBlocks(blocks);
+        if (verbose > 1) std::cout << "SeqMinimizer: " << blocks.size() << " independent blocks of parameters" << std::endl;
+    }
+    static int seqNewton = runtimedef::get("SeqMinimizer_newton");
+    if (seqNewton && myType == "SeqMinimizer") {
+        // pure rate systematics with a gaussian constraint give a nearly quadratic NLL, for which Newton steps converge much faster
+        std::vector<std::string> names;
+        cacheutils::CachingSimNLL *simnll = dynamic_cast<cacheutils::CachingSimNLL *>(&nll_);
+        if (simnll) simnll->rateOnlyParameters(names);
+        cmsmath::SequentialMinimizer::setNewtonParameters(names);
+        if (verbose > 1) std::cout << "SeqMinimizer: " << names.size() << " parameters minimized with Newton steps" << std::endl;
+    }
     if (oldFallback_){
         if (optConst) minimizer_->optimizeConst(std::max(0,optConst));
         if (rooFitOffset) minimizer_->setOffsetting(std::max(0,rooFitOffset));
@@ -127,6 +290,7 @@ bool CascadeMinimizer::improveOnce(int verbose, bool noHesse)
         if ((!simnll) && optConst) minimizer_->optimizeConst(std::max(0,optConst));
         if ((!simnll) && rooFitOffset) minimizer_->setOffsetting(std::max(0,rooFitOffset));
         if (firstHesse_ && !noHesse) {
+            TelemetryScope telemetry(*this, TelemetryScope::Hesse);
             minimizer_->setPrintLevel(std::max(0,verbose-3)); 
             minimizer_->hesse();
             if (simnll) simnll->updateZeroPoint(); 
@@ -134,6 +298,7 @@ bool CascadeMinimizer::improveOnce(int verbose, bool noHesse)
         }
         int status = minimizer_->minimize(myType.c_str(), myAlgo.c_str());
         if (lastHesse_ && !noHesse) {
+            TelemetryScope telemetry(*this, TelemetryScope::Hesse);
             if (simnll) simnll->updateZeroPoint(); 
             minimizer_->setPrintLevel(std::max(0,verbose-3)); 
             status = minimizer_->hesse();
@@ -146,8 +311,117 @@ bool CascadeMinimizer::improveOnce(int verbose, bool noHesse)
 }
 
 
+bool CascadeMinimizer::improveInParallel(int verbose) 
+{
+    std::string nominalType(ROOT::Math::MinimizerOptions::DefaultMinimizerType());
+    std::string nominalAlgo(ROOT::Math::MinimizerOptions::DefaultMinimizerAlgo());
+    float       nominalTol(ROOT::Math::MinimizerOptions::DefaultTolerance());
+    // candidate 0 is the nominal configuration, run by this process, then the fallbacks and the jittered starts
+    std::vector<Algo> candidates(1, Algo(nominalType+","+nominalAlgo, nominalTol, strategy_));
+    for (std::vector<Algo>::const_iterator it = fallbacks_.begin(), ed = fallbacks_.end(); it != ed; ++it) {
+        candidates.push_back(Algo(it->algo, it->tolerance != Algo::default_tolerance() ? it->tolerance : nominalTol, 
+                                            it->strategy  != Algo::default_strategy()  ? it->strategy  : strategy_));
+    }
+    unsigned int nconfigs = candidates.size();
+    for (int j = 0; j < jitteredStarts_; ++j) candidates.push_back(candidates.front());
+    telemetry_.fallbacks += candidates.size() - 1;
+
+    std::auto_ptr<RooArgSet> params(nll_.getParameters((const RooArgSet *)0));
+    RooArgSet start; params->snapshot(start);
+    // the jittered starting points are drawn here, so that they don't depend on how the candidates are spread among the processes
+    std::vector<std::vector<double> > jitters(candidates.size() - nconfigs);
+    for (unsigned int j = 0; j < jitters.size(); ++j) {
+        RooFIter iter = params->fwdIterator();
+        for (RooAbsArg *a = iter.next(); a != 0; a = iter.next()) {
+            RooRealVar *rrv = dynamic_cast<RooRealVar *>(a);
+            if (rrv == 0 || rrv->isConstant()) continue;
+            double width = jitterWidth_ * (rrv->getError() > 0 ? rrv->getError() : 1.0);
+            double val = rrv->getVal() + RooRandom::randomGenerator()->Gaus(0, width);
+            jitters[j].push_back(std::max(rrv->getMin(), std::min(rrv->getMax(), val)));
+        }
+    }
+
+    // each record is: outcome, nll, then the value of each parameter
+    unsigned int stride = 2 + params->getSize();
+    std::vector<std::vector<double> > results(candidates.size());
+    nll_.getVal(); // build the caches in the parent, so that the children share them copy-on-write
+    auto runCandidate = [&](unsigned int icand) -> std::vector<double> {
+        std::vector<double> record(stride, 0.);
+        try {
+            params->assignValueOnly(start);
+            if (icand >= nconfigs) {
+                RooFIter iter = params->fwdIterator(); unsigned int ip = 0;
+                for (RooAbsArg *a = iter.next(); a != 0; a = iter.next()) {
+                    RooRealVar *rrv = dynamic_cast<RooRealVar *>(a);
+                    if (rrv == 0 || rrv->isConstant()) continue;
+                    rrv->setVal(jitters[icand-nconfigs][ip++]);
+                }
+            }
+            const Algo &c = candidates[icand];
+            if (verbose > 1) std::cout << "Minimization " << icand << " using " << c.algo << ", strategy " << c.strategy << " and tolerance " << c.tolerance << (icand >= nconfigs ? " from a jittered start" : "") << std::endl;
+            ProfileLikelihood::MinimizerSentry minimizerConfig(c.algo, c.tolerance);
+            minimizer_->setEps(c.tolerance);
+            minimizer_->setStrategy(c.strategy);
+            record[0] = improveOnce(verbose-2);
+            record[1] = nll_.getVal();
+            RooFIter iter = params->fwdIterator(); unsigned int ip = 2;
+            for (RooAbsArg *a = iter.next(); a != 0; a = iter.next(), ++ip) {
+                RooRealVar *rrv = dynamic_cast<RooRealVar *>(a);
+                if (rrv) { record[ip] = rrv->getVal(); continue; }
+                RooCategory *rc = dynamic_cast<RooCategory *>(a);
+                if (rc) record[ip] = rc->getIndex();
+            }
+        } catch (std::exception &ex) {
+            if (icand != 0) throw; // reported by runInForks
+            std::cerr << "Minimization " << icand << " failed: " << ex.what() << std::endl;
+            record[0] = 0;
+        }
+        return record;
+    };
+    for (unsigned int first = 0, ncand = candidates.size(); first < ncand; ) {
+        // the parent runs the nominal configuration itself in the first batch
+        unsigned int last = std::min<unsigned int>(ncand, first + parallelStarts_);
+        utils::runInForks(first, last, runCandidate, results, first == 0, verbose > 2);
+        if (first == 0) {
+            minimizer_->setEps(nominalTol);
+            minimizer_->setStrategy(strategy_);
+        }
+        first = last;
+    }
+
+    // keep the lowest valid minimum; ties go to the earliest candidate, i.e. the same one the sequential cascade would pick
+    int best = -1;
+    for (unsigned int i = 0; i < results.size(); ++i) {
+        if (results[i].empty() || results[i][0] == 0 || std::isnan(results[i][1])) continue;
+        if (verbose > 1) std::cout << "Minimization " << i << " converged with NLL " << std::setprecision(10) << results[i][1] << std::endl;
+        if (best == -1 || results[i][1] < results[best][1] - discreteMinTol_) best = i;
+    }
+    if (best == -1) {
+        if (verbose > 0) std::cerr << "Failed minimization with all the " << candidates.size() << " configurations and starting points" << std::endl;
+        return false;
+    }
+    if (best == 0) return true; // this process is already at the nominal minimum
+    if (verbose > 0) std::cerr << "Best minimum found using " << candidates[best].algo << ", strategy " << candidates[best].strategy << (unsigned(best) >= nconfigs ? " from a jittered start" : "") << std::endl;
+    RooFIter iter = params->fwdIterator(); unsigned int ip = 2;
+    for (RooAbsArg *a = iter.next(); a != 0; a = iter.next(), ++ip) {
+        RooRealVar *rrv = dynamic_cast<RooRealVar *>(a);
+        if (rrv) { rrv->setVal(results[best][ip]); continue; }
+        RooCategory *rc = dynamic_cast<RooCategory *>(a);
+        if (rc) rc->setIndex(int(results[best][ip]));
+    }
+    // polish the minimum in this process, so that the minimizer state is there for hesse and minos
+    ProfileLikelihood::MinimizerSentry minimizerConfig(candidates[best].algo, candidates[best].tolerance);
+    minimizer_->setEps(candidates[best].tolerance);
+    minimizer_->setStrategy(candidates[best].strategy);
+    bool outcome = improveOnce(verbose-2);
+    minimizer_->setEps(nominalTol);
+    minimizer_->setStrategy(strategy_);
+    return outcome;
+}
+
 bool CascadeMinimizer::minos(const RooArgSet & params , int verbose ) {
    
+   TelemetryScope telemetry(*this, TelemetryScope::Minos);
    minimizer_->setPrintLevel(verbose-1); // for debugging
    std::string myType(ROOT::Math::MinimizerOptions::DefaultMinimizerType());
    std::string myAlgo(ROOT::Math::MinimizerOptions::DefaultMinimizerAlgo());
@@ -176,6 +450,7 @@ bool CascadeMinimizer::minos(const RooArgSet & params , int verbose ) {
 
 bool CascadeMinimizer::hesse(int verbose ) {
    
+   TelemetryScope telemetry(*this, TelemetryScope::Hesse);
    minimizer_->setPrintLevel(verbose-1); // for debugging
    std::string myType(ROOT::Math::MinimizerOptions::DefaultMinimizerType());
    std::string myAlgo(ROOT::Math::MinimizerOptions::DefaultMinimizerAlgo());
@@ -253,6 +528,8 @@ are freely floating. We should cut them down to find which ones are
 
 bool CascadeMinimizer::minimize(int verbose, bool cascade) 
 {
+    ScopedTimer timer("CascadeMinimizer::minimize");
+    TelemetryScope telemetry(*this, TelemetryScope::Minimize);
     static int optConst = runtimedef::get("MINIMIZER_optimizeConst");
     static int rooFitOffset = runtimedef::get("MINIMIZER_rooFitOffset");
     if (runtimedef::get("CMIN_CENSURE")) {
@@ -330,29 +607,64 @@ bool CascadeMinimizer::minimize(int verbose, bool cascade)
       (nllParams)->snapshot(reallyCleanParameters); // should remove also the nuisance parameters from here!
       // Before each step, reset the parameters back to their prefit state!
       
-      if (runShortCombinations) {
-        // Initial fit under current index values
-        improve(verbose, cascade);
-        double minimumNLL  = 10+nll_.getVal();
-        double previousNLL = nll_.getVal();
-        int maxIterations = 15; int iterationCounter=0;
-        for (;iterationCounter<maxIterations;iterationCounter++){
-          iterativeMinimize(minimumNLL,verbose,cascade);
-          if ( fabs(previousNLL-minimumNLL) < discreteMinTol_ ) break; // should be minimizer tolerance
-          previousNLL = minimumNLL ;
-        }
-
-      } else {
+      const cacheutils::CachingSimNLL *prunedSimNLL = dynamic_cast<const cacheutils::CachingSimNLL *>(&nll_);
+      bool pruning = (discretePruneDeltaNLL_ > 0 && prunedSimNLL != 0);
+      DiscretePruning &dp = discretePruning_;
+      std::size_t floatingKey = 0;
+      if (pruning) {
+          // another NLL, or new data for this one: start again from scratch
+          if (dp.dataId != prunedSimNLL->dataId()) { dp = DiscretePruning(); dp.dataId = prunedSimNLL->dataId(); }
+          dp.fullCheck = (discretePruneRecheck_ > 0 ? dp.calls % discretePruneRecheck_ == 0 : dp.calls == 0);
+          dp.calls++; dp.pruned = 0;
+          std::auto_ptr<RooArgSet> params(nll_.getParameters((const RooArgSet *)0));
+          RooFIter iter = params->fwdIterator();
+          for (RooAbsArg *a = iter.next(); a != 0; a = iter.next()) {
+              if (!a->isConstant()) boost::hash_combine(floatingKey, std::string(a->GetName()));
+          }
+      }
 
-        double minimumNLL = 10+nll_.getVal();
-        std::vector<std::vector<bool>> contIndex;
-        multipleMinimize(reallyCleanParameters,ret,minimumNLL,verbose,cascade,0,contIndex);
+      auto scanDiscrete = [&]() {
+        if (runShortCombinations) {
+          // Initial fit under current index values
+          improve(verbose, cascade);
+          double minimumNLL  = 10+nll_.getVal();
+          double previousNLL = nll_.getVal();
+          int maxIterations = 15; int iterationCounter=0;
+          for (;iterationCounter<maxIterations;iterationCounter++){
+            iterativeMinimize(minimumNLL,verbose,cascade);
+            if ( fabs(previousNLL-minimumNLL) < discreteMinTol_ ) break; // should be minimizer tolerance
+            previousNLL = minimumNLL ;
+          }
+
+        } else {
+
+          double minimumNLL = 10+nll_.getVal();
+          std::vector<std::vector<bool>> contIndex;
+          multipleMinimize(reallyCleanParameters,ret,minimumNLL,verbose,cascade,0,contIndex);
    
-        if (CascadeMinimizerGlobalConfigs::O().pdfCategories.getSize() > 1) {
-           multipleMinimize(reallyCleanParameters,ret,minimumNLL,verbose,cascade,1,contIndex);
-           multipleMinimize(reallyCleanParameters,ret,minimumNLL,verbose,cascade,2,contIndex);
-        }
+          if (CascadeMinimizerGlobalConfigs::O().pdfCategories.getSize() > 1) {
+             multipleMinimize(reallyCleanParameters,ret,minimumNLL,verbose,cascade,1,contIndex);
+             multipleMinimize(reallyCleanParameters,ret,minimumNLL,verbose,cascade,2,contIndex);
+          }
 
+        }
+      };
+      scanDiscrete();
+
+      if (pruning) {
+          double here = nll_.getVal();
+          if (verbose > 1 && dp.pruned) std::cout << "Skipped " << dp.pruned << " fits of pdfs of the envelopes more than " << discretePruneDeltaNLL_ << " above the best one" << std::endl;
+          std::map<std::size_t, double>::iterator best = dp.bestNLL.find(floatingKey);
+          if (dp.pruned && best != dp.bestNLL.end() && here < best->second - discreteMinTol_) {
+              // the best point so far with these floating parameters, found without some of the pdfs: check it with all of them
+              if (verbose > 1) std::cout << "New best NLL " << here << " (was " << best->second << "), fitting again all the pdfs of the envelopes" << std::endl;
+              dp.fullCheck = true; dp.pruned = 0;
+              scanDiscrete();
+              here = nll_.getVal();
+          }
+          if (best == dp.bestNLL.end()) dp.bestNLL[floatingKey] = here;
+          else if (here < best->second) best->second = here;
+          dp.fullCheck = false;
       }
     }
 
@@ -369,6 +681,7 @@ bool CascadeMinimizer::minimize(int verbose, bool cascade)
         " [WARNING] Are you sure your model is correct?\n");
     }
 
+    telemetry.setStatus(ret);
     return ret;
 }
 
@@ -415,6 +728,10 @@ bool CascadeMinimizer::multipleMinimize(const RooArgSet &reallyCleanParameters,
 	pdfSizes.push_back(npdf);
     }
 
+    // skip the pdfs far from the best one the last time, and take their NLL in this scan
+    bool notePruning = (mode == 0 && discretePruneDeltaNLL_ > 0);
+    if (notePruning) startDiscretePass_(bestIndeces, pdfSizes, contributingIndeces);
+
     // keep hold of best fitted parameters! 
     std::auto_ptr<RooArgSet> params;
     params.reset(nll_.getParameters((const RooArgSet *)0) );
@@ -449,6 +766,12 @@ bool CascadeMinimizer::multipleMinimize(const RooArgSet &reallyCleanParameters,
 
     std::vector<std::vector<int> >::iterator my_it = myCombos.begin();
     if (mode!=0) my_it++; // already did the best fit case
+
+    if (discreteForks_ > 1 && myCombos.end() - my_it > 1) {
+        std::vector<std::vector<int> > todo(my_it, myCombos.end());
+        newDiscreteMinimum = multipleMinimizeInParallel(todo, *params, snap, reallyCleanParameters, bestIndeces, ret, minimumNLL, verbose, cascade, mode, contributingIndeces);
+        my_it = myCombos.end();
+    }
   
 
     int fitCounter = 0;
@@ -491,6 +814,7 @@ bool CascadeMinimizer::multipleMinimize(const RooArgSet &reallyCleanParameters,
 
       fitCounter++;
       double thisNllValue = nll_.getVal();
+      if (notePruning) noteDiscreteNLL_(cit, thisNllValue);
       
       if ( thisNllValue < minimumNLL ){
 		// Now we insert the correction ! 
@@ -534,6 +858,8 @@ bool CascadeMinimizer::multipleMinimize(const RooArgSet &reallyCleanParameters,
 
     }
 
+    if (notePruning) endDiscretePass_();
+
     // Assign best values ;
     for (int id=0;id<numIndeces;id++) {
 	((RooCategory*)(pdfCategoryIndeces.at(id)))->setIndex(bestIndeces[id]);	
@@ -542,6 +868,172 @@ bool CascadeMinimizer::multipleMinimize(const RooArgSet &reallyCleanParameters,
     return newDiscreteMinimum;
 }
 
+void CascadeMinimizer::startDiscretePass_(const std::vector<int> &start, const std::vector<int> &sizes, std::vector<std::vector<bool> > &contributing)
+{
+    DiscretePruning &dp = discretePruning_;
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    bool sameLayout = (dp.deltaNLL.size() == sizes.size());
+    for (unsigned int id = 0; sameLayout && id < sizes.size(); ++id) sameLayout = (int(dp.deltaNLL[id].size()) == sizes[id]);
+    if (!sameLayout) dp.deltaNLL.resize(sizes.size());
+    dp.start = start;
+    dp.pass.resize(sizes.size());
+    for (unsigned int id = 0; id < sizes.size(); ++id) {
+        if (!sameLayout) dp.deltaNLL[id].assign(sizes[id], nan);
+        dp.pass[id].assign(sizes[id], nan);
+    }
+    if (dp.fullCheck) return;
+    for (unsigned int id = 0; id < sizes.size(); ++id) {
+        for (int j = 0; j < sizes[id]; ++j) {
+            // never the current pdf (NaN, never fitted, compares false)
+            if (j != start[id] && contributing[id][j] && dp.deltaNLL[id][j] > discretePruneDeltaNLL_) {
+                contributing[id][j] = false;
+                dp.pruned++;
+            }
+        }
+    }
+}
+
+void CascadeMinimizer::noteDiscreteNLL_(const std::vector<int> &combo, double nll)
+{
+    DiscretePruning &dp = discretePruning_;
+    if (dp.start.size() != combo.size() || std::isnan(nll)) return;
+    int moved = -1, nmoved = 0;
+    for (unsigned int id = 0; id < combo.size(); ++id) {
+        if (combo[id] != dp.start[id]) { moved = id; nmoved++; }
+    }
+    if (nmoved > 1) return;
+    for (unsigned int id = 0; id < combo.size(); ++id) {
+        if (nmoved == 1 && int(id) != moved) continue;
+        double &slot = dp.pass[id][combo[id]];
+        if (std::isnan(slot) || nll < slot) slot = nll;
+    }
+}
+
+void CascadeMinimizer::endDiscretePass_()
+{
+    DiscretePruning &dp = discretePruning_;
+    double best = std::numeric_limits<double>::infinity();
+    for (unsigned int id = 0; id < dp.pass.size(); ++id) {
+        for (unsigned int j = 0; j < dp.pass[id].size(); ++j) {
+            if (!std::isnan(dp.pass[id][j])) best = std::min(best, dp.pass[id][j]);
+        }
+    }
+    if (!std::isinf(best)) {
+        for (unsigned int id = 0; id < dp.pass.size(); ++id) {
+            for (unsigned int j = 0; j < dp.pass[id].size(); ++j) {
+                if (!std::isnan(dp.pass[id][j])) dp.deltaNLL[id][j] = dp.pass[id][j] - best;
+            }
+        }
+    }
+    dp.start.clear();
+}
+
+bool CascadeMinimizer::multipleMinimizeInParallel(const std::vector<std::vector<int> > &combos, RooArgSet &params, RooArgSet &snap, const RooArgSet &reallyCleanParameters, 
+                                                  std::vector<int> &bestIndeces, bool &ret, double &minimumNLL, int verbose, bool cascade, int mode, 
+                                                  std::vector<std::vector<bool> > &contributingIndeces)
+{
+    RooArgList pdfCategoryIndeces = CascadeMinimizerGlobalConfigs::O().pdfCategories; 
+    int numIndeces = pdfCategoryIndeces.getSize();
+    bool newDiscreteMinimum = false;
+    // same as in multipleMinimize, used both for pruning after the cheap fit and for removing indices in mode 1
+    double maxDeviation = 5;
+
+    // the best NLL found by each running child, shared among all of them so that they can prune against the incumbent
+    double *incumbent = (double *) mmap(0, discreteForks_ * sizeof(double), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (incumbent == MAP_FAILED) throw std::runtime_error("CascadeMinimizer: failed to allocate shared memory");
+
+    // each record is: outcome, nll, pruned, then the value of each parameter
+    unsigned int stride = 3 + params.getSize();
+    nll_.getVal(); // build the caches in the parent, so that the children share them copy-on-write
+    int nfits = 0, npruned = 0;
+    std::vector<std::vector<int> >::const_iterator next = combos.begin();
+    while (next != combos.end()) {
+        // collect the next batch of combinations, skipping those with indices removed by the previous batches
+        std::vector<const std::vector<int> *> batch;
+        for (; next != combos.end() && int(batch.size()) < discreteForks_; ++next) {
+            bool isValidCombo = true;
+            for (int id = 0; id < numIndeces; ++id) isValidCombo = isValidCombo && contributingIndeces[id][(*next)[id]];
+            if (isValidCombo) batch.push_back(&*next);
+        }
+        if (batch.empty()) break;
+        for (int i = 0; i < discreteForks_; ++i) incumbent[i] = std::numeric_limits<double>::infinity();
+        std::vector<std::vector<double> > records;
+        utils::runInForks(0, batch.size(), [&](unsigned int ich) -> std::vector<double> {
+            std::vector<double> record(stride, 0.);
+            for (int id = 0; id < numIndeces; ++id) ((RooCategory*)(pdfCategoryIndeces.at(id)))->setIndex((*batch[ich])[id]);
+            params.assignValueOnly(reallyCleanParameters);
+            if (mode_ == Unconstrained && poiOnlyFit_) trivialMinimize(nll_, *poi_, 200);
+            // cheap first fit: if it's already far above the incumbent, don't bother with the full one
+            std::string myType(ROOT::Math::MinimizerOptions::DefaultMinimizerType());
+            std::string myAlgo(ROOT::Math::MinimizerOptions::DefaultMinimizerAlgo());
+            double nominalTol = ROOT::Math::MinimizerOptions::DefaultTolerance();
+            {
+                ProfileLikelihood::MinimizerSentry minimizerConfig(myType+","+myAlgo, 10*nominalTol);
+                minimizer_->setEps(10*nominalTol);
+                minimizer_->setStrategy(0);
+                improveOnce(verbose-2, true);
+                minimizer_->setEps(nominalTol);
+                minimizer_->setStrategy(strategy_);
+            }
+            double bound = minimumNLL;
+            for (int i = 0; i < discreteForks_; ++i) bound = std::min(bound, incumbent[i]);
+            double cheapNll = nll_.getVal();
+            if (cheapNll > bound + maxDeviation) {
+                record[0] = 1; record[1] = cheapNll; record[2] = 1;
+                if (verbose > 2) std::cout << "Pruned after the first fit: NLL " << cheapNll << " vs best " << bound << std::endl;
+            } else {
+                record[0] = improve(verbose, cascade);
+                record[1] = nll_.getVal();
+                if (record[0]) incumbent[ich] = record[1];
+            }
+            RooFIter iter = params.fwdIterator(); unsigned int ip = 3;
+            for (RooAbsArg *a = iter.next(); a != 0; a = iter.next(), ++ip) {
+                RooRealVar *rrv = dynamic_cast<RooRealVar *>(a);
+                if (rrv) { record[ip] = rrv->getVal(); continue; }
+                RooCategory *rc = dynamic_cast<RooCategory *>(a);
+                if (rc) record[ip] = rc->getIndex();
+            }
+            return record;
+        }, records, false, verbose > 2);
+        // now go through the results in order, exactly as the sequential loop would do
+        for (unsigned int ich = 0; ich < batch.size(); ++ich) {
+            const std::vector<double> &record = records[ich];
+            if (record.size() != stride) { ret = false; continue; }
+            const std::vector<int> &cit = *batch[ich];
+            nfits++; if (record[2]) npruned++;
+            if (!record[2]) ret = record[0];
+            double thisNllValue = record[1];
+            if (mode == 0 && discretePruneDeltaNLL_ > 0) noteDiscreteNLL_(cit, thisNllValue);
+            if (!record[2] && thisNllValue < minimumNLL) {
+                minimumNLL = thisNllValue;
+                RooFIter iter = params.fwdIterator(); unsigned int ip = 3;
+                for (RooAbsArg *a = iter.next(); a != 0; a = iter.next(), ++ip) {
+                    RooRealVar *rrv = dynamic_cast<RooRealVar *>(a);
+                    if (rrv) { rrv->setVal(record[ip]); continue; }
+                    RooCategory *rc = dynamic_cast<RooCategory *>(a);
+                    if (rc) rc->setIndex(int(record[ip]));
+                }
+                snap.assignValueOnly(params);
+                for (int id = 0; id < numIndeces; id++) {
+                    if (bestIndeces[id] != cit[id]) newDiscreteMinimum = true;
+                    bestIndeces[id] = cit[id];
+                }
+            }
+            if (mode == 1 && thisNllValue > minimumNLL + maxDeviation) {
+                // as in multipleMinimize: if a single index differs from the best, that pdf is not worth trying in mode 2
+                int modid = 0, modcount = 0;
+                for (int id = 0; id < numIndeces; id++) {
+                    if (cit[id] != bestIndeces[id]) { modid = id; modcount++; }
+                }
+                if (modcount == 1) contributingIndeces[modid][cit[modid]] = false;
+            }
+        }
+    }
+    munmap(incumbent, discreteForks_ * sizeof(double));
+    if (verbose > 1) std::cout << "Fitted " << nfits << " combinations of the discrete indices in parallel, " << npruned << " of them pruned after the first fit" << std::endl;
+    return newDiscreteMinimum;
+}
+
 void CascadeMinimizer::initOptions() 
 {
     options_.add_options()
@@ -552,6 +1044,13 @@ void CascadeMinimizer::initOptions()
         ("cminApproxPreFitStrategy", boost::program_options::value<int>(&approxPreFitStrategy_)->default_value(approxPreFitStrategy_), "Strategy to use in the pre-fit")
         ("cminSingleNuisFit", "Do first a minimization of each nuisance parameter individually")
         ("cminFallbackAlgo", boost::program_options::value<std::vector<std::string> >(), "Fallback algorithms if the default minimizer fails (can use multiple ones). Syntax is algo[,subalgo][,strategy][:tolerance]")
+        ("saveFitTelemetry", "Save in the output tree the cost of the last fit before each entry: calls of the NLL (all, and of the minimization alone), fallbacks, status, edm, time of the minimization, hesse and minos, and time per call of the minimization (fit_* branches)")
+        ("cminParallelStarts", boost::program_options::value<int>(&parallelStarts_)->default_value(parallelStarts_), "If > 1, run the nominal minimizer and the fallback algorithms at the same time in up to this many forked processes, and keep the best valid minimum")
+        ("cminAdaptive", "Run the nominal minimizer and the fallbacks in the order of the fewest calls of the NLL per successful fit in the fits done so far by this job (toys, points of a scan), instead of the configured one")
+        ("cminAdaptiveReprobe", boost::program_options::value<int>(&adaptiveReprobe_)->default_value(adaptiveReprobe_), "With --cminAdaptive, use the configured order every this many fits, to measure again the configurations that were pushed back (0 = never)")
+        ("cminJitteredStarts", boost::program_options::value<int>(&jitteredStarts_)->default_value(jitteredStarts_), "With --cminParallelStarts, also run the nominal minimizer from this many starting points jittered around the initial one")
+        ("cminJitterWidth", boost::program_options::value<float>(&jitterWidth_)->default_value(jitterWidth_), "Width of the gaussian jitter of the starting points, in units of the parameter uncertainty (or 1 if not known)")
+        ("cminWarmStart", "Seed each Minuit2 minimization with the covariance matrix of the previous successful one with the same floating parameters (e.g. the previous point of a scan)")
         ("cminSetZeroPoint", boost::program_options::value<bool>(&setZeroPoint_)->default_value(setZeroPoint_), "Change the reference point of the NLL to be zero during minimization")
         ("cminOldRobustMinimize", boost::program_options::value<bool>(&oldFallback_)->default_value(oldFallback_), "Use the old 'robustMinimize' logic in addition to the cascade")
         ("cminInitialHesse", boost::program_options::value<bool>(&firstHesse_)->default_value(firstHesse_), "Call Hesse before the minimization")
@@ -559,7 +1058,10 @@ void CascadeMinimizer::initOptions()
 	("cminDefaultMinimizerType",boost::program_options::value<std::string>(&defaultMinimizerType_)->default_value(defaultMinimizerType_), "Set the default minimizer Type")
 	("cminDefaultMinimizerAlgo",boost::program_options::value<std::string>(&defaultMinimizerAlgo_)->default_value(defaultMinimizerAlgo_), "Set the default minimizer Algo")
         ("cminRunAllDiscreteCombinations",  "Run all combinations for discrete nuisances")
+        ("cminDiscreteForks", boost::program_options::value<int>(&discreteForks_)->default_value(discreteForks_), "If > 1, fit the combinations of discrete indices in up to this many forked processes at the same time, pruning those that are already far from the best one after a quick first fit")
         ("cminDiscreteMinTol", boost::program_options::value<double>(&discreteMinTol_)->default_value(discreteMinTol_), "tolerance on min NLL for discrete combination iterations")
+        ("cminDiscretePruneDeltaNLL", boost::program_options::value<double>(&discretePruneDeltaNLL_)->default_value(discretePruneDeltaNLL_), "If > 0, skip in the scans of the discrete indices the pdfs whose NLL (with its correction) was more than this above the best one the last time they were fitted, e.g. at the previous point of a scan")
+        ("cminDiscretePruneRecheck", boost::program_options::value<int>(&discretePruneRecheck_)->default_value(discretePruneRecheck_), "With --cminDiscretePruneDeltaNLL, fit all the pdfs again every this many minimizations (0 = only in the first one)")
         ("cminM2StorageLevel", boost::program_options::value<int>(&minuit2StorageLevel_)->default_value(minuit2StorageLevel_), "storage level for minuit2 (0 = don't store intermediate covariances, 1 = store them)")
         //("cminNuisancePruning", boost::program_options::value<float>(&nuisancePruningThreshold_)->default_value(nuisancePruningThreshold_), "if non-zero, discard constrained nuisances whose effect on the NLL when changing by 0.2*range is less than the absolute value of the threshold; if threshold is negative, repeat afterwards the fit with these floating")
 
@@ -579,9 +1081,12 @@ void CascadeMinimizer::applyOptions(const boost::program_options::variables_map
     using namespace std;
 
     preScan_ = vm.count("cminPreScan");
+    saveTelemetry_ = vm.count("saveFitTelemetry");
     poiOnlyFit_ = vm.count("cminPoiOnlyFit");
     singleNuisFit_ = vm.count("cminSingleNuisFit");
+    adaptive_ = vm.count("cminAdaptive");
     setZeroPoint_  = vm.count("cminSetZeroPoint");
+    RooMinimizerOpt::setWarmStart(vm.count("cminWarmStart"));
     runShortCombinations = !(vm.count("cminRunAllDiscreteCombinations"));
     if (vm.count("cminFallbackAlgo")) {
         vector<string> falls(vm["cminFallbackAlgo"].as<vector<string> >());
@@ -16,6 +16,7 @@
 
 
 #include <Math/MinimizerOptions.h>
+#include <cmath>
 
 using namespace RooStats;
 
@@ -23,6 +24,8 @@ float ChannelCompatibilityCheck::mu_ = 0.0;
 bool  ChannelCompatibilityCheck::fixedMu_ = false;
 bool  ChannelCompatibilityCheck::saveFitResult_ = true;
 bool  ChannelCompatibilityCheck::runMinos_ = true;
+bool  ChannelCompatibilityCheck::parallelFits_ = false;
+bool  ChannelCompatibilityCheck::warmStart_ = false;
 std::vector<std::string> ChannelCompatibilityCheck::groups_;
 
 ChannelCompatibilityCheck::ChannelCompatibilityCheck() :
@@ -33,6 +36,8 @@ ChannelCompatibilityCheck::ChannelCompatibilityCheck() :
         ("saveFitResult",       "Save fit results in output file")
         ("group,g",             boost::program_options::value<std::vector<std::string> >(&groups_), "Group together channels that contain a given name. Can be used multiple times.")
         ("runMinos", boost::program_options::value<bool>(&runMinos_)->default_value(runMinos_), "Compute also uncertainties using profile likeilhood (MINOS or robust variants of it)")
+        ("parallelFits",        "Run the nominal fit in a forked process, at the same time as the freeform one (not with --saveFitResult, nor with --warmStart)")
+        ("warmStart",           "Start the freeform fit from the result of the nominal one, with the signal strengths of all channels set to the common best fit value")
     ;
 }
 
@@ -41,6 +46,12 @@ void ChannelCompatibilityCheck::applyOptions(const boost::program_options::varia
     applyOptionsBase(vm);
     fixedMu_ = !vm["fixedSignalStrength"].defaulted();
     saveFitResult_ = vm.count("saveFitResult");
+    warmStart_ = vm.count("warmStart");
+    parallelFits_ = vm.count("parallelFits");
+    if (parallelFits_ && (saveFitResult_ || warmStart_)) {
+        std::cerr << "ChannelCompatibilityCheck: --parallelFits can't be used with --saveFitResult or --warmStart, the fits will be done one after the other." << std::endl;
+        parallelFits_ = false;
+    }
 }
 
 bool ChannelCompatibilityCheck::runSpecific(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, double &limit, double &limitErr, const double *hint) { 
@@ -57,6 +68,7 @@ bool ChannelCompatibilityCheck::runSpecific(RooWorkspace *w, RooStats::ModelConf
   TString satname = TString::Format("%s_freeform", sim->GetName());
   std::auto_ptr<RooSimultaneous> newsim((typeid(*sim) == typeid(RooSimultaneousOpt)) ? new RooSimultaneousOpt(satname, "", *cat) : new RooSimultaneous(satname, "", *cat)); 
   std::map<std::string,std::string> rs;
+  RooArgList ris;
   RooArgList minosVars, minosOneVar; if (runMinos_) minosOneVar.add(*r);
   for (int ic = 0, nc = nbins; ic < nc; ++ic) {
       cat->setBin(ic);
@@ -69,19 +81,61 @@ bool ChannelCompatibilityCheck::runSpecific(RooWorkspace *w, RooStats::ModelConf
         w->factory(TString::Format("%s[%g,%g]", riName.Data(), r->getMin(), r->getMax()));
       }
       customizer.replaceArg(*r, *w->var(riName));
+      if (!ris.find(riName)) ris.add(*w->var(riName));
       newsim->addPdf((RooAbsPdf&)*customizer.build(), cat->getLabel());
       if (runMinos_ && !minosVars.find(riName)) minosVars.add(*w->var(riName));
   }
 
   CloseCoutSentry sentry(verbose < 2);
   const RooCmdArg &constCmdArg = withSystematics  ? RooFit::Constrain(*mc_s->GetNuisanceParameters()) : RooFit::NumCPU(1); // use something dummy 
-  std::auto_ptr<RooFitResult> result_nominal (doFit(   *sim, data, minosOneVar, constCmdArg, runMinos_)); // let's run Hesse if we want to run Minos
-  double nll_nominal   = nll->getVal();
-  std::auto_ptr<RooFitResult> result_freeform(doFit(*newsim, data, minosVars,   constCmdArg, runMinos_));
-  double nll_freeform   = nll->getVal();
-  sentry.clear();
+  std::auto_ptr<RooFitResult> result_nominal, result_freeform;
+  // value and uncertainties of r in the nominal fit: value, error, asymmetric errors, 95% CL range
+  double nll_nominal, nll_freeform, rNominal[6] = { r->getVal(), 0, 0, 0, 0, 0 };
+  if (parallelFits_) {
+      // the nominal fit in a forked process, that sends back only its nll and r, and the freeform one here.
+      std::vector<std::vector<double> > fits;
+      runInForks(2, [&](unsigned int i) -> std::vector<double> {
+          if (i == 0) {
+              result_freeform.reset(doFit(*newsim, data, minosVars, constCmdArg, runMinos_));
+              return std::vector<double>(1, result_freeform.get() ? nll->getVal() : NAN);
+          } 
+          std::auto_ptr<RooFitResult> res(doFit(*sim, data, minosOneVar, constCmdArg, runMinos_, /*ndim=*/1, /*reuseNLL=*/true));
+          if (res.get() == 0) return std::vector<double>(1, NAN);
+          std::vector<double> ret(1, nll->getVal());
+          RooRealVar *rf = (RooRealVar*) res->floatParsFinal().find(r->GetName());
+          if (rf) {
+              ret.push_back(rf->getVal()); ret.push_back(rf->getError()); 
+              ret.push_back(rf->getAsymErrorLo()); ret.push_back(rf->getAsymErrorHi()); 
+              ret.push_back(rf->getMin("err95")); ret.push_back(rf->getMax("err95"));
+          }
+          return ret;
+      }, fits, true);
+      sentry.clear();
+      if (fits[1].empty() || std::isnan(fits[1][0]) || result_freeform.get() == 0) return false;
+      nll_freeform = fits[0][0]; 
+      nll_nominal  = fits[1][0];
+      if (fits[1].size() == 7) std::copy(fits[1].begin()+1, fits[1].end(), rNominal);
+  } else {
+      result_nominal.reset(doFit(*sim, data, minosOneVar, constCmdArg, runMinos_, /*ndim=*/1, /*reuseNLL=*/true)); // let's run Hesse if we want to run Minos
+      nll_nominal   = nll->getVal();
+      if (result_nominal.get() == 0) { sentry.clear(); return false; }
+      RooRealVar *rf = (RooRealVar*) result_nominal->floatParsFinal().find(r->GetName());
+      if (rf) {
+          rNominal[0] = rf->getVal(); rNominal[1] = rf->getError(); rNominal[2] = rf->getAsymErrorLo(); rNominal[3] = rf->getAsymErrorHi();
+          rNominal[4] = rf->getMin("err95"); rNominal[5] = rf->getMax("err95");
+      }
+      if (warmStart_) {
+          // the nuisances are already at the nominal best fit: the freeform model has the same minimum if all channels agree
+          std::auto_ptr<RooArgSet> params(sim->getParameters(data));
+          *params = result_nominal->floatParsFinal();
+          RooFIter iter = ris.fwdIterator();
+          for (RooAbsArg *a = iter.next(); a != 0; a = iter.next()) ((RooRealVar *)a)->setVal(rNominal[0]);
+      }
+      result_freeform.reset(doFit(*newsim, data, minosVars, constCmdArg, runMinos_));
+      nll_freeform   = nll->getVal();
+      sentry.clear();
+  }
 
-  if (result_nominal.get()  == 0) return false;
   if (result_freeform.get() == 0) return false;
 
   //double nll_nominal   = result_nominal->minNll();
@@ -94,14 +148,13 @@ bool ChannelCompatibilityCheck::runSpecific(RooWorkspace *w, RooStats::ModelConf
     if (fixedMu_) { 
         printf("Nominal fit: %s fixed at %7.4f\n", r->GetName(), r->getVal());
     } else {
-        RooRealVar *rNominal = (RooRealVar*) result_nominal->floatParsFinal().find(r->GetName());
         if (runMinos_ && do95_) {
-            printf("Nominal fit  : %s = %7.4f  %+6.4f/%+6.4f (68%% CL)\n", r->GetName(), rNominal->getVal(), rNominal->getAsymErrorLo(), rNominal->getAsymErrorHi());
-            printf("               %s = %7.4f  %+6.4f/%+6.4f (95%% CL)\n", r->GetName(), rNominal->getVal(), rNominal->getMin("err95")-rNominal->getVal(), rNominal->getMax("err95")-rNominal->getVal());
+            printf("Nominal fit  : %s = %7.4f  %+6.4f/%+6.4f (68%% CL)\n", r->GetName(), rNominal[0], rNominal[2], rNominal[3]);
+            printf("               %s = %7.4f  %+6.4f/%+6.4f (95%% CL)\n", r->GetName(), rNominal[0], rNominal[4]-rNominal[0], rNominal[5]-rNominal[0]);
         } else if (runMinos_) {
-            printf("Nominal fit  : %s = %7.4f  %+6.4f/%+6.4f\n", r->GetName(), rNominal->getVal(), rNominal->getAsymErrorLo(), rNominal->getAsymErrorHi());
+            printf("Nominal fit  : %s = %7.4f  %+6.4f/%+6.4f\n", r->GetName(), rNominal[0], rNominal[2], rNominal[3]);
         } else {
-            printf("Nominal fit  : %s = %7.4f  +/- %6.4f\n", r->GetName(), rNominal->getVal(), rNominal->getError());
+            printf("Nominal fit  : %s = %7.4f  +/- %6.4f\n", r->GetName(), rNominal[0], rNominal[1]);
         }
     }
     for (std::map<std::string,std::string>::const_iterator it = rs.begin(), ed = rs.end(); it != ed; ++it) {
@@ -119,6 +172,7 @@ bool ChannelCompatibilityCheck::runSpecific(RooWorkspace *w, RooStats::ModelConf
   std::cout << "Chi2-like compatibility variable: " << limit << std::endl;
 
   if (saveFitResult_) {
+      std::unique_lock<std::mutex> lock(Combine::lockOutput());
       writeToysHere->GetFile()->WriteTObject(result_nominal.release(),  "fit_nominal"  );
       writeToysHere->GetFile()->WriteTObject(result_freeform.release(), "fit_alternate");
   }
@@ -0,0 +1,151 @@
+#include "HiggsAnalysis/CombinedLimit/interface/ChannelKernel.h"
+#include "HiggsAnalysis/CombinedLimit/interface/BinnedOffload.h"
+#include <RooAbsReal.h>
+#include <algorithm>
+#include <cmath>
+#include <memory>
+
+namespace {
+    /// add M morphs to the template t: t[j] += a[m] * (diff[m][j] + b[m] * sum[m][j])
+    template<unsigned int M>
+    inline void meldMorphs(unsigned int n, double * __restrict__ t, const double * const *diff, const double * const *sum, const double *a, const double *b) {
+        for (unsigned int j = 0; j < n; ++j) {
+            double v = t[j];
+            for (unsigned int m = 0; m < M; ++m) v += a[m]*(diff[m][j] + b[m]*sum[m][j]);
+            t[j] = v;
+        }
+    }
+
+    /// the kernel for a channel of N processes
+    template<unsigned int N>
+    class ChannelKernelT : public cacheutils::ChannelKernel {
+        public:
+            ChannelKernelT(const cacheutils::BinnedChannelData &data) : ChannelKernel(data) {}
+            virtual bool evaluate(const double *coeffs, double sumCoeff, double &nll) const ;
+    };
+
+    template<unsigned int N>
+    bool ChannelKernelT<N>::evaluate(const double *coeffs, double sumCoeff, double &nll) const {
+        for (unsigned int k = 0, n = params_.size(); k < n; ++k) paramVals_[k] = params_[k]->getVal();
+        unsigned int nbins = nbins_, nentries = nentries_;
+        double scale[N];
+        const double *t[N];
+        for (unsigned int p = 0; p < N; ++p) {
+            t[p] = &templ_[p*nbins];
+            if (coeffs[p] == 0) { scale[p] = 0; continue; }
+            double norm = morph_(p);
+            scale[p] = coeffs[p] * (norm > 0 ? 1.0/norm : 1.0);
+        }
+        double ret = 0, invSumCoeff = 1.0/sumCoeff;
+        const double *w = &weights_[0];
+        if (identity_) {
+            for (unsigned int i = 0; i < nentries; ++i) {
+                double s = 0;
+                for (unsigned int p = 0; p < N; ++p) s += scale[p] * t[p][i];
+                if (!std::isnormal(s) || s <= 0) return false;
+                ret += w[i] * std::log(s*invSumCoeff);
+            }
+        } else {
+            const unsigned int *bins = &entryBins_[0];
+            for (unsigned int i = 0; i < nentries; ++i) {
+                double s = 0;
+                for (unsigned int p = 0; p < N; ++p) s += scale[p] * t[p][bins[i]];
+                if (!std::isnormal(s) || s <= 0) return false;
+                ret += w[i] * std::log(s*invSumCoeff);
+            }
+        }
+        nll = ret;
+        return true;
+    }
+
+    /// a new ChannelKernelT<M> for the packed channel if it has M processes, with M <= N
+    template<unsigned int N>
+    cacheutils::ChannelKernel * makeChannelKernel(const cacheutils::BinnedChannelData &data) {
+        if (data.smoothAlgo.size() == N) return new ChannelKernelT<N>(data);
+        return makeChannelKernel<N-1>(data);
+    }
+    template<>
+    cacheutils::ChannelKernel * makeChannelKernel<0>(const cacheutils::BinnedChannelData &data) { return 0; }
+}
+
+cacheutils::ChannelKernel *
+cacheutils::ChannelKernel::create(const std::vector<const FastVerticalInterpHistPdf2 *> &pdfs, const RooAbsData &data, bool includeZeroWeights, const std::vector<Double_t> &weights)
+{
+    if (pdfs.size() > MaxProcesses) return 0;
+    BinnedChannelData packed;
+    if (!packed.fill(pdfs, data, includeZeroWeights, weights)) return 0;
+    return makeChannelKernel<MaxProcesses>(packed);
+}
+
+cacheutils::ChannelKernel::ChannelKernel(const BinnedChannelData &data) :
+    nbins_(data.nbins), nentries_(data.entryBins.size()),
+    binWidths_(data.binWidths), weights_(data.weights), smoothRegion_(data.smoothRegion), nominal_(data.nominal),
+    morphSum_(data.morphSum), morphDiff_(data.morphDiff), smoothAlgo_(data.smoothAlgo),
+    entryBins_(data.entryBins), morphBegin_(data.morphBegin), morphParam_(data.morphParam), params_(data.params),
+    paramVals_(data.params.size()), templ_(data.smoothAlgo.size() * data.nbins),
+    morphedVals_(data.morphParam.size()), morphedNorms_(data.smoothAlgo.size()), morphed_(data.smoothAlgo.size(), 0)
+{
+    identity_ = (nentries_ == nbins_);
+    for (unsigned int i = 0; identity_ && i < nentries_; ++i) identity_ = (entryBins_[i] == i);
+}
+
+cacheutils::ChannelKernel::~ChannelKernel()
+{
+}
+
+void
+cacheutils::ChannelKernel::setWeights(const std::vector<Double_t> &weights)
+{
+    std::copy(weights.begin(), weights.begin() + nentries_, weights_.begin());
+}
+
+std::size_t
+cacheutils::ChannelKernel::bytes() const
+{
+    return (binWidths_.capacity() + weights_.capacity() + smoothRegion_.capacity() + nominal_.capacity() + morphSum_.capacity() +
+            morphDiff_.capacity() + paramVals_.capacity() + templ_.capacity() + morphedVals_.capacity() + morphedNorms_.capacity()) * sizeof(double) +
+           (entryBins_.capacity() + morphBegin_.capacity() + morphParam_.capacity()) * sizeof(unsigned int);
+}
+
+double
+cacheutils::ChannelKernel::morph_(unsigned int p) const
+{
+    enum { MorphsAtOnce = 4 };
+    // most calls of a fit move only some of the parameters, so most processes keep their template
+    bool same = morphed_[p];
+    for (unsigned int k = morphBegin_[p], end = morphBegin_[p+1]; same && k < end; ++k) same = (morphedVals_[k] == paramVals_[morphParam_[k]]);
+    if (same) return morphedNorms_[p];
+    for (unsigned int k = morphBegin_[p], end = morphBegin_[p+1]; k < end; ++k) morphedVals_[k] = paramVals_[morphParam_[k]];
+    unsigned int nbins = nbins_;
+    double *t = &templ_[p*nbins];
+    std::copy(&nominal_[p*nbins], &nominal_[p*nbins] + nbins, t);
+    double region = smoothRegion_[p];
+    for (unsigned int k = morphBegin_[p], end = morphBegin_[p+1]; k < end; k += MorphsAtOnce) {
+        unsigned int m = std::min<unsigned int>(MorphsAtOnce, end - k);
+        const double *diff[MorphsAtOnce], *sum[MorphsAtOnce];
+        double a[MorphsAtOnce], b[MorphsAtOnce];
+        for (unsigned int i = 0; i < m; ++i) {
+            double x = paramVals_[morphParam_[k+i]];
+            a[i] = 0.5*x;
+            if (std::abs(x) >= region) b[i] = (x > 0 ? +1 : -1);
+            else { double u = x/region, u2 = u*u; b[i] = 0.125 * u * (u2 * (3.*u2 - 10.) + 15); }
+            diff[i] = &morphDiff_[(k+i)*nbins]; sum[i] = &morphSum_[(k+i)*nbins];
+        }
+        switch (m) {
+            case 1: meldMorphs<1>(nbins, t, diff, sum, a, b); break;
+            case 2: meldMorphs<2>(nbins, t, diff, sum, a, b); break;
+            case 3: meldMorphs<3>(nbins, t, diff, sum, a, b); break;
+            default: meldMorphs<4>(nbins, t, diff, sum, a, b); break;
+        }
+    }
+    if (smoothAlgo_[p] < 0) {
+        for (unsigned int j = 0; j < nbins; ++j) t[j] = std::exp(t[j]);
+    } else {
+        for (unsigned int j = 0; j < nbins; ++j) t[j] = std::max(t[j], 1e-9);
+    }
+    double norm = 0;
+    const double *bw = &binWidths_[0];
+    for (unsigned int j = 0; j < nbins; ++j) norm += t[j]*bw[j];
+    morphedNorms_[p] = norm; morphed_[p] = 1;
+    return norm;
+}
@@ -0,0 +1,112 @@
+#include "HiggsAnalysis/CombinedLimit/interface/Checkpoint.h"
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <TBufferFile.h>
+#include <TClass.h>
+#include <TObject.h>
+#include <TRandom.h>
+#include <TString.h>
+#include <RooRandom.h>
+#include "HiggsAnalysis/CombinedLimit/interface/CounterRandom.h"
+
+std::string Checkpoint::fileName_ = "";
+bool Checkpoint::resume_ = false;
+
+namespace {
+    const unsigned int kRecordMagic = 0x31504b43; // "CKP1"
+
+    void putBytes(std::vector<char> &buff, const char *p, unsigned int n) {
+        buff.insert(buff.end(), reinterpret_cast<const char *>(&n), reinterpret_cast<const char *>(&n) + sizeof(n));
+        buff.insert(buff.end(), p, p + n);
+    }
+    bool getBytes(FILE *f, std::vector<char> &out) {
+        unsigned int n;
+        if (fread(&n, sizeof(n), 1, f) != 1) return false;
+        out.resize(n);
+        return n == 0 || fread(&out[0], 1, n, f) == n;
+    }
+}
+
+void Checkpoint::setup(const std::string &fileName, bool resume) {
+    fileName_ = fileName;
+    resume_ = resume;
+    if (!resume && !fileName.empty() && unlink(fileName.c_str()) == -1 && errno != ENOENT) {
+        throw std::runtime_error("Checkpoint: can't remove the old file "+fileName);
+    }
+}
+
+void Checkpoint::save(const std::string &what, const std::string &key, const std::vector<char> &payload) {
+    if (fileName_.empty()) return;
+    std::vector<char> buff;
+    buff.insert(buff.end(), reinterpret_cast<const char *>(&kRecordMagic), reinterpret_cast<const char *>(&kRecordMagic) + sizeof(kRecordMagic));
+    putBytes(buff, what.data(), what.size());
+    putBytes(buff, key.data(), key.size());
+    putBytes(buff, payload.empty() ? 0 : &payload[0], payload.size());
+    if (CounterRandom::active()) {
+        putBytes(buff, 0, 0);
+    } else {
+        TBufferFile random(TBuffer::kWrite);
+        RooRandom::randomGenerator()->Streamer(random);
+        putBytes(buff, random.Buffer(), random.Length());
+    }
+    // one write at the end of the file, so that a job killed in the middle leaves at worst an incomplete last record
+    int fd = open(fileName_.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd == -1) throw std::runtime_error("Checkpoint: can't open "+fileName_+" for writing");
+    const char *p = &buff[0]; size_t left = buff.size();
+    while (left > 0) {
+        ssize_t written = write(fd, p, left);
+        if (written == -1 && errno == EINTR) continue;
+        if (written <= 0) { close(fd); throw std::runtime_error("Checkpoint: failed to write to "+fileName_); }
+        p += written; left -= written;
+    }
+    close(fd);
+}
+
+void Checkpoint::save(const std::string &what, const std::string &key, const TObject &object) {
+    if (fileName_.empty()) return;
+    TBufferFile buff(TBuffer::kWrite);
+    buff.WriteObject(&object);
+    save(what, key, std::vector<char>(buff.Buffer(), buff.Buffer() + buff.Length()));
+}
+
+void Checkpoint::load(const std::string &what, std::vector<Record> &records) {
+    records.clear();
+    if (fileName_.empty()) return;
+    FILE *f = fopen(fileName_.c_str(), "rb");
+    if (f == 0) return; // nothing saved yet
+    std::vector<char> recordWhat;
+    for (long offset = 0; ; offset = ftell(f)) {
+        unsigned int magic; Record r;
+        if (fread(&magic, sizeof(magic), 1, f) != 1) break;
+        if (magic != kRecordMagic) {
+            fclose(f);
+            throw std::runtime_error(TString::Format("Checkpoint: corrupted file %s at byte %ld", fileName_.c_str(), offset).Data());
+        }
+        std::vector<char> key;
+        if (!getBytes(f, recordWhat) || !getBytes(f, key) || !getBytes(f, r.payload) || !getBytes(f, r.random)) break;
+        if (std::string(recordWhat.begin(), recordWhat.end()) != what) continue;
+        r.key.assign(key.begin(), key.end());
+        records.push_back(r);
+    }
+    fclose(f);
+}
+
+TObject *Checkpoint::object(const Record &record, const TClass *cls) {
+    if (record.payload.empty()) return 0;
+    std::vector<char> copy(record.payload);
+    TBufferFile buff(TBuffer::kRead, copy.size(), &copy[0], kFALSE);
+    TObject *ret = buff.ReadObject(cls);
+    if (ret && !ret->InheritsFrom(cls)) { delete ret; ret = 0; }
+    return ret;
+}
+
+void Checkpoint::restoreRandom(const Record &record) {
+    if (record.random.empty() || CounterRandom::active()) return;
+    std::vector<char> copy(record.random);
+    TBufferFile buff(TBuffer::kRead, copy.size(), &copy[0], kFALSE);
+    RooRandom::randomGenerator()->Streamer(buff);
+}
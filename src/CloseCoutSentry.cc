@@ -1,12 +1,15 @@
 #include "HiggsAnalysis/CombinedLimit/interface/CloseCoutSentry.h"
+#include "HiggsAnalysis/CombinedLimit/interface/Logging.h"
 
 #include <cstdio>
 #include <cassert>
 #include <unistd.h>
+#include <fcntl.h>
 
 bool CloseCoutSentry::open_ = true;
 int  CloseCoutSentry::fdOut_ = 0;
 int  CloseCoutSentry::fdErr_ = 0;
+int  CloseCoutSentry::fdNull_ = -1;
 FILE * CloseCoutSentry::trueStdOut_ = 0;
 CloseCoutSentry *CloseCoutSentry::owner_ = 0;
 
@@ -20,9 +23,15 @@ CloseCoutSentry::CloseCoutSentry(bool silent) :
             if (fdOut_ == 0 && fdErr_ == 0) {
                 fdOut_ = dup(1);
                 fdErr_ = dup(2);
+                fdNull_ = open("/dev/null", O_WRONLY);
             }
-            freopen("/dev/null", "w", stdout);
-            freopen("/dev/null", "w", stderr);
+            // point the descriptors to the /dev/null opened once, instead of reopening the streams each time
+            fflush(stdout); fflush(stderr);
+            if (fdNull_ == -1 || dup2(fdNull_, 1) == -1 || dup2(fdNull_, 2) == -1) {
+                freopen("/dev/null", "w", stdout);
+                freopen("/dev/null", "w", stderr);
+            }
+            ++logging::silenced_;
             assert(owner_ == 0);
             owner_ = this;
         } else {
@@ -51,9 +60,13 @@ void CloseCoutSentry::clear()
 void CloseCoutSentry::reallyClear() 
 {
     if (fdOut_ != fdErr_) {
-        char buf[50];
-        sprintf(buf, "/dev/fd/%d", fdOut_); freopen(buf, "w", stdout);
-        sprintf(buf, "/dev/fd/%d", fdErr_); freopen(buf, "w", stderr);
+        fflush(stdout); fflush(stderr);
+        if (fdNull_ == -1 || dup2(fdOut_, 1) == -1 || dup2(fdErr_, 2) == -1) {
+            char buf[50];
+            sprintf(buf, "/dev/fd/%d", fdOut_); freopen(buf, "w", stdout);
+            sprintf(buf, "/dev/fd/%d", fdErr_); freopen(buf, "w", stderr);
+        }
+        if (!open_) --logging::silenced_;
         open_   = true;
         owner_ = 0;
     }
@@ -77,7 +90,7 @@ FILE *CloseCoutSentry::trueStdOut()
     if (owner_ != this && owner_ != 0) return owner_->trueStdOut();
     assert(owner_ == this);
     stdOutIsMine_ = true;
-    char buf[50];
-    sprintf(buf, "/dev/fd/%d", fdOut_); trueStdOut_ = fopen(buf, "w");
+    // a new descriptor of the same file (reopening /dev/fd/N would truncate it, if stdout is a file)
+    trueStdOut_ = fdopen(dup(fdOut_), "w");
     return trueStdOut_;
 }
@@ -0,0 +1,112 @@
+#include "HiggsAnalysis/CombinedLimit/interface/ColumnarLimits.h"
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <TTree.h>
+#include <TBranch.h>
+#include <TLeaf.h>
+#include <TObjArray.h>
+
+namespace {
+    const char kMagic[8] = { 'C', 'M', 'B', 'L', 'I', 'M', 'T', '1' };
+    struct Header { char magic[8]; uint32_t ncolumns, reserved; uint64_t nrows, textBytes; };
+    struct ColumnHeader { char type[4]; uint32_t size, len; };
+
+    /// the code of the type in a leaf list, or 0 if not one of those
+    char leafType(const TLeaf &leaf) {
+        static const char *names[] = { "Double_t", "Float_t", "Long64_t", "ULong64_t", "Int_t", "UInt_t", "Short_t", "UShort_t", "Char_t", "UChar_t", "Bool_t" };
+        static const char codes[]  = { 'D', 'F', 'L', 'l', 'I', 'i', 'S', 's', 'B', 'b', 'O' };
+        for (unsigned int i = 0; i < sizeof(codes); ++i) {
+            if (std::strcmp(leaf.GetTypeName(), names[i]) == 0) return codes[i];
+        }
+        return 0;
+    }
+
+    void put(FILE *f, const std::string &fileName, const void *p, std::size_t n) {
+        if (n && fwrite(p, 1, n, f) != n) throw std::runtime_error("ColumnarLimitWriter: failed to write to "+fileName);
+    }
+    void pad(FILE *f, const std::string &fileName, std::size_t n) {
+        static const char zeros[8] = { 0 };
+        if (n % 8) put(f, fileName, zeros, 8 - n % 8);
+    }
+}
+
+ColumnarLimitWriter::ColumnarLimitWriter(const std::string &fileName) :
+    fileName_(fileName),
+    closed_(false),
+    rows_(0)
+{
+}
+
+ColumnarLimitWriter::~ColumnarLimitWriter()
+{
+    if (closed_) return;
+    try {
+        close();
+    } catch (std::exception &ex) {
+        fprintf(stderr, "%s\n", ex.what());
+    }
+}
+
+void ColumnarLimitWriter::columnsFrom_(const TTree &tree)
+{
+    TObjArray *leaves = const_cast<TTree &>(tree).GetListOfLeaves();
+    for (int i = columns_.size(), n = leaves->GetEntriesFast(); i < n; ++i) {
+        const TLeaf *leaf = (const TLeaf *) leaves->At(i);
+        Column col;
+        TBranch *branch = leaf->GetBranch();
+        col.name = (branch->GetListOfLeaves()->GetEntriesFast() == 1 ? std::string(branch->GetName()) : std::string(branch->GetName())+"."+leaf->GetName());
+        col.type = leafType(*leaf);
+        if (col.type == 0) throw std::invalid_argument(std::string("ColumnarLimitWriter: can't store the branch ")+col.name+" of type "+leaf->GetTypeName());
+        col.size = leaf->GetLenType();
+        col.len  = leaf->GetLen();
+        col.leaf = leaf;
+        // the rows before this branch existed
+        col.data.resize(std::size_t(rows_) * col.size * col.len, 0);
+        columns_.push_back(col);
+    }
+}
+
+void ColumnarLimitWriter::fill(const TTree &tree)
+{
+    if (closed_) throw std::runtime_error("ColumnarLimitWriter: "+fileName_+" is already closed");
+    if (columns_.size() != std::size_t(const_cast<TTree &>(tree).GetListOfLeaves()->GetEntriesFast())) columnsFrom_(tree);
+    for (std::vector<Column>::iterator it = columns_.begin(), ed = columns_.end(); it != ed; ++it) {
+        const char *value = (const char *) it->leaf->GetValuePointer();
+        it->data.insert(it->data.end(), value, value + it->size * it->len);
+    }
+    ++rows_;
+}
+
+void ColumnarLimitWriter::close()
+{
+    if (closed_) return;
+    closed_ = true;
+    std::string text;
+    for (std::vector<Column>::const_iterator it = columns_.begin(), ed = columns_.end(); it != ed; ++it) {
+        text += it->name; text += '\0';
+    }
+    FILE *f = fopen(fileName_.c_str(), "wb");
+    if (f == 0) throw std::runtime_error("ColumnarLimitWriter: can't open "+fileName_+" for writing");
+    try {
+        Header h;
+        std::memcpy(h.magic, kMagic, sizeof(kMagic));
+        h.ncolumns = columns_.size(); h.reserved = 0; h.nrows = rows_; h.textBytes = text.size();
+        put(f, fileName_, &h, sizeof(h));
+        put(f, fileName_, text.data(), text.size());
+        pad(f, fileName_, text.size());
+        for (std::vector<Column>::const_iterator it = columns_.begin(), ed = columns_.end(); it != ed; ++it) {
+            ColumnHeader c = { { it->type, 0, 0, 0 }, it->size, it->len };
+            put(f, fileName_, &c, sizeof(c));
+        }
+        pad(f, fileName_, columns_.size() * sizeof(ColumnHeader));
+        for (std::vector<Column>::const_iterator it = columns_.begin(), ed = columns_.end(); it != ed; ++it) {
+            put(f, fileName_, it->data.empty() ? 0 : &it->data[0], it->data.size());
+            pad(f, fileName_, it->data.size());
+        }
+    } catch (...) {
+        fclose(f);
+        throw;
+    }
+    if (fclose(f) != 0) throw std::runtime_error("ColumnarLimitWriter: failed to write to "+fileName_);
+}
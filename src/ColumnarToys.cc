@@ -0,0 +1,352 @@
+#include "HiggsAnalysis/CombinedLimit/interface/ColumnarToys.h"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/classification.hpp>
+#include <RooAbsData.h>
+#include <RooDataSet.h>
+#include <RooDataHist.h>
+#include <RooRealVar.h>
+#include <RooCategory.h>
+#include <RooArgSet.h>
+
+namespace {
+    const char kMagic[8] = { 'C', 'M', 'B', 'T', 'O', 'Y', 'S', '1' };
+    enum RecordType { LayoutRecord = 1, ToyRecord = 2 };
+    enum DataKind { UnweightedSet = 0, WeightedSet = 1, DataHist = 2 };
+    struct Record { int32_t type, id; uint32_t n, nseg; };
+    struct Segment { int32_t layout; uint32_t n; };
+    struct Footer { uint64_t textBytes, ntoys, nlayouts, nglobal; };
+    const char *kWeightName = "_weight_";
+
+    std::string join(const std::vector<std::string> &names) {
+        std::string ret;
+        for (unsigned int i = 0; i < names.size(); ++i) { if (i) ret += ","; ret += names[i]; }
+        return ret;
+    }
+    void split(const std::string &text, std::vector<std::string> &names) {
+        names.clear();
+        if (!text.empty()) boost::split(names, text, boost::is_any_of(","));
+    }
+    /// the name of the column without the "cat:" or "real:" in front
+    std::string columnName(const std::string &column) { return column.substr(column.find(':') + 1); }
+}
+
+ColumnarToyWriter::ColumnarToyWriter(const std::string &fileName) :
+    fileName_(fileName),
+    file_(fopen(fileName.c_str(), "wb")),
+    offset_(0),
+    catColumn_(-1)
+{
+    if (file_ == 0) throw std::runtime_error("ColumnarToyWriter: can't open "+fileName+" for writing");
+    put_(kMagic, sizeof(kMagic));
+}
+
+ColumnarToyWriter::~ColumnarToyWriter()
+{
+    if (file_ == 0) return;
+    try {
+        close();
+    } catch (std::exception &ex) {
+        fprintf(stderr, "%s\n", ex.what());
+    }
+}
+
+void ColumnarToyWriter::put_(const void *p, std::size_t n)
+{
+    if (n && fwrite(p, 1, n, file_) != n) throw std::runtime_error("ColumnarToyWriter: failed to write to "+fileName_);
+    offset_ += n;
+}
+
+void ColumnarToyWriter::columnsFrom_(const RooAbsData &data)
+{
+    RooLinkedListIter iter = data.get()->iterator();
+    for (RooAbsArg *a = (RooAbsArg *) iter.Next(); a != 0; a = (RooAbsArg *) iter.Next()) {
+        if (dynamic_cast<RooAbsCategory *>(a)) {
+            if (catColumn_ == -1) catColumn_ = columns_.size();
+            columns_.push_back(std::string("cat:")+a->GetName());
+        } else if (dynamic_cast<RooAbsReal *>(a)) {
+            columns_.push_back(std::string("real:")+a->GetName());
+        } else {
+            throw std::invalid_argument(std::string("ColumnarToyWriter: can't store the observable ")+a->GetName()+" of type "+a->ClassName());
+        }
+    }
+}
+
+int ColumnarToyWriter::layoutFor_(const double *first, const double *last, bool always)
+{
+    int channel = catColumn_ >= 0 ? int(first[catColumn_]) : 0;
+    std::map<int, std::pair<std::vector<double>, int> >::iterator it = channelLayouts_.find(channel);
+    if (it != channelLayouts_.end() && it->second.first.size() == std::size_t(last - first) && std::equal(first, last, it->second.first.begin())) {
+        return it->second.second;
+    }
+    if (it != channelLayouts_.end() && !always) return -1;
+    // the first time a channel is seen, its entries become its layout
+    int layout = layoutOffsets_.size();
+    if (it == channelLayouts_.end()) channelLayouts_[channel] = std::make_pair(std::vector<double>(first, last), layout);
+    layoutOffsets_.push_back(offset_);
+    Record r = { LayoutRecord, layout, uint32_t(columns_.empty() ? 0 : (last - first) / columns_.size()), 0 };
+    put_(&r, sizeof(r));
+    put_(first, (last - first) * sizeof(double));
+    return layout;
+}
+
+void ColumnarToyWriter::write(int id, const RooAbsData &data, const RooArgSet *globalObs)
+{
+    if (file_ == 0) throw std::runtime_error("ColumnarToyWriter: "+fileName_+" is already closed");
+    if (columns_.empty()) columnsFrom_(data);
+    unsigned int ncol = columns_.size(), n = data.numEntries();
+    uint32_t kind = dynamic_cast<const RooDataHist *>(&data) ? DataHist : (data.isWeighted() ? WeightedSet : UnweightedSet);
+
+    // read the entries into columns, in the order of columns_
+    std::vector<double> coords(std::size_t(n) * ncol), weights(kind == UnweightedSet ? 0 : n);
+    std::vector<const RooAbsArg *> args(ncol);
+    const RooArgSet *row = data.get();
+    for (unsigned int j = 0; j < ncol; ++j) {
+        args[j] = row->find(columnName(columns_[j]).c_str());
+        if (args[j] == 0) throw std::invalid_argument("ColumnarToyWriter: toy "+std::to_string(id)+" has no observable "+columnName(columns_[j]));
+    }
+    for (unsigned int i = 0; i < n; ++i) {
+        data.get(i);
+        double *out = &coords[std::size_t(i) * ncol];
+        for (unsigned int j = 0; j < ncol; ++j) {
+            out[j] = columns_[j][0] == 'c' ? double(static_cast<const RooAbsCategory *>(args[j])->getIndex()) : static_cast<const RooAbsReal *>(args[j])->getVal();
+        }
+        if (kind != UnweightedSet) weights[i] = data.weight();
+    }
+
+    // split into channels, and decide which ones use a layout (writing the new layouts before the toy)
+    std::vector<unsigned int> begins;
+    std::vector<int> layouts;
+    for (unsigned int i = 0; i < n; ++i) {
+        if (i == 0 || (catColumn_ >= 0 && coords[std::size_t(i) * ncol + catColumn_] != coords[std::size_t(i-1) * ncol + catColumn_])) begins.push_back(i);
+    }
+    if (n) begins.push_back(n);
+    for (unsigned int s = 0; s + 1 < begins.size(); ++s) {
+        const double *first = &coords[std::size_t(begins[s]) * ncol], *last = first + std::size_t(begins[s+1] - begins[s]) * ncol;
+        layouts.push_back(kind != UnweightedSet ? layoutFor_(first, last, false) : -1);
+    }
+
+    ids_.push_back(id);
+    toyOffsets_.push_back(offset_);
+    Record r = { ToyRecord, id, kind, uint32_t(layouts.size()) };
+    put_(&r, sizeof(r));
+    for (unsigned int s = 0; s < layouts.size(); ++s) {
+        Segment seg = { layouts[s], begins[s+1] - begins[s] };
+        put_(&seg, sizeof(seg));
+        if (layouts[s] == -1) put_(&coords[std::size_t(begins[s]) * ncol], std::size_t(seg.n) * ncol * sizeof(double));
+        if (kind != UnweightedSet) put_(&weights[begins[s]], seg.n * sizeof(double));
+    }
+
+    // global observables
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    if (globalObs && globalNames_.empty() && globalObs->getSize()) {
+        RooLinkedListIter iter = globalObs->iterator();
+        for (RooAbsArg *a = (RooAbsArg *) iter.Next(); a != 0; a = (RooAbsArg *) iter.Next()) globalNames_.push_back(a->GetName());
+        globals_.assign((ids_.size()-1) * globalNames_.size(), nan);
+    }
+    for (unsigned int j = 0; j < globalNames_.size(); ++j) {
+        const RooAbsArg *a = globalObs ? globalObs->find(globalNames_[j].c_str()) : 0;
+        if (dynamic_cast<const RooAbsCategory *>(a)) globals_.push_back(static_cast<const RooAbsCategory *>(a)->getIndex());
+        else if (dynamic_cast<const RooAbsReal *>(a)) globals_.push_back(static_cast<const RooAbsReal *>(a)->getVal());
+        else globals_.push_back(nan);
+    }
+}
+
+void ColumnarToyWriter::append(const ColumnarToyReader &in)
+{
+    if (file_ == 0) throw std::runtime_error("ColumnarToyWriter: "+fileName_+" is already closed");
+    if (in.ntoys_ == 0) return;
+    if (columns_.empty()) {
+        columns_ = in.columns_;
+        for (unsigned int j = 0; j < columns_.size() && catColumn_ == -1; ++j) if (columns_[j][0] == 'c') catColumn_ = j;
+    } else if (columns_ != in.columns_) {
+        throw std::invalid_argument("ColumnarToyWriter: the toys of "+in.fileName_+" don't have the same observables as those of "+fileName_);
+    }
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    if (globalNames_.empty() && !in.globalNames_.empty()) {
+        globalNames_ = in.globalNames_;
+        globals_.assign(ids_.size() * globalNames_.size(), nan);
+    }
+    std::vector<int> globalMap(globalNames_.size(), -1);
+    for (unsigned int j = 0; j < globalNames_.size(); ++j) {
+        std::vector<std::string>::const_iterator it = std::find(in.globalNames_.begin(), in.globalNames_.end(), globalNames_[j]);
+        if (it != in.globalNames_.end()) globalMap[j] = it - in.globalNames_.begin();
+    }
+
+    // copy the records, with the layouts of in mapped to those of this file
+    unsigned int ncol = columns_.size();
+    std::vector<int> layoutMap(in.nlayouts_, -1);
+    for (uint64_t l = 0; l < in.nlayouts_; ++l) {
+        const Record *r = reinterpret_cast<const Record *>(in.data_ + in.layoutOffsets_[l]);
+        const double *first = reinterpret_cast<const double *>(r + 1);
+        layoutMap[l] = layoutFor_(first, first + std::size_t(r->n) * ncol, true);
+    }
+    for (uint64_t i = 0; i < in.ntoys_; ++i) {
+        const Record *r = reinterpret_cast<const Record *>(in.data_ + in.toyOffsets_[i]);
+        ids_.push_back(in.ids_[i]);
+        toyOffsets_.push_back(offset_);
+        put_(r, sizeof(*r));
+        const char *p = reinterpret_cast<const char *>(r + 1);
+        for (unsigned int s = 0; s < r->nseg; ++s) {
+            Segment seg = *reinterpret_cast<const Segment *>(p); p += sizeof(Segment);
+            std::size_t bytes = (seg.layout == -1 ? std::size_t(seg.n) * ncol * sizeof(double) : 0) + (r->n != UnweightedSet ? seg.n * sizeof(double) : 0);
+            if (seg.layout != -1) seg.layout = layoutMap[seg.layout];
+            put_(&seg, sizeof(seg));
+            put_(p, bytes); p += bytes;
+        }
+        for (unsigned int j = 0; j < globalNames_.size(); ++j) {
+            globals_.push_back(globalMap[j] == -1 ? nan : in.globals_[i * in.nglobal_ + globalMap[j]]);
+        }
+    }
+}
+
+void ColumnarToyWriter::close()
+{
+    if (file_ == 0) return;
+    std::string text = join(columns_) + "\n" + join(globalNames_) + "\n";
+    text.resize((text.size() + 7) & ~std::size_t(7), '\0');
+    uint64_t footerOffset = offset_;
+    Footer f = { text.size(), ids_.size(), layoutOffsets_.size(), globalNames_.size() };
+    put_(&f, sizeof(f));
+    put_(text.data(), text.size());
+    put_(ids_.empty() ? 0 : &ids_[0], ids_.size() * sizeof(int64_t));
+    put_(toyOffsets_.empty() ? 0 : &toyOffsets_[0], toyOffsets_.size() * sizeof(uint64_t));
+    put_(layoutOffsets_.empty() ? 0 : &layoutOffsets_[0], layoutOffsets_.size() * sizeof(uint64_t));
+    put_(globals_.empty() ? 0 : &globals_[0], globals_.size() * sizeof(double));
+    put_(&footerOffset, sizeof(footerOffset));
+    put_(kMagic, sizeof(kMagic));
+    bool ok = (fclose(file_) == 0);
+    file_ = 0;
+    if (!ok) throw std::runtime_error("ColumnarToyWriter: failed to close "+fileName_);
+}
+
+bool ColumnarToyReader::isColumnar(const std::string &fileName)
+{
+    FILE *f = fopen(fileName.c_str(), "rb");
+    if (f == 0) return false;
+    char magic[sizeof(kMagic)];
+    bool ret = fseek(f, -long(sizeof(kMagic)), SEEK_END) == 0 && fread(magic, 1, sizeof(magic), f) == sizeof(magic) && memcmp(magic, kMagic, sizeof(kMagic)) == 0;
+    fclose(f);
+    return ret;
+}
+
+ColumnarToyReader::ColumnarToyReader(const std::string &fileName) :
+    fileName_(fileName),
+    data_(0), size_(0)
+{
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd == -1) throw std::runtime_error("ColumnarToyReader: can't open "+fileName);
+    struct stat st;
+    if (fstat(fd, &st) == -1) { ::close(fd); throw std::runtime_error("ColumnarToyReader: can't stat "+fileName); }
+    size_ = st.st_size;
+    void *map = size_ ? mmap(0, size_, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (map == MAP_FAILED) throw std::runtime_error("ColumnarToyReader: can't map "+fileName);
+    data_ = static_cast<const char *>(map);
+
+    uint64_t footerOffset = 0;
+    bool ok = size_ >= 2 * sizeof(kMagic) + sizeof(uint64_t) + sizeof(Footer) && memcmp(data_, kMagic, sizeof(kMagic)) == 0 && memcmp(data_ + size_ - sizeof(kMagic), kMagic, sizeof(kMagic)) == 0;
+    if (ok) {
+        memcpy(&footerOffset, data_ + size_ - sizeof(kMagic) - sizeof(uint64_t), sizeof(uint64_t));
+        ok = footerOffset >= sizeof(kMagic) && footerOffset + sizeof(Footer) <= size_;
+    }
+    const Footer *f = ok ? reinterpret_cast<const Footer *>(data_ + footerOffset) : 0;
+    if (ok) {
+        uint64_t bytes = sizeof(Footer) + f->textBytes + f->ntoys * (sizeof(int64_t) + sizeof(uint64_t)) + f->nlayouts * sizeof(uint64_t) + f->ntoys * f->nglobal * sizeof(double);
+        ok = footerOffset + bytes + sizeof(uint64_t) + sizeof(kMagic) == size_;
+    }
+    if (!ok) { munmap(const_cast<char *>(data_), size_); data_ = 0; throw std::runtime_error("ColumnarToyReader: "+fileName+" is not a complete columnar toy file"); }
+
+    const char *p = data_ + footerOffset + sizeof(Footer);
+    std::string text(p, strnlen(p, f->textBytes));
+    std::string::size_type nl = text.find('\n');
+    split(text.substr(0, nl), columns_);
+    split(text.substr(nl + 1, text.find('\n', nl + 1) - nl - 1), globalNames_);
+    p += f->textBytes;
+    nglobal_ = f->nglobal;
+    ntoys_ = f->ntoys; nlayouts_ = f->nlayouts;
+    ids_           = reinterpret_cast<const int64_t *>(p);        p += f->ntoys * sizeof(int64_t);
+    toyOffsets_    = reinterpret_cast<const uint64_t *>(p);       p += f->ntoys * sizeof(uint64_t);
+    layoutOffsets_ = reinterpret_cast<const uint64_t *>(p);       p += f->nlayouts * sizeof(uint64_t);
+    globals_       = reinterpret_cast<const double *>(p);
+    for (uint64_t i = 0; i < f->ntoys; ++i) index_[ids_[i]] = i;
+}
+
+ColumnarToyReader::~ColumnarToyReader()
+{
+    if (data_) munmap(const_cast<char *>(data_), size_);
+}
+
+RooAbsData * ColumnarToyReader::get(int id, const RooArgSet &obs) const
+{
+    std::map<int, unsigned int>::const_iterator it = index_.find(id);
+    if (it == index_.end()) return 0;
+    unsigned int ncol = columns_.size();
+    std::vector<RooAbsArg *> args(ncol);
+    RooArgSet vars;
+    for (unsigned int j = 0; j < ncol; ++j) {
+        args[j] = obs.find(columnName(columns_[j]).c_str());
+        if (args[j] == 0) throw std::invalid_argument("ColumnarToyReader: no observable "+columnName(columns_[j])+" for the toys of "+fileName_);
+        vars.add(*args[j]);
+    }
+
+    const Record *r = reinterpret_cast<const Record *>(data_ + toyOffsets_[it->second]);
+    RooAbsData *ret = 0;
+    RooDataHist *hist = 0; RooDataSet *set = 0;
+    if (r->n == DataHist) {
+        ret = hist = new RooDataHist("toy", "toy", vars);
+    } else if (r->n == WeightedSet) {
+        RooRealVar weight(kWeightName, "", 1.0);
+        RooArgSet varsPlusWeight(vars); varsPlusWeight.add(weight);
+        ret = set = new RooDataSet("toy", "toy", varsPlusWeight, kWeightName);
+    } else {
+        ret = set = new RooDataSet("toy", "toy", vars);
+    }
+    RooAbsArg::setDirtyInhibit(true); // don't propagate dirty flags while filling
+    const char *p = reinterpret_cast<const char *>(r + 1);
+    for (unsigned int s = 0; s < r->nseg; ++s) {
+        const Segment *seg = reinterpret_cast<const Segment *>(p); p += sizeof(Segment);
+        const double *coords;
+        if (seg->layout == -1) {
+            coords = reinterpret_cast<const double *>(p); p += std::size_t(seg->n) * ncol * sizeof(double);
+        } else {
+            coords = reinterpret_cast<const double *>(data_ + layoutOffsets_[seg->layout] + sizeof(Record));
+        }
+        const double *weights = 0;
+        if (r->n != UnweightedSet) { weights = reinterpret_cast<const double *>(p); p += seg->n * sizeof(double); }
+        for (unsigned int i = 0; i < seg->n; ++i, coords += ncol) {
+            for (unsigned int j = 0; j < ncol; ++j) {
+                if (columns_[j][0] == 'c') static_cast<RooCategory *>(args[j])->setIndex(int(coords[j]));
+                else static_cast<RooRealVar *>(args[j])->setVal(coords[j]);
+            }
+            if (hist) hist->add(vars, weights[i]);
+            else if (weights) set->add(vars, weights[i]);
+            else set->add(vars);
+        }
+    }
+    RooAbsArg::setDirtyInhibit(false); // restore proper propagation of dirty flags
+    return ret;
+}
+
+bool ColumnarToyReader::getGlobalObservables(int id, RooArgSet &globalObs) const
+{
+    std::map<int, unsigned int>::const_iterator it = index_.find(id);
+    if (it == index_.end() || nglobal_ == 0) return false;
+    const double *vals = globals_ + std::size_t(it->second) * nglobal_;
+    bool found = false;
+    for (unsigned int j = 0; j < nglobal_; ++j) {
+        if (std::isnan(vals[j])) continue;
+        RooAbsArg *a = globalObs.find(globalNames_[j].c_str());
+        if (RooCategory *cat = dynamic_cast<RooCategory *>(a)) { cat->setIndex(int(vals[j])); found = true; }
+        else if (RooRealVar *var = dynamic_cast<RooRealVar *>(a)) { var->setVal(vals[j]); found = true; }
+    }
+    return found;
+}
@@ -2,6 +2,8 @@
 #include "HiggsAnalysis/CombinedLimit/interface/utils.h"
 
 #include <cmath>
+#include <stdexcept>
+#include <RooAbsLValue.h>
 
 CombDataSetFactory::CombDataSetFactory(const RooArgSet &vars, RooCategory &cat) :
     vars_(vars), cat_(&cat), weight_(0)
@@ -15,6 +17,16 @@ void CombDataSetFactory::addSetBin(const char *label, RooDataHist *set) {
     map_[label] = set;
 }
 
+void CombDataSetFactory::addSetBin(const char *label, const double *weights, const double *sumw2, unsigned int n) {
+    bulk_[label].assign(weights, weights + n);
+    bulkSumw2_[label].assign(sumw2 ? sumw2 : weights, (sumw2 ? sumw2 : weights) + n);
+}
+
+void CombDataSetFactory::addSetBin(const char *label, const std::vector<double> &weights, const std::vector<double> &sumw2) {
+    if (sumw2.size() != weights.size()) throw std::invalid_argument(std::string("CombDataSetFactory: not as many sums of squared weights as weights for ")+label);
+    addSetBin(label, weights.empty() ? 0 : &weights[0], sumw2.empty() ? 0 : &sumw2[0], weights.size());
+}
+
 void CombDataSetFactory::addSetAny(const char *label, RooDataHist *set) {
     if (weight_ == 0) weight_ = new RooRealVar("_weight_","",1);
     RooDataSet *data = new RooDataSet(TString(set->GetName())+"_unbin", "", RooArgSet(*set->get(), *weight_), "_weight_");
@@ -32,8 +44,36 @@ void CombDataSetFactory::addSetAny(const char *label, RooDataSet *set) {
 
 
 RooDataHist *CombDataSetFactory::done(const char *name, const char *title) {
-    return new RooDataHist(name,title,vars_,*cat_,map_);
+    RooDataHist *ret = 0;
+    if (map_.empty()) {
+        RooArgSet varsPlusCat(vars_); varsPlusCat.add(*cat_);
+        ret = new RooDataHist(name,title,varsPlusCat);
+    } else {
+        ret = new RooDataHist(name,title,vars_,*cat_,map_);
+    }
+    if (!bulk_.empty()) {
+        if (vars_.getSize() != 1) throw std::invalid_argument("CombDataSetFactory: bulk import of binned data needs a single observable");
+        // set the bin of the observable and the category directly in the variables of the dataset,
+        // so that each add() only has to compute the index from them (no lookup by name nor copy of the entries of the channel)
+        RooArgSet *row = const_cast<RooArgSet *>(ret->get());
+        RooAbsLValue *x = dynamic_cast<RooAbsLValue *>(row->find(vars_.first()->GetName()));
+        RooCategory *cat = dynamic_cast<RooCategory *>(row->find(cat_->GetName()));
+        if (x == 0 || cat == 0) throw std::logic_error("CombDataSetFactory: observable or category missing from the combined dataset");
+        for (std::map<std::string, std::vector<double> >::const_iterator it = bulk_.begin(), ed = bulk_.end(); it != ed; ++it) {
+            if (cat->setLabel(it->first.c_str())) throw std::invalid_argument("CombDataSetFactory: unknown category "+it->first);
+            const std::vector<double> &weights = it->second, &sumw2 = bulkSumw2_[it->first];
+            if (int(weights.size()) > x->numBins()) throw std::invalid_argument("CombDataSetFactory: more weights than bins for "+it->first);
+            for (int i = 0, n = weights.size(); i < n; ++i) {
+                if (weights[i] == 0) continue;
+                x->setBin(i);
+                // as RooDataHist(TH1) does, not the square of the sum of the weights that add() assumes otherwise
+                ret->add(*row, weights[i], sumw2[i]);
+            }
+        }
+        bulk_.clear(); bulkSumw2_.clear();
+    }
     map_.clear();
+    return ret;
 }
 
 RooDataSet *CombDataSetFactory::doneUnbinned(const char *name, const char *title) {
@@ -10,20 +10,34 @@
 #include <vector>
 #include <string>
 #include <stdexcept>
+#include <exception>
 #include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <regex>
+#include <cctype>
 #include <unistd.h>
 #include <errno.h>
+#include <limits>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include <TCanvas.h>
 #include <TFile.h>
 #include <TGraphErrors.h>
 #include <TIterator.h>
+#include <TKey.h>
+#include <TLeaf.h>
 #include <TLine.h>
 #include <TMath.h>
 #include <TString.h>
 #include <TSystem.h>
 #include <TStopwatch.h>
 #include <TTree.h>
+#include <TROOT.h>
+#include <RVersion.h>
+#include <RConfigure.h>
 
 #include <RooAbsData.h>
 #include <RooAbsPdf.h>
@@ -48,15 +62,26 @@
 #include <boost/filesystem.hpp>
 #include <boost/program_options.hpp>
 #include <boost/algorithm/string/predicate.hpp>
+#include <boost/functional/hash.hpp>
 
 #include "HiggsAnalysis/CombinedLimit/interface/LimitAlgo.h"
 #include "HiggsAnalysis/CombinedLimit/interface/utils.h"
 #include "HiggsAnalysis/CombinedLimit/interface/CloseCoutSentry.h"
 #include "HiggsAnalysis/CombinedLimit/interface/RooSimultaneousOpt.h"
 #include "HiggsAnalysis/CombinedLimit/interface/ToyMCSamplerOpt.h"
+#include "HiggsAnalysis/CombinedLimit/interface/ColumnarToys.h"
+#include "HiggsAnalysis/CombinedLimit/interface/ColumnarLimits.h"
 #include "HiggsAnalysis/CombinedLimit/interface/AsimovUtils.h"
 #include "HiggsAnalysis/CombinedLimit/interface/CascadeMinimizer.h"
 #include "HiggsAnalysis/CombinedLimit/interface/ProfilingTools.h"
+#include "HiggsAnalysis/CombinedLimit/interface/AsyncWriter.h"
+#include "HiggsAnalysis/CombinedLimit/interface/AsyncReader.h"
+#include "HiggsAnalysis/CombinedLimit/interface/SplitWorkspace.h"
+#include "HiggsAnalysis/CombinedLimit/interface/CounterRandom.h"
+#include "HiggsAnalysis/CombinedLimit/interface/Checkpoint.h"
+#include "HiggsAnalysis/CombinedLimit/interface/ThreadPool.h"
+#include "HiggsAnalysis/CombinedLimit/interface/FcnTrace.h"
+#include "HiggsAnalysis/CombinedLimit/interface/VerticalInterpHistPdf.h"
 
 using namespace RooStats;
 using namespace RooFit;
@@ -69,6 +94,9 @@ Float_t g_quantileExpected_ = -1.0;
 TDirectory *outputFile = 0;
 TDirectory *writeToysHere = 0;
 TDirectory *readToysFromHere = 0;
+ColumnarToyWriter *writeColumnarToysHere = 0;
+ColumnarToyReader *readColumnarToysFromHere = 0;
+ColumnarLimitWriter *writeColumnarLimitsHere = 0;
 int  verbose = 1;
 bool withSystematics = 1;
 bool doSignificance_ = 0;
@@ -77,6 +105,7 @@ float cl = 0.95;
 bool bypassFrequentistFit_ = false;
 bool g_fillTree_ = true;
 TTree *Combine::tree_ = 0;
+std::vector<char> *Combine::toyRecord_ = 0;
 
 std::string setPhysicsModelParameterExpression_ = "";
 std::string setPhysicsModelParameterRangeExpression_ = "";
@@ -126,6 +155,12 @@ Combine::Combine() :
 
       ("validateModel,V", "Perform some sanity checks on the model and abort if they fail.")
       ("saveToys",   "Save results of toy MC in output file")
+      ("saveToysColumnar", "With --saveToys, write the toys in a columnar binary file next to the output file (.toys instead of .root), which --toysFile reads much faster than the toys of the output file")
+      ("saveColumnarTree", "Also write the rows of the limit tree in a columnar binary file next to the output file (.limit instead of .root), written at the end of the job; the files of many jobs can be merged with cat, and read with python/ColumnarLimits.py")
+      ("asyncOutput", po::value<unsigned int>(&asyncOutput_)->default_value(0), "Write the toys saved with --saveToys from a background thread, with at most N of them waiting to be written (0 = write them immediately)")
+      ("prefetchToys", po::value<unsigned int>(&prefetchToys_)->default_value(0), "When reading the toys with --toysFile, read and decompress up to N of the next toys in a background thread while the current one is being fitted (0 = read each toy when it's needed)")
+      ("modelCache", po::value<std::string>(&modelCache_)->default_value(""), "Directory where to keep the workspaces converted from text datacards, to reuse them as long as the datacard, its shape files and the conversion options don't change")
+      ("asimovCache", po::value<std::string>(&asimovCache_)->default_value(""), "Reuse the fitted asimov datasets when the model, its parameters and the data are the same: 'memory' to keep them only for this job, or a directory where to keep them also for the next jobs")
       ("floatAllNuisances", po::value<bool>(&floatAllNuisances_)->default_value(false), "Make all nuisance parameters floating")
       ("floatNuisances", po::value<string>(&floatNuisances_)->default_value(""), "Set to floating these nuisance parameters (note freeze will take priority over float)")
       ("freezeAllGlobalObs", po::value<bool>(&freezeAllGlobalObs_)->default_value(true), "Make all global observables constant")
@@ -136,12 +171,26 @@ Combine::Combine() :
       ("noMCbonly", po::value<bool>(&noMCbonly_)->default_value(false), "Don't create a background-only modelConfig")
       ("noDefaultPrior", po::value<bool>(&noDefaultPrior_)->default_value(false), "Don't create a default uniform prior")
       ("rebuildSimPdf", po::value<bool>(&rebuildSimPdf_)->default_value(false), "Rebuild simultaneous pdf from scratch to make sure constraints are correct (not needed in CMS workspaces)")
+      ("loadChannels", po::value<std::string>(&loadChannels_)->default_value(""), "For workspaces split by channel (text2workspace.py --X-split-channels), read only the channels whose label matches this regular expression, and those not masked by --setParameters. The others are left out of the model")
+      ("upgradeHistPdfs", po::value<bool>(&upgradeHistPdfs_)->default_value(false), "Replace the legacy VerticalInterpHistPdf, FastVerticalInterpHistPdf and FastVerticalInterpHistPdf2D of old workspaces with the faster FastVerticalInterpHistPdf2 and FastVerticalInterpHistPdf2D2, checking that they give the same values")
       ("compile", "Compile expressions instead of interpreting them")
       ("tempDir", po::value<bool>(&makeTempDir_)->default_value(false), "Run the program from a temporary directory (automatically on for text datacards or if 'compile' is activated)")
       ("guessGenMode", "Guess if to generate binned or unbinned based on dataset")
       ("genBinnedChannels", po::value<std::string>(&genAsBinned_)->default_value(genAsBinned_), "Flag the given channels to be generated binned (irrespectively of how they were flagged at workspace creation)") 
       ("genUnbinnedChannels", po::value<std::string>(&genAsUnbinned_)->default_value(genAsUnbinned_), "Flag the given channels to be generated unbinned (irrespectively of how they were flagged at workspace creation)") 
       ("trackParameters",   boost::program_options::value<std::string>(&trackParametersNameString_)->default_value(""), "Keep track of parameters in workspace (default = none)")
+      ("toyForks", po::value<unsigned int>(&toyForks_)->default_value(0), "Split the toys among N forked processes, each doing a contiguous block of toys, and fill the output tree in toy order.\n"
+                                                                          "Any non-zero value also seeds each toy from --seed and the toy number, so that the results don't depend on N")
+      ("threads", po::value<unsigned int>(&threads_)->default_value(0), "Number of threads of the pool shared by all the parallel parts of combine (including the main thread), e.g. the core count of the batch slot.\n"
+                                                                      "The expected CLs from the grid of HybridNew and the quantiles use it unless their --X-rtd knob is set, which then only limits how many of the threads they take; the channels of the NLL are evaluated in parallel only with --X-rtd SIMNLL_THREADS=N, on at most N of them. ROOT's implicit multi-threading, if enabled, is limited to the same number")
+      ("pinThreads", "Pin the threads of --threads to the cores allowed to the job, one NUMA node after the other, and have each channel of the NLL allocated on the node of the thread that evaluates it")
+      ("massList", po::value<std::string>(&massListString_)->default_value(""), "Comma separated list of values of MH for which to compute the result from the same model, instead of only the one from --mass (only for the observed data or the b-only asimov dataset, not with toys; one entry per mass point in the output tree)")
+      ("fcnTrace", po::value<std::string>(&fcnTrace_)->default_value(""), "Write to this file the parameters, value and time of every evaluation of the functions minimized, to replay them later on the same workspace with replayFcnTrace")
+      ("checkpoint", po::value<std::string>(&checkpoint_)->default_value(""), "Save the partial results of HybridNew (each batch of toys), MarkovChainMC (each chain) and MultiDimFit (each point of the grid) in this file as they are done, to continue from them with --resume if the job is killed")
+      ("resume", "Continue from the partial results in the file of --checkpoint, with the same options as the job that left them")
+      ("server", po::value<std::string>(&server_)->default_value(""), "Load the model and the data once, then run the requests read one per line from stdin ('-') or from connections to the local socket at this path, until 'quit'.\n"
+                                                                      "A request is '-M method' followed by the options of the method, and optionally -m, --significance, --setPhysicsModelParameters, --setPhysicsModelParameterRanges and --freezeNuisances, which apply to that request only.\n"
+                                                                      "The model is reset to its initial state after each request, the results go into the output tree, and the reply is 'DONE <ok> <limit> <limitErr> <seconds>' or 'ERROR <message>'")
       ; 
 }
 
@@ -171,7 +220,27 @@ void Combine::applyOptions(const boost::program_options::variables_map &vm) {
   bypassFrequentistFit_ = vm.count("bypassFrequentistFit");
   overrideSnapshotMass_ = vm.count("overrideSnapshotMass");
   mass_ = vm["mass"].as<float>();
+  massList_.clear();
+  if (!massListString_.empty()) {
+    std::vector<std::string> masses;
+    boost::split(masses, massListString_, boost::is_any_of(","));
+    for (const std::string &m : masses) massList_.push_back(atof(m.c_str()));
+  }
+  if (vm.count("pinThreads") && threads_ == 0) throw std::invalid_argument("Option --pinThreads needs --threads");
+  if (threads_ > 0) {
+    ThreadPool::setGlobalThreads(threads_, vm.count("pinThreads"));
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,4,0)
+    if (threads_ > 1) ROOT::EnableThreadSafety();
+#endif
+#ifdef R__USE_IMT
+    // ROOT's own pool would otherwise take all the cores of the machine
+    if (ROOT::IsImplicitMTEnabled()) { ROOT::DisableImplicitMT(); ROOT::EnableImplicitMT(threads_); }
+#endif
+  }
+  if (!fcnTrace_.empty()) FcnTraceWriter::open(fcnTrace_);
   saveToys_ = vm.count("saveToys");
+  resume_ = vm.count("resume");
+  if (resume_ && checkpoint_.empty()) throw std::invalid_argument("Option --resume needs the file of --checkpoint");
   validateModel_ = vm.count("validateModel");
   const std::string &method = vm["method"].as<std::string>();
   if (method == "MultiDimFit" || ( method == "MaxLikelihoodFit" && vm.count("justFit")) || method == "MarkovChainMC") {
@@ -202,6 +271,7 @@ bool Combine::mklimit(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::Mo
         } 
     }
     limitErr = 0; // start with 0, as some algorithms don't compute it
+    ScopedTimer algoTimer(algo->name().c_str());
     ret = algo->run(w, mc_s, mc_b, data, limit, limitErr, (hashint ? &hint : 0));    
   } catch (std::exception &ex) {
     std::cerr << "Caught exception " << ex.what() << std::endl;
@@ -231,11 +301,169 @@ namespace {
             if (!path.empty()) {  boost::filesystem::remove_all(path); }
         }
     };
+    /// Name of the workspace for this datacard in the model cache: the key is a hash of the conversion options,
+    /// of the text of the datacard, and of the name, size and modification time of the shape files it reads
+    /// add to key the path, size and modification time of an input file of a datacard, or of all the files 
+    /// its name can stand for if it has placeholders ($MASS, $CHANNEL, $PROCESS, ...) or wildcards in it.
+    /// Returns false if the files can't be listed (placeholders in the directory)
+    bool hashInputFile(std::size_t &key, const boost::filesystem::path &file) {
+        boost::system::error_code ec;
+        std::string name = file.filename().string();
+        if (file.parent_path().string().find_first_of("$*") != std::string::npos) return false;
+        std::vector<boost::filesystem::path> files;
+        if (name.find_first_of("$*") == std::string::npos) {
+            files.push_back(file);
+        } else {
+            std::string pattern;
+            for (unsigned int i = 0, n = name.size(); i < n; ++i) {
+                if (name[i] == '*') { pattern += ".*"; continue; }
+                if (name[i] == '$') { pattern += ".*"; while (i+1 < n && (isalnum(name[i+1]) || name[i+1] == '_')) ++i; continue; }
+                if (!isalnum(name[i])) pattern += '\\';
+                pattern += name[i];
+            }
+            std::regex match(pattern);
+            for (boost::filesystem::directory_iterator it(file.parent_path(), ec), ed; !ec && it != ed; it.increment(ec)) {
+                if (std::regex_match(it->path().filename().string(), match)) files.push_back(it->path());
+            }
+            if (ec) return false;
+            std::sort(files.begin(), files.end());
+        }
+        for (const boost::filesystem::path &f : files) {
+            boost::hash_combine(key, f.string());
+            boost::hash_combine(key, boost::filesystem::file_size(f, ec));
+            boost::hash_combine(key, boost::filesystem::last_write_time(f, ec));
+        }
+        return true;
+    }
+    /// name of the workspace for this datacard and conversion options in the model cache, or empty if it can't be cached
+    std::string cachedModelName(const std::string &cacheDir, const std::string &datacard, const std::string &options) {
+        std::ifstream in(datacard.c_str());
+        std::stringstream text; text << in.rdbuf();
+        std::size_t key = 0;
+        boost::hash_combine(key, options);
+        boost::hash_combine(key, text.str());
+        boost::filesystem::path dir = boost::filesystem::path(datacard).parent_path();
+        std::istringstream lines(text.str()); std::string line;
+        while (std::getline(lines, line)) {
+            // the shape files, and the workspaces of the rateParams taken from a file (file.root:workspace)
+            std::istringstream tokens(line); std::string words[4], file;
+            if (!(tokens >> words[0] >> words[1] >> words[2] >> words[3])) continue;
+            if (words[0] == "shapes") file = words[3];
+            else if (words[1] == "rateParam" && (tokens >> file) && file.find(".root:") != std::string::npos) file = file.substr(0, file.find(".root:") + 5);
+            else continue;
+            boost::filesystem::path input(file);
+            if (input.is_relative()) input = dir / input;
+            if (!hashInputFile(key, input)) return std::string();
+        }
+        char buff[32]; snprintf(buff, 31, "%016llx", (unsigned long long) key);
+        return cacheDir + "/model-" + buff + ".root";
+    }
+
+    /// With --toyForks the children record the content of the branches at each commitPoint, and the parent fills the tree with it.
+    /// All the branches are booked with a leaf list, so the content is just the bytes at the addresses of the leaves.
+    void appendLeaves(TTree *tree, std::vector<char> &out) {
+        TIter next(tree->GetListOfLeaves());
+        while (TLeaf *leaf = (TLeaf *) next()) {
+            const char *data = (const char *) leaf->GetValuePointer();
+            out.insert(out.end(), data, data + leaf->GetLenType() * leaf->GetLen());
+        }
+    }
+    /// copy back into the leaves what was saved by appendLeaves, returning the end of the data that was used
+    const char * restoreLeaves(TTree *tree, const char *in, const char *end) {
+        TIter next(tree->GetListOfLeaves());
+        while (TLeaf *leaf = (TLeaf *) next()) {
+            int size = leaf->GetLenType() * leaf->GetLen();
+            if (in + size > end) throw std::runtime_error("The toys from the forked processes don't match the branches of the output tree");
+            memcpy(leaf->GetValuePointer(), in, size);
+            in += size;
+        }
+        return in;
+    }
+    /// what a forked child writes for each toy, followed by the bytes of all its commits
+    struct ForkedToyHeader { int iToy, ok, bytes; double limit; };
+    /// seed of each toy with --toyForks, the same whatever process it is run in
+    UInt_t toySeed(UInt_t base, int iToy) {
+        std::size_t seed = base;
+        boost::hash_combine(seed, iToy);
+        UInt_t ret = UInt_t(seed) ^ UInt_t(seed >> 16 >> 16);
+        return ret ? ret : 1; // TRandom3::SetSeed(0) would take a random seed
+    }
+    /// where the requests of --server come from: lines of stdin, with the replies on stdout,
+    /// or one line for each connection to a local socket, with the reply on the same connection
+    class ServerChannel {
+        public:
+            explicit ServerChannel(const std::string &address) : listen_(-1), conn_(-1) {
+                if (address == "-") return;
+                struct sockaddr_un addr; memset(&addr, 0, sizeof(addr));
+                addr.sun_family = AF_UNIX;
+                if (address.size() >= sizeof(addr.sun_path)) throw std::invalid_argument("Path of the --server socket too long: "+address);
+                strcpy(addr.sun_path, address.c_str());
+                unlink(address.c_str()); // left over by a server that was killed
+                listen_ = socket(AF_UNIX, SOCK_STREAM, 0);
+                if (listen_ == -1 || bind(listen_, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(listen_, 16) != 0) {
+                    throw std::runtime_error("Can't listen on the --server socket "+address+": "+strerror(errno));
+                }
+                path_ = address;
+            }
+            ~ServerChannel() {
+                if (conn_ != -1) close(conn_);
+                if (listen_ != -1) { close(listen_); unlink(path_.c_str()); }
+            }
+            bool next(std::string &line) {
+                line.clear();
+                if (listen_ == -1) return bool(std::getline(std::cin, line));
+                for (;;) {
+                    if (conn_ != -1) close(conn_);
+                    conn_ = accept(listen_, 0, 0);
+                    if (conn_ == -1) {
+                        if (errno == EINTR) continue;
+                        std::cerr << "Failed to accept a connection on " << path_ << ": " << strerror(errno) << std::endl;
+                        return false;
+                    }
+                    char c; ssize_t got;
+                    while ((got = recv(conn_, &c, 1, 0)) == 1 || (got == -1 && errno == EINTR)) {
+                        if (got == 1 && c == '\n') return true;
+                        if (got == 1) line += c;
+                    }
+                    if (!line.empty()) return true;
+                }
+            }
+            void reply(const std::string &text) {
+                std::string line = text + "\n";
+                if (listen_ == -1) {
+                    std::cout << ">>> server: " << line << std::flush;
+                } else if (conn_ != -1) {
+                    if (send(conn_, line.data(), line.size(), MSG_NOSIGNAL) != ssize_t(line.size())) std::cerr << "Failed to send the reply on " << path_ << std::endl;
+                    close(conn_); conn_ = -1;
+                }
+            }
+        private:
+            int listen_, conn_;
+            std::string path_;
+    };
+    /// a forked child that unwinds out of the toy loop because of an exception must exit there, and not continue in the code of the parent
+    struct ForkedToyGuard {
+        bool active;
+        ForkedToyGuard() : active(false) {}
+        ~ForkedToyGuard() {
+            if (active && std::uncaught_exception()) {
+                std::cerr << "Toy loop of a forked process terminated by an exception" << std::endl;
+                fflush(stdout); fflush(stderr);
+                _exit(1);
+            }
+        }
+    };
 }
 void Combine::run(TString hlfFile, const std::string &dataset, double &limit, double &limitErr, int &iToy, TTree *tree, int nToys) {
   ToCleanUp garbageCollect; // use this to close and delete temporary files
 
   TString tmpDir = "", tmpFile = "", pwd(gSystem->pwd());
+  if (!massList_.empty() && nToys > 0) throw std::invalid_argument("Option --massList works only on the observed data or the asimov dataset, not with toys (run one job per mass instead)");
+  if (!checkpoint_.empty()) {
+      if (nToys > 0) throw std::invalid_argument("Option --checkpoint works only on the observed data or the asimov dataset, not with toys");
+      Checkpoint::setup(checkpoint_[0] == '/' ? checkpoint_ : std::string(pwd.Data())+"/"+checkpoint_, resume_);
+      if (resume_) std::cout << ">>> resuming from the partial results in " << checkpoint_ << std::endl;
+  }
   if (makeTempDir_) { 
       tmpDir = "roostats-XXXXXX"; tmpFile = "model";
       mkdtemp(const_cast<char *>(tmpDir.Data()));
@@ -267,12 +495,38 @@ void Combine::run(TString hlfFile, const std::string &dataset, double &limit, do
     //int status = gSystem->Exec("text2workspace.py "+options+" '"+txtFile+"' -o "+tmpFile+".hlf"); 
     //isTextDatacard = true; fileToLoad = tmpFile+".hlf";
     //-- Binary mode: new default 
-    int status = gSystem->Exec("text2workspace.py "+options+" '"+txtFile+"' -b -o "+tmpFile+".root"); 
-    isBinary = true; fileToLoad = tmpFile+".root";
-    if (status != 0 || !boost::filesystem::exists(fileToLoad.Data())) {
-        throw std::invalid_argument("Failed to convert the input datacard from LandS to RooStats format. The lines above probably contain more information about the error.");
+    std::string cached;
+    if (!modelCache_.empty()) {
+        cached = cachedModelName(modelCache_[0] == '/' ? modelCache_ : std::string(pwd.Data())+"/"+modelCache_, txtFile.Data(), options.Data());
+    }
+    if (!cached.empty() && boost::filesystem::exists(cached)) {
+        if (verbose > 0) std::cout << "Using the workspace " << cached << " from the model cache." << std::endl;
+        isBinary = true; fileToLoad = cached.c_str();
+    } else {
+        int status = gSystem->Exec("text2workspace.py "+options+" '"+txtFile+"' -b -o "+tmpFile+".root"); 
+        isBinary = true; fileToLoad = tmpFile+".root";
+        if (status != 0 || !boost::filesystem::exists(fileToLoad.Data())) {
+            throw std::invalid_argument("Failed to convert the input datacard from LandS to RooStats format. The lines above probably contain more information about the error.");
+        }
+        garbageCollect.file = fileToLoad;
+        if (!cached.empty()) {
+            // copy and then rename, so that concurrent jobs never see a partially written file
+            std::string partial = cached + TString::Format(".%d", getpid()).Data();
+            try {
+                boost::filesystem::create_directories(boost::filesystem::path(cached).parent_path());
+                boost::filesystem::copy_file(fileToLoad.Data(), partial, boost::filesystem::copy_option::overwrite_if_exists);
+                boost::filesystem::rename(partial, cached);
+                if (verbose > 0) std::cout << "Saved the workspace as " << cached << " in the model cache." << std::endl;
+            } catch (const boost::filesystem::filesystem_error &err) {
+                std::cerr << "Could not save the workspace in the model cache: " << err.what() << std::endl;
+                boost::system::error_code ec; boost::filesystem::remove(partial, ec);
+            }
+        }
     }
-    garbageCollect.file = fileToLoad;
+  }
+
+  if (!asimovCache_.empty()) {
+      asimovutils::setCache(true, asimovCache_ == "memory" ? std::string() : (asimovCache_[0] == '/' ? asimovCache_ : std::string(pwd.Data())+"/"+asimovCache_), fileToLoad.Data());
   }
 
   if (getenv("CMSSW_BASE")) {
@@ -288,12 +542,19 @@ void Combine::run(TString hlfFile, const std::string &dataset, double &limit, do
   // Load the model, but going in a temporary directory to avoid polluting the current one with garbage from 'cexpr'
   RooWorkspace *w = 0; RooStats::ModelConfig *mc = 0, *mc_bonly = 0;
   std::auto_ptr<RooStats::HLFactory> hlf(0);
+  utils::clearSnapshots(); // they belong to the workspace of the previous run
 
   if (isBinary) {
     TFile *fIn = TFile::Open(fileToLoad); 
     garbageCollect.tfile = fIn; // request that we close this file when done
 
-    w = dynamic_cast<RooWorkspace *>(fIn->Get(workspaceName_.c_str()));
+    if (ThreadPool::globalThreads() > 1) {
+        TObject *obj = AsyncReader::readWithThreads(fIn, workspaceName_, ThreadPool::globalThreads());
+        w = dynamic_cast<RooWorkspace *>(obj);
+        if (w == 0) delete obj;
+    } else {
+        w = dynamic_cast<RooWorkspace *>(fIn->Get(workspaceName_.c_str()));
+    }
     if (w == 0) {  
         std::cerr << "Could not find workspace '" << workspaceName_ << "' in file " << fileToLoad << std::endl; fIn->ls(); 
         throw std::invalid_argument("Missing Workspace"); 
@@ -306,6 +567,19 @@ void Combine::run(TString hlfFile, const std::string &dataset, double &limit, do
       if (verbose > 2) std::cerr << "Setting variable 'MH' in workspace to the higgs mass " << mass_ << std::endl;
       MH->setVal(mass_);
     }
+    if (splitworkspace::isSplit(*fIn, *w)) {
+      // the masks set from the command line already leave their channels out
+      if (setPhysicsModelParameterExpression_ != "") {
+        RooArgSet allParams(w->allVars());
+        allParams.add(w->allCats());
+        utils::setModelParameters(setPhysicsModelParameterExpression_, allParams);
+      }
+      int nchannels = splitworkspace::loadChannels(*fIn, *w, loadChannels_, verbose);
+      if (nchannels == 0) throw std::invalid_argument("No channel of the workspace matches --loadChannels "+loadChannels_);
+      if (verbose > 0) std::cout << "Read " << nchannels << " channels of the split workspace '" << workspaceName_ << "'" << std::endl;
+    } else if (!loadChannels_.empty()) {
+      throw std::invalid_argument("Option --loadChannels works only on workspaces split by channel (text2workspace.py --X-split-channels)");
+    }
     mc       = dynamic_cast<RooStats::ModelConfig *>(w->genobj(modelConfigName_.c_str()));
     mc_bonly = dynamic_cast<RooStats::ModelConfig *>(w->genobj(modelConfigNameB_.c_str()));
 
@@ -324,6 +598,10 @@ void Combine::run(TString hlfFile, const std::string &dataset, double &limit, do
         w->import(*newpdf);
         mc->SetPdf(*newpdf);
     }
+    if (upgradeHistPdfs_) {
+        utils::upgradeHistPdfs(*mc->GetPdf(), *mc->GetObservables(), 1e-5, verbose);
+        if (mc_bonly && mc_bonly->GetPdf()) utils::upgradeHistPdfs(*mc_bonly->GetPdf(), *mc->GetObservables(), 1e-5, verbose);
+    }
     if (optSimPdf_ && typeid(*mc->GetPdf()) == typeid(RooSimultaneous)) {
         RooSimultaneousOpt *optpdf = new RooSimultaneousOpt(static_cast<RooSimultaneous&>(*mc->GetPdf()), TString(mc->GetPdf()->GetName())+"_opt");
         w->import(*optpdf);
@@ -637,7 +915,7 @@ void Combine::run(TString hlfFile, const std::string &dataset, double &limit, do
   addNuisances(nuisances);
   addPOI(POI);
 
-  w->saveSnapshot("clean", w->allVars());
+  utils::saveSnapshot(w, "clean", w->allVars());
   
   tree_ = tree;
 
@@ -659,6 +937,7 @@ void Combine::run(TString hlfFile, const std::string &dataset, double &limit, do
     const char * token = (it->first)->GetName();
     addBranch((std::string("trackedParam_")+token).c_str(), &(it->second), (std::string("trackedParam_")+token+std::string("/F")).c_str()); 
   }
+  CascadeMinimizer::addTelemetryBranches();
   // Should have the PDF at this point, if not something is really odd?
   if (!(mc->GetPdf())){
 	std::cerr << " FATAL ERROR! PDF not found in ModelConfig (this could be due to having no systematics and running -M MaxLikelihood). \n Try to build the workspace first with text2workspace.py and run with the binary output." << std::endl;
@@ -729,10 +1008,26 @@ void Combine::run(TString hlfFile, const std::string &dataset, double &limit, do
     }
   }
 
+  if (!server_.empty() && nToys > 0) throw std::invalid_argument("Option --server works only on the observed data or the asimov dataset, not with toys");
   if (nToys <= 0) { // observed or asimov
     iToy = nToys;
     if (iToy == -1) {
-     if (readToysFromHere != 0){
+     if (readColumnarToysFromHere != 0) {
+        dobs = readColumnarToysFromHere->get(-1, *observables);
+        if (dobs == 0) {
+          std::cerr << "Toy toy_asimov not found in " << readColumnarToysFromHere->fileName() << std::endl;
+          return;
+        }
+        if (toysFrequentist_ && newGen_ && mc->GetGlobalObservables()) {
+            RooArgSet gobs(*mc->GetGlobalObservables());
+            if (!readColumnarToysFromHere->getGlobalObservables(-1, gobs)) {
+                std::cerr << "Global observables of toy_asimov not found in " << readColumnarToysFromHere->fileName() << std::endl;
+                return;
+            }
+            utils::saveSnapshot(w, "clean", w->allVars());
+        }
+     }
+     else if (readToysFromHere != 0){
 	dobs = dynamic_cast<RooAbsData *>(readToysFromHere->Get("toys/toy_asimov"));
 	if (dobs == 0) {
 	  std::cerr << "Toy toy_asimov not found in " << readToysFromHere->GetName() << ". List follows:\n";
@@ -748,7 +1043,7 @@ void Combine::run(TString hlfFile, const std::string &dataset, double &limit, do
             }
             RooArgSet gobs(*mc->GetGlobalObservables());
             gobs.assignValueOnly(*snap);
-            w->saveSnapshot("clean", w->allVars());
+            utils::saveSnapshot(w, "clean", w->allVars());
         }
       }
       else{
@@ -769,7 +1064,7 @@ void Combine::run(TString hlfFile, const std::string &dataset, double &limit, do
                     gobs = gobsAsimov;
                 }
                 utils::setAllConstant(*mc->GetParametersOfInterest(), false);
-                w->saveSnapshot("clean", w->allVars());
+                utils::saveSnapshot(w, "clean", w->allVars());
             } else {
                 toymcoptutils::SimPdfGenInfo newToyMC(*genPdf, *observables, !unbinned_); 
                 dobs = newToyMC.generateAsimov(weightVar_); // as simple as that
@@ -788,7 +1083,9 @@ void Combine::run(TString hlfFile, const std::string &dataset, double &limit, do
       std::cerr << "No observed data '" << dataset << "' in the workspace. Cannot compute limit.\n" << std::endl;
       return;
     }
-    if (saveToys_) {
+    if (saveToys_ && writeColumnarToysHere) {
+        writeColumnarToysHere->write(-1, *dobs, toysFrequentist_ && newGen_ ? mc->GetGlobalObservables() : 0);
+    } else if (saveToys_) {
 	writeToysHere->WriteTObject(dobs, "toy_asimov");
         if (toysFrequentist_ && newGen_ && mc->GetGlobalObservables()) { 
             RooAbsCollection *snap = mc->GetGlobalObservables()->snapshot();
@@ -799,7 +1096,13 @@ void Combine::run(TString hlfFile, const std::string &dataset, double &limit, do
     std::cout << "Computing limit starting from " << (iToy == 0 ? "observation" : "expected outcome") << std::endl;
     if (MH) MH->setVal(mass_);    
     if (verbose > (isExtended ? 3 : 2)) utils::printRAD(dobs);
-    if (mklimit(w,mc,mc_bonly,*dobs,limit,limitErr)) commitPoint(0,g_quantileExpected_); //tree->Fill();
+    if (!massList_.empty()) {
+      if (MH == 0) throw std::invalid_argument("Option --massList needs the variable MH in the workspace");
+      if (iToy == -1 && expectSignal_ != 0) std::cerr << "WARNING: with --massList the asimov dataset is generated only once, at MH = " << mass_ << std::endl;
+      runMassList_(w, mc, mc_bonly, *dobs, limit, limitErr);
+    } else if (!server_.empty()) {
+      serve_(w, mc, mc_bonly, *dobs, limit, limitErr);
+    } else if (mklimit(w,mc,mc_bonly,*dobs,limit,limitErr)) commitPoint(0,g_quantileExpected_); //tree->Fill();
   }
   
   std::vector<double> limitHistory;
@@ -809,12 +1112,17 @@ void Combine::run(TString hlfFile, const std::string &dataset, double &limit, do
     toymcoptutils::SimPdfGenInfo newToyMC(*genPdf, *observables, !unbinned_); 
     double expLimit = 0;
     unsigned int nLimits = 0;
-    w->loadSnapshot("clean");
+    utils::loadSnapshot(w, "clean");
     RooDataSet *systDs = 0;
+    // or, with TMCSO_FastGlobalObs and constraint terms that factorize, from systSampler
+    std::auto_ptr<toymcoptutils::ConstraintSampler> systSampler;
+    // with a counter-based generator each toy draws its own values of the nuisances or global observables, instead of taking them from systDs
+    bool counterRNG = CounterRandom::active();
+    const RooArgSet *systVars = 0;
     RooArgSet allFloatingParameters = w->allVars(); 
     allFloatingParameters.remove(*mc->GetParametersOfInterest());
     int nFloatingNonPoiParameters = utils::countFloating(allFloatingParameters); 
-    if (nFloatingNonPoiParameters && !toysNoSystematics_ && (readToysFromHere == 0)) {
+    if (nFloatingNonPoiParameters && !toysNoSystematics_ && (readToysFromHere == 0) && (readColumnarToysFromHere == 0)) {
       if (nuisances == 0) throw std::logic_error("Running with systematics enabled, but nuisances not defined.");
       nuisancePdf.reset(utils::makeNuisancePdf(expectSignal_ ||  setPhysicsModelParameterExpression_ != "" || noMCbonly_ ? *mc : *mc_bonly));
       if (toysFrequentist_) {
@@ -832,25 +1140,98 @@ void Combine::run(TString hlfFile, const std::string &dataset, double &limit, do
                 utils::setAllConstant(*mc->GetParametersOfInterest(), false); 
                 w->saveSnapshot("frequentistPreFit", w->allVars());
           }
-          if (nuisancePdf.get()) systDs = nuisancePdf->generate(*mc->GetGlobalObservables(), nToys);
+          systVars = mc->GetGlobalObservables();
       } else {
-          if (nuisancePdf.get()) systDs = nuisancePdf->generate(*nuisances, nToys);
+          systVars = nuisances;
       } 
+      if (nuisancePdf.get() && !counterRNG) {
+          if (runtimedef::get("TMCSO_FastGlobalObs")) {
+              systSampler.reset(new toymcoptutils::ConstraintSampler(*nuisancePdf, *systVars));
+              if (systSampler->ok()) systSampler->generate(nToys); else systSampler.reset();
+          }
+          if (systSampler.get() == 0) systDs = nuisancePdf->generate(*systVars, nToys);
+      }
     }
     std::auto_ptr<RooArgSet> vars(genPdf->getVariables());
     algo->setNToys(nToys);
+    std::auto_ptr<AsyncWriter> asyncWriter(saveToys_ && asyncOutput_ && writeColumnarToysHere == 0 ? new AsyncWriter(asyncOutput_, outputMutex()) : 0);
 
-    for (iToy = 1; iToy <= nToys; ++iToy) {
+    unsigned int toyForks = std::min<unsigned int>(toyForks_, std::max(nToys - 1, 0));
+    if (toyForks > 1 && (readToysFromHere != 0 || readColumnarToysFromHere != 0)) {
+      std::cerr << "WARNING: --toyForks can't be used when reading the toys from a file, the toys will be run in this process." << std::endl;
+      toyForks = 0;
+    } else if (toyForks > 1 && !algo->forkableToys()) {
+      std::cerr << "WARNING: " << algo->name() << " writes its own output for each toy, so --toyForks can't be used. The toys will be run in this process." << std::endl;
+      toyForks = 0;
+    }
+    std::auto_ptr<AsyncReader> toyReader;
+    if (readToysFromHere != 0 && prefetchToys_ > 0 && readToysFromHere->GetDirectory("toys")) {
+      bool withSnapshots = toysFrequentist_ && newGen_ && mc->GetGlobalObservables();
+      std::vector<std::string> toyNames;
+      for (int i = 1; i <= nToys; ++i) {
+        toyNames.push_back(TString::Format("toy_%d", i).Data());
+        if (withSnapshots) toyNames.push_back(TString::Format("toy_%d_snapshot", i).Data());
+      }
+      toyReader.reset(new AsyncReader(readToysFromHere->GetDirectory("toys"), toyNames, prefetchToys_ * (withSnapshots ? 2 : 1)));
+    }
+    UInt_t toySeedBase = toyForks_ && !counterRNG ? RooRandom::integer(std::numeric_limits<UInt_t>::max()) : 0;
+    int lastToy = nToys, toyChild = -1;
+    char toyTmpFile[999];
+    std::vector<char> toyRecord;
+    FILE *toyRecordFile = 0;
+    TFile *toyChildFile = 0;
+    ForkedToyGuard toyGuard;
+    for (iToy = 1; iToy <= lastToy; ++iToy) {
+      if (iToy == 2 && toyForks > 1) {
+        // the first toy is run in the parent, so that the algorithm is initialized and all the branches are booked before forking
+        if (asyncWriter.get()) asyncWriter->flush();
+        snprintf(toyTmpFile, 998, "%s/rcombtoys-XXXXXX", P_tmpdir);
+        int fd = mkstemp(toyTmpFile); close(fd);
+        std::vector<int> toyPids(toyForks, 0);
+        for (toyChild = 0; toyChild < int(toyForks); ++toyChild) {
+          toyPids[toyChild] = utils::forkWithLogs(toyTmpFile, toyChild);
+          if (toyPids[toyChild] == 0) break;
+        }
+        if (toyChild == int(toyForks)) {
+          collectForkedToys_(toyTmpFile, toyPids, nToys, nLimits, expLimit, limitHistory);
+          toyChild = -1;
+          break;
+        }
+        // child: do a contiguous block of toys 2 ... nToys, and write everything in private files
+        toyGuard.active = true;
+        iToy    = 2 + (toyChild * (nToys - 1)) / toyForks;
+        lastToy = 1 + ((toyChild + 1) * (nToys - 1)) / toyForks;
+        asyncWriter.release(); // its thread is not running in this process
+        toyChildFile = TFile::Open(TString::Format("%s.%d.root", toyTmpFile, toyChild), "RECREATE");
+        toyRecordFile = fopen(TString::Format("%s.%d.dat", toyTmpFile, toyChild).Data(), "wb");
+        if (toyChildFile == 0 || toyRecordFile == 0) { std::cerr << "Can't open the output files of the forked process" << std::endl; _exit(1); }
+        outputFile = toyChildFile;
+        writeToysHere = toyChildFile->mkdir("toys","toys");
+        if (writeColumnarToysHere) {
+          // the parent's writer is left alone, its buffers are not flushed by _exit
+          writeColumnarToysHere = new ColumnarToyWriter(TString::Format("%s.%d.toys", toyTmpFile, toyChild).Data());
+        }
+        toyRecord_ = &toyRecord;
+      }
+      if (toySeedBase) RooRandom::randomGenerator()->SetSeed(toySeed(toySeedBase, iToy));
+      CounterRandom::select(iToy, CounterRandom::ToyStream);
       algo->setToyNumber(iToy-1);
       RooAbsData *absdata_toy = 0;
-      if (readToysFromHere == 0) {
-	w->loadSnapshot("clean");
+      if (readToysFromHere == 0 && readColumnarToysFromHere == 0) {
+	utils::loadSnapshot(w, "clean");
 	if (verbose > 3) utils::printPdf(genPdf);
 	if (withSystematics && !toysNoSystematics_) {
 	  if (systDs) {
 	  	if (systDs->numEntries()>=iToy) *vars = *systDs->get(iToy-1);
+	  } else if (systSampler.get()) {
+	  	if (int(systSampler->ntoys())>=iToy) { systSampler->set(iToy-1); *vars = systSampler->vars(); }
+	  } else if (counterRNG && nuisancePdf.get()) {
+	  	CounterRandom::select(iToy, CounterRandom::GlobalObservablesStream);
+	  	std::auto_ptr<RooDataSet> toySyst(nuisancePdf->generate(*systVars, 1));
+	  	*vars = *toySyst->get(0);
+	  	CounterRandom::select(iToy, CounterRandom::ToyStream);
 	  }
-          if (toysFrequentist_) w->saveSnapshot("clean", w->allVars());
+          if (toysFrequentist_) utils::saveSnapshot(w, "clean", w->allVars());
 	  if (verbose > 3) utils::printPdf(genPdf);
 	}
         if (POI->find("r")) {
@@ -872,34 +1253,70 @@ void Combine::run(TString hlfFile, const std::string &dataset, double &limit, do
 	  RooDataSet *data_toy = genPdf->generate(*observables,1);
 	  absdata_toy = data_toy;
 	}
+      } else if (readColumnarToysFromHere != 0) {
+        absdata_toy = readColumnarToysFromHere->get(iToy, *observables);
+        if (absdata_toy == 0) {
+          std::cerr << "Toy toy_"<<iToy<<" not found in " << readColumnarToysFromHere->fileName() << std::endl;
+          return;
+        }
+        if (toysFrequentist_ && newGen_ && mc->GetGlobalObservables()) {
+            RooArgSet gobs(*mc->GetGlobalObservables());
+            if (!readColumnarToysFromHere->getGlobalObservables(iToy, gobs)) {
+                std::cerr << "Global observables of toy_"<<iToy<<" not found in " << readColumnarToysFromHere->fileName() << std::endl;
+                return;
+            }
+            utils::saveSnapshot(w, "clean", w->allVars());
+        }
       } else {
-	absdata_toy = dynamic_cast<RooAbsData *>(readToysFromHere->Get(TString::Format("toys/toy_%d",iToy)));
+	if (toyReader.get()) absdata_toy = dynamic_cast<RooAbsData *>(toyReader->get(TString::Format("toy_%d",iToy).Data()));
+	else absdata_toy = dynamic_cast<RooAbsData *>(readToysFromHere->Get(TString::Format("toys/toy_%d",iToy)));
 	if (absdata_toy == 0) {
 	  std::cerr << "Toy toy_"<<iToy<<" not found in " << readToysFromHere->GetName() << ". List follows:\n";
 	  readToysFromHere->ls();
 	  return;
 	}
         if (toysFrequentist_ && newGen_ && mc->GetGlobalObservables()) {
-            RooAbsCollection *snap = dynamic_cast<RooAbsCollection *>(readToysFromHere->Get(TString::Format("toys/toy_%d_snapshot",iToy)));
+            RooAbsCollection *snap = dynamic_cast<RooAbsCollection *>(toyReader.get() ? toyReader->get(TString::Format("toy_%d_snapshot",iToy).Data())
+                                                                                      : readToysFromHere->Get(TString::Format("toys/toy_%d_snapshot",iToy)));
             if (!snap) {
                 std::cerr << "Snapshot of global observables toy_"<<iToy<<"_snapshot not found in " << readToysFromHere->GetName() << ". List follows:\n";
                 readToysFromHere->ls();
                 return;
             }
             vars->assignValueOnly(*snap);
-            w->saveSnapshot("clean", w->allVars());
+            utils::saveSnapshot(w, "clean", w->allVars());
         }
       }
       if (verbose > (isExtended ? 3 : 2)) utils::printRAD(absdata_toy);
-      w->loadSnapshot("clean");
+      utils::loadSnapshot(w, "clean");
       //if (verbose > 1) utils::printPdf(w, "model_b");
-      if (mklimit(w,mc,mc_bonly,*absdata_toy,limit,limitErr)) {
+      bool toyOk = mklimit(w,mc,mc_bonly,*absdata_toy,limit,limitErr);
+      if (toyOk) {
 	commitPoint(0,g_quantileExpected_);//tree->Fill();
 	++nLimits;
 	expLimit += limit; 
         limitHistory.push_back(limit);
       }
-      if (saveToys_) {
+      if (toyRecordFile) {
+        ForkedToyHeader header = { iToy, toyOk, int(toyRecord.size()), limit };
+        fwrite(&header, sizeof(header), 1, toyRecordFile);
+        if (!toyRecord.empty()) fwrite(&toyRecord[0], 1, toyRecord.size(), toyRecordFile);
+        fflush(toyRecordFile);
+        toyRecord.clear();
+      }
+      if (saveToys_ && writeColumnarToysHere) {
+        writeColumnarToysHere->write(iToy, *absdata_toy, toysFrequentist_ && newGen_ ? mc->GetGlobalObservables() : 0);
+      } else if (saveToys_ && asyncWriter.get()) {
+        // the writer takes ownership of the toy, which has its own copies of the observables; the snapshot of the
+        // global observables is written here instead, as it is streamed from the variables of the workspace
+        asyncWriter->write(writeToysHere, absdata_toy, TString::Format("toy_%d", iToy).Data());
+        absdata_toy = 0;
+        if (toysFrequentist_ && newGen_ && mc->GetGlobalObservables()) { 
+            std::auto_ptr<RooAbsCollection> snap(mc->GetGlobalObservables()->snapshot());
+            std::unique_lock<std::mutex> lock(lockOutput());
+            writeToysHere->WriteTObject(snap.get(), TString::Format("toy_%d_snapshot", iToy));
+        }
+      } else if (saveToys_) {
 	writeToysHere->WriteTObject(absdata_toy, TString::Format("toy_%d", iToy));
         if (toysFrequentist_ && newGen_ && mc->GetGlobalObservables()) { 
             RooAbsCollection *snap = mc->GetGlobalObservables()->snapshot();
@@ -909,6 +1326,17 @@ void Combine::run(TString hlfFile, const std::string &dataset, double &limit, do
       }
       delete absdata_toy;
     }
+    if (toyChild >= 0) {
+      int status = ferror(toyRecordFile) ? 2 : 0;
+      if (writeColumnarToysHere) {
+        try { writeColumnarToysHere->close(); } catch (std::exception &ex) { std::cerr << ex.what() << std::endl; status = 2; }
+      }
+      fclose(toyRecordFile);
+      toyChildFile->Close();
+      fflush(stdout); fflush(stderr);
+      _exit(status); // don't unwind: the output file and the other objects belong to the parent
+    }
+    if (asyncWriter.get()) asyncWriter->flush();
     if (weightVar_) delete weightVar_;
     expLimit /= nLimits;
     double rms = 0;
@@ -936,7 +1364,8 @@ void Combine::run(TString hlfFile, const std::string &dataset, double &limit, do
   
   if (saveWorkspace_) {
     w->SetName(workspaceName_.c_str());
-    w->loadSnapshot("clean");
+    utils::loadSnapshot(w, "clean");
+    FastVerticalInterpHistPdf2Base::restoreDoubleMorphs(w->components());
     outputFile->WriteTObject(w,workspaceName_.c_str());
   }  
 
@@ -946,6 +1375,109 @@ void Combine::toggleGlobalFillTree(bool flag){
    g_fillTree_ = flag;
 }
 
+void Combine::runMassList_(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, double &limit, double &limitErr) {
+  RooRealVar *MH = w->var("MH");
+  // the mh branch points to the mass in the main program
+  double *mh = (double *) tree_->GetBranch("mh")->GetAddress();
+  for (unsigned int im = 0, nm = massList_.size(); im < nm; ++im) {
+    // the algorithms start from the "clean" snapshot, so it has to have the new mass
+    utils::loadSnapshot(w, "clean");
+    mass_ = massList_[im];
+    MH->setVal(mass_);
+    utils::saveSnapshot(w, "clean", w->allVars());
+    if (mh) *mh = mass_;
+    std::cout << "Computing the result for MH = " << mass_ << " (" << (im+1) << "/" << nm << ")" << std::endl;
+    algo->beginMassPoint(im);
+    if (mklimit(w,mc_s,mc_b,data,limit,limitErr)) commitPoint(0,g_quantileExpected_);
+  }
+}
+
+void Combine::serve_(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, double &limit, double &limitErr) {
+  if (!serverParser_) throw std::logic_error("Option --server needs a parser for the requests");
+  RooRealVar *MH = w->var("MH");
+  double *mh = (double *) tree_->GetBranch("mh")->GetAddress();
+  // the state to which the model goes back after each request: values, ranges and constant flags of the parameters, and nuisances
+  RooArgSet state(w->allVars()); state.add(w->allCats());
+  w->saveSnapshot("serverClean", state);
+  std::vector<RooRealVar *> vars; std::vector<std::pair<double,double> > ranges; std::vector<bool> constant;
+  RooLinkedListIter iter = w->allVars().iterator();
+  for (RooAbsArg *a = (RooAbsArg *) iter.Next(); a != 0; a = (RooAbsArg *) iter.Next()) {
+    RooRealVar *rrv = dynamic_cast<RooRealVar *>(a);
+    if (rrv == 0) continue;
+    vars.push_back(rrv); ranges.push_back(std::make_pair(rrv->getMin(), rrv->getMax())); constant.push_back(rrv->isConstant());
+  }
+  RooArgSet nuisances_s, nuisances_b;
+  if (mc_s->GetNuisanceParameters()) nuisances_s.add(*mc_s->GetNuisanceParameters());
+  if (mc_b && mc_b->GetNuisanceParameters()) nuisances_b.add(*mc_b->GetNuisanceParameters());
+  LimitAlgo *algo0 = algo;
+  double mass0 = mass_;
+  bool significance0 = doSignificance_;
+  std::string setParameters0 = setPhysicsModelParameterExpression_;
+
+  ServerChannel channel(server_);
+  std::cout << ">>> server: ready for requests on " << (server_ == "-" ? std::string("stdin") : server_) << std::endl;
+  std::string line;
+  unsigned int nRequests = 0;
+  while (channel.next(line)) {
+    std::vector<std::string> args = boost::program_options::split_unix(line);
+    if (args.empty()) continue;
+    if (args[0] == "quit" || args[0] == "exit") { channel.reply("BYE"); break; }
+    ServerRequest request; request.algo = 0; request.mass = std::numeric_limits<float>::quiet_NaN();
+    bool ok = false;
+    try {
+      serverParser_(args, request);
+      ++nRequests;
+      std::cout << ">>> server: request " << nRequests << ": " << line << std::endl;
+      if (!isnan(request.mass)) {
+        if (MH == 0) throw std::invalid_argument("Option -m of a request needs the variable MH in the workspace");
+        MH->setVal(request.mass);
+        mass_ = request.mass;
+        if (mh) *mh = mass_;
+      }
+      if (!request.setParameterRanges.empty()) utils::setModelParameterRanges(request.setParameterRanges, w->allVars());
+      if (!request.setParameters.empty()) {
+        RooArgSet allParams(w->allVars());
+        allParams.add(w->allCats());
+        utils::setModelParameters(request.setParameters, allParams);
+        setPhysicsModelParameterExpression_ = request.setParameters;
+        if (MH) mass_ = MH->getVal();
+      }
+      if (!request.freezeNuisances.empty()) {
+        RooArgSet toFreeze(w->argSet(request.freezeNuisances.c_str()));
+        utils::setAllConstant(toFreeze, true);
+        RooArgSet newnuis(nuisances_s);
+        newnuis.remove(toFreeze, /*silent=*/true, /*byname=*/true);
+        mc_s->SetNuisanceParameters(newnuis);
+        if (mc_b) mc_b->SetNuisanceParameters(newnuis);
+      }
+      // the algorithms start from the "clean" snapshot
+      utils::saveSnapshot(w, "clean", w->allVars());
+      algo = request.algo;
+      ok = mklimit(w, mc_s, mc_b, data, limit, limitErr);
+      if (ok) commitPoint(0, g_quantileExpected_);
+      channel.reply(TString::Format("DONE %d %.9g %.9g %.2f", int(ok), limit, limitErr, t_real_*60.).Data());
+    } catch (std::exception &ex) {
+      channel.reply(std::string("ERROR ") + ex.what());
+    }
+    // back to the initial state, for the next request
+    for (unsigned int i = 0, n = vars.size(); i < n; ++i) {
+      vars[i]->setRange(ranges[i].first, ranges[i].second);
+      vars[i]->setConstant(constant[i]);
+    }
+    w->loadSnapshot("serverClean");
+    utils::saveSnapshot(w, "clean", w->allVars());
+    if (!request.freezeNuisances.empty()) {
+      mc_s->SetNuisanceParameters(nuisances_s);
+      if (mc_b) mc_b->SetNuisanceParameters(nuisances_b);
+    }
+    algo = algo0;
+    mass_ = mass0; if (mh) *mh = mass0;
+    doSignificance_ = significance0;
+    setPhysicsModelParameterExpression_ = setParameters0;
+  }
+  std::cout << ">>> server: done after " << nRequests << " requests" << std::endl;
+}
+
 void Combine::commitPoint(bool expected, float quantile) {
     Float_t saveQuantile =  g_quantileExpected_;
     g_quantileExpected_ = quantile;
@@ -954,10 +1486,106 @@ void Combine::commitPoint(bool expected, float quantile) {
 	it->second = (it->first)->getVal();
     }
 
-    if (g_fillTree_) tree_->Fill();
+    if (g_fillTree_ && toyRecord_) {
+        appendLeaves(tree_, *toyRecord_);
+    } else if (g_fillTree_) {
+        std::unique_lock<std::mutex> lock(lockOutput());
+        tree_->Fill();
+        if (writeColumnarLimitsHere) writeColumnarLimitsHere->fill(*tree_);
+    }
     g_quantileExpected_ = saveQuantile;
 }
 
+void Combine::collectForkedToys_(const char *tmpfile, const std::vector<int> &pids, int nToys, unsigned int &nLimits, double &expLimit, std::vector<double> &limitHistory) {
+    unsigned int nfork = pids.size();
+    std::vector<std::string> problems(nfork);
+    for (unsigned int ich = 0; ich < nfork; ++ich) problems[ich] = utils::waitForChild(pids[ich]);
+    // the children did contiguous blocks of toys, so going through them in order keeps the toys in order
+    unsigned int ntoys = 0, nlost = 0;
+    for (unsigned int ich = 0; ich < nfork; ++ich) {
+        int firstToy = 2 + (ich * (nToys - 1)) / nfork, lastToy = 1 + ((ich + 1) * (nToys - 1)) / nfork;
+        int expected = lastToy - firstToy + 1, done = 0;
+        std::string &problem = problems[ich];
+        FILE *f = fopen(TString::Format("%s.%d.dat", tmpfile, ich).Data(), "rb");
+        if (f == 0 && problem.empty()) problem = TString::Format("didn't leave its output file %s.%d.dat", tmpfile, ich).Data();
+        ForkedToyHeader header; std::vector<char> record;
+        while (f && fread(&header, sizeof(header), 1, f) == 1) {
+            record.resize(header.bytes);
+            if (header.bytes && fread(&record[0], 1, header.bytes, f) != unsigned(header.bytes)) {
+                if (problem.empty()) problem = TString::Format("left a truncated record for toy %d", header.iToy).Data();
+                break;
+            }
+            for (const char *in = record.empty() ? 0 : &record[0], *end = in + record.size(); in != end; ) {
+                in = restoreLeaves(tree_, in, end);
+                std::unique_lock<std::mutex> lock(lockOutput());
+                tree_->Fill();
+                if (writeColumnarLimitsHere) writeColumnarLimitsHere->fill(*tree_);
+            }
+            if (header.ok) {
+                ++nLimits;
+                expLimit += header.limit;
+                limitHistory.push_back(header.limit);
+            }
+            ++ntoys; ++done;
+        }
+        if (f) fclose(f);
+        if (done < expected && problem.empty()) problem = TString::Format("did only %d of its %d toys", done, expected).Data();
+        std::ifstream log(TString::Format("%s.%d.out.txt", tmpfile, ich).Data());
+        std::cout << log.rdbuf() << std::flush;
+        if (!problem.empty()) {
+            utils::reportFailedChild("Combine", tmpfile, ich, problem);
+            nlost += expected - done;
+        } else {
+            std::ifstream err(TString::Format("%s.%d.err.txt", tmpfile, ich).Data());
+            std::cerr << err.rdbuf() << std::flush;
+        }
+        // then whatever the algorithm or --saveToys wrote in the output file
+        TFile *in = TFile::Open(TString::Format("%s.%d.root", tmpfile, ich));
+        if (in) {
+            std::unique_lock<std::mutex> lock(lockOutput());
+            TIter nextKey(in->GetListOfKeys());
+            while (TKey *key = (TKey *) nextKey()) {
+                if (strcmp(key->GetClassName(), "TDirectoryFile") == 0) continue;
+                TObject *obj = key->ReadObj();
+                outputFile->WriteTObject(obj, key->GetName());
+                delete obj;
+            }
+            TDirectory *toys = in->GetDirectory("toys");
+            TIter nextToy(toys ? toys->GetListOfKeys() : 0);
+            while (TKey *key = (TKey *) nextToy()) {
+                TObject *obj = key->ReadObj();
+                writeToysHere->WriteTObject(obj, key->GetName());
+                delete obj;
+            }
+            in->Close(); delete in;
+        }
+        TString columnar = TString::Format("%s.%d.toys", tmpfile, ich);
+        if (writeColumnarToysHere && ColumnarToyReader::isColumnar(columnar.Data())) {
+            ColumnarToyReader toys(columnar.Data());
+            writeColumnarToysHere->append(toys);
+        } else if (writeColumnarToysHere && done > 0) {
+            std::cerr << "WARNING: process " << ich << " didn't leave its toys in " << columnar << ", " << done << " toys are missing from the columnar toy file." << std::endl;
+        }
+        unlink(columnar.Data());
+        unlink(TString::Format("%s.%d.dat",     tmpfile, ich).Data());
+        unlink(TString::Format("%s.%d.root",    tmpfile, ich).Data());
+        unlink(TString::Format("%s.%d.out.txt", tmpfile, ich).Data());
+        unlink(TString::Format("%s.%d.err.txt", tmpfile, ich).Data());
+    }
+    unlink(tmpfile);
+    if (nlost) std::cerr << "WARNING: " << nlost << " of the " << (nToys - 1) << " toys given to the forked processes were lost." << std::endl;
+    if (verbose > 1) std::cout << "Collected " << ntoys << " toys from " << nfork << " processes." << std::endl;
+}
+
+std::mutex & Combine::outputMutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+std::unique_lock<std::mutex> Combine::lockOutput() {
+    return std::unique_lock<std::mutex>(outputMutex());
+}
+
 void Combine::addBranch(const char *name, void *address, const char *leaflist) {
     tree_->Branch(name,address,leaflist);
 }
@@ -0,0 +1,84 @@
+#include "HiggsAnalysis/CombinedLimit/interface/CounterRandom.h"
+#include <RooRandom.h>
+
+namespace {
+    const UInt_t PhiloxM0 = 0xD2511F53, PhiloxM1 = 0xCD9E8D57;
+    const UInt_t PhiloxW0 = 0x9E3779B9, PhiloxW1 = 0xBB67AE85;
+    inline void mulhilo(UInt_t a, UInt_t b, UInt_t &hi, UInt_t &lo) {
+        ULong64_t product = ULong64_t(a) * ULong64_t(b);
+        hi = UInt_t(product >> 32); lo = UInt_t(product);
+    }
+}
+
+CounterRandom::CounterRandom(ULong64_t seed) :
+    TRandom()
+{
+    SetName("CounterRandom");
+    SetTitle("Philox4x32-10 counter-based generator");
+    SetSeed(seed);
+}
+
+void CounterRandom::SetSeed(ULong_t seed) 
+{
+    fSeed = seed;
+    key_[0] = UInt_t(seed); 
+    key_[1] = UInt_t(ULong64_t(seed) >> 32);
+    setStream(0, 0);
+}
+
+void CounterRandom::setStream(ULong64_t index, UInt_t stream) 
+{
+    counter_[0] = 0; // position in the stream
+    counter_[1] = stream;
+    counter_[2] = UInt_t(index); 
+    counter_[3] = UInt_t(index >> 32);
+    used_ = 4;
+}
+
+void CounterRandom::nextBlock_() 
+{
+    UInt_t c0 = counter_[0], c1 = counter_[1], c2 = counter_[2], c3 = counter_[3];
+    UInt_t k0 = key_[0], k1 = key_[1];
+    for (int round = 0; round < 10; ++round) {
+        if (round) { k0 += PhiloxW0; k1 += PhiloxW1; }
+        UInt_t hi0, lo0, hi1, lo1;
+        mulhilo(PhiloxM0, c0, hi0, lo0);
+        mulhilo(PhiloxM1, c2, hi1, lo1);
+        c0 = hi1 ^ c1 ^ k0; c1 = lo1;
+        c2 = hi0 ^ c3 ^ k1; c3 = lo0;
+    }
+    block_[0] = c0; block_[1] = c1; block_[2] = c2; block_[3] = c3;
+    used_ = 0;
+    counter_[0]++; // 2^32 blocks per stream are more than any toy will ever need
+}
+
+#if ROOT_VERSION_CODE < ROOT_VERSION(6,4,0)
+Double_t CounterRandom::Rndm(Int_t) 
+#else
+Double_t CounterRandom::Rndm() 
+#endif
+{
+    return next_();
+}
+
+void CounterRandom::RndmArray(Int_t n, Float_t *array) 
+{
+    for (Int_t i = 0; i < n; ++i) array[i] = next_();
+}
+
+void CounterRandom::RndmArray(Int_t n, Double_t *array) 
+{
+    for (Int_t i = 0; i < n; ++i) array[i] = next_();
+}
+
+bool CounterRandom::select(ULong64_t index, UInt_t stream) 
+{
+    CounterRandom *rnd = dynamic_cast<CounterRandom *>(RooRandom::randomGenerator());
+    if (rnd) rnd->setStream(index, stream);
+    return rnd != 0;
+}
+
+bool CounterRandom::active() 
+{
+    return dynamic_cast<CounterRandom *>(RooRandom::randomGenerator()) != 0;
+}
@@ -0,0 +1,105 @@
+#include "HiggsAnalysis/CombinedLimit/interface/DataColumns.h"
+#include <cstdlib>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <RooAbsData.h>
+#include <RooArgSet.h>
+#include <RooRealVar.h>
+
+namespace {
+    /// the columns that exist, by dataset (the pdfs of a channel may be set up in several threads)
+    std::mutex registryLock;
+    std::multimap<const RooAbsData *, const cacheutils::DataColumns *> & registry() {
+        static std::multimap<const RooAbsData *, const cacheutils::DataColumns *> reg;
+        return reg;
+    }
+}
+
+cacheutils::DataColumns::DataColumns(const RooAbsData &data, bool includeZeroWeights) :
+    data_(&data), includeZeroWeights_(includeZeroWeights), withinRanges_(true), stride_(0), block_(0)
+{
+    const RooArgSet *obs = data.get();
+    std::vector<const RooRealVar *> vars;
+    RooLinkedListIter iter = obs->iterator();
+    for (RooAbsArg *a = (RooAbsArg *) iter.Next(); a != 0; a = (RooAbsArg *) iter.Next()) {
+        const RooRealVar *rrv = dynamic_cast<const RooRealVar *>(a);
+        if (rrv == 0) continue;
+        vars.push_back(rrv);
+        names_.push_back(rrv->GetName());
+    }
+    std::vector<Double_t> weights;
+    for (int i = 0, n = data.numEntries(); i < n; ++i) {
+        data.get(i);
+        double w = data.weight();
+        if (w || includeZeroWeights) { entries_.push_back(i); weights.push_back(w); }
+    }
+    // each array starts on a new 64-byte boundary
+    const unsigned int perLine = Alignment / sizeof(Double_t);
+    stride_ = ((entries_.size() + perLine - 1) / perLine) * perLine;
+    std::size_t needed = std::max<std::size_t>(std::size_t(stride_) * (vars.size() + 1), perLine);
+    void *mem = 0;
+    if (posix_memalign(&mem, Alignment, needed * sizeof(Double_t)) != 0) throw std::bad_alloc();
+    block_ = static_cast<Double_t *>(mem);
+    std::fill(block_, block_ + needed, 0.0);
+    for (unsigned int k = 0, nk = entries_.size(); k < nk; ++k) {
+        data.get(entries_[k]);
+        for (unsigned int j = 0, nj = vars.size(); j < nj; ++j) {
+            double x = vars[j]->getVal();
+            block_[j * stride_ + k] = x;
+            if (!vars[j]->inRange(x, 0)) withinRanges_ = false;
+        }
+    }
+    std::copy(weights.begin(), weights.end(), block_ + vars.size() * stride_);
+    std::lock_guard<std::mutex> guard(registryLock);
+    registry().insert(std::make_pair(data_, this));
+}
+
+cacheutils::DataColumns::~DataColumns()
+{
+    {
+        std::lock_guard<std::mutex> guard(registryLock);
+        std::multimap<const RooAbsData *, const DataColumns *> &reg = registry();
+        for (auto it = reg.lower_bound(data_), ed = reg.upper_bound(data_); it != ed; ++it) {
+            if (it->second == this) { reg.erase(it); break; }
+        }
+    }
+    free(block_);
+}
+
+const Double_t * cacheutils::DataColumns::column(const std::string &name) const
+{
+    for (unsigned int j = 0, nj = names_.size(); j < nj; ++j) {
+        if (names_[j] == name) return block_ + j * stride_;
+    }
+    return 0;
+}
+
+const cacheutils::DataColumns * cacheutils::DataColumns::find(const RooAbsData &data, bool includeZeroWeights)
+{
+    std::lock_guard<std::mutex> guard(registryLock);
+    std::multimap<const RooAbsData *, const DataColumns *> &reg = registry();
+    for (auto it = reg.lower_bound(&data), ed = reg.upper_bound(&data); it != ed; ++it) {
+        if (it->second->includeZeroWeights() == includeZeroWeights) return it->second;
+    }
+    return 0;
+}
+
+void cacheutils::DataColumns::fill(const RooAbsData &data, const std::string &name, bool includeZeroWeights, std::vector<Double_t> &out)
+{
+    const DataColumns *columns = find(data, includeZeroWeights);
+    const Double_t *column = columns ? columns->column(name) : 0;
+    if (column) {
+        out.assign(column, column + columns->size());
+        return;
+    }
+    const RooRealVar *x = dynamic_cast<const RooRealVar *>(data.get()->find(name.c_str()));
+    if (x == 0) throw std::invalid_argument("DataColumns: the dataset has no observable "+name);
+    out.clear(); out.reserve(data.numEntries());
+    for (int i = 0, n = data.numEntries(); i < n; ++i) {
+        data.get(i);
+        if (data.weight() || includeZeroWeights) out.push_back(x->getVal());
+    }
+}
@@ -1,15 +1,21 @@
 #include "HiggsAnalysis/CombinedLimit/interface/FastTemplate.h"
-#include "HiggsAnalysis/CombinedLimit/interface/Accumulators.h"
+#include "vectorized.h"
 
 #include <cmath>
 #include <cstdlib>
 #include <cstdio>
+#include <cstring>
 #include <algorithm>
+#include <mutex>
+#include <string>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <boost/functional/hash.hpp>
 
 FastTemplate::T FastTemplate::Integral() const {
-    DefaultAccumulator total = 0;
-    for (unsigned int i = 0; i < size_; ++i) total += values_[i];
-    return total.sum();
+    return size_ ? vectorized::sum(size_, &values_[0]) : T(0.0);
 }
 
 void FastTemplate::Scale(T factor) {
@@ -53,6 +59,18 @@ void FastTemplate::Dump() const {
     printf("\n"); 
 }
 
+FastTemplate::T FastTemplate::uniformInvWidth(const AT &edges) {
+    if (edges.size() < 2) return 0;
+    unsigned int n = edges.size() - 1;
+    T width = (edges[n] - edges[0]) / n;
+    if (!(width > 0)) return 0;
+    // a small tolerance is fine, since findBin corrects the guess against the actual edges
+    for (unsigned int i = 1; i < n; ++i) {
+        if (std::abs(edges[i] - (edges[0] + i * width)) > 1e-6 * width) return 0;
+    }
+    return T(1.0)/width;
+}
+
 FastHisto::FastHisto(const TH1 &hist) :
     FastTemplate(hist),
     binEdges_(size()+1),
@@ -63,33 +81,31 @@ FastHisto::FastHisto(const TH1 &hist) :
         binWidths_[i] = hist.GetBinWidth(i+1);
     }
     binEdges_.back() = hist.GetBinLowEdge(size()+1);
+    invWidth_ = uniformInvWidth(binEdges_);
 }
 
 FastHisto::FastHisto(const FastHisto &other) :
     FastTemplate(other),
     binEdges_(other.binEdges_),
-    binWidths_(other.binWidths_)
+    binWidths_(other.binWidths_),
+    invWidth_(other.invWidth_)
 {
 }
 
 int FastHisto::FindBin(const T &x) const {
-    auto match = std::lower_bound(binEdges_.begin(), binEdges_.end(), x);
-    if (match == binEdges_.begin()) return -1;
-    if (match == binEdges_.end()) return values_.size();
-    return match - binEdges_.begin() - 1;
+    int bin = findBin(binEdges_, invWidth_, x);
+    return (bin == int(binEdges_.size()) - 1 ? int(values_.size()) : bin);
 }
 
 
 FastHisto::T FastHisto::GetAt(const T &x) const {
-    auto match = std::lower_bound(binEdges_.begin(), binEdges_.end(), x);
-    if (match == binEdges_.begin() || match == binEdges_.end()) return T(0.0);
-    return values_[match - binEdges_.begin() - 1];
+    int bin = findBin(binEdges_, invWidth_, x);
+    if (bin < 0 || bin == int(binEdges_.size()) - 1) return T(0.0);
+    return values_[bin];
 }
 
 FastHisto::T FastHisto::IntegralWidth() const {
-    DefaultAccumulator total = 0;
-    for (unsigned int i = 0; i < size_; ++i) total += values_[i] * binWidths_[i];
-    return total.sum();
+    return size_ ? vectorized::dot_product(size_, &values_[0], &binWidths_[0]) : T(0.0);
 }
 
 void FastHisto::Dump() const {
@@ -102,7 +118,7 @@ void FastHisto::Dump() const {
 }
 
 FastHisto::T FastHisto::GetMax() const {
-    return * std::max(values_.begin(), values_.end());
+    return * std::max_element(values_.begin(), values_.end());
 }
 
 FastHisto2D::FastHisto2D(const TH2 &hist, bool normXonly) :
@@ -122,6 +138,8 @@ FastHisto2D::FastHisto2D(const TH2 &hist, bool normXonly) :
         binEdgesY_[iy] = ay->GetBinLowEdge(iy+1);
     }
     binEdgesY_.back() = ay->GetBinLowEdge(binY_+1);
+    invWidthX_ = uniformInvWidth(binEdgesX_);
+    invWidthY_ = uniformInvWidth(binEdgesY_);
     for (unsigned int ix = 1, i = 0; ix <= binX_; ++ix) {
         for (unsigned int iy = 1; iy <= binY_; ++iy, ++i) {
             binWidths_[i] = (normXonly ? 1 : ax->GetBinWidth(ix))*ay->GetBinWidth(iy);
@@ -135,39 +153,65 @@ FastHisto2D::FastHisto2D(const FastHisto2D &other) :
     binY_(other.binY_),
     binEdgesX_(other.binEdgesX_),
     binEdgesY_(other.binEdgesY_),
-    binWidths_(other.binWidths_)
+    binWidths_(other.binWidths_),
+    invWidthX_(other.invWidthX_),
+    invWidthY_(other.invWidthY_)
 {
 }
 
 FastHisto2D::T FastHisto2D::GetAt(const T &x, const T &y) const {
-    auto matchx = std::lower_bound(binEdgesX_.begin(), binEdgesX_.end(), x);
-    if (matchx == binEdgesX_.begin() || matchx == binEdgesX_.end()) return T(0.0);
-    int ix = (matchx - binEdgesX_.begin() - 1);
-    auto matchy = std::lower_bound(binEdgesY_.begin(), binEdgesY_.end(), y);
-    if (matchy == binEdgesY_.begin() || matchy == binEdgesY_.end()) return T(0.0);
-    int iy = (matchy - binEdgesY_.begin() - 1);
+    int ix = findBin(binEdgesX_, invWidthX_, x);
+    if (ix < 0 || ix == int(binX_)) return T(0.0);
+    int iy = findBin(binEdgesY_, invWidthY_, y);
+    if (iy < 0 || iy == int(binY_)) return T(0.0);
     return values_[ix * binY_ + iy];
 }
 
 FastHisto2D::T FastHisto2D::IntegralWidth() const {
-    DefaultAccumulator total = 0;
-    for (unsigned int i = 0; i < size_; ++i) total += values_[i] * binWidths_[i];
-    return total.sum();
+    return size_ ? vectorized::dot_product(size_, &values_[0], &binWidths_[0]) : T(0.0);
+}
+
+namespace {
+    /// values *= norm, returning the maximum of the result and updating the running maximum of each column
+    FastTemplate::T scalemax(FastTemplate::T * __restrict__ values, unsigned int n, FastTemplate::T norm, FastTemplate::T * __restrict__ colmax) {
+        FastTemplate::T ret = 0.0;
+        for (unsigned int i = 0; i < n; ++i) {
+            FastTemplate::T v = values[i] * norm;
+            values[i] = v;
+            ret = v > ret ? v : ret;
+            colmax[i] = v > colmax[i] ? v : colmax[i];
+        }
+        return ret;
+    }
 }
 
-void FastHisto2D::NormalizeXSlices() {
+void FastHisto2D::NormalizeXSlices(T *maxOnY, T *maxOnX) {
+    if (maxOnY) std::fill(maxOnX, maxOnX + binY_, T(0.0));
     for (unsigned int ix = 0, offs = 0; ix < binX_; ++ix, offs += binY_) {
        T *values = & values_[offs], *widths = & binWidths_[offs];
-       DefaultAccumulator totalc = 0;
-       for (unsigned int i = 0; i < binY_; ++i) totalc += values[i] * widths[i];
-       double total = totalc.sum();
-       if (total > 0) {
+       double total = vectorized::dot_product(binY_, values, widths);
+       if (maxOnY) {
+            maxOnY[ix] = scalemax(values, binY_, total > 0 ? T(1.0)/total : T(1.0), maxOnX);
+       } else if (total > 0) {
             total = T(1.0)/total;
             for (unsigned int i = 0; i < binY_; ++i) values[i] *= total;
        } 
     }
 }
 
+void FastHisto2D::GetMaxima(T *maxOnY, T *maxOnX) const {
+    std::fill(maxOnX, maxOnX + binY_, T(0.0));
+    for (unsigned int ix = 0, offs = 0; ix < binX_; ++ix, offs += binY_) {
+        const T * __restrict__ values = & values_[offs];
+        T ret = 0.0;
+        for (unsigned int i = 0; i < binY_; ++i) {
+            ret = values[i] > ret ? values[i] : ret;
+            maxOnX[i] = values[i] > maxOnX[i] ? values[i] : maxOnX[i];
+        }
+        maxOnY[ix] = ret;
+    }
+}
+
 void FastHisto2D::Dump() const {
     printf("--- dumping histo template with %d x %d bins (@%p)---\n", binX_, binY_, (void*)(&values_[0]));
     for (unsigned int i = 0; i < size_; ++i) {
@@ -181,14 +225,13 @@ void FastHisto2D::Dump() const {
 
 
 FastHisto2D::T FastHisto2D::GetMaxOnXY() const {
-    return *std::max(values_.begin(), values_.end());
+    return *std::max_element(values_.begin(), values_.end());
 }
 
 
 FastHisto2D::T FastHisto2D::GetMaxOnX(const T &y) const {
-    auto matchy = std::lower_bound(binEdgesY_.begin(), binEdgesY_.end(), y);
-    if (matchy == binEdgesY_.begin() || matchy == binEdgesY_.end()) return T(0.0);
-    int iy = (matchy - binEdgesY_.begin() - 1);
+    int iy = findBin(binEdgesY_, invWidthY_, y);
+    if (iy < 0 || iy == int(binY_)) return T(0.0);
     T ret = 0.0;
     for (unsigned int i = iy; i < size_; i += binY_) {
         if (ret < values_[i]) ret = values_[i];
@@ -197,10 +240,9 @@ FastHisto2D::T FastHisto2D::GetMaxOnX(const T &y) const {
 }
 
 FastHisto2D::T FastHisto2D::GetMaxOnY(const T &x) const {
-    auto matchx = std::lower_bound(binEdgesX_.begin(), binEdgesX_.end(), x);
-    if (matchx == binEdgesX_.begin() || matchx == binEdgesX_.end()) return T(0.0);
-    int ix = (matchx - binEdgesX_.begin() - 1);
-    return *std::max( &values_[ix * binY_], &values_[(ix+1) * binY_] );
+    int ix = findBin(binEdgesX_, invWidthX_, x);
+    if (ix < 0 || ix == int(binX_)) return T(0.0);
+    return *std::max_element( &values_[ix * binY_], &values_[(ix+1) * binY_] );
 }
 
 FastHisto3D::FastHisto3D(const TH3 &hist, bool normXonly) :
@@ -226,6 +268,9 @@ FastHisto3D::FastHisto3D(const TH3 &hist, bool normXonly) :
         binEdgesZ_[iz] = az->GetBinLowEdge(iz+1);
     }
     binEdgesZ_.back() = az->GetBinLowEdge(binZ_+1);
+    invWidthX_ = uniformInvWidth(binEdgesX_);
+    invWidthY_ = uniformInvWidth(binEdgesY_);
+    invWidthZ_ = uniformInvWidth(binEdgesZ_);
     for (unsigned int ix = 1, i = 0; ix <= binX_; ++ix) {
         for (unsigned int iy = 1; iy <= binY_; ++iy ) {
         	for (unsigned int iz = 1; iz <= binZ_; ++iz, ++i) {
@@ -242,28 +287,26 @@ FastHisto3D::FastHisto3D(const FastHisto3D &other) :
     binEdgesX_(other.binEdgesX_),
     binEdgesY_(other.binEdgesY_),
     binEdgesZ_(other.binEdgesZ_),
-    binWidths_(other.binWidths_)
+    binWidths_(other.binWidths_),
+    invWidthX_(other.invWidthX_),
+    invWidthY_(other.invWidthY_),
+    invWidthZ_(other.invWidthZ_)
 {
 }
 
 FastHisto3D::T FastHisto3D::GetAt(const T &x, const T &y, const T &z) const {
-    auto matchx = std::lower_bound(binEdgesX_.begin(), binEdgesX_.end(), x);
-    if (matchx == binEdgesX_.begin() || matchx == binEdgesX_.end()) return T(0.0);
-    int ix = (matchx - binEdgesX_.begin() - 1);
-    auto matchy = std::lower_bound(binEdgesY_.begin(), binEdgesY_.end(), y);
-    if (matchy == binEdgesY_.begin() || matchy == binEdgesY_.end()) return T(0.0);
-    int iy = (matchy - binEdgesY_.begin() - 1);
-    auto matchz = std::lower_bound(binEdgesZ_.begin(), binEdgesZ_.end(), z);
-    if (matchz == binEdgesZ_.begin() || matchz == binEdgesZ_.end()) return T(0.0);
-    int iz = (matchz - binEdgesZ_.begin() - 1);
+    int ix = findBin(binEdgesX_, invWidthX_, x);
+    if (ix < 0 || ix == int(binX_)) return T(0.0);
+    int iy = findBin(binEdgesY_, invWidthY_, y);
+    if (iy < 0 || iy == int(binY_)) return T(0.0);
+    int iz = findBin(binEdgesZ_, invWidthZ_, z);
+    if (iz < 0 || iz == int(binZ_)) return T(0.0);
     return values_[ix * binY_ *binZ_ +binZ_*iy + iz];
 }
 
 
 FastHisto3D::T FastHisto3D::IntegralWidth() const {
-    DefaultAccumulator total = 0;
-    for (unsigned int i = 0; i < size_; ++i) total += values_[i] * binWidths_[i];
-    return total.sum();
+    return size_ ? vectorized::dot_product(size_, &values_[0], &binWidths_[0]) : T(0.0);
 }
 
 void FastHisto3D::NormalizeXSlices() {
@@ -303,9 +346,37 @@ namespace {
     void subtract(FastTemplate::T * __restrict__ out, unsigned int n, FastTemplate::T  const * __restrict__ ref) {
         for (unsigned int i = 0; i < n; ++i) out[i] -= ref[i];
     }
+    /// the vdt functions work out of place, so the in-place operations go through a small buffer, a chunk at a time
+    const unsigned int vdtChunk = 256;
     void logratio(FastTemplate::T * __restrict__ out, unsigned int n, FastTemplate::T  const * __restrict__ ref) {
-        for (unsigned int i = 0; i < n; ++i) {
-            out[i] = (out[i] > 0 && ref[i] > 0) ? std::log(out[i]/ref[i]) : 0;
+        FastTemplate::T buff[vdtChunk];
+        for (unsigned int i0 = 0; i0 < n; i0 += vdtChunk) {
+            unsigned int m = std::min(vdtChunk, n - i0);
+            FastTemplate::T * __restrict__ o = out + i0;
+            FastTemplate::T const * __restrict__ r = ref + i0;
+            // log(1) = 0 for the bins where either template is empty
+            for (unsigned int i = 0; i < m; ++i) buff[i] = (o[i] > 0 && r[i] > 0) ? o[i]/r[i] : 1;
+            vectorized::logv(m, buff, o);
+        }
+    }
+    void logmin(FastTemplate::T * __restrict__ out, unsigned int n, FastTemplate::T floor) {
+        FastTemplate::T buff[vdtChunk], logs[vdtChunk];
+        for (unsigned int i0 = 0; i0 < n; i0 += vdtChunk) {
+            unsigned int m = std::min(vdtChunk, n - i0);
+            FastTemplate::T * __restrict__ o = out + i0;
+            for (unsigned int i = 0; i < m; ++i) buff[i] = o[i] > 0 ? o[i] : 1;
+            vectorized::logv(m, buff, logs);
+            for (unsigned int i = 0; i < m; ++i) o[i] = o[i] > 0 ? logs[i] : floor;
+        }
+    }
+    void expmax(FastTemplate::T * __restrict__ out, unsigned int n, FastTemplate::T minimum) {
+        FastTemplate::T buff[vdtChunk];
+        for (unsigned int i0 = 0; i0 < n; i0 += vdtChunk) {
+            unsigned int m = std::min(vdtChunk, n - i0);
+            FastTemplate::T * __restrict__ o = out + i0;
+            std::copy(o, o + m, buff);
+            vectorized::expv(m, buff, o);
+            for (unsigned int i = 0; i < m; ++i) o[i] = o[i] < minimum ? minimum : o[i];
         }
     }
     void sumdiff(FastTemplate::T * __restrict__ sum, FastTemplate::T * __restrict__ diff, 
@@ -323,13 +394,18 @@ namespace {
             out[i] += x*(diff[i] + y*sum[i]);
         }
     }
+    void meld(FastTemplate::T * __restrict__ out, unsigned int n, FastTemplateFloat::T  const * __restrict__ diff, FastTemplateFloat::T  const * __restrict__ sum, FastTemplate::T x, FastTemplate::T y) {
+        for (unsigned int i = 0; i < n; ++i) {
+            out[i] += x*(FastTemplate::T(diff[i]) + y*FastTemplate::T(sum[i]));
+        }
+    }
 }
 
 void FastTemplate::Subtract(const FastTemplate & ref) {
     subtract(&values_[0], size_, &ref[0]);
 }
 void FastTemplate::LogRatio(const FastTemplate & ref) {
-    logratio(&values_[0], size_, &ref[0]);
+    if (size_) logratio(&values_[0], size_, &ref[0]);
 }
 void FastTemplate::SumDiff(const FastTemplate & h1, const FastTemplate & h2, 
                            FastTemplate & sum, FastTemplate & diff) {
@@ -340,21 +416,135 @@ void FastTemplate::Meld(const FastTemplate & diff, const FastTemplate & sum, T x
     meld(&values_[0], size_, &diff[0], &sum[0], x, y);
 }
 
-void FastTemplate::Log() {
-    for (unsigned int i = 0; i < size_; ++i) {
-        //if (values_[i] <= 0) printf("WARNING: log(%g) at bin %d of %d bins (%d active bins)\n", values_[i], i, int(values_.size()), size_);
-        values_[i] = values_[i] > 0 ? std::log(values_[i]) : T(-999);
+void FastTemplate::Meld(const FastTemplateFloat & diff, const FastTemplateFloat & sum, T x, T y) {
+    meld(&values_[0], size_, &diff[0], &sum[0], x, y);
+}
+
+void FastTemplate::Meld(const FastTemplateShared & diff, const FastTemplateShared & sum, T x, T y) {
+    meld(&values_[0], size_, &diff[0], &sum[0], x, y);
+}
+
+void FastTemplate::Meld(const FastTemplateSparsePair & diffsum, T x, T y) {
+    const unsigned int *bins = diffsum.bins_.empty() ? 0 : &diffsum.bins_[0];
+    const T *diff = diffsum.diff_.empty() ? 0 : &diffsum.diff_[0], *sum = diffsum.sum_.empty() ? 0 : &diffsum.sum_[0];
+    for (unsigned int i = 0, n = diffsum.bins_.size(); i < n && bins[i] < size_; ++i) {
+        values_[bins[i]] += x*(diff[i] + y*sum[i]);
     }
 }
 
-void FastTemplate::Exp() {
+FastTemplateSparsePair::FastTemplateSparsePair(const FastTemplate &diff, const FastTemplate &sum) :
+    size_(std::min(diff.size(), sum.size()))
+{
     for (unsigned int i = 0; i < size_; ++i) {
-        values_[i] = std::exp(values_[i]);
+        if (diff[i] == 0 && sum[i] == 0) continue;
+        bins_.push_back(i);
+        diff_.push_back(diff[i]);
+        sum_.push_back(sum[i]);
     }
 }
 
+double FastTemplateSparsePair::Density(const FastTemplate &diff, const FastTemplate &sum) {
+    unsigned int n = std::min(diff.size(), sum.size()), nonzero = 0;
+    for (unsigned int i = 0; i < n; ++i) {
+        if (diff[i] != 0 || sum[i] != 0) ++nonzero;
+    }
+    return n ? nonzero/double(n) : 1.0;
+}
+
+void FastTemplate::Log() {
+    // empty bins go to -999
+    if (size_) logmin(&values_[0], size_, T(-999));
+}
+
+void FastTemplate::Exp(T minimum) {
+    if (size_) expmax(&values_[0], size_, minimum);
+}
+
 void FastTemplate::CropUnderflows(T minimum, bool activebinsonly) {
     for (unsigned int i = 0, n = activebinsonly ? size_ : values_.size(); i < n; ++i) {
         if (values_[i] < minimum) values_[i] = minimum;
     }
 }   
+
+FastTemplate FastTemplateFloat::ToDouble() const {
+    FastTemplate ret(fullsize_);
+    for (unsigned int i = 0; i < fullsize_; ++i) ret[i] = data_[i];
+    ret.SetActiveSize(size_);
+    return ret;
+}
+
+namespace {
+    /// the files created by this process in the directories of the shared templates, removed when it exits
+    /// (not by the processes forked from it, which exit before it does)
+    std::mutex sharedFilesLock;
+    std::vector<std::string> sharedFiles;
+    pid_t sharedFilesOwner = 0;
+    void removeSharedFiles() {
+        std::lock_guard<std::mutex> guard(sharedFilesLock);
+        if (getpid() != sharedFilesOwner) return;
+        for (const std::string &name : sharedFiles) unlink(name.c_str());
+        sharedFiles.clear();
+    }
+    void addSharedFile(const char *name) {
+        std::lock_guard<std::mutex> guard(sharedFilesLock);
+        if (sharedFilesOwner == 0) atexit(removeSharedFiles);
+        if (sharedFilesOwner != getpid()) { sharedFiles.clear(); sharedFilesOwner = getpid(); }
+        sharedFiles.push_back(name);
+    }
+
+    /// read-only mapping of a file in dir with a copy of the nbytes at values, named after their content
+    /// (created if not there yet); null if that is not possible
+    std::shared_ptr<const void> shareBytes(const char *dir, const void *values, std::size_t nbytes) {
+        std::shared_ptr<const void> ret;
+        const char *bytes = static_cast<const char *>(values);
+        std::size_t key = boost::hash_range(bytes, bytes + nbytes);
+        char name[1024]; snprintf(name, 1023, "%s/tmpl-%016llx-%lu", dir, (unsigned long long) key, (unsigned long) nbytes);
+        int fd = open(name, O_RDONLY);
+        if (fd == -1) {
+            // not there yet: write it under a temporary name and rename, so that the others never map a partial file
+            char tmp[1100]; snprintf(tmp, 1099, "%s.%d", name, int(getpid()));
+            int wfd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+            if (wfd == -1) return ret;
+            bool ok = (write(wfd, values, nbytes) == ssize_t(nbytes));
+            ok = (close(wfd) == 0) && ok;
+            if (!ok || rename(tmp, name) != 0) { unlink(tmp); return ret; }
+            addSharedFile(name);
+            fd = open(name, O_RDONLY);
+            if (fd == -1) return ret;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || std::size_t(info.st_size) != nbytes) { close(fd); return ret; }
+        void *addr = mmap(0, nbytes, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED) return ret;
+        // protect against hash collisions
+        if (memcmp(addr, values, nbytes) != 0) { munmap(addr, nbytes); return ret; }
+        ret.reset(addr, [nbytes](const void *ptr) { munmap(const_cast<void *>(ptr), nbytes); });
+        return ret;
+    }
+}
+
+bool FastTemplateFloat::Share(const char *dir) {
+    if (shared_ || values_.empty()) return shared();
+    std::shared_ptr<const void> mapped = shareBytes(dir, &values_[0], values_.size()*sizeof(T));
+    if (!mapped) return false;
+    shared_ = std::static_pointer_cast<const T>(mapped);
+    data_ = shared_.get();
+    std::vector<T>().swap(values_);
+    return true;
+}
+
+FastTemplateShared::FastTemplateShared(const FastTemplate &other, const char *dir) :
+    size_(0), fullsize_(0)
+{
+    if (other.fullsize() == 0) return;
+    data_ = std::static_pointer_cast<const T>(shareBytes(dir, &other[0], other.fullsize()*sizeof(T)));
+    if (data_) { size_ = other.size(); fullsize_ = other.fullsize(); }
+}
+
+FastTemplate FastTemplateShared::ToDouble() const {
+    FastTemplate ret(fullsize_);
+    for (unsigned int i = 0; i < fullsize_; ++i) ret[i] = data_.get()[i];
+    ret.SetActiveSize(size_);
+    return ret;
+}
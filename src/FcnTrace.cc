@@ -0,0 +1,150 @@
+#include "HiggsAnalysis/CombinedLimit/interface/FcnTrace.h"
+#include <RooAbsArg.h>
+#include <RooAbsReal.h>
+#include <RooAbsCategory.h>
+#include <RooAbsCollection.h>
+#include <memory>
+#include <stdexcept>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <fcntl.h>
+
+namespace {
+    const char traceMagic[8] = { 'C', 'M', 'B', 'F', 'C', 'N', 'T', '1' };
+    // deleted at exit, which writes what's left in the buffer
+    std::unique_ptr<FcnTraceWriter> traceWriter_;
+}
+
+void FcnTraceWriter::open(const std::string &fileName)
+{
+    int fd = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) throw std::runtime_error("Can't create the trace file "+fileName+": "+strerror(errno));
+    traceWriter_.reset(new FcnTraceWriter(fd, fileName));
+}
+
+FcnTraceWriter * FcnTraceWriter::get()
+{
+    FcnTraceWriter *ret = traceWriter_.get();
+    return (ret != 0 && ret->pid_ == getpid()) ? ret : 0;
+}
+
+FcnTraceWriter::FcnTraceWriter(int fd, const std::string &fileName) :
+    fd_(fd), fileName_(fileName), pid_(getpid())
+{
+    put_(traceMagic, sizeof(traceMagic));
+}
+
+FcnTraceWriter::~FcnTraceWriter()
+{
+    // a forked process has a copy of the buffer of the parent, which is not its to write
+    if (getpid() != pid_) return;
+    try {
+        flush_();
+    } catch (const std::exception &ex) {
+        fprintf(stderr, "%s\n", ex.what());
+    }
+    close(fd_);
+}
+
+void FcnTraceWriter::put_(const void *data, std::size_t size)
+{
+    const char *p = static_cast<const char *>(data);
+    buffer_.insert(buffer_.end(), p, p + size);
+    if (buffer_.size() > (1u << 20)) flush_();
+}
+
+void FcnTraceWriter::flush_()
+{
+    const char *p = buffer_.empty() ? 0 : &buffer_[0];
+    std::size_t size = buffer_.size();
+    while (size > 0) {
+        ssize_t written = write(fd_, p, size);
+        if (written == -1 && errno == EINTR) continue;
+        if (written <= 0) throw std::runtime_error("Error writing the trace file "+fileName_+": "+strerror(errno));
+        p += written; size -= written;
+    }
+    buffer_.clear();
+}
+
+unsigned int FcnTraceWriter::index_(const RooAbsArg *arg)
+{
+    std::unordered_map<const RooAbsArg *, unsigned int>::const_iterator match = byArg_.find(arg);
+    if (match != byArg_.end() && names_[match->second] == arg->GetName()) return match->second;
+    std::pair<std::unordered_map<std::string, unsigned int>::iterator, bool> ins = byName_.insert(std::make_pair(std::string(arg->GetName()), names_.size()));
+    if (ins.second) {
+        uint32_t index = names_.size(), length = strlen(arg->GetName());
+        names_.push_back(arg->GetName());
+        last_.push_back(0); written_.push_back(0);
+        put_("P", 1); put_(&index, sizeof(index)); put_(&length, sizeof(length)); put_(arg->GetName(), length);
+    }
+    byArg_[arg] = ins.first->second;
+    return ins.first->second;
+}
+
+void FcnTraceWriter::add_(const RooAbsCollection &params)
+{
+    RooFIter iter = params.fwdIterator();
+    for (RooAbsArg *a = iter.next(); a != 0; a = iter.next()) {
+        double val;
+        if (const RooAbsReal *rar = dynamic_cast<const RooAbsReal *>(a)) val = rar->getVal();
+        else if (const RooAbsCategory *cat = dynamic_cast<const RooAbsCategory *>(a)) val = cat->getIndex();
+        else continue;
+        unsigned int i = index_(a);
+        if (written_[i] && last_[i] == val) continue;
+        written_[i] = 1; last_[i] = val;
+        changed_.push_back(std::make_pair(uint32_t(i), val));
+    }
+}
+
+void FcnTraceWriter::record(const RooAbsCollection &floating, const RooAbsCollection &constant, unsigned long state, double nll, double seconds)
+{
+    changed_.clear();
+    add_(floating);
+    add_(constant);
+    uint64_t state64 = state;
+    uint32_t n = changed_.size();
+    put_("E", 1); put_(&state64, sizeof(state64)); put_(&n, sizeof(n));
+    for (const std::pair<uint32_t, double> &c : changed_) { put_(&c.first, sizeof(c.first)); put_(&c.second, sizeof(c.second)); }
+    put_(&nll, sizeof(nll)); put_(&seconds, sizeof(seconds));
+}
+
+FcnTraceReader::FcnTraceReader(const std::string &fileName)
+{
+    FILE *f = fopen(fileName.c_str(), "rb");
+    if (f == 0) throw std::runtime_error("Can't open the trace file "+fileName+": "+strerror(errno));
+    std::vector<char> data;
+    char buff[65536];
+    for (std::size_t got; (got = fread(buff, 1, sizeof(buff), f)) > 0; ) data.insert(data.end(), buff, buff + got);
+    fclose(f);
+    if (data.size() < sizeof(traceMagic) || memcmp(&data[0], traceMagic, sizeof(traceMagic)) != 0) throw std::runtime_error(fileName+" is not a trace file");
+    std::size_t pos = sizeof(traceMagic), size = data.size();
+    auto get = [&](void *out, std::size_t n) {
+        if (pos + n > size) throw std::runtime_error("Truncated trace file "+fileName);
+        memcpy(out, &data[pos], n); pos += n;
+    };
+    while (pos < size) {
+        char type = data[pos++];
+        if (type == 'P') {
+            uint32_t index, length;
+            get(&index, sizeof(index)); get(&length, sizeof(length));
+            if (index != names_.size()) throw std::runtime_error("Bad parameter index in the trace file "+fileName);
+            std::string name(length, ' ');
+            if (length) get(&name[0], length);
+            names_.push_back(name);
+        } else if (type == 'E') {
+            evals_.push_back(Eval());
+            Eval &e = evals_.back();
+            uint32_t n;
+            get(&e.state, sizeof(e.state)); get(&n, sizeof(n));
+            e.changed.resize(n);
+            for (uint32_t i = 0; i < n; ++i) {
+                get(&e.changed[i].first, sizeof(e.changed[i].first)); get(&e.changed[i].second, sizeof(e.changed[i].second));
+                if (e.changed[i].first >= names_.size()) throw std::runtime_error("Bad parameter index in the trace file "+fileName);
+            }
+            get(&e.nll, sizeof(e.nll)); get(&e.seconds, sizeof(e.seconds));
+        } else {
+            throw std::runtime_error("Bad record in the trace file "+fileName);
+        }
+    }
+}
@@ -1,11 +1,21 @@
 #include <stdexcept>
+#include <cmath>
+#include <cstdio>
+#include <limits>
 #include "HiggsAnalysis/CombinedLimit/interface/FeldmanCousins.h"
 #include "HiggsAnalysis/CombinedLimit/interface/Combine.h"
+#include "HiggsAnalysis/CombinedLimit/interface/CascadeMinimizer.h"
+#include "HiggsAnalysis/CombinedLimit/interface/CachingNLL.h"
+#include "HiggsAnalysis/CombinedLimit/interface/CloseCoutSentry.h"
+#include "HiggsAnalysis/CombinedLimit/interface/ToyMCSamplerOpt.h"
+#include "HiggsAnalysis/CombinedLimit/interface/utils.h"
 #include <RooRealVar.h>
 #include <RooArgSet.h>
 #include <RooArgSet.h>
 #include <RooWorkspace.h>
 #include <RooDataHist.h>
+#include <RooRandom.h>
+#include <TString.h>
 #include <RooStats/ModelConfig.h>
 #include <RooStats/FeldmanCousins.h>
 #include <RooStats/PointSetInterval.h>
@@ -13,6 +23,8 @@
 float FeldmanCousins::toysFactor_ = 1;
 float FeldmanCousins::rAbsAccuracy_ = 0.1;
 float FeldmanCousins::rRelAccuracy_ = 0.02;
+bool  FeldmanCousins::native_ = false;
+unsigned int FeldmanCousins::forks_ = 0;
 
 FeldmanCousins::FeldmanCousins() :
     LimitAlgo("FeldmanCousins specific options") {
@@ -20,11 +32,14 @@ FeldmanCousins::FeldmanCousins() :
         ("rAbsAcc", boost::program_options::value<float>(&rAbsAccuracy_)->default_value(rAbsAccuracy_), "Absolute accuracy on r to reach to terminate the scan")
         ("rRelAcc", boost::program_options::value<float>(&rRelAccuracy_)->default_value(rRelAccuracy_), "Relative accuracy on r to reach to terminate the scan")
         ("toysFactor", boost::program_options::value<float>(&toysFactor_)->default_value(toysFactor_),   "Increase the toys per point by this factor w.r.t. the minimum from adaptive sampling")
+        ("fcNative", "Run the Neyman construction natively on the combine NLL, stopping the toys at each point as soon as it's clear whether the point is in the interval")
+        ("fcForks", boost::program_options::value<unsigned int>(&forks_)->default_value(forks_), "With --fcNative, spread the points of each scan among up to N forked processes")
     ;
 }
 
 void FeldmanCousins::applyOptions(const boost::program_options::variables_map &vm) 
 {
+    native_ = vm.count("fcNative");
 }
 
 bool FeldmanCousins::run(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, double &limit, double &limitErr, const double *hint) {
@@ -45,23 +60,35 @@ bool FeldmanCousins::run(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats:
   fc.AdditionalNToysFactor(toysFactor_);
 
   fc.SetNBins(10);
+  float nativeToysFactor = toysFactor_;
   do { 
       if (verbose > 1) std::cout << "scan in range [" << r->getMin() << ", " << r->getMax() << "]" << std::endl;
-      std::auto_ptr<RooStats::PointSetInterval> fcInterval((RooStats::PointSetInterval *)fc.GetInterval());
-      if (fcInterval.get() == 0) return false;
-      if (verbose > 1) fcInterval->GetParameterPoints()->Print("V"); 
-      RooDataHist* parameterScan = (RooDataHist*) fc.GetPointsToScan();
-      int found = -1; 
-      if (lowerLimit_) {
+      // values of r of the scan, and whether they're in the interval
+      std::vector<double> points; std::vector<bool> insides;
+      if (native_) {
+          // same points as RooStats::FeldmanCousins: the centers of 10 bins in the range
+          for (int i = 0; i < 10; ++i) points.push_back(r->getMin() + (i + 0.5) * (r->getMax() - r->getMin()) / 10);
+          nativeConstruction(mc_s, data, r, points, nativeToysFactor, insides);
+      } else {
+          std::auto_ptr<RooStats::PointSetInterval> fcInterval((RooStats::PointSetInterval *)fc.GetInterval());
+          if (fcInterval.get() == 0) return false;
+          if (verbose > 1) fcInterval->GetParameterPoints()->Print("V"); 
+          RooDataHist* parameterScan = (RooDataHist*) fc.GetPointsToScan();
           for(int i=0; i<parameterScan->numEntries(); ++i){
               const RooArgSet * tmpPoint = parameterScan->get(i);
-              if (!fcInterval->IsInInterval(*tmpPoint)) found = i;
+              points.push_back(tmpPoint->getRealValue(r->GetName()));
+              insides.push_back(fcInterval->IsInInterval(*tmpPoint));
+          }
+      }
+      int found = -1, npoints = points.size(); 
+      if (lowerLimit_) {
+          for(int i=0; i<npoints; ++i){
+              if (!insides[i]) found = i;
               else break;
           }
       } else {
-          for(int i=0; i<parameterScan->numEntries(); ++i){
-              const RooArgSet * tmpPoint = parameterScan->get(i);
-              bool inside = fcInterval->IsInInterval(*tmpPoint);
+          for(int i=0; i<npoints; ++i){
+              bool inside = insides[i];
               if (inside) found = i;
               else if (found != -1) break;
           }
@@ -70,9 +97,8 @@ bool FeldmanCousins::run(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats:
             return false;
           }
       }
-      double fcBefore = (found > -1 ? parameterScan->get(found)->getRealValue(r->GetName()) : r->getMin());
-      double fcAfter  = (found < parameterScan->numEntries()-1 ? 
-              parameterScan->get(found+1)->getRealValue(r->GetName()) : r->getMax());
+      double fcBefore = (found > -1 ? points[found] : r->getMin());
+      double fcAfter  = (found < npoints-1 ? points[found+1] : r->getMax());
       limit = 0.5*(fcAfter+fcBefore);
       limitErr = 0.5*(fcAfter-fcBefore);
       if (verbose > 0) std::cout << "  would be " << r->GetName() << " < " << limit << " +/- "<<limitErr << std::endl;
@@ -80,6 +106,7 @@ bool FeldmanCousins::run(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats:
       r->setMax(std::min(r->getMax(), limit+3*limitErr));
       if (limitErr < 4*std::max<float>(rAbsAccuracy_, rRelAccuracy_ * limit)) { // make last scan more precise
           fc.AdditionalNToysFactor(4*toysFactor_);
+          nativeToysFactor = 4*toysFactor_;
       }
   } while (limitErr > std::max<float>(rAbsAccuracy_, rRelAccuracy_ * limit));
 
@@ -89,3 +116,84 @@ bool FeldmanCousins::run(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats:
   }
   return true;
 }
+
+double FeldmanCousins::testStatistic(RooAbsReal &nll, RooRealVar *r, RooArgSet &params, const RooArgSet &start, RooArgSet *nuisSnapshot) const {
+  // global fit with r within its range (the physical boundary of Feldman-Cousins), then conditional fit at r
+  double rVal = r->getVal();
+  params.assignValueOnly(start);
+  r->setConstant(false);
+  CascadeMinimizer minimG(nll, CascadeMinimizer::Unconstrained, r);
+  minimG.minimize(verbose-2);
+  double nllGlobal = nll.getVal();
+  params.assignValueOnly(start);
+  r->setVal(rVal); r->setConstant(true);
+  CascadeMinimizer minimC(nll, CascadeMinimizer::Constrained, r);
+  minimC.minimize(verbose-2);
+  double nllCond = nll.getVal();
+  r->setConstant(false);
+  if (nuisSnapshot) { nuisSnapshot->removeAll(); params.snapshot(*nuisSnapshot); }
+  return 2*std::max(0., nllCond - nllGlobal);
+}
+
+void FeldmanCousins::nativeConstruction(RooStats::ModelConfig *mc_s, RooAbsData &data, RooRealVar *r, const std::vector<double> &points, float toysFactor, std::vector<bool> &inside) const {
+  unsigned int npoints = points.size();
+  // toys are thrown in batches until the p-value is 3 sigma away from the size of the test, or up to the maximum
+  double alpha = 1 - cl;
+  int batch = std::max(10, int(std::ceil(5/alpha))), maxToys = std::max(batch, int(toysFactor * 100/alpha));
+  // the seeds are drawn here, so that the toys of each point don't depend on the number of processes
+  std::vector<UInt_t> seeds(npoints);
+  for (unsigned int i = 0; i < npoints; ++i) seeds[i] = RooRandom::integer(std::numeric_limits<UInt_t>::max() - 1);
+  unsigned int nforks = std::max(1u, std::min(forks_, npoints));
+  // process iproc does the points iproc, iproc + nforks, ...; each record is: in the interval, p-value, number of toys
+  auto runPoints = [&](unsigned int iproc) -> std::vector<double> {
+      std::vector<double> results(3*npoints, 0.);
+      // one NLL per process, that is attached to each toy in turn
+      RooAbsPdf *pdf = mc_s->GetPdf();
+      const RooCmdArg &constrain = (withSystematics && mc_s->GetNuisanceParameters()) ? RooFit::Constrain(*mc_s->GetNuisanceParameters()) : RooCmdArg::none();
+      std::auto_ptr<RooAbsReal> nll(pdf->createNLL(data, constrain, RooFit::Extended(pdf->canBeExtended())));
+      cacheutils::CachingSimNLL *simnll = dynamic_cast<cacheutils::CachingSimNLL *>(nll.get());
+      std::auto_ptr<RooArgSet> params(pdf->getParameters(data));
+      RooArgSet start; params->snapshot(start);
+      toymcoptutils::SimPdfGenInfo generator(*pdf, *mc_s->GetObservables(), true);
+      RooRealVar *weightVar = 0;
+      for (unsigned int ip = iproc; ip < npoints; ip += nforks) {
+          CloseCoutSentry sentry(verbose < 3);
+          r->setVal(points[ip]);
+          if (simnll) simnll->setData(data);
+          else nll.reset(pdf->createNLL(data, constrain, RooFit::Extended(pdf->canBeExtended())));
+          RooArgSet genPoint;
+          double qObs = testStatistic(*nll, r, *params, start, &genPoint);
+          RooRandom::randomGenerator()->SetSeed(seeds[ip]);
+          int ntoys = 0, nabove = 0;
+          double p = 1;
+          while (ntoys < maxToys) {
+              for (int itoy = 0; itoy < batch && ntoys < maxToys; ++itoy, ++ntoys) {
+                  // toys from the conditional best fit on the data at this point (profile construction)
+                  params->assignValueOnly(genPoint);
+                  std::auto_ptr<RooAbsData> toy(generator.generate(weightVar));
+                  if (simnll) simnll->setData(*toy);
+                  else nll.reset(pdf->createNLL(*toy, constrain, RooFit::Extended(pdf->canBeExtended())));
+                  r->setVal(points[ip]);
+                  if (testStatistic(*nll, r, *params, start, 0) >= qObs) nabove++;
+              }
+              p = nabove / double(ntoys);
+              if (std::abs(p - alpha) > 3 * std::sqrt(alpha*(1-alpha)/ntoys)) break;
+          }
+          sentry.clear();
+          results[3*ip+0] = (p > alpha);
+          results[3*ip+1] = p;
+          results[3*ip+2] = ntoys;
+          if (verbose > 1) printf("  %s = %g: test statistic %.4f, p-value %.4f from %d toys: %s\n", r->GetName(), points[ip], qObs, p, ntoys, p > alpha ? "inside" : "outside");
+          params->assignValueOnly(start);
+      }
+      return results;
+  };
+  std::vector<std::vector<double> > perProcess;
+  if (nforks > 1) {
+      if (utils::runInForks(0, nforks, runPoints, perProcess, true, verbose > 1)) throw std::runtime_error("FeldmanCousins: a forked process failed");
+  } else {
+      perProcess.push_back(runPoints(0));
+  }
+  inside.resize(npoints);
+  for (unsigned int ip = 0; ip < npoints; ++ip) inside[ip] = (perProcess[ip % nforks][3*ip] != 0);
+}
@@ -0,0 +1,93 @@
+#include "HiggsAnalysis/CombinedLimit/interface/FitResultCache.h"
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <unistd.h>
+#include <boost/functional/hash.hpp>
+#include <TFile.h>
+#include <TParameter.h>
+#include <TString.h>
+#include <TSystem.h>
+#include <RooAbsPdf.h>
+#include <RooAbsData.h>
+#include <RooArgSet.h>
+#include <RooRealVar.h>
+#include <RooCategory.h>
+#include <RooFitResult.h>
+
+std::string FitResultCache::dir_ = "";
+
+void FitResultCache::setup(const std::string &dir) {
+    dir_ = dir;
+    if (!dir.empty() && gSystem->AccessPathName(dir.c_str())) gSystem->mkdir(dir.c_str(), true);
+}
+
+std::string FitResultCache::key(const RooAbsPdf &pdf, const RooAbsData &data, const std::string &settings) {
+    std::size_t seed = 0;
+    boost::hash_combine(seed, settings);
+    boost::hash_combine(seed, std::string(pdf.GetName()));
+    std::unique_ptr<RooArgSet> nodes(pdf.getComponents());
+    RooFIter iter = nodes->fwdIterator();
+    for (RooAbsArg *a = iter.next(); a != 0; a = iter.next()) {
+        boost::hash_combine(seed, std::string(a->ClassName()));
+        boost::hash_combine(seed, std::string(a->GetName()));
+    }
+    std::unique_ptr<RooArgSet> params(pdf.getParameters(data));
+    iter = params->fwdIterator();
+    for (RooAbsArg *a = iter.next(); a != 0; a = iter.next()) {
+        boost::hash_combine(seed, std::string(a->GetName()));
+        boost::hash_combine(seed, a->isConstant());
+        if (RooRealVar *rrv = dynamic_cast<RooRealVar *>(a)) {
+            boost::hash_combine(seed, rrv->getVal());
+            boost::hash_combine(seed, rrv->getError());
+            boost::hash_combine(seed, rrv->getMin());
+            boost::hash_combine(seed, rrv->getMax());
+        } else if (RooCategory *cat = dynamic_cast<RooCategory *>(a)) {
+            boost::hash_combine(seed, cat->getIndex());
+        }
+    }
+    boost::hash_combine(seed, std::string(data.GetName()));
+    boost::hash_combine(seed, data.numEntries());
+    for (int i = 0, n = data.numEntries(); i < n; ++i) {
+        const RooArgSet *entry = data.get(i);
+        RooFIter eiter = entry->fwdIterator();
+        for (RooAbsArg *a = eiter.next(); a != 0; a = eiter.next()) {
+            if (RooRealVar *rrv = dynamic_cast<RooRealVar *>(a)) boost::hash_combine(seed, rrv->getVal());
+            else if (RooCategory *cat = dynamic_cast<RooCategory *>(a)) boost::hash_combine(seed, cat->getIndex());
+        }
+        boost::hash_combine(seed, data.weight());
+    }
+    return TString::Format("fit-%016lx", (unsigned long) seed).Data();
+}
+
+RooFitResult * FitResultCache::load(const std::string &key, double &nll) {
+    if (dir_.empty()) return 0;
+    std::string path = dir_ + "/" + key + ".root";
+    if (gSystem->AccessPathName(path.c_str())) return 0;
+    std::unique_ptr<TFile> file(TFile::Open(path.c_str()));
+    if (file.get() == 0 || file->IsZombie()) return 0;
+    RooFitResult *ret = dynamic_cast<RooFitResult *>(file->Get("fit"));
+    TParameter<double> *value = dynamic_cast<TParameter<double> *>(file->Get("nll"));
+    if (ret == 0 || value == 0) { delete ret; delete value; return 0; }
+    nll = value->GetVal();
+    delete value;
+    return ret;
+}
+
+void FitResultCache::save(const std::string &key, const RooFitResult &result, double nll) {
+    if (dir_.empty()) return;
+    std::string path = dir_ + "/" + key + ".root";
+    std::string tmp  = TString::Format("%s.%d.tmp", path.c_str(), int(getpid())).Data();
+    {
+        std::unique_ptr<TFile> file(TFile::Open(tmp.c_str(), "RECREATE"));
+        if (file.get() == 0 || file->IsZombie()) { std::cerr << "FitResultCache: can't write " << tmp << std::endl; return; }
+        TParameter<double> value("nll", nll);
+        file->WriteTObject(&result, "fit");
+        file->WriteTObject(&value, "nll");
+        file->Close();
+    }
+    if (rename(tmp.c_str(), path.c_str()) != 0) {
+        std::cerr << "FitResultCache: can't rename " << tmp << " to " << path << std::endl;
+        unlink(tmp.c_str());
+    }
+}
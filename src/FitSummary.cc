@@ -0,0 +1,70 @@
+#include "HiggsAnalysis/CombinedLimit/interface/FitSummary.h"
+#include "HiggsAnalysis/CombinedLimit/interface/RooMinimizerOpt.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <RooArgList.h>
+#include <RooRealVar.h>
+
+FitSummary::FitSummary()
+{
+    clear();
+}
+
+void FitSummary::setParameters(const RooArgList &params)
+{
+    params_.clear();
+    for (int i = 0, n = params.getSize(); i < n; ++i) {
+        RooRealVar *rrv = dynamic_cast<RooRealVar *>(params.at(i));
+        if (rrv) params_.push_back(rrv);
+    }
+    unsigned int n = params_.size();
+    floating_.resize(n); values_.resize(n); errors_.resize(n);
+    lo68_.resize(n); hi68_.resize(n); lo95_.resize(n); hi95_.resize(n);
+    clear();
+}
+
+int FitSummary::index(const char *name) const
+{
+    for (unsigned int i = 0, n = params_.size(); i < n; ++i) {
+        if (std::strcmp(params_[i]->GetName(), name) == 0) return i;
+    }
+    return -1;
+}
+
+void FitSummary::clear()
+{
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    status_ = -1; covQual_ = -1; numInvalidNLL_ = 0;
+    edm_ = nan; minNll_ = nan;
+    std::fill(floating_.begin(), floating_.end(), 0);
+    std::fill(values_.begin(), values_.end(), nan);
+    std::fill(errors_.begin(), errors_.end(), nan);
+    std::fill(lo68_.begin(), lo68_.end(), nan);
+    std::fill(hi68_.begin(), hi68_.end(), nan);
+    std::fill(lo95_.begin(), lo95_.end(), nan);
+    std::fill(hi95_.begin(), hi95_.end(), nan);
+}
+
+void FitSummary::fill(const RooMinimizerOpt &minim, double nll)
+{
+    clear();
+    minim.fitStatus(status_, covQual_, edm_, numInvalidNLL_);
+    minNll_ = nll;
+    for (unsigned int i = 0, n = params_.size(); i < n; ++i) {
+        floating_[i] = !params_[i]->isConstant();
+        values_[i] = params_[i]->getVal();
+        errors_[i] = params_[i]->getError();
+    }
+}
+
+bool FitSummary::hasInterval68(unsigned int i) const
+{
+    return !std::isnan(lo68_[i]) || !std::isnan(hi68_[i]);
+}
+
+bool FitSummary::hasInterval95(unsigned int i) const
+{
+    return !std::isnan(lo95_[i]) || !std::isnan(hi95_[i]);
+}
@@ -1,9 +1,15 @@
 #include "HiggsAnalysis/CombinedLimit/interface/FitterAlgoBase.h"
 #include <limits>
+#include <algorithm>
 #include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
 
 #include "RooRealVar.h"
 #include "RooArgSet.h"
+#include "RooCategory.h"
+#include "RooFIter.h"
 #include "RooRandom.h"
 #include "RooDataSet.h"
 #include "RooFitResult.h"
@@ -18,16 +24,19 @@
 #include "TStyle.h"
 #include "TH2.h"
 #include "TFile.h"
+#include "TString.h"
 #include <RooStats/ModelConfig.h>
 #include "HiggsAnalysis/CombinedLimit/interface/Combine.h"
 #include "HiggsAnalysis/CombinedLimit/interface/ProfileLikelihood.h"
 #include "HiggsAnalysis/CombinedLimit/interface/CascadeMinimizer.h"
 #include "HiggsAnalysis/CombinedLimit/interface/CloseCoutSentry.h"
+#include "HiggsAnalysis/CombinedLimit/interface/Logging.h"
 #include "HiggsAnalysis/CombinedLimit/interface/utils.h"
 #include "HiggsAnalysis/CombinedLimit/interface/ToyMCSamplerOpt.h"
 
 #include "HiggsAnalysis/CombinedLimit/interface/ProfilingTools.h"
 #include "HiggsAnalysis/CombinedLimit/interface/CachingNLL.h"
+#include "HiggsAnalysis/CombinedLimit/interface/FitSummary.h"
 
 #include <Math/MinimizerOptions.h>
 #include <Math/QuantFuncMathCore.h>
@@ -46,6 +55,7 @@ float       FitterAlgoBase::preFitValue_ = 1.0;
 float       FitterAlgoBase::stepSize_ = 0.1;
 bool        FitterAlgoBase::robustFit_ = false;
 int         FitterAlgoBase::maxFailedSteps_ = 5;
+int         FitterAlgoBase::crossingForks_ = 0;
 bool        FitterAlgoBase::do95_ = false;
 bool        FitterAlgoBase::forceRecreateNLL_ = false;
 bool        FitterAlgoBase::saveNLL_ = false;
@@ -58,7 +68,8 @@ double       FitterAlgoBase::nll0Value_ = std::numeric_limits<double>::quiet_NaN
 FitterAlgoBase::ProfilingMode FitterAlgoBase::profileMode_ = ProfileAll;
 
 FitterAlgoBase::FitterAlgoBase(const char *title) :
-    LimitAlgo(title)
+    LimitAlgo(title),
+    fitSummary_(0)
 {
     options_.add_options()
         ("minimizerAlgo",      boost::program_options::value<std::string>(&minimizerAlgo_)->default_value(minimizerAlgo_), "Choice of minimizer (Minuit vs Minuit2)")
@@ -69,6 +80,7 @@ FitterAlgoBase::FitterAlgoBase(const char *title) :
         ("robustFit",  boost::program_options::value<bool>(&robustFit_)->default_value(robustFit_),  "Search manually for 1 and 2 sigma bands instead of using Minos")
         ("maxFailedSteps",  boost::program_options::value<int>(&maxFailedSteps_)->default_value(maxFailedSteps_),  "How many failed steps to retry before giving up")
         ("stepSize",        boost::program_options::value<float>(&stepSize_)->default_value(stepSize_),  "Step size for robust fits (multiplier of the range)")
+        ("crossingForks",   boost::program_options::value<int>(&crossingForks_)->default_value(crossingForks_),  "For robust fits, if > 1: profile this many candidate points at a time in forked processes when searching for the crossings, and search for the up and down crossings at the same time")
         ("minimizerAlgoForMinos",      boost::program_options::value<std::string>(&minimizerAlgoForMinos_)->default_value(minimizerAlgoForMinos_), "Choice of minimizer (Minuit vs Minuit2) for profiling in robust fits")
         ("minimizerStrategyForMinos",  boost::program_options::value<int>(&minimizerStrategyForMinos_)->default_value(minimizerStrategyForMinos_),      "Stragegy for minimizer for profiling in robust fits")
         ("minimizerToleranceForMinos",  boost::program_options::value<float>(&minimizerToleranceForMinos_)->default_value(minimizerToleranceForMinos_),      "Tolerance for minimizer for profiling in robust fits")
@@ -172,7 +184,8 @@ bool FitterAlgoBase::run(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats:
   bool ret = runSpecific(w, mc_s, mc_b, *theData, limit, limitErr, hint);
   if (protectUnbinnedChannels_) { 
     // destroy things in the proper order
-    nll.reset(); // can't keep this
+    nll.reset(); spareNLL_.reset(); // can't keep these
+    nllKey_ = NLLKey(); spareNLLKey_ = NLLKey();
     generatedData.reset(); 
     generator.reset(); 
   }
@@ -181,18 +194,48 @@ bool FitterAlgoBase::run(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats:
 }
 
 
+bool FitterAlgoBase::setupNLL(RooAbsPdf &pdf, RooAbsData &data, const RooCmdArg &constrain, bool reuse, bool offset) {
+    const RooArgSet *constrained = constrain.getSet(0);
+    std::string signature = std::string(constrain.GetName()) + ":" + (constrained ? constrained->contentsString() : std::string());
+    auto matches = [&](const NLLKey &key, const RooAbsReal *n) -> bool {
+        return n != 0 && key.nll == n && key.pdf == &pdf && key.offset == offset && key.constrain == signature;
+    };
+    if (reuse && !forceRecreateNLL_) {
+        if (!matches(nllKey_, nll.get()) && matches(spareNLLKey_, spareNLL_.get())) {
+            RooAbsReal *current = nll.release(); nll.reset(spareNLL_.release()); spareNLL_.reset(current);
+            std::swap(nllKey_, spareNLLKey_);
+        }
+        cacheutils::CachingSimNLL *simnll = dynamic_cast<cacheutils::CachingSimNLL *>(nll.get());
+        if (simnll != 0 && matches(nllKey_, simnll)) {
+            try {
+                simnll->setData(data); // reuse nll but swap out the data (only the weights, if the entries are the same)
+                return true;
+            } catch (const std::logic_error &ex) {
+                if (verbose) std::cout << "Can't reuse the NLL with the new data (" << ex.what() << "), making a new one" << std::endl;
+            }
+        }
+    }
+    // keep the current one aside if it can be reused for the other pdf
+    if (nll.get() != 0 && nllKey_.nll == nll.get() && nllKey_.pdf != 0 && nllKey_.pdf != &pdf) {
+        spareNLL_.reset(nll.release()); spareNLLKey_ = nllKey_;
+    }
+    nll.reset(); // first delete the old one, to avoid using more memory, even if temporarily
+    nll.reset(pdf.createNLL(data, constrain, RooFit::Extended(pdf.canBeExtended()), offset ? RooFit::Offset(true) : RooCmdArg::none())); // make a new nll
+    nllKey_ = NLLKey();
+    nllKey_.nll = nll.get(); nllKey_.pdf = (reuse ? &pdf : 0); nllKey_.constrain = signature; nllKey_.offset = offset;
+    return false;
+}
+
 RooFitResult *FitterAlgoBase::doFit(RooAbsPdf &pdf, RooAbsData &data, RooRealVar &r, const RooCmdArg &constrain, bool doHesse, int ndim, bool reuseNLL, bool saveFitResult) {
     return doFit(pdf, data, RooArgList (r), constrain, doHesse, ndim, reuseNLL, saveFitResult);
 }
 
 RooFitResult *FitterAlgoBase::doFit(RooAbsPdf &pdf, RooAbsData &data, const RooArgList &rs, const RooCmdArg &constrain, bool doHesse, int ndim, bool reuseNLL, bool saveFitResult) {
     RooFitResult *ret = 0;
-    if (reuseNLL && nll.get() != 0 && !forceRecreateNLL_) {
-        ((cacheutils::CachingSimNLL&)(*nll)).setData(data); // reuse nll but swap out the data
-    } else {
-        nll.reset(); // first delete the old one, to avoid using more memory, even if temporarily
-        nll.reset(pdf.createNLL(data, constrain, RooFit::Extended(pdf.canBeExtended()), RooFit::Offset(true))); // make a new nll
-    }
+    if (fitSummary_) fitSummary_->clear();
+    // when reusing, keep the offset of the NLL already made for this pdf (MaxLikelihoodFit makes it without)
+    bool offset = (reuseNLL && nll.get() != 0 && nllKey_.nll == nll.get() && nllKey_.pdf == &pdf) ? nllKey_.offset : true;
+    setupNLL(pdf, data, constrain, reuseNLL, offset);
 
     double nll0 = nll->getVal();
     double delta68 = 0.5*ROOT::Math::chisquared_quantile_c(1-0.68,ndim);
@@ -215,8 +258,15 @@ RooFitResult *FitterAlgoBase::doFit(RooAbsPdf &pdf, RooAbsData &data, const RooA
     if (!ok && !keepFailures_) { std::cout << "Initial minimization failed. Aborting." << std::endl; return 0; }
     if (doHesse) minim.minimizer().hesse();
     sentry.clear();
-    ret = (saveFitResult || rs.getSize() ? minim.save() : new RooFitResult("dummy","success"));
-    if (verbose > 1 && ret != 0 && (saveFitResult || rs.getSize())) { ret->Print("V");  }
+    if (cacheutils::CachingSimNLL *simnll = dynamic_cast<cacheutils::CachingSimNLL *>(nll.get())) simnll->reportFineBinning();
+    if (fitSummary_) {
+        // only the status, the NLL and the tracked parameters; the crossings below go in the summary too
+        fitSummary_->fill(minim.minimizer(), nll->getVal());
+        ret = new RooFitResult("dummy","success");
+    } else {
+        ret = (saveFitResult || rs.getSize() ? minim.save() : new RooFitResult("dummy","success"));
+        if (verbose > 1 && ret != 0 && (saveFitResult || rs.getSize())) { ret->Print("V");  }
+    }
 
     // I'm done here
     if (rs.getSize() == 0 && parametersToFreeze_.getSize() == 0) {
@@ -224,6 +274,9 @@ RooFitResult *FitterAlgoBase::doFit(RooAbsPdf &pdf, RooAbsData &data, const RooA
     }
 
     std::auto_ptr<RooArgSet> allpars(pdf.getParameters(data));
+    // with a summary there are no parameters in ret to go back to the best fit from
+    utils::FastSnapshot bestFit;
+    if (fitSummary_) bestFit.readFrom(*allpars);
 
     RooArgSet frozenParameters(parametersToFreeze_);
     RooStats::RemoveConstantParameters(&frozenParameters);
@@ -246,7 +299,9 @@ RooFitResult *FitterAlgoBase::doFit(RooAbsPdf &pdf, RooAbsData &data, const RooA
     
     for (int i = 0, n = rs.getSize(); i < n; ++i) {
         // if this is not the first fit, reset parameters  
-        if (i) {
+        if (i && fitSummary_) {
+            bestFit.writeTo();
+        } else if (i) {
             RooArgSet oldparams(ret->floatParsFinal());
 	    oldparams.add(ret->constPars());
             *allpars = oldparams;
@@ -255,7 +310,9 @@ RooFitResult *FitterAlgoBase::doFit(RooAbsPdf &pdf, RooAbsData &data, const RooA
    	//bool fitwasconst = false;
         // get the parameter to scan, amd output variable in fit result
         RooRealVar &r = dynamic_cast<RooRealVar &>(*rs.at(i));
-	RooAbsArg *rfloat = ret->floatParsFinal().find(r.GetName());
+        // the parameter in the summary, if tracked there; the intervals of the others aren't kept
+        int si = fitSummary_ ? fitSummary_->index(r.GetName()) : -1;
+	RooAbsArg *rfloat = fitSummary_ ? (r.isConstant() ? 0 : &r) : ret->floatParsFinal().find(r.GetName());
 	if (!rfloat) {
                 fprintf(sentry.trueStdOut(), "Skipping %s. Looks like the last fit did not float this parameter. You could try running --algo grid to get the errors.\n",r.GetName());
 		continue ;
@@ -276,7 +333,8 @@ RooFitResult *FitterAlgoBase::doFit(RooAbsPdf &pdf, RooAbsData &data, const RooA
                 minim.improve(verbose-1);
                 minim.setErrorLevel(delta95);
                 if (minim.minos(RooArgSet(r)) != -1) {
-                    rf.setRange("err95", r.getVal() + r.getAsymErrorLo(), r.getVal() + r.getAsymErrorHi());
+                    if (si >= 0) fitSummary_->setInterval95(si, r.getVal() + r.getAsymErrorLo(), r.getVal() + r.getAsymErrorHi());
+                    else if (!fitSummary_) rf.setRange("err95", r.getVal() + r.getAsymErrorLo(), r.getVal() + r.getAsymErrorHi());
                 }
                 minim.setErrorLevel(delta68);
                 minim.improve(verbose-1);
@@ -286,8 +344,12 @@ RooFitResult *FitterAlgoBase::doFit(RooAbsPdf &pdf, RooAbsData &data, const RooA
             if (verbose>1) {tw.Reset(); tw.Start();}
             if (minim.minos(RooArgSet(r))) {
                if (verbose>1) std::cout << "Run Minos in  "; tw.Print(); std::cout << std::endl;
-               rf.setRange("err68", r.getVal() + r.getAsymErrorLo(), r.getVal() + r.getAsymErrorHi());
-               rf.setAsymError(r.getAsymErrorLo(), r.getAsymErrorHi());
+               if (si >= 0) {
+                   fitSummary_->setInterval68(si, r.getVal() + r.getAsymErrorLo(), r.getVal() + r.getAsymErrorHi());
+               } else if (!fitSummary_) {
+                   rf.setRange("err68", r.getVal() + r.getAsymErrorLo(), r.getVal() + r.getAsymErrorHi());
+                   rf.setAsymError(r.getAsymErrorLo(), r.getAsymErrorHi());
+               }
             }
        } else {
             r.setVal(r0); r.setConstant(true);
@@ -305,19 +367,46 @@ RooFitResult *FitterAlgoBase::doFit(RooAbsPdf &pdf, RooAbsData &data, const RooA
             // search for crossings
 
             assert(!std::isnan(r0));
+            double hi68, hi95, lo68, lo95;
+            if (crossingForks_ > 1) {
+                // high error in this process, low error in a forked one, both starting from the best fit
+                std::vector<std::vector<double> > both;
+                runInForks(2, [&](unsigned int i) -> std::vector<double> {
+                    std::vector<double> crossings(2);
+                    if (i == 0) {
+                        crossings[0] = findCrossing(minim2, *nll, r, threshold68, r0,   rMax);
+                        crossings[1] = do95_ ? findCrossing(minim2, *nll, r, threshold95, std::isnan(crossings[0]) ? r0 : crossings[0], std::max(rMax, std::isnan(crossings[0]*2-r0) ? r0 : crossings[0]*2-r0)) : r0;
+                    } else {
+                        crossings[0] = findCrossing(minim2, *nll, r, threshold68, r0,   rMin); 
+                        crossings[1] = do95_ ? findCrossing(minim2, *nll, r, threshold95, std::isnan(crossings[0]) ? r0 : crossings[0], rMin) : r0;
+                    }
+                    return crossings;
+                }, both, true);
+                hi68 = both[0][0]; hi95 = both[0][1];
+                lo68 = both[1].empty() ? NAN : both[1][0]; lo95 = both[1].empty() ? NAN : both[1][1];
+            } else {
             // high error
-            double hi68 = findCrossing(minim2, *nll, r, threshold68, r0,   rMax);
-            double hi95 = do95_ ? findCrossing(minim2, *nll, r, threshold95, std::isnan(hi68) ? r0 : hi68, std::max(rMax, std::isnan(hi68*2-r0) ? r0 : hi68*2-r0)) : r0;
+            hi68 = findCrossing(minim2, *nll, r, threshold68, r0,   rMax);
+            hi95 = do95_ ? findCrossing(minim2, *nll, r, threshold95, std::isnan(hi68) ? r0 : hi68, std::max(rMax, std::isnan(hi68*2-r0) ? r0 : hi68*2-r0)) : r0;
             // low error 
-            *allpars = RooArgSet(ret->floatParsFinal()); r.setVal(r0); r.setConstant(true);
-            double lo68 = findCrossing(minim2, *nll, r, threshold68, r0,   rMin); 
-            double lo95 = do95_ ? findCrossing(minim2, *nll, r, threshold95, std::isnan(lo68) ? r0 : lo68, rMin) : r0;
+            if (fitSummary_) bestFit.writeTo(); else *allpars = RooArgSet(ret->floatParsFinal());
+            r.setVal(r0); r.setConstant(true);
+            lo68 = findCrossing(minim2, *nll, r, threshold68, r0,   rMin); 
+            lo95 = do95_ ? findCrossing(minim2, *nll, r, threshold95, std::isnan(lo68) ? r0 : lo68, rMin) : r0;
+            }
 
+            if (si >= 0) {
+                fitSummary_->setInterval68(si, !std::isnan(lo68) ? lo68 : r0, !std::isnan(hi68) ? hi68 : r0);
+                if (do95_ && (!std::isnan(lo95) || !std::isnan(hi95))) {
+                    fitSummary_->setInterval95(si, !std::isnan(lo95) ? lo95 : r0, !std::isnan(hi95) ? hi95 : r0);
+                }
+            } else if (!fitSummary_) {
             rf.setAsymError(!std::isnan(lo68) ? lo68 - r0 : 0, !std::isnan(hi68) ? hi68 - r0 : 0);
             rf.setRange("err68", !std::isnan(lo68) ? lo68 : r0, !std::isnan(hi68) ? hi68 : r0);
             if (do95_ && (!std::isnan(lo95) || !std::isnan(hi95))) {
                 rf.setRange("err95", !std::isnan(lo95) ? lo95 : r0, !std::isnan(hi95) ? hi95 : r0);
             }
+            }
 
             r.setVal(r0); r.setConstant(false);
         }
@@ -327,6 +416,9 @@ RooFitResult *FitterAlgoBase::doFit(RooAbsPdf &pdf, RooAbsData &data, const RooA
 }
 
 double FitterAlgoBase::findCrossing(CascadeMinimizer &minim, RooAbsReal &nll, RooRealVar &r, double level, double rStart, double rBound) {
+    if (crossingForks_ > 1) {
+        return findCrossingParallel(minim, nll, r, level, rStart, rBound);
+    }
     if (runtimedef::get("FITTER_NEW_CROSSING_ALGO")) {
         return findCrossingNew(minim, nll, r, level, rStart, rBound);
     }
@@ -345,7 +437,7 @@ double FitterAlgoBase::findCrossing(CascadeMinimizer &minim, RooAbsReal &nll, Ro
     if (!ok) { std::cout << "Error: minimization failed at " << r.GetName() << " = " << rStart << std::endl; return NAN; }
     double here = nll.getVal();
     int nfail = 0;
-    if (verbose > 0) { printf("      %s      lvl-here  lvl-there   stepping\n", r.GetName()); fflush(stdout); }
+    CMB_LOGF(logging::Info, "      %s      lvl-here  lvl-there   stepping\n", r.GetName());
     do {
         rStart += rInc;
         if (rInc*(rStart - rBound) > 0) { // went beyond bounds
@@ -371,7 +463,7 @@ double FitterAlgoBase::findCrossing(CascadeMinimizer &minim, RooAbsReal &nll, Ro
         } else nfail = 0;
         double there = here;
         here = nll.getVal();
-        if (verbose > 0) { printf("%f    %+.5f  %+.5f    %f\n", rStart, level-here, level-there, rInc); fflush(stdout); }
+        CMB_LOGF(logging::Info, "%f    %+.5f  %+.5f    %f\n", rStart, level-here, level-there, rInc);
         if ( fabs(here - level) < 4*minimizerToleranceForMinos_ ) {
             // set to the right point with interpolation
             r.setVal(rStart + (level-here)*(level-there)/(here-there));
@@ -543,6 +635,101 @@ double FitterAlgoBase::findCrossingNew(CascadeMinimizer &minim, RooAbsReal &nll,
     return rVal;
 }
 
+double FitterAlgoBase::findCrossingParallel(CascadeMinimizer &minim, RooAbsReal &nll, RooRealVar &r, double level, double rStart, double rBound) {
+    ProfileLikelihood::MinimizerSentry minimizerConfig(minimizerAlgoForMinos_, minimizerToleranceForMinos_);
+    CloseCoutSentry sentry(verbose < 3);    
+    if (verbose) fprintf(sentry.trueStdOut(), "Searching for crossing at nll = %g in the interval [ %g , %g ] with %d processes\n", level, rStart, rBound, crossingForks_);
+
+    std::auto_ptr<RooArgSet> allpars(nll.getParameters((const RooArgSet *)0));
+    r.setVal(rStart); 
+    if (!minim.improve(verbose-1)) { fprintf(sentry.trueStdOut(), "Error: minimization failed at %s = %g\n", r.GetName(), rStart); return NAN; }
+    double y0 = nll.getVal();
+    // rIn is the furthest point known to be on the same side of the level as rStart, rOut the closest one known to be on the other side
+    double rIn = rStart, yIn = y0, rOut = NAN, yOut = NAN;
+    RooArgSet inState; allpars->snapshot(inState);
+    unsigned int n = crossingForks_;
+    std::vector<double> cands(n);
+    for (int iter = 0; iter < 20; ++iter) {
+        if (std::isnan(rOut)) {
+            // not bracketed yet: parabolic prediction from the points at rStart and rIn, and candidates up to twice as far
+            double guess = rIn + stepSize_*(rBound - rStart);
+            if (rIn != rStart && (yIn - y0)*(level - y0) > 0) guess = rStart + (rIn - rStart)*std::sqrt((level - y0)/(yIn - y0));
+            double far = rIn + 2*(guess - rIn);
+            if ((far - rBound)*(rBound - rStart) > 0) far = rBound;
+            for (unsigned int k = 0; k < n; ++k) cands[k] = rIn + (far - rIn)*(k+1)/n;
+        } else {
+            // bracketed: candidates clustered around the secant prediction, within the bracket
+            double guess = rIn + (rOut - rIn)*(level - yIn)/(yOut - yIn);
+            double width = std::abs(rOut - rIn)/(n+1), lo = std::min(rIn, rOut), hi = std::max(rIn, rOut);
+            for (unsigned int k = 0; k < n; ++k) {
+                double c = guess + (k - 0.5*(n-1))*0.5*width;
+                cands[k] = std::max(lo + 0.5*width/n, std::min(hi - 0.5*width/n, c));
+            }
+        }
+        // each record is: outcome, nll, then the values of all the parameters
+        std::vector<std::vector<double> > results;
+        runInForks(n, [&](unsigned int k) -> std::vector<double> {
+            std::vector<double> record(2 + allpars->getSize(), 0.);
+            allpars->assignValueOnly(inState);
+            r.setVal(cands[k]);
+            nll.clearEvalErrorLog(); nll.getVal();
+            if (nll.numEvalErrors() > 0 || !minim.improve(verbose-1)) return record;
+            record[0] = 1; record[1] = nll.getVal();
+            RooFIter iter = allpars->fwdIterator(); unsigned int ip = 2;
+            for (RooAbsArg *a = iter.next(); a != 0; a = iter.next(), ++ip) {
+                RooRealVar *rrv = dynamic_cast<RooRealVar *>(a);
+                if (rrv) { record[ip] = rrv->getVal(); continue; }
+                RooCategory *rc = dynamic_cast<RooCategory *>(a);
+                if (rc) record[ip] = rc->getIndex();
+            }
+            return record;
+        }, results, false);
+        int nok = 0, newIn = -1;
+        for (unsigned int k = 0; k < n; ++k) {
+            if (results[k].empty() || results[k][0] == 0) continue;
+            double c = cands[k], y = results[k][1];
+            nok++;
+            if (verbose > 1) fprintf(sentry.trueStdOut(), "x %+10.6f   yProf %+10.6f   [ iter %d ]\n", c, y-level, iter);
+            if ((y - level)*(y0 - level) > 0) {
+                if ((c - rIn)*(rBound - rStart) > 0) { rIn = c; yIn = y; newIn = k; }
+            } else if (std::isnan(rOut) || (c - rOut)*(rBound - rStart) < 0) {
+                rOut = c; yOut = y;
+            }
+        }
+        if (nok == 0) { fprintf(sentry.trueStdOut(), "Error: minimization failed at all the points around %s = %g\n", r.GetName(), cands[0]); return NAN; }
+        if (newIn != -1) {
+            // restart the next candidates from the profiled parameters at the new rIn
+            RooFIter iter = inState.fwdIterator(); unsigned int ip = 2;
+            for (RooAbsArg *a = iter.next(); a != 0; a = iter.next(), ++ip) {
+                RooRealVar *rrv = dynamic_cast<RooRealVar *>(a);
+                if (rrv) { rrv->setVal(results[newIn][ip]); continue; }
+                RooCategory *rc = dynamic_cast<RooCategory *>(a);
+                if (rc) rc->setIndex(int(results[newIn][ip]));
+            }
+        }
+        if (std::isnan(rOut)) {
+            if (rIn == rBound) {
+                fprintf(sentry.trueStdOut(), "Error: closed range at %s = %g without finding any crossing \n", r.GetName(), rIn); 
+                break;
+            }
+            continue;
+        }
+        if (std::abs(yIn - level) < minimizerTolerance_ || std::abs(yOut - level) < minimizerTolerance_ ||
+            std::abs(rOut - rIn) < minimizerToleranceForMinos_*stepSize_*std::max(1.0, std::abs(rBound - rStart))) break;
+    }
+    allpars->assignValueOnly(inState);
+    double ret = rIn;
+    if (!std::isnan(rOut)) ret = rIn + (rOut - rIn)*(level - yIn)/(yOut - yIn);
+    r.setVal(ret);
+    return ret;
+}
+
+unsigned int FitterAlgoBase::runInForks(unsigned int n, const std::function<std::vector<double>(unsigned int)> &job, std::vector<std::vector<double> > &results, bool parentTakesFirst) 
+{
+    results.assign(n, std::vector<double>());
+    return utils::runInForks(0, n, job, results, parentTakesFirst, verbose > 2);
+}
+
 void FitterAlgoBase::optimizeBounds(const RooWorkspace *w, const RooStats::ModelConfig *mc) {
     if (runtimedef::get("UNBOUND_GAUSSIANS") && mc->GetNuisanceParameters() != 0) {
         RooLinkedListIter iter = mc->GetNuisanceParameters()->iterator();
@@ -60,3 +60,27 @@ Double_t GaussExp::evaluate() const
 
 
 
+
+/// integral of exp(-t^2/2) for t < p2 and exp(p2^2/2 - p2 t) above, from 0 to t
+static double gaussExpPrimitive(double t, double k)
+{
+  static const double rootPiBy2 = sqrt(TMath::PiOver2());
+  if (t < k) return rootPiBy2*TMath::Erf(t/TMath::Sqrt2());
+  double atk = rootPiBy2*TMath::Erf(k/TMath::Sqrt2());
+  if (k == 0) return atk + t;
+  return atk + (exp(-0.5*k*k) - exp(0.5*k*k - k*t))/k;
+}
+
+Int_t GaussExp::getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* /*rangeName*/) const 
+{
+  if (matchArgs(allVars,analVars,x)) return 1 ;
+  return 0 ;
+}
+
+Double_t GaussExp::analyticalIntegral(Int_t code, const char* rangeName) const 
+{
+  if (code != 1) return 0;
+  // dx = p1 dt, also if p1 < 0 since then the limits in t are swapped
+  Double_t tmin = (x.min(rangeName)-p0)/p1, tmax = (x.max(rangeName)-p0)/p1;
+  return p1*(gaussExpPrimitive(tmax, p2) - gaussExpPrimitive(tmin, p2));
+}
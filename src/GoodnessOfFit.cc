@@ -40,12 +40,14 @@ int         GoodnessOfFit::minimizerStrategy_  = 1;
 float       GoodnessOfFit::mu_ = 0.0;
 bool        GoodnessOfFit::fixedMu_ = false;
 bool        GoodnessOfFit::makePlots_ = false;
+bool        GoodnessOfFit::fastSaturated_ = false;
 TDirectory* GoodnessOfFit::plotDir_ = nullptr;
 std::vector<std::string>  GoodnessOfFit::binNames_;
 std::vector<float>        GoodnessOfFit::qVals_;
 
 GoodnessOfFit::GoodnessOfFit() :
-    LimitAlgo("GoodnessOfFit specific options")
+    LimitAlgo("GoodnessOfFit specific options"),
+    ksadPdf_(0), ksadObsOnlyPdf_(0)
 {
     options_.add_options()
         ("algorithm",          boost::program_options::value<std::string>(&algo_), "Goodness of fit algorithm. Supported algorithms are 'saturated', 'KS' and 'AD'.")
@@ -54,6 +56,7 @@ GoodnessOfFit::GoodnessOfFit() :
         ("minimizerStrategy",  boost::program_options::value<int>(&minimizerStrategy_)->default_value(minimizerStrategy_),      "Stragegy for minimizer")
         ("fixedSignalStrength", boost::program_options::value<float>(&mu_)->default_value(mu_),  "Compute the goodness of fit for a fixed signal strength. If not specified, it's left floating")
         ("plots",  "Make plots containing information of the computation of the Anderson-Darling or Kolmogorov-Smirnov test statistic")
+        ("fastSaturated", "For the saturated algorithm, compute the NLL of the saturated model directly when all channels are binned, instead of fitting it")
     ;
 }
 
@@ -70,6 +73,7 @@ void GoodnessOfFit::applyOptions(const boost::program_options::variables_map &vm
       throw std::invalid_argument("GoodnessOfFit: algorithm "+algo_+" not supported");
     }
     makePlots_ = vm.count("plots");
+    fastSaturated_ = vm.count("fastSaturated");
 }
 
 bool GoodnessOfFit::run(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, double &limit, double &limitErr, const double *hint) { 
@@ -83,6 +87,7 @@ bool GoodnessOfFit::run(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::
     if (!is_init) {
       initKSandAD(mc_s);
       if (makePlots_) {
+        std::unique_lock<std::mutex> lock(Combine::lockOutput());
         plotDir_ = outputFile ? outputFile->mkdir("GoodnessOfFit") : 0;
       }
       is_init = true;
@@ -113,6 +118,31 @@ void GoodnessOfFit::initKSandAD(RooStats::ModelConfig *mc_s) {
 
 bool GoodnessOfFit::runSaturatedModel(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, double &limit, double &limitErr, const double *hint) { 
   RooAbsPdf *pdf_nominal = mc_s->GetPdf();
+  const RooCmdArg &constrainCmdArg = withSystematics  ? RooFit::Constrain(*mc_s->GetNuisanceParameters()) : RooCmdArg();
+  if (fastSaturated_) {
+    // for binned channels the saturated model is known: its NLL at the minimum is computed directly, and only the nominal fit is needed
+    CloseCoutSentry sentry(verbose < 2);
+    std::auto_ptr<RooAbsReal> nominal_nll(pdf_nominal->createNLL(data, constrainCmdArg));
+    cacheutils::CachingSimNLL *simnll = dynamic_cast<cacheutils::CachingSimNLL*>(nominal_nll.get());
+    double nll_saturated = 0;
+    if (simnll && simnll->saturatedNll(nll_saturated)) {
+      CascadeMinimizer minimn(*nominal_nll, CascadeMinimizer::Unconstrained);
+      minimn.setStrategy(minimizerStrategy_);
+      minimn.minimize(verbose-2);
+      simnll->clearConstantZeroPoint();
+      double nll_nominal = nominal_nll->getVal();
+      // the saturated NLL must be taken with the same zero points as the nominal one
+      simnll->saturatedNll(nll_saturated);
+      sentry.clear();
+      if (fabs(nll_nominal) > 1e10 || fabs(nll_saturated) > 1e10) return false;
+      limit = 2*(nll_nominal-nll_saturated);
+      std::cout << "\n --- GoodnessOfFit --- " << std::endl;
+      std::cout << "Best fit test statistic: " << limit << std::endl;
+      return true;
+    }
+    sentry.clear();
+    if (verbose) std::cout << "GoodnessOfFit: the saturated model can't be computed directly for this model, will fit it." << std::endl;
+  }
   // now I need to make the saturated pdf
   std::auto_ptr<RooAbsPdf> saturated;
   // factorize away constraints anyway
@@ -160,7 +190,6 @@ bool GoodnessOfFit::runSaturatedModel(RooWorkspace *w, RooStats::ModelConfig *mc
 
   CloseCoutSentry sentry(verbose < 2);
 
-  const RooCmdArg &constrainCmdArg = withSystematics  ? RooFit::Constrain(*mc_s->GetNuisanceParameters()) : RooCmdArg();
   std::auto_ptr<RooAbsReal> nominal_nll(pdf_nominal->createNLL(data, constrainCmdArg));
   std::auto_ptr<RooAbsReal> saturated_nll(saturated->createNLL(data, constrainCmdArg));
 
@@ -203,8 +232,7 @@ bool GoodnessOfFit::runKSandAD(RooWorkspace *w, RooStats::ModelConfig *mc_s, Roo
   RooAbsPdf *pdf = mc_s->GetPdf();
 
   // Don't want the constraints here
-  RooArgList constraints;
-  RooAbsPdf *obsOnlyPdf = utils::factorizePdf(*mc_s->GetObservables(), *pdf, constraints);
+  RooAbsPdf *obsOnlyPdf = obsOnlyPdfFor(*pdf, *mc_s->GetObservables());
 
   //First, find the best fit values
   CloseCoutSentry sentry(verbose < 2);
@@ -260,17 +288,38 @@ bool GoodnessOfFit::runKSandAD(RooWorkspace *w, RooStats::ModelConfig *mc_s, Roo
   return true;
 }
 
+RooAbsPdf *GoodnessOfFit::obsOnlyPdfFor(RooAbsPdf &pdf, const RooArgSet &observables) {
+  if (ksadPdf_ != &pdf) {
+    RooArgList constraints;
+    cdfCache_.clear();
+    ksadObsOnlyPdfOwned_.reset();
+    ksadPdf_ = &pdf;
+    ksadObsOnlyPdf_ = utils::factorizePdf(observables, pdf, constraints);
+    if (ksadObsOnlyPdf_ != &pdf) ksadObsOnlyPdfOwned_.reset(ksadObsOnlyPdf_);
+  }
+  return ksadObsOnlyPdf_;
+}
+
+RooAbsReal &GoodnessOfFit::cdfFor(RooAbsPdf &pdf, RooRealVar &observable) {
+  std::unique_ptr<RooAbsReal> &cdf = cdfCache_[std::string(pdf.GetName()) + ":" + observable.GetName()];
+  // If RooFit needs to use the scanning technique then increase the number
+  // of sampled bins from 1000 to 10000
+  if (!cdf) cdf.reset(pdf.createCdf(observable, RooFit::ScanParameters(10000, 2)));
+  return *cdf;
+}
+
 Double_t GoodnessOfFit::EvaluateADDistance(RooAbsPdf& pdf, RooAbsData& data, RooRealVar& observable, bool kolmo) {
     typedef std::pair<double, double> double_pair;
     std::vector<double_pair> data_points;
     Int_t n_data = data.numEntries();
     Double_t s_data = data.sumEntries();
+    data_points.reserve(n_data);
 
-    const RooArgSet* datavals;
-    RooRealVar* observable_val;
+    // the RooArgSet returned by get(i) is always the same one, only its values change
+    const RooArgSet* datavals = data.get();
+    RooRealVar* observable_val = datavals ? (RooRealVar*)(datavals->find(observable.GetName())) : 0;
     for (int i = 0; i < n_data; i++) {
-        datavals = data.get(i);
-        observable_val = (RooRealVar*)(datavals->find(observable.GetName()));
+        data.get(i);
         data_points.push_back(std::make_pair(observable_val->getVal(), data.weight()));
     }
 
@@ -287,10 +336,10 @@ Double_t GoodnessOfFit::EvaluateADDistance(RooAbsPdf& pdf, RooAbsData& data, Roo
     double bin_prob = 0.;
     double distance = 0.;
 
-    // CDF of the PDF
-    // If RooFit needs to use the scanning technique then increase the number
-    // of sampled bins from 1000 to 10000
-    std::auto_ptr<RooAbsReal> cdf(pdf.createCdf(observable, RooFit::ScanParameters(10000, 2)));
+    // CDF of the PDF, evaluated only once per bin of the observable
+    RooAbsReal *cdf = &cdfFor(pdf, observable);
+    const RooAbsBinning &binning = observable.getBinning();
+    std::vector<double> bin_cdf(binning.numBins(), -1.);
 
     TH1 * hCdf = nullptr;
     TH1 * hEdf = nullptr;
@@ -311,11 +360,18 @@ Double_t GoodnessOfFit::EvaluateADDistance(RooAbsPdf& pdf, RooAbsData& data, Roo
       
         // This is a better way to get the upper bin edge in the case where we
         // have variable bin widths (I hope)
-        observableval = observable.getBinning().binHigh(
-            observable.getBinning().binNumber(d->first));
-        observable.setVal(observableval);
-        // observable.bin
-        current_cdf_val = cdf->getVal();
+        int ibin = binning.binNumber(d->first);
+        observableval = binning.binHigh(ibin);
+        if (ibin < 0 || ibin >= int(bin_cdf.size())) {
+            observable.setVal(observableval);
+            current_cdf_val = cdf->getVal();
+        } else {
+            if (bin_cdf[ibin] < 0) {
+                observable.setVal(observableval);
+                bin_cdf[ibin] = cdf->getVal();
+            }
+            current_cdf_val = bin_cdf[ibin];
+        }
         empirical_df += d->second/s_data;
 
         if (plotDir_ && makePlots_) {
@@ -349,6 +405,7 @@ Double_t GoodnessOfFit::EvaluateADDistance(RooAbsPdf& pdf, RooAbsData& data, Roo
     }
 
     if (plotDir_ && makePlots_) {
+      std::unique_lock<std::mutex> lock(Combine::lockOutput());
       plotDir_->WriteTObject(hCdf);
       plotDir_->WriteTObject(hEdf);
       plotDir_->WriteTObject(hDiff);
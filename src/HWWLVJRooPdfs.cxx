@@ -7,6 +7,7 @@
 #include "Riostream.h" 
 
 #include "HiggsAnalysis/CombinedLimit/interface/HWWLVJRooPdfs.h"
+#include "HiggsAnalysis/CombinedLimit/interface/NormalizationCache.h"
 #include "RooAbsReal.h" 
 #include "RooAbsCategory.h" 
 #include "RooExponential.h" 
@@ -477,6 +478,20 @@ Double_t RooGausExpPdf::evaluate() const {
    return GausExp(x,c,mean,width_tmp);
 } 
 
+Int_t RooGausExpPdf::getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* /*rangeName*/) const  { 
+    if (matchArgs(allVars,analVars,x)) return 1 ; 
+    return 0 ; 
+} 
+
+Double_t RooGausExpPdf::analyticalIntegral(Int_t code, const char* rangeName) const  { 
+    if (code!=1) return 0 ; 
+    Double_t width_tmp=sigma; if(sigma<1e-2){ width_tmp=1e-2;}
+    Double_t xmin=x.min(rangeName), xmax=x.max(rangeName);
+    Double_t intExp = (c==0 ? xmax-xmin : (TMath::Exp(c*xmax)-TMath::Exp(c*xmin))/c);
+    Double_t intGaus = width_tmp*TMath::Sqrt(TMath::PiOver2())*(TMath::Erf((xmax-mean)/(TMath::Sqrt2()*width_tmp))-TMath::Erf((xmin-mean)/(TMath::Sqrt2()*width_tmp)));
+    return intExp + intGaus ; 
+} 
+
 
 /////////////// Alpha for Gaus Exp Function
 
@@ -549,6 +564,21 @@ Double_t RooErfPowPdf::evaluate() const {
    Double_t width_tmp=width; if(width<1e-2){ width_tmp=1e-2;}
    return ErfPow(x,c,offset,width_tmp);} 
 
+Int_t RooErfPowPdf::getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* /*rangeName*/) const  { 
+    // no closed form: the numerical integral is taken from the shared cache (PDF_NORM_CACHE)
+    if (NormalizationCache::enabled() && matchArgs(allVars,analVars,x)) return 1 ; 
+    return 0 ; 
+} 
+
+static double erfPowIntegrand(double x, const double *p) { return ErfPow(x,p[0],p[1],p[2]); }
+
+Double_t RooErfPowPdf::analyticalIntegral(Int_t code, const char* rangeName) const  { 
+    if (code!=1) return 0 ; 
+    Double_t width_tmp=width; if(width<1e-2){ width_tmp=1e-2;}
+    std::vector<double> pars = { c, offset, width_tmp };
+    return NormalizationCache::integral(&erfPowIntegrand, pars, x.min(rangeName), x.max(rangeName)) ; 
+} 
+
 
 //////// Alpha given by the ratio of two Erf*Pow
 
@@ -614,6 +644,20 @@ Double_t RooPow2Pdf::evaluate() const {
    return TMath::Power( x/sqrt_s,-1*( p0+p1*TMath::Log(x/sqrt_s) ) )  ; 
 } 
 
+Int_t RooPow2Pdf::getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* /*rangeName*/) const  { 
+    // no closed form: the numerical integral is taken from the shared cache (PDF_NORM_CACHE)
+    if (NormalizationCache::enabled() && matchArgs(allVars,analVars,x)) return 1 ; 
+    return 0 ; 
+} 
+
+static double pow2Integrand(double x, const double *p) { return TMath::Power( x/2000.,-1*( p[0]+p[1]*TMath::Log(x/2000.) ) ); }
+
+Double_t RooPow2Pdf::analyticalIntegral(Int_t code, const char* rangeName) const  { 
+    if (code!=1) return 0 ; 
+    std::vector<double> pars = { p0, p1 };
+    return NormalizationCache::integral(&pow2Integrand, pars, x.min(rangeName), x.max(rangeName)) ; 
+} 
+
 ////////////////////////////RooPowPdf.cxx
 ClassImp(RooPowPdf) 
 
@@ -638,6 +682,19 @@ Double_t RooPowPdf::evaluate() const {
    return TMath::Power( x/sqrt_s, p0 )  ; 
 } 
 
+Int_t RooPowPdf::getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* /*rangeName*/) const  { 
+    if (matchArgs(allVars,analVars,x)) return 1 ; 
+    return 0 ; 
+} 
+
+Double_t RooPowPdf::analyticalIntegral(Int_t code, const char* rangeName) const  { 
+    if (code!=1) return 0 ; 
+    Double_t sqrt_s=2000.;
+    Double_t xmin=x.min(rangeName), xmax=x.max(rangeName);
+    if (p0==-1) return sqrt_s*TMath::Log(xmax/xmin) ; 
+    return sqrt_s/(p0+1)*(TMath::Power(xmax/sqrt_s,p0+1)-TMath::Power(xmin/sqrt_s,p0+1)) ; 
+} 
+
 /////////////////////////////  RooQCDPdf.cxx
 ClassImp(RooQCDPdf) 
 
@@ -668,6 +725,20 @@ Double_t RooQCDPdf::evaluate() const {
    return TMath::Power(1-x/sqrt_s ,p0)/TMath::Power(x/sqrt_s, p1+p2*TMath::Log(x/sqrt_s))  ; 
 } 
 
+Int_t RooQCDPdf::getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* /*rangeName*/) const  { 
+    // no closed form: the numerical integral is taken from the shared cache (PDF_NORM_CACHE)
+    if (NormalizationCache::enabled() && matchArgs(allVars,analVars,x)) return 1 ; 
+    return 0 ; 
+} 
+
+static double qcdIntegrand(double x, const double *p) { return TMath::Power(1-x/2000. ,p[0])/TMath::Power(x/2000., p[1]+p[2]*TMath::Log(x/2000.)); }
+
+Double_t RooQCDPdf::analyticalIntegral(Int_t code, const char* rangeName) const  { 
+    if (code!=1) return 0 ; 
+    std::vector<double> pars = { p0, p1, p2 };
+    return NormalizationCache::integral(&qcdIntegrand, pars, x.min(rangeName), x.max(rangeName)) ; 
+} 
+
 //////////////////////////////////////////RooUser1Pdf.cxx
 ClassImp(RooUser1Pdf) 
 
@@ -695,6 +766,20 @@ Double_t RooUser1Pdf::evaluate() const {
    return TMath::Power(1-x/sqrt_s ,p0)/TMath::Power(x/sqrt_s, p1)  ; 
 } 
 
+Int_t RooUser1Pdf::getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* /*rangeName*/) const  { 
+    // no closed form: the numerical integral is taken from the shared cache (PDF_NORM_CACHE)
+    if (NormalizationCache::enabled() && matchArgs(allVars,analVars,x)) return 1 ; 
+    return 0 ; 
+} 
+
+static double user1Integrand(double x, const double *p) { return TMath::Power(1-x/500. ,p[0])/TMath::Power(x/500., p[1]); }
+
+Double_t RooUser1Pdf::analyticalIntegral(Int_t code, const char* rangeName) const  { 
+    if (code!=1) return 0 ; 
+    std::vector<double> pars = { p0, p1 };
+    return NormalizationCache::integral(&user1Integrand, pars, x.min(rangeName), x.max(rangeName)) ; 
+} 
+
 
 
 ///////////////////////////////////////////////RooExpNPdf.cxx
@@ -725,6 +810,20 @@ Double_t RooExpNPdf::evaluate() const {
    return ExpN(x,c,n); 
  } 
 
+Int_t RooExpNPdf::getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* /*rangeName*/) const  { 
+    // no closed form: the numerical integral is taken from the shared cache (PDF_NORM_CACHE)
+    if (NormalizationCache::enabled() && matchArgs(allVars,analVars,x)) return 1 ; 
+    return 0 ; 
+} 
+
+static double expNIntegrand(double x, const double *p) { return ExpN(x,p[0],p[1]); }
+
+Double_t RooExpNPdf::analyticalIntegral(Int_t code, const char* rangeName) const  { 
+    if (code!=1) return 0 ; 
+    std::vector<double> pars = { c, n };
+    return NormalizationCache::integral(&expNIntegrand, pars, x.min(rangeName), x.max(rangeName)) ; 
+} 
+
 
 ClassImp(RooAlpha4ExpNPdf) 
 
@@ -785,6 +884,20 @@ Double_t RooExpTailPdf::evaluate() const {
    return ExpTail(x, s, a) ; 
  } 
 
+Int_t RooExpTailPdf::getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* /*rangeName*/) const  { 
+    // no closed form: the numerical integral is taken from the shared cache (PDF_NORM_CACHE)
+    if (NormalizationCache::enabled() && matchArgs(allVars,analVars,x)) return 1 ; 
+    return 0 ; 
+} 
+
+static double expTailIntegrand(double x, const double *p) { return ExpTail(x,p[0],p[1]); }
+
+Double_t RooExpTailPdf::analyticalIntegral(Int_t code, const char* rangeName) const  { 
+    if (code!=1) return 0 ; 
+    std::vector<double> pars = { s, a };
+    return NormalizationCache::integral(&expTailIntegrand, pars, x.min(rangeName), x.max(rangeName)) ; 
+} 
+
 ClassImp(RooAlpha4ExpTailPdf) 
 
  RooAlpha4ExpTailPdf::RooAlpha4ExpTailPdf(const char *name, const char *title, 
@@ -847,6 +960,20 @@ Double_t Roo2ExpPdf::evaluate() const {
    return TwoExp(x,c0,c1,frac);
 } 
 
+Int_t Roo2ExpPdf::getAnalyticalIntegral(RooArgSet& allVars, RooArgSet& analVars, const char* /*rangeName*/) const  { 
+    if (matchArgs(allVars,analVars,x)) return 1 ; 
+    return 0 ; 
+} 
+
+Double_t Roo2ExpPdf::analyticalIntegral(Int_t code, const char* rangeName) const  { 
+    if (code!=1) return 0 ; 
+    Double_t frac_tmp=frac; if(frac<0){frac_tmp=0.;} if(frac>1){frac_tmp=1.;}
+    Double_t xmin=x.min(rangeName), xmax=x.max(rangeName);
+    Double_t int0 = (c0==0 ? xmax-xmin : (TMath::Exp(c0*xmax)-TMath::Exp(c0*xmin))/c0);
+    Double_t int1 = (c1==0 ? xmax-xmin : (TMath::Exp(c1*xmax)-TMath::Exp(c1*xmin))/c1);
+    return int0 + frac_tmp*int1 ; 
+} 
+
 ClassImp(RooAlpha42ExpPdf) 
 
 RooAlpha42ExpPdf::RooAlpha42ExpPdf(const char *name, const char *title, 
@@ -54,22 +54,29 @@ ClassImp(HZZ4L_RooSpinZeroPdf)
  } 
 
 
- Double_t HZZ4L_RooSpinZeroPdf::evaluate() const 
+ void HZZ4L_RooSpinZeroPdf::templateCoefficients(std::vector<double> &coeffs) const 
  { 
-   double value = 0.;
-
-	
-   Double_t T1 = dynamic_cast<const RooHistFunc*>(_coefList.at(0))->getVal();
-   Double_t T2 = dynamic_cast<const RooHistFunc*>(_coefList.at(1))->getVal();
-   Double_t T4 = dynamic_cast<const RooHistFunc*>(_coefList.at(2))->getVal();
    double mysgn = 1;
 
    if(fai < 0.) 
      {
        mysgn = -1.;
      }
-   
-   value = (1.-fabs(fai)) * T1 + fabs(fai) * T2 + mysgn*sqrt((1.-fabs(fai))*fabs(fai)) * T4; 
+
+   coeffs.resize(3);
+   coeffs[0] = 1.-fabs(fai);
+   coeffs[1] = fabs(fai);
+   coeffs[2] = mysgn*sqrt((1.-fabs(fai))*fabs(fai));
+ } 
+
+ Double_t HZZ4L_RooSpinZeroPdf::evaluate() const 
+ { 
+   std::vector<double> coeffs;
+   templateCoefficients(coeffs);
+   double value = 0.;
+   for (unsigned int j = 0, n = coeffs.size(); j < n; ++j) {
+     value += coeffs[j] * static_cast<const RooAbsReal*>(_coefList.at(j))->getVal();
+   }
    
    if ( value <= 0.) return 1.0e-200;
    
@@ -63,26 +63,33 @@ ClassImp(HZZ4L_RooSpinZeroPdf_2D)
  } 
 
 
- Double_t HZZ4L_RooSpinZeroPdf_2D::evaluate() const 
+ void HZZ4L_RooSpinZeroPdf_2D::templateCoefficients(std::vector<double> &coeffs) const 
  { 
-   double value = 0.;
+   double interf1 = sqrt((1.-fai1- fai2)*fai1), interf2 = sqrt((1.-fai1- fai2)*fai2), interf12 = sqrt(fai1*fai2);
 
+   coeffs.resize(9);
 // pure terms	
-   Double_t T1 = dynamic_cast<const RooHistFunc*>(_coefList.at(0))->getVal();
-   Double_t T2 = dynamic_cast<const RooHistFunc*>(_coefList.at(1))->getVal();
-   Double_t T3 = dynamic_cast<const RooHistFunc*>(_coefList.at(2))->getVal();
-
+   coeffs[0] = 1.-fai1 - fai2;
+   coeffs[1] = fai1;
+   coeffs[2] = fai2;
 // interference cos term 
-   Double_t T4 = dynamic_cast<const RooHistFunc*>(_coefList.at(3))->getVal();
-   Double_t T5 = dynamic_cast<const RooHistFunc*>(_coefList.at(4))->getVal();
-   Double_t T6 = dynamic_cast<const RooHistFunc*>(_coefList.at(5))->getVal();
-
+   coeffs[3] = interf1*cos(phi1);
+   coeffs[4] = interf2*cos(phi2);
+   coeffs[5] = interf12*cos(phi1-phi2);
 // interference sin term 
-   Double_t T7 = dynamic_cast<const RooHistFunc*>(_coefList.at(6))->getVal();
-   Double_t T8 = dynamic_cast<const RooHistFunc*>(_coefList.at(7))->getVal();
-   Double_t T9 = dynamic_cast<const RooHistFunc*>(_coefList.at(8))->getVal();
-   
-   value = (1.-fai1 - fai2) * T1 + fai1 * T2 + fai2 * T3 + sqrt((1.-fai1- fai2)*fai1) * (cos(phi1)*T4 +sin(phi1)*T7) + sqrt((1.-fai1- fai2)*fai2) * (cos(phi2)*T5 +sin(phi2)*T8) + sqrt(fai1*fai2) * (cos(phi1-phi2)*T6 +sin(phi1-phi2)*T9); 
+   coeffs[6] = interf1*sin(phi1);
+   coeffs[7] = interf2*sin(phi2);
+   coeffs[8] = interf12*sin(phi1-phi2);
+ } 
+
+ Double_t HZZ4L_RooSpinZeroPdf_2D::evaluate() const 
+ { 
+   std::vector<double> coeffs;
+   templateCoefficients(coeffs);
+   double value = 0.;
+   for (unsigned int j = 0, n = coeffs.size(); j < n; ++j) {
+     value += coeffs[j] * static_cast<const RooAbsReal*>(_coefList.at(j))->getVal();
+   }
    
    if ( value <= 0.) return 1.0e-200;
    
@@ -57,18 +57,25 @@ ClassImp(HZZ4L_RooSpinZeroPdf_phase)
  } 
 
 
- Double_t HZZ4L_RooSpinZeroPdf_phase::evaluate() const 
+ void HZZ4L_RooSpinZeroPdf_phase::templateCoefficients(std::vector<double> &coeffs) const 
  { 
-   double value = 0.;
+   double interf = sqrt((1.-fabs(fai))*fabs(fai));
 
-	
-   Double_t T1 = dynamic_cast<const RooHistFunc*>(_coefList.at(0))->getVal();
-   Double_t T2 = dynamic_cast<const RooHistFunc*>(_coefList.at(1))->getVal();
-   Double_t T4 = dynamic_cast<const RooHistFunc*>(_coefList.at(2))->getVal();
-   Double_t T5 = dynamic_cast<const RooHistFunc*>(_coefList.at(3))->getVal();
+   coeffs.resize(4);
+   coeffs[0] = 1.-fabs(fai);
+   coeffs[1] = fabs(fai);
+   coeffs[2] = interf*cos(phi);
+   coeffs[3] = interf*sin(phi);
+ } 
 
-   
-   value = (1.-fabs(fai)) * T1 + fabs(fai) * T2 + sqrt((1.-fabs(fai))*fabs(fai)) * (cos(phi)*T4 +sin(phi)*T5); 
+ Double_t HZZ4L_RooSpinZeroPdf_phase::evaluate() const 
+ { 
+   std::vector<double> coeffs;
+   templateCoefficients(coeffs);
+   double value = 0.;
+   for (unsigned int j = 0, n = coeffs.size(); j < n; ++j) {
+     value += coeffs[j] * static_cast<const RooAbsReal*>(_coefList.at(j))->getVal();
+   }
    
    if ( value <= 0.) return 1.0e-200;
    
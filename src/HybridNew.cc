@@ -1,5 +1,6 @@
 #include <stdexcept>
 #include <cstdio>
+#include <cmath>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -14,6 +15,8 @@
 #include <TCanvas.h>
 #include <TGraphErrors.h>
 #include <TStopwatch.h>
+#include <TROOT.h>
+#include <RVersion.h>
 #include "RooRealVar.h"
 #include "RooArgSet.h"
 #include "RooAbsPdf.h"
@@ -42,6 +45,10 @@
 #include "HiggsAnalysis/CombinedLimit/interface/utils.h"
 #include "HiggsAnalysis/CombinedLimit/interface/ProfileLikelihood.h"
 #include "HiggsAnalysis/CombinedLimit/interface/ProfilingTools.h"
+#include "HiggsAnalysis/CombinedLimit/interface/ToyResultStore.h"
+#include "HiggsAnalysis/CombinedLimit/interface/WorkQueueClient.h"
+#include "HiggsAnalysis/CombinedLimit/interface/Checkpoint.h"
+#include "HiggsAnalysis/CombinedLimit/interface/ThreadPool.h"
 
 
 #include <boost/algorithm/string/split.hpp>
@@ -77,9 +84,13 @@ bool  HybridNew::fullGrid_ = false;
 bool  HybridNew::saveGrid_ = false; 
 bool  HybridNew::noUpdateGrid_ = false; 
 std::string HybridNew::gridFile_ = "";
+std::string HybridNew::toyStore_ = "";
+std::string HybridNew::workQueue_ = "";
+std::string HybridNew::sharedBToysGrid_ = "";
 std::string HybridNew::scaleAndConfidenceSelection_ ="0.68,0.95";
 bool HybridNew::importanceSamplingNull_ = false;
 bool HybridNew::importanceSamplingAlt_  = false;
+float HybridNew::importanceSamplingFraction_ = 0.5;
 std::string HybridNew::algo_ = "logSecant";
 bool HybridNew::optimizeProductPdf_     = true;
 bool HybridNew::optimizeTestStatistics_ = true;
@@ -90,13 +101,17 @@ std::string HybridNew::plot_;
 std::string HybridNew::minimizerAlgo_ = "Minuit2";
 float       HybridNew::minimizerTolerance_ = 1e-2;
 float       HybridNew::adaptiveToys_ = -1;
+unsigned int HybridNew::sequentialToys_ = 0;
+float       HybridNew::sequentialSigmas_ = 3;
 bool        HybridNew::reportPVal_ = false;
 float HybridNew::confidenceToleranceForToyScaling_ = 0.2;
 float HybridNew::maxProbability_ = 0.999;
+unsigned int HybridNew::reuseToys_ = 0;
 #define EPS 1e-6
  
 HybridNew::HybridNew() : 
-LimitAlgo("HybridNew specific options") {
+LimitAlgo("HybridNew specific options"),
+resumeLoaded_(false) {
     options_.add_options()
         ("rule",    boost::program_options::value<std::string>(&rule_)->default_value(rule_),            "Rule to use: CLs, CLsplusb")
         ("testStat",boost::program_options::value<std::string>(&testStat_)->default_value(testStat_),    "Test statistics: LEP, TEV, LHC (previously known as Atlas), Profile.")
@@ -116,14 +131,21 @@ LimitAlgo("HybridNew specific options") {
         ("nCPU",    boost::program_options::value<unsigned int>(&nCpu_)->default_value(nCpu_),           "Use N CPUs with PROOF Lite (experimental!)")
         ("saveHybridResult",  "Save result in the output file")
         ("readHybridResults", "Read and merge results from file (requires 'toysFile' or 'grid')")
+        ("toyStore", boost::program_options::value<std::string>(&toyStore_), "Append the toys of each point to this indexed binary store; with 'readHybridResults' or for limits from a grid, read them from it instead of from the HypoTestResults in 'toysFile' or 'grid', loading only the points that are needed")
+        ("workQueue", boost::program_options::value<std::string>(&workQueue_), "Run as a worker of the coordinator at host:port (test/toyCoordinator.py): load the model once, then throw the toys of the units of work (number of toys, seed, point) it hands out and send them back as blocks of a toy store (also appended to 'toyStore', if given), until the queue is done. The token of the coordinator is taken from $COMBINE_WORKQUEUE_TOKEN or the file in $COMBINE_WORKQUEUE_TOKEN_FILE, and with --fork the toys of each unit must be a multiple of it")
+        ("sharedBToysGrid", boost::program_options::value<std::string>(&sharedBToysGrid_), "Compute CLs (or CLsplusb) at each of these values of the parameter of interest (comma separated): the S+B toys are thrown at each point, while a single set of B-only toys is thrown for all of them, the test statistic being evaluated on each B toy at all the values in one pass, starting each fit from the minimum at the previous value. One parameter of interest and LHC test statistics only")
         ("grid",    boost::program_options::value<std::string>(&gridFile_),            "Use the specified file containing a grid of SamplingDistributions for the limit (implies readHybridResults).\n For --singlePoint or --signif use --toysFile=x.root --readHybridResult instead of this.")
         ("expectedFromGrid", boost::program_options::value<float>(&quantileForExpectedFromGrid_)->default_value(0.5), "Use the grid to compute the expected limit for this quantile")
         ("signalForSignificance", boost::program_options::value<std::string>()->default_value("1"), "Use this value of the parameter of interest when generating signal toys for expected significance (same syntax as --singlePoint)")
         ("clsQuantiles", boost::program_options::value<bool>(&clsQuantiles_)->default_value(clsQuantiles_), "Compute correct quantiles of CLs or CLsplusb instead of assuming they're the same as CLb ones")
-        //("importanceSamplingNull", boost::program_options::value<bool>(&importanceSamplingNull_)->default_value(importanceSamplingNull_),  
-        //                           "Enable importance sampling for null hypothesis (background only)") 
-        //("importanceSamplingAlt",  boost::program_options::value<bool>(&importanceSamplingAlt_)->default_value(importanceSamplingAlt_),    
-        //                           "Enable importance sampling for alternative hypothesis (signal plus background)") 
+        ("importanceSamplingNull", boost::program_options::value<bool>(&importanceSamplingNull_)->default_value(importanceSamplingNull_),  
+                                   "Importance sampling for the null hypothesis (background only): throw part of its toys with the parameter of interest of the alternate one, and reweight them, to populate the signal-like tail for small p-values") 
+        ("importanceSamplingAlt",  boost::program_options::value<bool>(&importanceSamplingAlt_)->default_value(importanceSamplingAlt_),    
+                                   "Importance sampling for the alternative hypothesis (signal plus background): throw part of its toys with the parameter of interest of the null one, and reweight them") 
+        ("importanceSamplingFraction", boost::program_options::value<float>(&importanceSamplingFraction_)->default_value(importanceSamplingFraction_),
+                                   "Fraction of the toys thrown from the importance density, the others being thrown from the hypothesis itself (this bounds the weights to 1/(1-fraction))")
+        ("reuseToys", boost::program_options::value<unsigned int>(&reuseToys_)->default_value(reuseToys_),
+                                   "Keep up to N toys in memory, and use those thrown at the nearest value of the parameter of interest again at each new point, weighted with the likelihood ratio of the two points: new toys are thrown only until the effective number of toys reaches --toysH (requires --fork 0 or 1)")
         ("optimizeTestStatistics", boost::program_options::value<bool>(&optimizeTestStatistics_)->default_value(optimizeTestStatistics_), 
                                    "Use optimized test statistics if the likelihood is not extended (works for LEP and TEV test statistics).")
         ("optimizeProductPdf",     boost::program_options::value<bool>(&optimizeProductPdf_)->default_value(optimizeProductPdf_),      
@@ -139,6 +161,8 @@ LimitAlgo("HybridNew specific options") {
         ("fullBToys", "Run as many B toys as S ones (default is to run 1/4 of b-only toys)")
         ("pvalue", "Report p-value instead of significance (when running with --significance)")
         ("adaptiveToys",boost::program_options::value<float>(&adaptiveToys_)->default_value(adaptiveToys_), "Throw less toys far from interesting contours , --toysH scaled by scale when prob is far from any of CL_i = {importanceContours} ")
+        ("sequentialToys", boost::program_options::value<unsigned int>(&sequentialToys_)->default_value(sequentialToys_), "When searching for the limit, throw the toys of each point in batches of this size (per process) instead of --toysH, stopping as soon as CLs is above or below the target by more than 'sequentialSigmas' standard deviations, or when 'clsAcc' is reached (0 = off)")
+        ("sequentialSigmas", boost::program_options::value<float>(&sequentialSigmas_)->default_value(sequentialSigmas_), "Number of standard deviations from the target for the sequential decision (see 'sequentialToys')")
         ("importantContours",boost::program_options::value<std::string>(&scaleAndConfidenceSelection_)->default_value(scaleAndConfidenceSelection_), "Throw less toys far from interesting contours , format : CL_1,CL_2,..CL_N (--toysH scaled down when prob is far from any of CL_i) ")
         ("maxProbability", boost::program_options::value<float>(&maxProbability_)->default_value(maxProbability_),  "when point is >  maxProbability countour, don't bother throwing toys")
         ("confidenceTolerance", boost::program_options::value<float>(&confidenceToleranceForToyScaling_)->default_value(confidenceToleranceForToyScaling_),  "Determine what 'far' means for adatptiveToys. (relative in terms of (1-cl))")
@@ -183,13 +207,32 @@ void HybridNew::applyOptions(const boost::program_options::variables_map &vm) {
     }
     saveHybridResult_ = vm.count("saveHybridResult");
     readHybridResults_ = vm.count("readHybridResults") || vm.count("grid");
-    if (readHybridResults_ && !(vm.count("toysFile") || vm.count("grid")))     throw std::invalid_argument("HybridNew: must have 'toysFile' or 'grid' option to have 'readHybridResults'\n");
+    if (readHybridResults_ && !(vm.count("toysFile") || vm.count("grid") || vm.count("toyStore")))     throw std::invalid_argument("HybridNew: must have 'toysFile', 'grid' or 'toyStore' option to have 'readHybridResults'\n");
     mass_ = vm["mass"].as<float>();
     fullGrid_ = vm.count("fullGrid");
     saveGrid_ = vm.count("saveGrid");
     fullBToys_ = vm.count("fullBToys");
     noUpdateGrid_ = vm.count("noUpdateGrid");
     reportPVal_ = vm.count("pvalue");
+    if (!workQueue_.empty()) {
+        if (readHybridResults_) throw std::invalid_argument("HybridNew: --workQueue throws toys, it can't be used with --readHybridResults or --grid");
+        if (workingMode_ == MakeTestStatistics || workingMode_ == MakeSignificanceTestStatistics) throw std::invalid_argument("HybridNew: --workQueue can't be used with --onlyTestStat");
+    }
+    if (!sharedBToysGrid_.empty()) {
+        if (workingMode_ != MakeLimit || readHybridResults_ || !workQueue_.empty()) throw std::invalid_argument("HybridNew: --sharedBToysGrid throws toys for limits, it can't be used with --singlePoint, --significance, --readHybridResults, --grid or --workQueue");
+        if (!newToyMCSampler_ || !optimizeTestStatistics_) throw std::invalid_argument("HybridNew: --sharedBToysGrid requires --newToyMCSampler 1 and --optimizeTestStatistics 1");
+        if (importanceSamplingNull_ || importanceSamplingAlt_ || reuseToys_) throw std::invalid_argument("HybridNew: --sharedBToysGrid can't be used with importance sampling or --reuseToys");
+    }
+    if (importanceSamplingNull_ || importanceSamplingAlt_) {
+        if (importanceSamplingFraction_ <= 0 || importanceSamplingFraction_ >= 1) throw std::invalid_argument("HybridNew: the fraction of toys for importance sampling must be between 0 and 1");
+        if (!newToyMCSampler_) throw std::invalid_argument("HybridNew: importance sampling requires --newToyMCSampler 1");
+    }
+    if (reuseToys_) {
+        if (!newToyMCSampler_) throw std::invalid_argument("HybridNew: --reuseToys requires --newToyMCSampler 1");
+        if (fork_ > 1 || nCpu_ > 0) throw std::invalid_argument("HybridNew: --reuseToys keeps the toys in memory, so they must be thrown in this process (--fork 0 or 1, no --nCPU)");
+        if (importanceSamplingNull_ || importanceSamplingAlt_) std::cout << "HybridNew: toys thrown with importance sampling are not reused" << std::endl;
+        fork_ = 0; // a single child process would take the toys away with it
+    }
     validateOptions(); 
 }
 
@@ -245,7 +288,10 @@ bool HybridNew::run(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::Mode
     RooFitGlobalKillSentry silence(verbose <= 1 ? RooFit::WARNING : RooFit::DEBUG);
     ProfileLikelihood::MinimizerSentry minimizerConfig(minimizerAlgo_, minimizerTolerance_);
     perf_totalToysRun_ = 0; // reset performance counter
+    if (recycler_.get()) recycler_->clear(); // the toys of another dataset are not reused
     if (rValues_.getSize() == 0) setupPOI(mc_s);
+    if (!workQueue_.empty()) return runWorker(w, mc_s, mc_b, data, limit, limitErr, hint);
+    if (!sharedBToysGrid_.empty()) return runSharedBToysGrid(w, mc_s, mc_b, data, limit, limitErr, hint);
     switch (workingMode_) {
         case MakeLimit:            return runLimit(w, mc_s, mc_b, data, limit, limitErr, hint);
         case MakeSignificance:     return runSignificance(w, mc_s, mc_b, data, limit, limitErr, hint);
@@ -282,9 +328,13 @@ bool HybridNew::runSignificance(RooWorkspace *w, RooStats::ModelConfig *mc_s, Ro
             name += Form("_%s%g", rIn->GetName(), rIn->getVal());
         }
         name += Form("_%u", RooRandom::integer(std::numeric_limits<UInt_t>::max() - 1));
-        writeToysHere->WriteTObject(new HypoTestResult(*hcResult), name);
+        { std::unique_lock<std::mutex> lock(Combine::lockOutput()); writeToysHere->WriteTObject(new HypoTestResult(*hcResult), name); }
         if (verbose) std::cout << "Hybrid result saved as " << name << " in " << writeToysHere->GetFile()->GetName() << " : " << writeToysHere->GetPath() << std::endl;
     }
+    if (!toyStore_.empty() && !readHybridResults_) {
+        ToyResultStore(toyStore_).append(mass_, rValues_, *hcResult);
+        if (verbose) std::cout << "Hybrid result appended to " << toyStore_ << std::endl;
+    }
     if (verbose > 1) {
         std::cout << "Observed test statistics in data: " << hcResult->GetTestStatisticData() << std::endl;
         std::cout << "Background-only toys sampled:     " << hcResult->GetNullDistribution()->GetSize() << std::endl;
@@ -311,7 +361,7 @@ bool HybridNew::runSignificance(RooWorkspace *w, RooStats::ModelConfig *mc_s, Ro
 bool HybridNew::runLimit(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, double &limit, double &limitErr, const double *hint) {
   if (mc_s->GetParametersOfInterest()->getSize() != 1) throw std::logic_error("Cannot run limits in more than one dimension, for the moment.");
   RooRealVar *r = dynamic_cast<RooRealVar *>(mc_s->GetParametersOfInterest()->first()); r->setConstant(true);
-  w->loadSnapshot("clean");
+  utils::loadSnapshot(w, "clean");
 
   if ((hint != 0) && (*hint > r->getMin()) && testStat_ != "Profile") {
       r->setMax(std::min<double>(3.0 * (*hint), r->getMax()));
@@ -332,8 +382,12 @@ bool HybridNew::runLimit(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats:
   if (readHybridResults_) { 
       if (verbose > 0) std::cout << "Search for upper limit using pre-computed grid of p-values" << std::endl;
 
-      if (!gridFile_.empty()) {
-        if (grid_.empty()) {
+      if (!gridFile_.empty() || !toyStore_.empty()) {
+        if (grid_.empty() && !toyStore_.empty()) {
+            if (rValues_.getSize() != 1) throw std::runtime_error("Running limits with grid only works in one dimension for the moment");
+            ToyResultStore(toyStore_).readGrid(mass_, rValues_.first()->GetName(), rMinSet_ ? rMin : -99e99, rMaxSet_ ? rMax :+99e99, grid_);
+            if (verbose > 1) std::cout << "Read " << grid_.size() << " points of the grid from " << toyStore_ << std::endl;
+        } else if (grid_.empty()) {
             std::auto_ptr<TFile> gridFile(TFile::Open(gridFile_.c_str()));
             if (gridFile.get() == 0) throw std::runtime_error(("Can't open grid file "+gridFile_).c_str());
             TDirectory *toyDir = gridFile->GetDirectory("toys");
@@ -557,6 +611,196 @@ bool HybridNew::runSinglePoint(RooWorkspace *w, RooStats::ModelConfig *mc_s, Roo
     return true;
 }
 
+bool HybridNew::runWorker(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, double &limit, double &limitErr, const double *hint) {
+    WorkQueueClient queue(workQueue_);
+    WorkQueueClient::Unit unit;
+    RooArgSet POI(*mc_s->GetParametersOfInterest());
+    unsigned int nToysDefault = nToys_, nUnits = 0;
+    std::vector<char> block;
+    TStopwatch timer; timer.Start();
+    while (queue.next(unit)) {
+        RooArgSet rVals;
+        utils::createSnapshotFromString(unit.point, POI, rVals, "the point of a unit of --workQueue");
+        if (rVals.getSize() != POI.getSize()) throw std::invalid_argument("Error: not all parameters of interest specified in the point '"+unit.point+"' of a unit of --workQueue");
+        RooLinkedListIter it = rVals.iterator();
+        for (RooRealVar *rIn = (RooRealVar*) it.Next(); rIn != 0; rIn = (RooRealVar*) it.Next()) {
+            RooRealVar *r = dynamic_cast<RooRealVar *>(mc_s->GetParametersOfInterest()->find(rIn->GetName()));
+            if (rIn->getVal() > r->getMax()) r->setMax(2*rIn->getVal());
+            r->setVal(rIn->getVal());
+        }
+        if (verbose) std::cout << "Unit " << unit.id << ": " << unit.toys << " toys at " << unit.point << " with seed " << unit.seed << std::endl;
+        // the coordinator takes only results with the toys of the unit, so they must split evenly among the forks
+        if (fork_ > 1 && unit.toys % fork_ != 0) throw std::invalid_argument(TString::Format("HybridNew: the %u toys of unit %s of --workQueue can't be split among %u forks, use a multiple of --fork", unit.toys, unit.id.c_str(), fork_).Data());
+        // the toys of a unit are a function of its seed only, whichever worker runs it
+        RooRandom::randomGenerator()->SetSeed(unit.seed);
+        nToys_ = std::max(1u, fork_ > 1 ? unit.toys / fork_ : unit.toys);
+        HybridNew::Setup setup;
+        std::auto_ptr<RooStats::HybridCalculator> hc(create(w, mc_s, mc_b, data, rVals, setup));
+        std::auto_ptr<HypoTestResult> hcResult(evalGeneric(*hc));
+        if (hcResult.get() == 0) throw std::runtime_error("HybridNew: hypotest failed for unit "+unit.id+" of --workQueue");
+        ToyResultStore::serialize(mass_, rVals, *hcResult, block);
+        queue.submit(unit, block);
+        if (!toyStore_.empty()) ToyResultStore(toyStore_).appendBlock(block);
+        ++nUnits;
+    }
+    nToys_ = nToysDefault;
+    std::cout << "\n -- Hybrid New -- \n";
+    std::cout << "Worker of " << workQueue_ << " done: " << nUnits << " units in " << timer.RealTime() << " s" << std::endl;
+    limit = nUnits; limitErr = 0;
+    return true;
+}
+
+bool HybridNew::runSharedBToysGrid(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, double &limit, double &limitErr, const double *hint) {
+    if (mc_s->GetParametersOfInterest()->getSize() != 1 || testStat_ != "LHC") throw std::invalid_argument("HybridNew: --sharedBToysGrid works only with one parameter of interest and the LHC test statistics");
+    RooRealVar *r = dynamic_cast<RooRealVar *>(mc_s->GetParametersOfInterest()->first());
+    std::vector<std::string> items;
+    boost::split(items, sharedBToysGrid_, boost::is_any_of(","));
+    std::vector<Double_t> rVals;
+    for (const std::string &item : items) {
+        if (!item.empty()) rVals.push_back(atof(item.c_str()));
+    }
+    std::sort(rVals.begin(), rVals.end());
+    rVals.erase(std::unique(rVals.begin(), rVals.end()), rVals.end());
+    if (rVals.empty() || rVals.front() <= 0) throw std::invalid_argument("HybridNew: the values of --sharedBToysGrid must be positive");
+
+    // the B-only toys are thrown with r = 0 and the nuisances of the B-only fit to the data, which are the same for all
+    // the points, and with the same proportion to the S+B ones as in create(); nToys_ is per process when forking
+    unsigned int nSBToys = nToys_ * std::max(1u, fork_), nBToys = nSBToys;
+    if (!fullBToys_ && !(expectedFromGrid_ && fabs(0.5-quantileForExpectedFromGrid_) >= 0.4)) {
+        nBToys = (CLs_ ? std::max(1u, unsigned(0.25*nSBToys)) : unsigned(0.01*nSBToys)+1);
+    }
+    std::vector<std::vector<Double_t> > bTestStats;
+    unsigned int skippedBToys = 0;
+    {
+        TStopwatch timer; timer.Start();
+        HybridNew::Setup setup;
+        // set up at the largest r, so that the range of r contains all the others
+        std::auto_ptr<RooStats::HybridCalculator> hc(create(w, mc_s, mc_b, data, rVals.back(), setup));
+        skippedBToys = throwSharedBToys(setup, rVals, nBToys, bTestStats);
+        perf_totalToysRun_ += bTestStats.front().size();
+        if (verbose) std::cout << "Thrown " << nBToys << " B-only toys for " << rVals.size() << " points in " << timer.RealTime() << " s" << std::endl;
+    }
+    if (bTestStats.front().empty()) throw std::runtime_error("HybridNew: the test statistic is nan for all the shared B-only toys");
+    std::vector<Double_t> skippedPoints;
+
+    limitPlot_.reset(new TGraphErrors());
+    for (unsigned int i = 0, n = rVals.size(); i < n; ++i) {
+        RooArgSet rValues;
+        mc_s->GetParametersOfInterest()->snapshot(rValues);
+        RooRealVar *rv = dynamic_cast<RooRealVar*>(rValues.first());
+        if (rVals[i] > rv->getMax()) rv->setMax(2*rVals[i]);
+        rv->setVal(rVals[i]);
+        r->setVal(rVals[i]);
+        if (verbose) std::cout << "  " << r->GetName() << " = " << rVals[i] << std::endl;
+        HybridNew::Setup setup;
+        std::auto_ptr<RooStats::HybridCalculator> hc(create(w, mc_s, mc_b, data, rValues, setup));
+        hc->SetToys(1, nToys_); // the B-only toys are the shared ones
+        std::auto_ptr<HypoTestResult> hcResult(evalGeneric(*hc));
+        if (hcResult.get() == 0) {
+            std::cerr << "Hypotest failed for " << r->GetName() << " = " << rVals[i] << ", skipping this point" << std::endl;
+            skippedPoints.push_back(rVals[i]);
+            continue;
+        }
+        perf_totalToysRun_ += hcResult->GetAltDistribution()->GetSize();
+        SamplingDistribution *thrown = hcResult->GetNullDistribution();
+        std::vector<Double_t> weights(bTestStats[i].size(), 1.0);
+        SamplingDistribution *shared = new SamplingDistribution(thrown->GetName(), thrown->GetTitle(), bTestStats[i], weights, thrown->GetVarName());
+        delete thrown;
+        hcResult->SetNullDistribution(shared);
+        if (expectedFromGrid_) applyExpectedQuantile(*hcResult);
+        hcResult->SetTestStatisticData(hcResult->GetTestStatisticData()-EPS); // issue with < vs <= in discrete models
+        std::pair<double,double> cls = eval(*hcResult, rValues);
+        printf("  %s %.4g: %s = %6.4f +/- %6.4f (%d S+B toys, %d B toys)\n", r->GetName(), rVals[i], CLs_ ? "CLs" : "CLsplusb", cls.first, cls.second,
+                    hcResult->GetAltDistribution()->GetSize(), hcResult->GetNullDistribution()->GetSize());
+        saveResult(*hcResult, rValues);
+        limitPlot_->Set(limitPlot_->GetN()+1);
+        limitPlot_->SetPoint(limitPlot_->GetN()-1, rVals[i], cls.first);
+        limitPlot_->SetPointError(limitPlot_->GetN()-1, 0, cls.second);
+        // as with --saveGrid: r in 'limit', CLs in 'quantileExpected' and its uncertainty in 'limitErr'
+        limit = rVals[i]; limitErr = cls.second;
+        Combine::commitPoint(false, cls.first);
+    }
+    std::cout << "\n -- Hybrid New -- \n";
+    std::cout << "Computed " << (CLs_ ? "CLs" : "CLsplusb") << " at " << (rVals.size() - skippedPoints.size()) << " points with " << bTestStats.front().size() << " shared B-only toys";
+    if (skippedBToys) std::cout << " (" << skippedBToys << " skipped, with a nan test statistic)";
+    std::cout << std::endl;
+    if (!skippedPoints.empty()) {
+        std::cout << "Skipped " << skippedPoints.size() << " points, where the hypotest failed: " << r->GetName() << " =";
+        for (Double_t rv : skippedPoints) std::cout << " " << rv;
+        std::cout << std::endl;
+    }
+    if (verbose > 1) std::cout << "Total toys: " << perf_totalToysRun_ << std::endl;
+    return false; // the points are already in the tree
+}
+
+unsigned int HybridNew::throwSharedBToys(HybridNew::Setup &setup, const std::vector<Double_t> &rVals, unsigned int ntoys, std::vector<std::vector<Double_t> > &testStats) {
+    ProfiledLikelihoodTestStatOpt &qvar = dynamic_cast<ProfiledLikelihoodTestStatOpt &>(*setup.qvar);
+    qvar.setWarmStartAdjacent(true);
+    // set up the sampler for the B-only hypothesis, as the HybridCalculator does before throwing its toys
+    RooStats::ModelConfig &mcB = setup.modelConfig_bonly;
+    RooStats::ToyMCSampler &toymc = *setup.toymcsampler;
+    toymc.SetPdf(*mcB.GetPdf());
+    toymc.SetObservables(*mcB.GetObservables());
+    if (mcB.GetNuisanceParameters()) toymc.SetNuisanceParameters(*mcB.GetNuisanceParameters());
+    if (setup.priorNuisanceNull) toymc.SetPriorNuisance(setup.priorNuisanceNull);
+    toymc.SetNToys(ntoys);
+
+    std::auto_ptr<RooArgSet> allVars(mcB.GetPdf()->getVariables());
+    RooArgSet saveAll, bPoint;
+    allVars->snapshot(saveAll);
+    allVars->assignValueOnly(*mcB.GetSnapshot());
+    allVars->snapshot(bPoint);
+    RooArgSet nullPOI(*mcB.GetSnapshot());
+    unsigned int nr = rVals.size();
+    // throw toys [first, last): the first entry of the result is the number of toys skipped, then nr values for each good toy
+    auto throwToys = [&](unsigned int first, unsigned int last) -> std::vector<double> {
+        std::vector<double> ret(1, 0.);
+        ret.reserve(1 + nr * (last - first));
+        for (unsigned int i = first; i < last; ++i) {
+            if ((i - first) % 500 == 0 && i > first && verbose) std::cout << "generated B-only toys: " << (i - first) << " / " << (last - first) << std::endl;
+            *allVars = bPoint;
+            double weight = 1;
+            std::auto_ptr<RooAbsData> toy(toymc.GenerateToyData(nullPOI, weight));
+            // the global observables stay at the values of the toy while the test statistic is evaluated
+            std::vector<Double_t> vals = qvar.Evaluate(*toy, nullPOI, rVals);
+            bool good = true;
+            for (unsigned int j = 0; j < nr; ++j) good = good && (vals[j] == vals[j]);
+            if (!good) {
+                std::cerr << "skip B-only toy " << i << ": test statistic is nan" << std::endl;
+                ret[0]++;
+                continue;
+            }
+            ret.insert(ret.end(), vals.begin(), vals.end());
+        }
+        return ret;
+    };
+    // with --fork, each process throws a block of the toys with its own seed (this one the first block)
+    unsigned int nforks = std::max(1u, std::min(fork_, ntoys));
+    std::vector<std::vector<double> > blocks;
+    if (nforks > 1) {
+        std::vector<UInt_t> seeds(nforks);
+        for (unsigned int k = 0; k < nforks; ++k) seeds[k] = RooRandom::integer(std::numeric_limits<UInt_t>::max()-1);
+        unsigned int nfailed = utils::runInForks(0, nforks, [&](unsigned int k) -> std::vector<double> {
+            RooRandom::randomGenerator()->SetSeed(seeds[k]);
+            return throwToys(k * ntoys / nforks, (k + 1) * ntoys / nforks);
+        }, blocks, true, verbose > 1);
+        if (nfailed) throw std::runtime_error("HybridNew: a forked process throwing the shared B-only toys failed");
+    } else {
+        blocks.push_back(throwToys(0, ntoys));
+    }
+    *allVars = saveAll;
+    testStats.assign(nr, std::vector<Double_t>());
+    for (unsigned int j = 0; j < nr; ++j) testStats[j].reserve(ntoys);
+    unsigned int skipped = 0;
+    for (const std::vector<double> &block : blocks) {
+        skipped += block[0];
+        for (unsigned int i = 1, n = block.size(); i + nr <= n; i += nr) {
+            for (unsigned int j = 0; j < nr; ++j) testStats[j].push_back(block[i + j]);
+        }
+    }
+    return skipped;
+}
+
 bool HybridNew::runTestStatistics(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, double &limit, double &limitErr, const double *hint) {
     bool isProfile = (testStat_ == "LHC" || testStat_ == "LHCFC"  || testStat_ == "Profile");
     if (readHybridResults_ && expectedFromGrid_) {
@@ -643,7 +887,7 @@ std::auto_ptr<RooStats::HybridCalculator> HybridNew::create(RooWorkspace *w, Roo
 std::auto_ptr<RooStats::HybridCalculator> HybridNew::create(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, const RooAbsCollection & rVals, HybridNew::Setup &setup) {
   using namespace RooStats;
   
-  w->loadSnapshot("clean");
+  utils::loadSnapshot(w, "clean");
   // realData_ = &data;  
 
   RooArgSet  poi(*mc_s->GetParametersOfInterest()), params(poi);
@@ -882,6 +1126,26 @@ std::auto_ptr<RooStats::HybridCalculator> HybridNew::create(RooWorkspace *w, Roo
   }
 
   if (!mc_b->GetPdf()->canBeExtended()) setup.toymcsampler->SetNEventsPerToy(1);
+
+  if (newToyMCSampler_ && (importanceSamplingNull_ || importanceSamplingAlt_)) {
+    if (poi.getSize() != 1) {
+      std::cerr << "WARNING: importance sampling is supported only for one parameter of interest, it will not be used." << std::endl;
+    } else {
+      // the importance density of each hypothesis is the signal plus background model with the POI of the other hypothesis,
+      // and the nuisances of the hypothesis itself (so that their constraint terms cancel in the weights)
+      ToyMCSamplerOpt &toymc = static_cast<ToyMCSamplerOpt &>(*setup.toymcsampler);
+      RooArgSet nullPoint, altPoint;
+      nullPoint.addClone(*r); nullPoint.setRealValue(r->GetName(), paramsZero.getRealValue(r->GetName(), 0.));
+      altPoint.addClone(*r);  altPoint.setRealValue(r->GetName(), setup.modelConfig.GetSnapshot()->getRealValue(r->GetName()));
+      if (importanceSamplingNull_) toymc.addImportanceDensity(*setup.modelConfig.GetPdf(), nullPoint, altPoint, importanceSamplingFraction_);
+      if (importanceSamplingAlt_)  toymc.addImportanceDensity(*setup.modelConfig.GetPdf(), altPoint, nullPoint, importanceSamplingFraction_);
+    }
+  }
+  
+  if (newToyMCSampler_ && reuseToys_ > 0) {
+    if (recycler_.get() == 0) recycler_.reset(new toymcoptutils::ToyRecycler(reuseToys_));
+    static_cast<ToyMCSamplerOpt &>(*setup.toymcsampler).setToyRecycler(recycler_.get(), poi);
+  }
   
   if (nCpu_ > 0) {
     std::cerr << "ALERT: running with proof not validated." << std::endl;
@@ -896,11 +1160,13 @@ std::auto_ptr<RooStats::HybridCalculator> HybridNew::create(RooWorkspace *w, Roo
           setup.toymcsampler->SetGlobalObservables(*setup.modelConfig.GetNuisanceParameters());
           (static_cast<HybridCalculator&>(*hc)).ForcePriorNuisanceNull(*nuisancePdf);
           (static_cast<HybridCalculator&>(*hc)).ForcePriorNuisanceAlt(*nuisancePdf);
+          setup.priorNuisanceNull = nuisancePdf;
       }  
   } else if (genGlobalObs_ && !genNuisances_) {
       setup.toymcsampler->SetGlobalObservables(*setup.modelConfig.GetGlobalObservables());
       hc->ForcePriorNuisanceNull(*w->pdf("__HybridNew_fake_nuisPdf__"));
       hc->ForcePriorNuisanceAlt(*w->pdf("__HybridNew_fake_nuisPdf__"));
+      setup.priorNuisanceNull = w->pdf("__HybridNew_fake_nuisPdf__");
   }
 
   // we need less B toys than S toys
@@ -965,6 +1231,11 @@ std::auto_ptr<RooStats::HybridCalculator> HybridNew::create(RooWorkspace *w, Roo
 
 std::pair<double,double> 
 HybridNew::eval(RooStats::HybridCalculator &hc, const RooAbsCollection & rVals, bool adaptive, double clsTarget) {
+    bool sequential = (sequentialToys_ > 0 && adaptive && clsTarget != -1 && !expectedFromGrid_);
+    if (sequential) {
+        // same proportions of S+B and B toys as in the adaptive mode
+        hc.SetToys(CLs_ ? std::max<int>(1, int(0.25*sequentialToys_ + 1)) : 1, sequentialToys_);
+    }
     std::auto_ptr<HypoTestResult> hcResult(evalGeneric(hc));
     if (expectedFromGrid_) applyExpectedQuantile(*hcResult);
     if (hcResult.get() == 0) {
@@ -980,7 +1251,18 @@ HybridNew::eval(RooStats::HybridCalculator &hc, const RooAbsCollection & rVals,
     }
     std::pair<double,double> cls = eval(*hcResult, rVals);
     if (verbose) std::cout << (CLs_ ? "\tCLs = " : "\tCLsplusb = ") << cls.first << " +/- " << cls.second << std::endl;
-    if (adaptive) {
+    if (sequential) {
+        // the batches stay small, and each one is followed by the decision
+        while (cls.second >= clsAccuracy_ && !sequentialDecision(*hcResult, cls, clsTarget)) {
+            std::auto_ptr<HypoTestResult> more(evalGeneric(hc));
+            more->SetBackgroundAsAlt(false);
+            if (testStat_ == "LHC" || testStat_ == "LHCFC"  || testStat_ == "Profile") more->SetPValueIsRightTail(!more->GetPValueIsRightTail());
+            hcResult->Append(more.get());
+            cls = eval(*hcResult, rVals);
+            if (verbose) std::cout << (CLs_ ? "\tCLs = " : "\tCLsplusb = ") << cls.first << " +/- " << cls.second << std::endl;
+        }
+        if (verbose) std::cout << "\tSequential decision after " << hcResult->GetAltDistribution()->GetSize() << " S+B and " << hcResult->GetNullDistribution()->GetSize() << " B toys" << std::endl;
+    } else if (adaptive) {
         if (CLs_) {
           hc.SetToys(int(0.25*nToys_ + 1), nToys_);
         }
@@ -1029,6 +1311,12 @@ HybridNew::eval(RooStats::HybridCalculator &hc, const RooAbsCollection & rVals,
         c1->Print(plot_.c_str());
         delete c1;
     }
+    saveResult(*hcResult, rVals);
+
+    return cls;
+} 
+
+void HybridNew::saveResult(const RooStats::HypoTestResult &hcres, const RooAbsCollection & rVals) {
     if (saveHybridResult_) {
         TString name = TString::Format("HypoTestResult_mh%g",mass_);
         RooLinkedListIter it = rVals.iterator();
@@ -1036,12 +1324,26 @@ HybridNew::eval(RooStats::HybridCalculator &hc, const RooAbsCollection & rVals,
             name += Form("_%s%g", rIn->GetName(), rIn->getVal());
         }
         name += Form("_%u", RooRandom::integer(std::numeric_limits<UInt_t>::max() - 1));
-        writeToysHere->WriteTObject(new HypoTestResult(*hcResult), name);
+        { std::unique_lock<std::mutex> lock(Combine::lockOutput()); writeToysHere->WriteTObject(new HypoTestResult(hcres), name); }
         if (verbose) std::cout << "Hybrid result saved as " << name << " in " << writeToysHere->GetFile()->GetName() << " : " << writeToysHere->GetPath() << std::endl;
     }
+    if (!toyStore_.empty()) {
+        ToyResultStore(toyStore_).append(mass_, rVals, hcres);
+        if (verbose) std::cout << "Hybrid result appended to " << toyStore_ << std::endl;
+    }
+}
 
-    return cls;
-} 
+bool HybridNew::sequentialDecision(const RooStats::HypoTestResult &hcres, const std::pair<double,double> &cls, double clsTarget) 
+{
+    // with few toys the binomial errors are unreliable (e.g. zero when no toy is in the tail), so the uncertainty 
+    // is also estimated from the fractions with one pseudo-toy added on each side, and the larger one is used
+    double ns = hcres.GetAltDistribution()->GetSize(), nb = hcres.GetNullDistribution()->GetSize();
+    double ps = (hcres.CLsplusb() * ns + 1)/(ns + 2), pb = (hcres.CLb() * nb + 1)/(nb + 2);
+    double err = std::sqrt(ps*(1-ps)/ns);
+    if (CLs_) err = (ps/pb) * std::sqrt((1-ps)/(ps*ns) + (1-pb)/(pb*nb));
+    err = std::max(err, cls.second);
+    return std::abs(cls.first - clsTarget) > sequentialSigmas_ * err;
+}
 
 std::pair<double,double> HybridNew::eval(const RooStats::HypoTestResult &hcres, const RooAbsCollection & rVals) 
 {
@@ -1097,6 +1399,36 @@ std::pair<double,double> HybridNew::eval(const RooStats::HypoTestResult &hcres,
     }
 }
 
+double HybridNew::distributionQuantile(const RooStats::SamplingDistribution &dist, double quantile) {
+    const std::vector<Double_t> & vals = dist.GetSamplingDistribution();
+    const std::vector<Double_t> & weights = dist.GetSampleWeights();
+    bool weighted = false;
+    for (std::vector<Double_t>::const_iterator itw = weights.begin(), edw = weights.end(); itw != edw; ++itw) {
+        if (*itw != 1.0) { weighted = true; break; }
+    }
+    if (!weighted) {
+        // only the element at the quantile needs to be in its sorted place
+        std::vector<Double_t> toys(vals);
+        std::vector<Double_t>::iterator nth = toys.begin() + std::min<int>(floor(quantile * toys.size()+0.5), toys.size()-1);
+        std::nth_element(toys.begin(), nth, toys.end());
+        return *nth;
+    }
+    // toys with weights, e.g. from importance sampling
+    std::vector<std::pair<double,double> > toys; toys.reserve(vals.size());
+    double tot = 0;
+    for (unsigned int i = 0, n = vals.size(); i < n; ++i) {
+        toys.push_back(std::pair<double,double>(vals[i], weights[i]));
+        tot += weights[i];
+    }
+    std::sort(toys.begin(), toys.end());
+    double runningSum = 0, cut = quantile * tot;
+    for (std::vector<std::pair<double,double> >::const_iterator it = toys.begin(), ed = toys.end(); it != ed; ++it) {
+        runningSum += it->second;
+        if (runningSum >= cut) return it->first;
+    }
+    return toys.back().first;
+}
+
 void HybridNew::applyExpectedQuantile(RooStats::HypoTestResult &hcres) {
   if (expectedFromGrid_) {
       if (workingMode_ == MakeSignificance || workingMode_ == MakeSignificanceTestStatistics) {
@@ -1104,9 +1436,7 @@ void HybridNew::applyExpectedQuantile(RooStats::HypoTestResult &hcres) {
       } else if (clsQuantiles_) {
           applyClsQuantile(hcres);
       } else {
-          std::vector<Double_t> btoys = hcres.GetNullDistribution()->GetSamplingDistribution();
-          std::sort(btoys.begin(), btoys.end());
-          Double_t testStat = btoys[std::min<int>(floor((1.-quantileForExpectedFromGrid_) * btoys.size()+0.5), btoys.size())];
+          Double_t testStat = distributionQuantile(*hcres.GetNullDistribution(), 1.-quantileForExpectedFromGrid_);
           if (verbose > 0) std::cout << "Text statistics for " << quantileForExpectedFromGrid_ << " quantile: " << testStat << std::endl;
           hcres.SetTestStatisticData(testStat);
           //std::cout << "CLs quantile = " << (CLs_ ? hcres.CLs() : hcres.CLsplusb()) << " for test stat = " << testStat << std::endl;
@@ -1114,15 +1444,47 @@ void HybridNew::applyExpectedQuantile(RooStats::HypoTestResult &hcres) {
   }
 }
 void HybridNew::applyClsQuantile(RooStats::HypoTestResult &hcres) {
+    // the tables of the points of the grid are made once, in updateGridData, and reused by all the queries
+    std::map<const RooStats::HypoTestResult *, ClsQuantileTable>::const_iterator cached = clsQuantileTables_.find(&hcres);
+    ClsQuantileTable local;
+    const ClsQuantileTable *table = &local;
+    if (cached != clsQuantileTables_.end() && cached->second.nNull == hcres.GetNullDistribution()->GetSize() && cached->second.nAlt == hcres.GetAltDistribution()->GetSize()) {
+        table = &cached->second;
+    } else {
+        fillClsQuantileTable(hcres, local);
+    }
+    // get quantile
+    double cut = quantileForExpectedFromGrid_ * table->btot;
+    std::vector<double>::const_iterator match = std::lower_bound(table->cumulWeight.begin(), table->cumulWeight.end(), cut);
+    if (match != table->cumulWeight.end()) {
+        hcres.SetTestStatisticData(table->testStat[match - table->cumulWeight.begin()]);
+    }
+    //std::cout << "CLs quantile = " << (CLs_ ? hcres.CLs() : hcres.CLsplusb()) << std::endl;
+    //std::cout << "Computed quantiles in " << timer.RealTime() << " s" << std::endl; 
+#if 0
+    /** Implementation in RooStats 5.30: scales as N^2, inefficient */
+    timer.Start();
+    std::vector<std::pair<double, double> > values(bdist.size()); 
+    for (int i = 0, n = bdist.size(); i < n; ++i) { 
+        hcres.SetTestStatisticData( bdist[i] );
+        values[i] = std::pair<double, double>(CLs_ ? hcres.CLs() : hcres.CLsplusb(), bdist[i]);
+    }
+    std::sort(values.begin(), values.end());
+    int index = std::min<int>(floor((1.-quantileForExpectedFromGrid_) * values.size()+0.5), values.size());
+    std::cout << "CLs quantile = " << values[index].first << " for test stat = " << values[index].second << std::endl;
+    hcres.SetTestStatisticData(values[index].second);
+    std::cout << "CLs quantile = " << (CLs_ ? hcres.CLs() : hcres.CLsplusb()) << " for test stat = " << values[index].second << std::endl;
+    std::cout << "Computed quantiles in " << timer.RealTime() << " s" << std::endl; 
+#endif
+}
+
+void HybridNew::fillClsQuantileTable(const RooStats::HypoTestResult &hcres, ClsQuantileTable &table) {
     RooStats::SamplingDistribution * bDistribution = hcres.GetNullDistribution(), * sDistribution = hcres.GetAltDistribution();
     const std::vector<Double_t> & bdist   = bDistribution->GetSamplingDistribution();
     const std::vector<Double_t> & bweight = bDistribution->GetSampleWeights();
     const std::vector<Double_t> & sdist   = sDistribution->GetSamplingDistribution();
     const std::vector<Double_t> & sweight = sDistribution->GetSampleWeights();
-    TStopwatch timer;
-
     /** New test implementation, scales as N*log(N) */
-    timer.Start();
     std::vector<std::pair<double,double> > bcumul; bcumul.reserve(bdist.size()); 
     std::vector<std::pair<double,double> > scumul; scumul.reserve(sdist.size());
     double btot = 0, stot = 0;
@@ -1162,51 +1524,77 @@ void HybridNew::applyClsQuantile(RooStats::HypoTestResult &hcres) {
     }
     // sort 
     std::sort(xcumul.begin(), xcumul.end()); 
-    // get quantile
-    runningSum = 0; double cut = quantileForExpectedFromGrid_ * btot;
-    for (std::vector<std::pair<double,std::pair<double,double> > >::const_iterator it = xcumul.begin(), ed = xcumul.end(); it != ed; ++it) {
-        runningSum += it->second.second; 
-        if (runningSum >= cut) {
-            hcres.SetTestStatisticData(it->second.first);
-            //std::cout << "CLs quantile = " << it->first << " for test stat = " << it->second.first << std::endl;
-            break;
-        }
-    }
-    //std::cout << "CLs quantile = " << (CLs_ ? hcres.CLs() : hcres.CLsplusb()) << std::endl;
-    //std::cout << "Computed quantiles in " << timer.RealTime() << " s" << std::endl; 
-#if 0
-    /** Implementation in RooStats 5.30: scales as N^2, inefficient */
-    timer.Start();
-    std::vector<std::pair<double, double> > values(bdist.size()); 
-    for (int i = 0, n = bdist.size(); i < n; ++i) { 
-        hcres.SetTestStatisticData( bdist[i] );
-        values[i] = std::pair<double, double>(CLs_ ? hcres.CLs() : hcres.CLsplusb(), bdist[i]);
+    table.testStat.resize(xcumul.size());
+    table.cumulWeight.resize(xcumul.size());
+    runningSum = 0;
+    for (unsigned int i = 0, n = xcumul.size(); i < n; ++i) {
+        runningSum += xcumul[i].second.second;
+        table.testStat[i] = xcumul[i].second.first;
+        table.cumulWeight[i] = runningSum;
     }
-    std::sort(values.begin(), values.end());
-    int index = std::min<int>(floor((1.-quantileForExpectedFromGrid_) * values.size()+0.5), values.size());
-    std::cout << "CLs quantile = " << values[index].first << " for test stat = " << values[index].second << std::endl;
-    hcres.SetTestStatisticData(values[index].second);
-    std::cout << "CLs quantile = " << (CLs_ ? hcres.CLs() : hcres.CLsplusb()) << " for test stat = " << values[index].second << std::endl;
-    std::cout << "Computed quantiles in " << timer.RealTime() << " s" << std::endl; 
-#endif
+    table.btot = btot;
+    table.nNull = bdist.size();
+    table.nAlt = sdist.size();
 }
 
 void HybridNew::applySignalQuantile(RooStats::HypoTestResult &hcres) {
-    std::vector<Double_t> stoys = hcres.GetAltDistribution()->GetSamplingDistribution();
-    std::sort(stoys.begin(), stoys.end());
-    Double_t testStat = stoys[std::min<int>(floor(quantileForExpectedFromGrid_ * stoys.size()+0.5), stoys.size())];
+    Double_t testStat = distributionQuantile(*hcres.GetAltDistribution(), quantileForExpectedFromGrid_);
     if (verbose > 0) std::cout << "Text statistics for " << quantileForExpectedFromGrid_ << " quantile: " << testStat << std::endl;
     hcres.SetTestStatisticData(testStat);
 }
 
 RooStats::HypoTestResult * HybridNew::evalGeneric(RooStats::HybridCalculator &hc, bool noFork) {
-    if (fork_ && !noFork) return evalWithFork(hc);
+    // with --checkpoint each batch is saved (by the parent, when forking), and with --resume 
+    // the batches saved for this point are used first, in the order in which they were thrown
+    std::string key;
+    if (Checkpoint::enabled() && !noFork) {
+        key = checkpointKey(hc);
+        if (RooStats::HypoTestResult *saved = resumeBatch(key)) return saved;
+    }
+    RooStats::HypoTestResult * ret = 0;
+    if (fork_ && !noFork) ret = evalWithFork(hc);
     else {
         TStopwatch timer; timer.Start();
-        RooStats::HypoTestResult * ret = hc.GetHypoTest();
+        ret = hc.GetHypoTest();
         if (runtimedef::get("HybridNew_Timing")) std::cout << "Evaluated toys in " << timer.RealTime() << " s " <<  std::endl;
-        return ret;
     }
+    if (ret && !key.empty()) Checkpoint::save("HybridNew", key, *ret);
+    return ret;
+}
+
+std::string HybridNew::checkpointKey(const RooStats::HybridCalculator &hc) const {
+    TString key = TString::Format("mh%g", mass_);
+    const RooStats::ModelConfig *models[2] = { hc.GetNullModel(), hc.GetAlternateModel() };
+    for (int im = 0; im < 2; ++im) {
+        key += (im == 0 ? "_null" : "_alt");
+        const RooArgSet *snap = models[im] ? models[im]->GetSnapshot() : 0;
+        if (snap == 0) continue;
+        RooLinkedListIter it = snap->iterator();
+        for (RooAbsReal *rIn = (RooAbsReal*) it.Next(); rIn != 0; rIn = (RooAbsReal*) it.Next()) {
+            key += Form("_%s%g", rIn->GetName(), rIn->getVal());
+        }
+    }
+    return key.Data();
+}
+
+RooStats::HypoTestResult * HybridNew::resumeBatch(const std::string &key) {
+    if (!Checkpoint::resuming()) return 0;
+    if (!resumeLoaded_) {
+        std::vector<Checkpoint::Record> records;
+        Checkpoint::load("HybridNew", records);
+        for (const Checkpoint::Record &r : records) resumeBatches_[r.key].push_back(r);
+        resumeLoaded_ = true;
+        if (verbose) std::cout << "Read " << records.size() << " batches of toys from the checkpoint" << std::endl;
+    }
+    std::map<std::string, std::deque<Checkpoint::Record> >::iterator match = resumeBatches_.find(key);
+    if (match == resumeBatches_.end() || match->second.empty()) return 0;
+    RooStats::HypoTestResult *ret = dynamic_cast<RooStats::HypoTestResult *>(Checkpoint::object(match->second.front(), RooStats::HypoTestResult::Class()));
+    if (ret == 0) throw std::runtime_error("HybridNew: bad batch of toys for "+key+" in the checkpoint");
+    // continue with the random numbers that would have come after this batch
+    Checkpoint::restoreRandom(match->second.front());
+    match->second.pop_front();
+    if (verbose > 1) std::cout << "Toys for " << key << " from the checkpoint" << std::endl;
+    return ret;
 }
 
 RooStats::HypoTestResult * HybridNew::evalWithFork(RooStats::HybridCalculator &hc) {
@@ -1214,6 +1602,19 @@ RooStats::HypoTestResult * HybridNew::evalWithFork(RooStats::HybridCalculator &h
     std::auto_ptr<RooStats::HypoTestResult> result(0);
     char tmpfile[999]; snprintf(tmpfile, 998, "%s/rstats-XXXXXX", P_tmpdir);
     int fd = mkstemp(tmpfile); close(fd);
+    if (runtimedef::get("HybridNew_ForkWarmup") && hc.GetData() != 0) {
+        // Evaluate the test statistic once before forking, so that the NLL and its caches (clones of the pdfs, 
+        // templates, ...) are built only once in the parent and then shared copy-on-write by all the children, 
+        // which will just change the dataset of the NLL instead of building their own
+        TStopwatch warmup;
+        const RooStats::ModelConfig *model = hc.GetNullModel();
+        std::auto_ptr<RooArgSet> params(model->GetPdf()->getParameters(*hc.GetData()));
+        RooArgSet snap; params->snapshot(snap);
+        RooArgSet nullPoi(*model->GetSnapshot());
+        hc.GetTestStatSampler()->GetTestStatistic()->Evaluate(const_cast<RooAbsData &>(*hc.GetData()), nullPoi);
+        *params = snap;
+        if (verbose > 1) std::cout << "      Test statistics warmed up before forking in " << warmup.RealTime() << " s" << std::endl;
+    }
     unsigned int ich = 0;
     std::vector<UInt_t> newSeeds(fork_);
     for (ich = 0; ich < fork_; ++ich) {
@@ -1323,6 +1724,16 @@ RooStats::HypoTestResult * HybridNew::evalFrequentist(RooStats::HybridCalculator
 #endif
 
 RooStats::HypoTestResult * HybridNew::readToysFromFile(const RooAbsCollection & rVals) {
+    if (!toyStore_.empty()) {
+        std::auto_ptr<RooStats::HypoTestResult> ret(ToyResultStore(toyStore_).read(mass_, rVals));
+        if (ret.get() == 0) {
+            std::cout << "ERROR: parameter point not found in " << toyStore_ << std::endl;
+            rVals.Print("V");
+            throw std::invalid_argument("Missing input");
+        }
+        if (verbose > 0) std::cout << "Read " << ret->GetNullDistribution()->GetSize() << " + " << ret->GetAltDistribution()->GetSize() << " toys from " << toyStore_ << std::endl;
+        return ret.release();
+    }
     if (!readToysFromHere) throw std::logic_error("Cannot use readHypoTestResult: option toysFile not specified, or input file empty");
     TDirectory *toyDir = readToysFromHere->GetDirectory("toys");
     if (!toyDir) throw std::logic_error("Cannot use readHypoTestResult: empty toy dir in input file empty");
@@ -1410,21 +1821,30 @@ void HybridNew::readGrid(TDirectory *toyDir, double rMin, double rMax) {
 }
 void HybridNew::updateGridData(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, bool smart, double clsTarget_) {
     typedef std::map<double, RooStats::HypoTestResult *>::iterator point;
+    typedef std::pair<double,double> CLs_t;
+    std::vector<point> points; points.reserve(grid_.size()); 
+    std::vector<CLs_t> values; values.reserve(grid_.size());
+    for (point it = grid_.begin(), ed = grid_.end(); it != ed; ++it) { points.push_back(it); values.push_back(CLs_t(-99, -99)); }
+    if (expectedFromGrid_) {
+        // no fits are needed, so all the points are done up front (in parallel on the threads of --threads, or of the runtimedef HybridNew_GridThreads),
+        // and the searches below only look them up
+        updateExpectedGrid(points, values);
+    }
     if (!smart) {
-        for (point it = grid_.begin(), ed = grid_.end(); it != ed; ++it) {
-            it->second->ResetBit(1);
-            updateGridPoint(w, mc_s, mc_b, data, it);
+        for (int i = 0, n = points.size(); i < n; ++i) {
+            points[i]->second->ResetBit(1);
+            if (values[i].first < -2) updateGridPoint(w, mc_s, mc_b, data, points[i]);
         }
     } else {
-        typedef std::pair<double,double> CLs_t;
-        std::vector<point> points; points.reserve(grid_.size()); 
-        std::vector<CLs_t> values; values.reserve(grid_.size());
-        for (point it = grid_.begin(), ed = grid_.end(); it != ed; ++it) { points.push_back(it); values.push_back(CLs_t(-99, -99)); }
+        auto updateGridPointOnce = [&](int i) -> CLs_t {
+            if (values[i].first < -2) values[i] = updateGridPoint(w, mc_s, mc_b, data, points[i]);
+            return values[i];
+        };
         int iMin = 0, iMax = points.size()-1;
         while (iMax-iMin > 3) {
             if (verbose > 1) std::cout << "Bisecting range [" << iMin << ", " << iMax << "]" << std::endl; 
             int iMid = (iMin+iMax)/2;
-            CLs_t clsMid = values[iMid] = updateGridPoint(w, mc_s, mc_b, data, points[iMid]);
+            CLs_t clsMid = updateGridPointOnce(iMid);
             if (verbose > 1) std::cout << "    Midpoint " << iMid << " value " << clsMid.first << " +/- " << clsMid.second << std::endl; 
             if (clsMid.first - 3*max(clsMid.second,0.01) > clsTarget_) { 
                 if (verbose > 1) std::cout << "    Replacing Min" << std::endl; 
@@ -1436,14 +1856,14 @@ void HybridNew::updateGridData(RooWorkspace *w, RooStats::ModelConfig *mc_s, Roo
                 if (verbose > 1) std::cout << "    Tightening Range" << std::endl; 
                 while (iMin < iMid-1) {
                     int iLo = (iMin+iMid)/2;
-                    CLs_t clsLo = values[iLo] = updateGridPoint(w, mc_s, mc_b, data, points[iLo]);
+                    CLs_t clsLo = updateGridPointOnce(iLo);
                     if (verbose > 1) std::cout << "        Lowpoint " << iLo << " value " << clsLo.first << " +/- " << clsLo.second << std::endl; 
                     if (clsLo.first - 3*max(clsLo.second,0.01) > clsTarget_) iMin = iLo; 
                     else break;
                 }
                 while (iMax > iMid+1) {
                     int iHi = (iMax+iMid)/2;
-                    CLs_t clsHi = values[iHi] = updateGridPoint(w, mc_s, mc_b, data, points[iHi]);
+                    CLs_t clsHi = updateGridPointOnce(iHi);
                     if (verbose > 1) std::cout << "        Highpoint " << iHi << " value " << clsHi.first << " +/- " << clsHi.second << std::endl; 
                     if (clsHi.first + 3*max(clsHi.second,0.01) < clsTarget_) iMax = iHi; 
                     else break;
@@ -1470,6 +1890,51 @@ void HybridNew::updateGridData(RooWorkspace *w, RooStats::ModelConfig *mc_s, Roo
         }
     }
 }
+void HybridNew::updateExpectedGrid(const std::vector<std::map<double, RooStats::HypoTestResult *>::iterator> &points, std::vector<std::pair<double,double> > &values) {
+    bool isProfile = (testStat_ == "LHC" || testStat_ == "LHCFC"  || testStat_ == "Profile");
+    bool clsTables = clsQuantiles_ && workingMode_ != MakeSignificance && workingMode_ != MakeSignificanceTestStatistics;
+    unsigned int nThreads = ThreadPool::threadsFor(runtimedef::get("HybridNew_GridThreads"));
+    ThreadPool *pool = 0;
+    if (nThreads > 1 && points.size() > 1) {
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,4,0)
+        ROOT::EnableThreadSafety();
+#endif
+        pool = &ThreadPool::global(nThreads);
+    }
+    TStopwatch timer; timer.Start();
+    // first the tables, that are kept for all the later queries on these points, then the quantiles and CLs from them
+    if (clsTables) {
+        std::vector<ClsQuantileTable> tables(points.size());
+        std::vector<bool> cached(points.size());
+        for (unsigned int i = 0, n = points.size(); i < n; ++i) {
+            const RooStats::HypoTestResult *res = points[i]->second;
+            std::map<const RooStats::HypoTestResult *, ClsQuantileTable>::const_iterator it = clsQuantileTables_.find(res);
+            cached[i] = (it != clsQuantileTables_.end() && it->second.nNull == res->GetNullDistribution()->GetSize() && it->second.nAlt == res->GetAltDistribution()->GetSize());
+        }
+        auto fill = [&](unsigned int i) { if (!cached[i]) fillClsQuantileTable(*points[i]->second, tables[i]); };
+        if (pool) pool->parallelFor(points.size(), fill, nThreads);
+        else for (unsigned int i = 0, n = points.size(); i < n; ++i) fill(i);
+        for (unsigned int i = 0, n = points.size(); i < n; ++i) {
+            if (!cached[i]) std::swap(clsQuantileTables_[points[i]->second], tables[i]);
+        }
+    }
+    auto update = [&](unsigned int i) {
+        RooStats::HypoTestResult &res = *points[i]->second;
+        if (points[i]->first == 0 && CLs_) { values[i] = std::pair<double,double>(1,0); return; }
+        applyExpectedQuantile(res);
+        res.SetTestStatisticData(res.GetTestStatisticData() + (isProfile ? EPS : EPS));
+        values[i] = eval(res, points[i]->first);
+    };
+    if (pool) pool->parallelFor(points.size(), update, nThreads);
+    else for (unsigned int i = 0, n = points.size(); i < n; ++i) update(i);
+    if (verbose > 1) {
+        for (unsigned int i = 0, n = points.size(); i < n; ++i) {
+            std::cout << "At " << points[i]->first << ": " << (CLs_ ? "CLs" : "CLsplusb") << " = " << values[i].first << " +/- " << values[i].second << std::endl;
+        }
+    }
+    if (runtimedef::get("HybridNew_Timing")) std::cout << "Evaluated the expected " << (CLs_ ? "CLs" : "CLsplusb") << " of " << points.size() << " points in " << timer.RealTime() << " s " <<  std::endl;
+}
+
 void HybridNew::updateGridDataFC(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, bool smart, double clsTarget_) {
     typedef std::map<double, RooStats::HypoTestResult *>::iterator point;
     std::vector<Double_t> rToUpdate; std::vector<point> pointToUpdate;
@@ -1543,5 +2008,6 @@ void HybridNew::clearGrid() {
         delete it->second;
     }
     grid_.clear();
+    clsQuantileTables_.clear();
 }
 
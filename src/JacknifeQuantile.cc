@@ -3,9 +3,12 @@
 #include <stdexcept>
 #include <iostream>
 #include <algorithm>
+#include <limits>
 #include <Math/QuantFuncMathMore.h>
 #include <RooAbsData.h>
 #include <RooRealVar.h>
+#include "HiggsAnalysis/CombinedLimit/interface/ProfilingTools.h"
+#include "HiggsAnalysis/CombinedLimit/interface/ThreadPool.h"
 
 QuantileCalculator::QuantileCalculator()
 {
@@ -53,15 +56,24 @@ void QuantileCalculator::randomizePoints()
 
 std::pair<double,double> QuantileCalculator::quantileAndError(double quantile, Method method) 
 {
+    int nThreads = runtimedef::get("QUANTILE_SELECT");
     if (method == Simple) {
-        std::sort(points_.begin(), points_.end());
-        quantiles(quantile, false);
+        if (nThreads) {
+            selectQuantiles(quantile, false, nThreads);
+        } else {
+            std::sort(points_.begin(), points_.end());
+            quantiles(quantile, false);
+        }
         return std::pair<double,double>(quantiles_[0], 0);
     } else if (method == Sectioning || method == Jacknife) {
         int m = guessPartitions(points_.size(), quantile);
         partition(m, (method == Jacknife));
-        std::sort(points_.begin(), points_.end());
-        quantiles(quantile, (method == Jacknife));
+        if (nThreads) {
+            selectQuantiles(quantile, (method == Jacknife), nThreads);
+        } else {
+            std::sort(points_.begin(), points_.end());
+            quantiles(quantile, (method == Jacknife));
+        }
         double avg = 0;
         for (int i = 0; i < m; ++i) {
             avg += quantiles_[i];
@@ -162,3 +174,171 @@ void QuantileCalculator::quantiles(double quantile, bool doJacknife)
         }
     }
 }
+
+void QuantileCalculator::selectQuantiles(double quantile, bool doJacknife, unsigned int nThreads) 
+{
+    int m = sumw_.size()-1;
+    quantiles_.resize(m+1);
+    // the last subset is the full sample, that is needed only for the jacknife pseudo-values
+    int nsubsets = (doJacknife || m == 0) ? m+1 : m;
+    // each subset is selected in its own copy, so points_ keeps its order and the sections are the same as with sorting
+    auto job = [&](unsigned int j) {
+        std::vector<point> subset; 
+        subset.reserve(doJacknife || m == 0 ? points_.size() : points_.size()/m + 1);
+        for (std::vector<point>::const_iterator it = points_.begin(), ed = points_.end(); it != ed; ++it) {
+            if (int(j) < m && (it->set == int(j)) == doJacknife) continue;
+            subset.push_back(*it); 
+        }
+        quantiles_[j] = subset.empty() ? 0 : selectQuantile(&subset[0], &subset[0] + subset.size(), quantile * sumw_[j]);
+    };
+    nThreads = ThreadPool::threadsFor(nThreads);
+    if (nThreads > 1 && nsubsets > 1) {
+        ThreadPool::global(nThreads).parallelFor(nsubsets, job, nThreads);
+    } else {
+        for (int j = 0; j < nsubsets; ++j) job(j);
+    }
+    if (doJacknife) {
+        for (int j = 0; j < m; ++j) {
+            quantiles_[j] = m * quantiles_[m] - (m-1) * quantiles_[j];
+            printf("   ... jacknife quantile of section %d: %6.3f\n", j, quantiles_[j]);
+        }
+    }
+}
+
+double QuantileCalculator::selectQuantile(point *begin, point *end, double threshold) 
+{
+    // find the first point k in the sorted order such that the weight of the points before it plus its own is above threshold,
+    // by weighted quickselect: nth_element around the middle, and continue in the half that contains k
+    point *lo = begin, *hi = end, *k = end;
+    double runningSum = 0; // weight of [begin, lo)
+    while (lo < hi) {
+        point *mid = lo + (hi - lo)/2;
+        std::nth_element(lo, mid, hi);
+        double wleft = 0;
+        for (point *p = lo; p < mid; ++p) wleft += p->w;
+        if (runningSum + wleft + mid->w <= threshold) {
+            runningSum += wleft + mid->w;
+            lo = mid + 1;
+        } else if (runningSum + wleft <= threshold) {
+            runningSum += wleft;
+            k = mid; 
+            break;
+        } else {
+            hi = mid;
+        }
+    }
+    if (k == end) k = lo; // lo == hi here
+    // [begin, k) are all below k, and [k, end) all above, so the neighbours in the sorted order are a max and a min
+    double xlow  = (k == begin) ? std::min_element(begin, end)->x : std::max_element(begin, k)->x;
+    double xhigh = (k == end)   ? std::max_element(begin, end)->x : std::min_element(k, end)->x;
+    if (runningSum == threshold) { // possible if all unit weights
+        return xlow;
+    } else {
+        return 0.5*(xlow + xhigh);
+    }
+}
+
+QuantileSketch::QuantileSketch(double compression) :
+    compression_(compression),
+    sumw_(0), bufferSumw_(0),
+    min_(std::numeric_limits<double>::infinity()), max_(-std::numeric_limits<double>::infinity())
+{
+}
+
+QuantileSketch::QuantileSketch(const std::vector<std::pair<double,double> > &clusters, double compression) :
+    compression_(compression),
+    sumw_(0), bufferSumw_(0),
+    min_(std::numeric_limits<double>::infinity()), max_(-std::numeric_limits<double>::infinity())
+{
+    for (std::vector<std::pair<double,double> >::const_iterator it = clusters.begin(), ed = clusters.end(); it != ed; ++it) {
+        add(it->first, it->second);
+    }
+}
+
+void QuantileSketch::add(double x, double w) 
+{
+    if (w <= 0) return;
+    buffer_.push_back(std::make_pair(x, w));
+    bufferSumw_ += w;
+    if (x < min_) min_ = x;
+    if (x > max_) max_ = x;
+    if (buffer_.size() >= 10*compression_) compress_();
+}
+
+void QuantileSketch::merge(const QuantileSketch &other) 
+{
+    other.compress_();
+    buffer_.insert(buffer_.end(), other.clusters_.begin(), other.clusters_.end());
+    bufferSumw_ += other.sumw_;
+    if (other.min_ < min_) min_ = other.min_;
+    if (other.max_ > max_) max_ = other.max_;
+    compress_();
+}
+
+void QuantileSketch::compress_() const 
+{
+    if (buffer_.empty()) return;
+    buffer_.insert(buffer_.end(), clusters_.begin(), clusters_.end());
+    std::sort(buffer_.begin(), buffer_.end());
+    double total = sumw_ + bufferSumw_;
+    clusters_.clear();
+    // scale function k(q) = delta/(2 pi) asin(2q-1): a cluster can span at most a unit in k, so clusters are small in the tails
+    const double norm = compression_/(2*M_PI);
+    double wSoFar = 0, kLeft = norm * asin(-1.0);
+    std::pair<double,double> current = buffer_.front();
+    for (std::vector<std::pair<double,double> >::const_iterator it = buffer_.begin()+1, ed = buffer_.end(); it != ed; ++it) {
+        double q = (wSoFar + current.second + it->second)/total;
+        if (norm * asin(std::min(1.0, 2*q-1)) - kLeft <= 1) {
+            current.first  += (it->first - current.first) * it->second / (current.second + it->second);
+            current.second += it->second;
+        } else {
+            wSoFar += current.second;
+            kLeft = norm * asin(std::min(1.0, 2*wSoFar/total-1));
+            clusters_.push_back(current);
+            current = *it;
+        }
+    }
+    clusters_.push_back(current);
+    buffer_.clear();
+    sumw_ = total; bufferSumw_ = 0;
+}
+
+double QuantileSketch::quantile(double q) const 
+{
+    compress_();
+    if (clusters_.empty()) return 0;
+    if (clusters_.size() == 1) return clusters_.front().first;
+    double target = q * sumw_;
+    // linear interpolation between the centres of the clusters, and towards min and max in the tails
+    double wcentre = 0.5*clusters_.front().second;
+    if (target < wcentre) return min_ + (clusters_.front().first - min_) * target / wcentre;
+    for (unsigned int i = 1, n = clusters_.size(); i < n; ++i) {
+        double wnext = wcentre + 0.5*(clusters_[i-1].second + clusters_[i].second);
+        if (target < wnext) {
+            return clusters_[i-1].first + (clusters_[i].first - clusters_[i-1].first) * (target - wcentre) / (wnext - wcentre);
+        }
+        wcentre = wnext;
+    }
+    double wlast = 0.5*clusters_.back().second;
+    return clusters_.back().first + (max_ - clusters_.back().first) * std::min(1.0, (target - wcentre) / wlast);
+}
+
+double QuantileSketch::cdf(double x) const 
+{
+    compress_();
+    if (clusters_.empty() || x < min_) return 0;
+    if (x >= max_) return 1;
+    double wcentre = 0.5*clusters_.front().second;
+    if (x < clusters_.front().first) {
+        return (clusters_.front().first > min_ ? wcentre * (x - min_)/(clusters_.front().first - min_) : 0) / sumw_;
+    }
+    for (unsigned int i = 1, n = clusters_.size(); i < n; ++i) {
+        double wnext = wcentre + 0.5*(clusters_[i-1].second + clusters_[i].second);
+        if (x < clusters_[i].first) {
+            return (wcentre + (wnext - wcentre) * (x - clusters_[i-1].first) / (clusters_[i].first - clusters_[i-1].first)) / sumw_;
+        }
+        wcentre = wnext;
+    }
+    double wlast = 0.5*clusters_.back().second;
+    return (wcentre + wlast * (x - clusters_.back().first) / (max_ - clusters_.back().first)) / sumw_;
+}
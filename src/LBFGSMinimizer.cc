@@ -0,0 +1,204 @@
+#include "HiggsAnalysis/CombinedLimit/interface/LBFGSMinimizer.h"
+
+#include <cmath>
+#include <stdexcept>
+#include <algorithm>
+#include <limits>
+#include "HiggsAnalysis/CombinedLimit/interface/ProfilingTools.h"
+
+#define DEBUG_LBFGS_printf  if (PrintLevel() > 1) printf
+
+cmsmath::LBFGSMinimizer::LBFGSMinimizer(const char *name) :
+    ROOT::Math::Minimizer(),
+    func_(0), gradFunc_(0),
+    minValue_(std::numeric_limits<double>::quiet_NaN()), edm_(std::numeric_limits<double>::infinity()), nCalls_(0)
+{
+}
+
+void cmsmath::LBFGSMinimizer::Clear() {
+    minValue_ = std::numeric_limits<double>::quiet_NaN();
+    edm_      = std::numeric_limits<double>::infinity();
+    nCalls_   = 0;
+    s_.clear(); y_.clear();
+}
+
+void cmsmath::LBFGSMinimizer::SetFunction(const ROOT::Math::IMultiGenFunction & func) {
+    func_ = &func; gradFunc_ = 0;
+    vars_.assign(func.NDim(), Var());
+    x_.assign(func.NDim(), 0.);
+    grad_.assign(func.NDim(), 0.);
+    Clear();
+}
+
+void cmsmath::LBFGSMinimizer::SetFunction(const ROOT::Math::IMultiGradFunction & func) {
+    SetFunction(static_cast<const ROOT::Math::IMultiGenFunction &>(func));
+    gradFunc_ = &func;
+}
+
+void cmsmath::LBFGSMinimizer::resize(unsigned int ivar) {
+    if (ivar >= x_.size()) { x_.resize(ivar+1, 0.); grad_.resize(ivar+1, 0.); vars_.resize(ivar+1); }
+}
+
+bool cmsmath::LBFGSMinimizer::SetVariable(unsigned int ivar, const std::string & name, double val, double step) {
+    resize(ivar);
+    Var &v = vars_[ivar];
+    v.name = name; v.step = (step > 0 ? step : 1.0); v.lower = -std::numeric_limits<double>::infinity(); v.upper = std::numeric_limits<double>::infinity(); v.fixed = false;
+    x_[ivar] = val;
+    return true;
+}
+
+bool cmsmath::LBFGSMinimizer::SetLimitedVariable(unsigned int ivar, const std::string & name, double val, double  step, double  lower, double  upper) {
+    SetVariable(ivar, name, val, step);
+    vars_[ivar].lower = lower; vars_[ivar].upper = upper;
+    return true;
+}
+
+bool cmsmath::LBFGSMinimizer::SetFixedVariable(unsigned int ivar, const std::string & name, double val) {
+    SetVariable(ivar, name, val, 1.0);
+    vars_[ivar].fixed = true;
+    return true;
+}
+
+double cmsmath::LBFGSMinimizer::eval(const std::vector<double> &x) {
+    nCalls_++;
+    return (*func_)(&x[0]);
+}
+
+void cmsmath::LBFGSMinimizer::gradient(std::vector<double> &x, double fx, std::vector<double> &grad) {
+    if (gradFunc_) {
+        nCalls_++;
+        gradFunc_->Gradient(&x[0], &grad[0]);
+        return;
+    }
+    // central differences, with a step small with respect to the expected uncertainty, or one-sided at the bounds
+    for (unsigned int i = 0, nf = free_.size(); i < nf; ++i) {
+        unsigned int j = free_[i];
+        const Var &v = vars_[j];
+        double x0 = x[j], h = std::max(1e-3 * v.step, 1e-8 * (1 + std::abs(x0)));
+        double xup = std::min(v.upper, x0 + h), xdn = std::max(v.lower, x0 - h);
+        x[j] = xup; double fup = (xup != x0 ? eval(x) : fx);
+        x[j] = xdn; double fdn = (xdn != x0 ? eval(x) : fx);
+        x[j] = x0;
+        grad[j] = (xup != xdn ? (fup - fdn)/(xup - xdn) : 0.);
+    }
+}
+
+bool cmsmath::LBFGSMinimizer::blocked(unsigned int i, const std::vector<double> &x, const std::vector<double> &grad) const {
+    unsigned int j = free_[i];
+    return (x[j] <= vars_[j].lower && grad[j] > 0) || (x[j] >= vars_[j].upper && grad[j] < 0);
+}
+
+void cmsmath::LBFGSMinimizer::direction(const std::vector<double> &x, const std::vector<double> &grad, std::vector<double> &dir) const {
+    unsigned int nf = free_.size(), m = s_.size();
+    std::vector<double> q(nf), alpha(m), rho(m);
+    for (unsigned int i = 0; i < nf; ++i) q[i] = blocked(i, x, grad) ? 0. : grad[free_[i]];
+    for (int k = m-1; k >= 0; --k) {
+        double sy = 0, sq = 0;
+        for (unsigned int i = 0; i < nf; ++i) { sy += s_[k][i]*y_[k][i]; sq += s_[k][i]*q[i]; }
+        rho[k] = 1.0/sy; alpha[k] = rho[k]*sq;
+        for (unsigned int i = 0; i < nf; ++i) q[i] -= alpha[k]*y_[k][i];
+    }
+    // initial inverse hessian: the usual scaling from the last pair, or the squared steps (i.e. the expected uncertainties) before any update
+    if (m > 0) {
+        double sy = 0, yy = 0;
+        for (unsigned int i = 0; i < nf; ++i) { sy += s_[m-1][i]*y_[m-1][i]; yy += y_[m-1][i]*y_[m-1][i]; }
+        for (unsigned int i = 0; i < nf; ++i) q[i] *= sy/yy;
+    } else {
+        for (unsigned int i = 0; i < nf; ++i) q[i] *= vars_[free_[i]].step * vars_[free_[i]].step;
+    }
+    for (unsigned int k = 0; k < m; ++k) {
+        double yr = 0;
+        for (unsigned int i = 0; i < nf; ++i) yr += y_[k][i]*q[i];
+        double beta = rho[k]*yr;
+        for (unsigned int i = 0; i < nf; ++i) q[i] += s_[k][i]*(alpha[k]-beta);
+    }
+    dir.resize(nf);
+    for (unsigned int i = 0; i < nf; ++i) dir[i] = blocked(i, x, grad) ? 0. : -q[i];
+}
+
+bool cmsmath::LBFGSMinimizer::Minimize() {
+    if (func_ == 0) throw std::logic_error("LBFGSMinimizer: function not set");
+    static int memory = runtimedef::get("LBFGS_memory");
+    unsigned int mmax = memory > 0 ? memory : 10;
+
+    free_.clear();
+    for (unsigned int j = 0, n = x_.size(); j < n; ++j) {
+        if (vars_[j].fixed) continue;
+        free_.push_back(j);
+        x_[j] = std::max(vars_[j].lower, std::min(vars_[j].upper, x_[j]));
+    }
+    unsigned int nf = free_.size();
+    s_.clear(); y_.clear(); nCalls_ = 0;
+    double fx = eval(x_);
+    gradient(x_, fx, grad_);
+
+    // same convergence criterion as Migrad
+    double edmTarget = 0.002 * (Tolerance() > 0 ? Tolerance() : 0.01) * ErrorDef();
+    unsigned int maxIter  = MaxIterations() > 0 ? MaxIterations() : 100 + 20 * nf;
+    // with numerical derivatives each gradient costs 2*nf calls, so allow for the same budget as Minuit2
+    unsigned int maxCalls = MaxFunctionCalls() > 0 ? MaxFunctionCalls() : (gradFunc_ ? 200 + 100 * nf : 200 + 100 * nf + 5 * nf * nf);
+    std::vector<double> dir(nf), xnew(x_), gnew(grad_.size()), s(nf), y(nf);
+    int status = 1;
+    for (unsigned int iter = 0; iter < maxIter; ++iter) {
+        direction(x_, grad_, dir);
+        double gd = 0;
+        for (unsigned int i = 0; i < nf; ++i) gd += grad_[free_[i]]*dir[i];
+        if (!(gd < 0) && !s_.empty()) {
+            // not a descent direction: forget the history and take a scaled gradient step
+            DEBUG_LBFGS_printf("LBFGS: iteration %u, not a descent direction, resetting\n", iter);
+            s_.clear(); y_.clear();
+            direction(x_, grad_, dir);
+            gd = 0;
+            for (unsigned int i = 0; i < nf; ++i) gd += grad_[free_[i]]*dir[i];
+        }
+        edm_ = std::max(0., -0.5*gd);
+        DEBUG_LBFGS_printf("LBFGS: iteration %u, f = %.10g, edm = %.4g, calls = %u\n", iter, fx, edm_, nCalls_);
+        if (edm_ < edmTarget) { status = 0; break; }
+
+        // backtracking line search, projecting on the box, with a sufficient decrease condition
+        double fnew = fx; bool ok = false;
+        for (double t = 1.0; t > 1e-12; t *= 0.5) {
+            double decrease = 0;
+            for (unsigned int i = 0; i < nf; ++i) {
+                unsigned int j = free_[i];
+                xnew[j] = project(i, x_[j] + t*dir[i]);
+                decrease += grad_[j]*(xnew[j]-x_[j]);
+            }
+            fnew = eval(xnew);
+            if (std::isfinite(fnew) && fnew <= fx + 1e-4*decrease) { ok = true; break; }
+        }
+        if (!ok) {
+            if (!s_.empty()) { s_.clear(); y_.clear(); continue; }
+            status = 3;
+            break;
+        }
+        gradient(xnew, fnew, gnew);
+        double sy = 0, ss = 0, yy = 0;
+        for (unsigned int i = 0; i < nf; ++i) {
+            unsigned int j = free_[i];
+            s[i] = xnew[j] - x_[j]; y[i] = gnew[j] - grad_[j];
+            sy += s[i]*y[i]; ss += s[i]*s[i]; yy += y[i]*y[i];
+        }
+        // keep only the pairs that preserve a positive definite approximation
+        if (sy > 1e-10 * std::sqrt(ss*yy)) {
+            s_.push_back(s); y_.push_back(y);
+            if (s_.size() > mmax) { s_.pop_front(); y_.pop_front(); }
+        }
+        x_.swap(xnew); grad_.swap(gnew); fx = fnew;
+        xnew = x_;
+        if (nCalls_ > maxCalls) break;
+    }
+    if (status != 0) DEBUG_LBFGS_printf("LBFGS: failed to converge (status %d), f = %.10g, edm = %.4g, calls = %u\n", status, fx, edm_, nCalls_);
+    minValue_ = eval(x_); // leave the function at the minimum
+    fStatus = status;
+    return status == 0;
+}
+
+#include <TPluginManager.h>
+namespace {
+    static int load_lbfgs() {
+        gPluginMgr->AddHandler("ROOT::Math::Minimizer", "LBFGS", "cmsmath::LBFGSMinimizer", "HiggsAnalysisCombinedLimit", "LBFGSMinimizer(const char *)");
+        return 1;
+    }
+    static int loaded_lbfgs = load_lbfgs();
+}
@@ -0,0 +1,3 @@
+#include "HiggsAnalysis/CombinedLimit/interface/Logging.h"
+
+std::atomic<int> logging::silenced_(0);
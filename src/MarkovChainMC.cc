@@ -1,7 +1,12 @@
 #include "HiggsAnalysis/CombinedLimit/interface/MarkovChainMC.h"
 #include <stdexcept> 
 #include <cmath> 
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <unistd.h>
 #include "TKey.h"
+#include "TFile.h"
 #include "RooRealVar.h"
 #include "RooArgSet.h"
 #include "RooUniform.h"
@@ -20,6 +25,8 @@ class THnSparse;
 #include "RooStats/RooStatsUtils.h"
 #include "HiggsAnalysis/CombinedLimit/interface/Combine.h"
 #include "HiggsAnalysis/CombinedLimit/interface/TestProposal.h"
+#include "HiggsAnalysis/CombinedLimit/interface/AdaptiveProposal.h"
+#include "HiggsAnalysis/CombinedLimit/interface/CascadeMinimizer.h"
 #include "HiggsAnalysis/CombinedLimit/interface/DebugProposal.h"
 #include "HiggsAnalysis/CombinedLimit/interface/CloseCoutSentry.h"
 #include "HiggsAnalysis/CombinedLimit/interface/RooFitGlobalKillSentry.h"
@@ -27,6 +34,7 @@ class THnSparse;
 
 #include "HiggsAnalysis/CombinedLimit/interface/ProfilingTools.h"
 #include "HiggsAnalysis/CombinedLimit/interface/utils.h"
+#include "HiggsAnalysis/CombinedLimit/interface/Checkpoint.h"
 
 using namespace RooStats;
 using namespace std;
@@ -42,11 +50,14 @@ unsigned int MarkovChainMC::burnInSteps_ = 200;
 float MarkovChainMC::burnInFraction_ = 0.25;
 bool  MarkovChainMC::adaptiveBurnIn_ = false;
 unsigned int MarkovChainMC::tries_ = 10;
+unsigned int MarkovChainMC::chainForks_ = 0;
+float MarkovChainMC::gelmanRubin_ = 0;
 float MarkovChainMC::truncatedMeanFraction_ = 0.0;
 bool MarkovChainMC::adaptiveTruncation_ = true;
 float MarkovChainMC::hintSafetyFactor_ = 5.;
 bool MarkovChainMC::saveChain_ = false;
 bool MarkovChainMC::noSlimChain_ = false;
+bool MarkovChainMC::nativeChain_ = false;
 bool MarkovChainMC::mergeChains_ = false;
 bool MarkovChainMC::readChains_ = false;
 float MarkovChainMC::proposalHelperWidthRangeDivisor_ = 5.;
@@ -62,11 +73,13 @@ MarkovChainMC::MarkovChainMC() :
     options_.add_options()
         ("iteration,i", boost::program_options::value<unsigned int>(&iterations_)->default_value(iterations_), "Number of iterations")
         ("tries", boost::program_options::value<unsigned int>(&tries_)->default_value(tries_), "Number of times to run the MCMC on the same data")
+        ("chainForks", boost::program_options::value<unsigned int>(&chainForks_)->default_value(chainForks_), "If > 1, run up to this number of tries at the same time in forked processes, each with its own random seed")
+        ("gelmanRubin", boost::program_options::value<float>(&gelmanRubin_)->default_value(gelmanRubin_), "If > 0, stop before doing all the tries once the Gelman-Rubin R of the POI among the completed chains is below this value (e.g. 1.05); it's checked after each try, or each batch of tries with --chainForks")
         ("burnInSteps,b", boost::program_options::value<unsigned int>(&burnInSteps_)->default_value(burnInSteps_), "Burn in steps (absolute number)")
         ("burnInFraction", boost::program_options::value<float>(&burnInFraction_)->default_value(burnInFraction_), "Burn in steps (fraction of total accepted steps)")
         ("adaptiveBurnIn", boost::program_options::value<bool>(&adaptiveBurnIn_)->default_value(adaptiveBurnIn_), "Adaptively determine burn in steps (experimental!).")
         ("proposal", boost::program_options::value<std::string>(&proposalTypeName_)->default_value(proposalTypeName_), 
-                              "Proposal function to use: 'fit', 'uniform', 'gaus', 'ortho' (also known as 'test')")
+                              "Proposal function to use: 'fit', 'uniform', 'gaus', 'ortho' (also known as 'test'), 'adaptive' (correlated moves, with the covariance from Hesse at the best fit, updated during the burn-in)")
         ("runMinos",          "Run MINOS when fitting the data")
         ("noReset",           "Don't reset variable state after fit")
         ("updateHint",        "Update hint with the results")
@@ -95,6 +108,7 @@ MarkovChainMC::MarkovChainMC() :
                 "set range of integration equal to this number of times the hinted limit")
         ("saveChain", "Save MarkovChain to output file")
         ("noSlimChain", "Include also nuisance parameters in the chain that is saved to file")
+        ("nativeChain", "Run the Metropolis-Hastings steps directly on the NLL (e.g. CachingSimNLL with --optimizeSimPdf), instead of through RooStats::MCMCCalculator")
         ("mergeChains", "Merge MarkovChains instead of averaging limits")
         ("readChains", "Just read MarkovChains from toysFile instead of running MCMC directly")
         ("discreteModelPoints",
@@ -109,6 +123,7 @@ void MarkovChainMC::applyOptions(const boost::program_options::variables_map &vm
     else if (proposalTypeName_ == "gaus")    proposalType_ = MultiGaussianP;
     else if (proposalTypeName_ == "ortho")   proposalType_ = TestP;
     else if (proposalTypeName_ == "test")    proposalType_ = TestP;
+    else if (proposalTypeName_ == "adaptive") proposalType_ = AdaptiveP;
     else {
         std::cerr << "MarkovChainMC: proposal type " << proposalTypeName_ << " not known." << "\n" << options_ << std::endl;
         throw std::invalid_argument("MarkovChainMC: unsupported proposal");
@@ -121,6 +136,7 @@ void MarkovChainMC::applyOptions(const boost::program_options::variables_map &vm
     mass_ = vm["mass"].as<float>();
     saveChain_   = vm.count("saveChain");
     noSlimChain_   = vm.count("noSlimChain");
+    nativeChain_   = vm.count("nativeChain");
     mergeChains_ = vm.count("mergeChains");
     readChains_  = vm.count("readChains");
 
@@ -148,16 +164,61 @@ bool MarkovChainMC::run(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::
   if (readChains_)  {
       readChains(*mc_s->GetParametersOfInterest(), limits);
   } else {
-      for (unsigned int i = 0; i < tries_; ++i) {
-          if (int nacc = runOnce(w,mc_s,mc_b,data,limit,limitErr,thehint)) {
-              suma += nacc;
-              if (verbose > 1) std::cout << "Limit from this run: " << limit << std::endl;
-              limits.push_back(limit);
-              if (updateHint_ && tries_ > 1 && limit > savhint) { 
-                if (verbose > 0) std::cout << "Updating hint from " << savhint << " to " << limit << std::endl;
-                savhint = limit; thehint = &savhint; 
+      // with forks, the seeds are drawn here so that each chain is the same whatever the number of processes
+      std::vector<UInt_t> seeds;
+      if (chainForks_ > 1) {
+          for (unsigned int i = 0; i < tries_; ++i) seeds.push_back(RooRandom::integer(std::numeric_limits<UInt_t>::max() - 1));
+      }
+      // with --resume, the results of the chains saved in the checkpoint are used instead of running them again
+      std::vector<Checkpoint::Record> saved;
+      if (Checkpoint::resuming()) {
+          Checkpoint::load("MarkovChainMC", saved);
+          if (!saved.empty() && (mergeChains_ || saveChain_)) std::cerr << "WARNING: the " << saved.size() << " chains from the checkpoint are not merged or saved, only their limits are used" << std::endl;
+      }
+      std::vector<ChainResult> stats, batch;
+      for (unsigned int i = 0; i < tries_; ) {
+          unsigned int nbatch = (chainForks_ > 1 ? std::min(tries_ - i, chainForks_) : 1);
+          if (i + nbatch <= saved.size()) {
+              batch.resize(nbatch);
+              for (unsigned int j = 0; j < nbatch; ++j) {
+                  const Checkpoint::Record &rec = saved[i+j];
+                  if (rec.key != TString::Format("try%u", i+j).Data() || rec.payload.size() != sizeof(ChainResult)) throw std::runtime_error("MarkovChainMC: the checkpoint doesn't match the chains of this job");
+                  memcpy(&batch[j], &rec.payload[0], sizeof(ChainResult));
+              }
+              Checkpoint::restoreRandom(saved[i+nbatch-1]);
+              if (verbose > 1) std::cout << "Chains " << i << "-" << (i+nbatch-1) << " from the checkpoint" << std::endl;
+          } else {
+              if (chainForks_ > 1) {
+                  runForked(w,mc_s,mc_b,data,thehint,seeds,i,nbatch,batch);
+              } else {
+                  batch.resize(1);
+                  batch[0].accepted = runOnce(w,mc_s,mc_b,data,limit,limitErr,thehint,gelmanRubin_ > 0 ? &batch[0] : 0);
+                  batch[0].limit = limit;
+              }
+              for (unsigned int j = 0; j < nbatch && Checkpoint::enabled(); ++j) {
+                  const char *bytes = reinterpret_cast<const char *>(&batch[j]);
+                  Checkpoint::save("MarkovChainMC", TString::Format("try%u", i+j).Data(), std::vector<char>(bytes, bytes + sizeof(ChainResult)));
+              }
+          }
+          for (unsigned int j = 0; j < nbatch; ++j) {
+              if (int nacc = batch[j].accepted) {
+                  limit = batch[j].limit;
+                  suma += nacc;
+                  if (verbose > 1) std::cout << "Limit from this run: " << limit << std::endl;
+                  limits.push_back(limit);
+                  stats.push_back(batch[j]);
+                  if (updateHint_ && tries_ > 1 && limit > savhint) { 
+                    if (verbose > 0) std::cout << "Updating hint from " << savhint << " to " << limit << std::endl;
+                    savhint = limit; thehint = &savhint; 
+                  }
               }
           }
+          i += nbatch;
+          if (gelmanRubin_ > 0 && stats.size() >= 2 && i < tries_) {
+              double rhat = gelmanRubin(stats);
+              if (verbose > 0) std::cout << "Gelman-Rubin R after " << stats.size() << " chains: " << rhat << std::endl;
+              if (rhat < gelmanRubin_) break;
+          }
       }
   } 
   num = limits.size();
@@ -187,7 +248,7 @@ bool MarkovChainMC::run(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::
   }
   return true;
 }
-int MarkovChainMC::runOnce(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, double &limit, double &limitErr, const double *hint) const {
+int MarkovChainMC::runOnce(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, double &limit, double &limitErr, const double *hint, ChainResult *stats, RooStats::MarkovChain **keepChain) const {
   RooArgList poi(*mc_s->GetParametersOfInterest());
   RooRealVar *r = dynamic_cast<RooRealVar *>(poi.first());
 
@@ -199,15 +260,25 @@ int MarkovChainMC::runOnce(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStat
     throw std::logic_error("MarkovChainMC: running with systematics enabled, but nuisances not defined.");
   }
   
-  w->loadSnapshot("clean");
+  utils::loadSnapshot(w, "clean");
   std::auto_ptr<RooFitResult> fit(0);
-  if (proposalType_ == FitP || (cropNSigmas_ > 0)) {
+  if (proposalType_ == FitP || proposalType_ == AdaptiveP || (cropNSigmas_ > 0)) {
       CloseCoutSentry coutSentry(verbose <= 1); // close standard output and error, so that we don't flood them with minuit messages
-      fit.reset(mc_s->GetPdf()->fitTo(data, RooFit::Save(), RooFit::Minos(runMinos_)));
+      if (proposalType_ == AdaptiveP) {
+          const RooCmdArg &constrain = withSystematics ? RooFit::Constrain(*mc_s->GetNuisanceParameters()) : RooCmdArg::none();
+          std::auto_ptr<RooAbsReal> nll(mc_s->GetPdf()->createNLL(data, constrain, RooFit::Extended(mc_s->GetPdf()->canBeExtended())));
+          CascadeMinimizer minim(*nll, CascadeMinimizer::Unconstrained, r);
+          if (minim.minimize(verbose-2)) {
+              minim.minimizer().hesse();
+              fit.reset(minim.save());
+          }
+      } else {
+          fit.reset(mc_s->GetPdf()->fitTo(data, RooFit::Save(), RooFit::Minos(runMinos_)));
+      }
       coutSentry.clear();
       if (fit.get() == 0) { std::cerr << "Fit failed." << std::endl; return false; }
       if (verbose > 1) fit->Print("V");
-      if (!noReset_) w->loadSnapshot("clean");
+      if (!noReset_) utils::loadSnapshot(w, "clean");
   }
 
   if (cropNSigmas_ > 0) {
@@ -272,6 +343,34 @@ int MarkovChainMC::runOnce(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStat
         }
         pdfProp = ownedPdfProp.get();
         break;
+    case AdaptiveP:
+        {
+            if (verbose) std::cout << "Using adaptive proposal" << std::endl;
+            // covariance from the fit where available, and otherwise uncorrelated moves as for 'ortho'
+            RooArgList vars(poi);
+            if (withSystematics) vars.add(*mc_s->GetNuisanceParameters());
+            const RooArgList &fpf = fit->floatParsFinal();
+            const TMatrixDSym &fitCov = fit->covarianceMatrix();
+            int n = vars.getSize();
+            TMatrixDSym cov(n);
+            for (int i = 0; i < n; ++i) {
+                RooRealVar *vi = (RooRealVar *) vars.at(i);
+                int fi = fpf.index(vi->GetName());
+                if (fi == -1) { 
+                    double len = vi->getMax() - vi->getMin();
+                    cov(i,i) = std::pow(len / proposalHelperWidthRangeDivisor_, 2); 
+                    continue; 
+                }
+                for (int j = 0; j < n; ++j) {
+                    int fj = fpf.index(vars.at(j)->GetName());
+                    if (fj != -1) cov(i,j) = fitCov(fi,fj);
+                }
+            }
+            // adapt only during the first burnInSteps_ proposals, whose points are always discarded
+            ownedPdfProp.reset(new AdaptiveProposal(vars, cov, burnInSteps_));
+            pdfProp = ownedPdfProp.get();
+        }
+        break;
   }
   if (proposalType_ != UniformP) {
       ph.SetUpdateProposalParameters(updateProposalParams_);
@@ -280,64 +379,224 @@ int MarkovChainMC::runOnce(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStat
 
   std::auto_ptr<DebugProposal> pdfDebugProp(debugProposal_ > 0 ? new DebugProposal(pdfProp, mc_s->GetPdf(), &data, debugProposal_) : 0);
   
-  MCMCCalculator mc(data, *mc_s);
-  mc.SetNumIters(iterations_); 
-  mc.SetConfidenceLevel(cl);
-  mc.SetNumBurnInSteps(burnInSteps_); 
-  mc.SetProposalFunction(debugProposal_ > 0 ? *pdfDebugProp : *pdfProp);
-  mc.SetLeftSideTailFraction(0);
-
-  if (typeid(*mc_s->GetPriorPdf()) == typeid(RooUniform)) {
-    mc.SetPriorPdf(*((RooAbsPdf *)0));
-  }
-
   std::auto_ptr<MCMCInterval> mcInt;
-  try {  
-      mcInt.reset((MCMCInterval*)mc.GetInterval()); 
-  } catch (std::length_error &ex) {
-      mcInt.reset(0);
-  }
-  if (mcInt.get() == 0) return false;
-
-  // MCMCCalculator calls SetConfidenceLevel on MCMCInterval when creating it
-  // SetConfidenceLevel calls DetermineInterval, which compute the interval from the Markov Chain
-  // for a given confidence level. This results is cached, so if we change the number of burn-in steps
-  // after, it'll have no effect
-  // Clone the MCMCInterval to reset its state, set the number of burn-in steps before calling SetConfidenceLevel
-
-  MCMCInterval* oldInterval = mcInt.get();
-  RooStats::MarkovChain* clonedChain = slimChain(*mc_s->GetParametersOfInterest(), *oldInterval->GetChain());
-  MCMCInterval* newInterval = new MCMCInterval(TString("MCMCIntervalCloned_") + TString(mc.GetName()), RooArgSet(*mc_s->GetParametersOfInterest()), *clonedChain);
-  newInterval->SetUseKeys(oldInterval->GetUseKeys());
-  newInterval->SetIntervalType(oldInterval->GetIntervalType());
-  if (newInterval->GetIntervalType() == MCMCInterval::kTailFraction) {
+  if (nativeChain_) {
+    RooStats::MarkovChain *chain = runNativeChain(mc_s, data, debugProposal_ > 0 ? *pdfDebugProp : *pdfProp);
+    if (chain == 0) return false;
+    MCMCInterval* newInterval = new MCMCInterval("MCMCIntervalNative", RooArgSet(*mc_s->GetParametersOfInterest()), *chain);
+    newInterval->SetUseKeys(false);
+    newInterval->SetIntervalType(MCMCInterval::kTailFraction);
     newInterval->SetLeftSideTailFraction(0);
-  }
-  newInterval->SetNumBurnInSteps(burnInSteps_);
+    // the same burn-in as for the stats below (--burnInFraction, --adaptiveBurnIn), set before the interval is computed
+    newInterval->SetNumBurnInSteps(adaptiveBurnIn_ ? guessBurnInSteps(*chain) : max<int>(burnInSteps_, chain->Size() * burnInFraction_));
+    newInterval->SetConfidenceLevel(cl);
+    mcInt.reset(newInterval);
+  } else {
+    MCMCCalculator mc(data, *mc_s);
+    mc.SetNumIters(iterations_); 
+    mc.SetConfidenceLevel(cl);
+    mc.SetNumBurnInSteps(burnInSteps_); 
+    mc.SetProposalFunction(debugProposal_ > 0 ? *pdfDebugProp : *pdfProp);
+    mc.SetLeftSideTailFraction(0);
+
+    if (typeid(*mc_s->GetPriorPdf()) == typeid(RooUniform)) {
+      mc.SetPriorPdf(*((RooAbsPdf *)0));
+    }
 
-  if (adaptiveBurnIn_) {
-    mcInt->SetNumBurnInSteps(guessBurnInSteps(*mcInt->GetChain()));
-  } else if (mcInt->GetChain()->Size() * burnInFraction_ > burnInSteps_) {
-    mcInt->SetNumBurnInSteps(mcInt->GetChain()->Size() * burnInFraction_);
-  }
-  newInterval->SetConfidenceLevel(oldInterval->ConfidenceLevel());
+    try {  
+        mcInt.reset((MCMCInterval*)mc.GetInterval()); 
+    } catch (std::length_error &ex) {
+        mcInt.reset(0);
+    }
+    if (mcInt.get() == 0) return false;
+
+    // MCMCCalculator calls SetConfidenceLevel on MCMCInterval when creating it
+    // SetConfidenceLevel calls DetermineInterval, which compute the interval from the Markov Chain
+    // for a given confidence level. This results is cached, so if we change the number of burn-in steps
+    // after, it'll have no effect
+    // Clone the MCMCInterval to reset its state, set the number of burn-in steps before calling SetConfidenceLevel
+
+    MCMCInterval* oldInterval = mcInt.get();
+    RooStats::MarkovChain* clonedChain = slimChain(*mc_s->GetParametersOfInterest(), *oldInterval->GetChain());
+    MCMCInterval* newInterval = new MCMCInterval(TString("MCMCIntervalCloned_") + TString(mc.GetName()), RooArgSet(*mc_s->GetParametersOfInterest()), *clonedChain);
+    newInterval->SetUseKeys(oldInterval->GetUseKeys());
+    newInterval->SetIntervalType(oldInterval->GetIntervalType());
+    if (newInterval->GetIntervalType() == MCMCInterval::kTailFraction) {
+      newInterval->SetLeftSideTailFraction(0);
+    }
+    newInterval->SetNumBurnInSteps(burnInSteps_);
 
-  mcInt.reset(newInterval);
+    if (adaptiveBurnIn_) {
+      mcInt->SetNumBurnInSteps(guessBurnInSteps(*mcInt->GetChain()));
+    } else if (mcInt->GetChain()->Size() * burnInFraction_ > burnInSteps_) {
+      mcInt->SetNumBurnInSteps(mcInt->GetChain()->Size() * burnInFraction_);
+    }
+    newInterval->SetConfidenceLevel(oldInterval->ConfidenceLevel());
+
+    mcInt.reset(newInterval);
+  }
 
   limit = mcInt->UpperLimit(*r);
 
+  if (stats) {
+      const RooStats::MarkovChain &chain = *mcInt->GetChain();
+      int burnIn = adaptiveBurnIn_ ? guessBurnInSteps(chain) : max<int>(burnInSteps_, chain.Size() * burnInFraction_);
+      double sumw = 0, sumx = 0, sumx2 = 0;
+      for (int i = burnIn, n = chain.Size(); i < n; ++i) {
+          double x = chain.Get(i)->getRealValue(r->GetName()), wi = chain.Weight();
+          sumw += wi; sumx += wi*x; sumx2 += wi*x*x;
+      }
+      stats->weight = sumw;
+      stats->mean   = (sumw > 0 ? sumx/sumw : 0);
+      stats->var    = (sumw > 1 ? (sumx2 - sumw*stats->mean*stats->mean)/(sumw - 1) : 0);
+  }
+
   if (saveChain_ || mergeChains_) {
       // Copy-constructors don't work properly, so we just have to leak memory.
       //RooStats::MarkovChain *chain = new RooStats::MarkovChain(*mcInt->GetChain());
       RooStats::MarkovChain *chain = slimChain(*mc_s->GetParametersOfInterest(), *mcInt->GetChain());
-      if (mergeChains_) chains_.Add(chain);
-      if (saveChain_)  writeToysHere->WriteTObject(chain,  TString::Format("MarkovChain_mh%g_%u",mass_, RooRandom::integer(std::numeric_limits<UInt_t>::max() - 1)));
+      if (keepChain) *keepChain = chain;
+      else storeChain(chain);
       return chain->Size();
   } else {
       return mcInt->GetChain()->Size();
   }
 }
 
+RooStats::MarkovChain *MarkovChainMC::runNativeChain(RooStats::ModelConfig *mc_s, RooAbsData &data, RooStats::ProposalFunction &proposal) const {
+  RooArgSet params(*mc_s->GetParametersOfInterest());
+  if (withSystematics) params.add(*mc_s->GetNuisanceParameters());
+  const RooCmdArg &constrain = withSystematics ? RooFit::Constrain(*mc_s->GetNuisanceParameters()) : RooCmdArg::none();
+  std::auto_ptr<RooAbsReal> nll(mc_s->GetPdf()->createNLL(data, constrain, RooFit::Extended(mc_s->GetPdf()->canBeExtended())));
+  RooAbsPdf *prior = (mc_s->GetPriorPdf() && typeid(*mc_s->GetPriorPdf()) != typeid(RooUniform) ? mc_s->GetPriorPdf() : 0);
+
+  // the proposal moves snapshots of the parameters, which are copied into the parameters of the NLL
+  RooArgSet x, xPrime;
+  params.snapshot(x); params.snapshot(xPrime);
+  std::vector<RooRealVar *> vars, xVars, primeVars;
+  std::vector<unsigned int> kept;
+  RooArgSet keptSet;
+  RooLinkedListIter iter = params.iterator();
+  for (RooAbsArg *a = (RooAbsArg *) iter.Next(); a != 0; a = (RooAbsArg *) iter.Next()) {
+      RooRealVar *rrv = dynamic_cast<RooRealVar *>(a);
+      if (rrv == 0) continue;
+      if (noSlimChain_ || mc_s->GetParametersOfInterest()->find(rrv->GetName())) { kept.push_back(vars.size()); keptSet.add(*rrv); }
+      vars.push_back(rrv);
+      xVars.push_back((RooRealVar *) x.find(rrv->GetName()));
+      primeVars.push_back((RooRealVar *) xPrime.find(rrv->GetName()));
+  }
+  unsigned int nvars = vars.size(), nkept = kept.size();
+
+  // the chain: one entry per accepted point, with the number of steps spent there as weight
+  std::vector<double> points, nlls, weights;
+  points.reserve(nkept * iterations_ / 4); nlls.reserve(iterations_ / 4); weights.reserve(iterations_ / 4);
+
+  double nllx = nll->getVal() - (prior ? std::log(prior->getVal()) : 0), weight = 1;
+  if (!std::isfinite(nllx)) { std::cerr << "MarkovChainMC: the NLL is not finite at the starting point" << std::endl; return 0; }
+  bool symmetric = proposal.IsSymmetric(xPrime, x);
+  for (unsigned int i = 0; i < iterations_; ++i) {
+      proposal.Propose(xPrime, x);
+      for (unsigned int k = 0; k < nvars; ++k) vars[k]->setVal(primeVars[k]->getVal());
+      double nllp = nll->getVal() - (prior ? std::log(prior->getVal()) : 0);
+      if (!std::isfinite(nllp)) { weight += 1; continue; }
+      double logAlpha = nllx - nllp;
+      if (!symmetric) logAlpha += std::log(proposal.GetProposalDensity(x, xPrime)) - std::log(proposal.GetProposalDensity(xPrime, x));
+      if (logAlpha >= 0 || std::log(RooRandom::uniform()) < logAlpha) {
+          for (unsigned int k = 0; k < nkept; ++k) points.push_back(xVars[kept[k]]->getVal());
+          nlls.push_back(nllx); weights.push_back(weight);
+          for (unsigned int k = 0; k < nvars; ++k) xVars[k]->setVal(primeVars[k]->getVal());
+          nllx = nllp; weight = 1;
+      } else {
+          weight += 1;
+      }
+  }
+  for (unsigned int k = 0; k < nkept; ++k) points.push_back(xVars[kept[k]]->getVal());
+  nlls.push_back(nllx); weights.push_back(weight);
+  params.assignValueOnly(x);
+
+  // conversion to the RooStats format, only once at the end
+  RooArgSet entry; keptSet.snapshot(entry);
+  std::vector<RooRealVar *> entryVars;
+  for (unsigned int k = 0; k < nkept; ++k) entryVars.push_back((RooRealVar *) entry.find(vars[kept[k]]->GetName()));
+  RooStats::MarkovChain *chain = new RooStats::MarkovChain("", "", keptSet);
+  for (unsigned int i = 0, n = nlls.size(); i < n; ++i) {
+      for (unsigned int k = 0; k < nkept; ++k) entryVars[k]->setVal(points[i*nkept+k]);
+      if (i) chain->AddFast(entry, nlls[i], weights[i]);
+      else   chain->Add(entry, nlls[i], weights[i]);
+  }
+  return chain;
+}
+
+void MarkovChainMC::storeChain(RooStats::MarkovChain *chain) const {
+  if (mergeChains_) chains_.Add(chain);
+  if (saveChain_) {
+      std::unique_lock<std::mutex> lock(Combine::lockOutput());
+      writeToysHere->WriteTObject(chain,  TString::Format("MarkovChain_mh%g_%u",mass_, RooRandom::integer(std::numeric_limits<UInt_t>::max() - 1)));
+  }
+}
+
+void MarkovChainMC::runForked(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, const double *hint, const std::vector<UInt_t> &seeds, unsigned int first, unsigned int n, std::vector<ChainResult> &results) const {
+  results.assign(n, ChainResult());
+  bool withChains = (saveChain_ || mergeChains_);
+  // the chains come back through ROOT files, the rest of the result through utils::runInForks
+  char tmpfile[999]; snprintf(tmpfile, 998, "%s/mcmc-XXXXXX", P_tmpdir);
+  int fd = mkstemp(tmpfile);
+  if (fd == -1) throw std::runtime_error(std::string("MarkovChainMC: can't make a temporary file in ")+P_tmpdir);
+  close(fd);
+  std::vector<std::vector<double> > records;
+  unsigned int nfailed = utils::runInForks(0, n, [&](unsigned int k) -> std::vector<double> {
+      // the child: one chain with its own random stream
+      RooRandom::randomGenerator()->SetSeed(seeds[first+k]);
+      ChainResult res = { 0, 0., 0., 0., 0. };
+      RooStats::MarkovChain *chain = 0;
+      double limit, limitErr;
+      res.accepted = runOnce(w,mc_s,mc_b,data,limit,limitErr,hint,&res,withChains ? &chain : 0);
+      res.limit = limit;
+      if (chain) {
+          TFile *fout = TFile::Open(TString::Format("%s.%u.root", tmpfile, k), "RECREATE");
+          if (fout == 0 || fout->WriteTObject(chain, "chain") <= 0) throw std::runtime_error(TString::Format("can't save the chain of try %u", first+k).Data());
+          fout->Close();
+      }
+      std::vector<double> record(5);
+      record[0] = res.accepted; record[1] = res.limit; record[2] = res.mean; record[3] = res.var; record[4] = res.weight;
+      return record;
+  }, records, false, verbose > 1);
+  // collect in order of the tries, so that chains_ stays aligned with the limits
+  for (unsigned int k = 0; k < n; ++k) {
+      const std::vector<double> &record = records[k];
+      if (record.size() == 5) {
+          ChainResult res = { int(record[0]), record[1], record[2], record[3], record[4] };
+          results[k] = res;
+      } else {
+          results[k].accepted = 0;
+      }
+      if (results[k].accepted && withChains) {
+          // the file is not closed, as the chain may still read from it
+          TFile *fin = TFile::Open(TString::Format("%s.%u.root", tmpfile, k));
+          RooStats::MarkovChain *chain = fin ? dynamic_cast<RooStats::MarkovChain *>(fin->Get("chain")) : 0;
+          if (chain) storeChain(chain);
+          else results[k].accepted = 0;
+      }
+      unlink(TString::Format("%s.%u.root", tmpfile, k).Data());
+  }
+  unlink(tmpfile);
+  if (nfailed) std::cerr << "WARNING: MarkovChainMC: " << nfailed << " of the " << n << " chains run in forked processes failed, and are not used." << std::endl;
+}
+
+double MarkovChainMC::gelmanRubin(const std::vector<ChainResult> &chains) const {
+  // R = sqrt( ((n-1)/n W + B/n) / W ), with W the mean of the variances within each chain,
+  // B/n the variance of the means of the chains, and n the average length of the chains
+  unsigned int m = chains.size();
+  double n = 0, W = 0, mean = 0;
+  for (unsigned int j = 0; j < m; ++j) { n += chains[j].weight; W += chains[j].var; mean += chains[j].mean; }
+  n /= m; W /= m; mean /= m;
+  double Bn = 0;
+  for (unsigned int j = 0; j < m; ++j) Bn += (chains[j].mean - mean)*(chains[j].mean - mean);
+  Bn /= (m - 1);
+  if (!(W > 0) || !(n > 1)) return std::numeric_limits<double>::infinity();
+  return std::sqrt(((n-1)/n * W + Bn)/W);
+}
+
 void MarkovChainMC::limitAndError(double &limit, double &limitErr, const std::vector<double> &limitsIn) const {
   std::vector<double> limits(limitsIn);
   int num = limits.size();
@@ -518,6 +777,8 @@ MarkovChainMC::guessBurnInSteps(const RooStats::MarkovChain &chain) const
     for (start = n-1; start >= 0; --start) {
        if (nll[start] > maxcut) break;
     }
+    // the adaptive proposal is still changing during the first burnInSteps_ proposals, so those are always discarded
+    if (proposalType_ == AdaptiveP) start = std::max<int>(start, burnInSteps_);
     return start;
 }
 
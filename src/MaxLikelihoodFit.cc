@@ -16,6 +16,7 @@
 #include "TCanvas.h"
 #include "TStyle.h"
 #include "TH2.h"
+#include "TDecompChol.h"
 #include "TFile.h"
 #include <RooStats/ModelConfig.h>
 #include "HiggsAnalysis/CombinedLimit/interface/Combine.h"
@@ -23,11 +24,15 @@
 #include "HiggsAnalysis/CombinedLimit/interface/ProfiledLikelihoodRatioTestStatExt.h"
 #include "HiggsAnalysis/CombinedLimit/interface/CloseCoutSentry.h"
 #include "HiggsAnalysis/CombinedLimit/interface/utils.h"
+#include "HiggsAnalysis/CombinedLimit/interface/VerticalInterpHistPdf.h"
 
 
 #include <Math/MinimizerOptions.h>
 
 #include <iomanip>
+#include <memory>
+#include <cstdio>
+#include <unistd.h>
 using namespace RooStats;
 
 std::string MaxLikelihoodFit::name_ = "";
@@ -37,6 +42,8 @@ bool        MaxLikelihoodFit::makePlots_ = false;
 bool        MaxLikelihoodFit::saveWorkspace_ = false;
 float       MaxLikelihoodFit::rebinFactor_ = 1.0;
 int         MaxLikelihoodFit::numToysForShapes_ = 200;
+int         MaxLikelihoodFit::shapeForks_ = 0;
+bool        MaxLikelihoodFit::linearShapeErrors_ = false;
 std::string MaxLikelihoodFit::signalPdfNames_     = "shapeSig*";
 std::string MaxLikelihoodFit::filterString_     = "";
 std::string MaxLikelihoodFit::backgroundPdfNames_ = "shapeBkg*";
@@ -50,6 +57,8 @@ bool        MaxLikelihoodFit::skipBOnlyFit_ = false;
 bool        MaxLikelihoodFit::noErrors_ = false;
 bool        MaxLikelihoodFit::reuseParams_ = false;
 bool        MaxLikelihoodFit::customStartingPoint_ = false;
+bool        MaxLikelihoodFit::parallelFits_ = false;
+bool        MaxLikelihoodFit::lightToyFits_ = false;
 
 
 MaxLikelihoodFit::MaxLikelihoodFit() :
@@ -74,12 +83,16 @@ MaxLikelihoodFit::MaxLikelihoodFit() :
         ("saveOverallShapes",  "Save total shapes (and covariance if used with saveWithUncertainties) across all channels")
         ("saveWithUncertainties",  "Save also post-fit uncertainties on the shapes and normalizations (from resampling the covariance matrix)")
         ("numToysForShapes", boost::program_options::value<int>(&numToysForShapes_)->default_value(numToysForShapes_),  "Choose number of toys for re-sampling of the covariance (for shapes with uncertainties)")
+        ("shapeForks", boost::program_options::value<int>(&shapeForks_)->default_value(shapeForks_),  "Evaluate the shapes for the uncertainties in this number of forked processes")
+        ("linearShapeErrors",  "Propagate the covariance of the fit linearly to the shapes and normalizations, evaluating them at 2N points (N = floating parameters) instead of re-sampling")
         ("filterString", boost::program_options::value<std::string>(&filterString_)->default_value(filterString_), "Filter to search for when making covariance and shapes")
         ("justFit",  "Just do the S+B fit, don't do the B-only one, don't save output file")
         ("skipBOnlyFit",  "Skip the B-only fit (do only the S+B fit)")
         ("noErrors",  "Don't compute uncertainties on the best fit value")
         ("initFromBonly",  "Use the values of the nuisance parameters from the background only fit as the starting point for the s+b fit")
         ("customStartingPoint",  "Don't set the signal model parameters to zero before the fit")
+        ("parallelFits",  "Run the S+B fit in a forked process, at the same time as the B-only fit and its outputs (not with --initFromBonly)")
+        ("lightToyFits",  "In the toys after the first one, keep only the status, the NLL and the POIs of each fit instead of a full RooFitResult (not with --plots, --saveNormalizations or --parallelFits, which need it)")
    ;
 
     // setup a few defaults
@@ -109,12 +122,15 @@ void MaxLikelihoodFit::applyOptions(const boost::program_options::variables_map
     saveNormalizations_  = saveShapes_ || vm.count("saveNormalizations");
     oldNormNames_  = vm.count("oldNormNames");
     saveWithUncertainties_  = vm.count("saveWithUncertainties");
+    linearShapeErrors_  = vm.count("linearShapeErrors");
     saveWorkspace_ = vm.count("saveWorkspace");
     justFit_  = vm.count("justFit");
     skipBOnlyFit_ = vm.count("skipBOnlyFit");
     noErrors_ = vm.count("noErrors");
     reuseParams_ = vm.count("initFromBonly");
     customStartingPoint_ = vm.count("customStartingPoint");
+    parallelFits_ = vm.count("parallelFits");
+    lightToyFits_ = vm.count("lightToyFits");
      
     if (justFit_) { out_ = "none"; makePlots_ = false; saveNormalizations_ = false; reuseParams_ = false;}
     // For now default this to true;
@@ -193,100 +209,155 @@ bool MaxLikelihoodFit::runSpecific(RooWorkspace *w, RooStats::ModelConfig *mc_s,
   RooFitResult *res_b = 0, *res_s = 0;
   const RooCmdArg &constCmdArg_s = withSystematics  ? RooFit::Constrain(*mc_s->GetNuisanceParameters()) : RooFit::NumCPU(1); // use something dummy 
   //const RooCmdArg &minosCmdArg = minos_ == "poi" ?  RooFit::Minos(*mc_s->GetParametersOfInterest())   : RooFit::Minos(minos_ != "none");  //--> dont use fitTo!
-  w->loadSnapshot("clean");
+  utils::loadSnapshot(w, "clean");
   if (!customStartingPoint_) r->setVal(0.0); 
   r->setConstant(true);
 
-  // Setup Nll before calling fits;
-  if (currentToy_<1) nll.reset(mc_s->GetPdf()->createNLL(data,constCmdArg_s,RooFit::Extended(mc_s->GetPdf()->canBeExtended())));
+  // Setup Nll before calling fits (for toys, the one of the previous toy with the new data); without offset, as it always was here
+  setupNLL(*mc_s->GetPdf(), data, constCmdArg_s, /*reuse=*/true, /*offset=*/false);
   // Get the nll value on the prefit
   double nll0 = nll->getVal();
 
-  if (justFit_ || skipBOnlyFit_ ) { 
-    // skip b-only fit
-  } else if (minos_ != "all") {
-    RooArgList minos; 
-    res_b = doFit(*mc_s->GetPdf(), data, minos, constCmdArg_s, /*hesse=*/true,/*ndim*/1,/*reuseNLL*/ true); 
-    nll_bonly_=nll->getVal()-nll0;   
-  } else {
-    CloseCoutSentry sentry(verbose < 2);
-    RooArgList minos = (*mc_s->GetNuisanceParameters()); 
-    res_b = doFit(*mc_s->GetPdf(), data, minos, constCmdArg_s, /*hesse=*/true,/*ndim*/1,/*reuseNLL*/ true); 
-
-    if (res_b) nll_bonly_ = nll->getVal() - nll0;
+  // the toys after the first need only the status, the NLL and the POIs of the fits, unless the outputs need the full result
+  bool light = lightToyFits_ && currentToy_ >= 1 && !saveNormalizations_ && !makePlots_ && !(parallelFits_ && !reuseParams_ && !justFit_ && !skipBOnlyFit_);
+  if (light && toySummary_.size() == 0) toySummary_.setParameters(RooArgList(*mc_s->GetParametersOfInterest()));
+  fitSummary_ = (light ? &toySummary_ : 0);
+
+  // the B-only fit and its outputs
+  auto fitB = [&]() {
+    if (justFit_ || skipBOnlyFit_ ) { 
+      // skip b-only fit
+    } else if (minos_ != "all") {
+      RooArgList minos; 
+      res_b = doFit(*mc_s->GetPdf(), data, minos, constCmdArg_s, /*hesse=*/true,/*ndim*/1,/*reuseNLL*/ true); 
+      nll_bonly_=nll->getVal()-nll0;   
+    } else {
+      CloseCoutSentry sentry(verbose < 2);
+      RooArgList minos = (*mc_s->GetNuisanceParameters()); 
+      res_b = doFit(*mc_s->GetPdf(), data, minos, constCmdArg_s, /*hesse=*/true,/*ndim*/1,/*reuseNLL*/ true); 
+
+      if (res_b) nll_bonly_ = nll->getVal() - nll0;
 
-  }
+    }
 
-  if (res_b) { 
-      if (verbose > 1) res_b->Print("V");
-      if (fitOut.get()) {
-	 if (currentToy_< 1)	fitOut->WriteTObject(res_b,"fit_b");
-	 if (withSystematics)	{
-		setFitResultTrees(mc_s->GetNuisanceParameters(),nuisanceParameters_);
-		setFitResultTrees(mc_s->GetGlobalObservables(),globalObservables_);
-	 }
-	 fitStatus_ = res_b->status();
-      }
-      numbadnll_=res_b->numInvalidNLL();
+    if (res_b) { 
+        if (verbose > 1 && !light) res_b->Print("V");
+        if (fitOut.get()) {
+            if (currentToy_< 1) fitOut->WriteTObject(res_b,"fit_b");
+            if (withSystematics) {
+                setFitResultTrees(mc_s->GetNuisanceParameters(),nuisanceParameters_);
+                setFitResultTrees(mc_s->GetGlobalObservables(),globalObservables_);
+            }
+            fitStatus_ = (light ? toySummary_.status() : res_b->status());
+        }
+        numbadnll_ = (light ? toySummary_.numInvalidNLL() : res_b->numInvalidNLL());
+
+        if (makePlots_) {
+            std::vector<RooPlot *> plots = utils::makePlots(*mc_b->GetPdf(), data, signalPdfNames_.c_str(), backgroundPdfNames_.c_str(), rebinFactor_);
+            for (std::vector<RooPlot *>::iterator it = plots.begin(), ed = plots.end(); it != ed; ++it) {
+                c1->cd(); (*it)->Draw(); 
+                c1->Print((out_+"/"+(*it)->GetName()+"_fit_b.png").c_str());
+                if (fitOut.get() && currentToy_< 1) fitOut->WriteTObject(*it, (std::string((*it)->GetName())+"_fit_b").c_str());
+            }
+        }
 
-      if (makePlots_) {
-          std::vector<RooPlot *> plots = utils::makePlots(*mc_b->GetPdf(), data, signalPdfNames_.c_str(), backgroundPdfNames_.c_str(), rebinFactor_);
-          for (std::vector<RooPlot *>::iterator it = plots.begin(), ed = plots.end(); it != ed; ++it) {
-              c1->cd(); (*it)->Draw(); 
-              c1->Print((out_+"/"+(*it)->GetName()+"_fit_b.png").c_str());
-              if (fitOut.get() && currentToy_< 1) fitOut->WriteTObject(*it, (std::string((*it)->GetName())+"_fit_b").c_str());
-          }
-      }
+        if (saveNormalizations_) {
+            RooArgSet *norms = new RooArgSet();
+            norms->setName("norm_fit_b");
+            CovarianceReSampler sampler(res_b);
+            getNormalizations(mc_s->GetPdf(), *mc_s->GetObservables(), *norms, sampler, currentToy_<1 ? fitOut.get() : 0, "_fit_b",data);
+            setNormsFitResultTrees(norms,processNormalizations_);
+            delete norms;
+        }
 
-      if (saveNormalizations_) {
-          RooArgSet *norms = new RooArgSet();
-          norms->setName("norm_fit_b");
-          CovarianceReSampler sampler(res_b);
-          getNormalizations(mc_s->GetPdf(), *mc_s->GetObservables(), *norms, sampler, currentToy_<1 ? fitOut.get() : 0, "_fit_b",data);
-          setNormsFitResultTrees(norms,processNormalizations_);
-	  delete norms;
-      }
+        if (makePlots_ && currentToy_<1)  {
+            TH2 *corr = res_b->correlationHist();
+            c1->SetLeftMargin(0.25);  c1->SetBottomMargin(0.25);
+            corr->SetTitle("Correlation matrix of fit parameters");
+            gStyle->SetPaintTextFormat(res_b->floatParsFinal().getSize() > 10 ? ".1f" : ".2f");
+            gStyle->SetOptStat(0);
+            corr->SetMarkerSize(res_b->floatParsFinal().getSize() > 10 ? 2 : 1);
+            corr->Draw("COLZ TEXT");
+            c1->Print((out_+"/covariance_fit_b.png").c_str());
+            c1->SetLeftMargin(0.16);  c1->SetBottomMargin(0.13);
+            if (fitOut.get()) fitOut->WriteTObject(corr, "covariance_fit_b");
+        }
+    }
+    else {
+        fitStatus_=-1;
+        numbadnll_=-1;
+    }
+    mu_=r->getVal();
+    if (t_fit_b_) t_fit_b_->Fill();
+    // no longer need res_b
+    delete res_b;
+  };
+
+  // the S+B fit, from the clean snapshot unless --initFromBonly
+  auto fitS = [&]() {
+    if (!reuseParams_) utils::loadSnapshot(w, "clean"); // Reset, also ensures nll_prefit is same in call to doFit for b and s+b
+    r->setVal(preFitValue_); r->setConstant(false); 
+    if (minos_ != "all") {
+      RooArgList minos; if (minos_ == "poi") minos.add(*r);
+      res_s = doFit(*mc_s->GetPdf(), data, minos, constCmdArg_s, /*hesse=*/!noErrors_,/*ndim*/1,/*reuseNLL*/ true); 
+      nll_sb_ = nll->getVal()-nll0;
+    } else {
+      CloseCoutSentry sentry(verbose < 2);
+      RooArgList minos = (*mc_s->GetNuisanceParameters()); 
+      minos.add((*mc_s->GetParametersOfInterest()));  // Add POI this time 
+      res_s = doFit(*mc_s->GetPdf(), data, minos, constCmdArg_s, /*hesse=*/true,/*ndim*/1,/*reuseNLL*/ true); 
+      if (res_s) nll_sb_= nll->getVal()-nll0;
 
-      if (makePlots_ && currentToy_<1)  {
-	  TH2 *corr = res_b->correlationHist();
-          c1->SetLeftMargin(0.25);  c1->SetBottomMargin(0.25);
-          corr->SetTitle("Correlation matrix of fit parameters");
-          gStyle->SetPaintTextFormat(res_b->floatParsFinal().getSize() > 10 ? ".1f" : ".2f");
-          gStyle->SetOptStat(0);
-          corr->SetMarkerSize(res_b->floatParsFinal().getSize() > 10 ? 2 : 1);
-          corr->Draw("COLZ TEXT");
-          c1->Print((out_+"/covariance_fit_b.png").c_str());
-          c1->SetLeftMargin(0.16);  c1->SetBottomMargin(0.13);
-      	  if (fitOut.get()) fitOut->WriteTObject(corr, "covariance_fit_b");
-      }
-  }
-  else {
-	fitStatus_=-1;
-	numbadnll_=-1;	
-  }
-  mu_=r->getVal();
-  if (t_fit_b_) t_fit_b_->Fill();
-  // no longer need res_b
-  delete res_b;
-
-  if (!reuseParams_) w->loadSnapshot("clean"); // Reset, also ensures nll_prefit is same in call to doFit for b and s+b
-  r->setVal(preFitValue_); r->setConstant(false); 
-  if (minos_ != "all") {
-    RooArgList minos; if (minos_ == "poi") minos.add(*r);
-    res_s = doFit(*mc_s->GetPdf(), data, minos, constCmdArg_s, /*hesse=*/!noErrors_,/*ndim*/1,/*reuseNLL*/ true); 
-    nll_sb_ = nll->getVal()-nll0;
+    }
+  };
+  if (parallelFits_ && !reuseParams_ && !justFit_ && !skipBOnlyFit_) {
+    // the S+B fit in a forked process, started from the same point as the B-only one, which runs here with its outputs
+    // meanwhile; the result comes back through a temporary file
+    char tmpfile[999]; snprintf(tmpfile, 998, "%s/mlfit-sb-XXXXXX", P_tmpdir);
+    int fd = mkstemp(tmpfile); if (fd != -1) close(fd);
+    std::vector<std::vector<double> > results;
+    runInForks(2, [&](unsigned int i) -> std::vector<double> {
+        if (i == 0) { fitB(); return std::vector<double>(); }
+        fitS();
+        if (res_s == 0) return std::vector<double>(1, 0.);
+        std::unique_ptr<TFile> fout(TFile::Open(tmpfile, "RECREATE"));
+        if (fout.get() == 0 || fout->WriteTObject(res_s, "fit_s") <= 0) return std::vector<double>();
+        fout->Close();
+        std::vector<double> ret(2); ret[0] = 1; ret[1] = nll_sb_;
+        return ret;
+    }, results, true);
+    if (results[1].size() == 2) {
+        std::unique_ptr<TFile> fin(TFile::Open(tmpfile));
+        res_s = fin.get() ? dynamic_cast<RooFitResult *>(fin->Get("fit_s")) : 0;
+        if (res_s) nll_sb_ = results[1][1];
+    }
+    unlink(tmpfile);
+    if (results[1].size() == 1) {
+        // the fit failed in the forked process, as it would have here
+    } else if (res_s == 0) {
+        std::cerr << "MaxLikelihoodFit: the forked S+B fit didn't return its result, running it again here" << std::endl;
+        fitS();
+    } else {
+        // the parameters as the fit would have left them here
+        utils::loadSnapshot(w, "clean");
+        std::auto_ptr<RooArgSet> params(mc_s->GetPdf()->getParameters(data));
+        *params = RooArgSet(res_s->floatParsFinal());
+        r->setConstant(false);
+        RooRealVar *rf = dynamic_cast<RooRealVar*>(res_s->floatParsFinal().find(r->GetName()));
+        if (rf) {
+            r->setError(rf->getError());
+            if (rf->hasAsymError()) r->setAsymError(rf->getAsymErrorLo(), rf->getAsymErrorHi());
+        }
+    }
   } else {
-    CloseCoutSentry sentry(verbose < 2);
-    RooArgList minos = (*mc_s->GetNuisanceParameters()); 
-    minos.add((*mc_s->GetParametersOfInterest()));  // Add POI this time 
-    res_s = doFit(*mc_s->GetPdf(), data, minos, constCmdArg_s, /*hesse=*/true,/*ndim*/1,/*reuseNLL*/ true); 
-    if (res_s) nll_sb_= nll->getVal()-nll0;
-
+    fitB();
+    fitS();
   }
+  fitSummary_ = 0;
   if (res_s) { 
       limit    = r->getVal();
       limitErr = r->getError();
-      if (verbose > 1) res_s->Print("V");
+      if (verbose > 1 && !light) res_s->Print("V");
       if (fitOut.get()){
 	 if (currentToy_<1) fitOut->WriteTObject(res_s, "fit_s");
 
@@ -294,8 +365,8 @@ bool MaxLikelihoodFit::runSpecific(RooWorkspace *w, RooStats::ModelConfig *mc_s,
 	   setFitResultTrees(mc_s->GetNuisanceParameters(),nuisanceParameters_);
 	   setFitResultTrees(mc_s->GetGlobalObservables(),globalObservables_);
 	 }
-	 fitStatus_ = res_s->status();
-         numbadnll_ = res_s->numInvalidNLL();
+	 fitStatus_ = (light ? toySummary_.status() : res_s->status());
+         numbadnll_ = (light ? toySummary_.numInvalidNLL() : res_s->numInvalidNLL());
 
 	 // Additionally store the nll_sb - nll_bonly (=0.5*q0)
 	 nll_nll0_ =  nll_sb_ -  nll_bonly_;
@@ -339,23 +410,32 @@ bool MaxLikelihoodFit::runSpecific(RooWorkspace *w, RooStats::ModelConfig *mc_s,
   mu_=r->getVal();
 
   if (res_s) {
-      RooRealVar *rf = dynamic_cast<RooRealVar*>(res_s->floatParsFinal().find(r->GetName()));
-      if (rf){
-	double bestFitVal = rf->getVal();
-
-	double hiErr = +(rf->hasRange("err68") ? rf->getMax("err68") - bestFitVal : rf->getAsymErrorHi());
-	double loErr = -(rf->hasRange("err68") ? rf->getMin("err68") - bestFitVal : rf->getAsymErrorLo());
-	double maxError = std::max<double>(std::max<double>(hiErr, loErr), rf->getError());
-
-	if (fabs(hiErr) < 0.001*maxError) hiErr = -bestFitVal + rf->getMax();
-	if (fabs(loErr) < 0.001*maxError) loErr = +bestFitVal - rf->getMin();
+      // the POI as fitted, from the RooFitResult or from the summary of the fit in the light toys
+      RooRealVar *rf = (light ? 0 : dynamic_cast<RooRealVar*>(res_s->floatParsFinal().find(r->GetName())));
+      int is = (light ? toySummary_.index(r->GetName()) : -1);
+      if (rf || (is >= 0 && toySummary_.floating(is))) {
+	double bestFitVal = rf ? rf->getVal() : toySummary_.value(is);
+	double bestFitErr = rf ? rf->getError() : toySummary_.error(is);
+	bool has68 = rf ? rf->hasRange("err68") : toySummary_.hasInterval68(is);
+	bool has95 = rf ? rf->hasRange("err95") : toySummary_.hasInterval95(is);
+	double lo68 = !has68 ? 0 : (rf ? rf->getMin("err68") : toySummary_.lo68(is));
+	double hi68 = !has68 ? 0 : (rf ? rf->getMax("err68") : toySummary_.hi68(is));
+	double lo95 = !has95 ? 0 : (rf ? rf->getMin("err95") : toySummary_.lo95(is));
+	double hi95 = !has95 ? 0 : (rf ? rf->getMax("err95") : toySummary_.hi95(is));
+
+	double hiErr = +(has68 ? hi68 - bestFitVal : (rf ? rf->getAsymErrorHi() : 0));
+	double loErr = -(has68 ? lo68 - bestFitVal : (rf ? rf->getAsymErrorLo() : 0));
+	double maxError = std::max<double>(std::max<double>(hiErr, loErr), bestFitErr);
+
+	if (fabs(hiErr) < 0.001*maxError) hiErr = -bestFitVal + (rf ? rf->getMax() : r->getMax());
+	if (fabs(loErr) < 0.001*maxError) loErr = +bestFitVal - (rf ? rf->getMin() : r->getMin());
 
 	muLoErr_=loErr;
 	muHiErr_=hiErr;
-	muErr_  =rf->getError();
+	muErr_  =bestFitErr;
 
-	double hiErr95 = +(do95_ && rf->hasRange("err95") ? rf->getMax("err95") - bestFitVal : 0);
-	double loErr95 = -(do95_ && rf->hasRange("err95") ? rf->getMin("err95") - bestFitVal : 0);
+	double hiErr95 = +(do95_ && has95 ? hi95 - bestFitVal : 0);
+	double loErr95 = -(do95_ && has95 ? lo95 - bestFitVal : 0);
 
 	limit = bestFitVal;  limitErr = 0;
 	if (!noErrors_) Combine::commitPoint(/*expected=*/true, /*quantile=*/0.5);
@@ -363,17 +443,17 @@ bool MaxLikelihoodFit::runSpecific(RooWorkspace *w, RooStats::ModelConfig *mc_s,
 	if (!noErrors_) Combine::commitPoint(/*expected=*/true, /*quantile=*/0.16);
 	limit = bestFitVal + hiErr; limitErr = 0;
 	if (!noErrors_) Combine::commitPoint(/*expected=*/true, /*quantile=*/0.84);
-	if (do95_ && rf->hasRange("err95") && !noErrors_) {
-	  limit = rf->getMax("err95"); Combine::commitPoint(/*expected=*/true, /*quantile=*/0.975);
-	  limit = rf->getMin("err95"); Combine::commitPoint(/*expected=*/true, /*quantile=*/0.025);
+	if (do95_ && has95 && !noErrors_) {
+	  limit = hi95; Combine::commitPoint(/*expected=*/true, /*quantile=*/0.975);
+	  limit = lo95; Combine::commitPoint(/*expected=*/true, /*quantile=*/0.025);
 	}
 
 	limit = bestFitVal;
 	limitErr = maxError;
 	std::cout << "\n --- MaxLikelihoodFit ---" << std::endl;
-	std::cout << "Best fit " << r->GetName() << ": " << rf->getVal() << "  "<<  -loErr << "/+" << +hiErr << "  (68% CL)" << std::endl;
+	std::cout << "Best fit " << r->GetName() << ": " << bestFitVal << "  "<<  -loErr << "/+" << +hiErr << "  (68% CL)" << std::endl;
 	if (do95_) {
-	  std::cout << "         " << r->GetName() << ": " << rf->getVal() << "  "<<  -loErr95 << "/+" << +hiErr95 << "  (95% CL)" << std::endl;
+	  std::cout << "         " << r->GetName() << ": " << bestFitVal << "  "<<  -loErr95 << "/+" << +hiErr95 << "  (95% CL)" << std::endl;
 	}
       } else {
       	std::cout << "\n --- MaxLikelihoodFit ---" << std::endl;
@@ -399,6 +479,7 @@ bool MaxLikelihoodFit::runSpecific(RooWorkspace *w, RooStats::ModelConfig *mc_s,
 
   if(saveWorkspace_){
 	  RooWorkspace *ws = new RooWorkspace("MaxLikelihoodFitResult");
+	  FastVerticalInterpHistPdf2Base::restoreDoubleMorphs(w->components());
 	  ws->import(*mc_s->GetPdf());
 	  ws->import(data);
 	  std::cout << "Saving pdfs and data to MaxLikelihoodFitResult.root" << std::endl;
@@ -589,7 +670,9 @@ void MaxLikelihoodFit::getNormalizations(RooAbsPdf *pdf, const RooArgSet &obs, R
     int iBinOverall = 1;
     //Map to hold info on bins across channels
     std::map<TString,int> binMap;
+    std::map<std::string,int> overallOffset; // bin of the overall histograms just before the first one of each channel
     for (IH h = totByCh.begin(), eh = totByCh.end(); h != eh; ++h){
+	overallOffset[h->first] = iBinOverall - 1;
 	for (int iBin = 0; iBin < h->second->GetNbinsX(); iBin++,iBinOverall++){
 	    TString label = Form("%s_%d",h->first.c_str(),iBin);
 	    binMap[label] = iBinOverall;
@@ -621,10 +704,81 @@ void MaxLikelihoodFit::getNormalizations(RooAbsPdf *pdf, const RooArgSet &obs, R
     delete datOverallHist;
 
     if (saveWithUncertainties_) {
-        int ntoys = numToysForShapes_;
-
-        sampler.generate(ntoys);
         std::auto_ptr<RooArgSet> params(pdf->getParameters(obs));
+        // the points in the parameter space: random samples of the fit uncertainties, or the sigma points central +/- the columns of
+        // the Cholesky decomposition of the covariance. With the latter, the sums of the squared deviations divided by two are
+        // the linear propagation of the covariance V = L L^T, J V J^T = sum_k (J L_k) (J L_k)^T, up to second order terms.
+        std::vector<std::vector<double> > points;
+        RooArgList pointPars;
+        const RooFitResult *fitResult = sampler.fitResult();
+        if (linearShapeErrors_ && fitResult == 0 && verbose) std::cout << "Linear propagation of the uncertainties on the shapes needs a fit result, will sample them." << std::endl;
+        if (linearShapeErrors_ && fitResult != 0) {
+            const RooArgList &central = fitResult->floatParsFinal();
+            TDecompChol chol(fitResult->covarianceMatrix());
+            if (!chol.Decompose()) throw std::runtime_error("MaxLikelihoodFit: the covariance matrix of the fit is not positive definite");
+            const TMatrixD &U = chol.GetU(); // V = U^T U, so L_k is the row k of U
+            pointPars.add(central);
+            std::vector<double> x0(central.getSize());
+            for (int j = 0, n = central.getSize(); j < n; ++j) x0[j] = ((RooAbsReal *)central.at(j))->getVal();
+            for (int k = 0, n = central.getSize(); k < n; ++k) {
+                for (int sign = -1; sign <= +1; sign += 2) {
+                    points.push_back(x0);
+                    for (int j = 0; j < n; ++j) points.back()[j] += sign * U(k,j);
+                }
+            }
+        } else {
+            sampler.generate(numToysForShapes_);
+            for (int t = 0; t < numToysForShapes_; ++t) {
+                const RooAbsCollection &sample = sampler.get(t);
+                if (t == 0) pointPars.add(sample); 
+                points.push_back(std::vector<double>(pointPars.getSize()));
+                for (int j = 0, n = pointPars.getSize(); j < n; ++j) points.back()[j] = ((RooAbsReal *)sample.find(pointPars.at(j)->GetName()))->getVal();
+            }
+        }
+        int ntoys = points.size();
+        double denom = (linearShapeErrors_ && fitResult != 0 ? 2 : ntoys);
+        // what is recorded for each point: the normalization of each process and, if its shape is saved, its bin contents
+        std::vector<int> offsets(snm.size());
+        int sampleSize = 0;
+        for (i = 0; i < int(snm.size()); ++i) { offsets[i] = sampleSize; sampleSize += 1 + (shapes2[i] ? bins[i] : 0); }
+        RooArgList pointVars;
+        for (int j = 0, n = pointPars.getSize(); j < n; ++j) {
+            RooRealVar *v = dynamic_cast<RooRealVar *>(params->find(pointPars.at(j)->GetName()));
+            if (v) pointVars.add(*v); else pointVars.add(*pointPars.at(j)); // the latter is not a parameter of the pdf, setting it is harmless
+        }
+        // evaluate a block of points; the blocks go to forked processes with --shapeForks (see utils::runInForks)
+        int nforks = std::max(1, std::min(shapeForks_, ntoys));
+        auto evalBlock = [&](unsigned int k) -> std::vector<double> {
+            std::vector<double> ret; 
+            int first = (k*ntoys)/nforks, last = ((k+1)*ntoys)/nforks;
+            ret.reserve((last-first)*sampleSize);
+            for (int t = first; t < last; ++t) {
+                for (int j = 0, n = pointVars.getSize(); j < n; ++j) {
+                    RooRealVar *v = dynamic_cast<RooRealVar *>(pointVars.at(j));
+                    if (v) v->setVal(points[t][j]);
+                }
+                IT p; int ip;
+                for (p = bg, ip = 0; p != ed; ++p, ++ip) { 
+                    double norm = p->second.norm->getVal();
+                    ret.push_back(norm);
+                    if (!shapes2[ip]) continue;
+                    RooRealVar *x = (RooRealVar*)p->second.obs.at(0);
+                    std::auto_ptr<TH1> hist(p->second.pdf->createHistogram(p->second.pdf->GetName(), *x));
+                    hist->Scale(norm / hist->Integral("width"));
+                    for (int b = 1; b <= bins[ip]; ++b) ret.push_back(hist->GetBinContent(b));
+                }
+            }
+            return ret;
+        };
+        std::vector<double> samples;
+        if (nforks > 1) {
+            std::vector<std::vector<double> > blocks;
+            runInForks(nforks, evalBlock, blocks, true);
+            for (int k = 0; k < nforks; ++k) samples.insert(samples.end(), blocks[k].begin(), blocks[k].end());
+            if (int(samples.size()) != ntoys*sampleSize) throw std::runtime_error("MaxLikelihoodFit: a forked process failed while sampling the shapes");
+        } else {
+            samples = evalBlock(0);
+        }
         // prepare histograms for running sums
         std::map<std::string,TH1*> totByCh1, sigByCh1, bkgByCh1;
         for (IH h = totByCh.begin(), eh = totByCh.end(); h != eh; ++h) totByCh1[h->first] = (TH1*) h->second->Clone();
@@ -635,42 +789,36 @@ void MaxLikelihoodFit::getNormalizations(RooAbsPdf *pdf, const RooArgSet &obs, R
             for (IH h = totByCh1.begin(), eh = totByCh1.end(); h != eh; ++h) h->second->Reset();
             for (IH h = sigByCh1.begin(), eh = sigByCh1.end(); h != eh; ++h) h->second->Reset();
             for (IH h = bkgByCh1.begin(), eh = bkgByCh1.end(); h != eh; ++h) h->second->Reset();
-            // randomize numbers
-            params->assignValueOnly( sampler.get(t) );
+            const double *sample = &samples[t*sampleSize];
             for (pair = bg, i = 0; pair != ed; ++pair, ++i) { 
                 // add up deviations in numbers for each channel
-                sumx2[i] += std::pow(pair->second.norm->getVal() - vals[i], 2);  
-                if (saveShapes_ && pair->second.obs.getSize() == 1) {
-                    // and also deviations in the shapes
-                    RooRealVar *x = (RooRealVar*)pair->second.obs.at(0);
-                    std::auto_ptr<TH1> hist(pair->second.pdf->createHistogram(pair->second.pdf->GetName(), *x));
-                    hist->Scale(pair->second.norm->getVal() / hist->Integral("width"));
+                sumx2[i] += std::pow(sample[offsets[i]] - vals[i], 2);  
+                if (shapes2[i]) {
+                    // and also deviations in the shapes, cumulated in the total for this toy as well
+                    const double *contents = sample + offsets[i] + 1;
+                    TH1 *tot = totByCh1[pair->second.channel], *part = (sig[i] ? sigByCh1 : bkgByCh1)[pair->second.channel];
                     for (int b = 1; b <= bins[i]; ++b) {
-                        shapes2[i]->AddBinContent(b, std::pow(hist->GetBinContent(b) - shapes[i]->GetBinContent(b), 2));
+                        shapes2[i]->AddBinContent(b, std::pow(contents[b-1] - shapes[i]->GetBinContent(b), 2));
+                        tot->AddBinContent(b, contents[b-1]);
+                        part->AddBinContent(b, contents[b-1]);
                     }
-                    // and cumulate in the total for this toy as well
-                    totByCh1[pair->second.channel]->Add(&*hist);
-                    (sig[i] ? sigByCh1 : bkgByCh1)[pair->second.channel]->Add(&*hist);
                 }
             }
             // now add up the deviations within channels in this toy
             for (IH h = totByCh1.begin(), eh = totByCh1.end(); h != eh; ++h) {
                 TH1 *target = totByCh2[h->first], *reference = totByCh[h->first];
                 TH2 *targetCovar = totByCh2Covar[h->first];
+                int offset = overallOffset[h->first];
                 for (int b = 1, nb = target->GetNbinsX(); b <= nb; ++b) {
 		    double deltaBi = h->second->GetBinContent(b) - reference->GetBinContent(b);
 		    target->AddBinContent(b, std::pow(deltaBi, 2));
-		    int binX = b - 1;
-		    TString xLabel = Form("%s_%d",h->first.c_str(),binX);
 		    for (int bj = 1;bj <= b; bj++) {
-			int binY = bj - 1;
-			TString yLabel = Form("%s_%d",h->first.c_str(),binY);
 			double deltaBj = h->second->GetBinContent(bj) - reference->GetBinContent(bj);
 			targetCovar->AddBinContent(targetCovar->GetBin(b,bj),deltaBj*deltaBi);  // covariance
-			totOverall2Covar->Fill(xLabel,yLabel,deltaBj*deltaBi);
+			totOverall2Covar->AddBinContent(totOverall2Covar->GetBin(offset+b,offset+bj),deltaBj*deltaBi);
 			if (b != bj) {
 			    targetCovar->AddBinContent(targetCovar->GetBin(bj,b),deltaBj*deltaBi);  // covariance
-			    totOverall2Covar->Fill(yLabel,xLabel,deltaBj*deltaBi);
+			    totOverall2Covar->AddBinContent(totOverall2Covar->GetBin(offset+bj,offset+b),deltaBj*deltaBi);
 			}
 		    }
 		}
@@ -679,18 +827,16 @@ void MaxLikelihoodFit::getNormalizations(RooAbsPdf *pdf, const RooArgSet &obs, R
 	    if (saveOverallShapes_){
 		for (IH h = totByCh1.begin(), eh = totByCh1.end(); h != eh; ++h) {
 		    TH1 *reference = totByCh[h->first];
+		    int offset = overallOffset[h->first];
 		    for (IH h2 = totByCh1.begin();h2 != h; ++h2) {
 			TH1 *reference2 = totByCh[h2->first];
+			int offset2 = overallOffset[h2->first];
 			for (int b = 1, nb = reference->GetNbinsX(); b <= nb; ++b) {
 			    double deltaBi = h->second->GetBinContent(b) - reference->GetBinContent(b);
-			    int binX = b - 1;
-			    TString xLabel = Form("%s_%d",h->first.c_str(),binX);
 			    for (int bj = 1, nb2 = reference2->GetNbinsX(); bj <= nb2; ++bj) {
-				int binY = bj - 1;
 				double deltaBj = h2->second->GetBinContent(bj) - reference2->GetBinContent(bj);
-				TString yLabel = Form("%s_%d",h2->first.c_str(),binY);
-				totOverall2Covar->Fill(xLabel,yLabel,deltaBj*deltaBi);
-				totOverall2Covar->Fill(yLabel,xLabel,deltaBj*deltaBi);
+				totOverall2Covar->AddBinContent(totOverall2Covar->GetBin(offset+b,offset2+bj),deltaBj*deltaBi);
+				totOverall2Covar->AddBinContent(totOverall2Covar->GetBin(offset2+bj,offset+b),deltaBj*deltaBi);
 			    }
 			}
 		    }
@@ -711,10 +857,10 @@ void MaxLikelihoodFit::getNormalizations(RooAbsPdf *pdf, const RooArgSet &obs, R
         } // end of the toy loop
         // now take square roots and such
         for (pair = bg, i = 0; pair != ed; ++pair, ++i) {
-            sumx2[i] = sqrt(sumx2[i]/ntoys);
+            sumx2[i] = sqrt(sumx2[i]/denom);
             if (shapes2[i]) {
                 for (int b = 1; b <= bins[i]; ++b) {
-                    shapes[i]->SetBinError(b, std::sqrt(shapes2[i]->GetBinContent(b)/ntoys));
+                    shapes[i]->SetBinError(b, std::sqrt(shapes2[i]->GetBinContent(b)/denom));
                 }
                 delete shapes2[i]; shapes2[i] = 0;
             }
@@ -725,22 +871,22 @@ void MaxLikelihoodFit::getNormalizations(RooAbsPdf *pdf, const RooArgSet &obs, R
             TH1 *sum2   = totByCh2[h->first];
             for (int b = 1, nb = sum2->GetNbinsX(); b <= nb; ++b) {
 		TString xLabel = Form("%s_%d",h->first.c_str(),b-1);
-		totOverall->SetBinError(binMap[xLabel],std::sqrt(sum2->GetBinContent(b)/ntoys));
-                h->second->SetBinError(b, std::sqrt(sum2->GetBinContent(b)/ntoys));
+		totOverall->SetBinError(binMap[xLabel],std::sqrt(sum2->GetBinContent(b)/denom));
+                h->second->SetBinError(b, std::sqrt(sum2->GetBinContent(b)/denom));
             }
             delete sum2; delete totByCh1[h->first];
 	}
 	// same for covariance matrix 
 	for (int b = 1, nb = totOverall2Covar->GetNbinsX(); b <= nb; ++b) {
 	    for (int bj = 1, nbj = totOverall2Covar->GetNbinsY(); bj <= nbj; ++bj) {    
-		totOverall2Covar->SetBinContent(b,bj, (totOverall2Covar->GetBinContent(b,bj)/ntoys));
+		totOverall2Covar->SetBinContent(b,bj, (totOverall2Covar->GetBinContent(b,bj)/denom));
 	    }
 	}
         for (IH2 h = totByCh2Covar.begin(), eh = totByCh2Covar.end(); h != eh; ++h) {
             TH2 *covar2 = h->second;
             for (int b = 1, nb = covar2->GetNbinsX(); b <= nb; ++b) {
               for (int bj = 1, nbj = covar2->GetNbinsY(); bj <= nbj; ++bj) {    
-		  h->second->SetBinContent(b,bj, (covar2->GetBinContent(b,bj)/ntoys));
+		  h->second->SetBinContent(b,bj, (covar2->GetBinContent(b,bj)/denom));
 	      }
 	    }
 	}
@@ -748,18 +894,18 @@ void MaxLikelihoodFit::getNormalizations(RooAbsPdf *pdf, const RooArgSet &obs, R
         for (IH h = sigByCh.begin(), eh = sigByCh.end(); h != eh; ++h) {
             TH1 *sum2 = sigByCh2[h->first];
             for (int b = 1, nb = sum2->GetNbinsX(); b <= nb; ++b) {
-                h->second->SetBinError(b, std::sqrt(sum2->GetBinContent(b)/ntoys));
+                h->second->SetBinError(b, std::sqrt(sum2->GetBinContent(b)/denom));
 		TString xLabel = Form("%s_%d",h->first.c_str(),b-1);
-		sigOverall->SetBinError(binMap[xLabel],std::sqrt(sum2->GetBinContent(b)/ntoys));
+		sigOverall->SetBinError(binMap[xLabel],std::sqrt(sum2->GetBinContent(b)/denom));
             }
             delete sum2; delete sigByCh1[h->first];
         }
         for (IH h = bkgByCh.begin(), eh = bkgByCh.end(); h != eh; ++h) {
             TH1 *sum2 = bkgByCh2[h->first];
             for (int b = 1, nb = sum2->GetNbinsX(); b <= nb; ++b) {
-                h->second->SetBinError(b, std::sqrt(sum2->GetBinContent(b)/ntoys));
+                h->second->SetBinError(b, std::sqrt(sum2->GetBinContent(b)/denom));
 		TString xLabel = Form("%s_%d",h->first.c_str(),b-1);
-		bkgOverall->SetBinError(binMap[xLabel],std::sqrt(sum2->GetBinContent(b)/ntoys));
+		bkgOverall->SetBinError(binMap[xLabel],std::sqrt(sum2->GetBinContent(b)/denom));
             }
             delete sum2; delete bkgByCh1[h->first];
         }
@@ -1,25 +1,44 @@
 #include "HiggsAnalysis/CombinedLimit/interface/MultiDimFit.h"
 #include <stdexcept>
 #include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <regex>
+#include <algorithm>
+#include <set>
+#include <limits>
 
 #include "TMath.h"
+#include "TMatrixDSym.h"
+#include "TFile.h"
+#include "TTree.h"
+#include "TTreeFormula.h"
 #include "RooArgSet.h"
 #include "RooArgList.h"
 #include "RooRandom.h"
 #include "RooAbsData.h"
 #include "RooCategory.h"
 #include "RooFitResult.h"
+#include "RooFIter.h"
 #include "HiggsAnalysis/CombinedLimit/interface/RooMinimizerOpt.h"
 #include <RooStats/ModelConfig.h>
 #include "HiggsAnalysis/CombinedLimit/interface/Combine.h"
 #include "HiggsAnalysis/CombinedLimit/interface/CascadeMinimizer.h"
 #include "HiggsAnalysis/CombinedLimit/interface/CloseCoutSentry.h"
+#include "HiggsAnalysis/CombinedLimit/interface/Checkpoint.h"
+#include "HiggsAnalysis/CombinedLimit/interface/FitResultCache.h"
+#include "HiggsAnalysis/CombinedLimit/interface/SobolSequence.h"
 #include "HiggsAnalysis/CombinedLimit/interface/utils.h"
 
 #include <Math/Minimizer.h>
 #include <Math/MinimizerOptions.h>
 #include <Math/QuantFuncMathCore.h>
 #include <Math/ProbFunc.h>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/trim.hpp>
 
 using namespace RooStats;
 
@@ -36,6 +55,10 @@ unsigned int MultiDimFit::lastPoint_  = std::numeric_limits<unsigned int>::max()
 bool MultiDimFit::floatOtherPOIs_ = false;
 unsigned int MultiDimFit::nOtherFloatingPoi_ = 0;
 bool MultiDimFit::fastScan_ = false;
+bool MultiDimFit::fastScanHesse_ = false;
+bool MultiDimFit::fastScanNewton_ = false;
+std::vector<RooRealVar *> MultiDimFit::hesseParams_;
+std::vector<double> MultiDimFit::hesseBest_, MultiDimFit::hessePoiBest_, MultiDimFit::hesseSlope_, MultiDimFit::hesseCondCov_;
 bool MultiDimFit::loadedSnapshot_ = false;
 bool MultiDimFit::savingSnapshot_ = false;
 bool MultiDimFit::startFromPreFit_ = false;
@@ -45,6 +68,7 @@ bool MultiDimFit::skipInitialFit_ = false;
 float MultiDimFit::maxDeltaNLLForProf_ = 200;
 float MultiDimFit::autoRange_ = -1.0;
 std::string MultiDimFit::fixedPointPOIs_ = "";
+std::string MultiDimFit::fixedPointsFile_ = "";
 
   std::string MultiDimFit::saveSpecifiedFuncs_;
   std::string MultiDimFit::saveSpecifiedIndex_;
@@ -62,6 +86,31 @@ std::string MultiDimFit::fixedPointPOIs_ = "";
  std::vector<float>        MultiDimFit::specifiedVals_;
  RooArgList                MultiDimFit::specifiedList_;
  bool MultiDimFit::saveInactivePOI_= false;
+unsigned int MultiDimFit::gridForks_ = 0;
+bool MultiDimFit::gridWarmStart_ = false;
+bool MultiDimFit::randomPointsSobol_ = false;
+bool MultiDimFit::randomPointsWarmStart_ = false;
+std::string MultiDimFit::adaptiveLevels_ = "";
+unsigned int MultiDimFit::adaptiveDepth_ = 3;
+std::vector<double> * MultiDimFit::pointRecord_ = 0;
+int MultiDimFit::checkpointPoint_ = -1;
+std::vector<double> MultiDimFit::checkpointRecord_;
+std::map<unsigned int, std::vector<double> > MultiDimFit::checkpointSaved_;
+std::string MultiDimFit::impactNuisances_ = "";
+unsigned int MultiDimFit::impactForks_ = 0;
+unsigned int MultiDimFit::contourForks_ = 0;
+bool MultiDimFit::impactHesse_ = false;
+bool MultiDimFit::impactWarmStart_ = false;
+std::string MultiDimFit::breakdownGroups_ = "";
+unsigned int MultiDimFit::breakdownForks_ = 0;
+bool MultiDimFit::breakdownHesse_ = false;
+int MultiDimFit::breakdownGroup_ = -1;
+float MultiDimFit::freezeNegligible_ = 0;
+RooArgSet MultiDimFit::frozenNuisances_;
+float MultiDimFit::bestScanDeltaNLL_ = 0;
+double MultiDimFit::bestFitNLL_ = 0;
+std::vector<float> MultiDimFit::bestScanPoiVals_;
+std::string MultiDimFit::fitCache_ = "";
 
 MultiDimFit::MultiDimFit() :
     FitterAlgoBase("MultiDimFit specific options")
@@ -77,13 +126,32 @@ MultiDimFit::MultiDimFit() :
         ("lastPoint",  boost::program_options::value<unsigned int>(&lastPoint_)->default_value(lastPoint_), "Last point to use")
         ("autoRange", boost::program_options::value<float>(&autoRange_)->default_value(autoRange_), "Set to any X >= 0 to do the scan in the +/- X sigma range (where the sigma is from the initial fit, so it may be fairly approximate)")
 	("fixedPointPOIs",   boost::program_options::value<std::string>(&fixedPointPOIs_)->default_value(""), "Parameter space point for --algo=fixed")
+        ("fixedPointsFile",   boost::program_options::value<std::string>(&fixedPointsFile_)->default_value(""), "In --algo=fixed, evaluate all the points in this file: a text file with one point per line in the syntax of --fixedPointPOIs, or file.root:tree with a branch per POI, or file.root:tree:POI=expression,... to compute some of them from the branches (TTreeFormula syntax). Points outside the ranges of the POIs, not finite or whose fit fails are skipped with a warning. The points are fitted in nearest-neighbour order, each starting from the result of the previous one, and split among --gridForks processes")
         ("fastScan", "Do a fast scan, evaluating the likelihood without profiling it.")
+        ("fastScanHesse", "Do a fast scan, but instead of keeping them at their best fit values move the other floating parameters with the POIs as predicted by the covariance matrix of the initial fit")
+        ("fastScanNewton", "With --fastScanHesse, also do one Newton step on the other floating parameters at each point, using the numerical gradient of the likelihood")
         ("maxDeltaNLLForProf",  boost::program_options::value<float>(&maxDeltaNLLForProf_)->default_value(maxDeltaNLLForProf_), "Last point to use")
 	("saveSpecifiedNuis",   boost::program_options::value<std::string>(&saveSpecifiedNuis_)->default_value(""), "Save specified parameters (default = none)")
 	("saveSpecifiedFunc",   boost::program_options::value<std::string>(&saveSpecifiedFuncs_)->default_value(""), "Save specified function values (default = none)")
 	("saveSpecifiedIndex",   boost::program_options::value<std::string>(&saveSpecifiedIndex_)->default_value(""), "Save specified indexes/discretes (default = none)")
 	("saveInactivePOI",   boost::program_options::value<bool>(&saveInactivePOI_)->default_value(saveInactivePOI_), "Save inactive POIs in output (1) or not (0, default)")
 	("startFromPreFit",   boost::program_options::value<bool>(&startFromPreFit_)->default_value(startFromPreFit_), "Start each point of the likelihood scan from the pre-fit values")
+        ("gridForks",  boost::program_options::value<unsigned int>(&gridForks_)->default_value(gridForks_), "Split the points of the grid or random scan among N forked processes, each taking a contiguous block of points")
+        ("gridWarmStart", "In the grid scan, start each fit from the result of the previous point (2D grids are then visited row by row, back and forth)")
+        ("randomPointsSobol", "In --algo=random, take the points from a Sobol quasi-random sequence, which covers the space more evenly than pseudo-random points")
+        ("randomPointsWarmStart", "In --algo=random, start each fit from the result of the nearest point already fitted")
+        ("adaptiveLevels",  boost::program_options::value<std::string>(&adaptiveLevels_)->default_value(adaptiveLevels_), "In --algo=adaptive, comma separated values of deltaNLL of the contours to refine (default = the 68% and 95% CL contours)")
+        ("adaptiveDepth",  boost::program_options::value<unsigned int>(&adaptiveDepth_)->default_value(adaptiveDepth_), "In --algo=adaptive, number of times the cells of the initial grid of --points points crossed by a contour are split in half along each POI")
+        ("impactNuisances",  boost::program_options::value<std::string>(&impactNuisances_)->default_value(impactNuisances_), "In --algo=impact, also compute the impacts of all the nuisances whose name matches this regular expression")
+        ("impactForks",  boost::program_options::value<unsigned int>(&impactForks_)->default_value(impactForks_), "In --algo=impact, split the parameters among N forked processes")
+        ("contourForks",  boost::program_options::value<unsigned int>(&contourForks_)->default_value(contourForks_), "In --algo=cross and --algo=contour2d, run the independent crossing searches (the sides of the box, the values of y of the contour) in N forked processes")
+        ("impactHesse", "In --algo=impact, use the Hesse errors of the initial fit instead of a profile likelihood scan for each parameter")
+        ("impactWarmStart", "In --algo=impact, start each fit from the shift of the other parameters predicted by the covariance matrix of the initial fit")
+        ("breakdownGroups",  boost::program_options::value<std::string>(&breakdownGroups_)->default_value(breakdownGroups_), "In --algo=breakdown, comma separated groups of nuisances to freeze in turn: the name of a group of the datacard (^name for all the nuisances not in it), label=regex for the nuisances matching regex, or stat for all of them")
+        ("breakdownForks",  boost::program_options::value<unsigned int>(&breakdownForks_)->default_value(breakdownForks_), "In --algo=breakdown, split the groups among N forked processes")
+        ("breakdownHesse", "In --algo=breakdown, first print the uncertainties with each group frozen as predicted by the covariance matrix of the initial fit")
+        ("freezeNegligibleNuisances",  boost::program_options::value<float>(&freezeNegligible_)->default_value(freezeNegligible_), "In the grid, adaptive, random and fixed scans (not contour2d), if > 0: freeze the nuisances whose correlation with all the POIs in the Hesse matrix of the initial fit is below this value, and check with a refit with all of them floating at the best point of the scan")
+        ("fitCache",  boost::program_options::value<std::string>(&fitCache_)->default_value(fitCache_), "Directory where the initial fit is saved, under a hash of the model, the data, the starting values and the fit settings, and read back by the jobs starting from the same point instead of doing the fit again")
        ;
 }
 
@@ -100,6 +168,8 @@ void MultiDimFit::applyOptions(const boost::program_options::variables_map &vm)
     } else if (algo == "grid" || algo == "grid3x3" ) {
         algo_ = Grid; gridType_ = G1x1;
         if (algo == "grid3x3") gridType_ = G3x3;
+    } else if (algo == "adaptive") {
+        algo_ = AdaptiveGrid;
     } else if (algo == "fixed") {
         algo_ = FixedPoint;
     } else if (algo == "random") {
@@ -112,13 +182,25 @@ void MultiDimFit::applyOptions(const boost::program_options::variables_map &vm)
         algo_ = Impact;
         if (vm["floatOtherPOIs"].defaulted()) floatOtherPOIs_ = true;
         if (vm["saveInactivePOI"].defaulted()) saveInactivePOI_ = true;
+    } else if (algo == "breakdown") {
+        algo_ = Breakdown;
+        if (breakdownGroups_.empty()) throw std::invalid_argument("MultiDimFit: --algo=breakdown needs the groups of nuisances to freeze (--breakdownGroups)");
     } else throw std::invalid_argument(std::string("Unknown algorithm: "+algo));
-    fastScan_ = (vm.count("fastScan") > 0);
+    fastScanHesse_ = (vm.count("fastScanHesse") > 0 || vm.count("fastScanNewton") > 0);
+    fastScanNewton_ = (vm.count("fastScanNewton") > 0);
+    fastScan_ = (vm.count("fastScan") > 0 || fastScanHesse_);
     squareDistPoiStep_ = (vm.count("squareDistPoiStep") > 0);
     skipInitialFit_ = (vm.count("skipInitialFit") > 0);
+    gridWarmStart_ = (vm.count("gridWarmStart") > 0);
+    randomPointsSobol_ = (vm.count("randomPointsSobol") > 0);
+    randomPointsWarmStart_ = (vm.count("randomPointsWarmStart") > 0);
+    impactHesse_ = (vm.count("impactHesse") > 0);
+    impactWarmStart_ = (vm.count("impactWarmStart") > 0);
+    breakdownHesse_ = (vm.count("breakdownHesse") > 0);
     hasMaxDeltaNLLForProf_ = !vm["maxDeltaNLLForProf"].defaulted();
     loadedSnapshot_ = !vm["snapshotName"].defaulted();
     savingSnapshot_ = (!loadedSnapshot_) && vm.count("saveWorkspace");
+    FitResultCache::setup(fitCache_);
 }
 
 bool MultiDimFit::runSpecific(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooStats::ModelConfig *mc_b, RooAbsData &data, double &limit, double &limitErr, const double *hint) { 
@@ -154,7 +236,30 @@ bool MultiDimFit::runSpecific(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooS
     std::auto_ptr<RooFitResult> res;
     if (verbose <= 3) RooAbsReal::setEvalErrorLoggingMode(RooAbsReal::CountErrors);
     if ( !skipInitialFit_){
-        res.reset(doFit(pdf, data, ((algo_ == Singles || algo_ == Impact) ? poiList_ : RooArgList()), constrainCmdArg, false, 1, true, false));
+        bool hesseOnly = (algo_ == Impact && impactHesse_);
+        bool freezing  = (freezeNegligible_ > 0 && (algo_ == Grid || algo_ == AdaptiveGrid || algo_ == RandomPoints || algo_ == FixedPoint));
+        bool needCov   = hesseOnly || freezing || fastScanHesse_ || (algo_ == Breakdown && breakdownHesse_);
+        bool crossings = (algo_ == Singles || algo_ == Breakdown || (algo_ == Impact && !hesseOnly));
+        std::string cacheKey;
+        if (FitResultCache::enabled()) {
+            // everything that changes the result of doFit and is not in the model, the data or the parameters
+            std::string settings = TString::Format("%d:%d:%d:%d:%d:%s:%s:%g:%d", int(algo_), int(crossings), int(needCov), int(robustFit_), int(do95_),
+                                                   ROOT::Math::MinimizerOptions::DefaultMinimizerType().c_str(), ROOT::Math::MinimizerOptions::DefaultMinimizerAlgo().c_str(),
+                                                   ROOT::Math::MinimizerOptions::DefaultTolerance(), minimizerStrategy_).Data();
+            for (int i = 0, n = poiList_.getSize(); i < n; ++i) settings += std::string(":") + poiList_.at(i)->GetName();
+            settings += ":frozen";
+            RooFIter iterF = parametersToFreeze_.fwdIterator();
+            for (RooAbsArg *a = iterF.next(); a != 0; a = iterF.next()) settings += std::string(":") + a->GetName();
+            cacheKey = FitResultCache::key(pdf, data, settings);
+            res.reset(loadCachedFit(pdf, data, constrainCmdArg, cacheKey));
+        }
+        if (res.get() == 0) {
+            // with the cache, save the full result even if nothing here needs it, for the jobs that will
+            res.reset(doFit(pdf, data, (crossings ? poiList_ : RooArgList()), constrainCmdArg, needCov, 1, true, needCov || !cacheKey.empty()));
+            if (res.get() && !cacheKey.empty() && !keepFailures_) FitResultCache::save(cacheKey, *res, nll0Value_ + nllValue_);
+        }
+        if (freezing && res.get()) freezeNegligibleNuisances(*res, mc_s->GetNuisanceParameters());
+        if (fastScanHesse_ && res.get()) setupHesseScan(w, *res);
         if (algo_ == Impact && res.get()) {
             // Set the floating parameters back to the best-fit value
             // before we write an entry into the output TTree
@@ -163,7 +268,7 @@ bool MultiDimFit::runSpecific(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooS
     } else {
         std::cout << "MultiDimFit -- Skipping initial global fit" << std::endl;
         // must still create the NLL
-        nll.reset(pdf.createNLL(data, constrainCmdArg, RooFit::Extended(pdf.canBeExtended()), RooFit::Offset(true)));
+        setupNLL(pdf, data, constrainCmdArg);
     }
 
     if(w->var("r")) {w->var("r")->Print();}
@@ -199,6 +304,14 @@ bool MultiDimFit::runSpecific(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooS
         }
     }
 
+    std::auto_ptr<RooArgSet> bestFitSnap;
+    if (frozenNuisances_.getSize()) {
+        std::auto_ptr<RooArgSet> params(nll->getParameters((const RooArgSet *)0));
+        bestFitSnap.reset((RooArgSet*) params->snapshot());
+        bestFitNLL_ = nll->getVal();
+        bestScanPoiVals_.clear();
+    }
+
     switch(algo_) {
         case None: 
             if (verbose > 0) {
@@ -215,13 +328,16 @@ bool MultiDimFit::runSpecific(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooS
             break;
         case Singles: if (res.get()) doSingles(*res); break;
         case Cross: doBox(*nll, cl, "box", true); break;
-        case Grid: doGrid(w,*nll); break;
+        case Grid: if (gridForks_ > 1) doGridWithFork(w,*nll); else doGrid(w,*nll); break;
         case RandomPoints: doRandomPoints(w,*nll); break;
+        case AdaptiveGrid: doAdaptiveGrid(w,*nll); break;
         case FixedPoint: doFixedPoint(w,*nll); break;
         case Contour2D: doContour2D(w,*nll); break;
         case Stitch2D: doStitch2D(w,*nll); break;
         case Impact: if (res.get()) doImpact(*res, *nll); break;
+        case Breakdown: if (res.get()) doBreakdown(w, mc_s, *res, *nll); break;
     }
+    if (frozenNuisances_.getSize()) checkFrozenNuisances(*nll, *bestFitSnap);
     
     Combine::toggleGlobalFillTree(false);
     return true;
@@ -232,6 +348,15 @@ void MultiDimFit::initOnce(RooWorkspace *w, RooStats::ModelConfig *mc_s) {
     // Tell combine not to Fill its tree, we'll do it here;
 
     RooArgSet mcPoi(*mc_s->GetParametersOfInterest());
+    if (algo_ == Impact && !impactNuisances_.empty() && mc_s->GetNuisanceParameters()) {
+        std::regex rx(impactNuisances_, std::regex::ECMAScript);
+        RooLinkedListIter iterN = mc_s->GetNuisanceParameters()->iterator();
+        for (RooAbsArg *a = (RooAbsArg*) iterN.Next(); a != 0; a = (RooAbsArg*) iterN.Next()) {
+            if (!std::regex_match(a->GetName(), rx)) continue;
+            if (std::find(poi_.begin(), poi_.end(), a->GetName()) == poi_.end()) poi_.push_back(a->GetName());
+        }
+        if (verbose) std::cout << "MultiDimFit: computing the impacts of " << poi_.size() << " parameters" << std::endl;
+    }
     if (poi_.empty()) {
         RooLinkedListIter iterP = mc_s->GetParametersOfInterest()->iterator();
         for (RooAbsArg *a = (RooAbsArg*) iterP.Next(); a != 0; a = (RooAbsArg*) iterP.Next()) {
@@ -345,6 +470,39 @@ void MultiDimFit::initOnce(RooWorkspace *w, RooStats::ModelConfig *mc_s) {
 	Combine::addBranch(specifiedCatNames_[i].c_str(), &specifiedCatVals_[i], (specifiedCatNames_[i]+"/I").c_str()); 
     }
     Combine::addBranch("deltaNLL", &deltaNLL_, "deltaNLL/F");
+    if (algo_ == Breakdown) Combine::addBranch("breakdownGroup", &breakdownGroup_, "breakdownGroup/I");
+}
+
+RooFitResult * MultiDimFit::loadCachedFit(RooAbsPdf &pdf, RooAbsData &data, const RooCmdArg &constrain, const std::string &key)
+{
+    double savedNLL;
+    std::auto_ptr<RooFitResult> ret(FitResultCache::load(key, savedNLL));
+    if (ret.get() == 0) return 0;
+    setupNLL(pdf, data, constrain);
+    std::auto_ptr<RooArgSet> params(nll->getParameters((const RooArgSet *)0));
+    std::auto_ptr<RooArgSet> start((RooArgSet *) params->snapshot());
+    double nll0 = nll->getVal();
+    RooFIter iter = ret->floatParsFinal().fwdIterator();
+    for (RooAbsArg *a = iter.next(); a != 0; a = iter.next()) {
+        RooRealVar *rrv = dynamic_cast<RooRealVar *>(params->find(a->GetName())), *saved = dynamic_cast<RooRealVar *>(a);
+        if (rrv == 0 || saved == 0) continue;
+        rrv->setVal(saved->getVal());
+        rrv->setError(saved->getError());
+        if (saved->hasAsymError()) rrv->setAsymError(saved->getAsymErrorLo(), saved->getAsymErrorHi());
+        else rrv->removeAsymError();
+    }
+    double nllBest = nll->getVal();
+    // a collision of the hashes, or a model that evaluates differently (e.g. another version of the code)
+    if (!(std::abs(nllBest - savedNLL) <= 1e-7 * std::max(1.0, std::abs(savedNLL)))) {
+        std::cout << "MultiDimFit -- The NLL at the best fit in " << fitCache_ << " (" << key << ") is " << savedNLL << ", but it is " << nllBest << " here: doing the fit again" << std::endl;
+        *params = *start;
+        return 0;
+    }
+    std::cout << "MultiDimFit -- Taking the initial fit from " << fitCache_ << " (" << key << ")" << std::endl;
+    nll0Value_ = nll0;
+    nllValue_ = nllBest - nll0;
+    if (verbose > 1) ret->Print("V");
+    return ret.release();
 }
 
 void MultiDimFit::doSingles(RooFitResult &res)
@@ -401,8 +559,6 @@ void MultiDimFit::doImpact(RooFitResult &res, RooAbsReal &nll) {
   // Save the best-fit values of the saved parameters
   // we want to measure the impacts on
   std::vector<float> specifiedVals = specifiedVals_;
-  std::vector<float> impactLo = specifiedVals_;
-  std::vector<float> impactHi = specifiedVals_;
 
   int len = 9;
   for (int i = 0, n = poi_.size(); i < n; ++i) {
@@ -414,8 +570,20 @@ void MultiDimFit::doImpact(RooFitResult &res, RooAbsReal &nll) {
   }
   printf("\n");
 
+  if (impactForks_ > 1 && poi_.size() > 1) {
+    doWithFork(nll, 0, poi_.size()-1, impactForks_, /*printLogs=*/true, [&](unsigned int first, unsigned int last) {
+        doImpactRange(res, nll, *params, init_snap, specifiedVals, len, first, last);
+    });
+  } else {
+    doImpactRange(res, nll, *params, init_snap, specifiedVals, len, 0, poi_.size()-1);
+  }
+}
+
+void MultiDimFit::doImpactRange(RooFitResult &res, RooAbsReal &nll, RooArgSet &params, const RooArgSet &init_snap, const std::vector<float> &specifiedVals, int len, unsigned int first, unsigned int last) {
+  std::vector<float> impactLo = specifiedVals;
+  std::vector<float> impactHi = specifiedVals;
 
-  for (int i = 0, n = poi_.size(); i < n; ++i) {
+  for (unsigned int i = first; i <= last && i < poi_.size(); ++i) {
     RooAbsArg *rfloat = res.floatParsFinal().find(poi_[i].c_str());
     if (!rfloat) {
       rfloat = res.constPars().find(poi_[i].c_str());
@@ -424,25 +592,37 @@ void MultiDimFit::doImpact(RooFitResult &res, RooAbsReal &nll) {
     double bestFitVal = rf->getVal();
 
     double hiErr = +(rf->hasRange("err68") ? rf->getMax("err68") - bestFitVal
-                                           : rf->getAsymErrorHi());
+                                           : (rf->hasAsymError() ? rf->getAsymErrorHi() : rf->getError()));
     double loErr = -(rf->hasRange("err68") ? rf->getMin("err68") - bestFitVal
-                                           : rf->getAsymErrorLo());
+                                           : (rf->hasAsymError() ? rf->getAsymErrorLo() : -rf->getError()));
       printf("  %-*s : %+8.3f  %+6.3f/%+6.3f", len, poi_[i].c_str(),
                     bestFitVal, -loErr, hiErr);
     // Reset all parameters to initial state
-    *params = init_snap;
+    params = init_snap;
     // Then set this NP constant
     poiVars_[i]->setConstant(true);
     CascadeMinimizer minim(nll, CascadeMinimizer::Constrained);
     minim.setStrategy(minimizerStrategy_);
     // Another snapshot to reset between high and low fits
-    RooArgSet snap;
-    params->snapshot(snap);
+    utils::FastSnapshot snap(params);
+    // Position of the NP in the covariance matrix of the initial fit, to predict the shifts of the other parameters
+    int icov = (impactWarmStart_ && res.covQual() >= 0) ? res.floatParsFinal().index(rf) : -1;
     std::vector<double> doVals = {bestFitVal - loErr, bestFitVal + hiErr};
     for (unsigned x = 0; x < doVals.size(); ++x) {
-      *params = snap;
+      snap.writeTo();
       poiVals_[i] = doVals[x];
       poiVars_[i]->setVal(doVals[x]);
+      if (icov >= 0) {
+        // start from the linear prediction of the conditional best fit, theta_j + cov_ji/cov_ii * (theta_i' - theta_i)
+        const TMatrixDSym &cov = res.covarianceMatrix();
+        double scale = (doVals[x] - bestFitVal) / cov(icov,icov);
+        for (int j = 0, nf = res.floatParsFinal().getSize(); j < nf; ++j) {
+          if (j == icov) continue;
+          RooRealVar *pj = dynamic_cast<RooRealVar *>(params.find(res.floatParsFinal()[j].GetName()));
+          if (pj == 0 || pj->isConstant()) continue;
+          pj->setVal(std::max(pj->getMin(), std::min(pj->getMax(), pj->getVal() + cov(j,icov) * scale)));
+        }
+      }
       bool ok = minim.minimize(verbose - 1);
       if (ok) {
         for (unsigned int j = 0; j < poiVars_.size(); j++) {
@@ -457,7 +637,7 @@ void MultiDimFit::doImpact(RooFitResult &res, RooAbsReal &nll) {
         for (unsigned int j = 0; j < specifiedCatNames_.size(); j++) {
           specifiedCatVals_[j] = specifiedCat_[j]->getIndex();
         }
-        Combine::commitPoint(true, /*quantile=*/0.32);
+        commitPoint(params, /*quantile=*/0.32);
       }
       for (unsigned int j = 0; j < specifiedNuis_.size(); j++) {
         if (x == 0) {
@@ -475,12 +655,190 @@ void MultiDimFit::doImpact(RooFitResult &res, RooAbsReal &nll) {
 }
 
 
+void MultiDimFit::doBreakdown(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooFitResult &res, RooAbsReal &nll) {
+  std::cout << "\n --- MultiDimFit ---" << std::endl;
+  std::cout << "Breakdown of the uncertainties: " << std::endl;
+  std::auto_ptr<RooArgSet> params(nll.getParameters((const RooArgSet *)0));
+  RooArgSet nuisances;
+  if (mc_s->GetNuisanceParameters()) nuisances.add(*mc_s->GetNuisanceParameters());
+
+  // the floating parameters of each group
+  std::vector<std::string> names;
+  std::vector<RooArgList> groups;
+  std::vector<std::string> items;
+  boost::algorithm::split(items, breakdownGroups_, boost::algorithm::is_any_of(","));
+  for (std::string item : items) {
+    boost::algorithm::trim(item);
+    if (item.empty()) continue;
+    RooArgList group;
+    std::string::size_type eq = item.find('=');
+    if (item == "stat") {
+      group.add(nuisances);
+    } else if (eq != std::string::npos) {
+      std::regex rx(item.substr(eq+1), std::regex::ECMAScript);
+      RooFIter iterN = nuisances.fwdIterator();
+      for (RooAbsArg *a = iterN.next(); a != 0; a = iterN.next()) {
+        if (std::regex_match(a->GetName(), rx)) group.add(*a);
+      }
+      item = item.substr(0, eq);
+    } else {
+      bool complement = (item[0] == '^');
+      const RooArgSet *set = w->set(Form("group_%s", item.c_str() + (complement ? 1 : 0)));
+      if (set == 0) throw std::invalid_argument("MultiDimFit: unknown nuisance group "+item+" in --breakdownGroups");
+      RooFIter iterN = nuisances.fwdIterator();
+      for (RooAbsArg *a = iterN.next(); a != 0; a = iterN.next()) {
+        if ((set->find(a->GetName()) != 0) != complement) group.add(*a);
+      }
+    }
+    // only what the fit can move
+    RooArgList floating;
+    RooFIter iterG = group.fwdIterator();
+    for (RooAbsArg *a = iterG.next(); a != 0; a = iterG.next()) {
+      RooRealVar *rrv = dynamic_cast<RooRealVar *>(params->find(a->GetName()));
+      if (rrv != 0 && !rrv->isConstant() && !poiList_.contains(*rrv)) floating.add(*rrv);
+    }
+    if (floating.getSize() == 0) std::cout << "Warning: no floating nuisances in the group " << item << " of --breakdownGroups" << std::endl;
+    names.push_back(item);
+    groups.push_back(floating);
+  }
+
+  int len = 5;
+  for (int i = 0, n = poi_.size(); i < n; ++i) len = std::max<int>(len, poi_[i].length());
+  for (unsigned int g = 0; g < names.size(); ++g) len = std::max<int>(len, names[g].length());
+
+  // the total uncertainties, from the initial fit, as in doSingles
+  unsigned int npoi = poi_.size(), ngroups = groups.size();
+  std::vector<double> bestFit(npoi), totLo(npoi), totHi(npoi);
+  breakdownGroup_ = -1;
+  for (unsigned int i = 0; i < npoi; ++i) {
+    RooAbsArg *rfloat = res.floatParsFinal().find(poi_[i].c_str());
+    if (!rfloat) rfloat = res.constPars().find(poi_[i].c_str());
+    RooRealVar *rf = dynamic_cast<RooRealVar *>(rfloat);
+    bestFit[i] = rf->getVal();
+    totLo[i] = rf->hasRange("err68") ? rf->getMin("err68") : bestFit[i] + rf->getAsymErrorLo();
+    totHi[i] = rf->hasRange("err68") ? rf->getMax("err68") : bestFit[i] + rf->getAsymErrorHi();
+    deltaNLL_ = 0.5;
+    poiVals_[i] = totLo[i]; Combine::commitPoint(true, /*quantile=*/0.32);
+    poiVals_[i] = totHi[i]; Combine::commitPoint(true, /*quantile=*/0.32);
+    poiVals_[i] = bestFit[i];
+  }
+  deltaNLL_ = 0;
+
+  if (breakdownHesse_ && res.covQual() >= 0) {
+    // conditional variance with the group fixed: V_ii - V_iG (V_GG)^-1 V_Gi, the second term being the part of the group
+    printf("  %-*s  %-*s   %-10s  %-10s  (from the covariance matrix)\n", len, "POI", len, "Group", "Frozen", "Group");
+    const TMatrixDSym &cov = res.covarianceMatrix();
+    const RooArgList &floatPars = res.floatParsFinal();
+    for (unsigned int i = 0; i < npoi; ++i) {
+      int ip = floatPars.index(poiVars_[i]->GetName());
+      if (ip < 0) continue;
+      printf("  %-*s  %-*s   %-10.4f\n", len, poi_[i].c_str(), len, "total", std::sqrt(cov(ip,ip)));
+      for (unsigned int g = 0; g < ngroups; ++g) {
+        std::vector<int> idx;
+        RooFIter iterG = groups[g].fwdIterator();
+        for (RooAbsArg *a = iterG.next(); a != 0; a = iterG.next()) {
+          int j = floatPars.index(a->GetName());
+          if (j >= 0) idx.push_back(j);
+        }
+        double part = 0;
+        if (!idx.empty()) {
+          TMatrixDSym vgg(idx.size());
+          for (unsigned int a = 0; a < idx.size(); ++a) {
+            for (unsigned int b = 0; b < idx.size(); ++b) vgg(a,b) = cov(idx[a],idx[b]);
+          }
+          double det = 0; vgg.Invert(&det);
+          for (unsigned int a = 0; a < idx.size(); ++a) {
+            for (unsigned int b = 0; b < idx.size(); ++b) part += cov(ip,idx[a]) * vgg(a,b) * cov(idx[b],ip);
+          }
+        }
+        double frozen = cov(ip,ip) - part;
+        printf("  %-*s  %-*s   %-10.4f  %-10.4f\n", len, poi_[i].c_str(), len, names[g].c_str(), std::sqrt(std::max(frozen, 0.)), std::sqrt(std::max(part, 0.)));
+      }
+    }
+  } else if (breakdownHesse_) {
+    std::cout << "Warning: no covariance matrix from the initial fit, skipping the estimate of --breakdownHesse" << std::endl;
+  }
+
+  // the fits with each group frozen; the crossings of each group are committed here, in order, with their index
+  std::vector<double> record;
+  if (breakdownForks_ > 1 && ngroups > 1) {
+    doWithFork(nll, 0, ngroups-1, breakdownForks_, /*printLogs=*/verbose > 0, [&](unsigned int first, unsigned int last) {
+        doBreakdownRange(nll, groups, first, last);
+    }, &record, /*commit=*/false);
+  } else {
+    std::vector<double> *pointRecord = pointRecord_;
+    pointRecord_ = &record;
+    doBreakdownRange(nll, groups, 0, ngroups-1);
+    pointRecord_ = pointRecord;
+  }
+  unsigned int stride = 2 + npoi + params->getSize(), perGroup = 2 * npoi * stride;
+  if (record.size() != ngroups * perGroup) throw std::runtime_error("MultiDimFit: the fits of some groups of --breakdownGroups failed");
+  utils::FastSnapshot snap(*params);
+  for (unsigned int g = 0; g < ngroups; ++g) {
+    breakdownGroup_ = g;
+    // replayPoints takes the points of one group at a time, to set its index
+    replayPoints(*params, std::vector<double>(record.begin() + g * perGroup, record.begin() + (g+1) * perGroup));
+  }
+  breakdownGroup_ = -1;
+  snap.writeTo();
+  for (unsigned int i = 0; i < npoi; ++i) poiVals_[i] = bestFit[i];
+
+  // the uncertainty due to each group is the difference in quadrature between the total and the frozen one
+  printf("  %-*s  %-*s   %-19s  %-19s\n", len, "POI", len, "Group", "Frozen", "Group");
+  for (unsigned int i = 0; i < npoi; ++i) {
+    double tLo = bestFit[i] - totLo[i], tHi = totHi[i] - bestFit[i];
+    printf("  %-*s  %-*s   %+8.4f/%+8.4f\n", len, poi_[i].c_str(), len, "total", -tLo, tHi);
+    for (unsigned int g = 0; g < ngroups; ++g) {
+      unsigned int ip0 = g * perGroup + 2 * i * stride;
+      double fLo = bestFit[i] - record[ip0 + 2 + i], fHi = record[ip0 + stride + 2 + i] - bestFit[i];
+      printf("  %-*s  %-*s   %+8.4f/%+8.4f  %+8.4f/%+8.4f\n", len, poi_[i].c_str(), len, names[g].c_str(), -fLo, fHi,
+             -std::sqrt(std::max(tLo*tLo - fLo*fLo, 0.)), std::sqrt(std::max(tHi*tHi - fHi*fHi, 0.)));
+    }
+  }
+}
+
+void MultiDimFit::doBreakdownRange(RooAbsReal &nll, const std::vector<RooArgList> &groups, unsigned int first, unsigned int last) {
+  std::auto_ptr<RooArgSet> params(nll.getParameters((const RooArgSet *)0));
+  utils::FastSnapshot bestFit(*params);
+  std::vector<float> poiBest = poiVals_;
+  CascadeMinimizer minim(nll, CascadeMinimizer::Constrained);
+  if (!autoBoundsPOIs_.empty()) minim.setAutoBounds(&autoBoundsPOISet_);
+  if (!autoMaxPOIs_.empty()) minim.setAutoMax(&autoMaxPOISet_);
+  minim.setStrategy(minimizerStrategyForMinos_);
+  // the group is frozen at its best fit value, so the minimum doesn't move
+  double nll0 = nll.getVal(), threshold68 = nll0 + 0.5;
+  for (unsigned int g = first; g <= last && g < groups.size(); ++g) {
+    bestFit.writeTo();
+    RooFIter iterG = groups[g].fwdIterator();
+    for (RooAbsArg *a = iterG.next(); a != 0; a = iterG.next()) static_cast<RooRealVar *>(a)->setConstant(true);
+    utils::FastSnapshot frozen(*params);
+    for (unsigned int i = 0; i < poi_.size(); ++i) {
+      RooRealVar &r = *poiVars_[i];
+      double r0 = r.getVal();
+      frozen.writeTo(); r.setConstant(true);
+      double lo = findCrossing(minim, nll, r, threshold68, r0, r.getMin());
+      frozen.writeTo(); r.setConstant(true);
+      double hi = findCrossing(minim, nll, r, threshold68, r0, r.getMax());
+      if (verbose) std::cout << "Group " << g << ", " << poi_[i] << ": [" << lo << ", " << hi << "]" << std::endl;
+      // as in doSingles, a crossing that isn't found is taken at the boundary
+      bestFit.writeTo();
+      deltaNLL_ = 0.5;
+      poiVals_ = poiBest; poiVals_[i] = std::isnan(lo) ? r.getMin() : lo; commitPoint(*params, /*quantile=*/0.32);
+      poiVals_ = poiBest; poiVals_[i] = std::isnan(hi) ? r.getMax() : hi; commitPoint(*params, /*quantile=*/0.32);
+    }
+  }
+  bestFit.writeTo();
+  poiVals_ = poiBest;
+  deltaNLL_ = 0;
+}
+
+
 void MultiDimFit::doGrid(RooWorkspace *w, RooAbsReal &nll) 
 {
     unsigned int n = poi_.size();
     //if (poi_.size() > 2) throw std::logic_error("Don't know how to do a grid with more than 2 POIs.");
     double nll0 = nll.getVal();
-    if (startFromPreFit_) w->loadSnapshot("clean");
+    if (startFromPreFit_) utils::loadSnapshot(w, "clean");
 
     std::vector<double> p0(n), pmin(n), pmax(n);
     for (unsigned int i = 0; i < n; ++i) {
@@ -497,8 +855,10 @@ void MultiDimFit::doGrid(RooWorkspace *w, RooAbsReal &nll)
     if (!autoMaxPOIs_.empty()) minim.setAutoMax(&autoMaxPOISet_); 
     minim.setStrategy(minimizerStrategy_);
     std::auto_ptr<RooArgSet> params(nll.getParameters((const RooArgSet *)0));
-    RooArgSet snap; params->snapshot(snap);
-    //snap.Print("V");
+    utils::FastSnapshot snap(*params);
+    // with warm starts, each fit starts from the result of the previous point instead of the snapshot
+    bool warmStart = gridWarmStart_ && !startFromPreFit_ && !fastScan_, prevOk = false;
+    loadGridCheckpoint(*params);
     if (n == 1) {
 	// can do a more intellegent spacing of points
 	double xbestpoint = (p0[0] - pmin[0]) / ((pmax[0]-pmin[0])/points_) ;
@@ -506,6 +866,7 @@ void MultiDimFit::doGrid(RooWorkspace *w, RooAbsReal &nll)
         for (unsigned int i = 0; i < points_; ++i) {
             if (i < firstPoint_) continue;
             if (i > lastPoint_)  break;
+            if (checkpointGridPoint(*params, i)) { prevOk = false; continue; }
             double x =  pmin[0] + (i+0.5)*(pmax[0]-pmin[0])/points_; 
 	    if( xbestpoint > lastPoint_ ){
 		int ireverse = lastPoint_ - i + firstPoint_ ;
@@ -521,7 +882,8 @@ void MultiDimFit::doGrid(RooWorkspace *w, RooAbsReal &nll)
 
             //if (verbose > 1) std::cout << "Point " << i << "/" << points_ << " " << poiVars_[0]->GetName() << " = " << x << std::endl;
              std::cout << "Point " << i << "/" << points_ << " " << poiVars_[0]->GetName() << " = " << x << std::endl;
-            *params = snap; 
+            if (!warmStart || !prevOk) snap.writeTo(); 
+            prevOk = false;
             poiVals_[0] = x;
             poiVars_[0]->setVal(x);
             // now we minimize
@@ -535,12 +897,12 @@ void MultiDimFit::doGrid(RooWorkspace *w, RooAbsReal &nll)
 		for(unsigned int j=0; j<specifiedFuncNames_.size(); j++){
 			specifiedFuncVals_[j]=specifiedFunc_[j]->getVal();
 		}
-                Combine::commitPoint(true, /*quantile=*/0);
+                commitPoint(*params, /*quantile=*/0);
                 continue;
             }
-            bool ok = fastScan_ || (hasMaxDeltaNLLForProf_ && (nll.getVal() - nll0) > maxDeltaNLLForProf_) ? 
-                        true : 
-                        minim.minimize(verbose-1);
+            bool skipme = hasMaxDeltaNLLForProf_ && (nll.getVal() - nll0) > maxDeltaNLLForProf_;
+            bool ok = fastScan_ || skipme ? fastProfile(nll, skipme) : minim.minimize(verbose-1);
+            prevOk = ok;
             if (ok) {
                 deltaNLL_ = nll.getVal() - nll0;
                 double qN = 2*(deltaNLL_);
@@ -554,7 +916,7 @@ void MultiDimFit::doGrid(RooWorkspace *w, RooAbsReal &nll)
 		for(unsigned int j=0; j<specifiedCatNames_.size(); j++){
 			specifiedCatVals_[j]=specifiedCat_[j]->getIndex();
 		}
-                Combine::commitPoint(true, /*quantile=*/prob);
+                commitPoint(*params, /*quantile=*/prob);
             }
         }
     } else if (n == 2) {
@@ -567,12 +929,16 @@ void MultiDimFit::doGrid(RooWorkspace *w, RooAbsReal &nll)
             for (unsigned int j = 0; j < sqrn; ++j, ++ipoint) {
                 if (ipoint < firstPoint_) continue;
                 if (ipoint > lastPoint_)  break;
-                *params = snap; 
+                if (checkpointGridPoint(*params, ipoint)) { prevOk = false; continue; }
+                if (!warmStart || !prevOk) snap.writeTo(); 
+                prevOk = false;
+                // with warm starts, walk the rows back and forth so that consecutive points are always neighbours
+                unsigned int jj = (warmStart && (i % 2 == 1)) ? sqrn - 1 - j : j;
                 double x =  pmin[0] + (i+0.5)*deltaX; 
-                double y =  pmin[1] + (j+0.5)*deltaY; 
+                double y =  pmin[1] + (jj+0.5)*deltaY; 
                 if (verbose && (ipoint % nprint == 0)) {
                          fprintf(sentry.trueStdOut(), "Point %d/%d, (i,j) = (%d,%d), %s = %f, %s = %f\n",
-                                        ipoint,sqrn*sqrn, i,j, poiVars_[0]->GetName(), x, poiVars_[1]->GetName(), y);
+                                        ipoint,sqrn*sqrn, i,jj, poiVars_[0]->GetName(), x, poiVars_[1]->GetName(), y);
                 }
                 poiVals_[0] = x;
                 poiVals_[1] = y;
@@ -589,7 +955,7 @@ void MultiDimFit::doGrid(RooWorkspace *w, RooAbsReal &nll)
 			for(unsigned int j=0; j<specifiedCatNames_.size(); j++){
 				specifiedCatVals_[j]=specifiedCat_[j]->getIndex();
 			}
-                    deltaNLL_ = 9999; Combine::commitPoint(true, /*quantile=*/0); 
+                    deltaNLL_ = 9999; commitPoint(*params, /*quantile=*/0); 
                     if (gridType_ == G3x3) {
                         for (int i2 = -1; i2 <= +1; ++i2) {
                             for (int j2 = -1; j2 <= +1; ++j2) {
@@ -605,7 +971,7 @@ void MultiDimFit::doGrid(RooWorkspace *w, RooAbsReal &nll)
 				for(unsigned int j=0; j<specifiedCatNames_.size(); j++){
 					specifiedCatVals_[j]=specifiedCat_[j]->getIndex();
 				}
-                                deltaNLL_ = 9999; Combine::commitPoint(true, /*quantile=*/0); 
+                                deltaNLL_ = 9999; commitPoint(*params, /*quantile=*/0); 
                             }
                         }
                     }
@@ -613,7 +979,8 @@ void MultiDimFit::doGrid(RooWorkspace *w, RooAbsReal &nll)
                 }
                 // now we minimize
                 bool skipme = hasMaxDeltaNLLForProf_ && (nll.getVal() - nll0) > maxDeltaNLLForProf_;
-                bool ok = fastScan_ || skipme ? true :  minim.minimize(verbose-1);
+                bool ok = fastScan_ || skipme ? fastProfile(nll, skipme) : minim.minimize(verbose-1);
+                prevOk = ok;
                 if (ok) {
                     deltaNLL_ = nll.getVal() - nll0;
                     double qN = 2*(deltaNLL_);
@@ -627,7 +994,7 @@ void MultiDimFit::doGrid(RooWorkspace *w, RooAbsReal &nll)
 		    for(unsigned int j=0; j<specifiedCatNames_.size(); j++){
 			    specifiedCatVals_[j]=specifiedCat_[j]->getIndex();
 		    }
-                    Combine::commitPoint(true, /*quantile=*/prob);
+                    commitPoint(*params, /*quantile=*/prob);
                 }
                 if (gridType_ == G3x3) {
                     bool forceProfile = !fastScan_ && std::min(fabs(deltaNLL_ - 1.15), fabs(deltaNLL_ - 2.995)) < 0.5;
@@ -652,9 +1019,10 @@ void MultiDimFit::doGrid(RooWorkspace *w, RooAbsReal &nll)
 				    for(unsigned int j=0; j<specifiedCatNames_.size(); j++){
 					    specifiedCatVals_[j]=specifiedCat_[j]->getIndex();
 				    }
-                                deltaNLL_ = 9999; Combine::commitPoint(true, /*quantile=*/0); 
+                                deltaNLL_ = 9999; commitPoint(*params, /*quantile=*/0); 
                                 continue;
                             }
+                            if (fastScan_) fastProfile(nll, false);
                             deltaNLL_ = nll.getVal() - nll0;
                             if (forceProfile || (!fastScan_ && std::min(fabs(deltaNLL_ - 1.15), fabs(deltaNLL_ - 2.995)) < 0.5)) {
                                 minim.minimize(verbose-1);
@@ -671,9 +1039,10 @@ void MultiDimFit::doGrid(RooWorkspace *w, RooAbsReal &nll)
 			    for(unsigned int j=0; j<specifiedCatNames_.size(); j++){
 				    specifiedCatVals_[j]=specifiedCat_[j]->getIndex();
 			    }
-                            Combine::commitPoint(true, /*quantile=*/prob);
+                            commitPoint(*params, /*quantile=*/prob);
                         }
                     }
+                    if (warmStart) center.writeTo(*params);
                 }
             }
         }
@@ -701,7 +1070,9 @@ void MultiDimFit::doGrid(RooWorkspace *w, RooAbsReal &nll)
 
           if (ipoint < firstPoint_) {ipoint++; continue;}
           if (ipoint > lastPoint_)  break;
-          *params = snap; 
+          if (checkpointGridPoint(*params, ipoint)) { prevOk = false; ipoint++; continue; }
+          if (!warmStart || !prevOk) snap.writeTo(); 
+          prevOk = false;
 
           if (verbose && (ipoint % nprint == 0)) {
              fprintf(sentry.trueStdOut(), "Point %d/%d, ",
@@ -730,13 +1101,14 @@ void MultiDimFit::doGrid(RooWorkspace *w, RooAbsReal &nll)
 		for(unsigned int j=0; j<specifiedCatNames_.size(); j++){
 			specifiedCatVals_[j]=specifiedCat_[j]->getIndex();
 		}
-               deltaNLL_ = 9999; Combine::commitPoint(true, /*quantile=*/0);
+               deltaNLL_ = 9999; commitPoint(*params, /*quantile=*/0);
                ipoint++;
 	       continue;
 	  }
           // now we minimize
           bool skipme = hasMaxDeltaNLLForProf_ && (nll.getVal() - nll0) > maxDeltaNLLForProf_;
-          bool ok = fastScan_ || skipme ? true :  minim.minimize(verbose-1);
+          bool ok = fastScan_ || skipme ? fastProfile(nll, skipme) : minim.minimize(verbose-1);
+          prevOk = ok;
           if (ok) {
                deltaNLL_ = nll.getVal() - nll0;
                double qN = 2*(deltaNLL_);
@@ -750,37 +1122,380 @@ void MultiDimFit::doGrid(RooWorkspace *w, RooAbsReal &nll)
 		for(unsigned int j=0; j<specifiedCatNames_.size(); j++){
 			specifiedCatVals_[j]=specifiedCat_[j]->getIndex();
 		}
-               Combine::commitPoint(true, /*quantile=*/prob);
+               commitPoint(*params, /*quantile=*/prob);
           }
 	  ipoint++;	
 	} 
     }
+    checkpointGridPoint(*params, -1);
+}
+
+unsigned int MultiDimFit::gridSize() const
+{
+    unsigned int n = poi_.size();
+    if (n == 1) return points_;
+    if (n == 2) {
+        unsigned int sqrn = ceil(sqrt(double(points_)));
+        return sqrn*sqrn;
+    }
+    unsigned int rootn = ceil(TMath::Power(double(points_),double(1./n))), ret = 1;
+    for (unsigned int i = 0; i < n; ++i) ret *= rootn;
+    return ret;
+}
+
+void MultiDimFit::commitPoint(const RooAbsCollection &params, float quantile) 
+{
+    trackBestPoint();
+    if (checkpointPoint_ >= 0) recordPoint(checkpointRecord_, params, quantile);
+    if (pointRecord_ == 0) { 
+        Combine::commitPoint(true, quantile); 
+        return; 
+    }
+    recordPoint(*pointRecord_, params, quantile);
+}
+
+void MultiDimFit::recordPoint(std::vector<double> &record, const RooAbsCollection &params, float quantile) const
+{
+    // record what can't be recomputed from the parameters, and the parameters themselves
+    record.push_back(quantile);
+    record.push_back(deltaNLL_);
+    record.insert(record.end(), poiVals_.begin(), poiVals_.end());
+    RooFIter iter = params.fwdIterator();
+    for (RooAbsArg *a = iter.next(); a != 0; a = iter.next()) {
+        RooRealVar *rrv = dynamic_cast<RooRealVar *>(a);
+        if (rrv) { record.push_back(rrv->getVal()); continue; }
+        RooCategory *rc = dynamic_cast<RooCategory *>(a);
+        record.push_back(rc ? rc->getIndex() : 0);
+    }
+}
+
+unsigned int MultiDimFit::replayPoints(const RooAbsCollection &params, const std::vector<double> &record)
+{
+    unsigned int n = poi_.size(), stride = 2 + n + params.getSize(), npoints = 0;
+    // the points being replayed are already in the checkpoint
+    int checkpointPoint = checkpointPoint_; checkpointPoint_ = -1;
+    for (unsigned int ip0 = 0; ip0 + stride <= record.size(); ip0 += stride, ++npoints) {
+        RooFIter iter = params.fwdIterator(); unsigned int ip = ip0 + 2 + n;
+        for (RooAbsArg *a = iter.next(); a != 0; a = iter.next(), ++ip) {
+            RooRealVar *rrv = dynamic_cast<RooRealVar *>(a);
+            if (rrv) { rrv->setVal(record[ip]); continue; }
+            RooCategory *rc = dynamic_cast<RooCategory *>(a);
+            if (rc) rc->setIndex(int(record[ip]));
+        }
+        for (unsigned int j = 0; j < n; ++j) poiVals_[j] = record[ip0+2+j];
+        deltaNLL_ = record[ip0+1];
+        if (algo_ == FixedPoint) nllValue_ = nll0Value_ + deltaNLL_;
+        for(unsigned int j=0; j<specifiedNuis_.size(); j++){
+            specifiedVals_[j]=specifiedVars_[j]->getVal();
+        }
+        for(unsigned int j=0; j<specifiedFuncNames_.size(); j++){
+            specifiedFuncVals_[j]=specifiedFunc_[j]->getVal();
+        }
+        for(unsigned int j=0; j<specifiedCatNames_.size(); j++){
+            specifiedCatVals_[j]=specifiedCat_[j]->getIndex();
+        }
+        commitPoint(params, /*quantile=*/record[ip0]);
+    }
+    checkpointPoint_ = checkpointPoint;
+    return npoints;
+}
+
+void MultiDimFit::loadGridCheckpoint(const RooAbsCollection &params)
+{
+    checkpointSaved_.clear(); checkpointRecord_.clear(); checkpointPoint_ = -1;
+    if (!Checkpoint::enabled() || !Checkpoint::resuming()) return;
+    unsigned int stride = 2 + poi_.size() + params.getSize(), nbad = 0;
+    std::vector<Checkpoint::Record> records;
+    Checkpoint::load("MultiDimFit::doGrid", records);
+    for (std::vector<Checkpoint::Record>::const_iterator it = records.begin(), ed = records.end(); it != ed; ++it) {
+        char *end = 0; unsigned long ipoint = strtoul(it->key.c_str(), &end, 10);
+        if (it->key.empty() || *end != 0 || it->payload.size() % (stride*sizeof(double)) != 0) { ++nbad; continue; }
+        std::vector<double> &saved = checkpointSaved_[ipoint];
+        saved.resize(it->payload.size()/sizeof(double));
+        if (!saved.empty()) memcpy(&saved[0], &it->payload[0], it->payload.size());
+    }
+    if (nbad) std::cerr << "MultiDimFit: ignored " << nbad << " records of the checkpoint that don't match this model" << std::endl;
+    if (verbose) std::cout << "MultiDimFit: " << checkpointSaved_.size() << " points of the grid found in the checkpoint" << std::endl;
+}
+
+bool MultiDimFit::checkpointGridPoint(const RooAbsCollection &params, int ipoint)
+{
+    if (!Checkpoint::enabled()) return false;
+    if (checkpointPoint_ >= 0) {
+        std::vector<char> payload(reinterpret_cast<const char *>(checkpointRecord_.data()), 
+                                  reinterpret_cast<const char *>(checkpointRecord_.data() + checkpointRecord_.size()));
+        Checkpoint::save("MultiDimFit::doGrid", TString::Format("%d", checkpointPoint_).Data(), payload);
+        checkpointRecord_.clear(); checkpointPoint_ = -1;
+    }
+    if (ipoint < 0) return false;
+    std::map<unsigned int, std::vector<double> >::const_iterator saved = checkpointSaved_.find(ipoint);
+    if (saved != checkpointSaved_.end()) {
+        replayPoints(params, saved->second);
+        return true;
+    }
+    checkpointPoint_ = ipoint;
+    return false;
+}
+
+void MultiDimFit::doGridWithFork(RooWorkspace *w, RooAbsReal &nll) 
+{
+    unsigned int first = firstPoint_, last = std::min(lastPoint_, gridSize()-1);
+    if (last < first) return;
+    doWithFork(nll, first, last, gridForks_, verbose > 1, [&](unsigned int firstPoint, unsigned int lastPoint) {
+        firstPoint_ = firstPoint; lastPoint_ = lastPoint;
+        doGrid(w, nll);
+    });
+}
+
+void MultiDimFit::doWithFork(RooAbsReal &nll, unsigned int first, unsigned int last, unsigned int nforks, bool printLogs, const std::function<void(unsigned int, unsigned int)> &job, std::vector<double> *collected, bool commit) 
+{
+    unsigned int nfork = std::min(nforks, last - first + 1);
+    std::auto_ptr<RooArgSet> params(nll.getParameters((const RooArgSet *)0));
+    // evaluate the NLL once, so that its caches are built in the parent and shared copy-on-write by all the children
+    nll.getVal();
+    // each child does a contiguous block of items, so that consecutive fits are close to each other
+    std::vector<std::vector<double> > records;
+    std::vector<bool> failed;
+    utils::runInForks(0, nfork, [&](unsigned int ich) -> std::vector<double> {
+        unsigned int myFirst = first + (ich * (last - first + 1)) / nfork;
+        unsigned int myLast  = first + ((ich + 1) * (last - first + 1)) / nfork - 1;
+        std::vector<double> record; 
+        pointRecord_ = &record;
+        job(myFirst, myLast);
+        return record;
+    }, records, false, printLogs, &failed);
+    // now fill the tree in order, restoring the parameters of each point before committing it
+    unsigned int stride = 2 + poi_.size() + params->getSize(), npoints = 0;
+    for (unsigned int ich = 0; ich < nfork; ++ich) {
+        if (failed[ich]) {
+            std::cerr << "WARNING: MultiDimFit: the items " << first + (ich * (last - first + 1)) / nfork << "-" << first + ((ich + 1) * (last - first + 1)) / nfork - 1 << " were lost, as the process doing them failed." << std::endl;
+            continue;
+        }
+        std::vector<double> &record = records[ich];
+        if (record.size() % stride) record.resize(record.size() - record.size() % stride);
+        npoints += commit ? replayPoints(*params, record) : record.size() / stride;
+        if (collected) collected->insert(collected->end(), record.begin(), record.end());
+    }
+    if (verbose > 1) std::cout << "Collected " << npoints << " points from " << nfork << " processes." << std::endl;
+}
+
+void MultiDimFit::doAdaptiveGrid(RooWorkspace *w, RooAbsReal &nll) 
+{
+    unsigned int n = poi_.size();
+    double nll0 = nll.getVal();
+    if (startFromPreFit_) utils::loadSnapshot(w, "clean");
+    std::vector<double> pmin(n), pmax(n);
+    for (unsigned int i = 0; i < n; ++i) {
+        pmin[i] = poiVars_[i]->getMin();
+        pmax[i] = poiVars_[i]->getMax();
+        poiVars_[i]->setConstant(true);
+    }
+    std::vector<double> levels;
+    if (adaptiveLevels_.empty()) {
+        // the 68% and 95% contours
+        levels.push_back(0.5*ROOT::Math::chisquared_quantile(0.6827, n+nOtherFloatingPoi_));
+        levels.push_back(0.5*ROOT::Math::chisquared_quantile(0.9545, n+nOtherFloatingPoi_));
+    } else {
+        std::vector<std::string> items;
+        boost::split(items, adaptiveLevels_, boost::is_any_of(","));
+        for (const std::string &item : items) levels.push_back(atof(item.c_str()));
+    }
+
+    // all the points are on a lattice with fine = coarse * 2^adaptiveDepth_ intervals along each POI
+    unsigned int coarse = std::max(1u, n == 1 ? points_ : (unsigned int)ceil(TMath::Power(double(points_), 1./n)));
+    unsigned int fine = coarse << adaptiveDepth_, ncorners = 1u << n;
+    if (n > 4 || TMath::Power(fine + 1., double(n)) > double(std::numeric_limits<uint64_t>::max())) throw std::invalid_argument("MultiDimFit: --algo=adaptive can't do so many POIs or levels of refinement");
+    auto key = [&](const std::vector<unsigned int> &idx) { uint64_t k = 0; for (unsigned int i = 0; i < n; ++i) k = k * (fine + 1) + idx[i]; return k; };
+    std::map<uint64_t, double> values; // deltaNLL at each lattice point fitted (NaN if the fit failed)
+
+    CascadeMinimizer minim(nll, CascadeMinimizer::Constrained);
+    if (!autoBoundsPOIs_.empty()) minim.setAutoBounds(&autoBoundsPOISet_); 
+    if (!autoMaxPOIs_.empty()) minim.setAutoMax(&autoMaxPOISet_); 
+    minim.setStrategy(minimizerStrategy_);
+    std::auto_ptr<RooArgSet> params(nll.getParameters((const RooArgSet *)0));
+    utils::FastSnapshot snap(*params);
+    RooAbsReal::setEvalErrorLoggingMode(RooAbsReal::CountErrors);
+    // fit the points indexed by todo[first ... last], committing them, and return their deltaNLL
+    std::vector<std::vector<unsigned int> > todo;
+    auto fitPoints = [&](unsigned int first, unsigned int last, std::vector<double> *out) {
+        CloseCoutSentry sentry(verbose < 2);
+        for (unsigned int ip = first; ip <= last; ++ip) {
+            snap.writeTo();
+            for (unsigned int i = 0; i < n; ++i) {
+                poiVals_[i] = pmin[i] + todo[ip][i] * (pmax[i] - pmin[i]) / fine;
+                poiVars_[i]->setVal(poiVals_[i]);
+            }
+            nll.clearEvalErrorLog(); nll.getVal();
+            bool ok = (nll.numEvalErrors() == 0);
+            if (ok) {
+                bool skipme = hasMaxDeltaNLLForProf_ && (nll.getVal() - nll0) > maxDeltaNLLForProf_;
+                ok = fastScan_ || skipme ? fastProfile(nll, skipme) : minim.minimize(verbose-1);
+            }
+            deltaNLL_ = ok ? nll.getVal() - nll0 : std::numeric_limits<double>::quiet_NaN();
+            if (out) out->push_back(deltaNLL_);
+            if (!ok) continue;
+            for(unsigned int j=0; j<specifiedNuis_.size(); j++){
+                specifiedVals_[j]=specifiedVars_[j]->getVal();
+            }
+            for(unsigned int j=0; j<specifiedFuncNames_.size(); j++){
+                specifiedFuncVals_[j]=specifiedFunc_[j]->getVal();
+            }
+            for(unsigned int j=0; j<specifiedCatNames_.size(); j++){
+                specifiedCatVals_[j]=specifiedCat_[j]->getIndex();
+            }
+            commitPoint(*params, /*quantile=*/ROOT::Math::chisquared_cdf_c(2*deltaNLL_, n+nOtherFloatingPoi_));
+        }
+    };
+
+    // cells by the lattice index of their lowest corner, starting from the coarse grid
+    std::vector<std::vector<unsigned int> > cells;
+    std::vector<unsigned int> idx(n, 0);
+    for (bool more = true; more; ) {
+        cells.push_back(idx);
+        for (unsigned int i = 0; i < n; ++i) cells.back()[i] <<= adaptiveDepth_;
+        more = false;
+        for (unsigned int i = 0; i < n && !more; ++i) { if (++idx[i] < coarse) more = true; else idx[i] = 0; }
+    }
+    unsigned int npoints = 0;
+    for (unsigned int level = 0; ; ++level) {
+        unsigned int step = 1u << (adaptiveDepth_ - level);
+        // the corners of the cells of this level that have not been fitted yet, all fitted together (or by the forks)
+        todo.clear();
+        std::set<uint64_t> queued;
+        for (const std::vector<unsigned int> &cell : cells) {
+            for (unsigned int mask = 0; mask < ncorners; ++mask) {
+                for (unsigned int i = 0; i < n; ++i) idx[i] = cell[i] + ((mask >> i) & 1) * step;
+                uint64_t k = key(idx);
+                if (values.count(k) || !queued.insert(k).second) continue;
+                todo.push_back(idx);
+            }
+        }
+        if (verbose) std::cout << "Adaptive scan, level " << level << ": " << cells.size() << " cells, " << todo.size() << " new points" << std::endl;
+        std::vector<double> deltaNLLs;
+        if (!todo.empty() && gridForks_ > 1 && todo.size() > 1) {
+            std::vector<double> records;
+            doWithFork(nll, 0, todo.size()-1, gridForks_, verbose > 1, [&](unsigned int first, unsigned int last) { fitPoints(first, last, 0); }, &records);
+            // the failed fits are not recorded: match the points by their POI values
+            std::map<uint64_t, double> got;
+            unsigned int stride = 2 + n + params->getSize();
+            for (unsigned int ip0 = 0; ip0 + stride <= records.size(); ip0 += stride) {
+                for (unsigned int i = 0; i < n; ++i) idx[i] = (unsigned int) floor((records[ip0+2+i] - pmin[i]) * fine / (pmax[i] - pmin[i]) + 0.5);
+                got[key(idx)] = records[ip0+1];
+            }
+            for (const std::vector<unsigned int> &p : todo) {
+                std::map<uint64_t, double>::const_iterator it = got.find(key(p));
+                deltaNLLs.push_back(it != got.end() ? it->second : std::numeric_limits<double>::quiet_NaN());
+            }
+        } else if (!todo.empty()) {
+            fitPoints(0, todo.size()-1, &deltaNLLs);
+        }
+        for (unsigned int ip = 0; ip < todo.size(); ++ip) values[key(todo[ip])] = deltaNLLs[ip];
+        npoints += todo.size();
+        if (level == adaptiveDepth_) break;
+        // split in 2^n the cells whose corners are on both sides of a contour
+        std::vector<std::vector<unsigned int> > next;
+        unsigned int half = step / 2;
+        for (const std::vector<unsigned int> &cell : cells) {
+            double lo = std::numeric_limits<double>::max(), hi = -lo;
+            for (unsigned int mask = 0; mask < ncorners; ++mask) {
+                for (unsigned int i = 0; i < n; ++i) idx[i] = cell[i] + ((mask >> i) & 1) * step;
+                double v = values[key(idx)];
+                if (std::isnan(v)) continue;
+                lo = std::min(lo, v); hi = std::max(hi, v);
+            }
+            bool straddles = false;
+            for (double l : levels) if (lo < l && l <= hi) straddles = true;
+            if (!straddles) continue;
+            for (unsigned int mask = 0; mask < ncorners; ++mask) {
+                for (unsigned int i = 0; i < n; ++i) idx[i] = cell[i] + ((mask >> i) & 1) * half;
+                next.push_back(idx);
+            }
+        }
+        if (next.empty()) break;
+        cells.swap(next);
+    }
+    if (verbose) std::cout << "Adaptive scan done with " << npoints << " points, instead of " << TMath::Power(fine + 1., double(n)) << " for the uniform grid with the same resolution" << std::endl;
 }
 
 void MultiDimFit::doRandomPoints(RooWorkspace *w, RooAbsReal &nll) 
 {
     double nll0 = nll.getVal();
-    if (startFromPreFit_) w->loadSnapshot("clean");
+    if (startFromPreFit_) utils::loadSnapshot(w, "clean");
     for (unsigned int i = 0, n = poi_.size(); i < n; ++i) {
         poiVars_[i]->setConstant(true);
     }
+    if (points_ == 0) return;
+    unsigned int n = poi_.size();
+    // with forks or a Sobol sequence all the points are drawn first, so that they don't depend on which process fits them
+    std::vector<double> points;
+    bool forks = gridForks_ > 1 && points_ > 1;
+    if (randomPointsSobol_) {
+        points.resize(points_ * n);
+        SobolSequence sobol(n, RooRandom::integer(std::numeric_limits<UInt_t>::max() - 1));
+        for (unsigned int j = 0; j < points_; ++j) {
+            double *x = &points[j * n];
+            sobol.next(x);
+            for (unsigned int i = 0; i < n; ++i) x[i] = poiVars_[i]->getMin() + x[i] * (poiVars_[i]->getMax() - poiVars_[i]->getMin());
+        }
+    } else if (forks) {
+        points.resize(points_ * n);
+        for (unsigned int j = 0; j < points_; ++j) {
+            for (unsigned int i = 0; i < n; ++i) {
+                poiVars_[i]->randomize();
+                points[j * n + i] = poiVars_[i]->getVal();
+            }
+        }
+    }
+    if (forks) {
+        doWithFork(nll, 0, points_ - 1, gridForks_, verbose > 1, [&](unsigned int first, unsigned int last) {
+            doRandomPointRange(nll, nll0, points, first, last);
+        });
+    } else {
+        doRandomPointRange(nll, nll0, points, 0, points_ - 1);
+    }
+}
 
+void MultiDimFit::doRandomPointRange(RooAbsReal &nll, double nll0, const std::vector<double> &points, unsigned int first, unsigned int last) 
+{
     CascadeMinimizer minim(nll, CascadeMinimizer::Constrained);
     if (!autoBoundsPOIs_.empty()) minim.setAutoBounds(&autoBoundsPOISet_); 
     if (!autoMaxPOIs_.empty()) minim.setAutoMax(&autoMaxPOISet_); 
     minim.setStrategy(minimizerStrategy_);
     unsigned int n = poi_.size();
-    for (unsigned int j = 0; j < points_; ++j) {
+    std::auto_ptr<RooArgSet> params(nll.getParameters((const RooArgSet *)0));
+    // with warm starts, the floating parameters start from the result of the nearest point already fitted,
+    // the distance being measured with each POI scaled to its range
+    std::vector<RooRealVar *> floating;
+    RooFIter iter = params->fwdIterator();
+    for (RooAbsArg *a = iter.next(); a != 0; a = iter.next()) {
+        RooRealVar *rrv = dynamic_cast<RooRealVar *>(a);
+        if (rrv && !rrv->isConstant()) floating.push_back(rrv);
+    }
+    unsigned int nf = floating.size();
+    std::vector<double> fittedPois, fittedVals, scale(n);
+    for (unsigned int i = 0; i < n; ++i) scale[i] = 1.0/std::max(poiVars_[i]->getMax() - poiVars_[i]->getMin(), 1e-30);
+    for (unsigned int j = first; j <= last; ++j) {
         for (unsigned int i = 0; i < n; ++i) {
-            poiVars_[i]->randomize();
+            if (points.empty()) poiVars_[i]->randomize();
+            else poiVars_[i]->setVal(points[j * n + i]);
             poiVals_[i] = poiVars_[i]->getVal(); 
         }
+        if (randomPointsWarmStart_ && !fittedPois.empty()) {
+            unsigned int best = 0; double bestDist = std::numeric_limits<double>::max();
+            for (unsigned int k = 0, nk = fittedPois.size() / n; k < nk; ++k) {
+                double dist = 0;
+                for (unsigned int i = 0; i < n; ++i) dist += std::pow((fittedPois[k * n + i] - poiVals_[i]) * scale[i], 2);
+                if (dist < bestDist) { bestDist = dist; best = k; }
+            }
+            for (unsigned int f = 0; f < nf; ++f) floating[f]->setVal(fittedVals[best * nf + f]);
+        }
         // now we minimize
         {   
             CloseCoutSentry sentry(verbose < 3);    
             bool ok = minim.minimize(verbose-1);
             if (ok) {
-                double qN = 2*(nll.getVal() - nll0);
+                deltaNLL_ = nll.getVal() - nll0;
+                double qN = 2*deltaNLL_;
                 double prob = ROOT::Math::chisquared_cdf_c(qN, n+nOtherFloatingPoi_);
 		for(unsigned int j=0; j<specifiedNuis_.size(); j++){
 			specifiedVals_[j]=specifiedVars_[j]->getVal();
@@ -791,7 +1506,11 @@ void MultiDimFit::doRandomPoints(RooWorkspace *w, RooAbsReal &nll)
 		for(unsigned int j=0; j<specifiedCatNames_.size(); j++){
 			specifiedCatVals_[j]=specifiedCat_[j]->getIndex();
 		}
-                Combine::commitPoint(true, /*quantile=*/prob);
+                commitPoint(*params, /*quantile=*/prob);
+                if (randomPointsWarmStart_) {
+                    fittedPois.insert(fittedPois.end(), poiVals_.begin(), poiVals_.end());
+                    for (unsigned int f = 0; f < nf; ++f) fittedVals.push_back(floating[f]->getVal());
+                }
             }
         } 
     }
@@ -799,10 +1518,11 @@ void MultiDimFit::doRandomPoints(RooWorkspace *w, RooAbsReal &nll)
 void MultiDimFit::doFixedPoint(RooWorkspace *w, RooAbsReal &nll) 
 {
     double nll0 = nll.getVal();
-    if (startFromPreFit_) w->loadSnapshot("clean");
+    if (startFromPreFit_) utils::loadSnapshot(w, "clean");
     for (unsigned int i = 0, n = poi_.size(); i < n; ++i) {
         poiVars_[i]->setConstant(true);
     }
+    if (fixedPointsFile_ != "") { doFixedPoints(nll, nll0); return; }
 
     CascadeMinimizer minim(nll, CascadeMinimizer::Constrained);
     if (!autoBoundsPOIs_.empty()) minim.setAutoBounds(&autoBoundsPOISet_); 
@@ -852,6 +1572,176 @@ void MultiDimFit::doFixedPoint(RooWorkspace *w, RooAbsReal &nll)
     } 
 }
 
+void MultiDimFit::readFixedPoints(std::vector<double> &points) const
+{
+    unsigned int n = poi_.size();
+    std::vector<double> defaults(n);
+    for (unsigned int i = 0; i < n; ++i) defaults[i] = poiVars_[i]->getVal();
+    std::string::size_type root = fixedPointsFile_.find(".root:");
+    if (root != std::string::npos) {
+        // file.root:tree, or file.root:tree:POI=expression,... to take some POIs from expressions instead of branches
+        std::string fileName = fixedPointsFile_.substr(0, root+5), treeName = fixedPointsFile_.substr(root+6);
+        std::vector<std::string> exprs(poi_);
+        std::string::size_type colon = treeName.find(':');
+        if (colon != std::string::npos) {
+            std::vector<std::string> items;
+            std::string list = treeName.substr(colon+1);
+            boost::split(items, list, boost::is_any_of(","), boost::token_compress_on);
+            treeName = treeName.substr(0, colon);
+            for (const std::string &item : items) {
+                std::string::size_type eq = item.find('=');
+                std::vector<std::string>::const_iterator it = (eq == std::string::npos ? poi_.end() : std::find(poi_.begin(), poi_.end(), boost::trim_copy(item.substr(0, eq))));
+                if (it == poi_.end()) throw std::invalid_argument("MultiDimFit: can't parse '"+item+"' in "+fixedPointsFile_+", expecting POI=expression");
+                exprs[it - poi_.begin()] = item.substr(eq+1);
+            }
+        }
+        std::auto_ptr<TFile> file(TFile::Open(fileName.c_str()));
+        if (file.get() == 0 || file->IsZombie()) throw std::invalid_argument("MultiDimFit: can't open the points file "+fileName);
+        TTree *tree = dynamic_cast<TTree *>(file->Get(treeName.c_str()));
+        if (tree == 0) throw std::invalid_argument("MultiDimFit: no tree "+treeName+" in "+fileName);
+        std::vector<TTreeFormula *> formulas(n, (TTreeFormula *)0);
+        for (unsigned int i = 0; i < n; ++i) {
+            if (exprs[i] == poi_[i] && tree->GetBranch(poi_[i].c_str()) == 0) {
+                std::cout << "The points of " << fixedPointsFile_ << " don't have " << poi_[i] << ", it will be kept at " << defaults[i] << std::endl;
+                continue;
+            }
+            formulas[i] = new TTreeFormula(poi_[i].c_str(), exprs[i].c_str(), tree);
+            if (formulas[i]->GetNdim() == 0) {
+                for (unsigned int j = 0; j <= i; ++j) delete formulas[j];
+                throw std::invalid_argument("MultiDimFit: can't compile '"+exprs[i]+"' for "+poi_[i]+" on the tree "+treeName+" of "+fileName);
+            }
+        }
+        for (Long64_t entry = 0, nentries = tree->GetEntries(); entry < nentries; ++entry) {
+            tree->LoadTree(entry);
+            std::vector<double> point(defaults);
+            bool ok = true;
+            for (unsigned int i = 0; i < n; ++i) {
+                if (formulas[i] == 0) continue;
+                formulas[i]->GetNdata();
+                point[i] = formulas[i]->EvalInstance();
+                if (!std::isfinite(point[i])) ok = false;
+            }
+            if (!ok) { std::cout << "Skipping the entry " << entry << " of " << fixedPointsFile_ << ", its point is not finite" << std::endl; continue; }
+            points.insert(points.end(), point.begin(), point.end());
+        }
+        for (unsigned int i = 0; i < n; ++i) delete formulas[i];
+        return;
+    }
+    std::ifstream in(fixedPointsFile_.c_str());
+    if (!in.good()) throw std::invalid_argument("MultiDimFit: can't open the points file "+fixedPointsFile_);
+    std::string line;
+    for (unsigned int iline = 1; std::getline(in, line); ++iline) {
+        line = line.substr(0, line.find('#'));
+        boost::trim(line);
+        if (line.empty()) continue;
+        std::vector<double> point(defaults);
+        std::vector<std::string> items;
+        boost::split(items, line, boost::is_any_of(", \t"), boost::token_compress_on);
+        for (const std::string &item : items) {
+            std::string::size_type eq = item.find('=');
+            std::vector<std::string>::const_iterator it = (eq == std::string::npos ? poi_.end() : std::find(poi_.begin(), poi_.end(), item.substr(0, eq)));
+            if (it == poi_.end()) {
+                throw std::invalid_argument("MultiDimFit: can't parse '"+item+"' at line "+std::to_string(iline)+" of "+fixedPointsFile_+", expecting POI=value");
+            }
+            point[it - poi_.begin()] = atof(item.substr(eq+1).c_str());
+        }
+        if (std::find_if(point.begin(), point.end(), [](double x) { return !std::isfinite(x); }) != point.end()) {
+            std::cout << "Skipping the line " << iline << " of " << fixedPointsFile_ << ", its point is not finite" << std::endl;
+            continue;
+        }
+        points.insert(points.end(), point.begin(), point.end());
+    }
+}
+
+void MultiDimFit::doFixedPoints(RooAbsReal &nll, double nll0) 
+{
+    unsigned int n = poi_.size();
+    std::vector<double> points;
+    readFixedPoints(points);
+    unsigned int npoints = n ? points.size() / n : 0;
+    if (npoints == 0) { std::cout << "No points to evaluate in " << fixedPointsFile_ << std::endl; return; }
+    // visit the points in nearest-neighbour order starting from the best fit, the distance being measured with
+    // each POI scaled to its range, so that each fit starts close to the previous one
+    std::vector<double> scale(n);
+    for (unsigned int i = 0; i < n; ++i) scale[i] = 1.0/std::max(poiVars_[i]->getMax() - poiVars_[i]->getMin(), 1e-30);
+    std::vector<double> ordered; ordered.reserve(points.size());
+    std::vector<bool> done(npoints, false);
+    std::vector<double> last(n);
+    for (unsigned int i = 0; i < n; ++i) last[i] = poiVars_[i]->getVal();
+    for (unsigned int k = 0; k < npoints; ++k) {
+        unsigned int best = 0; double bestDist = std::numeric_limits<double>::max();
+        for (unsigned int j = 0; j < npoints; ++j) {
+            if (done[j]) continue;
+            double dist = 0;
+            for (unsigned int i = 0; i < n; ++i) dist += std::pow((points[j * n + i] - last[i]) * scale[i], 2);
+            if (dist < bestDist) { bestDist = dist; best = j; }
+        }
+        done[best] = true;
+        std::copy(&points[best * n], &points[best * n] + n, last.begin());
+        ordered.insert(ordered.end(), last.begin(), last.end());
+    }
+    std::cout << "Evaluating " << npoints << " points from " << fixedPointsFile_ << std::endl;
+    nll0Value_ = nll0;
+    if (gridForks_ > 1 && npoints > 1) {
+        doWithFork(nll, 0, npoints - 1, gridForks_, verbose > 1, [&](unsigned int first, unsigned int last) {
+            doFixedPointRange(nll, nll0, ordered, first, last);
+        });
+    } else {
+        doFixedPointRange(nll, nll0, ordered, 0, npoints - 1);
+    }
+}
+
+void MultiDimFit::doFixedPointRange(RooAbsReal &nll, double nll0, const std::vector<double> &points, unsigned int first, unsigned int last) 
+{
+    CascadeMinimizer minim(nll, CascadeMinimizer::Constrained);
+    if (!autoBoundsPOIs_.empty()) minim.setAutoBounds(&autoBoundsPOISet_); 
+    if (!autoMaxPOIs_.empty()) minim.setAutoMax(&autoMaxPOISet_); 
+    minim.setStrategy(minimizerStrategy_);
+    unsigned int n = poi_.size();
+    std::auto_ptr<RooArgSet> params(nll.getParameters((const RooArgSet *)0));
+    utils::FastSnapshot snap(*params);
+    // each fit starts from the result of the previous point, unless that failed
+    bool warmStart = !startFromPreFit_, prevOk = false;
+    auto pointString = [&](const double *point) {
+        std::string ret;
+        for (unsigned int i = 0; i < n; ++i) ret += (i ? "," : "") + poi_[i] + "=" + std::to_string(point[i]);
+        return ret;
+    };
+    for (unsigned int ip = first; ip <= last; ++ip) {
+        bool inRange = true;
+        for (unsigned int i = 0; i < n; ++i) inRange = inRange && poiVars_[i]->inRange(points[ip * n + i], 0);
+        if (!inRange) { 
+            std::cout << "Skipping the point " << pointString(&points[ip * n]) << " of " << fixedPointsFile_ << ", it is outside the range of the POIs" << std::endl;
+            continue;
+        }
+        if (!(warmStart && prevOk)) snap.writeTo();
+        for (unsigned int i = 0; i < n; ++i) {
+            poiVars_[i]->setVal(points[ip * n + i]);
+            poiVals_[i] = poiVars_[i]->getVal(); 
+        }
+        CloseCoutSentry sentry(verbose < 3);    
+        prevOk = minim.minimize(verbose-1);
+        if (!prevOk) { 
+            sentry.clear();
+            std::cout << "Skipping the point " << pointString(&points[ip * n]) << " of " << fixedPointsFile_ << ", the fit failed" << std::endl;
+            continue;
+        }
+        nllValue_ = nll.getVal();
+        deltaNLL_ = nll.getVal() - nll0;
+        double prob = ROOT::Math::chisquared_cdf_c(2*deltaNLL_, n+nOtherFloatingPoi_);
+        for(unsigned int j=0; j<specifiedNuis_.size(); j++){
+            specifiedVals_[j]=specifiedVars_[j]->getVal();
+        }
+        for(unsigned int j=0; j<specifiedFuncNames_.size(); j++){
+            specifiedFuncVals_[j]=specifiedFunc_[j]->getVal();
+        }
+        for(unsigned int j=0; j<specifiedCatNames_.size(); j++){
+            specifiedCatVals_[j]=specifiedCat_[j]->getIndex();
+        }
+        commitPoint(*params, /*quantile=*/prob);
+    }
+}
+
 void MultiDimFit::doContour2D(RooWorkspace *, RooAbsReal &nll) 
 {
     if (poi_.size() != 2) throw std::logic_error("Contour2D works only in 2 dimensions");
@@ -861,6 +1751,9 @@ void MultiDimFit::doContour2D(RooWorkspace *, RooAbsReal &nll)
     double threshold = nll.getVal() + 0.5*ROOT::Math::chisquared_quantile_c(1-cl,2+nOtherFloatingPoi_);
     if (verbose>0) std::cout << "Best fit point is for " << xv->GetName() << ", "  << yv->GetName() << " =  " << x0 << ", " << y0 << std::endl;
 
+    std::auto_ptr<RooArgSet> params(nll.getParameters((const RooArgSet *)0));
+    utils::FastSnapshot bestFit(*params);
+
     // make a box
     doBox(nll, cl, "box");
     double xMin = xv->getMin("box"), xMax = xv->getMax("box");
@@ -869,9 +1762,9 @@ void MultiDimFit::doContour2D(RooWorkspace *, RooAbsReal &nll)
     verbose--; // reduce verbosity to avoid messages from findCrossing
     // ===== Get relative min/max of x for several fixed y values =====
     yv->setConstant(true);
-    for (unsigned int j = 0; j <= points_; ++j) {
-        if (j < firstPoint_) continue;
-        if (j > lastPoint_)  break;
+    // as in doBox, the points are committed directly (not tracked as the best point of a scan), or recorded in the children of doWithFork
+    auto commit = [&](float quantile) { if (pointRecord_) recordPoint(*pointRecord_, *params, quantile); else Combine::commitPoint(true, quantile); };
+    auto scanX = [&](unsigned int j) {
         // take points uniformly spaced in polar angle in the case of a perfect circle
         double yc = 0.5*(yMax + yMin), yr = 0.5*(yMax - yMin);
         yv->setVal( yc + yr * std::cos(j*M_PI/double(points_)) );
@@ -893,15 +1786,27 @@ void MultiDimFit::doContour2D(RooWorkspace *, RooAbsReal &nll)
         if (!autoMaxPOIs_.empty()) minim.setAutoMax(&autoMaxPOISet_); 
         double xup = findCrossing(minim, nll, *xv, threshold, xc, xMax);
         if (!std::isnan(xup)) { 
-            x = xup; y = yv->getVal(); Combine::commitPoint(true, /*quantile=*/1-cl);
+            x = xup; y = yv->getVal(); commit(/*quantile=*/1-cl);
             if (verbose>-1) std::cout << "Minimum of " << xv->GetName() << " at " << cl << " CL for " << yv->GetName() << " = " << y << " is " << x << std::endl;
         }
         
         double xdn = findCrossing(minim, nll, *xv, threshold, xc, xMin);
         if (!std::isnan(xdn)) { 
-            x = xdn; y = yv->getVal(); Combine::commitPoint(true, /*quantile=*/1-cl);
+            x = xdn; y = yv->getVal(); commit(/*quantile=*/1-cl);
             if (verbose>-1) std::cout << "Maximum of " << xv->GetName() << " at " << cl << " CL for " << yv->GetName() << " = " << y << " is " << x << std::endl;
         }
+    };
+    unsigned int first = firstPoint_, last = std::min(lastPoint_, points_);
+    if (contourForks_ > 1 && first < last) {
+        // the values of y are independent: each child does a contiguous block of them, starting from the best fit
+        // rather than from the last point of the box
+        bestFit.writeTo();
+        yv->setConstant(true);
+        doWithFork(nll, first, last, contourForks_, verbose > 0, [&](unsigned int firstY, unsigned int lastY) {
+            for (unsigned int j = firstY; j <= lastY; ++j) scanX(j);
+        });
+    } else {
+        for (unsigned int j = first; j <= last; ++j) scanX(j);
     }
 
     verbose++; // restore verbosity
@@ -968,9 +1873,15 @@ void MultiDimFit::doBox(RooAbsReal &nll, double cl, const char *name, bool commi
         p0[i] = poiVars_[i]->getVal();
         poiVars_[i]->setConstant(false);
     }
+    std::auto_ptr<RooArgSet> params(nll.getParameters((const RooArgSet *)0));
 
     verbose--; // reduce verbosity due to findCrossing
-    for (unsigned int i = 0; i < n; ++i) {
+    // in the children of doWithFork the points are always recorded, since the bounds are taken back from them
+    auto commit = [&](float quantile) { if (pointRecord_) recordPoint(*pointRecord_, *params, quantile); else if (commitPoints) Combine::commitPoint(true, quantile); };
+    // search k is for the minimum (k even) or the maximum (k odd) of POI k/2 with all the others floating; 
+    // it commits the point found, or the one on the boundary with its p-value, and returns the crossing or the boundary
+    auto search = [&](unsigned int k) -> double {
+        unsigned int i = k / 2; bool up = (k % 2 == 1);
         RooRealVar *xv = poiVars_[i];
         xv->setConstant(true);
         CascadeMinimizer minimX(nll, CascadeMinimizer::Constrained);
@@ -979,35 +1890,214 @@ void MultiDimFit::doBox(RooAbsReal &nll, double cl, const char *name, bool commi
         minimX.setStrategy(minimizerStrategy_);
 
         for (unsigned int j = 0; j < n; ++j) poiVars_[j]->setVal(p0[j]);
-        double xMin = findCrossing(minimX, nll, *xv, threshold, p0[i], xv->getMin()); 
-        if (!std::isnan(xMin)) { 
-            if (verbose > -1) std::cout << "Minimum of " << xv->GetName() << " at " << cl << " CL for all others floating is " << xMin << std::endl;
-            for (unsigned int j = 0; j < n; ++j) poiVals_[j] = poiVars_[j]->getVal();
-            if (commitPoints) Combine::commitPoint(true, /*quantile=*/1-cl);
-        } else {
-            xMin = xv->getMin();
-            for (unsigned int j = 0; j < n; ++j) poiVals_[j] = poiVars_[j]->getVal();
-            double prob = ROOT::Math::chisquared_cdf_c(2*(nll.getVal() - nll0), n+nOtherFloatingPoi_);
-            if (commitPoints) Combine::commitPoint(true, /*quantile=*/prob);
-            if (verbose > -1) std::cout << "Minimum of " << xv->GetName() << " at " << cl << " CL for all others floating is " << xMin << " (on the boundary, p-val " << prob << ")" << std::endl;
-        }
-        
-        for (unsigned int j = 0; j < n; ++j) poiVars_[j]->setVal(p0[j]);
-        double xMax = findCrossing(minimX, nll, *xv, threshold, p0[i], xv->getMax()); 
-        if (!std::isnan(xMax)) { 
-            if (verbose > -1) std::cout << "Maximum of " << xv->GetName() << " at " << cl << " CL for all others floating is " << xMax << std::endl;
-            for (unsigned int j = 0; j < n; ++j) poiVals_[j] = poiVars_[j]->getVal();
-            if (commitPoints) Combine::commitPoint(true, /*quantile=*/1-cl);
+        double xCross = findCrossing(minimX, nll, *xv, threshold, p0[i], up ? xv->getMax() : xv->getMin()); 
+        for (unsigned int j = 0; j < n; ++j) poiVals_[j] = poiVars_[j]->getVal();
+        if (!std::isnan(xCross)) { 
+            if (verbose > -1) std::cout << (up ? "Maximum" : "Minimum") << " of " << xv->GetName() << " at " << cl << " CL for all others floating is " << xCross << std::endl;
+            commit(/*quantile=*/1-cl);
         } else {
-            xMax = xv->getMax();
+            xCross = up ? xv->getMax() : xv->getMin();
             double prob = ROOT::Math::chisquared_cdf_c(2*(nll.getVal() - nll0), n+nOtherFloatingPoi_);
-            for (unsigned int j = 0; j < n; ++j) poiVals_[j] = poiVars_[j]->getVal();
-            if (commitPoints) Combine::commitPoint(true, /*quantile=*/prob);
-            if (verbose > -1) std::cout << "Maximum of " << xv->GetName() << " at " << cl << " CL for all others floating is " << xMax << " (on the boundary, p-val " << prob << ")" << std::endl;
+            commit(/*quantile=*/prob);
+            if (verbose > -1) std::cout << (up ? "Maximum" : "Minimum") << " of " << xv->GetName() << " at " << cl << " CL for all others floating is " << xCross << " (on the boundary, p-val " << prob << ")" << std::endl;
         }
-
-        xv->setRange(name, xMin, xMax);
         xv->setConstant(false);
+        return xCross;
+    };
+    std::vector<double> bounds(2*n);
+    if (contourForks_ > 1 && n > 0) {
+        // the searches are independent, so each child does some of them; the bound of each search is taken back from the point
+        // it recorded (the value of the POI if the crossing was found, i.e. if the quantile is 1-cl, else the boundary)
+        std::vector<double> records;
+        doWithFork(nll, 0, 2*n-1, contourForks_, verbose > 0, [&](unsigned int first, unsigned int last) {
+            for (unsigned int k = first; k <= last; ++k) search(k);
+        }, &records, commitPoints);
+        unsigned int stride = 2 + n + params->getSize();
+        if (records.size() != 2*n*stride) throw std::runtime_error("MultiDimFit: some of the searches for the box failed");
+        for (unsigned int k = 0; k < 2*n; ++k) {
+            RooRealVar *xv = poiVars_[k/2];
+            int ip = params->index(params->find(xv->GetName()));
+            if (records[k*stride] == float(1-cl)) bounds[k] = records[k*stride + 2 + n + ip];
+            else bounds[k] = (k % 2 == 1) ? xv->getMax() : xv->getMin();
+        }
+    } else {
+        for (unsigned int k = 0; k < 2*n; ++k) bounds[k] = search(k);
     }
+    for (unsigned int i = 0; i < n; ++i) poiVars_[i]->setRange(name, bounds[2*i], bounds[2*i+1]);
     verbose++; // restore verbosity 
 }
+
+void MultiDimFit::freezeNegligibleNuisances(const RooFitResult &res, const RooArgSet *nuisances)
+{
+    frozenNuisances_.removeAll();
+    if (nuisances == 0) return;
+    if (res.covQual() <= 0) {
+        std::cout << "MultiDimFit: no covariance matrix from the initial fit, so no nuisance will be frozen" << std::endl;
+        return;
+    }
+    const RooArgList &floats = res.floatParsFinal();
+    std::vector<std::string> fitPois;
+    for (int i = 0, n = poi_.size(); i < n; ++i) {
+        if (floats.find(poi_[i].c_str())) fitPois.push_back(poi_[i]);
+    }
+    if (fitPois.empty()) return;
+    // at the Hesse level, the shift of a POI when fixing a nuisance at +/-1 sigma is the correlation times the error of the POI,
+    // so the correlation is the impact relative to the POI uncertainty
+    unsigned int nfloat = 0;
+    RooFIter iter = floats.fwdIterator();
+    for (RooAbsArg *a = iter.next(); a != 0; a = iter.next()) {
+        RooRealVar *rrv = dynamic_cast<RooRealVar *>(a);
+        if (rrv == 0 || !nuisances->find(rrv->GetName()) || poiList_.find(rrv->GetName())) continue;
+        RooRealVar *var = dynamic_cast<RooRealVar *>(nuisances->find(rrv->GetName()));
+        if (var == 0 || var->isConstant()) continue;
+        nfloat++;
+        double maxCorr = 0;
+        for (const std::string &poi : fitPois) {
+            maxCorr = std::max(maxCorr, std::abs(res.correlation(poi.c_str(), rrv->GetName())));
+        }
+        if (maxCorr >= freezeNegligible_) continue;
+        if (verbose > 1) std::cout << "MultiDimFit: freezing " << rrv->GetName() << " (max correlation with the POIs: " << maxCorr << ")" << std::endl;
+        var->setConstant(true);
+        frozenNuisances_.add(*var);
+    }
+    std::cout << "MultiDimFit: " << frozenNuisances_.getSize() << " out of " << nfloat << " floating nuisances have a correlation below " << freezeNegligible_ <<
+                 " with the POIs, and will be kept fixed at their best fit values during the scan" << std::endl;
+}
+
+void MultiDimFit::setupHesseScan(RooWorkspace *w, const RooFitResult &res)
+{
+    hesseParams_.clear(); hesseBest_.clear(); hessePoiBest_.clear(); hesseSlope_.clear(); hesseCondCov_.clear();
+    const RooArgList &floats = res.floatParsFinal();
+    unsigned int n = poi_.size();
+    std::vector<int> ipoi(n);
+    for (unsigned int i = 0; i < n; ++i) ipoi[i] = floats.index(poi_[i].c_str());
+    if (res.covQual() <= 0 || std::find(ipoi.begin(), ipoi.end(), -1) != ipoi.end()) {
+        std::cout << "MultiDimFit: no covariance matrix for the POIs from the initial fit, --fastScanHesse will be the same as --fastScan" << std::endl;
+        return;
+    }
+    // for a Gaussian likelihood the conditional best fit is theta + C_tp C_pp^-1 (p - p_hat), and the inverse of the
+    // Hessian of the other parameters at fixed POIs is the conditional covariance C_tt - C_tp C_pp^-1 C_pt
+    const TMatrixDSym &cov = res.covarianceMatrix();
+    TMatrixDSym cpp(n);
+    for (unsigned int i = 0; i < n; ++i) {
+        for (unsigned int k = 0; k < n; ++k) cpp(i,k) = cov(ipoi[i],ipoi[k]);
+        hessePoiBest_.push_back(static_cast<RooRealVar &>(floats[ipoi[i]]).getVal());
+    }
+    double det = 0; cpp.Invert(&det);
+    if (det == 0) {
+        std::cout << "MultiDimFit: singular covariance matrix for the POIs, --fastScanHesse will be the same as --fastScan" << std::endl;
+        hessePoiBest_.clear();
+        return;
+    }
+    std::vector<int> icov;
+    for (int j = 0, nf = floats.getSize(); j < nf; ++j) {
+        if (std::find(ipoi.begin(), ipoi.end(), j) != ipoi.end()) continue;
+        RooRealVar *var = w->var(floats[j].GetName());
+        if (var == 0) continue;
+        icov.push_back(j);
+        hesseParams_.push_back(var);
+        hesseBest_.push_back(static_cast<RooRealVar &>(floats[j]).getVal());
+        for (unsigned int k = 0; k < n; ++k) {
+            double slope = 0;
+            for (unsigned int l = 0; l < n; ++l) slope += cov(j,ipoi[l]) * cpp(l,k);
+            hesseSlope_.push_back(slope);
+        }
+    }
+    unsigned int m = hesseParams_.size();
+    if (fastScanNewton_) {
+        hesseCondCov_.resize(m * m);
+        for (unsigned int a = 0; a < m; ++a) {
+            for (unsigned int b = 0; b < m; ++b) {
+                double c = cov(icov[a],icov[b]);
+                for (unsigned int k = 0; k < n; ++k) c -= hesseSlope_[a * n + k] * cov(ipoi[k],icov[b]);
+                hesseCondCov_[a * m + b] = c;
+            }
+        }
+    }
+    std::cout << "MultiDimFit: fast scan moving " << m << " parameters with the POIs" << (fastScanNewton_ ? ", with one Newton step per point" : "") << std::endl;
+}
+
+bool MultiDimFit::fastProfile(RooAbsReal &nll, bool skip)
+{
+    unsigned int n = poi_.size(), m = hesseParams_.size();
+    if (skip || m == 0) return true;
+    for (unsigned int a = 0; a < m; ++a) {
+        RooRealVar *var = hesseParams_[a];
+        if (var->isConstant()) continue;
+        double val = hesseBest_[a];
+        for (unsigned int k = 0; k < n; ++k) val += hesseSlope_[a * n + k] * (poiVars_[k]->getVal() - hessePoiBest_[k]);
+        var->setVal(std::max(var->getMin(), std::min(var->getMax(), val)));
+    }
+    if (!fastScanNewton_) return true;
+    // Newton step with the conditional covariance as inverse Hessian, and the gradient from central differences
+    std::vector<double> start(m), grad(m, 0.);
+    for (unsigned int a = 0; a < m; ++a) {
+        RooRealVar *var = hesseParams_[a];
+        start[a] = var->getVal();
+        double h = 1e-3 * std::sqrt(std::max(hesseCondCov_[a * m + a], 0.));
+        if (var->isConstant() || h == 0) continue;
+        var->setVal(start[a] + h); double up = nll.getVal();
+        var->setVal(start[a] - h); double dn = nll.getVal();
+        var->setVal(start[a]);
+        grad[a] = (up - dn) / (2 * h);
+    }
+    double before = nll.getVal();
+    for (unsigned int a = 0; a < m; ++a) {
+        RooRealVar *var = hesseParams_[a];
+        if (var->isConstant()) continue;
+        double step = 0;
+        for (unsigned int b = 0; b < m; ++b) step -= hesseCondCov_[a * m + b] * grad[b];
+        var->setVal(std::max(var->getMin(), std::min(var->getMax(), start[a] + step)));
+    }
+    // the step can overshoot far from the quadratic regime: keep the linear prediction then
+    if (!(nll.getVal() <= before)) {
+        for (unsigned int a = 0; a < m; ++a) hesseParams_[a]->setVal(start[a]);
+    }
+    return true;
+}
+
+void MultiDimFit::trackBestPoint()
+{
+    if (frozenNuisances_.getSize() == 0 || deltaNLL_ >= 9999) return;
+    if (bestScanPoiVals_.empty() || deltaNLL_ < bestScanDeltaNLL_) {
+        bestScanDeltaNLL_ = deltaNLL_;
+        bestScanPoiVals_  = poiVals_;
+    }
+}
+
+void MultiDimFit::checkFrozenNuisances(RooAbsReal &nll, const RooArgSet &bestFitSnap)
+{
+    std::auto_ptr<RooArgSet> params(nll.getParameters((const RooArgSet *)0));
+    if (bestScanPoiVals_.empty()) {
+        utils::setAllConstant(frozenNuisances_, false);
+        frozenNuisances_.removeAll();
+        return;
+    }
+    // refit at the best point of the scan, starting from the best fit, first as in the scan and then with all the nuisances floating
+    *params = bestFitSnap;
+    std::vector<bool> wasConstant(poiVars_.size());
+    for (unsigned int i = 0, n = poiVars_.size(); i < n; ++i) {
+        wasConstant[i] = poiVars_[i]->isConstant();
+        poiVars_[i]->setVal(bestScanPoiVals_[i]);
+        poiVars_[i]->setConstant(true);
+    }
+    CascadeMinimizer minim(nll, CascadeMinimizer::Constrained);
+    minim.setStrategy(minimizerStrategy_);
+    bool okFrozen = minim.minimize(verbose-1);
+    double dnllFrozen = nll.getVal() - bestFitNLL_;
+    utils::setAllConstant(frozenNuisances_, false);
+    bool okFree = minim.minimize(verbose-1);
+    double dnllFree = nll.getVal() - bestFitNLL_;
+    std::cout << "MultiDimFit: refit at the best point of the scan (";
+    for (unsigned int i = 0, n = poi_.size(); i < n; ++i) std::cout << (i ? ", " : "") << poi_[i] << " = " << bestScanPoiVals_[i];
+    std::cout << "): deltaNLL = " << dnllFrozen << " with the " << frozenNuisances_.getSize() << " negligible nuisances frozen, " << dnllFree << " with all of them floating" << std::endl;
+    if (!okFrozen || !okFree) {
+        std::cout << "MultiDimFit: WARNING: the refit at the best point of the scan failed, so the effect of freezing the nuisances could not be checked" << std::endl;
+    } else if (std::abs(dnllFree - dnllFrozen) > 0.05) {
+        std::cout << "MultiDimFit: WARNING: freezing the negligible nuisances changed the likelihood at the best point of the scan by " << (dnllFree - dnllFrozen) <<
+                     ", consider a smaller value of --freezeNegligibleNuisances" << std::endl;
+    }
+    for (unsigned int i = 0, n = poiVars_.size(); i < n; ++i) poiVars_[i]->setConstant(wasConstant[i]);
+    *params = bestFitSnap;
+    frozenNuisances_.removeAll();
+}
@@ -0,0 +1,124 @@
+#include "HiggsAnalysis/CombinedLimit/interface/NLLEvaluator.h"
+#include "HiggsAnalysis/CombinedLimit/interface/CachingNLL.h"
+#include "HiggsAnalysis/CombinedLimit/interface/ThreadPool.h"
+#include <RooAbsReal.h>
+#include <RooArgList.h>
+#include <RooArgSet.h>
+#include <RooRealVar.h>
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+cacheutils::NLLEvaluator::NLLEvaluator(RooAbsReal &nll, const RooArgList *params) :
+    nll_(dynamic_cast<CachingSimNLL *>(&nll)),
+    clonesState_(0)
+{
+    if (nll_ == 0) throw std::invalid_argument(std::string("NLLEvaluator: ")+nll.GetName()+" is not a CachingSimNLL");
+    if (params) {
+        for (int i = 0, n = params->getSize(); i < n; ++i) {
+            RooRealVar *rrv = dynamic_cast<RooRealVar *>(params->at(i));
+            if (rrv == 0) throw std::invalid_argument(std::string("NLLEvaluator: parameter ")+params->at(i)->GetName()+" is not a RooRealVar");
+            params_.push_back(rrv);
+        }
+    } else {
+        std::unique_ptr<RooArgSet> all(nll.getParameters((const RooArgSet *)0));
+        RooFIter iter = all->fwdIterator();
+        for (RooAbsArg *a = iter.next(); a != 0; a = iter.next()) {
+            RooRealVar *rrv = dynamic_cast<RooRealVar *>(a);
+            if (rrv != 0 && !rrv->isConstant()) params_.push_back(rrv);
+        }
+        std::sort(params_.begin(), params_.end(), [](const RooRealVar *a, const RooRealVar *b) { return std::strcmp(a->GetName(), b->GetName()) < 0; });
+    }
+}
+
+cacheutils::NLLEvaluator::~NLLEvaluator()
+{
+}
+
+const char *
+cacheutils::NLLEvaluator::name(unsigned int i) const
+{
+    return params_[i]->GetName();
+}
+
+void
+cacheutils::NLLEvaluator::values(double *x) const
+{
+    for (unsigned int i = 0, n = params_.size(); i < n; ++i) x[i] = params_[i]->getVal();
+}
+
+void
+cacheutils::NLLEvaluator::set_(const std::vector<RooRealVar *> &params, const double *x)
+{
+    // setVal marks the clients dirty even if the value doesn't change, which would throw away the caches of the channels
+    for (unsigned int i = 0, n = params.size(); i < n; ++i) {
+        if (params[i]->getVal() != x[i]) params[i]->setVal(x[i]);
+    }
+}
+
+double
+cacheutils::NLLEvaluator::eval(const double *x)
+{
+    set_(params_, x);
+    return nll_->getVal();
+}
+
+double
+cacheutils::NLLEvaluator::evalGradient(const double *x, double *grad)
+{
+    set_(params_, x);
+    double ret = nll_->getVal();
+    nll_->gradient(params_, grad_);
+    std::copy(grad_.begin(), grad_.end(), grad);
+    return ret;
+}
+
+void
+cacheutils::NLLEvaluator::makeClones_(unsigned int n)
+{
+    if (clonesState_ != nll_->stateId()) clones_.clear();
+    clonesState_ = nll_->stateId();
+    if (clones_.size() >= n) return;
+    double ref = nll_->getVal();
+    while (clones_.size() < n) {
+        std::unique_ptr<Clone> clone(new Clone());
+        clone->context.reset(new NLLEvalContext(*nll_));
+        for (RooRealVar *p : params_) {
+            RooRealVar *cp = clone->context->param(p->GetName());
+            if (cp == 0) throw std::runtime_error(std::string("NLLEvaluator: no parameter ")+p->GetName()+" in the clone of the NLL");
+            clone->params.push_back(cp);
+        }
+        // the context starts at the values of the original, and has no zero points
+        clone->offset = ref - clone->context->getVal();
+        clones_.push_back(std::move(clone));
+    }
+}
+
+void
+cacheutils::NLLEvaluator::evalBatch(unsigned int n, const double *x, double *out, unsigned int nThreads)
+{
+    unsigned int size = params_.size();
+    if (nThreads <= 1 || n <= 1) {
+        std::vector<double> x0(size);
+        values(&x0[0]);
+        for (unsigned int k = 0; k < n; ++k) out[k] = eval(x + k*size);
+        set_(params_, &x0[0]);
+        return;
+    }
+    unsigned int nClones = std::min(nThreads, n);
+    makeClones_(nClones);
+    std::mutex mutex;
+    std::vector<unsigned int> idle;
+    for (unsigned int c = 0; c < nClones; ++c) idle.push_back(c);
+    auto run = [&](unsigned int k) {
+        unsigned int c;
+        { std::lock_guard<std::mutex> lock(mutex); c = idle.back(); idle.pop_back(); }
+        struct Release { std::mutex &mutex; std::vector<unsigned int> &idle; unsigned int c; ~Release() { std::lock_guard<std::mutex> lock(mutex); idle.push_back(c); } } release = { mutex, idle, c };
+        Clone &clone = *clones_[c];
+        set_(clone.params, x + k*size);
+        out[k] = clone.context->getVal() + clone.offset;
+    };
+    ThreadPool::global(nClones).parallelFor(n, run, nClones);
+}
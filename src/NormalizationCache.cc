@@ -0,0 +1,97 @@
+#include "HiggsAnalysis/CombinedLimit/interface/NormalizationCache.h"
+#include "HiggsAnalysis/CombinedLimit/interface/ProfilingTools.h"
+#include <map>
+#include <mutex>
+#include <cmath>
+
+namespace {
+    struct Key {
+        NormalizationCache::Function f;
+        std::vector<double> params;
+        double xmin, xmax;
+        bool operator<(const Key &other) const {
+            if (f != other.f) return f < other.f;
+            if (xmin != other.xmin) return xmin < other.xmin;
+            if (xmax != other.xmax) return xmax < other.xmax;
+            return params < other.params;
+        }
+    };
+    /// bound on the number of integrals kept: the cache is emptied when it's reached (e.g. after a long scan)
+    const unsigned int kMaxEntries = 200000;
+    std::map<Key, double> cache_;
+    std::mutex mutex_;
+
+    // 7-point Gauss and 15-point Kronrod abscissae and weights on [-1,1]
+    const double xgk[8] = { 0.991455371120812639206854697526329, 0.949107912342758524526189684047851, 0.864864423359769072789712788640926,
+                            0.741531185599394439863864773280788, 0.586087235467691130294144845693013, 0.405845151377397166906606412076961,
+                            0.207784955007898467600689403773245, 0.000000000000000000000000000000000 };
+    const double wgk[8] = { 0.022935322010529224963732008058970, 0.063092092629978553290700663189204, 0.104790010322250183839876322541518,
+                            0.140653259715525918745189590510238, 0.169004726639267902826583426598550, 0.190350578064785409913256402421014,
+                            0.204432940075298892414161999234649, 0.209482141084727828012999174891714 };
+    const double wg[4]  = { 0.129484966168869693270611432679082, 0.279705391489276667901467771423780, 0.381830050505118944950369775488975,
+                            0.417959183673469387755102040816327 };
+
+    /// Kronrod estimate of the integral over [a,b], and its difference from the Gauss one in err
+    double gk15(NormalizationCache::Function f, const double *params, double a, double b, double &err) {
+        double center = 0.5*(a+b), half = 0.5*(b-a);
+        double fc = f(center, params);
+        double resk = fc * wgk[7], resg = fc * wg[3];
+        for (int j = 0; j < 7; ++j) {
+            double dx = half * xgk[j];
+            double fsum = f(center - dx, params) + f(center + dx, params);
+            resk += wgk[j] * fsum;
+            if (j % 2 == 1) resg += wg[j/2] * fsum;
+        }
+        err = std::abs((resk - resg) * half);
+        return resk * half;
+    }
+}
+
+bool NormalizationCache::enabled() 
+{
+    static bool enabled = runtimedef::get("PDF_NORM_CACHE");
+    return enabled;
+}
+
+double NormalizationCache::integral(Function f, const std::vector<double> &params, double xmin, double xmax) 
+{
+    Key key = { f, params, xmin, xmax };
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        std::map<Key, double>::const_iterator match = cache_.find(key);
+        if (match != cache_.end()) return match->second;
+    }
+    double ret = integrate_(f, params.empty() ? 0 : &params[0], xmin, xmax);
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (cache_.size() >= kMaxEntries) cache_.clear();
+    cache_[key] = ret;
+    return ret;
+}
+
+void NormalizationCache::clear() 
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+    cache_.clear();
+}
+
+double NormalizationCache::integrate_(Function f, const double *params, double xmin, double xmax) 
+{
+    const double relTol = 1e-9;
+    const int maxIntervals = 200;
+    // intervals with their estimates and errors, the one with the largest error split in two until converged
+    std::vector<double> as(1, xmin), bs(1, xmax), vals(1), errs(1);
+    vals[0] = gk15(f, params, xmin, xmax, errs[0]);
+    double total = vals[0], totalErr = errs[0];
+    while (totalErr > relTol * std::abs(total) && int(as.size()) < maxIntervals) {
+        unsigned int worst = 0;
+        for (unsigned int i = 1, n = errs.size(); i < n; ++i) if (errs[i] > errs[worst]) worst = i;
+        double a = as[worst], b = bs[worst], mid = 0.5*(a+b);
+        double err1, err2;
+        double val1 = gk15(f, params, a, mid, err1), val2 = gk15(f, params, mid, b, err2);
+        as[worst] = a; bs[worst] = mid; vals[worst] = val1; errs[worst] = err1;
+        as.push_back(mid); bs.push_back(b); vals.push_back(val2); errs.push_back(err2);
+        total = 0; totalErr = 0;
+        for (unsigned int i = 0, n = vals.size(); i < n; ++i) { total += vals[i]; totalErr += errs[i]; }
+    }
+    return total;
+}
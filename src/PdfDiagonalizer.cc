@@ -9,6 +9,8 @@
 #include <RooFitResult.h>
 #include <RooRealVar.h>
 #include <RooWorkspace.h>
+#include "HiggsAnalysis/CombinedLimit/interface/ProfilingTools.h"
+#include "HiggsAnalysis/CombinedLimit/interface/RooCheapLinearCombination.h"
 
 PdfDiagonalizer::PdfDiagonalizer(const char *name, RooWorkspace *w, RooFitResult &result) :
     name_(name),
@@ -29,6 +31,19 @@ PdfDiagonalizer::PdfDiagonalizer(const char *name, RooWorkspace *w, RooFitResult
         snprintf(buff,sizeof(buff),"%s_eig%d[-5,5]", name, i);
         eigenVars_.add(*w->factory(buff));
     }
+    if (runtimedef::get("DIAGONALIZER_CHEAP_LINEAR")) {
+        // one node per parameter with its row of the matrix as plain numbers, so that a change of the eigen-parameters
+        // costs a dense matrix-vector product instead of the evaluation of n RooProducts per parameter
+        for (int i = 0; i < n; ++i) {   
+            std::vector<double> coeffs(n);
+            for (int j = 0; j < n; ++j) coeffs[j] = vectors(i,j)*sqrt(values(j));
+            snprintf(buff,sizeof(buff),"%s_eigLin_%d", name, i);
+            RooCheapLinearCombination *lin = new RooCheapLinearCombination(buff, buff, eigenVars_, coeffs, (dynamic_cast<RooAbsReal*>(parameters_.at(i)))->getVal());
+            w->import(*lin);
+            replacements_.add(*lin);
+        }
+        return;
+    }
     // put them in a list, with a one at the end to set the mean
     RooArgList eigvVarsPlusOne(eigenVars_);
     if (w->var("_one_") == 0) w->factory("_one_[1]");
@@ -0,0 +1,71 @@
+#include "HiggsAnalysis/CombinedLimit/interface/PoissonSampler.h"
+
+#include <cmath>
+#include <algorithm>
+#include <TRandom.h>
+
+void PoissonSampler::setMeans(unsigned int n, const double *means) {
+    if (means_.size() == n && std::equal(means, means + n, means_.begin())) return;
+    means_.assign(means, means + n);
+    params_.resize(n);
+    uniformsPerToy_ = 0;
+    for (unsigned int i = 0; i < n; ++i) {
+        Params &p = params_[i];
+        p.mean = means[i];
+        p.expm = p.a = p.b = p.vr = p.logInvAlpha = p.logMean = 0;
+        if (!(p.mean > 0)) continue;
+        if (p.mean < 10) {
+            p.expm = std::exp(-p.mean);
+            uniformsPerToy_ += 1;
+        } else {
+            uniformsPerToy_ += 2.3;
+            double smu = std::sqrt(p.mean);
+            p.b  = 0.931 + 2.53 * smu;
+            p.a  = -0.059 + 0.02483 * p.b;
+            p.vr = 0.9277 - 3.6224 / (p.b - 2);
+            p.logInvAlpha = std::log(1.1239 + 1.1328 / (p.b - 3.4));
+            p.logMean = std::log(p.mean);
+        }
+    }
+}
+
+void PoissonSampler::generate(TRandom &rnd, double *counts, unsigned int ntoys) {
+    rnd_ = &rnd;
+    block_ = std::min(4096., std::max(16., std::ceil(ntoys * uniformsPerToy_)));
+    next_ = uniforms_.size(); // don't reuse the uniforms of another generator, or of a previous call
+    for (unsigned int itoy = 0, n = params_.size(); itoy < ntoys; ++itoy) {
+        for (unsigned int i = 0; i < n; ++i, ++counts) *counts = draw_(params_[i]);
+    }
+}
+
+double PoissonSampler::uniform_() {
+    if (next_ >= uniforms_.size()) {
+        uniforms_.resize(block_);
+        rnd_->RndmArray(block_, &uniforms_[0]);
+        next_ = 0;
+    }
+    return uniforms_[next_++];
+}
+
+double PoissonSampler::draw_(const Params &p) {
+    if (!(p.mean > 0)) return 0;
+    if (p.a == 0) {
+        // inversion: the first k for which the cumulative exceeds u (when the terms underflow, the tail is done)
+        double u = uniform_(), term = p.expm, cumulative = term;
+        unsigned int k = 0;
+        while (u > cumulative && term > 0) {
+            ++k;
+            term *= p.mean / k;
+            cumulative += term;
+        }
+        return k;
+    }
+    while (true) {
+        double u = uniform_() - 0.5, v = uniform_();
+        double us = 0.5 - std::abs(u);
+        double k = std::floor((2 * p.a / us + p.b) * u + p.mean + 0.43);
+        if (us >= 0.07 && v <= p.vr) return k;
+        if (k < 0 || (us < 0.013 && v > us)) continue;
+        if (std::log(v) + p.logInvAlpha - std::log(p.a / (us * us) + p.b) <= -p.mean + k * p.logMean - std::lgamma(k + 1)) return k;
+    }
+}
@@ -1,8 +1,15 @@
 #include "HiggsAnalysis/CombinedLimit/interface/ProcessNormalization.h"
 
+#include <RooWorkspace.h>
+#include <RooGlobalFunc.h>
 #include <cmath>
 #include <cassert>
 #include <cstdio>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 ProcessNormalization::ProcessNormalization(const char *name, const char *title, double nominal) :
         RooAbsReal(name,title),
@@ -56,7 +63,51 @@ void ProcessNormalization::addOtherFactor(RooAbsReal &factor) {
     otherFactorList_.add(factor);
 }
 
+unsigned int ProcessNormalization::importAll(RooWorkspace &w, unsigned int n, const char *names, const double *nominal, const char *params,
+                                             const int *begin, const int *kind, const int *param, const double *kappaLo, const double *kappaHi) {
+    // look up each parameter once
+    std::vector<RooAbsReal *> args;
+    std::istringstream paramNames(params);
+    for (std::string name; paramNames >> name; ) {
+        RooAbsReal *arg = w.function(name.c_str());
+        if (arg == 0) arg = w.var(name.c_str());
+        if (arg == 0) throw std::invalid_argument("ProcessNormalization::importAll: no parameter "+name+" in the workspace");
+        args.push_back(arg);
+    }
+    std::istringstream normNames(names);
+    unsigned int done = 0;
+    for (std::string name; done < n && normNames >> name; ++done) {
+        std::auto_ptr<ProcessNormalization> norm(new ProcessNormalization(name.c_str(), "", nominal[done]));
+        for (int j = begin[done]; j < begin[done+1]; ++j) {
+            if (param[j] < 0 || param[j] >= int(args.size())) throw std::invalid_argument("ProcessNormalization::importAll: bad parameter index for "+name);
+            RooAbsReal &arg = *args[param[j]];
+            switch (kind[j]) {
+                case 0: norm->addLogNormal(kappaHi[j], arg); break;
+                case 1: norm->addAsymmLogNormal(kappaLo[j], kappaHi[j], arg); break;
+                case 2: norm->addOtherFactor(arg); break;
+                default: throw std::invalid_argument("ProcessNormalization::importAll: bad kind of term for "+name);
+            }
+        }
+        w.import(*norm, RooFit::Silence());
+    }
+    if (done != n) throw std::invalid_argument("ProcessNormalization::importAll: fewer names than normalizations");
+    return done;
+}
+
 Double_t ProcessNormalization::evaluate() const {
+    double logVal = logValue();
+    double norm = nominalValue_;
+    if (logVal) norm *= std::exp(logVal);
+    if (otherFactorList_.getSize()) {
+        RooLinkedListIter iterOther = otherFactorList_.iterator();
+        for (RooAbsReal *fact = (RooAbsReal*) iterOther.Next(); fact != 0; fact = (RooAbsReal*) iterOther.Next()) {
+            norm *= fact->getVal();
+        }
+    }
+    return norm;
+}
+
+Double_t ProcessNormalization::logValue() const {
     double logVal = 0.0;
     if (!logKappa_.empty()) {
         RooLinkedListIter iterTheta = thetaList_.iterator();
@@ -73,15 +124,52 @@ Double_t ProcessNormalization::evaluate() const {
             logVal +=  x * logKappaForX(x, *logKappas);
         }
     }
-    double norm = nominalValue_;
-    if (logVal) norm *= std::exp(logVal);
-    if (otherFactorList_.getSize()) {
-        RooLinkedListIter iterOther = otherFactorList_.iterator();
-        for (RooAbsReal *fact = (RooAbsReal*) iterOther.Next(); fact != 0; fact = (RooAbsReal*) iterOther.Next()) {
-            norm *= fact->getVal();
+    return logVal;
+}
+
+bool ProcessNormalization::analyticalDerivative(const RooAbsArg &theta, double &deriv) const {
+    // norm = nominal * exp(logVal) * prod_j other_j, 
+    // so d(norm) = norm * d(logVal) + sum_j (norm / other_j) * d(other_j)
+    double dlogVal = 0.0;
+    for (int i = 0, n = thetaList_.getSize(); i < n; ++i) {
+        if (thetaList_.at(i) == &theta) dlogVal += logKappa_[i];
+        else if (thetaList_.at(i)->dependsOnValue(theta)) return false;
+    }
+    for (int i = 0, n = asymmThetaList_.getSize(); i < n; ++i) {
+        if (asymmThetaList_.at(i) != &theta) {
+            if (asymmThetaList_.at(i)->dependsOnValue(theta)) return false;
+            continue;
         }
+        double x = static_cast<const RooAbsReal *>(asymmThetaList_.at(i))->getVal();
+        dlogVal += logKappaForX(x, logAsymmKappa_[i]) + x * logKappaForXDerivative(x, logAsymmKappa_[i]);
     }
-    return norm;
+    deriv = (dlogVal != 0 ? getVal() * dlogVal : 0);
+    for (int j = 0, n = otherFactorList_.getSize(); j < n; ++j) {
+        const RooAbsArg *fact = otherFactorList_.at(j);
+        if (fact == &theta) {
+            // the product without this factor is recomputed, so that it works also when the factor is zero
+            double others = nominalValue_ * std::exp(logValue());
+            for (int k = 0; k < n; ++k) {
+                if (k != j) others *= static_cast<const RooAbsReal *>(otherFactorList_.at(k))->getVal();
+            }
+            deriv += others;
+        } else if (fact->dependsOnValue(theta)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+Double_t ProcessNormalization::logKappaForXDerivative(double x, const std::pair<double,double> &logKappas) const {
+    if (fabs(x) >= 0.5) return 0;
+    // logKappa(x) = avg + halfdiff * h(2x), so its derivative is 2 * halfdiff * h'(2x)
+    // with h'(y) = 15 (y^4 - 2 y^2 + 1)/8
+    double logKhi =  logKappas.second;
+    double logKlo = -logKappas.first;
+    double halfdiff = 0.5*(logKhi - logKlo);
+    double twox = x+x, twox2 = twox*twox;
+    double dalpha = 2 * 0.125 * 15. * (twox2 * (twox2 - 2.) + 1.);
+    return dalpha*halfdiff;
 }
 
 Double_t ProcessNormalization::logKappaForX(double x, const std::pair<double,double> &logKappas) const {
@@ -19,6 +19,7 @@
 #include "HiggsAnalysis/CombinedLimit/interface/utils.h"
 #include "HiggsAnalysis/CombinedLimit/interface/ProfiledLikelihoodRatioTestStatExt.h"
 #include "HiggsAnalysis/CombinedLimit/interface/CascadeMinimizer.h"
+#include "HiggsAnalysis/CombinedLimit/interface/FitterAlgoBase.h"
 
 
 #include <Math/MinimizerOptions.h>
@@ -36,6 +37,7 @@ float       ProfileLikelihood::maxRelDeviation_ = 0.05;
 float       ProfileLikelihood::maxOutlierFraction_ = 0.25;
 int         ProfileLikelihood::maxOutliers_ = 3;
 int         ProfileLikelihood::points_ = 20;
+int         ProfileLikelihood::bfForks_ = 0;
 bool        ProfileLikelihood::preFit_ = false;
 bool        ProfileLikelihood::useMinos_ = true;
 bool        ProfileLikelihood::bruteForce_ = false;
@@ -67,6 +69,7 @@ ProfileLikelihood::ProfileLikelihood() :
         ("bruteForce", "Compute PL limit by brute force, bypassing the ProfileLikelihoodCalculator and Minos")
         ("bfAlgo", boost::program_options::value<std::string>(&bfAlgo_)->default_value(bfAlgo_), "NLL scan algorithm used for --bruteForce. Supported values are 'scale' (default), 'stepUp[Twice]', 'stepDown[Twice]'")
         ("scanPoints", boost::program_options::value<int>(&points_)->default_value(points_), "Points for the scan")
+        ("bruteForceForks", boost::program_options::value<int>(&bfForks_)->default_value(bfForks_), "Split the points of the brute force searches among N forked processes")
         ("minimizerAlgoForBF",      boost::program_options::value<std::string>(&minimizerAlgoForBF_)->default_value(minimizerAlgoForBF_), "Choice of minimizer for brute-force search")
         ("minimizerToleranceForBF", boost::program_options::value<float>(&minimizerToleranceForBF_)->default_value(minimizerToleranceForBF_),  "Tolerance for minimizer when doing brute-force search")
     ;
@@ -114,7 +117,7 @@ bool ProfileLikelihood::run(RooWorkspace *w, RooStats::ModelConfig *mc_s, RooSta
   std::vector<double> limits; double rMax = r->getMax();  
   std::auto_ptr<RooAbsPdf> nuisancePdf(0);
   for (int i = 0; i < maxTries_; ++i) {
-      w->loadSnapshot("clean");
+      utils::loadSnapshot(w, "clean");
       if (i > 0) { // randomize starting point
         r->setMax(rMax*(0.5+RooRandom::uniform()));
         r->setVal((0.1+0.5*RooRandom::uniform())*r->getMax()); 
@@ -340,7 +343,31 @@ std::pair<double,double> ProfileLikelihood::upperLimitBruteForce(RooAbsPdf &pdf,
         printf("%8.5f  %8.5f\n", rval, 0.);
         fflush(stdout);
     }
-    do {
+    if (bfForks_ > 1) {
+        // (N+1)-section instead of bisection: the N points inside the interval are profiled at the same time
+        double rnear = rlow, rfar = rhigh;
+        std::vector<double> rvals(bfForks_);
+        while (fabs(rfar - rnear) > tolerance) {
+            for (int k = 0; k < bfForks_; ++k) rvals[k] = rnear + (rfar - rnear)*(k+1)/(bfForks_+1);
+            std::vector<double> res = profileInForks_(rvals, poi, *nll, [&]() -> bool { minim.setStrategy(0); return nllutils::robustMinimize(*nll, minim, verbose-2); }, false);
+            int above = bfForks_;
+            for (int k = 0; k < bfForks_; ++k) {
+                if (res[2*k+1] == 0) {
+                    std::cerr << "Minimization failed at " << rvals[k] <<". exiting the bisection loop" << std::endl;
+                    fail = true;
+                    break;
+                }
+                if (verbose) {  printf("%8.5f  %8.5f\n", rvals[k], res[2*k]-minnll); fflush(stdout);  }
+                if (fabs(res[2*k] - target) < tolerance) return std::pair<double,double>(rvals[k], fabs(rfar - rnear)/(bfForks_+1));
+                if (res[2*k] > target) { above = k; break; }
+            }
+            if (fail) break;
+            double rnearNext = (above > 0 ? rvals[above-1] : rnear);
+            if (above < bfForks_) rfar = rvals[above];
+            rnear = rnearNext;
+        }
+        if (!fail) return std::pair<double,double>(0.5*(rnear + rfar), fabs(rfar - rnear)*0.5);
+    } else do {
         poi.setVal(rval);
         minim.setStrategy(0);
         bool success = nllutils::robustMinimize(*nll, minim, verbose-2);
@@ -426,13 +453,27 @@ double ProfileLikelihood::significanceBruteForce(RooAbsPdf &pdf, RooAbsData &dat
         points->SetName(Form("nll_scan_%g", mass_));
         points->SetPoint(0, rval, 0);
     }
+    // with bruteForceForks, the next points are profiled in batches; those after the end of the search are just not used
+    std::vector<double> batch; unsigned int inBatch = 0;
     while (std::abs(rval) >= tolerance * std::abs(rval > 0 ? poi.getMax() : poi.getMin())) {
         rval *= 0.8;
-        poi.setVal(rval);
-        minim.setStrategy(0);
-        bool success = minim.improve(verbose-2, /*cascade=*/false);
+        bool success;
         lastnll = thisnll;
-        thisnll = nll->getVal();
+        if (bfForks_ > 1) {
+            if (2*inBatch == batch.size()) {
+                std::vector<double> rvals(bfForks_, rval);
+                for (int k = 1; k < bfForks_; ++k) rvals[k] = 0.8*rvals[k-1];
+                batch = profileInForks_(rvals, poi, *nll, [&]() -> bool { minim.setStrategy(0); return minim.improve(verbose-2, /*cascade=*/false); }, false);
+                inBatch = 0;
+            }
+            thisnll = batch[2*inBatch]; success = (batch[2*inBatch+1] != 0);
+            ++inBatch;
+        } else {
+            poi.setVal(rval);
+            minim.setStrategy(0);
+            success = minim.improve(verbose-2, /*cascade=*/false);
+            thisnll = nll->getVal();
+        }
         if (success == false) {
             std::cerr << "Minimization failed at " << poi.getVal() <<". exiting the loop" << std::endl;
             return -1;
@@ -467,7 +508,10 @@ double ProfileLikelihood::significanceBruteForce(RooAbsPdf &pdf, RooAbsData &dat
         }
 #endif
    }
-   if (points) outputFile->WriteTObject(points);
+   if (points) { 
+       std::unique_lock<std::mutex> lock(Combine::lockOutput());
+       outputFile->WriteTObject(points);
+   }
    return std::copysign(thisnll - minnll, rbest);
 }
 
@@ -511,12 +555,25 @@ double ProfileLikelihood::significanceFromScan(RooAbsPdf &pdf, RooAbsData &data,
         printf("%8.5f  %8.5f\n", rval, 0.);
         fflush(stdout);
     }
+    // with bruteForceForks, the points of both passes (except the last one of the second) are profiled first, in blocks
+    std::vector<double> forked;
+    if (bfForks_ > 1 && steps > 2) {
+        std::vector<double> rvals;
+        for (int i = 1; i < steps; ++i) rvals.push_back((maxScan * (stepDown ? i : steps-i-1))/steps);
+        forked = profileInForks_(rvals, poi, *nll, [&]() -> bool { return minim.improve(verbose-2, /*cascade=*/false); }, twice);
+    }
     for (int i = 1; i < steps; ++i) {
         rval = (maxScan * (stepDown ? i : steps-i-1))/steps;
-        poi.setVal(rval);
-        bool success = minim.improve(verbose-2, /*cascade=*/false);
-        thisnll = nll->getVal();
-        if (success == false) std::cerr << "Minimization failed at " << poi.getVal() <<"." << std::endl;
+        bool success;
+        if (forked.empty()) {
+            poi.setVal(rval);
+            success = minim.improve(verbose-2, /*cascade=*/false);
+            thisnll = nll->getVal();
+        } else {
+            thisnll = forked[2*(i-1)]; success = (forked[2*(i-1)+1] != 0);
+            if (std::isnan(thisnll)) { std::cerr << "Minimization failed at " << rval <<"." << std::endl; continue; }
+        }
+        if (success == false) std::cerr << "Minimization failed at " << rval <<"." << std::endl;
         if (verbose) {  printf("%8.5f  %8.5f\n", rval, thisnll-refnll); fflush(stdout);  }
         points->SetPoint(i, rval, thisnll-refnll);
         if (thisnll < minnll) { minnll = thisnll; rbest = rval; }
@@ -531,10 +588,16 @@ double ProfileLikelihood::significanceFromScan(RooAbsPdf &pdf, RooAbsData &data,
         for (int i = steps-1; i >= 0; --i) {
             rval = (maxScan * (stepDown ? i : steps-i-1))/steps;
             if (i == 0 && !stepDown) rval = rbest;
-            poi.setVal(rval);
-            bool success = minim.improve(verbose-2, /*cascade=*/false);
-            thisnll = nll->getVal();
-            if (success == false) std::cerr << "Minimization failed at " << poi.getVal() <<"." << std::endl;
+            bool success;
+            if (forked.empty() || i == 0) {
+                poi.setVal(rval);
+                success = minim.improve(verbose-2, /*cascade=*/false);
+                thisnll = nll->getVal();
+            } else {
+                thisnll = forked[2*(steps-1 + i-1)]; success = (forked[2*(steps-1 + i-1)+1] != 0);
+                if (std::isnan(thisnll)) { std::cerr << "Minimization failed at " << rval <<"." << std::endl; continue; }
+            }
+            if (success == false) std::cerr << "Minimization failed at " << rval <<"." << std::endl;
             if (verbose) {  printf("%8.5f  %8.5f\n", rval, thisnll-refnll); fflush(stdout);  }
             points->SetPoint(i, rval, thisnll-refnll);
             if (thisnll < minnll) { minnll = thisnll; rbest = rval; }
@@ -549,8 +612,11 @@ double ProfileLikelihood::significanceFromScan(RooAbsPdf &pdf, RooAbsData &data,
         MinimizerSentry minimizerConfig(minimizerAlgo_, minimizerTolerance_);
         res = points->Fit(fit,"S0");
     }
-    outputFile->WriteTObject(points);
-    outputFile->WriteTObject(fit);
+    {
+        std::unique_lock<std::mutex> lock(Combine::lockOutput());
+        outputFile->WriteTObject(points);
+        outputFile->WriteTObject(fit);
+    }
     if (res.Get()->Status() == 0) {
         std::cout << "Using first and last value, the result would be " << ret << std::endl;
         ret = fit->Eval(0) - fit->Eval(fit->GetParameter(1)) ;
@@ -560,3 +626,34 @@ double ProfileLikelihood::significanceFromScan(RooAbsPdf &pdf, RooAbsData &data,
     }
     return ret;
 }
+
+std::vector<double> ProfileLikelihood::profileInForks_(const std::vector<double> &rvals, RooRealVar &poi, RooAbsReal &nll, const std::function<bool()> &minimize, bool twice) const {
+    int n = rvals.size(), nforks = std::min<int>(bfForks_, n), passes = (twice ? 2 : 1);
+    std::vector<std::vector<double> > results;
+    FitterAlgoBase::runInForks(nforks, [&](unsigned int ij) -> std::vector<double> {
+        int first = (ij*n)/nforks, last = ((ij+1)*n)/nforks;
+        std::vector<double> ret;
+        for (int pass = 0; pass < passes; ++pass) {
+            for (int k = 0; k < last - first; ++k) {
+                poi.setVal(rvals[pass == 0 ? first + k : last - 1 - k]);
+                bool success = minimize();
+                ret.push_back(nll.getVal());
+                ret.push_back(success);
+            }
+        }
+        return ret;
+    }, results, true);
+    std::vector<double> ret(2*n*passes, 0.0);
+    for (int ij = 0; ij < nforks; ++ij) {
+        int first = (ij*n)/nforks, last = ((ij+1)*n)/nforks;
+        bool ok = (int(results[ij].size()) == 2*(last-first)*passes);
+        for (int pass = 0, j = 0; pass < passes; ++pass) {
+            for (int k = 0; k < last - first; ++k, ++j) {
+                int i = pass*n + (pass == 0 ? first + k : last - 1 - k);
+                ret[2*i]   = ok ? results[ij][2*j]   : std::numeric_limits<double>::quiet_NaN();
+                ret[2*i+1] = ok ? results[ij][2*j+1] : 0;
+            }
+        }
+    }
+    return ret;
+}
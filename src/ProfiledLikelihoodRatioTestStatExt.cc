@@ -62,8 +62,8 @@ ProfiledLikelihoodRatioTestStatOpt::ProfiledLikelihoodRatioTestStatOpt(
 
 Double_t ProfiledLikelihoodRatioTestStatOpt::Evaluate(RooAbsData& data, RooArgSet& nullPOI)
 {
-    RooArgSet initialStateAlt;  paramsAlt_->snapshot(initialStateAlt);
-    RooArgSet initialStateNull; paramsNull_->snapshot(initialStateNull);
+    utils::FastSnapshot initialStateAlt(*paramsAlt_);
+    utils::FastSnapshot initialStateNull(*paramsNull_);
 
     *paramsNull_ = nuisances_;
     *paramsNull_ = snapNull_;
@@ -88,8 +88,8 @@ Double_t ProfiledLikelihoodRatioTestStatOpt::Evaluate(RooAbsData& data, RooArgSe
     DBG(DBG_TestStat_params, (printf("Pln: null = %+8.4f, alt = %+8.4f\n", nullNLL, altNLL)))
     double ret = nullNLL-altNLL;
 
-    *paramsAlt_  = initialStateAlt;
-    *paramsNull_ = initialStateNull;
+    initialStateAlt.writeTo();
+    initialStateNull.writeTo();
 
     return ret;
 }
@@ -140,7 +140,8 @@ ProfiledLikelihoodTestStatOpt::ProfiledLikelihoodTestStatOpt(
     gobsParams_(gobsParams),
     gobs_(gobs),
     verbosity_(verbosity),
-    oneSided_(oneSided)
+    oneSided_(oneSided),
+    warmStartAdjacent_(false)
 {
     DBG(DBG_PLTestStat_main, (std::cout << "Created for " << pdf.GetName() << "." << std::endl))
 
@@ -172,7 +173,7 @@ Double_t ProfiledLikelihoodTestStatOpt::Evaluate(RooAbsData& data, RooArgSet& /*
     DBG(DBG_PLTestStat_main, (std::cout << "Being evaluated on " << data.GetName() << std::endl))
 
     // Take snapshot of initial state, to restore it at the end 
-    RooArgSet initialState; params_->snapshot(initialState);
+    utils::FastSnapshot initialState(*params_);
 
     DBG(DBG_PLTestStat_pars, std::cout << "Being evaluated on " << data.GetName() << ": params before snapshot are " << std::endl)
     DBG(DBG_PLTestStat_pars, params_->Print("V"))
@@ -211,8 +212,11 @@ Double_t ProfiledLikelihoodTestStatOpt::Evaluate(RooAbsData& data, RooArgSet& /*
     DBG(DBG_PLTestStat_pars, std::cout << "r before the fit: ") DBG(DBG_PLTestStat_pars, r->Print("")) DBG(DBG_PLTestStat_pars, std::cout << std::endl)
 
     //std::cout << "PERFORMING UNCONSTRAINED FIT " << r->GetName() << " [ " << r->getMin() << " - " << r->getMax() << " ] "<< std::endl;
+    static bool warmStart = runtimedef::get("PLTSO_WARMSTART");
+    if (warmStart) warmStart_(warmUnconstrained_[initialR]);
     double nullNLL = minNLL(/*constrained=*/false, r);
     double bestFitR = r->getVal();
+    if (warmStart) saveWarmStart_(warmUnconstrained_[initialR], nullNLL);
 
     DBG(DBG_PLTestStat_pars, (std::cout << "r after the fit: ")) DBG(DBG_PLTestStat_pars, (r->Print(""))) DBG(DBG_PLTestStat_pars, std::cout << std::endl)
     DBG(DBG_PLTestStat_pars, std::cout << "Was evaluated on " << data.GetName() << ": params before snapshot are " << std::endl)
@@ -234,7 +238,9 @@ Double_t ProfiledLikelihoodTestStatOpt::Evaluate(RooAbsData& data, RooArgSet& /*
         // must do constrained fit (if there's something to fit besides XS)
         //std::cout << "PERFORMING CONSTRAINED FIT " << r->GetName() << " == " << r->getVal() << std::endl;
         if (do_debug) std::cout << "NLL shift from unconstrained fit before re-profiling: " << nll_->getVal() - nullNLL << std::endl;    
+        if (warmStart && nfloatingpars > 0) warmStart_(warmConstrained_[initialR]);
         thisNLL = (nfloatingpars > 0 ? minNLL(/*constrained=*/true, r) : nll_->getVal());
+        if (warmStart && nfloatingpars > 0) saveWarmStart_(warmConstrained_[initialR], thisNLL);
         if (thisNLL - nullNLL < -0.02) { 
             DBG(DBG_PLTestStat_main, (printf("  --> constrained fit is better... will repeat unconstrained fit\n")))
             utils::setAllConstant(poiParams_,false);
@@ -272,7 +278,7 @@ Double_t ProfiledLikelihoodTestStatOpt::Evaluate(RooAbsData& data, RooArgSet& /*
     }
 
     //Restore initial state, to avoid issues with ToyMCSampler
-    *params_ = initialState;
+    initialState.writeTo();
 
     if (!canKeepNLL) nll_.reset();
 
@@ -290,7 +296,7 @@ std::vector<Double_t> ProfiledLikelihoodTestStatOpt::Evaluate(RooAbsData& data,
     DBG(DBG_PLTestStat_main, (std::cout << "Being evaluated on " << data.GetName() << std::endl))
 
     // Take snapshot of initial state, to restore it at the end 
-    RooArgSet initialState; params_->snapshot(initialState);
+    utils::FastSnapshot initialState(*params_);
 
     DBG(DBG_PLTestStat_pars, std::cout << "Being evaluated on " << data.GetName() << ": params before snapshot are " << std::endl)
     DBG(DBG_PLTestStat_pars, params_->Print("V"))
@@ -322,8 +328,11 @@ std::vector<Double_t> ProfiledLikelihoodTestStatOpt::Evaluate(RooAbsData& data,
     DBG(DBG_PLTestStat_pars, std::cout << "r before the fit: ") DBG(DBG_PLTestStat_pars, r->Print("")) DBG(DBG_PLTestStat_pars, std::cout << std::endl)
 
     if (do_debug) std::cout << "PERFORMING UNCONSTRAINED FIT " << r->GetName() << " [ " << r->getMin() << " - " << r->getVal() << " - " << r->getMax() << " ] "<< std::endl;
+    static bool warmStart = runtimedef::get("PLTSO_WARMSTART");
+    if (warmStart) warmStart_(warmUnconstrained_[initialR]);
     double nullNLL = minNLL(/*constrained=*/false, r);
     double bestFitR = r->getVal();
+    if (warmStart) saveWarmStart_(warmUnconstrained_[initialR], nullNLL);
     // Take snapshot of initial state, to restore it at the end 
     RooArgSet bestFitState; params_->snapshot(bestFitState);
 
@@ -333,6 +342,7 @@ std::vector<Double_t> ProfiledLikelihoodTestStatOpt::Evaluate(RooAbsData& data,
     DBG(DBG_PLTestStat_pars, params_->Print("V"))
 
     double EPS = 0.25*ROOT::Math::MinimizerOptions::DefaultTolerance();
+    utils::CheapValueSnapshot adjacent; // parameters at the constrained minimum of the previous r
     for (int iR = 0, nR = rVals.size(); iR < nR; ++iR) {
         if (fabs(ret[iR]) > 10*EPS) continue; // don't bother re-update points which were too far from zero anyway.
         *params_ = bestFitState;
@@ -345,7 +355,17 @@ std::vector<Double_t> ProfiledLikelihoodTestStatOpt::Evaluate(RooAbsData& data,
         if (initialR == 0 || oneSided_ != oneSidedDef || bestFitR < initialR) { 
             // must do constrained fit (if there's something to fit besides XS)
             //std::cout << "PERFORMING CONSTRAINED FIT " << r->GetName() << " == " << r->getVal() << std::endl;
+            if (warmStartAdjacent_ && nfloatingpars > 0 && !adjacent.empty()) {
+                double nllHere = nll_->getVal();
+                utils::CheapValueSnapshot here(*params_);
+                adjacent.writeTo(*params_);
+                r->setVal(initialR);
+                if (!(nll_->getVal() < nllHere)) here.writeTo(*params_);
+            }
+            if (warmStart && nfloatingpars > 0) warmStart_(warmConstrained_[initialR]);
             thisNLL = (nfloatingpars > 0 ? minNLL(/*constrained=*/true, r) : nll_->getVal());
+            if (warmStartAdjacent_ && nfloatingpars > 0) saveWarmStart_(adjacent, thisNLL);
+            if (warmStart && nfloatingpars > 0) saveWarmStart_(warmConstrained_[initialR], thisNLL);
             //thisNLL = (nuisances_.getSize() > 0 ? minNLL(/*constrained=*/true, r) : nll_->getVal());
             if (thisNLL - nullNLL < 0 && thisNLL - nullNLL >= -EPS) {
                 thisNLL = nullNLL;
@@ -377,7 +397,7 @@ std::vector<Double_t> ProfiledLikelihoodTestStatOpt::Evaluate(RooAbsData& data,
         }
     }
     //Restore initial state, to avoid issues with ToyMCSampler
-    *params_ = initialState;
+    initialState.writeTo();
 
     if (!canKeepNLL) nll_.reset();
 
@@ -396,6 +416,28 @@ bool ProfiledLikelihoodTestStatOpt::createNLL(RooAbsPdf &pdf, RooAbsData &data)
     }
 }
 
+bool ProfiledLikelihoodTestStatOpt::warmStart_(const utils::CheapValueSnapshot &start) 
+{
+    if (start.empty()) return false;
+    double nllDefault = nll_->getVal();
+    utils::CheapValueSnapshot defaults(*params_);
+    start.writeTo(*params_);
+    // the "globalConstrained" nuisances stay at the values of the global observables of this toy
+    for (int i=0; i<gobsParams_.getSize(); ++i) {
+      ((RooRealVar*)gobsParams_.at(i))->setVal(((RooRealVar*)gobs_.at(i))->getVal());
+    }
+    // fallback in case the previous toy was too different from this one
+    if (nll_->getVal() <= nllDefault) return true;
+    defaults.writeTo(*params_);
+    return false;
+}
+
+void ProfiledLikelihoodTestStatOpt::saveWarmStart_(utils::CheapValueSnapshot &start, double nll) 
+{
+    if (std::isfinite(nll)) start.readFrom(*params_);
+    else start.clear();
+}
+
 double ProfiledLikelihoodTestStatOpt::minNLL(bool constrained, RooRealVar *r) 
 {
     CascadeMinimizer::Mode mode(constrained ? CascadeMinimizer::Constrained : CascadeMinimizer::Unconstrained);
@@ -8,7 +8,18 @@
 #include <unistd.h>
 
 #include <cassert>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include <cxxabi.h>
 #include <boost/unordered_map.hpp>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
 
 void (*igProfRequestDump_)(const char *);
 int igProfDumpNumber_ = 0;
@@ -50,6 +61,261 @@ void PerfCounter::printAll()
     }
 }
 
+/// hardware counters that the timers can read (PROFILE_COUNTERS), the last one only if PROFILE_COUNTERS_RAW gives its code
+enum { CounterCycles = 0, CounterInstructions, CounterL1DMisses, CounterLLCMisses, CounterRaw, MaxCounters };
+
+struct ScopedTimerNode {
+    ScopedTimerNode(const char *akey, const std::string &aname, ScopedTimerNode *aparent) : key(akey), name(aname), parent(aparent), calls(0), total(0), start(0) {
+        std::fill(counters, counters + MaxCounters, 0ULL);
+        std::fill(startCounters, startCounters + MaxCounters, 0ULL);
+    }
+    ~ScopedTimerNode() { for (std::vector<ScopedTimerNode *>::iterator it = children.begin(); it != children.end(); ++it) delete *it; }
+    std::string key;  // name used to look up the node
+    std::string name; // name to print (e.g. demangled)
+    ScopedTimerNode *parent;
+    std::vector<ScopedTimerNode *> children;
+    unsigned long calls;
+    double total, start;
+    /// counts between construction and destruction of the timers, summed over the calls, and at the start of the current one
+    unsigned long long counters[MaxCounters], startCounters[MaxCounters];
+};
+
+namespace {
+    struct TraceEvent { ScopedTimerNode *node; double start, stop; };
+    struct ThreadTimers {
+        ThreadTimers(int aid) : root("", "", 0), current(&root), id(aid), counterFd(-1) {}
+        ScopedTimerNode root, *current;
+        std::vector<TraceEvent> trace;
+        int id;
+        /// leader of the group of perf_event counters of this thread (-1 if none), and which counters are in it, in order
+        int counterFd;
+        std::vector<int> counterIds;
+    };
+    int timersLevel_ = 0;
+    bool countersEnabled_ = false;
+    unsigned long long countersRaw_ = 0;
+    const char *counterKeys_[MaxCounters] = { "cycles", "instructions", "l1dMisses", "llcMisses", "raw" };
+    const unsigned int maxTraceEvents_ = 1 << 22;
+    std::mutex timersMutex_;
+    std::vector<ThreadTimers *> allTimers_;
+    __thread ThreadTimers *threadTimers_ = 0;
+    const std::chrono::steady_clock::time_point timersStart_ = std::chrono::steady_clock::now();
+
+    double timersNow() { 
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - timersStart_).count(); 
+    }
+
+    std::string demangle(const char *name) {
+        int status = 0;
+        char *demangled = abi::__cxa_demangle(name, 0, 0, &status);
+        std::string ret(status == 0 && demangled ? demangled : name);
+        free(demangled);
+        return ret;
+    }
+
+    std::string jsonEscape(const std::string &str) {
+        std::string ret;
+        for (std::string::const_iterator it = str.begin(); it != str.end(); ++it) {
+            if (*it == '"' || *it == '\\') ret += '\\';
+            ret += *it;
+        }
+        return ret;
+    }
+
+#ifdef __linux__
+    /// open the counters of the calling thread as one group, so that they are read together; those that the kernel
+    /// or the CPU don't support are left out (all of them, e.g., if /proc/sys/kernel/perf_event_paranoid forbids it)
+    void openCounters(ThreadTimers *timers) {
+        for (int ic = 0; ic < MaxCounters; ++ic) {
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            switch (ic) {
+                case CounterCycles:       attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+                case CounterInstructions: attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+                case CounterL1DMisses:    attr.type = PERF_TYPE_HW_CACHE; 
+                                          attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16); break;
+                case CounterLLCMisses:    attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_CACHE_MISSES; break;
+                case CounterRaw:          if (countersRaw_ == 0) continue;
+                                          attr.type = PERF_TYPE_RAW; attr.config = countersRaw_; break;
+            }
+            attr.read_format = PERF_FORMAT_GROUP;
+            attr.exclude_kernel = 1; attr.exclude_hv = 1;
+            int fd = syscall(__NR_perf_event_open, &attr, 0, -1, timers->counterFd, 0);
+            if (fd == -1) {
+                if (timers->counterFd == -1 && ic == CounterCycles) break; // without the leader there's no group
+                continue;
+            }
+            if (timers->counterFd == -1) timers->counterFd = fd;
+            timers->counterIds.push_back(ic);
+        }
+        if (timers->counterFd == -1) {
+            fprintf(stderr, "WARNING: can't open the hardware counters for the timers of thread %d (see /proc/sys/kernel/perf_event_paranoid)\n", timers->id);
+        }
+    }
+    /// current values of the counters of the thread, by counter id
+    void readCounters(const ThreadTimers *timers, unsigned long long *values) {
+        unsigned long long buff[1 + MaxCounters];
+        if (read(timers->counterFd, buff, sizeof(buff)) < ssize_t(sizeof(unsigned long long))) return;
+        for (unsigned int i = 0, n = std::min<unsigned long long>(buff[0], timers->counterIds.size()); i < n; ++i) {
+            values[timers->counterIds[i]] = buff[1+i];
+        }
+    }
+#else
+    void openCounters(ThreadTimers *timers) {
+        fprintf(stderr, "WARNING: hardware counters for the timers are only available on Linux\n");
+    }
+    void readCounters(const ThreadTimers *timers, unsigned long long *values) {}
+#endif
+
+    const ThreadTimers *reportedTimers_ = 0;
+    void printCounters(const ScopedTimerNode *node, int depth) {
+        const unsigned long long *c = node->counters;
+        double kinstr = 1e-3*c[CounterInstructions];
+        fprintf(stderr, "%*s%-*s %10.4g Gcycles  IPC %5.2f", 2*depth, "", std::max(1, 50-2*depth), "", 1e-9*c[CounterCycles], 
+                    c[CounterCycles] ? double(c[CounterInstructions])/c[CounterCycles] : 0.);
+        if (kinstr > 0) fprintf(stderr, "  L1D %7.2f/kinstr  LLC %7.3f/kinstr", c[CounterL1DMisses]/kinstr, c[CounterLLCMisses]/kinstr);
+        if (countersRaw_) fprintf(stderr, "  raw 0x%llx %.4g", countersRaw_, double(c[CounterRaw]));
+        fprintf(stderr, "\n");
+    }
+
+    double childrenTime(const ScopedTimerNode *node) {
+        double ret = 0;
+        for (std::vector<ScopedTimerNode *>::const_iterator it = node->children.begin(); it != node->children.end(); ++it) ret += (*it)->total;
+        return ret;
+    }
+
+    bool slowerThan(const ScopedTimerNode *a, const ScopedTimerNode *b) { return a->total > b->total; }
+
+    void printTimers(const ScopedTimerNode *node, int depth, double parentTotal) {
+        std::vector<ScopedTimerNode *> children(node->children);
+        std::sort(children.begin(), children.end(), slowerThan);
+        for (std::vector<ScopedTimerNode *>::const_iterator it = children.begin(); it != children.end(); ++it) {
+            const ScopedTimerNode *c = *it;
+            fprintf(stderr, "%*s%-*s %10.3f s %6.1f%% %12lu calls  (self %.3f s)\n", 2*depth, "", std::max(1, 50-2*depth), c->name.c_str(), 
+                        c->total, parentTotal > 0 ? 100*c->total/parentTotal : 100., c->calls, c->total - childrenTime(c));
+            if (reportedTimers_ && reportedTimers_->counterFd != -1) printCounters(c, depth);
+            printTimers(c, depth+1, c->total);
+        }
+    }
+
+    void writeTimers(FILE *out, const ScopedTimerNode *node) {
+        fprintf(out, "[");
+        for (std::vector<ScopedTimerNode *>::const_iterator it = node->children.begin(); it != node->children.end(); ++it) {
+            const ScopedTimerNode *c = *it;
+            fprintf(out, "%s{\"name\":\"%s\",\"calls\":%lu,\"total\":%.9g,\"self\":%.9g,", 
+                        (it == node->children.begin() ? "" : ","), jsonEscape(c->name).c_str(), c->calls, c->total, c->total - childrenTime(c));
+            if (reportedTimers_ && reportedTimers_->counterFd != -1) {
+                fprintf(out, "\"counters\":{");
+                for (unsigned int i = 0, n = reportedTimers_->counterIds.size(); i < n; ++i) {
+                    int ic = reportedTimers_->counterIds[i];
+                    fprintf(out, "%s\"%s\":%llu", (i ? "," : ""), counterKeys_[ic], c->counters[ic]);
+                }
+                fprintf(out, "},");
+            }
+            fprintf(out, "\"children\":");
+            writeTimers(out, c);
+            fprintf(out, "}");
+        }
+        fprintf(out, "]");
+    }
+}
+
+bool ScopedTimer::enabled_ = false;
+
+void ScopedTimer::enable(int level) 
+{
+    timersLevel_ = level;
+    enabled_ = (level > 0);
+    countersEnabled_ = enabled_ && runtimedef::get("PROFILE_COUNTERS");
+    countersRaw_ = (unsigned int) runtimedef::get("PROFILE_COUNTERS_RAW");
+}
+
+ScopedTimerNode * ScopedTimer::push(const char *name, bool demangled) 
+{
+    ThreadTimers *timers = threadTimers_;
+    if (timers == 0) {
+        std::lock_guard<std::mutex> lock(timersMutex_);
+        timers = threadTimers_ = new ThreadTimers(allTimers_.size());
+        allTimers_.push_back(timers);
+        if (countersEnabled_) openCounters(timers);
+    }
+    ScopedTimerNode *parent = timers->current, *node = 0;
+    for (std::vector<ScopedTimerNode *>::const_iterator it = parent->children.begin(); it != parent->children.end(); ++it) {
+        if ((*it)->key == name) { node = *it; break; }
+    }
+    if (node == 0) { 
+        node = new ScopedTimerNode(name, demangled ? demangle(name) : std::string(name), parent); 
+        parent->children.push_back(node); 
+    }
+    node->calls++;
+    if (timers->counterFd != -1) readCounters(timers, node->startCounters);
+    node->start = timersNow();
+    timers->current = node;
+    return node;
+}
+
+void ScopedTimer::pop(ScopedTimerNode *node) 
+{
+    ThreadTimers *timers = threadTimers_;
+    double stop = timersNow();
+    node->total += stop - node->start;
+    if (timers->counterFd != -1) {
+        unsigned long long now[MaxCounters];
+        std::copy(node->startCounters, node->startCounters + MaxCounters, now);
+        readCounters(timers, now);
+        for (int ic = 0; ic < MaxCounters; ++ic) node->counters[ic] += now[ic] - node->startCounters[ic];
+    }
+    if (timersLevel_ >= 3 && timers->trace.size() < maxTraceEvents_) {
+        TraceEvent event = { node, node->start, stop };
+        timers->trace.push_back(event);
+    }
+    timers->current = node->parent;
+}
+
+void ScopedTimer::report() 
+{
+    if (!enabled_) return;
+    std::lock_guard<std::mutex> lock(timersMutex_);
+    for (std::vector<ThreadTimers *>::const_iterator it = allTimers_.begin(); it != allTimers_.end(); ++it) {
+        fprintf(stderr, "Timers of thread %d:\n", (*it)->id);
+        reportedTimers_ = *it;
+        printTimers(&(*it)->root, 1, childrenTime(&(*it)->root));
+    }
+    if (timersLevel_ >= 2) {
+        char name[50]; snprintf(name, 49, "timers.%d.json", int(getpid()));
+        if (FILE *out = fopen(name, "w")) {
+            fprintf(out, "{\"threads\":[");
+            for (std::vector<ThreadTimers *>::const_iterator it = allTimers_.begin(); it != allTimers_.end(); ++it) {
+                fprintf(out, "%s{\"thread\":%d,\"timers\":", (it == allTimers_.begin() ? "" : ","), (*it)->id);
+                reportedTimers_ = *it;
+                writeTimers(out, &(*it)->root);
+                fprintf(out, "}");
+            }
+            fprintf(out, "]}\n");
+            fclose(out);
+            fprintf(stderr, "Timers saved in %s\n", name);
+        }
+    }
+    if (timersLevel_ >= 3) {
+        char name[50]; snprintf(name, 49, "trace.%d.json", int(getpid()));
+        if (FILE *out = fopen(name, "w")) {
+            fprintf(out, "{\"traceEvents\":[");
+            bool first = true;
+            for (std::vector<ThreadTimers *>::const_iterator it = allTimers_.begin(); it != allTimers_.end(); ++it) {
+                for (std::vector<TraceEvent>::const_iterator ev = (*it)->trace.begin(); ev != (*it)->trace.end(); ++ev, first = false) {
+                    fprintf(out, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}", (first ? "" : ","),
+                                jsonEscape(ev->node->name).c_str(), 1e6*ev->start, 1e6*(ev->stop - ev->start), int(getpid()), (*it)->id);
+                }
+                if ((*it)->trace.size() == maxTraceEvents_) fprintf(stderr, "Trace of thread %d truncated after %u calls\n", (*it)->id, maxTraceEvents_);
+            }
+            fprintf(out, "\n]}\n");
+            fclose(out);
+            fprintf(stderr, "Trace saved in %s\n", name);
+        }
+    }
+}
+
 // we define them by string value, but we lookup them by const char *
 namespace runtimedef {
     boost::unordered_map<const char *, std::pair<int,int> > defines_;
@@ -0,0 +1,44 @@
+#include "HiggsAnalysis/CombinedLimit/interface/RooCheapLinearCombination.h"
+#include <stdexcept>
+
+RooCheapLinearCombination::RooCheapLinearCombination(const char *name, const char *title, const RooArgList &terms, const std::vector<double> &coeffs, double offset) :
+    RooAbsReal(name,title),
+    terms_("terms","Terms of the linear combination",this),
+    offset_(offset)
+{
+    if (int(coeffs.size()) != terms.getSize()) {
+        throw std::invalid_argument(std::string("RooCheapLinearCombination ")+name+": the numbers of terms and coefficients differ"); 
+    }
+    RooFIter iter = terms.fwdIterator();
+    unsigned int i = 0;
+    for (RooAbsArg *a = iter.next(); a != 0; a = iter.next(), ++i) {
+        RooAbsReal *rar = dynamic_cast<RooAbsReal *>(a);
+        if (!rar) { 
+            throw std::invalid_argument(std::string("Component ")+a->GetName()+" of RooCheapLinearCombination is a "+a->ClassName()); 
+        }
+        if (coeffs[i] == 0) continue;
+        terms_.add(*rar);
+        coeffs_.push_back(coeffs[i]);
+    }
+}
+
+RooCheapLinearCombination::RooCheapLinearCombination(const RooCheapLinearCombination& other, const char* name) :
+    RooAbsReal(other, name),
+    terms_("terms",this,other.terms_),
+    coeffs_(other.coeffs_),
+    offset_(other.offset_)
+{
+}
+
+Double_t RooCheapLinearCombination::evaluate() const 
+{
+    double ret = offset_;
+    RooFIter iter = terms_.fwdIterator();
+    std::vector<double>::const_iterator coeff = coeffs_.begin();
+    for (RooAbsArg *a = iter.next(); a != 0; a = iter.next(), ++coeff) {
+        ret += (*coeff) * static_cast<RooAbsReal *>(a)->getVal();
+    }
+    return ret;
+}
+
+ClassImp(RooCheapLinearCombination)
@@ -0,0 +1,289 @@
+#include "HiggsAnalysis/CombinedLimit/interface/RooCompiledFormula.h"
+
+#include <cmath>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include <RooMsgService.h>
+
+inline double RooCompiledFormula::apply(OpCode op, double a, double b) {
+    switch (op) {
+        case Add: return a + b;
+        case Sub: return a - b;
+        case Mul: return a * b;
+        case Div: return a / b;
+        case Pow: return std::pow(a, b);
+        case Min: return std::min(a, b);
+        case Max: return std::max(a, b);
+        case Atan2: return std::atan2(a, b);
+        case Lt: return a < b;
+        case Le: return a <= b;
+        case Gt: return a > b;
+        case Ge: return a >= b;
+        case Eq: return a == b;
+        case Ne: return a != b;
+        case And: return a && b;
+        case Or: return a || b;
+        case Neg: return -a;
+        case Not: return !a;
+        case Sqrt: return std::sqrt(a);
+        case Exp: return std::exp(a);
+        case Log: return std::log(a);
+        case Log10: return std::log10(a);
+        case Abs: return std::abs(a);
+        case Sin: return std::sin(a);
+        case Cos: return std::cos(a);
+        case Tan: return std::tan(a);
+        case Atan: return std::atan(a);
+    }
+    return 0;
+}
+
+/// Recursive descent parser from the formula into the program of a RooCompiledFormula, with the usual C precedences
+/// (|| && == != < <= > >= + - * / unary, and ^ or ** binding tighter than the unary minus as in TFormula).
+/// Each distinct (op, a, b) is emitted only once, and the instructions on constants are computed right away.
+class RooCompiledFormulaParser {
+    public:
+        RooCompiledFormulaParser(const RooCompiledFormula &f) : f_(f), s_(f.formula_), pos_(0), ok_(true) {
+            RooFIter iter = f.deps_.fwdIterator();
+            for (RooAbsArg *a = iter.next(); a != 0; a = iter.next()) {
+                names_[a->GetName()] = f_.regs_.size();
+                f_.regs_.push_back(0.);
+                isConst_.push_back(false);
+            }
+        }
+        /// register of the result, false if the formula can't be compiled
+        bool parse(unsigned int &result) {
+            result = parseOr_();
+            skipSpace_();
+            return ok_ && pos_ == s_.size();
+        }
+    private:
+        typedef RooCompiledFormula F;
+        const RooCompiledFormula &f_;
+        const std::string &s_;
+        std::size_t pos_;
+        bool ok_;
+        std::map<std::string, unsigned int> names_;
+        std::vector<bool> isConst_;
+        std::map<double, unsigned int> consts_;
+        std::map<std::pair<int, std::pair<unsigned int, unsigned int> >, unsigned int> nodes_;
+
+        unsigned int fail_() { ok_ = false; return 0; }
+        void skipSpace_() { while (pos_ < s_.size() && std::isspace(s_[pos_])) ++pos_; }
+        bool accept_(const char *tok) {
+            skipSpace_();
+            std::size_t n = strlen(tok);
+            if (s_.compare(pos_, n, tok) != 0) return false;
+            pos_ += n;
+            return true;
+        }
+        unsigned int const_(double val) {
+            std::map<double, unsigned int>::const_iterator it = consts_.find(val);
+            if (it != consts_.end()) return it->second;
+            f_.regs_.push_back(val); isConst_.push_back(true);
+            return consts_[val] = f_.regs_.size()-1;
+        }
+        unsigned int emit_(F::OpCode op, unsigned int a, unsigned int b = 0) {
+            if (!ok_) return 0;
+            bool unary = (op >= F::Neg);
+            if (isConst_[a] && (unary || isConst_[b])) return const_(F::apply(op, f_.regs_[a], unary ? 0. : f_.regs_[b]));
+            bool commutes = (op == F::Add || op == F::Mul || op == F::Min || op == F::Max || op == F::Eq || op == F::Ne || op == F::And || op == F::Or);
+            if (unary) b = 0;
+            else if (commutes && b < a) std::swap(a, b);
+            std::pair<int, std::pair<unsigned int, unsigned int> > key(op, std::make_pair(a, b));
+            std::map<std::pair<int, std::pair<unsigned int, unsigned int> >, unsigned int>::const_iterator it = nodes_.find(key);
+            if (it != nodes_.end()) return it->second;
+            f_.regs_.push_back(0.); isConst_.push_back(false);
+            F::Instr ins = { op, unsigned(f_.regs_.size()-1), a, b };
+            f_.code_.push_back(ins);
+            return nodes_[key] = ins.out;
+        }
+
+        unsigned int parseOr_() {
+            unsigned int ret = parseAnd_();
+            while (ok_ && accept_("||")) ret = emit_(F::Or, ret, parseAnd_());
+            return ret;
+        }
+        unsigned int parseAnd_() {
+            unsigned int ret = parseEquality_();
+            while (ok_ && accept_("&&")) ret = emit_(F::And, ret, parseEquality_());
+            return ret;
+        }
+        unsigned int parseEquality_() {
+            unsigned int ret = parseRelation_();
+            while (ok_) {
+                if      (accept_("==")) ret = emit_(F::Eq, ret, parseRelation_());
+                else if (accept_("!=")) ret = emit_(F::Ne, ret, parseRelation_());
+                else break;
+            }
+            return ret;
+        }
+        unsigned int parseRelation_() {
+            unsigned int ret = parseSum_();
+            while (ok_) {
+                if      (accept_("<=")) ret = emit_(F::Le, ret, parseSum_());
+                else if (accept_(">=")) ret = emit_(F::Ge, ret, parseSum_());
+                else if (accept_("<"))  ret = emit_(F::Lt, ret, parseSum_());
+                else if (accept_(">"))  ret = emit_(F::Gt, ret, parseSum_());
+                else break;
+            }
+            return ret;
+        }
+        unsigned int parseSum_() {
+            unsigned int ret = parseProduct_();
+            while (ok_) {
+                if      (accept_("+")) ret = emit_(F::Add, ret, parseProduct_());
+                else if (accept_("-")) ret = emit_(F::Sub, ret, parseProduct_());
+                else break;
+            }
+            return ret;
+        }
+        unsigned int parseProduct_() {
+            unsigned int ret = parseUnary_();
+            while (ok_) {
+                if      (accept_("*")) ret = emit_(F::Mul, ret, parseUnary_());
+                else if (accept_("/")) ret = emit_(F::Div, ret, parseUnary_());
+                else break;
+            }
+            return ret;
+        }
+        unsigned int parseUnary_() {
+            if (accept_("-")) return emit_(F::Neg, parseUnary_());
+            if (accept_("+")) return parseUnary_();
+            if (accept_("!") ) return emit_(F::Not, parseUnary_());
+            return parsePower_();
+        }
+        unsigned int parsePower_() {
+            unsigned int base = parsePrimary_();
+            if (ok_ && (accept_("^") || accept_("**"))) return emit_(F::Pow, base, parseUnary_()); // right associative
+            return base;
+        }
+        unsigned int parsePrimary_() {
+            skipSpace_();
+            if (!ok_ || pos_ >= s_.size()) return fail_();
+            char c = s_[pos_];
+            if (c == '(') {
+                ++pos_;
+                unsigned int ret = parseOr_();
+                return accept_(")") ? ret : fail_();
+            }
+            if (c == '@') {
+                const char *start = s_.c_str() + pos_ + 1; char *end;
+                long i = strtol(start, &end, 10);
+                if (end == start || i < 0 || i >= long(names_.size())) return fail_();
+                pos_ += 1 + (end - start);
+                return i;
+            }
+            if (std::isdigit(c) || c == '.') {
+                const char *start = s_.c_str() + pos_; char *end;
+                double val = strtod(start, &end);
+                if (end == start) return fail_();
+                pos_ += end - start;
+                return const_(val);
+            }
+            if (!(std::isalpha(c) || c == '_')) return fail_();
+            std::size_t start = pos_;
+            while (pos_ < s_.size()) {
+                if (std::isalnum(s_[pos_]) || s_[pos_] == '_') ++pos_;
+                else if (s_.compare(pos_, 2, "::") == 0) pos_ += 2; // TMath::
+                else break;
+            }
+            std::string name = s_.substr(start, pos_ - start);
+            if (accept_("(")) return parseCall_(name);
+            std::map<std::string, unsigned int>::const_iterator it = names_.find(name);
+            if (it != names_.end()) return it->second;
+            if (name == "pi") return const_(M_PI);
+            return fail_();
+        }
+        unsigned int parseCall_(const std::string &name) {
+            if (name == "TMath::Pi") return accept_(")") ? const_(M_PI) : fail_();
+            unsigned int a = parseOr_(), b = 0;
+            bool two = ok_ && accept_(",");
+            if (two) b = parseOr_();
+            if (!ok_ || !accept_(")")) return fail_();
+            static std::map<std::string, F::OpCode> unary, binary;
+            if (unary.empty()) {
+                unary["sqrt"] = F::Sqrt;   unary["TMath::Sqrt"] = F::Sqrt;
+                unary["exp"] = F::Exp;     unary["TMath::Exp"] = F::Exp;
+                unary["log"] = F::Log;     unary["TMath::Log"] = F::Log;
+                unary["log10"] = F::Log10; unary["TMath::Log10"] = F::Log10;
+                unary["abs"] = F::Abs;     unary["fabs"] = F::Abs; unary["TMath::Abs"] = F::Abs;
+                unary["sin"] = F::Sin;     unary["TMath::Sin"] = F::Sin;
+                unary["cos"] = F::Cos;     unary["TMath::Cos"] = F::Cos;
+                unary["tan"] = F::Tan;     unary["TMath::Tan"] = F::Tan;
+                unary["atan"] = F::Atan;   unary["TMath::ATan"] = F::Atan;
+                binary["pow"] = F::Pow;    binary["TMath::Power"] = F::Pow;
+                binary["min"] = F::Min;    binary["TMath::Min"] = F::Min;
+                binary["max"] = F::Max;    binary["TMath::Max"] = F::Max;
+                binary["atan2"] = F::Atan2; binary["TMath::ATan2"] = F::Atan2;
+            }
+            std::map<std::string, F::OpCode> &table = two ? binary : unary;
+            std::map<std::string, F::OpCode>::const_iterator it = table.find(name);
+            if (it == table.end()) return fail_();
+            return emit_(it->second, a, b);
+        }
+};
+
+RooCompiledFormula::RooCompiledFormula(const char *name, const char *title, const char *formula, const RooArgList &dependents) :
+        RooAbsReal(name,title),
+        formula_(formula),
+        deps_("deps","Dependents",this),
+        init_(false), compiled_(false)
+{
+    RooFIter iter = dependents.fwdIterator();
+    for (RooAbsArg *a = iter.next(); a != 0; a = iter.next()) {
+        if (!dynamic_cast<RooAbsReal *>(a)) {
+            throw std::invalid_argument(std::string("Dependent ")+a->GetName()+" of RooCompiledFormula is a "+a->ClassName());
+        }
+        deps_.add(*a);
+    }
+}
+
+RooCompiledFormula::RooCompiledFormula(const RooCompiledFormula &other, const char *newname) :
+    RooAbsReal(other,newname),
+    formula_(other.formula_),
+    deps_("deps",this,other.deps_),
+    init_(false), compiled_(false)
+{
+}
+
+void RooCompiledFormula::init() const {
+    init_ = true;
+    code_.clear(); regs_.clear();
+    RooCompiledFormulaParser parser(*this);
+    compiled_ = parser.parse(result_);
+    if (!compiled_) code_.clear();
+}
+
+bool RooCompiledFormula::compiled() const {
+    if (!init_) init();
+    return compiled_;
+}
+
+unsigned int RooCompiledFormula::size() const {
+    if (!init_) init();
+    return code_.size();
+}
+
+Double_t RooCompiledFormula::evaluate() const {
+    if (!init_) init();
+    if (!compiled_) {
+        coutE(Eval) << "RooCompiledFormula " << GetName() << ": can't compile '" << formula_ << "'" << std::endl;
+        throw std::invalid_argument("RooCompiledFormula: can't compile '"+formula_+"'");
+    }
+    Double_t *regs = &regs_[0];
+    RooFIter iter = deps_.fwdIterator();
+    unsigned int i = 0;
+    for (RooAbsArg *a = iter.next(); a != 0; a = iter.next(), ++i) regs[i] = static_cast<const RooAbsReal *>(a)->getVal();
+    for (std::vector<Instr>::const_iterator it = code_.begin(), ed = code_.end(); it != ed; ++it) {
+        regs[it->out] = apply(it->op, regs[it->a], regs[it->b]);
+    }
+    return regs[result_];
+}
+
+
+ClassImp(RooCompiledFormula)
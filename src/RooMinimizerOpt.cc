@@ -1,22 +1,79 @@
 #include "HiggsAnalysis/CombinedLimit/interface/RooMinimizerOpt.h"
+#include "HiggsAnalysis/CombinedLimit/interface/CachingNLL.h"
+#include "HiggsAnalysis/CombinedLimit/interface/ProfilingTools.h"
+#include "HiggsAnalysis/CombinedLimit/interface/ThreadPool.h"
+#include "HiggsAnalysis/CombinedLimit/interface/FcnTrace.h"
+#include "HiggsAnalysis/CombinedLimit/interface/utils.h"
 
 #include <stdexcept>
 #include <RooRealVar.h>
 #include <RooAbsPdf.h>
 #include <RooMsgService.h>
+#include <RooAbsCategory.h>
+#include <RooFitResult.h>
+#include <TDecompChol.h>
 
 #include <Math/MinimizerOptions.h>
+#include <Math/Minimizer.h>
 
 #include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <set>
+#include <cmath>
+#include <chrono>
+#include <cstdio>
+#include <csignal>
+#include <unistd.h>
+#include <errno.h>
+#include <boost/functional/hash.hpp>
 
 using namespace std;
 
+bool RooMinimizerOpt::warmStart_ = false;
+unsigned long RooMinimizerFcnOpt::totalEvals_ = 0;
+unsigned long RooMinimizerFcnOpt::memoHits_ = 0;
+
+namespace {
+    /// RooAbsArg::_valueDirty is protected, but a pointer to it taken through a derived class works on any node
+    struct DirtyFlagAccess : public RooAbsArg {
+        static Bool_t RooAbsArg::* flag() { return &DirtyFlagAccess::_valueDirty; }
+    };
+}
+
+const char *
+RooMinimizerOpt::fitterType(const char *type)
+{
+    return (warmStart_ && type != 0 && std::string(type) == "Minuit2") ? "Minuit2Warm" : type;
+}
+
 RooMinimizerOpt::RooMinimizerOpt(RooAbsReal& function) :
     RooMinimizer(function)
 {
     delete _fcn;
     _fcn = new RooMinimizerFcnOpt(_func,this,_verbose); 
     setEps(ROOT::Math::MinimizerOptions::DefaultTolerance());
+    if (runtimedef::get("MINIMIZER_ANALYTIC_GRADIENT") && RooMinimizerFcnOptGrad::canHandle(function)) {
+        _gradFcn.reset(new RooMinimizerFcnOptGrad(*static_cast<RooMinimizerFcnOpt*>(_fcn), dynamic_cast<cacheutils::CachingSimNLL &>(function)));
+    } else if (runtimedef::get("MINIMIZER_COLORED_GRADIENT") && RooMinimizerFcnOptGrad::canHandle(function)) {
+        _gradFcn.reset(new RooMinimizerFcnOptGrad(*static_cast<RooMinimizerFcnOpt*>(_fcn), dynamic_cast<cacheutils::CachingSimNLL &>(function), true));
+    } else if (runtimedef::get("MINIMIZER_PARALLEL_GRADIENT") > 1) {
+        _forkGradFcn.reset(new RooMinimizerFcnOptForkGrad(*static_cast<RooMinimizerFcnOpt*>(_fcn), runtimedef::get("MINIMIZER_PARALLEL_GRADIENT") - 1));
+    }
+}
+
+bool
+RooMinimizerOpt::fitFCN()
+{
+    if (_gradFcn.get()) return _theFitter->FitFCN(*_gradFcn);
+    if (_forkGradFcn.get()) {
+        bool ret = _theFitter->FitFCN(*_forkGradFcn);
+        // the processes have a copy of the function as it was when they were started: between fits
+        // the constant parameters or the data can change, so they're started again for the next one
+        _forkGradFcn->stopWorkers();
+        return ret;
+    }
+    return _theFitter->FitFCN(*_fcn);
 }
 
 Double_t
@@ -36,13 +93,13 @@ Int_t RooMinimizerOpt::minimize(const char* type, const char* alg)
             _optConst,_verbose) ;
   }
 
-  _theFitter->Config().SetMinimizer(type,alg);
+  _theFitter->Config().SetMinimizer(fitterType(type),alg);
 
   profileStart() ;
   RooAbsReal::setEvalErrorLoggingMode(RooAbsReal::CollectErrors) ;
   RooAbsReal::clearEvalErrorLog() ;
 
-  bool ret = _theFitter->FitFCN(*_fcn);
+  bool ret = fitFCN();
   _status = ((ret) ? _theFitter->Result().Status() : -1);
 
   RooAbsReal::setEvalErrorLoggingMode(RooAbsReal::PrintErrors) ;
@@ -72,8 +129,8 @@ Int_t RooMinimizerOpt::improve()
   RooAbsReal::setEvalErrorLoggingMode(RooAbsReal::CollectErrors) ;
   RooAbsReal::clearEvalErrorLog() ;
 
-  _theFitter->Config().SetMinimizer(_minimizerType.c_str(),"migradimproved");
-  bool ret = _theFitter->FitFCN(*_fcn);
+  _theFitter->Config().SetMinimizer(fitterType(_minimizerType.c_str()),"migradimproved");
+  bool ret = fitFCN();
   _status = ((ret) ? _theFitter->Result().Status() : -1);
 
   RooAbsReal::setEvalErrorLoggingMode(RooAbsReal::PrintErrors) ;
@@ -104,8 +161,8 @@ Int_t RooMinimizerOpt::migrad()
   RooAbsReal::setEvalErrorLoggingMode(RooAbsReal::CollectErrors) ;
   RooAbsReal::clearEvalErrorLog() ;
 
-  _theFitter->Config().SetMinimizer(_minimizerType.c_str(),"migrad");
-  bool ret = _theFitter->FitFCN(*_fcn);
+  _theFitter->Config().SetMinimizer(fitterType(_minimizerType.c_str()),"migrad");
+  bool ret = fitFCN();
   _status = ((ret) ? _theFitter->Result().Status() : -1);
 
   RooAbsReal::setEvalErrorLoggingMode(RooAbsReal::PrintErrors) ;
@@ -142,11 +199,17 @@ Int_t RooMinimizerOpt::hesse()
                   _optConst,_verbose) ;
     }
 
+    if (runtimedef::get("MINIMIZER_NATIVE_HESSE") && nativeHesse_()) {
+        _status = 0;
+        saveStatus("HESSE",_status) ;
+        return _status ;
+    }
+
     profileStart() ;
     RooAbsReal::setEvalErrorLoggingMode(RooAbsReal::CollectErrors) ;
     RooAbsReal::clearEvalErrorLog() ;
 
-    _theFitter->Config().SetMinimizer(_minimizerType.c_str());
+    _theFitter->Config().SetMinimizer(fitterType(_minimizerType.c_str()));
     bool ret = _theFitter->CalculateHessErrors();
     _status = ((ret) ? _theFitter->Result().Status() : -1);
 
@@ -162,6 +225,64 @@ Int_t RooMinimizerOpt::hesse()
 
 }
 
+bool
+RooMinimizerOpt::nativeHesse_()
+{
+    cacheutils::CachingSimNLL *simnll = dynamic_cast<cacheutils::CachingSimNLL *>(_func);
+    if (simnll == 0 || typeid(*_fcn) != typeid(RooMinimizerFcnOpt)) return false;
+    const std::vector<RooRealVar *> &vars = static_cast<RooMinimizerFcnOpt*>(_fcn)->floatVars();
+    unsigned int n = vars.size();
+    int knob = runtimedef::get("MINIMIZER_NATIVE_HESSE");
+    std::vector<double> hess;
+    if (!simnll->hessian(vars, hess, ThreadPool::threadsFor(knob > 1 ? knob : 0))) {
+        coutW(Minimization) << "RooMinimizerOpt::hesse: can't compute the hessian of the NLL directly, using Minuit's HESSE" << endl ;
+        return false;
+    }
+    TMatrixDSym cov(n);
+    for (unsigned int i = 0; i < n; ++i) {
+        for (unsigned int j = 0; j < n; ++j) cov(i,j) = hess[i*n + j];
+    }
+    TDecompChol chol(cov);
+    if (!chol.Decompose()) {
+        coutW(Minimization) << "RooMinimizerOpt::hesse: the hessian of the NLL is not positive definite, using Minuit's HESSE" << endl ;
+        return false;
+    }
+    // same convention as Minuit, the errors being where the function rises by the error level
+    cov = chol.Invert();
+    cov *= 2 * _theFitter->Config().MinimizerOptions().ErrorDef();
+    _nativeCovX.resize(n);
+    for (unsigned int i = 0; i < n; ++i) {
+        vars[i]->setError(std::sqrt(cov(i,i)));
+        vars[i]->removeAsymError();
+        _nativeCovX[i] = vars[i]->getVal();
+    }
+    _nativeCov.reset(new TMatrixDSym(cov));
+    return true;
+}
+
+RooFitResult *
+RooMinimizerOpt::save(const char *name, const char *title)
+{
+    RooFitResult *ret = RooMinimizer::save(name, title);
+    if (ret == 0 || _nativeCov.get() == 0 || typeid(*_fcn) != typeid(RooMinimizerFcnOpt)) return ret;
+    const std::vector<RooRealVar *> &vars = static_cast<RooMinimizerFcnOpt*>(_fcn)->floatVars();
+    if (vars.size() != _nativeCovX.size() || int(vars.size()) != ret->floatParsFinal().getSize()) return ret;
+    for (unsigned int i = 0, n = vars.size(); i < n; ++i) {
+        if (vars[i]->getVal() != _nativeCovX[i]) return ret;
+    }
+    ret->setCovarianceMatrix(*_nativeCov);
+    return ret;
+}
+
+void
+RooMinimizerOpt::fitStatus(int &status, int &covQual, double &edm, int &numInvalidNLL) const
+{
+    status = _status;
+    covQual = (_theFitter->GetMinimizer() ? _theFitter->GetMinimizer()->CovMatrixStatus() : -1);
+    edm = _theFitter->Result().Edm();
+    numInvalidNLL = _fcn->GetNumInvalidNLL();
+}
+
 //_____________________________________________________________________________
 Int_t RooMinimizerOpt::minos()
 {
@@ -188,7 +309,7 @@ Int_t RooMinimizerOpt::minos()
     RooAbsReal::setEvalErrorLoggingMode(RooAbsReal::CollectErrors) ;
     RooAbsReal::clearEvalErrorLog() ;
 
-    _theFitter->Config().SetMinimizer(_minimizerType.c_str());
+    _theFitter->Config().SetMinimizer(fitterType(_minimizerType.c_str()));
     bool ret = _theFitter->CalculateMinosErrors();
     _status = ((ret) ? _theFitter->Result().Status() : -1);
 
@@ -244,19 +365,31 @@ Int_t RooMinimizerOpt::minos(const RooArgSet& minosParamList)
     }
     delete aIter ;
 
+    std::vector<std::pair<double,double> > forkedErrors;
     if (paramInd.size()) {
       // set the parameter indeces
       _theFitter->Config().SetMinosErrors(paramInd);
 
-      _theFitter->Config().SetMinimizer(_minimizerType.c_str());
-      bool ret = _theFitter->CalculateMinosErrors();
-      _status = ((ret) ? _theFitter->Result().Status() : -1);
+      _theFitter->Config().SetMinimizer(fitterType(_minimizerType.c_str()));
+      int forks = runtimedef::get("MINIMIZER_PARALLEL_MINOS");
+      if (forks > 1) {
+        bool ret = parallelMinos_(paramInd, forks, forkedErrors);
+        _status = ((ret) ? _theFitter->Result().Status() : -1);
+      } else {
+        bool ret = _theFitter->CalculateMinosErrors();
+        _status = ((ret) ? _theFitter->Result().Status() : -1);
+      }
 
     }
 
     RooAbsReal::setEvalErrorLoggingMode(RooAbsReal::PrintErrors) ;
     profileStop() ;
     _fcn->BackProp(_theFitter->Result());
+    // the errors from the forks aren't in the result of the fitter
+    for (unsigned int k = 0, n = forkedErrors.size(); k < n; ++k) {
+      RooRealVar *var = dynamic_cast<RooRealVar *>(_fcn->GetFloatParamList()->at(paramInd[k]));
+      if (var) var->setAsymError(forkedErrors[k].first, forkedErrors[k].second);
+    }
 
     saveStatus("MINOS",_status) ;
 
@@ -288,14 +421,39 @@ RooMinimizerFcnOpt::Clone() const
       return new RooMinimizerFcnOpt(*this);
 }
 
+RooMinimizerFcnOpt::MemoEntry &
+RooMinimizerFcnOpt::memoSlot_(const double *x, unsigned int size) const
+{
+  // the state is the one of the NLL and all the constant parameters, discrete ones included
+  _memoStateWork.clear();
+  _memoStateWork.push_back(static_cast<const cacheutils::CachingSimNLL *>(_funct)->stateId());
+  RooFIter iter = _constParamList->fwdIterator();
+  for (RooAbsArg *a = iter.next(); a != 0; a = iter.next()) {
+      if (RooAbsReal *rar = dynamic_cast<RooAbsReal *>(a)) _memoStateWork.push_back(rar->getVal());
+      else if (RooAbsCategory *cat = dynamic_cast<RooAbsCategory *>(a)) _memoStateWork.push_back(cat->getIndex());
+  }
+  if (_memo.size() != size || _memoStateWork != _memoState) {
+      _memo.assign(size, MemoEntry());
+      _memoState.swap(_memoStateWork);
+  }
+  return _memo[boost::hash_range(x, x + _nDim) % size];
+}
+
 double
 RooMinimizerFcnOpt::DoEval(const double * x) const 
 {
+  // the same point as a recent call, with the same constants and data, gives the same value
+  static int memoSize = runtimedef::get("MINIMIZER_MEMO");
+  MemoEntry *memo = (memoSize > 0 && dynamic_cast<const cacheutils::CachingSimNLL *>(_funct) != 0) ? &memoSlot_(x, memoSize) : 0;
+
   // Set the parameter values for this iteration
+  static bool directWrite = runtimedef::get("MINIMIZER_DIRECT_WRITE");
+  if (directWrite && _dirtyLists.size() != _vars.size()) initDirtyLists();
   for (int index = 0; index < _nDim; index++) {
       if (_vals[index]!=x[index]) {
           RooRealVar* par = _vars[index];
           if (_verbose) cout << par->GetName() << "=" << x[index] << ", " ;
+          if (directWrite) RooAbsArg::setDirtyInhibit(true);
           if (_hasOptimzedBounds[index]) {
               // boundary transformation done internally
               par->setVal( _optimzedBounds[index].transform(x[index]) );
@@ -304,6 +462,14 @@ RooMinimizerFcnOpt::DoEval(const double * x) const
               par->setVal(x[index]);
               _vals[index] = par->getVal(); // might not work otherwise if x is out of the boundary
           }
+          if (directWrite) {
+              RooAbsArg::setDirtyInhibit(false);
+              // same as what RooFit would do, except that nodes reached through many paths are not visited many times
+              Bool_t RooAbsArg::* flag = DirtyFlagAccess::flag();
+              for (RooAbsArg *node : _dirtyLists[index]) {
+                  if (node->operMode() == RooAbsArg::Auto) node->*flag = kTRUE;
+              }
+          }
       }
   }
   if (_logfile) {
@@ -312,10 +478,31 @@ RooMinimizerFcnOpt::DoEval(const double * x) const
       }
   }
 
+  if (memo && memo->x.size() == unsigned(_nDim) && std::equal(x, x + _nDim, memo->x.begin())) {
+      if (_logfile) (*_logfile) << setprecision(15) << memo->value << setprecision(4) << endl;
+      _evalCounter++ ;
+      memoHits_++;
+      return memo->value;
+  }
+
   // Calculate the function for these parameters  
+  FcnTraceWriter *trace = FcnTraceWriter::get();
+  std::chrono::steady_clock::time_point start;
+  if (trace) start = std::chrono::steady_clock::now();
   RooAbsReal::setHideOffset(kFALSE) ;
   double fvalue = _funct->getVal();
   RooAbsReal::setHideOffset(kTRUE) ;
+  if (trace) {
+      double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      const cacheutils::CachingSimNLL *simnll = dynamic_cast<const cacheutils::CachingSimNLL *>(_funct);
+      trace->record(*_floatParamList, *_constParamList, simnll ? simnll->stateId() : 0, fvalue, seconds);
+  }
+
+  // only the good values, as the others are replaced by something depending on the history of the fit
+  if (memo && !(RooAbsPdf::evalError() || RooAbsReal::numEvalErrors()>0 || fvalue>1e30)) {
+      memo->x.assign(x, x + _nDim);
+      memo->value = fvalue;
+  }
 
   if (RooAbsPdf::evalError() || RooAbsReal::numEvalErrors()>0 || fvalue>1e30) {
 
@@ -370,10 +557,236 @@ RooMinimizerFcnOpt::DoEval(const double * x) const
   }
 
   _evalCounter++ ;
+  totalEvals_++;
 
   return fvalue;
 }
 
+RooMinimizerFcnOptGrad::RooMinimizerFcnOptGrad(const RooMinimizerFcnOpt &fcn, const cacheutils::CachingSimNLL &nll, bool colored) :
+    _fcn(fcn), _nll(nll), _colored(colored)
+{
+}
+
+bool
+RooMinimizerFcnOptGrad::canHandle(const RooAbsReal &funct)
+{
+    return dynamic_cast<const cacheutils::CachingSimNLL *>(&funct) != 0;
+}
+
+void
+RooMinimizerFcnOptGrad::Gradient(const double *x, double *grad) const
+{
+    // set the parameters and bring the nll up to date, then differentiate it
+    _fcn(x);
+    if (_colored) _nll.coloredGradient(_fcn.floatVars(), _work);
+    else _nll.gradient(_fcn.floatVars(), _work);
+    unsigned int n = NDim();
+    for (unsigned int i = 0; i < n; ++i) {
+        grad[i] = _work[i] * _fcn.dTransform(i, x[i]);
+    }
+    _lastX.assign(x, x+n);
+    _lastGrad.assign(grad, grad+n);
+}
+
+double
+RooMinimizerFcnOptGrad::DoDerivative(const double * x, unsigned int icoord) const
+{
+    // minimizers asking for the single components usually go through all of them at the same point 
+    if (_lastX.size() != NDim() || !std::equal(_lastX.begin(), _lastX.end(), x)) {
+        std::vector<double> grad(NDim());
+        Gradient(x, &grad[0]);
+    }
+    return _lastGrad[icoord];
+}
+
+namespace {
+    bool readAll(int fd, void *buff, size_t size) {
+        char *p = static_cast<char *>(buff);
+        while (size > 0) {
+            ssize_t got = read(fd, p, size);
+            if (got == -1 && errno == EINTR) continue;
+            if (got <= 0) return false;
+            p += got; size -= got;
+        }
+        return true;
+    }
+    bool writeAll(int fd, const void *buff, size_t size) {
+        const char *p = static_cast<const char *>(buff);
+        while (size > 0) {
+            ssize_t written = write(fd, p, size);
+            if (written == -1 && errno == EINTR) continue;
+            if (written <= 0) return false;
+            p += written; size -= written;
+        }
+        return true;
+    }
+}
+
+bool
+RooMinimizerOpt::parallelMinos_(const std::vector<unsigned int> &paramInd, unsigned int forks, std::vector<std::pair<double,double> > &errors)
+{
+    // one process per side of each parameter, all starting from the minimum in the minimizer of this process;
+    // a side whose process died is done again here at the end
+    unsigned int njobs = 2*paramInd.size();
+    std::vector<double> results(njobs, 0);
+    std::vector<int> state(njobs, -1); // -1 not done, 0 failed, 1 valid
+    ROOT::Math::Minimizer *minimizer = _theFitter->GetMinimizer();
+    auto minosSide = [minimizer, &paramInd](unsigned int job, double &err) {
+        double lo = 0, hi = 0;
+        // runopt 1 = lower side only, 2 = upper side only
+        bool ok = minimizer->GetMinosError(paramInd[job/2], lo, hi, job % 2 ? 2 : 1);
+        err = (job % 2 ? hi : lo);
+        return ok;
+    };
+    std::vector<std::vector<double> > records;
+    try {
+        for (unsigned int first = 0; first < njobs; first += std::max(forks, 1u)) {
+            utils::runInForks(first, std::min(njobs, first + std::max(forks, 1u)), [&](unsigned int job) -> std::vector<double> {
+                std::vector<double> record(2);
+                record[0] = minosSide(job, record[1]);
+                return record;
+            }, records, false, false);
+        }
+    } catch (std::exception &ex) {
+        std::cerr << "RooMinimizerOpt: " << ex.what() << ", the remaining MINOS errors are computed here" << std::endl;
+    }
+    records.resize(njobs);
+    for (unsigned int job = 0; job < njobs; ++job) {
+        if (records[job].size() == 2) { state[job] = (records[job][0] != 0); results[job] = records[job][1]; }
+    }
+    bool ok = true;
+    errors.resize(paramInd.size());
+    for (unsigned int job = 0; job < njobs; ++job) {
+        if (state[job] == -1) state[job] = minosSide(job, results[job]);
+        if (state[job] == 0) ok = false;
+        (job % 2 ? errors[job/2].second : errors[job/2].first) = results[job];
+    }
+    return ok;
+}
+
+RooMinimizerFcnOptForkGrad::RooMinimizerFcnOptForkGrad(const RooMinimizerFcnOpt &fcn, unsigned int workers) :
+    _fcn(fcn), _workers(new Workers(workers))
+{
+}
+
+void
+RooMinimizerFcnOptForkGrad::Workers::stop()
+{
+    // closing the pipe makes the process exit at its next read
+    for (unsigned int k = 0, n = pids.size(); k < n; ++k) {
+        close(toChild[k]); close(fromChild[k]);
+    }
+    for (unsigned int k = 0, n = pids.size(); k < n; ++k) {
+        std::string problem = utils::waitForChild(pids[k]);
+        if (!problem.empty()) std::cerr << "RooMinimizerFcnOptForkGrad: gradient process " << k << " " << problem << std::endl;
+    }
+    pids.clear(); toChild.clear(); fromChild.clear();
+}
+
+void
+RooMinimizerFcnOptForkGrad::stopWorkers() const
+{
+    _workers->stop();
+}
+
+double
+RooMinimizerFcnOptForkGrad::partial_(const double *x, unsigned int i) const
+{
+    // step: a small fraction of the uncertainty on the parameter, if known, converted to the internal coordinates
+    // of the minimizer for the parameters with soft bounds; central differences, one-sided at the hard bounds
+    const RooRealVar *var = _fcn.floatVars()[i];
+    double dt = std::abs(_fcn.dTransform(i, x[i]));
+    double h = (var->getError() > 0 && dt > 0) ? 1e-3 * var->getError() / dt : 1e-4 * std::max(1.0, std::abs(x[i]));
+    double xup = x[i] + h, xdn = x[i] - h;
+    if (!_fcn.hasOptimizedBounds(i)) {
+        if (var->hasMax() && xup > var->getMax()) xup = x[i];
+        if (var->hasMin() && xdn < var->getMin()) xdn = x[i];
+        if (xup == xdn) return 0;
+    }
+    _xwork[i] = xup; double fup = _fcn(&_xwork[0]);
+    _xwork[i] = xdn; double fdn = _fcn(&_xwork[0]);
+    _xwork[i] = x[i];
+    return (fup - fdn)/(xup - xdn);
+}
+
+void
+RooMinimizerFcnOptForkGrad::startWorkers_() const
+{
+    Workers &w = *_workers;
+    unsigned int n = NDim(), slots = w.size + 1;
+    fflush(stdout); fflush(stderr);
+    for (unsigned int k = 0; k < w.size; ++k) {
+        int down[2], up[2];
+        if (pipe(down) == -1) break;
+        if (pipe(up) == -1) { close(down[0]); close(down[1]); break; }
+        int pid = fork();
+        if (pid == -1) { close(down[0]); close(down[1]); close(up[0]); close(up[1]); break; }
+        if (pid == 0) {
+            close(down[1]); close(up[0]);
+            for (unsigned int j = 0; j < w.pids.size(); ++j) { close(w.toChild[j]); close(w.fromChild[j]); }
+            std::vector<double> x(n), res;
+            while (readAll(down[0], &x[0], n*sizeof(double))) {
+                _xwork = x; res.clear();
+                for (unsigned int i = k+1; i < n; i += slots) res.push_back(partial_(&x[0], i));
+                if (!res.empty() && !writeAll(up[1], &res[0], res.size()*sizeof(double))) break;
+            }
+            _exit(0);
+        }
+        close(down[0]); close(up[1]);
+        w.pids.push_back(pid); w.toChild.push_back(down[1]); w.fromChild.push_back(up[0]);
+    }
+}
+
+void
+RooMinimizerFcnOptForkGrad::Gradient(const double *x, double *grad) const
+{
+    Workers &w = *_workers;
+    unsigned int n = NDim();
+    if (w.pids.empty()) startWorkers_();
+    unsigned int slots = w.pids.size() + 1;
+    std::vector<bool> done(n, false);
+    // a process that died only costs us its share, which is then done here, and the processes are started again at the
+    // next call; ignore SIGPIPE meanwhile
+    bool lost = false;
+    void (*oldHandler)(int) = signal(SIGPIPE, SIG_IGN);
+    std::vector<bool> sent(w.pids.size(), false);
+    for (unsigned int k = 0, nw = w.pids.size(); k < nw; ++k) {
+        if (k+1 < n && !(sent[k] = writeAll(w.toChild[k], x, n*sizeof(double)))) lost = true;
+    }
+    _xwork.assign(x, x+n);
+    for (unsigned int i = 0; i < n; i += slots) { grad[i] = partial_(x, i); done[i] = true; }
+    for (unsigned int k = 0, nw = w.pids.size(); k < nw; ++k) {
+        if (!sent[k]) continue;
+        unsigned int nres = 0;
+        for (unsigned int i = k+1; i < n; i += slots) ++nres;
+        _buffer.resize(nres);
+        if (!readAll(w.fromChild[k], &_buffer[0], nres*sizeof(double))) { lost = true; continue; }
+        for (unsigned int i = k+1, j = 0; i < n; i += slots, ++j) { grad[i] = _buffer[j]; done[i] = true; }
+    }
+    signal(SIGPIPE, oldHandler);
+    if (lost) {
+        std::cerr << "RooMinimizerFcnOptForkGrad: lost a gradient process, its share of the gradient is computed here" << std::endl;
+        w.stop(); // reports how the processes exited
+    }
+    for (unsigned int i = 0; i < n; ++i) {
+        if (!done[i]) grad[i] = partial_(x, i);
+    }
+    // leave the parameters of this process at x, as for the other functions
+    _fcn(x);
+    _lastX.assign(x, x+n);
+    _lastGrad.assign(grad, grad+n);
+}
+
+double
+RooMinimizerFcnOptForkGrad::DoDerivative(const double * x, unsigned int icoord) const
+{
+    if (_lastX.size() != NDim() || !std::equal(_lastX.begin(), _lastX.end(), x)) {
+        std::vector<double> grad(NDim());
+        Gradient(x, &grad[0]);
+    }
+    return _lastGrad[icoord];
+}
+
 Bool_t RooMinimizerFcnOpt::Synchronize(std::vector<ROOT::Fit::ParameterSettings>& parameters, 
                  Bool_t optConst, Bool_t verbose)
 {
@@ -625,6 +1038,7 @@ Bool_t RooMinimizerFcnOpt::Synchronize(std::vector<ROOT::Fit::ParameterSettings>
 }
 
 void RooMinimizerFcnOpt::initStdVects() const {
+  _dirtyLists.clear();
   _vars.resize(_floatParamList->getSize());
   _vals.resize(_vars.size());
   _hasOptimzedBounds.resize(_vars.size());
@@ -650,3 +1064,23 @@ void RooMinimizerFcnOpt::initStdVects() const {
       }
   }
 }
+
+void RooMinimizerFcnOpt::initDirtyLists() const {
+  _dirtyLists.resize(_vars.size());
+  std::vector<RooAbsArg *> stack; 
+  std::set<RooAbsArg *> seen;
+  for (unsigned int i = 0, n = _vars.size(); i < n; ++i) {
+      std::vector<RooAbsArg *> &list = _dirtyLists[i];
+      list.clear(); seen.clear();
+      stack.assign(1, _vars[i]);
+      while (!stack.empty()) {
+          // we go also past the nodes that are not in the automatic mode, in case they are switched back to it later:
+          // marking a few more nodes is harmless, missing some is not
+          RooAbsArg *node = stack.back(); stack.pop_back();
+          RooFIter iter = node->valueClientMIterator();
+          for (RooAbsArg *client = iter.next(); client != 0; client = iter.next()) {
+              if (seen.insert(client).second) { list.push_back(client); stack.push_back(client); }
+          }
+      }
+  }
+}
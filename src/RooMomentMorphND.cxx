@@ -944,6 +944,73 @@ void RooMomentMorphND::findShape(const vector<double>& x) const
 }
 
 
+//_____________________________________________________________________________
+Bool_t RooMomentMorphND::mixingFractions(vector<double>& fracs) const
+{
+  // Same fractions of the pdfs as CacheElem::calculateFractions, without going through the RooRealVars of the cache:
+  // for the Linear settings the weights of the multilinear interpolation in the cell of the grid (extrapolating
+  // linearly outside of it, as the inverted matrix of findShape), for the NonLinear ones the product with the
+  // matrix made by initialize()
+  if (_useHorizMorph) return false;
+  int nPdf = _pdfList.getSize();
+  int nPar = _parList.getSize();
+  if (nPar == 0 || int(_referenceGrid._grid.size()) != nPar) return false;
+  fracs.assign(nPdf, 0.);
+
+  if (_setting == NonLinear || _setting == NonLinearPosFractions) {
+    if (_M == 0 || _M->GetNrows() != nPdf) return false;
+    vector<vector<int> > powers(nPar), output;
+    for (int idim = 0; idim < nPar; idim++) {
+      for (int ix = 0; ix < _referenceGrid._nnuis[idim]; ix++) powers[idim].push_back(ix);
+    }
+    cartesian_product(output, powers);
+    if (int(output.size()) != nPdf) return false;
+    vector<double> dm(nPar), deltavec(nPdf, 1.0);
+    for (int idim = 0; idim < nPar; idim++) {
+      dm[idim] = ((RooAbsReal*)_parList.at(idim))->getVal() - _referenceGrid._nref[0][idim];
+    }
+    for (int j = 0; j < nPdf; ++j) {
+      for (int ix = 0; ix < nPar; ix++) deltavec[j] *= TMath::Power(dm[ix], static_cast<double>(output[j][ix]));
+    }
+    double sumposfrac = 0.0;
+    for (int i = 0; i < nPdf; ++i) {
+      for (int j = 0; j < nPdf; ++j) fracs[i] += (*_M)(j,i) * deltavec[j];
+      if (fracs[i] >= 0) sumposfrac += fracs[i];
+    }
+    if (_setting == NonLinearPosFractions) {
+      for (int i = 0; i < nPdf; ++i) fracs[i] = (fracs[i] < 0 ? 0. : fracs[i]/sumposfrac);
+    }
+    return true;
+  }
+
+  // the corners of the cell are found among the reference points by their coordinates, as findShape does
+  vector<double> lo(nPar), hi(nPar), t(nPar);
+  for (int idim = 0; idim < nPar; idim++) {
+    const RooAbsBinning& binning = *_referenceGrid._grid[idim];
+    double x = ((RooAbsReal*)_parList.at(idim))->getVal();
+    int bin = binning.binNumber(x);
+    lo[idim] = binning.binLow(bin);
+    hi[idim] = binning.binHigh(bin);
+    t[idim] = (x - lo[idim])/(hi[idim] - lo[idim]);
+  }
+  int nRef = _referenceGrid._nref.size();
+  vector<double> corner(nPar);
+  for (int icorner = 0, ncorners = 1 << nPar; icorner < ncorners; ++icorner) {
+    double w = 1.0;
+    for (int idim = 0; idim < nPar; idim++) {
+      bool up = (icorner >> idim) & 1;
+      corner[idim] = (up ? hi[idim] : lo[idim]);
+      w *= (up ? t[idim] : 1.0 - t[idim]);
+    }
+    int iref = 0;
+    while (iref < nRef && _referenceGrid._nref[iref] != corner) ++iref;
+    if (iref == nRef || iref >= nPdf) return false;
+    fracs[iref] += w;
+  }
+  return true;
+}
+
+
 //_____________________________________________________________________________
 Bool_t RooMomentMorphND::setBinIntegrator(RooArgSet& allVars)
 {
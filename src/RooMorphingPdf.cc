@@ -7,6 +7,7 @@
 #include "RooArgSet.h"
 #include "RooAbsReal.h"
 #include "TH1F.h"
+#include "HiggsAnalysis/CombinedLimit/interface/ProfilingTools.h"
 
 RooMorphingPdf::RooMorphingPdf()
     : x_(RooRealProxy()),
@@ -138,10 +139,21 @@ void RooMorphingPdf::Init() const {
   sentry_.addVars(RooArgList(mh_.arg()));
   sentry_.setValueDirty();
 
+  for (MassMapIter it = hmap_.begin(); it != hmap_.end(); ++it) {
+    shape_sentry_.addVars(it->second->coefList());
+  }
+  shape_sentry_.setValueDirty();
+  morphed_.clear();
+
   init_ = true;
 }
 
 Double_t RooMorphingPdf::evaluate() const {
+  return cache().GetAt(x_);
+}
+
+FastHisto const& RooMorphingPdf::cache() const {
+  static int max_morphed = runtimedef::get("MORPHPDF_CACHE_SIZE");
   if (!init_ || hmap_.empty()) Init();
 
   // cache is empty: throw exception
@@ -154,6 +166,12 @@ Double_t RooMorphingPdf::evaluate() const {
     throw std::runtime_error("RooMorphingPdf: Cache is empty!");
   }
 
+  // The input templates have changed shape, so none of the stored morphed
+  // templates can be reused. Changes of the normalisation alone don't
+  // matter, as the morphed template is normalised anyway.
+  bool shapes_good = shape_sentry_.good();
+  if (!shapes_good) morphed_.clear();
+
   if (!sentry_.good()) {
     // Mass value has changed so we need to figure out what
     // new masspoints to take
@@ -183,6 +201,15 @@ Double_t RooMorphingPdf::evaluate() const {
         single_point_ = false;
       }
     }
+    // We have already been at this mass with the same input templates
+    if (shapes_good && !single_point_) {
+      MorphedMap::const_iterator match = morphed_.find(mh_);
+      if (match != morphed_.end()) {
+        cache_ = match->second;
+        sentry_.reset();
+        return cache_;
+      }
+    }
   }
 
   if (single_point_) {
@@ -207,10 +234,42 @@ Double_t RooMorphingPdf::evaluate() const {
       }
       cache_.CropUnderflows();
       cache_.Normalize();
+      // Keep the result for later evaluations at this mass (negative
+      // MORPHPDF_CACHE_SIZE disables this)
+      if (max_morphed >= 0) {
+        if (morphed_.size() >= unsigned(max_morphed ? max_morphed : 32)) morphed_.clear();
+        morphed_[mh_] = cache_;
+      }
     }
   }
   sentry_.reset();
-  return cache_.GetAt(x_);
+  shape_sentry_.reset();
+  return cache_;
+}
+
+RooMorphingPdfV::RooMorphingPdfV(const RooMorphingPdf& pdf,
+                                 const RooAbsData& data,
+                                 bool includeZeroWeights)
+    : pdf_(pdf) {
+  const FastHisto& cache = pdf.cache();
+  RooArgSet obs(pdf.x_.arg());
+  const RooRealVar& x = static_cast<const RooRealVar&>(*obs.first());
+  bins_.reserve(data.numEntries());
+  for (int i = 0, n = data.numEntries(); i < n; ++i) {
+    obs = *data.get(i);
+    if (data.weight() == 0 && !includeZeroWeights) continue;
+    // out of range entries have a bin of -1 or size(), and a value of zero
+    bins_.push_back(cache.FindBin(x.getVal()));
+  }
+}
+
+void RooMorphingPdfV::fill(std::vector<Double_t>& out) const {
+  const FastHisto& cache = pdf_.cache();
+  int nbins = cache.size();
+  out.resize(bins_.size());
+  for (unsigned i = 0, n = bins_.size(); i < n; ++i) {
+    out[i] = (bins_[i] >= 0 && bins_[i] < nbins) ? cache.GetBinContent(bins_[i]) : 0.;
+  }
 }
 
 FastTemplate RooMorphingPdf::morph(FastTemplate const& hist1,
@@ -15,6 +15,8 @@
 #include "RooFit.h"
 
 #include "TFile.h"
+#include "vectorized.h"
+#include <algorithm>
 
 //using namespace RooFit ;
 
@@ -148,3 +150,41 @@ Double_t RooParametricHist::evaluate() const
   return ret; 
 }
 
+
+RooParametricHistV::RooParametricHistV(const RooParametricHist &pdf, const RooAbsData &data, bool includeZeroWeights) 
+{
+  for (int i = 0; i < pdf.N_bins; ++i) {
+     pars_.push_back(static_cast<const RooAbsReal*>(pdf.pars.at(i)));
+     widths_.push_back(pdf.widths[i]);
+  }
+  densities_.resize(pdf.N_bins);
+
+  RooArgSet obs(pdf.x.arg());
+  const RooAbsReal &x = static_cast<const RooAbsReal &>(*obs.first());
+  bins_.reserve(data.numEntries());
+  for (int i = 0, n = data.numEntries(); i < n; ++i) {
+     obs = *data.get(i);
+     if (data.weight() == 0 && !includeZeroWeights) continue;
+     // same binning as evaluate(): [low, high) edges, -1 for out of range entries
+     double xval = x.getVal();
+     int bin = -1; 
+     if (xval >= pdf.bins[0] && xval < pdf.bins[pdf.N_bins]) {
+        bin = std::upper_bound(pdf.bins.begin(), pdf.bins.begin()+pdf.N_bins+1, xval) - pdf.bins.begin() - 1;
+     }
+     bins_.push_back(bin);
+  }
+}
+
+void RooParametricHistV::fill(std::vector<Double_t> &out) const 
+{
+  for (unsigned int i = 0, n = pars_.size(); i < n; ++i) {
+     densities_[i] = pars_[i]->getVal() / widths_[i];
+  }
+  // the integral over the full range, i.e. getFullSum()
+  double norm = densities_.empty() ? 0. : vectorized::dot_product(densities_.size(), &densities_[0], &widths_[0]);
+  double inorm = 1.0/norm;
+  out.resize(bins_.size());
+  for (unsigned int i = 0, n = bins_.size(); i < n; ++i) {
+     out[i] = (bins_[i] >= 0 ? densities_[bins_[i]] * inorm : 0.);
+  }
+}
@@ -8,11 +8,19 @@ const double RooScaleLOSM::mW_ = 80.398;
 
 RooScaleLOSM::RooScaleLOSM(const char *name, const char *title, RooAbsReal &mH):
   RooAbsReal(name, title),
-  mH_("mH","Higgs boson mass [GeV]",this,mH)
+  mH_("mH","Higgs boson mass [GeV]",this,mH),
+  mHAmp_(NAN), mbAmp_(NAN)
 {
 
 }
 
+bool RooScaleLOSM::amplitudesOutdated(double mH, double mb) const
+{
+  if (mH == mHAmp_ && mb == mbAmp_) return false;
+  mHAmp_ = mH; mbAmp_ = mb;
+  return true;
+}
+
 complexD RooScaleLOSM::f(double tau) const
 {
   if(tau <= 1)
@@ -55,9 +63,16 @@ RooScaleHGamGamLOSM::RooScaleHGamGamLOSM(const char *name, const char *title,
   mb_("mb", "(Running) Bottom Quark mass [GeV]",this,mb),
   cb_("cb", "Bottom Quark coupling constant", this, cb)
 {
-	At_ = (4./3.) * AmpSpinOneHalf( (mH_*mH_)/(4*mt_*mt_) ); // Nc = 3, Qt^2 = 4/9  => 4/3
-	Ab_ = (1./3.) * AmpSpinOneHalf( (mH_*mH_)/(4*mb_*mb_) ); // Nc = 3, Qb^2 = 1/9  => 1/3
-	AW_ = AmpSpinOne( (mH_*mH_)/(4*mW_*mW_) );
+	updateAmplitudes();
+}
+
+void RooScaleHGamGamLOSM::updateAmplitudes() const
+{
+	const double mH = mH_, mb = mb_;
+	if (!amplitudesOutdated(mH, mb)) return;
+	At_ = (4./3.) * AmpSpinOneHalf( (mH*mH)/(4*mt_*mt_) ); // Nc = 3, Qt^2 = 4/9  => 4/3
+	Ab_ = (1./3.) * AmpSpinOneHalf( (mH*mH)/(4*mb*mb) ); // Nc = 3, Qb^2 = 1/9  => 1/3
+	AW_ = AmpSpinOne( (mH*mH)/(4*mW_*mW_) );
 	C_SM_ = norm(At_ + Ab_ + AW_);
 }
 
@@ -75,6 +90,7 @@ TObject* RooScaleHGamGamLOSM::clone(const char *newname) const
 
 Double_t RooScaleHGamGamLOSM::evaluate() const
 {
+	updateAmplitudes();
 	const double ct = ct_, cb = cb_, cW = cW_;
 
 	const double C_deviated = norm(ct*At_ + cb*Ab_ + cW*AW_);
@@ -94,8 +110,15 @@ RooScaleHGluGluLOSM::RooScaleHGluGluLOSM(const char *name, const char *title,
   mb_("mb", "(Running) Bottom Quark mass [GeV]",this,mb),
   cb_("cb", "Bottom Quark coupling constant", this, cb)
 {
-	At_ = AmpSpinOneHalf( (mH_*mH_)/(4*mt_*mt_) );
-	Ab_ = AmpSpinOneHalf( (mH_*mH_)/(4*mb_*mb_) );
+	updateAmplitudes();
+}
+
+void RooScaleHGluGluLOSM::updateAmplitudes() const
+{
+	const double mH = mH_, mb = mb_;
+	if (!amplitudesOutdated(mH, mb)) return;
+	At_ = AmpSpinOneHalf( (mH*mH)/(4*mt_*mt_) );
+	Ab_ = AmpSpinOneHalf( (mH*mH)/(4*mb*mb) );
 	C_SM_ = norm(At_ + Ab_);
 }
 
@@ -112,6 +135,7 @@ TObject* RooScaleHGluGluLOSM::clone(const char *newname) const
 
 Double_t RooScaleHGluGluLOSM::evaluate() const
 {
+	updateAmplitudes();
 	const double ct = ct_, cb = cb_;
 
 	const double C_deviated = norm(ct*At_ + cb*Ab_);
@@ -147,6 +171,7 @@ TObject* RooScaleHGamGamLOSMPlusX::clone(const char *newname) const
 
 Double_t RooScaleHGamGamLOSMPlusX::evaluate() const
 {
+	updateAmplitudes();
 	const double ct = ct_, cb = cb_, cW = cW_, X =  X_;
 
 	const double C_deviated = norm(ct*At_ + cb*Ab_ + cW*AW_ + X);
@@ -181,6 +206,7 @@ TObject* RooScaleHGluGluLOSMPlusX::clone(const char *newname) const
 
 Double_t RooScaleHGluGluLOSMPlusX::evaluate() const
 {
+	updateAmplitudes();
 	const double ct = ct_, cb = cb_, X =  X_;
 
 	const double C_deviated = norm(ct*At_ + cb*Ab_ + X);
@@ -1,6 +1,7 @@
 #include "HiggsAnalysis/CombinedLimit/interface/RooSpline1D.h"
 
 #include <stdexcept>
+#include <algorithm>
 
 #include <fstream>
 #include <sstream>
@@ -9,7 +10,7 @@ RooSpline1D::RooSpline1D(const char *name, const char *title, RooAbsReal &xvar,
         RooAbsReal(name,title),
         xvar_("xvar","Variable", this, xvar),
         x_(), y_(), type_(algo),
-        interp_(0)
+        interp_(0), init_(false), direct_(false), lastValid_(false)
 {
         std::ifstream file( path, std::ios::in);
         std::string line;
@@ -34,7 +35,7 @@ RooSpline1D::RooSpline1D(const char *name, const char *title, RooAbsReal &xvar,
         RooAbsReal(name,title),
         xvar_("xvar","Variable", this, xvar), 
         x_(npoints), y_(npoints), type_(algo),
-        interp_(0)
+        interp_(0), init_(false), direct_(false), lastValid_(false)
 { 
     for (unsigned int i = 0; i < npoints; ++i) {
         x_[i] = xvals[i];
@@ -46,7 +47,7 @@ RooSpline1D::RooSpline1D(const char *name, const char *title, RooAbsReal &xvar,
         RooAbsReal(name,title),
         xvar_("xvar","Variable", this, xvar), 
         x_(npoints), y_(npoints), type_(algo),
-        interp_(0)
+        interp_(0), init_(false), direct_(false), lastValid_(false)
 { 
     for (unsigned int i = 0; i < npoints; ++i) {
         x_[i] = xvals[i];
@@ -58,7 +59,7 @@ RooSpline1D::RooSpline1D(const RooSpline1D &other, const char *newname) :
     RooAbsReal(other,newname),
     xvar_("xvar",this,other.xvar_),
     x_(other.x_), y_(other.y_), type_(other.type_),
-    interp_(0)
+    interp_(0), init_(false), direct_(false), lastValid_(false)
 {
 }
 
@@ -84,9 +85,67 @@ void RooSpline1D::init() const {
     else throw std::invalid_argument("Unknown interpolation type '"+type_+"'");
 }
 
+void RooSpline1D::initCoefficients() const {
+    init_ = true;
+    lastValid_ = false;
+    lastInterval_ = 0;
+    unsigned int n = x_.size();
+    direct_ = (type_ == "LINEAR" && n >= 2) || (type_ == "CSPLINE" && n >= 3);
+    for (unsigned int i = 1; direct_ && i < n; ++i) {
+        if (!(x_[i] > x_[i-1])) direct_ = false; // leave it to the interpolator to complain
+    }
+    if (!direct_) return;
+    b_.assign(n-1, 0.); c_.assign(n, 0.); d_.assign(n-1, 0.);
+    if (type_ == "CSPLINE") {
+        // natural cubic spline as in GSL: c_ is half the second derivative, zero at the ends,
+        // from the tridiagonal system of the continuity of the first derivative (Thomas algorithm)
+        std::vector<double> diag(n), rhs(n);
+        for (unsigned int i = 1; i < n-1; ++i) {
+            double h0 = x_[i] - x_[i-1], h1 = x_[i+1] - x_[i];
+            double g = 3.0 * ((y_[i+1] - y_[i])/h1 - (y_[i] - y_[i-1])/h0);
+            diag[i] = 2.0 * (h0 + h1);
+            rhs[i]  = g;
+            if (i > 1) {
+                double m = h0 / diag[i-1];
+                diag[i] -= m * h0;
+                rhs[i]  -= m * rhs[i-1];
+            }
+        }
+        for (unsigned int i = n-2; i >= 1; --i) {
+            double h1 = x_[i+1] - x_[i];
+            c_[i] = (rhs[i] - (i < n-2 ? h1 * c_[i+1] : 0.0)) / diag[i];
+        }
+    }
+    for (unsigned int i = 0; i < n-1; ++i) {
+        double h = x_[i+1] - x_[i], dy = y_[i+1] - y_[i];
+        b_[i] = dy/h - h * (c_[i+1] + 2.0*c_[i]) / 3.0;
+        d_[i] = (c_[i+1] - c_[i]) / (3.0*h);
+    }
+}
+
+double RooSpline1D::evalDirect(double x) const {
+    unsigned int i = lastInterval_;
+    if (!(x_[i] <= x && x <= x_[i+1])) {
+        i = std::upper_bound(x_.begin(), x_.end(), x) - x_.begin();
+        i = (i == 0 ? 0 : std::min<unsigned int>(i - 1, x_.size() - 2));
+        lastInterval_ = i;
+    }
+    double dx = x - x_[i];
+    return y_[i] + dx * (b_[i] + dx * (c_[i] + dx * d_[i]));
+}
+
 Double_t RooSpline1D::evaluate() const {
-    if (interp_ == 0) init();
-    return interp_->Eval(xvar_);
+    if (!init_) initCoefficients();
+    double x = xvar_;
+    if (lastValid_ && x == lastX_) return lastY_;
+    if (direct_ && x >= x_.front() && x <= x_.back()) {
+        lastY_ = evalDirect(x);
+    } else {
+        if (interp_ == 0) init();
+        lastY_ = interp_->Eval(x);
+    }
+    lastX_ = x; lastValid_ = true;
+    return lastY_;
 }
 
 
@@ -1,8 +1,13 @@
 #include "HiggsAnalysis/CombinedLimit/interface/RooSplineND.h"
+#include <algorithm>
+#include "TFile.h"
+#include "TMD5.h"
+#include "TRandom3.h"
 
-RooSplineND::RooSplineND(const char *name, const char *title, RooArgList &vars, TTree *tree, const char *fName, double eps, bool rescale, std::string cutstring) :
+RooSplineND::RooSplineND(const char *name, const char *title, RooArgList &vars, TTree *tree, const char *fName, double eps, bool rescale, std::string cutstring, double support, const char *weightCache) :
   RooAbsReal(name,title),
-  vars_("vars","Variables", this)
+  vars_("vars","Variables", this),
+  support_(support)
 {
   rescaleAxis = rescale;
   ndim_ = vars.getSize();
@@ -56,7 +61,42 @@ RooSplineND::RooSplineND(const char *name, const char *title, RooArgList &vars,
   // Try to re-scale axis to even out dimensions.
   axis_pts_ = TMath::Power(M_,1./ndim_);
   eps_= eps;
-  calculateWeights(F_vec); 
+  bool cached = false;
+  if (weightCache && weightCache[0]) {
+    // the solved weights depend only on the points, the function values and the settings
+    TMD5 md5;
+    int settings[3] = { ndim_, M_, rescaleAxis };
+    double dsettings[2] = { eps_, support_ };
+    md5.Update((const UChar_t *) settings, sizeof(settings));
+    md5.Update((const UChar_t *) dsettings, sizeof(dsettings));
+    for (int k=0;k<ndim_ && M_>0;k++) md5.Update((const UChar_t *) &v_map[k][0], M_*sizeof(double));
+    if (M_>0) md5.Update((const UChar_t *) &F_vec[0], M_*sizeof(double));
+    md5.Final();
+    std::string key = std::string("RooSplineND_") + md5.AsString();
+    TDirectory::TContext ctx;
+    TFile *cache = TFile::Open(weightCache, "UPDATE");
+    if (cache && !cache->IsZombie()) {
+      TVectorD *saved = (TVectorD *) cache->Get(key.c_str());
+      if (saved && saved->GetNrows() == M_) {
+        std::cout << "RooSplineND -- Weights read from " << weightCache << std::endl;
+        setWeights(*saved);
+        cached = true;
+      } else {
+        if (support_ > 0) calculateSparseWeights(F_vec);
+        else calculateWeights(F_vec);
+        TVectorD weights(M_);
+        for (int i=0;i<M_;i++) weights[i] = w_[i];
+        weights.Write(key.c_str());
+        cached = true;
+      }
+      delete saved;
+    }
+    if (cache) { cache->Close(); delete cache; }
+  }
+  if (!cached) {
+    if (support_ > 0) calculateSparseWeights(F_vec);
+    else calculateWeights(F_vec);
+  }
   delete b_map;	
 }
 
@@ -85,12 +125,15 @@ RooSplineND::RooSplineND(const RooSplineND& other, const char *name) :
   r_map = other.r_map;
   
   rescaleAxis=other.rescaleAxis;
+  support_ = other.support_;
+  lutN_ = other.lutN_;
+  lut_  = other.lut_;
 }
 //_____________________________________________________________________________
 // Clone Constructor
 RooSplineND::RooSplineND(const char *name, const char *title, const RooListProxy &vars, 
- int ndim, int M, double eps, bool rescale, std::vector<double> &w, std::map<int,std::vector<double> > &map, std::map<int,std::pair<double,double> > &rmap,double wmean, double wrms) :
- RooAbsReal(name, title),vars_("vars",this,RooListProxy()) 
+ int ndim, int M, double eps, bool rescale, std::vector<double> &w, std::map<int,std::vector<double> > &map, std::map<int,std::pair<double,double> > &rmap,double wmean, double wrms, double support) :
+ RooAbsReal(name, title),vars_("vars",this,RooListProxy()),support_(support)
 {
 
   RooAbsReal *rIt;	
@@ -117,8 +160,11 @@ RooSplineND::RooSplineND(const char *name, const char *title, const RooListProxy
 //_____________________________________________________________________________
 TObject *RooSplineND::clone(const char *newname) const 
 {
-    return new RooSplineND(newname, this->GetTitle(), 
-	vars_,ndim_,M_,eps_,rescaleAxis,w_,v_map,r_map,w_mean,w_rms);
+    RooSplineND *ret = new RooSplineND(newname, this->GetTitle(), 
+	vars_,ndim_,M_,eps_,rescaleAxis,w_,v_map,r_map,w_mean,w_rms,support_);
+    ret->lutN_ = lutN_;
+    ret->lut_  = lut_;
+    return ret;
 }
 //_____________________________________________________________________________
 RooSplineND::~RooSplineND() 
@@ -176,7 +222,12 @@ void RooSplineND::calculateWeights(std::vector<double> &f){
   decomp.Solve(weights); // Solution now in weights
   std::cout << "RooSplineND -- ........ Done" << std::endl;
 
-  w_mean = 0.;
+  setWeights(weights);
+}
+//_____________________________________________________________________________
+void RooSplineND::setWeights(const TVectorD &weights){
+  w_.clear();
+  w_mean = 0.; w_rms = 0.;
   for (int i=0;i<M_;i++){
     double tw = weights[i];
     w_.push_back(tw);
@@ -187,6 +238,82 @@ void RooSplineND::calculateWeights(std::vector<double> &f){
   w_rms = TMath::Sqrt(w_rms);
 }
 //_____________________________________________________________________________
+void RooSplineND::calculateSparseWeights(std::vector<double> &f){
+
+  std::cout << "RooSplineND -- Solving for Weights (compact support " << support_ << ")" << std::endl;
+  w_mean = 0; w_rms = 1;
+  if (M_==0) return;
+  buildTree();
+  // Only the pairs of points within the support give non-zero entries
+  std::vector<int> rows, cols; std::vector<double> vals;
+  std::vector<std::pair<int,double> > found;
+  for (int i=0;i<M_;i++){
+    found.clear();
+    neighbours(&kdPts_[i*ndim_], found, 0, M_, 0);
+    for (unsigned int j=0, n=found.size(); j<n; j++){
+      rows.push_back(i); cols.push_back(found[j].first);
+      vals.push_back(found[j].first == i ? 1. : compactFunc(found[j].second));
+    }
+  }
+  std::cout << "RooSplineND -- " << vals.size() << " non-zero elements (" << double(vals.size())/M_ << " per point)" << std::endl;
+  TMatrixDSparse fMatrix(M_,M_);
+  fMatrix.SetMatrixArray(vals.size(), &rows[0], &cols[0], &vals[0]);
+
+  TVectorD weights(M_);
+  for (int i=0;i<M_;i++) weights[i]=f[i];
+
+  TDecompSparse decomp(fMatrix,0);
+  decomp.Solve(weights); // Solution now in weights
+  std::cout << "RooSplineND -- ........ Done" << std::endl;
+
+  setWeights(weights);
+}
+//_____________________________________________________________________________
+void RooSplineND::buildTree() const {
+  kdPts_.resize(M_*ndim_);
+  kdIdx_.resize(M_);
+  for (int i=0;i<M_;i++){
+    kdIdx_[i] = i;
+    for (int k=0;k<ndim_;k++) kdPts_[i*ndim_+k] = coord(k, v_map[k][i]);
+  }
+  buildTree(0, M_, 0);
+}
+//_____________________________________________________________________________
+void RooSplineND::buildTree(int lo, int hi, int depth) const {
+  if (hi - lo <= 1) return;
+  int mid = (lo + hi)/2, k = depth % ndim_;
+  const std::vector<double> &pts = kdPts_; int nd = ndim_;
+  std::nth_element(kdIdx_.begin()+lo, kdIdx_.begin()+mid, kdIdx_.begin()+hi, [&pts,nd,k](int a, int b) { return pts[a*nd+k] < pts[b*nd+k]; });
+  buildTree(lo, mid, depth+1);
+  buildTree(mid+1, hi, depth+1);
+}
+//_____________________________________________________________________________
+void RooSplineND::neighbours(const double *x, std::vector<std::pair<int,double> > &out, int lo, int hi, int depth) const {
+  if (hi <= lo) return;
+  int mid = (lo + hi)/2, k = depth % ndim_, p = kdIdx_[mid];
+  const double *xp = &kdPts_[p*ndim_];
+  double r2 = support_*support_, d2 = 0;
+  for (int j=0;j<ndim_;j++) d2 += (x[j]-xp[j])*(x[j]-xp[j]);
+  if (d2 < r2) out.push_back(std::make_pair(p, d2));
+  double dk = x[k] - xp[k];
+  // the side of the split containing x first, then the other one only if the support crosses the split
+  if (dk < 0) {
+    neighbours(x, out, lo, mid, depth+1);
+    if (dk*dk < r2) neighbours(x, out, mid+1, hi, depth+1);
+  } else {
+    neighbours(x, out, mid+1, hi, depth+1);
+    if (dk*dk < r2) neighbours(x, out, lo, mid, depth+1);
+  }
+}
+//_____________________________________________________________________________
+double RooSplineND::compactFunc(double d2) const{
+  // Wendland function with C2 continuity, positive definite in up to ndim_ dimensions
+  double r = TMath::Sqrt(d2)/support_;
+  if (r >= 1) return 0.;
+  int l = ndim_/2 + 2;
+  return TMath::Power(1-r, l+1)*((l+1)*r+1);
+}
+//_____________________________________________________________________________
 double RooSplineND::getDistSquare(int i, int j){
   double D = 0.; 
   for (int k=0;k<ndim_;k++){
@@ -201,13 +328,12 @@ double RooSplineND::getDistSquare(int i, int j){
   return D; // only ever use square of distance!
 }
 //_____________________________________________________________________________
-double RooSplineND::getDistFromSquare(int i) const{
+double RooSplineND::getDistFromSquare(int i, const double *x) const{
   // Read parameters distance from point i in the sample
   double D = 0.; 
   for (int k=0;k<ndim_;k++){
     double v_i = v_map[k][i];
-    RooAbsReal *v = (RooAbsReal*)vars_.at(k);
-    double v_j = v->getVal();
+    double v_j = x[k];
     double dk; 
     if (rescaleAxis) dk = axis_pts_*(v_i-v_j)/(r_map[k].second-r_map[k].first);
     else dk = (v_i-v_j);
@@ -225,16 +351,100 @@ double RooSplineND::radialFunc(double d2, double eps) const{
 }
 //_____________________________________________________________________________
 Double_t RooSplineND::evaluate() const {
+ std::vector<double> &x = evalX_;
+ x.resize(ndim_);
+ for (int k=0;k<ndim_;k++) x[k] = ((RooAbsReal*)vars_.at(k))->getVal();
+ if (!lut_.empty()) {
+   double ret;
+   if (evaluateTable(&x[0], ret)) return ret;
+ }
+ return evaluateExact(&x[0]);
+}
+//_____________________________________________________________________________
+double RooSplineND::evaluateExact(const double *v) const {
+ if (support_ > 0) {
+   if (kdIdx_.empty() && M_ > 0) buildTree();
+   std::vector<std::pair<int,double> > &found = kdFound_;
+   std::vector<double> x(ndim_);
+   for (int k=0;k<ndim_;k++) x[k] = coord(k, v[k]);
+   found.clear();
+   if (M_ > 0) neighbours(&x[0], found, 0, M_, 0);
+   double ret = 0;
+   for (unsigned int i=0, n=found.size(); i<n; i++) ret += w_[found[i].first]*compactFunc(found[i].second);
+   return ret;
+ }
  double ret = 0;
  for (int i=0;i<M_;i++){
- //  std::cout << "EVAL == "<< i << " " << w_[i] << " " << getDistFromSquare(i) << std::endl;
    double w = w_[i];
    if (w==0) continue;
-   ret+=((w/w_mean)*radialFunc(getDistFromSquare(i),eps_));
+   ret+=((w/w_mean)*radialFunc(getDistFromSquare(i,v),eps_));
  }
  ret*=w_mean;
  return ret;
 }
 //_____________________________________________________________________________
+bool RooSplineND::evaluateTable(const double *v, double &ret) const {
+ // multilinear interpolation from the 2^ndim corners of the cell containing v; false if outside the table
+ std::vector<double> &frac = evalFrac_;
+ frac.resize(ndim_);
+ int base = 0, stride = 1;
+ for (int k=0;k<ndim_;k++){
+   int n = lutN_[k];
+   std::map<int,std::pair<double,double> >::const_iterator r = r_map.find(k);
+   double t = (v[k]-r->second.first)/(r->second.second-r->second.first)*(n-1);
+   if (!(t >= 0 && t <= n-1)) return false;
+   int i = std::min(int(t), n-2);
+   frac[k] = t - i;
+   base += i*stride;
+   stride *= n;
+ }
+ ret = 0;
+ for (int c=0, nc=(1<<ndim_); c<nc; c++){
+   double wc = 1; int idx = base; stride = 1;
+   for (int k=0;k<ndim_;k++){
+     if (c & (1<<k)) { wc *= frac[k]; idx += stride; } else wc *= 1-frac[k];
+     stride *= lutN_[k];
+   }
+   if (wc != 0) ret += wc*lut_[idx];
+ }
+ return true;
+}
+//_____________________________________________________________________________
+bool RooSplineND::buildLookupTable(int nPointsPerDim, double tolerance, int nCheck){
+  lut_.clear(); lutN_.clear();
+  if (M_==0 || ndim_==0 || nPointsPerDim < 2) return false;
+  lutN_.assign(ndim_, nPointsPerDim);
+  long size = 1;
+  for (int k=0;k<ndim_;k++) size *= nPointsPerDim;
+  std::cout << "RooSplineND -- Filling a lookup table of " << size << " points" << std::endl;
+  std::vector<double> table(size), v(ndim_);
+  for (long idx=0;idx<size;idx++){
+    long rest = idx;
+    for (int k=0;k<ndim_;k++){
+      int i = rest % nPointsPerDim; rest /= nPointsPerDim;
+      v[k] = r_map[k].first + (r_map[k].second-r_map[k].first)*i/(nPointsPerDim-1);
+    }
+    table[idx] = evaluateExact(&v[0]);
+  }
+  lut_.swap(table);
+  // compare with the exact spline at random points, which are mostly far from the nodes of the table
+  TRandom3 rnd(4357);
+  double maxdiff = 0;
+  for (int i=0;i<nCheck;i++){
+    for (int k=0;k<ndim_;k++) v[k] = rnd.Uniform(r_map[k].first, r_map[k].second);
+    double exact = evaluateExact(&v[0]), approx = exact;
+    evaluateTable(&v[0], approx);
+    maxdiff = std::max(maxdiff, TMath::Abs(exact - approx));
+  }
+  std::cout << "RooSplineND -- Lookup table: max difference from the exact spline over " << nCheck << " random points = " << maxdiff << std::endl;
+  if (maxdiff > tolerance) {
+    std::cout << "RooSplineND -- Lookup table exceeds the tolerance " << tolerance << ", not using it" << std::endl;
+    lut_.clear(); lutN_.clear();
+    return false;
+  }
+  setValueDirty();
+  return true;
+}
+//_____________________________________________________________________________
 
 ClassImp(RooSplineND)
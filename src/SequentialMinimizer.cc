@@ -37,7 +37,7 @@ bool cmsmath::OneDimMinimizer::minimize(int steps, double ytol, double xtol)
     // get initial bracket
     seek();
     
-    bool done = doloop(steps,ytol,xtol);
+    bool done = (newton_ && newtonSteps(steps,ytol,(xtol ? xtol : (fabs(xi_[1])+XTOL)*XTOL))) || doloop(steps,ytol,xtol);
     parabolaStep();
     x() = xi_[1];
     xstep_ = xi_[2] - xi_[0];
@@ -82,7 +82,7 @@ cmsmath::OneDimMinimizer::ImproveRet cmsmath::OneDimMinimizer::improve(int steps
     assert(xi_[1] == xi_[0] || yi_[1] <= yi_[0]); 
     assert(xi_[1] == xi_[2] || yi_[1] <= yi_[2]);
 
-    bool done = doloop(steps,ytol,xtol);
+    bool done = (newton_ && newtonSteps(steps,ytol,xtol)) || doloop(steps,ytol,xtol);
     parabolaStep(); 
 
     //post-condition: always a sorted interval
@@ -282,6 +282,37 @@ bool cmsmath::OneDimMinimizer::parabolaStep() {
     return false;
 }
 
+bool cmsmath::OneDimMinimizer::newtonSteps(int steps, double ytol, double xtol) 
+{
+    if (steps <= 0) steps = 100;
+    for (int i = 0; i < steps; ++i) {
+        if (xtol > 0 && (xi_[2] - xi_[0]) < xtol) return true;
+        if (xi_[0] == xi_[1] || xi_[1] == xi_[2]) return false;
+        double h0 = xi_[1] - xi_[0], h2 = xi_[2] - xi_[1];
+        double d0 = (yi_[1] - yi_[0])/h0, d2 = (yi_[2] - yi_[1])/h2;
+        double deriv2 = 2*(d2 - d0)/(h0 + h2);
+        if (!(deriv2 > 0)) return false;
+        double deriv1 = (d0*h2 + d2*h0)/(h0 + h2);
+        // expected decrease to the minimum (exact for a parabola): if small, the final parabolaStep will take it
+        if (ytol > 0 && 0.5*deriv1*deriv1/deriv2 < ytol) return true;
+        double xn = std::max(xi_[0], std::min(xi_[2], xi_[1] - deriv1/deriv2));
+        if (xn == xi_[0] || xn == xi_[1] || xn == xi_[2]) return false;
+        double yn = eval(xn);
+        DEBUG_ODM_printf("ODM: newton step %d for %s x = [%.4f, %.4f, %.4f], y = [%.4f, %.4f, %.4f], xn = %.4f, yn = %.4f\n", i, name_.c_str(), xi_[0], xi_[1], xi_[2], yi_[0], yi_[1], yi_[2], xn, yn);
+        // keep the lowest of the four points and its two neighbours
+        int iside = (xn < xi_[1] ? 0 : 2);
+        if (yn <= yi_[1]) {
+            assign(2-iside, 1);
+            xi_[1] = xn; yi_[1] = yn;
+        } else {
+            xi_[iside] = xn; yi_[iside] = yn;
+            // not as quadratic as expected: leave it to the golden bisection, from the smaller triplet
+            return false;
+        }
+    }
+    return false;
+}
+
 void cmsmath::OneDimMinimizer::moveTo(double x) {
     if (x == xmax_) {
         xi_[0] = xmax_ - (xi_[2]-xi_[0]); yi_[0] = eval(xi_[0]);
@@ -299,6 +330,29 @@ void cmsmath::OneDimMinimizer::moveTo(double x) {
     }
 }
 
+std::map<std::string,int> cmsmath::SequentialMinimizer::parameterBlocks_;
+int cmsmath::SequentialMinimizer::nParameterBlocks_ = 0;
+
+void cmsmath::SequentialMinimizer::setParameterBlocks(const std::vector<std::vector<std::string> > &blocks) {
+    parameterBlocks_.clear();
+    nParameterBlocks_ = blocks.size();
+    for (int ib = 0; ib < nParameterBlocks_; ++ib) {
+        foreach(const std::string &name, blocks[ib]) parameterBlocks_[name] = ib;
+    }
+}
+
+std::set<std::string> cmsmath::SequentialMinimizer::newtonParameters_;
+
+void cmsmath::SequentialMinimizer::setNewtonParameters(const std::vector<std::string> &names) {
+    newtonParameters_.clear();
+    newtonParameters_.insert(names.begin(), names.end());
+}
+
+int cmsmath::SequentialMinimizer::blockOf(const std::string &name) const {
+    std::map<std::string,int>::const_iterator match = parameterBlocks_.find(name);
+    return match == parameterBlocks_.end() ? -1 : match->second;
+}
+
 void cmsmath::SequentialMinimizer::SetFunction(const ROOT::Math::IMultiGenFunction & func) {
     DEBUG_SM_printf("SequentialMinimizer::SetFunction: nDim = %u\n", func.NDim());
     func_.reset(new MinimizerContext(&func));
@@ -324,6 +378,8 @@ bool cmsmath::SequentialMinimizer::SetVariable(unsigned int ivar, const std::str
     func_->x[ivar] = val;
     workers_[ivar].initUnbound(*func_, ivar, step, name);
     workers_[ivar].state = Cleared;
+    workers_[ivar].block = blockOf(name);
+    workers_[ivar].setNewton(newtonParameters_.count(name));
     return true;
 }
 
@@ -333,6 +389,8 @@ bool cmsmath::SequentialMinimizer::SetLimitedVariable(unsigned int ivar, const s
     func_->x[ivar] = val;
     workers_[ivar].init(*func_, ivar, lower, upper, step, name);
     workers_[ivar].state = Cleared;
+    workers_[ivar].block = blockOf(name);
+    workers_[ivar].setNewton(newtonParameters_.count(name));
     return true;
 }
 
@@ -342,6 +400,8 @@ bool cmsmath::SequentialMinimizer::SetFixedVariable(unsigned int ivar, const std
     func_->x[ivar] = val;
     workers_[ivar].initUnbound(*func_, ivar, 1.0, name);
     workers_[ivar].state = Fixed;
+    workers_[ivar].block = blockOf(name);
+    workers_[ivar].setNewton(newtonParameters_.count(name));
     return true;
 }
 
@@ -382,6 +442,11 @@ bool cmsmath::SequentialMinimizer::improve(int smallsteps)
         if (w.state != Fixed) w.state = Active;
     }
 
+    // blocks in which some parameter moved since the last time the done workers were woken up.
+    // a change in a parameter outside of all blocks (anyBlockMoved) could affect any of them
+    std::vector<char> blockMoved(nParameterBlocks_, 1), blockMovedBefore(nParameterBlocks_);
+    bool anyBlockMoved = true, anyBlockMovedBefore;
+
     state_ = Active;
     for (int i = 0; i < bigsteps; ++i) {
         DEBUG_SM_printf("Start of loop. Strategy %d, State is %s\n",Strategy(),(state_ == Done ? "DONE" : "ACTIVE"));
@@ -402,11 +467,13 @@ bool cmsmath::SequentialMinimizer::improve(int smallsteps)
                 w.state = Active;
                 newstate = Active;
                 newActiveWorkers++;
+                if (w.block >= 0) blockMoved[w.block] = 1; else anyBlockMoved = true;
             }
         }
         if (Strategy() >= 2 && newActiveWorkers <= 30) { // arbitrary cut-off
             DEBUG_SM_printf("Middle of loop. Strategy %d, active workers %d: firing full minimizer\n", Strategy(), newActiveWorkers);
             if (doFullMinim()) newstate = Done;
+            anyBlockMoved = true;
         }
         if (newstate == Done) {
             DEBUG_SM_printf("Middle of loop. Strategy %d, State is %s, active workers %d --> %d \n",Strategy(),(state_ == Done ? "DONE" : "ACTIVE"), oldActiveWorkers, newActiveWorkers);
@@ -417,10 +484,14 @@ bool cmsmath::SequentialMinimizer::improve(int smallsteps)
             // We save a reference to it, remove it from the done list, and if the loop doesn't end there we set it to active again 
             Worker* firstWorker = *it; 
             it = doneWorkers.erase(it);
+            blockMovedBefore.swap(blockMoved); std::fill(blockMoved.begin(), blockMoved.end(), 0);
+            anyBlockMovedBefore = anyBlockMoved; anyBlockMoved = false;
             // Then we check all the others
             while( it != doneWorkers.end()) {
                 Worker &w = **it;
                 if (nFailWakeUpAttempts && w.nUnaffected >= nFailWakeUpAttempts) { ++it; continue; }
+                // nothing moved in its block, so its minimum is still the same
+                if (w.block >= 0 && !anyBlockMovedBefore && !blockMovedBefore[w.block]) { ++it; continue; }
                 OneDimMinimizer::ImproveRet iret = w.improve(smallsteps,ytol,0,/*force=*/true);
                 oldActiveWorkers++;
                 if (iret == OneDimMinimizer::Unchanged) {
@@ -434,6 +505,7 @@ bool cmsmath::SequentialMinimizer::improve(int smallsteps)
                     w.nUnaffected = 0;
                     it = doneWorkers.erase(it);
                     newActiveWorkers++;
+                    if (w.block >= 0) blockMoved[w.block] = 1; else anyBlockMoved = true;
                     if (Strategy() == 0) break;
                 }
             }
@@ -1,5 +1,21 @@
 #include "HiggsAnalysis/CombinedLimit/interface/SimplerLikelihoodRatioTestStatExt.h"
 #include "HiggsAnalysis/CombinedLimit/interface/utils.h"
+#include "HiggsAnalysis/CombinedLimit/interface/ProfilingTools.h"
+#include "vectorized.h"
+#include <cmath>
+#include <RooRealVar.h>
+
+namespace {
+    void readValues(const RooArgSet &params, std::vector<double> &out) {
+        out.clear();
+        RooLinkedListIter iter = params.iterator();
+        for (RooAbsArg *a = (RooAbsArg *) iter.Next(); a != 0; a = (RooAbsArg *) iter.Next()) {
+            RooAbsReal *rar = dynamic_cast<RooAbsReal *>(a);
+            if (rar) out.push_back(rar->getVal());
+            else if (RooAbsCategory *cat = dynamic_cast<RooAbsCategory *>(a)) out.push_back(cat->getIndex());
+        }
+    }
+}
 
 SimplerLikelihoodRatioTestStatOpt::SimplerLikelihoodRatioTestStatOpt(
         const RooArgSet &obs, 
@@ -65,14 +81,20 @@ SimplerLikelihoodRatioTestStatOpt::Evaluate(RooAbsData& data, RooArgSet& nullPOI
         }
     }
 
-    // evaluate null pdf
-    *paramsNull_ = snapNull_;
-    *paramsNull_ = nullPOI;
-    double nullNLL = simPdfNull_ ? evalSimNLL(data, simPdfNull_, simPdfComponentsNull_) : evalSimpleNLL(data, pdfNull_);
+    static bool fused = runtimedef::get("SLRTSO_FUSED");
+    double fusedQ = 0, nullNLL = 0, altNLL = 0;
+    if (fused && evalFused(data, nullPOI, fusedQ)) {
+        nullNLL = fusedQ;
+    } else {
+        // evaluate null pdf
+        *paramsNull_ = snapNull_;
+        *paramsNull_ = nullPOI;
+        nullNLL = simPdfNull_ ? evalSimNLL(data, simPdfNull_, simPdfComponentsNull_) : evalSimpleNLL(data, pdfNull_);
 
-    // evaluate alt pdf
-    *paramsAlt_ = snapAlt_;
-    double altNLL = simPdfAlt_ ? evalSimNLL(data, simPdfAlt_, simPdfComponentsAlt_) : evalSimpleNLL(data, pdfAlt_);
+        // evaluate alt pdf
+        *paramsAlt_ = snapAlt_;
+        altNLL = simPdfAlt_ ? evalSimNLL(data, simPdfAlt_, simPdfComponentsAlt_) : evalSimpleNLL(data, pdfAlt_);
+    }
 
     // put back links in pdf nodes, otherwise if the dataset goes out of scope they have dangling pointers
     if (nonEmpty) {
@@ -85,6 +107,107 @@ SimplerLikelihoodRatioTestStatOpt::Evaluate(RooAbsData& data, RooArgSet& nullPOI
     return nullNLL-altNLL;
 }
 
+bool SimplerLikelihoodRatioTestStatOpt::evalFused(RooAbsData &data, RooArgSet &nullPOI, double &ret) {
+    // the two pdfs must be simultaneous ones over the same category, or both plain ones
+    if ((simPdfNull_ == 0) != (simPdfAlt_ == 0)) return false;
+    if (simPdfNull_) {
+        if (simPdfComponentsNull_.size() != simPdfComponentsAlt_.size()) return false;
+        for (unsigned int ic = 0, nc = simPdfComponentsNull_.size(); ic < nc; ++ic) {
+            if ((simPdfComponentsNull_[ic] == 0) != (simPdfComponentsAlt_[ic] == 0)) return false;
+        }
+    }
+
+    // read the layout of the dataset: the observables and channel of each entry, and the weights
+    int n = data.numEntries();
+    fusedCoords_.clear(); fusedWeights_.resize(n); fusedChannels_.resize(n);
+    if (n > 0) {
+        const RooArgSet *entry = data.get(0);
+        std::vector<RooRealVar *> vars;
+        RooLinkedListIter iter = entry->iterator();
+        for (RooAbsArg *a = (RooAbsArg *) iter.Next(); a != 0; a = (RooAbsArg *) iter.Next()) {
+            RooRealVar *rrv = dynamic_cast<RooRealVar *>(a);
+            if (rrv && obs_->find(rrv->GetName())) vars.push_back(rrv);
+        }
+        RooAbsCategoryLValue *cat = 0;
+        if (simPdfNull_) {
+            cat = dynamic_cast<RooAbsCategoryLValue *>(entry->find(simPdfNull_->indexCat().GetName()));
+            if (cat == 0) return false;
+        }
+        fusedCoords_.reserve(n * vars.size());
+        for (int i = 0; i < n; ++i) {
+            data.get(i);
+            fusedWeights_[i] = data.weight();
+            fusedChannels_[i] = cat ? cat->getBin() : 0;
+            for (std::vector<RooRealVar *>::const_iterator itv = vars.begin(), edv = vars.end(); itv != edv; ++itv) {
+                fusedCoords_.push_back((*itv)->getVal());
+            }
+        }
+    }
+
+    // check if the cache is still valid, i.e. same entries and same parameters
+    std::vector<double> valsNull, valsAlt;
+    *paramsNull_ = snapNull_;
+    *paramsNull_ = nullPOI;
+    readValues(*paramsNull_, valsNull);
+    *paramsAlt_ = snapAlt_;
+    readValues(*paramsAlt_, valsAlt);
+    if (logRatio_.size() != unsigned(n) || fusedCoords_ != cachedCoords_ || fusedChannels_ != cachedChannels_ || 
+        valsNull != cachedParamsNull_ || valsAlt != cachedParamsAlt_) {
+        fillFusedCache(data, nullPOI);
+        cachedCoords_ = fusedCoords_; cachedChannels_ = fusedChannels_;
+        cachedParamsNull_.swap(valsNull); cachedParamsAlt_.swap(valsAlt);
+    }
+
+    // Q = sum_i w_i log(pdfNull/pdfAlt)(x_i) + extended terms, per channel, as in evalSimNLL and evalSimpleNLL
+    std::vector<double> sumw(expectedNull_.size(), 0.);
+    for (int i = 0; i < n; ++i) {
+        double w = fusedWeights_[i]; if (w == 0) continue;
+        if (logRatioBad_[i]) return false;
+        sumw[fusedChannels_[i]] += w;
+    }
+    ret = (n > 0 ? -vectorized::dot_product(n, &fusedWeights_[0], &logRatio_[0]) : 0.);
+    for (unsigned int ic = 0, nc = expectedNull_.size(); ic < nc; ++ic) {
+        if (simPdfNull_ && simPdfComponentsNull_[ic] == 0) continue; // no pdf for this channel
+        UInt_t observed = UInt_t(sumw[ic]);
+        double termNull = (std::abs(expectedNull_[ic]) < 1e-10 && observed == 0) ? 0 : expectedNull_[ic] - observed*std::log(expectedNull_[ic]);
+        double termAlt  = (std::abs(expectedAlt_[ic])  < 1e-10 && observed == 0) ? 0 : expectedAlt_[ic]  - observed*std::log(expectedAlt_[ic]);
+        ret += termNull - termAlt;
+    }
+    return std::isfinite(ret);
+}
+
+void SimplerLikelihoodRatioTestStatOpt::fillFusedCache(RooAbsData &data, RooArgSet &nullPOI) {
+    data.setDirtyProp(false);
+    int n = data.numEntries();
+    unsigned int nch = simPdfNull_ ? simPdfComponentsNull_.size() : 1;
+    std::vector<double> logNull(n, 0), logAlt(n, 0);
+    logRatio_.assign(n, 0); logRatioBad_.assign(n, 0);
+    expectedNull_.assign(nch, 0); expectedAlt_.assign(nch, 0);
+    for (int ih = 0; ih < 2; ++ih) {
+        // the parameters of the alternate pdf are set last, as in Evaluate
+        if (ih == 0) { *paramsNull_ = snapNull_; *paramsNull_ = nullPOI; }
+        else         { *paramsAlt_ = snapAlt_; }
+        RooAbsPdf *pdf = (ih == 0 ? pdfNull_ : pdfAlt_);
+        const std::vector<RooAbsPdf *> &components = (ih == 0 ? simPdfComponentsNull_ : simPdfComponentsAlt_);
+        std::vector<double> &logs = (ih == 0 ? logNull : logAlt), &expected = (ih == 0 ? expectedNull_ : expectedAlt_);
+        for (int i = 0; i < n; ++i) {
+            data.get(i);
+            RooAbsPdf *pdfi = simPdfNull_ ? components[fusedChannels_[i]] : pdf;
+            if (pdfi == 0) continue; // entries of channels without pdf are skipped, as in evalSimNLL
+            logs[i] = pdfi->getLogVal(obs_);
+        }
+        for (unsigned int ic = 0; ic < nch; ++ic) {
+            RooAbsPdf *pdfi = simPdfNull_ ? components[ic] : pdf;
+            if (pdfi) expected[ic] = pdfi->expectedEvents(obs_);
+        }
+    }
+    for (int i = 0; i < n; ++i) {
+        if (logRatioBad_[i]) continue;
+        logRatio_[i] = logNull[i] - logAlt[i];
+        if (!std::isfinite(logRatio_[i])) { logRatio_[i] = 0; logRatioBad_[i] = 1; }
+    }
+}
+
 void SimplerLikelihoodRatioTestStatOpt::unrollSimPdf(RooSimultaneous *simpdf, std::vector<RooAbsPdf *> &out) {
     // get a clone of the pdf category, so that I can use it to enumerate the pdf states
     std::auto_ptr<RooAbsCategoryLValue> catClone((RooAbsCategoryLValue*) simpdf->indexCat().Clone());
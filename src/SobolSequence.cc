@@ -0,0 +1,82 @@
+#include "HiggsAnalysis/CombinedLimit/interface/SobolSequence.h"
+#include <stdexcept>
+
+namespace {
+    /// product of polynomials over GF(2) modulo p, of degree deg
+    uint64_t mulmod(uint64_t a, uint64_t b, uint64_t p, int deg) {
+        uint64_t ret = 0;
+        for (; b; b >>= 1) {
+            if (b & 1) ret ^= a;
+            a <<= 1;
+            if (a & (uint64_t(1) << deg)) a ^= p;
+        }
+        return ret;
+    }
+    uint64_t powmod(uint64_t e, uint64_t p, int deg) {
+        uint64_t ret = 1, x = 2; // the polynomial "x"
+        if (x & (uint64_t(1) << deg)) x ^= p;
+        for (; e; e >>= 1) {
+            if (e & 1) ret = mulmod(ret, x, p, deg);
+            x = mulmod(x, x, p, deg);
+        }
+        return ret;
+    }
+    /// p (with bit deg set) is primitive if x has order 2^deg-1 modulo p 
+    bool isPrimitive(uint64_t p, int deg) {
+        if (!(p & 1)) return false;
+        uint64_t n = (uint64_t(1) << deg) - 1;
+        if (powmod(n, p, deg) != 1) return false;
+        uint64_t m = n;
+        for (uint64_t q = 2; q*q <= m; ++q) {
+            if (m % q) continue;
+            if (powmod(n/q, p, deg) == 1) return false;
+            while (m % q == 0) m /= q;
+        }
+        if (m > 1 && m != n && powmod(n/m, p, deg) == 1) return false;
+        return true;
+    }
+    /// xorshift, to draw the initial direction numbers and the shifts
+    uint32_t xorshift(uint32_t &s) { s ^= s << 13; s ^= s >> 17; s ^= s << 5; return s; }
+}
+
+SobolSequence::SobolSequence(unsigned int dimension, uint32_t seed) :
+    dim_(dimension), index_(0), v_(32*dimension), state_(dimension)
+{
+    uint32_t rng = seed ? seed : 0x9e3779b9;
+    for (int i = 0; i < 4; ++i) xorshift(rng);
+    uint64_t poly = 1; int deg = 0;
+    for (unsigned int d = 0; d < dim_; ++d) {
+        uint32_t *v = &v_[32*d];
+        if (d == 0) {
+            for (int k = 0; k < 32; ++k) v[k] = uint32_t(1) << (31-k);
+        } else {
+            // next primitive polynomial
+            do {
+                poly += 2;
+                if (poly >= (uint64_t(2) << deg)) { deg++; poly = (uint64_t(1) << deg) | 1; }
+                if (deg > 31) throw std::invalid_argument("SobolSequence: too many dimensions");
+            } while (!isPrimitive(poly, deg));
+            std::vector<uint32_t> m(32);
+            for (int k = 0; k < deg && k < 32; ++k) m[k] = (k == 0 ? 1 : ((xorshift(rng) % (uint32_t(2) << k)) | 1));
+            for (int k = deg; k < 32; ++k) {
+                uint32_t mk = m[k-deg] ^ (m[k-deg] << deg);
+                for (int j = 1; j < deg; ++j) {
+                    if ((poly >> (deg-j)) & 1) mk ^= m[k-j] << j;
+                }
+                m[k] = mk;
+            }
+            for (int k = 0; k < 32; ++k) v[k] = m[k] << (31-k);
+        }
+        state_[d] = xorshift(rng);
+    }
+}
+
+void SobolSequence::next(double *x) {
+    for (unsigned int d = 0; d < dim_; ++d) x[d] = (double(state_[d]) + 0.5) / 4294967296.0;
+    // Gray code order: flip the direction number of the lowest zero bit of the index
+    uint32_t c = 0;
+    for (uint32_t i = index_; i & 1; i >>= 1) ++c;
+    if (c >= 32) throw std::runtime_error("SobolSequence: too many points");
+    for (unsigned int d = 0; d < dim_; ++d) state_[d] ^= v_[32*d + c];
+    index_++;
+}
@@ -0,0 +1,124 @@
+#include "HiggsAnalysis/CombinedLimit/interface/SplitWorkspace.h"
+#include "HiggsAnalysis/CombinedLimit/interface/RooSimultaneousOpt.h"
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <regex>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#include <TDirectory.h>
+#include <TNamed.h>
+#include <TStopwatch.h>
+#include <RooWorkspace.h>
+#include <RooAbsPdf.h>
+#include <RooCategory.h>
+#include <RooAbsReal.h>
+#include <RooArgList.h>
+#include <RooGlobalFunc.h>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/classification.hpp>
+
+namespace {
+    std::vector<std::string> splitBy(const std::string &str, const char *separators) {
+        std::vector<std::string> ret;
+        boost::algorithm::split(ret, str, boost::algorithm::is_any_of(separators));
+        return ret;
+    }
+
+    /// the args of w with these comma separated names ("-" for none)
+    RooArgList argsByName(RooWorkspace &w, const std::string &names) {
+        RooArgList ret;
+        if (names == "-" || names.empty()) return ret;
+        for (const std::string &name : splitBy(names, ",")) {
+            RooAbsArg *arg = w.arg(name.c_str());
+            if (arg == 0) throw std::runtime_error("Missing "+name+" in the top workspace "+w.GetName());
+            ret.add(*arg);
+        }
+        return ret;
+    }
+
+    /// the list of channels (owned by the caller), or 0
+    TNamed * channelList(TDirectory &dir, const RooWorkspace &w) {
+        return dynamic_cast<TNamed *>(dir.Get((std::string(w.GetName())+"_channels").c_str()));
+    }
+}
+
+bool splitworkspace::isSplit(TDirectory &dir, const RooWorkspace &w)
+{
+    std::unique_ptr<TNamed> list(channelList(dir, w));
+    return list.get() != 0;
+}
+
+int splitworkspace::loadChannels(TDirectory &dir, RooWorkspace &w, const std::string &channels, int verbose)
+{
+    std::unique_ptr<TNamed> list(channelList(dir, w));
+    if (list.get() == 0) throw std::runtime_error(std::string("No list of channels for the workspace ")+w.GetName());
+    TStopwatch timer;
+    std::regex select(channels.empty() ? std::string(".*") : channels);
+    struct Model { std::string cat; std::map<std::string, int> bins; RooArgList constraints, masks; std::vector<std::pair<std::string,std::string> > pdfs; };
+    std::vector<std::string> order;
+    std::map<std::string, Model> models;
+    std::map<std::string, std::string> keys; // the workspace of each channel read
+    for (const std::string &line : splitBy(list->GetTitle(), "\n")) {
+        if (line.empty()) continue;
+        std::vector<std::string> items = splitBy(line, "\t");
+        if (items[0] == "model" && items.size() == 5) {
+            if (models.count(items[1])) throw std::runtime_error("Model "+items[1]+" listed twice");
+            Model &m = models[items[1]]; order.push_back(items[1]);
+            m.cat = items[2];
+            RooCategory *cat = w.cat(m.cat.c_str());
+            if (cat == 0) throw std::runtime_error("Missing index category "+m.cat+" of the model "+items[1]);
+            // the masks are in the order of the bins of the category, as the channels of CachingSimNLL
+            std::unique_ptr<RooCategory> catClone(static_cast<RooCategory *>(cat->Clone()));
+            for (int ib = 0, nb = catClone->numBins((const char *)0); ib < nb; ++ib) {
+                catClone->setBin(ib);
+                m.bins[catClone->getLabel()] = ib;
+            }
+            m.constraints.add(argsByName(w, items[3]));
+            m.masks.add(argsByName(w, items[4]));
+        } else if (items[0] == "pdf" && items.size() == 5) {
+            std::map<std::string, Model>::iterator m = models.find(items[1]);
+            if (m == models.end()) throw std::runtime_error("Pdf "+items[3]+" listed for the unknown model "+items[1]);
+            if (!std::regex_match(items[2], select)) continue;
+            // a channel masked from the start is never evaluated, so it's not worth reading
+            std::map<std::string, int>::const_iterator bin = m->second.bins.find(items[2]);
+            if (bin == m->second.bins.end()) throw std::runtime_error("Channel "+items[2]+" is not a state of "+m->second.cat);
+            if (bin->second < m->second.masks.getSize() && static_cast<RooAbsReal &>(*m->second.masks.at(bin->second)).getVal() != 0) continue;
+            m->second.pdfs.push_back(std::make_pair(items[2], items[3]));
+            keys[items[3]] = items[4];
+        } else {
+            throw std::runtime_error("Bad line in the list of channels: "+line);
+        }
+    }
+
+    // each channel workspace is read once, for the pdfs of all the models
+    std::map<std::string, std::vector<std::string> > pdfsOfKey;
+    for (const std::pair<const std::string, std::string> &pk : keys) pdfsOfKey[pk.second].push_back(pk.first);
+    for (const std::pair<const std::string, std::vector<std::string> > &kp : pdfsOfKey) {
+        std::unique_ptr<RooWorkspace> wc(dynamic_cast<RooWorkspace *>(dir.Get(kp.first.c_str())));
+        if (wc.get() == 0) throw std::runtime_error("Missing channel workspace "+kp.first);
+        for (const std::string &name : kp.second) {
+            RooAbsPdf *pdf = wc->pdf(name.c_str());
+            if (pdf == 0) throw std::runtime_error("Missing pdf "+name+" in "+kp.first);
+            // the parameters and the nodes shared among the channels are taken from the top workspace
+            w.import(*pdf, RooFit::RecycleConflictNodes(), RooFit::Silence());
+        }
+    }
+
+    int nchannels = 0;
+    for (const std::string &name : order) {
+        Model &m = models[name];
+        RooSimultaneousOpt sim(name.c_str(), name.c_str(), *w.cat(m.cat.c_str()));
+        for (const std::pair<std::string,std::string> &p : m.pdfs) sim.addPdf(*w.pdf(p.second.c_str()), p.first.c_str());
+        if (m.constraints.getSize()) sim.addExtraConstraints(m.constraints);
+        if (m.masks.getSize()) sim.addChannelMasks(m.masks);
+        w.import(sim, RooFit::RecycleConflictNodes(), RooFit::Silence());
+        nchannels = std::max<int>(nchannels, m.pdfs.size());
+    }
+    if (verbose > 0) {
+        std::cout << "Read " << pdfsOfKey.size() << " channel workspaces of " << w.GetName() << " for " << order.size() << " models, in "
+                  << timer.RealTime() << " s" << std::endl;
+    }
+    return nchannels;
+}
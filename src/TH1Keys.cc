@@ -4,6 +4,9 @@
 
 #include <stdexcept>
 #include <vector>
+#include <complex>
+#include <cmath>
+#include <algorithm>
 
 TH1Keys::TH1Keys() :
     x_(0),
@@ -157,7 +160,9 @@ void TH1Keys::Reset(Option_t *option) {
 
 void TH1Keys::FillH1() const
 {
-    if (dataset_->numEntries() == 0) {
+    if (dataset_->numEntries() > 0 && options_.Contains("F")) {
+        FillH1FFT();
+    } else if (dataset_->numEntries() == 0) {
         cache_->Reset(); // make sure it's empty
     } else {
         RooFit::MsgLevel gKill = RooMsgService::instance().globalKillBelow();
@@ -174,6 +179,126 @@ void TH1Keys::FillH1() const
     isCacheGood_ = true;
 }
 
+namespace {
+    /// in-place radix-2 FFT of a sequence with a power of two length (unnormalized inverse for sign = +1)
+    void fft(std::vector<std::complex<double> > &a, int sign) {
+        unsigned int n = a.size();
+        for (unsigned int i = 1, j = 0; i < n; ++i) {
+            unsigned int bit = n >> 1;
+            for (; j & bit; bit >>= 1) j ^= bit;
+            j ^= bit;
+            if (i < j) std::swap(a[i], a[j]);
+        }
+        for (unsigned int len = 2; len <= n; len <<= 1) {
+            std::complex<double> wlen(std::polar(1.0, sign * 2 * M_PI / len));
+            for (unsigned int i = 0; i < n; i += len) {
+                std::complex<double> w(1.0);
+                for (unsigned int j = 0; j < len/2; ++j) {
+                    std::complex<double> u = a[i+j], v = a[i+j+len/2] * w;
+                    a[i+j] = u + v; a[i+j+len/2] = u - v;
+                    w *= wlen;
+                }
+            }
+        }
+    }
+
+    unsigned int nextPow2(unsigned int n) { unsigned int p = 1; while (p < n) p <<= 1; return p; }
+
+    /// linear convolution of the bin contents with a gaussian of the given sigma (in bins), normalized to unit sum
+    void gaussConvolve(const std::vector<double> &data, double sigma, std::vector<double> &out) {
+        int n = data.size(), maxOff = std::min<int>(n-1, int(std::ceil(8*sigma)));
+        unsigned int len = nextPow2(n + 2*maxOff + 1);
+        std::vector<std::complex<double> > fdata(len), fkern(len);
+        for (int i = 0; i < n; ++i) fdata[i] = data[i];
+        double sum = 0;
+        for (int d = -maxOff; d <= maxOff; ++d) {
+            double k = std::exp(-0.5*(d/sigma)*(d/sigma));
+            fkern[(d + len) % len] = k; sum += k;
+        }
+        fft(fdata, -1); fft(fkern, -1);
+        for (unsigned int i = 0; i < len; ++i) fdata[i] *= fkern[i];
+        fft(fdata, +1);
+        out.resize(n);
+        for (int i = 0; i < n; ++i) out[i] = fdata[i].real()/(sum*len);
+    }
+}
+
+void TH1Keys::FillH1FFT() const
+{
+    // bandwidths as in the one-dimensional RooKeysPdf: h = (4/3)^(1/5) N^(-1/5) rho,
+    // sigma*h for the fixed kernels, and h sqrt(sigma)/(2 sqrt 3)/sqrt(f0(x)) for the adaptive ones, f0 being the fixed estimate
+    bool adaptive = options_.Contains("a"), mirror = options_.Contains("m");
+    double sumw = 0, sumx = 0, sumx2 = 0;
+    for (int i = 0, n = dataset_->numEntries(); i < n; ++i) {
+        double x = dataset_->get(i)->getRealValue("x"), w = dataset_->weight();
+        sumw += w; sumx += w*x; sumx2 += w*x*x;
+    }
+    double range = max_ - min_;
+    double h = std::pow(4./3., 0.2) * std::pow(double(dataset_->numEntries()), -0.2) * rho_;
+    double sigma = (sumw > 0 && sumx2/sumw > std::pow(sumx/sumw, 2) ? std::sqrt(sumx2/sumw - std::pow(sumx/sumw, 2)) : 0);
+    if (!(sigma > 0)) sigma = range / cache_->GetNbinsX();
+    double h0 = h * sigma;
+
+    // fine binning, with bins much smaller than the kernels, and with mirror copies on both sides if needed
+    unsigned int nfine = std::max(1024u, std::min(1u << 16, nextPow2((unsigned int) std::min(65536., std::max(16. * cache_->GetNbinsX(), 32 * range / h0)))));
+    double dx = range / nfine;
+    unsigned int offset = mirror ? nfine : 0, ngrid = mirror ? 3*nfine : nfine;
+    std::vector<double> fine(ngrid, 0.0);
+    for (int i = 0, n = dataset_->numEntries(); i < n; ++i) {
+        double x = dataset_->get(i)->getRealValue("x"), w = dataset_->weight();
+        unsigned int bin = std::min<unsigned int>(nfine-1, (unsigned int)((x - min_)/dx));
+        fine[offset + bin] += w;
+        if (mirror) { fine[offset - 1 - bin] += w; fine[offset + 2*nfine - 1 - bin] += w; }
+    }
+
+    std::vector<double> density;
+    gaussConvolve(fine, h0/dx, density);
+    if (adaptive) {
+        // local bandwidth of each occupied fine bin, from the fixed kernel estimate
+        std::vector<double> hbin(ngrid, 0.0);
+        double hmin = 0, hmax = 0, norm = h * std::sqrt(sigma) / (2 * std::sqrt(3.));
+        for (unsigned int j = 0; j < ngrid; ++j) {
+            if (fine[j] == 0) continue;
+            double f0 = density[j] / (dx * sumw);
+            hbin[j] = (f0 > 0 ? norm / std::sqrt(f0) : h0) / dx;
+            if (hmin == 0 || hbin[j] < hmin) hmin = hbin[j];
+            hmax = std::max(hmax, hbin[j]);
+        }
+        // convolve separately each group of bins with similar bandwidths (within 5%, at most 64 groups)
+        double ratio = std::max(1.05, std::pow(hmax/hmin, 1./63));
+        unsigned int ngroups = 1 + (unsigned int)(std::log(hmax/hmin)/std::log(ratio) + 0.5);
+        std::vector<std::vector<double> > groups(ngroups, std::vector<double>());
+        for (unsigned int j = 0; j < ngrid; ++j) {
+            if (fine[j] == 0) continue;
+            unsigned int k = std::min(ngroups-1, (unsigned int)(std::log(hbin[j]/hmin)/std::log(ratio) + 0.5));
+            if (groups[k].empty()) groups[k].resize(ngrid, 0.0);
+            groups[k][j] = fine[j];
+        }
+        density.assign(ngrid, 0.0);
+        std::vector<double> conv;
+        for (unsigned int k = 0; k < ngroups; ++k) {
+            if (groups[k].empty()) continue;
+            gaussConvolve(groups[k], hmin * std::pow(ratio, double(k)), conv);
+            for (unsigned int j = 0; j < ngrid; ++j) density[j] += conv[j];
+        }
+    }
+
+    // rebin the fine estimate within [min, max] to the target binning
+    cache_->Reset();
+    for (unsigned int j = 0; j < nfine; ++j) {
+        int bin = cache_->FindFixBin(min_ + (j + 0.5) * dx);
+        cache_->SetBinContent(bin, cache_->GetBinContent(bin) + density[offset + j]);
+    }
+    // like RooNDKeysPdf::createHistogram, the values are densities at the bin
+    for (int b = 1, nb = cache_->GetNbinsX(); b <= nb; ++b) {
+        cache_->SetBinContent(b, cache_->GetBinContent(b) / cache_->GetBinWidth(b));
+    }
+    if (cache_->Integral()) cache_->Scale(1.0/cache_->Integral());
+    cache_->Scale(dataset_->sumEntries() * globalScale_);
+    cache_->SetBinContent(0,                     underflow_ * globalScale_);
+    cache_->SetBinContent(cache_->GetNbinsX()+1, overflow_  * globalScale_);
+}
+
 void TH1Keys::dont(const char *msg) const {
     TObject::Error("TH1Keys",msg);
     throw std::runtime_error(std::string("Error in TH1Keys: ")+msg);
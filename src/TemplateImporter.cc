@@ -0,0 +1,38 @@
+#include "HiggsAnalysis/CombinedLimit/interface/TemplateImporter.h"
+#include <TH1F.h>
+#include <TString.h>
+#include <algorithm>
+#include <stdexcept>
+
+TH1 *TemplateImporter::rebin(const TH1 &shape, int nbins, const char *name) 
+{
+    TH1F *ret = new TH1F(name, "", nbins, 0.0, double(nbins));
+    ret->SetDirectory(0);
+    for (int i = 1, n = std::min(shape.GetNbinsX(), nbins); i <= n; ++i) {
+        ret->SetBinContent(i, shape.GetBinContent(i));
+    }
+    return ret;
+}
+
+TList *TemplateImporter::rebinAll(const TList &shapes, int nbins) 
+{
+    TList *ret = new TList();
+    TIter next(&shapes);
+    for (TObject *obj = next(); obj != 0; obj = next()) {
+        const TH1 *shape = dynamic_cast<const TH1 *>(obj);
+        if (shape == 0) { delete ret; throw std::invalid_argument(std::string("TemplateImporter: ")+obj->GetName()+" is not a TH1"); }
+        ret->Add(rebin(*shape, nbins, TString(shape->GetName())+"_rebin"));
+    }
+    return ret;
+}
+
+int TemplateImporter::maxBins(const TList &shapes) 
+{
+    int ret = 0;
+    TIter next(&shapes);
+    for (TObject *obj = next(); obj != 0; obj = next()) {
+        const TH1 *shape = dynamic_cast<const TH1 *>(obj);
+        if (shape) ret = std::max(ret, shape->GetNbinsX());
+    }
+    return ret;
+}
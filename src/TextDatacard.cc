@@ -0,0 +1,588 @@
+#include "HiggsAnalysis/CombinedLimit/interface/TextDatacard.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <stdint.h>
+#include <algorithm>
+#include <limits>
+#include <iostream>
+#include <stdexcept>
+#include <regex>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace {
+    /// a word of a line, in the mapped file; zero if it's made only of dashes in a line of systematics
+    struct Word { const char *begin, *end; bool zero; };
+
+    inline bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v'; }
+
+    /// the words of [begin, end), as str.split() in python
+    void splitWords(const char *begin, const char *end, std::vector<Word> &words) {
+        words.clear();
+        for (const char *p = begin; ; ) {
+            while (p != end && isSpace(*p)) ++p;
+            if (p == end) return;
+            Word w; w.begin = p; w.zero = false;
+            while (p != end && !isSpace(*p)) ++p;
+            w.end = p;
+            words.push_back(w);
+        }
+    }
+
+    /// the words of a line of systematics: up to the first '#', and with the words made only of dashes read as 0
+    /// (what the two re.sub of parseCard do)
+    void splitBody(const char *begin, const char *end, std::vector<Word> &words) {
+        const char *hash = static_cast<const char *>(memchr(begin, '#', end - begin));
+        splitWords(begin, hash ? hash : end, words);
+        for (unsigned int i = 1, n = words.size(); i < n; ++i) {
+            const char *p = words[i].begin;
+            while (p != words[i].end && *p == '-') ++p;
+            words[i].zero = (p == words[i].end);
+        }
+    }
+
+    inline std::string str(const Word &w) { return w.zero ? std::string("0") : std::string(w.begin, w.end); }
+
+    /// the exact powers of ten of a double
+    const double kPowersOfTen[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+    /// float() of python: the whole word must be a decimal number, inf or nan
+    double toFloat(const char *begin, const char *end) {
+        // the usual [-]ddd.ddd with at most 15 digits: the integer of the digits and the power of ten are exact
+        // doubles, so their ratio is the correctly rounded value that strtod would give
+        const char *p = begin;
+        bool negative = (p != end && *p == '-');
+        if (p != end && (*p == '-' || *p == '+')) ++p;
+        uint64_t digits = 0;
+        int ndigits = 0, decimals = -1;
+        for (; p != end; ++p) {
+            if (*p >= '0' && *p <= '9') { digits = digits * 10 + (*p - '0'); ++ndigits; if (decimals >= 0) ++decimals; }
+            else if (*p == '.' && decimals < 0) decimals = 0;
+            else break;
+        }
+        if (p == end && ndigits > 0 && ndigits <= 15) {
+            double ret = decimals > 0 ? double(digits) / kPowersOfTen[decimals] : double(digits);
+            return negative ? -ret : ret;
+        }
+        char buff[64];
+        std::size_t n = end - begin;
+        std::string big;
+        const char *s;
+        if (n < sizeof(buff)) { memcpy(buff, begin, n); buff[n] = '\0'; s = buff; } else { big.assign(begin, end); s = big.c_str(); }
+        char *stop;
+        double ret = n ? strtod(s, &stop) : 0;
+        if (n == 0 || stop != s + n || strpbrk(s, "xX") != 0) throw std::runtime_error("could not convert string to float: "+std::string(begin, end));
+        return ret;
+    }
+    inline double toFloat(const Word &w) { return w.zero ? 0 : toFloat(w.begin, w.end); }
+    inline double toFloat(const std::string &s) { return toFloat(s.data(), s.data() + s.size()); }
+
+    /// int() of python
+    long toInt(const std::string &s) {
+        char *stop;
+        errno = 0;
+        long ret = s.empty() ? 0 : strtol(s.c_str(), &stop, 10);
+        if (s.empty() || *stop != '\0' || errno != 0) throw std::runtime_error("invalid literal for int() with base 10: '"+s+"'");
+        return ret;
+    }
+
+    /// re.match(r"-?[0-9]+", s)
+    bool startsWithInt(const std::string &s) {
+        std::size_t i = (!s.empty() && s[0] == '-') ? 1 : 0;
+        return i < s.size() && s[i] >= '0' && s[i] <= '9';
+    }
+    inline bool startsWithDigit(const std::string &s) { return !s.empty() && s[0] >= '0' && s[0] <= '9'; }
+
+    const Word & at(const std::vector<Word> &words, unsigned int i) {
+        if (i >= words.size()) throw std::runtime_error("list index out of range");
+        return words[i];
+    }
+
+    std::string join(const std::vector<std::string> &words, const char *sep) {
+        std::string ret;
+        for (unsigned int i = 0, n = words.size(); i < n; ++i) { if (i) ret += sep; ret += words[i]; }
+        return ret;
+    }
+
+    /// the repr of a python list of strings, for the error messages
+    std::string listRepr(const std::vector<std::string> &words) {
+        std::string ret = "[";
+        for (unsigned int i = 0, n = words.size(); i < n; ++i) { if (i) ret += ", "; ret += "'" + words[i] + "'"; }
+        return ret + "]";
+    }
+
+    int indexOf(const std::vector<std::string> &v, const std::string &s) {
+        std::vector<std::string>::const_iterator it = std::find(v.begin(), v.end(), s);
+        return it == v.end() ? -1 : int(it - v.begin());
+    }
+
+    bool isRegularPdf(const std::string &pdf) {
+        return pdf == "lnN" || pdf == "lnU" || pdf == "gmM" || pdf == "trG" || pdf.compare(0, 5, "shape") == 0 ||
+               pdf == "gmN" || pdf == "unif" || pdf == "dFD" || pdf == "dFD2";
+    }
+}
+
+TextDatacard::TextDatacard(const std::string &fileName, const std::vector<std::string> &excludePatterns, bool stat, bool noJMax, bool allowNoSignal, bool allowNoBackground) :
+    fileName_(fileName),
+    data_(0), size_(0),
+    ratesChanged_(false),
+    declared_(-1)
+{
+    for (const std::string &p : excludePatterns) {
+        try { std::regex check(p); } catch (std::regex_error &) { throw std::runtime_error("TextDatacard: invalid exclusion pattern "+p); }
+    }
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd == -1) throw std::runtime_error("TextDatacard: can't open "+fileName);
+    struct stat st;
+    if (fstat(fd, &st) == -1) { ::close(fd); throw std::runtime_error("TextDatacard: can't stat "+fileName); }
+    size_ = st.st_size;
+    void *map = size_ ? mmap(0, size_, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (size_ && map == MAP_FAILED) throw std::runtime_error("TextDatacard: can't map "+fileName);
+    data_ = size_ ? static_cast<const char *>(map) : 0;
+    // the rows are read sequentially, and then again in the same order by the users
+    if (size_) madvise(map, size_, MADV_SEQUENTIAL);
+
+    std::size_t pos = 0;
+    unsigned int line = 0;
+    try {
+        readHeader_(pos, line, noJMax, allowNoSignal);
+        readBody_(pos, line, excludePatterns, stat);
+    } catch (std::runtime_error &e) {
+        if (data_) munmap(const_cast<char *>(data_), size_);
+        data_ = 0;
+        char buff[64];
+        snprintf(buff, sizeof(buff), "Error reading line %u", line + 1);
+        throw std::runtime_error(std::string(buff) + " of file " + fileName + ": " + e.what());
+    }
+
+    try {
+        // check if there are bins with no rate
+        for (unsigned int b = 0, nb = bins_.size(); b < nb; ++b) {
+            unsigned int np = 0, ns = 0;
+            for (unsigned int i = 0, n = columns(); i < n; ++i) {
+                if (colBin_[i] != b || rates_[i] == 0) continue;
+                ++np; if (colSignal_[i]) ++ns;
+            }
+            if (np == 0) throw std::runtime_error("Bin "+bins_[b]+" has no processes contributing to it");
+            if (ns == 0 && !allowNoSignal) std::cerr << "Warning: Bin " << bins_[b] << " has no signal processes contributing to it" << std::endl;
+            if (np == ns && !allowNoBackground) throw std::runtime_error("Bin "+bins_[b]+" has no background processes contributing to it");
+        }
+    } catch (std::runtime_error &e) {
+        if (data_) munmap(const_cast<char *>(data_), size_);
+        data_ = 0;
+        throw;
+    }
+}
+
+TextDatacard::~TextDatacard()
+{
+    if (data_) munmap(const_cast<char *>(data_), size_);
+}
+
+bool TextDatacard::isSignal(const std::string &process) const
+{
+    int p = indexOf(processes_, process);
+    return p != -1 && signal_[p] == 1;
+}
+
+void TextDatacard::readHeader_(std::size_t &pos, unsigned int &line, bool noJMax, bool allowNoSignal)
+{
+    int nbins = -1, nprocesses = -1;
+    std::vector<std::string> binline, processline, sigline;
+    std::vector<double> obs;
+    bool shapesUseBin = false;
+    std::vector<Word> f;
+    for (; pos < size_; ++line) {
+        const char *begin = data_ + pos, *nl = static_cast<const char *>(memchr(begin, '\n', size_ - pos));
+        const char *end = nl ? nl : data_ + size_;
+        pos = (end - data_) + (nl ? 1 : 0);
+        splitWords(begin, end, f);
+        if (f.empty()) continue;
+        std::string key = str(f[0]);
+        if (key == "imax") {
+            std::string v = str(at(f, 1));
+            nbins = v != "*" ? toInt(v) : -1;
+        } else if (key == "jmax") {
+            std::string v = str(at(f, 1));
+            nprocesses = v != "*" ? toInt(v) + 1 : -1;
+        } else if (key == "kmax") {
+            std::string v = str(at(f, 1));
+            declared_ = v != "*" ? toInt(v) : -1;
+        } else if (key == "shapes") {
+            if (f.size() < 4) throw std::runtime_error("Malformed shapes line");
+            std::vector<std::string> shape;
+            for (unsigned int i = 1, n = f.size(); i < n; ++i) shape.push_back(str(f[i]));
+            for (const std::vector<std::string> &other : shapes_) {
+                if (other[0] == shape[0] && other[1] == shape[1]) throw std::runtime_error("Duplicate definition for process '"+shape[0]+"', channel '"+shape[1]+"'");
+            }
+            shapes_.push_back(shape);
+            if (std::string(begin, end).find("$CHANNEL") != std::string::npos || shape[1] != "*") shapesUseBin = true;
+        } else if (key == "Observation" || key == "observation") {
+            obs.clear();
+            for (unsigned int i = 1, n = f.size(); i < n; ++i) obs.push_back(toFloat(f[i]));
+            if (nbins == -1) nbins = obs.size();
+            char buff[128];
+            if (int(obs.size()) != nbins) {
+                snprintf(buff, sizeof(buff), "Found %u observations but %d bins have been declared", unsigned(obs.size()), nbins);
+                throw std::runtime_error(buff);
+            }
+            if (!binline.empty()) {
+                if (binline.size() != obs.size()) {
+                    snprintf(buff, sizeof(buff), "Found %u bins (", unsigned(bins_.size()));
+                    std::string msg = buff + listRepr(bins_);
+                    snprintf(buff, sizeof(buff), ") but %d bins have been declared", nbins);
+                    throw std::runtime_error(msg + buff);
+                }
+                bins_ = binline;
+                obs_ = obs; obs.clear();
+                binline.clear();
+            }
+        } else if (key == "bin") {
+            binline.clear();
+            for (unsigned int i = 1, n = f.size(); i < n; ++i) {
+                std::string b = str(f[i]);
+                if (startsWithDigit(b)) {
+                    if (shapesUseBin) std::cerr << "Warning: Bin " << b << " starts with a digit. Will call it 'bin" << b << "' but this may break shapes." << std::endl;
+                    b = "bin" + b;
+                }
+                binline.push_back(b);
+            }
+        } else if (key == "process") {
+            if (processline.empty()) { // first line contains names
+                for (unsigned int i = 1, n = f.size(); i < n; ++i) processline.push_back(str(f[i]));
+                if (binline.size() != processline.size()) throw std::runtime_error("'bin' line has a different length than 'process' line.");
+                continue;
+            }
+            sigline.clear();
+            for (unsigned int i = 1, n = f.size(); i < n; ++i) sigline.push_back(str(f[i]));
+            if (!processline.empty() && !sigline.empty() && startsWithInt(processline[0]) && !startsWithInt(sigline[0])) std::swap(processline, sigline);
+            if (sigline.size() != processline.size()) throw std::runtime_error("'bin' line has a different length than 'process' line.");
+            bool hadBins = !bins_.empty();
+            for (unsigned int i = 0, n = binline.size(); i < n; ++i) {
+                const std::string &b = binline[i], &p = processline[i];
+                int ib = indexOf(bins_, b);
+                if (ib == -1) {
+                    if (hadBins) throw std::runtime_error("Bin "+b+" not among the declared bins "+listRepr(bins_));
+                    ib = bins_.size(); bins_.push_back(b);
+                }
+                int ip = indexOf(processes_, p);
+                if (ip == -1) { ip = processes_.size(); processes_.push_back(p); }
+                colBin_.push_back(ib);
+                colProcess_.push_back(ip);
+                colSignal_.push_back(toInt(sigline[i]) <= 0); // <=0 for signals, >0 for backgrounds
+            }
+            if (nprocesses == -1) nprocesses = processes_.size();
+            if (nbins == -1) nbins = bins_.size();
+            char buff[64], buff2[64];
+            if (!noJMax && nprocesses != int(processes_.size())) {
+                snprintf(buff, sizeof(buff), "Found %u processes (", unsigned(processes_.size()));
+                snprintf(buff2, sizeof(buff2), "), declared jmax = %d", nprocesses);
+                throw std::runtime_error(buff + listRepr(processes_) + buff2);
+            }
+            if (nbins != int(bins_.size())) {
+                snprintf(buff, sizeof(buff), "Found %u bins (", unsigned(bins_.size()));
+                snprintf(buff2, sizeof(buff2), "), declared imax = %d", nbins);
+                throw std::runtime_error(buff + listRepr(bins_) + buff2);
+            }
+            // still as list, must change into map with bin names
+            if (!obs.empty()) {
+                if (obs.size() < bins_.size()) throw std::runtime_error("list index out of range");
+                obs.resize(bins_.size());
+                obs_ = obs; obs.clear();
+            }
+            signal_.assign(processes_.size(), -1);
+            for (unsigned int i = 0, n = columns(); i < n; ++i) {
+                int &s = signal_[colProcess_[i]];
+                if (s == -1) s = colSignal_[i];
+                else if (s != colSignal_[i]) throw std::runtime_error("Process "+processes_[colProcess_[i]]+" is declared as signal in some bin and as background in some other bin");
+            }
+            if (std::find(signal_.begin(), signal_.end(), 1) == signal_.end() && !allowNoSignal) throw std::runtime_error("You must have at least one signal process (id <= 0)");
+        } else if (key == "rate") {
+            if (processline.empty()) throw std::runtime_error("Missing line with process names before rate line");
+            if (sigline.empty()) throw std::runtime_error("Missing line with process id before rate line");
+            if (f.size() - 1 != columns()) {
+                char buff[128];
+                snprintf(buff, sizeof(buff), "Malformed rate line: length %u, while bins and process lines have length %u", unsigned(f.size() - 1), columns());
+                throw std::runtime_error(buff);
+            }
+            rates_.resize(columns());
+            for (unsigned int i = 0, n = columns(); i < n; ++i) rates_[i] = toFloat(f[i + 1]);
+            ++line;
+            return; // rate is the last line before nuisances
+        }
+    }
+}
+
+void TextDatacard::readBody_(std::size_t pos, unsigned int line, const std::vector<std::string> &excludePatterns, bool stat)
+{
+    std::vector<std::regex> vetos;
+    for (const std::string &p : excludePatterns) if (!p.empty()) vetos.push_back(std::regex(p));
+    std::vector<Word> f;
+    std::vector<double> lo, hi;
+    // the last row that changed the rates: the rows before it may have an effect that wasn't there when they were read
+    int lastChange = -1;
+    for (; pos < size_; ++line) {
+        const char *begin = data_ + pos, *nl = static_cast<const char *>(memchr(begin, '\n', size_ - pos));
+        const char *end = nl ? nl : data_ + size_;
+        pos = (end - data_) + (nl ? 1 : 0);
+        if (end - begin >= 2 && begin[0] == '-' && begin[1] == '-') continue;
+        splitBody(begin, end, f);
+        if (f.size() <= 1) continue;
+        std::string lsyst = str(f[0]), pdf = str(f[1]);
+        bool nofloat = false;
+        const std::string tag = "[nofloat]";
+        if (lsyst.size() >= tag.size() && lsyst.compare(lsyst.size() - tag.size(), tag.size(), tag) == 0) {
+            for (std::size_t at; (at = lsyst.find(tag)) != std::string::npos; ) lsyst.erase(at, tag.size());
+            nofloat = true;
+        }
+        bool vetoed = false;
+        for (const std::regex &veto : vetos) {
+            if (std::regex_search(lsyst, veto, std::regex_constants::match_continuous)) { vetoed = true; break; }
+        }
+        if (vetoed) {
+            if (declared_ != -1) --declared_;
+            continue;
+        }
+        std::string written = lsyst;
+        if (startsWithDigit(lsyst)) lsyst = "theta" + lsyst;
+        if (isRegularPdf(pdf)) {
+            Row row;
+            row.name = lsyst; row.written = written; row.pdf = pdf;
+            row.nofloat = nofloat; row.line = line;
+            unsigned int first = 2;
+            if (pdf == "gmN") {
+                row.args.push_back(str(at(f, 2))); toInt(row.args.back());
+                first = 3;
+            } else if (pdf == "unif") {
+                row.args.push_back(str(at(f, 2))); toFloat(row.args.back());
+                row.args.push_back(str(at(f, 3))); toFloat(row.args.back());
+                first = 4;
+            } else if (pdf == "dFD" || pdf == "dFD2") {
+                row.args.push_back(str(at(f, 2))); toFloat(row.args.back());
+                first = 3;
+            }
+            if (f.size() < first + columns()) {
+                char buff[256];
+                snprintf(buff, sizeof(buff), "Malformed systematics line %s of length %u: while bins and process lines have length %u", lsyst.c_str(), unsigned(f.size() > first ? f.size() - first : 0), columns());
+                throw std::runtime_error(buff);
+            }
+            row.begin = first < f.size() ? f[first].begin - data_ : end - data_;
+            const char *hash = static_cast<const char *>(memchr(begin, '#', end - begin));
+            row.end = (hash ? hash : end) - data_;
+            parseValues_(row, lo, hi);
+            row.asymmetric = false;
+            for (unsigned int i = 0, n = columns(); i < n; ++i) {
+                if (!std::isnan(hi[i])) row.asymmetric = true;
+                // set the rate to epsilon for backgrounds with zero observed sideband events
+                if (pdf == "gmN" && rates_[i] == 0 && lo[i] != 0) { rates_[i] = 1e-6; ratesChanged_ = true; lastChange = rows_.size(); }
+            }
+            row.hasEffect = hasEffect_(row, lo, hi);
+            rows_.push_back(row);
+        } else if (pdf == "param") {
+            // for parametric uncertainties, there's no line to account per bin/process effects
+            std::vector<std::string> args;
+            for (unsigned int i = 2, n = f.size(); i < n; ++i) args.push_back(str(f[i]));
+            if (args.size() <= 1) throw std::runtime_error("Uncertainties of type 'param' must have at least two arguments (mean and sigma)");
+            params_.push_back(std::make_pair(lsyst, args));
+        } else if (pdf == "flatParam") {
+            if (indexOf(flatParams_, lsyst) == -1) flatParams_.push_back(lsyst);
+        } else if (pdf == "extArg") {
+            // look for additional parameters in workspaces
+            std::vector<std::string> tokens;
+            for (const Word &w : f) tokens.push_back(str(w));
+            unsigned int i = 0;
+            while (i < extArgs_.size() && extArgs_[i].first != lsyst) ++i;
+            if (i == extArgs_.size()) extArgs_.push_back(std::make_pair(lsyst, tokens));
+            else extArgs_[i].second = tokens;
+        } else if (pdf == "rateParam") {
+            at(f, 3);
+            std::vector<std::string> tokens;
+            for (const Word &w : f) tokens.push_back(str(w));
+            const std::string binPattern = tokens[2], procPattern = tokens[3];
+            if (procPattern.find('*') != std::string::npos || binPattern.find('*') != std::string::npos) { // all channels/processes
+                for (const std::string &c : processes_) {
+                    for (const std::string &b : bins_) {
+                        if (fnmatch(procPattern.c_str(), c.c_str(), 0) != 0) continue;
+                        if (fnmatch(binPattern.c_str(), b.c_str(), 0) != 0) continue;
+                        tokens[2] = b; tokens[3] = c;
+                        addRateParam_(lsyst, tokens);
+                    }
+                }
+            } else {
+                addRateParam_(lsyst, tokens);
+            }
+        } else if (pdf == "discrete") {
+            discretes_.push_back(lsyst);
+        } else if (pdf == "edit") {
+            declared_ = -1;
+            std::vector<std::string> numbers;
+            for (unsigned int i = 2, n = f.size(); i < n; ++i) numbers.push_back(str(f[i]));
+            if (numbers.empty() || (numbers[0] != "changepdf" && numbers[0] != "freeze" && numbers.size() < 3)) throw std::runtime_error("list index out of range");
+            edits_.push_back(numbers);
+        } else if (pdf == "group") {
+            // not really a pdf type, but a way to be able to name groups of nuisances together
+            if (f.size() == 2) throw std::runtime_error("Syntax error for group '"+lsyst+"': empty line after 'group'.");
+            std::string defTok = str(f[2]);
+            if (defTok != "=" && defTok != "+=") throw std::runtime_error("Syntax error for group '"+lsyst+"': first thing after 'group' is not '[+]=' but '"+defTok+"'.");
+            std::vector<std::string> nuisances;
+            for (unsigned int i = 3, n = f.size(); i < n; ++i) if (indexOf(nuisances, str(f[i])) == -1) nuisances.push_back(str(f[i]));
+            unsigned int g = 0;
+            while (g < groups_.size() && groups_[g].first != lsyst) ++g;
+            if (g == groups_.size()) {
+                if (defTok != "=") throw std::runtime_error("Cannot append to group '"+lsyst+"' as it was not yet defined.");
+                groups_.push_back(std::make_pair(lsyst, nuisances));
+            } else {
+                if (defTok != "+=") throw std::runtime_error("Will not redefine group '"+lsyst+"'. It previously contained 'set("+listRepr(groups_[g].second)+")' and you now wanted it to contain '"+listRepr(nuisances)+"'.");
+                for (const std::string &n : nuisances) if (indexOf(groups_[g].second, n) == -1) groups_[g].second.push_back(n);
+            }
+        } else {
+            throw std::runtime_error("Unsupported pdf "+pdf);
+        }
+    }
+    // the rates only go from 0 to 1e-6, so only the rows that had no effect need to be checked again
+    for (int r = 0; r < lastChange; ++r) {
+        if (rows_[r].hasEffect) continue;
+        parseValues_(rows_[r], lo, hi);
+        rows_[r].hasEffect = hasEffect_(rows_[r], lo, hi);
+    }
+    // cleanup systematics that have no effect to avoid zero derivatives
+    for (const Row &row : rows_) {
+        if (!row.hasEffect && declared_ != -1) --declared_;
+    }
+    // remove them if asked to
+    if (stat) {
+        declared_ = 0;
+        rows_.clear();
+        params_.clear();
+    }
+}
+
+void TextDatacard::addRateParam_(const std::string &name, const std::vector<std::string> &f)
+{
+    if (f.size() > 6 || f.size() < 5) throw std::runtime_error("Error, directives of type 'rateParam' should be of form .. name rateParam channel process initial value OR name rateParam channel process formula args");
+    RateParam rp;
+    rp.name = name; rp.bin = f[2]; rp.process = f[3];
+    rp.values.push_back(f[4]);
+    if (f.size() == 6) {
+        // a range, or the arguments of the formula
+        if (f[5].find('[') != std::string::npos && f[5].find(']') != std::string::npos) rp.range = f[5];
+        else rp.values.push_back(f[5]);
+    }
+    // check for malformed bin/process
+    if (indexOf(bins_, f[2]) == -1 || indexOf(processes_, f[3]) == -1) throw std::runtime_error(" No such channel/process '"+f[2]+"/"+f[3]+"', malformed line:\n   "+join(f, " "));
+    rateParams_.push_back(rp);
+}
+
+void TextDatacard::parseValues_(const Row &row, std::vector<double> &lo, std::vector<double> &hi) const
+{
+    unsigned int n = columns();
+    lo.resize(n); hi.assign(n, std::numeric_limits<double>::quiet_NaN());
+    bool logNormal = (row.pdf == "lnN" || row.pdf == "lnU" || row.pdf.find('?') != std::string::npos);
+    bool positive = (row.pdf != "trG" && row.pdf != "dFD" && row.pdf != "dFD2");
+    const char *p = data_ + row.begin, *end = data_ + row.end;
+    for (unsigned int i = 0; i < n; ++i) {
+        while (p != end && isSpace(*p)) ++p;
+        const char *w = p;
+        while (p != end && !isSpace(*p)) ++p;
+        if (w == p) throw std::runtime_error("Malformed systematics line "+row.name);
+        const char *d = w;
+        while (d != p && *d == '-') ++d;
+        if (d == p) { lo[i] = 0; continue; } // "-"
+        const char *slash = static_cast<const char *>(memchr(w, '/', p - w));
+        if (slash != 0) { // "number/number"
+            if (!logNormal) throw std::runtime_error("Asymmetric errors are allowed only for Log-normals");
+            const char *next = static_cast<const char *>(memchr(slash + 1, '/', p - slash - 1));
+            lo[i] = toFloat(w, slash);
+            hi[i] = toFloat(slash + 1, next ? next : p);
+            bool bad = lo[i] <= 0 || hi[i] <= 0;
+            for (const char *q = next; q != 0 && !bad; ) {
+                const char *r = static_cast<const char *>(memchr(q + 1, '/', p - q - 1));
+                bad = toFloat(q + 1, r ? r : p) <= 0;
+                q = r;
+            }
+            if (bad) throw std::runtime_error("Found \""+std::string(w, p)+"\" in the nuisances affecting "+columnProcess(i)+" for "+columnBin(i)+". This would lead to NANs later on, so please fix it.");
+        } else {
+            lo[i] = toFloat(w, p);
+            // values of 0.0 are treated as 1.0; scrap negative values
+            if (positive && lo[i] < 0) throw std::runtime_error("Found \""+std::string(w, p)+"\" in the nuisances affecting "+columnProcess(i)+" in "+columnBin(i)+". This would lead to NANs later on, so please fix it.");
+        }
+    }
+}
+
+bool TextDatacard::hasEffect_(const Row &row, const std::vector<double> &lo, const std::vector<double> &hi) const
+{
+    bool lnN = (row.pdf == "lnN");
+    for (unsigned int i = 0, n = columns(); i < n; ++i) {
+        if (rates_[i] == 0) continue;
+        if (!std::isnan(hi[i])) return true;
+        if (lo[i] != 0 && !(lnN && lo[i] == 1)) return true;
+    }
+    return false;
+}
+
+int TextDatacard::rowAtLine(unsigned int line) const
+{
+    unsigned int lo = 0, hi = rows_.size();
+    while (lo < hi) {
+        unsigned int mid = (lo + hi) / 2;
+        if (rows_[mid].line < line) lo = mid + 1; else hi = mid;
+    }
+    return lo < rows_.size() && rows_[lo].line == line ? int(lo) : -1;
+}
+
+void TextDatacard::readRow(unsigned int r, std::vector<double> &lo, std::vector<double> &hi) const
+{
+    parseValues_(rows_[r], lo, hi);
+}
+
+std::string TextDatacard::rowText(unsigned int r, bool high) const
+{
+    // the words as they are, which were checked to be valid numbers for python when the card was read
+    const Row &row = rows_[r];
+    std::string ret;
+    ret.reserve(row.end - row.begin);
+    const char *p = data_ + row.begin, *end = data_ + row.end;
+    for (unsigned int i = 0, n = columns(); i < n; ++i) {
+        while (p != end && isSpace(*p)) ++p;
+        const char *w = p;
+        while (p != end && !isSpace(*p)) ++p;
+        const char *d = w;
+        while (d != p && *d == '-') ++d;
+        const char *slash = d == p ? 0 : static_cast<const char *>(memchr(w, '/', p - w));
+        if (high) {
+            if (slash == 0) continue;
+            const char *next = static_cast<const char *>(memchr(slash + 1, '/', p - slash - 1));
+            if (!ret.empty()) ret += ' ';
+            ret += std::to_string(i);
+            ret += ' ';
+            ret.append(slash + 1, next ? next : p);
+        } else {
+            if (i) ret += ' ';
+            if (d == p) ret += '0';
+            else ret.append(w, slash ? slash : p);
+        }
+    }
+    return ret;
+}
+
+unsigned int TextDatacard::nuisances() const
+{
+    unsigned int ret = params_.size();
+    for (const Row &row : rows_) if (row.hasEffect) ++ret;
+    return ret;
+}
+
+void TextDatacard::checkNuisances() const
+{
+    if (declared_ == -1 || int(nuisances()) == declared_) return;
+    char buff[128];
+    snprintf(buff, sizeof(buff), "Found %u systematics, expected %d", nuisances(), declared_);
+    throw std::runtime_error(buff);
+}
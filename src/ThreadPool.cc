@@ -0,0 +1,287 @@
+#include "HiggsAnalysis/CombinedLimit/interface/ThreadPool.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <sched.h>
+#include <sstream>
+#include <string>
+
+namespace {
+    // number of jobs the current thread is executing (more than one if nested), for inJob()
+    __thread unsigned int threadPoolDepth_ = 0;
+    // NUMA node of the core the current thread is pinned to, or -1
+    __thread int threadPoolNode_ = -1;
+
+    // the pool of global() and the number of threads of --threads
+    std::mutex globalMutex_;
+    ThreadPool *globalPool_ = 0;
+    unsigned int globalThreads_ = 0;
+    // the process that set --threads: its forked children don't get threads of their own, so that they stay within the budget
+    pid_t globalPid_ = 0;
+    bool globalPin_ = false;
+
+    /// the cores in the affinity mask of the process, as (NUMA node, core), ordered by node; all in node 0 if the
+    /// topology isn't in /sys
+    std::vector<std::pair<int,int> > allowedCores() {
+        std::vector<std::pair<int,int> > ret;
+        cpu_set_t allowed;
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return ret;
+        std::vector<int> nodeOf(CPU_SETSIZE, 0);
+        if (DIR *dir = opendir("/sys/devices/system/node")) {
+            while (struct dirent *entry = readdir(dir)) {
+                int node;
+                if (sscanf(entry->d_name, "node%d", &node) != 1) continue;
+                std::string path = std::string("/sys/devices/system/node/") + entry->d_name + "/cpulist";
+                char list[4096];
+                FILE *f = fopen(path.c_str(), "r");
+                if (f == 0) continue;
+                if (fgets(list, sizeof(list), f) != 0) {
+                    // e.g. "0-31,64-95"
+                    std::istringstream ranges(list);
+                    std::string tok;
+                    while (std::getline(ranges, tok, ',')) {
+                        int first, last;
+                        int n = sscanf(tok.c_str(), "%d-%d", &first, &last);
+                        if (n < 1) continue;
+                        if (n == 1) last = first;
+                        for (int c = first; c <= last && c < CPU_SETSIZE; ++c) if (c >= 0) nodeOf[c] = node;
+                    }
+                }
+                fclose(f);
+            }
+            closedir(dir);
+        }
+        for (int c = 0; c < CPU_SETSIZE; ++c) {
+            if (CPU_ISSET(c, &allowed)) ret.push_back(std::make_pair(nodeOf[c], c));
+        }
+        std::sort(ret.begin(), ret.end());
+        return ret;
+    }
+}
+
+ThreadPool::ThreadPool(unsigned int nThreads) :
+    nWorkers_(0), pinned_(false), stop_(false), pid_(getpid())
+{
+    grow_(nThreads);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wakeUp_.notify_all();
+    // in a forked child the workers don't exist, so there's nothing to join
+    for (std::thread &t : workers_) { if (getpid() == pid_) t.join(); else t.detach(); }
+}
+
+bool ThreadPool::inJob()
+{
+    return threadPoolDepth_ > 0;
+}
+
+ThreadPool & ThreadPool::global(unsigned int nThreads)
+{
+    std::lock_guard<std::mutex> lock(globalMutex_);
+    // never deleted, as the workers may still be waiting when the static objects are destroyed at exit
+    if (globalPool_ == 0) {
+        globalPool_ = new ThreadPool(globalThreads_ && getpid() == globalPid_ ? globalThreads_ : 1);
+        if (globalPin_ && getpid() == globalPid_) globalPool_->pinAll_();
+    }
+    if (globalThreads_ == 0 && nThreads > globalPool_->size() && !inJob()) globalPool_->grow_(nThreads);
+    return *globalPool_;
+}
+
+void ThreadPool::setGlobalThreads(unsigned int nThreads, bool pin)
+{
+    std::lock_guard<std::mutex> lock(globalMutex_);
+    globalThreads_ = nThreads;
+    globalPid_ = getpid();
+    globalPin_ = pin;
+    if (globalPool_ != 0) {
+        globalPool_->grow_(nThreads);
+        if (pin && !globalPool_->pinned_) globalPool_->pinAll_();
+    }
+}
+
+bool ThreadPool::pinned()
+{
+    std::lock_guard<std::mutex> lock(globalMutex_);
+    return globalPool_ != 0 && globalPool_->pinned_;
+}
+
+unsigned int ThreadPool::globalThreads()
+{
+    std::lock_guard<std::mutex> lock(globalMutex_);
+    return globalThreads_;
+}
+
+unsigned int ThreadPool::threadsFor(int knob)
+{
+    unsigned int budget = globalThreads();
+    if (knob > 0) return budget ? std::min<unsigned int>(knob, budget) : knob;
+    return budget ? budget : 1;
+}
+
+void ThreadPool::grow_(unsigned int nThreads)
+{
+    if (getpid() != pid_) return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (workers_.size() + 1 < nThreads) {
+        workers_.push_back(std::thread(&ThreadPool::workerLoop_, this, workers_.size() + 1));
+        nodes_.push_back(-1);
+        if (pinned_) pinOne_(workers_.size(), workers_.back().native_handle());
+        ++nWorkers_;
+    }
+}
+
+void ThreadPool::pinAll_()
+{
+    if (getpid() != pid_) return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    cores_ = allowedCores();
+    if (cores_.empty()) return;
+    pinned_ = true;
+    // the calling thread is left free: the processes it forks inherit its affinity
+    for (unsigned int i = 0, n = workers_.size(); i < n; ++i) pinOne_(i + 1, workers_[i].native_handle());
+}
+
+void ThreadPool::pinOne_(unsigned int id, pthread_t thread)
+{
+    // worker i on the i-th core, so that the first node is filled before going to the next one
+    const std::pair<int,int> &core = cores_[id % cores_.size()];
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core.second, &set);
+    if (pthread_setaffinity_np(thread, sizeof(set), &set) == 0) nodes_[id - 1] = core.first;
+}
+
+void ThreadPool::parallelFor(unsigned int n, const std::function<void(unsigned int)> &job, unsigned int maxThreads)
+{
+    unsigned int nThreads = std::min(n, maxThreads ? std::min(maxThreads, size()) : size());
+    if (nThreads <= 1 || getpid() != pid_) {
+        for (unsigned int i = 0; i < n; ++i) job(i);
+        return;
+    }
+    Loop loop;
+    loop.job = &job;
+    loop.nRanges = nThreads;
+    loop.ranges.reset(new Range[nThreads]);
+    for (unsigned int k = 0; k < nThreads; ++k) {
+        loop.ranges[k].begin = k * n / nThreads;
+        loop.ranges[k].end = (k + 1) * n / nThreads;
+        loop.ranges[k].node = -1;
+        loop.ranges[k].taken = false;
+    }
+    loop.joined = 1; loop.active = 1; // the calling thread has the first range
+    loop.node = threadPoolNode_;
+    loop.ranges[0].node = threadPoolNode_;
+    loop.ranges[0].taken = true;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        loops_.push_back(&loop);
+    }
+    wakeUp_.notify_all();
+    runJobs_(loop, 0);
+    // nothing is left to take: no other thread may join from now on, wait for those that did to finish their jobs
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<Loop *>::iterator it = std::find(loops_.begin(), loops_.end(), &loop);
+        if (it != loops_.end()) loops_.erase(it);
+    }
+    {
+        std::unique_lock<std::mutex> lock(loop.mutex);
+        --loop.active;
+        loop.left.wait(lock, [&loop]{ return loop.active == 0; });
+    }
+    if (loop.error) std::rethrow_exception(loop.error);
+}
+
+void ThreadPool::workerLoop_(unsigned int id)
+{
+    for (;;) {
+        Loop *loop;
+        unsigned int slot;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wakeUp_.wait(lock, [this]{ return stop_ || !loops_.empty(); });
+            if (stop_) return;
+            threadPoolNode_ = nodes_[id - 1];
+            // the innermost loop first, so that the outer jobs waiting for it are freed as soon as possible,
+            // among those called from the same node if there are any
+            std::vector<Loop *>::iterator it = loops_.end() - 1;
+            if (threadPoolNode_ != -1) {
+                for (std::vector<Loop *>::iterator it2 = loops_.end(); it2 != loops_.begin(); ) {
+                    if ((*--it2)->node == threadPoolNode_) { it = it2; break; }
+                }
+            }
+            loop = *it;
+            // the range with the same number as the worker if it's free, so that it gets the same one on every call
+            slot = id;
+            if (slot >= loop->nRanges || loop->ranges[slot].taken) {
+                for (slot = 1; loop->ranges[slot].taken; ++slot) {}
+            }
+            loop->ranges[slot].taken = true;
+            if (++loop->joined == loop->nRanges) loops_.erase(it);
+            {
+                std::lock_guard<std::mutex> rangeLock(loop->ranges[slot].mutex);
+                loop->ranges[slot].node = threadPoolNode_;
+            }
+            std::lock_guard<std::mutex> loopLock(loop->mutex);
+            ++loop->active;
+        }
+        runJobs_(*loop, slot);
+        std::lock_guard<std::mutex> loopLock(loop->mutex);
+        if (--loop->active == 0) loop->left.notify_all();
+    }
+}
+
+bool ThreadPool::take_(Loop &loop, unsigned int slot, unsigned int &index)
+{
+    Range &own = loop.ranges[slot];
+    int node;
+    {
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (own.begin < own.end) { index = own.begin++; return true; }
+        node = own.node;
+    }
+    // steal the second half of what's left of the range of another thread, first from the threads of the same node
+    for (unsigned int k = 1, n = 2 * loop.nRanges; k < n; ++k) {
+        if (k == loop.nRanges) continue;
+        bool local = k < loop.nRanges;
+        if (local && node == -1) continue;
+        Range &other = loop.ranges[(slot + k) % loop.nRanges];
+        unsigned int begin, end;
+        {
+            std::lock_guard<std::mutex> lock(other.mutex);
+            if (other.begin == other.end) continue;
+            if (local && other.node != node) continue;
+            if (other.end - other.begin == 1) { index = --other.end; return true; }
+            begin = other.begin + (other.end - other.begin) / 2;
+            end = other.end;
+            other.end = begin;
+        }
+        std::lock_guard<std::mutex> lock(own.mutex);
+        index = begin;
+        own.begin = begin + 1; own.end = end;
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::runJobs_(Loop &loop, unsigned int slot)
+{
+    ++threadPoolDepth_;
+    unsigned int i;
+    while (take_(loop, slot, i)) {
+        try {
+            (*loop.job)(i);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(loop.mutex);
+            if (!loop.error) loop.error = std::current_exception();
+        }
+    }
+    --threadPoolDepth_;
+}
@@ -2,6 +2,11 @@
 #include "HiggsAnalysis/CombinedLimit/interface/utils.h"
 #include <memory>
 #include <stdexcept>
+#include <typeinfo>
+#include <cmath>
+#include <algorithm>
+#include <numeric>
+#include <limits>
 #include <TH1.h>
 #include <TH2.h>
 #include <TH3.h>
@@ -9,10 +14,16 @@
 #include <RooRealVar.h>
 #include <RooProdPdf.h>
 #include <RooPoisson.h>
+#include <RooGaussian.h>
+#include "HiggsAnalysis/CombinedLimit/interface/SimpleGaussianConstraint.h"
+#include "HiggsAnalysis/CombinedLimit/interface/SimplePoissonConstraint.h"
 #include <RooDataHist.h>
 #include <RooDataSet.h>
 #include <RooRandom.h>
 #include <HiggsAnalysis/CombinedLimit/interface/ProfilingTools.h>
+#include "HiggsAnalysis/CombinedLimit/interface/CachingNLL.h"
+#include "HiggsAnalysis/CombinedLimit/interface/RooSimultaneousOpt.h"
+#include "HiggsAnalysis/CombinedLimit/interface/Combine.h"
 #include "RooStats/DetailedOutputAggregator.h"
 
 using namespace std;
@@ -22,7 +33,10 @@ ToyMCSamplerOpt::ToyMCSamplerOpt(RooStats::TestStatistic& ts, Int_t ntoys, RooAb
     globalObsPdf_(globalObsPdf),
     globalObsValues_(0), globalObsIndex_(-1),
     nuisValues_(0), nuisIndex_(-1),
-    weightVar_(0)
+    globalObsSampler_(0), nuisSampler_(0),
+    weightVar_(0),
+    currentImportance_(0),
+    recycler_(0), recyclerNll_(0)
 {
     if (!generateNuisances) fPriorNuisance = 0; // set things straight from the beginning
 }
@@ -32,7 +46,11 @@ ToyMCSamplerOpt::ToyMCSamplerOpt(const RooStats::ToyMCSampler &base) :
     ToyMCSampler(base),
     globalObsPdf_(0),
     globalObsValues_(0), globalObsIndex_(-1),
-    weightVar_(0)
+    nuisValues_(0), nuisIndex_(-1),
+    globalObsSampler_(0), nuisSampler_(0),
+    weightVar_(0),
+    currentImportance_(0),
+    recycler_(0), recyclerNll_(0)
 {
 }
 
@@ -40,26 +58,40 @@ ToyMCSamplerOpt::ToyMCSamplerOpt(const ToyMCSamplerOpt &other) :
     ToyMCSampler(other),
     globalObsPdf_(0),
     globalObsValues_(0), globalObsIndex_(-1),
-    weightVar_(0)
+    nuisValues_(0), nuisIndex_(-1),
+    globalObsSampler_(0), nuisSampler_(0),
+    weightVar_(0),
+    currentImportance_(0),
+    recycler_(0), recyclerNll_(0)
 {
 }
 
 ToyMCSamplerOpt::~ToyMCSamplerOpt()
 {
     delete weightVar_;
+    for (std::vector<ImportanceDensity>::iterator it = importanceDensities_.begin(), ed = importanceDensities_.end(); it != ed; ++it) {
+        delete it->point; delete it->density;
+        delete it->nllPoint; delete it->nllDensity;
+    }
     for (std::map<RooAbsPdf *, toymcoptutils::SimPdfGenInfo *>::iterator it = genCache_.begin(), ed = genCache_.end(); it != ed; ++it) {
         delete it->second;
     }
     genCache_.clear();
     delete _allVars; _allVars = 0;
     delete globalObsValues_;
+    delete nuisValues_;
+    delete globalObsSampler_;
+    delete nuisSampler_;
+    delete recyclerNll_;
 }
 
 
 toymcoptutils::SinglePdfGenInfo::SinglePdfGenInfo(RooAbsPdf &pdf, const RooArgSet& observables, bool preferBinned, const RooDataSet* protoData, int forceEvents) :
    mode_(pdf.canBeExtended() ? (preferBinned ? Binned : Unbinned) : Counting),
    pdf_(&pdf),
-   spec_(0),histoSpec_(0),keepHistoSpec_(0),weightVar_(0)
+   spec_(0),histoSpec_(0),keepHistoSpec_(0),weightVar_(0),
+   batchSize_(0),batchToys_(0),batchNext_(0),batchAsimov_(0),
+   fastUnbinned_(false),cachingPdf_(0),params_(0),envelope_(0),acceptance_(0.1)
 {
    if (pdf.canBeExtended()) {
        if (pdf.getAttribute("forceGenBinned")) mode_ = Binned;
@@ -75,6 +107,13 @@ toymcoptutils::SinglePdfGenInfo::SinglePdfGenInfo(RooAbsPdf &pdf, const RooArgSe
       else if (runtimedef::get("TMCSO_GenBinnedWorkaround")) mode_ = Binned;
       else mode_ = Poisson;
    } else if (mode_ == Unbinned) {
+       // the fast generation needs a box to draw the proposals from
+       fastUnbinned_ = runtimedef::get("TMCSO_FastUnbinned");
+       RooLinkedListIter iter = observables_.iterator(); 
+       for (RooAbsArg *a = (RooAbsArg *) iter.Next(); a != 0 && fastUnbinned_; a = (RooAbsArg *) iter.Next()) {
+           RooRealVar *rrv = dynamic_cast<RooRealVar *>(a);
+           if (rrv == 0 || !rrv->hasMin() || !rrv->hasMax()) fastUnbinned_ = false;
+       }
        //if (!runtimedef::get("TMCSO_NoPrepareMultiGen")) {
        //    spec_ = protoData ? pdf.prepareMultiGen(observables_, RooFit::Extended(), RooFit::ProtoData(*protoData, true, true)) 
        //                      : pdf.prepareMultiGen(observables_, RooFit::Extended());
@@ -87,6 +126,9 @@ toymcoptutils::SinglePdfGenInfo::~SinglePdfGenInfo()
     delete spec_;
     delete weightVar_;
     delete histoSpec_;
+    delete batchAsimov_;
+    delete cachingPdf_;
+    delete params_;
 }
 
 
@@ -97,6 +139,10 @@ toymcoptutils::SinglePdfGenInfo::generate(const RooDataSet* protoData, int force
     RooAbsData *ret = 0;
     switch (mode_) {
         case Unbinned:
+            if (fastUnbinned_ && protoData == 0) {
+                ret = generateUnbinnedFast();
+                break;
+            }
             if (spec_ == 0) spec_ = protoData ? pdf_->prepareMultiGen(observables_, RooFit::Extended(), RooFit::ProtoData(*protoData, true, true))
                                               : pdf_->prepareMultiGen(observables_, RooFit::Extended());
             if (spec_) ret = pdf_->generate(*spec_);
@@ -115,7 +161,7 @@ toymcoptutils::SinglePdfGenInfo::generate(const RooDataSet* protoData, int force
                             : pdf_->generateBinned(observables_, RooFit::Extended());
             break;
         case Poisson:
-            ret = generateWithHisto(weightVar_, false);
+            ret = (batchSize_ > 1 && keepHistoSpec_) ? generateFromBatch(weightVar_) : generateWithHisto(weightVar_, false);
             break;
         case Counting:
             ret = pdf_->generate(observables_, 1);
@@ -201,15 +247,14 @@ toymcoptutils::SinglePdfGenInfo::generateWithHisto(RooRealVar *&weightVar, bool
 
     double expectedEvents = pdf_->expectedEvents(observables_);
     histoSpec_->Scale(expectedEvents/ histoSpec_->Integral("width")); 
-    RooArgSet obsPlusW(obs); obsPlusW.add(*weightVar);
-    RooDataSet *data = new RooDataSet(TString::Format("%sData", pdf_->GetName()), "", obsPlusW, weightVar->GetName());
-    RooAbsArg::setDirtyInhibit(true); // don't propagate dirty flags while filling histograms 
+    // expected yield and center of each bin, then the counts of all the bins at once
+    std::vector<double> expected, cx, cy, cz;
     switch (obs.getSize()) {
         case 1:
             for (int i = 1, n = histoSpec_->GetNbinsX(); i <= n; ++i) {
-                x->setVal(histoSpec_->GetXaxis()->GetBinCenter(i));
+                cx.push_back(histoSpec_->GetXaxis()->GetBinCenter(i));
                 double w = histoSpec_->GetXaxis()->GetBinWidth(i);
-                data->add(observables_,  weightScale*(asimov ? w*histoSpec_->GetBinContent(i) : RooRandom::randomGenerator()->Poisson(w*histoSpec_->GetBinContent(i))) );
+                expected.push_back(w*histoSpec_->GetBinContent(i));
             }
             break;
         case 2:
@@ -217,10 +262,10 @@ toymcoptutils::SinglePdfGenInfo::generateWithHisto(RooRealVar *&weightVar, bool
             TH2& h2 = dynamic_cast<TH2&>(*histoSpec_);
             for (int ix = 1, nx = h2.GetNbinsX(); ix <= nx; ++ix) {
             for (int iy = 1, ny = h2.GetNbinsY(); iy <= ny; ++iy) {
-                x->setVal(h2.GetXaxis()->GetBinCenter(ix));
-                y->setVal(h2.GetYaxis()->GetBinCenter(iy));
+                cx.push_back(h2.GetXaxis()->GetBinCenter(ix));
+                cy.push_back(h2.GetYaxis()->GetBinCenter(iy));
                 double w = h2.GetXaxis()->GetBinWidth(ix) * h2.GetYaxis()->GetBinWidth(iy);
-                data->add(observables_, weightScale*(asimov ? w*h2.GetBinContent(ix,iy) : RooRandom::randomGenerator()->Poisson(w*h2.GetBinContent(ix,iy))) );
+                expected.push_back(w*h2.GetBinContent(ix,iy));
             } }
             }
             break;
@@ -230,14 +275,30 @@ toymcoptutils::SinglePdfGenInfo::generateWithHisto(RooRealVar *&weightVar, bool
             for (int ix = 1, nx = h3.GetNbinsX(); ix <= nx; ++ix) {
             for (int iy = 1, ny = h3.GetNbinsY(); iy <= ny; ++iy) {
             for (int iz = 1, nz = h3.GetNbinsZ(); iz <= nz; ++iz) {
-                x->setVal(h3.GetXaxis()->GetBinCenter(ix));
-                y->setVal(h3.GetYaxis()->GetBinCenter(iy));
-                z->setVal(h3.GetZaxis()->GetBinCenter(iz));
+                cx.push_back(h3.GetXaxis()->GetBinCenter(ix));
+                cy.push_back(h3.GetYaxis()->GetBinCenter(iy));
+                cz.push_back(h3.GetZaxis()->GetBinCenter(iz));
                 double w = h3.GetXaxis()->GetBinWidth(ix) * h3.GetYaxis()->GetBinWidth(iy) * h3.GetZaxis()->GetBinWidth(iz);
-                data->add(observables_, weightScale*(asimov ? w*h3.GetBinContent(ix,iy,iz) : RooRandom::randomGenerator()->Poisson(w*h3.GetBinContent(ix,iy,iz))) );
+                expected.push_back(w*h3.GetBinContent(ix,iy,iz));
             } } }
             }
     }
+    unsigned int nbins = expected.size();
+    std::vector<double> counts;
+    if (!asimov && nbins) {
+        counts.resize(nbins);
+        throwPoisson(nbins, &expected[0], &counts[0], 1);
+    }
+    const std::vector<double> & values = asimov ? expected : counts;
+    RooArgSet obsPlusW(obs); obsPlusW.add(*weightVar);
+    RooDataSet *data = new RooDataSet(TString::Format("%sData", pdf_->GetName()), "", obsPlusW, weightVar->GetName());
+    RooAbsArg::setDirtyInhibit(true); // don't propagate dirty flags while filling histograms 
+    for (unsigned int i = 0; i < nbins; ++i) {
+        x->setVal(cx[i]);
+        if (y) y->setVal(cy[i]);
+        if (z) z->setVal(cz[i]);
+        data->add(observables_, weightScale*values[i]);
+    }
     RooAbsArg::setDirtyInhibit(false); // restore proper propagation of dirty flags
     if (!keepHistoSpec_) { delete histoSpec_; histoSpec_ = 0; }
     //std::cout << "Asimov dataset generated from " << pdf_->GetName() << " (sumw? " << data->sumEntries() << ", expected events " << expectedEvents << ")" << std::endl;
@@ -246,6 +307,337 @@ toymcoptutils::SinglePdfGenInfo::generateWithHisto(RooRealVar *&weightVar, bool
 }
 
 
+void
+toymcoptutils::SinglePdfGenInfo::paramValues(std::vector<double> &values) 
+{
+    if (params_ == 0) params_ = pdf_->getParameters(observables_);
+    values.clear();
+    RooLinkedListIter iter = params_->iterator(); 
+    for (RooAbsArg *a = (RooAbsArg *) iter.Next(); a != 0; a = (RooAbsArg *) iter.Next()) {
+        RooAbsReal *rar = dynamic_cast<RooAbsReal *>(a);
+        RooAbsCategory *cat = rar ? 0 : dynamic_cast<RooAbsCategory *>(a);
+        values.push_back(rar ? rar->getVal() : (cat ? cat->getIndex() : 0));
+    }
+}
+
+RooDataSet *  
+toymcoptutils::SinglePdfGenInfo::generateFromBatch(RooRealVar *&weightVar) 
+{
+    // the rest of the batch is thrown away if the parameters changed since (e.g. nuisances or global observables 
+    // randomized for each toy, or another point of the scan), as the yields must be those of each toy
+    std::vector<double> point;
+    paramValues(point);
+    if (batchNext_ >= batchToys_ || point != batchPoint_) {
+        batchPoint_.swap(point);
+        // evaluate the expected yields once, and throw the bins of all toys in one go
+        delete batchAsimov_;
+        batchAsimov_ = generateWithHisto(weightVar, true);
+        unsigned int nbins = batchAsimov_->numEntries();
+        std::vector<double> expected(nbins);
+        for (unsigned int i = 0; i < nbins; ++i) {
+            batchAsimov_->get(i);
+            expected[i] = batchAsimov_->weight();
+        }
+        batchCounts_.resize(nbins * batchSize_);
+        if (nbins) throwPoisson(nbins, &expected[0], &batchCounts_[0], batchSize_);
+        batchToys_ = batchSize_; batchNext_ = 0;
+    }
+    unsigned int nbins = batchAsimov_->numEntries();
+    const double *counts = &batchCounts_[nbins * (batchNext_++)];
+    RooArgSet obsPlusW(observables_); obsPlusW.add(*weightVar);
+    RooDataSet *data = new RooDataSet(TString::Format("%sData", pdf_->GetName()), "", obsPlusW, weightVar->GetName());
+    RooAbsArg::setDirtyInhibit(true); // don't propagate dirty flags while filling histograms 
+    for (unsigned int i = 0; i < nbins; ++i) {
+        observables_ = *batchAsimov_->get(i);
+        data->add(observables_, counts[i]);
+    }
+    RooAbsArg::setDirtyInhibit(false); // restore proper propagation of dirty flags
+    return data;
+}
+
+const std::vector<double> &
+toymcoptutils::SinglePdfGenInfo::evalPoints(const std::vector<double> &points) 
+{
+    RooArgList obs(observables_);
+    unsigned int ndim = obs.getSize(), npoints = points.size()/ndim;
+    RooDataSet data("points", "", observables_);
+    RooAbsArg::setDirtyInhibit(true); // don't propagate dirty flags while filling the dataset
+    for (unsigned int i = 0; i < npoints; ++i) {
+        for (unsigned int j = 0; j < ndim; ++j) static_cast<RooRealVar &>(obs[j]).setVal(points[i*ndim+j]);
+        data.add(observables_);
+    }
+    RooAbsArg::setDirtyInhibit(false); // restore proper propagation of dirty flags
+    if (cachingPdf_ == 0) cachingPdf_ = cacheutils::makeCachingPdf(pdf_, &observables_);
+    cachingPdf_->setDataDirty();
+    return cachingPdf_->eval(data);
+}
+
+RooDataSet *
+toymcoptutils::SinglePdfGenInfo::generateUnbinnedFast() 
+{
+    RooArgList obs(observables_);
+    unsigned int ndim = obs.getSize();
+    std::vector<double> lo(ndim), width(ndim);
+    for (unsigned int j = 0; j < ndim; ++j) {
+        const RooRealVar &v = static_cast<const RooRealVar &>(obs[j]);
+        lo[j] = v.getMin(); width[j] = v.getMax() - v.getMin();
+    }
+    TRandom *rnd = RooRandom::randomGenerator();
+
+    // the envelope is kept as long as the parameters don't change; it's the maximum on a grid times a safety margin,
+    // and if a proposal goes above it the envelope is raised and the toy started again
+    std::vector<double> point;
+    paramValues(point);
+    if (envelope_ <= 0 || point != envelopePoint_) {
+        unsigned int ngrid = std::max(2, int(std::pow(4096., 1.0/ndim)));
+        unsigned int npoints = 1; for (unsigned int j = 0; j < ndim; ++j) npoints *= ngrid;
+        std::vector<double> grid(npoints*ndim);
+        for (unsigned int i = 0; i < npoints; ++i) {
+            for (unsigned int j = 0, k = i; j < ndim; ++j, k /= ngrid) grid[i*ndim+j] = lo[j] + width[j]*((k % ngrid) + 0.5)/ngrid;
+        }
+        const std::vector<double> & vals = evalPoints(grid);
+        envelope_ = 1.2 * (*std::max_element(vals.begin(), vals.end()));
+        envelopePoint_.swap(point);
+    }
+
+    unsigned int nevents = rnd->Poisson(pdf_->expectedEvents(observables_));
+    std::vector<double> proposals, uniforms;
+    events_.clear();
+    while (events_.size() < nevents*ndim && envelope_ > 0) {
+        // enough proposals for the events still needed at the acceptance seen so far
+        unsigned int missing = nevents - events_.size()/ndim;
+        unsigned int nprop = std::min(65536., std::max(256., 1.2*missing/acceptance_));
+        proposals.resize(nprop*ndim); uniforms.resize(nprop);
+        rnd->RndmArray(proposals.size(), &proposals[0]);
+        rnd->RndmArray(uniforms.size(), &uniforms[0]);
+        for (unsigned int i = 0; i < nprop; ++i) {
+            for (unsigned int j = 0; j < ndim; ++j) proposals[i*ndim+j] = lo[j] + width[j]*proposals[i*ndim+j];
+        }
+        const std::vector<double> & vals = evalPoints(proposals);
+        double maxval = *std::max_element(vals.begin(), vals.end());
+        if (maxval > envelope_) {
+            if (verbose > 1) std::cout << "SinglePdfGenInfo: value " << maxval << " of " << pdf_->GetName() << " above the envelope " << envelope_ << ", starting the toy again with a higher one" << std::endl;
+            envelope_ = 1.2 * maxval;
+            events_.clear();
+            continue;
+        }
+        for (unsigned int i = 0; i < nprop && events_.size() < nevents*ndim; ++i) {
+            if (uniforms[i]*envelope_ < vals[i]) {
+                events_.insert(events_.end(), &proposals[i*ndim], &proposals[i*ndim] + ndim);
+            }
+        }
+        // the probability of accepting a proposal is the mean of pdf/envelope over all of them, including those not
+        // looked at once the toy had all its events (counting only the accepted ones over nprop would underestimate it)
+        double sumvals = std::accumulate(vals.begin(), vals.begin() + nprop, 0.0);
+        acceptance_ = std::min(1.0, std::max(1e-4, sumvals/(nprop*envelope_)));
+    }
+
+    RooDataSet *data = new RooDataSet(TString::Format("%sData", pdf_->GetName()), "", observables_);
+    RooAbsArg::setDirtyInhibit(true); // don't propagate dirty flags while filling the dataset
+    for (unsigned int i = 0, n = events_.size()/ndim; i < n; ++i) {
+        for (unsigned int j = 0; j < ndim; ++j) static_cast<RooRealVar &>(obs[j]).setVal(events_[i*ndim+j]);
+        data->add(observables_);
+    }
+    RooAbsArg::setDirtyInhibit(false); // restore proper propagation of dirty flags
+    return data;
+}
+
+void
+toymcoptutils::SinglePdfGenInfo::throwPoisson(unsigned int nbins, const double *expected, double *counts, unsigned int ntoys) 
+{
+    TRandom *rnd = RooRandom::randomGenerator();
+    static bool fastPoisson = runtimedef::get("TMCSO_FastPoisson");
+    if (fastPoisson) {
+        poisson_.setMeans(nbins, expected);
+        poisson_.generate(*rnd, counts, ntoys);
+        return;
+    }
+    for (unsigned int itoy = 0; itoy < ntoys; ++itoy) {
+        for (unsigned int i = 0; i < nbins; ++i, ++counts) *counts = rnd->Poisson(expected[i]);
+    }
+}
+
+toymcoptutils::ConstraintSampler::ConstraintSampler(RooAbsPdf &pdf, const RooArgSet &vars) :
+    ntoys_(0), ok_(true)
+{
+    addTerms_(&pdf, vars);
+    // each variable must come from exactly one term
+    RooLinkedListIter iter = vars.iterator(); 
+    for (RooAbsArg *a = (RooAbsArg *) iter.Next(); a != 0 && ok_; a = (RooAbsArg *) iter.Next()) {
+        if (!vars_.find(a->GetName())) ok_ = false;
+    }
+    if (ok_ && vars_.getSize() != int(gaussians_.size() + poissons_.size())) ok_ = false;
+}
+
+void
+toymcoptutils::ConstraintSampler::addTerms_(RooAbsPdf *pdf, const RooArgSet &vars) 
+{
+    if (!ok_ || !pdf->dependsOn(vars)) return;
+    RooProdPdf *prod = dynamic_cast<RooProdPdf *>(pdf);
+    if (prod) {
+        RooFIter iter = prod->pdfList().fwdIterator();
+        for (RooAbsArg *a = iter.next(); a != 0; a = iter.next()) addTerms_(static_cast<RooAbsPdf *>(a), vars);
+        return;
+    }
+    Term t = { 0, 0, 0 };
+    RooGaussian *gauss = dynamic_cast<RooGaussian *>(pdf);
+    RooPoisson  *pois  = dynamic_cast<RooPoisson *>(pdf);
+    if (gauss) {
+        // a copy as SimpleGaussianConstraint, to get at the servers of a plain RooGaussian
+        SimpleGaussianConstraint sgc(*gauss);
+        const RooAbsReal *x = &sgc.getX(), *mean = &sgc.getMean(), *sigma = &sgc.getSigma();
+        if (sigma->dependsOn(vars)) { ok_ = false; return; }
+        if (vars.contains(*mean) && !x->dependsOn(vars)) { t.var = dynamic_cast<RooRealVar *>(const_cast<RooAbsReal *>(mean)); t.center = x; }
+        else if (vars.contains(*x) && !mean->dependsOn(vars)) { t.var = dynamic_cast<RooRealVar *>(const_cast<RooAbsReal *>(x)); t.center = mean; }
+        t.sigma = sigma;
+    } else if (pois) {
+        SimplePoissonConstraint spc(*pois);
+        const RooAbsReal *x = &spc.getX(), *mean = &spc.getMean();
+        if (vars.contains(*x) && !mean->dependsOn(vars)) { t.var = dynamic_cast<RooRealVar *>(const_cast<RooAbsReal *>(x)); t.center = mean; }
+    }
+    if (t.var == 0 || vars_.find(t.var->GetName())) { ok_ = false; return; }
+    (gauss ? gaussians_ : poissons_).push_back(t);
+}
+
+void
+toymcoptutils::ConstraintSampler::generate(unsigned int ntoys) 
+{
+    TRandom *rnd = RooRandom::randomGenerator();
+    unsigned int ng = gaussians_.size(), np = poissons_.size(), n = ng + np;
+    vars_.removeAll();
+    for (unsigned int i = 0; i < ng; ++i) vars_.add(*gaussians_[i].var);
+    for (unsigned int i = 0; i < np; ++i) vars_.add(*poissons_[i].var);
+    ntoys_ = ntoys;
+    values_.resize(ntoys * n);
+    if (ng) {
+        // unit gaussians by Box-Muller, two from each pair of uniforms
+        std::vector<double> centers(ng), sigmas(ng), u((ntoys * ng + 1) & ~1u);
+        for (unsigned int i = 0; i < ng; ++i) { centers[i] = gaussians_[i].center->getVal(); sigmas[i] = gaussians_[i].sigma->getVal(); }
+        rnd->RndmArray(u.size(), &u[0]);
+        for (unsigned int i = 0, nu = u.size(); i < nu; i += 2) {
+            double r = std::sqrt(-2.0 * std::log(u[i])), phi = 2.0 * M_PI * u[i+1];
+            u[i] = r * std::cos(phi); u[i+1] = r * std::sin(phi);
+        }
+        for (unsigned int itoy = 0, k = 0; itoy < ntoys; ++itoy) {
+            double *out = &values_[itoy * n];
+            for (unsigned int i = 0; i < ng; ++i, ++k) out[i] = centers[i] + sigmas[i] * u[k];
+        }
+        // as in RooGaussian::generateEvent, the values outside the range are thrown again
+        for (unsigned int itoy = 0; itoy < ntoys; ++itoy) {
+            for (unsigned int i = 0; i < ng; ++i) {
+                const RooRealVar *v = gaussians_[i].var;
+                double &val = values_[itoy * n + i];
+                while (!(val > v->getMin() && val < v->getMax())) val = rnd->Gaus(centers[i], sigmas[i]);
+            }
+        }
+    }
+    if (np) {
+        std::vector<double> means(np), counts(ntoys * np);
+        for (unsigned int i = 0; i < np; ++i) means[i] = poissons_[i].center->getVal();
+        poisson_.setMeans(np, &means[0]);
+        poisson_.generate(*rnd, &counts[0], ntoys);
+        for (unsigned int itoy = 0; itoy < ntoys; ++itoy) {
+            for (unsigned int i = 0; i < np; ++i) {
+                const RooRealVar *v = poissons_[i].var;
+                double &val = values_[itoy * n + ng + i];
+                val = counts[itoy * np + i];
+                // as in RooPoisson::generateEvent
+                while (!(val >= v->getMin() && val <= v->getMax())) val = rnd->Poisson(means[i]);
+            }
+        }
+    }
+}
+
+void
+toymcoptutils::ConstraintSampler::set(unsigned int itoy) const
+{
+    const double *vals = &values_[itoy * (gaussians_.size() + poissons_.size())];
+    for (unsigned int i = 0, ng = gaussians_.size(); i < ng; ++i) gaussians_[i].var->setVal(vals[i]);
+    for (unsigned int i = 0, ng = gaussians_.size(), np = poissons_.size(); i < np; ++i) poissons_[i].var->setVal(vals[ng + i]);
+}
+
+const toymcoptutils::ToyRecycler::Batch *
+toymcoptutils::ToyRecycler::nearest(const std::string &pdf, const RooArgSet &point, const RooArgSet &pois, const std::string &key) 
+{
+    const Batch *ret = 0;
+    double best = std::numeric_limits<double>::max();
+    for (std::vector<Batch>::const_iterator it = batches_.begin(), ed = batches_.end(); it != ed; ++it) {
+        if (it->pdf != pdf || it->toys.empty() || served_.count(std::make_pair(key, it->id))) continue;
+        double dist = 0;
+        RooLinkedListIter iter = pois.iterator();
+        for (RooAbsArg *a = (RooAbsArg *) iter.Next(); a != 0; a = (RooAbsArg *) iter.Next()) {
+            dist += std::pow(point.getRealValue(a->GetName()) - it->point->getRealValue(a->GetName()), 2);
+        }
+        if (dist <= best) { best = dist; ret = &*it; }
+    }
+    if (ret) served_.insert(std::make_pair(key, ret->id));
+    return ret;
+}
+
+void
+toymcoptutils::ToyRecycler::newBatch(const std::string &pdf, const RooArgSet &point, const RooArgList &globalObs, const RooArgList &nuisances, const std::string &key) 
+{
+    batches_.push_back(Batch());
+    Batch &b = batches_.back();
+    b.id = nextId_++;
+    // the toys are already counted in the distribution for which they are thrown
+    served_.insert(std::make_pair(key, b.id));
+    b.pdf = pdf;
+    b.point = (RooArgSet *) point.snapshot();
+    for (int i = 0, n = globalObs.getSize(); i < n; ++i) b.globalObsNames.push_back(globalObs.at(i)->GetName());
+    for (int i = 0, n = nuisances.getSize(); i < n; ++i) b.nuisanceNames.push_back(nuisances.at(i)->GetName());
+}
+
+void
+toymcoptutils::ToyRecycler::add(const RooAbsData &data, const RooArgList &globalObs, const RooArgList &nuisances, double weight) 
+{
+    if (batches_.empty() || maxToys_ == 0) return;
+    // keep at most maxToys_, dropping the oldest batches (but never the one being filled)
+    while (ntoys_ >= maxToys_ && batches_.size() > 1) {
+        ntoys_ -= batches_.front().toys.size();
+        for (Toy &t : batches_.front().toys) delete t.data;
+        delete batches_.front().point;
+        unsigned long id = batches_.front().id;
+        for (auto it = served_.begin(); it != served_.end(); ) {
+            if (it->second == id) it = served_.erase(it); else ++it;
+        }
+        batches_.erase(batches_.begin());
+    }
+    if (ntoys_ >= maxToys_) return;
+    Toy t;
+    // the toys of the sampler share their memory with the next one, so they must be copied entry by entry
+    const RooDataSet *ds = dynamic_cast<const RooDataSet *>(&data);
+    if (ds) {
+        RooRealVar weightVar("_weight_", "", 1.0);
+        RooArgSet vars(*ds->get()), varsPlusWeight(vars); varsPlusWeight.add(weightVar);
+        RooDataSet *copy = new RooDataSet(ds->GetName(), "", varsPlusWeight, weightVar.GetName());
+        for (int i = 0, n = ds->numEntries(); i < n; ++i) {
+            vars = *ds->get(i);
+            copy->add(vars, ds->weight());
+        }
+        t.data = copy;
+    } else {
+        t.data = (RooAbsData *) data.Clone();
+    }
+    for (int i = 0, n = globalObs.getSize(); i < n; ++i) t.globalObs.push_back(((RooAbsReal *) globalObs.at(i))->getVal());
+    for (int i = 0, n = nuisances.getSize(); i < n; ++i) t.nuisances.push_back(((RooAbsReal *) nuisances.at(i))->getVal());
+    t.weight = weight;
+    batches_.back().toys.push_back(t);
+    ++ntoys_;
+}
+
+void
+toymcoptutils::ToyRecycler::clear() 
+{
+    for (Batch &b : batches_) {
+        for (Toy &t : b.toys) delete t.data;
+        delete b.point;
+    }
+    batches_.clear();
+    served_.clear();
+    ntoys_ = 0;
+}
+
 RooDataSet *  
 toymcoptutils::SinglePdfGenInfo::generateCountingAsimov() 
 {
@@ -481,6 +873,14 @@ toymcoptutils::SimPdfGenInfo::setCacheTemplates(bool cache)
     }
 }
 
+void
+toymcoptutils::SimPdfGenInfo::setBatchSize(unsigned int n) 
+{
+    for (std::vector<SinglePdfGenInfo *>::const_iterator it = pdfs_.begin(), ed = pdfs_.end(); it != ed; ++it) {
+        if (*it) (*it)->setBatchSize(n);
+    }
+}
+
 void
 ToyMCSamplerOpt::SetPdf(RooAbsPdf& pdf) 
 {
@@ -490,6 +890,77 @@ ToyMCSamplerOpt::SetPdf(RooAbsPdf& pdf)
     delete _allVars; _allVars = 0; 
     delete globalObsValues_; globalObsValues_ = 0; globalObsIndex_ = -1;
     delete nuisValues_; nuisValues_ = 0; nuisIndex_ = -1;
+    delete globalObsSampler_; globalObsSampler_ = 0;
+    delete nuisSampler_; nuisSampler_ = 0;
+}
+
+void
+ToyMCSamplerOpt::addImportanceDensity(RooAbsPdf &pdf, const RooArgSet &point, const RooArgSet &density, double fraction)
+{
+    ImportanceDensity d;
+    d.pdf = &pdf;
+    d.point = (RooArgSet *) point.snapshot();
+    d.density = (RooArgSet *) density.snapshot();
+    d.fraction = fraction;
+    d.nllPoint = d.nllDensity = 0;
+    importanceDensities_.push_back(d);
+}
+
+void
+ToyMCSamplerOpt::setToyRecycler(toymcoptutils::ToyRecycler *recycler, const RooArgSet &pois)
+{
+    recycler_ = recycler;
+    recyclerPois_.removeAll();
+    recyclerPois_.add(pois);
+}
+
+double
+ToyMCSamplerOpt::reuseToys_(const toymcoptutils::ToyRecycler::Batch &batch, RooArgSet &allVars, const RooArgSet &saveAll, RooStats::DetailedOutputAggregator &detOutAgg, double &toysInTails)
+{
+   std::vector<RooRealVar *> globalObs, nuisances;
+   for (const std::string &name : batch.globalObsNames) globalObs.push_back(dynamic_cast<RooRealVar *>(allVars.find(name.c_str())));
+   for (const std::string &name : batch.nuisanceNames)  nuisances.push_back(dynamic_cast<RooRealVar *>(allVars.find(name.c_str())));
+   auto setToy = [&](const toymcoptutils::ToyRecycler::Toy &toy, bool withNuisances) {
+      for (unsigned int i = 0, n = globalObs.size(); i < n; ++i) if (globalObs[i]) globalObs[i]->setVal(toy.globalObs[i]);
+      if (!withNuisances) return;
+      for (unsigned int i = 0, n = nuisances.size(); i < n; ++i) if (nuisances[i]) nuisances[i]->setVal(toy.nuisances[i]);
+   };
+   // weights: the likelihood of each toy (with its global observables and nuisances) here over that at the point it was thrown at
+   unsigned int ntoys = batch.toys.size();
+   std::vector<double> weights(ntoys);
+   double sumw = 0, sumw2 = 0;
+   for (unsigned int i = 0; i < ntoys; ++i) {
+      const toymcoptutils::ToyRecycler::Toy &toy = batch.toys[i];
+      allVars = *batch.point; setToy(toy, true);
+      double nllThrown = importanceNll_(*fPdf, *toy.data, recyclerNll_);
+      allVars = saveAll; setToy(toy, true);
+      double nllHere = recyclerNll_->getVal();
+      weights[i] = toy.weight * std::exp(nllThrown - nllHere);
+      if (!std::isfinite(weights[i])) weights[i] = 0;
+      sumw += weights[i]; sumw2 += weights[i]*weights[i];
+   }
+   allVars = saveAll;
+   if (sumw2 == 0) return 0;
+   // scaled so that they count as much as their effective number of toys when pooled with the toys thrown here
+   double neff = sumw*sumw/sumw2, scale = neff/sumw;
+   for (unsigned int i = 0; i < ntoys; ++i) {
+      if (weights[i] == 0) continue;
+      const toymcoptutils::ToyRecycler::Toy &toy = batch.toys[i];
+      // as for the toys thrown here, the global observables (or the nuisances generated in their place) stay at the toy values
+      allVars = saveAll; setToy(toy, false);
+      allVars = *fParametersForTestStat;
+      const RooArgList* allTS = EvaluateAllTestStatistics(*toy.data, *fParametersForTestStat, detOutAgg);
+      if (allTS->getSize() > Int_t(fTestStatistics.size()))
+        detOutAgg.AppendArgSet( fGlobalObservables, "globObs_" );
+      Double_t valueFirst = -999.0, weight = weights[i] * scale;
+      if (RooRealVar* firstTS = dynamic_cast<RooRealVar*>(allTS->first())) valueFirst = firstTS->getVal();
+      if (valueFirst != valueFirst) continue;
+      detOutAgg.CommitSet(weight);
+      if (valueFirst <= fAdaptiveLowLimit  ||  valueFirst >= fAdaptiveHighLimit) toysInTails += weight;
+   }
+   allVars = saveAll;
+   oocoutP((TObject*)0,Generation) << "reused " << ntoys << " toys thrown at another point, equivalent to " << neff << " toys" << endl;
+   return neff;
 }
 
 RooDataSet* ToyMCSamplerOpt::GetSamplingDistributionsSingleWorker(RooArgSet& paramPointIn) {
@@ -513,13 +984,53 @@ RooDataSet* ToyMCSamplerOpt::GetSamplingDistributionsSingleWorker(RooArgSet& par
 
    RooStats::DetailedOutputAggregator detOutAgg;
 
+   // importance sampling, if it was requested for this parameter point
+   currentImportance_ = 0;
+   for (std::vector<ImportanceDensity>::iterator itd = importanceDensities_.begin(), edd = importanceDensities_.end(); itd != edd; ++itd) {
+      bool match = true;
+      RooLinkedListIter iter = itd->point->iterator();
+      for (RooAbsArg *a = (RooAbsArg *) iter.Next(); a != 0 && match; a = (RooAbsArg *) iter.Next()) {
+         RooRealVar *rrv = dynamic_cast<RooRealVar *>(a);
+         if (rrv == 0) continue;
+         double val = paramPoint->find(rrv->GetName()) ? paramPoint->getRealValue(rrv->GetName()) : allVars->getRealValue(rrv->GetName());
+         if (std::abs(val - rrv->getVal()) > 1e-9*(1+std::abs(val))) match = false;
+      }
+      if (match) { currentImportance_ = &*itd; break; }
+   }
+
    // counts the number of toys in the limits set for adaptive sampling
    // (taking weights into account; always on first test statistic)
    Double_t toysInTails = 0.0;
 
+   // with a recycler, use first the toys thrown at the nearest point, and throw only the missing ones
+   Int_t nToys = fNToys;
+   bool recycling = (recycler_ != 0 && currentImportance_ == 0);
+   RooArgList recyclerGlobalObs, recyclerNuisances;
+   if (recycling) {
+      // the same toys can be used only once for each point and parameters of the test statistic
+      std::string key;
+      RooLinkedListIter iter = recyclerPois_.iterator();
+      for (RooAbsArg *a = (RooAbsArg *) iter.Next(); a != 0; a = (RooAbsArg *) iter.Next()) {
+         key += TString::Format("%s=%g,", a->GetName(), saveAll->getRealValue(a->GetName())).Data();
+      }
+      key += "|";
+      RooLinkedListIter itts = fParametersForTestStat->iterator();
+      for (RooAbsArg *a = (RooAbsArg *) itts.Next(); a != 0; a = (RooAbsArg *) itts.Next()) {
+         RooAbsReal *rar = dynamic_cast<RooAbsReal *>(a);
+         if (rar) key += TString::Format("%s=%g,", a->GetName(), rar->getVal()).Data();
+      }
+      if (const toymcoptutils::ToyRecycler::Batch *batch = recycler_->nearest(fPdf->GetName(), *saveAll, recyclerPois_, key)) {
+         double neff = reuseToys_(*batch, *allVars, *saveAll, detOutAgg, toysInTails);
+         nToys = std::max<Int_t>(0, Int_t(std::ceil(fNToys - neff)));
+      }
+      if (fGlobalObservables) { std::auto_ptr<RooArgSet> gobs(fPdf->getObservables(*fGlobalObservables)); recyclerGlobalObs.add(*gobs); }
+      if (fPriorNuisance && fNuisancePars) recyclerNuisances.add(*fNuisancePars);
+      recycler_->newBatch(fPdf->GetName(), *saveAll, recyclerGlobalObs, recyclerNuisances, key);
+   }
+
    for (Int_t i = 0; i < fMaxToys; ++i) {
       // need to check at the beginning for case that zero toys are requested
-      if (toysInTails >= fToysInTails  &&  i+1 > fNToys) break;
+      if (toysInTails >= fToysInTails  &&  i+1 > nToys) break;
 
       // status update
       if ( i% 500 == 0 && i>0 ) {
@@ -547,6 +1058,14 @@ RooDataSet* ToyMCSamplerOpt::GetSamplingDistributionsSingleWorker(RooArgSet& par
       if (RooRealVar* firstTS = dynamic_cast<RooRealVar*>(allTS->first()))
          valueFirst = firstTS->getVal();
 
+      if (recycling && valueFirst == valueFirst) {
+         // the nuisances were restored after the generation: put back those of the toy while it's copied
+         RooArgSet saveNuis; if (!lastNuisances_.empty()) recyclerNuisances.snapshot(saveNuis);
+         for (unsigned int j = 0, n = lastNuisances_.size(); j < n; ++j) ((RooRealVar *) recyclerNuisances.at(j))->setVal(lastNuisances_[j]);
+         recycler_->add(*toydata, recyclerGlobalObs, recyclerNuisances, weight);
+         if (!lastNuisances_.empty()) recyclerNuisances.assignValueOnly(saveNuis);
+      }
+
       delete toydata;
 
       // check for nan
@@ -565,6 +1084,7 @@ RooDataSet* ToyMCSamplerOpt::GetSamplingDistributionsSingleWorker(RooArgSet& par
    }
 
    // clean up
+   currentImportance_ = 0;
    *allVars = *saveAll;
    delete saveAll;
    delete allVars;
@@ -586,16 +1106,28 @@ RooAbsData* ToyMCSamplerOpt::GenerateToyData(RooArgSet& /*nullPOI*/, double& wei
    }
 
    // generate nuisances
+   static bool fastGlobalObs = runtimedef::get("TMCSO_FastGlobalObs");
    RooArgSet saveNuis;
    if(fPriorNuisance && fNuisancePars && fNuisancePars->getSize() > 0) {
-        if (nuisValues_ == 0 || nuisIndex_ == nuisValues_->numEntries()) {
-            delete nuisValues_;
-            nuisValues_ = fPriorNuisance->generate(*fNuisancePars, fNToys);
-            nuisIndex_  = 0;
+        if (fastGlobalObs && nuisSampler_ == 0) nuisSampler_ = new toymcoptutils::ConstraintSampler(*fPriorNuisance, *fNuisancePars);
+        if (nuisSampler_ && nuisSampler_->ok()) {
+            if (nuisIndex_ < 0 || nuisIndex_ == int(nuisSampler_->ntoys())) {
+                nuisSampler_->generate(fNToys);
+                nuisIndex_ = 0;
+            }
+            fNuisancePars->snapshot(saveNuis);
+            nuisSampler_->set(nuisIndex_++);
+            RooArgSet pars(*fNuisancePars); pars = nuisSampler_->vars();
+        } else {
+            if (nuisValues_ == 0 || nuisIndex_ == nuisValues_->numEntries()) {
+                delete nuisValues_;
+                nuisValues_ = fPriorNuisance->generate(*fNuisancePars, fNToys);
+                nuisIndex_  = 0;
+            }
+            fNuisancePars->snapshot(saveNuis);
+            const RooArgSet *values = nuisValues_->get(nuisIndex_++);
+            RooArgSet pars(*fNuisancePars); pars = *values;
         }
-        fNuisancePars->snapshot(saveNuis);
-        const RooArgSet *values = nuisValues_->get(nuisIndex_++);
-        RooArgSet pars(*fNuisancePars); pars = *values;
    }
 
    RooArgSet observables(*fObservables);
@@ -604,66 +1136,81 @@ RooAbsData* ToyMCSamplerOpt::GenerateToyData(RooArgSet& /*nullPOI*/, double& wei
 
       // generate one set of global observables and assign it
       assert(globalObsPdf_);
-      if (globalObsValues_ == 0 || globalObsIndex_ == globalObsValues_->numEntries()) {
-          delete globalObsValues_;
-          globalObsValues_ = (globalObsPdf_ ? globalObsPdf_ : fPdf)->generate(*fGlobalObservables, fNToys);
-          globalObsIndex_  = 0;
-      }
-      const RooArgSet *values = globalObsValues_->get(globalObsIndex_++);
+      if (fastGlobalObs && globalObsSampler_ == 0) globalObsSampler_ = new toymcoptutils::ConstraintSampler(*(globalObsPdf_ ? globalObsPdf_ : fPdf), *fGlobalObservables);
       if (!_allVars) _allVars = fPdf->getObservables(*fGlobalObservables);
-      *_allVars = *values;
+      if (globalObsSampler_ && globalObsSampler_->ok()) {
+          if (globalObsIndex_ < 0 || globalObsIndex_ == int(globalObsSampler_->ntoys())) {
+              globalObsSampler_->generate(fNToys);
+              globalObsIndex_ = 0;
+          }
+          globalObsSampler_->set(globalObsIndex_++);
+          *_allVars = globalObsSampler_->vars();
+      } else {
+          if (globalObsValues_ == 0 || globalObsIndex_ == globalObsValues_->numEntries()) {
+              delete globalObsValues_;
+              globalObsValues_ = (globalObsPdf_ ? globalObsPdf_ : fPdf)->generate(*fGlobalObservables, fNToys);
+              globalObsIndex_  = 0;
+          }
+          const RooArgSet *values = globalObsValues_->get(globalObsIndex_++);
+          *_allVars = *values;
+      }
    }
 
    RooAbsData* data = NULL;
-
-
-#if ROOT_VERSION_CODE <  ROOT_VERSION(5,34,00)
-
-   if(!fImportanceDensity) {
-      // no Importance Sampling
+   if (currentImportance_) {
+      data = GenerateToyDataWithImportanceSampling(observables, weight);
+   } else {
       data = Generate(*fPdf, observables);
-   }else{
-
-      throw std::runtime_error("No importance sampling yet");
-
-      // Importance Sampling
-      RooArgSet* allVars = fPdf->getVariables();
-      RooArgSet* allVars2 = fImportanceDensity->getVariables();
-      allVars->add(*allVars2);
-      const RooArgSet* saveVars = (const RooArgSet*)allVars->snapshot();
-
-      // the number of events generated is either the given fNEvents or
-      // in case this is not given, the expected number of events of
-      // the pdf with a Poisson fluctuation
-      int forceEvents = 0;
-      if(fNEvents == 0) {
-         forceEvents = (int)fPdf->expectedEvents(observables);
-         forceEvents = RooRandom::randomGenerator()->Poisson(forceEvents);
+   }
+
+   if (saveNuis.getSize()) {
+      RooArgList pars(*fNuisancePars);
+      if (recycler_) {
+         lastNuisances_.resize(pars.getSize());
+         for (int i = 0, n = pars.getSize(); i < n; ++i) lastNuisances_[i] = ((RooAbsReal *) pars.at(i))->getVal();
       }
+      pars.assignValueOnly(saveNuis);
+   }
+   return data;
+}
 
-      // need to be careful here not to overwrite the current state of the
-      // nuisance parameters, ie they must not be part of the snapshot
-      if(fImportanceSnapshot) *allVars = *fImportanceSnapshot;
 
-      // generate with the parameters configured in this class
-      //   NULL => no protoData
-      //   overwriteEvents => replaces fNEvents it would usually take
-      data = Generate(*fImportanceDensity, observables, NULL, forceEvents);
+RooAbsData* ToyMCSamplerOpt::GenerateToyDataWithImportanceSampling(RooArgSet& observables, double& weight) const {
+   ImportanceDensity &d = *currentImportance_;
+   std::auto_ptr<RooArgSet> vars(d.pdf->getVariables()), pointVars(fPdf->getVariables());
+   vars->add(*pointVars, true);
+   RooArgSet saveVars; vars->snapshot(saveVars);
 
-      *allVars = *saveVars;
-      delete allVars;
-      delete allVars2;
-      delete saveVars;
+   // throw the toy from the mixture of the point itself and of the importance density
+   RooAbsData *data = 0;
+   if (RooRandom::uniform() < d.fraction) {
+      *vars = *d.density;
+      data = Generate(*d.pdf, observables);
+      *vars = saveVars;
+   } else {
+      data = Generate(*fPdf, observables);
    }
-#else
-   // no Importance Sampling defined in ToyMCSampler of 5.34
-   data = Generate(*fPdf, observables);
-#endif   
 
-   if (saveNuis.getSize()) { RooArgSet pars(*fNuisancePars); pars = saveNuis; }
+   // weight = L(point)/[(1-f) L(point) + f L(density)], with the same nuisances and global observables for both
+   double nllPoint = importanceNll_(*fPdf, *data, d.nllPoint);
+   *vars = *d.density;
+   double nllDensity = importanceNll_(*d.pdf, *data, d.nllDensity);
+   *vars = saveVars;
+   weight = 1.0/((1.0 - d.fraction) + d.fraction * std::exp(nllPoint - nllDensity));
    return data;
 }
 
+double 
+ToyMCSamplerOpt::importanceNll_(RooAbsPdf &pdf, RooAbsData &data, RooAbsReal *&nll) const 
+{
+   if (nll != 0 && typeid(pdf) == typeid(RooSimultaneousOpt)) {
+      ((cacheutils::CachingSimNLL&)(*nll)).setData(data);
+   } else {
+      delete nll;
+      nll = pdf.createNLL(data, RooFit::Extended(pdf.canBeExtended()));
+   }
+   return nll->getVal();
+}
 
 RooAbsData *  
 ToyMCSamplerOpt::Generate(RooAbsPdf& pdf, RooArgSet& observables, const RooDataSet* protoData, int forceEvents) const 
@@ -674,7 +1221,12 @@ ToyMCSamplerOpt::Generate(RooAbsPdf& pdf, RooArgSet& observables, const RooDataS
    if (info == 0) { 
        info = new toymcoptutils::SimPdfGenInfo(pdf, observables, fGenerateBinned, protoData, forceEvents);
        info->setCopyData(false);
-       if (!fPriorNuisance && importanceSnapshots_.empty()) info->setCacheTemplates(true);
+       if (!fPriorNuisance && importanceDensities_.empty()) {
+           info->setCacheTemplates(true);
+           // the templates don't change, so the toys can also be thrown in batches (by default, all of them at once)
+           static int batchSize = runtimedef::get("TMCSO_GenBatch");
+           if (batchSize) info->setBatchSize(batchSize > 1 ? batchSize : fNToys);
+       }
    }
    return info->generate(weightVar_, protoData, forceEvents);
 }
@@ -0,0 +1,285 @@
+#include "HiggsAnalysis/CombinedLimit/interface/ToyResultStore.h"
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <TString.h>
+#include <RooAbsCollection.h>
+#include <RooAbsReal.h>
+#include <RooStats/HypoTestResult.h>
+#include <RooStats/SamplingDistribution.h>
+
+namespace {
+    const unsigned int kBlockMagic = 0x31535443; // "CTS1"
+    enum { kRightTail = 1, kBackgroundIsAlt = 2 };
+
+    template<typename T> void put(std::vector<char> &buff, const T &x) {
+        const char *p = reinterpret_cast<const char *>(&x);
+        buff.insert(buff.end(), p, p + sizeof(T));
+    }
+    template<typename T> bool get(FILE *f, T &x) { return fread(&x, sizeof(T), 1, f) == 1; }
+    /// FNV-1a, continuing from hash
+    uint64_t fnv1a(const void *data, size_t n, uint64_t hash = 14695981039346656037ULL) {
+        const unsigned char *p = static_cast<const unsigned char *>(data);
+        for (size_t i = 0; i < n; ++i) { hash ^= p[i]; hash *= 1099511628211ULL; }
+        return hash;
+    }
+}
+
+ToyResultStore::ToyResultStore(const std::string &fileName) :
+    fileName_(fileName),
+    indexedBytes_(0)
+{
+}
+
+bool ToyResultStore::sameValue_(double a, double b) {
+    return a == b || TString::Format("%g", a) == TString::Format("%g", b);
+}
+
+void ToyResultStore::append(double mass, const RooAbsCollection &pois, const RooStats::HypoTestResult &result) const {
+    std::vector<char> buff;
+    serialize(mass, pois, result, buff);
+    appendBlock(buff);
+}
+
+void ToyResultStore::serialize(double mass, const RooAbsCollection &pois, const RooStats::HypoTestResult &result, std::vector<char> &buff) {
+    std::string names; std::vector<double> values;
+    RooLinkedListIter it = pois.iterator();
+    for (RooAbsReal *rIn = (RooAbsReal*) it.Next(); rIn != 0; rIn = (RooAbsReal*) it.Next()) {
+        if (!names.empty()) names += ",";
+        names += rIn->GetName();
+        values.push_back(rIn->getVal());
+    }
+    const RooStats::SamplingDistribution *null = result.GetNullDistribution(), *alt = result.GetAltDistribution();
+    buff.clear();
+    putHeader_(buff, mass, names, values, null ? null->GetSize() : 0, alt ? alt->GetSize() : 0, result.GetTestStatisticData(),
+               result.GetPValueIsRightTail(), result.GetBackGroundIsAlt());
+    // the columns: values and weights of the null toys, then of the alternate ones
+    const RooStats::SamplingDistribution *dists[2] = { null, alt };
+    for (int id = 0; id < 2; ++id) {
+        if (dists[id] == 0) continue;
+        const std::vector<Double_t> &vals = dists[id]->GetSamplingDistribution(), &weights = dists[id]->GetSampleWeights();
+        for (int i = 0, n = vals.size(); i < n; ++i) put(buff, double(vals[i]));
+        for (int i = 0, n = vals.size(); i < n; ++i) put(buff, double(i < int(weights.size()) ? weights[i] : 1.0));
+    }
+}
+
+void ToyResultStore::putHeader_(std::vector<char> &buff, double mass, const std::string &names, const std::vector<double> &values, int nNull, int nAlt, double tsData, bool rightTail, bool backgroundIsAlt) {
+    put(buff, kBlockMagic);
+    put(buff, mass);
+    put(buff, (unsigned int) names.size());
+    buff.insert(buff.end(), names.begin(), names.end());
+    put(buff, (unsigned int) values.size());
+    for (double v : values) put(buff, v);
+    put(buff, nNull);
+    put(buff, nAlt);
+    put(buff, tsData);
+    unsigned char flags = (rightTail ? kRightTail : 0) | (backgroundIsAlt ? kBackgroundIsAlt : 0);
+    put(buff, flags);
+}
+
+void ToyResultStore::appendBlock(const std::vector<char> &buff) const {
+    unsigned int magic = 0;
+    if (buff.size() >= sizeof(magic)) memcpy(&magic, &buff[0], sizeof(magic));
+    if (magic != kBlockMagic) {
+        throw std::invalid_argument("ToyResultStore: not a block of toys, can't append it to "+fileName_);
+    }
+    // one write at the end of the file, so that blocks from different jobs don't get mixed
+    int fd = open(fileName_.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd == -1) throw std::runtime_error("ToyResultStore: can't open "+fileName_+" for writing");
+    const char *p = &buff[0]; size_t left = buff.size();
+    while (left > 0) {
+        ssize_t written = write(fd, p, left);
+        if (written == -1 && errno == EINTR) continue;
+        if (written <= 0) { close(fd); throw std::runtime_error("ToyResultStore: failed to write to "+fileName_); }
+        p += written; left -= written;
+    }
+    close(fd);
+}
+
+void ToyResultStore::updateIndex_() const {
+    FILE *f = fopen(fileName_.c_str(), "rb");
+    if (f == 0) return; // nothing stored yet
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, indexedBytes_, SEEK_SET);
+    while (indexedBytes_ < size) {
+        Block b; unsigned int magic, len, npoi; unsigned char flags;
+        if (!get(f, magic)) break;
+        if (magic != kBlockMagic) {
+            fclose(f);
+            throw std::runtime_error(TString::Format("ToyResultStore: corrupted file %s at byte %ld", fileName_.c_str(), indexedBytes_).Data());
+        }
+        if (!get(f, b.mass) || !get(f, len)) break;
+        b.poiNames.resize(len);
+        if (len > 0 && fread(&b.poiNames[0], 1, len, f) != len) break;
+        if (!get(f, npoi)) break;
+        b.poiValues.resize(npoi);
+        if (npoi > 0 && fread(&b.poiValues[0], sizeof(double), npoi, f) != npoi) break;
+        if (!get(f, b.nNull) || !get(f, b.nAlt) || !get(f, b.tsData) || !get(f, flags)) break;
+        b.rightTail = (flags & kRightTail);
+        b.backgroundIsAlt = (flags & kBackgroundIsAlt);
+        b.offset = ftell(f);
+        long end = b.offset + 2 * sizeof(double) * long(b.nNull + b.nAlt);
+        // a block that is still being written, or was truncated, is ignored until it's complete
+        if (end > size) break;
+        index_.push_back(b);
+        indexedBytes_ = end;
+        fseek(f, end, SEEK_SET);
+    }
+    fclose(f);
+}
+
+RooStats::HypoTestResult *ToyResultStore::merge_(const std::vector<const Block *> &blocks) const {
+    if (blocks.empty()) return 0;
+    FILE *f = fopen(fileName_.c_str(), "rb");
+    if (f == 0) throw std::runtime_error("ToyResultStore: can't open "+fileName_);
+    std::vector<Double_t> nullVals, nullWeights, altVals, altWeights;
+    std::vector<double> column;
+    for (const Block *b : blocks) {
+        fseek(f, b->offset, SEEK_SET);
+        int sizes[2] = { b->nNull, b->nAlt };
+        std::vector<Double_t> *dest[4] = { &nullVals, &nullWeights, &altVals, &altWeights };
+        for (int ic = 0; ic < 4; ++ic) {
+            int n = sizes[ic/2];
+            column.resize(n);
+            if (n > 0 && fread(&column[0], sizeof(double), n, f) != size_t(n)) {
+                fclose(f);
+                throw std::runtime_error("ToyResultStore: failed to read from "+fileName_);
+            }
+            dest[ic]->insert(dest[ic]->end(), column.begin(), column.end());
+        }
+    }
+    fclose(f);
+    // as for HypoTestResult::Append, the test statistic on data and the flags are those of the first block
+    const Block &first = *blocks.front();
+    RooStats::HypoTestResult *ret = new RooStats::HypoTestResult();
+    ret->SetPValueIsRightTail(first.rightTail);
+    ret->SetBackgroundAsAlt(first.backgroundIsAlt);
+    ret->SetTestStatisticData(first.tsData);
+    ret->SetNullDistribution(new RooStats::SamplingDistribution("b", "b", nullVals, nullWeights));
+    ret->SetAltDistribution(new RooStats::SamplingDistribution("sb", "sb", altVals, altWeights));
+    return ret;
+}
+
+RooStats::HypoTestResult *ToyResultStore::read(double mass, const RooAbsCollection &pois) const {
+    updateIndex_();
+    std::string names; std::vector<double> values;
+    RooLinkedListIter it = pois.iterator();
+    for (RooAbsReal *rIn = (RooAbsReal*) it.Next(); rIn != 0; rIn = (RooAbsReal*) it.Next()) {
+        if (!names.empty()) names += ",";
+        names += rIn->GetName();
+        values.push_back(rIn->getVal());
+    }
+    std::vector<const Block *> found;
+    for (const Block &b : index_) {
+        if (!sameValue_(b.mass, mass) || b.poiNames != names) continue;
+        bool same = true;
+        for (unsigned int i = 0, n = values.size(); i < n && same; ++i) same = sameValue_(b.poiValues[i], values[i]);
+        if (same) found.push_back(&b);
+    }
+    return merge_(found);
+}
+
+void ToyResultStore::readGrid(double mass, const std::string &poiName, double rMin, double rMax, std::map<double, RooStats::HypoTestResult *> &grid) const {
+    updateIndex_();
+    // group the blocks by point, with the value as written in the names of the HypoTestResults
+    std::map<double, std::vector<const Block *> > points;
+    for (const Block &b : index_) {
+        if (!sameValue_(b.mass, mass) || b.poiNames != poiName) continue;
+        double rVal = atof(TString::Format("%g", b.poiValues[0]).Data());
+        if (rVal < rMin || rVal > rMax) continue;
+        points[rVal].push_back(&b);
+    }
+    for (std::map<double, std::vector<const Block *> >::const_iterator it = points.begin(), ed = points.end(); it != ed; ++it) {
+        RooStats::HypoTestResult *&merge = grid[it->first];
+        std::auto_ptr<RooStats::HypoTestResult> res(merge_(it->second));
+        if (merge == 0) merge = res.release();
+        else merge->Append(res.get());
+    }
+}
+
+bool ToyResultStore::isStore(const std::string &fileName) {
+    FILE *f = fopen(fileName.c_str(), "rb");
+    if (f == 0) return false;
+    unsigned int magic = 0;
+    bool ret = get(f, magic) && magic == kBlockMagic;
+    fclose(f);
+    return ret;
+}
+
+unsigned int ToyResultStore::compact(const std::vector<std::string> &inputs, const ToyResultStore &out) {
+    std::vector<ToyResultStore> stores;
+    for (const std::string &in : inputs) {
+        if (in == out.fileName_) throw std::invalid_argument("ToyResultStore: can't compact "+in+" into itself");
+        stores.push_back(ToyResultStore(in));
+        stores.back().updateIndex_();
+    }
+    // group the blocks by point, with the values as written in the names of the HypoTestResults, in the order in which the points appear
+    typedef std::pair<unsigned int, const Block *> Ref; // store, block
+    std::map<std::string, unsigned int> pointIndex;
+    std::vector<std::vector<Ref> > points;
+    for (unsigned int i = 0, n = stores.size(); i < n; ++i) {
+        for (const Block &b : stores[i].index_) {
+            TString key = TString::Format("%g:%s", b.mass, b.poiNames.c_str());
+            for (double v : b.poiValues) key += TString::Format(":%g", v);
+            std::map<std::string, unsigned int>::iterator it = pointIndex.find(key.Data());
+            if (it == pointIndex.end()) {
+                it = pointIndex.insert(std::make_pair(std::string(key.Data()), (unsigned int) points.size())).first;
+                points.push_back(std::vector<Ref>());
+            }
+            points[it->second].push_back(Ref(i, &b));
+        }
+    }
+    struct Files {
+        std::vector<FILE *> f;
+        ~Files() { for (FILE *x : f) if (x) fclose(x); }
+    } files;
+    files.f.resize(stores.size(), 0);
+    unsigned int skipped = 0;
+    std::vector<double> columns[4], block;
+    std::vector<char> buff;
+    for (const std::vector<Ref> &point : points) {
+        std::set<uint64_t> seen;
+        for (int ic = 0; ic < 4; ++ic) columns[ic].clear();
+        for (const Ref &ref : point) {
+            const Block &b = *ref.second;
+            FILE *&f = files.f[ref.first];
+            if (f == 0 && (f = fopen(stores[ref.first].fileName_.c_str(), "rb")) == 0) {
+                throw std::runtime_error("ToyResultStore: can't open "+stores[ref.first].fileName_);
+            }
+            size_t n = 2 * size_t(b.nNull + b.nAlt);
+            block.resize(n);
+            fseek(f, b.offset, SEEK_SET);
+            if (n > 0 && fread(&block[0], sizeof(double), n, f) != n) {
+                throw std::runtime_error("ToyResultStore: failed to read from "+stores[ref.first].fileName_);
+            }
+            // the same toys (e.g. from the same seed) give the same sizes, test statistic on data and columns
+            int sizes[2] = { b.nNull, b.nAlt };
+            uint64_t hash = fnv1a(sizes, sizeof(sizes));
+            hash = fnv1a(&b.tsData, sizeof(double), hash);
+            if (n > 0) hash = fnv1a(&block[0], n * sizeof(double), hash);
+            if (!seen.insert(hash).second) { ++skipped; continue; }
+            const double *p = n > 0 ? &block[0] : 0;
+            for (int ic = 0; ic < 4; ++ic) {
+                columns[ic].insert(columns[ic].end(), p, p + sizes[ic/2]);
+                p += sizes[ic/2];
+            }
+        }
+        // as in merge_, the test statistic on data and the flags are those of the first block
+        const Block &first = *point.front().second;
+        buff.clear();
+        putHeader_(buff, first.mass, first.poiNames, first.poiValues, columns[0].size(), columns[2].size(), first.tsData, first.rightTail, first.backgroundIsAlt);
+        for (int ic = 0; ic < 4; ++ic) {
+            for (double x : columns[ic]) put(buff, x);
+        }
+        out.appendBlock(buff);
+    }
+    return skipped;
+}
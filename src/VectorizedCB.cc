@@ -2,10 +2,12 @@
 #include "RooMath.h"
 #include "vectorized.h"
 #include "HiggsAnalysis/CombinedLimit/interface/ProfilingTools.h"
+#include "HiggsAnalysis/CombinedLimit/interface/DataColumns.h"
 #include <RooRealVar.h>
 #include <stdexcept>
 
-VectorizedCBShape::VectorizedCBShape(const RooCBShape &gaus, const RooAbsData &data, bool includeZeroWeights)
+VectorizedCBShape::VectorizedCBShape(const RooCBShape &gaus, const RooAbsData &data, bool includeZeroWeights) :
+    coreMean_(0), coreSigma_(0), coreValid_(false)
 {
     RooArgSet obs(*data.get());
     if (obs.getSize() != 1) throw std::invalid_argument("Multi-dimensional dataset?");
@@ -22,11 +24,7 @@ VectorizedCBShape::VectorizedCBShape(const RooCBShape &gaus, const RooAbsData &d
     alpha_ = & w.alphavar();
     sigma_ = & w.sigmavar();
 
-    xvals_.reserve(data.numEntries());
-    for (unsigned int i = 0, n = data.numEntries(); i < n; ++i) {
-        obs.assignValueOnly(*data.get(i), true);
-        if (data.weight() || includeZeroWeights) xvals_.push_back(x->getVal());        
-    }
+    cacheutils::DataColumns::fill(data, x->GetName(), includeZeroWeights, xvals_);
     work1_.resize(xvals_.size());
     work2_.resize(xvals_.size());
     bool sorted = std::is_sorted(xvals_.begin(), xvals_.end());
@@ -50,6 +48,12 @@ VectorizedCBShape::VectorizedCBShape(const RooCBShape &gaus, const RooAbsData &d
         case 4:
             mode_ = FastPreSort;
             break;
+        case 5:
+            mode_ = FastBranchless;
+            break;
+        case 6:
+            mode_ = Branchless;
+            break;
 
     }
     if (sigma_->getVal() < 0) {
@@ -81,7 +85,9 @@ void VectorizedCBShape::fill(std::vector<Double_t> &out) const {
     out.resize(xvals_.size());
     unsigned int n = xvals_.size();
 
-    if (hasSort()) {
+    if (hasBranchless()) {
+        fillBranchless(out, norm);
+    } else if (hasSort()) {
         const std::vector<Double_t> & x = (hasPreSort() ? xsorted_ : xvals_);
         // t = (x-mean)*invw
         // and then check if t > -alpha1
@@ -134,6 +140,44 @@ void VectorizedCBShape::fill(std::vector<Double_t> &out) const {
     }
 }
 
+void VectorizedCBShape::fillBranchless(std::vector<Double_t> &out, double norm) const {
+    double mean  = m0_->getVal();
+    double sigma = sigma_->getVal(), invw = 1/sigma;
+    double alpha1 = alpha_->getVal();
+    double n1 = n_->getVal();
+    double alpha1invn1 = alpha1/n1, tailExp = -0.5*alpha1*alpha1;
+    unsigned int n = xvals_.size();
+    double * __restrict__ t = &work1_[0];
+    double * __restrict__ w = &work2_[0];
+    double * __restrict__ o = &out[0];
+    if (!coreValid_ || mean != coreMean_ || sigma != coreSigma_) {
+        core_.resize(n);
+        for (unsigned int i = 0; i < n; ++i) {
+            t[i] = (xvals_[i]-mean)*invw;
+            w[i] = -0.5*t[i]*t[i];
+        }
+        if (hasFast()) vdt::fast_expv(n, w, &core_[0]);
+        else           vdt::expv(n, w, &core_[0]);
+        coreMean_ = mean; coreSigma_ = sigma; coreValid_ = true;
+    }
+    // tail: exp(-alpha^2/2 - n log(1 - alpha/n (alpha+t))), with the argument of the log set to 1 for the events in the core
+    for (unsigned int i = 0; i < n; ++i) {
+        double u = 1. - alpha1invn1*(alpha1+t[i]);
+        w[i] = (t[i] > -alpha1 ? 1.0 : u);
+    }
+    if (hasFast()) vdt::fast_logv(n, w, o);
+    else           vdt::logv(n, w, o);
+    for (unsigned int i = 0; i < n; ++i) {
+        o[i] = tailExp - n1*o[i];
+    }
+    if (hasFast()) vdt::fast_expv(n, o, w);
+    else           vdt::expv(n, o, w);
+    const double * __restrict__ core = &core_[0];
+    for (unsigned int i = 0; i < n; ++i) {
+        o[i] = norm * (t[i] > -alpha1 ? core[i] : w[i]);
+    }
+}
+
 double VectorizedCBShape::getIntegral() const {
     double central=0;
     double left=0;
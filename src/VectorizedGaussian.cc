@@ -1,4 +1,5 @@
 #include "HiggsAnalysis/CombinedLimit/interface/VectorizedGaussian.h"
+#include "HiggsAnalysis/CombinedLimit/interface/DataColumns.h"
 #include "RooMath.h"
 #include "vectorized.h"
 #include <RooRealVar.h>
@@ -23,11 +24,7 @@ VectorizedGaussian::VectorizedGaussian(const RooGaussian &gaus, const RooAbsData
         throw std::invalid_argument("Dataset is not the mean or x of the gaussian");
     }
 
-    xvals_.reserve(data.numEntries());
-    for (unsigned int i = 0, n = data.numEntries(); i < n; ++i) {
-        obs.assignValueOnly(*data.get(i), true);
-        if (data.weight() || includeZeroWeights) xvals_.push_back(x->getVal());        
-    }
+    cacheutils::DataColumns::fill(data, x->GetName(), includeZeroWeights, xvals_);
     work_.resize(xvals_.size());
     work2_.resize(xvals_.size());
 }
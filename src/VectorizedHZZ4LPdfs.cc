@@ -0,0 +1,167 @@
+#include "HiggsAnalysis/CombinedLimit/interface/VectorizedHZZ4LPdfs.h"
+#include "HiggsAnalysis/CombinedLimit/interface/HZZ4L_RooSpinZeroPdf.h"
+#include "HiggsAnalysis/CombinedLimit/interface/HZZ4L_RooSpinZeroPdf_2D.h"
+#include "HiggsAnalysis/CombinedLimit/interface/HZZ4L_RooSpinZeroPdf_phase.h"
+#include "HiggsAnalysis/CombinedLimit/interface/HZZ4LRooPdfs.h"
+#include "HiggsAnalysis/CombinedLimit/interface/DataColumns.h"
+#include "vectorized.h"
+#include <RooHistFunc.h>
+#include <stdexcept>
+#include <memory>
+#include <cmath>
+#include <RooRealVar.h>
+
+template<typename PdfT>
+VectorizedHZZ4LSpinZeroPdf<PdfT>::VectorizedHZZ4LSpinZeroPdf(const PdfT &pdf, const RooAbsData &data, bool includeZeroWeights) :
+    pdf_(&pdf)
+{
+    // the analytical integral of these pdfs is only defined over all the three observables
+    std::auto_ptr<RooArgSet> obs(pdf.getObservables(data));
+    if (obs->getSize() != 3) {
+        throw std::invalid_argument(std::string("HZZ4L spin-zero pdf ")+pdf.GetName()+" is not normalized over its three observables: if this is intended, set --X-rtd ADDNLL_HZZNLL=0 to disable its vectorization in NLL.");
+    }
+
+    const RooArgList &coefs = pdf.coefList();
+    unsigned int ntemplates = coefs.getSize();
+    templates_.resize(ntemplates);
+    integrals_.resize(ntemplates);
+    std::vector<const RooHistFunc *> funcs(ntemplates);
+    for (unsigned int j = 0; j < ntemplates; ++j) {
+        funcs[j] = dynamic_cast<const RooHistFunc *>(coefs.at(j));
+        if (funcs[j] == 0) throw std::invalid_argument(std::string("Template ")+coefs.at(j)->GetName()+" of "+pdf.GetName()+" is not a RooHistFunc");
+        integrals_[j] = funcs[j]->analyticalIntegral(1000);
+        templates_[j].reserve(data.numEntries());
+    }
+
+    // the templates are attached to the dataset, so it's enough to load each entry
+    for (unsigned int i = 0, n = data.numEntries(); i < n; ++i) {
+        data.get(i);
+        if (data.weight() || includeZeroWeights) {
+            for (unsigned int j = 0; j < ntemplates; ++j) templates_[j].push_back(funcs[j]->getVal());
+        }
+    }
+}
+
+template<typename PdfT>
+void VectorizedHZZ4LSpinZeroPdf<PdfT>::fill(std::vector<Double_t> &out) const {
+    pdf_->templateCoefficients(coeffs_);
+    unsigned int size = templates_.empty() ? 0 : templates_.front().size();
+    double norm = 0;
+    out.assign(size, 0.);
+    if (size == 0) return;
+    for (unsigned int j = 0, n = coeffs_.size(); j < n; ++j) {
+        if (coeffs_[j] == 0) continue;
+        vectorized::mul_add(size, coeffs_[j], &templates_[j][0], &out[0]);
+        norm += coeffs_[j] * integrals_[j];
+    }
+    // same as evaluate(), i.e. floor at 1e-200 before normalizing
+    for (unsigned int i = 0; i < size; ++i) {
+        out[i] = (out[i] <= 0. ? 1.0e-200 : out[i]) / norm;
+    }
+}
+
+template class VectorizedHZZ4LSpinZeroPdf<HZZ4L_RooSpinZeroPdf>;
+template class VectorizedHZZ4LSpinZeroPdf<HZZ4L_RooSpinZeroPdf_2D>;
+template class VectorizedHZZ4LSpinZeroPdf<HZZ4L_RooSpinZeroPdf_phase>;
+
+namespace {
+    /// access to the proxies of the ZZ continuum pdfs: the observable, and the parameters in order
+    class qqZZWorker : public RooqqZZPdf_v2 {
+        public:
+            qqZZWorker(const RooqqZZPdf_v2 &pdf) : RooqqZZPdf_v2(pdf, "") {}
+            const RooAbsReal & xvar() const { return m4l.arg(); }
+            std::vector<const RooAbsReal *> params() const { 
+                const RooRealProxy *ps[14] = { &a0, &a1, &a2, &a3, &a4, &a5, &a6, &a7, &a8, &a9, &a10, &a11, &a12, &a13 };
+                std::vector<const RooAbsReal *> ret;
+                for (const RooRealProxy *p : ps) ret.push_back(&p->arg());
+                return ret;
+            }
+    };
+    class ggZZWorker : public RooggZZPdf_v2 {
+        public:
+            ggZZWorker(const RooggZZPdf_v2 &pdf) : RooggZZPdf_v2(pdf, "") {}
+            const RooAbsReal & xvar() const { return m4l.arg(); }
+            std::vector<const RooAbsReal *> params() const { 
+                const RooRealProxy *ps[10] = { &a0, &a1, &a2, &a3, &a4, &a5, &a6, &a7, &a8, &a9 };
+                std::vector<const RooAbsReal *> ret;
+                for (const RooRealProxy *p : ps) ret.push_back(&p->arg());
+                return ret;
+            }
+    };
+    template<typename PdfT> struct ZZWorker;
+    template<> struct ZZWorker<RooqqZZPdf_v2> { typedef qqZZWorker type; };
+    template<> struct ZZWorker<RooggZZPdf_v2> { typedef ggZZWorker type; };
+}
+
+template<typename PdfT>
+VectorizedZZContinuumPdf<PdfT>::VectorizedZZContinuumPdf(const PdfT &pdf, const RooAbsData &data, bool includeZeroWeights) :
+    pdf_(&pdf),
+    obs_(data.get())
+{
+    typename ZZWorker<PdfT>::type w(pdf);
+    const RooRealVar *x = dynamic_cast<const RooRealVar *>(data.get()->find(w.xvar().GetName()));
+    if (x == 0 || data.get()->getSize() != 1) {
+        throw std::invalid_argument(std::string("ZZ continuum pdf ")+pdf.GetName()+" is not a function of the only observable of the dataset: if this is intended, set --X-rtd ADDNLL_HZZNLL=0 to disable its vectorization in NLL.");
+    }
+    params_ = w.params();
+    cacheutils::DataColumns::fill(data, x->GetName(), includeZeroWeights, xvals_);
+    work1_.resize(xvals_.size());
+    work2_.resize(xvals_.size());
+    work3_.resize(xvals_.size());
+}
+
+template<typename PdfT>
+void VectorizedZZContinuumPdf<PdfT>::addTerm_(unsigned int size, double a, double b, const double *c, const double *d, unsigned int nk, double *out) const {
+    const double *x = &xvals_[0];
+    double * __restrict__ t = &work1_[0];
+    double * __restrict__ arg = &work2_[0];
+    double * __restrict__ e = &work3_[0];
+    // the sum of the logistic functions in t, then the erf factor
+    for (unsigned int i = 0; i < size; ++i) t[i] = 0;
+    for (unsigned int k = 0; k < nk; ++k) {
+        double invd = 1.0/d[k];
+        for (unsigned int i = 0; i < size; ++i) arg[i] = (x[i]-a)*invd;
+        vdt::expv(size, arg, e);
+        for (unsigned int i = 0; i < size; ++i) t[i] += c[k]/(1+e[i]);
+    }
+    double invb = 1.0/b;
+    for (unsigned int i = 0; i < size; ++i) {
+        out[i] += (.5+.5*std::erf((x[i]-a)*invb)) * t[i];
+    }
+}
+
+template<typename PdfT>
+double VectorizedZZContinuumPdf<PdfT>::normalization_() const {
+    pars_.resize(params_.size());
+    for (unsigned int j = 0, n = params_.size(); j < n; ++j) pars_[j] = params_[j]->getVal();
+    for (unsigned int i = 0, n = normCache_.size(); i < n; ++i) {
+        if (normCache_[i].first == pars_) {
+            if (i > 0) std::rotate(normCache_.begin(), normCache_.begin() + i, normCache_.begin() + i + 1);
+            return normCache_.front().second;
+        }
+    }
+    double norm = pdf_->getNorm(obs_);
+    if (normCache_.size() < NormCacheSize) normCache_.push_back(std::make_pair(pars_, norm));
+    else normCache_.back() = std::make_pair(pars_, norm);
+    std::rotate(normCache_.begin(), normCache_.end() - 1, normCache_.end());
+    return norm;
+}
+
+template<typename PdfT>
+void VectorizedZZContinuumPdf<PdfT>::fill(std::vector<Double_t> &out) const {
+    unsigned int size = xvals_.size();
+    out.assign(size, 0.);
+    if (size == 0) return;
+    double a[14];
+    for (unsigned int j = 0, n = params_.size(); j < n; ++j) a[j] = params_[j]->getVal();
+    // same terms as in RooqqZZPdf_v2::evaluate and RooggZZPdf_v2::evaluate
+    addTerm_(size, a[0], a[1], &a[3], &a[2], 1, &out[0]);
+    double c2[2] = { a[7], a[9] }, d2[2] = { a[6], a[8] };
+    addTerm_(size, a[4], a[5], c2, d2, 2, &out[0]);
+    if (params_.size() == 14) addTerm_(size, a[10], a[11], &a[13], &a[12], 1, &out[0]);
+    double invNorm = 1.0/normalization_();
+    for (unsigned int i = 0; i < size; ++i) out[i] *= invNorm;
+}
+
+template class VectorizedZZContinuumPdf<RooqqZZPdf_v2>;
+template class VectorizedZZContinuumPdf<RooggZZPdf_v2>;
@@ -1,6 +1,9 @@
 #include "HiggsAnalysis/CombinedLimit/interface/VectorizedHistFactoryPdfs.h"
 #include <memory>
 #include <RooRealVar.h>
+#include <map>
+#include "vectorized.h"
+#include "HiggsAnalysis/CombinedLimit/interface/ProfilingTools.h"
 
 cacheutils::VectorizedHistFunc::VectorizedHistFunc(const RooHistFunc &pdf, bool includeZeroWeights) :
     pdf_(&pdf), data_(0), includeZeroWeights_(includeZeroWeights)
@@ -63,25 +66,73 @@ cacheutils::VectorizedParamHistFunc::VectorizedParamHistFunc(const ParamHistFunc
     
 {
     RooArgSet obs(*data.get());
-    yvars_.reserve(data.numEntries());
+    std::map<const RooRealVar *, uint32_t> indices;
+    index_.reserve(data.numEntries());
     for (unsigned int i = 0, n = data.numEntries(); i < n; ++i) {
         obs.assignValueOnly(*data.get(i), true);
         if (data.weight() || includeZeroWeights) {
-            RooRealVar * rrv = & pdf.getParameter();
-            yvars_.push_back(rrv);        
+            const RooRealVar * rrv = & pdf.getParameter();
+            std::map<const RooRealVar *, uint32_t>::const_iterator match = indices.find(rrv);
+            if (match == indices.end()) {
+                match = indices.insert(std::make_pair(rrv, uint32_t(yvars_.size()))).first;
+                yvars_.push_back(rrv);
+            }
+            index_.push_back(match->second);
         }
     }
+    yvals_.resize(yvars_.size());
 }
 
-void 
-cacheutils::VectorizedParamHistFunc::fill(std::vector<Double_t> &out) const 
+void
+cacheutils::VectorizedParamHistFunc::readValues_() const
 {
-    out.resize(yvars_.size());
     for (unsigned int i = 0, n = yvars_.size(); i < n; ++i) {
-        out[i] = yvars_[i]->getVal();
+        yvals_[i] = yvars_[i]->getVal();
     }
 }
 
+void 
+cacheutils::VectorizedParamHistFunc::fill(std::vector<Double_t> &out) const 
+{
+    readValues_();
+    out.resize(index_.size());
+    if (!index_.empty()) vectorized::gather(index_.size(), &index_[0], &yvals_[0], &out[0]);
+}
+
+void 
+cacheutils::VectorizedParamHistFunc::multiply(std::vector<Double_t> &out) const 
+{
+    readValues_();
+    if (!index_.empty()) vectorized::gather_mul(index_.size(), &index_[0], &yvals_[0], &out[0]);
+}
+
+void
+cacheutils::CachingParamHistFunc::newData_(const RooAbsData &data)
+{
+    CachingPdf::newData_(data);
+    vpdf_.reset(new VectorizedParamHistFunc(static_cast<const ParamHistFunc &>(*pdf_), data, includeZeroWeights_));
+}
+
+void
+cacheutils::CachingParamHistFunc::realFill_(const RooAbsData &data, std::vector<Double_t> &vals)
+{
+    vpdf_->fill(vals);
+}
+
+unsigned int
+cacheutils::CachingParamHistFunc::size(const RooAbsData &data)
+{
+    if (lastData_ != &data) newData_(data);
+    return vpdf_->size();
+}
+
+void
+cacheutils::CachingParamHistFunc::multiply(const RooAbsData &data, std::vector<Double_t> &out)
+{
+    if (lastData_ != &data) newData_(data);
+    vpdf_->multiply(out);
+}
+
 namespace {
     class PiecewiseInterpolationWithAccessor : public PiecewiseInterpolation {
         public:
@@ -94,7 +145,11 @@ namespace {
 }
 
 cacheutils::CachingPiecewiseInterpolation::CachingPiecewiseInterpolation(const PiecewiseInterpolation &pdf, const RooArgSet &obs) :
-    pdf_(&pdf)
+    pdf_(&pdf),
+    constantTemplates_(true),
+    diffData_(0),
+    additive_(true),
+    sumUpdates_(-1)
 {
     PiecewiseInterpolationWithAccessor fixme(pdf);
     const RooArgList & highList  = pdf.highList();
@@ -115,7 +170,12 @@ cacheutils::CachingPiecewiseInterpolation::CachingPiecewiseInterpolation(const P
         //std::cout << "      PiecewiseInterpolation Adding " << pdf.GetName() << "[" << i << "] Hi    : " << pdfiHi->ClassName() << " " << pdfiHi->GetName() << " using " << typeid(cachingPdfsHi_.back()).name() << std::endl;
         //std::cout << "      PiecewiseInterpolation Adding " << pdf.GetName() << "[" << i << "] Coeff : " << coeffs_.back()->ClassName() << " " << coeffs_.back()->GetName()  << std::endl;
         //std::cout << "      PiecewiseInterpolation Adding " << pdf.GetName() << "[" << i << "] Code  : " << codes_.back()  << std::endl;
+        if (codes_.back() != 0 && codes_.back() != 4) additive_ = false;
+        std::auto_ptr<RooArgSet> paramsHi(pdfiHi->getParameters(obs)), paramsLo(pdfiLo->getParameters(obs));
+        if (paramsHi->getSize() || paramsLo->getSize()) constantTemplates_ = false;
     }
+    std::auto_ptr<RooArgSet> paramsNominal(nominal.getParameters(obs));
+    if (paramsNominal->getSize()) constantTemplates_ = false;
 }
 
 cacheutils::CachingPiecewiseInterpolation::~CachingPiecewiseInterpolation()
@@ -125,6 +185,7 @@ cacheutils::CachingPiecewiseInterpolation::~CachingPiecewiseInterpolation()
 
 const std::vector<Double_t> & cacheutils::CachingPiecewiseInterpolation::eval(const RooAbsData &data)
 {
+    if (constantTemplates_) return evalFromTemplates_(data);
     const std::vector<Double_t> & nominal = cachingPdfNominal_->eval(data);
     unsigned int size = nominal.size();
     work_.resize(size);
@@ -200,8 +261,107 @@ const std::vector<Double_t> & cacheutils::CachingPiecewiseInterpolation::eval(co
     return work_;
 }
 
+void cacheutils::CachingPiecewiseInterpolation::fillDiffs_(const RooAbsData &data)
+{
+    nominal_ = cachingPdfNominal_->eval(data);
+    unsigned int size = nominal_.size(), n = coeffs_.size();
+    diffHi_.resize(n); diffLo_.resize(n);
+    for (unsigned int i = 0; i < n; ++i) {
+        const std::vector<Double_t> & hi = cachingPdfsHi_[i].eval(data);
+        const std::vector<Double_t> & lo = cachingPdfsLow_[i].eval(data);
+        diffHi_[i].resize(size); diffLo_[i].resize(size);
+        for (unsigned int j = 0; j < size; ++j) {
+            if (codes_[i] == 2) {
+                diffHi_[i][j] = hi[j]/nominal_[j];
+                diffLo_[i][j] = lo[j]/nominal_[j];
+            } else {
+                diffHi_[i][j] = hi[j] - nominal_[j];
+                diffLo_[i][j] = nominal_[j] - lo[j];
+            }
+        }
+    }
+    diffData_ = &data;
+    sumUpdates_ = -1;
+}
+
+void cacheutils::CachingPiecewiseInterpolation::addTerm_(std::vector<Double_t> &out, int i, double x, double scale) const
+{
+    const std::vector<Double_t> & dhi = diffHi_[i], & dlo = diffLo_[i];
+    unsigned int size = out.size();
+    if (x > 1. || (codes_[i] == 0 && x > 0)) {
+        for (unsigned int j = 0; j < size; ++j) out[j] += scale * x * dhi[j];
+    } else if (x < -1. || codes_[i] == 0) {
+        for (unsigned int j = 0; j < size; ++j) out[j] += scale * x * dlo[j];
+    } else {
+        double p = 0.0625 * x * (15 + x * x * (-10 + x * x * 3));
+        for (unsigned int j = 0; j < size; ++j) {
+            double val = nominal_[j] + x * (0.5*(dhi[j]+dlo[j]) + p * (dhi[j]-dlo[j]));
+            if (val < 0) val = 0;
+            out[j] += scale * (val - nominal_[j]);
+        }
+    }
+}
+
+const std::vector<Double_t> & cacheutils::CachingPiecewiseInterpolation::evalFromTemplates_(const RooAbsData &data)
+{
+    if (diffData_ != &data) fillDiffs_(data);
+    static bool incremental = runtimedef::get("MORPH_INCREMENTAL");
+    enum { MaxIncrementalUpdates = 100 };
+    int n = coeffs_.size();
+    unsigned int size = nominal_.size();
+    bool done = false;
+    // as in FastVerticalInterpHistPdf2Base::syncTotal, replace only the terms that changed, and rebuild the sum from time to time
+    if (incremental && additive_ && sumUpdates_ >= 0 && sumUpdates_ < MaxIncrementalUpdates) {
+        int nchanged = 0;
+        for (int i = 0; i < n; ++i) {
+            if (coeffs_[i]->getVal() != sumX_[i]) ++nchanged;
+        }
+        if (2*nchanged <= n) {
+            for (int i = 0; i < n; ++i) {
+                double x = coeffs_[i]->getVal();
+                if (x == sumX_[i]) continue;
+                addTerm_(sum_, i, sumX_[i], -1);
+                addTerm_(sum_, i, x, +1);
+                sumX_[i] = x;
+            }
+            sumUpdates_++;
+            work_ = sum_;
+            done = true;
+        }
+    }
+    if (!done) {
+        work_ = nominal_;
+        for (int i = 0; i < n; ++i) {
+            double x = coeffs_[i]->getVal();
+            if (codes_[i] == 0 || codes_[i] == 4) {
+                addTerm_(work_, i, x, +1);
+            } else if (codes_[i] == 2) {
+                const std::vector<Double_t> & ratio = (x > 0 ? diffHi_[i] : diffLo_[i]);
+                double power = std::abs(x);
+                for (unsigned int j = 0; j < size; ++j) work_[j] *= std::pow(ratio[j], power);
+            } else {
+                std::cout << "Interpolation code " << codes_[i] << " not implemented. Sorry" << std::endl;
+                throw std::invalid_argument("Bad interpolation code in CachingPiecewiseInterpolation");
+            }
+        }
+        if (incremental && additive_) {
+            sum_ = work_;
+            sumX_.resize(n);
+            for (int i = 0; i < n; ++i) sumX_[i] = coeffs_[i]->getVal();
+            sumUpdates_ = 0;
+        }
+    }
+    if (positiveDefinite_) {
+        for (unsigned int j = 0; j < size; ++j) {
+            if (work_[j] < 0) work_[j] = 0;
+        }
+    }
+    return work_;
+}
+
 void cacheutils::CachingPiecewiseInterpolation::setDataDirty()
 {
+    diffData_ = 0;
     cachingPdfNominal_->setDataDirty();
     for (CachingPdfBase &pdf : cachingPdfsHi_) pdf.setDataDirty();
     for (CachingPdfBase &pdf : cachingPdfsLow_) pdf.setDataDirty();
@@ -209,10 +369,22 @@ void cacheutils::CachingPiecewiseInterpolation::setDataDirty()
 
 void cacheutils::CachingPiecewiseInterpolation::setIncludeZeroWeights(bool includeZeroWeights) 
 {
+    diffData_ = 0;
     cachingPdfNominal_->setIncludeZeroWeights(includeZeroWeights);
     for (CachingPdfBase &pdf : cachingPdfsHi_) pdf.setIncludeZeroWeights(includeZeroWeights);
     for (CachingPdfBase &pdf : cachingPdfsLow_) pdf.setIncludeZeroWeights(includeZeroWeights);
 }
 
+std::size_t cacheutils::CachingPiecewiseInterpolation::cacheBytes() const
+{
+    std::size_t ret = cachingPdfNominal_->cacheBytes();
+    for (const CachingPdfBase &pdf : cachingPdfsHi_) ret += pdf.cacheBytes();
+    for (const CachingPdfBase &pdf : cachingPdfsLow_) ret += pdf.cacheBytes();
+    std::size_t values = work_.capacity() + nominal_.capacity() + sum_.capacity();
+    for (const std::vector<Double_t> &diff : diffHi_) values += diff.capacity();
+    for (const std::vector<Double_t> &diff : diffLo_) values += diff.capacity();
+    return ret + values * sizeof(Double_t);
+}
+
 
 
@@ -1,9 +1,12 @@
 #include "HiggsAnalysis/CombinedLimit/interface/VectorizedSimplePdfs.h"
+#include "HiggsAnalysis/CombinedLimit/interface/DataColumns.h"
 #include "RooMath.h"
 #include "vectorized.h"
 #include <RooRealVar.h>
 #include <stdexcept>
 #include <memory>
+#include <cmath>
+#include <algorithm>
 
 VectorizedExponential::VectorizedExponential(const RooExponential &pdf, const RooAbsData &data, bool includeZeroWeights)
 {
@@ -14,11 +17,7 @@ VectorizedExponential::VectorizedExponential(const RooExponential &pdf, const Ro
     x_ = dynamic_cast<const RooRealVar*>(obs.first());
     lambda_ = dynamic_cast<const RooAbsReal*>(params->first());
 
-    xvals_.reserve(data.numEntries());
-    for (unsigned int i = 0, n = data.numEntries(); i < n; ++i) {
-        obs.assignValueOnly(*data.get(i), true);
-        if (data.weight() || includeZeroWeights) xvals_.push_back(x_->getVal());        
-    }
+    cacheutils::DataColumns::fill(data, x_->GetName(), includeZeroWeights, xvals_);
     work_.resize(xvals_.size());
 }
 
@@ -36,11 +35,7 @@ VectorizedPower::VectorizedPower(const RooPower &pdf, const RooAbsData &data, bo
     x_ = dynamic_cast<const RooRealVar*>(obs.first());
     exponent_ = &pdf.exponent();
 
-    xvals_.reserve(data.numEntries());
-    for (unsigned int i = 0, n = data.numEntries(); i < n; ++i) {
-        obs.assignValueOnly(*data.get(i), true);
-        if (data.weight() || includeZeroWeights) xvals_.push_back(x_->getVal());        
-    }
+    cacheutils::DataColumns::fill(data, x_->GetName(), includeZeroWeights, xvals_);
     work_.resize(xvals_.size());
 }
 
@@ -53,3 +48,300 @@ void VectorizedPower::fill(std::vector<Double_t> &out) const {
     out.resize(xvals_.size());
     vectorized::powers(xvals_.size(), exponent, norm, &xvals_[0], &out[0], &work_[0]);
 }
+
+template<int N>
+VectorizedBernstein<N>::VectorizedBernstein(const RooBernsteinFast<N> &pdf, const RooAbsData &data, bool includeZeroWeights) :
+    pdf_(&pdf)
+{
+    RooArgSet obs(pdf.x());
+    const RooRealVar *x = dynamic_cast<const RooRealVar*>(obs.first());
+    if (x == 0) throw std::invalid_argument("The observable of the RooBernsteinFast is not a RooRealVar");
+    Double_t xmin = x->getMin(), xmax = x->getMax();
+    xrange_ = xmax - xmin;
+
+    std::vector<Double_t> xvals;
+    cacheutils::DataColumns::fill(data, x->GetName(), includeZeroWeights, xvals);
+    for (std::vector<Double_t>::iterator it = xvals.begin(), ed = xvals.end(); it != ed; ++it) *it = (*it - xmin)/xrange_;
+    size_ = xvals.size();
+    xpows_.resize((N+1)*size_);
+    std::fill(xpows_.begin(), xpows_.begin()+size_, 1.0);
+    for (int ipow = 1; ipow <= N; ++ipow) {
+        const Double_t *prev = &xpows_[(ipow-1)*size_];
+        Double_t *row = &xpows_[ipow*size_];
+        for (unsigned int i = 0; i < size_; ++i) row[i] = prev[i]*xvals[i];
+    }
+}
+
+template<int N>
+void VectorizedBernstein<N>::fill(std::vector<Double_t> &out) const {
+    Double_t coeffs[N+1];
+    Double_t norm = xrange_ * pdf_->powerCoefficients(coeffs);
+    out.assign(size_, 0.);
+    if (size_ == 0) return;
+    for (int ipow = 0; ipow <= N; ++ipow) {
+        vectorized::mul_add(size_, coeffs[ipow]/norm, &xpows_[ipow*size_], &out[0]);
+    }
+}
+
+template class VectorizedBernstein<1>;
+template class VectorizedBernstein<2>;
+template class VectorizedBernstein<3>;
+template class VectorizedBernstein<4>;
+template class VectorizedBernstein<5>;
+template class VectorizedBernstein<6>;
+template class VectorizedBernstein<7>;
+
+namespace {
+    /// access to the proxies of the pdfs, and the definition of their functions of x:
+    /// linear(x, xmin, xmax, row, integral) fills the values of the functions of a linear basis and their integrals over [xmin, xmax],
+    /// expOfSum(x, row) the functions in the argument of the exponential
+    class PolynomialWorker : public RooPolynomial {
+        public:
+            PolynomialWorker(const RooPolynomial &pdf) : RooPolynomial(pdf, "") {}
+            const RooAbsReal & xvar() const { return _x.arg(); }
+            /// sum_i c_i x^(i+lowestOrder), plus one if lowestOrder > 0
+            std::vector<const RooAbsReal *> coeffs() const {
+                std::vector<const RooAbsReal *> ret;
+                if (_lowestOrder > 0) ret.push_back(0);
+                for (int i = 0, n = _coefList.getSize(); i < n; ++i) ret.push_back(static_cast<const RooAbsReal *>(_coefList.at(i)));
+                return ret;
+            }
+            void linear(double x, double xmin, double xmax, double *row, double *integral) const {
+                int j = 0;
+                if (_lowestOrder > 0) { row[0] = 1; integral[0] = xmax - xmin; j = 1; }
+                for (int i = 0, n = _coefList.getSize(); i < n; ++i, ++j) {
+                    int order = i + _lowestOrder;
+                    row[j] = std::pow(x, order);
+                    integral[j] = (std::pow(xmax, order+1) - std::pow(xmin, order+1))/(order+1);
+                }
+            }
+    };
+    class ChebychevWorker : public RooChebychev {
+        public:
+            ChebychevWorker(const RooChebychev &pdf) : RooChebychev(pdf, "") {}
+            const RooAbsReal & xvar() const { return _x.arg(); }
+            /// 1 + sum_i c_i T_(i+1)(x'), with x' in [-1, 1]
+            std::vector<const RooAbsReal *> coeffs() const {
+                std::vector<const RooAbsReal *> ret(1, (const RooAbsReal *) 0);
+                for (int i = 0, n = _coefList.getSize(); i < n; ++i) ret.push_back(static_cast<const RooAbsReal *>(_coefList.at(i)));
+                return ret;
+            }
+            void linear(double x, double xmin, double xmax, double *row, double *integral) const {
+                double xp = (2*x - xmin - xmax)/(xmax - xmin), halfw = 0.5*(xmax - xmin);
+                for (int n = 0, nmax = _coefList.getSize(); n <= nmax; ++n) {
+                    row[n] = (n == 0 ? 1 : (n == 1 ? xp : 2*xp*row[n-1] - row[n-2]));
+                    integral[n] = (n % 2 == 0 ? halfw * 2.0/(1.0 - n*n) : 0.);
+                }
+            }
+    };
+    class ExpPolyWorker : public RooExpPoly {
+        public:
+            ExpPolyWorker(const RooExpPoly &pdf) : RooExpPoly(pdf, "") {}
+            const RooAbsReal & xvar() const { return x.arg(); }
+            /// exp(sum_k c_k x^(k+1))
+            std::vector<const RooAbsReal *> params() const {
+                std::vector<const RooAbsReal *> ret;
+                for (int i = 0, n = coefs.getSize(); i < n; ++i) ret.push_back(static_cast<const RooAbsReal *>(coefs.at(i)));
+                return ret;
+            }
+            std::vector<double> factors() const { return std::vector<double>(coefs.getSize(), 1.0); }
+            void expOfSum(double xval, double *row) const {
+                for (int k = 0, n = coefs.getSize(); k < n; ++k) row[k] = std::pow(xval, k+1);
+            }
+    };
+    /// the dijet-style functions are in x/sqrt(s), with sqrt(s) = 2000 as in their evaluate()
+    class PowWorker : public RooPowPdf {
+        public:
+            PowWorker(const RooPowPdf &pdf) : RooPowPdf(pdf, "") {}
+            const RooAbsReal & xvar() const { return x.arg(); }
+            /// (x/sqrt(s))^p0
+            std::vector<const RooAbsReal *> params() const { return std::vector<const RooAbsReal *>(1, &p0.arg()); }
+            std::vector<double> factors() const { return std::vector<double>(1, 1.0); }
+            void expOfSum(double xval, double *row) const { row[0] = std::log(xval/2000.); }
+    };
+    class Pow2Worker : public RooPow2Pdf {
+        public:
+            Pow2Worker(const RooPow2Pdf &pdf) : RooPow2Pdf(pdf, "") {}
+            const RooAbsReal & xvar() const { return x.arg(); }
+            /// (x/sqrt(s))^-(p0 + p1 log(x/sqrt(s)))
+            std::vector<const RooAbsReal *> params() const { 
+                const RooAbsReal *ps[2] = { &p0.arg(), &p1.arg() };
+                return std::vector<const RooAbsReal *>(ps, ps+2);
+            }
+            std::vector<double> factors() const { return std::vector<double>(2, -1.0); }
+            void expOfSum(double xval, double *row) const { row[0] = std::log(xval/2000.); row[1] = row[0]*row[0]; }
+    };
+    class QCDWorker : public RooQCDPdf {
+        public:
+            QCDWorker(const RooQCDPdf &pdf) : RooQCDPdf(pdf, "") {}
+            const RooAbsReal & xvar() const { return x.arg(); }
+            /// (1-x/sqrt(s))^p0 / (x/sqrt(s))^(p1 + p2 log(x/sqrt(s)))
+            std::vector<const RooAbsReal *> params() const { 
+                const RooAbsReal *ps[3] = { &p0.arg(), &p1.arg(), &p2.arg() };
+                return std::vector<const RooAbsReal *>(ps, ps+3);
+            }
+            std::vector<double> factors() const { 
+                std::vector<double> ret(3, -1.0); ret[0] = 1.0;
+                return ret;
+            }
+            void expOfSum(double xval, double *row) const { row[0] = std::log(1 - xval/2000.); row[1] = std::log(xval/2000.); row[2] = row[1]*row[1]; }
+    };
+    class TwoExpWorker : public Roo2ExpPdf {
+        public:
+            TwoExpWorker(const Roo2ExpPdf &pdf) : Roo2ExpPdf(pdf, "") {}
+            const RooAbsReal & xvar() const { return x.arg(); }
+            const RooAbsReal & c0var() const { return c0.arg(); }
+            const RooAbsReal & c1var() const { return c1.arg(); }
+            const RooAbsReal & fracvar() const { return frac.arg(); }
+    };
+
+    template<typename PdfT> struct Worker;
+    template<> struct Worker<RooPolynomial> { typedef PolynomialWorker type; };
+    template<> struct Worker<RooChebychev> { typedef ChebychevWorker type; };
+    template<> struct Worker<RooExpPoly> { typedef ExpPolyWorker type; };
+    template<> struct Worker<RooPowPdf> { typedef PowWorker type; };
+    template<> struct Worker<RooPow2Pdf> { typedef Pow2Worker type; };
+    template<> struct Worker<RooQCDPdf> { typedef QCDWorker type; };
+
+    /// the observable of the pdf, which must be the only one of the dataset
+    const RooRealVar * onlyObservable(const RooAbsPdf &pdf, const RooAbsReal &x, const RooAbsData &data) {
+        const RooRealVar *ret = dynamic_cast<const RooRealVar *>(data.get()->find(x.GetName()));
+        if (ret == 0 || data.get()->getSize() != 1) {
+            throw std::invalid_argument(std::string("Background pdf ")+pdf.GetName()+" is not a function of the only observable of the dataset: if this is intended, set --X-rtd ADDNLL_BKGNLL=0 to disable its vectorization in NLL.");
+        }
+        return ret;
+    }
+}
+
+template<typename PdfT>
+VectorizedLinearBasisPdf<PdfT>::VectorizedLinearBasisPdf(const PdfT &pdf, const RooAbsData &data, bool includeZeroWeights)
+{
+    typename Worker<PdfT>::type w(pdf);
+    const RooRealVar *x = onlyObservable(pdf, w.xvar(), data);
+    Double_t xmin = x->getMin(), xmax = x->getMax();
+    coeffs_ = w.coeffs();
+    unsigned int nrows = coeffs_.size();
+    integrals_.resize(nrows);
+
+    std::vector<Double_t> vals(nrows), scratch(nrows), entries;
+    w.linear(xmin, xmin, xmax, &vals[0], &integrals_[0]);
+    int first = -1;
+    entries.reserve(nrows*data.numEntries());
+    for (unsigned int i = 0, n = data.numEntries(); i < n; ++i) {
+        data.get(i);
+        if (data.weight() || includeZeroWeights) {
+            if (first == -1) first = i;
+            w.linear(x->getVal(), xmin, xmax, &vals[0], &scratch[0]);
+            entries.insert(entries.end(), vals.begin(), vals.end());
+        }
+    }
+    // transpose, so that each function is contiguous
+    size_ = entries.size()/nrows;
+    rows_.resize(entries.size());
+    for (unsigned int i = 0; i < size_; ++i) {
+        for (unsigned int j = 0; j < nrows; ++j) rows_[j*size_+i] = entries[i*nrows+j];
+    }
+
+    // the pdf might be defined with a reference range different from the one of the observable (e.g. RooChebychev)
+    if (first != -1) {
+        data.get(first);
+        std::vector<Double_t> check; fill(check);
+        double ref = pdf.getVal(data.get());
+        if (std::abs(check[0] - ref) > 1e-6 * std::abs(ref)) {
+            throw std::invalid_argument(std::string("Vectorized evaluation of ")+pdf.GetName()+" does not match the pdf (is it using a reference range?): set --X-rtd ADDNLL_BKGNLL=0 to disable its vectorization in NLL.");
+        }
+    }
+}
+
+template<typename PdfT>
+void VectorizedLinearBasisPdf<PdfT>::fill(std::vector<Double_t> &out) const {
+    out.assign(size_, 0.);
+    Double_t norm = 0;
+    for (unsigned int j = 0, n = coeffs_.size(); j < n; ++j) {
+        Double_t c = coeffs_[j] ? coeffs_[j]->getVal() : 1.0;
+        norm += c * integrals_[j];
+    }
+    if (size_ == 0) return;
+    for (unsigned int j = 0, n = coeffs_.size(); j < n; ++j) {
+        Double_t c = coeffs_[j] ? coeffs_[j]->getVal() : 1.0;
+        if (c != 0) vectorized::mul_add(size_, c/norm, &rows_[j*size_], &out[0]);
+    }
+}
+
+template class VectorizedLinearBasisPdf<RooPolynomial>;
+template class VectorizedLinearBasisPdf<RooChebychev>;
+
+template<typename PdfT>
+VectorizedExpOfSumPdf<PdfT>::VectorizedExpOfSumPdf(const PdfT &pdf, const RooAbsData &data, bool includeZeroWeights) :
+    pdf_(&pdf),
+    obs_(data.get())
+{
+    typename Worker<PdfT>::type w(pdf);
+    const RooRealVar *x = onlyObservable(pdf, w.xvar(), data);
+    params_ = w.params();
+    factors_ = w.factors();
+    unsigned int nrows = params_.size();
+
+    std::vector<Double_t> vals(nrows), entries;
+    entries.reserve(nrows*data.numEntries());
+    for (unsigned int i = 0, n = data.numEntries(); i < n; ++i) {
+        data.get(i);
+        if (data.weight() || includeZeroWeights) {
+            w.expOfSum(x->getVal(), &vals[0]);
+            entries.insert(entries.end(), vals.begin(), vals.end());
+        }
+    }
+    size_ = nrows ? entries.size()/nrows : 0;
+    rows_.resize(entries.size());
+    for (unsigned int i = 0; i < size_; ++i) {
+        for (unsigned int j = 0; j < nrows; ++j) rows_[j*size_+i] = entries[i*nrows+j];
+    }
+    work_.resize(size_);
+}
+
+template<typename PdfT>
+void VectorizedExpOfSumPdf<PdfT>::fill(std::vector<Double_t> &out) const {
+    out.resize(size_);
+    if (size_ == 0) return;
+    std::fill(work_.begin(), work_.end(), 0.);
+    for (unsigned int j = 0, n = params_.size(); j < n; ++j) {
+        Double_t c = factors_[j] * params_[j]->getVal();
+        if (c != 0) vectorized::mul_add(size_, c, &rows_[j*size_], &work_[0]);
+    }
+    vdt::expv(size_, &work_[0], &out[0]);
+    Double_t invNorm = 1.0/pdf_->getNorm(obs_);
+    for (unsigned int i = 0; i < size_; ++i) out[i] *= invNorm;
+}
+
+template class VectorizedExpOfSumPdf<RooExpPoly>;
+template class VectorizedExpOfSumPdf<RooPowPdf>;
+template class VectorizedExpOfSumPdf<RooPow2Pdf>;
+template class VectorizedExpOfSumPdf<RooQCDPdf>;
+
+VectorizedTwoExp::VectorizedTwoExp(const Roo2ExpPdf &pdf, const RooAbsData &data, bool includeZeroWeights) :
+    pdf_(&pdf),
+    obs_(data.get())
+{
+    TwoExpWorker w(pdf);
+    const RooRealVar *x = onlyObservable(pdf, w.xvar(), data);
+    c0_ = &w.c0var(); c1_ = &w.c1var(); frac_ = &w.fracvar();
+    cacheutils::DataColumns::fill(data, x->GetName(), includeZeroWeights, xvals_);
+    work1_.resize(xvals_.size());
+    work2_.resize(xvals_.size());
+}
+
+void VectorizedTwoExp::fill(std::vector<Double_t> &out) const {
+    unsigned int size = xvals_.size();
+    out.resize(size);
+    if (size == 0) return;
+    // same clamping of the fraction as in TwoExp
+    Double_t c0 = c0_->getVal(), c1 = c1_->getVal(), frac = std::max(0., std::min(1., frac_->getVal()));
+    Double_t invNorm = 1.0/pdf_->getNorm(obs_);
+    for (unsigned int i = 0; i < size; ++i) work1_[i] = c0*xvals_[i];
+    vdt::expv(size, &work1_[0], &out[0]);
+    for (unsigned int i = 0; i < size; ++i) out[i] *= invNorm;
+    if (frac == 0) return;
+    for (unsigned int i = 0; i < size; ++i) work1_[i] = c1*xvals_[i];
+    vdt::expv(size, &work1_[0], &work2_[0]);
+    vectorized::mul_add(size, frac*invNorm, &work2_[0], &out[0]);
+}
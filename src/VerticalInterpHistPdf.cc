@@ -2,6 +2,8 @@
 
 #include <cassert>
 #include <memory>
+#include <map>
+#include <boost/functional/hash.hpp>
 
 #include "RooFit.h"
 #include "Riostream.h"
@@ -10,6 +12,7 @@
 #include "RooRealVar.h"
 #include "RooMsgService.h"
 #include "RooAbsData.h"
+#include "RooFIter.h"
 
 //#define TRACE_CALLS
 #ifdef TRACE_CALLS
@@ -25,6 +28,7 @@
 #include "RooHistPdf.h"
 #include "RooDataHist.h"
 #include "HiggsAnalysis/CombinedLimit/interface/utils.h"
+#include "HiggsAnalysis/CombinedLimit/interface/DataColumns.h"
 namespace {
     std::auto_ptr<TH1> safeCreateHist2D(RooAbsPdf *pdf, const RooRealVar &x, const RooRealVar &y, bool conditional) {
         if (!pdf->getAttribute("safeCreateHist2D:ok") && typeid(*pdf) == typeid(RooHistPdf)) {
@@ -690,13 +694,12 @@ FastVerticalInterpHistPdfV::FastVerticalInterpHistPdfV(const FastVerticalInterpH
     if (!hpdf._sentry.good() || !hpdf._init) hpdf.syncTotal();
     // find bins
     std::vector<int> bins;
-    RooArgSet obs(hpdf._x.arg());
-    const RooRealVar &x = static_cast<const RooRealVar &>(*obs.first());
+    std::vector<Double_t> xvals;
+    cacheutils::DataColumns::fill(data, hpdf._x.arg().GetName(), includeZeroWeights, xvals);
     bool aligned = true;
-    for (int i = 0, n = data.numEntries(); i < n; ++i) {
-        obs = *data.get(i);
-        if (data.weight() == 0 && !includeZeroWeights) continue;
-        int idx = hpdf._cache.FindBin(x.getVal());
+    bins.reserve(xvals.size());
+    for (std::vector<Double_t>::const_iterator it = xvals.begin(), ed = xvals.end(); it != ed; ++it) {
+        int idx = hpdf._cache.FindBin(*it);
         if (!bins.empty() && idx != bins.back() + 1) aligned = false;
         bins.push_back(idx);
     }
@@ -752,7 +755,8 @@ ClassImp(FastVerticalInterpHistPdf2)
 
 //_____________________________________________________________________________
 FastVerticalInterpHistPdf2Base::FastVerticalInterpHistPdf2Base() :
-    _initBase(false)
+    _initBase(false),
+    _morphSumUpdates(-1), _frozenState(0), _morphsFloatState(0), _morphsSparseState(0), _morphsSharedState(0), _sharedTotalState(0)
 {
   // Default constructor
 }
@@ -765,7 +769,8 @@ FastVerticalInterpHistPdf2Base::FastVerticalInterpHistPdf2Base(const char *name,
   _smoothRegion(smoothRegion),
   _smoothAlgo(smoothAlgo),
   _initBase(false),
-  _morphs(), _morphParams()
+  _morphs(), _morphParams(),
+  _morphSumUpdates(-1), _frozenState(0), _morphsFloatState(0), _morphsSparseState(0), _morphsSharedState(0), _sharedTotalState(0)
 { 
   if (inFuncList.GetSize()!=2*inCoefList.getSize()+1) {
     coutE(InputArguments) << "VerticalInterpHistPdf::VerticalInterpHistPdf(" << GetName() 
@@ -808,8 +813,12 @@ FastVerticalInterpHistPdf2Base::FastVerticalInterpHistPdf2Base(const FastVertica
   _smoothRegion(other._smoothRegion),
   _smoothAlgo(other._smoothAlgo),
   _initBase(other._initBase),
-  _morphs(other._morphs), _morphParams(other._morphParams)
+  _morphs(other._morphs), _morphParams(other._morphParams),
+  _morphSumUpdates(-1), _frozenState(0), _morphsFloatState(0), _morphsSparseState(0), _morphsSharedState(0), _sharedTotalState(0)
 {
+    // the single precision morphs must come along, as the double precision ones they replace were released
+    if (other._morphsFloatState > 0) { _morphsFloat = other._morphsFloat; _morphsFloatState = +1; }
+    if (other._morphsSharedState > 0) { _morphsShared = other._morphsShared; _morphsSharedState = +1; }
     if (_initBase) {
         // Morph params are already set, but we must set the sentry
         _sentry.addVars(_coefList);
@@ -824,7 +833,8 @@ FastVerticalInterpHistPdf2Base::FastVerticalInterpHistPdf2Base(const FastVertica
   _smoothRegion(other._smoothRegion),
   _smoothAlgo(other._smoothAlgo),
   _initBase(false),
-  _morphs(), _morphParams()
+  _morphs(), _morphParams(),
+  _morphSumUpdates(-1), _frozenState(0), _morphsFloatState(0), _morphsSparseState(0), _morphsSharedState(0), _sharedTotalState(0)
 {
   // Convert constructor
 }
@@ -834,6 +844,7 @@ Bool_t FastVerticalInterpHistPdf2Base::importWorkspaceHook(RooWorkspace& ws) {
   _initBase = false;
   _morphParams.clear();
   _sentry.reset();
+  _sharedTotal.reset(); _sharedTotalState = 0;
   return kFALSE;
 }
 
@@ -864,13 +875,19 @@ FastVerticalInterpHistPdf2Base::initBase() const
 
     _sentry.addVars(_coefList);
     _sentry.setValueDirty(); 
+    _morphSumUpdates = -1;
+    _frozenState = 0;
+    // the single precision or shared morphs in use replace the double precision ones, which were released
+    if (_morphsFloatState <= 0) { _morphsFloatState = 0; _morphsFloat.clear(); }
+    if (_morphsSharedState <= 0) { _morphsSharedState = 0; _morphsShared.clear(); }
+    _morphsSparseState = 0; _morphsSparse.clear();
     _initBase = true;
 }
 
 FastVerticalInterpHistPdf2::FastVerticalInterpHistPdf2(const char *name, const char *title, const RooRealVar &x, const TList & funcList, const RooArgList& coefList, Double_t smoothRegion, Int_t smoothAlgo) :
     FastVerticalInterpHistPdf2Base(name,title,RooArgSet(x),funcList,coefList,smoothRegion,smoothAlgo),
     _x("x","Independent variable",this,const_cast<RooRealVar&>(x)),
-    _cache(), _cacheNominal(), _cacheNominalLog()
+    _cache(), _cacheNorm(1.0), _cacheNominal(), _cacheNominalLog()
 {
     initBase();
     initNominal(funcList.At(0));
@@ -885,7 +902,8 @@ FastVerticalInterpHistPdf2D2::FastVerticalInterpHistPdf2D2(const char *name, con
     _x("x","Independent variable",this,const_cast<RooRealVar&>(x)),
     _y("y","Independent variable",this,const_cast<RooRealVar&>(y)),
     _conditional(conditional),
-    _cache(), _cacheNominal(), _cacheNominalLog()
+    _cache(), _cacheNominal(), _cacheNominalLog(),
+    _maxOnXY(0), _trackMax(false), _maxValid(false)
 {
     initBase();
     initNominal(funcList.At(0));
@@ -900,7 +918,7 @@ FastVerticalInterpHistPdf2D2::FastVerticalInterpHistPdf2D2(const char *name, con
 FastVerticalInterpHistPdf2::FastVerticalInterpHistPdf2(const FastVerticalInterpHistPdf& other, const char* name) :
     FastVerticalInterpHistPdf2Base(other,name),
     _x("x",this,other._x),
-    _cache(), _cacheNominal(), _cacheNominalLog()
+    _cache(), _cacheNorm(1.0), _cacheNominal(), _cacheNominalLog()
 {
     initBase();
     other.getVal(RooArgSet(_x.arg()));
@@ -916,7 +934,8 @@ FastVerticalInterpHistPdf2D2::FastVerticalInterpHistPdf2D2(const FastVerticalInt
     _x("x",this,other._x),
     _y("y",this,other._y),
     _conditional(other._conditional),
-    _cache(), _cacheNominal(), _cacheNominalLog()
+    _cache(), _cacheNominal(), _cacheNominalLog(),
+    _maxOnXY(0), _trackMax(false), _maxValid(false)
 {
     initBase();
     other.getVal(RooArgSet(_x.arg(), _y.arg()));
@@ -1074,6 +1093,7 @@ void FastVerticalInterpHistPdf2Base::initMorph(Morph &out, const FastTemplate &n
 
 
 void FastVerticalInterpHistPdf2Base::syncTotal(FastTemplate &cache, const FastTemplate &cacheNominal, const FastTemplate &cacheNominalLog) const {
+    ScopedTimer timer("FastVerticalInterpHistPdf2Base::syncTotal");
     /* === how the algorithm works, in theory ===
      * let  dhi = h_hi - h_nominal
      *      dlo = h_lo - h_nominal
@@ -1091,16 +1111,100 @@ void FastVerticalInterpHistPdf2Base::syncTotal(FastTemplate &cache, const FastTe
      * so we just do template += (0.5 * x) * (diff + smoothStepFunc(x) * sum)
      * ========================================== */
 
-    // start from nominal
-    cache.CopyValues(_smoothAlgo < 0 ? cacheNominalLog : cacheNominal);
-    //printf("Cache initialized to nominal template: \n");  cacheNominal.Dump();
+    // In incremental mode, if only a few coefficients changed since the last time, 
+    // just replace their terms in the sum of the morphs instead of redoing it from scratch.
+    // The sum is anyway rebuilt every MaxIncrementalUpdates times, to keep the rounding errors at bay.
+    static bool incremental = runtimedef::get("MORPH_INCREMENTAL");
+    enum { MaxIncrementalUpdates = 100 };
+    int ndim = _coefList.getSize();
+    bool done = false;
+
+    // If an identical pdf already did the morphing for the same values of the coefficients, just take its result
+    static bool shareTotal = runtimedef::get("MORPH_SHARED_TOTAL");
+    if (shareTotal && _sharedTotalState == 0) initSharedTotal(cacheNominal);
+    if (_sharedTotalState > 0) {
+        std::lock_guard<std::mutex> guard(_sharedTotal->lock);
+        bool same = _sharedTotal->valid && _sharedTotal->cache.size() == cache.size();
+        for (int i = 0; i < ndim && same; ++i) same = (_morphParams[i]->getVal() == _sharedTotal->x[i]);
+        if (same) {
+            cache.CopyValues(_sharedTotal->cache);
+            _sentry.reset();
+            return;
+        }
+    }
+    if (_morphsSparseState == 0) initMorphsSparse();
+    if (_morphsSharedState == 0) initMorphsShared();
+    if (incremental && _morphSumUpdates >= 0 && _morphSumUpdates < MaxIncrementalUpdates && _morphSum.size() == cache.size()) {
+        int nchanged = 0;
+        for (int i = 0; i < ndim; ++i) {
+            if (_morphParams[i]->getVal() != _morphSumX[i]) ++nchanged;
+        }
+        if (2*nchanged <= ndim) {
+            for (int i = 0; i < ndim; ++i) {
+                double x = _morphParams[i]->getVal(), xold = _morphSumX[i];
+                if (x == xold) continue;
+                meldMorph(_morphSum, i, -0.5*xold, smoothStepFunc(xold));
+                meldMorph(_morphSum, i,  0.5*x,    smoothStepFunc(x));
+                _morphSumX[i] = x;
+            }
+            _morphSumUpdates++;
+            cache.CopyValues(_morphSum);
+            done = true;
+        }
+    }
 
-    // apply all morphs one by one
-    for (int i = 0, ndim = _coefList.getSize(); i < ndim; ++i) {
-        double x = _morphParams[i]->getVal();
-        double a = 0.5*x, b = smoothStepFunc(x);
-        cache.Meld(_morphs[i].diff, _morphs[i].sum, a, b);    
-        //printf("Merged transformation for dimension %d, x = %+5.3f, step = %.3f: \n", i, x, b);  cache.Dump();
+    static bool foldConstant = runtimedef::get("MORPH_FOLD_CONSTANT");
+    if (!done && foldConstant) {
+        // the morphs of the constant coefficients (e.g. frozen nuisances) are added once to the nominal, 
+        // and only those of the floating ones are added at each update
+        const FastTemplate &nominal = _smoothAlgo < 0 ? cacheNominalLog : cacheNominal;
+        if (!frozenSumIsGood(nominal)) {
+            _frozenSum = nominal;
+            _frozenIdx.clear(); _frozenX.clear(); _floatingIdx.clear();
+            for (int i = 0; i < ndim; ++i) {
+                if (!_morphParams[i]->isConstant()) { _floatingIdx.push_back(i); continue; }
+                double x = _morphParams[i]->getVal();
+                meldMorph(_frozenSum, i, 0.5*x, smoothStepFunc(x));
+                _frozenIdx.push_back(i); _frozenX.push_back(x);
+            }
+            _frozenState = 1;
+        }
+        cache.CopyValues(_frozenSum);
+        for (int i : _floatingIdx) {
+            double x = _morphParams[i]->getVal();
+            meldMorph(cache, i, 0.5*x, smoothStepFunc(x));
+        }
+        if (incremental) {
+            _morphSum = cache;
+            _morphSumX.resize(ndim);
+            for (int i = 0; i < ndim; ++i) _morphSumX[i] = _morphParams[i]->getVal();
+            _morphSumUpdates = 0;
+        }
+        done = true;
+    }
+
+    if (!done) {
+        // start from nominal
+        cache.CopyValues(_smoothAlgo < 0 ? cacheNominalLog : cacheNominal);
+        //printf("Cache initialized to nominal template: \n");  cacheNominal.Dump();
+
+        // apply all morphs one by one
+        for (int i = 0; i < ndim; ++i) {
+            double x = _morphParams[i]->getVal();
+            double a = 0.5*x, b = smoothStepFunc(x);
+            meldMorph(cache, i, a, b);
+            //printf("Merged transformation for dimension %d, x = %+5.3f, step = %.3f: \n", i, x, b);  cache.Dump();
+        }
+
+        static bool useFloat = runtimedef::get("MORPH_FLOAT");
+        if (useFloat && _morphsFloatState == 0) initMorphsFloat(_smoothAlgo < 0 ? cacheNominalLog : cacheNominal);
+
+        if (incremental) {
+            _morphSum = cache;
+            _morphSumX.resize(ndim);
+            for (int i = 0; i < ndim; ++i) _morphSumX[i] = _morphParams[i]->getVal();
+            _morphSumUpdates = 0;
+        }
     }
 
     // if necessary go back to linear scale
@@ -1110,28 +1214,290 @@ void FastVerticalInterpHistPdf2Base::syncTotal(FastTemplate &cache, const FastTe
     } else {
         cache.CropUnderflows();
     }
+
+    if (_sharedTotalState > 0) {
+        std::lock_guard<std::mutex> guard(_sharedTotal->lock);
+        _sharedTotal->cache = cache;
+        _sharedTotal->x.resize(ndim);
+        for (int i = 0; i < ndim; ++i) _sharedTotal->x[i] = _morphParams[i]->getVal();
+        _sharedTotal->valid = true;
+    }
     
     // mark as done
     _sentry.reset();
 }
 
+namespace {
+    /// the SharedTotal of each set of templates, smoothing and morphing parameters, as long as some pdf uses it
+    typedef std::map<std::pair<std::size_t,std::size_t>, std::weak_ptr<FastVerticalInterpHistPdf2Base::SharedTotal> > SharedTotalRegistry;
+    std::mutex sharedTotalRegistryLock;
+    SharedTotalRegistry & sharedTotalRegistry() { static SharedTotalRegistry reg; return reg; }
+
+    /// two independent hashes of the same contents, so that a collision of both is not a concern
+    template<typename Template>
+    void hashTemplate(const Template &t, std::pair<std::size_t,std::size_t> &key) {
+        boost::hash_combine(key.first, t.size());
+        for (unsigned int i = 0, n = t.size(); i < n; ++i) boost::hash_combine(key.first, t[i]);
+        for (unsigned int i = t.size(); i > 0; --i) boost::hash_combine(key.second, t[i-1]);
+        boost::hash_combine(key.second, t.size());
+    }
+}
+
+void FastVerticalInterpHistPdf2Base::initSharedTotal(const FastTemplate &cacheNominal) const {
+    _sharedTotalState = -1;
+    // the single precision morphs are only approximately the same, so we don't mix them with the others
+    static bool useFloat = runtimedef::get("MORPH_FLOAT");
+    if (useFloat || _morphParams.size() != _morphs.size()) return;
+    std::pair<std::size_t,std::size_t> key(0, 0x9e3779b9);
+    boost::hash_combine(key.first, std::string(typeid(*this).name()));
+    boost::hash_combine(key.first, _smoothRegion);
+    boost::hash_combine(key.first, _smoothAlgo);
+    for (const RooAbsReal *param : _morphParams) {
+        boost::hash_combine(key.first, param);
+        boost::hash_combine(key.second, param);
+    }
+    hashTemplate(cacheNominal, key);
+    for (unsigned int i = 0, n = _morphs.size(); i < n; ++i) {
+        // (in clones, the morphs already moved to shared memory)
+        if (_morphsSharedState > 0 && _morphsShared[i].sum.size()) { hashTemplate(_morphsShared[i].sum, key); hashTemplate(_morphsShared[i].diff, key); }
+        else                                                       { hashTemplate(_morphs[i].sum, key);       hashTemplate(_morphs[i].diff, key); }
+    }
+    std::lock_guard<std::mutex> guard(sharedTotalRegistryLock);
+    std::weak_ptr<SharedTotal> &entry = sharedTotalRegistry()[key];
+    _sharedTotal = entry.lock();
+    if (!_sharedTotal) {
+        _sharedTotal.reset(new SharedTotal());
+        _sharedTotal->valid = false;
+        entry = _sharedTotal;
+    }
+    _sharedTotalState = +1;
+}
+
+void FastVerticalInterpHistPdf2Base::templateBytes(std::size_t &nominal, std::size_t &morphs) const {
+    for (const Morph &m : _morphs) morphs += m.sum.bytes() + m.diff.bytes();
+    for (const MorphFloat &m : _morphsFloat) morphs += m.sum.bytes() + m.diff.bytes();
+    for (const FastTemplateSparsePair &m : _morphsSparse) morphs += m.bytes();
+    morphs += _morphSum.bytes();
+}
+
+void FastVerticalInterpHistPdf2::templateBytes(std::size_t &nominal, std::size_t &morphs) const {
+    FastVerticalInterpHistPdf2Base::templateBytes(nominal, morphs);
+    nominal += _cache.bytes() + _cacheNominal.bytes() + _cacheNominalLog.bytes();
+}
+
+void FastVerticalInterpHistPdf2D2::templateBytes(std::size_t &nominal, std::size_t &morphs) const {
+    FastVerticalInterpHistPdf2Base::templateBytes(nominal, morphs);
+    nominal += _cache.bytes() + _cacheNominal.bytes() + _cacheNominalLog.bytes();
+}
+
+void FastVerticalInterpHistPdf2Base::localizeTemplates() {
+    for (Morph &m : _morphs) { m.sum.Localize(); m.diff.Localize(); }
+    _morphSum.Localize();
+}
+
+void FastVerticalInterpHistPdf2::localizeTemplates() {
+    FastVerticalInterpHistPdf2Base::localizeTemplates();
+    _cache.Localize(); _cacheNominal.Localize(); _cacheNominalLog.Localize();
+}
+
+void FastVerticalInterpHistPdf2D2::localizeTemplates() {
+    FastVerticalInterpHistPdf2Base::localizeTemplates();
+    _cache.Localize(); _cacheNominal.Localize(); _cacheNominalLog.Localize();
+}
+
+bool FastVerticalInterpHistPdf2Base::frozenSumIsGood(const FastTemplate &nominal) const {
+    if (_frozenState == 0 || _frozenSum.size() != nominal.size()) return false;
+    for (unsigned int k = 0, n = _frozenIdx.size(); k < n; ++k) {
+        const RooAbsReal *param = _morphParams[_frozenIdx[k]];
+        if (!param->isConstant() || param->getVal() != _frozenX[k]) return false;
+    }
+    // a coefficient that was frozen since then is folded too
+    for (int i : _floatingIdx) {
+        if (_morphParams[i]->isConstant()) return false;
+    }
+    return true;
+}
+
+void FastVerticalInterpHistPdf2Base::initMorphsSparse() const {
+    // automatic for the morphs with at most 1/4 of the bins not empty; 
+    // --X-rtd MORPH_SPARSE=<percent> changes the fraction, and MORPH_SPARSE=-1 never uses them
+    static int percent = runtimedef::get("MORPH_SPARSE");
+    double maxDensity = (percent == 0 ? 0.25 : 0.01*percent);
+    _morphsSparseState = -1;
+    _morphsSparse.clear();
+    if (maxDensity <= 0 || _morphParams.size() != _morphs.size()) return;
+    _morphsSparse.resize(_morphs.size());
+    for (unsigned int i = 0, n = _morphs.size(); i < n; ++i) {
+        // those released with MORPH_FLOAT or COMBINE_SHARED_TEMPLATES keep their copy
+        if (_morphs[i].sum.fullsize() == 0) continue;
+        if (FastTemplateSparsePair::Density(_morphs[i].diff, _morphs[i].sum) > maxDensity) continue;
+        _morphsSparse[i] = FastTemplateSparsePair(_morphs[i].diff, _morphs[i].sum);
+        _morphsSparseState = +1;
+    }
+    if (_morphsSparseState < 0) _morphsSparse.clear();
+}
+
+void FastVerticalInterpHistPdf2Base::initMorphsFloat(const FastTemplate &start) const {
+    _morphsFloat.resize(_morphs.size());
+    for (unsigned int i = 0, n = _morphs.size(); i < n; ++i) {
+        // the sparse morphs are used instead of these anyway
+        if (_morphsSparseState > 0 && _morphsSparse[i].size()) continue;
+        _morphsFloat[i].sum  = FastTemplateFloat(_morphs[i].sum);
+        _morphsFloat[i].diff = FastTemplateFloat(_morphs[i].diff);
+    }
+    // validate: apply each morph at -1 and +1 on top of start in single and double precision, and compare
+    // (start is in log scale for multiplicative morphing, so the comparison is on the relative differences;
+    //  for additive morphing, bins much smaller than the largest one are compared to a fraction of it, since they are affected by cancellations)
+    double maxdiff = 0;
+    FastTemplate ref(start), check(start);
+    for (unsigned int i = 0, n = _morphsFloat.size(); i < n; ++i) {
+        if (_morphsFloat[i].sum.size() == 0) continue;
+        for (double x = -1; x <= 1; x += 2) {
+            ref.CopyValues(start);   ref.Meld(_morphs[i].diff, _morphs[i].sum, 0.5*x, smoothStepFunc(x));
+            check.CopyValues(start); check.Meld(_morphsFloat[i].diff, _morphsFloat[i].sum, 0.5*x, smoothStepFunc(x));
+            double maxval = 1e-9;
+            for (unsigned int j = 0, nb = ref.size(); j < nb; ++j) maxval = std::max(maxval, std::abs(ref[j]));
+            for (unsigned int j = 0, nb = ref.size(); j < nb; ++j) {
+                double norm = (_smoothAlgo < 0 ? 1.0 : std::max(std::abs(ref[j]), 1e-3*maxval));
+                maxdiff = std::max(maxdiff, std::abs(check[j] - ref[j])/norm);
+            }
+        }
+    }
+    if (maxdiff > 1e-5) {
+        coutW(Eval) << "WARNING: " << GetName() << ": morphing in single precision differs by " << maxdiff << " from the one in double precision, will not use it." << std::endl;
+        _morphsFloatState = -1;
+        _morphsFloat.clear();
+        return;
+    }
+    _morphsFloatState = +1;
+    // the double precision morphs are not used any more (restoreDoubleMorphs puts them back if needed)
+    for (unsigned int i = 0, n = _morphsFloat.size(); i < n; ++i) {
+        if (_morphsFloat[i].sum.size() == 0) continue;
+        _morphs[i].sum.Release();
+        _morphs[i].diff.Release();
+    }
+    // the morphs are read-only from now on, so they can be shared with the other processes running on the same model
+    static const char *sharedDir = getenv("COMBINE_SHARED_TEMPLATES");
+    if (sharedDir && sharedDir[0]) {
+        for (unsigned int i = 0, n = _morphsFloat.size(); i < n; ++i) {
+            _morphsFloat[i].sum.Share(sharedDir);
+            _morphsFloat[i].diff.Share(sharedDir);
+        }
+    }
+}
+
+void FastVerticalInterpHistPdf2Base::initMorphsShared() const {
+    _morphsSharedState = -1;
+    _morphsShared.clear();
+    // with MORPH_FLOAT the single precision morphs are shared instead
+    static const char *sharedDir = getenv("COMBINE_SHARED_TEMPLATES");
+    static bool useFloat = runtimedef::get("MORPH_FLOAT");
+    if (!sharedDir || !sharedDir[0] || useFloat) return;
+    _morphsShared.resize(_morphs.size());
+    for (unsigned int i = 0, n = _morphs.size(); i < n; ++i) {
+        if (_morphsSparseState > 0 && _morphsSparse[i].size()) continue;
+        if (_morphs[i].sum.fullsize() == 0) continue;
+        MorphShared m; 
+        m.sum  = FastTemplateShared(_morphs[i].sum, sharedDir);
+        m.diff = FastTemplateShared(_morphs[i].diff, sharedDir);
+        if (m.sum.size() == 0 || m.diff.size() == 0) continue;
+        _morphsShared[i] = m;
+        _morphs[i].sum.Release();
+        _morphs[i].diff.Release();
+        _morphsSharedState = +1;
+    }
+    if (_morphsSharedState < 0) _morphsShared.clear();
+}
+
+void FastVerticalInterpHistPdf2Base::restoreDoubleMorphs() const {
+    for (unsigned int i = 0, n = _morphs.size(); i < n; ++i) {
+        if (_morphs[i].sum.fullsize() != 0) continue;
+        if (_morphsSharedState > 0 && _morphsShared[i].sum.size()) {
+            _morphs[i].sum  = _morphsShared[i].sum.ToDouble();
+            _morphs[i].diff = _morphsShared[i].diff.ToDouble();
+        } else if (_morphsFloatState > 0 && _morphsFloat[i].sum.size()) {
+            _morphs[i].sum  = _morphsFloat[i].sum.ToDouble();
+            _morphs[i].diff = _morphsFloat[i].diff.ToDouble();
+        }
+    }
+}
+
+void FastVerticalInterpHistPdf2Base::restoreDoubleMorphs(const RooAbsCollection &components) {
+    RooFIter iter = components.fwdIterator();
+    for (RooAbsArg *a = iter.next(); a != 0; a = iter.next()) {
+        const FastVerticalInterpHistPdf2Base *pdf = dynamic_cast<const FastVerticalInterpHistPdf2Base *>(a);
+        if (pdf) pdf->restoreDoubleMorphs();
+    }
+}
+
 void FastVerticalInterpHistPdf2::syncTotal() const {
     FastVerticalInterpHistPdf2Base::syncTotal(_cache, _cacheNominal, _cacheNominalLog);
 
     // normalize the result
-    _cache.Normalize(); 
+    _cacheNorm = _cache.Normalize(); 
     //printf("Normalized result\n");  _cache.Dump();
 }
 
+bool FastVerticalInterpHistPdf2::cacheDerivative(const RooAbsArg &param, FastHisto &out) const {
+    if (!_initBase) initBase();
+    if (_cache.size() == 0) _cache = _cacheNominal; // _cache is not persisted
+    if (!_sentry.good()) syncTotal();
+    out = _cache;
+    out.Clear();
+    // derivative of the template before normalization (in log scale for multiplicative morphing):
+    //    d/dx [ 0.5 * x * (diff + smoothStepFunc(x) * sum) ] = 0.5 * (diff + (smoothStepFunc(x) + x * smoothStepFunc'(x)) * sum)
+    bool found = false;
+    for (int i = 0, ndim = _coefList.getSize(); i < ndim; ++i) {
+        if (_morphParams[i] == &param) {
+            double x = _morphParams[i]->getVal(), dstep = 0;
+            if (fabs(x) < _smoothRegion) {
+                double xnorm = x/_smoothRegion, xnorm2 = xnorm*xnorm;
+                dstep = 0.125 * 15. * (xnorm2 * (xnorm2 - 2.) + 1.) / _smoothRegion;
+            }
+            meldMorph(out, i, 0.5, smoothStepFunc(x) + x * dstep);
+            found = true;
+        } else if (_morphParams[i]->dependsOnValue(param)) {
+            return false;
+        }
+    }
+    if (!found) return true;
+    // then propagate through the exponential (if any) and the normalization:
+    //   f = raw / norm    ==>   df = (draw - f * integral(draw)) / norm
+    if (_smoothAlgo < 0) {
+        // raw = exp(log raw), so draw / norm = f * dlog
+        for (unsigned int i = 0, n = out.size(); i < n; ++i) out[i] *= _cache[i];
+    } else {
+        // bins cropped to avoid underflows don't move
+        for (unsigned int i = 0, n = out.size(); i < n; ++i) {
+            if (_cache[i]*_cacheNorm <= 1e-9) out[i] = 0;
+        }
+        if (_cacheNorm > 0) out.Scale(1.0/_cacheNorm);
+    }
+    double dintegral = out.IntegralWidth();
+    for (unsigned int i = 0, n = out.size(); i < n; ++i) out[i] -= _cache[i] * dintegral;
+    return true;
+}
+
 void FastVerticalInterpHistPdf2D2::syncTotal() const {
     FastVerticalInterpHistPdf2Base::syncTotal(_cache, _cacheNominal, _cacheNominalLog);
 
-    // normalize the result
-    if (_conditional) _cache.NormalizeXSlices(); 
-    else              _cache.Normalize(); 
+    // normalize the result, and if maxVal is in use track the maxima in the same pass
+    _maxValid = false;
+    if (_conditional && _trackMax) syncMaxima(true);
+    else if (_conditional) _cache.NormalizeXSlices(); 
+    else                   _cache.Normalize(); 
     //printf("Normalized result\n");  _cache.Dump();
 }
 
+void FastVerticalInterpHistPdf2D2::syncMaxima(bool normalizeXSlices) const {
+    _maxOnY.resize(_cache.binX());
+    _maxOnX.resize(_cache.binY());
+    if (normalizeXSlices) _cache.NormalizeXSlices(_maxOnY.data(), _maxOnX.data());
+    else                  _cache.GetMaxima(_maxOnY.data(), _maxOnX.data());
+    _maxOnXY = _maxOnY.empty() ? 0.0 : *std::max_element(_maxOnY.begin(), _maxOnY.end());
+    _maxValid = true;
+}
+
 Int_t FastVerticalInterpHistPdf2D2::getMaxVal(const RooArgSet& vars) const {
     //static int ncalls = 0;
     //if (++ncalls < 100) {
@@ -1154,15 +1520,21 @@ Int_t FastVerticalInterpHistPdf2D2::getMaxVal(const RooArgSet& vars) const {
 
 Double_t FastVerticalInterpHistPdf2D2::maxVal(int code) const {
     if (!_initBase) initBase();
-    if (_cache.size() == 0) _cache = _cacheNominal;
+    if (_cache.size() == 0) { _cache = _cacheNominal; _maxValid = false; }
+    _trackMax = true;
     if (!_sentry.good()) syncTotal();
+    if (!_maxValid) syncMaxima(false);
     switch (code) {
-        case 1:
-            return _cache.GetMaxOnX(_y);
-        case 2:
-            return _cache.GetMaxOnY(_x);
+        case 1: {
+                int iy = _cache.FindBinY(_y);
+                return (iy < 0 || iy == int(_cache.binY())) ? 0.0 : _maxOnX[iy];
+            }
+        case 2: {
+                int ix = _cache.FindBinX(_x);
+                return (ix < 0 || ix == int(_cache.binX())) ? 0.0 : _maxOnY[ix];
+            }
         case 3:
-            return _cache.GetMaxOnXY();
+            return _maxOnXY;
     }
     coutE(InputArguments) << "FastVerticalInterpHistPdf2D2::maxVal(" << GetName() 
 			  << ") unsupported integration code " << code << "\n" << std::endl;
@@ -1179,13 +1551,12 @@ FastVerticalInterpHistPdf2V::FastVerticalInterpHistPdf2V(const FastVerticalInter
     if (!hpdf._sentry.good()) hpdf.syncTotal();
     // find bins
     std::vector<int> bins;
-    RooArgSet obs(hpdf._x.arg());
-    const RooRealVar &x = static_cast<const RooRealVar &>(*obs.first());
+    std::vector<Double_t> xvals;
+    cacheutils::DataColumns::fill(data, hpdf._x.arg().GetName(), includeZeroWeights, xvals);
     bool aligned = true;
-    for (int i = 0, n = data.numEntries(); i < n; ++i) {
-        obs = *data.get(i);
-        if (data.weight() == 0 && !includeZeroWeights) continue;
-        int idx = hpdf._cache.FindBin(x.getVal());
+    bins.reserve(xvals.size());
+    for (std::vector<Double_t>::const_iterator it = xvals.begin(), ed = xvals.end(); it != ed; ++it) {
+        int idx = hpdf._cache.FindBin(*it);
         if (!bins.empty() && idx != bins.back() + 1) aligned = false;
         bins.push_back(idx);
     }
@@ -1221,16 +1592,21 @@ FastVerticalInterpHistPdf2V::FastVerticalInterpHistPdf2V(const FastVerticalInter
 void FastVerticalInterpHistPdf2V::fill(std::vector<Double_t> &out) const 
 {
     if (!hpdf_._sentry.good()) hpdf_.syncTotal();
+    fill(hpdf_._cache, out);
+}
+
+void FastVerticalInterpHistPdf2V::fill(const FastHisto &templ, std::vector<Double_t> &out) const 
+{
     if (begin_ != end_) {
         out.resize(end_-begin_);
-        std::copy(& hpdf_._cache.GetBinContent(begin_), & hpdf_._cache.GetBinContent(end_), out.begin());
+        std::copy(& templ.GetBinContent(begin_), & templ.GetBinContent(end_), out.begin());
     } else if (!blocks_.empty()) {
         out.resize(nbins_);
-        for (auto b : blocks_) std::copy(& hpdf_._cache.GetBinContent(b.begin), & hpdf_._cache.GetBinContent(b.end), out.begin()+b.index);
+        for (auto b : blocks_) std::copy(& templ.GetBinContent(b.begin), & templ.GetBinContent(b.end), out.begin()+b.index);
     } else {
         out.resize(bins_.size());
         for (int i = 0, n = bins_.size(); i < n; ++i) {
-            out[i] = hpdf_._cache.GetBinContent(bins_[i]);
+            out[i] = templ.GetBinContent(bins_[i]);
         }
     }
 }
@@ -0,0 +1,47 @@
+#include "HiggsAnalysis/CombinedLimit/interface/WarmMinuit2Minimizer.h"
+
+#include <Minuit2/MnUserCovariance.h>
+#include <iostream>
+
+std::vector<std::string> cmsmath::WarmMinuit2Minimizer::names_;
+std::vector<double>      cmsmath::WarmMinuit2Minimizer::covariance_;
+
+cmsmath::WarmMinuit2Minimizer::WarmMinuit2Minimizer(const char *algo) :
+    ROOT::Minuit2::Minuit2Minimizer(algo ? algo : "Migrad")
+{
+}
+
+void cmsmath::WarmMinuit2Minimizer::floatingNames(std::vector<std::string> &names) const
+{
+    names.clear();
+    for (unsigned int i = 0, n = fState.MinuitParameters().size(); i < n; ++i) {
+        const ROOT::Minuit2::MinuitParameter &par = fState.Parameter(i);
+        if (!par.IsFixed() && !par.IsConst()) names.push_back(par.GetName());
+    }
+}
+
+bool cmsmath::WarmMinuit2Minimizer::Minimize()
+{
+    std::vector<std::string> names;
+    floatingNames(names);
+    // seed only if it's the same problem: same floating parameters in the same order
+    if (!names_.empty() && names == names_ && !fState.HasCovariance()) {
+        fState.AddCovariance(ROOT::Minuit2::MnUserCovariance(covariance_, names.size()));
+        if (PrintLevel() > 0) std::cout << "Minuit2Warm: starting from the covariance matrix of the previous minimization" << std::endl;
+    }
+    bool ok = ROOT::Minuit2::Minuit2Minimizer::Minimize();
+    if (ok && fState.HasCovariance() && fState.Covariance().Nrow() == names.size()) {
+        names_.swap(names);
+        covariance_ = fState.Covariance().Data();
+    }
+    return ok;
+}
+
+#include <TPluginManager.h>
+namespace {
+    static int load_warmminuit2() {
+        gPluginMgr->AddHandler("ROOT::Math::Minimizer", "Minuit2Warm", "cmsmath::WarmMinuit2Minimizer", "HiggsAnalysisCombinedLimit", "WarmMinuit2Minimizer(const char *)");
+        return 1;
+    }
+    static int loaded_warmminuit2 = load_warmminuit2();
+}
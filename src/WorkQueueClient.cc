@@ -0,0 +1,118 @@
+#include "HiggsAnalysis/CombinedLimit/interface/WorkQueueClient.h"
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <stdexcept>
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <TString.h>
+
+namespace {
+    /// seconds for which an unreachable coordinator is retried before giving up
+    const int kRetryTime = 300;
+
+    bool sendAll(int fd, const char *p, size_t left) {
+        while (left > 0) {
+            ssize_t sent = send(fd, p, left, 0);
+            if (sent == -1 && errno == EINTR) continue;
+            if (sent <= 0) return false;
+            p += sent; left -= sent;
+        }
+        return true;
+    }
+}
+
+WorkQueueClient::WorkQueueClient(const std::string &address)
+{
+    std::string::size_type colon = address.rfind(':');
+    if (colon == std::string::npos || colon == 0 || colon + 1 == address.size()) {
+        throw std::invalid_argument("WorkQueueClient: the address of the coordinator must be host:port, not '"+address+"'");
+    }
+    host_ = address.substr(0, colon);
+    port_ = address.substr(colon+1);
+    char hostname[256];
+    if (gethostname(hostname, sizeof(hostname)) != 0) strcpy(hostname, "unknown");
+    hostname[sizeof(hostname)-1] = 0;
+    worker_ = TString::Format("%s:%d", hostname, int(getpid())).Data();
+    const char *token = getenv("COMBINE_WORKQUEUE_TOKEN"), *tokenFile = getenv("COMBINE_WORKQUEUE_TOKEN_FILE");
+    if (token != 0 && *token != 0) {
+        std::istringstream(token) >> token_;
+    } else if (tokenFile != 0 && *tokenFile != 0) {
+        std::ifstream in(tokenFile);
+        if (!in.good()) throw std::runtime_error(std::string("WorkQueueClient: can't read the token from ")+tokenFile);
+        in >> token_;
+    }
+    if (token_.empty()) {
+        throw std::invalid_argument("WorkQueueClient: no token for the coordinator, set COMBINE_WORKQUEUE_TOKEN or COMBINE_WORKQUEUE_TOKEN_FILE (e.g. to the <store>.token made by the coordinator)");
+    }
+}
+
+std::string WorkQueueClient::exchange_(const std::string &request, const std::vector<char> *data) {
+    for (int waited = 0; ; ) {
+        std::string error;
+        struct addrinfo hints, *res = 0;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        int gai = getaddrinfo(host_.c_str(), port_.c_str(), &hints, &res);
+        if (gai != 0) throw std::runtime_error("WorkQueueClient: can't resolve "+host_+": "+gai_strerror(gai));
+        int fd = -1;
+        for (struct addrinfo *ai = res; ai != 0 && fd == -1; ai = ai->ai_next) {
+            fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (fd != -1 && connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) { close(fd); fd = -1; }
+        }
+        freeaddrinfo(res);
+        if (fd == -1) {
+            error = strerror(errno);
+        } else {
+            std::string line = "AUTH " + token_ + " " + request + "\n", reply;
+            bool ok = sendAll(fd, line.data(), line.size());
+            if (ok && data != 0 && !data->empty()) ok = sendAll(fd, &(*data)[0], data->size());
+            shutdown(fd, SHUT_WR);
+            char c;
+            while (ok) {
+                ssize_t got = recv(fd, &c, 1, 0);
+                if (got == -1 && errno == EINTR) continue;
+                if (got <= 0 || c == '\n') break;
+                reply += c;
+            }
+            close(fd);
+            if (ok && !reply.empty()) return reply;
+            error = "no reply";
+        }
+        if (waited >= kRetryTime) throw std::runtime_error("WorkQueueClient: can't talk to the coordinator at "+host_+":"+port_+" ("+error+")");
+        std::cerr << "WorkQueueClient: can't talk to the coordinator at " << host_ << ":" << port_ << " (" << error << "), trying again in 10 s" << std::endl;
+        sleep(10); waited += 10;
+    }
+}
+
+bool WorkQueueClient::next(Unit &unit) {
+    for (;;) {
+        std::istringstream reply(exchange_("GET "+worker_, 0));
+        std::string what; reply >> what;
+        if (what == "END") return false;
+        if (what == "WAIT") {
+            int seconds = 10; reply >> seconds;
+            sleep(seconds > 0 ? seconds : 1);
+            continue;
+        }
+        if (what == "UNIT" && (reply >> unit.id >> unit.toys >> unit.seed >> unit.point)) return true;
+        throw std::runtime_error("WorkQueueClient: unexpected reply from the coordinator: '"+reply.str()+"'");
+    }
+}
+
+void WorkQueueClient::submit(const Unit &unit, const std::vector<char> &data) {
+    std::string reply = exchange_(TString::Format("RESULT %s %u", unit.id.c_str(), unsigned(data.size())).Data(), &data);
+    if (reply == "IGNORED") {
+        // e.g. the lease expired and someone else already did it
+        std::cerr << "WorkQueueClient: the result of unit " << unit.id << " was not needed anymore" << std::endl;
+    } else if (reply != "OK") {
+        throw std::runtime_error("WorkQueueClient: the coordinator refused the result of unit "+unit.id+": '"+reply+"'");
+    }
+}
@@ -1,9 +1,12 @@
 #include "HiggsAnalysis/CombinedLimit/interface/TestProposal.h"
+#include "HiggsAnalysis/CombinedLimit/interface/AdaptiveProposal.h"
 #include "HiggsAnalysis/CombinedLimit/interface/DebugProposal.h"
 #include "HiggsAnalysis/CombinedLimit/interface/VerticalInterpPdf.h"
 #include "HiggsAnalysis/CombinedLimit/interface/VerticalInterpHistPdf.h"
 #include "HiggsAnalysis/CombinedLimit/interface/AsymPow.h"
 #include "HiggsAnalysis/CombinedLimit/interface/CombDataSetFactory.h"
+#include "HiggsAnalysis/CombinedLimit/interface/TemplateImporter.h"
+#include "HiggsAnalysis/CombinedLimit/interface/JacknifeQuantile.h"
 #include "HiggsAnalysis/CombinedLimit/interface/TH1Keys.h"
 #include "HiggsAnalysis/CombinedLimit/interface/RooSimultaneousOpt.h"
 #include "HiggsAnalysis/CombinedLimit/interface/SimpleCacheSentry.h"
@@ -14,13 +17,19 @@
 #include "HiggsAnalysis/CombinedLimit/interface/HGGRooPdfs.h"
 #include "HiggsAnalysis/CombinedLimit/interface/HZGRooPdfs.h"
 #include "HiggsAnalysis/CombinedLimit/interface/SequentialMinimizer.h"
+#include "HiggsAnalysis/CombinedLimit/interface/LBFGSMinimizer.h"
+#include "HiggsAnalysis/CombinedLimit/interface/WarmMinuit2Minimizer.h"
 #include "HiggsAnalysis/CombinedLimit/interface/ProcessNormalization.h"
+#include "HiggsAnalysis/CombinedLimit/interface/RooCheapLinearCombination.h"
 #include "HiggsAnalysis/CombinedLimit/interface/RooSpline1D.h"
+#include "HiggsAnalysis/CombinedLimit/interface/RooCompiledFormula.h"
 #include "HiggsAnalysis/CombinedLimit/interface/RooSplineND.h"
 #include "HiggsAnalysis/CombinedLimit/interface/RooScaleLOSM.h"
 #include "HiggsAnalysis/CombinedLimit/interface/rVrFLikelihood.h"
 #include "HiggsAnalysis/CombinedLimit/interface/RooMultiPdf.h"
 #include "HiggsAnalysis/CombinedLimit/interface/RooBernsteinFast.h"
+#include "HiggsAnalysis/CombinedLimit/interface/TextDatacard.h"
+#include "HiggsAnalysis/CombinedLimit/interface/NLLEvaluator.h"
 #include "HiggsAnalysis/CombinedLimit/interface/SimpleGaussianConstraint.h"
 #include "HiggsAnalysis/CombinedLimit/interface/SimplePoissonConstraint.h"
 #include "HiggsAnalysis/CombinedLimit/interface/AtlasPdfs.h"
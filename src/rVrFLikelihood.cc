@@ -1,5 +1,7 @@
 #include "HiggsAnalysis/CombinedLimit/interface/rVrFLikelihood.h"
 #include <cstdio>
+#include <algorithm>
+#include <cmath>
 
 rVrFLikelihood::rVrFLikelihood(const char *name, const char *title) :
         RooAbsReal(name,title)
@@ -10,6 +12,7 @@ void
 rVrFLikelihood::addChannel(const TH2* chi2, RooAbsReal &muV, RooAbsReal &muF) 
 {
     channels_.push_back(Channel(this,chi2,muV,muF));
+    grids_.push_back(Grid(*chi2));
 }
 
 rVrFLikelihood::~rVrFLikelihood() 
@@ -29,20 +32,57 @@ TObject
 
 Double_t rVrFLikelihood::evaluate() const {
     double ret = 0;
-    for (std::vector<Channel>::const_iterator it = channels_.begin(), ed = channels_.end(); it != ed; ++it) {
-        double x = it->muF;
-        double y = it->muV;
-        if (!(x > it->chi2->GetXaxis()->GetXmin())) return 9999;
-        if (!(x < it->chi2->GetXaxis()->GetXmax())) return 9999;
-        if (!(y > it->chi2->GetYaxis()->GetXmin())) return 9999;
-        if (!(y < it->chi2->GetYaxis()->GetXmax())) return 9999;
-        /*printf("looked up %s at (%g,%g), x [%g,%g], y [%g,%g]\n",
-                    it->chi2->GetName(), x, y,
-                    it->chi2->GetXaxis()->GetXmin(), it->chi2->GetXaxis()->GetXmax(),
-                    it->chi2->GetYaxis()->GetXmin(), it->chi2->GetYaxis()->GetXmax());*/
-        ret += (const_cast<TH2 *>(it->chi2))->Interpolate(x,y); // WTF Interpolate is not const??
+    for (unsigned int i = 0, n = channels_.size(); i < n; ++i) {
+        const Grid &grid = grids_[i];
+        double x = channels_[i].muF;
+        double y = channels_[i].muV;
+        if (!(x > grid.xmin)) return 9999;
+        if (!(x < grid.xmax)) return 9999;
+        if (!(y > grid.ymin)) return 9999;
+        if (!(y < grid.ymax)) return 9999;
+        // the channels whose signal strengths didn't move since the last call keep their value
+        if (x != grid.lastX || y != grid.lastY) {
+            grid.lastValue = grid.eval(x, y);
+            grid.lastX = x; grid.lastY = y;
+        }
+        ret += grid.lastValue;
     }
     return 0.5*ret; // NLL
 }
 
+rVrFLikelihood::Grid::Grid(const TH2 &chi2) :
+    xmin(chi2.GetXaxis()->GetXmin()), xmax(chi2.GetXaxis()->GetXmax()),
+    ymin(chi2.GetYaxis()->GetXmin()), ymax(chi2.GetYaxis()->GetXmax()),
+    lastX(NAN), lastY(NAN), lastValue(0)
+{
+    int nx = chi2.GetNbinsX(), ny = chi2.GetNbinsY();
+    for (int ix = 1; ix <= nx; ++ix) centersX.push_back(chi2.GetXaxis()->GetBinCenter(ix));
+    for (int iy = 1; iy <= ny; ++iy) centersY.push_back(chi2.GetYaxis()->GetBinCenter(iy));
+    values.resize(nx*ny);
+    for (int ix = 1; ix <= nx; ++ix) {
+        for (int iy = 1; iy <= ny; ++iy) values[(ix-1)*ny + (iy-1)] = chi2.GetBinContent(ix, iy);
+    }
+}
+
+namespace {
+    /// the two bin centers around x and the weight of the second; beyond the first or the last center both are that
+    /// one, as TH2::Interpolate takes the content of the last bin for the overflow
+    inline void bracket(const std::vector<double> &centers, double x, unsigned int &i0, unsigned int &i1, double &t) {
+        unsigned int i = std::upper_bound(centers.begin(), centers.end(), x) - centers.begin();
+        if (i == 0) { i0 = i1 = 0; t = 0; }
+        else if (i == centers.size()) { i0 = i1 = i-1; t = 0; }
+        else { i0 = i-1; i1 = i; t = (x - centers[i0])/(centers[i1] - centers[i0]); }
+    }
+}
+
+double rVrFLikelihood::Grid::eval(double x, double y) const
+{
+    unsigned int ix0, ix1, iy0, iy1; double tx, ty;
+    bracket(centersX, x, ix0, ix1, tx);
+    bracket(centersY, y, iy0, iy1, ty);
+    unsigned int ny = centersY.size();
+    return (1-tx)*((1-ty)*values[ix0*ny+iy0] + ty*values[ix0*ny+iy1]) +
+              tx *((1-ty)*values[ix1*ny+iy0] + ty*values[ix1*ny+iy1]);
+}
+
 ClassImp(rVrFLikelihood)
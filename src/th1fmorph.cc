@@ -6,6 +6,7 @@
 #include <iostream>
 #include <cmath>
 #include <set>
+#include <algorithm>
 
 using namespace std;
 
@@ -501,3 +502,152 @@ TH1D *th1fmorph(const char *chname,
                 Double_t morphedhistnorm,
                 Int_t idebug)
 { return th1fmorph_<TH1D, Double_t>(chname, chtitle, hist1, hist2, par1, par2, parinterp, morphedhistnorm, idebug); }
+
+FastHorizontalMorph::FastHorizontalMorph(const TH1 &hist1, const TH1 &hist2) :
+    empty_(true)
+{
+    std::vector<double> edges1(hist1.GetNbinsX()+1), edges2(hist2.GetNbinsX()+1);
+    for (int i = 0, n = edges1.size(); i < n; ++i) edges1[i] = hist1.GetXaxis()->GetBinLowEdge(i+1);
+    for (int i = 0, n = edges2.size(); i < n; ++i) edges2[i] = hist2.GetXaxis()->GetBinLowEdge(i+1);
+    init(FastTemplate(hist1), edges1, FastTemplate(hist2), edges2);
+}
+
+FastHorizontalMorph::FastHorizontalMorph(const FastHisto &hist1, const FastHisto &hist2) :
+    empty_(true)
+{
+    init(hist1, hist1.binEdges(), hist2, hist2.binEdges());
+}
+
+FastHorizontalMorph::FastHorizontalMorph(const FastTemplate &hist1, const std::vector<double> &edges1, const FastTemplate &hist2, const std::vector<double> &edges2) :
+    empty_(true)
+{
+    init(hist1, edges1, hist2, edges2);
+}
+
+void FastHorizontalMorph::init(const FastTemplate &hist1, const std::vector<double> &edges1, const FastTemplate &hist2, const std::vector<double> &edges2)
+{
+  // same steps as th1fmorph_ above, up to the part that depends on the interpolation point
+  Int_t nb1 = hist1.size(), nb2 = hist2.size();
+  std::set<Double_t> bedgesn_tmp(edges1.begin(), edges1.end());
+  bedgesn_tmp.insert(edges2.begin(), edges2.end());
+  bedgesn_.assign(bedgesn_tmp.begin(), bedgesn_tmp.end());
+  Int_t nbn = bedgesn_.size() - 1;
+
+  dx2_.resize(nbn+1);
+  for (Int_t ix = 0; ix <= nbn; ++ix) {
+    // as axis2->GetBinWidth(axis2->FindBin(x)), which uses the first (last) bin for the underflow (overflow)
+    Int_t bin = std::upper_bound(edges2.begin(), edges2.end(), bedgesn_[ix]) - edges2.begin() - 1;
+    bin = std::max(0, std::min(nb2-1, bin));
+    dx2_[ix] = edges2[bin+1] - edges2[bin];
+  }
+  x1_.clear(); x2_.clear(); y_.clear();
+
+  std::vector<Double_t> sigdis1(nb1+1, 0.), sigdis2(nb2+1, 0.);
+  Double_t total1 = 0, total2 = 0;
+  for (Int_t i = 1; i < nb1+1; i++) total1 += (sigdis1[i] = hist1[i-1]);
+  for (Int_t i = 1; i < nb2+1; i++) total2 += (sigdis2[i] = hist2[i-1]);
+  empty_ = (total1 <= 0 || total2 <= 0);
+  if (empty_) return;
+  for (Int_t i = 1; i < nb1+1; i++) sigdis1[i] = sigdis1[i]/total1 + sigdis1[i-1];
+  for (Int_t i = 1; i < nb2+1; i++) sigdis2[i] = sigdis2[i]/total2 + sigdis2[i-1];
+
+  Int_t ix1l = nb1, ix2l = nb2;
+  while (sigdis1[ix1l-1] >= sigdis1[ix1l]) ix1l--;
+  while (sigdis2[ix2l-1] >= sigdis2[ix2l]) ix2l--;
+  Int_t ix1 = -1, ix2 = -1;
+  do { ix1++; } while (sigdis1[ix1+1] <= sigdis1[0]);
+  do { ix2++; } while (sigdis2[ix2+1] <= sigdis2[0]);
+
+  Double_t x1 = edges1[ix1], x2 = edges2[ix2];
+  x1_.push_back(x1); x2_.push_back(x2); y_.push_back(0);
+
+  Double_t yprev = -1, y = 0;
+  while ((ix1 < ix1l) | (ix2 < ix2l)) {
+    Int_t i12type = -1;
+    if ((sigdis1[ix1+1] <= sigdis2[ix2+1] || ix2 == ix2l) && ix1 < ix1l) {
+      ix1++;
+      while (sigdis1[ix1+1] <= sigdis1[ix1] && ix1 < ix1l) ix1++;
+      i12type = 1;
+    } else if (ix2 < ix2l) {
+      ix2++;
+      while (sigdis2[ix2+1] <= sigdis2[ix2] && ix2 < ix2l) ix2++;
+      i12type = 2;
+    }
+    if (i12type == 1) {
+      x1 = edges1[ix1];
+      y = sigdis1[ix1];
+      Double_t x20 = edges2[ix2], x21 = edges2[ix2+1];
+      Double_t y20 = sigdis2[ix2], y21 = sigdis2[ix2+1];
+      x2 = (y21 > y20 ? x20 + (x21-x20)*(y-y20)/(y21-y20) : x20);
+    } else {
+      x2 = edges2[ix2];
+      y = sigdis2[ix2];
+      Double_t x10 = edges1[ix1], x11 = edges1[ix1+1];
+      Double_t y10 = sigdis1[ix1], y11 = sigdis1[ix1+1];
+      x1 = (y11 > y10 ? x10 + (x11-x10)*(y-y10)/(y11-y10) : x10);
+    }
+    if (y > yprev) {
+      yprev = y;
+      x1_.push_back(x1); x2_.push_back(x2); y_.push_back(y);
+    }
+  }
+}
+
+void FastHorizontalMorph::morph(double par1, double par2, double parinterp, double morphedhistnorm, FastTemplate &out) const
+{
+  Int_t nbn = bedgesn_.size() - 1;
+  out.Resize(nbn);
+  if (empty_) { out.Clear(); return; }
+
+  Double_t wt1 = 0.5, wt2 = 0.5;
+  if (par2 != par1) {
+    wt1 = 1. - (parinterp-par1)/(par2-par1);
+    wt2 = 1. + (parinterp-par2)/(par2-par1);
+  }
+
+  // interpolated cdf, in one pass over the precomputed points
+  Int_t np = y_.size(), nx3 = np - 1;
+  xdisn_.resize(np);
+  const double *x1 = &x1_[0], *x2 = &x2_[0];
+  double *xdisn = &xdisn_[0];
+  for (Int_t k = 0; k < np; ++k) xdisn[k] = wt1*x1[k] + wt2*x2[k];
+  const std::vector<double> &sigdisn = y_;
+
+  // projection on the output edges, as in th1fmorph_
+  sigdisf_.resize(nbn+1);
+  Double_t x = bedgesn_[nbn], y;
+  Int_t ix = nbn;
+  while (x >= xdisn[nx3]) {
+    sigdisf_[ix] = sigdisn[nx3];
+    if (--ix < 0) break;
+    x = bedgesn_[ix];
+  }
+  Int_t ixl = ix + 1;
+  ix = 0;
+  while (ix < nbn && bedgesn_[ix+1] <= xdisn[0]) {
+    sigdisf_[ix] = sigdisn[0];
+    ix++;
+  }
+  Int_t ixf = ix;
+  Int_t ix3 = 0;
+  for (ix = ixf; ix < ixl; ix++) {
+    x = bedgesn_[ix];
+    if (x < xdisn[0]) {
+      y = 0;
+    } else if (x > xdisn[nx3]) {
+      y = 1.;
+    } else {
+      while (ix3+1 < nx3 && xdisn[ix3+1] <= x) ix3++;
+      if (xdisn[ix3+1]-x > 1.1*dx2_[ix]) { // Empty bin treatment
+        y = sigdisn[ix3+1];
+      } else if (xdisn[ix3+1] > xdisn[ix3]) {
+        y = sigdisn[ix3] + (sigdisn[ix3+1]-sigdisn[ix3])*(x-xdisn[ix3])/(xdisn[ix3+1]-xdisn[ix3]);
+      } else {
+        y = 0;
+      }
+    }
+    sigdisf_[ix] = y;
+  }
+
+  for (ix = 0; ix < nbn; ++ix) out[ix] = (sigdisf_[ix+1]-sigdisf_[ix])*morphedhistnorm;
+}
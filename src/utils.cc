@@ -1,5 +1,6 @@
 #include "HiggsAnalysis/CombinedLimit/interface/utils.h"
 #include "HiggsAnalysis/CombinedLimit/interface/RooSimultaneousOpt.h"
+#include "HiggsAnalysis/CombinedLimit/interface/VerticalInterpHistPdf.h"
 
 #include <cstdio>
 #include <iostream>
@@ -7,10 +8,20 @@
 #include <cmath>
 #include <vector>
 #include <unordered_map>
+#include <map>
+#include <algorithm>
 #include <string>
 #include <memory>
 #include <typeinfo>
 #include <stdexcept>
+#include <limits>
+#include <fstream>
+#include <cerrno>
+#include <cstring>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 
 #include <TIterator.h>
 #include <TString.h>
@@ -106,6 +117,64 @@ void utils::printPdf(RooWorkspace *w, const char *pdfName) {
   params->Print("V");
 }
 
+namespace {
+    /// Memo of term.dependsOn(observables) for the terms reached by factorizePdf and factorizeFunc (--X-rtd UTILS_FACTORIZE_CACHE),
+    /// which is what makes them expensive, since it walks the whole graph below each term.
+    /// Sets of observables are identified by the names they contain; an entry is used only if the term has the same name and
+    /// the same number of servers as when it was made, otherwise it's computed again.
+    struct FactorizeCache {
+        struct Entry { const TNamed *name; int servers; bool depends; };
+        std::vector<std::string> obsKeys;
+        std::vector<std::unordered_map<const RooAbsArg *, Entry> > byObs; // one map for each set of observables
+        // the recursive calls all come with the same set, so the last one is checked first, just comparing the pointers
+        std::vector<const RooAbsArg *> lastObs; int lastObsId;
+        FactorizeCache() : lastObsId(-1) {}
+        void clear() { obsKeys.clear(); byObs.clear(); lastObs.clear(); lastObsId = -1; }
+        int obsId(const RooAbsCollection &observables) {
+            if (lastObsId != -1 && int(lastObs.size()) == observables.getSize()) {
+                bool same = true; int i = 0;
+                RooFIter iter = observables.fwdIterator();
+                for (RooAbsArg *a = iter.next(); a != 0 && same; a = iter.next(), ++i) same = (a == lastObs[i]);
+                if (same) return lastObsId;
+            }
+            std::vector<std::string> names; lastObs.clear();
+            RooFIter iter = observables.fwdIterator();
+            for (RooAbsArg *a = iter.next(); a != 0; a = iter.next()) { names.push_back(a->GetName()); lastObs.push_back(a); }
+            std::sort(names.begin(), names.end());
+            std::string key;
+            for (const std::string &n : names) { key += n; key += ','; }
+            std::vector<std::string>::const_iterator match = std::find(obsKeys.begin(), obsKeys.end(), key);
+            lastObsId = match - obsKeys.begin();
+            if (match == obsKeys.end()) { obsKeys.push_back(key); byObs.resize(obsKeys.size()); }
+            return lastObsId;
+        }
+    };
+    FactorizeCache factorizeCache_;
+
+    int countServers(const RooAbsArg &arg) {
+        int n = 0;
+        std::auto_ptr<TIterator> iter(arg.serverIterator());
+        while (iter->Next() != 0) ++n;
+        return n;
+    }
+
+    bool dependsOnObs(const RooAbsArg &term, const RooArgSet &observables) {
+        static bool cache = runtimedef::get("UTILS_FACTORIZE_CACHE");
+        if (!cache) return term.dependsOn(observables);
+        std::unordered_map<const RooAbsArg *, FactorizeCache::Entry> &entries = factorizeCache_.byObs[factorizeCache_.obsId(observables)];
+        int servers = countServers(term);
+        std::unordered_map<const RooAbsArg *, FactorizeCache::Entry>::iterator match = entries.find(&term);
+        if (match != entries.end() && match->second.name == term.namePtr() && match->second.servers == servers) return match->second.depends;
+        FactorizeCache::Entry &e = entries[&term];
+        e.name = term.namePtr(); e.servers = servers; e.depends = term.dependsOn(observables);
+        return e.depends;
+    }
+}
+
+void utils::clearFactorizeCache() {
+    factorizeCache_.clear();
+}
+
 RooAbsPdf *utils::factorizePdf(const RooArgSet &observables, RooAbsPdf &pdf, RooArgList &constraints) {
     assert(&pdf);
     const std::type_info & id = typeid(pdf);
@@ -173,7 +242,7 @@ RooAbsPdf *utils::factorizePdf(const RooArgSet &observables, RooAbsPdf &pdf, Roo
         delete cat;
         copyAttributes(pdf, *ret);
         return ret;
-    } else if (pdf.dependsOn(observables)) {
+    } else if (dependsOnObs(pdf, observables)) {
         return &pdf;
     } else {
         if (!constraints.contains(pdf) && (!pdf.getAttribute("ignoreConstraint"))) constraints.add(pdf);
@@ -211,7 +280,7 @@ void utils::factorizePdf(const RooArgSet &observables, RooAbsPdf &pdf, RooArgLis
             if (pdfi != 0) factorizePdf(observables, *pdfi, obsTerms, constraints);
         }
         delete cat;
-    } else if (pdf.dependsOn(observables)) {
+    } else if (dependsOnObs(pdf, observables)) {
         if (!obsTerms.contains(pdf)) obsTerms.add(pdf);
     } else {
         if (!constraints.contains(pdf) && (!pdf.getAttribute("ignoreConstraint")) ) constraints.add(pdf);
@@ -238,7 +307,7 @@ void utils::factorizeFunc(const RooArgSet &observables, RooAbsReal &func, RooArg
             //std::cout << "  component " << funci->GetName() << " of type " << funci->ClassName() << "(dep obs? " << funci->dependsOn(observables) << ")" << std::endl;
             factorizeFunc(observables, *funci, obsTerms, constraints, true);
         }
-    } else if (func.dependsOn(observables)) {
+    } else if (dependsOnObs(func, observables)) {
         if (!obsTerms.contains(func) || keepDuplicate) obsTerms.add(func);
     } else {
         if (( !constraints.contains(func) && (!func.getAttribute("ignoreConstraint")) ) || keepDuplicate) constraints.add(func);
@@ -300,6 +369,100 @@ RooAbsReal *utils::fullCloneFunc(const RooAbsReal *pdf, const RooArgSet &obs, Ro
 
 
 
+namespace {
+    /// largest relative difference between a and b on the bin centers of obs (one or two RooRealVars) 
+    double maxHistPdfDifference(const RooAbsPdf &a, const RooAbsPdf &b, const RooArgSet &obs) {
+        std::vector<RooRealVar *> vars;
+        RooFIter iter = obs.fwdIterator();
+        for (RooAbsArg *o = iter.next(); o != 0; o = iter.next()) {
+            RooRealVar *v = dynamic_cast<RooRealVar *>(o);
+            if (v == 0) return std::numeric_limits<double>::infinity();
+            vars.push_back(v);
+        }
+        if (vars.empty() || vars.size() > 2) return std::numeric_limits<double>::infinity();
+        int nx = vars[0]->numBins(), ny = vars.size() > 1 ? vars[1]->numBins() : 1;
+        double ret = 0;
+        for (int ix = 0; ix < nx; ++ix) {
+            vars[0]->setVal(vars[0]->getBinning().binCenter(ix));
+            for (int iy = 0; iy < ny; ++iy) {
+                if (vars.size() > 1) vars[1]->setVal(vars[1]->getBinning().binCenter(iy));
+                double va = a.getVal(obs), vb = b.getVal(obs);
+                double diff = std::abs(va - vb) / std::max(std::max(std::abs(va), std::abs(vb)), 1e-12);
+                if (std::isnan(diff)) return std::numeric_limits<double>::infinity();
+                ret = std::max(ret, diff);
+            }
+        }
+        return ret;
+    }
+}
+
+int utils::upgradeHistPdfs(RooAbsPdf &pdf, const RooArgSet &observables, double tolerance, int verbose) {
+    RooArgSet nodes;
+    pdf.branchNodeServerList(&nodes);
+    RooArgSet upgraded;
+    int nup = 0, nkept = 0;
+    RooFIter iter = nodes.fwdIterator();
+    for (RooAbsArg *a = iter.next(); a != 0; a = iter.next()) {
+        if (a == &pdf) continue;
+        std::auto_ptr<RooAbsPdf> upgrade;
+        const RooArgList *coefs = 0;
+        if (typeid(*a) == typeid(VerticalInterpHistPdf)) {
+            // through the v1 pdf, which makes the templates from the functions
+            VerticalInterpHistPdf *old = static_cast<VerticalInterpHistPdf *>(a);
+            const RooRealVar *x = dynamic_cast<const RooRealVar *>(&old->x().arg());
+            if (x == 0) continue;
+            FastVerticalInterpHistPdf v1(old->GetName(), old->GetTitle(), *x, old->funcList(), old->coefList(), old->smoothRegion(), old->smoothAlgo());
+            upgrade.reset(new FastVerticalInterpHistPdf2(v1, old->GetName()));
+            coefs = &old->coefList();
+        } else if (typeid(*a) == typeid(FastVerticalInterpHistPdf)) {
+            FastVerticalInterpHistPdf *old = static_cast<FastVerticalInterpHistPdf *>(a);
+            upgrade.reset(new FastVerticalInterpHistPdf2(*old, old->GetName()));
+            coefs = &old->coefList();
+        } else if (typeid(*a) == typeid(FastVerticalInterpHistPdf2D)) {
+            FastVerticalInterpHistPdf2D *old = static_cast<FastVerticalInterpHistPdf2D *>(a);
+            upgrade.reset(new FastVerticalInterpHistPdf2D2(*old, old->GetName()));
+            coefs = &old->coefList();
+        } else {
+            continue;
+        }
+        RooAbsPdf *old = static_cast<RooAbsPdf *>(a);
+        upgrade->SetTitle(old->GetTitle());
+        copyAttributes(*old, *upgrade);
+        // compare them at the current point and moving each parameter to +1 and -1, restoring everything afterwards
+        std::auto_ptr<RooArgSet> obs(old->getObservables(observables));
+        std::auto_ptr<RooArgSet> obsSnap(dynamic_cast<RooArgSet *>(obs->snapshot()));
+        double maxDiff = maxHistPdfDifference(*old, *upgrade, *obs);
+        RooFIter iterC = coefs->fwdIterator();
+        for (RooAbsArg *c = iterC.next(); c != 0 && maxDiff <= tolerance; c = iterC.next()) {
+            RooRealVar *v = dynamic_cast<RooRealVar *>(c);
+            if (v == 0) continue;
+            double v0 = v->getVal();
+            for (double shift : { +1.0, -1.0 }) {
+                v->setVal(shift);
+                maxDiff = std::max(maxDiff, maxHistPdfDifference(*old, *upgrade, *obs));
+            }
+            v->setVal(v0);
+        }
+        *obs = *obsSnap;
+        if (!(maxDiff <= tolerance)) {
+            std::cerr << "Not upgrading " << old->ClassName() << " " << old->GetName() << ": the new pdf differs by up to " << maxDiff << " (relative)" << std::endl;
+            ++nkept;
+            continue;
+        }
+        if (verbose > 1) std::cout << "Upgrading " << old->ClassName() << " " << old->GetName() << " to " << upgrade->ClassName() << " (max relative difference " << maxDiff << ")" << std::endl;
+        // collect the clients first, as redirecting their servers changes the list
+        std::vector<RooAbsArg *> clients;
+        std::auto_ptr<TIterator> clientIter(old->clientIterator());
+        for (RooAbsArg *c = (RooAbsArg *) clientIter->Next(); c != 0; c = (RooAbsArg *) clientIter->Next()) clients.push_back(c);
+        for (RooAbsArg *c : clients) c->redirectServers(RooArgSet(*upgrade), /*mustReplaceAll=*/false, /*nameChange=*/false);
+        upgraded.add(*upgrade.release());
+        ++nup;
+    }
+    if (upgraded.getSize()) pdf.addOwnedComponents(upgraded);
+    if (verbose || nkept) std::cout << "Upgraded " << nup << " legacy template morphing pdfs to FastVerticalInterpHistPdf2" << (nkept ? TString::Format(", kept %d that don't agree", nkept).Data() : "") << std::endl;
+    return nup;
+}
+
 void utils::getClients(const RooAbsCollection &values, const RooAbsCollection &allObjects, RooAbsCollection &clients) {
     std::auto_ptr<TIterator> iterAll(allObjects.createIterator());
     std::auto_ptr<TIterator> iterVal(values.createIterator());
@@ -648,6 +811,85 @@ void utils::CheapValueSnapshot::writeTo(const RooAbsCollection &src) const {
     }
 }
 
+void utils::FastSnapshot::readFrom(const RooAbsCollection &src, bool withRanges) {
+    clear();
+    withRanges_ = withRanges;
+    RooLinkedListIter iter = src.iterator();
+    for (RooAbsArg *a = (RooAbsArg *) iter.Next(); a != 0; a = (RooAbsArg *) iter.Next()) {
+        if (RooRealVar *rrv = dynamic_cast<RooRealVar *>(a)) {
+            RealState st = { rrv, 0, 0, 0, false };
+            reals_.push_back(st);
+        } else if (RooCategory *rc = dynamic_cast<RooCategory *>(a)) {
+            CatState st = { rc, 0, false };
+            cats_.push_back(st);
+        }
+    }
+    update();
+}
+
+void utils::FastSnapshot::update() {
+    for (std::vector<RealState>::iterator it = reals_.begin(), ed = reals_.end(); it != ed; ++it) {
+        it->val = it->var->getVal();
+        it->constant = it->var->isConstant();
+        if (withRanges_) { it->min = it->var->getMin(); it->max = it->var->getMax(); } 
+    }
+    for (std::vector<CatState>::iterator it = cats_.begin(), ed = cats_.end(); it != ed; ++it) {
+        it->index = it->cat->getIndex();
+        it->constant = it->cat->isConstant();
+    }
+}
+
+void utils::FastSnapshot::writeTo() const {
+    // all the ranges first, so that no value is clipped to the current range, of its variable or of one it depends on
+    if (withRanges_) {
+        for (std::vector<RealState>::const_iterator it = reals_.begin(), ed = reals_.end(); it != ed; ++it) {
+            RooRealVar *rrv = it->var;
+            if (rrv->getMin() != it->min || rrv->getMax() != it->max) rrv->setRange(it->min, it->max);
+        }
+    }
+    for (std::vector<RealState>::const_iterator it = reals_.begin(), ed = reals_.end(); it != ed; ++it) {
+        RooRealVar *rrv = it->var;
+        if (rrv->getVal() != it->val) rrv->setVal(it->val);
+        if (rrv->isConstant() != it->constant) rrv->setConstant(it->constant);
+    }
+    for (std::vector<CatState>::const_iterator it = cats_.begin(), ed = cats_.end(); it != ed; ++it) {
+        if (it->cat->getIndex() != it->index) it->cat->setIndex(it->index);
+        if (it->cat->isConstant() != it->constant) it->cat->setAttribute("Constant", it->constant);
+    }
+}
+
+namespace {
+    struct FastWorkspaceSnapshot {
+        const RooArgSet *saved; // the snapshot in the workspace, to know if it was replaced
+        utils::FastSnapshot snap;
+    };
+    std::map<std::pair<const RooWorkspace *, std::string>, FastWorkspaceSnapshot> fastWorkspaceSnapshots_;
+}
+
+void utils::saveSnapshot(RooWorkspace *w, const char *name, const RooArgSet &params) {
+    w->saveSnapshot(name, params);
+    std::pair<const RooWorkspace *, std::string> key(w, name);
+    // the variables are taken from params, so they must be those of the workspace for the two to be the same
+    RooLinkedListIter iter = params.iterator();
+    for (RooAbsArg *a = (RooAbsArg *) iter.Next(); a != 0; a = (RooAbsArg *) iter.Next()) {
+        if (w->arg(a->GetName()) != a) { fastWorkspaceSnapshots_.erase(key); return; }
+    }
+    FastWorkspaceSnapshot &fast = fastWorkspaceSnapshots_[key];
+    fast.saved = w->getSnapshot(name);
+    fast.snap.readFrom(params);
+}
+
+bool utils::loadSnapshot(RooWorkspace *w, const char *name) {
+    std::map<std::pair<const RooWorkspace *, std::string>, FastWorkspaceSnapshot>::const_iterator match = fastWorkspaceSnapshots_.find(std::make_pair(w, std::string(name)));
+    if (match == fastWorkspaceSnapshots_.end() || match->second.saved != w->getSnapshot(name)) return w->loadSnapshot(name);
+    match->second.snap.writeTo();
+    return true;
+}
+
+void utils::clearSnapshots() {
+    fastWorkspaceSnapshots_.clear();
+}
+
 void utils::CheapValueSnapshot::Print(const char *fmt) const {
     if (src_ == 0) { printf("<NIL>\n"); return; }
     if (fmt[0] == 'V') {
@@ -892,3 +1134,129 @@ int utils::countFloating(const RooArgSet &params){
         }
 	return count;
 }
+
+int utils::forkWithLogs(const char *tmpfile, unsigned int i)
+{
+    fflush(stdout); fflush(stderr);
+    pid_t pid = fork();
+    if (pid == -1) throw std::runtime_error(std::string("failed to fork: ")+strerror(errno));
+    if (pid == 0 && (freopen(TString::Format("%s.%u.out.txt", tmpfile, i).Data(), "w", stdout) == 0 ||
+                     freopen(TString::Format("%s.%u.err.txt", tmpfile, i).Data(), "w", stderr) == 0)) {
+        fprintf(stderr, "process %u can't redirect its output to %s.%u.*.txt: %s\n", i, tmpfile, i, strerror(errno));
+    }
+    return pid;
+}
+
+std::string utils::waitForChild(int pid)
+{
+    int cstatus = 0, ret;
+    do { ret = waitpid(pid, &cstatus, 0); } while (ret == -1 && errno == EINTR);
+    if (ret == -1) return std::string("can't be waited for: ")+strerror(errno);
+    if (WIFSIGNALED(cstatus)) return TString::Format("was killed by signal %d", WTERMSIG(cstatus)).Data();
+    if (!WIFEXITED(cstatus) || WEXITSTATUS(cstatus) != 0) return TString::Format("exited with status %d", WEXITSTATUS(cstatus)).Data();
+    return std::string();
+}
+
+void utils::reportFailedChild(const char *who, const char *tmpfile, unsigned int i, const std::string &problem)
+{
+    std::cerr << who << ": process " << i << " " << problem << "; its stderr was:" << std::endl;
+    std::ifstream err(TString::Format("%s.%u.err.txt", tmpfile, i).Data());
+    if (err.good() && err.peek() != std::ifstream::traits_type::eof()) std::cerr << err.rdbuf() << std::flush;
+    else std::cerr << "    (empty)" << std::endl;
+}
+
+unsigned int utils::runInForks(unsigned int first, unsigned int last, const std::function<std::vector<double>(unsigned int)> &job,
+                               std::vector<std::vector<double> > &results, bool parentTakesFirst, bool showOutput, std::vector<bool> *failed)
+{
+    if (results.size() < last) results.resize(last);
+    if (failed && failed->size() < last) failed->resize(last, false);
+    if (first >= last) return 0;
+    char tmpfile[999]; snprintf(tmpfile, 998, "%s/rfork-XXXXXX", P_tmpdir);
+    int fd = mkstemp(tmpfile);
+    if (fd == -1) throw std::runtime_error(std::string("utils::runInForks: can't make a temporary file in ")+P_tmpdir+": "+strerror(errno));
+    close(fd);
+    std::vector<int> pids(last, 0);
+    for (unsigned int i = (parentTakesFirst ? first+1 : first); i < last; ++i) {
+        int pid;
+        try {
+            pid = forkWithLogs(tmpfile, i);
+        } catch (std::exception &ex) {
+            // don't leave the ones already started behind
+            for (unsigned int j = first; j < i; ++j) if (pids[j] > 0) waitForChild(pids[j]);
+            throw std::runtime_error(std::string("utils::runInForks: ")+ex.what());
+        }
+        if (pid != 0) { pids[i] = pid; continue; }
+        // the child
+        int status = 0;
+        std::vector<double> result;
+        try {
+            result = job(i);
+        } catch (std::exception &ex) {
+            std::cerr << "Job " << i << " failed: " << ex.what() << std::endl;
+            status = 1;
+        } catch (...) {
+            std::cerr << "Job " << i << " failed with an unknown exception" << std::endl;
+            status = 1;
+        }
+        if (status == 0) {
+            // the size first, so that the parent can tell a complete result from a truncated one
+            uint64_t size = result.size();
+            FILE *f = fopen(TString::Format("%s.%d.dat", tmpfile, i).Data(), "wb");
+            if (f == 0 || fwrite(&size, sizeof(size), 1, f) != 1 || 
+                (size && fwrite(&result[0], sizeof(double), size, f) != size)) {
+                std::cerr << "Job " << i << " can't write its result: " << strerror(errno) << std::endl;
+                status = 2;
+            }
+            if (f && fclose(f) != 0) status = 2;
+        }
+        fflush(stdout); fflush(stderr);
+        _exit(status); // don't unwind: everything belongs to the parent
+    }
+    if (parentTakesFirst) {
+        try {
+            results[first] = job(first);
+        } catch (...) {
+            for (unsigned int i = first+1; i < last; ++i) waitForChild(pids[i]);
+            for (unsigned int i = first+1; i < last; ++i) {
+                unlink(TString::Format("%s.%d.dat",     tmpfile, i).Data());
+                unlink(TString::Format("%s.%d.out.txt", tmpfile, i).Data());
+                unlink(TString::Format("%s.%d.err.txt", tmpfile, i).Data());
+            }
+            unlink(tmpfile);
+            throw;
+        }
+    }
+    unsigned int nfailed = 0;
+    for (unsigned int i = (parentTakesFirst ? first+1 : first); i < last; ++i) {
+        std::string problem = waitForChild(pids[i]);
+        results[i].clear();
+        if (problem.empty()) {
+            FILE *f = fopen(TString::Format("%s.%d.dat", tmpfile, i).Data(), "rb");
+            uint64_t size = 0;
+            if (f == 0 || fread(&size, sizeof(size), 1, f) != 1) {
+                problem = "didn't send back its result";
+            } else {
+                results[i].resize(size);
+                if (size && fread(&results[i][0], sizeof(double), size, f) != size) {
+                    problem = TString::Format("sent back a truncated result (expected %lu values)", (unsigned long) size).Data();
+                    results[i].clear();
+                }
+            }
+            if (f) fclose(f);
+        }
+        if (showOutput) {
+            std::ifstream log(TString::Format("%s.%d.out.txt", tmpfile, i).Data());
+            if (log.good()) std::cout << log.rdbuf() << std::flush;
+        }
+        if (!problem.empty()) {
+            nfailed++;
+            if (failed) (*failed)[i] = true;
+            reportFailedChild("utils::runInForks", tmpfile, i, problem);
+        }
+        unlink(TString::Format("%s.%d.dat",     tmpfile, i).Data());
+        unlink(TString::Format("%s.%d.out.txt", tmpfile, i).Data());
+        unlink(TString::Format("%s.%d.err.txt", tmpfile, i).Data());
+    }
+    unlink(tmpfile);
+    return nfailed;
+}
@@ -1,36 +1,406 @@
 #include "vectorized.h"
 #include <HiggsAnalysis/CombinedLimit/interface/Accumulators.h>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define VECTORIZED_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+// The kernels below come in one version per instruction set, and the best one supported by the CPU is picked
+// at runtime on the first call (the environment variable COMBINE_VECTORIZED_ISA=scalar|sse4|avx2|avx512 can
+// be used to force a lower one). They all give the same results up to the rounding of the sums in dot_product,
+// sum and nll_reduce, which are done per lane (with Kahan compensation) and then combined.
+
+namespace {
+    typedef void   (*mul_add_t)(const uint32_t size, double coeff, double const * __restrict__ iarray, double* __restrict__ oarray) ;
+    typedef void   (*mul_inplace_t)(const uint32_t size, double const * __restrict__ iarray, double* __restrict__ oarray) ;
+    typedef double (*dot_product_t)(const uint32_t size, double const * __restrict__ iarray, double const * __restrict__ iarray2) ;
+    typedef double (*sum_t)(const uint32_t size, double const * __restrict__ iarray) ;
+    typedef void   (*unary_t)(const uint32_t size, double const * __restrict__ iarray, double* __restrict__ oarray) ;
+    typedef void   (*gather_t)(const uint32_t size, uint32_t const * __restrict__ index, double const * __restrict__ values, double* __restrict__ oarray) ;
+
+    struct Kernels {
+        vectorized::ISA isa;
+        mul_add_t     mul_add;
+        mul_inplace_t mul_inplace;
+        dot_product_t dot_product;
+        sum_t         sum;
+        unary_t       logv, expv;
+        gather_t      gather, gather_mul;
+    };
+
+    //=== scalar versions, relying on compiler auto-vectorization and on the vdt library
+    void mul_add_scalar(const uint32_t size, double coeff, double const * __restrict__ iarray, double* __restrict__ oarray) {
+        for (uint32_t i = 0; i < size; ++i) {
+            oarray[i] += coeff * iarray[i];
+        }
+    }
+    void mul_inplace_scalar(const uint32_t size, double const * __restrict__ iarray, double* __restrict__ oarray) {
+        for (uint32_t i = 0; i < size; ++i) {
+            oarray[i] *= iarray[i];
+        }
+    }
+    double kahanFold(unsigned int nlanes, const double *sums, const double *comps, const uint32_t from, const uint32_t size, double const * vec1, double const * vec2) ;
+    double dot_product_scalar(const uint32_t size, double const * __restrict__ vec1, double const *  __restrict__ vec2) {
+        // four lanes as in the AVX2 version, so that each addition doesn't wait for the previous one
+        double sums[4] = { 0, 0, 0, 0 }, comps[4] = { 0, 0, 0, 0 };
+        uint32_t i = 0;
+        for (; i + 4 <= size; i += 4) {
+            for (unsigned int j = 0; j < 4; ++j) {
+                double y = vec1[i+j]*vec2[i+j] - comps[j];
+                double t = sums[j] + y;
+                comps[j] = (t - sums[j]) - y;
+                sums[j] = t;
+            }
+        }
+        return kahanFold(4, sums, comps, i, size, vec1, vec2);
+    }
+    double sum_scalar(const uint32_t size, double const * __restrict__ iarray) {
+        return sumKahanLanes(iarray, size);
+    }
+    void logv_scalar(const uint32_t size, double const * __restrict__ iarray, double* __restrict__ oarray) {
+        vdt::fast_logv(size, iarray, oarray);
+    }
+    void expv_scalar(const uint32_t size, double const * __restrict__ iarray, double* __restrict__ oarray) {
+        vdt::fast_expv(size, iarray, oarray);
+    }
+    void gather_scalar(const uint32_t size, uint32_t const * __restrict__ index, double const * __restrict__ values, double* __restrict__ oarray) {
+        for (uint32_t i = 0; i < size; ++i) oarray[i] = values[index[i]];
+    }
+    void gather_mul_scalar(const uint32_t size, uint32_t const * __restrict__ index, double const * __restrict__ values, double* __restrict__ oarray) {
+        for (uint32_t i = 0; i < size; ++i) oarray[i] *= values[index[i]];
+    }
+
+    // combine the per-lane Kahan sums and compensations, and add the remaining elements
+    double kahanFold(unsigned int nlanes, const double *sums, const double *comps, const uint32_t from, const uint32_t size, double const * vec1, double const * vec2) {
+        DefaultAccumulator ret = 0;
+        for (unsigned int j = 0; j < nlanes; ++j) { ret += sums[j]; ret -= comps[j]; }
+        for (uint32_t i = from; i < size; ++i) ret += vec1[i]*vec2[i];
+        return ret.sum();
+    }
+    double kahanFoldSum(unsigned int nlanes, const double *sums, const double *comps, const uint32_t from, const uint32_t size, double const * vec) {
+        DefaultAccumulator ret = 0;
+        for (unsigned int j = 0; j < nlanes; ++j) { ret += sums[j]; ret -= comps[j]; }
+        for (uint32_t i = from; i < size; ++i) ret += vec[i];
+        return ret.sum();
+    }
+
+#ifdef VECTORIZED_X86
+    //=== SSE4 (two doubles per register)
+    __attribute__((target("sse4.2")))
+    void mul_add_sse4(const uint32_t size, double coeff, double const * __restrict__ iarray, double* __restrict__ oarray) {
+        const __m128d c = _mm_set1_pd(coeff);
+        uint32_t i = 0;
+        for (; i + 2 <= size; i += 2) {
+            _mm_storeu_pd(oarray+i, _mm_add_pd(_mm_loadu_pd(oarray+i), _mm_mul_pd(c, _mm_loadu_pd(iarray+i))));
+        }
+        for (; i < size; ++i) oarray[i] += coeff * iarray[i];
+    }
+    __attribute__((target("sse4.2")))
+    void mul_inplace_sse4(const uint32_t size, double const * __restrict__ iarray, double* __restrict__ oarray) {
+        uint32_t i = 0;
+        for (; i + 2 <= size; i += 2) {
+            _mm_storeu_pd(oarray+i, _mm_mul_pd(_mm_loadu_pd(oarray+i), _mm_loadu_pd(iarray+i)));
+        }
+        for (; i < size; ++i) oarray[i] *= iarray[i];
+    }
+    __attribute__((target("sse4.2")))
+    double dot_product_sse4(const uint32_t size, double const * __restrict__ vec1, double const *  __restrict__ vec2) {
+        __m128d sum = _mm_setzero_pd(), comp = _mm_setzero_pd();
+        uint32_t i = 0;
+        for (; i + 2 <= size; i += 2) {
+            __m128d y = _mm_sub_pd(_mm_mul_pd(_mm_loadu_pd(vec1+i), _mm_loadu_pd(vec2+i)), comp);
+            __m128d t = _mm_add_pd(sum, y);
+            comp = _mm_sub_pd(_mm_sub_pd(t, sum), y);
+            sum = t;
+        }
+        double sums[2], comps[2];
+        _mm_storeu_pd(sums, sum); _mm_storeu_pd(comps, comp);
+        return kahanFold(2, sums, comps, i, size, vec1, vec2);
+    }
+    __attribute__((target("sse4.2")))
+    double sum_sse4(const uint32_t size, double const * __restrict__ iarray) {
+        __m128d sum = _mm_setzero_pd(), comp = _mm_setzero_pd();
+        uint32_t i = 0;
+        for (; i + 2 <= size; i += 2) {
+            __m128d y = _mm_sub_pd(_mm_loadu_pd(iarray+i), comp);
+            __m128d t = _mm_add_pd(sum, y);
+            comp = _mm_sub_pd(_mm_sub_pd(t, sum), y);
+            sum = t;
+        }
+        double sums[2], comps[2];
+        _mm_storeu_pd(sums, sum); _mm_storeu_pd(comps, comp);
+        return kahanFoldSum(2, sums, comps, i, size, iarray);
+    }
+    __attribute__((target("sse4.2")))
+    void logv_sse4(const uint32_t size, double const * __restrict__ iarray, double* __restrict__ oarray) {
+        for (uint32_t i = 0; i < size; ++i) oarray[i] = vdt::fast_log(iarray[i]);
+    }
+    __attribute__((target("sse4.2")))
+    void expv_sse4(const uint32_t size, double const * __restrict__ iarray, double* __restrict__ oarray) {
+        for (uint32_t i = 0; i < size; ++i) oarray[i] = vdt::fast_exp(iarray[i]);
+    }
+
+    //=== AVX2 (four doubles per register).
+    // FMA is deliberately not used, so that mul_add gives the same result bit by bit on all CPUs
+    __attribute__((target("avx2")))
+    void mul_add_avx2(const uint32_t size, double coeff, double const * __restrict__ iarray, double* __restrict__ oarray) {
+        const __m256d c = _mm256_set1_pd(coeff);
+        uint32_t i = 0;
+        for (; i + 4 <= size; i += 4) {
+            _mm256_storeu_pd(oarray+i, _mm256_add_pd(_mm256_loadu_pd(oarray+i), _mm256_mul_pd(c, _mm256_loadu_pd(iarray+i))));
+        }
+        for (; i < size; ++i) oarray[i] += coeff * iarray[i];
+    }
+    __attribute__((target("avx2")))
+    void mul_inplace_avx2(const uint32_t size, double const * __restrict__ iarray, double* __restrict__ oarray) {
+        uint32_t i = 0;
+        for (; i + 4 <= size; i += 4) {
+            _mm256_storeu_pd(oarray+i, _mm256_mul_pd(_mm256_loadu_pd(oarray+i), _mm256_loadu_pd(iarray+i)));
+        }
+        for (; i < size; ++i) oarray[i] *= iarray[i];
+    }
+    __attribute__((target("avx2")))
+    double dot_product_avx2(const uint32_t size, double const * __restrict__ vec1, double const *  __restrict__ vec2) {
+        __m256d sum = _mm256_setzero_pd(), comp = _mm256_setzero_pd();
+        uint32_t i = 0;
+        for (; i + 4 <= size; i += 4) {
+            __m256d y = _mm256_sub_pd(_mm256_mul_pd(_mm256_loadu_pd(vec1+i), _mm256_loadu_pd(vec2+i)), comp);
+            __m256d t = _mm256_add_pd(sum, y);
+            comp = _mm256_sub_pd(_mm256_sub_pd(t, sum), y);
+            sum = t;
+        }
+        double sums[4], comps[4];
+        _mm256_storeu_pd(sums, sum); _mm256_storeu_pd(comps, comp);
+        return kahanFold(4, sums, comps, i, size, vec1, vec2);
+    }
+    __attribute__((target("avx2")))
+    double sum_avx2(const uint32_t size, double const * __restrict__ iarray) {
+        __m256d sum = _mm256_setzero_pd(), comp = _mm256_setzero_pd();
+        uint32_t i = 0;
+        for (; i + 4 <= size; i += 4) {
+            __m256d y = _mm256_sub_pd(_mm256_loadu_pd(iarray+i), comp);
+            __m256d t = _mm256_add_pd(sum, y);
+            comp = _mm256_sub_pd(_mm256_sub_pd(t, sum), y);
+            sum = t;
+        }
+        double sums[4], comps[4];
+        _mm256_storeu_pd(sums, sum); _mm256_storeu_pd(comps, comp);
+        return kahanFoldSum(4, sums, comps, i, size, iarray);
+    }
+    __attribute__((target("avx2")))
+    void logv_avx2(const uint32_t size, double const * __restrict__ iarray, double* __restrict__ oarray) {
+        for (uint32_t i = 0; i < size; ++i) oarray[i] = vdt::fast_log(iarray[i]);
+    }
+    __attribute__((target("avx2")))
+    void expv_avx2(const uint32_t size, double const * __restrict__ iarray, double* __restrict__ oarray) {
+        for (uint32_t i = 0; i < size; ++i) oarray[i] = vdt::fast_exp(iarray[i]);
+    }
+    // the masked gathers with all lanes set and an explicit zero source: the unmasked ones start from an undefined
+    // register, which g++ reports as maybe-uninitialized
+    __attribute__((target("avx2")))
+    inline __m256d gather4(double const * values, uint32_t const * index) {
+        return _mm256_mask_i32gather_pd(_mm256_setzero_pd(), values, _mm_loadu_si128((const __m128i *)index), _mm256_castsi256_pd(_mm256_set1_epi64x(-1)), 8);
+    }
+    __attribute__((target("avx2")))
+    void gather_avx2(const uint32_t size, uint32_t const * __restrict__ index, double const * __restrict__ values, double* __restrict__ oarray) {
+        uint32_t i = 0;
+        for (; i + 4 <= size; i += 4) {
+            _mm256_storeu_pd(oarray+i, gather4(values, index+i));
+        }
+        for (; i < size; ++i) oarray[i] = values[index[i]];
+    }
+    __attribute__((target("avx2")))
+    void gather_mul_avx2(const uint32_t size, uint32_t const * __restrict__ index, double const * __restrict__ values, double* __restrict__ oarray) {
+        uint32_t i = 0;
+        for (; i + 4 <= size; i += 4) {
+            __m256d v = gather4(values, index+i);
+            _mm256_storeu_pd(oarray+i, _mm256_mul_pd(_mm256_loadu_pd(oarray+i), v));
+        }
+        for (; i < size; ++i) oarray[i] *= values[index[i]];
+    }
+
+    //=== AVX-512 (eight doubles per register)
+    __attribute__((target("avx512f")))
+    void mul_add_avx512(const uint32_t size, double coeff, double const * __restrict__ iarray, double* __restrict__ oarray) {
+        const __m512d c = _mm512_set1_pd(coeff);
+        uint32_t i = 0;
+        for (; i + 8 <= size; i += 8) {
+            _mm512_storeu_pd(oarray+i, _mm512_add_pd(_mm512_loadu_pd(oarray+i), _mm512_mul_pd(c, _mm512_loadu_pd(iarray+i))));
+        }
+        for (; i < size; ++i) oarray[i] += coeff * iarray[i];
+    }
+    __attribute__((target("avx512f")))
+    void mul_inplace_avx512(const uint32_t size, double const * __restrict__ iarray, double* __restrict__ oarray) {
+        uint32_t i = 0;
+        for (; i + 8 <= size; i += 8) {
+            _mm512_storeu_pd(oarray+i, _mm512_mul_pd(_mm512_loadu_pd(oarray+i), _mm512_loadu_pd(iarray+i)));
+        }
+        for (; i < size; ++i) oarray[i] *= iarray[i];
+    }
+    __attribute__((target("avx512f")))
+    double dot_product_avx512(const uint32_t size, double const * __restrict__ vec1, double const *  __restrict__ vec2) {
+        __m512d sum = _mm512_setzero_pd(), comp = _mm512_setzero_pd();
+        uint32_t i = 0;
+        for (; i + 8 <= size; i += 8) {
+            __m512d y = _mm512_sub_pd(_mm512_mul_pd(_mm512_loadu_pd(vec1+i), _mm512_loadu_pd(vec2+i)), comp);
+            __m512d t = _mm512_add_pd(sum, y);
+            comp = _mm512_sub_pd(_mm512_sub_pd(t, sum), y);
+            sum = t;
+        }
+        double sums[8], comps[8];
+        _mm512_storeu_pd(sums, sum); _mm512_storeu_pd(comps, comp);
+        return kahanFold(8, sums, comps, i, size, vec1, vec2);
+    }
+    __attribute__((target("avx512f")))
+    double sum_avx512(const uint32_t size, double const * __restrict__ iarray) {
+        __m512d sum = _mm512_setzero_pd(), comp = _mm512_setzero_pd();
+        uint32_t i = 0;
+        for (; i + 8 <= size; i += 8) {
+            __m512d y = _mm512_sub_pd(_mm512_loadu_pd(iarray+i), comp);
+            __m512d t = _mm512_add_pd(sum, y);
+            comp = _mm512_sub_pd(_mm512_sub_pd(t, sum), y);
+            sum = t;
+        }
+        double sums[8], comps[8];
+        _mm512_storeu_pd(sums, sum); _mm512_storeu_pd(comps, comp);
+        return kahanFoldSum(8, sums, comps, i, size, iarray);
+    }
+    __attribute__((target("avx512f")))
+    void logv_avx512(const uint32_t size, double const * __restrict__ iarray, double* __restrict__ oarray) {
+        for (uint32_t i = 0; i < size; ++i) oarray[i] = vdt::fast_log(iarray[i]);
+    }
+    __attribute__((target("avx512f")))
+    void expv_avx512(const uint32_t size, double const * __restrict__ iarray, double* __restrict__ oarray) {
+        for (uint32_t i = 0; i < size; ++i) oarray[i] = vdt::fast_exp(iarray[i]);
+    }
+    __attribute__((target("avx512f")))
+    inline __m512d gather8(double const * values, uint32_t const * index) {
+        return _mm512_mask_i32gather_pd(_mm512_setzero_pd(), 0xFF, _mm256_loadu_si256((const __m256i *)index), values, 8);
+    }
+    __attribute__((target("avx512f")))
+    void gather_avx512(const uint32_t size, uint32_t const * __restrict__ index, double const * __restrict__ values, double* __restrict__ oarray) {
+        uint32_t i = 0;
+        for (; i + 8 <= size; i += 8) {
+            _mm512_storeu_pd(oarray+i, gather8(values, index+i));
+        }
+        for (; i < size; ++i) oarray[i] = values[index[i]];
+    }
+    __attribute__((target("avx512f")))
+    void gather_mul_avx512(const uint32_t size, uint32_t const * __restrict__ index, double const * __restrict__ values, double* __restrict__ oarray) {
+        uint32_t i = 0;
+        for (; i + 8 <= size; i += 8) {
+            __m512d v = gather8(values, index+i);
+            _mm512_storeu_pd(oarray+i, _mm512_mul_pd(_mm512_loadu_pd(oarray+i), v));
+        }
+        for (; i < size; ++i) oarray[i] *= values[index[i]];
+    }
+
+    // highest instruction set supported by both the CPU and the OS (which must save the wide registers)
+    vectorized::ISA cpuISA() {
+        unsigned int eax, ebx, ecx, edx;
+        if (__get_cpuid_max(0, 0) < 1) return vectorized::ISA_Scalar;
+        __cpuid(1, eax, ebx, ecx, edx);
+        if (!(ecx & bit_SSE4_2)) return vectorized::ISA_Scalar;
+        bool osxsave = (ecx & (1u << 27)), avx = (ecx & (1u << 28));
+        if (!osxsave || !avx || __get_cpuid_max(0, 0) < 7) return vectorized::ISA_SSE4;
+        unsigned int xcr0lo, xcr0hi;
+        __asm__ ("xgetbv" : "=a" (xcr0lo), "=d" (xcr0hi) : "c" (0));
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        if ((xcr0lo & 0x6) != 0x6 || !(ebx & (1u << 5))) return vectorized::ISA_SSE4;
+        if ((xcr0lo & 0xe6) != 0xe6 || !(ebx & (1u << 16))) return vectorized::ISA_AVX2;
+        return vectorized::ISA_AVX512;
+    }
+#else
+    vectorized::ISA cpuISA() { return vectorized::ISA_Scalar; }
+#endif
+
+    Kernels makeKernels(vectorized::ISA isa) {
+        Kernels k = { vectorized::ISA_Scalar, &mul_add_scalar, &mul_inplace_scalar, &dot_product_scalar, &sum_scalar, &logv_scalar, &expv_scalar, &gather_scalar, &gather_mul_scalar };
+#ifdef VECTORIZED_X86
+        switch (isa) {
+            case vectorized::ISA_AVX512:
+                k = { isa, &mul_add_avx512, &mul_inplace_avx512, &dot_product_avx512, &sum_avx512, &logv_avx512, &expv_avx512, &gather_avx512, &gather_mul_avx512 }; break;
+            case vectorized::ISA_AVX2:
+                k = { isa, &mul_add_avx2, &mul_inplace_avx2, &dot_product_avx2, &sum_avx2, &logv_avx2, &expv_avx2, &gather_avx2, &gather_mul_avx2 }; break;
+            case vectorized::ISA_SSE4: // no gather instructions before AVX2
+                k = { isa, &mul_add_sse4, &mul_inplace_sse4, &dot_product_sse4, &sum_sse4, &logv_sse4, &expv_sse4, &gather_scalar, &gather_mul_scalar }; break;
+            default:
+                break;
+        }
+#endif
+        return k;
+    }
+
+    vectorized::ISA chooseISA() {
+        vectorized::ISA best = cpuISA();
+        const char *env = getenv("COMBINE_VECTORIZED_ISA");
+        if (env == 0 || *env == 0) return best;
+        for (int i = vectorized::ISA_Scalar; i <= vectorized::ISA_AVX512; ++i) {
+            vectorized::ISA req = vectorized::ISA(i);
+            if (strcmp(env, vectorized::isaName(req)) != 0) continue;
+            if (req > best) {
+                fprintf(stderr, "WARNING: COMBINE_VECTORIZED_ISA=%s is not supported by this CPU, will use %s\n", env, vectorized::isaName(best));
+                return best;
+            }
+            return req;
+        }
+        fprintf(stderr, "WARNING: unknown COMBINE_VECTORIZED_ISA=%s (allowed: scalar, sse4, avx2, avx512), will use %s\n", env, vectorized::isaName(best));
+        return best;
+    }
+
+    const Kernels & kernels() {
+        static const Kernels k = makeKernels(chooseISA());
+        return k;
+    }
+}
+
+vectorized::ISA vectorized::isa() {
+    return kernels().isa;
+}
+
+const char * vectorized::isaName(vectorized::ISA isa) {
+    switch (isa) {
+        case ISA_SSE4:   return "sse4";
+        case ISA_AVX2:   return "avx2";
+        case ISA_AVX512: return "avx512";
+        default:         return "scalar";
+    }
+}
 
 void vectorized::mul_add(const uint32_t size, double coeff, double const * __restrict__ iarray, double* __restrict__ oarray) {
-    for (uint32_t i = 0; i < size; ++i) {
-        oarray[i] += coeff * iarray[i];
-    } 
+    kernels().mul_add(size, coeff, iarray, oarray);
 }
 void vectorized::mul_inplace(const uint32_t size, double const * __restrict__ iarray, double* __restrict__ oarray) {
-    for (uint32_t i = 0; i < size; ++i) {
-        oarray[i] *= iarray[i];
-    } 
+    kernels().mul_inplace(size, iarray, oarray);
+}
+void vectorized::gather(const uint32_t size, uint32_t const * __restrict__ index, double const * __restrict__ values, double* __restrict__ oarray) {
+    kernels().gather(size, index, values, oarray);
+}
+void vectorized::gather_mul(const uint32_t size, uint32_t const * __restrict__ index, double const * __restrict__ values, double* __restrict__ oarray) {
+    kernels().gather_mul(size, index, values, oarray);
+}
+void vectorized::logv(const uint32_t size, double const * __restrict__ iarray, double* __restrict__ oarray) {
+    kernels().logv(size, iarray, oarray);
+}
+void vectorized::expv(const uint32_t size, double const * __restrict__ iarray, double* __restrict__ oarray) {
+    kernels().expv(size, iarray, oarray);
 }
 
 double vectorized::nll_reduce(const uint32_t size, double* __restrict__ pdfvals, double const * __restrict__ weights, double sumcoeff,  double *  __restrict__ workingArea) {
+    const Kernels & k = kernels();
     double invsum = 1.0/sumcoeff;
     for (uint32_t i = 0; i < size; ++i) {
         pdfvals[i] *= invsum;
     }
 
-    vdt::fast_logv(size, pdfvals, workingArea);
-
-    for (uint32_t i = 0; i < size; ++i) {
-        pdfvals[i] = weights[i] * workingArea[i];
-    }
-
+    k.logv(size, pdfvals, workingArea);
 
-    DefaultAccumulator ret = 0;
-    for (uint32_t i = 0; i < size; ++i) {
-        ret += pdfvals[i];
-    }
-
-    return ret.sum();
+    return k.dot_product(size, weights, workingArea);
 }
 
 void vectorized::gaussians(const uint32_t size, double mean, double sigma, double norm, const double* __restrict__ xvals, double * __restrict__ out, double * __restrict__ workingArea, double * __restrict__ workingArea2)
@@ -39,7 +409,7 @@ void vectorized::gaussians(const uint32_t size, double mean, double sigma, doubl
     for (uint32_t i = 0; i < size; ++i) {
         workingArea[i] = xscale * std::pow(xvals[i] - mean, 2);
     }
-    vdt::fast_expv(size, workingArea, workingArea2);
+    kernels().expv(size, workingArea, workingArea2);
     double inorm = 1.0/norm;
     for (uint32_t i = 0; i < size; ++i) {
         out[i] = inorm*workingArea2[i];
@@ -53,26 +423,24 @@ void vectorized::exponentials(const uint32_t size, double lambda, double norm, c
     for (uint32_t i = 0; i < size; ++i) {
         workingArea[i] = xvals[i] * lambda + lognfact;
     }
-    vdt::fast_expv(size, workingArea, out);
+    kernels().expv(size, workingArea, out);
 }
 
 void vectorized::powers(const uint32_t size, double exponent, double norm, const double* __restrict__ xvals, double * __restrict__ out, double * __restrict__ workingArea)
 {
     //out[i] = std::pow(xvals[i],exponent) * nfact; // nfact = 1.0/norm
+    const Kernels & k = kernels();
     double lognfact = -std::log(norm);
-    vdt::fast_logv(size, xvals, workingArea);
+    k.logv(size, xvals, workingArea);
     for (uint32_t i = 0; i < size; ++i) {
         workingArea[i] = workingArea[i]*exponent + lognfact;
     }
-    vdt::fast_expv(size, workingArea, out);
+    k.expv(size, workingArea, out);
 }
 
 double vectorized::dot_product(const uint32_t size, double const * __restrict__ vec1, double const *  __restrict__ vec2) {
-    DefaultAccumulator ret = 0;
-    for (uint32_t i = 0; i < size; ++i) {
-        ret += vec1[i]*vec2[i];
-    }
-    return ret.sum();
+    return kernels().dot_product(size, vec1, vec2);
+}
+double vectorized::sum(const uint32_t size, double const * __restrict__ iarray) {
+    return kernels().sum(size, iarray);
 }
-
-
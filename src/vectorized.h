@@ -1,12 +1,31 @@
 #include "vdt/vdtMath.h"
 
 namespace vectorized {
+    // instruction sets for which the kernels are available
+    enum ISA { ISA_Scalar = 0, ISA_SSE4, ISA_AVX2, ISA_AVX512 };
+
+    // instruction set in use, chosen from CPUID at the first call unless forced lower with COMBINE_VECTORIZED_ISA
+    ISA isa() ;
+    const char * isaName(ISA isa) ;
+
     // oarray += coeff * iarray
     void mul_add(const uint32_t size, double coeff, double const * __restrict__ iarray, double* __restrict__ oarray) ;
 
     // oarray *= iarray
     void mul_inplace(const uint32_t size, double const * __restrict__ iarray, double* __restrict__ oarray) ;
 
+    // oarray = values[index] (the indices must be below 2^31)
+    void gather(const uint32_t size, uint32_t const * __restrict__ index, double const * __restrict__ values, double* __restrict__ oarray) ;
+
+    // oarray *= values[index]
+    void gather_mul(const uint32_t size, uint32_t const * __restrict__ index, double const * __restrict__ values, double* __restrict__ oarray) ;
+
+    // oarray = log(iarray), with vdt (the arrays must not overlap)
+    void logv(const uint32_t size, double const * __restrict__ iarray, double* __restrict__ oarray) ;
+
+    // oarray = exp(iarray), with vdt (the arrays must not overlap)
+    void expv(const uint32_t size, double const * __restrict__ iarray, double* __restrict__ oarray) ;
+
     // nll_reduce = sum ( weights * log(pdfvals/sumCoeff) )
     double nll_reduce(const uint32_t size, double* __restrict__ pdfvals, double const * __restrict__ weights, double sumcoeff, double *  __restrict__ workingArea) ;
 
@@ -21,5 +40,8 @@ namespace vectorized {
 
     // dot product of two vectors 
     double dot_product(const uint32_t size, double const * __restrict__ iarray, double const * __restrict__ iarray2) ;
+
+    // sum of the elements, with the same compensation as dot_product
+    double sum(const uint32_t size, double const * __restrict__ iarray) ;
 }
 
@@ -39,13 +39,9 @@ f.write("mkdir scratch\n")
 f.write("cd scratch\n")
 f.write("cp -p %s . \n" % (wslocation) )
 
-# Loop over number of points, and add wait after npoints/nCPU jobs
-ext = " & " if options.nCPU>1 else " " 
-for i,po in enumerate(points):
-  f.write("combine -M Asymptotic %s -m %.1f --singlePoint %f -n %.1f %s %s \n" % (ws,mass,po,po,ext,options.options) )
-  if (i>0 and i%options.nCPU==0): f.write("wait\n")
-print i
-if options.nCPU>i: f.write("wait\n")
+# A single job computes all the points, split among nCPU processes
+f.write("combine -M Asymptotic %s -m %.1f --gridPoints %s --gridForks %d -n grid %s \n" % (ws,mass,",".join("%f"%po for po in points),options.nCPU,options.options) )
+print len(points)
 f.write("hadd -f grid_%.1f%s.root higgsCombine* \n"%(mass,outputname))
 f.write("cp -f grid_%.1f%s.root %s \n"%(mass,outputname,workingDir))
 f.write("echo 'DONE' \n")
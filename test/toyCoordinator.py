@@ -0,0 +1,193 @@
+#!/usr/bin/env python
+
+##  coordinator of distributed HybridNew toys: long-lived combine workers, started anywhere with
+##       combine -M HybridNew [model and toy options] --workQueue <host>:<port>
+##  load the model once, then pull units of work (number of toys, seed, point of the POIs) from here,
+##  and send back their toys, which are appended on the fly to a single toy store (no hadd needed).
+##  Limits, grids and p-values are then computed from the store, also while it's still growing, with
+##       combine -M HybridNew --readHybridResults --toyStore <store> ...
+##  usage: toyCoordinator.py --store toys.bin [ --grid 0:2:21 | --points 0.5,1,1.5 | --point r=1,x=2 ... ] --toys 500 --units 4
+##  more units can be added while it runs (e.g. to refine a grid around the crossing) with
+##       toyCoordinator.py --put <host>:<port> --toys 500 --units 4 --points 1.1,1.2
+##  every request must carry a shared token, taken from $COMBINE_WORKQUEUE_TOKEN, or from the file named by
+##  $COMBINE_WORKQUEUE_TOKEN_FILE (or --token-file); if neither is set, the coordinator makes one in <store>.token,
+##  readable only by its owner, and the workers and --put/--status need COMBINE_WORKQUEUE_TOKEN_FILE=<store>.token
+import os, sys, socket, struct, time, hmac, binascii
+import SocketServer
+from optparse import OptionParser
+
+parser = OptionParser(usage="usage: %prog [options]")
+parser.add_option("--port",   dest="port",   type="int",    default=9735, help="Port to listen to")
+parser.add_option("--bind",   dest="bind",   type="string", default="",   help="Address of the interface to listen on (default: all of them)")
+parser.add_option("--token-file", dest="tokenFile", type="string", default=None, help="File with the token shared with the workers (default: $COMBINE_WORKQUEUE_TOKEN, then $COMBINE_WORKQUEUE_TOKEN_FILE, then <store>.token, made if needed)")
+parser.add_option("--store",  dest="store",  type="string", default=None, help="Toy store to which the results are appended (as for combine --toyStore)")
+parser.add_option("--poi",    dest="poi",    type="string", default="r",  help="Parameter of interest of --points and --grid")
+parser.add_option("--points", dest="points", type="string", default="",   help="Comma separated values of the POI")
+parser.add_option("--grid",   dest="grid",   type="string", default="",   help="min:max:n, n equally spaced values of the POI")
+parser.add_option("--point",  dest="point",  type="string", default=[], action="append", help="A point as name=value,name2=value2,... (can be repeated)")
+parser.add_option("-T", "--toys", dest="toys", type="int",  default=500,  help="Toys per unit (as --toysH of combine)")
+parser.add_option("--units",  dest="units",  type="int",    default=1,    help="Units for each point")
+parser.add_option("-s", "--seed", dest="seed", type="int",  default=123456, help="Seed of the first unit; each unit has its own one, so the toys don't depend on which worker runs it")
+parser.add_option("--lease",  dest="lease",  type="float",  default=3600, help="Seconds after which a unit given to a worker that didn't send its result is given to another one")
+parser.add_option("--keep-alive", dest="keepAlive", default=False, action="store_true", help="Keep the workers waiting when all the units are done, for units added later with --put")
+parser.add_option("--linger", dest="linger", type="float",  default=120,  help="Seconds for which the workers are told to stop after all units are done, before exiting")
+parser.add_option("--put",    dest="put",    type="string", default=None, help="Don't run a coordinator, add the units to the one at host:port")
+parser.add_option("--status", dest="status", type="string", default=None, help="Don't run a coordinator, print the status of the one at host:port")
+parser.add_option("-v", "--verbose", dest="verbose", type="int", default=0, help="Verbosity level")
+(options, args) = parser.parse_args()
+
+BLOCK_MAGIC = struct.pack("=I", 0x31535443) # as ToyResultStore
+
+def readToken(fileName):
+    token = open(fileName).read().strip()
+    if not token or len(token.split()) != 1: raise RuntimeError("the token in %s must be a single word" % fileName)
+    return token
+
+def findToken(makeIn=None):
+    if options.tokenFile: return readToken(options.tokenFile)
+    if os.environ.get("COMBINE_WORKQUEUE_TOKEN"): return os.environ["COMBINE_WORKQUEUE_TOKEN"].strip()
+    if os.environ.get("COMBINE_WORKQUEUE_TOKEN_FILE"): return readToken(os.environ["COMBINE_WORKQUEUE_TOKEN_FILE"])
+    if makeIn is None: return None
+    if not os.path.exists(makeIn):
+        fd = os.open(makeIn, os.O_WRONLY | os.O_CREAT | os.O_EXCL, 0600)
+        os.write(fd, binascii.hexlify(os.urandom(16)) + "\n")
+        os.close(fd)
+        print "Made the token for the workers in %s: start them with COMBINE_WORKQUEUE_TOKEN_FILE=%s" % (makeIn, makeIn)
+    return readToken(makeIn)
+
+def blockToys(block):
+    """number of null and alternate toys of a block of ToyResultStore, or None if its size doesn't match its layout"""
+    try:
+        pos = 4 + 8
+        (nlen,) = struct.unpack_from("=I", block, pos); pos += 4 + nlen
+        (nval,) = struct.unpack_from("=I", block, pos); pos += 4 + 8*nval
+        (nNull, nAlt) = struct.unpack_from("=ii", block, pos); pos += 8 + 8 + 1
+    except struct.error:
+        return None
+    if nNull < 0 or nAlt < 0 or len(block) != pos + 16*(nNull + nAlt): return None
+    return (nNull, nAlt)
+
+def pointsFromOptions():
+    points = []
+    if options.grid:
+        (xmin, xmax, n) = options.grid.split(":")
+        (xmin, xmax, n) = (float(xmin), float(xmax), int(n))
+        points += [ "%s=%g" % (options.poi, xmin + (xmax-xmin)*i/float(max(n-1,1))) for i in range(n) ]
+    if options.points:
+        points += [ "%s=%g" % (options.poi, float(x)) for x in options.points.split(",") ]
+    points += options.point
+    return points
+
+def talk(address, request):
+    token = findToken()
+    if token is None: parser.error("no token: set COMBINE_WORKQUEUE_TOKEN or COMBINE_WORKQUEUE_TOKEN_FILE, or use --token-file")
+    (host, port) = address.rsplit(":", 1)
+    sock = socket.create_connection((host, int(port)))
+    sock.sendall("AUTH %s %s\n" % (token, request))
+    sock.shutdown(socket.SHUT_WR)
+    reply = sock.makefile().read()
+    sock.close()
+    return reply.strip()
+
+if options.put:
+    for p in pointsFromOptions():
+        print talk(options.put, "PUT %d %d %s" % (options.toys, options.units, p))
+    exit(0)
+if options.status:
+    print talk(options.status, "STATUS")
+    exit(0)
+if not options.store:
+    parser.error("a coordinator needs a --store")
+TOKEN = findToken(makeIn=options.store + ".token")
+
+class Queue:
+    def __init__(self):
+        self.units = []      # [ toys, seed, point, state, time of the lease, worker ]
+        self.done = 0
+        self.doneSince = None
+    def add(self, toys, units, point):
+        for i in range(units):
+            self.units.append([ toys, options.seed + len(self.units), point, "pending", 0, None ])
+        self.doneSince = None
+    def get(self, worker):
+        now = time.time()
+        for (i, u) in enumerate(self.units):
+            if u[3] == "pending" or (u[3] == "leased" and now - u[4] > options.lease):
+                if u[3] == "leased": print "Unit u%d given to %s expired, giving it to %s" % (i, u[5], worker)
+                u[3], u[4], u[5] = "leased", now, worker
+                return "UNIT u%d %d %d %s" % (i, u[0], u[1], u[2])
+        if self.done < len(self.units) or options.keepAlive or not self.units: return "WAIT 10"
+        return "END"
+    def unit(self, uid):
+        i = int(uid[1:]) if uid.startswith("u") and uid[1:].isdigit() else -1
+        return i if 0 <= i < len(self.units) else None
+    def maxResultSize(self, uid):
+        # header (names and values of the POIs) plus values and weights of both kinds of toys
+        i = self.unit(uid)
+        return 65536 + 32*self.units[i][0] if i is not None else 0
+    def result(self, uid, block):
+        i = self.unit(uid)
+        if i is None: return "ERROR unknown unit %s" % uid
+        if self.units[i][3] == "done": return "IGNORED"
+        if block[:4] != BLOCK_MAGIC: return "ERROR not a block of toys"
+        toys = blockToys(block)
+        if toys is None: return "ERROR malformed block of toys"
+        # the S+B or the B-only toys (whichever are the most) are the toys of the unit, the others can be fewer
+        if max(toys) != self.units[i][0]: return "ERROR %d toys in the result of unit %s, instead of %d" % (max(toys), uid, self.units[i][0])
+        # one write at the end of the file, as ToyResultStore::appendBlock, so combine can read the store at any time
+        fd = os.open(options.store, os.O_WRONLY | os.O_CREAT | os.O_APPEND, 0644)
+        try:
+            while block:
+                block = block[os.write(fd, block):]
+        finally:
+            os.close(fd)
+        self.units[i][3] = "done"
+        self.done += 1
+        if self.done == len(self.units): self.doneSince = time.time()
+        if options.verbose or self.done == len(self.units):
+            print "Unit %s (%s) done by %s, %d/%d" % (uid, self.units[i][2], self.units[i][5], self.done, len(self.units))
+        return "OK"
+    def status(self):
+        leased = len([ u for u in self.units if u[3] == "leased" ])
+        return "%d units: %d done, %d running, %d pending" % (len(self.units), self.done, leased, len(self.units) - self.done - leased)
+
+queue = Queue()
+for p in pointsFromOptions(): queue.add(options.toys, options.units, p)
+
+class Handler(SocketServer.StreamRequestHandler):
+    def handle(self):
+        words = self.rfile.readline(4096).split()
+        if len(words) == 0: return
+        if len(words) < 3 or words[0] != "AUTH" or not hmac.compare_digest(words[1], TOKEN):
+            print "%s: refused a request without the right token" % self.client_address[0]
+            self.wfile.write("ERROR not authorized\n")
+            return
+        words = words[2:]
+        if   words[0] == "GET"    and len(words) == 2: reply = queue.get(words[1])
+        elif words[0] == "RESULT" and len(words) == 3:
+            size = int(words[2]) if words[2].isdigit() else -1
+            if queue.unit(words[1]) is None:
+                reply = "ERROR unknown unit %s" % words[1]
+            elif size < 0 or size > queue.maxResultSize(words[1]):
+                reply = "ERROR result of %d bytes too large for unit %s" % (size, words[1])
+            else:
+                block = self.rfile.read(size)
+                reply = queue.result(words[1], block) if len(block) == size else "ERROR truncated result"
+        elif words[0] == "PUT"    and len(words) == 4:
+            queue.add(int(words[1]), int(words[2]), words[3])
+            reply = "OK " + queue.status()
+        elif words[0] == "STATUS": reply = queue.status()
+        else: reply = "ERROR unknown request"
+        if options.verbose > 1: print "%s: %s -> %s" % (self.client_address[0], " ".join(words[:3]), reply)
+        self.wfile.write(reply + "\n")
+
+SocketServer.TCPServer.allow_reuse_address = True
+server = SocketServer.TCPServer((options.bind, options.port), Handler)
+server.timeout = 5
+print "Coordinator listening on %s:%d, appending toys to %s; %s" % (options.bind or socket.getfqdn(), options.port, options.store, queue.status())
+try:
+    while queue.doneSince is None or options.keepAlive or time.time() - queue.doneSince < options.linger:
+        server.handle_request()
+except KeyboardInterrupt:
+    print "Stopped: " + queue.status()
+server.server_close()
@@ -0,0 +1,119 @@
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+#include <unistd.h>
+#include "TRandom3.h"
+#include "HiggsAnalysis/CombinedLimit/interface/FastTemplate.h"
+#include "vectorized.h"
+
+// Microbenchmark of the kernels of src/vectorized.cc and of the FastTemplate operations, on arrays from tens of bins
+// to millions of events, reporting ns/element and GB/s (counting each array read or written once per call).
+// The instruction set of the kernels can be chosen with COMBINE_VECTORIZED_ISA=scalar|sse4|avx2|avx512.
+// Usage: benchKernels.exe [-m max size(=4194304)] [-s min size(=16)] [-t seconds per measurement(=0.05)] [-k kernel] [-o output.json]
+
+struct Result { std::string kernel; unsigned int size; double nsPerElement, gbPerSecond; };
+std::vector<Result> results;
+
+double now() { return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count(); }
+
+/// seconds per call of f, the best of three rounds each lasting at least minTime
+template<typename F> double timeIt(F f, double minTime) {
+    f(0); // warm up the caches
+    long reps = 1;
+    double best = 1e99;
+    for (int round = 0; round < 3; ++round) {
+        while (true) {
+            double start = now();
+            for (long r = 0; r < reps; ++r) f(r);
+            double elapsed = now() - start;
+            if (elapsed >= minTime) { best = std::min(best, elapsed/reps); break; }
+            reps *= 2;
+        }
+    }
+    return best;
+}
+
+int main(int argc, char **argv) {
+    unsigned int maxSize = 4194304, minSize = 16;
+    double minTime = 0.05;
+    const char *output = NULL, *only = NULL;
+    do {
+        int opt = getopt(argc, argv, "m:s:t:k:o:");
+        switch (opt) {
+            case 'm': maxSize = atoi(optarg); break;
+            case 's': minSize = atoi(optarg); break;
+            case 't': minTime = atof(optarg); break;
+            case 'k': only = optarg; break;
+            case 'o': output = optarg; break;
+            case '?': std::cerr << "Unsupported option. Please see the code. " << std::endl; return 1; break;
+        }
+        if (opt == -1) break;
+    } while (true);
+    printf("Instruction set: %s\n", vectorized::isaName(vectorized::isa()));
+    printf("%-16s %10s %12s %10s\n", "kernel", "size", "ns/element", "GB/s");
+
+    TRandom3 rnd(37);
+    for (unsigned int size = minSize; size <= maxSize; size *= 4) {
+        std::vector<double> a(size), b(size), w(size), out(size), work(size), work2(size), backup(size), ones(size, 1.0);
+        for (unsigned int i = 0; i < size; ++i) {
+            backup[i] = 0.5 + rnd.Uniform();
+            b[i] = 1 + rnd.Uniform();
+            w[i] = rnd.Poisson(5);
+        }
+        a = backup;
+        FastTemplate t(size), tref(size), tdiff(size), tsum(size), tbackup(size);
+        for (unsigned int i = 0; i < size; ++i) {
+            tbackup[i] = backup[i]; tref[i] = b[i];
+            tdiff[i] = 0.1 * (rnd.Uniform() - 0.5); tsum[i] = 0.1 * (rnd.Uniform() - 0.5);
+        }
+        t = tbackup;
+        double sink = 0;
+        // the time of restoring the input of the in-place operations, subtracted from theirs
+        double tCopy = timeIt([&](long) { std::copy(backup.begin(), backup.end(), a.begin()); }, minTime);
+        double tCopyTemplate = timeIt([&](long) { t.CopyValues(tbackup); }, minTime);
+        // name, seconds per call, arrays read or written per call
+        auto record = [&](const char *name, double seconds, int arrays) {
+            Result r = { name, size, 1e9*seconds/size, arrays * sizeof(double) * double(size) / seconds / 1e9 };
+            results.push_back(r);
+            printf("%-16s %10u %12.4f %10.3f\n", name, size, r.nsPerElement, r.gbPerSecond);
+        };
+        auto wanted = [&](const char *name) { return only == NULL || std::string(only) == name; };
+
+        if (wanted("mul_add"))      record("mul_add",      timeIt([&](long r) { vectorized::mul_add(size, r % 2 ? 1e-3 : -1e-3, &b[0], &out[0]); }, minTime), 3);
+        if (wanted("mul_inplace"))  record("mul_inplace",  timeIt([&](long) { vectorized::mul_inplace(size, &ones[0], &out[0]); }, minTime), 3);
+        if (wanted("nll_reduce"))   record("nll_reduce",   std::max(0., timeIt([&](long r) {
+                                                               std::copy(backup.begin(), backup.end(), a.begin());
+                                                               sink += vectorized::nll_reduce(size, &a[0], &w[0], 1.0 + 1e-6*r, &work[0]); }, minTime) - tCopy), 3);
+        if (wanted("gaussians"))    record("gaussians",    timeIt([&](long r) { vectorized::gaussians(size, 1.0 + 1e-6*r, 0.3, 1.3, &b[0], &out[0], &work[0], &work2[0]); }, minTime), 2);
+        if (wanted("exponentials")) record("exponentials", timeIt([&](long r) { vectorized::exponentials(size, -0.5 - 1e-6*r, 1.3, &b[0], &out[0], &work[0]); }, minTime), 2);
+        if (wanted("powers"))       record("powers",       timeIt([&](long r) { vectorized::powers(size, -2.5 - 1e-6*r, 1.3, &b[0], &out[0], &work[0]); }, minTime), 2);
+        if (wanted("dot_product"))  record("dot_product",  timeIt([&](long) { sink += vectorized::dot_product(size, &b[0], &w[0]); }, minTime), 2);
+        if (wanted("sum"))          record("sum",          timeIt([&](long) { sink += vectorized::sum(size, &b[0]); }, minTime), 1);
+
+        if (wanted("Meld"))           record("Meld",           timeIt([&](long r) { t.Meld(tdiff, tsum, r % 2 ? 1e-3 : -1e-3, 0.5); }, minTime), 3);
+        if (wanted("LogRatio"))       record("LogRatio",       std::max(0., timeIt([&](long) { t.CopyValues(tbackup); t.LogRatio(tref); }, minTime) - tCopyTemplate), 2);
+        if (wanted("Exp"))            record("Exp",            std::max(0., timeIt([&](long) { t.CopyValues(tbackup); t.Exp(); }, minTime) - tCopyTemplate), 1);
+        if (wanted("CropUnderflows")) record("CropUnderflows", timeIt([&](long) { t.CropUnderflows(0.6); }, minTime), 1);
+        if (wanted("SumDiff"))        record("SumDiff",        timeIt([&](long) { FastTemplate::SumDiff(tbackup, tref, tsum, tdiff); }, minTime), 4);
+        if (sink == 0) printf("\n"); // make sure the loops are not optimized away
+    }
+
+    if (output) {
+        FILE *out = fopen(output, "w");
+        if (!out) { std::cerr << "ERROR: could not write " << output << std::endl; return 2; }
+        fprintf(out, "{\n  \"isa\": \"%s\",\n  \"results\": [", vectorized::isaName(vectorized::isa()));
+        for (unsigned int i = 0, n = results.size(); i < n; ++i) {
+            fprintf(out, "%s\n    { \"kernel\": \"%s\", \"size\": %u, \"ns_per_element\": %.6g, \"gb_per_s\": %.6g }", (i ? "," : ""),
+                    results[i].kernel.c_str(), results[i].size, results[i].nsPerElement, results[i].gbPerSecond);
+        }
+        fprintf(out, "\n  ]\n}\n");
+        fclose(out);
+    }
+    return 0;
+}
@@ -0,0 +1,216 @@
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <iostream>
+#include <unistd.h>
+#include "TFile.h"
+#include "TStopwatch.h"
+#include "TRandom3.h"
+#include "RooWorkspace.h"
+#include "RooRealVar.h"
+#include "RooAbsData.h"
+#include "RooMinimizer.h"
+#include "RooStats/ModelConfig.h"
+#include "Math/MinimizerOptions.h"
+#include "Math/IOptions.h"
+#include "HiggsAnalysis/CombinedLimit/interface/ProfilingTools.h"
+#include "HiggsAnalysis/CombinedLimit/interface/CachingNLL.h"
+#include "HiggsAnalysis/CombinedLimit/interface/VerticalInterpHistPdf.h"
+#include "vectorized.h"
+
+// Reproducible timing of the hot paths of the likelihood for one workspace, written as one JSON object.
+// Usage: benchmark.exe file.root [-w workspace] [-c modelConfig] [-D dataset] [-n evaluations] [-g gradients] [-k kernel calls] [-F (no fit)] [-R rtd[=value]] [-o output.json]
+
+std::vector<std::pair<std::string,double> > results;
+void report(const std::string &name, double value) {
+    results.push_back(std::make_pair(name, value));
+    printf("%-32s %14.6g\n", name.c_str(), value);
+}
+
+void set_rtd(const char *rtd) {
+  std::string rtds(rtd);
+  std::string::size_type idx = rtds.find('=');
+  if (idx == std::string::npos) {
+      runtimedef::set(rtd, 1);
+  } else {
+      runtimedef::set(rtds.substr(0, idx), atoi(rtds.substr(idx+1).c_str()));
+  }
+}
+
+/// shift each parameter by a small fraction of its range, alternating up and down
+void wiggle(RooRealVar *v, double v0, int i) {
+    double step = 1e-3 * (std::isfinite(v->getMax() - v->getMin()) ? (v->getMax() - v->getMin()) : 1.0);
+    v->setVal(i % 2 ? v0 : std::min(v->getMax(), v0 + step));
+}
+
+int main(int argc, char **argv) {
+    if (argc <= 1) { printf("Usage: %s file -w workspace(=w) -c modelConfig(=ModelConfig) -D dataset(=data_obs) -n evaluations(=2000) -g gradients(=200) -k kernelCalls(=2000) -F -R rtd -o output.json\n",argv[0]); return 1; }
+    const char *workspace = "w"; // -w
+    const char *dataset   = "data_obs"; // -D
+    const char *modelConfig = "ModelConfig"; // -c
+    const char *output      = NULL; // -o
+    int nEvals = 2000, nGrads = 200, nKernel = 2000;
+    bool doFit = true;
+    do {
+        int opt = getopt(argc, argv, "w:D:c:n:g:k:FR:o:");
+        switch (opt) {
+            case 'w': workspace = optarg; break;
+            case 'D': dataset = optarg; break;
+            case 'c': modelConfig = optarg; break;
+            case 'n': nEvals = atoi(optarg); break;
+            case 'g': nGrads = atoi(optarg); break;
+            case 'k': nKernel = atoi(optarg); break;
+            case 'F': doFit = false; break;
+            case 'R': set_rtd(optarg); break;
+            case 'o': output = optarg; break;
+            case '?': std::cerr << "Unsupported option. Please see the code. " << std::endl; return 1; break;
+        }
+        if (opt == -1) break;
+    } while (true);
+    TFile *f = TFile::Open(argv[optind]);
+    if (!f) { std::cerr << "ERROR: could not open " << argv[optind] << std::endl; return 2; }
+    RooWorkspace *w = (RooWorkspace *) f->Get(workspace);
+    if (!w)  { std::cerr << "ERROR: could not find workspace '" << workspace << "' in " << argv[optind] << std::endl; return 2; }
+    RooStats::ModelConfig *mc = (RooStats::ModelConfig *) w->genobj(modelConfig);
+    if (!mc) { std::cerr << "ERROR: could not find ModelConfig '" << modelConfig << "' in workspace" << std::endl; return 2; }
+    RooAbsData *d = w->data(dataset);
+    if (!d) { std::cerr << "ERROR: could not find dataset '" << dataset << "' in workspace" << std::endl; return 2; }
+    RooAbsReal::setEvalErrorLoggingMode(RooAbsReal::CountErrors);
+    TStopwatch timer;
+
+    // --- NLL construction
+    timer.Start();
+    RooAbsPdf *pdf = mc->GetPdf();
+    const RooCmdArg &constrain = mc->GetNuisanceParameters() ? RooFit::Constrain(*mc->GetNuisanceParameters()) : RooCmdArg::none();
+    RooAbsReal *nll = pdf->createNLL(*d, constrain, RooFit::Extended(pdf->canBeExtended()));
+    timer.Stop();
+    report("nll_create_s", timer.RealTime());
+    cacheutils::CachingSimNLL *simnll = dynamic_cast<cacheutils::CachingSimNLL *>(nll);
+    report("entries", d->numEntries());
+
+    std::auto_ptr<RooArgSet> params(nll->getParameters(*d));
+    std::vector<RooRealVar *> floats;
+    std::vector<double> vals0;
+    RooLinkedListIter iter = params->iterator();
+    for (RooAbsArg *a = (RooAbsArg *) iter.Next(); a != 0; a = (RooAbsArg *) iter.Next()) {
+        RooRealVar *rrv = dynamic_cast<RooRealVar *>(a);
+        if (rrv && !rrv->isConstant()) { floats.push_back(rrv); vals0.push_back(rrv->getVal()); }
+    }
+    report("floating_parameters", floats.size());
+    if (floats.empty()) { std::cerr << "ERROR: no floating parameters" << std::endl; return 2; }
+    nll->getVal();
+
+    // --- NLL evaluations, moving one parameter at a time (what the minimizer does for the numerical derivatives)
+    timer.Start();
+    for (int i = 0; i < nEvals; ++i) {
+        unsigned int j = (i/2) % floats.size();
+        wiggle(floats[j], vals0[j], i);
+        nll->getVal();
+    }
+    timer.Stop();
+    report("nll_eval_one_param_per_s", nEvals/timer.RealTime());
+
+    // --- NLL evaluations, moving all parameters (no caching of the unchanged channels possible)
+    timer.Start();
+    for (int i = 0; i < nEvals; ++i) {
+        for (unsigned int j = 0, n = floats.size(); j < n; ++j) wiggle(floats[j], vals0[j], i);
+        nll->getVal();
+    }
+    timer.Stop();
+    double tEvalAll = timer.RealTime()/nEvals;
+    report("nll_eval_all_params_per_s", 1.0/tEvalAll);
+    report("nll_eval_all_params_bins_per_s", d->numEntries()/tEvalAll);
+
+    // --- analytical gradient
+    if (simnll) {
+        std::vector<double> grad;
+        timer.Start();
+        for (int i = 0; i < nGrads; ++i) {
+            for (unsigned int j = 0, n = floats.size(); j < n; ++j) wiggle(floats[j], vals0[j], i);
+            simnll->gradient(floats, grad);
+        }
+        timer.Stop();
+        report("gradient_per_s", nGrads/timer.RealTime());
+        report("gradient_cost_in_evals", timer.RealTime()/nGrads/tEvalAll);
+    }
+    for (unsigned int j = 0, n = floats.size(); j < n; ++j) floats[j]->setVal(vals0[j]);
+
+    // --- kernels: nll_reduce on a channel-sized array, and syncTotal of all the morphing templates
+    {
+        unsigned int size = std::max(1024, d->numEntries());
+        std::vector<double> pdfvals(size), backup(size), weights(size, 1.0), work(size);
+        TRandom3 rnd(37);
+        for (unsigned int i = 0; i < size; ++i) backup[i] = 0.5 + rnd.Uniform();
+        double sum = 0;
+        timer.Start();
+        for (int i = 0; i < nKernel; ++i) {
+            std::copy(backup.begin(), backup.end(), pdfvals.begin());
+            sum += vectorized::nll_reduce(size, &pdfvals[0], &weights[0], 1.0 + 1e-6*i, &work[0]);
+        }
+        timer.Stop();
+        report("nll_reduce_bins_per_s", double(size)*nKernel/timer.RealTime());
+        if (sum == 0) printf("\n"); // make sure the loop is not optimized away
+    }
+    {
+        std::vector<RooAbsPdf *> morphs; std::vector<RooRealVar *> coefs;
+        std::auto_ptr<TIterator> it(w->components().createIterator());
+        for (RooAbsArg *a = (RooAbsArg *) it->Next(); a != 0; a = (RooAbsArg *) it->Next()) {
+            const RooArgList *coefList = 0;
+            if (FastVerticalInterpHistPdf2Base *p2 = dynamic_cast<FastVerticalInterpHistPdf2Base *>(a)) coefList = &p2->coefList();
+            else if (FastVerticalInterpHistPdfBase *p = dynamic_cast<FastVerticalInterpHistPdfBase *>(a)) coefList = &p->coefList();
+            if (coefList == 0) continue;
+            for (int i = 0, n = coefList->getSize(); i < n; ++i) {
+                RooRealVar *rrv = dynamic_cast<RooRealVar *>(coefList->at(i));
+                if (rrv && !rrv->isConstant()) { morphs.push_back((RooAbsPdf *)a); coefs.push_back(rrv); break; }
+            }
+        }
+        report("morphing_templates", morphs.size());
+        if (!morphs.empty()) {
+            int nSync = std::max<int>(1, nKernel/morphs.size());
+            std::vector<double> c0(coefs.size());
+            for (unsigned int j = 0, n = coefs.size(); j < n; ++j) { c0[j] = coefs[j]->getVal(); morphs[j]->getVal(); }
+            timer.Start();
+            for (int i = 0; i < nSync; ++i) {
+                for (unsigned int j = 0, n = morphs.size(); j < n; ++j) {
+                    coefs[j]->setVal(c0[j] + (i % 2 ? 0 : 1e-3));
+                    morphs[j]->getVal();
+                }
+            }
+            timer.Stop();
+            report("syncTotal_templates_per_s", double(nSync)*morphs.size()/timer.RealTime());
+            for (unsigned int j = 0, n = coefs.size(); j < n; ++j) coefs[j]->setVal(c0[j]);
+        }
+    }
+
+    // --- full fit, as in plainfit
+    if (doFit) {
+        ROOT::Math::IOptions & options = ROOT::Math::MinimizerOptions::Default("Minuit2");
+        options.SetValue("StorageLevel", 0);
+        RooMinimizer minim(*nll);
+        minim.setPrintLevel(-1);
+        minim.setPrintEvalErrors(0);
+        minim.setStrategy(0);
+        minim.setEps(1);
+        minim.setOffsetting(1);
+        minim.optimizeConst(2);
+        timer.Start();
+        int status = minim.minimize("Minuit2","minimize");
+        timer.Stop();
+        report("fit_s", timer.RealTime());
+        report("fit_status", status);
+    }
+
+    if (output) {
+        FILE *out = fopen(output, "w");
+        if (!out) { std::cerr << "ERROR: could not write " << output << std::endl; return 2; }
+        fprintf(out, "{\n  \"file\": \"%s\"", argv[optind]);
+        for (unsigned int i = 0, n = results.size(); i < n; ++i) fprintf(out, ",\n  \"%s\": %.6g", results[i].first.c_str(), results[i].second);
+        fprintf(out, "\n}\n");
+        fclose(out);
+    }
+    return 0;
+}
@@ -0,0 +1,66 @@
+#!/usr/bin/env python
+
+##  run the performance benchmarks on the cards in data/benchmarks, and write all the results in one JSON file
+##  for each card: benchmark.exe (NLL evaluation, gradient, kernels, fit), combine -M Asymptotic, combine -M HybridNew toys
+##  usage: runBenchmarks.py [ -o benchmarks.json ] [ --toys N ] [ -R rtd ] [ card1.txt card2.txt ... ]
+from __future__ import print_function
+import os, sys, json, time, subprocess
+from optparse import OptionParser
+
+parser = OptionParser(usage="usage: %prog [options] [cards]")
+parser.add_option("-o", "--out",    dest="out",    default="benchmarks.json", type="string", help="Output JSON file")
+parser.add_option("-m", "--mass",   dest="mass",   default=120.,   type="float",  help="Higgs mass to use for the cards")
+parser.add_option("-t", "--toys",   dest="toys",   default=200,    type="int",    help="Toys for HybridNew (0 to skip it)")
+parser.add_option("-R", "--rtd",    dest="rtd",    default=[],     action="append", help="Runtime define for benchmark.exe and combine (can be repeated)")
+parser.add_option("-w", "--workdir",dest="workdir",default="benchmarks.tmp", type="string", help="Directory for the workspaces and logs")
+parser.add_option("--exe",          dest="exe",    default=os.path.join(os.path.dirname(os.path.abspath(__file__)), "benchmark.exe"), help="Path of benchmark.exe")
+(options, args) = parser.parse_args()
+
+defaultCards = [
+    "simple-counting/counting-B5p5-Obs6-Syst30U.txt",
+    "summer11/hwwc.170/comb_hww_cnt.txt",
+    "summer11/hwws.130/comb_hww.txt",
+    "summer11/htt.125/comb_htt.txt",
+    "summer11/hzz4l.145/comb_hzz4l.txt",
+    "summer11/hgg/hgg_8cats.txt",
+]
+if not args:
+    base = os.path.join(os.path.dirname(os.path.abspath(__file__)), "../../data/benchmarks")
+    args = [ os.path.join(base, c) for c in defaultCards ]
+
+if not os.path.isdir(options.workdir): os.makedirs(options.workdir)
+
+def run(command, log):
+    """run a command, returning its wall time in seconds (or None if it failed)"""
+    start = time.time()
+    with open(log, "w") as logfile:
+        ret = subprocess.call(command, stdout=logfile, stderr=subprocess.STDOUT, shell=True)
+    if ret != 0:
+        print("   FAILED (%d): %s, see %s" % (ret, command, log))
+        return None
+    return time.time() - start
+
+rtdArgs = "".join(" -R %s" % r for r in options.rtd)
+combineRtd = "".join(" --X-rtd %s" % r for r in options.rtd)
+results = []
+for card in args:
+    name = os.path.basename(card).replace(".txt","")
+    print("Benchmarking %s" % card)
+    entry = { "card": card, "mass": options.mass }
+    ws = os.path.join(options.workdir, name + ".root")
+    carddir = os.path.dirname(os.path.abspath(card))
+    if run("cd %s && text2workspace.py -b %s -m %g -o %s" % (carddir, os.path.abspath(card), options.mass, os.path.abspath(ws)), os.path.join(options.workdir, name + ".t2w.log")) is None:
+        results.append(entry); continue
+    out = os.path.join(options.workdir, name + ".nll.json")
+    if run("%s %s -o %s%s" % (options.exe, ws, out, rtdArgs), os.path.join(options.workdir, name + ".nll.log")) is not None:
+        with open(out) as f: entry.update(json.load(f))
+    entry["asymptotic_s"] = run("combine -M Asymptotic %s -m %g -n %s%s" % (ws, options.mass, name, combineRtd), os.path.join(options.workdir, name + ".asymptotic.log"))
+    if options.toys > 0:
+        t = run("combine -M HybridNew --singlePoint 1 --clsAcc 0 -T %d -i 1 --fork 0 -s 1 %s -m %g -n %s%s" % (options.toys, ws, options.mass, name, combineRtd), os.path.join(options.workdir, name + ".hybridnew.log"))
+        entry["hybridnew_s"] = t
+        entry["hybridnew_toys_per_s"] = options.toys / t if t else None
+    results.append(entry)
+
+with open(options.out, "w") as f:
+    json.dump(results, f, indent=2, sort_keys=True)
+print("Results written to %s" % options.out)
@@ -0,0 +1,118 @@
+// Integrals of the RooRealSumPdf channels from the bins (ADDNLL_ROOREALSUM_BASICINT) against the RooFit NLL of the same
+// model, at random values of the parameters, for a sequence of datasets given through CachingSimNLL::setData:
+// the binned one it was made with, another binned one, an unbinned one (no basic integrals), and the first one again.
+// Channel "a" has a process whose integral doesn't match the sum over its bins, which must keep its RooFit integral.
+// Usage: testBasicIntegrals.exe [ntries]  (exit code 1 if any comparison fails)
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <RooRealVar.h>
+#include <RooCategory.h>
+#include <RooBinning.h>
+#include <RooDataHist.h>
+#include <RooDataSet.h>
+#include <RooHistFunc.h>
+#include <RooFormulaVar.h>
+#include <RooRealSumPdf.h>
+#include <RooSimultaneous.h>
+#include <RooRandom.h>
+#include <RooGlobalFunc.h>
+#include "HiggsAnalysis/CombinedLimit/interface/CachingNLL.h"
+#include "HiggsAnalysis/CombinedLimit/interface/ProfilingTools.h"
+
+RooRealVar *x;
+RooCategory *cat;
+
+RooHistFunc *makeTemplate(const char *name, double slope, double norm) {
+    RooDataHist *hist = new RooDataHist(TString(name)+"_hist", "", RooArgSet(*x));
+    for (int i = 0, n = x->numBins(); i < n; ++i) {
+        x->setBin(i);
+        hist->set(RooArgSet(*x), norm * (1 + slope * x->getVal()));
+    }
+    return new RooHistFunc(name, "", RooArgSet(*x), *hist);
+}
+
+RooDataHist *makeBinnedData(const char *name, double scale) {
+    RooDataHist *data = new RooDataHist(name, "", RooArgSet(*x, *cat));
+    for (int ic = 0; ic < 2; ++ic) {
+        cat->setIndex(ic);
+        for (int i = 0, n = x->numBins(); i < n; ++i) {
+            x->setBin(i);
+            data->set(RooArgSet(*x, *cat), RooRandom::randomGenerator()->Poisson(scale * (20 + 2 * x->getVal())));
+        }
+    }
+    return data;
+}
+
+RooDataSet *makeUnbinnedData(const char *name, int events) {
+    RooDataSet *data = new RooDataSet(name, "", RooArgSet(*x, *cat));
+    for (int ic = 0; ic < 2; ++ic) {
+        cat->setIndex(ic);
+        for (int i = 0; i < events; ++i) {
+            x->setVal(x->getMin() + RooRandom::uniform() * (x->getMax() - x->getMin()));
+            data->add(RooArgSet(*x, *cat));
+        }
+    }
+    return data;
+}
+
+int testData(RooSimultaneous &sim, cacheutils::CachingSimNLL &onll, RooAbsData &data, RooArgList &params, int ntries) {
+    RooAbsReal *nll = sim.createNLL(data, RooFit::Extended(true));
+    onll.setData(data);
+    std::vector<double> snap;
+    for (int j = 0, n = params.getSize(); j < n; ++j) snap.push_back(((RooRealVar *) params.at(j))->getVal());
+    double plain0 = nll->getVal(), alter0 = onll.getVal();
+    int fails = 0;
+    for (int i = 0; i < ntries; ++i) {
+        for (int j = 0, n = params.getSize(); j < n; ++j) ((RooRealVar *) params.at(j))->randomize();
+        double plain = nll->getVal() - plain0, alter = onll.getVal() - alter0;
+        bool ok = std::abs(alter - plain) < 1e-6 * std::max(1.0, std::abs(plain));
+        if (!ok) fails++;
+        printf("%-10s plain % 12.6f  alter % 12.6f   diff % 10.2e  %s\n", data.GetName(), plain, alter, alter - plain, ok ? "OK" : "FAIL");
+    }
+    for (int j = 0, n = params.getSize(); j < n; ++j) ((RooRealVar *) params.at(j))->setVal(snap[j]);
+    delete nll;
+    return fails;
+}
+
+int main(int argc, char **argv) {
+    int ntries = (argc > 1 ? atoi(argv[1]) : 20);
+    // must be set before the first NLL is made, as in combine
+    runtimedef::set("ADDNLL_ROOREALSUM_BASICINT", 1);
+    runtimedef::set("ADDNLL_ROOREALSUM_KEEPZEROS", 1);
+    RooRandom::randomGenerator()->SetSeed(42);
+
+    // bins of different widths, so that the volumes of the bins are used and not only their number
+    double edges[] = { 0, 1, 2, 3, 4, 5, 6, 8, 10 };
+    x = new RooRealVar("x", "x", 0, 10);
+    x->setBinning(RooBinning(8, edges));
+    cat = new RooCategory("cat", "cat");
+    cat->defineType("a", 0);
+    cat->defineType("b", 1);
+
+    RooRealVar r("r", "r", 1, 0, 5), bscale("bscale", "bscale", 1, 0.5, 2), qscale("qscale", "qscale", 0.5, 0, 2);
+    RooArgList params(r, bscale, qscale);
+    // the integral of a parabola isn't the one of the midpoint rule: this process must keep its RooFit integral
+    RooFormulaVar quad("quad", "1+0.05*@0*@0", RooArgList(*x));
+    RooRealSumPdf pdfa("pdf_a", "", RooArgList(*makeTemplate("sig_a", 0.2, 2), *makeTemplate("bkg_a", -0.05, 10), quad), RooArgList(r, bscale, qscale));
+    RooRealSumPdf pdfb("pdf_b", "", RooArgList(*makeTemplate("sig_b", -0.1, 3), *makeTemplate("bkg_b", 0.1, 15)), RooArgList(r, bscale));
+    RooSimultaneous sim("sim", "", *cat);
+    sim.addPdf(pdfa, "a");
+    sim.addPdf(pdfb, "b");
+
+    RooDataHist *data1 = makeBinnedData("binned1", 1.0);
+    RooDataHist *data2 = makeBinnedData("binned2", 1.5);
+    RooDataSet  *data3 = makeUnbinnedData("unbinned", 200);
+
+    RooArgSet noConstraints;
+    cacheutils::CachingSimNLL onll(&sim, data1, &noConstraints);
+    int fails = 0;
+    fails += testData(sim, onll, *data1, params, ntries);
+    fails += testData(sim, onll, *data2, params, ntries);
+    fails += testData(sim, onll, *data3, params, ntries);
+    fails += testData(sim, onll, *data1, params, ntries);
+    printf("%s: %d failures\n", fails ? "FAIL" : "OK", fails);
+    return fails ? 1 : 0;
+}
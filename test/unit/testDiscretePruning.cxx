@@ -0,0 +1,127 @@
+// Scan of a POI with an envelope of background pdfs (RooMultiPdf), with the pruning of the discrete scans
+// (--cminDiscretePruneDeltaNLL) against the same scan fitting all the pdfs at each point: the minima and the chosen
+// pdfs must be the same, with fewer calls of the NLL. Then the same for a second dataset given to the NLL by setData.
+// Usage: testDiscretePruning.exe [points]  (exit code 1 if any comparison fails)
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "HiggsAnalysis/CombinedLimit/interface/CascadeMinimizer.h"
+#include <boost/program_options.hpp>
+#include <RooRealVar.h>
+#include <RooCategory.h>
+#include <RooFormulaVar.h>
+#include <RooGaussian.h>
+#include <RooExponential.h>
+#include <RooPolynomial.h>
+#include <RooAddPdf.h>
+#include <RooSimultaneous.h>
+#include <RooDataSet.h>
+#include <RooRandom.h>
+#include <RooGlobalFunc.h>
+#include "HiggsAnalysis/CombinedLimit/interface/CachingNLL.h"
+#include "HiggsAnalysis/CombinedLimit/interface/RooMultiPdf.h"
+
+struct ScanPoint { double nll; int index; };
+
+void configure(const char *deltaNLL) {
+    std::vector<std::string> args;
+    args.push_back("--cminDiscretePruneDeltaNLL"); args.push_back(deltaNLL);
+    args.push_back("--cminDiscretePruneRecheck");  args.push_back("0");
+    boost::program_options::variables_map vm;
+    boost::program_options::store(boost::program_options::command_line_parser(args).options(CascadeMinimizer::options()).run(), vm);
+    boost::program_options::notify(vm);
+    CascadeMinimizer::applyOptions(vm);
+}
+
+// best fit with the POI floating, then the scan, as MultiDimFit does; returns the calls of the NLL of all the fits
+unsigned long scan(RooAbsReal &nll, RooRealVar &r, RooCategory &pdfindex, RooArgSet &params, const RooArgSet &prefit, int points, std::vector<ScanPoint> &out) {
+    params = prefit; pdfindex.setIndex(0);
+    unsigned long calls = 0;
+    {
+        CascadeMinimizer minim(nll, CascadeMinimizer::Unconstrained, &r);
+        minim.setStrategy(1);
+        minim.minimize(0);
+        calls += CascadeMinimizer::telemetry().fcnCalls;
+    }
+    out.clear();
+    r.setConstant(true);
+    for (int i = 0; i < points; ++i) {
+        r.setVal(r.getMin() + (i + 0.5) * (r.getMax() - r.getMin()) / points);
+        CascadeMinimizer minim(nll, CascadeMinimizer::Constrained, &r);
+        minim.setStrategy(1);
+        minim.minimize(0);
+        calls += CascadeMinimizer::telemetry().fcnCalls;
+        ScanPoint p = { nll.getVal(), pdfindex.getIndex() };
+        out.push_back(p);
+    }
+    r.setConstant(false);
+    return calls;
+}
+
+int compare(RooAbsReal &nll, RooRealVar &r, RooCategory &pdfindex, RooArgSet &params, const RooArgSet &prefit, int points) {
+    std::vector<ScanPoint> full, pruned;
+    configure("0");
+    unsigned long fullCalls = scan(nll, r, pdfindex, params, prefit, points, full);
+    configure("1");
+    unsigned long prunedCalls = scan(nll, r, pdfindex, params, prefit, points, pruned);
+    configure("0");
+    int fails = 0;
+    for (int i = 0; i < points; ++i) {
+        bool ok = std::abs(pruned[i].nll - full[i].nll) < 5e-3 && pruned[i].index == full[i].index;
+        if (!ok) fails++;
+        printf("point %2d: full NLL % 14.6f (pdf %d)  pruned NLL % 14.6f (pdf %d)  %s\n", i, full[i].nll, full[i].index, pruned[i].nll, pruned[i].index, ok ? "OK" : "FAIL");
+    }
+    bool fewer = prunedCalls < fullCalls;
+    if (!fewer) fails++;
+    printf("calls of the NLL: full %lu, pruned %lu  %s\n", fullCalls, prunedCalls, fewer ? "OK" : "FAIL");
+    return fails;
+}
+
+int main(int argc, char **argv) {
+    int points = (argc > 1 ? atoi(argv[1]) : 10);
+    RooRandom::randomGenerator()->SetSeed(42);
+    CascadeMinimizer::initOptions();
+
+    RooRealVar x("x", "x", 0, 10);
+    RooCategory cat("cat", "cat");
+    cat.defineType("ch1", 0);
+    RooRealVar r("r", "r", 1, 0, 4), nb("nb", "nb", 1000, 0, 5000);
+    RooRealVar mean("mean", "mean", 5), sigma("sigma", "sigma", 0.5);
+    RooRealVar slope("slope", "slope", -0.3, -2, 0), p1("p1", "p1", -0.05, -0.1, 0);
+    RooFormulaVar ns("ns", "40*@0", RooArgList(r));
+    RooGaussian sig("sig", "", x, mean, sigma);
+    RooExponential expo("expo", "", x, slope);
+    RooPolynomial pol1("pol1", "", x, RooArgList(p1));
+    // far from the data at every point of the scan, so that the pruning skips it after the first fit
+    RooPolynomial flat("flat", "", x, RooArgList());
+    RooCategory pdfindex("pdfindex", "pdfindex");
+    RooMultiPdf envelope("envelope", "", pdfindex, RooArgList(expo, pol1, flat));
+    RooAddPdf pdf("pdf_ch1", "", RooArgList(sig, envelope), RooArgList(ns, nb));
+    RooSimultaneous sim("sim", "", cat);
+    sim.addPdf(pdf, "ch1");
+    RooAddPdf truth("truth_ch1", "", RooArgList(sig, expo), RooArgList(ns, nb));
+    RooSimultaneous simTruth("simTruth", "", cat);
+    simTruth.addPdf(truth, "ch1");
+
+    CascadeMinimizerGlobalConfigs::O().pdfCategories = RooArgList();
+    CascadeMinimizerGlobalConfigs::O().pdfCategories.add(pdfindex);
+    CascadeMinimizerGlobalConfigs::O().parametersOfInterest = RooArgList();
+    CascadeMinimizerGlobalConfigs::O().parametersOfInterest.add(r);
+
+    RooArgSet params(r, nb, slope, p1);
+    RooArgSet prefit; params.snapshot(prefit);
+    RooArgSet observables(x, cat);
+    RooDataSet *data1 = simTruth.generate(observables, RooFit::Extended());
+    RooDataSet *data2 = simTruth.generate(observables, RooFit::Extended());
+
+    RooArgSet noConstraints;
+    cacheutils::CachingSimNLL nll(&sim, data1, &noConstraints);
+    int fails = compare(nll, r, pdfindex, params, prefit, points);
+    // the pruning must start from scratch with the new data
+    nll.setData(*data2);
+    fails += compare(nll, r, pdfindex, params, prefit, points);
+    printf("%s: %d failures\n", fails ? "FAIL" : "OK", fails);
+    return fails ? 1 : 0;
+}
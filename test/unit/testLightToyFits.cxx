@@ -0,0 +1,101 @@
+// Summaries of the fits of toys (FitSummary, as MaxLikelihoodFit --lightToyFits) against the RooFitResult saved by the
+// same minimizer: status, covariance quality, EDM, invalid evaluations, NLL, and values and errors of the tracked
+// parameters, floating and constant.
+// Usage: testLightToyFits.exe [ntoys]  (exit code 1 if any comparison fails)
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include "HiggsAnalysis/CombinedLimit/interface/RooMinimizerOpt.h"
+#include <RooRealVar.h>
+#include <RooCategory.h>
+#include <RooFormulaVar.h>
+#include <RooGaussian.h>
+#include <RooExponential.h>
+#include <RooAddPdf.h>
+#include <RooSimultaneous.h>
+#include <RooDataSet.h>
+#include <RooFitResult.h>
+#include <RooRandom.h>
+#include <RooGlobalFunc.h>
+#include "HiggsAnalysis/CombinedLimit/interface/CachingNLL.h"
+#include "HiggsAnalysis/CombinedLimit/interface/FitSummary.h"
+
+int fails = 0;
+
+void check(const char *what, double light, double full, double tolerance) {
+    bool ok = (std::isnan(light) && std::isnan(full)) || std::abs(light - full) <= tolerance * std::max(1.0, std::abs(full));
+    if (!ok) fails++;
+    printf("  %-24s light % 14.8f  full % 14.8f  %s\n", what, light, full, ok ? "OK" : "FAIL");
+}
+
+int main(int argc, char **argv) {
+    int ntoys = (argc > 1 ? atoi(argv[1]) : 10);
+    RooRandom::randomGenerator()->SetSeed(42);
+
+    RooRealVar x("x", "x", 0, 10);
+    RooCategory cat("cat", "cat");
+    cat.defineType("ch1", 0);
+    RooRealVar r("r", "r", 1, -5, 10), nb("nb", "nb", 200, 0, 1000);
+    RooRealVar mean("mean", "mean", 5, 3, 7), sigma("sigma", "sigma", 0.8), slope("slope", "slope", -0.2, -2, 0);
+    sigma.setConstant(true);
+    RooFormulaVar ns("ns", "20*@0", RooArgList(r));
+    RooGaussian sig("sig", "", x, mean, sigma);
+    RooExponential bkg("bkg", "", x, slope);
+    RooAddPdf pdf("pdf_ch1", "", RooArgList(sig, bkg), RooArgList(ns, nb));
+    RooSimultaneous sim("sim", "", cat);
+    sim.addPdf(pdf, "ch1");
+
+    RooArgSet params(r, nb, mean, slope);
+    RooArgSet prefit; params.snapshot(prefit);
+    // tracked as MaxLikelihoodFit tracks the POIs, plus a constant one
+    FitSummary summary;
+    summary.setParameters(RooArgList(r, mean, sigma));
+
+    RooArgSet observables(x, cat);
+    RooDataSet *toy = sim.generate(observables, RooFit::Extended());
+    RooArgSet noConstraints;
+    cacheutils::CachingSimNLL nll(&sim, toy, &noConstraints);
+    for (int i = 0; i < ntoys; ++i) {
+        if (i > 0) {
+            delete toy;
+            toy = sim.generate(observables, RooFit::Extended());
+            nll.setData(*toy);
+        }
+        params = prefit;
+        RooMinimizerOpt minim(nll);
+        minim.setPrintLevel(-1);
+        minim.setStrategy(1);
+        minim.minimize("Minuit2", "migrad");
+        minim.hesse();
+        summary.fill(minim, nll.getVal());
+        RooFitResult *res = minim.save();
+        printf("toy %d: %d entries\n", i, toy->numEntries());
+        check("status", summary.status(), res->status(), 0);
+        check("covQual", summary.covQual(), res->covQual(), 0);
+        check("edm", summary.edm(), res->edm(), 1e-9);
+        check("numInvalidNLL", summary.numInvalidNLL(), res->numInvalidNLL(), 0);
+        check("minNll", summary.minNll(), res->minNll(), 1e-8);
+        for (unsigned int j = 0; j < summary.size(); ++j) {
+            const char *name = summary.parameter(j).GetName();
+            RooRealVar *fl = (RooRealVar *) res->floatParsFinal().find(name);
+            RooRealVar *cp = (RooRealVar *) res->constPars().find(name);
+            bool ok = (summary.floating(j) ? fl != 0 : cp != 0);
+            if (!ok) fails++;
+            printf("  %-24s %s in the summary and %s in the result  %s\n", name, summary.floating(j) ? "floating" : "constant", fl ? "floating" : (cp ? "constant" : "missing"), ok ? "OK" : "FAIL");
+            RooRealVar *full = (fl ? fl : cp);
+            if (full == 0) continue;
+            check((std::string("value of ") + name).c_str(), summary.value(j), full->getVal(), 1e-9);
+            if (fl) check((std::string("error of ") + name).c_str(), summary.error(j), fl->getError(), 1e-9);
+            if (summary.hasInterval68(j) || summary.hasInterval95(j)) {
+                printf("  %-24s intervals set without a MINOS or crossing run  FAIL\n", name);
+                fails++;
+            }
+        }
+        delete res;
+    }
+    delete toy;
+    printf("%s: %d failures\n", fails ? "FAIL" : "OK", fails);
+    return fails ? 1 : 0;
+}
@@ -0,0 +1,116 @@
+// RooMomentMorphND without horizontal morphing as the mixture of its cached reference pdfs (CachingMomentMorphND,
+// ADDNLL_MOMENTMORPHNLL) against RooFit, for the Linear and NonLinear settings: first the values of the pdf at each
+// entry of a dataset, then the NLL of a model with a morphed signal in each channel, at random values of the parameters.
+// Usage: testMomentMorphNLL.exe [ntries]  (exit code 1 if any comparison fails)
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <TVectorD.h>
+#include <RooRealVar.h>
+#include <RooCategory.h>
+#include <RooFormulaVar.h>
+#include <RooGaussian.h>
+#include <RooExponential.h>
+#include <RooAddPdf.h>
+#include <RooSimultaneous.h>
+#include <RooDataSet.h>
+#include <RooRandom.h>
+#include <RooGlobalFunc.h>
+#include "HiggsAnalysis/CombinedLimit/interface/CachingNLL.h"
+#include "HiggsAnalysis/CombinedLimit/interface/CachingMultiPdf.h"
+#include "HiggsAnalysis/CombinedLimit/interface/RooMomentMorphND.h"
+#include "HiggsAnalysis/CombinedLimit/interface/ProfilingTools.h"
+
+bool agree(double alter, double plain, double tolerance) {
+    return std::abs(alter - plain) <= tolerance * std::max(1.0, std::abs(plain));
+}
+
+int testCachingMorph(RooMomentMorphND &pdf, RooRealVar &m, RooAbsData &data, int ntries) {
+    const RooArgSet *obs = data.get();
+    RooArgSet *vars = pdf.getVariables();
+    if (!cacheutils::CachingMomentMorphND::supports(pdf, *obs)) {
+        printf("%s: not supported by CachingMomentMorphND  FAIL\n", pdf.GetName());
+        return 1;
+    }
+    cacheutils::CachingMomentMorphND cpdf(pdf, *obs);
+    int fails = 0;
+    for (int i = 0; i < ntries; ++i) {
+        // the reference points, then random points of the grid
+        m.setVal(i < 3 ? 1.0 + i : m.getMin() + RooRandom::uniform() * (m.getMax() - m.getMin()));
+        double mval = m.getVal();
+        std::vector<double> plain;
+        for (int j = 0, n = data.numEntries(); j < n; ++j) {
+            *vars = *data.get(j);
+            plain.push_back(pdf.getVal(obs));
+        }
+        const std::vector<Double_t> &alter = cpdf.eval(data);
+        int bad = 0;
+        for (int j = 0, n = data.numEntries(); j < n; ++j) {
+            if (!agree(alter[j], plain[j], 1e-9)) bad++;
+        }
+        if (bad) fails++;
+        printf("%-12s m = %6.4f: %d of %d values differ  %s\n", pdf.GetName(), mval, bad, data.numEntries(), bad ? "FAIL" : "OK");
+    }
+    delete vars;
+    return fails;
+}
+
+int testCachingSimNLL(RooSimultaneous &sim, RooAbsData &data, RooArgList &params, int ntries) {
+    RooAbsReal *nll = sim.createNLL(data, RooFit::Extended(true));
+    RooArgSet noConstraints;
+    cacheutils::CachingSimNLL onll(&sim, &data, &noConstraints);
+    double plain0 = nll->getVal(), alter0 = onll.getVal();
+    int fails = 0;
+    for (int i = 0; i < ntries; ++i) {
+        for (int j = 0, n = params.getSize(); j < n; ++j) ((RooRealVar *) params.at(j))->randomize();
+        double plain = nll->getVal() - plain0, alter = onll.getVal() - alter0;
+        bool ok = agree(alter, plain, 1e-6);
+        if (!ok) fails++;
+        printf("plain % 12.6f  alter % 12.6f   diff % 10.2e  %s\n", plain, alter, alter - plain, ok ? "OK" : "FAIL");
+    }
+    delete nll;
+    return fails;
+}
+
+int main(int argc, char **argv) {
+    int ntries = (argc > 1 ? atoi(argv[1]) : 20);
+    // must be set before the first NLL is made, as with --X-rtd
+    runtimedef::set("ADDNLL_MOMENTMORPHNLL", 1);
+    RooRandom::randomGenerator()->SetSeed(42);
+
+    RooRealVar x("x", "x", 0, 10);
+    RooRealVar m("m", "m", 1.5, 1, 3);
+    RooRealVar mean1("mean1", "", 4), mean2("mean2", "", 5), mean3("mean3", "", 6);
+    RooRealVar sigma1("sigma1", "", 0.8), sigma2("sigma2", "", 1.0), sigma3("sigma3", "", 1.2);
+    RooGaussian ref1("ref1", "", x, mean1, sigma1), ref2("ref2", "", x, mean2, sigma2), ref3("ref3", "", x, mean3, sigma3);
+    TVectorD mrefs(3); mrefs[0] = 1; mrefs[1] = 2; mrefs[2] = 3;
+    RooMomentMorphND morphLin("morph_lin", "", m, RooArgList(x), RooArgList(ref1, ref2, ref3), mrefs, RooMomentMorphND::Linear);
+    RooMomentMorphND morphNonLin("morph_nonlin", "", m, RooArgList(x), RooArgList(ref1, ref2, ref3), mrefs, RooMomentMorphND::NonLinear);
+    morphLin.useHorizontalMorphing(false);
+    morphNonLin.useHorizontalMorphing(false);
+
+    RooCategory cat("cat", "cat");
+    cat.defineType("lin", 0);
+    cat.defineType("nonlin", 1);
+    RooRealVar r("r", "r", 1, 0, 5), slope("slope", "slope", -0.2, -1, 0), nb("nb", "nb", 300, 100, 500);
+    RooFormulaVar ns("ns", "50*@0", RooArgList(r));
+    RooExponential bkg("bkg", "", x, slope);
+    RooAddPdf pdfLin("pdf_lin", "", RooArgList(morphLin, bkg), RooArgList(ns, nb));
+    RooAddPdf pdfNonLin("pdf_nonlin", "", RooArgList(morphNonLin, bkg), RooArgList(ns, nb));
+    RooSimultaneous sim("sim", "", cat);
+    sim.addPdf(pdfLin, "lin");
+    sim.addPdf(pdfNonLin, "nonlin");
+
+    RooDataSet *points = morphLin.generate(RooArgSet(x), 200);
+    RooDataSet *data = sim.generate(RooArgSet(x, cat), RooFit::Extended());
+
+    int fails = 0;
+    fails += testCachingMorph(morphLin, m, *points, ntries);
+    fails += testCachingMorph(morphNonLin, m, *points, ntries);
+    RooArgList params(m, r, slope, nb);
+    fails += testCachingSimNLL(sim, *data, params, ntries);
+    printf("%s: %d failures\n", fails ? "FAIL" : "OK", fails);
+    return fails ? 1 : 0;
+}
@@ -1,4 +1,4 @@
-import os, os.path, re, json, stat
+import os, os.path, re, json, stat, glob
 import ROOT
 from math import *
 
@@ -13,6 +13,9 @@ class Test:
         return "%s/%s.log" % (dir,self._name)
     def jsonName(self,dir):
         return "%s/%s.json" % (dir,self._name)
+    def perfName(self,tag=None):
+        """File (relative to the test directory) with the wall time and peak memory of the combine commands of the test"""
+        return "%s.%s.perf" % (self._name,tag) if tag != None else "%s.perf" % self._name
     def numCPUs(self):
         return 1
     def forceSingleCPU(self):
@@ -32,6 +35,9 @@ class Test:
     def readOutputBase(self,dir):
         """Calls readOutput to read the output, saves it as JSON file"""
         output = self.readOutput(dir)
+        if type(output) == dict and output['status'] != 'aborted':
+            perf = _readPerf(["%s/%s" % (dir,self.perfName())] + glob.glob("%s/%s" % (dir,self.perfName("*"))))
+            if perf: output['perf'] = perf
         if output != None:
             fout = open(self.jsonName(dir), "w");
             fout.write(json.dumps({self._name : output}, sort_keys=True, indent=4))
@@ -50,8 +56,38 @@ class Test:
                    "     eval $(scram runtime -sh);     \n"
                    "fi\n" % (E['HOSTNAME'], E['SCRAM_ARCH']));
         file.write(": > %s.log\n" % self._name);
+        file.write("rm -f %s %s\n" % (self.perfName(), self.perfName("*")));
         
 
+def hardwareClass():
+    """Model of the CPU, to keep apart the timing baselines of different hardware"""
+    if os.access("/proc/cpuinfo", os.R_OK):
+        for line in open("/proc/cpuinfo"):
+            if line.startswith("model name"): return " ".join(line.split(":",1)[1].split())
+    import platform
+    return platform.processor() or platform.machine()
+
+def _timed(perfFile):
+    """Prefix for a command in the scripts, to append its wall time (s) and peak resident memory (kB) to perfFile (if GNU time is there)"""
+    if not os.access("/usr/bin/time", os.X_OK): return ""
+    return "/usr/bin/time -f '%%e %%M' -a -o %s " % perfFile
+
+def _readPerf(fnames):
+    """Sum of the wall times (s) and maximum of the peak memory (MB) of the commands recorded in the files, or None"""
+    wall, maxrss, found = 0., 0., False
+    for fname in fnames:
+        if not os.access(fname, os.R_OK): continue
+        for line in open(fname):
+            items = line.split()
+            if len(items) != 2: continue   # e.g. "Command exited with non-zero status"
+            try:
+                (w, m) = float(items[0]), float(items[1])
+            except ValueError:
+                continue
+            wall += w; maxrss = max(maxrss, m/1024.); found = True
+    if not found: return None
+    return { 'wall':wall, 'maxrss':maxrss }
+
 def _readRootFile(fname):
         if os.access(fname, os.R_OK) == False: return { 'status':'aborted', 'comment':'rootfile does not exist' }
         if os.stat(fname).st_size < 1000:   return { 'status':'aborted', 'comment':'rootfile is smaller than 1kb' }
@@ -146,7 +182,7 @@ class SingleDatacardTest(Test):
         if os.access(datacard_full, os.R_OK) == False: 
             raise RuntimeError, "Datacard HiggsAnalysis/CombinedLimit/data/benchmarks/%s is not accessible" % self._datacard
         file.write("echo    %s -n %s -M %s %s -m %s > %s.log\n" % (datacard_full, self._name, self._method, self._options, self._mass, self._name));
-        file.write("combine %s -n %s -M %s %s -m %s 2>&1 | cat >> %s.log\n" % (datacard_full, self._name, self._method, self._options, self._mass, self._name));
+        file.write("%scombine %s -n %s -M %s %s -m %s 2>&1 | cat >> %s.log\n" % (_timed(self.perfName()), datacard_full, self._name, self._method, self._options, self._mass, self._name));
     def readOutput(self,dir):
         fname = "%s/higgsCombine%s.%s.mH%s.root" % (dir, self._name, self._method, self._mass)
         if "Median" in self._name  and "Hybrid" in self._method:
@@ -183,7 +219,7 @@ class MultiDatacardTest(Test):
             if os.access(datacard_full, os.R_OK) == False: 
                 raise RuntimeError, "Datacard HiggsAnalysis/CombinedLimit/data/benchmarks/%s is not accessible" % dc 
             file.write("echo    %s -n %s -M %s %s -m %s >  %s.%s.log     \n" % (datacard_full, self._name, self._method, self._options, mass, self._name, mass));
-            file.write("combine %s -n %s -M %s %s -m %s 2>&1 | cat >> %s.%s.log\n" % (datacard_full, self._name, self._method, self._options, mass, self._name, mass));
+            file.write("%scombine %s -n %s -M %s %s -m %s 2>&1 | cat >> %s.%s.log\n" % (_timed(self.perfName(mass)), datacard_full, self._name, self._method, self._options, mass, self._name, mass));
     def readOutput(self,dir):
         ret = { 'results':{}}
         for dc, mass in self._datacards:
@@ -229,7 +265,7 @@ class WorkspaceWithExpectedTest(MultiDatacardTest):
         file.write("combineCards.py -S %s &> %s\n" % (" ".join(dc_list), self._cmb_card))
         file.write("text2workspace.py %s -b %s -o %s -m %s\n" % (self._ws_options, self._cmb_card, self._cmb_wsp, self._mass))
         file.write("echo    %s -n %s -M %s %s -m %s >  %s.%s.log     \n" % (self._cmb_wsp, self._name, self._method, self._options, self._mass, self._name, self._mass));
-        file.write("combine %s -n %s -M %s %s -m %s 2>&1 | cat >> %s.%s.log\n" % (self._cmb_wsp, self._name, self._method, self._options, self._mass, self._name, self._mass));
+        file.write("%scombine %s -n %s -M %s %s -m %s 2>&1 | cat >> %s.%s.log\n" % (_timed(self.perfName(self._mass)), self._cmb_wsp, self._name, self._method, self._options, self._mass, self._name, self._mass));
     def readOutput(self,dir):
         if ("MultiDimFit" in self._method):
           out = _readRootFileWithPOI("%s/higgsCombine%s.%s.mH%s.root" % (dir, self._name, self._method, self._mass), self._poi)
@@ -275,7 +311,7 @@ class MultiOptionTest(Test):
             raise RuntimeError, "Datacard HiggsAnalysis/CombinedLimit/data/benchmarks/%s is not accessible" % self._datacard
         for on, ov, mass in self._options:
             file.write("echo    %s -n %s -M %s %s -m %s >  %s.%s.log     \n" % (datacard_full, self._name, self._method, ov, mass, self._name, mass));
-            file.write("combine %s -n %s -M %s %s -m %s >> %s.%s.log 2>&1\n" % (datacard_full, self._name, self._method, ov, mass, self._name, mass));
+            file.write("%scombine %s -n %s -M %s %s -m %s >> %s.%s.log 2>&1\n" % (_timed(self.perfName(mass)), datacard_full, self._name, self._method, ov, mass, self._name, mass));
     def readOutput(self,dir):
         ret = { 'results':{}}
         for on, ov, mass in self._options:
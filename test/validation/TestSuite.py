@@ -83,6 +83,53 @@ class TestSuite:
         if format == "text": textReport(obj)
         if format == "twiki": twikiReport(obj)
         else: RuntimeError, "Unknown format %s" % format
+    def _readReport(self):
+        if os.access("%s/report.json" % self._dir, os.R_OK) == False:
+            raise RuntimeError, "%s/report.json not found. please run 'report' before." % self._dir 
+        return json.loads(''.join([f for f in open("%s/report.json" % self._dir)]))
+    def _readBaselines(self,baseline):
+        if not os.access(baseline, os.R_OK): return {}
+        return json.loads(''.join([f for f in open(baseline)]))
+    def recordPerf(self,baseline,hwclass):
+        """Store the wall time and peak memory of the tests in report.json as the baselines for this hardware class"""
+        obj  = self._readReport()
+        allb = self._readBaselines(baseline)
+        mine = allb.setdefault(hwclass, {})
+        n = 0
+        for tn,tv in obj.items():
+            if tv == True or not tv.has_key('perf'): continue
+            mine[tn] = tv['perf']; n += 1
+        fout = open(baseline, "w")
+        fout.write(json.dumps(allb, sort_keys=True, indent=4))
+        fout.close()
+        print "Recorded the baselines of %d tests for '%s' in %s" % (n, hwclass, baseline)
+    def checkPerf(self,baseline,hwclass,tolerance,minTime,minMemory):
+        """Compare the wall time and peak memory of the tests in report.json with the baselines for this hardware class.
+           A test regresses if it got slower or bigger by more than the relative tolerance, ignoring the times below 
+           minTime (s) and the memory below minMemory (MB) which are dominated by noise. Returns the number of regressions"""
+        obj  = self._readReport()
+        allb = self._readBaselines(baseline)
+        if not allb.has_key(hwclass):
+            print "No baselines for '%s' in %s (available: %s); record them with 'perf-record'." % (hwclass, baseline, ", ".join(sorted(allb.keys())))
+            return 0
+        ref = allb[hwclass]
+        tlength = max([10]+[len(t) for t in obj.keys() if obj[t] != True])
+        tfmt = "%-"+str(tlength)+"s"
+        print (tfmt+"  %-9s  %21s  %21s") % ("test", "status", "wall time (s)", "peak memory (MB)")
+        print (tfmt+"  %-9s  %21s  %21s") % ("-"*tlength, "-"*9, "-"*21, "-"*21)
+        regressions = 0
+        for tn,tv in sorted(obj.items()):
+            if tv == True or not tv.has_key('perf') or not ref.has_key(tn): continue
+            (cur, old) = tv['perf'], ref[tn]
+            status = 'ok'
+            if cur['wall'] > max(minTime, old['wall']*(1+tolerance)): status = 'w time'
+            if cur['maxrss'] > max(minMemory, old['maxrss']*(1+tolerance)): status = 'w memory' if status == 'ok' else 'w both'
+            if status != 'ok': regressions += 1
+            print (tfmt+"  %-9s  %9.1f / %9.1f  %9.1f / %9.1f") % (tn, status, cur['wall'], old['wall'], cur['maxrss'], old['maxrss'])
+        missing = [tn for tn,tv in obj.items() if tv != True and tv.has_key('perf') and not ref.has_key(tn)]
+        if missing: print "No baseline for %d tests: %s" % (len(missing), ", ".join(sorted(missing)))
+        print "%d regressions beyond %.0f%% of the baselines for '%s'" % (regressions, 100*tolerance, hwclass)
+        return regressions
     def _selTests(self,method="*",length="full"):
         jobs = []
         for m,l,t in self._tests: 
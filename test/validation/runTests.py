@@ -2,7 +2,7 @@
 import sys
 
 from optparse import OptionParser
-parser = OptionParser(usage="usage: %prog [options] command \ncommand = list, create, runLocally, runBatch, report")
+parser = OptionParser(usage="usage: %prog [options] command \ncommand = list, create, runLocally, runBatch, report, perf-record, perf-check")
 parser.add_option("-M", "--method", dest="method", help="method to test", default="*", metavar="METHOD")
 parser.add_option("-n", "--name",   dest="name",  help="name of the test directory to create; defaults to the name of the test suite", default=None, metavar="TEST")
 parser.add_option("-t", "--test",   dest="suite", help="which test suite: fast, full", default="fast", metavar="TEST")
@@ -13,6 +13,11 @@ parser.add_option("-f", "--format", dest="format", help="format for print output
 parser.add_option("-j", "--threads", dest="threads", help="run in parallel on N threads", type="int", default=0)
 parser.add_option("-q", "--queue",     dest="queue",  help="queue to run in batch on", default="8nh")
 parser.add_option("-1", "--nofork",     dest="nofork",  default=False, action="store_true", help="force running on a single CPU")
+parser.add_option("--perf-baseline",  dest="perfBaseline",  help="file with the timing and memory baselines (for perf-record and perf-check)", default="perf_reference.json")
+parser.add_option("--perf-class",     dest="perfClass",     help="hardware class of the baselines; defaults to the model of the CPU", default=None)
+parser.add_option("--perf-tolerance", dest="perfTolerance", help="relative increase of time or memory flagged by perf-check", type="float", default=0.25)
+parser.add_option("--perf-min-time",  dest="perfMinTime",   help="times below this (s) are not flagged by perf-check", type="float", default=5.)
+parser.add_option("--perf-min-memory",dest="perfMinMemory", help="peak memory below this (MB) is not flagged by perf-check", type="float", default=100.)
 (options, args) = parser.parse_args()
 if len(args) == 0:
     parser.print_usage()
@@ -59,4 +64,9 @@ for cmd in args:
         thisSuite.printIt(options.format,reference=options.reference)
     elif cmd == "print": 
         thisSuite.printIt(options.format,reference=options.reference)
+    elif cmd == "perf-record": 
+        thisSuite.recordPerf(options.perfBaseline, options.perfClass or hardwareClass())
+    elif cmd == "perf-check": 
+        if thisSuite.checkPerf(options.perfBaseline, options.perfClass or hardwareClass(), options.perfTolerance, options.perfMinTime, options.perfMinMemory):
+            sys.exit(1)
     else: RuntimeError, "Unknown command %s" % cmd